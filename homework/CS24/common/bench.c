@@ -0,0 +1,399 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+#include "bench.h"
+
+
+/*
+   The common benchmark harness.  bench_run() calls a function some number
+   of times untimed, to warm up the caches and branch predictors, and then
+   times each of at least min_reps calls until min_seconds have passed.  The
+   times of the calls are sorted for their percentiles, which say more than
+   an average when some calls are slowed down by interrupts or page faults.
+
+   Each call is timed with the time-stamp counter where there is one, which
+   costs a few nanoseconds to read, against a microsecond or so for some
+   clock_gettime() implementations; its rate is measured against
+   clock_gettime() once.  On Linux, the cycles, cache misses and branch
+   misses of the timed calls are counted too, if perf_event_paranoid lets
+   the process count its own events.  The counters are inherited, so they
+   also count the child processes of benchrun.
+*/
+
+
+static const char *counter_names[BENCH_NUM_COUNTERS] = {
+    "cycles", "cache_misses", "branch_misses"
+};
+
+
+/* Returns the time of the monotonic clock, in nanoseconds. */
+uint64_t bench_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/* Returns the time-stamp counter ticks per nanosecond, measuring it the
+ * first time.
+ */
+static double tsc_per_ns(void) {
+    static double rate = 0;
+#if HAVE_TSC
+    uint64_t start_ns, start_tsc, ns;
+
+    if (rate == 0) {
+        start_ns = bench_now_ns();
+        start_tsc = __rdtsc();
+        do {
+            ns = bench_now_ns() - start_ns;
+        } while (ns < 20000000);
+        rate = (double) (__rdtsc() - start_tsc) / ns;
+    }
+#endif
+    return rate;
+}
+
+
+/* Returns the current time, in TSC ticks or nanoseconds. */
+static inline uint64_t read_timer(int use_tsc) {
+#if HAVE_TSC
+    if (use_tsc)
+        return __rdtsc();
+#endif
+    (void) use_tsc;
+    return bench_now_ns();
+}
+
+
+/* Returns the value of an environment variable as a number, or dflt if it
+ * isn't set.
+ */
+static double env_number(const char *name, double dflt) {
+    const char *value = getenv(name);
+
+    return (value && *value) ? atof(value) : dflt;
+}
+
+
+/* Fills in the default configuration, and whatever the environment says to
+ * change about it.
+ */
+void bench_default_config(bench_config *config) {
+    const char *format;
+
+    assert(config != NULL);
+
+    config->warmup = (int) env_number("BENCH_WARMUP", 1);
+    config->min_reps = (int) env_number("BENCH_REPS", 5);
+    config->max_reps = 100000;
+    config->min_seconds = env_number("BENCH_SECONDS", 0.2);
+    config->use_tsc = HAVE_TSC && env_number("BENCH_TSC", 1) != 0;
+    config->use_counters = env_number("BENCH_COUNTERS", 1) != 0;
+
+    config->format = BENCH_TEXT;
+    format = getenv("BENCH_FORMAT");
+    if (format && strcmp(format, "csv") == 0)
+        config->format = BENCH_CSV;
+    else if (format && strcmp(format, "json") == 0)
+        config->format = BENCH_JSON;
+
+    config->output = getenv("BENCH_OUTPUT");
+    if (config->output && *config->output == '\0')
+        config->output = NULL;
+
+    if (config->min_reps < 1)
+        config->min_reps = 1;
+    if (config->max_reps < config->min_reps)
+        config->max_reps = config->min_reps;
+}
+
+
+#ifdef __linux__
+
+static const unsigned long long counter_events[BENCH_NUM_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+
+/* Opens the counters, disabled, into fds.  Returns 0 if any can't be
+ * opened, with none left open.
+ */
+static int open_counters(int *fds) {
+    struct perf_event_attr attr;
+    int i, j;
+
+    for (i = 0; i < BENCH_NUM_COUNTERS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = counter_events[i];
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fds[i] < 0) {
+            for (j = 0; j < i; j++)
+                close(fds[j]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+static void start_counters(const int *fds) {
+    int i;
+
+    for (i = 0; i < BENCH_NUM_COUNTERS; i++) {
+        ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+
+/* Stops and closes the counters, storing their counts per call. */
+static void stop_counters(const int *fds, long reps, double *counts) {
+    unsigned long long value;
+    int i;
+
+    for (i = 0; i < BENCH_NUM_COUNTERS; i++)
+        ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (i = 0; i < BENCH_NUM_COUNTERS; i++) {
+        if (read(fds[i], &value, sizeof(value)) != sizeof(value))
+            value = 0;
+        counts[i] = (double) value / reps;
+        close(fds[i]);
+    }
+}
+
+#else
+
+static int open_counters(int *fds) {
+    (void) fds;
+    return 0;
+}
+
+static void start_counters(const int *fds) {
+    (void) fds;
+}
+
+static void stop_counters(const int *fds, long reps, double *counts) {
+    (void) fds;
+    (void) reps;
+    (void) counts;
+}
+
+#endif /* __linux__ */
+
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+/* Returns the p'th percentile of n sorted samples, by nearest rank. */
+static double percentile(const double *sorted, long n, double p) {
+    long rank = (long) (p * n + 0.999999);
+
+    if (rank < 1)
+        rank = 1;
+    if (rank > n)
+        rank = n;
+    return sorted[rank - 1];
+}
+
+
+/* Times fn(arg) as the configuration says, and fills in *result, named
+ * name, with each call doing ops operations.  Returns 0, or -1 if there
+ * isn't memory for the samples.
+ */
+int bench_run(const char *name, bench_fn fn, void *arg, double ops,
+              const bench_config *config, bench_result *result) {
+    int fds[BENCH_NUM_COUNTERS];
+    double *samples, scale, total = 0;
+    uint64_t start_ns, t0, t1, min_ns;
+    long reps = 0;
+    int i;
+
+    assert(name != NULL && fn != NULL && config != NULL && result != NULL);
+
+    samples = malloc(config->max_reps * sizeof(double));
+    if (samples == NULL)
+        return -1;
+
+    memset(result, 0, sizeof(bench_result));
+    strncpy(result->name, name, sizeof(result->name) - 1);
+    result->ops = ops > 0 ? ops : 1;
+
+    scale = config->use_tsc ? 1 / tsc_per_ns() : 1;
+
+    for (i = 0; i < config->warmup; i++)
+        fn(arg);
+
+    result->have_counters = config->use_counters && open_counters(fds);
+    if (result->have_counters)
+        start_counters(fds);
+
+    min_ns = (uint64_t) (config->min_seconds * 1e9);
+    start_ns = bench_now_ns();
+    while (reps < config->max_reps &&
+           (reps < config->min_reps || bench_now_ns() - start_ns < min_ns)) {
+        t0 = read_timer(config->use_tsc);
+        fn(arg);
+        t1 = read_timer(config->use_tsc);
+        samples[reps++] = (t1 - t0) * scale;
+    }
+
+    if (result->have_counters)
+        stop_counters(fds, reps, result->counters);
+
+    for (i = 0; i < reps; i++)
+        total += samples[i];
+    qsort(samples, reps, sizeof(double), compare_doubles);
+
+    result->reps = reps;
+    result->min_ns = samples[0];
+    result->p50_ns = percentile(samples, reps, 0.50);
+    result->p90_ns = percentile(samples, reps, 0.90);
+    result->p99_ns = percentile(samples, reps, 0.99);
+    result->max_ns = samples[reps - 1];
+    result->mean_ns = total / reps;
+    result->ns_per_op = result->p50_ns / result->ops;
+
+    free(samples);
+    return 0;
+}
+
+
+/* Writes a value for a CSV or JSON field:  a counter's blank or null if it
+ * wasn't counted.
+ */
+static void print_counter(FILE *out, const bench_result *result, int i,
+                          bench_format format) {
+    if (result->have_counters)
+        fprintf(out, "%.0f", result->counters[i]);
+    else if (format == BENCH_JSON)
+        fprintf(out, "null");
+}
+
+
+/* Writes one result in the given format, after the column headings if
+ * header is nonzero and the format has them.
+ */
+void bench_print(FILE *out, const bench_result *result,
+                 bench_format format, int header) {
+    const char *p;
+    int i;
+
+    switch (format) {
+    case BENCH_CSV:
+        if (header) {
+            fprintf(out, "name,reps,ops,min_ns,p50_ns,p90_ns,p99_ns,max_ns,"
+                         "mean_ns,ns_per_op");
+            for (i = 0; i < BENCH_NUM_COUNTERS; i++)
+                fprintf(out, ",%s", counter_names[i]);
+            fprintf(out, "\n");
+        }
+        fprintf(out, "%s,%ld,%.0f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.3f",
+                result->name, result->reps, result->ops, result->min_ns,
+                result->p50_ns, result->p90_ns, result->p99_ns,
+                result->max_ns, result->mean_ns, result->ns_per_op);
+        for (i = 0; i < BENCH_NUM_COUNTERS; i++) {
+            fprintf(out, ",");
+            print_counter(out, result, i, format);
+        }
+        fprintf(out, "\n");
+        break;
+
+    case BENCH_JSON:
+        fprintf(out, "{\"name\": \"");
+        for (p = result->name; *p; p++) {
+            if (*p == '"' || *p == '\\')
+                fputc('\\', out);
+            fputc(*p, out);
+        }
+        fprintf(out, "\", \"reps\": %ld, \"ops\": %.0f, \"min_ns\": %.1f, "
+                     "\"p50_ns\": %.1f, \"p90_ns\": %.1f, \"p99_ns\": %.1f, "
+                     "\"max_ns\": %.1f, \"mean_ns\": %.1f, "
+                     "\"ns_per_op\": %.3f",
+                result->reps, result->ops, result->min_ns, result->p50_ns,
+                result->p90_ns, result->p99_ns, result->max_ns,
+                result->mean_ns, result->ns_per_op);
+        for (i = 0; i < BENCH_NUM_COUNTERS; i++) {
+            fprintf(out, ", \"%s\": ", counter_names[i]);
+            print_counter(out, result, i, format);
+        }
+        fprintf(out, "}\n");
+        break;
+
+    default:
+        if (header) {
+            fprintf(out, "%-32s %7s %12s %12s %12s %12s %12s\n", "name",
+                    "reps", "min ns", "p50 ns", "p90 ns", "p99 ns",
+                    "ns/op");
+        }
+        fprintf(out, "%-32s %7ld %12.1f %12.1f %12.1f %12.1f %12.3f\n",
+                result->name, result->reps, result->min_ns, result->p50_ns,
+                result->p90_ns, result->p99_ns, result->ns_per_op);
+        if (result->have_counters) {
+            fprintf(out, "%-32s %.0f cycles, %.0f cache misses, "
+                         "%.0f branch misses per call\n", "",
+                    result->counters[BENCH_CYCLES],
+                    result->counters[BENCH_CACHE_MISSES],
+                    result->counters[BENCH_BRANCH_MISSES]);
+        }
+    }
+}
+
+
+/* Writes one result where the configuration says:  appended to its output
+ * file, with the headings if the file is new, or to stdout, with the
+ * headings the first time.
+ */
+void bench_emit(const bench_result *result, const bench_config *config) {
+    static int printed_header = 0;
+    FILE *out;
+
+    if (config->output == NULL) {
+        bench_print(stdout, result, config->format, !printed_header);
+        printed_header = 1;
+        fflush(stdout);
+        return;
+    }
+
+    out = fopen(config->output, "a");
+    if (out == NULL) {
+        perror(config->output);
+        return;
+    }
+    fseek(out, 0, SEEK_END);
+    bench_print(out, result, config->format, ftell(out) == 0);
+    fclose(out);
+}
@@ -0,0 +1,117 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+/* The ways that bench_emit() can write results. */
+typedef enum bench_format {
+    BENCH_TEXT,
+    BENCH_CSV,
+    BENCH_JSON      /* One JSON object per line. */
+} bench_format;
+
+
+/* How bench_run() times something.  bench_default_config() fills this in,
+ * with anything that the environment overrides:
+ *
+ *     BENCH_WARMUP    warmup
+ *     BENCH_REPS      min_reps
+ *     BENCH_SECONDS   min_seconds
+ *     BENCH_TSC       use_tsc (0 or 1)
+ *     BENCH_COUNTERS  use_counters (0 or 1)
+ *     BENCH_FORMAT    format (text, csv or json)
+ *     BENCH_OUTPUT    output
+ */
+typedef struct bench_config {
+
+    /* The number of untimed calls before the timed ones. */
+    int warmup;
+
+    /* The timed calls go on until there have been at least min_reps of them
+     * and min_seconds have passed, but stop at max_reps.
+     */
+    int min_reps;
+
+    int max_reps;
+
+    double min_seconds;
+
+    /* Nonzero to time each call with the time-stamp counter rather than
+     * clock_gettime(), where there is one.
+     */
+    int use_tsc;
+
+    /* Nonzero to count cycles, cache misses and branch misses with
+     * perf_event, where the OS allows it.
+     */
+    int use_counters;
+
+    bench_format format;
+
+    /* The file that bench_emit() appends to, or NULL for stdout. */
+    const char *output;
+
+} bench_config;
+
+
+/* The hardware events that bench_run() can count. */
+typedef enum bench_counter {
+    BENCH_CYCLES,
+    BENCH_CACHE_MISSES,
+    BENCH_BRANCH_MISSES,
+    BENCH_NUM_COUNTERS
+} bench_counter;
+
+
+/* The results of bench_run().  Times are of one call, in nanoseconds, and
+ * ops is how many operations a call does, for ns_per_op.
+ */
+typedef struct bench_result {
+
+    char name[80];
+
+    long reps;
+
+    double ops;
+
+    double min_ns;
+
+    double p50_ns;
+
+    double p90_ns;
+
+    double p99_ns;
+
+    double max_ns;
+
+    double mean_ns;
+
+    double ns_per_op;
+
+    /* The average count of each event per call, if have_counters. */
+    int have_counters;
+
+    double counters[BENCH_NUM_COUNTERS];
+
+} bench_result;
+
+
+/* What bench_run() times:  one call does ops operations on arg. */
+typedef void (*bench_fn)(void *arg);
+
+
+void bench_default_config(bench_config *config);
+
+int bench_run(const char *name, bench_fn fn, void *arg, double ops,
+              const bench_config *config, bench_result *result);
+
+void bench_emit(const bench_result *result, const bench_config *config);
+
+void bench_print(FILE *out, const bench_result *result,
+                 bench_format format, int header);
+
+uint64_t bench_now_ns(void);
+
+#endif /* BENCH_H */
@@ -0,0 +1,16 @@
+# The common benchmark harness, for the "bench" targets of the modules.  A
+# module's Makefile sets BENCH_DIR to the path of this directory and
+# includes this file at its end, after its own "bench" target, whose recipe
+# times the module's programs with
+#
+#     $(BENCHRUN) -n module/name -- ./program args...
+#
+# Each prints, or appends to $BENCH_OUTPUT, a line of results in the format
+# that $BENCH_FORMAT says; see bench.h for the other BENCH_* settings.
+
+BENCHRUN = $(BENCH_DIR)/benchrun
+
+bench: $(BENCHRUN)
+
+$(BENCHRUN): $(BENCH_DIR)/benchrun.c $(BENCH_DIR)/bench.c $(BENCH_DIR)/bench.h
+	$(MAKE) -C $(BENCH_DIR) benchrun
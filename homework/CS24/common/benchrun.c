@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+
+/*
+   Times a command with the common benchmark harness, so that every module's
+   programs can be timed the same way by its "make bench":
+
+       benchrun [-n name] [-i input-file] [-o ops] [-v] -- command args...
+
+   Each run's standard input is the input file, or /dev/null, and its
+   standard output and error are thrown away unless -v is given.  A run that
+   can't be started, or that is killed by a signal, stops the benchmark;
+   exit statuses are otherwise ignored, since some of the programs exit
+   nonzero after running normally.
+*/
+
+
+/* The command that each call of run_command() runs. */
+typedef struct command {
+    char **argv;
+    const char *input;
+    int verbose;
+} command;
+
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-n name] [-i input-file] [-o ops] [-v] "
+                    "-- command args...\n", prog);
+    exit(1);
+}
+
+
+static void run_command(void *arg) {
+    command *cmd = arg;
+    int status, fd;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+
+    if (pid == 0) {
+        fd = open(cmd->input ? cmd->input : "/dev/null", O_RDONLY);
+        if (fd < 0) {
+            perror(cmd->input);
+            _exit(127);
+        }
+        dup2(fd, 0);
+        close(fd);
+
+        if (!cmd->verbose) {
+            fd = open("/dev/null", O_WRONLY);
+            dup2(fd, 1);
+            dup2(fd, 2);
+            close(fd);
+        }
+
+        execvp(cmd->argv[0], cmd->argv);
+        _exit(127);
+    }
+
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) == 127) {
+        fprintf(stderr, "benchrun:  %s failed to run\n", cmd->argv[0]);
+        exit(1);
+    }
+}
+
+
+int main(int argc, char **argv) {
+    bench_config config;
+    bench_result result;
+    command cmd;
+    const char *name = NULL;
+    double ops = 1;
+    int opt;
+
+    cmd.input = NULL;
+    cmd.verbose = 0;
+
+    while ((opt = getopt(argc, argv, "n:i:o:v")) != -1) {
+        switch (opt) {
+        case 'n':
+            name = optarg;
+            break;
+        case 'i':
+            cmd.input = optarg;
+            break;
+        case 'o':
+            ops = atof(optarg);
+            break;
+        case 'v':
+            cmd.verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind >= argc)
+        usage(argv[0]);
+
+    cmd.argv = argv + optind;
+    if (cmd.input && access(cmd.input, R_OK) != 0) {
+        perror(cmd.input);
+        return 1;
+    }
+    if (name == NULL)
+        name = cmd.argv[0];
+
+    bench_default_config(&config);
+    if (bench_run(name, run_command, &cmd, ops, &config, &result) != 0) {
+        fprintf(stderr, "benchrun:  out of memory\n");
+        return 1;
+    }
+    bench_emit(&result, &config);
+
+    return 0;
+}
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "pool.h"
+
+
+/*
+   The pools that the modules allocate their small fixed-size records from,
+   instead of calling malloc() and free() for each one.  Handing out an
+   object is a pointer bump or a pop from the free list, and the objects
+   of a structure are packed together in a few slabs rather than scattered
+   around the heap between everything else.
+
+   Objects are aligned for a pointer or a double, since that is what the
+   records hold; nothing that needs more alignment should come from a pool.
+*/
+
+
+/* The alignment of every object, which also keeps each slab's objects aligned
+ * after its header.
+ */
+#define POOL_ALIGN  (sizeof(double) > sizeof(void *) ? \
+                     sizeof(double) : sizeof(void *))
+
+/* The header of a slab, rounded up to the alignment of the objects. */
+#define SLAB_HEADER \
+    ((sizeof(pool_slab) + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1))
+
+
+/* Initializes a pool with no slabs, for objects of the specified size.  The
+ * name is kept, not copied, so it should be a string constant.
+ */
+void pool_init(pool *p, const char *name, size_t object_size) {
+    assert(p != NULL);
+
+    /* Every object must be able to hold the free-list pointer. */
+    if (object_size < sizeof(void *))
+        object_size = sizeof(void *);
+
+    p->name = name;
+    p->object_size = (object_size + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1);
+    p->slabs = NULL;
+    p->spare_slabs = NULL;
+    p->next_object = NULL;
+    p->objects_left = 0;
+    p->slab_objects = POOL_START_OBJECTS;
+    p->free_objects = NULL;
+    memset(&p->stats, 0, sizeof(pool_stats));
+}
+
+
+/* Starts handing out the objects of another slab:  one that pool_reset()
+ * kept, if there is one, or else a new one.  Returns 0 if there is no memory
+ * for a new slab.
+ */
+static int add_slab(pool *p) {
+    pool_slab *slab;
+
+    if (p->spare_slabs != NULL) {
+        slab = p->spare_slabs;
+        p->spare_slabs = slab->next;
+    }
+    else {
+        slab = malloc(SLAB_HEADER + p->slab_objects * p->object_size);
+        if (slab == NULL)
+            return 0;
+
+        slab->num_objects = p->slab_objects;
+        p->stats.slabs++;
+        p->stats.slab_bytes += SLAB_HEADER + p->slab_objects * p->object_size;
+
+        if (p->slab_objects < POOL_MAX_OBJECTS)
+            p->slab_objects *= 2;
+    }
+
+    slab->next = p->slabs;
+    p->slabs = slab;
+    p->next_object = (char *) slab + SLAB_HEADER;
+    p->objects_left = slab->num_objects;
+    return 1;
+}
+
+
+/* Returns a zeroed object from the pool, or NULL if there is no memory for
+ * it.  Released objects are reused first; otherwise the next object of the
+ * newest slab is handed out, starting another slab if that one is used up.
+ */
+void * pool_alloc(pool *p) {
+    void *object;
+
+    if (p->free_objects != NULL) {
+        object = p->free_objects;
+        p->free_objects = *(void **) object;
+    }
+    else {
+        if (p->objects_left == 0 && !add_slab(p))
+            return NULL;
+
+        object = p->next_object;
+        p->next_object += p->object_size;
+        p->objects_left--;
+    }
+
+    p->stats.allocs++;
+    if (++p->stats.live > p->stats.peak_live)
+        p->stats.peak_live = p->stats.live;
+
+    memset(object, 0, p->object_size);
+    return object;
+}
+
+
+/* Returns an object to the pool, for pool_alloc() to hand out again. */
+void pool_release(pool *p, void *object) {
+    assert(object != NULL);
+
+#ifdef DEBUG_ZERO
+    /* Clear out what we are about to release, to expose issues quickly. */
+    memset(object, 0, p->object_size);
+#endif
+    *(void **) object = p->free_objects;
+    p->free_objects = object;
+
+    p->stats.releases++;
+    p->stats.live--;
+}
+
+
+/* Releases every object that came from the pool at once, keeping the slabs
+ * to hand the next objects out from.
+ */
+void pool_reset(pool *p) {
+    pool_slab *slab = p->slabs;
+
+    while (slab != NULL) {
+        pool_slab *next = slab->next;
+        slab->next = p->spare_slabs;
+        p->spare_slabs = slab;
+        slab = next;
+    }
+
+    p->slabs = NULL;
+    p->next_object = NULL;
+    p->objects_left = 0;
+    p->free_objects = NULL;
+
+    p->stats.resets++;
+    p->stats.live = 0;
+}
+
+
+/* Frees a list of slabs. */
+static void free_slabs(pool_slab *slab) {
+    while (slab != NULL) {
+        pool_slab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+}
+
+
+/* Frees all of the pool's slabs, which releases every object that came from
+ * the pool at once.  The pool is left empty, and can be used again.
+ */
+void pool_free(pool *p) {
+    free_slabs(p->slabs);
+    free_slabs(p->spare_slabs);
+
+    pool_init(p, p->name, p->object_size);
+}
+
+
+/* Prints one line of the pool's statistics. */
+void pool_print_stats(FILE *f, const pool *p) {
+    fprintf(f, "pool %s:  %ld live (peak %ld) of %lu bytes \t%ld allocs "
+               "\t%ld releases \t%ld resets \t%ld slabs of %ld bytes\n",
+            p->name, p->stats.live, p->stats.peak_live,
+            (unsigned long) p->object_size, p->stats.allocs,
+            p->stats.releases, p->stats.resets, p->stats.slabs,
+            p->stats.slab_bytes);
+}
@@ -0,0 +1,95 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+
+/* Pools start with slabs of this many objects, and double the size of each
+ * new slab up to the maximum.
+ */
+#define POOL_START_OBJECTS  64
+#define POOL_MAX_OBJECTS    65536
+
+
+/* A slab of objects handed out by a pool.  The objects follow the header in
+ * memory.
+ */
+typedef struct pool_slab {
+    struct pool_slab *next;
+
+    /* The number of objects that the slab holds. */
+    int num_objects;
+} pool_slab;
+
+
+/* The counts that a pool keeps of its use, for pool_print_stats(). */
+typedef struct pool_stats {
+    /* The calls of pool_alloc(), pool_release() and pool_reset(). */
+    long allocs;
+    long releases;
+    long resets;
+
+    /* The objects handed out and not yet released, now and at most. */
+    long live;
+    long peak_live;
+
+    /* The slabs that the pool has malloc()ed, and their total size. */
+    long slabs;
+    long slab_bytes;
+} pool_stats;
+
+
+/* Hands out objects of one size from slabs that are allocated as needed, so
+ * objects allocated one after another are next to each other in memory.
+ * Released objects are kept on a free list for reuse.  Every object can be
+ * released at once, either keeping the slabs for the objects that come next
+ * with pool_reset(), or freeing them with pool_free().
+ *
+ * A pool isn't thread-safe; each thread, or each structure that a lock
+ * protects, should have its own.
+ */
+typedef struct pool {
+    /* What the objects are, for pool_print_stats(). */
+    const char *name;
+
+    /* The size of each object, rounded up for the alignment of a pointer or
+     * a double, whichever is larger.
+     */
+    size_t object_size;
+
+    /* All of the slabs that objects are handed out from, the newest first,
+     * and the slabs kept by pool_reset() to be used again.
+     */
+    pool_slab *slabs;
+    pool_slab *spare_slabs;
+
+    /* The objects of the newest slab that haven't been handed out yet. */
+    char *next_object;
+    int objects_left;
+
+    /* The number of objects in the next slab that is malloc()ed. */
+    int slab_objects;
+
+    /* A linked list of released objects, threaded through their first
+     * bytes.
+     */
+    void *free_objects;
+
+    pool_stats stats;
+} pool;
+
+
+void pool_init(pool *p, const char *name, size_t object_size);
+
+void * pool_alloc(pool *p);
+
+void pool_release(pool *p, void *object);
+
+void pool_reset(pool *p);
+
+void pool_free(pool *p);
+
+void pool_print_stats(FILE *f, const pool *p);
+
+#endif /* POOL_H */
@@ -0,0 +1,184 @@
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "probe.h"
+
+
+/*
+   The probes' registry, and their report.  Each thread's first pass through a
+   probe claims a block of counters from a fixed array, and each site's first
+   pass claims a column of the blocks, both with one atomic increment, so that
+   neither needs a lock or malloc() and both work in signal handlers.  A site
+   that two threads reach first at the same time keeps whichever column was
+   stored first; the other is never used.
+
+   The report reads the other threads' blocks while they may still be
+   counting, so it is only exact once they have stopped, as they have when
+   the program exits.
+*/
+
+
+#ifdef PROBES
+
+__thread probe_thread *probe_self;
+
+static probe_thread threads[PROBE_MAX_THREADS];
+static probe_thread shared_thread;
+static int num_threads;
+
+static probe_site *sites[PROBE_MAX_SITES];
+static int num_sites;
+
+
+/* Claims this thread's block of counters, or the shared block if they have
+ * all been claimed.
+ */
+probe_thread * probe_claim_thread(void) {
+    int i = __atomic_fetch_add(&num_threads, 1, __ATOMIC_RELAXED);
+
+    probe_self = (i < PROBE_MAX_THREADS) ? &threads[i] : &shared_thread;
+    return probe_self;
+}
+
+
+/* Gives the site its column of counters, if another thread hasn't already,
+ * and returns the site's column.
+ */
+int probe_register(probe_site *site) {
+    int i = __atomic_fetch_add(&num_sites, 1, __ATOMIC_RELAXED);
+    int expected = -1;
+
+    if (i > PROBE_MAX_SITES)
+        i = PROBE_MAX_SITES;
+
+    if (!__atomic_compare_exchange_n(&site->index, &expected, i, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return expected;
+
+    if (i < PROBE_MAX_SITES)
+        __atomic_store_n(&sites[i], site, __ATOMIC_RELEASE);
+    return i;
+}
+
+
+/* Returns the probe ticks per nanosecond, measuring it the first time. */
+static double ticks_per_ns(void) {
+    static double rate = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec start, now;
+    uint64_t start_ticks;
+    double ns;
+
+    if (rate == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        start_ticks = probe_ticks();
+        do {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            ns = (now.tv_sec - start.tv_sec) * 1e9 +
+                 (now.tv_nsec - start.tv_nsec);
+        } while (ns < 10e6);
+        rate = (probe_ticks() - start_ticks) / ns;
+    }
+#else
+    rate = 1;
+#endif
+    return rate;
+}
+
+
+/* Prints one line of a site's counts, with its time if it was timed. */
+static void print_counts(FILE *f, const char *label, uint64_t count,
+                         uint64_t ticks, double rate) {
+    fprintf(f, "  %-36s %14llu", label, (unsigned long long) count);
+    if (ticks > 0) {
+        fprintf(f, " %12.3f ms %10.1f ns each", ticks / rate / 1e6,
+                count > 0 ? ticks / rate / count : 0.0);
+    }
+    fprintf(f, "\n");
+}
+
+
+/* Prints every site's counts, totalled over the threads, and each thread's
+ * counts when more than one thread passed through the site.
+ */
+void probe_dump(FILE *f) {
+    int n_sites = __atomic_load_n(&num_sites, __ATOMIC_ACQUIRE);
+    int n_threads = __atomic_load_n(&num_threads, __ATOMIC_ACQUIRE);
+    probe_site *site;
+    uint64_t count, ticks;
+    double rate = ticks_per_ns();
+    char label[40];
+    int i, t, users;
+
+    if (n_sites > PROBE_MAX_SITES)
+        n_sites = PROBE_MAX_SITES;
+    if (n_threads > PROBE_MAX_THREADS)
+        n_threads = PROBE_MAX_THREADS + 1;
+
+    fprintf(f, "probes:%31s %14s\n", "", "calls");
+    for (i = 0; i < n_sites; i++) {
+        site = __atomic_load_n(&sites[i], __ATOMIC_ACQUIRE);
+        if (site == NULL)
+            continue;
+
+        count = ticks = 0;
+        users = 0;
+        for (t = 0; t < n_threads; t++) {
+            probe_thread *pt = t < PROBE_MAX_THREADS ? &threads[t]
+                                                     : &shared_thread;
+            count += pt->counts[i];
+            ticks += pt->ticks[i];
+            users += (pt->counts[i] > 0);
+        }
+        print_counts(f, site->name, count, ticks, rate);
+
+        if (users < 2)
+            continue;
+        for (t = 0; t < n_threads; t++) {
+            probe_thread *pt = t < PROBE_MAX_THREADS ? &threads[t]
+                                                     : &shared_thread;
+            if (pt->counts[i] == 0)
+                continue;
+            if (t < PROBE_MAX_THREADS)
+                snprintf(label, sizeof(label), "  thread %d", t);
+            else
+                snprintf(label, sizeof(label), "  other threads");
+            print_counts(f, label, pt->counts[i], pt->ticks[i], rate);
+        }
+    }
+}
+
+
+/* Dumps the probes when the program exits. */
+__attribute__((destructor))
+static void dump_at_exit(void) {
+    const char *output = getenv("PROBE_OUTPUT");
+    FILE *f = stderr;
+
+    if (__atomic_load_n(&num_sites, __ATOMIC_ACQUIRE) == 0)
+        return;
+
+    if (output != NULL && *output != '\0') {
+        f = fopen(output, "a");
+        if (f == NULL) {
+            perror(output);
+            return;
+        }
+    }
+
+    probe_dump(f);
+
+    if (f != stderr)
+        fclose(f);
+}
+
+#else
+
+/* Without the probes, there is nothing to report. */
+void probe_dump(FILE *f) {
+    (void) f;
+}
+
+#endif /* PROBES */
@@ -0,0 +1,126 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#if defined(PROBES) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#elif defined(PROBES)
+#include <time.h>
+#endif
+
+
+/*
+ * Counters and timers for the modules' hot paths.  They are only compiled in
+ * when PROBES is defined, which "make PROBES=1" does; otherwise every macro
+ * below expands to nothing at all.  A site is defined once at file scope,
+ * and then counted or timed where it is used:
+ *
+ *     PROBE_DEFINE(alloc_probe, "myalloc");
+ *
+ *     unsigned char *myalloc(int size) {
+ *         PROBE_BEGIN(alloc_probe);
+ *         ...
+ *         PROBE_END(alloc_probe);
+ *         return ptr;
+ *     }
+ *
+ * PROBE_COUNT() counts a pass through a site without timing it.  PROBE_BEGIN()
+ * declares a variable, so it has to be where a declaration can go, and every
+ * way out of a timed region must have its own PROBE_END().  The time of a
+ * site that is timed inside itself, such as a recursive function, includes
+ * the time of the inner calls.
+ *
+ * Each thread counts into its own block, without locks or atomic operations;
+ * only the first pass of a thread, or the first pass through a site, takes an
+ * atomic operation.  Nothing ever calls malloc(), so sites can be in signal
+ * handlers.  probe_dump() reports every site, and each thread's share when
+ * more than one thread passed through it.  A program built with the probes
+ * dumps them when it exits, to stderr or appended to the file named by the
+ * PROBE_OUTPUT environment variable.
+ */
+
+
+/* The most sites, and the most threads that get their own counts; any more
+ * threads share one block, whose counts may lose an update now and then.
+ */
+#define PROBE_MAX_SITES    64
+#define PROBE_MAX_THREADS  256
+
+
+/* A place in the code that is counted or timed. */
+typedef struct probe_site {
+    const char *name;
+
+    /* The site's counters in each thread's block, or -1 until the site is
+     * first passed.  Sites past PROBE_MAX_SITES all use the spare counter at
+     * PROBE_MAX_SITES, which isn't reported.
+     */
+    int index;
+} probe_site;
+
+
+/* A thread's counts of every site, and the ticks that were timed. */
+typedef struct probe_thread {
+    uint64_t counts[PROBE_MAX_SITES + 1];
+    uint64_t ticks[PROBE_MAX_SITES + 1];
+} probe_thread;
+
+
+void probe_dump(FILE *f);
+
+
+#ifdef PROBES
+
+extern __thread probe_thread *probe_self;
+
+probe_thread * probe_claim_thread(void);
+int probe_register(probe_site *site);
+
+
+/* Returns the current time in ticks of the time-stamp counter, or in
+ * nanoseconds where there isn't one.
+ */
+static inline uint64_t probe_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+
+/* Counts a pass through the site, which took the specified ticks. */
+static inline void probe_record(probe_site *site, uint64_t ticks) {
+    probe_thread *t = probe_self;
+    int i = site->index;
+
+    if (__builtin_expect(t == NULL, 0))
+        t = probe_claim_thread();
+    if (__builtin_expect(i < 0, 0))
+        i = probe_register(site);
+
+    t->counts[i]++;
+    t->ticks[i] += ticks;
+}
+
+
+#define PROBE_DEFINE(site, name)  static probe_site site = { name, -1 }
+#define PROBE_COUNT(site)         probe_record(&(site), 0)
+#define PROBE_BEGIN(site)         uint64_t site##_start = probe_ticks()
+#define PROBE_END(site) \
+    probe_record(&(site), probe_ticks() - site##_start)
+
+#else
+
+#define PROBE_DEFINE(site, name)  extern int probe_unused
+#define PROBE_COUNT(site)         ((void) 0)
+#define PROBE_BEGIN(site)         ((void) 0)
+#define PROBE_END(site)           ((void) 0)
+
+#endif /* PROBES */
+
+#endif /* PROBE_H */
@@ -0,0 +1,17 @@
+# The probes of probe.h, for a module with probes in its hot paths.  The
+# module's Makefile sets PROBE_DIR to the path of this directory, includes
+# this file at its end, and links probe.o into its programs.  "make
+# PROBES=1" builds the programs with the probes, which report when the
+# programs exit; "make clean" first, since objects built without them
+# aren't rebuilt.
+
+ifeq ($(filter -I$(PROBE_DIR),$(CPPFLAGS)),)
+CPPFLAGS += -I$(PROBE_DIR)
+endif
+
+ifdef PROBES
+override CFLAGS += -DPROBES
+endif
+
+probe.o: $(PROBE_DIR)/probe.c $(PROBE_DIR)/probe.h
+	$(CC) $(CPPFLAGS) $(CFLAGS) -c $< -o $@
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "bitmap.h"
+
+
+/*
+   A benchmark of the bitmap kernels.  Each kernel runs over a whole bitmap,
+   once as a loop that looks at one bit at a time, as count_onebits() does in
+   onebits.c, and then with each word width and each instruction set that
+   the CPU supports.  It prints how many billions of bits each one gets
+   through a second, and checks that they all get the same answer.
+*/
+
+
+/* How many bits the bitmaps have, if the command line doesn't say. */
+#define DEFAULT_MEGABITS 16
+
+/* How long each kernel is repeated for, in seconds. */
+#define MIN_SECONDS 0.1
+
+/* The kernels, and what each one does over the whole bitmap. */
+#define KERNEL_FIRST_SET  0   /* Find the one set bit, at the very end. */
+#define KERNEL_NEXT_ZERO  1   /* Find the one clear bit, at the very end. */
+#define KERNEL_RANK       2   /* Count the random bits. */
+#define KERNEL_SELECT     3   /* Find the last of the random bits. */
+#define KERNEL_AND        4   /* AND two random bitmaps. */
+#define NUM_KERNELS       5
+
+/* The version that goes a bit at a time, besides the instruction sets. */
+#define VERSION_LOOP -1
+
+
+static const char *kernel_names[NUM_KERNELS] = {
+    "find_first_set", "find_next_zero", "rank", "select", "and"
+};
+
+
+/* The bitmaps, each as 64-bit words, but read as 32-bit words too. */
+static uint64_t *sparse, *dense, *random_a, *random_b, *result;
+static size_t nbits, nwords, random_count;
+
+
+/* Returns the current time in seconds. */
+static double get_seconds() {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/* The loop in onebits.c. */
+static int count_onebits(unsigned int n) {
+    int count = 0;
+    while (n > 0) {
+        count += n & 1;
+        n = n >> 1;
+    }
+    return count;
+}
+
+
+/* Returns bit i of a bitmap of 32-bit words, by shifting it down. */
+static int get_bit(const uint32_t *map, size_t i) {
+    return (map[i / 32] >> (i % 32)) & 1;
+}
+
+
+/* Runs a kernel one bit at a time, and returns its answer. */
+static size_t run_loop(int kernel) {
+    const uint32_t *a = (const uint32_t *) random_a;
+    const uint32_t *b = (const uint32_t *) random_b;
+    uint32_t *dst = (uint32_t *) result, word;
+    size_t i, count = 0, target;
+    int j;
+
+    switch (kernel) {
+    case KERNEL_FIRST_SET:
+        for (i = 0; i < nbits; i++) {
+            if (get_bit((const uint32_t *) sparse, i))
+                return i;
+        }
+        return nbits;
+
+    case KERNEL_NEXT_ZERO:
+        for (i = 0; i < nbits; i++) {
+            if (!get_bit((const uint32_t *) dense, i))
+                return i;
+        }
+        return nbits;
+
+    case KERNEL_RANK:
+        for (i = 0; i < nbits / 32; i++)
+            count += count_onebits(a[i]);
+        return count;
+
+    case KERNEL_SELECT:
+        target = random_count - 1;
+        for (i = 0; i < nbits; i++) {
+            if (get_bit(a, i) && count++ == target)
+                return i;
+        }
+        return nbits;
+
+    default:
+        for (i = 0; i < nbits / 32; i++) {
+            word = 0;
+            for (j = 0; j < 32; j++)
+                word |= ((a[i] >> j) & (b[i] >> j) & 1) << j;
+            dst[i] = word;
+        }
+        return dst[nbits / 32 - 1];
+    }
+}
+
+
+/* Runs a kernel with the given word width, in the current instruction set,
+ * and returns its answer.
+ */
+static size_t run_kernel(int kernel, int width) {
+    const uint32_t *a32 = (const uint32_t *) random_a;
+    const uint32_t *b32 = (const uint32_t *) random_b;
+    uint32_t *dst32 = (uint32_t *) result;
+
+    switch (kernel) {
+    case KERNEL_FIRST_SET:
+        return width == 32 ?
+            bitmap32_find_first_set((const uint32_t *) sparse, nbits) :
+            bitmap64_find_first_set(sparse, nbits);
+
+    case KERNEL_NEXT_ZERO:
+        return width == 32 ?
+            bitmap32_find_next_zero((const uint32_t *) dense, nbits, 0) :
+            bitmap64_find_next_zero(dense, nbits, 0);
+
+    case KERNEL_RANK:
+        return width == 32 ? bitmap32_rank(a32, nbits) :
+                             bitmap64_rank(random_a, nbits);
+
+    case KERNEL_SELECT:
+        return width == 32 ?
+            bitmap32_select(a32, nbits, random_count - 1) :
+            bitmap64_select(random_a, nbits, random_count - 1);
+
+    default:
+        if (width == 32) {
+            bitmap32_and(dst32, a32, b32, nbits / 32);
+            return dst32[nbits / 32 - 1];
+        }
+        bitmap64_and(result, random_a, random_b, nwords);
+        return dst32[nbits / 32 - 1];
+    }
+}
+
+
+/* Repeats a kernel until MIN_SECONDS have passed, stores its answer in
+ * *answer, and returns how many billion bits a second it went through.
+ */
+static double time_kernel(int kernel, int version, int width,
+                          size_t *answer) {
+    double start = get_seconds(), seconds;
+    long reps = 0;
+
+    do {
+        if (version == VERSION_LOOP)
+            *answer = run_loop(kernel);
+        else
+            *answer = run_kernel(kernel, width);
+        reps++;
+        seconds = get_seconds() - start;
+    } while (seconds < MIN_SECONDS);
+
+    return (double) nbits * reps / seconds / 1e9;
+}
+
+
+/* Returns a random 64-bit word. */
+static uint64_t random_word() {
+    return ((uint64_t) rand() << 42) ^ ((uint64_t) rand() << 21) ^ rand();
+}
+
+
+int main(int argc, char **argv) {
+    size_t i, expected, answer;
+    int kernel, isa, width;
+    double rate;
+
+    nbits = DEFAULT_MEGABITS;
+    if (argc > 2 || (argc == 2 && sscanf(argv[1], "%zu", &nbits) != 1) ||
+        nbits == 0) {
+        printf("usage:  %s [megabits]\n\n", argv[0]);
+        printf("\tTimes each bitmap kernel over bitmaps of the given number\n"
+               "\tof millions of bits (default %d).\n\n", DEFAULT_MEGABITS);
+        return 1;
+    }
+    nbits *= 1 << 20;
+    nwords = nbits / 64;
+
+    sparse = calloc(nwords, sizeof(uint64_t));
+    dense = malloc(nwords * sizeof(uint64_t));
+    random_a = malloc(nwords * sizeof(uint64_t));
+    random_b = malloc(nwords * sizeof(uint64_t));
+    result = malloc(nwords * sizeof(uint64_t));
+    if (!sparse || !dense || !random_a || !random_b || !result) {
+        printf("ERROR:  couldn't allocate the bitmaps!\n");
+        return 1;
+    }
+
+    memset(dense, 0xFF, nwords * sizeof(uint64_t));
+    sparse[nwords - 1] = 1ULL << 63;
+    dense[nwords - 1] = ~(1ULL << 63);
+    for (i = 0; i < nwords; i++) {
+        random_a[i] = random_word();
+        random_b[i] = random_word();
+    }
+    random_count = bitmap64_rank(random_a, nbits);
+
+    printf("%zu bits; the best instruction set is %s.\n\n", nbits,
+           bitmap_isa_name(bitmap_get_isa()));
+    printf("    %-16s %-8s %6s %10s\n", "kernel", "version", "width",
+           "Gbit/s");
+
+    for (kernel = 0; kernel < NUM_KERNELS; kernel++) {
+        rate = time_kernel(kernel, VERSION_LOOP, 32, &expected);
+        printf("    %-16s %-8s %6d %10.3f\n", kernel_names[kernel], "loop",
+               32, rate);
+
+        for (isa = 0; isa < BITMAP_NUM_ISAS; isa++) {
+            if (!bitmap_set_isa(isa))
+                continue;
+
+            for (width = 32; width <= 64; width += 32) {
+                rate = time_kernel(kernel, isa, width, &answer);
+                printf("    %-16s %-8s %6d %10.3f%s\n", kernel_names[kernel],
+                       bitmap_isa_name(isa), width, rate,
+                       answer == expected ? "" : "   WRONG ANSWER");
+            }
+        }
+    }
+
+    free(sparse);
+    free(dense);
+    free(random_a);
+    free(random_b);
+    free(result);
+    return 0;
+}
@@ -0,0 +1,380 @@
+#include "bitmap.h"
+#include "popcount.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BITMAP_X86
+#include <immintrin.h>
+#endif
+
+
+/*
+   The kernels are written once, as macros over the word type, and expanded
+   for each word width and for each instruction set that changes them:
+
+     - The searches only need count-trailing-zeros, which every CPU has, so
+       there is one version of each for each width.
+
+     - rank and select count the bits of each word.  The generic versions do
+       it with bit-twiddling; the BMI2 versions with POPCNT, and select finds
+       the k'th set bit within a word with PDEP, which deposits the bit 1 << k
+       at the position of the k'th set bit.
+
+     - AND, OR and ANDNOT don't care about the word width, but the AVX2
+       versions do 32 bytes at a time.
+
+   The public functions call whichever versions the best instruction set
+   that the CPU supports has, or the one that bitmap_set_isa() chose.
+*/
+
+
+static const char *isa_names[BITMAP_NUM_ISAS] = {
+    "generic", "bmi2", "avx2"
+};
+
+/* The instruction set that the public functions use, or -1 until the first
+ * call picks the best one.
+ */
+static int current_isa = -1;
+
+
+/* Portable one-bit counts of a word. */
+static inline unsigned popcount32_generic(uint32_t x) {
+    x = x - ((x >> 1) & 0x55555555);
+    x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+    x = (x + (x >> 4)) & 0x0F0F0F0F;
+    return (x * 0x01010101) >> 24;
+}
+
+static inline unsigned popcount64_generic(uint64_t x) {
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (x * 0x0101010101010101ULL) >> 56;
+}
+
+
+/* Portable positions of the k'th set bit of a word, which must have more
+ * than k set bits:  clear the lowest set bit k times.
+ */
+static inline unsigned word_select32_generic(uint32_t x, unsigned k) {
+    while (k-- > 0)
+        x &= x - 1;
+    return __builtin_ctz(x);
+}
+
+static inline unsigned word_select64_generic(uint64_t x, unsigned k) {
+    while (k-- > 0)
+        x &= x - 1;
+    return __builtin_ctzll(x);
+}
+
+
+#ifdef BITMAP_X86
+
+#define BMI2_TARGET __attribute__((target("popcnt,bmi,bmi2")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+BMI2_TARGET
+static inline unsigned word_select32_bmi2(uint32_t x, unsigned k) {
+    return __builtin_ctz(_pdep_u32(1U << k, x));
+}
+
+#ifdef __x86_64__
+BMI2_TARGET
+static inline unsigned word_select64_bmi2(uint64_t x, unsigned k) {
+    return __builtin_ctzll(_pdep_u64(1ULL << k, x));
+}
+#else
+/* 32-bit x86 has no 64-bit PDEP, so do a half at a time. */
+BMI2_TARGET
+static inline unsigned word_select64_bmi2(uint64_t x, unsigned k) {
+    unsigned low = __builtin_popcount((uint32_t) x);
+
+    if (k < low)
+        return word_select32_bmi2((uint32_t) x, k);
+    return 32 + word_select32_bmi2((uint32_t) (x >> 32), k - low);
+}
+#endif
+
+#endif /* BITMAP_X86 */
+
+
+/* The searches, for words of BITS bits of type W, with CTZ counting the
+ * trailing zeros of a word.
+ */
+#define BITMAP_FIND(BITS, W, CTZ)                                            \
+size_t bitmap##BITS##_find_next_set(const W *map, size_t nbits,              \
+                                    size_t start) {                          \
+    size_t i = start / BITS;                                                 \
+    W word;                                                                  \
+                                                                             \
+    if (start >= nbits)                                                      \
+        return nbits;                                                        \
+                                                                             \
+    word = map[i] & ((W) ~(W) 0 << (start % BITS));                          \
+    while (word == 0) {                                                      \
+        if (++i * BITS >= nbits)                                             \
+            return nbits;                                                    \
+        word = map[i];                                                       \
+    }                                                                        \
+                                                                             \
+    start = i * BITS + CTZ(word);                                            \
+    return start < nbits ? start : nbits;                                    \
+}                                                                            \
+                                                                             \
+size_t bitmap##BITS##_find_next_zero(const W *map, size_t nbits,             \
+                                     size_t start) {                         \
+    size_t i = start / BITS;                                                 \
+    W word;                                                                  \
+                                                                             \
+    if (start >= nbits)                                                      \
+        return nbits;                                                        \
+                                                                             \
+    word = (W) ~map[i] & ((W) ~(W) 0 << (start % BITS));                     \
+    while (word == 0) {                                                      \
+        if (++i * BITS >= nbits)                                             \
+            return nbits;                                                    \
+        word = (W) ~map[i];                                                  \
+    }                                                                        \
+                                                                             \
+    start = i * BITS + CTZ(word);                                            \
+    return start < nbits ? start : nbits;                                    \
+}                                                                            \
+                                                                             \
+size_t bitmap##BITS##_find_first_set(const W *map, size_t nbits) {           \
+    return bitmap##BITS##_find_next_set(map, nbits, 0);                      \
+}
+
+BITMAP_FIND(32, uint32_t, __builtin_ctz)
+BITMAP_FIND(64, uint64_t, __builtin_ctzll)
+
+
+/* rank and select, for words of BITS bits of type W, as the ISA version,
+ * compiled with ATTR, with POPCOUNT counting the bits of a word and SELECT
+ * finding the k'th set bit of a word.
+ */
+#define BITMAP_RANK(BITS, W, ISA, ATTR, POPCOUNT)                            \
+ATTR                                                                         \
+static size_t rank##BITS##_##ISA(const W *map, size_t pos) {                 \
+    size_t i, count = 0;                                                     \
+                                                                             \
+    for (i = 0; i < pos / BITS; i++)                                         \
+        count += POPCOUNT(map[i]);                                           \
+    if (pos % BITS != 0)                                                     \
+        count += POPCOUNT(map[i] & (((W) 1 << (pos % BITS)) - 1));           \
+    return count;                                                            \
+}
+
+#define BITMAP_SELECT(BITS, W, ISA, ATTR, POPCOUNT, SELECT)                  \
+ATTR                                                                         \
+static size_t select##BITS##_##ISA(const W *map, size_t nbits, size_t k) {   \
+    size_t nwords = (nbits + BITS - 1) / BITS, i, count, pos;                \
+                                                                             \
+    for (i = 0; i < nwords; i++) {                                           \
+        count = POPCOUNT(map[i]);                                            \
+        if (k < count) {                                                     \
+            pos = i * BITS + SELECT(map[i], k);                              \
+            return pos < nbits ? pos : nbits;                                \
+        }                                                                    \
+        k -= count;                                                          \
+    }                                                                        \
+    return nbits;                                                            \
+}
+
+#define BITMAP_NO_TARGET
+
+/* The 64-bit rank only uses its generic version, for the last word. */
+BITMAP_RANK(32, uint32_t, generic, BITMAP_NO_TARGET, popcount32_generic)
+BITMAP_RANK(64, uint64_t, generic, BITMAP_NO_TARGET, popcount64_generic)
+BITMAP_SELECT(32, uint32_t, generic, BITMAP_NO_TARGET,
+              popcount32_generic, word_select32_generic)
+BITMAP_SELECT(64, uint64_t, generic, BITMAP_NO_TARGET,
+              popcount64_generic, word_select64_generic)
+
+#ifdef BITMAP_X86
+BITMAP_RANK(32, uint32_t, bmi2, BMI2_TARGET, __builtin_popcount)
+BITMAP_SELECT(32, uint32_t, bmi2, BMI2_TARGET,
+              __builtin_popcount, word_select32_bmi2)
+BITMAP_SELECT(64, uint64_t, bmi2, BMI2_TARGET,
+              __builtin_popcountll, word_select64_bmi2)
+#endif
+
+
+/* AND, OR and ANDNOT, for words of BITS bits of type W.  EXPR combines the
+ * words a and b, and SIMD_OP is the AVX2 intrinsic that does the same, with
+ * SIMD_A and SIMD_B in the order that it takes them.
+ */
+#define BITMAP_BULK_GENERIC(BITS, W, NAME, EXPR)                             \
+static void NAME##BITS##_generic(W *dst, const W *a, const W *b,             \
+                                 size_t nwords) {                            \
+    size_t i;                                                                \
+                                                                             \
+    for (i = 0; i < nwords; i++)                                             \
+        dst[i] = EXPR(a[i], b[i]);                                           \
+}
+
+#define BITMAP_BULK_AVX2(BITS, W, NAME, EXPR, SIMD_OP, SIMD_A, SIMD_B)       \
+AVX2_TARGET                                                                  \
+static void NAME##BITS##_avx2(W *dst, const W *a, const W *b,                \
+                              size_t nwords) {                               \
+    const size_t step = 32 / sizeof(W);                                      \
+    __m256i va, vb;                                                          \
+    size_t i = 0;                                                            \
+                                                                             \
+    for (; i + step <= nwords; i += step) {                                  \
+        va = _mm256_loadu_si256((const __m256i *) (a + i));                  \
+        vb = _mm256_loadu_si256((const __m256i *) (b + i));                  \
+        _mm256_storeu_si256((__m256i *) (dst + i), SIMD_OP(SIMD_A, SIMD_B)); \
+    }                                                                        \
+    for (; i < nwords; i++)                                                  \
+        dst[i] = EXPR(a[i], b[i]);                                           \
+}
+
+#define AND_EXPR(a, b)    ((a) & (b))
+#define OR_EXPR(a, b)     ((a) | (b))
+#define ANDNOT_EXPR(a, b) ((a) & ~(b))
+
+BITMAP_BULK_GENERIC(32, uint32_t, and, AND_EXPR)
+BITMAP_BULK_GENERIC(32, uint32_t, or, OR_EXPR)
+BITMAP_BULK_GENERIC(32, uint32_t, andnot, ANDNOT_EXPR)
+BITMAP_BULK_GENERIC(64, uint64_t, and, AND_EXPR)
+BITMAP_BULK_GENERIC(64, uint64_t, or, OR_EXPR)
+BITMAP_BULK_GENERIC(64, uint64_t, andnot, ANDNOT_EXPR)
+
+#ifdef BITMAP_X86
+/* _mm256_andnot_si256(x, y) is ~x & y, so it takes b first. */
+BITMAP_BULK_AVX2(32, uint32_t, and, AND_EXPR, _mm256_and_si256, va, vb)
+BITMAP_BULK_AVX2(32, uint32_t, or, OR_EXPR, _mm256_or_si256, va, vb)
+BITMAP_BULK_AVX2(32, uint32_t, andnot, ANDNOT_EXPR, _mm256_andnot_si256,
+                 vb, va)
+BITMAP_BULK_AVX2(64, uint64_t, and, AND_EXPR, _mm256_and_si256, va, vb)
+BITMAP_BULK_AVX2(64, uint64_t, or, OR_EXPR, _mm256_or_si256, va, vb)
+BITMAP_BULK_AVX2(64, uint64_t, andnot, ANDNOT_EXPR, _mm256_andnot_si256,
+                 vb, va)
+#endif
+
+
+/* Returns nonzero if the CPU can run the kernels of the instruction set. */
+int bitmap_isa_supported(BitmapIsa isa) {
+#ifdef BITMAP_X86
+    __builtin_cpu_init();
+#endif
+
+    switch (isa) {
+    case BITMAP_ISA_GENERIC:
+        return 1;
+#ifdef BITMAP_X86
+    case BITMAP_ISA_BMI2:
+        return __builtin_cpu_supports("popcnt") &&
+               __builtin_cpu_supports("bmi") &&
+               __builtin_cpu_supports("bmi2");
+    case BITMAP_ISA_AVX2:
+        return bitmap_isa_supported(BITMAP_ISA_BMI2) &&
+               __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return 0;
+    }
+}
+
+
+/* Returns the instruction set that the kernels use. */
+BitmapIsa bitmap_get_isa(void) {
+    int isa;
+
+    /* Threads that race to set this all set it to the same thing. */
+    if (current_isa < 0) {
+        for (isa = BITMAP_NUM_ISAS - 1; isa > 0; isa--) {
+            if (bitmap_isa_supported(isa))
+                break;
+        }
+        current_isa = isa;
+    }
+    return current_isa;
+}
+
+
+/* Makes the kernels use the given instruction set, which is mostly of use
+ * for comparing them.  Returns 0, and changes nothing, if the CPU doesn't
+ * support it.
+ */
+int bitmap_set_isa(BitmapIsa isa) {
+    if (!bitmap_isa_supported(isa))
+        return 0;
+    current_isa = isa;
+    return 1;
+}
+
+
+/* Returns the name of an instruction set, for printing. */
+const char * bitmap_isa_name(BitmapIsa isa) {
+    if (isa < 0 || isa >= BITMAP_NUM_ISAS)
+        return "unknown";
+    return isa_names[isa];
+}
+
+
+size_t bitmap32_rank(const uint32_t *map, size_t pos) {
+#ifdef BITMAP_X86
+    if (bitmap_get_isa() >= BITMAP_ISA_BMI2)
+        return rank32_bmi2(map, pos);
+#endif
+    return rank32_generic(map, pos);
+}
+
+
+/* The whole words go to popcount_array(), which has faster versions yet. */
+size_t bitmap64_rank(const uint64_t *map, size_t pos) {
+    size_t count;
+
+    if (bitmap_get_isa() == BITMAP_ISA_GENERIC)
+        count = popcount_array_with(POPCOUNT_SCALAR, map, pos / 64);
+    else
+        count = popcount_array(map, pos / 64);
+
+    if (pos % 64 != 0)
+        count += rank64_generic(map + pos / 64, pos % 64);
+    return count;
+}
+
+
+size_t bitmap32_select(const uint32_t *map, size_t nbits, size_t k) {
+#ifdef BITMAP_X86
+    if (bitmap_get_isa() >= BITMAP_ISA_BMI2)
+        return select32_bmi2(map, nbits, k);
+#endif
+    return select32_generic(map, nbits, k);
+}
+
+
+size_t bitmap64_select(const uint64_t *map, size_t nbits, size_t k) {
+#ifdef BITMAP_X86
+    if (bitmap_get_isa() >= BITMAP_ISA_BMI2)
+        return select64_bmi2(map, nbits, k);
+#endif
+    return select64_generic(map, nbits, k);
+}
+
+
+/* The public AND, OR and ANDNOT of each width. */
+#ifdef BITMAP_X86
+#define BITMAP_BULK_DISPATCH(BITS, W, NAME)                                  \
+void bitmap##BITS##_##NAME(W *dst, const W *a, const W *b, size_t nwords) {  \
+    if (bitmap_get_isa() >= BITMAP_ISA_AVX2)                                 \
+        NAME##BITS##_avx2(dst, a, b, nwords);                                \
+    else                                                                     \
+        NAME##BITS##_generic(dst, a, b, nwords);                             \
+}
+#else
+#define BITMAP_BULK_DISPATCH(BITS, W, NAME)                                  \
+void bitmap##BITS##_##NAME(W *dst, const W *a, const W *b, size_t nwords) {  \
+    NAME##BITS##_generic(dst, a, b, nwords);                                 \
+}
+#endif
+
+BITMAP_BULK_DISPATCH(32, uint32_t, and)
+BITMAP_BULK_DISPATCH(32, uint32_t, or)
+BITMAP_BULK_DISPATCH(32, uint32_t, andnot)
+BITMAP_BULK_DISPATCH(64, uint64_t, and)
+BITMAP_BULK_DISPATCH(64, uint64_t, or)
+BITMAP_BULK_DISPATCH(64, uint64_t, andnot)
@@ -0,0 +1,66 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+   Operations on bitmaps of 32-bit or 64-bit words.  Bit i of a bitmap is bit
+   i % 32 (or 64) of word i / 32 (or 64), counting from the least significant
+   bit.  Bits of the last word past nbits are ignored by the searches, but
+   should be zero for rank and select.
+
+   For each word width BITS (32 or 64), words of type W (uint32_t or
+   uint64_t), there are:
+
+     bitmapBITS_find_first_set(map, nbits)
+         The first set bit, or nbits if there are none.
+     bitmapBITS_find_next_set(map, nbits, start)
+     bitmapBITS_find_next_zero(map, nbits, start)
+         The first set (or clear) bit at or after start, or nbits.
+     bitmapBITS_rank(map, pos)
+         The number of set bits before bit pos.
+     bitmapBITS_select(map, nbits, k)
+         The set bit with k set bits before it, or nbits if there are only k.
+     bitmapBITS_and(dst, a, b, nwords)
+     bitmapBITS_or(dst, a, b, nwords)
+     bitmapBITS_andnot(dst, a, b, nwords)
+         dst = a & b, a | b, or a & ~b, word by word.  dst may be a or b.
+*/
+
+#define BITMAP_DECLARE(BITS, W)                                              \
+    size_t bitmap##BITS##_find_first_set(const W *map, size_t nbits);        \
+    size_t bitmap##BITS##_find_next_set(const W *map, size_t nbits,          \
+                                        size_t start);                       \
+    size_t bitmap##BITS##_find_next_zero(const W *map, size_t nbits,         \
+                                         size_t start);                      \
+    size_t bitmap##BITS##_rank(const W *map, size_t pos);                    \
+    size_t bitmap##BITS##_select(const W *map, size_t nbits, size_t k);      \
+    void bitmap##BITS##_and(W *dst, const W *a, const W *b, size_t nwords);  \
+    void bitmap##BITS##_or(W *dst, const W *a, const W *b, size_t nwords);   \
+    void bitmap##BITS##_andnot(W *dst, const W *a, const W *b,               \
+                               size_t nwords);
+
+BITMAP_DECLARE(32, uint32_t)
+BITMAP_DECLARE(64, uint64_t)
+
+
+/* The instruction sets that the kernels are specialized for.  Each one
+ * includes the ones before it.
+ */
+typedef enum BitmapIsa {
+    BITMAP_ISA_GENERIC,   /* Portable C. */
+    BITMAP_ISA_BMI2,      /* POPCNT, and PDEP for select. */
+    BITMAP_ISA_AVX2,      /* 256-bit AND, OR and ANDNOT. */
+    BITMAP_NUM_ISAS
+} BitmapIsa;
+
+
+int bitmap_isa_supported(BitmapIsa isa);
+BitmapIsa bitmap_get_isa(void);
+int bitmap_set_isa(BitmapIsa isa);
+const char * bitmap_isa_name(BitmapIsa isa);
+
+
+#endif /* BITMAP_H */
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "popcount.h"
+
+
+/*
+   A benchmark of the ways to count one-bits.  It counts the bits of large
+   arrays of random words, of sparse words with about one bit in 64 set, and
+   of dense words with every bit set, with each of:
+
+     - shift:  the loop in onebits.c, which looks at every bit of a number.
+     - clear:  the loop in faster_onebits.c, which clears the lowest set bit
+       until there are none, so it takes as long as there are set bits.
+     - table:  a lookup of each byte in a 256-entry table of counts.
+     - each version of popcount_array() that the CPU supports.
+
+   and prints how many billions of bits each one counts a second.
+*/
+
+
+/* How many bits the arrays have, if the command line doesn't say. */
+#define DEFAULT_MEGABITS 16
+
+/* How long each way is repeated for, in seconds. */
+#define MIN_SECONDS 0.1
+
+/* The ways of counting that aren't versions of popcount_array(). */
+#define METHOD_SHIFT  0
+#define METHOD_CLEAR  1
+#define METHOD_TABLE  2
+#define NUM_LOOPS     3
+
+static const char *loop_names[NUM_LOOPS] = { "shift", "clear", "table" };
+
+
+/* The count of one-bits in each byte. */
+static unsigned char byte_counts[256];
+
+
+/* Returns the current time in seconds. */
+static double get_seconds() {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/* The loop in onebits.c. */
+static int count_shift(unsigned int n) {
+    int count = 0;
+    while (n > 0) {
+        count += n & 1;
+        n = n >> 1;
+    }
+    return count;
+}
+
+
+/* The loop in faster_onebits.c. */
+static int count_clear(unsigned int n) {
+    int count = 0;
+    while (n > 0) {
+        n = n & (n - 1);
+        ++count;
+    }
+    return count;
+}
+
+
+/* Counts the bits of the array in one of the ways, shift, clear and table
+ * a 32-bit number at a time as the programs do, and popcount_array() on
+ * 64-bit words.
+ */
+static uint64_t count_bits(int method, const uint64_t *words, size_t n) {
+    const uint32_t *numbers = (const uint32_t *) words;
+    uint64_t count = 0;
+    uint32_t x;
+    size_t i;
+
+    switch (method) {
+    case METHOD_SHIFT:
+        for (i = 0; i < 2 * n; i++)
+            count += count_shift(numbers[i]);
+        return count;
+
+    case METHOD_CLEAR:
+        for (i = 0; i < 2 * n; i++)
+            count += count_clear(numbers[i]);
+        return count;
+
+    case METHOD_TABLE:
+        for (i = 0; i < 2 * n; i++) {
+            x = numbers[i];
+            count += byte_counts[x & 0xFF] + byte_counts[(x >> 8) & 0xFF] +
+                     byte_counts[(x >> 16) & 0xFF] + byte_counts[x >> 24];
+        }
+        return count;
+
+    default:
+        return popcount_array_with(method - NUM_LOOPS, words, n);
+    }
+}
+
+
+/* Repeats a way of counting until MIN_SECONDS have passed, stores its count
+ * in *count, and returns how many billion bits a second it counted.
+ */
+static double time_count(int method, const uint64_t *words, size_t n,
+                         uint64_t *count) {
+    double start = get_seconds(), seconds;
+    long reps = 0;
+
+    do {
+        *count = count_bits(method, words, n);
+        reps++;
+        seconds = get_seconds() - start;
+    } while (seconds < MIN_SECONDS);
+
+    return 64.0 * n * reps / seconds / 1e9;
+}
+
+
+/* Returns a random 64-bit word. */
+static uint64_t random_word() {
+    return ((uint64_t) rand() << 42) ^ ((uint64_t) rand() << 21) ^ rand();
+}
+
+
+int main(int argc, char **argv) {
+    static const char *set_names[3] = { "random", "sparse", "dense" };
+    uint64_t *words, count, expected;
+    size_t n, i;
+    int set, method;
+    double rate;
+
+    n = DEFAULT_MEGABITS;
+    if (argc > 2 || (argc == 2 && sscanf(argv[1], "%zu", &n) != 1) ||
+        n == 0) {
+        printf("usage:  %s [megabits]\n\n", argv[0]);
+        printf("\tTimes each way of counting one-bits over arrays of the\n"
+               "\tgiven number of millions of bits (default %d).\n\n",
+               DEFAULT_MEGABITS);
+        return 1;
+    }
+    n = n * (1 << 20) / 64;
+
+    words = malloc(n * sizeof(uint64_t));
+    if (!words) {
+        printf("ERROR:  couldn't allocate the array!\n");
+        return 1;
+    }
+
+    for (i = 0; i < 256; i++)
+        byte_counts[i] = count_clear(i);
+
+    printf("The best version of popcount_array() is %s.\n\n",
+           popcount_name(popcount_best()));
+    printf("    %-8s %-8s %10s\n", "array", "method", "Gbit/s");
+
+    for (set = 0; set < 3; set++) {
+        for (i = 0; i < n; i++) {
+            if (set == 0)
+                words[i] = random_word();
+            else if (set == 1)
+                words[i] = 1ULL << (random_word() % 64);
+            else
+                words[i] = ~0ULL;
+        }
+
+        expected = count_bits(METHOD_TABLE, words, n);
+        for (method = 0; method < NUM_LOOPS + POPCOUNT_NUM_IMPLS; method++) {
+            if (method >= NUM_LOOPS &&
+                !popcount_supported(method - NUM_LOOPS))
+                continue;
+
+            rate = time_count(method, words, n, &count);
+            printf("    %-8s %-8s %10.3f%s\n", set_names[set],
+                   method < NUM_LOOPS ? loop_names[method] :
+                                        popcount_name(method - NUM_LOOPS),
+                   rate, count == expected ? "" : "   WRONG COUNT");
+        }
+    }
+
+    free(words);
+    return 0;
+}
@@ -0,0 +1,219 @@
+#include "popcount.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define POPCOUNT_X86
+#include <immintrin.h>
+#endif
+
+
+/*
+   Counting the one-bits of whole arrays.
+
+   count_onebits() in onebits.c and faster_onebits.c loops over the bits of
+   one number, so it takes up to 32 iterations a number.  These functions
+   count the bits of an array of 64-bit words, with whichever of these the
+   CPU supports, picked the first time popcount_array() is called:
+
+     - The scalar version adds up the bits of a word in parallel, in 2-bit,
+       then 4-bit, then 8-bit fields, and sums the bytes with a multiply.
+
+     - The POPCNT instruction counts a word in one instruction.
+
+     - The AVX2 version looks up the count of each 4-bit nibble of 32 bytes
+       at once with VPSHUFB, in a 16-entry table (Wojciech Mula's method),
+       and adds the byte counts into 64-bit sums with VPSADBW.
+
+     - AVX-512 VPOPCNTDQ counts 8 words in one instruction.
+
+   The versions that need particular instructions are compiled for them with
+   the target attribute, so that the rest of the program needn't be, and are
+   only called when the CPU has the instructions.
+*/
+
+
+static const char *impl_names[POPCOUNT_NUM_IMPLS] = {
+    "scalar", "popcnt", "avx2", "avx512"
+};
+
+
+/* Counts the bits of a word by adding them up in ever wider fields. */
+static inline uint64_t popcount_word(uint64_t x) {
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (x * 0x0101010101010101ULL) >> 56;
+}
+
+
+static uint64_t popcount_scalar(const uint64_t *words, size_t n) {
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        count += popcount_word(words[i]);
+    return count;
+}
+
+
+#ifdef POPCOUNT_X86
+
+__attribute__((target("popcnt")))
+static uint64_t popcount_popcnt(const uint64_t *words, size_t n) {
+    uint64_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+    size_t i = 0;
+
+    /* Four sums, so that the additions don't wait on each other. */
+    for (; i + 4 <= n; i += 4) {
+        c0 += __builtin_popcountll(words[i]);
+        c1 += __builtin_popcountll(words[i + 1]);
+        c2 += __builtin_popcountll(words[i + 2]);
+        c3 += __builtin_popcountll(words[i + 3]);
+    }
+    for (; i < n; i++)
+        c0 += __builtin_popcountll(words[i]);
+
+    return c0 + c1 + c2 + c3;
+}
+
+
+/* How many vectors the AVX2 version adds up in bytes before the bytes could
+ * overflow:  each vector adds at most 8 to a byte.
+ */
+#define AVX2_BATCH 31
+
+__attribute__((target("avx2,popcnt")))
+static uint64_t popcount_avx2(const uint64_t *words, size_t n) {
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                           1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3,
+                                           1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0F);
+    __m256i total = _mm256_setzero_si256(), bytes, v, lo, hi;
+    uint64_t count, sums[4];
+    size_t i = 0, j, batch;
+
+    while (i + 4 <= n) {
+        batch = (n - i) / 4;
+        if (batch > AVX2_BATCH)
+            batch = AVX2_BATCH;
+
+        bytes = _mm256_setzero_si256();
+        for (j = 0; j < batch; j++, i += 4) {
+            v = _mm256_loadu_si256((const __m256i *) (words + i));
+            lo = _mm256_and_si256(v, low_mask);
+            hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+            bytes = _mm256_add_epi8(bytes, _mm256_shuffle_epi8(table, lo));
+            bytes = _mm256_add_epi8(bytes, _mm256_shuffle_epi8(table, hi));
+        }
+
+        /* Sum each 8 bytes into a 64-bit lane. */
+        total = _mm256_add_epi64(total,
+                    _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+    }
+
+    _mm256_storeu_si256((__m256i *) sums, total);
+    count = sums[0] + sums[1] + sums[2] + sums[3];
+
+    for (; i < n; i++)
+        count += __builtin_popcountll(words[i]);
+    return count;
+}
+
+
+__attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+static uint64_t popcount_avx512(const uint64_t *words, size_t n) {
+    __m512i total = _mm512_setzero_si512(), v;
+    uint64_t count;
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        v = _mm512_loadu_si512((const void *) (words + i));
+        total = _mm512_add_epi64(total, _mm512_popcnt_epi64(v));
+    }
+    count = _mm512_reduce_add_epi64(total);
+
+    for (; i < n; i++)
+        count += __builtin_popcountll(words[i]);
+    return count;
+}
+
+#endif /* POPCOUNT_X86 */
+
+
+/* Returns nonzero if the CPU can run the given version. */
+int popcount_supported(PopcountImpl impl) {
+#ifdef POPCOUNT_X86
+    __builtin_cpu_init();
+#endif
+
+    switch (impl) {
+    case POPCOUNT_SCALAR:
+        return 1;
+#ifdef POPCOUNT_X86
+    case POPCOUNT_POPCNT:
+        return __builtin_cpu_supports("popcnt");
+    case POPCOUNT_AVX2:
+        return __builtin_cpu_supports("avx2") &&
+               __builtin_cpu_supports("popcnt");
+    case POPCOUNT_AVX512:
+        return __builtin_cpu_supports("avx512f") &&
+               __builtin_cpu_supports("avx512vpopcntdq") &&
+               __builtin_cpu_supports("popcnt");
+#endif
+    default:
+        return 0;
+    }
+}
+
+
+/* Returns the fastest version that the CPU can run. */
+PopcountImpl popcount_best(void) {
+    if (popcount_supported(POPCOUNT_AVX512))
+        return POPCOUNT_AVX512;
+    if (popcount_supported(POPCOUNT_AVX2))
+        return POPCOUNT_AVX2;
+    if (popcount_supported(POPCOUNT_POPCNT))
+        return POPCOUNT_POPCNT;
+    return POPCOUNT_SCALAR;
+}
+
+
+/* Returns the name of a version, for printing. */
+const char * popcount_name(PopcountImpl impl) {
+    if (impl < 0 || impl >= POPCOUNT_NUM_IMPLS)
+        return "unknown";
+    return impl_names[impl];
+}
+
+
+/* Returns the number of one-bits in words[0..n-1], counted with the given
+ * version, which the CPU is assumed to support.
+ */
+uint64_t popcount_array_with(PopcountImpl impl, const uint64_t *words,
+                             size_t n) {
+    switch (impl) {
+#ifdef POPCOUNT_X86
+    case POPCOUNT_POPCNT:
+        return popcount_popcnt(words, n);
+    case POPCOUNT_AVX2:
+        return popcount_avx2(words, n);
+    case POPCOUNT_AVX512:
+        return popcount_avx512(words, n);
+#endif
+    default:
+        return popcount_scalar(words, n);
+    }
+}
+
+
+/* Returns the number of one-bits in words[0..n-1], counted with the fastest
+ * version that the CPU supports.
+ */
+uint64_t popcount_array(const uint64_t *words, size_t n) {
+    /* Threads that race to set this all set it to the same thing. */
+    static int best = -1;
+
+    if (best < 0)
+        best = popcount_best();
+    return popcount_array_with((PopcountImpl) best, words, n);
+}
@@ -0,0 +1,27 @@
+#ifndef POPCOUNT_H
+#define POPCOUNT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* The ways that popcount_array() can count the one-bits of an array. */
+typedef enum PopcountImpl {
+    POPCOUNT_SCALAR,   /* Portable bit-twiddling, a word at a time. */
+    POPCOUNT_POPCNT,   /* The POPCNT instruction, a word at a time. */
+    POPCOUNT_AVX2,     /* A 4-bit lookup table with AVX2, 4 words at a time. */
+    POPCOUNT_AVX512,   /* AVX-512 VPOPCNTDQ, 8 words at a time. */
+    POPCOUNT_NUM_IMPLS
+} PopcountImpl;
+
+
+uint64_t popcount_array(const uint64_t *words, size_t n);
+uint64_t popcount_array_with(PopcountImpl impl, const uint64_t *words,
+                             size_t n);
+
+int popcount_supported(PopcountImpl impl);
+PopcountImpl popcount_best(void);
+const char * popcount_name(PopcountImpl impl);
+
+
+#endif /* POPCOUNT_H */
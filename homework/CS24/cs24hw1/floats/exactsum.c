@@ -0,0 +1,328 @@
+#include "exactsum.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+/*
+   Exact summation with a superaccumulator.
+
+   Every float is an integer times a power of two:  m * 2^(e - 150), where e
+   is the biased exponent (1 for denormals) and m is the 24-bit significand,
+   with its hidden bit.  So the sum of any floats is an integer number of
+   units of 2^-149, the smallest denormal, and a fixed-point number with
+   enough bits to hold the largest float's bits plus room for the carries
+   of 2^31 additions holds the sum exactly.  The sum is rounded to a float
+   only once, at the very end, so it is the correctly rounded sum of the
+   values, whatever order they come in.
+
+   Shifting every float into a 300-bit number would be slow, though, so the
+   floats are first added up by exponent:  bins[e] holds the sum of the
+   signed significands of the values with exponent e, which fits in 64 bits
+   for up to 2^39 values.  Splitting a float into its exponent and
+   significand is done 4 floats at a time with SSE2, and the floats go into
+   4 separate sets of bins, so that neighboring values with the same exponent
+   don't wait on each other's additions.  Only once all the values have been
+   binned are the 254 bins shifted into the superaccumulator.
+*/
+
+
+/* The number of 32-bit digits of the superaccumulator.  The values span
+ * 2^-149 up to 2^128, which is 277 bits, and the carries need 31 more.
+ */
+#define ACC_DIGITS 10
+
+/* How many values a thread takes at a time. */
+#define EXACT_CHUNK 65536
+
+/* How many separate sets of bins the values are spread over. */
+#define BIN_SETS 4
+
+
+/* The bins of one thread, by exponent, and whether it has seen an infinity
+ * or a NaN, which go in bin 255 and have to be handled on their own.
+ */
+typedef struct Bins {
+    long long bins[BIN_SETS][256];
+    int special;
+} Bins;
+
+
+/* The work that exact_fsum() shares among its threads. */
+typedef struct ExactJob {
+    const float *values;
+    int count;
+    int num_chunks;
+
+    Bins *thread_bins;   /* The bins of each thread. */
+
+    int next_thread;     /* The index of the next thread to start. */
+    int next_chunk;      /* The first chunk that no thread has taken yet. */
+} ExactJob;
+
+
+/* Adds count values into the bins. */
+static void bin_values(const float *values, int count, Bins *b) {
+    unsigned int bits;
+    int i = 0, e, m, j;
+
+#ifdef __SSE2__
+    __m128i exp_mask = _mm_set1_epi32(0xFF);
+    __m128i frac_mask = _mm_set1_epi32(0x7FFFFF);
+    __m128i hidden = _mm_set1_epi32(0x800000);
+    __m128i one = _mm_set1_epi32(1);
+    __m128i special = _mm_setzero_si128();
+    int exps[4], sigs[4];
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (values + i));
+        __m128i ev = _mm_and_si128(_mm_srli_epi32(v, 23), exp_mask);
+        __m128i denormal = _mm_cmpeq_epi32(ev, _mm_setzero_si128());
+        __m128i sign = _mm_srai_epi32(v, 31);
+
+        /* m = the fraction, with the hidden bit unless it's a denormal,
+         * whose exponent is 1 rather than 0.  Then negate m if the sign bit
+         * is set:  (m ^ -1) - -1 == -m.
+         */
+        __m128i mv = _mm_or_si128(_mm_and_si128(v, frac_mask),
+                                  _mm_andnot_si128(denormal, hidden));
+        mv = _mm_sub_epi32(_mm_xor_si128(mv, sign), sign);
+        ev = _mm_add_epi32(ev, _mm_and_si128(denormal, one));
+
+        special = _mm_or_si128(special, _mm_cmpeq_epi32(ev, exp_mask));
+
+        _mm_storeu_si128((__m128i *) exps, ev);
+        _mm_storeu_si128((__m128i *) sigs, mv);
+        for (j = 0; j < 4; j++)
+            b->bins[j][exps[j]] += sigs[j];
+    }
+
+    if (_mm_movemask_epi8(special) != 0)
+        b->special = 1;
+#endif
+
+    for (; i < count; i++) {
+        memcpy(&bits, &values[i], sizeof(bits));
+        e = (bits >> 23) & 0xFF;
+        m = bits & 0x7FFFFF;
+        if (e == 0)
+            e = 1;
+        else
+            m |= 0x800000;
+        if (e == 0xFF)
+            b->special = 1;
+        b->bins[i % BIN_SETS][e] += (bits >> 31) ? -m : m;
+    }
+}
+
+
+/* The body of each thread in the pool:  takes chunks of values from the job
+ * until there are none left, and adds them into the thread's own bins.
+ */
+static void * bin_chunks_thread(void *arg) {
+    ExactJob *job = arg;
+    Bins *b = &job->thread_bins[__sync_fetch_and_add(&job->next_thread, 1)];
+    int chunk, first, count;
+
+    while (1) {
+        chunk = __sync_fetch_and_add(&job->next_chunk, 1);
+        if (chunk >= job->num_chunks)
+            break;
+
+        first = chunk * EXACT_CHUNK;
+        count = job->count - first;
+        if (count > EXACT_CHUNK)
+            count = EXACT_CHUNK;
+        bin_values(job->values + first, count, b);
+    }
+
+    return NULL;
+}
+
+
+/* Adds value * 2^shift to the superaccumulator.  Each digit of acc holds 32
+ * bits of the sum, but as a signed 64-bit value, so that carries can wait
+ * until the end.
+ */
+static void acc_add(long long *acc, long long value, int shift) {
+    int k = shift / 32, s = shift % 32;
+    long long lo = value & 0xFFFFFFFF;     /* value == lo + hi * 2^32 */
+    long long hi = (value - lo) / 4294967296LL;
+    long long part;
+
+    /* lo * 2^s has at most 63 bits, and hi * 2^s at most 56 and its sign. */
+    part = lo << s;
+    acc[k] += part & 0xFFFFFFFF;
+    acc[k + 1] += part >> 32;
+
+    part = hi * (1LL << s);
+    acc[k + 1] += part & 0xFFFFFFFF;
+    acc[k + 2] += (part - (part & 0xFFFFFFFF)) / 4294967296LL;
+}
+
+
+/* Propagates the carries of the superaccumulator, so that every digit but
+ * the top one is in [0, 2^32).
+ */
+static void acc_normalize(long long *acc) {
+    long long carry;
+    int i;
+
+    for (i = 0; i < ACC_DIGITS - 1; i++) {
+        carry = (acc[i] - (acc[i] & 0xFFFFFFFF)) / 4294967296LL;
+        acc[i] &= 0xFFFFFFFF;
+        acc[i + 1] += carry;
+    }
+}
+
+
+/* Returns bit pos of the (normalized, nonnegative) superaccumulator. */
+static int acc_bit(const long long *acc, int pos) {
+    if (pos < 0)
+        return 0;
+    return (acc[pos / 32] >> (pos % 32)) & 1;
+}
+
+
+/* Returns nonzero if any bit of the superaccumulator below pos is set. */
+static int acc_any_below(const long long *acc, int pos) {
+    int i;
+
+    if (pos <= 0)
+        return 0;
+    for (i = 0; i < pos / 32; i++) {
+        if (acc[i] != 0)
+            return 1;
+    }
+    return (acc[pos / 32] & ((1LL << (pos % 32)) - 1)) != 0;
+}
+
+
+/* Rounds the sum in the superaccumulator, in units of 2^-149, to the
+ * nearest float, with ties to even, as adding would.
+ */
+static float acc_round(long long *acc) {
+    int negative = 0, top, i, pos;
+    unsigned int mant;
+    float result;
+
+    acc_normalize(acc);
+    if (acc[ACC_DIGITS - 1] < 0) {
+        negative = 1;
+        for (i = 0; i < ACC_DIGITS; i++)
+            acc[i] = -acc[i];
+        acc_normalize(acc);
+    }
+
+    for (top = ACC_DIGITS - 1; top >= 0 && acc[top] == 0; top--)
+        ;
+    if (top < 0)
+        return 0.0f;
+
+    /* pos is the highest set bit. */
+    pos = 32 * top + 31;
+    while (!acc_bit(acc, pos))
+        pos--;
+
+    if (pos < 24) {
+        /* Fewer than 24 bits, so it's exact, as a denormal or not. */
+        result = ldexpf((float) acc[0], -149);
+    }
+    else {
+        mant = 0;
+        for (i = pos; i > pos - 24; i--)
+            mant = (mant << 1) | acc_bit(acc, i);
+
+        /* Round half to even on the bits below the 24 that are kept. */
+        if (acc_bit(acc, pos - 24) &&
+            (acc_any_below(acc, pos - 24) || (mant & 1)))
+            mant++;
+
+        result = ldexpf((float) mant, pos - 23 - 149);
+    }
+
+    return negative ? -result : result;
+}
+
+
+/* Returns the sum of a float array, exactly rounded:  the float nearest to
+ * the true sum of the values, which doesn't depend on their order.  The
+ * values are binned in chunks on num_threads threads, or one per CPU if
+ * num_threads is 0.  As with adding them up, an infinity makes the sum
+ * infinite, and a NaN, or infinities of both signs, make it NaN.
+ */
+float exact_fsum(FloatArray *floats, int num_threads) {
+    ExactJob job;
+    pthread_t *threads;
+    long long acc[ACC_DIGITS];
+    int i, j, e, special = 0, pos_inf = 0, neg_inf = 0, nan = 0;
+
+    if (num_threads <= 0)
+        num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    job.values = floats->values;
+    job.count = floats->count;
+    job.num_chunks = (floats->count + EXACT_CHUNK - 1) / EXACT_CHUNK;
+    job.next_thread = 0;
+    job.next_chunk = 0;
+
+    if (num_threads > job.num_chunks)
+        num_threads = job.num_chunks > 0 ? job.num_chunks : 1;
+
+    job.thread_bins = calloc(num_threads, sizeof(Bins));
+    threads = malloc(num_threads * sizeof(pthread_t));
+    if (job.thread_bins == NULL || threads == NULL) {
+        printf("ERROR:  couldn't allocate the threads' bins!\n");
+        exit(1);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, bin_chunks_thread, &job) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    for (i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    /* Shift every bin into the superaccumulator.  A bin of exponent e is in
+     * units of 2^(e - 150), which is 2^(e - 1) units of 2^-149.
+     */
+    memset(acc, 0, sizeof(acc));
+    for (i = 0; i < num_threads; i++) {
+        special |= job.thread_bins[i].special;
+        for (j = 0; j < BIN_SETS; j++) {
+            for (e = 1; e < 255; e++) {
+                if (job.thread_bins[i].bins[j][e] != 0)
+                    acc_add(acc, job.thread_bins[i].bins[j][e], e - 1);
+            }
+        }
+    }
+
+    free(job.thread_bins);
+    free(threads);
+
+    /* Infinities and NaNs don't have a place in the superaccumulator. */
+    if (special) {
+        for (i = 0; i < floats->count; i++) {
+            if (isnan(floats->values[i]))
+                nan = 1;
+            else if (isinf(floats->values[i]) && floats->values[i] > 0)
+                pos_inf = 1;
+            else if (isinf(floats->values[i]))
+                neg_inf = 1;
+        }
+        if (nan || (pos_inf && neg_inf))
+            return NAN;
+        return pos_inf ? INFINITY : -INFINITY;
+    }
+
+    return acc_round(acc);
+}
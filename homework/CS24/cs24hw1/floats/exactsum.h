@@ -0,0 +1,10 @@
+#ifndef EXACTSUM_H
+#define EXACTSUM_H
+
+#include "ffunc.h"
+
+
+float exact_fsum(FloatArray *floats, int num_threads);
+
+
+#endif /* EXACTSUM_H */
@@ -4,58 +4,348 @@
 #include <string.h>
 #include <assert.h>
 #include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
-/* Load a sequence of floating-point values from the specified
- * input file.  The format must be as follows:
- *     Line 1:       Number of values N
- *     Line 2..N+1:  The floating-point values themselves
+/* How many values load_floats() makes room for at first; the array grows
+ * geometrically from there, up to the count that the input gives.
+ */
+#define INITIAL_CAPACITY 65536
+
+/* How much load_floats() reads at a time from an input that can't be
+ * mapped into memory.
+ */
+#define READ_BLOCK (1 << 20)
+
+
+/* The powers of ten that are exactly representable as doubles. */
+static const double powers_of_10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+/* Returns nonzero if c is a whitespace character, as scanf() sees them. */
+static int is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' ||
+           c == '\v' || c == '\f';
+}
+
+
+/* Parses the float at *p, which mustn't go past end, into *value, and
+ * moves *p past it.  Returns 0 if there isn't a float there.
  *
- * The values themselves are stored into the specified FloatArray
- * struct, which functions as an in/out parameter.
+ * The usual decimal form, with up to 19 digits and a power of ten that a
+ * double holds exactly, is converted by hand:  the digits as an integer,
+ * times or divided by the power of ten, is the correctly rounded double, and
+ * rounding that to a float is the correctly rounded float, unless the double
+ * falls exactly halfway between two floats.  That case, and anything else
+ * (more digits, huge exponents, inf and nan, hexadecimal floats), is left to
+ * strtof(), so the values are always the same as scanf("%f") would read.
  */
-void load_floats(FILE *input, FloatArray *floats) {
-    int count, i;
-    float value;
+static int parse_float(const char **p, const char *end, float *value) {
+    const char *s = *p, *start;
+    unsigned long long digits = 0;
+    int num_digits = 0, exponent = 0, exp_value = 0, exp_sign = 1;
+    int negative = 0, any = 0, ok;
+    double d, back, other;
+    float f;
+    char buf[64], *copy = buf, *stop;
 
-    assert(input != NULL);
-    assert(floats != NULL);
+    while (s < end && is_space(*s))
+        s++;
+    start = s;
+
+    if (s < end && (*s == '-' || *s == '+')) {
+        negative = (*s == '-');
+        s++;
+    }
+
+    while (s < end && *s >= '0' && *s <= '9') {
+        if (num_digits < 19) {
+            digits = 10 * digits + (*s - '0');
+            if (digits != 0)
+                num_digits++;
+        }
+        else {
+            exponent++;
+            num_digits++;
+        }
+        any = 1;
+        s++;
+    }
+    if (s < end && *s == '.') {
+        s++;
+        while (s < end && *s >= '0' && *s <= '9') {
+            if (num_digits < 19) {
+                digits = 10 * digits + (*s - '0');
+                exponent--;
+                if (digits != 0)
+                    num_digits++;
+            }
+            else {
+                num_digits++;
+            }
+            any = 1;
+            s++;
+        }
+    }
+    if (any && s < end && (*s == 'e' || *s == 'E')) {
+        const char *e = s + 1;
+
+        if (e < end && (*e == '-' || *e == '+')) {
+            exp_sign = (*e == '-') ? -1 : 1;
+            e++;
+        }
+        if (e < end && *e >= '0' && *e <= '9') {
+            while (e < end && *e >= '0' && *e <= '9') {
+                if (exp_value < 10000)
+                    exp_value = 10 * exp_value + (*e - '0');
+                e++;
+            }
+            exponent += exp_sign * exp_value;
+            s = e;
+        }
+    }
+
+    if (any && num_digits <= 19 && digits < (1ULL << 53) &&
+        exponent >= -22 && exponent <= 22 &&
+        !(s < end && (*s == 'x' || *s == 'X' || *s == '.'))) {
+        d = (double) digits;
+        if (exponent >= 0)
+            d *= powers_of_10[exponent];
+        else
+            d /= powers_of_10[-exponent];
+
+        f = (float) d;
+        back = f;
+        if (d != back) {
+            other = nextafterf(f, d > back ? INFINITY : -INFINITY);
+            if ((back + other) / 2 == d)
+                any = 0;    /* Exactly halfway; let strtof() round it. */
+        }
+
+        if (any) {
+            *value = negative ? -f : f;
+            *p = s;
+            return 1;
+        }
+    }
+
+    /* The slow path:  strtof() needs a terminated copy of the number.  The
+     * whole token is copied, however long it is, so that strtof() sees every
+     * digit that scanf() would.
+     */
+    s = start;
+    while (s < end && !is_space(*s))
+        s++;
+    if (s == start)
+        return 0;
+
+    if (s - start >= (long) sizeof(buf)) {
+        copy = malloc(s - start + 1);
+        if (copy == NULL) {
+            printf("ERROR:  couldn't allocate %ld bytes!\n",
+                   (long) (s - start + 1));
+            exit(1);
+        }
+    }
+
+    memcpy(copy, start, s - start);
+    copy[s - start] = '\0';
+    *value = strtof(copy, &stop);
+    ok = (stop != copy);
+    if (ok)
+        *p = start + (stop - copy);
 
-    if (fscanf(input, "%d", &count) != 1) {
+    if (copy != buf)
+        free(copy);
+    return ok;
+}
+
+
+/* Loads the floats of the text format from memory:  the count, then the
+ * values.  Returns how many bytes were used.
+ */
+static size_t load_text(const char *data, size_t size, FloatArray *floats) {
+    const char *p = data, *end = data + size;
+    long count = 0;
+    int i, capacity, any = 0;
+    float *values;
+
+    while (p < end && is_space(*p))
+        p++;
+    if (p < end && *p == '+')
+        p++;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (count <= 0x7FFFFFFF)
+            count = 10 * count + (*p - '0');
+        any = 1;
+        p++;
+    }
+    if (!any || (p < end && *p == '-')) {
         printf("Error:  couldn't read count from input list\n");
         exit(1);
     }
 
-    if (count <= 0) {
-        printf("ERROR:  count must be positive; got %d\n", count);
+    if (count <= 0 || count > 0x7FFFFFFF) {
+        printf("ERROR:  count must be positive; got %ld\n", count);
         exit(1);
     }
 
-    float *values = malloc(count * sizeof(float));
+    capacity = count < INITIAL_CAPACITY ? count : INITIAL_CAPACITY;
+    values = malloc(capacity * sizeof(float));
     if (values == NULL) {
         printf("ERROR:  couldn't allocate %ld bytes!\n",
-               count * sizeof(float));
+               capacity * sizeof(float));
         exit(1);
     }
 
-    /* Zero out the newly allocated memory. */
-    memset(values, 0, count * sizeof(float));
-
-    /* Load each floating-point value into its corresponding location
-     * in the array.
-     */
     for (i = 0; i < count; i++) {
-        if (fscanf(input, "%f", &value) != 1) {
+        if (i == capacity) {
+            capacity = capacity > count / 2 ? count : 2 * capacity;
+            values = realloc(values, capacity * sizeof(float));
+            if (values == NULL) {
+                printf("ERROR:  couldn't allocate %ld bytes!\n",
+                       capacity * sizeof(float));
+                exit(1);
+            }
+        }
+
+        if (!parse_float(&p, end, &values[i])) {
             printf("ERROR:  couldn't read a value from input list\n");
             exit(1);
         }
-
-        values[i] = value;
     }
 
-    /* Finally, store the loaded values into the passed-in struct. */
     floats->count = count;
     floats->values = values;
+    return p - data;
+}
+
+
+/* Loads the floats of the binary format from memory:  the magic number, the
+ * count, then the values.  Returns how many bytes were used.
+ */
+static size_t load_binary(const char *data, size_t size, FloatArray *floats) {
+    int count;
+
+    memcpy(&count, data + 4, sizeof(int));
+    if (count <= 0) {
+        printf("ERROR:  count must be positive; got %d\n", count);
+        exit(1);
+    }
+    if ((size - 8) / sizeof(float) < count) {
+        printf("ERROR:  couldn't read a value from input list\n");
+        exit(1);
+    }
+
+    floats->values = malloc(count * sizeof(float));
+    if (floats->values == NULL) {
+        printf("ERROR:  couldn't allocate %ld bytes!\n",
+               count * sizeof(float));
+        exit(1);
+    }
+    memcpy(floats->values, data + 8, count * sizeof(float));
+    floats->count = count;
+
+    return 8 + count * sizeof(float);
+}
+
+
+/* Loads the floats from memory, in whichever format they are in. */
+static size_t load_data(const char *data, size_t size, FloatArray *floats) {
+    if (size >= 8 && memcmp(data, FLOATS_MAGIC, 4) == 0)
+        return load_binary(data, size, floats);
+    return load_text(data, size, floats);
+}
+
+
+/* Load a sequence of floating-point values from the specified
+ * input file.  The format must be as follows:
+ *     Line 1:       Number of values N
+ *     Line 2..N+1:  The floating-point values themselves
+ *
+ * or else the binary format that save_floats() writes.
+ *
+ * The values themselves are stored into the specified FloatArray
+ * struct, which functions as an in/out parameter.
+ *
+ * Rather than reading the input a value at a time with fscanf(), the input
+ * is mapped into memory if it's a file, or read in large blocks if it
+ * isn't, and the values are parsed straight out of memory.  A file is left
+ * positioned just after the values, so that whatever follows them can still
+ * be read; from a pipe, everything is read.
+ */
+void load_floats(FILE *input, FloatArray *floats) {
+    struct stat st;
+    off_t offset;
+    char *data;
+    size_t size, capacity, used;
+    ssize_t n;
+
+    assert(input != NULL);
+    assert(floats != NULL);
+
+    offset = ftello(input);
+    if (fstat(fileno(input), &st) == 0 && S_ISREG(st.st_mode) &&
+        offset >= 0 && st.st_size > offset) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                    fileno(input), 0);
+        if (data != MAP_FAILED) {
+            used = load_data(data + offset, st.st_size - offset, floats);
+            munmap(data, st.st_size);
+            fseeko(input, offset + used, SEEK_SET);
+            return;
+        }
+    }
+
+    /* Read whatever is left of the input, a block at a time, starting with
+     * anything that the FILE has already buffered.
+     */
+    capacity = READ_BLOCK;
+    size = 0;
+    data = malloc(capacity);
+    while (data != NULL) {
+        if (size == capacity) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+            if (data == NULL)
+                break;
+        }
+        n = fread(data + size, 1, capacity - size, input);
+        if (n <= 0)
+            break;
+        size += n;
+    }
+    if (data == NULL) {
+        printf("ERROR:  couldn't allocate %ld bytes!\n", (long) capacity);
+        exit(1);
+    }
+
+    load_data(data, size, floats);
+    free(data);
+}
+
+
+/* Saves the floats to the output file in the binary format:  the 4
+ * characters of FLOATS_MAGIC, the count as an int, and then the floats, all
+ * in the machine's own byte order.  load_floats() reads this format back
+ * without any parsing at all.
+ */
+void save_floats(FILE *output, FloatArray *floats) {
+    assert(output != NULL);
+    assert(floats != NULL);
+
+    if (fwrite(FLOATS_MAGIC, 1, 4, output) != 4 ||
+        fwrite(&floats->count, sizeof(int), 1, output) != 1 ||
+        fwrite(floats->values, sizeof(float), floats->count, output) !=
+            floats->count) {
+        perror("fwrite");
+        exit(1);
+    }
 }
 
 
@@ -93,20 +383,106 @@ int cmp_dec_fmag(const void *pf1, const void *pf2) {
 }
 
 
+/* Below this many values, radix_sort_mag() is no faster than qsort(). */
+#define RADIX_MIN_COUNT 256
+
+
+/* Returns the key that radix_sort_mag() sorts a float by.  Dropping the sign
+ * bit leaves the exponent and the significand, and for floats that aren't
+ * NaNs, those bits read as an unsigned integer are in the same order as the
+ * magnitudes of the floats.  For decreasing magnitude, the key is inverted.
+ */
+static unsigned int mag_key(float f, int decreasing) {
+    unsigned int bits;
+
+    memcpy(&bits, &f, sizeof(bits));
+    bits &= 0x7FFFFFFF;
+    return decreasing ? 0x7FFFFFFF - bits : bits;
+}
+
+
+/* This helper function sorts the float-array by magnitude, increasing or
+ * decreasing, with a least-significant-digit radix sort on the bits of the
+ * floats.  Each of the four passes is a stable counting sort on one byte of
+ * the keys, from the lowest byte to the highest; the counts of all four
+ * bytes are taken in one pass over the floats first, and a pass is skipped
+ * if every float has the same value of that byte.  There are no comparisons
+ * at all, and the sort takes O(n) time.
+ */
+static void radix_sort_mag(FloatArray *floats, int decreasing) {
+    static int counts[4][256];
+    float *from = floats->values, *to, *tmp;
+    int n = floats->count;
+    int i, pass, byte, pos, c;
+    unsigned int key;
+
+    to = malloc(n * sizeof(float));
+    if (to == NULL) {
+        printf("ERROR:  couldn't allocate %ld bytes!\n", n * sizeof(float));
+        exit(1);
+    }
+
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < n; i++) {
+        key = mag_key(from[i], decreasing);
+        for (pass = 0; pass < 4; pass++)
+            counts[pass][(key >> (8 * pass)) & 0xFF]++;
+    }
+
+    for (pass = 0; pass < 4; pass++) {
+        /* If every key has the same byte, the pass wouldn't move anything. */
+        if (counts[pass][(mag_key(from[0], decreasing) >> (8 * pass)) & 0xFF]
+            == n)
+            continue;
+
+        /* Turn the counts into where each byte value's floats start. */
+        pos = 0;
+        for (byte = 0; byte < 256; byte++) {
+            c = counts[pass][byte];
+            counts[pass][byte] = pos;
+            pos += c;
+        }
+
+        for (i = 0; i < n; i++) {
+            key = mag_key(from[i], decreasing);
+            to[counts[pass][(key >> (8 * pass)) & 0xFF]++] = from[i];
+        }
+
+        tmp = from;
+        from = to;
+        to = tmp;
+    }
+
+    /* After an odd number of passes, the sorted floats are in the buffer. */
+    if (from != floats->values) {
+        memcpy(floats->values, from, n * sizeof(float));
+        to = from;
+    }
+    free(to);
+}
+
+
 /* This helper function sorts the input float-array by increasing magnitude,
- * using the qsort() utility function and the cmp_inc_fmag comparison function.
+ * using radix_sort_mag(), or for only a few values, the qsort() utility
+ * function and the cmp_inc_fmag comparison function.
  */
 void sort_incmag(FloatArray *floats) {
     assert(floats != NULL);
-    qsort(floats->values, floats->count, sizeof(float), cmp_inc_fmag);
+    if (floats->count < RADIX_MIN_COUNT)
+        qsort(floats->values, floats->count, sizeof(float), cmp_inc_fmag);
+    else
+        radix_sort_mag(floats, 0);
 }
 
 
 /* This helper function sorts the input float-array by decreasing magnitude,
- * using the qsort() utility function and the cmp_dec_fmag comparison function.
+ * using radix_sort_mag(), or for only a few values, the qsort() utility
+ * function and the cmp_dec_fmag comparison function.
  */
 void sort_decmag(FloatArray *floats) {
     assert(floats != NULL);
-    qsort(floats->values, floats->count, sizeof(float), cmp_dec_fmag);
+    if (floats->count < RADIX_MIN_COUNT)
+        qsort(floats->values, floats->count, sizeof(float), cmp_dec_fmag);
+    else
+        radix_sort_mag(floats, 1);
 }
-
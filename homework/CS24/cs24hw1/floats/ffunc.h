@@ -14,7 +14,12 @@ typedef struct FloatArray {
 } FloatArray;
 
 
+/* The first 4 bytes of the binary format of save_floats(). */
+#define FLOATS_MAGIC "FLTB"
+
+
 void load_floats(FILE *input, FloatArray *floats);
+void save_floats(FILE *output, FloatArray *floats);
 
 void sort_incmag(FloatArray *floats);
 void sort_decmag(FloatArray *floats);
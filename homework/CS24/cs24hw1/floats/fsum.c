@@ -3,8 +3,27 @@
 #include <string.h>
 #include <assert.h>
 #include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 #include "ffunc.h"
+#include "exactsum.h"
+
+
+/* How many vectors of 4 floats simd_fsum() keeps separate sums in. */
+#define SUM_VECTORS 4
+#define SUM_LANES (4 * SUM_VECTORS)
+
+/* How many values pairwise_fsum() sums in order, rather than in halves. */
+#define PAIRWISE_BLOCK 128
+
+/* How many values parallel_fsum() gives a thread at a time. */
+#define SUM_CHUNK 65536
 
 
 /* This function takes an array of single-precision floating point values,
@@ -49,13 +68,298 @@ float my_fsum(FloatArray *floats) {
 }
 
 
-int main() {
-    FloatArray floats;
-    float sum1, sum2, sum3, my_sum;
+/*
+   Kahan summation is one long chain of dependent additions, so it runs at the
+   latency of four floating-point operations per value.  This version uses
+   Neumaier's variant of it, which also keeps the correction when the value
+   being added is bigger than the sum so far, in SUM_LANES independent lanes:
+   lane k sums the values k, k + SUM_LANES, k + 2 * SUM_LANES, and so on.
+   The lanes are SSE vectors, so each step adds SUM_LANES values at once, and
+   the chains of the SUM_VECTORS vectors overlap each other in the pipeline.
+   The branch of Neumaier's update is done with a compare mask in each lane.
+   Finally the sums and corrections of the lanes, and the few values left
+   over at the end, are combined in double precision.  simd_sum_range() sums
+   count values this way, and returns the sum as a double.
+*/
+static double simd_sum_range(const float *values, int count) {
+    float sums[SUM_LANES], corrections[SUM_LANES];
+    double total = 0.0, c = 0.0, t, x;
+    int i = 0, j;
+
+#ifdef __SSE__
+    __m128 s[SUM_VECTORS], comp[SUM_VECTORS];
+    __m128 sign = _mm_set1_ps(-0.0f);
+
+    for (j = 0; j < SUM_VECTORS; j++) {
+        s[j] = _mm_setzero_ps();
+        comp[j] = _mm_setzero_ps();
+    }
+
+    for (; i + SUM_LANES <= count; i += SUM_LANES) {
+        for (j = 0; j < SUM_VECTORS; j++) {
+            __m128 v = _mm_loadu_ps(values + i + 4 * j);
+            __m128 sum = _mm_add_ps(s[j], v);
+
+            /* Where |s| >= |v|, the low bits of v were lost, and otherwise
+             * the low bits of s were.
+             */
+            __m128 s_bigger = _mm_cmpge_ps(_mm_andnot_ps(sign, s[j]),
+                                           _mm_andnot_ps(sign, v));
+            __m128 lost_v = _mm_add_ps(_mm_sub_ps(s[j], sum), v);
+            __m128 lost_s = _mm_add_ps(_mm_sub_ps(v, sum), s[j]);
+
+            comp[j] = _mm_add_ps(comp[j],
+                                 _mm_or_ps(_mm_and_ps(s_bigger, lost_v),
+                                           _mm_andnot_ps(s_bigger, lost_s)));
+            s[j] = sum;
+        }
+    }
+
+    for (j = 0; j < SUM_VECTORS; j++) {
+        _mm_storeu_ps(sums + 4 * j, s[j]);
+        _mm_storeu_ps(corrections + 4 * j, comp[j]);
+    }
+#else
+    for (j = 0; j < SUM_LANES; j++) {
+        sums[j] = 0.0;
+        corrections[j] = 0.0;
+    }
+
+    for (; i + SUM_LANES <= count; i += SUM_LANES) {
+        for (j = 0; j < SUM_LANES; j++) {
+            float v = values[i + j], sum = sums[j] + v;
+
+            if (fabsf(sums[j]) >= fabsf(v))
+                corrections[j] += (sums[j] - sum) + v;
+            else
+                corrections[j] += (v - sum) + sums[j];
+            sums[j] = sum;
+        }
+    }
+#endif
+
+    /* Combine the lanes and the rest of the values, with Neumaier's
+     * algorithm again.
+     */
+    for (j = 0; j < 2 * SUM_LANES + count - i; j++) {
+        if (j < SUM_LANES)
+            x = sums[j];
+        else if (j < 2 * SUM_LANES)
+            x = corrections[j - SUM_LANES];
+        else
+            x = values[i + j - 2 * SUM_LANES];
+
+        t = total + x;
+        if (fabs(total) >= fabs(x))
+            c += (total - t) + x;
+        else
+            c += (x - t) + total;
+        total = t;
+    }
+
+    return total + c;
+}
+
+
+float simd_fsum(FloatArray *floats) {
+    return (float) simd_sum_range(floats->values, floats->count);
+}
+
+
+/*
+   Pairwise (cascade) summation:  the values are split in half, each half is
+   summed the same way, and the two sums are added.  Each value is only part
+   of O(log n) additions, instead of up to n of them in fsum(), so the error
+   grows with log n instead of n.  Below PAIRWISE_BLOCK values, the recursion
+   would cost more than it saves, so short runs are summed in order.
+*/
+static float pairwise_sum_range(const float *values, int count) {
+    float sum = 0;
+    int i, half;
+
+    if (count <= PAIRWISE_BLOCK) {
+        for (i = 0; i < count; i++)
+            sum += values[i];
+        return sum;
+    }
+
+    half = count / 2;
+    return pairwise_sum_range(values, half) +
+           pairwise_sum_range(values + half, count - half);
+}
+
+
+float pairwise_fsum(FloatArray *floats) {
+    return pairwise_sum_range(floats->values, floats->count);
+}
+
+
+/* The work that parallel_fsum() shares among its threads. */
+typedef struct SumJob {
+    const float *values;
+    int count;
+
+    int num_chunks;
+    double *chunk_sums;   /* The sum of each chunk. */
+
+    int next_chunk;       /* The first chunk that no thread has taken yet. */
+} SumJob;
+
+
+/* The body of each thread of parallel_fsum():  takes chunks from the job
+ * until there are none left, and sums each one.
+ */
+static void * sum_chunks_thread(void *arg) {
+    SumJob *job = arg;
+    int chunk, first, count;
+
+    while (1) {
+        chunk = __sync_fetch_and_add(&job->next_chunk, 1);
+        if (chunk >= job->num_chunks)
+            break;
+
+        first = chunk * SUM_CHUNK;
+        count = job->count - first;
+        if (count > SUM_CHUNK)
+            count = SUM_CHUNK;
+        job->chunk_sums[chunk] = simd_sum_range(job->values + first, count);
+    }
+
+    return NULL;
+}
+
+
+/*
+   A multithreaded sum:  the values are split into chunks of SUM_CHUNK
+   values, which the threads take one at a time and sum with
+   simd_sum_range().  The chunks don't depend on how many threads there are,
+   and the sums of the chunks are always combined in the same order, with
+   Neumaier's algorithm, so the result is the same however many threads
+   there are and whichever thread summed which chunk.  num_threads is the
+   number of threads to use, or 0 for one per CPU.
+*/
+float parallel_fsum(FloatArray *floats, int num_threads) {
+    SumJob job;
+    pthread_t *threads;
+    double total = 0.0, c = 0.0, t, x;
+    int i;
+
+    if (num_threads <= 0)
+        num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    job.values = floats->values;
+    job.count = floats->count;
+    job.num_chunks = (floats->count + SUM_CHUNK - 1) / SUM_CHUNK;
+    job.next_chunk = 0;
+
+    if (num_threads > job.num_chunks)
+        num_threads = job.num_chunks > 0 ? job.num_chunks : 1;
+
+    job.chunk_sums = malloc(job.num_chunks * sizeof(double) + 1);
+    threads = malloc(num_threads * sizeof(pthread_t));
+    if (job.chunk_sums == NULL || threads == NULL) {
+        printf("ERROR:  couldn't allocate the threads' sums!\n");
+        exit(1);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, sum_chunks_thread, &job) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    for (i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    for (i = 0; i < job.num_chunks; i++) {
+        x = job.chunk_sums[i];
+        t = total + x;
+        if (fabs(total) >= fabs(x))
+            c += (total - t) + x;
+        else
+            c += (x - t) + total;
+        total = t;
+    }
+
+    free(job.chunk_sums);
+    free(threads);
+
+    return (float) (total + c);
+}
+
+
+/* Returns the current time in seconds. */
+static double get_seconds() {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/* Sums the floats with the method'th summation function, returning the sum
+ * in *sum, and returns how many nanoseconds it took per value.  The sum is
+ * repeated until it has taken at least a tenth of a second, to get a steady
+ * time.
+ */
+static double time_sum(int method, FloatArray *floats, float *sum) {
+    double start = get_seconds(), seconds;
+    long runs = 0;
+
+    do {
+        switch (method) {
+        case 0:  *sum = fsum(floats);               break;
+        case 1:  *sum = my_fsum(floats);            break;
+        case 2:  *sum = simd_fsum(floats);          break;
+        case 3:  *sum = pairwise_fsum(floats);      break;
+        case 4:  *sum = parallel_fsum(floats, 0);   break;
+        default: *sum = exact_fsum(floats, 0);      break;
+        }
+        runs++;
+        seconds = get_seconds() - start;
+    } while (seconds < 0.1);
+
+    return seconds / runs / floats->count * 1e9;
+}
+
+
+int main(int argc, char **argv) {
+    FloatArray floats, original;
+    FILE *output;
+    static const char *methods[] = {
+        "fsum", "my_fsum", "simd_fsum", "pairwise_fsum", "parallel_fsum",
+        "exact_fsum"
+    };
+    float sum1, sum2, sum3, my_sum, simd_sum, pairwise_sum, parallel_sum;
+    float exact_sum, sum;
+    double accurate, ns;
+    int have_accurate, i;
+
+    if (argc != 1 && (argc != 3 || strcmp(argv[1], "-w") != 0)) {
+        fprintf(stderr, "Usage: %s [-w binary-file] < input\n"
+                        "\t-w  just save the floats in the binary format, "
+                        "which loads much faster\n", argv[0]);
+        exit(1);
+    }
 
     load_floats(stdin, &floats);
     printf("Loaded %d floats from stdin.\n", floats.count);
 
+    if (argc == 3) {
+        output = fopen(argv[2], "wb");
+        if (output == NULL) {
+            perror(argv[2]);
+            exit(1);
+        }
+        save_floats(output, &floats);
+        fclose(output);
+        printf("Saved %d floats to %s.\n", floats.count, argv[2]);
+        return 0;
+    }
+
+    /* The input files end with the accurate sum of their values. */
+    have_accurate = (scanf(" accurate sum: %lf", &accurate) == 1);
+
     /* Compute a sum, in the order of input. */
     sum1 = fsum(&floats);
 
@@ -63,6 +367,19 @@ int main() {
      * summation function won't be affected by the order of the input floats.
      */
     my_sum = my_fsum(&floats);
+    simd_sum = simd_fsum(&floats);
+    pairwise_sum = pairwise_fsum(&floats);
+    parallel_sum = parallel_fsum(&floats, 0);
+    exact_sum = exact_fsum(&floats, 0);
+
+    /* Keep a copy in the order of input, for timing the sums on. */
+    original.count = floats.count;
+    original.values = malloc(floats.count * sizeof(float));
+    if (original.values == NULL) {
+        printf("ERROR:  couldn't allocate a copy of the floats!\n");
+        exit(1);
+    }
+    memcpy(original.values, floats.values, floats.count * sizeof(float));
 
     /* Compute a sum, in order of increasing magnitude. */
     sort_incmag(&floats);
@@ -79,6 +396,25 @@ int main() {
     printf("Sum computed in order of increasing magnitude:  %e\n", sum2);
     printf("Sum computed in order of decreasing magnitude:  %e\n", sum3);
     printf("Sum computed using Kahan Summation Algorithm:  %e\n", my_sum);
+    printf("Sum computed using SIMD Neumaier Summation:  %e\n", simd_sum);
+    printf("Sum computed using pairwise summation:  %e\n", pairwise_sum);
+    printf("Sum computed using parallel summation:  %e\n", parallel_sum);
+    printf("Sum computed exactly, with a superaccumulator:  %e\n", exact_sum);
+
+    /* Weigh the accuracy of each way of summing against its speed, on the
+     * values in the order of input.  The accurate sums in the input files
+     * only have 7 digits, so errors below about 1e-7 can't be told apart.
+     */
+    if (have_accurate) {
+        printf("Against the accurate sum %e:\n", accurate);
+        printf("    %-14s %14s %14s %10s\n", "method", "sum", "rel. error",
+               "ns/value");
+        for (i = 0; i < 6; i++) {
+            ns = time_sum(i, &original, &sum);
+            printf("    %-14s %14e %14e %10.3f\n", methods[i], sum,
+                   fabs(sum - accurate) / fabs(accurate), ns);
+        }
+    }
 
     /* TODO:  UNCOMMENT
     printf("My sum:  %e\n", my_sum);
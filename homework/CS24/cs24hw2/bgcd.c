@@ -0,0 +1,116 @@
+/*
+ * Binary GCDs of 64-bit values.
+ *
+ * gcd.s finds the GCD by repeated division, which takes tens of cycles a
+ * step.  Stein's binary GCD only shifts and subtracts:  the common factors
+ * of 2 come out first, with a count of trailing zeros, and then
+ *
+ *     gcd(a, b) = gcd(min(a, b), |a - b|)
+ *
+ * where both are odd, so |a - b| is even, and its factors of 2 can be
+ * shifted out, since they aren't common to a.  The count of trailing zeros
+ * is TZCNT, which CPUs without BMI run as BSF, with the same answer for the
+ * nonzero values that it's used on here.
+ *
+ * Each step depends on the one before, so one GCD leaves most of the CPU
+ * idle.  gcd_batch() runs GCD_LANES independent GCDs in the same loop, which
+ * the CPU can overlap.
+ */
+#include "bgcd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BGCD_TARGET __attribute__((target("bmi")))
+#else
+#define BGCD_TARGET
+#endif
+
+/* How many GCDs gcd_batch() interleaves; its loop steps each one by name. */
+#define GCD_LANES 4
+
+
+/*
+ * One step of the binary GCD, where a and b are odd and differ:  replace
+ * them with the smaller one and their difference, with its factors of 2
+ * taken out.  The count of trailing zeros of a - b is the same as that of
+ * b - a, so it doesn't have to wait for the comparison.
+ */
+#define GCD_STEP(a, b) do {                                 \
+        int zeros = __builtin_ctzll((a) - (b));             \
+        uint64_t smaller = (a) < (b) ? (a) : (b);           \
+        (a) = ((a) < (b) ? (b) - (a) : (a) - (b)) >> zeros; \
+        (b) = smaller;                                      \
+    } while (0)
+
+
+/*
+ * Returns the greatest common divisor of a and b, where gcd(a, 0) = a.
+ */
+BGCD_TARGET
+uint64_t binary_gcd(uint64_t a, uint64_t b) {
+    int shift;
+
+    if (a == 0)
+        return b;
+    if (b == 0)
+        return a;
+
+    shift = __builtin_ctzll(a | b);
+    a >>= __builtin_ctzll(a);
+    b >>= __builtin_ctzll(b);
+    while (a != b)
+        GCD_STEP(a, b);
+
+    return a << shift;
+}
+
+
+/*
+ * Sets out[i] to the GCD of a[i] and b[i] for each i < n.  out may be a or
+ * b.
+ */
+BGCD_TARGET
+void gcd_batch(const uint64_t *a, const uint64_t *b, uint64_t *out,
+               size_t n) {
+    uint64_t x[GCD_LANES], y[GCD_LANES];
+    int shift[GCD_LANES], j;
+    size_t i;
+
+    for (i = 0; i + GCD_LANES <= n; i += GCD_LANES) {
+        /* A lane is done when x == y.  Those with a zero are done from the
+         * start; the others start with both odd.
+         */
+        for (j = 0; j < GCD_LANES; j++) {
+            x[j] = a[i + j];
+            y[j] = b[i + j];
+            if (x[j] == 0 || y[j] == 0) {
+                x[j] |= y[j];
+                y[j] = x[j];
+                shift[j] = 0;
+            }
+            else {
+                shift[j] = __builtin_ctzll(x[j] | y[j]);
+                x[j] >>= __builtin_ctzll(x[j]);
+                y[j] >>= __builtin_ctzll(y[j]);
+            }
+        }
+
+        /* Step every lane until all of them are done. */
+        while (x[0] != y[0] || x[1] != y[1] || x[2] != y[2] ||
+               x[3] != y[3]) {
+            if (x[0] != y[0])
+                GCD_STEP(x[0], y[0]);
+            if (x[1] != y[1])
+                GCD_STEP(x[1], y[1]);
+            if (x[2] != y[2])
+                GCD_STEP(x[2], y[2]);
+            if (x[3] != y[3])
+                GCD_STEP(x[3], y[3]);
+        }
+
+        for (j = 0; j < GCD_LANES; j++)
+            out[i + j] = x[j] << shift[j];
+    }
+
+    for (; i < n; i++)
+        out[i] = binary_gcd(a[i], b[i]);
+}
@@ -0,0 +1,9 @@
+/*
+ * Binary GCDs of 64-bit values, one at a time or in batches.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+uint64_t binary_gcd(uint64_t a, uint64_t b);
+void gcd_batch(const uint64_t *a, const uint64_t *b, uint64_t *out,
+               size_t n);
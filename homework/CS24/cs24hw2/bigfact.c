@@ -0,0 +1,45 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "factorial.h"
+
+/*
+ * Prints n!, looked up if it fits in 64 bits, and otherwise found as a big
+ * number on as many threads as -j says, one per CPU by default.
+ */
+int main(int argc, char **argv) {
+    int num_threads = sysconf(_SC_NPROCESSORS_ONLN), n;
+    uint64_t small;
+    BigNum *num;
+    char *str;
+
+    if (argc == 4 && strcmp(argv[1], "-j") == 0) {
+        num_threads = atoi(argv[2]);
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 2 || num_threads <= 0) {
+        printf("Usage: %s [-j threads] [non-negative integer]\n", argv[0]);
+        return 0;
+    }
+
+    n = atoi(argv[1]);
+    if (n < 0) {
+        printf("Argument must be a non-negative integer.\n");
+        return 0;
+    }
+
+    if (factorial64(n, &small)) {
+        printf("%llu\n", (unsigned long long) small);
+        return 1;
+    }
+
+    num = factorial_big(n, num_threads);
+    str = bignum_to_string(num);
+    printf("%s\n", str);
+
+    free(str);
+    free_bignum(num);
+    return 1;
+}
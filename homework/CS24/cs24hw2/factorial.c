@@ -0,0 +1,367 @@
+/*
+ * Factorials.
+ *
+ * fact.s recurses once for each n, and its 32-bit result overflows past
+ * 12!.  Only 21 factorials fit in 64 bits, so factorial64() just looks them
+ * up, and says when n! doesn't fit.
+ *
+ * factorial_big() finds larger factorials as big numbers.  Multiplying
+ * 1 * 2 * ... * n one at a time would multiply an ever longer number by a
+ * short one, n times.  A product tree instead multiplies the products of
+ * the two halves of the range, recursively, so the big multiplications are
+ * of numbers of about the same size, which Karatsuba multiplication does in
+ * less than quadratic time.  The two halves are independent, so the top
+ * levels of the tree run on threads of their own.  The factors of 2 are
+ * taken out of every number, and the product shifted by them once at the
+ * end; n! has n - (the number of 1 bits in n) of them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "factorial.h"
+
+/* How many numbers a leaf of the product tree multiplies one at a time. */
+#define LEAF_SIZE 32
+
+/* Below how many digits multiplication is done the schoolbook way. */
+#define KARATSUBA_THRESHOLD 40
+
+
+static const uint64_t factorial_table[MAX_FACTORIAL64 + 1] = {
+    1ULL, 1ULL, 2ULL, 6ULL, 24ULL, 120ULL, 720ULL, 5040ULL, 40320ULL,
+    362880ULL, 3628800ULL, 39916800ULL, 479001600ULL, 6227020800ULL,
+    87178291200ULL, 1307674368000ULL, 20922789888000ULL,
+    355687428096000ULL, 6402373705728000ULL, 121645100408832000ULL,
+    2432902008176640000ULL
+};
+
+
+/*
+ * Sets *result to n! and returns 1 if it fits in 64 bits, and otherwise
+ * returns 0 and leaves *result alone.
+ */
+int factorial64(unsigned n, uint64_t *result) {
+    if (n > MAX_FACTORIAL64)
+        return 0;
+    *result = factorial_table[n];
+    return 1;
+}
+
+
+static void * alloc_or_die(size_t size) {
+    void *p = malloc(size);
+
+    if (!p) {
+        printf("Out of memory.\n");
+        exit(1);
+    }
+    return p;
+}
+
+
+static BigNum * new_bignum(size_t capacity) {
+    BigNum *num = alloc_or_die(sizeof(BigNum));
+
+    num->digits = alloc_or_die((capacity > 0 ? capacity : 1) *
+                               sizeof(uint32_t));
+    num->length = 0;
+    return num;
+}
+
+
+void free_bignum(BigNum *num) {
+    free(num->digits);
+    free(num);
+}
+
+
+/* Drops the leading zero digits of a number. */
+static void trim(BigNum *num) {
+    while (num->length > 0 && num->digits[num->length - 1] == 0)
+        num->length--;
+}
+
+
+/* out[0 .. an + bn) = a * b, the schoolbook way. */
+static void mul_schoolbook(const uint32_t *a, size_t an, const uint32_t *b,
+                           size_t bn, uint32_t *out) {
+    uint64_t carry;
+    size_t i, j;
+
+    memset(out, 0, (an + bn) * sizeof(uint32_t));
+    for (i = 0; i < an; i++) {
+        carry = 0;
+        for (j = 0; j < bn; j++) {
+            carry += (uint64_t) a[i] * b[j] + out[i + j];
+            out[i + j] = (uint32_t) carry;
+            carry >>= 32;
+        }
+        out[i + bn] = (uint32_t) carry;
+    }
+}
+
+
+/* a[0 .. an) += b[0 .. bn), where the sum fits in an digits. */
+static void add_into(uint32_t *a, size_t an, const uint32_t *b, size_t bn) {
+    uint64_t carry = 0;
+    size_t i;
+
+    for (i = 0; i < an && (i < bn || carry != 0); i++) {
+        carry += (uint64_t) a[i] + (i < bn ? b[i] : 0);
+        a[i] = (uint32_t) carry;
+        carry >>= 32;
+    }
+}
+
+
+/* a[0 .. an) -= b[0 .. bn), where b <= a. */
+static void sub_from(uint32_t *a, size_t an, const uint32_t *b, size_t bn) {
+    uint64_t borrow = 0, d;
+    size_t i;
+
+    for (i = 0; i < an && (i < bn || borrow != 0); i++) {
+        d = (uint64_t) a[i] - (i < bn ? b[i] : 0) - borrow;
+        a[i] = (uint32_t) d;
+        borrow = (d >> 32) & 1;
+    }
+}
+
+
+/*
+ * out[0 .. an + bn) = a * b, by Karatsuba's method:  with a = a1 B + a0 and
+ * b = b1 B + b0,
+ *
+ *     a * b = a1 b1 B^2 + ((a0 + a1)(b0 + b1) - a0 b0 - a1 b1) B + a0 b0
+ *
+ * which is three half-size multiplications rather than four.
+ */
+static void mul(const uint32_t *a, size_t an, const uint32_t *b, size_t bn,
+                uint32_t *out) {
+    const uint32_t *t;
+    uint32_t *tmp, *sa, *sb, *z1;
+    size_t m;
+
+    if (an < bn) {
+        t = a;  a = b;  b = t;
+        m = an; an = bn; bn = m;
+    }
+    if (bn < KARATSUBA_THRESHOLD) {
+        mul_schoolbook(a, an, b, bn, out);
+        return;
+    }
+
+    m = (an + 1) / 2;
+
+    /* b is too short to split, so split a alone. */
+    if (bn <= m) {
+        tmp = alloc_or_die((an - m + bn) * sizeof(uint32_t));
+        mul(a, m, b, bn, out);
+        mul(a + m, an - m, b, bn, tmp);
+        memset(out + m + bn, 0, (an - m) * sizeof(uint32_t));
+        add_into(out + m, an - m + bn, tmp, an - m + bn);
+        free(tmp);
+        return;
+    }
+
+    /* a0 b0 goes in the low 2m digits and a1 b1 in the rest. */
+    mul(a, m, b, m, out);
+    mul(a + m, an - m, b + m, bn - m, out + 2 * m);
+
+    sa = alloc_or_die((m + 1) * sizeof(uint32_t));
+    sb = alloc_or_die((m + 1) * sizeof(uint32_t));
+    z1 = alloc_or_die((2 * m + 2) * sizeof(uint32_t));
+
+    memcpy(sa, a, m * sizeof(uint32_t));
+    sa[m] = 0;
+    add_into(sa, m + 1, a + m, an - m);
+    memcpy(sb, b, m * sizeof(uint32_t));
+    sb[m] = 0;
+    add_into(sb, m + 1, b + m, bn - m);
+
+    mul(sa, m + 1, sb, m + 1, z1);
+    sub_from(z1, 2 * m + 2, out, 2 * m);
+    sub_from(z1, 2 * m + 2, out + 2 * m, an + bn - 2 * m);
+    add_into(out + m, an + bn - m, z1, 2 * m + 2);
+
+    free(sa);
+    free(sb);
+    free(z1);
+}
+
+
+/* Returns a * b, and frees a and b. */
+static BigNum * mul_bignums(BigNum *a, BigNum *b) {
+    BigNum *product = new_bignum(a->length + b->length);
+
+    if (a->length > 0 && b->length > 0) {
+        mul(a->digits, a->length, b->digits, b->length, product->digits);
+        product->length = a->length + b->length;
+        trim(product);
+    }
+
+    free_bignum(a);
+    free_bignum(b);
+    return product;
+}
+
+
+/* Returns the product of the odd parts of lo, lo + 1, ..., hi - 1. */
+static BigNum * product_leaf(unsigned lo, unsigned hi) {
+    BigNum *num = new_bignum(hi - lo + 1);
+    uint64_t carry;
+    unsigned k, odd;
+    size_t i;
+
+    num->digits[0] = 1;
+    num->length = 1;
+    for (k = lo; k < hi; k++) {
+        odd = k >> __builtin_ctz(k);
+        carry = 0;
+        for (i = 0; i < num->length; i++) {
+            carry += (uint64_t) num->digits[i] * odd;
+            num->digits[i] = (uint32_t) carry;
+            carry >>= 32;
+        }
+        if (carry != 0)
+            num->digits[num->length++] = (uint32_t) carry;
+    }
+    return num;
+}
+
+
+/* One subtree of the product tree, for a thread to compute. */
+typedef struct ProductJob {
+    unsigned lo, hi;
+    int depth;          /* How many more levels get threads of their own. */
+    BigNum *product;
+} ProductJob;
+
+
+static void * product_thread(void *arg);
+
+/* Sets job->product to the product of the odd parts of lo .. hi - 1. */
+static void product_range(ProductJob *job) {
+    ProductJob left, right;
+    pthread_t thread;
+    unsigned mid;
+
+    if (job->hi - job->lo <= LEAF_SIZE) {
+        job->product = product_leaf(job->lo, job->hi);
+        return;
+    }
+
+    mid = job->lo + (job->hi - job->lo) / 2;
+    left.lo = job->lo;
+    left.hi = mid;
+    left.depth = job->depth - 1;
+    right.lo = mid;
+    right.hi = job->hi;
+    right.depth = job->depth - 1;
+
+    /* The left half goes to a new thread while this one does the right. */
+    if (job->depth > 0 &&
+        pthread_create(&thread, NULL, product_thread, &left) == 0) {
+        product_range(&right);
+        pthread_join(thread, NULL);
+    }
+    else {
+        product_range(&left);
+        product_range(&right);
+    }
+
+    job->product = mul_bignums(left.product, right.product);
+}
+
+
+static void * product_thread(void *arg) {
+    product_range(arg);
+    return NULL;
+}
+
+
+/* Returns num * 2^shift, and frees num. */
+static BigNum * shift_left(BigNum *num, size_t shift) {
+    size_t words = shift / 32, bits = shift % 32, i;
+    BigNum *result = new_bignum(num->length + words + 1);
+
+    memset(result->digits, 0, (num->length + words + 1) * sizeof(uint32_t));
+    for (i = 0; i < num->length; i++) {
+        result->digits[i + words] |= num->digits[i] << bits;
+        if (bits != 0)
+            result->digits[i + words + 1] = num->digits[i] >> (32 - bits);
+    }
+    result->length = num->length + words + 1;
+    trim(result);
+
+    free_bignum(num);
+    return result;
+}
+
+
+/*
+ * Returns n! as a big number, which the caller frees with free_bignum().
+ * The product tree is split among up to num_threads threads.
+ */
+BigNum * factorial_big(unsigned n, int num_threads) {
+    ProductJob job;
+    BigNum *num;
+    uint64_t small;
+
+    if (factorial64(n, &small)) {
+        num = new_bignum(2);
+        num->digits[0] = (uint32_t) small;
+        num->digits[1] = (uint32_t) (small >> 32);
+        num->length = 2;
+        trim(num);
+        return num;
+    }
+
+    /* Each level of the tree doubles the number of threads. */
+    job.lo = 1;
+    job.hi = n + 1;
+    job.depth = 0;
+    while ((1 << job.depth) < num_threads)
+        job.depth++;
+    product_range(&job);
+
+    return shift_left(job.product, n - __builtin_popcount(n));
+}
+
+
+/*
+ * Returns the number in decimal, as a string that the caller frees.  Nine
+ * decimal digits at a time are divided off a copy of the number.
+ */
+char * bignum_to_string(const BigNum *num) {
+    uint32_t *digits, *chunks;
+    size_t length = num->length, num_chunks = 0, i;
+    uint64_t rem;
+    char *str, *p;
+
+    digits = alloc_or_die((length + 1) * sizeof(uint32_t));
+    memcpy(digits, num->digits, length * sizeof(uint32_t));
+
+    /* Each 32-bit digit is a bit under 10 decimal digits. */
+    chunks = alloc_or_die((length * 10 / 9 + 2) * sizeof(uint32_t));
+    do {
+        rem = 0;
+        for (i = length; i-- > 0; ) {
+            rem = (rem << 32) | digits[i];
+            digits[i] = (uint32_t) (rem / 1000000000);
+            rem %= 1000000000;
+        }
+        chunks[num_chunks++] = (uint32_t) rem;
+        while (length > 0 && digits[length - 1] == 0)
+            length--;
+    } while (length > 0);
+
+    str = alloc_or_die(num_chunks * 9 + 1);
+    p = str + sprintf(str, "%u", chunks[num_chunks - 1]);
+    for (i = num_chunks - 1; i-- > 0; )
+        p += sprintf(p, "%09u", chunks[i]);
+
+    free(digits);
+    free(chunks);
+    return str;
+}
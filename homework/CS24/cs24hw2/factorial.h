@@ -0,0 +1,21 @@
+/*
+ * Factorials, by table lookup when they fit in 64 bits, and as big numbers
+ * when they don't.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+/* The largest n whose factorial fits in 64 bits. */
+#define MAX_FACTORIAL64 20
+
+/* A nonnegative big number, in base 2^32. */
+typedef struct BigNum {
+    uint32_t *digits;   /* Least significant first. */
+    size_t length;      /* Without leading zeros, so 0 for zero. */
+} BigNum;
+
+int factorial64(unsigned n, uint64_t *result);
+BigNum * factorial_big(unsigned n, int num_threads);
+
+char * bignum_to_string(const BigNum *num);
+void free_bignum(BigNum *num);
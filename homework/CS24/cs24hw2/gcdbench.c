@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "bgcd.h"
+
+/*
+ * Times GCDs of random 64-bit pairs by repeated division, as gcd.s does,
+ * with binary_gcd() one at a time, and with gcd_batch(), and checks that
+ * they agree.
+ */
+
+#define NUM_PAIRS (1 << 20)
+
+
+static double get_seconds() {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/* The algorithm of gcd.s, on 64-bit values. */
+static uint64_t division_gcd(uint64_t a, uint64_t b) {
+    uint64_t r;
+
+    while (b != 0) {
+        r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+
+static uint64_t random_value() {
+    return ((uint64_t) rand() << 42) ^ ((uint64_t) rand() << 21) ^ rand();
+}
+
+
+int main(int argc, char **argv) {
+    uint64_t *a, *b, *expected, *out;
+    double start, seconds;
+    int i, method, mismatches;
+
+    a = malloc(NUM_PAIRS * sizeof(uint64_t));
+    b = malloc(NUM_PAIRS * sizeof(uint64_t));
+    expected = malloc(NUM_PAIRS * sizeof(uint64_t));
+    out = malloc(NUM_PAIRS * sizeof(uint64_t));
+    if (!a || !b || !expected || !out) {
+        printf("Out of memory.\n");
+        return 1;
+    }
+
+    /* Random pairs, with some common factors, some of 2, and some zeros. */
+    for (i = 0; i < NUM_PAIRS; i++) {
+        uint64_t common = (random_value() % 1000 + 1) << (rand() % 8);
+
+        a[i] = (random_value() >> 12) * common;
+        b[i] = (random_value() >> 12) * common;
+        if (i % 1000 == 0)
+            a[i] = 0;
+        if (i % 1001 == 0)
+            b[i] = 0;
+    }
+
+    for (method = 0; method < 3; method++) {
+        start = get_seconds();
+        if (method == 0) {
+            for (i = 0; i < NUM_PAIRS; i++)
+                expected[i] = division_gcd(a[i], b[i]);
+        }
+        else if (method == 1) {
+            for (i = 0; i < NUM_PAIRS; i++)
+                out[i] = binary_gcd(a[i], b[i]);
+        }
+        else {
+            gcd_batch(a, b, out, NUM_PAIRS);
+        }
+        seconds = get_seconds() - start;
+
+        mismatches = 0;
+        for (i = 0; method > 0 && i < NUM_PAIRS; i++)
+            mismatches += (out[i] != expected[i]);
+
+        printf("%-12s %7.2f ns/gcd  %d mismatches\n",
+               method == 0 ? "division" : method == 1 ? "binary" : "batch",
+               seconds * 1e9 / NUM_PAIRS, mismatches);
+    }
+
+    free(a);
+    free(b);
+    free(expected);
+    free(out);
+    return 0;
+}
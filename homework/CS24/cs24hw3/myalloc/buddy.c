@@ -0,0 +1,241 @@
+/*! \file
+ * Implementation of a buddy-system allocator, as described in the midterm
+ * (cs24mid/buddy.txt).  It is one of the backends behind myalloc.h; see
+ * buddy.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "myalloc.h"
+#include "buddy.h"
+
+/*
+ * Implementation Details:
+ * Every block is MIN_BLOCK_SIZE * 2^order bytes and starts at a multiple of
+ * its own size, measured from the start of the pool.  The buddy of the block
+ * at offset o of order k is therefore at o ^ (MIN_BLOCK_SIZE << k).
+ *
+ * Each block starts with a 4 byte header holding its order and whether it is
+ * allocated, so 4 bytes of overhead per block.  Free blocks are also kept on
+ * one explicit doubly-linked free list per order; the links live in the free
+ * block after the header and are offsets from the start of the pool.
+ *
+ * A pool whose size is not a power of two is split into the largest aligned
+ * power-of-two blocks that fit, in decreasing order.  A block whose buddy
+ * would run past the end of the pool simply never merges.
+ *
+ * Allocation:
+ * Rounds the request plus header up to the next order and takes a block from
+ * the first non-empty free list of that order or higher, splitting it in half
+ * until it is the right size.  At most one split per order, so O(log n).
+ *
+ * Deallocation:
+ * Merges the block with its buddy for as long as the buddy is free and of the
+ * same order, so also O(log n).  Freeing an already free block does nothing.
+ */
+
+/* smallest block, big enough for the header and the free list links */
+#define MIN_BLOCK_SIZE 32
+
+/* orders 0 .. MAX_ORDERS - 1; the largest block is 1GB, so sizes fit an int */
+#define MAX_ORDERS 26
+
+/* marks the end of a free list */
+#define NO_BLOCK (-1)
+
+/* header at the start of every block */
+struct buddy_header {
+    /* order, shifted left by one, with the low bit set if allocated */
+    int data;
+};
+
+/* free list links, stored just after the header of a free block */
+struct buddy_links {
+    int next;
+    int prev;
+};
+
+static unsigned char *pool;
+/* bytes of the pool that are covered by blocks */
+static int pool_size;
+static int free_lists[MAX_ORDERS];
+/* free blocks of each order, for the statistics */
+static long free_counts[MAX_ORDERS];
+static struct myalloc_counters counters;
+
+
+static struct buddy_header *header_at(int offset) {
+    return (struct buddy_header *) (pool + offset);
+}
+
+static struct buddy_links *links_at(int offset) {
+    return (struct buddy_links *) (pool + offset + sizeof(struct buddy_header));
+}
+
+static int block_bytes(int order) {
+    return MIN_BLOCK_SIZE << order;
+}
+
+static int order_of(int offset) {
+    return header_at(offset)->data >> 1;
+}
+
+static int is_allocated(int offset) {
+    return header_at(offset)->data & 1;
+}
+
+/* mark the block at offset as a free block of the given order, and list it */
+static void push_free(int offset, int order) {
+    struct buddy_links *links = links_at(offset);
+
+    header_at(offset)->data = order << 1;
+    links->prev = NO_BLOCK;
+    links->next = free_lists[order];
+    if (free_lists[order] != NO_BLOCK) {
+        links_at(free_lists[order])->prev = offset;
+    }
+    free_lists[order] = offset;
+    free_counts[order]++;
+}
+
+/* take the free block at offset off of its free list */
+static void remove_free(int offset) {
+    struct buddy_links *links = links_at(offset);
+    int order = order_of(offset);
+
+    if (links->prev != NO_BLOCK) {
+        links_at(links->prev)->next = links->next;
+    }
+    else {
+        free_lists[order] = links->next;
+    }
+    if (links->next != NO_BLOCK) {
+        links_at(links->next)->prev = links->prev;
+    }
+    free_counts[order]--;
+}
+
+
+void buddy_init(unsigned char *start, int size) {
+    int order, offset = 0;
+
+    pool = start;
+    pool_size = 0;
+    memset(&counters, 0, sizeof(counters));
+    for (order = 0; order < MAX_ORDERS; order++) {
+        free_lists[order] = NO_BLOCK;
+        free_counts[order] = 0;
+    }
+
+    /* cover the pool with the largest blocks that fit, biggest first */
+    for (order = MAX_ORDERS - 1; order >= 0; order--) {
+        if ((long) offset + block_bytes(order) <= size) {
+            push_free(offset, order);
+            offset += block_bytes(order);
+        }
+    }
+    pool_size = offset;
+}
+
+unsigned char *buddy_alloc(int size) {
+    int order = 0, k, offset;
+
+    if (size < 0) {
+        return 0;
+    }
+
+    /* smallest order that holds the payload plus the header */
+    while (order < MAX_ORDERS &&
+           block_bytes(order) - (int) sizeof(struct buddy_header) < size) {
+        order++;
+    }
+
+    counters.searches++;
+    for (k = order; k < MAX_ORDERS && free_lists[k] == NO_BLOCK; k++)
+        ;
+    if (k == MAX_ORDERS) {
+        return 0;
+    }
+
+    offset = free_lists[k];
+    remove_free(offset);
+
+    /* split off upper halves until the block is the order we want */
+    while (k > order) {
+        k--;
+        push_free(offset + block_bytes(k), k);
+        counters.splits++;
+    }
+
+    header_at(offset)->data = (order << 1) | 1;
+    return pool + offset + sizeof(struct buddy_header);
+}
+
+void buddy_free(unsigned char *ptr) {
+    int offset = ptr - sizeof(struct buddy_header) - pool, order, buddy;
+
+    if (!is_allocated(offset)) {
+        /* this is already free, so do nothing */
+        return;
+    }
+
+    order = order_of(offset);
+    while (order < MAX_ORDERS - 1) {
+        buddy = offset ^ block_bytes(order);
+        if (buddy + block_bytes(order) > pool_size || is_allocated(buddy) ||
+            order_of(buddy) != order) {
+            break;
+        }
+
+        remove_free(buddy);
+        if (buddy < offset) {
+            offset = buddy;
+        }
+        order++;
+        counters.coalesces++;
+    }
+
+    push_free(offset, order);
+}
+
+int buddy_block_size(unsigned char *ptr) {
+    int offset = ptr - sizeof(struct buddy_header) - pool;
+
+    return block_bytes(order_of(offset)) - sizeof(struct buddy_header);
+}
+
+void buddy_stats(struct myalloc_stats *stats) {
+    int order, payload, class;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->arenas = 1;
+    stats->pool_bytes = pool_size;
+
+    for (order = 0; order < MAX_ORDERS; order++) {
+        if (free_counts[order] == 0) {
+            continue;
+        }
+
+        payload = block_bytes(order) - sizeof(struct buddy_header);
+        stats->free_blocks += free_counts[order];
+        stats->free_bytes += free_counts[order] * payload;
+        stats->largest_free = payload;
+
+        /* report orders in the same size classes the best-fit lists use */
+        for (class = 0; class < MYALLOC_SIZE_CLASSES - 1 &&
+             (16 << class) <= payload; class++)
+            ;
+        stats->free_blocks_by_class[class] += free_counts[order];
+    }
+
+    if (stats->free_bytes > 0) {
+        stats->fragmentation =
+            1.0 - (double) stats->largest_free / (double) stats->free_bytes;
+    }
+}
+
+void buddy_counters(struct myalloc_counters *result) {
+    *result = counters;
+}
@@ -0,0 +1,25 @@
+/*! \file
+ * Declarations for the buddy-system backend of the allocator.  These are used
+ * by myalloc.c when init_myalloc() is called with MYALLOC_BACKEND set to
+ * MYALLOC_BUDDY; callers should go through the myalloc.h interface instead.
+ * None of these functions lock; myalloc.c serializes calls to them.
+ *
+ * myalloc.h must be included before this file.
+ */
+
+
+/* Set the buddy allocator up to manage "size" bytes at pool. */
+void buddy_init(unsigned char *pool, int size);
+
+/* Allocate a block with room for "size" bytes, or return 0. */
+unsigned char * buddy_alloc(int size);
+
+/* Free a block returned by buddy_alloc(). */
+void buddy_free(unsigned char *ptr);
+
+/* Return how many bytes the block at ptr can hold. */
+int buddy_block_size(unsigned char *ptr);
+
+/* Fill in the free space summary and event counters for the buddy pool. */
+void buddy_stats(struct myalloc_stats *stats);
+void buddy_counters(struct myalloc_counters *counters);
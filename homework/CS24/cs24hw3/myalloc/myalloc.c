@@ -8,10 +8,27 @@
  * All rights reserved.
  */
 
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "myalloc.h"
+#include "buddy.h"
+#include "probe.h"
+
+
+/* The probes of the allocator's hot paths, for "make PROBES=1"; refills
+ * count the times that a thread's cache is refilled from the pool.
+ */
+PROBE_DEFINE(myalloc_probe, "myalloc");
+PROBE_DEFINE(myfree_probe, "myfree");
+PROBE_DEFINE(refill_probe, "myalloc cache refills");
 
 /*
  * Implementation Details:
@@ -19,18 +36,81 @@
  * All blocks, both freed and allocated, are stored with 4 byte headers and
  * footers, so 8 extra bytes used per block.
  *
+ * Free blocks are additionally threaded onto explicit, doubly-linked free
+ * lists.  The links live in the payload of the free block (so they cost no
+ * extra space) and are stored as offsets from the start of the arena.  There
+ * is one list per size class, where size classes are powers of two.  Free blocks
+ * smaller than MIN_BLOCK_SIZE cannot hold the links and are not listed; they
+ * are picked up again when a neighbour is freed and coalesces with them.
+ *
  * Allocation:
- * Uses best-fit strategy, time complexity is linear in size of memory pool.
+ * Uses best-fit strategy.  Only the size classes that can hold the request
+ * are searched.  Within the first non-empty class that has a large enough
+ * block the best fit is chosen; every block in a larger class is bigger than
+ * anything in that class, so this is still a global best fit.  Time complexity
+ * is linear in the number of free blocks of a similar size, not in the size of
+ * the memory pool.
  * All allocation sizes requested are increased to the smallest multiple of four
  * that is greater than the requested size to maintain alignment, presumably
  * making most use-cases faster.
  *
  * Deallocation:
  * Constant time deallocation, coalesces with previous and next blocks if free.
- * Uses boundary tags (headers and footers) to do so. If myfree() is called on
+ * Uses boundary tags (headers and footers) to do so, and unlinks merged
+ * neighbours from their free lists in constant time.  If myfree() is called on
  * an already freed block, it will not do anything as it checks. If myfree() is
  * called on a pointer that was not returned by myalloc(), this will result in a
  * segfault.
+ *
+ * Threads:
+ * The pool itself is shared and guarded by a single lock.  In front of it each
+ * thread can keep a cache of recently freed small blocks, one bin per aligned
+ * size, so that a matching myalloc()/myfree() pair never takes the lock.  Bins
+ * are refilled from and flushed back to the pool in batches of half the bin
+ * capacity, and a thread's cache is flushed back when the thread exits.
+ * Cached blocks still look allocated to the pool, so they do not coalesce; the
+ * cache is disabled (THREAD_CACHE_SIZE == 0) unless the caller turns it on.
+ * Freeing a block twice while it sits in a cache is not detected.
+ *
+ * Aligned blocks:
+ * myalloc_aligned() over-allocates by the alignment plus the smallest
+ * possible block, then splits the slack in front of the aligned address off
+ * as a free block of its own and gives any excess at the end back too.  Slab
+ * runs use the same path.
+ *
+ * Backends:
+ * When init_myalloc() is called with MYALLOC_BACKEND set to MYALLOC_BUDDY, the
+ * pool is handed to the buddy allocator in buddy.c instead, and myalloc(),
+ * myfree(), myrealloc(), mycalloc() and the statistics go to it.  The thread
+ * caches, deferred coalescing, arenas, aligned blocks and slabs are only
+ * available with the default best-fit backend.
+ *
+ * Slabs:
+ * A slab hands out objects of one fixed size.  It carves SLAB_RUN_SIZE-aligned
+ * runs out of the pool, each an ordinary pool block, and packs the objects in
+ * a run with no per-object boundary tags.  Free slots are tracked with a
+ * bitmap at the start of the run, so allocation is a scan for a set bit and
+ * the run owning an object is found by masking its address.  Runs with free
+ * slots are kept ahead of full runs, and a run that becomes entirely free is
+ * given back to the pool unless it is the slab's only run.
+ *
+ * Arenas:
+ * The pool can grow.  When no arena has a block that fits, a new arena of at
+ * least ARENA_SIZE bytes is mapped with mmap() and appended to the arena list;
+ * each arena keeps its own free lists, and best fit is taken across all of
+ * them.  Frees find their arena by address.  When a mapped arena becomes
+ * entirely free it is unmapped, except that one empty arena is kept as a spare
+ * so a workload hovering at an arena boundary does not map and unmap on every
+ * call.  Growth is off unless ARENA_SIZE is set.
+ *
+ * Deferred coalescing:
+ * With DEFERRED_COALESCING set, myfree() does not merge small blocks with
+ * their neighbours.  They are parked, still tagged as allocated, on shared
+ * quick lists of exact sizes (the same bins the thread caches use), and
+ * myalloc() of that size pops one straight back off.  Only when a best-fit
+ * search fails are all quick lists coalesced in a single pass and the search
+ * retried, before the pool is grown.  get_myalloc_counters() reports how many
+ * requests each path served and how much merging and splitting was done.
  */
 
 
@@ -43,6 +123,27 @@
 int MEMORY_SIZE;
 unsigned char *mem;
 
+/*!
+ * Number of free blocks each thread may cache per size bin.  Zero disables
+ * the per-thread caches entirely.
+ */
+int THREAD_CACHE_SIZE = 0;
+
+/*!
+ * Size of the extra arenas mapped from the OS when the pool runs out.  Zero
+ * means the pool never grows past MEMORY_SIZE.
+ */
+int ARENA_SIZE = 0;
+
+/*!
+ * Nonzero to park small freed blocks on quick lists and only coalesce them
+ * when an allocation cannot otherwise be satisfied.
+ */
+int DEFERRED_COALESCING = 0;
+
+/*! Which allocator init_myalloc() sets the pool up for. */
+int MYALLOC_BACKEND = MYALLOC_BEST_FIT;
+
 /* used for boundary tags of blocks */
 struct header {
     /* positive if block is allocated */
@@ -51,29 +152,324 @@ struct header {
     int data;
 };
 
+/* free list links, stored in the payload of a free block */
+struct free_links {
+    /* offsets from the arena base of the next and previous free blocks */
+    int next;
+    int prev;
+};
+
+/* number of segregated free lists */
+#define NUM_SIZE_CLASSES MYALLOC_SIZE_CLASSES
+
+/* marks the end of a free list */
+#define NO_BLOCK (-1)
+
+/* bytes of tags and links a free block may have written past an arena's clean mark */
+#define CLEAN_SLOP (4 + (int) sizeof(struct free_links))
+
+/* smallest payload a block can have, so that it can hold its links when free */
+#define MIN_BLOCK_SIZE ((int) sizeof(struct free_links))
+
+/* largest block payload that is kept in the per-thread caches */
+#define CACHE_MAX_SIZE 256
+
+/* one cache bin for every multiple of 4 up to CACHE_MAX_SIZE */
+#define NUM_CACHE_BINS (CACHE_MAX_SIZE / 4)
+
+/* per-thread stacks of cached blocks, linked through their payloads */
+struct thread_cache {
+    /* pool generation the cached blocks belong to */
+    int generation;
+    /* nonzero once the exit-time flush has been registered for this thread */
+    int registered;
+    /* the top block in each bin, and how many blocks it holds */
+    unsigned char *head[NUM_CACHE_BINS];
+    int count[NUM_CACHE_BINS];
+};
+
+/* size and alignment of the runs that slabs carve out of the pool */
+#define SLAB_RUN_SIZE 4096
+
+/* bits per slab bitmap word */
+#define BITMAP_BITS 32
+
+/* a fixed-size object allocator, see slab_create() */
+struct slab {
+    /* size of each object, and how many fit in one run */
+    int object_size;
+    int objects_per_run;
+    /* offset of the first object from the start of a run */
+    int objects_offset;
+    /* doubly-linked runs, those with free slots always ahead of full ones */
+    struct slab_run *first;
+    struct slab_run *last;
+};
+
+/* header at the (aligned) start of every slab run */
+struct slab_run {
+    struct slab *slab;
+    struct slab_run *next;
+    struct slab_run *prev;
+    int free_count;
+    /* one bit per object, set if the slot is free */
+    uint32_t bitmap[];
+};
+
+/*
+ * A contiguous region of blocks.  The pool handed to init_myalloc() is the
+ * first arena; more are mapped from the OS when it runs out.
+ */
+struct arena {
+    /* address of the first block's header, and the bytes of blocks after it */
+    unsigned char *base;
+    int size;
+    /* bytes to give back to munmap(), or 0 for the calloc'd main pool */
+    int mapped_size;
+    /*
+     * Nothing at or past this offset has ever been handed out, so apart from
+     * the tags and links of the free block starting here (CLEAN_SLOP bytes)
+     * and the arena's final footer it is still zero.
+     */
+    int clean;
+    /* heads of the segregated free lists, as offsets from base */
+    int free_lists[NUM_SIZE_CLASSES];
+    struct arena *next;
+};
+
+/* the arena list, which always starts with the main pool */
+static struct arena main_arena;
+static struct arena *arenas = 0;
+/* an entirely free mapped arena kept around to absorb the next burst */
+static struct arena *spare_arena = 0;
+
 /* pointer to start of pool */
 static unsigned char *freeptr;
 /* size of header struct */
 static unsigned int header_size = sizeof(struct header);
 
+/*
+ * Free space summary, kept up to date as blocks enter and leave the free
+ * lists (including the tiny blocks that are never actually listed).
+ */
+static long free_bytes = 0;
+static long free_counts[NUM_SIZE_CLASSES];
+
+/* guards the pool and the free lists */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+/* the MYALLOC_BACKEND in effect since the last init_myalloc() */
+static int backend = MYALLOC_BEST_FIT;
+/* bumped by init_myalloc() so that caches filled from an old pool are dropped */
+static int pool_generation = 0;
+
+/* exact-size lists of freed blocks waiting to be coalesced, and their count */
+static unsigned char *quick_lists[NUM_CACHE_BINS];
+static int quick_blocks = 0;
+
+/* allocator event counters, guarded by pool_lock */
+static struct myalloc_counters counters;
+
+/*
+ * Leading bytes of the block last returned by pool_alloc() that may not be
+ * zero, guarded by pool_lock.
+ */
+static int last_dirty = 0;
+
+static __thread struct thread_cache cache;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+
+/* get the header of the block at the given offset into an arena */
+static struct header *block_at(struct arena *a, int offset) {
+    return (struct header *) ((void *) a->base + offset);
+}
+
+/* get the free list links of the free block at the given offset */
+static struct free_links *links_at(struct arena *a, int offset) {
+    return (struct free_links *) ((void *) a->base + offset + header_size);
+}
+
+/* get the offset of a payload's block header within an arena */
+static int offset_of(struct arena *a, unsigned char *ptr) {
+    return ((void *) ptr - header_size) - (void *) a->base;
+}
+
+/* find the arena a payload pointer belongs to */
+static struct arena *arena_of(unsigned char *ptr) {
+    struct arena *a;
+
+    for (a = arenas; a != 0; a = a->next) {
+        if (ptr > a->base && ptr < a->base + a->size) {
+            return a;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Return the free list a block with a payload of the given size belongs on.
+ * Class 0 holds sizes below 16, and class k holds sizes in [2^(k+3), 2^(k+4)).
+ * The last class holds everything larger.
+ */
+static int size_class(int size) {
+    int class = 0;
+
+    size >>= 4;
+    while (size != 0 && class < NUM_SIZE_CLASSES - 1) {
+        size >>= 1;
+        class++;
+    }
+
+    return class;
+}
+
+/*
+ * Push the free block at the given offset onto the front of its free list.
+ * Blocks too small to hold the links are left off the lists; they are only
+ * reclaimed when a neighbour is freed and coalesces with them.
+ */
+static void list_insert(struct arena *a, int offset) {
+    int size = abs(block_at(a, offset)->data);
+    int class = size_class(size);
+    struct free_links *links = links_at(a, offset);
+
+    free_bytes += size;
+    free_counts[class]++;
+
+    if (size < MIN_BLOCK_SIZE) {
+        return;
+    }
+
+    links->prev = NO_BLOCK;
+    links->next = a->free_lists[class];
+    if (a->free_lists[class] != NO_BLOCK) {
+        links_at(a, a->free_lists[class])->prev = offset;
+    }
+    a->free_lists[class] = offset;
+}
+
+/* unlink the free block at the given offset from its free list */
+static void list_remove(struct arena *a, int offset) {
+    struct free_links *links = links_at(a, offset);
+    int size = abs(block_at(a, offset)->data);
+
+    free_bytes -= size;
+    free_counts[size_class(size)]--;
+
+    if (size < MIN_BLOCK_SIZE) {
+        return;
+    }
+
+    if (links->prev != NO_BLOCK) {
+        links_at(a, links->prev)->next = links->next;
+    }
+    else {
+        a->free_lists[size_class(abs(block_at(a, offset)->data))] = links->next;
+    }
+
+    if (links->next != NO_BLOCK) {
+        links_at(a, links->next)->prev = links->prev;
+    }
+}
+
+/* write matching header and footer tags for the block at the given offset */
+static void set_tags(struct arena *a, int offset, int data) {
+    block_at(a, offset)->data = data;
+    block_at(a, offset + abs(data) + header_size)->data = data;
+}
+
+/* set up an arena over "size" bytes at base, as a single free block */
+static void arena_init(struct arena *a, unsigned char *base, int size) {
+    int i;
+
+    a->base = base;
+    a->size = size;
+    a->clean = 0;
+    a->next = 0;
+    for (i = 0; i < NUM_SIZE_CLASSES; i++) {
+        a->free_lists[i] = NO_BLOCK;
+    }
+
+    set_tags(a, 0, -(size - 2 * (int) header_size));
+    list_insert(a, 0);
+}
+
+/*
+ * Map a new arena with room for at least a "size"-byte block and add it to the
+ * end of the arena list.  The arena descriptor lives at the start of the
+ * mapping.  Returns 0 if growth is disabled or the OS refuses.
+ */
+static struct arena *arena_create(int size) {
+    long page = sysconf(_SC_PAGESIZE);
+    int offset = aligned_size(sizeof(struct arena)), bytes;
+    struct arena *a, *last;
+    void *region;
+
+    if (ARENA_SIZE <= 0) {
+        return 0;
+    }
+
+    bytes = offset + aligned_size(size) + 2 * header_size;
+    if (bytes < ARENA_SIZE) {
+        bytes = ARENA_SIZE;
+    }
+    bytes = (bytes + page - 1) / page * page;
+
+    region = mmap(0, bytes, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        return 0;
+    }
+
+    a = (struct arena *) region;
+    arena_init(a, (unsigned char *) region + offset, bytes - offset);
+    a->mapped_size = bytes;
+
+    for (last = arenas; last->next != 0; last = last->next)
+        ;
+    last->next = a;
+
+    return a;
+}
+
+/* unlink a mapped arena from the arena list and give it back to the OS */
+static void arena_release(struct arena *a) {
+    struct arena *prev;
+
+    for (prev = arenas; prev->next != a; prev = prev->next)
+        ;
+    prev->next = a->next;
+
+    /* its one free block leaves the free space summary with it */
+    list_remove(a, 0);
+    munmap(a, a->mapped_size);
+}
+
 
 /*!
  * This function initializes both the allocator state, and the memory pool.  It
  * must be called before myalloc() or myfree() will work at all.
  *
- * Note that we allocate the entire memory pool using malloc().  This is so we
+ * Note that we allocate the entire memory pool using calloc().  This is so we
  * can create different memory-pool sizes for testing.  Obviously, in a real
  * allocator, this memory pool would either be a fixed memory region, or the
  * allocator would request a memory region from the operating system (see the
- * C standard function sbrk(), for example).
+ * C standard function sbrk(), for example).  Arenas mapped by earlier calls
+ * are given back to the OS.  The pool starts out zeroed, which lets mycalloc()
+ * skip clearing memory that has never been handed out.
  */
 void init_myalloc() {
+    struct arena *a, *next;
+    int i;
+
     /*
      * Allocate the entire memory pool, from which our simple allocator will
      * serve allocation requests.
      */
 
-    mem = (unsigned char *) malloc(MEMORY_SIZE);
+    mem = (unsigned char *) calloc(MEMORY_SIZE, 1);
     if (mem == 0) {
         fprintf(stderr,
                 "init_myalloc: could not get %d bytes from the system\n",
@@ -89,15 +485,36 @@ void init_myalloc() {
         abort();
     }
 
-    /* put boundary tags on the full memory pool to start */
-    struct header start, end;
+    /* forget the blocks and counts that belonged to the previous pool */
+    for (i = 0; i < NUM_CACHE_BINS; i++) {
+        quick_lists[i] = 0;
+    }
+    quick_blocks = 0;
+    memset(&counters, 0, sizeof(counters));
+    free_bytes = 0;
+    memset(free_counts, 0, sizeof(free_counts));
 
-    start.data = -(MEMORY_SIZE - 2 * header_size);
-    end.data = -(MEMORY_SIZE - 2 * header_size);
+    /* drop any arenas mapped for the previous pool */
+    for (a = (arenas != 0) ? arenas->next : 0; a != 0; a = next) {
+        next = a->next;
+        munmap(a, a->mapped_size);
+    }
+    spare_arena = 0;
 
-    *((struct header *) freeptr) = start;
-    *((struct header *)
-        ((void *) freeptr + MEMORY_SIZE - header_size)) = end;
+    backend = MYALLOC_BACKEND;
+    if (backend == MYALLOC_BUDDY) {
+        /* the buddy backend keeps its own structures in the pool */
+        buddy_init(freeptr, MEMORY_SIZE);
+        arenas = 0;
+    }
+    else {
+        /* put boundary tags on the full memory pool to start */
+        arena_init(&main_arena, freeptr, MEMORY_SIZE);
+        main_arena.mapped_size = 0;
+        arenas = &main_arena;
+    }
+
+    pool_generation++;
 }
 
 /* return smallest multiple of 4 greater than or equal to given size */
@@ -106,12 +523,247 @@ int aligned_size(int size) {
 }
 
 /*
- * Attempt to allocate a chunk of memory of "size" bytes.  Return 0 if
- * allocation fails.
+ * Find the best fit for an aligned "size" in one arena.  Returns the block's
+ * offset and stores its size in *best_size, or returns NO_BLOCK.
+ */
+static int arena_best_fit(struct arena *a, int size, int *best_size) {
+    int class, offset, curr_size, best_fit = NO_BLOCK;
+
+    /* look for best fit, starting at the smallest class that could hold it */
+    for (class = size_class(size); class < NUM_SIZE_CLASSES; class++) {
+        for (offset = a->free_lists[class]; offset != NO_BLOCK;
+             offset = links_at(a, offset)->next) {
+            curr_size = abs(block_at(a, offset)->data);
+
+            /* ties go to the lowest address, like an address-ordered scan */
+            if (curr_size >= size &&
+                (best_fit == NO_BLOCK || curr_size < *best_size ||
+                 (curr_size == *best_size && offset < best_fit))) {
+                best_fit = offset;
+                *best_size = curr_size;
+            }
+        }
+
+        /* everything in later classes is larger than this class's blocks */
+        if (best_fit != NO_BLOCK) {
+            break;
+        }
+    }
+
+    return best_fit;
+}
+
+/* get the payload size recorded in the header of an allocated block */
+static int block_size(unsigned char *ptr) {
+    return ((struct header *) ((void *) ptr - header_size))->data;
+}
+
+/*
+ * Get the bin for small blocks of the given payload size, or -1 if none.  The
+ * thread caches and the quick lists both use these bins.  Binned blocks hold
+ * a pointer to the next one, so 4-byte blocks are never binned.
+ */
+static int small_bin(int size) {
+    if (size < (int) sizeof(unsigned char *) || size > CACHE_MAX_SIZE) {
+        return -1;
+    }
+    return size / 4 - 1;
+}
+
+/*
+ * Push a block onto a singly-linked bin.  Payloads are only 4-byte aligned, so
+ * the link is copied in and out with memcpy().
+ */
+static void bin_push(unsigned char **head, unsigned char *ptr) {
+    memcpy(ptr, head, sizeof(unsigned char *));
+    *head = ptr;
+}
+
+/* pop the top block off of a non-empty singly-linked bin */
+static unsigned char *bin_pop(unsigned char **head) {
+    unsigned char *ptr = *head;
+
+    memcpy(head, ptr, sizeof(unsigned char *));
+    return ptr;
+}
+
+/*
+ * Take a block for an aligned "size" out of the free block at the given
+ * offset, splitting off the remainder if it is big enough to be a block.
+ */
+static unsigned char *carve(struct arena *a, int offset, int size) {
+    int best_size = abs(block_at(a, offset)->data), rest, dirty;
+
+    if (a == spare_arena) {
+        spare_arena = 0;
+    }
+    list_remove(a, offset);
+
+    if (best_size - size <= 2 * (int) header_size) {
+        /* no space for the extra free block so make larger block */
+        size = best_size;
+    }
+    else {
+        /* make the extra free block out of the remainder */
+        rest = offset + size + 2 * header_size;
+        set_tags(a, rest, -(best_size - size - 2 * (int) header_size));
+        list_insert(a, rest);
+        counters.splits++;
+    }
+
+    /* put in header and footer for the alloc block */
+    set_tags(a, offset, size);
+
+    /* note how much of the payload may be nonzero, then move the clean mark */
+    dirty = a->clean + CLEAN_SLOP - (offset + (int) header_size);
+    last_dirty = dirty < 0 ? 0 : (dirty > size ? size : dirty);
+    if (offset + size + 2 * (int) header_size > a->clean) {
+        a->clean = offset + size + 2 * header_size;
+    }
+
+    /* return pointer to beginning of the payload */
+    return (unsigned char *) ((void *) a->base + offset + header_size);
+}
+
+/*
+ * Best-fit search for an aligned "size" over the free lists of every arena.
+ * Return 0 if nothing fits.
+ */
+static unsigned char *pool_search(int size) {
+    struct arena *a, *best_arena = 0;
+    int offset, curr_size = 0, best_fit = NO_BLOCK, best_size = 0;
+
+    counters.searches++;
+
+    for (a = arenas; a != 0; a = a->next) {
+        offset = arena_best_fit(a, size, &curr_size);
+        if (offset != NO_BLOCK &&
+            (best_fit == NO_BLOCK || curr_size < best_size)) {
+            best_arena = a;
+            best_fit = offset;
+            best_size = curr_size;
+        }
+    }
+
+    if (best_fit == NO_BLOCK) {
+        return 0;
+    }
+
+    return carve(best_arena, best_fit, size);
+}
+
+/*
+ * Return a block to the shared pool.  The caller must hold pool_lock.
  *
- * Uses best-fit strategy.
+ * Coalesces all adjacent free blocks, takes constant time.  A mapped arena
+ * that ends up entirely free is unmapped, unless it can become the spare.
  */
-unsigned char *myalloc(int size) {
+static void pool_free(unsigned char *oldptr) {
+    struct arena *a = arena_of(oldptr);
+    int offset, size, start, new_size, prev_size, next;
+
+    /* get header of block being freed */
+    offset = offset_of(a, oldptr);
+    size = block_at(a, offset)->data;
+
+    if (size < 0) {
+        /* this is already free, so do nothing */
+        return;
+    }
+
+    start = offset;
+    new_size = size;
+
+    /* if not at the beginning, try to coalesce with previous */
+    if (offset != 0) {
+        prev_size = block_at(a, offset - header_size)->data;
+        if (prev_size < 0) {
+            start = offset - 2 * header_size + prev_size;
+            list_remove(a, start);
+            new_size += 2 * header_size - prev_size;
+            counters.coalesces++;
+        }
+    }
+
+    /* if not at the end, try to coalesce with next */
+    next = offset + size + 2 * header_size;
+    if (next != a->size && block_at(a, next)->data < 0) {
+        list_remove(a, next);
+        new_size += 2 * header_size - block_at(a, next)->data;
+        counters.coalesces++;
+    }
+
+    /* put in new headers for free block and make it available again */
+    set_tags(a, start, -new_size);
+    list_insert(a, start);
+
+    /* keep one empty mapped arena for the next burst, release the rest */
+    if (a->mapped_size != 0 && new_size == a->size - 2 * (int) header_size) {
+        if (spare_arena == 0) {
+            spare_arena = a;
+        }
+        else if (spare_arena != a) {
+            arena_release(a);
+        }
+    }
+}
+
+/*
+ * Shrink the allocated block at the given offset to an aligned "size" if the
+ * excess is big enough to be a block of its own, and free the excess.  The
+ * caller must hold pool_lock.
+ */
+static void split_tail(struct arena *a, int offset, int size) {
+    int total = block_at(a, offset)->data, rest;
+
+    if (total - size < 2 * (int) header_size + 4) {
+        return;
+    }
+
+    rest = offset + size + 2 * header_size;
+    set_tags(a, offset, size);
+    set_tags(a, rest, total - size - 2 * header_size);
+    pool_free((unsigned char *) block_at(a, rest) + header_size);
+}
+
+/*
+ * Coalesce everything parked on the quick lists back into the free lists in
+ * one pass.  The caller must hold pool_lock.
+ */
+static void quick_consolidate() {
+    struct timespec start, end;
+    int bin;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (bin = 0; bin < NUM_CACHE_BINS; bin++) {
+        while (quick_lists[bin] != 0) {
+            pool_free(bin_pop(&quick_lists[bin]));
+            counters.consolidated++;
+        }
+    }
+    quick_blocks = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    counters.consolidations++;
+    counters.consolidate_ns += (end.tv_sec - start.tv_sec) * 1000000000L +
+        (end.tv_nsec - start.tv_nsec);
+}
+
+/*
+ * Attempt to allocate a chunk of memory of "size" bytes from the shared pool.
+ * Return 0 if allocation fails.  The caller must hold pool_lock.
+ *
+ * With deferred coalescing a quick list holding this exact size is tried
+ * first.  Otherwise uses best-fit strategy over the segregated free lists of
+ * every arena; if nothing fits, the quick lists are coalesced and the search
+ * retried, and only then is a new arena mapped.
+ */
+static unsigned char *pool_alloc(int size) {
+    unsigned char *ptr;
+    struct arena *a;
+    int bin;
+
     /* get aligned size */
     size = aligned_size(size);
     /* Note:
@@ -120,69 +772,252 @@ unsigned char *myalloc(int size) {
      * results in faster reading and writing for most applications.
      */
 
-    unsigned char * current = freeptr, * best_fit;
-    int offset = 0, best_offset = 0, flag = 0,
-        needed_size = size + 2 * header_size, curr_size, best_size;
-
-    /* go through all memory looking for best fit */
-    while (1) {
-        /* get size of current block */
-        curr_size = ((struct header *) current)->data;
-
-        /* check if block is free and big enough */
-        if ((curr_size < 0) && (abs(curr_size) >= size)) {
-            if ((!flag) || ((flag) && (abs(curr_size) < abs(best_size)))) {
-                best_size = curr_size;
-                best_fit = current;
-                best_offset = offset;
-                flag = 1;
-            }
+    bin = small_bin(size);
+    if (bin >= 0 && quick_lists[bin] != 0) {
+        quick_blocks--;
+        counters.quick_allocs++;
+        last_dirty = size;
+        return bin_pop(&quick_lists[bin]);
+    }
+
+    ptr = pool_search(size);
+    if (ptr == 0 && quick_blocks > 0) {
+        quick_consolidate();
+        ptr = pool_search(size);
+    }
+
+    /* if never found a large enough free block, try to grow the pool */
+    if (ptr == 0) {
+        a = arena_create(size);
+        if (a != 0) {
+            ptr = carve(a, 0, size);
         }
+    }
 
-        /* find next header */
-        offset += abs(curr_size) + 2 * header_size;
+    return ptr;
+}
 
-        /* if gone beyond the end, end while loop */
-        if (offset >= MEMORY_SIZE - 2 * header_size) {
-            break;
+/*
+ * Release a block the caller no longer needs.  With deferred coalescing small
+ * blocks are parked on the quick list for their exact size, still tagged as
+ * allocated so their neighbours leave them alone; everything else is freed
+ * and coalesced right away.  The caller must hold pool_lock.
+ */
+static void pool_release(unsigned char *ptr) {
+    int bin = small_bin(block_size(ptr));
+
+    if (DEFERRED_COALESCING && bin >= 0) {
+        bin_push(&quick_lists[bin], ptr);
+        quick_blocks++;
+        counters.quick_frees++;
+        return;
+    }
+
+    pool_free(ptr);
+}
+
+
+/*
+ * Fill in a summary of the pool's free space.  Everything but the largest free
+ * block is maintained as blocks move on and off the free lists; the largest
+ * block is found by scanning only the highest non-empty size class, or the
+ * whole pool when that class holds only unlisted tiny blocks.  Blocks
+ * sitting in thread caches or on quick lists count as allocated.
+ */
+void myalloc_stats(struct myalloc_stats *stats) {
+    struct arena *a;
+    int class, offset, size;
+
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&pool_lock);
+
+    if (backend == MYALLOC_BUDDY) {
+        buddy_stats(stats);
+        pthread_mutex_unlock(&pool_lock);
+        return;
+    }
+
+    for (a = arenas; a != 0; a = a->next) {
+        stats->arenas++;
+        stats->pool_bytes += a->size;
+    }
+
+    stats->free_bytes = free_bytes;
+    for (class = 0; class < NUM_SIZE_CLASSES; class++) {
+        stats->free_blocks_by_class[class] = free_counts[class];
+        stats->free_blocks += free_counts[class];
+    }
+
+    for (class = NUM_SIZE_CLASSES - 1; class >= 0; class--) {
+        if (free_counts[class] == 0) {
+            continue;
+        }
+
+        for (a = arenas; a != 0; a = a->next) {
+            for (offset = a->free_lists[class]; offset != NO_BLOCK;
+                 offset = links_at(a, offset)->next) {
+                size = abs(block_at(a, offset)->data);
+                if (size > stats->largest_free) {
+                    stats->largest_free = size;
+                }
+            }
+        }
+
+        /*
+         * Tiny unlisted blocks all fall in class 0, below MIN_BLOCK_SIZE.
+         * If they are the only free blocks, walk the arenas' tags for them.
+         */
+        if (stats->largest_free == 0) {
+            for (a = arenas; a != 0; a = a->next) {
+                for (offset = 0; offset < a->size;
+                     offset += abs(size) + 2 * header_size) {
+                    size = block_at(a, offset)->data;
+                    if (-size > stats->largest_free) {
+                        stats->largest_free = -size;
+                    }
+                }
+            }
         }
+        break;
+    }
+
+    pthread_mutex_unlock(&pool_lock);
 
-        /* move forward to next header if not beyond end */
-        current = ((void *) freeptr) + offset;
+    if (stats->free_bytes > 0) {
+        stats->fragmentation =
+            1.0 - (double) stats->largest_free / (double) stats->free_bytes;
     }
+}
 
-    /* if never found a large enough free block, return 0 */
-    if (!flag) {
-        return 0;
+
+/* Copy the allocator's event counters into *result. */
+void get_myalloc_counters(struct myalloc_counters *result) {
+    pthread_mutex_lock(&pool_lock);
+    *result = counters;
+    if (backend == MYALLOC_BUDDY) {
+        /* the buddy backend counts its own searches, splits and merges */
+        buddy_counters(result);
+        result->reallocs_in_place = counters.reallocs_in_place;
+        result->reallocs_moved = counters.reallocs_moved;
     }
+    pthread_mutex_unlock(&pool_lock);
+}
 
-    /* can allocate at best_fit */
-    struct header start, end;
 
-    if ((abs(best_size) <= size + 2 * header_size) && (abs(best_size) != size)) {
-        /* no space for the extra free block headers so make larger block */
-        size = abs(best_size);
+/* push a block onto its bin in this thread's cache */
+static void cache_push(int bin, unsigned char *ptr) {
+    bin_push(&cache.head[bin], ptr);
+    cache.count[bin]++;
+}
+
+/* pop the top block off of a non-empty bin in this thread's cache */
+static unsigned char *cache_pop(int bin) {
+    cache.count[bin]--;
+    return bin_pop(&cache.head[bin]);
+}
+
+/* hand up to n blocks from a bin back to the pool under a single lock */
+static void cache_flush_bin(int bin, int n) {
+    pthread_mutex_lock(&pool_lock);
+    while (n-- > 0 && cache.count[bin] > 0) {
+        pool_release(cache_pop(bin));
     }
-    else if (abs(best_size) > size) {
-        /* make the extra free block */
-        /* put in header and footer for remaining free block */
-        struct header start, end;
-        start.data = -(abs(best_size) - needed_size);
-        end.data = -(abs(best_size) - needed_size);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/* thread-exit destructor, gives every cached block back to the pool */
+static void cache_destroy(void *unused) {
+    int bin;
 
-        *((struct header *) ((void *) best_fit + needed_size)) = start;
-        *((struct header *) ((void *) best_fit + abs(best_size) +
-            header_size)) = end;
+    if (cache.generation != pool_generation) {
+        return;
     }
 
-    /* put in header and footer for the alloc block */
-    end.data = size;
-    start.data = size;
-    *((struct header *) best_fit) = start;
-    *((struct header *) ((void *) best_fit + size + header_size)) = end;
+    for (bin = 0; bin < NUM_CACHE_BINS; bin++) {
+        cache_flush_bin(bin, cache.count[bin]);
+    }
+}
 
-    /* return pointer to beginning of the payload */
-    return (unsigned char *) ((void *) best_fit + header_size);
+static void cache_make_key() {
+    pthread_key_create(&cache_key, cache_destroy);
+}
+
+/*
+ * Make sure this thread's cache refers to the current pool.  Caches left over
+ * from before the last init_myalloc() point into a discarded pool, so they are
+ * simply emptied.
+ */
+static void cache_check() {
+    int bin;
+
+    if (cache.generation == pool_generation) {
+        return;
+    }
+
+    for (bin = 0; bin < NUM_CACHE_BINS; bin++) {
+        cache.count[bin] = 0;
+    }
+    cache.generation = pool_generation;
+
+    if (!cache.registered) {
+        pthread_once(&cache_key_once, cache_make_key);
+        pthread_setspecific(cache_key, &cache);
+        cache.registered = 1;
+    }
+}
+
+/*
+ * Attempt to allocate a chunk of memory of "size" bytes.  Return 0 if
+ * allocation fails.
+ *
+ * Small requests are served from this thread's cache when possible.  An empty
+ * bin is refilled with a batch of blocks from the pool under one lock.
+ */
+unsigned char *myalloc(int size) {
+    unsigned char *ptr;
+    int bin, n;
+
+    PROBE_BEGIN(myalloc_probe);
+
+    if (backend == MYALLOC_BUDDY) {
+        pthread_mutex_lock(&pool_lock);
+        ptr = buddy_alloc(size);
+        pthread_mutex_unlock(&pool_lock);
+        PROBE_END(myalloc_probe);
+        return ptr;
+    }
+
+    bin = small_bin(aligned_size(size));
+    if (THREAD_CACHE_SIZE > 0 && bin >= 0) {
+        cache_check();
+
+        if (cache.count[bin] == 0) {
+            PROBE_COUNT(refill_probe);
+            pthread_mutex_lock(&pool_lock);
+            for (n = THREAD_CACHE_SIZE / 2; n > 0; n--) {
+                ptr = pool_alloc(size);
+                if (ptr == 0) {
+                    break;
+                }
+                cache_push(bin, ptr);
+            }
+            pthread_mutex_unlock(&pool_lock);
+        }
+
+        if (cache.count[bin] > 0) {
+            ptr = cache_pop(bin);
+            PROBE_END(myalloc_probe);
+            return ptr;
+        }
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    ptr = pool_alloc(size);
+    pthread_mutex_unlock(&pool_lock);
+
+    PROBE_END(myalloc_probe);
+    return ptr;
 }
 
 
@@ -190,77 +1025,431 @@ unsigned char *myalloc(int size) {
  * Free a previously allocated pointer.  oldptr should be an address returned by
  * myalloc().
  *
- * Coalesces all adjacent free blocks, takes constant time.
+ * Small blocks go into this thread's cache; when a bin overflows, half of it
+ * is returned to the pool under one lock.
  */
 void myfree(unsigned char *oldptr) {
-    int size, next_size, prev_size, new_size, start_offset, flag = 0;
-    struct header * prev_end, * next_end, * curr_end, new_start, new_end;
+    int bin;
 
-    /* get header of block being freed */
-    curr_end = (struct header *) ((void *) oldptr - header_size);
-    size = curr_end->data;
+    PROBE_BEGIN(myfree_probe);
 
-    if (size < 0) {
-        /* this is already free, so do nothing */
+    if (backend == MYALLOC_BUDDY) {
+        pthread_mutex_lock(&pool_lock);
+        buddy_free(oldptr);
+        pthread_mutex_unlock(&pool_lock);
+        PROBE_END(myfree_probe);
+        return;
+    }
+
+    bin = small_bin(block_size(oldptr));
+
+    if (THREAD_CACHE_SIZE > 0 && bin >= 0) {
+        cache_check();
+
+        cache_push(bin, oldptr);
+        if (cache.count[bin] > THREAD_CACHE_SIZE) {
+            cache_flush_bin(bin, cache.count[bin] - THREAD_CACHE_SIZE / 2);
+        }
+        PROBE_END(myfree_probe);
         return;
     }
 
-    /* get headers of adjacent blocks */
-    prev_end = (struct header *) ((void *) curr_end - header_size);
-    next_end = (struct header *) ((void *) curr_end + size + 2 * header_size);
+    pthread_mutex_lock(&pool_lock);
+    pool_release(oldptr);
+    pthread_mutex_unlock(&pool_lock);
+    PROBE_END(myfree_probe);
+}
+
 
-    prev_size = prev_end->data;
-    next_size = next_end->data;
+/*
+ * Try to resize the block at ptr to an aligned "size" without moving it,
+ * either by splitting off the excess or by absorbing a free successor.
+ * Return 1 on success.  The caller must hold pool_lock.
+ */
+static int resize_in_place(unsigned char *ptr, int size) {
+    struct arena *a = arena_of(ptr);
+    int offset = offset_of(a, ptr), curr_size = block_at(a, offset)->data;
+    int next = offset + curr_size + 2 * header_size, combined;
 
-    /* if at the beginning, do not coalesce with previous */
-    if (curr_end == (struct header *) freeptr) {
-        prev_size = 0;
+    if (size <= curr_size) {
+        split_tail(a, offset, size);
+        return 1;
     }
 
-    /* if at the end, do not coalesce with next */
-    if (next_end == (struct header *) ((void *) freeptr + MEMORY_SIZE)) {
-        next_size = 0;
+    if (next == a->size || block_at(a, next)->data >= 0) {
+        return 0;
     }
 
-    /* check which of adjacent blocks are free */
-    if (prev_size < 0) {
-        if (next_size < 0) {
-            /* join all three */
-            start_offset = -(2 * header_size + abs(prev_size));
-            new_size = 4 * header_size + abs(prev_size) +
-                abs(next_size) + abs(size);
-        }
-        else {
-            /* join with prev */
-            start_offset = -(2 * header_size + abs(prev_size));
-            new_size = 2 * header_size + abs(prev_size) +
-                abs(size);
-        }
+    combined = curr_size + 2 * header_size - block_at(a, next)->data;
+    if (combined < size) {
+        return 0;
+    }
+
+    /* merge the successor into this block, then give back what isn't needed */
+    list_remove(a, next);
+    set_tags(a, offset, combined);
+    split_tail(a, offset, size);
+
+    /* the grown payload has now been handed out, so move the clean mark */
+    next = offset + block_at(a, offset)->data + 2 * header_size;
+    if (next > a->clean) {
+        a->clean = next;
+    }
+    return 1;
+}
+
+/*
+ * Resize a block previously returned by myalloc() to "size" bytes, returning
+ * its new address, or 0 if there is no room (in which case the old block is
+ * left alone).  The block grows in place when the block after it is free and
+ * big enough; otherwise the contents are copied to a new block.  A null ptr
+ * behaves like myalloc(), and a zero size like myfree().  Slab objects cannot
+ * be resized.
+ */
+unsigned char *myrealloc(unsigned char *ptr, int size) {
+    unsigned char *result;
+    int old_size, done;
+
+    if (ptr == 0) {
+        return myalloc(size);
+    }
+    if (size == 0) {
+        myfree(ptr);
+        return 0;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    if (backend == MYALLOC_BUDDY) {
+        /* a buddy block can only stay put if it is already big enough */
+        old_size = buddy_block_size(ptr);
+        done = (size <= old_size);
     }
     else {
-        if (next_size < 0) {
-            /* join with next */
-            start_offset = 0;
-            new_size = 2 * header_size + abs(next_size) +
-                abs(size);
+        old_size = block_size(ptr);
+        done = resize_in_place(ptr, aligned_size(size));
+    }
+    if (done) {
+        counters.reallocs_in_place++;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (done) {
+        return ptr;
+    }
+
+    result = myalloc(size);
+    if (result == 0) {
+        return 0;
+    }
+    memcpy(result, ptr, old_size < size ? old_size : size);
+    myfree(ptr);
+
+    pthread_mutex_lock(&pool_lock);
+    counters.reallocs_moved++;
+    pthread_mutex_unlock(&pool_lock);
+
+    return result;
+}
+
+/*
+ * Allocate a zeroed array of "count" elements of "size" bytes each.  Return 0
+ * if the total overflows or allocation fails.  Memory that has never been
+ * handed out is still zero, so only the part of the block that may have been
+ * used before is cleared.
+ */
+unsigned char *mycalloc(int count, int size) {
+    unsigned char *ptr;
+    int bytes, dirty;
+
+    if (count < 0 || size < 0 || (size != 0 && count > INT_MAX / size)) {
+        return 0;
+    }
+    bytes = count * size;
+
+    pthread_mutex_lock(&pool_lock);
+    if (backend == MYALLOC_BUDDY) {
+        ptr = buddy_alloc(bytes);
+        dirty = bytes;
+    }
+    else {
+        ptr = pool_alloc(bytes);
+        dirty = last_dirty;
+    }
+    if (ptr != 0) {
+        counters.calloc_bytes_skipped += bytes - (dirty < bytes ? dirty : bytes);
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (ptr != 0) {
+        memset(ptr, 0, dirty < bytes ? dirty : bytes);
+    }
+
+    return ptr;
+}
+
+
+/*
+ * Allocate a pool block of at least "size" bytes whose payload starts at a
+ * multiple of "align", which must be a power of two no smaller than 4.  The
+ * request is padded so that the slack in front of the aligned address is
+ * either zero or large enough to become a free block of its own; the slack is
+ * given back to the pool, as is any excess at the end.  The caller must hold
+ * pool_lock.
+ */
+static unsigned char *pool_alloc_aligned(int size, int align) {
+    int min_split = 2 * header_size + 4, slack, total;
+    unsigned char *ptr, *aligned;
+    struct arena *a;
+
+    size = aligned_size(size);
+    ptr = pool_alloc(size + align + min_split);
+    if (ptr == 0) {
+        return 0;
+    }
+
+    if (((uintptr_t) ptr & (align - 1)) == 0) {
+        aligned = ptr;
+    }
+    else {
+        aligned = (unsigned char *)
+            (((uintptr_t) ptr + min_split + align - 1) & ~(uintptr_t) (align - 1));
+    }
+    slack = aligned - ptr;
+    total = block_size(ptr);
+    a = arena_of(ptr);
+
+    /* split off the front slack as its own block, then free it */
+    if (slack > 0) {
+        set_tags(a, offset_of(a, ptr), slack - 2 * header_size);
+        set_tags(a, offset_of(a, aligned), total - slack);
+        pool_free(ptr);
+    }
+
+    /* split off whatever is left past the requested size, then free it */
+    split_tail(a, offset_of(a, aligned), size);
+
+    return aligned;
+}
+
+
+/*
+ * Allocate a chunk of memory of "size" bytes starting at a multiple of
+ * "alignment", which must be a power of two.  Return 0 if the alignment is not
+ * a power of two or allocation fails.  The slack in front of the aligned
+ * block is split off as an ordinary free block, so it is not wasted.  The
+ * result can be passed to myfree() like any other block, but myrealloc() may
+ * move it to an address without the alignment.
+ */
+unsigned char *myalloc_aligned(int size, int alignment) {
+    unsigned char *ptr;
+
+    /* the buddy backend does not support aligned blocks */
+    if (alignment <= 0 || (alignment & (alignment - 1)) != 0 ||
+        backend == MYALLOC_BUDDY) {
+        return 0;
+    }
+
+    /* every block is already 4-byte aligned */
+    if (alignment <= 4) {
+        return myalloc(size);
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    ptr = pool_alloc_aligned(size, alignment);
+    pthread_mutex_unlock(&pool_lock);
+
+    return ptr;
+}
+
+
+/* take a run out of its slab's run list */
+static void run_unlink(struct slab *slab, struct slab_run *run) {
+    if (run->prev != 0) {
+        run->prev->next = run->next;
+    }
+    else {
+        slab->first = run->next;
+    }
+
+    if (run->next != 0) {
+        run->next->prev = run->prev;
+    }
+    else {
+        slab->last = run->prev;
+    }
+}
+
+/* put a run at the front of its slab's run list */
+static void run_push_front(struct slab *slab, struct slab_run *run) {
+    run->prev = 0;
+    run->next = slab->first;
+    if (slab->first != 0) {
+        slab->first->prev = run;
+    }
+    else {
+        slab->last = run;
+    }
+    slab->first = run;
+}
+
+/* put a run at the back of its slab's run list */
+static void run_push_back(struct slab *slab, struct slab_run *run) {
+    run->next = 0;
+    run->prev = slab->last;
+    if (slab->last != 0) {
+        slab->last->next = run;
+    }
+    else {
+        slab->first = run;
+    }
+    slab->last = run;
+}
+
+/* carve a new, entirely free run for a slab out of the pool */
+static struct slab_run *run_create(struct slab *slab) {
+    struct slab_run *run;
+    int i, words = (slab->objects_per_run + BITMAP_BITS - 1) / BITMAP_BITS;
+
+    pthread_mutex_lock(&pool_lock);
+    run = (struct slab_run *) pool_alloc_aligned(SLAB_RUN_SIZE, SLAB_RUN_SIZE);
+    pthread_mutex_unlock(&pool_lock);
+    if (run == 0) {
+        return 0;
+    }
+
+    run->slab = slab;
+    run->free_count = slab->objects_per_run;
+    for (i = 0; i < words; i++) {
+        run->bitmap[i] = ~(uint32_t) 0;
+    }
+    /* clear the bits past the last object so they are never handed out */
+    if (slab->objects_per_run % BITMAP_BITS != 0) {
+        run->bitmap[words - 1] =
+            ((uint32_t) 1 << (slab->objects_per_run % BITMAP_BITS)) - 1;
+    }
+
+    return run;
+}
+
+
+/*
+ * Create a slab that allocates objects of "size" bytes.  The slab descriptor
+ * itself lives in the pool.  Returns 0 if the pool is out of memory or the
+ * objects are too large to share a run.
+ */
+struct slab *slab_create(int size) {
+    struct slab *slab;
+    int n, offset;
+
+    /* slab runs need aligned blocks, which the buddy backend cannot carve */
+    if (backend == MYALLOC_BUDDY) {
+        return 0;
+    }
+
+    size = aligned_size(size);
+    if (size < 4) {
+        size = 4;
+    }
+
+    /* fit as many objects as possible in a run, after the header and bitmap */
+    n = (SLAB_RUN_SIZE - (int) sizeof(struct slab_run)) * 8 / (size * 8 + 1);
+    while (n > 0) {
+        offset = aligned_size(sizeof(struct slab_run) +
+            (n + BITMAP_BITS - 1) / BITMAP_BITS * sizeof(uint32_t));
+        if (offset + n * size <= SLAB_RUN_SIZE) {
+            break;
         }
-        else {
-            /* no joining, just switch to free by changing sign of data */
-            flag = 1;
-            curr_end->data *= -1;
-            ((struct header *)
-                ((void *) curr_end + size + header_size))->data *= -1;
+        n--;
+    }
+    if (n < 2) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    slab = (struct slab *)
+        pool_alloc_aligned(sizeof(struct slab), sizeof(void *));
+    pthread_mutex_unlock(&pool_lock);
+    if (slab == 0) {
+        return 0;
+    }
+
+    slab->object_size = size;
+    slab->objects_per_run = n;
+    slab->objects_offset = offset;
+    slab->first = 0;
+    slab->last = 0;
+
+    return slab;
+}
+
+/*
+ * Allocate one object from a slab.  Return 0 if a new run is needed and the
+ * pool is out of memory.
+ */
+unsigned char *slab_alloc(struct slab *slab) {
+    struct slab_run *run = slab->first;
+    int word, bit;
+
+    if (run == 0 || run->free_count == 0) {
+        run = run_create(slab);
+        if (run == 0) {
+            return 0;
         }
+        run_push_front(slab, run);
     }
 
-    /* put in new headers for free block if needed */
-    if (!flag) {
-        new_start.data = -new_size;
-        new_end.data = -new_size;
+    for (word = 0; run->bitmap[word] == 0; word++)
+        ;
+    bit = __builtin_ctz(run->bitmap[word]);
+    run->bitmap[word] &= ~((uint32_t) 1 << bit);
+
+    /* full runs go to the back, so the first run always has room if any do */
+    if (--run->free_count == 0) {
+        run_unlink(slab, run);
+        run_push_back(slab, run);
+    }
+
+    return (unsigned char *) run + slab->objects_offset +
+        (word * BITMAP_BITS + bit) * slab->object_size;
+}
+
+/* Return an object previously handed out by slab_alloc() to its slab. */
+void slab_free(struct slab *slab, unsigned char *ptr) {
+    struct slab_run *run = (struct slab_run *)
+        ((uintptr_t) ptr & ~(uintptr_t) (SLAB_RUN_SIZE - 1));
+    int index = (ptr - (unsigned char *) run - slab->objects_offset) /
+        slab->object_size;
+
+    if (run->bitmap[index / BITMAP_BITS] & ((uint32_t) 1 << (index % BITMAP_BITS))) {
+        /* this is already free, so do nothing */
+        return;
+    }
+    run->bitmap[index / BITMAP_BITS] |= (uint32_t) 1 << (index % BITMAP_BITS);
+    run->free_count++;
+
+    if (run->free_count == slab->objects_per_run && slab->first != slab->last) {
+        /* give back an empty run, unless it is the only one */
+        run_unlink(slab, run);
+        pthread_mutex_lock(&pool_lock);
+        pool_free((unsigned char *) run);
+        pthread_mutex_unlock(&pool_lock);
+    }
+    else if (run->free_count == 1) {
+        /* a full run has room again, so it moves ahead of the full runs */
+        run_unlink(slab, run);
+        run_push_front(slab, run);
+    }
+}
+
+/* Give every run of a slab, and the slab itself, back to the pool. */
+void slab_destroy(struct slab *slab) {
+    struct slab_run *run, *next;
 
-        *((struct header *)
-            ((void *) curr_end + start_offset)) = new_start;
-        *((struct header *)
-            ((void *) oldptr + start_offset + new_size)) = new_end;
+    pthread_mutex_lock(&pool_lock);
+    for (run = slab->first; run != 0; run = next) {
+        next = run->next;
+        pool_free((unsigned char *) run);
     }
+    pool_free((unsigned char *) slab);
+    pthread_mutex_unlock(&pool_lock);
 }
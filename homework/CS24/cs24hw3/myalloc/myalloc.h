@@ -12,6 +12,74 @@
 /*! Specifies the size of the memory pool the allocator has to work with. */
 extern int MEMORY_SIZE;
 
+/*!
+ * Specifies how many freed blocks each thread may cache per size bin before
+ * handing them back to the shared pool.  Zero (the default) disables caching.
+ */
+extern int THREAD_CACHE_SIZE;
+
+/*!
+ * Specifies the minimum size of the extra arenas mapped from the OS once the
+ * pool is exhausted.  Zero (the default) keeps the pool at MEMORY_SIZE.
+ */
+extern int ARENA_SIZE;
+
+/*! Allocator backends that init_myalloc() can set the pool up for. */
+#define MYALLOC_BEST_FIT 0
+#define MYALLOC_BUDDY 1
+
+/*!
+ * Selects the backend used from the next init_myalloc() on; MYALLOC_BEST_FIT
+ * by default.
+ */
+extern int MYALLOC_BACKEND;
+
+/*! Nonzero to defer coalescing of small freed blocks; zero by default. */
+extern int DEFERRED_COALESCING;
+
+/*!
+ * Number of size classes the free lists are segregated into.  Class 0 holds
+ * free blocks below 16 bytes, class k holds [2^(k+3), 2^(k+4)) bytes, and the
+ * last class everything larger.
+ */
+#define MYALLOC_SIZE_CLASSES 24
+
+/*! A summary of the pool's free space, see myalloc_stats(). */
+struct myalloc_stats {
+    /* arenas in the pool, and their combined size including tags */
+    int arenas;
+    long pool_bytes;
+    /* payload bytes in free blocks, and the number of free blocks */
+    long free_bytes;
+    long free_blocks;
+    long free_blocks_by_class[MYALLOC_SIZE_CLASSES];
+    /* payload size of the largest free block */
+    int largest_free;
+    /* external fragmentation, 1 - largest_free / free_bytes */
+    double fragmentation;
+};
+
+/*! Event counters kept by the allocator since the last init_myalloc(). */
+struct myalloc_counters {
+    /* frees parked on a quick list, and allocations served from one */
+    long quick_frees;
+    long quick_allocs;
+    /* best-fit searches of the free lists */
+    long searches;
+    /* free blocks split by an allocation, and merges of neighbouring blocks */
+    long splits;
+    long coalesces;
+    /* passes that coalesced the quick lists, blocks they freed, time spent */
+    long consolidations;
+    long consolidated;
+    long consolidate_ns;
+    /* myrealloc() calls resized in place, and those that had to move */
+    long reallocs_in_place;
+    long reallocs_moved;
+    /* bytes mycalloc() did not have to clear because they were never used */
+    long calloc_bytes_skipped;
+};
+
 
 /* Initializes allocator state, and memory pool state too. */
 void init_myalloc();
@@ -22,6 +90,37 @@ int aligned_size(int size);
 /* Attempt to allocate a chunk of memory of "size" bytes. */
 unsigned char * myalloc(int size);
 
+/* Allocate "size" bytes aligned to a power-of-two "alignment". */
+unsigned char * myalloc_aligned(int size, int alignment);
+
 /* Free a previously allocated pointer. */
 void myfree(unsigned char *oldptr);
 
+/* Resize a previously allocated block, growing it in place when possible. */
+unsigned char * myrealloc(unsigned char *ptr, int size);
+
+/* Allocate a zero-filled array of "count" elements of "size" bytes. */
+unsigned char * mycalloc(int count, int size);
+
+/* Get a summary of the pool's free space. */
+void myalloc_stats(struct myalloc_stats *stats);
+
+/* Get a snapshot of the allocator's event counters. */
+void get_myalloc_counters(struct myalloc_counters *result);
+
+
+
+/* A fixed-size object allocator that carves its storage out of the pool. */
+struct slab;
+
+/* Create a slab handing out objects of "size" bytes. */
+struct slab *slab_create(int size);
+
+/* Allocate one object from a slab. */
+unsigned char *slab_alloc(struct slab *slab);
+
+/* Return an object to the slab it was allocated from. */
+void slab_free(struct slab *slab, unsigned char *ptr);
+
+/* Release a slab and all of its objects back to the pool. */
+void slab_destroy(struct slab *slab);
@@ -0,0 +1,143 @@
+/*! \file
+ * Replays an allocation trace against the allocator.  The trace is run once
+ * purely for timing, to report nanoseconds per operation, and then again while
+ * tracking the live bytes and the pool footprint (the highest pool address in
+ * use), to report peak footprint and external fragmentation over time.
+ *
+ * Usage:  replaytrace [-d] [-b] trace-file [memory-size]
+ *
+ * -d turns on deferred coalescing and -b selects the buddy backend, so that
+ * policies can be compared on the same trace.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "myalloc.h"
+#include "sequence.h"
+#include "trace.h"
+
+// number of fragmentation samples printed over the course of the trace
+#define NUM_SAMPLES 20
+
+// the pool that myalloc() works against
+extern unsigned char *mem;
+
+
+// replay the whole sequence once, return elapsed nanoseconds or -1 on failure
+long replay_timed(SEQLIST *seq, int mem_size) {
+  struct timespec start, end;
+  SEQLIST *sptr;
+  unsigned char *block;
+
+  MEMORY_SIZE = mem_size;
+  init_myalloc();
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (sptr = seq; !seq_null(sptr); sptr = seq_next(sptr)) {
+    if (seq_alloc(sptr)) {
+      block = myalloc(seq_size(sptr));
+      if (block == 0)
+        return -1;
+      seq_set_myalloc_block(sptr, block);
+    }
+    else {
+      myfree(seq_myalloc_block(seq_tofree(sptr)));
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  return (end.tv_sec - start.tv_sec) * 1000000000L +
+    (end.tv_nsec - start.tv_nsec);
+}
+
+
+// replay again, printing live bytes, footprint and fragmentation as it goes
+void replay_footprint(SEQLIST *seq, int mem_size, long num_ops) {
+  SEQLIST *sptr;
+  unsigned char *block;
+  long op = 0, live = 0, peak_live = 0, footprint = 0, end;
+  long sample_every = num_ops / NUM_SAMPLES > 0 ? num_ops / NUM_SAMPLES : 1;
+
+  MEMORY_SIZE = mem_size;
+  init_myalloc();
+
+  printf("%10s %12s %12s %14s\n", "op", "live", "footprint", "fragmentation");
+
+  for (sptr = seq; !seq_null(sptr); sptr = seq_next(sptr)) {
+    if (seq_alloc(sptr)) {
+      block = myalloc(seq_size(sptr));
+      seq_set_myalloc_block(sptr, block);
+      live += seq_size(sptr);
+
+      // only the main pool counts towards the footprint
+      end = block + seq_size(sptr) - mem;
+      if (block >= mem && end <= mem_size && end > footprint)
+        footprint = end;
+      if (live > peak_live)
+        peak_live = live;
+    }
+    else {
+      myfree(seq_myalloc_block(seq_tofree(sptr)));
+      live -= seq_size(seq_tofree(sptr));
+    }
+
+    op++;
+    if (op % sample_every == 0 || seq_null(seq_next(sptr))) {
+      printf("%10ld %12ld %12ld %14f\n", op, live, footprint,
+             footprint > 0 ? 1.0 - (double) live / (double) footprint : 0.0);
+    }
+  }
+
+  printf("Peak live bytes: %ld\n", peak_live);
+  printf("Peak footprint:  %ld\n", footprint);
+  printf("Peak utilization: %f\n",
+         footprint > 0 ? (double) peak_live / (double) footprint : 0.0);
+}
+
+
+int main(int argc, char *argv[]) {
+  SEQLIST *seq, *sptr;
+  int arg = 1, mem_size = 1 << 26;
+  long num_ops = 0, ns;
+
+  for (; arg < argc && argv[arg][0] == '-'; arg++) {
+    if (strcmp(argv[arg], "-d") == 0)
+      DEFERRED_COALESCING = 1;
+    else if (strcmp(argv[arg], "-b") == 0)
+      MYALLOC_BACKEND = MYALLOC_BUDDY;
+  }
+
+  if (arg >= argc) {
+    fprintf(stderr, "usage: %s [-d] [-b] trace-file [memory-size]\n",
+            argv[0]);
+    return 1;
+  }
+
+  seq = trace_read_sequence(argv[arg]);
+  if (seq_null(seq)) {
+    fprintf(stderr, "%s: could not read trace\n", argv[arg]);
+    return 1;
+  }
+  if (arg + 1 < argc)
+    mem_size = atoi(argv[arg + 1]);
+
+  for (sptr = seq; !seq_null(sptr); sptr = seq_next(sptr))
+    num_ops++;
+
+  ns = replay_timed(seq, mem_size);
+  if (ns < 0) {
+    printf("Trace does not fit in a pool of %d bytes.\n", mem_size);
+    return 1;
+  }
+
+  printf("Replayed %ld operations%s%s\n", num_ops,
+         MYALLOC_BACKEND == MYALLOC_BUDDY ? " with the buddy backend" : "",
+         DEFERRED_COALESCING ? " with deferred coalescing" : "");
+  printf("Time: %f ns/op\n", (double) ns / (double) num_ops);
+
+  replay_footprint(seq, mem_size, num_ops);
+  return 0;
+}
@@ -27,6 +27,7 @@ SEQLIST *seq_add_front(int size, unsigned char *ref_block, SEQLIST *next) {
   result->myalloc_block = (unsigned char *) 0;
   result->tofree = (SEQLIST *) 0;
   result->next = next;
+  result->id = 0;
   return result;
 }
 
@@ -47,6 +48,7 @@ SEQLIST *seq_set_next_allocate(int size, unsigned char *ref_block,
   result->myalloc_block = (unsigned char *) 0;
   result->tofree = (SEQLIST *) 0;
   result->next = (SEQLIST *) 0;
+  result->id = 0;
   prev->next = result;
 
   return result;
@@ -69,6 +71,7 @@ SEQLIST *seq_set_next_free(SEQLIST *tofree, SEQLIST *prev) {
   result->myalloc_block = (unsigned char *) 0;
   result->tofree = tofree;
   result->next = (SEQLIST *) 0;
+  result->id = 0;
   prev->next = result;
 
   return result;
@@ -18,6 +18,7 @@ typedef struct sequence_struct {
   struct sequence_struct *tofree; // for a free, the sequence_struct
                                   // whose allocation should be freed
   struct sequence_struct *next;  // next pointer
+  int id; // for an allocate, its allocation id in a trace file
 } SEQLIST;
 
 // add to front, always an allocate
@@ -0,0 +1,85 @@
+/*! \file
+ * Tester for myalloc_aligned().  Blocks of random sizes are allocated with
+ * every power-of-two alignment up to 4KiB, mixed with ordinary allocations,
+ * and checked for alignment and integrity.  Once everything is freed the
+ * pool must be a single block again, showing the slack in front of each
+ * aligned block was reclaimed.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "myalloc.h"
+
+#define NUM_BLOCKS 500
+#define ITERATIONS 50000
+#define MAX_BLOCK_SIZE 600
+
+
+int main(int argc, char *argv[]) {
+  unsigned char *blocks[NUM_BLOCKS] = { 0 };
+  int sizes[NUM_BLOCKS], aligns[NUM_BLOCKS];
+  struct myalloc_stats stats;
+  int failed = 0;
+  int i, j, k;
+
+  MEMORY_SIZE = 1 << 22;
+  init_myalloc();
+
+  // alignments that are not powers of two are refused
+  if (myalloc_aligned(16, 24) != 0 || myalloc_aligned(16, 0) != 0) {
+    printf("bad alignment accepted\n");
+    failed = 1;
+  }
+
+  for (i = 0; i < ITERATIONS; i++) {
+    j = rand() % NUM_BLOCKS;
+
+    if (blocks[j] != 0) {
+      for (k = 0; k < sizes[j]; k++) {
+        if (blocks[j][k] != (unsigned char) (j + k))
+          failed = 1;
+      }
+      myfree(blocks[j]);
+      blocks[j] = 0;
+    }
+    else {
+      sizes[j] = 1 + rand() % MAX_BLOCK_SIZE;
+      // a quarter of the blocks are ordinary allocations
+      aligns[j] = (rand() % 4 == 0) ? 4 : 1 << (3 + rand() % 10);
+      blocks[j] = myalloc_aligned(sizes[j], aligns[j]);
+      if (blocks[j] == 0) {
+        printf("myalloc_aligned(%d, %d) ran out of memory\n", sizes[j],
+               aligns[j]);
+        return 1;
+      }
+      if (((uintptr_t) blocks[j] & (aligns[j] - 1)) != 0) {
+        printf("block %p not aligned to %d\n", blocks[j], aligns[j]);
+        failed = 1;
+      }
+      for (k = 0; k < sizes[j]; k++)
+        blocks[j][k] = (unsigned char) (j + k);
+    }
+  }
+
+  for (j = 0; j < NUM_BLOCKS; j++) {
+    if (blocks[j] != 0)
+      myfree(blocks[j]);
+  }
+
+  myalloc_stats(&stats);
+  if (stats.free_blocks != 1 || stats.free_bytes != MEMORY_SIZE - 8) {
+    printf("Slack was not reclaimed: %ld free blocks, %ld free bytes\n",
+           stats.free_blocks, stats.free_bytes);
+    failed = 1;
+  }
+
+  if (failed) {
+    printf("Aligned test FAIL.\n");
+    return 1;
+  }
+
+  printf("Aligned test PASS.\n");
+  return 0;
+}
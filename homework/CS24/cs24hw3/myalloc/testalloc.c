@@ -10,10 +10,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "errno.h"
 #include "myalloc.h"
 #include "sequence.h"
+#include "trace.h"
 
 #define VERBOSE 0
 
@@ -289,6 +291,27 @@ int main(int argc, char *argv[]) {
   int memory_required;
 
   SEQLIST *test_sequence;
+  struct myalloc_counters counters;
+  struct myalloc_stats stats;
+  char *trace_file = 0;
+  int i;
+
+  // "-d" runs the sequences with deferred coalescing turned on, "-b" with
+  // the buddy backend, and "-w file" saves the generated sequence as a trace
+  // for replaytrace
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-d") == 0) {
+      DEFERRED_COALESCING = 1;
+      printf("deferred coalescing enabled\n");
+    }
+    else if (strcmp(argv[i], "-b") == 0) {
+      MYALLOC_BACKEND = MYALLOC_BUDDY;
+      printf("buddy allocator backend\n");
+    }
+    else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+      trace_file = argv[++i];
+    }
+  }
 
   max_used_memory = 2000;
   allocation_factor = 11;
@@ -300,6 +323,9 @@ int main(int argc, char *argv[]) {
   if (VERBOSE)
     seq_print(test_sequence);
 
+  if (trace_file != 0 && !trace_write_sequence(test_sequence, trace_file))
+    printf("Could not write trace to %s\n", trace_file);
+
   // check that allocation can actually do something.
   // This becomes upper bound on binary search.
   if (try_sequence(test_sequence, max_used_memory * allocation_factor * 2)) {
@@ -322,6 +348,21 @@ int main(int argc, char *argv[]) {
       // print statistics
       printf("Memory utilization: (%d/%d)=%f\n", max_used_memory, memory_required,
              ((double) max_used_memory / (double) memory_required));
+
+      // the free space left over at the end of the final run
+      myalloc_stats(&stats);
+      printf("Free bytes %ld in %ld blocks, largest %d, fragmentation %f\n",
+             stats.free_bytes, stats.free_blocks, stats.largest_free,
+             stats.fragmentation);
+
+      // counters describe the final run at the identified size
+      get_myalloc_counters(&counters);
+      printf("Searches %ld, splits %ld, coalesces %ld\n",
+             counters.searches, counters.splits, counters.coalesces);
+      printf("Quick list frees %ld, hits %ld, consolidations %ld "
+             "(%ld blocks, %ld ns)\n", counters.quick_frees,
+             counters.quick_allocs, counters.consolidations,
+             counters.consolidated, counters.consolidate_ns);
     }
     else {
       printf("Consistency problem: binary_search_reqruired_memory "
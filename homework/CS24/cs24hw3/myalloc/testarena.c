@@ -0,0 +1,110 @@
+/*! \file
+ * Growable pool tester.  Starting from a tiny pool, far more memory than the
+ * pool holds is allocated, filled and checked, so that the allocator has to map
+ * extra arenas.  Everything is then freed and allocated again to make sure the
+ * memory given back is usable.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "myalloc.h"
+
+#define NUM_BLOCKS 20000
+#define MAX_BLOCK_SIZE 300
+
+
+// allocate and fill every block, return 0 if anything could not be allocated
+int fill_all(unsigned char **blocks, int *sizes) {
+  int i, k;
+
+  for (i = 0; i < NUM_BLOCKS; i++) {
+    sizes[i] = 1 + rand() % MAX_BLOCK_SIZE;
+    blocks[i] = myalloc(sizes[i]);
+    if (blocks[i] == 0) {
+      return 0;
+    }
+    for (k = 0; k < sizes[i]; k++) {
+      blocks[i][k] = (unsigned char) (i + k);
+    }
+  }
+
+  return 1;
+}
+
+
+// check and free every block, return 0 if any were corrupted
+int check_and_free_all(unsigned char **blocks, int *sizes, int step) {
+  int i, k, start, result = 1;
+
+  // free in an interleaved order so the arenas empty out unevenly
+  for (start = 0; start < step; start++) {
+    for (i = start; i < NUM_BLOCKS; i += step) {
+      for (k = 0; k < sizes[i]; k++) {
+        if (blocks[i][k] != (unsigned char) (i + k)) {
+          result = 0;
+        }
+      }
+      myfree(blocks[i]);
+    }
+  }
+
+  return result;
+}
+
+
+int main(int argc, char *argv[]) {
+  static unsigned char *blocks[NUM_BLOCKS];
+  static int sizes[NUM_BLOCKS];
+  struct myalloc_stats stats;
+  int failed = 0;
+
+  MEMORY_SIZE = 4096;
+  ARENA_SIZE = 1 << 16;
+  init_myalloc();
+
+  if (!fill_all(blocks, sizes)) {
+    printf("Allocation failed with a growable pool.\n");
+    return 1;
+  }
+  if (!check_and_free_all(blocks, sizes, 7)) {
+    failed = 1;
+  }
+
+  // the second round reuses the spare arena and maps the rest again
+  if (!fill_all(blocks, sizes)) {
+    printf("Allocation failed after arenas were released.\n");
+    return 1;
+  }
+  if (!check_and_free_all(blocks, sizes, 1)) {
+    failed = 1;
+  }
+
+  // a request bigger than an arena still gets an arena of its own
+  blocks[0] = myalloc(4 * ARENA_SIZE);
+  if (blocks[0] == 0) {
+    printf("Oversized allocation failed.\n");
+    failed = 1;
+  }
+  else {
+    myfree(blocks[0]);
+  }
+
+  // with everything freed, each arena is a single free block again
+  myalloc_stats(&stats);
+  if (stats.free_blocks != stats.arenas ||
+      stats.free_bytes != stats.pool_bytes - 8 * stats.arenas) {
+    printf("Free space summary is inconsistent: %ld blocks and %ld bytes "
+           "free in %d arenas of %ld bytes\n", stats.free_blocks,
+           stats.free_bytes, stats.arenas, stats.pool_bytes);
+    failed = 1;
+  }
+
+  if (failed) {
+    printf("Arena test FAIL.\n");
+    return 1;
+  }
+
+  printf("Arena test PASS.\n");
+  return 0;
+}
@@ -0,0 +1,129 @@
+/*! \file
+ * Tester for myrealloc() and mycalloc().  A set of buffers is grown and shrunk
+ * at random, checking that contents survive every resize, and the counters
+ * show how often a resize could be done in place.  mycalloc() results are
+ * checked to be zero both in a fresh pool and once the pool has been dirtied.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "myalloc.h"
+
+#define NUM_BUFFERS 64
+#define ITERATIONS 20000
+#define MAX_BUFFER_SIZE 4000
+
+
+// check that a buffer holds its expected pattern
+int check_buffer(unsigned char *buf, int len, int id) {
+  int k;
+
+  for (k = 0; k < len; k++) {
+    if (buf[k] != (unsigned char) (id * 7 + k))
+      return 0;
+  }
+
+  return 1;
+}
+
+// return 1 if every byte of a block is zero
+int all_zero(unsigned char *buf, int len) {
+  int k;
+
+  for (k = 0; k < len; k++) {
+    if (buf[k] != 0)
+      return 0;
+  }
+
+  return 1;
+}
+
+
+int main(int argc, char *argv[]) {
+  unsigned char *buffers[NUM_BUFFERS] = { 0 };
+  int lengths[NUM_BUFFERS] = { 0 };
+  struct myalloc_counters counters;
+  unsigned char *p;
+  struct myalloc_stats stats;
+  int failed = 0;
+  int i, j, k, len;
+
+  MEMORY_SIZE = 1 << 20;
+  init_myalloc();
+
+  // a fresh pool hands out zeroed memory without clearing it
+  p = mycalloc(1000, 4);
+  if (p == 0 || !all_zero(p, 4000)) {
+    printf("mycalloc on a fresh pool is not zeroed\n");
+    failed = 1;
+  }
+  myfree(p);
+
+  for (i = 0; i < ITERATIONS; i++) {
+    j = rand() % NUM_BUFFERS;
+    len = 1 + rand() % MAX_BUFFER_SIZE;
+
+    if (!check_buffer(buffers[j], lengths[j], j)) {
+      printf("buffer %d corrupted\n", j);
+      failed = 1;
+    }
+
+    p = myrealloc(buffers[j], len);
+    if (p == 0) {
+      printf("myrealloc(%d) ran out of memory\n", len);
+      return 1;
+    }
+
+    // the surviving prefix must be intact, then extend the pattern
+    if (!check_buffer(p, len < lengths[j] ? len : lengths[j], j)) {
+      printf("buffer %d lost data in a resize\n", j);
+      failed = 1;
+    }
+    for (k = 0; k < len; k++)
+      p[k] = (unsigned char) (j * 7 + k);
+
+    buffers[j] = p;
+    lengths[j] = len;
+
+    // dirty memory must come back zeroed too
+    if (i % 100 == 0) {
+      p = mycalloc(len, 1);
+      if (p == 0 || !all_zero(p, len)) {
+        printf("mycalloc returned dirty memory\n");
+        failed = 1;
+      }
+      memset(p, 0xff, len);
+      myfree(p);
+    }
+  }
+
+  for (j = 0; j < NUM_BUFFERS; j++)
+    myfree(buffers[j]);
+
+  // with everything freed, each arena is a single free block again
+  myalloc_stats(&stats);
+  if (stats.free_blocks != stats.arenas ||
+      stats.free_bytes != stats.pool_bytes - 8 * stats.arenas ||
+      stats.fragmentation != 0.0) {
+    printf("Free space summary is inconsistent: %ld blocks and %ld bytes "
+           "free in %d arenas of %ld bytes\n", stats.free_blocks,
+           stats.free_bytes, stats.arenas, stats.pool_bytes);
+    failed = 1;
+  }
+
+  get_myalloc_counters(&counters);
+  printf("Resized in place %ld times, moved %ld times\n",
+         counters.reallocs_in_place, counters.reallocs_moved);
+  printf("mycalloc skipped clearing %ld bytes\n",
+         counters.calloc_bytes_skipped);
+
+  if (failed) {
+    printf("Realloc test FAIL.\n");
+    return 1;
+  }
+
+  printf("Realloc test PASS.\n");
+  return 0;
+}
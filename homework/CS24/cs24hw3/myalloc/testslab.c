@@ -0,0 +1,81 @@
+/*! \file
+ * Slab allocator tester.  Objects of a few fixed sizes are allocated and freed
+ * in random order from slabs carved out of the memory pool, checking that the
+ * objects never overlap or get corrupted, and that the pool is whole again
+ * once every slab has been destroyed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "myalloc.h"
+
+#define NUM_OBJECTS 4000
+#define ITERATIONS 200000
+
+static int sizes[] = { 4, 12, 24, 100 };
+#define NUM_SLABS (sizeof(sizes) / sizeof(sizes[0]))
+
+
+int main(int argc, char *argv[]) {
+  struct slab *slabs[NUM_SLABS];
+  unsigned char *objects[NUM_OBJECTS] = { 0 };
+  int owner[NUM_OBJECTS];
+  int failed = 0;
+  int i, j, k;
+
+  MEMORY_SIZE = 1 << 21;
+  init_myalloc();
+
+  for (i = 0; i < NUM_SLABS; i++) {
+    slabs[i] = slab_create(sizes[i]);
+    if (slabs[i] == 0) {
+      printf("slab_create(%d) failed\n", sizes[i]);
+      return 1;
+    }
+  }
+
+  for (i = 0; i < ITERATIONS; i++) {
+    j = rand() % NUM_OBJECTS;
+
+    if (objects[j] != 0) {
+      // verify the object still holds its own id
+      for (k = 0; k < sizes[owner[j]]; k++) {
+        if (objects[j][k] != (unsigned char) (j + k)) {
+          failed = 1;
+        }
+      }
+      slab_free(slabs[owner[j]], objects[j]);
+      objects[j] = 0;
+    }
+    else {
+      owner[j] = rand() % NUM_SLABS;
+      objects[j] = slab_alloc(slabs[owner[j]]);
+      if (objects[j] == 0) {
+        printf("slab_alloc ran out of memory\n");
+        return 1;
+      }
+      for (k = 0; k < sizes[owner[j]]; k++) {
+        objects[j][k] = (unsigned char) (j + k);
+      }
+    }
+  }
+
+  for (i = 0; i < NUM_SLABS; i++) {
+    slab_destroy(slabs[i]);
+  }
+
+  // every run went back to the pool, so it must be one block again
+  if (myalloc(MEMORY_SIZE - 8) == 0) {
+    printf("Pool not whole after destroying slabs.\n");
+    failed = 1;
+  }
+
+  if (failed) {
+    printf("Slab test FAIL.\n");
+    return 1;
+  }
+
+  printf("Slab test PASS.\n");
+  return 0;
+}
@@ -0,0 +1,112 @@
+/*! \file
+ * Multithreaded allocator tester.  A number of threads repeatedly allocate,
+ * fill, check and free blocks against the shared memory pool, with and without
+ * the per-thread caches enabled, and report the elapsed time for each run.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "myalloc.h"
+
+#define NUM_THREADS 4
+#define LIVE_BLOCKS 256
+#define ITERATIONS 200000
+#define MAX_BLOCK_SIZE 128
+
+/* set by any thread that finds a corrupted block */
+static int failed = 0;
+
+
+/* churn through allocations, checking each block before freeing it */
+void * worker(void *arg) {
+  unsigned char *blocks[LIVE_BLOCKS] = { 0 };
+  int sizes[LIVE_BLOCKS];
+  unsigned int seed = (unsigned int) (long) arg;
+  unsigned char tag = (unsigned char) (long) arg;
+  int i, j, k;
+
+  for (i = 0; i < ITERATIONS; i++) {
+    j = rand_r(&seed) % LIVE_BLOCKS;
+
+    if (blocks[j] != 0) {
+      for (k = 0; k < sizes[j]; k++) {
+        if (blocks[j][k] != (unsigned char) (tag + k)) {
+          failed = 1;
+        }
+      }
+      myfree(blocks[j]);
+      blocks[j] = 0;
+    }
+    else {
+      sizes[j] = 1 + rand_r(&seed) % MAX_BLOCK_SIZE;
+      blocks[j] = myalloc(sizes[j]);
+      if (blocks[j] == 0) {
+        fprintf(stderr, "thread %d: out of memory\n", (int) tag);
+        failed = 1;
+        return 0;
+      }
+      for (k = 0; k < sizes[j]; k++) {
+        blocks[j][k] = (unsigned char) (tag + k);
+      }
+    }
+  }
+
+  for (j = 0; j < LIVE_BLOCKS; j++) {
+    if (blocks[j] != 0) {
+      myfree(blocks[j]);
+    }
+  }
+
+  return 0;
+}
+
+
+// run all of the workers against a fresh pool, return elapsed seconds
+double run(int cache_size) {
+  pthread_t threads[NUM_THREADS];
+  struct timespec start, end;
+  long i;
+
+  MEMORY_SIZE = 1 << 22;
+  THREAD_CACHE_SIZE = cache_size;
+  init_myalloc();
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < NUM_THREADS; i++) {
+    pthread_create(&threads[i], 0, worker, (void *) (i + 1));
+  }
+  for (i = 0; i < NUM_THREADS; i++) {
+    pthread_join(threads[i], 0);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+
+int main(int argc, char *argv[]) {
+  double t;
+
+  t = run(0);
+  printf("%d threads, no thread caches:  %f sec\n", NUM_THREADS, t);
+
+  t = run(32);
+  printf("%d threads, 32-block caches:   %f sec\n", NUM_THREADS, t);
+
+  // every block was handed back, so the whole pool must be one block again
+  if (myalloc(MEMORY_SIZE - 8) == 0) {
+    printf("Pool not fully coalesced after thread exit.\n");
+    failed = 1;
+  }
+
+  if (failed) {
+    printf("Thread test FAIL.\n");
+    return 1;
+  }
+
+  printf("Thread test PASS.\n");
+  return 0;
+}
@@ -0,0 +1,265 @@
+/*! \file
+ * Recording of allocation traces from running programs, and conversion between
+ * trace files and SEQLIST sequences.  See trace.h for the file format.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sequence.h"
+#include "trace.h"
+
+// marks a hash table slot whose pointer has been freed
+#define TOMBSTONE ((void *) 1)
+
+struct trace_slot {
+  void *ptr;
+  uint32_t id;
+};
+
+struct trace_recorder {
+  FILE *file;
+  pthread_mutex_t lock;
+  uint32_t next_id;
+  // open-addressed table from live pointers to their allocation ids
+  struct trace_slot *slots;
+  int capacity; // always a power of two
+  int used;     // live entries plus tombstones
+};
+
+
+static void * checked_calloc(size_t count, size_t size) {
+  void *result = calloc(count, size);
+
+  if (result == 0) {
+    fprintf(stderr, "real memory exhausted.\n");
+    abort();
+  }
+
+  return result;
+}
+
+static unsigned int hash_ptr(void *ptr) {
+  uintptr_t h = (uintptr_t) ptr;
+  h ^= h >> 17;
+  h *= 0x9e3779b1u;
+  return (unsigned int) (h ^ (h >> 15));
+}
+
+// find the slot holding ptr, or the empty slot where it would go
+static struct trace_slot * find_slot(struct trace_recorder *rec, void *ptr) {
+  unsigned int i = hash_ptr(ptr) & (rec->capacity - 1);
+
+  while (rec->slots[i].ptr != 0 && rec->slots[i].ptr != ptr) {
+    i = (i + 1) & (rec->capacity - 1);
+  }
+
+  return &rec->slots[i];
+}
+
+// double the table and drop tombstones once it is half full
+static void grow_table(struct trace_recorder *rec) {
+  struct trace_slot *old = rec->slots;
+  int old_capacity = rec->capacity, i;
+
+  rec->capacity *= 2;
+  rec->slots = checked_calloc(rec->capacity, sizeof(struct trace_slot));
+  rec->used = 0;
+
+  for (i = 0; i < old_capacity; i++) {
+    if (old[i].ptr != 0 && old[i].ptr != TOMBSTONE) {
+      *find_slot(rec, old[i].ptr) = old[i];
+      rec->used++;
+    }
+  }
+
+  free(old);
+}
+
+static void write_record(FILE *file, uint32_t id, int32_t size) {
+  struct trace_record record;
+
+  record.id = id;
+  record.size = size;
+  fwrite(&record, sizeof(record), 1, file);
+}
+
+static int write_header(FILE *file) {
+  struct trace_file_header header;
+
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  header.version = TRACE_VERSION;
+  return fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+// free every node of a sequence that is being thrown away
+static void free_sequence(SEQLIST *seq) {
+  SEQLIST *next;
+
+  while (!seq_null(seq)) {
+    next = seq_next(seq);
+    free(seq);
+    seq = next;
+  }
+}
+
+
+struct trace_recorder * trace_open(const char *filename) {
+  struct trace_recorder *rec;
+  FILE *file = fopen(filename, "wb");
+
+  if (file == 0 || !write_header(file)) {
+    if (file != 0)
+      fclose(file);
+    return 0;
+  }
+
+  rec = checked_calloc(1, sizeof(struct trace_recorder));
+  rec->file = file;
+  pthread_mutex_init(&rec->lock, 0);
+  rec->capacity = 1024;
+  rec->slots = checked_calloc(rec->capacity, sizeof(struct trace_slot));
+  return rec;
+}
+
+void trace_alloc(struct trace_recorder *rec, void *ptr, int size) {
+  struct trace_slot *slot;
+
+  if (ptr == 0)  // failed allocations are not part of the stream
+    return;
+
+  pthread_mutex_lock(&rec->lock);
+
+  if (2 * (rec->used + 1) > rec->capacity)
+    grow_table(rec);
+
+  slot = find_slot(rec, ptr);
+  slot->ptr = ptr;
+  slot->id = rec->next_id++;
+  rec->used++;
+  write_record(rec->file, slot->id, size);
+
+  pthread_mutex_unlock(&rec->lock);
+}
+
+void trace_free(struct trace_recorder *rec, void *ptr) {
+  struct trace_slot *slot;
+
+  pthread_mutex_lock(&rec->lock);
+
+  // pointers allocated before recording started are not in the table
+  slot = find_slot(rec, ptr);
+  if (slot->ptr == ptr) {
+    write_record(rec->file, slot->id, TRACE_FREE);
+    slot->ptr = TOMBSTONE;
+  }
+
+  pthread_mutex_unlock(&rec->lock);
+}
+
+void trace_close(struct trace_recorder *rec) {
+  fclose(rec->file);
+  pthread_mutex_destroy(&rec->lock);
+  free(rec->slots);
+  free(rec);
+}
+
+
+int trace_write_sequence(SEQLIST *seq, const char *filename) {
+  SEQLIST *sptr;
+  int next_id = 0;
+  FILE *file = fopen(filename, "wb");
+
+  if (file == 0 || !write_header(file)) {
+    if (file != 0)
+      fclose(file);
+    return 0;
+  }
+
+  for (sptr = seq; !seq_null(sptr); sptr = seq_next(sptr)) {
+    if (seq_alloc(sptr)) {
+      sptr->id = next_id++;
+      write_record(file, sptr->id, seq_size(sptr));
+    }
+    else {
+      write_record(file, seq_tofree(sptr)->id, TRACE_FREE);
+    }
+  }
+
+  return fclose(file) == 0;
+}
+
+SEQLIST * trace_read_sequence(const char *filename) {
+  struct trace_file_header header;
+  struct trace_record record;
+  SEQLIST *head = 0, *tail = 0, **allocs = 0;
+  int num_allocs = 0, max_allocs = 1024, bad = 0;
+  FILE *file = fopen(filename, "rb");
+
+  if (file == 0)
+    return 0;
+
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != TRACE_VERSION) {
+    fprintf(stderr, "%s: not a version %d allocation trace\n", filename,
+            TRACE_VERSION);
+    fclose(file);
+    return 0;
+  }
+
+  // allocations are numbered in order, so ids index straight into allocs
+  allocs = checked_calloc(max_allocs, sizeof(SEQLIST *));
+
+  while (fread(&record, sizeof(record), 1, file) == 1) {
+    if (record.size != TRACE_FREE) {
+      if (record.id != (uint32_t) num_allocs || record.size < 0) {
+        fprintf(stderr, "%s: bad allocation record %u\n", filename,
+                record.id);
+        bad = 1;
+        break;
+      }
+
+      if (num_allocs == max_allocs) {
+        max_allocs *= 2;
+        allocs = realloc(allocs, max_allocs * sizeof(SEQLIST *));
+        if (allocs == 0) {
+          fprintf(stderr, "real memory exhausted.\n");
+          abort();
+        }
+      }
+
+      if (seq_null(head)) {
+        head = seq_add_front(record.size, 0, (SEQLIST *) 0);
+        tail = head;
+      }
+      else {
+        tail = seq_set_next_allocate(record.size, 0, tail);
+      }
+      tail->id = record.id;
+      allocs[num_allocs++] = tail;
+    }
+    else {
+      if (record.id >= (uint32_t) num_allocs || seq_freed(allocs[record.id])) {
+        fprintf(stderr, "%s: bad free of allocation %u\n", filename,
+                record.id);
+        bad = 1;
+        break;
+      }
+
+      tail = seq_set_next_free(allocs[record.id], tail);
+      seq_free(allocs[record.id]);
+    }
+  }
+
+  if (bad) {
+    free_sequence(head);
+    head = 0;
+  }
+
+  free(allocs);
+  fclose(file);
+  return head;
+}
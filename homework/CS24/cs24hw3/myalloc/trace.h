@@ -0,0 +1,45 @@
+/*! \file
+ * Declarations for recording allocation traces from running programs, and for
+ * converting between trace files and the SEQLIST sequences that the
+ * allocator testers replay.
+ *
+ * A trace file starts with a trace_file_header, followed by one trace_record
+ * per allocation or free in program order.  Every allocation is numbered in
+ * order starting from 0, and a free names the allocation it releases.
+ *
+ * sequence.h must be included before this file.
+ */
+
+#include <stdint.h>
+
+/*! Identifies a trace file. */
+#define TRACE_MAGIC "MATR"
+
+/*! Version of the trace format written by this code. */
+#define TRACE_VERSION 1
+
+/*! Size recorded for a free, distinguishing it from an allocation. */
+#define TRACE_FREE (-1)
+
+struct trace_file_header {
+  char magic[4];
+  uint32_t version;
+};
+
+struct trace_record {
+  uint32_t id;  // allocation id
+  int32_t size; // bytes requested, or TRACE_FREE
+};
+
+/*! State for capturing a live alloc/free stream into a trace file. */
+struct trace_recorder;
+
+// recording from a running program; these are safe to call from many threads
+struct trace_recorder *trace_open(const char *filename);
+void trace_alloc(struct trace_recorder *rec, void *ptr, int size);
+void trace_free(struct trace_recorder *rec, void *ptr);
+void trace_close(struct trace_recorder *rec);
+
+// conversion between trace files and sequences; both return 0 on failure
+int trace_write_sequence(SEQLIST *seq, const char *filename);
+SEQLIST *trace_read_sequence(const char *filename);
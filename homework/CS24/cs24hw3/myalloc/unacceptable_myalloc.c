@@ -10,6 +10,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "myalloc.h"
 
@@ -23,6 +24,12 @@
 int MEMORY_SIZE;
 unsigned char *mem;
 
+/*! The unacceptable allocator never coalesces, deferred or otherwise. */
+int DEFERRED_COALESCING;
+
+/*! The unacceptable allocator is its own, and only, backend. */
+int MYALLOC_BACKEND;
+
 
 /* TODO:  The unacceptable allocator uses an external "free-pointer" to track
  *        where free memory starts.  If your allocator doesn't use this
@@ -102,3 +109,24 @@ void myfree(unsigned char *oldptr) {
      */
 }
 
+
+/*!
+ * The unacceptable allocator keeps no statistics, so every counter is zero.
+ */
+void get_myalloc_counters(struct myalloc_counters *result) {
+    memset(result, 0, sizeof(*result));
+}
+
+
+/*!
+ * The unacceptable allocator never reuses memory, so everything past the
+ * free-pointer is a single free block.
+ */
+void myalloc_stats(struct myalloc_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->arenas = 1;
+    stats->pool_bytes = MEMORY_SIZE;
+    stats->free_bytes = MEMORY_SIZE - (freeptr - mem);
+    stats->free_blocks = 1;
+    stats->largest_free = stats->free_bytes;
+}
@@ -0,0 +1,167 @@
+/*
+ * Throughput benchmark for the RLE encoders and decoders.  Corpora with
+ * controlled run-length distributions are generated in memory, and each
+ * codec's encode and decode are timed on them and reported in MB/s of
+ * decoded data.
+ *
+ * Usage:  bench_rle [megabytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rl_encode.h"
+#include "rl_decode.h"
+#include "rl_packbits.h"
+
+
+/*! Each measurement is repeated until it has run for at least this long. */
+#define MIN_SECONDS 0.5
+
+
+/*! The corpora, by their distribution of run lengths. */
+typedef enum corpus {
+    ALL_LITERAL,        /* no byte equals the one before it */
+    GEOMETRIC,          /* run lengths geometric with mean 4 */
+    LONG_RUNS,          /* run lengths uniform in 100..1000 */
+    NUM_CORPORA
+} corpus;
+
+static const char *corpus_names[NUM_CORPORA] = {
+    "all-literal", "geometric", "long runs"
+};
+
+
+/*! Fills data with length bytes of the given corpus. */
+void make_corpus(corpus kind, unsigned char *data, int length) {
+    int i = 0, run, value = 0;
+
+    srand(24);
+    while (i < length) {
+        switch (kind) {
+        case ALL_LITERAL:
+            run = 1;
+            break;
+
+        case GEOMETRIC:
+            /* Continue the run with probability 3/4. */
+            for (run = 1; rand() % 4 != 0; run++)
+                ;
+            break;
+
+        default:
+            run = 100 + rand() % 901;
+            break;
+        }
+
+        /* Always change the value, so that runs don't merge. */
+        value = (value + 1 + rand() % 255) & 0xff;
+        while (run-- > 0 && i < length)
+            data[i++] = value;
+    }
+}
+
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/* The operations being timed, each over the whole corpus. */
+
+static unsigned char *input, *encoded, *decoded;
+static int input_length, encoded_length;
+
+void encode_pairs(void) {
+    rl_encoder enc;
+
+    rl_encoder_init(&enc);
+    encoded_length = rl_encode_chunk(&enc, input, input_length, encoded);
+    encoded_length += rl_encode_finish(&enc, encoded + encoded_length);
+}
+
+void decode_pairs(void) {
+    rl_decode_into(encoded, encoded_length, decoded);
+}
+
+void encode_packbits(void) {
+    rl_packbits_encoder enc;
+
+    rl_packbits_encoder_init(&enc);
+    encoded_length = rl_packbits_encode_chunk(&enc, input, input_length,
+                                              encoded);
+    encoded_length += rl_packbits_encode_finish(&enc,
+                                                encoded + encoded_length);
+}
+
+void decode_packbits(void) {
+    rl_packbits_decode_into(encoded, encoded_length, decoded);
+}
+
+
+/*! Runs op repeatedly, and returns its throughput in MB/s of input_length. */
+double measure(void (*op)(void)) {
+    double start = now(), elapsed;
+    long runs = 0;
+
+    do {
+        op();
+        runs++;
+        elapsed = now() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    return (double) input_length * runs / elapsed / 1e6;
+}
+
+
+int main(int argc, char **argv) {
+    corpus kind;
+    double enc_mbs, dec_mbs;
+    int megabytes = argc > 1 ? atoi(argv[1]) : 64;
+
+    if (megabytes <= 0 || megabytes > 512) {
+        printf("usage:  %s [megabytes]\n", argv[0]);
+        return 1;
+    }
+
+    input_length = megabytes << 20;
+    input = malloc(input_length);
+    encoded = malloc(RL_ENCODE_BOUND(input_length) + 2);
+    decoded = malloc(input_length);
+    if (input == NULL || encoded == NULL || decoded == NULL) {
+        printf("Couldn't allocate the buffers!\n");
+        return 2;
+    }
+
+    printf("%-12s %-9s %8s %12s %12s\n", "corpus", "codec", "ratio",
+           "encode MB/s", "decode MB/s");
+
+    for (kind = 0; kind < NUM_CORPORA; kind++) {
+        make_corpus(kind, input, input_length);
+
+        enc_mbs = measure(encode_pairs);
+        dec_mbs = measure(decode_pairs);
+        if (memcmp(decoded, input, input_length) != 0)
+            printf("pairs decoder MISMATCH on %s\n", corpus_names[kind]);
+        printf("%-12s %-9s %8.3f %12.1f %12.1f\n", corpus_names[kind],
+               "pairs", (double) encoded_length / input_length,
+               enc_mbs, dec_mbs);
+
+        enc_mbs = measure(encode_packbits);
+        dec_mbs = measure(decode_packbits);
+        if (memcmp(decoded, input, input_length) != 0)
+            printf("PackBits decoder MISMATCH on %s\n", corpus_names[kind]);
+        printf("%-12s %-9s %8.3f %12.1f %12.1f\n", corpus_names[kind],
+               "packbits", (double) encoded_length / input_length,
+               enc_mbs, dec_mbs);
+    }
+
+    free(decoded);
+    free(encoded);
+    free(input);
+    return 0;
+}
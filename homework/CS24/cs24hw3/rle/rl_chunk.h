@@ -0,0 +1,87 @@
+/*
+ * The chunked RLE container.  The input is split into chunks that are each
+ * run-length encoded on their own, so they can be decoded in any order, in
+ * parallel, or one at a time to reach a given offset.  The layout is:
+ *
+ *     header   8 bytes:  0x00 'R' 'L' 'C', version, codec, 2 reserved bytes
+ *     chunks   the encoded data of each chunk, one after the other
+ *     index    16 bytes per chunk:  u64 offset of the chunk in the file,
+ *              u32 encoded length, u32 decoded length
+ *     footer   16 bytes:  u64 offset of the index, u32 number of chunks,
+ *              'R' 'L' 'C' 'I'
+ *
+ * The codec says how each chunk is encoded:  RL_CHUNK_PAIRS for the
+ * [count][value] pairs of rl_encode(), or RL_CHUNK_PACKBITS for PackBits
+ * packets (rl_packbits.h, without the stream magic).  All integers are
+ * little-endian.  A plain RLE stream never starts with a
+ * zero count, so the leading 0x00 tells the two formats apart.  The index is
+ * written at the end so that the container can be produced in one pass.
+ */
+
+#include <stdio.h>
+
+
+#define RL_CHUNK_VERSION 1
+
+#define RL_CHUNK_PAIRS 0
+#define RL_CHUNK_PACKBITS 1
+
+#define RL_CHUNK_HEADER_SIZE 8
+#define RL_CHUNK_ENTRY_SIZE 16
+#define RL_CHUNK_FOOTER_SIZE 16
+
+
+/*! Where one chunk is, and how much data it decodes to. */
+typedef struct rl_chunk_entry {
+    long long offset;           /* offset of the encoded chunk in the file */
+    int encoded_length;
+    int decoded_length;
+    long long decoded_offset;   /* where the chunk goes in the output */
+} rl_chunk_entry;
+
+
+/*! The parsed index of a container. */
+typedef struct rl_chunk_index {
+    int codec;
+    int num_chunks;
+    long long decoded_length;   /* total size of the decoded data */
+    rl_chunk_entry *entries;
+} rl_chunk_index;
+
+
+/*! Writes a container to a stdio stream, one chunk at a time. */
+typedef struct rl_chunk_writer {
+    FILE *output;
+    int codec;
+    long long offset;           /* bytes written to output so far */
+    int num_chunks;
+    int capacity;
+    rl_chunk_entry *entries;
+    unsigned char *buffer;      /* scratch space for encoding a chunk */
+    int buffer_size;
+} rl_chunk_writer;
+
+
+/* Writing, in rl_chunk_enc.c. */
+
+int rl_chunk_writer_open(rl_chunk_writer *writer, FILE *output, int codec);
+
+int rl_chunk_write(rl_chunk_writer *writer, const unsigned char *data,
+                   int length);
+
+int rl_chunk_writer_close(rl_chunk_writer *writer);
+
+
+/* Reading, in rl_chunk_dec.c. */
+
+int rl_chunk_is_container(const unsigned char *data, long long length);
+
+rl_chunk_index * rl_chunk_read_index(const unsigned char *data,
+                                     long long length);
+
+void rl_chunk_free_index(rl_chunk_index *index);
+
+int rl_chunk_find(const rl_chunk_index *index, long long decoded_offset);
+
+int rl_chunk_decode(const rl_chunk_index *index, unsigned char *data,
+                    unsigned char *output, int num_threads);
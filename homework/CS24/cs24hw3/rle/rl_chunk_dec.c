@@ -0,0 +1,243 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "rl_decode.h"
+#include "rl_packbits.h"
+#include "rl_chunk.h"
+
+
+/*! Loads a little-endian 32-bit value. */
+static unsigned int get32(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+
+/*! Loads a little-endian 64-bit value. */
+static unsigned long long get64(const unsigned char *p) {
+    return get32(p) | ((unsigned long long) get32(p + 4) << 32);
+}
+
+
+/*! Returns 1 if the data starts with a container header. */
+int rl_chunk_is_container(const unsigned char *data, long long length) {
+    return length >= RL_CHUNK_HEADER_SIZE + RL_CHUNK_FOOTER_SIZE &&
+           memcmp(data, "\0RLC", 4) == 0;
+}
+
+
+/*!
+ * Parses the index of a container held in memory.  Returns a malloc'd index
+ * to release with rl_chunk_free_index(), or NULL if the data isn't a
+ * well-formed container of a version we understand.
+ */
+rl_chunk_index * rl_chunk_read_index(const unsigned char *data,
+                                     long long length) {
+    const unsigned char *footer, *p;
+    rl_chunk_index *index;
+    rl_chunk_entry *entry;
+    unsigned long long index_offset;
+    unsigned int num_chunks;
+    long long decoded = 0;
+    unsigned int i;
+
+    if (!rl_chunk_is_container(data, length) ||
+        data[4] != RL_CHUNK_VERSION ||
+        (data[5] != RL_CHUNK_PAIRS && data[5] != RL_CHUNK_PACKBITS)) {
+        return NULL;
+    }
+
+    footer = data + length - RL_CHUNK_FOOTER_SIZE;
+    if (memcmp(footer + 12, "RLCI", 4) != 0)
+        return NULL;
+
+    index_offset = get64(footer);
+    num_chunks = get32(footer + 8);
+    if (index_offset < RL_CHUNK_HEADER_SIZE ||
+        index_offset > (unsigned long long) (footer - data) ||
+        num_chunks > ((footer - data) - index_offset) / RL_CHUNK_ENTRY_SIZE) {
+        return NULL;
+    }
+
+    index = malloc(sizeof(rl_chunk_index));
+    if (index == NULL)
+        return NULL;
+
+    index->codec = data[5];
+    index->num_chunks = num_chunks;
+    index->entries = malloc((num_chunks + 1) * sizeof(rl_chunk_entry));
+    if (index->entries == NULL) {
+        free(index);
+        return NULL;
+    }
+
+    for (i = 0; i < num_chunks; i++) {
+        p = data + index_offset + i * RL_CHUNK_ENTRY_SIZE;
+        entry = &index->entries[i];
+        entry->offset = get64(p);
+        entry->encoded_length = get32(p + 8);
+        entry->decoded_length = get32(p + 12);
+        entry->decoded_offset = decoded;
+
+        /* Every chunk has to lie between the header and the index. */
+        if (entry->encoded_length < 0 || entry->decoded_length < 0 ||
+            entry->offset < RL_CHUNK_HEADER_SIZE ||
+            (unsigned long long) entry->offset + entry->encoded_length >
+                index_offset) {
+            rl_chunk_free_index(index);
+            return NULL;
+        }
+
+        decoded += entry->decoded_length;
+    }
+
+    index->decoded_length = decoded;
+    return index;
+}
+
+
+void rl_chunk_free_index(rl_chunk_index *index) {
+    if (index != NULL) {
+        free(index->entries);
+        free(index);
+    }
+}
+
+
+/*!
+ * Returns the number of the chunk that holds the given offset of the decoded
+ * data, or -1 if the offset is past the end.  Only that chunk needs to be
+ * decoded to get at the data there.
+ */
+int rl_chunk_find(const rl_chunk_index *index, long long decoded_offset) {
+    int lo = 0, hi = index->num_chunks - 1, mid;
+    const rl_chunk_entry *entry;
+
+    assert(index != NULL);
+
+    if (decoded_offset < 0 || decoded_offset >= index->decoded_length)
+        return -1;
+
+    /* Binary search over the chunks' starting offsets. */
+    while (lo < hi) {
+        mid = lo + (hi - lo + 1) / 2;
+        entry = &index->entries[mid];
+        if (entry->decoded_offset <= decoded_offset)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return lo;
+}
+
+
+/*! What each decoding thread is given to work on. */
+typedef struct decode_job {
+    const rl_chunk_index *index;
+    unsigned char *data;
+    unsigned char *output;
+    int first;                  /* first chunk to decode */
+    int stride;                 /* step to the next chunk to decode */
+    int ok;                     /* cleared if a chunk didn't decode right */
+} decode_job;
+
+
+static void * decode_chunks(void *arg) {
+    decode_job *job = arg;
+    const rl_chunk_entry *entry;
+    int i, size;
+
+    for (i = job->first; i < job->index->num_chunks; i += job->stride) {
+        entry = &job->index->entries[i];
+
+        /* Check the size first, so a bad chunk can't overrun the output. */
+        if (job->index->codec == RL_CHUNK_PACKBITS) {
+            size = rl_packbits_decode_size(job->data + entry->offset,
+                                           entry->encoded_length);
+        }
+        else {
+            size = rl_decode_size(job->data + entry->offset,
+                                  entry->encoded_length);
+        }
+
+        if (size != entry->decoded_length) {
+            job->ok = 0;
+            continue;
+        }
+
+        if (job->index->codec == RL_CHUNK_PACKBITS) {
+            rl_packbits_decode_into(job->data + entry->offset,
+                                    entry->encoded_length,
+                                    job->output + entry->decoded_offset);
+        }
+        else {
+            rl_decode_into(job->data + entry->offset, entry->encoded_length,
+                           job->output + entry->decoded_offset);
+        }
+    }
+
+    return NULL;
+}
+
+
+/*!
+ * Decodes every chunk of the container into output, which must hold
+ * index->decoded_length bytes, using up to num_threads threads.  Returns 1
+ * on success, or 0 if some chunk's data doesn't match its index entry.
+ */
+int rl_chunk_decode(const rl_chunk_index *index, unsigned char *data,
+                    unsigned char *output, int num_threads) {
+    decode_job *jobs;
+    pthread_t *threads;
+    int i, started, ok = 1;
+
+    assert(index != NULL);
+
+    if (num_threads > index->num_chunks)
+        num_threads = index->num_chunks;
+    if (num_threads < 1)
+        num_threads = 1;
+
+    jobs = malloc(num_threads * sizeof(decode_job));
+    threads = malloc(num_threads * sizeof(pthread_t));
+    if (jobs == NULL || threads == NULL) {
+        free(jobs);
+        free(threads);
+        return 0;
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        jobs[i].index = index;
+        jobs[i].data = data;
+        jobs[i].output = output;
+        jobs[i].first = i;
+        jobs[i].stride = num_threads;
+        jobs[i].ok = 1;
+    }
+
+    /* Job 0 runs on this thread; if a thread can't be started, the jobs it
+     * would have done are done here too.
+     */
+    for (started = 1; started < num_threads; started++) {
+        if (pthread_create(&threads[started], NULL, decode_chunks,
+                           &jobs[started]) != 0) {
+            break;
+        }
+    }
+
+    decode_chunks(&jobs[0]);
+    for (i = started; i < num_threads; i++)
+        decode_chunks(&jobs[i]);
+
+    for (i = 1; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    for (i = 0; i < num_threads; i++)
+        ok = ok && jobs[i].ok;
+
+    free(jobs);
+    free(threads);
+    return ok;
+}
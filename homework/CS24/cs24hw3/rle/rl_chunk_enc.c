@@ -0,0 +1,156 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "rl_encode.h"
+#include "rl_packbits.h"
+#include "rl_chunk.h"
+
+
+/*! Stores a 32-bit value little-endian. */
+static void put32(unsigned char *p, unsigned int value) {
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+
+/*! Stores a 64-bit value little-endian. */
+static void put64(unsigned char *p, unsigned long long value) {
+    put32(p, (unsigned int) value);
+    put32(p + 4, (unsigned int) (value >> 32));
+}
+
+
+/*! Writes length bytes to the output, keeping track of the offset. */
+static int write_bytes(rl_chunk_writer *writer, const unsigned char *data,
+                       int length) {
+    if (fwrite(data, 1, length, writer->output) != (size_t) length)
+        return 0;
+
+    writer->offset += length;
+    return 1;
+}
+
+
+/*!
+ * Starts a container on the output stream by writing its header.  The
+ * chunks will be encoded with the given codec.  Returns 1 on success, or 0
+ * if the header couldn't be written.
+ */
+int rl_chunk_writer_open(rl_chunk_writer *writer, FILE *output, int codec) {
+    unsigned char header[RL_CHUNK_HEADER_SIZE] = {
+        0x00, 'R', 'L', 'C', RL_CHUNK_VERSION, 0, 0, 0
+    };
+
+    assert(writer != NULL);
+    assert(output != NULL);
+    assert(codec == RL_CHUNK_PAIRS || codec == RL_CHUNK_PACKBITS);
+
+    header[5] = (unsigned char) codec;
+
+    memset(writer, 0, sizeof(*writer));
+    writer->output = output;
+    writer->codec = codec;
+
+    return write_bytes(writer, header, sizeof(header));
+}
+
+
+/*!
+ * Encodes length bytes of data as the next chunk of the container.  Returns
+ * 1 on success, or 0 if memory ran out or the chunk couldn't be written.
+ */
+int rl_chunk_write(rl_chunk_writer *writer, const unsigned char *data,
+                   int length) {
+    rl_encoder enc;
+    rl_packbits_encoder pb;
+    rl_chunk_entry *entry;
+    void *grown;
+    int bound, encoded;
+
+    assert(writer != NULL);
+
+    /* Make room for another index entry and for the encoded chunk. */
+    if (writer->num_chunks == writer->capacity) {
+        writer->capacity = writer->capacity ? 2 * writer->capacity : 64;
+        grown = realloc(writer->entries,
+                        writer->capacity * sizeof(rl_chunk_entry));
+        if (grown == NULL)
+            return 0;
+        writer->entries = grown;
+    }
+
+    bound = writer->codec == RL_CHUNK_PACKBITS ?
+        RL_PACKBITS_BOUND(length) : RL_ENCODE_BOUND(length) + 2;
+    if (writer->buffer_size < bound) {
+        writer->buffer_size = bound;
+        grown = realloc(writer->buffer, writer->buffer_size);
+        if (grown == NULL)
+            return 0;
+        writer->buffer = grown;
+    }
+
+    /* Each chunk is a complete RLE stream of its own. */
+    if (writer->codec == RL_CHUNK_PACKBITS) {
+        rl_packbits_encoder_init(&pb);
+        encoded = rl_packbits_encode_chunk(&pb, data, length, writer->buffer);
+        encoded += rl_packbits_encode_finish(&pb, writer->buffer + encoded);
+    }
+    else {
+        rl_encoder_init(&enc);
+        encoded = rl_encode_chunk(&enc, data, length, writer->buffer);
+        encoded += rl_encode_finish(&enc, writer->buffer + encoded);
+    }
+
+    entry = &writer->entries[writer->num_chunks];
+    entry->offset = writer->offset;
+    entry->encoded_length = encoded;
+    entry->decoded_length = length;
+    entry->decoded_offset = writer->num_chunks == 0 ? 0 :
+        entry[-1].decoded_offset + entry[-1].decoded_length;
+
+    if (!write_bytes(writer, writer->buffer, encoded))
+        return 0;
+
+    writer->num_chunks++;
+    return 1;
+}
+
+
+/*!
+ * Finishes the container by writing the index and the footer, and frees the
+ * writer's memory.  The output stream is left open.  Returns 1 on success,
+ * or 0 if the index couldn't be written.
+ */
+int rl_chunk_writer_close(rl_chunk_writer *writer) {
+    unsigned char entry[RL_CHUNK_ENTRY_SIZE];
+    unsigned char footer[RL_CHUNK_FOOTER_SIZE];
+    long long index_offset;
+    int i, ok = 1;
+
+    assert(writer != NULL);
+
+    index_offset = writer->offset;
+    for (i = 0; i < writer->num_chunks && ok; i++) {
+        put64(entry, writer->entries[i].offset);
+        put32(entry + 8, writer->entries[i].encoded_length);
+        put32(entry + 12, writer->entries[i].decoded_length);
+        ok = write_bytes(writer, entry, sizeof(entry));
+    }
+
+    if (ok) {
+        put64(footer, index_offset);
+        put32(footer + 8, writer->num_chunks);
+        memcpy(footer + 12, "RLCI", 4);
+        ok = write_bytes(writer, footer, sizeof(footer));
+    }
+
+    free(writer->entries);
+    free(writer->buffer);
+    writer->entries = NULL;
+    writer->buffer = NULL;
+
+    return ok;
+}
@@ -1,3 +1,34 @@
 unsigned char * rl_decode(unsigned char *input_data, int input_length,
                           int *output_length);
 
+/* Size of the decoded data, for sizing a buffer to pass to rl_decode_into. */
+int rl_decode_size(unsigned char *input_data, int input_length);
+
+/* Decodes into output, which must hold rl_decode_size() bytes; returns the
+ * number of bytes written.
+ */
+int rl_decode_into(unsigned char *input_data, int input_length,
+                   unsigned char *output);
+
+
+/*!
+ * The state of a decoder that is fed the encoded input a piece at a time,
+ * for decoding streams that are too large to hold in memory.  The same
+ * decoder handles PackBits streams when set up by rl_packbits_decoder_init().
+ */
+typedef struct rl_decoder {
+    int packbits;       /* nonzero for PackBits packets, zero for pairs */
+    int state;          /* what the next input byte is */
+    int remaining;      /* bytes of the current run or literal span left */
+    int value;          /* value of the current run */
+    int consumed;       /* input bytes used by the last rl_decoder_feed() */
+} rl_decoder;
+
+void rl_decoder_init(rl_decoder *dec);
+
+void rl_packbits_decoder_init(rl_decoder *dec);
+
+int rl_decoder_feed(rl_decoder *dec, const unsigned char *in, int n,
+                    unsigned char *out, int cap);
+
+int rl_decoder_done(const rl_decoder *dec);
@@ -1,4 +1,6 @@
 .globl rl_decode
+.globl rl_decode_size
+.globl rl_decode_into
 
 #============================================================================
 # rl_decode:  decode RLE-encoded input into a malloc'd buffer
@@ -16,7 +18,7 @@
 #                should be stored
 #
 # Return-value in %eax is the pointer to the malloc'd buffer containing
-# the decoded data.
+# the decoded data, or 0 if it couldn't be allocated.
 #
 rl_decode:
         # Set up stack frame.
@@ -28,6 +30,79 @@ rl_decode:
         push    %esi
         push    %edi
 
+        # First, figure out how much space is required to decode the data.
+        push    12(%ebp)
+        push    8(%ebp)
+        call    rl_decode_size
+        add     $8, %esp
+        mov     %eax, %ebx        # ebx = size required
+
+        # Write the length of the decoded output to the output-variable
+        mov     16(%ebp), %edx    # edx = last pointer-argument to function
+        mov     %ebx, (%edx)      # store computed size into this location
+
+        # Allocate memory for the decoded data using malloc.
+        # Pointer to allocated memory will be returned in %eax.
+        push    %ebx              # Number of bytes to allocate...
+        call    malloc
+        add     $4, %esp          # Clean up stack after call.
+        mov     %eax, %edi        # edi = the output buffer
+
+        test    %eax, %eax
+        jz      rl_decode_done
+
+        # Now, decode the data from the input buffer into the output buffer.
+        push    %edi
+        push    12(%ebp)
+        push    8(%ebp)
+        call    rl_decode_into
+        add     $12, %esp
+        mov     %edi, %eax
+
+rl_decode_done:
+
+        # Restore callee-save registers.
+        pop     %edi
+        pop     %esi
+        pop     %ebx
+
+        # Clean up stack frame.
+        mov     %ebp, %esp
+        pop     %ebp
+
+        ret
+
+
+
+#============================================================================
+# rl_decode_size:  compute the size of the data that the RLE-encoded input
+# decodes to, without decoding it, so that a buffer can be sized exactly.
+#
+# Arguments to rl_decode_size are at these stack locations:
+#
+#      8(%ebp) = data buffer containing run-length encoded input data
+#
+#     12(%ebp) = length of the run-length-encoded data in the buffer
+#
+# Return-value in %eax is the decoded size in bytes.
+#
+rl_decode_size:
+        # Set up stack frame.
+        push    %ebp
+        mov     %esp, %ebp
+
+        # Save callee-save registers.
+        push    %ebx
+        push    %esi
+        push    %edi
+
+        # Find out once whether this processor has SSE2; the wide paths
+        # below are only taken if it does.
+        cmpl    $0, have_sse2
+        jne     size_sse2_known
+        call    check_sse2
+size_sse2_known:
+
         # First, figure out how much space is required to decode the data.
         # We do this by summing up the counts, which are in the odd memory
         # locations.
@@ -37,7 +112,38 @@ rl_decode:
         xor     %ebx, %ebx                # %ebx = size required
         xor     %edx, %edx                # clear for counting (Bug 1)
 
-        # Find-space while-loop starts here...
+        # With SSE2, sum 8 counts at a time:  mask off the values, and let
+        # psadbw add up the remaining bytes of each 8-byte half.
+        cmpl    $1, have_sse2
+        jne     find_space_tail
+
+        movdqa  count_mask, %xmm1         # %xmm1 = 0x00ff in each word
+        pxor    %xmm2, %xmm2              # %xmm2 = zero, for psadbw
+        pxor    %xmm3, %xmm3              # %xmm3 = running sums
+        mov     12(%ebp), %edi
+        sub     $16, %edi                 # %edi = last start for a 16-byte load
+
+        cmp     %edi, %esi
+        jg      find_space_wide_done
+
+find_space_wide_loop:
+        movdqu  (%ecx, %esi), %xmm0
+        pand    %xmm1, %xmm0              # keep the count bytes only
+        psadbw  %xmm2, %xmm0              # two partial sums, one per qword
+        paddq   %xmm0, %xmm3
+        add     $16, %esi
+
+        cmp     %edi, %esi
+        jle     find_space_wide_loop
+
+find_space_wide_done:
+        pshufd  $0x4e, %xmm3, %xmm0       # swap the two qwords and add them
+        paddq   %xmm0, %xmm3
+        movd    %xmm3, %ebx
+
+find_space_tail:
+        # Find-space while-loop starts here, for whatever wasn't summed
+        # above...
         cmp     12(%ebp), %esi
         jge     find_space_done
 
@@ -51,18 +157,54 @@ find_space_loop:
 
 find_space_done:
 
-        # Write the length of the decoded output to the output-variable
-        mov     16(%ebp), %edx    # edx = last pointer-argument to function
-        mov     %ebx, (%edx)      # store computed size into this location
+        mov     %ebx, %eax
 
-        # Allocate memory for the decoded data using malloc.
-        # Pointer to allocated memory will be returned in %eax.
-        push    %ebx              # Number of bytes to allocate...
-        call    malloc
-        mov     8(%ebp), %ecx     # overwrote by malloc so move again. (Bug 3)
-        add     $4, %esp          # Clean up stack after call.
+        # Restore callee-save registers.
+        pop     %edi
+        pop     %esi
+        pop     %ebx
 
-        # Now, decode the data from the input buffer into the output buffer.
+        # Clean up stack frame.
+        mov     %ebp, %esp
+        pop     %ebp
+
+        ret
+
+
+
+#============================================================================
+# rl_decode_into:  decode RLE-encoded input into a buffer the caller
+# provides, which must hold at least rl_decode_size() bytes.
+#
+# Arguments to rl_decode_into are at these stack locations:
+#
+#      8(%ebp) = data buffer containing run-length encoded input data
+#
+#     12(%ebp) = length of the run-length-encoded data in the buffer
+#
+#     16(%ebp) = buffer to store the decoded data into
+#
+# Return-value in %eax is the number of bytes written to the buffer.
+#
+rl_decode_into:
+        # Set up stack frame.
+        push    %ebp
+        mov     %esp, %ebp
+
+        # Save callee-save registers.
+        push    %ebx
+        push    %esi
+        push    %edi
+
+        # Find out once whether this processor has SSE2; the wide paths
+        # below are only taken if it does.
+        cmpl    $0, have_sse2
+        jne     into_sse2_known
+        call    check_sse2
+into_sse2_known:
+
+        mov     8(%ebp), %ecx             # %ecx = start of source array
+        mov     16(%ebp), %eax            # %eax = start of output buffer
         xor     %esi, %esi
         xor     %edi, %edi
 
@@ -72,15 +214,43 @@ find_space_done:
 
 decode_loop:
         # Pull out the next [count][value] pair from the encoded data.
-        mov     (%ecx, %esi), %bh         # bh is the count of repetitions
-        mov     1(%ecx, %esi), %bl        # bl is the value to repeat
+        movzbl  (%ecx, %esi), %edx        # edx is the count of repetitions
+        movzbl  1(%ecx, %esi), %ebx       # bl is the value to repeat
+
+        # Runs of 16 or more are filled with 16-byte stores when we can.
+        cmp     $16, %edx
+        jb      write_bytes
+        cmpl    $1, have_sse2
+        jne     write_bytes
+
+        imul    $0x01010101, %ebx         # copy the value into every byte
+        movd    %ebx, %xmm0
+        pshufd  $0, %xmm0, %xmm0          # ...and across all of %xmm0
+
+write_wide_loop:
+        movdqu  %xmm0, (%eax, %edi)
+        add     $16, %edi
+        sub     $16, %edx
+        cmp     $16, %edx
+        jae     write_wide_loop
+
+        # Finish the last 0..15 bytes with one store that ends at the end of
+        # the run; it overlaps bytes this run has already written.
+        add     %edx, %edi
+        movdqu  %xmm0, -16(%eax, %edi)
+        jmp     write_done
+
+write_bytes:
+        test    %edx, %edx                # a zero count writes nothing
+        jz      write_done
 
 write_loop:
         mov     %bl, (%eax, %edi)
         inc     %edi                      # inc to go to next byte (Bug 4)
-        dec     %bh
+        dec     %edx
         jnz     write_loop
 
+write_done:
         add     $2, %esi
 
         cmp     12(%ebp), %esi
@@ -88,6 +258,8 @@ write_loop:
 
 decode_done:
 
+        mov     %edi, %eax
+
         # Restore callee-save registers.
         pop     %edi
         pop     %esi
@@ -99,3 +271,31 @@ decode_done:
 
         ret
 
+
+
+#============================================================================
+# check_sse2:  set have_sse2 to 1 if the processor supports SSE2, or to 2 if
+# it doesn't.  CPUID leaf 1 reports SSE2 in bit 26 of %edx.  Clobbers %eax,
+# %ecx and %edx, and saves %ebx, which cpuid also overwrites.
+#
+check_sse2:
+        push    %ebx
+        mov     $1, %eax
+        cpuid
+        movl    $2, have_sse2
+        test    $0x04000000, %edx
+        jz      check_sse2_done
+        movl    $1, have_sse2
+check_sse2_done:
+        pop     %ebx
+        ret
+
+
+        .data
+        .align  4
+have_sse2:                                # 0 = not checked yet, 1 = yes, 2 = no
+        .long   0
+
+        .align  16
+count_mask:
+        .word   0x00ff, 0x00ff, 0x00ff, 0x00ff, 0x00ff, 0x00ff, 0x00ff, 0x00ff
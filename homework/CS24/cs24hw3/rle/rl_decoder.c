@@ -0,0 +1,130 @@
+#include <string.h>
+#include <assert.h>
+
+#include "rl_decode.h"
+
+
+/* What the decoder expects next. */
+#define NEED_HEADER 0       /* a count, or a PackBits header byte */
+#define NEED_VALUE 1        /* the value of a run */
+#define IN_RUN 2            /* output of the current run */
+#define IN_LITERAL 3        /* literal bytes of a PackBits packet */
+
+
+static void decoder_init(rl_decoder *dec, int packbits) {
+    assert(dec != NULL);
+
+    dec->packbits = packbits;
+    dec->state = NEED_HEADER;
+    dec->remaining = 0;
+    dec->value = 0;
+    dec->consumed = 0;
+}
+
+
+/*! Resets the decoder to the start of a stream of [count][value] pairs. */
+void rl_decoder_init(rl_decoder *dec) {
+    decoder_init(dec, 0);
+}
+
+
+/*!
+ * Resets the decoder to the start of a stream of PackBits packets, after the
+ * RL_PACKBITS_MAGIC bytes.
+ */
+void rl_packbits_decoder_init(rl_decoder *dec) {
+    decoder_init(dec, 1);
+}
+
+
+/*!
+ * Decodes as much of the n bytes of input as fits into the cap bytes of
+ * output, picking up wherever the last call left off, even in the middle of
+ * a pair or a run.  Returns the number of bytes written to output, and
+ * leaves the number of input bytes used in dec->consumed.  Input is only
+ * left over when the output fills up, and a call that returns cap may have
+ * more of a run pending, so callers should pass the rest of the input (or
+ * none) again until the result is less than cap.
+ */
+int rl_decoder_feed(rl_decoder *dec, const unsigned char *in, int n,
+                    unsigned char *out, int cap) {
+    const unsigned char *start = in, *end = in + n;
+    unsigned char *out_start = out, *out_end = out + cap;
+    int h, len;
+
+    assert(dec != NULL);
+    assert(n >= 0 && cap >= 0);
+
+    while (1) {
+        switch (dec->state) {
+        case NEED_HEADER:
+            if (in == end)
+                goto done;
+
+            h = *in++;
+            if (!dec->packbits) {
+                dec->remaining = h;
+                dec->state = NEED_VALUE;
+            }
+            else if (h < 128) {
+                dec->remaining = h + 1;
+                dec->state = IN_LITERAL;
+            }
+            else if (h > 128) {
+                dec->remaining = 257 - h;
+                dec->state = NEED_VALUE;
+            }
+            break;
+
+        case NEED_VALUE:
+            if (in == end)
+                goto done;
+
+            dec->value = *in++;
+            dec->state = IN_RUN;
+            break;
+
+        case IN_RUN:
+            len = out_end - out < dec->remaining ?
+                out_end - out : dec->remaining;
+            memset(out, dec->value, len);
+            out += len;
+            dec->remaining -= len;
+
+            if (dec->remaining > 0)
+                goto done;
+            dec->state = NEED_HEADER;
+            break;
+
+        case IN_LITERAL:
+            len = out_end - out < dec->remaining ?
+                out_end - out : dec->remaining;
+            if (end - in < len)
+                len = end - in;
+            memcpy(out, in, len);
+            in += len;
+            out += len;
+            dec->remaining -= len;
+
+            if (dec->remaining > 0)
+                goto done;
+            dec->state = NEED_HEADER;
+            break;
+        }
+    }
+
+done:
+    dec->consumed = in - start;
+    return out - out_start;
+}
+
+
+/*!
+ * Returns 1 if the decoder is between pairs or packets, which is where a
+ * complete stream ends, or 0 if the input so far stopped partway through.
+ */
+int rl_decoder_done(const rl_decoder *dec) {
+    assert(dec != NULL);
+
+    return dec->state == NEED_HEADER;
+}
@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "rl_encode.h"
+
+
+/*!
+ * Returns the first position in [p, end) whose byte isn't ch, or end if the
+ * whole range is ch.  With SSE2 the bytes are compared 16 at a time.
+ */
+static const unsigned char * run_end(const unsigned char *p,
+                                     const unsigned char *end,
+                                     unsigned char ch) {
+#ifdef __SSE2__
+    __m128i value = _mm_set1_epi8((char) ch);
+    int mask;
+
+    /* Most runs in data that doesn't compress are only one byte long. */
+    if (p != end && *p != ch)
+        return p;
+
+    while (end - p >= 16) {
+        mask = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) p), value));
+        if (mask != 0xffff)
+            return p + __builtin_ctz(~mask);
+        p += 16;
+    }
+#endif
+
+    while (p != end && *p == ch)
+        p++;
+
+    return p;
+}
+
+
+/*! Resets the encoder to the start of a new input. */
+void rl_encoder_init(rl_encoder *enc) {
+    assert(enc != NULL);
+
+    enc->lastch = -1;
+    enc->count = 0;
+}
+
+
+/*!
+ * Encodes the next input_length bytes of input, writing every [count][value]
+ * pair that is completed into output, which must have room for
+ * RL_ENCODE_BOUND(input_length) bytes.  The last run is left open in the
+ * encoder.  Returns the number of bytes written.
+ */
+int rl_encode_chunk(rl_encoder *enc, const unsigned char *input_data,
+                    int input_length, unsigned char *output) {
+    const unsigned char *end = input_data + input_length;
+    const unsigned char *limit;
+    unsigned char *out = output;
+    int lastch, count;
+
+    assert(enc != NULL);
+    assert(input_data != NULL || input_length == 0);
+
+    if (input_length == 0)
+        return 0;
+
+    /* Start the first run if this is the very beginning of the input. */
+    if (enc->lastch == -1) {
+        enc->lastch = *input_data++;
+        enc->count = 1;
+    }
+
+    lastch = enc->lastch;
+    count = enc->count;
+
+    while (input_data != end) {
+        /* Find where the current run stops, without going past 255. */
+        limit = end - input_data < 255 - count ?
+            end : input_data + (255 - count);
+        limit = run_end(input_data, limit, (unsigned char) lastch);
+        count += limit - input_data;
+        input_data = limit;
+
+        if (input_data == end)
+            break;
+
+        assert(count > 0 && count < 256);
+
+        /* Write out the count and then the character. */
+        *out++ = (unsigned char) count;
+        *out++ = (unsigned char) lastch;
+
+        lastch = *input_data++;
+        count = 1;
+    }
+
+    enc->lastch = lastch;
+    enc->count = count;
+
+    return out - output;
+}
+
+
+/*!
+ * Writes the run still open in the encoder, if any, into output (which needs
+ * room for 2 bytes), and resets the encoder.  Returns the number of bytes
+ * written.
+ */
+int rl_encode_finish(rl_encoder *enc, unsigned char *output) {
+    int written = 0;
+
+    assert(enc != NULL);
+
+    if (enc->count > 0) {
+        /* Write the last values out. */
+        output[0] = (unsigned char) enc->count;
+        output[1] = (unsigned char) enc->lastch;
+        written = 2;
+    }
+
+    rl_encoder_init(enc);
+    return written;
+}
+
+
+/*!
+ * Run-length encodes the input buffer into a malloc'd buffer, the reverse of
+ * rl_decode().  The length of the encoded result is stored into
+ * *output_length.
+ */
+unsigned char * rl_encode(unsigned char *input_data, int input_length,
+                          int *output_length) {
+    rl_encoder enc;
+    unsigned char *output;
+    int length;
+
+    assert(output_length != NULL);
+
+    /* malloc(0) may return NULL, so always ask for at least one byte. */
+    output = malloc(RL_ENCODE_BOUND(input_length) + 1);
+    if (output == NULL)
+        return NULL;
+
+    rl_encoder_init(&enc);
+    length = rl_encode_chunk(&enc, input_data, input_length, output);
+    length += rl_encode_finish(&enc, output + length);
+
+    *output_length = length;
+    return output;
+}
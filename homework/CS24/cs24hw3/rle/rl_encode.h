@@ -0,0 +1,27 @@
+/*!
+ * The state of a run-length encoder that is fed its input in chunks.  The
+ * run that is still open at the end of one chunk is carried over into the
+ * next, so the output is the same as if all of the input came at once.
+ */
+typedef struct rl_encoder {
+    int lastch;     /* value of the current run, or -1 before any input */
+    int count;      /* length of the current run so far */
+} rl_encoder;
+
+
+/*!
+ * The largest number of bytes that encoding input_length bytes can produce,
+ * for sizing output buffers.
+ */
+#define RL_ENCODE_BOUND(input_length)  (2 * (input_length))
+
+
+void rl_encoder_init(rl_encoder *enc);
+
+int rl_encode_chunk(rl_encoder *enc, const unsigned char *input_data,
+                    int input_length, unsigned char *output);
+
+int rl_encode_finish(rl_encoder *enc, unsigned char *output);
+
+unsigned char * rl_encode(unsigned char *input_data, int input_length,
+                          int *output_length);
@@ -0,0 +1,173 @@
+#include <string.h>
+#include <assert.h>
+
+#include "rl_packbits.h"
+
+
+/*! Resets the encoder to the start of a new input. */
+void rl_packbits_encoder_init(rl_packbits_encoder *enc) {
+    assert(enc != NULL);
+
+    enc->num_literals = 0;
+    enc->lastch = -1;
+    enc->count = 0;
+}
+
+
+/*! Writes out the pending literal bytes as one packet, if there are any. */
+static unsigned char * flush_literals(rl_packbits_encoder *enc,
+                                      unsigned char *out) {
+    if (enc->num_literals > 0) {
+        *out++ = (unsigned char) (enc->num_literals - 1);
+        memcpy(out, enc->literals, enc->num_literals);
+        out += enc->num_literals;
+        enc->num_literals = 0;
+    }
+    return out;
+}
+
+
+/*! Adds a byte to the pending literals, writing them out when full. */
+static unsigned char * add_literal(rl_packbits_encoder *enc,
+                                   unsigned char *out, int ch) {
+    enc->literals[enc->num_literals++] = (unsigned char) ch;
+    if (enc->num_literals == 128)
+        out = flush_literals(enc, out);
+    return out;
+}
+
+
+/*!
+ * Ends the current run.  Runs of three or more get a repeat packet; shorter
+ * ones are cheaper as part of a literal span.
+ */
+static unsigned char * end_run(rl_packbits_encoder *enc, unsigned char *out) {
+    if (enc->count >= 3) {
+        out = flush_literals(enc, out);
+        *out++ = (unsigned char) (257 - enc->count);
+        *out++ = (unsigned char) enc->lastch;
+    }
+    else {
+        while (enc->count-- > 0)
+            out = add_literal(enc, out, enc->lastch);
+    }
+
+    enc->count = 0;
+    return out;
+}
+
+
+/*!
+ * Encodes the next input_length bytes of input, writing every packet that is
+ * completed into output, which must have room for
+ * RL_PACKBITS_BOUND(input_length) bytes.  Returns the number of bytes
+ * written.
+ */
+int rl_packbits_encode_chunk(rl_packbits_encoder *enc,
+                             const unsigned char *input_data,
+                             int input_length, unsigned char *output) {
+    const unsigned char *end = input_data + input_length;
+    unsigned char *out = output;
+    int ch;
+
+    assert(enc != NULL);
+    assert(input_data != NULL || input_length == 0);
+
+    while (input_data != end) {
+        ch = *input_data++;
+
+        if (ch == enc->lastch && enc->count > 0) {
+            /* A run that reaches the longest packet is written right away,
+             * and a new run of the same value starts after it.
+             */
+            if (++enc->count == 128) {
+                out = end_run(enc, out);
+            }
+        }
+        else {
+            out = end_run(enc, out);
+            enc->lastch = ch;
+            enc->count = 1;
+        }
+    }
+
+    return out - output;
+}
+
+
+/*!
+ * Writes everything still pending in the encoder into output, which needs
+ * room for RL_PACKBITS_BOUND(0) bytes, and resets the encoder.  Returns the
+ * number of bytes written.
+ */
+int rl_packbits_encode_finish(rl_packbits_encoder *enc,
+                              unsigned char *output) {
+    unsigned char *out = output;
+
+    assert(enc != NULL);
+
+    out = end_run(enc, out);
+    out = flush_literals(enc, out);
+
+    rl_packbits_encoder_init(enc);
+    return out - output;
+}
+
+
+/*!
+ * Returns the size of the data that the PackBits input decodes to.  A packet
+ * cut short by the end of the input contributes only the bytes present.
+ */
+int rl_packbits_decode_size(const unsigned char *input_data,
+                            int input_length) {
+    const unsigned char *end = input_data + input_length;
+    int size = 0, h, n;
+
+    while (input_data != end) {
+        h = *input_data++;
+        if (h < 128) {
+            n = h + 1;
+            if (n > end - input_data)
+                n = end - input_data;
+            size += n;
+            input_data += n;
+        }
+        else if (h > 128 && input_data != end) {
+            size += 257 - h;
+            input_data++;
+        }
+    }
+
+    return size;
+}
+
+
+/*!
+ * Decodes PackBits input into output, which must hold
+ * rl_packbits_decode_size() bytes.  Returns the number of bytes written.
+ */
+int rl_packbits_decode_into(const unsigned char *input_data,
+                            int input_length, unsigned char *output) {
+    const unsigned char *end = input_data + input_length;
+    unsigned char *out = output;
+    int h, n;
+
+    while (input_data != end) {
+        h = *input_data++;
+        if (h < 128) {
+            n = h + 1;
+            if (n > end - input_data)
+                n = end - input_data;
+            memcpy(out, input_data, n);
+            out += n;
+            input_data += n;
+        }
+        else if (h > 128 && input_data != end) {
+            n = 257 - h;
+            memset(out, *input_data++, n);
+            out += n;
+        }
+    }
+
+    return out - output;
+}
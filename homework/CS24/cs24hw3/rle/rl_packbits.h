@@ -0,0 +1,55 @@
+/*
+ * The PackBits flavor of run-length encoding.  The data is a sequence of
+ * packets, each starting with a header byte h:
+ *
+ *     h = 0..127      h + 1 literal bytes follow (1 to 128)
+ *     h = 129..255    the next byte is repeated 257 - h times (2 to 128)
+ *     h = 128         no-op; nothing follows
+ *
+ * Literal spans cost one byte per 128 instead of doubling the way [count]
+ * [value] pairs do, so incompressible data grows by under 1%.  A PackBits
+ * stream written by rlenc starts with the four bytes 0x00 'R' 'L' 'P', which
+ * can't begin a plain RLE stream.
+ */
+
+
+#define RL_PACKBITS_MAGIC "\0RLP"
+#define RL_PACKBITS_MAGIC_SIZE 4
+
+
+/*!
+ * The largest number of bytes that one call to rl_packbits_encode_chunk() or
+ * rl_packbits_encode_finish() can produce from input_length bytes of input,
+ * including what was still pending from earlier chunks.
+ */
+#define RL_PACKBITS_BOUND(input_length) \
+    ((input_length) + (input_length) / 128 + 258)
+
+
+/*!
+ * The state of a PackBits encoder that is fed its input in chunks.  Literal
+ * bytes and the current run are held back until it is known how they end,
+ * but never more than 127 of each, so the output keeps up with the input.
+ */
+typedef struct rl_packbits_encoder {
+    unsigned char literals[128];
+    int num_literals;
+    int lastch;         /* value of the current run, or -1 if none */
+    int count;          /* length of the current run so far */
+} rl_packbits_encoder;
+
+
+void rl_packbits_encoder_init(rl_packbits_encoder *enc);
+
+int rl_packbits_encode_chunk(rl_packbits_encoder *enc,
+                             const unsigned char *input_data,
+                             int input_length, unsigned char *output);
+
+int rl_packbits_encode_finish(rl_packbits_encoder *enc,
+                              unsigned char *output);
+
+int rl_packbits_decode_size(const unsigned char *input_data,
+                            int input_length);
+
+int rl_packbits_decode_into(const unsigned char *input_data,
+                            int input_length, unsigned char *output);
@@ -0,0 +1,273 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "rl_pipe.h"
+
+
+/*! A buffer, and how many bytes of it are in use. */
+typedef struct block {
+    unsigned char *data;
+    int length;
+} block;
+
+
+/*!
+ * A queue of blocks passed from one thread to another.  It has room for one
+ * more block than there are buffers, for the block that marks the end.
+ */
+#define QUEUE_SIZE (RL_PIPE_DEPTH + 1)
+
+typedef struct queue {
+    block items[QUEUE_SIZE];
+    int head;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} queue;
+
+
+struct rl_pipe {
+    FILE *input;
+    FILE *output;
+    int input_size;
+
+    queue free_input;       /* input buffers ready to be read into */
+    queue full_input;       /* input blocks ready for the caller */
+    queue free_output;      /* output buffers ready for the caller */
+    queue full_output;      /* output blocks ready to be written */
+
+    unsigned char *buffers; /* the single allocation holding all buffers */
+    unsigned char *current; /* input block the caller is working on */
+
+    pthread_t reader;
+    pthread_t writer;
+    int read_failed;        /* set by the reader if fread() fails */
+    int write_failed;       /* set by the writer if fwrite() fails */
+};
+
+
+static void queue_init(queue *q) {
+    q->head = 0;
+    q->count = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->changed, NULL);
+}
+
+
+static void queue_destroy(queue *q) {
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->changed);
+}
+
+
+static void queue_put(queue *q, unsigned char *data, int length) {
+    pthread_mutex_lock(&q->lock);
+    assert(q->count < QUEUE_SIZE);
+
+    q->items[(q->head + q->count) % QUEUE_SIZE].data = data;
+    q->items[(q->head + q->count) % QUEUE_SIZE].length = length;
+    q->count++;
+
+    pthread_cond_signal(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+}
+
+
+static block queue_get(queue *q) {
+    block b;
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0)
+        pthread_cond_wait(&q->changed, &q->lock);
+
+    b = q->items[q->head];
+    q->head = (q->head + 1) % QUEUE_SIZE;
+    q->count--;
+
+    pthread_mutex_unlock(&q->lock);
+    return b;
+}
+
+
+/*! Frees the pipeline once its threads have stopped. */
+static void pipe_free(rl_pipe *pipe) {
+    queue_destroy(&pipe->free_input);
+    queue_destroy(&pipe->full_input);
+    queue_destroy(&pipe->free_output);
+    queue_destroy(&pipe->full_output);
+
+    free(pipe->buffers);
+    free(pipe);
+}
+
+
+/*! Reads blocks until the end of the input, which is passed on as a block
+ *  of length 0.  A read error ends the input there too.
+ */
+static void * reader_main(void *arg) {
+    rl_pipe *pipe = arg;
+    block b;
+
+    do {
+        b = queue_get(&pipe->free_input);
+        b.length = fread(b.data, 1, pipe->input_size, pipe->input);
+        if (ferror(pipe->input)) {
+            pipe->read_failed = 1;
+            b.length = 0;
+        }
+        queue_put(&pipe->full_input, b.data, b.length);
+    } while (b.length > 0);
+
+    return NULL;
+}
+
+
+/*! Writes blocks until it is handed one with no buffer. */
+static void * writer_main(void *arg) {
+    rl_pipe *pipe = arg;
+    block b;
+
+    while (1) {
+        b = queue_get(&pipe->full_output);
+        if (b.data == NULL)
+            break;
+
+        if (fwrite(b.data, 1, b.length, pipe->output) != (size_t) b.length)
+            pipe->write_failed = 1;
+
+        queue_put(&pipe->free_output, b.data, 0);
+    }
+
+    return NULL;
+}
+
+
+/*!
+ * Starts a pipeline that reads input_size-byte blocks from input, and hands
+ * out output buffers of output_size bytes whose contents are written to
+ * output.  Returns NULL if memory or threads ran out.
+ */
+rl_pipe * rl_pipe_open(FILE *input, FILE *output, int input_size,
+                       int output_size) {
+    rl_pipe *pipe;
+    unsigned char *data;
+    int i;
+
+    assert(input != NULL && output != NULL);
+    assert(input_size > 0 && output_size > 0);
+
+    pipe = malloc(sizeof(rl_pipe));
+    if (pipe == NULL)
+        return NULL;
+
+    pipe->input = input;
+    pipe->output = output;
+    pipe->input_size = input_size;
+    pipe->current = NULL;
+    pipe->read_failed = 0;
+    pipe->write_failed = 0;
+
+    queue_init(&pipe->free_input);
+    queue_init(&pipe->full_input);
+    queue_init(&pipe->free_output);
+    queue_init(&pipe->full_output);
+
+    /* Allocate all of the buffers in one piece. */
+    data = malloc(RL_PIPE_DEPTH * ((long) input_size + output_size));
+    pipe->buffers = data;
+    if (data == NULL) {
+        pipe_free(pipe);
+        return NULL;
+    }
+
+    for (i = 0; i < RL_PIPE_DEPTH; i++) {
+        queue_put(&pipe->free_input, data, 0);
+        data += input_size;
+    }
+    for (i = 0; i < RL_PIPE_DEPTH; i++) {
+        queue_put(&pipe->free_output, data, 0);
+        data += output_size;
+    }
+
+    if (pthread_create(&pipe->writer, NULL, writer_main, pipe) != 0) {
+        pipe_free(pipe);
+        return NULL;
+    }
+
+    if (pthread_create(&pipe->reader, NULL, reader_main, pipe) != 0) {
+        /* The writer stops when it is handed a block with no buffer. */
+        queue_put(&pipe->full_output, NULL, 0);
+        pthread_join(pipe->writer, NULL);
+        pipe_free(pipe);
+        return NULL;
+    }
+
+    return pipe;
+}
+
+
+/*!
+ * Gets the next block of input, and releases the previous one back to the
+ * reader.  Returns the length of the block, which is 0 at the end of the
+ * input or after a read error.
+ */
+int rl_pipe_read(rl_pipe *pipe, unsigned char **data) {
+    block b;
+
+    assert(pipe != NULL && data != NULL);
+
+    if (pipe->current != NULL) {
+        queue_put(&pipe->free_input, pipe->current, 0);
+        pipe->current = NULL;
+    }
+
+    b = queue_get(&pipe->full_input);
+    if (b.length == 0) {
+        /* Keep the end-of-input block, so that later calls see it again. */
+        queue_put(&pipe->full_input, b.data, 0);
+        *data = NULL;
+        return 0;
+    }
+
+    pipe->current = b.data;
+    *data = b.data;
+    return b.length;
+}
+
+
+/*! Gets an empty output buffer, waiting for the writer if need be. */
+unsigned char * rl_pipe_buffer(rl_pipe *pipe) {
+    assert(pipe != NULL);
+
+    return queue_get(&pipe->free_output).data;
+}
+
+
+/*! Queues the first length bytes of an output buffer to be written. */
+void rl_pipe_write(rl_pipe *pipe, unsigned char *buffer, int length) {
+    assert(pipe != NULL && buffer != NULL);
+
+    queue_put(&pipe->full_output, buffer, length);
+}
+
+
+/*!
+ * Waits for all of the queued output to be written, stops the threads and
+ * frees the pipeline.  The caller must have read to the end of the input.
+ * Returns 1 if everything was read and written, or 0 if a read or a write
+ * failed.
+ */
+int rl_pipe_close(rl_pipe *pipe) {
+    int ok;
+
+    assert(pipe != NULL);
+
+    queue_put(&pipe->full_output, NULL, 0);
+    pthread_join(pipe->writer, NULL);
+    pthread_join(pipe->reader, NULL);
+
+    ok = !pipe->read_failed && !pipe->write_failed;
+    pipe_free(pipe);
+    return ok;
+}
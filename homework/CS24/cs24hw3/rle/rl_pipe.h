@@ -0,0 +1,32 @@
+/*
+ * An I/O pipeline for the RLE tools.  One thread reads input blocks ahead of
+ * the caller, and another writes the caller's output blocks behind it, so
+ * reading, encoding or decoding, and writing all overlap.  With slow files
+ * the throughput approaches that of the slowest stage instead of the sum of
+ * all three.
+ *
+ * The caller loops over rl_pipe_read() until it returns 0, and for each
+ * piece of output gets a buffer from rl_pipe_buffer(), fills it, and hands
+ * it to rl_pipe_write().  Output is written in the order it is handed over.
+ */
+
+#include <stdio.h>
+
+
+/*! Number of input blocks and of output blocks in flight at once. */
+#define RL_PIPE_DEPTH 3
+
+
+typedef struct rl_pipe rl_pipe;
+
+
+rl_pipe * rl_pipe_open(FILE *input, FILE *output, int input_size,
+                       int output_size);
+
+int rl_pipe_read(rl_pipe *pipe, unsigned char **data);
+
+unsigned char * rl_pipe_buffer(rl_pipe *pipe);
+
+void rl_pipe_write(rl_pipe *pipe, unsigned char *buffer, int length);
+
+int rl_pipe_close(rl_pipe *pipe);
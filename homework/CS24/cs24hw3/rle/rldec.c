@@ -1,66 +1,210 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include "rl_decode.h"
+#include "rl_packbits.h"
+#include "rl_chunk.h"
+#include "rl_pipe.h"
 
 
 void usage(const char *progname) {
     assert(progname != NULL);
 
-    printf("usage:  %s infile outfile\n", progname);
+    printf("usage:  %s [-j threads] [-t] infile outfile\n", progname);
     printf("\tThe program takes a run-length-encoded input file and\n");
     printf("\tproduces a decoded version of the file, saving\n");
-    printf("\tthe result to outfile.\n");
+    printf("\tthe result to outfile.  Chunked files from rlenc -c\n");
+    printf("\tare decoded on the given number of threads, which\n");
+    printf("\tdefaults to the number of processors.  PackBits files\n");
+    printf("\tfrom rlenc -p are recognized as well.  With -t\n");
+    printf("\treading and writing run on their own threads,\n");
+    printf("\toverlapped with the decoding.\n");
+}
+
+
+/*! Number of bytes of input read, and of output written, at a time. */
+#define BLOCK_SIZE (256 * 1024)
+
+static unsigned char inbuf[BLOCK_SIZE];
+static unsigned char outbuf[BLOCK_SIZE];
+
+
+/*!
+ * Decodes a chunked container.  The index is at the end of the file, so the
+ * whole file is loaded, and the chunks are decoded on num_threads threads.
+ * Returns 0 on success, or 4 if the container is damaged.
+ */
+int decode_container(FILE *input, FILE *output, int num_threads) {
+    long long input_size;
+    unsigned char *input_buffer, *output_buffer;
+    rl_chunk_index *index;
+    int ok = 0;
+
+    /* Load the input file into a buffer in memory. */
+    fseek(input, 0, SEEK_END);
+    input_size = ftell(input);
+    fseek(input, 0, SEEK_SET);
+    input_buffer = malloc(input_size + 1);
+    if (input_buffer == NULL)
+        return 4;
+
+    fread(input_buffer, sizeof(unsigned char), input_size, input);
+
+    index = rl_chunk_read_index(input_buffer, input_size);
+    if (index != NULL) {
+        output_buffer = malloc(index->decoded_length + 1);
+        if (output_buffer != NULL &&
+            rl_chunk_decode(index, input_buffer, output_buffer,
+                            num_threads)) {
+            fwrite(output_buffer, sizeof(unsigned char),
+                   index->decoded_length, output);
+            ok = 1;
+        }
+
+        free(output_buffer);
+        rl_chunk_free_index(index);
+    }
+
+    free(input_buffer);
+    return ok ? 0 : 4;
+}
+
+
+/*!
+ * Decodes one block of input, writing the output either directly or through
+ * the pipeline if there is one.  Runs can decode to more than a block, so
+ * the rest of the input is fed in until the output buffer isn't filled.
+ */
+void decode_block(rl_decoder *dec, const unsigned char *next, size_t nread,
+                  FILE *output, rl_pipe *pipe) {
+    unsigned char *buffer;
+    int written;
+
+    do {
+        buffer = pipe != NULL ? rl_pipe_buffer(pipe) : outbuf;
+        written = rl_decoder_feed(dec, next, nread, buffer, BLOCK_SIZE);
+        if (pipe != NULL)
+            rl_pipe_write(pipe, buffer, written);
+        else
+            fwrite(buffer, 1, written, output);
+
+        next += dec->consumed;
+        nread -= dec->consumed;
+    } while (nread > 0 || written == BLOCK_SIZE);
+}
+
+
+/*!
+ * Decodes a stream of pairs or PackBits packets a block at a time, in
+ * constant memory.  The first nread bytes of input are already in inbuf.
+ * If piped is nonzero, the input is read ahead and the output written
+ * behind on other threads.  Returns 0 on success, or 4 if the input ends
+ * partway through a pair or packet, or couldn't be read, or the output
+ * couldn't be written.
+ */
+int decode_stream(FILE *input, FILE *output, size_t nread, int piped) {
+    rl_decoder dec;
+    rl_pipe *pipe = NULL;
+    unsigned char *next = inbuf, *data;
+    int length, ok = 1;
+
+    if (nread >= RL_PACKBITS_MAGIC_SIZE &&
+        memcmp(inbuf, RL_PACKBITS_MAGIC, RL_PACKBITS_MAGIC_SIZE) == 0) {
+        rl_packbits_decoder_init(&dec);
+        next += RL_PACKBITS_MAGIC_SIZE;
+        nread -= RL_PACKBITS_MAGIC_SIZE;
+    }
+    else {
+        rl_decoder_init(&dec);
+    }
+
+    /* Without a pipeline, just fall back to doing things in order. */
+    if (piped)
+        pipe = rl_pipe_open(input, output, BLOCK_SIZE, BLOCK_SIZE);
+
+    decode_block(&dec, next, nread, output, pipe);
+
+    if (pipe != NULL) {
+        while ((length = rl_pipe_read(pipe, &data)) > 0)
+            decode_block(&dec, data, length, output, pipe);
+        ok = rl_pipe_close(pipe);
+    }
+    else {
+        while ((nread = fread(inbuf, 1, BLOCK_SIZE, input)) > 0)
+            decode_block(&dec, inbuf, nread, output, NULL);
+    }
+
+    return ok && rl_decoder_done(&dec) ? 0 : 4;
 }
 
 
 int main(int argc, char **argv) {
     FILE *input, *output;
-    int input_size, output_size;
-    unsigned char *input_buffer, *output_buffer;
+    size_t nread;
+    int num_threads = (int) sysconf(_SC_NPROCESSORS_ONLN), arg = 1, result;
+    int piped = 0;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+            num_threads = atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "-t") == 0) {
+            piped = 1;
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
 
     /* If we didn't get enough arguments, complain. */
-    if (argc != 3) {
+    if (argc - arg != 2) {
         usage(argv[0]);
         return 1;
     }
 
-    input = fopen(argv[1], "rb");
+    input = fopen(argv[arg], "rb");
     if (input == NULL) {
-        printf("Couldn't open input file \"%s\"!\n", argv[1]);
+        printf("Couldn't open input file \"%s\"!\n", argv[arg]);
         return 2;
     }
 
-    output = fopen(argv[2], "wb");
+    output = fopen(argv[arg + 1], "wb");
     if (output == NULL) {
-        printf("Couldn't open output file \"%s\"!\n", argv[2]);
+        printf("Couldn't open output file \"%s\"!\n", argv[arg + 1]);
         return 3;
     }
 
-    printf("Decoding file \"%s\" into file \"%s\".\n", argv[1], argv[2]);
-
-    /* Load the input file into a buffer in memory. */
-    fseek(input, 0, SEEK_END);
-    input_size = ftell(input);
-    fseek(input, 0, SEEK_SET);
-    input_buffer = malloc(input_size + 1);
-
-    fread(input_buffer, sizeof(unsigned char), input_size, input);
-
-    /* Decode the input file, and write the resutls to the output file. */
-    output_buffer = rl_decode(input_buffer, input_size, &output_size);
-
-    fwrite(output_buffer, sizeof(unsigned char), output_size, output);
-
-    printf("All done!\n");
+    printf("Decoding file \"%s\" into file \"%s\".\n", argv[arg],
+           argv[arg + 1]);
+
+    /* Decode the input file, and write the resutls to the output file.
+     * The first block says which format the input is in.
+     */
+    nread = fread(inbuf, 1, BLOCK_SIZE, input);
+    if (rl_chunk_is_container(inbuf, nread))
+        result = decode_container(input, output, num_threads);
+    else
+        result = decode_stream(input, output, nread, piped);
+
+    if (ferror(input)) {
+        printf("Couldn't read the input file \"%s\"!\n", argv[arg]);
+        result = 4;
+    }
+    else if (result != 0) {
+        printf("Input file \"%s\" is damaged or incomplete!\n", argv[arg]);
+    }
 
     fclose(output);
     fclose(input);
 
-    free(input_buffer);
-    free(output_buffer);
+    if (result != 0)
+        return result;
+
+    printf("All done!\n");
 
     return 0;
 }
-
@@ -1,83 +1,199 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
+#include "rl_encode.h"
+#include "rl_packbits.h"
+#include "rl_chunk.h"
+#include "rl_pipe.h"
+
+
+/*! Number of bytes of input read and encoded at a time. */
+#define BLOCK_SIZE (256 * 1024)
+
+static unsigned char inbuf[BLOCK_SIZE];
+static unsigned char outbuf[RL_ENCODE_BOUND(BLOCK_SIZE)];
+
 
 void usage(const char *progname) {
     assert(progname != NULL);
 
-    printf("usage:  %s infile outfile\n", progname);
+    printf("usage:  %s [-c] [-p] [-t] infile outfile\n", progname);
     printf("\tThe program takes the input file and produces a\n");
     printf("\trun-length-encoded version of the file, saving\n");
-    printf("\tthe result to outfile.\n");
+    printf("\tthe result to outfile.  With -c the result is a\n");
+    printf("\tchunked container that rldec can decode in parallel.\n");
+    printf("\tWith -p the data is encoded as PackBits packets,\n");
+    printf("\twhich don't double the size of incompressible data.\n");
+    printf("\tWith -t reading and writing run on their own threads,\n");
+    printf("\toverlapped with the encoding (not with -c).\n");
+}
+
+
+/*! Either of the two stream encoders, whichever the output uses. */
+typedef struct stream_encoder {
+    int packbits;
+    rl_encoder enc;
+    rl_packbits_encoder pb;
+} stream_encoder;
+
+
+void stream_encoder_init(stream_encoder *se, int packbits) {
+    se->packbits = packbits;
+    rl_encoder_init(&se->enc);
+    rl_packbits_encoder_init(&se->pb);
+}
+
+
+/*!
+ * Encodes the next block of input into output, which must hold
+ * RL_ENCODE_BOUND(BLOCK_SIZE) bytes; a block of length 0 finishes the
+ * stream.  Returns the number of bytes written.
+ */
+int encode_block(stream_encoder *se, const unsigned char *data, int length,
+                 unsigned char *output) {
+    if (se->packbits) {
+        return length > 0 ?
+            rl_packbits_encode_chunk(&se->pb, data, length, output) :
+            rl_packbits_encode_finish(&se->pb, output);
+    }
+
+    return length > 0 ? rl_encode_chunk(&se->enc, data, length, output) :
+                        rl_encode_finish(&se->enc, output);
+}
+
+
+/*!
+ * Encodes the input file a block at a time, and writes the results to the
+ * output file.  Runs that span two blocks are carried over by the encoder,
+ * so the output doesn't depend on the block size.
+ */
+void encode_serial(FILE *input, FILE *output, int packbits) {
+    stream_encoder se;
+    size_t nread, nwrite;
+
+    stream_encoder_init(&se, packbits);
+    if (packbits)
+        fwrite(RL_PACKBITS_MAGIC, 1, RL_PACKBITS_MAGIC_SIZE, output);
+
+    while ((nread = fread(inbuf, 1, BLOCK_SIZE, input)) > 0) {
+        nwrite = encode_block(&se, inbuf, nread, outbuf);
+        fwrite(outbuf, 1, nwrite, output);
+    }
+
+    nwrite = encode_block(&se, NULL, 0, outbuf);
+    fwrite(outbuf, 1, nwrite, output);
+}
+
+
+/*!
+ * Like encode_serial(), but the next block is read and the previous one is
+ * written on other threads while a block is being encoded.  Returns 1 on
+ * success, or 0 if the pipeline couldn't be started or a read or a write
+ * failed.
+ */
+int encode_piped(FILE *input, FILE *output, int packbits) {
+    stream_encoder se;
+    rl_pipe *pipe;
+    unsigned char *data, *buffer;
+    int length;
+
+    pipe = rl_pipe_open(input, output, BLOCK_SIZE,
+                        RL_ENCODE_BOUND(BLOCK_SIZE));
+    if (pipe == NULL)
+        return 0;
+
+    stream_encoder_init(&se, packbits);
+    if (packbits) {
+        buffer = rl_pipe_buffer(pipe);
+        memcpy(buffer, RL_PACKBITS_MAGIC, RL_PACKBITS_MAGIC_SIZE);
+        rl_pipe_write(pipe, buffer, RL_PACKBITS_MAGIC_SIZE);
+    }
+
+    do {
+        length = rl_pipe_read(pipe, &data);
+        buffer = rl_pipe_buffer(pipe);
+        rl_pipe_write(pipe, buffer, encode_block(&se, data, length, buffer));
+    } while (length > 0);
+
+    return rl_pipe_close(pipe);
 }
 
 
 int main(int argc, char **argv) {
     FILE *input, *output;
-    int lastch, nextch, count;
+    rl_chunk_writer writer;
+    size_t nread;
+    int chunked = 0, packbits = 0, piped = 0, arg = 1, ok = 1;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-c") == 0) {
+            chunked = 1;
+        }
+        else if (strcmp(argv[arg], "-p") == 0) {
+            packbits = 1;
+        }
+        else if (strcmp(argv[arg], "-t") == 0) {
+            piped = 1;
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
 
     /* If we didn't get enough arguments, complain. */
-    if (argc != 3) {
+    if (argc - arg != 2) {
         usage(argv[0]);
         return 1;
     }
 
-    input = fopen(argv[1], "rb");
+    input = fopen(argv[arg], "rb");
     if (input == NULL) {
-        printf("Couldn't open input file \"%s\"!\n", argv[1]);
+        printf("Couldn't open input file \"%s\"!\n", argv[arg]);
         return 2;
     }
 
-    output = fopen(argv[2], "wb");
+    output = fopen(argv[arg + 1], "wb");
     if (output == NULL) {
-        printf("Couldn't open output file \"%s\"!\n", argv[2]);
+        printf("Couldn't open output file \"%s\"!\n", argv[arg + 1]);
         return 3;
     }
 
-    printf("Encoding file \"%s\" into file \"%s\".\n", argv[1], argv[2]);
-
-    /* Encode the input file, and write the resutls to the output file. */
-
-    lastch = fgetc(input);
-    if (lastch != EOF) {
-        count = 1;
-
-        while (1) {
-            nextch = fgetc(input);
-            if (nextch == EOF)
-                break;
+    printf("Encoding file \"%s\" into file \"%s\".\n", argv[arg],
+           argv[arg + 1]);
 
-            assert(count > 0 && count < 256);
-
-	    if ((nextch != lastch && lastch != -1) || count == 255) {
-                /* Write out the count and then the character. */
-                fputc(count, output);
-                fputc(lastch, output);
-
-                lastch = nextch;
-                count = 1;
-            }
-            else {
-                /* Saw the same character again. */
-                count++;
-            }
-
-            assert(count > 0 && count < 256);
-        }
+    if (chunked) {
+        /* Each block read becomes one independent chunk. */
+        ok = rl_chunk_writer_open(&writer, output,
+            packbits ? RL_CHUNK_PACKBITS : RL_CHUNK_PAIRS);
+        while (ok && (nread = fread(inbuf, 1, BLOCK_SIZE, input)) > 0)
+            ok = rl_chunk_write(&writer, inbuf, nread);
+        ok = rl_chunk_writer_close(&writer) && ok;
+    }
+    else if (piped) {
+        ok = encode_piped(input, output, packbits);
+    }
+    else {
+        encode_serial(input, output, packbits);
+    }
 
-        if (count > 0) {
-            /* Write the last values out. */
-            fputc(count, output);
-            fputc(lastch, output);
-        }
+    if (ferror(input)) {
+        printf("Couldn't read the input file \"%s\"!\n", argv[arg]);
+        ok = 0;
+    }
+    else if (!ok) {
+        printf("Couldn't write the output file!\n");
     }
 
     fclose(output);
     fclose(input);
 
+    if (!ok)
+        return 4;
+
     printf("All done!\n");
 
     return 0;
 }
-
@@ -0,0 +1,131 @@
+/*
+ * Tests for the chunked RLE container:  data is written as a container, and
+ * must come back the same whether the chunks are decoded on one thread or
+ * several, and rl_chunk_find() must locate every offset's chunk.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rl_chunk.h"
+
+
+/*! Builds test data with runs of varying lengths. */
+void make_data(unsigned char *data, int length) {
+    int i = 0, run, value = 0;
+
+    while (i < length) {
+        run = 1 + (i * 7 + value) % 300;
+        value = (value + 37) & 0xff;
+        while (run-- > 0 && i < length)
+            data[i++] = value;
+    }
+}
+
+
+/*! Writes the data as a container in chunks of chunk_size bytes. */
+unsigned char * make_container(unsigned char *data, int length,
+                               int chunk_size, int codec,
+                               long *container_length) {
+    rl_chunk_writer writer;
+    unsigned char *container;
+    FILE *f = tmpfile();
+    int pos, n;
+
+    rl_chunk_writer_open(&writer, f, codec);
+    for (pos = 0; pos < length; pos += n) {
+        n = length - pos < chunk_size ? length - pos : chunk_size;
+        rl_chunk_write(&writer, data + pos, n);
+    }
+    rl_chunk_writer_close(&writer);
+
+    *container_length = ftell(f);
+    container = malloc(*container_length);
+    rewind(f);
+    fread(container, 1, *container_length, f);
+    fclose(f);
+
+    return container;
+}
+
+
+int test_case(int length, int chunk_size, int codec) {
+    unsigned char *data, *container, *output;
+    rl_chunk_index *index;
+    long container_length;
+    int threads, chunk, i, ok = 1;
+
+    data = malloc(length + 1);
+    make_data(data, length);
+    container = make_container(data, length, chunk_size, codec,
+                               &container_length);
+
+    index = rl_chunk_read_index(container, container_length);
+    if (index == NULL || index->decoded_length != length) {
+        printf("Length %d, chunks of %d:\tFAIL:  bad index\n",
+               length, chunk_size);
+        return 0;
+    }
+
+    output = malloc(length + 1);
+    for (threads = 1; threads <= 4; threads += 3) {
+        memset(output, 0, length + 1);
+        if (!rl_chunk_decode(index, container, output, threads) ||
+            memcmp(output, data, length) != 0) {
+            printf("Length %d, chunks of %d, %d threads:\tFAIL:  decoded "
+                   "data doesn't match\n", length, chunk_size, threads);
+            ok = 0;
+        }
+    }
+
+    for (i = 0; i < length; i += 97) {
+        chunk = rl_chunk_find(index, i);
+        if (chunk < 0 || index->entries[chunk].decoded_offset > i ||
+            index->entries[chunk].decoded_offset +
+                index->entries[chunk].decoded_length <= i) {
+            printf("Length %d, chunks of %d:\tFAIL:  offset %d not found\n",
+                   length, chunk_size, i);
+            ok = 0;
+            break;
+        }
+    }
+    if (rl_chunk_find(index, length) != -1) {
+        printf("Length %d, chunks of %d:\tFAIL:  found the end\n",
+               length, chunk_size);
+        ok = 0;
+    }
+
+    /* A truncated container must be rejected rather than misread. */
+    if (rl_chunk_read_index(container, container_length - 1) != NULL) {
+        printf("Length %d, chunks of %d:\tFAIL:  truncated container "
+               "accepted\n", length, chunk_size);
+        ok = 0;
+    }
+
+    rl_chunk_free_index(index);
+    free(output);
+    free(container);
+    free(data);
+    return ok;
+}
+
+
+int main() {
+    int codec, failures = 0;
+
+    for (codec = RL_CHUNK_PAIRS; codec <= RL_CHUNK_PACKBITS; codec++) {
+        failures += !test_case(0, 1000, codec);
+        failures += !test_case(1, 1000, codec);
+        failures += !test_case(5000, 1000, codec);
+        failures += !test_case(5001, 1000, codec);
+        failures += !test_case(100000, 4096, codec);
+    }
+
+    if (failures == 0)
+        printf("Container test PASS.\n");
+    else
+        printf("Container test FAIL:  %d failures.\n", failures);
+
+    return failures != 0;
+}
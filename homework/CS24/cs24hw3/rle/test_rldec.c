@@ -98,6 +98,32 @@ void print_buf(unsigned char *buf, int length) {
 }
 
 
+/*!
+ * Decodes the input again through rl_decode_size() and rl_decode_into(),
+ * into a buffer of exactly the reported size followed by a guard byte that
+ * must be left alone.  Returns 1 if the result matches the expected data.
+ */
+int check_decode_into(unsigned char *input, int input_length,
+                      unsigned char *expected, int expected_length) {
+    unsigned char *buf;
+    int size, written, ok;
+
+    size = rl_decode_size(input, input_length);
+    if (size != expected_length)
+        return 0;
+
+    buf = malloc(size + 1);
+    buf[size] = 0xA5;
+    written = rl_decode_into(input, input_length, buf);
+
+    ok = written == size && buf[size] == 0xA5 &&
+         memcmp(buf, expected, size) == 0;
+
+    free(buf);
+    return ok;
+}
+
+
 /*!
  * Main entry-point for testing that the RLE decoder works.
  */
@@ -140,6 +166,11 @@ int main() {
             print_buf(actual, actual_length);
             printf("\n\n");
         }
+        else if (!check_decode_into(tests[i].encoded_str, input_length,
+                                    tests[i].decoded_str, expected_length)) {
+            printf("\tFAIL:  rl_decode_size()/rl_decode_into() don't match "
+                   "rl_decode()\n\n");
+        }
         else {
             printf("\tPASS\n\n");
         }
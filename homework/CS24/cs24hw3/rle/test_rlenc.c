@@ -0,0 +1,113 @@
+/*
+ * Tests for the RLE encoder library.  Each case is encoded all at once with
+ * rl_encode(), and again a few bytes at a time with rl_encode_chunk(), and
+ * both results must match the expected encoding.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rl_encode.h"
+
+
+/*!
+ * This struct is used to represent a single test-case for exercising
+ * the RLE encoder.
+ */
+typedef struct test_case {
+    unsigned char *decoded_str;
+    int repeat;                     /* decoded_str is repeated this often */
+    unsigned char encoded_str[100];
+    int encoded_length;
+} test_case;
+
+
+test_case tests[] = {
+    { "ABCDE", 1, {1, 'A', 1, 'B', 1, 'C', 1, 'D', 1, 'E'}, 10 },
+    { "AAABBCCCCCDEEE", 1, {3, 'A', 2, 'B', 5, 'C', 1, 'D', 3, 'E'}, 10 },
+    { "", 1, {0}, 0 },
+
+    /* Runs longer than 255 characters are split into several runs. */
+    { "A", 377, {255, 'A', 122, 'A'}, 4 },
+    { "A", 255, {255, 'A'}, 2 },
+    { "A", 510, {255, 'A', 255, 'A'}, 4 },
+    { "AB", 3, {1, 'A', 1, 'B', 1, 'A', 1, 'B', 1, 'A', 1, 'B'}, 12 },
+
+    /* Indicates the end of the test sequence. */
+    { NULL, 0, {0}, 0 }
+};
+
+
+/*! Encodes the input in pieces of chunk bytes, into output. */
+int encode_in_chunks(unsigned char *input, int length, int chunk,
+                     unsigned char *output) {
+    rl_encoder enc;
+    int pos, n, written = 0;
+
+    rl_encoder_init(&enc);
+    for (pos = 0; pos < length; pos += n) {
+        n = length - pos < chunk ? length - pos : chunk;
+        written += rl_encode_chunk(&enc, input + pos, n, output + written);
+    }
+    written += rl_encode_finish(&enc, output + written);
+
+    return written;
+}
+
+
+int check(const char *what, int i, unsigned char *expected,
+          int expected_length, unsigned char *actual, int actual_length) {
+    if (expected_length != actual_length) {
+        printf("Test case %d (%s):\tFAIL:  actual size %d doesn't match "
+               "expected size %d\n", i, what, actual_length, expected_length);
+        return 0;
+    }
+    if (memcmp(expected, actual, expected_length) != 0) {
+        printf("Test case %d (%s):\tFAIL:  encoded data doesn't match\n",
+               i, what);
+        return 0;
+    }
+    return 1;
+}
+
+
+int main() {
+    unsigned char *input, *actual;
+    int input_length, actual_length, len, r, chunk;
+    int i, failures = 0;
+
+    for (i = 0; tests[i].decoded_str != NULL; i++) {
+        len = strlen((char *) tests[i].decoded_str);
+        input_length = len * tests[i].repeat;
+        input = malloc(input_length + 1);
+        for (r = 0; r < tests[i].repeat; r++)
+            memcpy(input + r * len, tests[i].decoded_str, len);
+
+        actual = rl_encode(input, input_length, &actual_length);
+        if (!check("whole", i, tests[i].encoded_str, tests[i].encoded_length,
+                   actual, actual_length)) {
+            failures++;
+        }
+        free(actual);
+
+        actual = malloc(RL_ENCODE_BOUND(input_length) + 1);
+        for (chunk = 1; chunk <= 7; chunk += 3) {
+            actual_length = encode_in_chunks(input, input_length, chunk,
+                                             actual);
+            if (!check("chunked", i, tests[i].encoded_str,
+                       tests[i].encoded_length, actual, actual_length)) {
+                failures++;
+            }
+        }
+        free(actual);
+        free(input);
+    }
+
+    if (failures == 0)
+        printf("Encoder test PASS.\n");
+    else
+        printf("Encoder test FAIL:  %d failures.\n", failures);
+
+    return failures != 0;
+}
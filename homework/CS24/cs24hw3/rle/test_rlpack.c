@@ -0,0 +1,143 @@
+/*
+ * Tests for the PackBits encoder and decoder.  Fixed cases check the exact
+ * packets produced; generated data checks that encoding in chunks of any
+ * size round-trips, stays within RL_PACKBITS_BOUND, and matches encoding the
+ * whole input at once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rl_packbits.h"
+
+
+typedef struct test_case {
+    unsigned char *decoded_str;
+    int repeat;                     /* decoded_str is repeated this often */
+    unsigned char encoded_str[100];
+    int encoded_length;
+} test_case;
+
+
+test_case tests[] = {
+    { "", 1, {0}, 0 },
+    { "ABCDE", 1, {4, 'A', 'B', 'C', 'D', 'E'}, 6 },
+    { "AAB", 1, {2, 'A', 'A', 'B'}, 4 },
+    { "AAAB", 1, {254, 'A', 0, 'B'}, 4 },
+    { "A", 128, {129, 'A'}, 2 },
+    { "A", 130, {129, 'A', 1, 'A', 'A'}, 5 },
+    { "A", 256, {129, 'A', 129, 'A'}, 4 },
+
+    /* Indicates the end of the test sequence. */
+    { NULL, 0, {0}, 0 }
+};
+
+
+/*! Encodes the input in pieces of chunk bytes, into output. */
+int encode_in_chunks(const unsigned char *input, int length, int chunk,
+                     unsigned char *output, int *too_long) {
+    rl_packbits_encoder enc;
+    int pos, n, w, written = 0;
+
+    rl_packbits_encoder_init(&enc);
+    for (pos = 0; pos < length; pos += n) {
+        n = length - pos < chunk ? length - pos : chunk;
+        w = rl_packbits_encode_chunk(&enc, input + pos, n, output + written);
+        if (w > RL_PACKBITS_BOUND(n))
+            *too_long = 1;
+        written += w;
+    }
+    written += rl_packbits_encode_finish(&enc, output + written);
+
+    return written;
+}
+
+
+/*! Encodes and decodes the input, returning 1 if it comes back intact. */
+int round_trip(const unsigned char *input, int length, int chunk) {
+    unsigned char *encoded, *decoded;
+    int encoded_length, size, too_long = 0, ok;
+
+    encoded = malloc(RL_PACKBITS_BOUND(length));
+    encoded_length = encode_in_chunks(input, length, chunk, encoded,
+                                      &too_long);
+
+    size = rl_packbits_decode_size(encoded, encoded_length);
+    decoded = malloc(size + 1);
+    ok = !too_long && size == length &&
+         rl_packbits_decode_into(encoded, encoded_length, decoded) == size &&
+         memcmp(decoded, input, length) == 0;
+
+    free(decoded);
+    free(encoded);
+    return ok;
+}
+
+
+int main() {
+    unsigned char *input, actual[1000];
+    int len, r, i, length, actual_length, too_long, chunk;
+    int failures = 0;
+
+    for (i = 0; tests[i].decoded_str != NULL; i++) {
+        len = strlen((char *) tests[i].decoded_str);
+        length = len * tests[i].repeat;
+        input = malloc(length + 1);
+        for (r = 0; r < tests[i].repeat; r++)
+            memcpy(input + r * len, tests[i].decoded_str, len);
+
+        for (chunk = 1; chunk <= 1000; chunk *= 7) {
+            too_long = 0;
+            actual_length = encode_in_chunks(input, length, chunk, actual,
+                                             &too_long);
+            if (actual_length != tests[i].encoded_length ||
+                memcmp(actual, tests[i].encoded_str, actual_length) != 0) {
+                printf("Test case %d, chunks of %d:\tFAIL:  encoded data "
+                       "doesn't match\n", i, chunk);
+                failures++;
+            }
+        }
+
+        if (!round_trip(input, length, 1000)) {
+            printf("Test case %d:\tFAIL:  round trip\n", i);
+            failures++;
+        }
+        free(input);
+    }
+
+    /* Random data with runs of every length, in chunks of various sizes. */
+    length = 200000;
+    input = malloc(length);
+    srand(24);
+    for (i = 0; i < length; ) {
+        r = rand() % 4 == 0 ? rand() % 400 : 1;
+        len = rand() & 0xff;
+        while (r-- > 0 && i < length)
+            input[i++] = len;
+    }
+
+    for (chunk = 1; chunk <= length; chunk *= 3) {
+        if (!round_trip(input, length, chunk)) {
+            printf("Random data, chunks of %d:\tFAIL:  round trip\n", chunk);
+            failures++;
+        }
+    }
+    free(input);
+
+    /* A header promising more literals than remain decodes what is there. */
+    {
+        unsigned char cut[] = {9, 'x', 'y'};
+        if (rl_packbits_decode_size(cut, 3) != 2) {
+            printf("Truncated packet:\tFAIL\n");
+            failures++;
+        }
+    }
+
+    if (failures == 0)
+        printf("PackBits test PASS.\n");
+    else
+        printf("PackBits test FAIL:  %d failures.\n", failures);
+
+    return failures != 0;
+}
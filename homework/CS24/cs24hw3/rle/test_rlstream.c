@@ -0,0 +1,117 @@
+/*
+ * Tests for the streaming decoder.  Data is encoded with rl_encode() and
+ * with PackBits, then decoded again with rl_decoder_feed() using input
+ * pieces and output buffers of many small sizes, so that pairs, packets and
+ * runs are split at every possible point.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rl_encode.h"
+#include "rl_decode.h"
+#include "rl_packbits.h"
+
+
+/*!
+ * Decodes the encoded data feeding in_piece bytes at a time into an output
+ * buffer of cap bytes.  Returns 1 if the result matches expected.
+ */
+int stream_decode(rl_decoder *dec, const unsigned char *encoded,
+                  int encoded_length, int in_piece, int cap,
+                  const unsigned char *expected, int expected_length) {
+    unsigned char *decoded = malloc(expected_length + cap + 1);
+    unsigned char *out = malloc(cap);
+    int pos = 0, total = 0, n, left, written, ok;
+
+    while (pos < encoded_length) {
+        n = encoded_length - pos < in_piece ? encoded_length - pos : in_piece;
+        left = n;
+        do {
+            written = rl_decoder_feed(dec, encoded + pos, left, out, cap);
+            if (total + written <= expected_length + cap)
+                memcpy(decoded + total, out, written);
+            total += written;
+            pos += dec->consumed;
+            left -= dec->consumed;
+        } while (left > 0 || written == cap);
+    }
+
+    ok = total == expected_length && rl_decoder_done(dec) &&
+         memcmp(decoded, expected, expected_length) == 0;
+
+    free(out);
+    free(decoded);
+    return ok;
+}
+
+
+int main() {
+    unsigned char *input, *encoded;
+    rl_packbits_encoder pb;
+    rl_decoder dec;
+    int length = 20000, encoded_length, i, r, value, in_piece, cap;
+    int failures = 0;
+
+    /* Data with short and long runs, including runs over 255. */
+    input = malloc(length);
+    srand(24);
+    for (i = 0; i < length; ) {
+        r = rand() % 3 == 0 ? rand() % 700 : 1 + rand() % 3;
+        value = rand() & 0xff;
+        while (r-- > 0 && i < length)
+            input[i++] = value;
+    }
+
+    for (in_piece = 1; in_piece <= 5000; in_piece = in_piece * 3 + 1) {
+        for (cap = 1; cap <= 1000; cap = cap * 4 + 3) {
+            encoded = rl_encode(input, length, &encoded_length);
+            rl_decoder_init(&dec);
+            if (!stream_decode(&dec, encoded, encoded_length, in_piece, cap,
+                               input, length)) {
+                printf("Pairs, input pieces of %d, output of %d:\tFAIL\n",
+                       in_piece, cap);
+                failures++;
+            }
+            free(encoded);
+
+            encoded = malloc(RL_PACKBITS_BOUND(length));
+            rl_packbits_encoder_init(&pb);
+            encoded_length = rl_packbits_encode_chunk(&pb, input, length,
+                                                      encoded);
+            encoded_length += rl_packbits_encode_finish(
+                &pb, encoded + encoded_length);
+            rl_packbits_decoder_init(&dec);
+            if (!stream_decode(&dec, encoded, encoded_length, in_piece, cap,
+                               input, length)) {
+                printf("PackBits, input pieces of %d, output of %d:\tFAIL\n",
+                       in_piece, cap);
+                failures++;
+            }
+            free(encoded);
+        }
+    }
+
+    /* Input that stops between a count and its value isn't complete. */
+    {
+        unsigned char cut[] = {3, 'x', 2};
+        unsigned char out[10];
+
+        rl_decoder_init(&dec);
+        if (rl_decoder_feed(&dec, cut, 3, out, 10) != 3 ||
+            rl_decoder_done(&dec)) {
+            printf("Truncated pair:\tFAIL\n");
+            failures++;
+        }
+    }
+
+    free(input);
+
+    if (failures == 0)
+        printf("Streaming decoder test PASS.\n");
+    else
+        printf("Streaming decoder test FAIL:  %d failures.\n", failures);
+
+    return failures != 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * Throughput benchmark for computing the volumes and masses of many shapes.
+ * A random mix of boxes, spheres and cones is built both as an array of
+ * objects and as a ShapeBatch, and each way of computing the results is timed
+ * and reported in nanoseconds per shape:
+ *
+ *   virtual - one call through the class's getVolume() pointer per shape
+ *   grouped - Shape_getVolumes() / Shape_getMasses() on the mixed array
+ *   batch   - ShapeBatch_getVolumes() / ShapeBatch_getMasses()
+ *   sorted  - the virtual and grouped loops again, after the array has been
+ *             sorted by class once, so that neighbouring shapes share a class
+ *
+ * The virtual mass is density * getVolume(), i.e. the uncached computation.
+ * The cached row calls Shape_getMass() on shapes whose cached mass is already
+ * valid, and the grouped masses likewise come straight from the cache after
+ * the first run, so those two measure reading the cache.  The sorted+g row is
+ * the grouped functions on the sorted array.
+ *
+ * Usage:  bench_shapes [millions of shapes]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "shapes.h"
+#include "shape_batch.h"
+#include "shape_pool.h"
+
+
+/*! Each measurement is repeated until it has run for at least this long. */
+#define MIN_SECONDS 0.5
+
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/* The operations being timed, each over every shape. */
+
+static Shape_Data **shapes;
+static ShapeBatch batch;
+static float *results;
+static int num_shapes;
+
+void virtual_volumes(void) {
+    int i;
+    for (i = 0; i < num_shapes; i++)
+        results[i] = shapes[i]->class->getVolume(shapes[i]);
+}
+
+void virtual_masses(void) {
+    int i;
+    for (i = 0; i < num_shapes; i++) {
+        results[i] = shapes[i]->density *
+            shapes[i]->class->getVolume(shapes[i]);
+    }
+}
+
+void cached_masses(void) {
+    int i;
+    for (i = 0; i < num_shapes; i++)
+        results[i] = Shape_getMass(shapes[i]);
+}
+
+void grouped_volumes(void) {
+    Shape_getVolumes(shapes, num_shapes, results);
+}
+
+void grouped_masses(void) {
+    Shape_getMasses(shapes, num_shapes, results);
+}
+
+void batch_volumes(void) {
+    ShapeBatch_getVolumes(&batch, results);
+}
+
+void batch_masses(void) {
+    ShapeBatch_getMasses(&batch, results);
+}
+
+
+/*! Runs op repeatedly, and returns its cost in nanoseconds per shape. */
+double measure(void (*op)(void)) {
+    double start = now(), elapsed;
+    long runs = 0;
+
+    do {
+        op();
+        runs++;
+        elapsed = now() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    return elapsed * 1e9 / ((double) num_shapes * runs);
+}
+
+
+/*! qsort() comparison that orders shapes by their class pointer. */
+int compare_class(const void *a, const void *b) {
+    uintptr_t ca = (uintptr_t) (*(Shape_Data * const *) a)->class;
+    uintptr_t cb = (uintptr_t) (*(Shape_Data * const *) b)->class;
+    return (ca > cb) - (ca < cb);
+}
+
+
+/*! Returns a random dimension in the range [0.5, 10.5). */
+float random_size(void) {
+    return 0.5f + (rand() % 10000) / 1000.0f;
+}
+
+
+int main(int argc, char **argv) {
+    ShapePool pool;
+    float D;
+    int i, millions = argc > 1 ? atoi(argv[1]) : 4;
+
+    if (millions <= 0 || millions > 64) {
+        printf("usage:  %s [millions of shapes]\n", argv[0]);
+        return 1;
+    }
+
+    num_shapes = millions * 1000000;
+    shapes = malloc(num_shapes * sizeof(Shape_Data *));
+    results = malloc(num_shapes * sizeof(float));
+    if (shapes == NULL || results == NULL) {
+        printf("Couldn't allocate the arrays!\n");
+        return 2;
+    }
+
+    /* Build the same random sequence of shapes both ways. */
+    ShapePool_init(&pool);
+    ShapeBatch_init(&batch);
+    srand(24);
+    for (i = 0; i < num_shapes; i++) {
+        D = random_size();
+        switch (rand() % 3) {
+        case 0: {
+            float L = random_size(), W = random_size(), H = random_size();
+            shapes[i] = (Shape_Data *) ShapePool_newBox(&pool, L, W, H, D);
+            ShapeBatch_addBox(&batch, L, W, H, D);
+            break;
+        }
+        case 1: {
+            float R = random_size();
+            shapes[i] = (Shape_Data *) ShapePool_newSphere(&pool, R, D);
+            ShapeBatch_addSphere(&batch, R, D);
+            break;
+        }
+        default: {
+            float BR = random_size(), H = random_size();
+            shapes[i] = (Shape_Data *) ShapePool_newCone(&pool, BR, H, D);
+            ShapeBatch_addCone(&batch, BR, H, D);
+            break;
+        }
+        }
+
+        if (shapes[i] == NULL) {
+            printf("Couldn't allocate the shapes!\n");
+            return 2;
+        }
+    }
+
+    printf("%d mixed shapes\n", num_shapes);
+    printf("%-8s %14s %14s\n", "mode", "volume ns", "mass ns");
+    printf("%-8s %14.2f %14.2f\n", "virtual",
+           measure(virtual_volumes), measure(virtual_masses));
+    printf("%-8s %14s %14.2f\n", "cached", "-", measure(cached_masses));
+    printf("%-8s %14.2f %14.2f\n", "grouped",
+           measure(grouped_volumes), measure(grouped_masses));
+    printf("%-8s %14.2f %14.2f\n", "batch",
+           measure(batch_volumes), measure(batch_masses));
+
+    qsort(shapes, num_shapes, sizeof(Shape_Data *), compare_class);
+    printf("%-8s %14.2f %14.2f\n", "sorted",
+           measure(virtual_volumes), measure(virtual_masses));
+    printf("%-8s %14.2f %14.2f\n", "sorted+g",
+           measure(grouped_volumes), measure(grouped_masses));
+
+    ShapeBatch_uninit(&batch);
+    ShapePool_uninit(&pool);
+    free(results);
+    free(shapes);
+    return 0;
+}
@@ -0,0 +1,270 @@
+#include "shape_batch.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// approximate value for pi
+#define PI 3.14159265
+
+// the constant factors in the sphere and cone volume formulas, as floats so
+// that the batch loops stay entirely in single precision
+#define SPHERE_FACTOR ((float) (4.0 / 3.0 * PI))
+#define CONE_FACTOR   ((float) (1.0 / 3.0 * PI))
+
+// number of shapes a subclass array holds the first time it grows
+#define INITIAL_CAPACITY 16
+
+
+/*============================================================================
+ * Helper Functions
+ */
+
+
+/*!
+ * Grows a set of parallel arrays so that they can hold at least one more
+ * element.  The capacity is doubled each time.  Returns 1 on success, or 0 if
+ * any of the arrays could not be reallocated; in that case the capacity is
+ * left unchanged, and every array is still at least that large.
+ */
+static int grow_arrays(float **arrays[], int num_arrays, int *capacity) {
+    int new_capacity, i;
+    float *new_array;
+
+    new_capacity = *capacity * 2;
+    if (new_capacity == 0)
+        new_capacity = INITIAL_CAPACITY;
+
+    for (i = 0; i < num_arrays; i++) {
+        new_array = realloc(*arrays[i], new_capacity * sizeof(float));
+        if (new_array == NULL)
+            return 0;
+        *arrays[i] = new_array;
+    }
+
+    *capacity = new_capacity;
+    return 1;
+}
+
+
+/*============================================================================
+ * ShapeBatch
+ */
+
+
+/*! Initializes an empty shape batch. */
+void ShapeBatch_init(ShapeBatch *this) {
+    memset(this, 0, sizeof(ShapeBatch));
+}
+
+
+/*! Releases all memory held by a shape batch, leaving it empty. */
+void ShapeBatch_uninit(ShapeBatch *this) {
+    // free box arrays
+    free(this->boxes.density);
+    free(this->boxes.length);
+    free(this->boxes.width);
+    free(this->boxes.height);
+    // free sphere arrays
+    free(this->spheres.density);
+    free(this->spheres.radius);
+    // free cone arrays
+    free(this->cones.density);
+    free(this->cones.base_radius);
+    free(this->cones.height);
+
+    ShapeBatch_init(this);
+}
+
+
+/*! Returns the total number of shapes in the batch. */
+int ShapeBatch_size(ShapeBatch *this) {
+    return this->boxes.count + this->spheres.count + this->cones.count;
+}
+
+
+/*!
+ * Adds a box to the batch.  The arguments are checked just like Box_init()
+ * checks them.  Returns the index of the new box, or -1 if the batch could not
+ * grow to hold it.
+ */
+int ShapeBatch_addBox(ShapeBatch *this, float L, float W, float H, float D) {
+    BoxArray *a = &this->boxes;
+
+    // check values the same way the Box constructor does
+    assert(D >= 0);
+    assert(L >= 0 && W >= 0 && H >= 0);
+
+    if (a->count == a->capacity) {
+        float **arrays[] = { &a->density, &a->length, &a->width, &a->height };
+        if (!grow_arrays(arrays, 4, &a->capacity))
+            return -1;
+    }
+
+    a->density[a->count] = D;
+    a->length[a->count] = L;
+    a->width[a->count] = W;
+    a->height[a->count] = H;
+    return a->count++;
+}
+
+
+/*!
+ * Adds a sphere to the batch.  Returns the index of the new sphere, or -1 if
+ * the batch could not grow to hold it.
+ */
+int ShapeBatch_addSphere(ShapeBatch *this, float R, float D) {
+    SphereArray *a = &this->spheres;
+
+    // check values the same way the Sphere constructor does
+    assert(D >= 0);
+    assert(R >= 0);
+
+    if (a->count == a->capacity) {
+        float **arrays[] = { &a->density, &a->radius };
+        if (!grow_arrays(arrays, 2, &a->capacity))
+            return -1;
+    }
+
+    a->density[a->count] = D;
+    a->radius[a->count] = R;
+    return a->count++;
+}
+
+
+/*!
+ * Adds a cone to the batch.  Returns the index of the new cone, or -1 if the
+ * batch could not grow to hold it.
+ */
+int ShapeBatch_addCone(ShapeBatch *this, float BR, float H, float D) {
+    ConeArray *a = &this->cones;
+
+    // check values the same way the Cone constructor does
+    assert(D >= 0);
+    assert(BR >= 0 && H >= 0);
+
+    if (a->count == a->capacity) {
+        float **arrays[] = { &a->density, &a->base_radius, &a->height };
+        if (!grow_arrays(arrays, 3, &a->capacity))
+            return -1;
+    }
+
+    a->density[a->count] = D;
+    a->base_radius[a->count] = BR;
+    a->height[a->count] = H;
+    return a->count++;
+}
+
+
+/*
+ * The per-subclass kernels.  Each one is a single loop over restrict-qualified
+ * arrays, with the density either folded in or not, so the compiler can turn
+ * them into SIMD code.
+ */
+
+static void box_volumes(const BoxArray *a, float * restrict out) {
+    const float * restrict L = a->length;
+    const float * restrict W = a->width;
+    const float * restrict H = a->height;
+    int i;
+
+    for (i = 0; i < a->count; i++)
+        out[i] = L[i] * W[i] * H[i];
+}
+
+static void box_masses(const BoxArray *a, float * restrict out) {
+    const float * restrict D = a->density;
+    const float * restrict L = a->length;
+    const float * restrict W = a->width;
+    const float * restrict H = a->height;
+    int i;
+
+    for (i = 0; i < a->count; i++)
+        out[i] = D[i] * (L[i] * W[i] * H[i]);
+}
+
+static void sphere_volumes(const SphereArray *a, float * restrict out) {
+    const float * restrict R = a->radius;
+    int i;
+
+    for (i = 0; i < a->count; i++)
+        out[i] = SPHERE_FACTOR * R[i] * R[i] * R[i];
+}
+
+static void sphere_masses(const SphereArray *a, float * restrict out) {
+    const float * restrict D = a->density;
+    const float * restrict R = a->radius;
+    int i;
+
+    for (i = 0; i < a->count; i++)
+        out[i] = D[i] * (SPHERE_FACTOR * R[i] * R[i] * R[i]);
+}
+
+static void cone_volumes(const ConeArray *a, float * restrict out) {
+    const float * restrict BR = a->base_radius;
+    const float * restrict H = a->height;
+    int i;
+
+    for (i = 0; i < a->count; i++)
+        out[i] = CONE_FACTOR * BR[i] * BR[i] * H[i];
+}
+
+static void cone_masses(const ConeArray *a, float * restrict out) {
+    const float * restrict D = a->density;
+    const float * restrict BR = a->base_radius;
+    const float * restrict H = a->height;
+    int i;
+
+    for (i = 0; i < a->count; i++)
+        out[i] = D[i] * (CONE_FACTOR * BR[i] * BR[i] * H[i]);
+}
+
+
+/*!
+ * Computes the volume of every shape in the batch.  The output array must
+ * have room for ShapeBatch_size() values, laid out as described above.
+ */
+void ShapeBatch_getVolumes(ShapeBatch *this, float *volumes) {
+    box_volumes(&this->boxes, volumes);
+    volumes += this->boxes.count;
+    sphere_volumes(&this->spheres, volumes);
+    volumes += this->spheres.count;
+    cone_volumes(&this->cones, volumes);
+}
+
+
+/*!
+ * Computes the mass of every shape in the batch.  The output array must have
+ * room for ShapeBatch_size() values, laid out as described above.
+ */
+void ShapeBatch_getMasses(ShapeBatch *this, float *masses) {
+    box_masses(&this->boxes, masses);
+    masses += this->boxes.count;
+    sphere_masses(&this->spheres, masses);
+    masses += this->spheres.count;
+    cone_masses(&this->cones, masses);
+}
+
+
+/*! Returns the sum of the masses of all shapes in the batch. */
+float ShapeBatch_getTotalMass(ShapeBatch *this) {
+    const BoxArray *b = &this->boxes;
+    const SphereArray *s = &this->spheres;
+    const ConeArray *c = &this->cones;
+    float total = 0;
+    int i;
+
+    for (i = 0; i < b->count; i++)
+        total += b->density[i] * (b->length[i] * b->width[i] * b->height[i]);
+
+    for (i = 0; i < s->count; i++) {
+        total += s->density[i] *
+            (SPHERE_FACTOR * s->radius[i] * s->radius[i] * s->radius[i]);
+    }
+
+    for (i = 0; i < c->count; i++) {
+        total += c->density[i] *
+            (CONE_FACTOR * c->base_radius[i] * c->base_radius[i] * c->height[i]);
+    }
+
+    return total;
+}
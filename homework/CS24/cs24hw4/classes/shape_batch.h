@@ -0,0 +1,105 @@
+#ifndef SHAPE_BATCH_H
+#define SHAPE_BATCH_H
+
+
+/*============================================================================
+ * ShapeBatch
+ *
+ * A collection of shapes stored as a structure of arrays, rather than as an
+ * array of individually allocated objects.  Each subclass keeps its own data
+ * members in parallel arrays, so the volume and mass of every shape in the
+ * batch can be computed with one straight-line loop per subclass.  There is no
+ * class pointer and no virtual dispatch inside those loops, and the compiler
+ * is free to vectorize them.
+ *
+ * Shapes are identified by their index within their own subclass; e.g. the
+ * third box added to a batch is box 2, regardless of how many spheres and
+ * cones were added before it.  Whenever the batch reports per-shape results,
+ * they are laid out as all boxes first, then all spheres, then all cones, each
+ * group in the order the shapes were added.
+ */
+
+
+/*! Parallel arrays holding the data members of every box in a batch. */
+typedef struct BoxArray {
+    int count;                  /*!< Number of boxes stored. */
+    int capacity;               /*!< Number of boxes the arrays can hold. */
+
+    float *density;             /*!< The density of each box. */
+    float *length;              /*!< The length of each box. */
+    float *width;               /*!< The width of each box. */
+    float *height;              /*!< The height of each box. */
+} BoxArray;
+
+/*! Parallel arrays holding the data members of every sphere in a batch. */
+typedef struct SphereArray {
+    int count;                  /*!< Number of spheres stored. */
+    int capacity;               /*!< Number of spheres the arrays can hold. */
+
+    float *density;             /*!< The density of each sphere. */
+    float *radius;              /*!< The radius of each sphere. */
+} SphereArray;
+
+/*! Parallel arrays holding the data members of every cone in a batch. */
+typedef struct ConeArray {
+    int count;                  /*!< Number of cones stored. */
+    int capacity;               /*!< Number of cones the arrays can hold. */
+
+    float *density;             /*!< The density of each cone. */
+    float *base_radius;         /*!< The radius of each cone at its base. */
+    float *height;              /*!< The height of each cone. */
+} ConeArray;
+
+/*! A batch of boxes, spheres and cones, stored by subclass. */
+typedef struct ShapeBatch {
+    BoxArray boxes;             /*!< All boxes in the batch. */
+    SphereArray spheres;        /*!< All spheres in the batch. */
+    ConeArray cones;            /*!< All cones in the batch. */
+} ShapeBatch;
+
+
+/*! Initializes an empty shape batch. */
+void ShapeBatch_init(ShapeBatch *this);
+
+/*! Releases all memory held by a shape batch, leaving it empty. */
+void ShapeBatch_uninit(ShapeBatch *this);
+
+/*! Returns the total number of shapes in the batch. */
+int ShapeBatch_size(ShapeBatch *this);
+
+/*!
+ * Adds a box to the batch.  The arguments are checked just like Box_init()
+ * checks them.  Returns the index of the new box, or -1 if the batch could not
+ * grow to hold it.
+ */
+int ShapeBatch_addBox(ShapeBatch *this, float L, float W, float H, float D);
+
+/*!
+ * Adds a sphere to the batch.  Returns the index of the new sphere, or -1 if
+ * the batch could not grow to hold it.
+ */
+int ShapeBatch_addSphere(ShapeBatch *this, float R, float D);
+
+/*!
+ * Adds a cone to the batch.  Returns the index of the new cone, or -1 if the
+ * batch could not grow to hold it.
+ */
+int ShapeBatch_addCone(ShapeBatch *this, float BR, float H, float D);
+
+/*!
+ * Computes the volume of every shape in the batch.  The output array must
+ * have room for ShapeBatch_size() values, laid out as described above.
+ */
+void ShapeBatch_getVolumes(ShapeBatch *this, float *volumes);
+
+/*!
+ * Computes the mass of every shape in the batch.  The output array must have
+ * room for ShapeBatch_size() values, laid out as described above.
+ */
+void ShapeBatch_getMasses(ShapeBatch *this, float *masses);
+
+/*! Returns the sum of the masses of all shapes in the batch. */
+float ShapeBatch_getTotalMass(ShapeBatch *this);
+
+
+#endif /* SHAPE_BATCH_H */
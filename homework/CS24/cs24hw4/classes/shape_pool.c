@@ -0,0 +1,113 @@
+#include "shape_pool.h"
+#include <stddef.h>
+#include <stdlib.h>
+
+// bytes of shape storage in each block of the pool
+#define BLOCK_SIZE (64 * 1024)
+
+// shapes are placed on multiples of this; enough for a class pointer
+#define ALIGNMENT (sizeof(void *))
+
+
+/*! A block of memory that shapes are carved out of. */
+struct ShapePool_Block {
+    ShapePool_Block *next;      /*!< The next older block in the pool. */
+    size_t used;                /*!< Bytes of data[] handed out so far. */
+    void *data[];               /*!< The storage itself (pointer-aligned). */
+};
+
+
+/*============================================================================
+ * Helper Functions
+ */
+
+
+/*!
+ * Returns size bytes of pool memory, starting a new block if the newest one
+ * is full.  Returns NULL if a new block could not be allocated.
+ */
+static void * pool_alloc(ShapePool *this, size_t size) {
+    ShapePool_Block *block = this->blocks;
+    void *mem;
+
+    // round the size up so the next shape is aligned too
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+    if (block == NULL || block->used + size > BLOCK_SIZE) {
+        block = malloc(sizeof(ShapePool_Block) + BLOCK_SIZE);
+        if (block == NULL)
+            return NULL;
+
+        block->next = this->blocks;
+        block->used = 0;
+        this->blocks = block;
+    }
+
+    mem = (char *) block->data + block->used;
+    block->used += size;
+    this->count++;
+    return mem;
+}
+
+
+/*============================================================================
+ * ShapePool
+ */
+
+
+/*! Initializes an empty shape pool. */
+void ShapePool_init(ShapePool *this) {
+    this->blocks = NULL;
+    this->count = 0;
+}
+
+
+/*! Frees every shape allocated from the pool, leaving it empty. */
+void ShapePool_uninit(ShapePool *this) {
+    ShapePool_Block *block, *next;
+
+    // one free() per block, no matter how many shapes it held
+    for (block = this->blocks; block != NULL; block = next) {
+        next = block->next;
+        free(block);
+    }
+
+    ShapePool_init(this);
+}
+
+
+/*!
+ * Allocates a box from the pool and runs the Box constructor on it.  Returns
+ * NULL if the pool could not get more memory.
+ */
+Box_Data * ShapePool_newBox(ShapePool *this,
+    float L, float W, float H, float D) {
+    void *mem = pool_alloc(this, sizeof(Box_Data));
+    if (mem == NULL)
+        return NULL;
+    return place_Box(mem, L, W, H, D);
+}
+
+
+/*!
+ * Allocates a sphere from the pool and runs the Sphere constructor on it.
+ * Returns NULL if the pool could not get more memory.
+ */
+Sphere_Data * ShapePool_newSphere(ShapePool *this, float R, float D) {
+    void *mem = pool_alloc(this, sizeof(Sphere_Data));
+    if (mem == NULL)
+        return NULL;
+    return place_Sphere(mem, R, D);
+}
+
+
+/*!
+ * Allocates a cone from the pool and runs the Cone constructor on it.  Returns
+ * NULL if the pool could not get more memory.
+ */
+Cone_Data * ShapePool_newCone(ShapePool *this, float BR, float H, float D) {
+    void *mem = pool_alloc(this, sizeof(Cone_Data));
+    if (mem == NULL)
+        return NULL;
+    return place_Cone(mem, BR, H, D);
+}
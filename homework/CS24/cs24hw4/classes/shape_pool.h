@@ -0,0 +1,54 @@
+#ifndef SHAPE_POOL_H
+#define SHAPE_POOL_H
+
+#include "shapes.h"
+
+
+/*============================================================================
+ * ShapePool
+ *
+ * An arena that hands out memory for shape objects from large blocks, rather
+ * than making one malloc() call per shape.  Shapes allocated one after another
+ * sit next to each other in memory, which makes iterating over them cheaper,
+ * and the whole pool is released at once by ShapePool_uninit().  Individual
+ * shapes from a pool must never be passed to free().
+ */
+
+
+/* (the block type is private to shape_pool.c) */
+typedef struct ShapePool_Block ShapePool_Block;
+
+/*! A pool of shape objects. */
+typedef struct ShapePool {
+    ShapePool_Block *blocks;    /*!< Blocks allocated so far, newest first. */
+    int count;                  /*!< Number of shapes allocated. */
+} ShapePool;
+
+
+/*! Initializes an empty shape pool. */
+void ShapePool_init(ShapePool *this);
+
+/*! Frees every shape allocated from the pool, leaving it empty. */
+void ShapePool_uninit(ShapePool *this);
+
+/*!
+ * Allocates a box from the pool and runs the Box constructor on it.  Returns
+ * NULL if the pool could not get more memory.
+ */
+Box_Data * ShapePool_newBox(ShapePool *this,
+    float L, float W, float H, float D);
+
+/*!
+ * Allocates a sphere from the pool and runs the Sphere constructor on it.
+ * Returns NULL if the pool could not get more memory.
+ */
+Sphere_Data * ShapePool_newSphere(ShapePool *this, float R, float D);
+
+/*!
+ * Allocates a cone from the pool and runs the Cone constructor on it.  Returns
+ * NULL if the pool could not get more memory.
+ */
+Cone_Data * ShapePool_newCone(ShapePool *this, float BR, float H, float D);
+
+
+#endif /* SHAPE_POOL_H */
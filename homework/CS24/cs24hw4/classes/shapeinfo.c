@@ -2,6 +2,8 @@
 #include <stdlib.h>
 
 #include "shapes.h"
+#include "shape_batch.h"
+#include "shape_pool.h"
 
 
 /* This helper function prints some useful information about any Shape that is
@@ -23,23 +25,48 @@ int main() {
     Cone_Data *c;
     Box_Data *b;
     Sphere_Data *s;
-
-    /* Initialize the class information for all classes. */
-    static_init();
+    Shape_Data *mixed[3];
+    ShapePool pool;
+    ShapeBatch batch;
+    float masses[3];
 
     printf("\n");
 
-    c = new_Cone(1.5, 5, 0.5);
+    /* All three shapes come out of one pool, and are freed together. */
+    ShapePool_init(&pool);
+
+    c = ShapePool_newCone(&pool, 1.5, 5, 0.5);
     print_info("cone", (Shape_Data *) c);
-    free(c);
 
-    b = new_Box(5.3, 2.1, 7.7, 3);
+    b = ShapePool_newBox(&pool, 5.3, 2.1, 7.7, 3);
     print_info("box", (Shape_Data *) b);
-    free(b);
 
-    s = new_Sphere(0.3, 10);
+    s = ShapePool_newSphere(&pool, 0.3, 10);
     print_info("sphere", (Shape_Data *) s);
-    free(s);
+
+    /* The same shapes as a mixed array, dispatched once per class. */
+    mixed[0] = (Shape_Data *) c;
+    mixed[1] = (Shape_Data *) b;
+    mixed[2] = (Shape_Data *) s;
+    Shape_getMasses(mixed, 3, masses);
+    printf("Grouped masses:  cone %f\tbox %f\tsphere %f\n\n",
+           masses[0], masses[1], masses[2]);
+
+    ShapePool_uninit(&pool);
+
+    /* The same three shapes again, computed together as a batch.  Results
+     * come back as boxes, then spheres, then cones.
+     */
+    ShapeBatch_init(&batch);
+    ShapeBatch_addCone(&batch, 1.5, 5, 0.5);
+    ShapeBatch_addBox(&batch, 5.3, 2.1, 7.7, 3);
+    ShapeBatch_addSphere(&batch, 0.3, 10);
+
+    ShapeBatch_getMasses(&batch, masses);
+    printf("Batch masses:  box %f\tsphere %f\tcone %f\n",
+           masses[0], masses[1], masses[2]);
+    printf("Batch total mass:  %f\n\n", ShapeBatch_getTotalMass(&batch));
+    ShapeBatch_uninit(&batch);
 
     return 0;
 }
@@ -1,6 +1,7 @@
 #include "shapes.h"
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 // approximate value for pi
 #define PI 3.14159265
@@ -11,12 +12,17 @@
  *
  * These are the instances of class-information used by objects of the various
  * types.  Pass a pointer to these to the various object-init functions.
+ *
+ * They are const and initialized statically, so they live in read-only data,
+ * are ready before main() runs, and let the compiler resolve getVolume() calls
+ * on objects whose class it can see.  The initializers must agree with the
+ * corresponding *_class_init() functions below.  Shape itself is abstract,
+ * so no object ever refers to a Shape class instance, and none is defined.
  */
 
-static Shape_Class  Shape;
-static Box_Class    Box;
-static Sphere_Class Sphere;
-static Cone_Class   Cone;
+static const Box_Class    Box    = { Box_getVolume };
+static const Sphere_Class Sphere = { Sphere_getVolume };
+static const Cone_Class   Cone   = { Cone_getVolume };
 
 
 /*============================================================================
@@ -25,14 +31,13 @@ static Cone_Class   Cone;
 
 
 /*!
- * This function performs static initialization of all classes.  It must be
- * called before any of the classes can be used.
+ * The class information for Shape, Box, Sphere and Cone is constant data that
+ * is fully initialized at compile time, so nothing needs to run before the
+ * classes are used.  This function does nothing; it is kept so that existing
+ * callers still build.
  */
 void static_init() {
-    Shape_class_init(&Shape);
-    Box_class_init(&Box);
-    Sphere_class_init(&Sphere);
-    Cone_class_init(&Cone);
+    // nothing to do; see Global State above
 }
 
 
@@ -52,7 +57,7 @@ void Shape_class_init(Shape_Class *class) {
  * Object initialization (i.e. the constructor) for the Shape class.  This
  * function initializes the density of the shape, as well as the class info.
  */
-void Shape_init(Shape_Data *this, Shape_Class *class, float D) {
+void Shape_init(Shape_Data *this, const Shape_Class *class, float D) {
     // init class
     this->class = class;
     // set density
@@ -66,13 +71,28 @@ void Shape_setDensity(Shape_Data *this, float D) {
     assert(D >= 0);
     // set value
     this->density = D;
+    Shape_invalidate(this);
 }
 
 
-/*! Returns the mass of this shape, computed from the density and volume. */
+/*!
+ * Returns the mass of this shape, computed from the density and volume.  The
+ * result is cached until the shape is next modified.
+ */
 float Shape_getMass(Shape_Data *this) {
-    // calculate mass
-    return this->density * this->class->getVolume(this);
+    // calculate mass only if a setter has changed the shape since last time
+    if (this->mass == SHAPE_MASS_UNKNOWN)
+        this->mass = this->density * this->class->getVolume(this);
+    return this->mass;
+}
+
+
+/*!
+ * Discards the cached mass of the shape.  Subclass setters call this whenever
+ * they change a dimension of the shape.
+ */
+void Shape_invalidate(Shape_Data *this) {
+    this->mass = SHAPE_MASS_UNKNOWN;
 }
 
 
@@ -105,10 +125,10 @@ void Box_class_init(Box_Class *class) {
  * function first calls the Shape constructor to initialize the class info and
  * density, and then it initializes its data members with the specified values.
  */
-void Box_init(Box_Data *this, Box_Class *class,
+void Box_init(Box_Data *this, const Box_Class *class,
     float L, float W, float H, float D) {
     // init superclass
-    Shape_init((Shape_Data *) this, (Shape_Class *) class, D);
+    Shape_init((Shape_Data *) this, (const Shape_Class *) class, D);
     // init box
     Box_setSize(this, L, W, H);
 }
@@ -127,6 +147,20 @@ Box_Data * new_Box(float L, float W, float H, float D) {
 }
 
 
+/*!
+ * This function implements the operation corresponding to the C++ code
+ * "new (mem) Box(L, W, H, D)", initializing an object in memory provided by the
+ * caller.  The memory must be at least sizeof(Box_Data) bytes, and suitably
+ * aligned.  Returns mem.
+ */
+Box_Data * place_Box(void *mem, float L, float W, float H, float D) {
+    // init data in the caller's memory
+    Box_Data *data = mem;
+    Box_init(data, &Box, L, W, H, D);
+    return data;
+}
+
+
 /*!
  * Sets the dimensions of the box.  The arguments are asserted to be positive.
  */
@@ -137,6 +171,7 @@ void Box_setSize(Box_Data *this, float L, float W, float H) {
     this->length = L;
     this->width = W;
     this->height = H;
+    Shape_invalidate((Shape_Data *) this);
 }
 
 
@@ -167,9 +202,10 @@ void Sphere_class_init(Sphere_Class *class) {
  * function first calls the Shape constructor to initialize the class info and
  * density, and then it initializes its data members with the specified values.
  */
-void Sphere_init(Sphere_Data *this, Sphere_Class *class, float R, float D) {
+void Sphere_init(Sphere_Data *this, const Sphere_Class *class,
+    float R, float D) {
     // init superclass
-    Shape_init((Shape_Data *) this, (Shape_Class *) class, D);
+    Shape_init((Shape_Data *) this, (const Shape_Class *) class, D);
     // init sphere
     Sphere_setRadius(this, R);
 }
@@ -188,12 +224,27 @@ Sphere_Data * new_Sphere(float R, float D) {
 }
 
 
+/*!
+ * This function implements the operation corresponding to the C++ code
+ * "new (mem) Sphere(R, D)", initializing an object in memory provided by the
+ * caller.  The memory must be at least sizeof(Sphere_Data) bytes, and suitably
+ * aligned.  Returns mem.
+ */
+Sphere_Data * place_Sphere(void *mem, float R, float D) {
+    // init data in the caller's memory
+    Sphere_Data *data = mem;
+    Sphere_init(data, &Sphere, R, D);
+    return data;
+}
+
+
 /*! Sets the radius of the sphere.  The argument is asserted to be positive. */
 void Sphere_setRadius(Sphere_Data *this, float R) {
     // check radius gte 0
     assert(R >= 0);
     // set value
     this->radius = R;
+    Shape_invalidate((Shape_Data *) this);
 }
 
 
@@ -224,9 +275,10 @@ void Cone_class_init(Cone_Class *class) {
  * function first calls the Shape constructor to initialize the class info and
  * density, and then it initializes its data members with the specified values.
  */
-void Cone_init(Cone_Data *this, Cone_Class *class, float BR, float H, float D) {
+void Cone_init(Cone_Data *this, const Cone_Class *class,
+    float BR, float H, float D) {
     // init superclass
-    Shape_init((Shape_Data *) this, (Shape_Class *) class, D);
+    Shape_init((Shape_Data *) this, (const Shape_Class *) class, D);
     // init cone
     Cone_setBaseHeight(this, BR, H);
 }
@@ -245,6 +297,20 @@ Cone_Data * new_Cone(float BR, float H, float D) {
 }
 
 
+/*!
+ * This function implements the operation corresponding to the C++ code
+ * "new (mem) Cone(BR, H, D)", initializing an object in memory provided by the
+ * caller.  The memory must be at least sizeof(Cone_Data) bytes, and suitably
+ * aligned.  Returns mem.
+ */
+Cone_Data * place_Cone(void *mem, float BR, float H, float D) {
+    // init data in the caller's memory
+    Cone_Data *data = mem;
+    Cone_init(data, &Cone, BR, H, D);
+    return data;
+}
+
+
 /*!
  * Sets the dimensions of the cone.  The arguments are asserted to be positive.
  */
@@ -254,6 +320,7 @@ void Cone_setBaseHeight(Cone_Data *this, float BR, float H) {
     // set values
     this->base_radius = BR;
     this->height = H;
+    Shape_invalidate((Shape_Data *) this);
 }
 
 
@@ -266,3 +333,147 @@ float Cone_getVolume(Cone_Data *this) {
     return 1.0 / 3.0 * PI * this->base_radius * this->base_radius * this->height;
 }
 
+
+
+/*============================================================================
+ * Operations on arrays of shapes
+ */
+
+
+/* The classes shapes are grouped into; anything else is SHAPE_GROUP_OTHER. */
+#define SHAPE_GROUP_BOX    0
+#define SHAPE_GROUP_SPHERE 1
+#define SHAPE_GROUP_CONE   2
+#define SHAPE_GROUP_OTHER  3
+#define SHAPE_NUM_GROUPS   4
+
+// shapes are grouped this many at a time, so that each block of shapes is
+// still in the cache when the per-class loops run over it
+#define SHAPE_GROUP_BLOCK 256
+
+
+/*!
+ * Returns which group a shape belongs in, based on its class pointer.  This is
+ * written without branches, since the classes of consecutive shapes are
+ * usually unpredictable.
+ */
+static int shape_group(Shape_Data *s) {
+    const Shape_Class *c = s->class;
+    int is_box = c == (const Shape_Class *) &Box;
+    int is_sphere = c == (const Shape_Class *) &Sphere;
+    int is_cone = c == (const Shape_Class *) &Cone;
+
+    return is_sphere * SHAPE_GROUP_SPHERE + is_cone * SHAPE_GROUP_CONE +
+        !(is_box | is_sphere | is_cone) * SHAPE_GROUP_OTHER;
+}
+
+
+/*!
+ * Stores one result of shape_compute().  For masses, the result is also
+ * cached in the shape, exactly as Shape_getMass() would.
+ */
+static void store_result(Shape_Data *s, float v, float *out, int mass) {
+    if (mass) {
+        s->mass = s->density * v;
+        *out = s->mass;
+    }
+    else {
+        *out = v;
+    }
+}
+
+
+/*!
+ * Computes either the volumes or the masses of up to SHAPE_GROUP_BLOCK shapes.
+ * The indexes of the shapes are counting-sorted by group into order[], and
+ * then each group is processed by a loop that calls that class's getVolume()
+ * directly.
+ */
+static void shape_compute_block(Shape_Data **shapes, int n, float *out,
+    int mass) {
+    unsigned char group[SHAPE_GROUP_BLOCK];
+    int order[SHAPE_GROUP_BLOCK];
+    int start[SHAPE_NUM_GROUPS + 1], fill[SHAPE_NUM_GROUPS];
+    int i, g, idx;
+    float v;
+
+    assert(n <= SHAPE_GROUP_BLOCK);
+
+    // count the shapes in each group, and find where each group starts;
+    // shapes with an up-to-date cached mass don't need a group at all
+    memset(start, 0, sizeof(start));
+    for (i = 0; i < n; i++) {
+        if (mass && shapes[i]->mass != SHAPE_MASS_UNKNOWN) {
+            out[i] = shapes[i]->mass;
+            group[i] = SHAPE_NUM_GROUPS;
+        }
+        else {
+            group[i] = shape_group(shapes[i]);
+            start[group[i] + 1]++;
+        }
+    }
+    for (g = 0; g < SHAPE_NUM_GROUPS; g++)
+        start[g + 1] += start[g];
+
+    // distribute the shape indexes into their groups
+    memcpy(fill, start, sizeof(fill));
+    for (i = 0; i < n; i++) {
+        if (group[i] != SHAPE_NUM_GROUPS)
+            order[fill[group[i]]++] = i;
+    }
+
+    // boxes
+    for (i = start[SHAPE_GROUP_BOX]; i < start[SHAPE_GROUP_BOX + 1]; i++) {
+        idx = order[i];
+        v = Box_getVolume((Box_Data *) shapes[idx]);
+        store_result(shapes[idx], v, &out[idx], mass);
+    }
+
+    // spheres
+    for (i = start[SHAPE_GROUP_SPHERE]; i < start[SHAPE_GROUP_CONE]; i++) {
+        idx = order[i];
+        v = Sphere_getVolume((Sphere_Data *) shapes[idx]);
+        store_result(shapes[idx], v, &out[idx], mass);
+    }
+
+    // cones
+    for (i = start[SHAPE_GROUP_CONE]; i < start[SHAPE_GROUP_OTHER]; i++) {
+        idx = order[i];
+        v = Cone_getVolume((Cone_Data *) shapes[idx]);
+        store_result(shapes[idx], v, &out[idx], mass);
+    }
+
+    // anything else still needs its own class's implementation
+    for (i = start[SHAPE_GROUP_OTHER]; i < start[SHAPE_NUM_GROUPS]; i++) {
+        idx = order[i];
+        v = shapes[idx]->class->getVolume(shapes[idx]);
+        store_result(shapes[idx], v, &out[idx], mass);
+    }
+}
+
+
+/*!
+ * Computes either the volumes or the masses of an array of shapes, one block
+ * at a time.  Grouping the whole array at once would mean walking every shape
+ * once per group; a block's worth of shapes stays in the cache instead.
+ */
+static void shape_compute(Shape_Data **shapes, int n, float *out, int mass) {
+    int i, count;
+
+    for (i = 0; i < n; i += SHAPE_GROUP_BLOCK) {
+        count = n - i < SHAPE_GROUP_BLOCK ? n - i : SHAPE_GROUP_BLOCK;
+        shape_compute_block(shapes + i, count, out + i, mass);
+    }
+}
+
+
+/*! Computes the volume of each of the n shapes into volumes[]. */
+void Shape_getVolumes(Shape_Data **shapes, int n, float *volumes) {
+    shape_compute(shapes, n, volumes, 0);
+}
+
+
+/*! Computes the mass of each of the n shapes into masses[]. */
+void Shape_getMasses(Shape_Data **shapes, int n, float *masses) {
+    shape_compute(shapes, n, masses, 1);
+}
@@ -8,8 +8,10 @@
 
 
 /*!
- * This function performs static initialization of all classes.  It must be
- * called before any of the classes can be used.
+ * The class information for Shape, Box, Sphere and Cone is constant data that
+ * is fully initialized at compile time, so nothing needs to run before the
+ * classes are used.  This function does nothing; it is kept so that existing
+ * callers still build.
  */
 void static_init();
 
@@ -48,8 +50,17 @@ void static_init();
  *             return density * getVolume();
  *         }
  *     };
+ *
+ * Since shapes are read far more often than they are changed, the mass is
+ * cached in the object the first time it is computed.  Every setter that can
+ * change the mass (setDensity() here, and the size setters in the subclasses)
+ * invalidates the cache by setting it to SHAPE_MASS_UNKNOWN.  Subclasses must
+ * call the invalidation whenever their own data members change.
  */
 
+/*! Value of the cached mass when it needs to be recomputed. */
+#define SHAPE_MASS_UNKNOWN (-1.0f)
+
 /* (declare these typedefs first, since the structs reference each other) */
 typedef struct Shape_Class Shape_Class;
 typedef struct Shape_Data Shape_Data;
@@ -65,9 +76,10 @@ struct Shape_Class {
 
 /*! Shape object data-members, and reference to Shape class information. */
 struct Shape_Data {
-    Shape_Class *class;         /*!< Class information for the Shape class. */
+    const Shape_Class *class;   /*!< Class information for the Shape class. */
 
     float density;              /*!< The density of this shape object. */
+    float mass;                 /*!< Cached mass, or SHAPE_MASS_UNKNOWN. */
 };
 
 /*! Static initialization for the Shape class. */
@@ -77,14 +89,23 @@ void Shape_class_init(Shape_Class *class);
  * Object initialization (i.e. the constructor) for the Shape class.  This
  * function initializes the density of the shape, as well as the class info.
  */
-void Shape_init(Shape_Data *this, Shape_Class *class, float D);
+void Shape_init(Shape_Data *this, const Shape_Class *class, float D);
 
 /*! Sets the density of this shape.  The argument must be nonnegative! */
 void Shape_setDensity(Shape_Data *this, float D);
 
-/*! Returns the mass of this shape, computed from the density and volume. */
+/*!
+ * Returns the mass of this shape, computed from the density and volume.  The
+ * result is cached until the shape is next modified.
+ */
 float Shape_getMass(Shape_Data *this);
 
+/*!
+ * Discards the cached mass of the shape.  Subclass setters call this whenever
+ * they change a dimension of the shape.
+ */
+void Shape_invalidate(Shape_Data *this);
+
 /*
  * THERE IS NO Shape_getVolume() FUNCTION, because Shape doesn't provide an
  * implementation!  In the class initialization, set the function-pointer to
@@ -140,8 +161,9 @@ struct Box_Class {
 
 /*! Box object data-members, and reference to Shape class information. */
 struct Box_Data {
-    Box_Class *class;           /*!< Class information for the Box class. */
+    const Box_Class *class;     /*!< Class information for the Box class. */
     float density;              /*!< The density of this shape object. */
+    float mass;                 /*!< Cached mass, or SHAPE_MASS_UNKNOWN. */
 
     float length;               /*!< The length of the box. */
     float width;                /*!< The width of the box. */
@@ -156,7 +178,7 @@ void Box_class_init(Box_Class *class);
  * function first calls the Shape constructor to initialize the class info and
  * density, and then it initializes its data members with the specified values.
  */
-void Box_init(Box_Data *this, Box_Class *class,
+void Box_init(Box_Data *this, const Box_Class *class,
     float L, float W, float H, float D);
 
 /*!
@@ -165,6 +187,14 @@ void Box_init(Box_Data *this, Box_Class *class,
  */
 Box_Data * new_Box(float L, float W, float H, float D);
 
+/*!
+ * This function implements the operation corresponding to the C++ code
+ * "new (mem) Box(L, W, H, D)", initializing an object in memory provided by the
+ * caller.  The memory must be at least sizeof(Box_Data) bytes, and suitably
+ * aligned.  Returns mem.
+ */
+Box_Data * place_Box(void *mem, float L, float W, float H, float D);
+
 /*!
  * Sets the dimensions of the box.  The arguments are asserted to be positive.
  */
@@ -216,8 +246,9 @@ struct Sphere_Class {
 
 /*! Sphere object data-members, and reference to Shape class information. */
 struct Sphere_Data {
-    Sphere_Class *class;        /*!< Class information for the Sphere class. */
+    const Sphere_Class *class;  /*!< Class information for the Sphere class. */
     float density;              /*!< The density of this shape object. */
+    float mass;                 /*!< Cached mass, or SHAPE_MASS_UNKNOWN. */
 
     float radius;               /*!< The radius of the sphere. */
 };
@@ -230,7 +261,8 @@ void Sphere_class_init(Sphere_Class *class);
  * function first calls the Shape constructor to initialize the class info and
  * density, and then it initializes its data members with the specified values.
  */
-void Sphere_init(Sphere_Data *this, Sphere_Class *class, float R, float D);
+void Sphere_init(Sphere_Data *this, const Sphere_Class *class,
+    float R, float D);
 
 /*!
  * This function implements the operation corresponding to the C++ code
@@ -238,6 +270,14 @@ void Sphere_init(Sphere_Data *this, Sphere_Class *class, float R, float D);
  */
 Sphere_Data * new_Sphere(float R, float D);
 
+/*!
+ * This function implements the operation corresponding to the C++ code
+ * "new (mem) Sphere(R, D)", initializing an object in memory provided by the
+ * caller.  The memory must be at least sizeof(Sphere_Data) bytes, and suitably
+ * aligned.  Returns mem.
+ */
+Sphere_Data * place_Sphere(void *mem, float R, float D);
+
 /*! Sets the radius of the sphere.  The argument is asserted to be positive. */
 void Sphere_setRadius(Sphere_Data *this, float R);
 
@@ -290,8 +330,9 @@ struct Cone_Class {
 
 /*! Cone object data-members, and reference to Shape class information. */
 struct Cone_Data {
-    Cone_Class *class;          /*!< Class information for the Cone class. */
+    const Cone_Class *class;    /*!< Class information for the Cone class. */
     float density;              /*!< The density of this shape object. */
+    float mass;                 /*!< Cached mass, or SHAPE_MASS_UNKNOWN. */
 
     float base_radius;          /*!< The radius of the cone at its base. */
     float height;               /*!< The height of the cone. */
@@ -305,7 +346,8 @@ void Cone_class_init(Cone_Class *class);
  * function first calls the Shape constructor to initialize the class info and
  * density, and then it initializes its data members with the specified values.
  */
-void Cone_init(Cone_Data *this, Cone_Class *class, float BR, float H, float D);
+void Cone_init(Cone_Data *this, const Cone_Class *class,
+    float BR, float H, float D);
 
 /*!
  * This function implements the operation corresponding to the C++ code
@@ -313,6 +355,14 @@ void Cone_init(Cone_Data *this, Cone_Class *class, float BR, float H, float D);
  */
 Cone_Data * new_Cone(float BR, float H, float D);
 
+/*!
+ * This function implements the operation corresponding to the C++ code
+ * "new (mem) Cone(BR, H, D)", initializing an object in memory provided by the
+ * caller.  The memory must be at least sizeof(Cone_Data) bytes, and suitably
+ * aligned.  Returns mem.
+ */
+Cone_Data * place_Cone(void *mem, float BR, float H, float D);
+
 /*!
  * Sets the dimensions of the cone.  The arguments are asserted to be positive.
  */
@@ -325,5 +375,25 @@ void Cone_setBaseHeight(Cone_Data *this, float BR, float H);
 float Cone_getVolume(Cone_Data *this);
 
 
+/*============================================================================
+ * Operations on arrays of shapes
+ *
+ * These functions take an array of pointers to shapes of mixed types.  Rather
+ * than making one virtual call per shape, they sort each block of a few
+ * hundred shapes into groups by class, and then call each class's getVolume()
+ * implementation directly for every shape in its group.  Shapes whose class
+ * is not one of the classes defined above still go through their class's
+ * function pointer.  Results are written in the same order as the input
+ * array.  Shape_getMasses() uses and refreshes each shape's cached mass, just
+ * as Shape_getMass() does.
+ */
+
+/*! Computes the volume of each of the n shapes into volumes[]. */
+void Shape_getVolumes(Shape_Data **shapes, int n, float *volumes);
+
+/*! Computes the mass of each of the n shapes into masses[]. */
+void Shape_getMasses(Shape_Data **shapes, int n, float *masses);
+
+
 #endif /* SHAPES_H */
 
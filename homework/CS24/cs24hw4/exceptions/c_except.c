@@ -1,10 +1,10 @@
 #include "c_except.h"
 
 #include <assert.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
-
-#include "ptr_vector.h"
+#include <string.h>
 
 
 
@@ -33,34 +33,79 @@ const char *get_exception_name(ExceptionType exc_type) {
 
 
 
-static PtrStack env_stack = PTR_VECTOR_STATIC_INIT;
+__thread exception_frame *exception_top = NULL;
 
+__thread exception_payload exception_info;
 
 
 
-int start_try(jmp_buf *p_buf) {
-    assert(p_buf != NULL);
-    return ps_push_elem(&env_stack, p_buf);
-}
 
+/*! Jumps to the innermost handler with the payload as it stands. */
+static void unwind(void) {
+    exception_frame *frame = exception_top;
+    ExceptionType exc_type = exception_info.type;
+
+    if (frame == NULL) {
+        if (exception_info.message[0] != '\0') {
+            printf("Unhandled exception %s (%d): %s, aborting!!!\n",
+                   get_exception_name(exc_type), exc_type,
+                   exception_info.message);
+        }
+        else {
+            printf("Unhandled exception %s (%d), aborting!!!\n",
+                   get_exception_name(exc_type), exc_type);
+        }
+        abort();
+    }
 
-void finish_try() {
-    ps_pop_elem(&env_stack);
+    /* The handler is done with once it has been jumped to. */
+    exception_top = frame->prev;
+
+    longjmp(frame->env, exc_type);
 }
 
 
 void throw_exception(ExceptionType exc_type) {
-    jmp_buf *p_buf;
-    
-    if (env_stack.size == 0) {
-        printf("Unhandled exception %s (%d), aborting!!!\n",
-               get_exception_name(exc_type), exc_type);
-        abort();
-    }
+    exception_info.type = exc_type;
+    exception_info.message[0] = '\0';
+    exception_info.num_data = 0;
+    unwind();
+}
 
-    p_buf = (jmp_buf *) ps_pop_elem(&env_stack);
 
-    longjmp(*p_buf, exc_type);
+void throw_exception_msg(ExceptionType exc_type, const char *format, ...) {
+    va_list args;
+
+    exception_info.type = exc_type;
+    exception_info.num_data = 0;
+
+    /* Overly long messages are truncated to fit the buffer. */
+    va_start(args, format);
+    vsnprintf(exception_info.message, EXCEPTION_MESSAGE_SIZE, format, args);
+    va_end(args);
+
+    unwind();
+}
+
+
+void throw_exception_data(ExceptionType exc_type, int num_data,
+                          const long *data) {
+    assert(num_data >= 0 && num_data <= EXCEPTION_MAX_DATA);
+
+    exception_info.type = exc_type;
+    exception_info.message[0] = '\0';
+    exception_info.num_data = num_data;
+    memcpy(exception_info.data, data, num_data * sizeof(long));
+    unwind();
 }
 
 
+/*!
+ * Throws exc_type again, keeping the payload of the exception being handled.
+ * (If the handler caught another exception of its own in the meantime, the
+ * payload is that one's.)
+ */
+void rethrow_exception(ExceptionType exc_type) {
+    exception_info.type = exc_type;
+    unwind();
+}
@@ -28,22 +28,67 @@ typedef enum ExceptionType {
 } ExceptionType;
 
 
-int start_try(jmp_buf *p_buf);
-void finish_try();
+/*
+ * Each TRY block links an exception_frame on its own stack frame into the
+ * current thread's chain of handlers, so entering and leaving a TRY block
+ * that doesn't throw costs a couple of stores plus the setjmp(), without any
+ * function calls or allocation.  Since the chain is thread-local, threads can
+ * throw and catch independently.
+ */
+typedef struct exception_frame {
+  jmp_buf env;
+  struct exception_frame *prev;
+} exception_frame;
+
+/* Innermost TRY block of the current thread, or NULL outside of any. */
+extern __thread exception_frame *exception_top;
+
+
+/*
+ * Details of the exception being thrown, kept in a fixed-size thread-local
+ * area so that throwing never allocates.  THROW_MSG fills in the message and
+ * THROW_DATA the data words; CATCH code reads them through EXCEPTION_INFO.
+ * The payload stays valid until the thread throws another exception, and
+ * RETHROW passes it along unchanged.
+ */
+#define EXCEPTION_MESSAGE_SIZE 128
+#define EXCEPTION_MAX_DATA 4
+
+typedef struct exception_payload {
+  ExceptionType type;
+  char message[EXCEPTION_MESSAGE_SIZE];   /* "" if no message was given */
+  int num_data;
+  long data[EXCEPTION_MAX_DATA];
+} exception_payload;
+
+extern __thread exception_payload exception_info;
+
+#define EXCEPTION_INFO (&exception_info)
+
+
+const char *get_exception_name(ExceptionType exc_type);
+
 void throw_exception(ExceptionType exc_type);
+void throw_exception_msg(ExceptionType exc_type, const char *format, ...)
+  __attribute__((format(printf, 2, 3)));
+void throw_exception_data(ExceptionType exc_type, int num_data,
+                          const long *data);
+void rethrow_exception(ExceptionType exc_type);
 
 
 #define TRY(code) \
   { \
-    jmp_buf env; \
-    int exception = setjmp(env); \
+    exception_frame frame; \
+    int exception; \
+    frame.prev = exception_top; \
+    exception_top = &frame; \
+    exception = setjmp(frame.env); \
     /* printf("exception = %d\n", exception); */ \
     if (exception == NO_EXCEPTION) { \
-      start_try(&env); \
       { \
         code \
       } \
-      finish_try();
+      exception_top = frame.prev;
 
 #define CATCH(exc_type, code) \
     } \
@@ -59,7 +104,16 @@ void throw_exception(ExceptionType exc_type);
 
 #define THROW(exc_type) throw_exception(exc_type)
 
-#define RETHROW throw_exception(exception)
+/* THROW_MSG(type, format, ...) formats the message printf-style. */
+#define THROW_MSG(exc_type, ...) throw_exception_msg(exc_type, __VA_ARGS__)
+
+/* THROW_DATA(type, word, ...) carries up to EXCEPTION_MAX_DATA longs. */
+#define THROW_DATA(exc_type, ...) \
+  throw_exception_data(exc_type, \
+    sizeof((long[]) { __VA_ARGS__ }) / sizeof(long), \
+    (long[]) { __VA_ARGS__ })
+
+#define RETHROW rethrow_exception(exception)
 
 
 #endif /* C_EXCEPT */
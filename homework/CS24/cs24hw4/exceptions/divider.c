@@ -12,8 +12,10 @@ double read_double() {
 
     fgets(buf, sizeof(buf), stdin);
     val = strtod(buf, &end);
-    if (end == buf)
-        THROW(NUMBER_PARSE_ERROR);
+    if (end == buf) {
+        buf[strcspn(buf, "\n")] = '\0';
+        THROW_MSG(NUMBER_PARSE_ERROR, "\"%s\" is not a number", buf);
+    }
 
     return val;
 }
@@ -42,7 +44,8 @@ int main() {
         printf("The quotient of %lg / %lg is:  %lg\n", n1, n2, divide(n1, n2));
     )
     CATCH (NUMBER_PARSE_ERROR,
-        printf("Ack!!  I couldn't parse what you entered!\n");
+        printf("Ack!!  I couldn't parse what you entered:  %s\n",
+               EXCEPTION_INFO->message);
         RETHROW;
     )
     CATCH (DIVIDE_BY_ZERO,
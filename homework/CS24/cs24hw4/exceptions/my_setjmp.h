@@ -15,8 +15,15 @@
  * setjmp() and longjmp()!  Watch out stack, here we come!
  */
 
+#if defined(__x86_64__)
+/* rbx, rbp, r12-r15, rsp and the return address; see my_setjmp_x86_64.s */
+#define MY_JB_LEN 8
+typedef long my_jmp_buf[MY_JB_LEN];
+#else
+/* ebx, esi, edi, ebp, esp and the return address; see my_setjmp.s */
 #define MY_JB_LEN 6
 typedef int my_jmp_buf[MY_JB_LEN];
+#endif
 
 int my_setjmp(my_jmp_buf buf);
 void my_longjmp(my_jmp_buf buf, int ret);
@@ -1,80 +1,64 @@
 # my_setjmp:
 # puts information neccessary to reinstate execution state into memory address
-# provided as input. Saves ebx, esi, edi, esp, ebp, and caller's return address.
+# provided as input. Saves ebx, esi, edi, ebp, the caller's esp, and the
+# caller's return address; these are the only registers a function has to
+# preserve, so nothing else needs saving.  No stack frame is set up, so the
+# whole thing is a handful of moves.
 # args:
-#     8(%ebp): beginning of memory address for execution state to be saved at
+#     4(%esp): beginning of memory address for execution state to be saved at
 .globl my_setjmp
 
 
 # my_longjmp:
 # restores information saved by my_setjmp in order to reinstate execution state.
-# this includes: ebx, esi, edi, esp, ebp, and caller's return address.
+# this includes: ebx, esi, edi, ebp, esp, and caller's return address, which
+# is jumped to directly rather than written back onto the stack.
 # args:
-#     8(%ebp): beginning of memory address where execution state is saved.
-#     12(%ebp): return value.
+#     4(%esp): beginning of memory address where execution state is saved.
+#     8(%esp): return value.
 .globl my_longjmp
 
 
 my_setjmp:
-  # push old base pointer and make current stack new base
-  push  %ebp
-  mov   %esp, %ebp
+  # get arg (mem location where execution state should go) into register
+  mov   4(%esp), %eax
 
-  # move arg (mem location where execution state should go) into register
-  mov   8(%ebp), %eax
-
-  # put callee-saved registers in execution state memory (pos 1 - 3)
+  # put callee-saved registers in execution state memory (pos 1 - 4)
   mov   %ebx, 0(%eax)
   mov   %esi, 4(%eax)
   mov   %edi, 8(%eax)
-
-  # put base pointer and stack pointer in execution state memory (pos 4 - 5)
   mov   %ebp, 12(%eax)
-  mov   %esp, 16(%eax)
+
+  # put the stack pointer as it will be after we return at pos 5
+  lea   4(%esp), %ecx
+  mov   %ecx, 16(%eax)
 
   # put caller's return address at sixth position in execution state memory
-  # have to move return address to register in order to move to memory
-  mov   4(%ebp), %ecx
+  mov   (%esp), %ecx
   mov   %ecx, 20(%eax)
 
   # Set eax (return val) to 0
-  mov   $0, %eax
-
-  # pop local stack and old base pointer
-  mov   %ebp, %esp
-  pop   %ebp
+  xor   %eax, %eax
   ret
 
 
 my_longjmp:
-  # push old base pointer and make current stack new base
-  push  %ebp
-  mov   %esp, %ebp
-
-  # get address of memory block into register
-  mov   8(%ebp), %eax
-
-  # put callee-saved registers values back to the original registers
-  mov   0(%eax), %ebx
-  mov   4(%eax), %esi
-  mov   8(%eax), %edi
-
-  # put back base pointer and stack pointer
-  mov   12(%eax), %ebp
-  mov   16(%eax), %esp
-
-  # put caller's return address back
-  mov   20(%eax), %ecx
-  mov   %ecx, 4(%ebp)
+  # get address of memory block and the return value into registers
+  mov   4(%esp), %edx
+  mov   8(%esp), %eax
 
   # set eax (return val) to 1 (if arg is 0) or n (if arg is n)
-  # put 1 in ecx because cmove needs registers, cannot give it 1
-  mov   $1, %ecx
-  mov   12(%ebp), %eax
-  cmp   $0, %eax
-  cmove %ecx, %eax
+  test  %eax, %eax
+  jnz   1f
+  inc   %eax
+1:
 
-  # pop local stack and old base pointer
-  mov   %ebp, %esp
-  pop   %ebp
-  ret
+  # put callee-saved registers values back to the original registers
+  mov   0(%edx), %ebx
+  mov   4(%edx), %esi
+  mov   8(%edx), %edi
+  mov   12(%edx), %ebp
+
+  # put back the stack pointer, and return to where my_setjmp was called
+  mov   16(%edx), %esp
+  jmp   *20(%edx)
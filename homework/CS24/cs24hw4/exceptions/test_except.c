@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "c_except.h"
+
+#define NUM_THREADS 4
+#define ITERATIONS 100000
+
+// throws when x is a multiple of 3, from a couple of calls down
+// the payload carries x, so each catch can check it got its own thread's
+int check_value(int x) {
+    if (x % 3 == 0)
+        THROW_DATA(DIVIDE_BY_ZERO, x, -x);
+    if (x % 5 == 0)
+        THROW_MSG(NUMBER_PARSE_ERROR, "bad value %d", x);
+    return x;
+}
+
+// whether the caught payload is the one check_value(x) threw
+int payload_matches(int x) {
+    char expected[EXCEPTION_MESSAGE_SIZE];
+
+    if (EXCEPTION_INFO->type == DIVIDE_BY_ZERO) {
+        return EXCEPTION_INFO->num_data == 2 &&
+               EXCEPTION_INFO->data[0] == x && EXCEPTION_INFO->data[1] == -x &&
+               EXCEPTION_INFO->message[0] == '\0';
+    }
+
+    snprintf(expected, sizeof(expected), "bad value %d", x);
+    return EXCEPTION_INFO->type == NUMBER_PARSE_ERROR &&
+           EXCEPTION_INFO->num_data == 0 &&
+           strcmp(EXCEPTION_INFO->message, expected) == 0;
+}
+
+int call_down(int x) {
+    return check_value(x) + 1;
+}
+
+// each thread throws and catches in nested TRY blocks, counting what it
+// sees; with a shared handler chain the threads would jump into each other
+void * run_thread(void *arg) {
+    long *failures = arg;
+    // volatile, since they change between setjmp() and longjmp()
+    volatile int caught_outer = 0, caught_inner = 0, passed = 0;
+    volatile int bad_payloads = 0;
+    int i;
+
+    for (i = 0; i < ITERATIONS; i++) {
+        TRY (
+            TRY (
+                call_down(i);
+                passed++;
+            )
+            CATCH (DIVIDE_BY_ZERO,
+                caught_inner++;
+                bad_payloads += !payload_matches(i);
+            )
+            END_TRY;
+        )
+        CATCH (NUMBER_PARSE_ERROR,
+            caught_outer++;
+            bad_payloads += !payload_matches(i);
+        )
+        END_TRY;
+    }
+
+    // after all of that, no handler should be left linked
+    if (exception_top != NULL)
+        (*failures)++;
+
+    for (i = 0; i < ITERATIONS; i++) {
+        if (i % 3 == 0)
+            caught_inner--;
+        else if (i % 5 == 0)
+            caught_outer--;
+        else
+            passed--;
+    }
+
+    if (caught_inner != 0 || caught_outer != 0 || passed != 0 ||
+        bad_payloads != 0)
+        (*failures)++;
+
+    return NULL;
+}
+
+int main() {
+    pthread_t threads[NUM_THREADS];
+    long failures[NUM_THREADS] = {0};
+    long total = 0;
+    int i;
+
+    printf("Testing exceptions on %d threads.\n", NUM_THREADS);
+
+    for (i = 0; i < NUM_THREADS; i++)
+        pthread_create(&threads[i], NULL, run_thread, &failures[i]);
+    for (i = 0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        total += failures[i];
+    }
+
+    if (total == 0)
+        printf("exceptions are caught by the right thread: PASS\n");
+    else
+        printf("exceptions went astray in %ld threads: FAIL\n", total);
+
+    return total != 0;
+}
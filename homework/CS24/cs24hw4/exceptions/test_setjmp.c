@@ -1,6 +1,67 @@
 #include <stdio.h>
+#include <time.h>
+
+// The libc versions, for the benchmark, have to be used before
+// my_setjmp.h takes over the names.
+#include <setjmp.h>
+
+#define BENCH_ITERATIONS 10000000
+
+static double seconds_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// ns per call of the no-throw path, and per setjmp/longjmp round trip,
+// for the given way of saving and restoring; the macro body is pasted
+// in so that the setjmp is called from the loop itself
+#define BENCH(name, save, restore)                                    \
+static void bench_##name(void) {                                      \
+    volatile long i;                                                  \
+    double start, save_ns, jump_ns;                                   \
+                                                                      \
+    start = seconds_now();                                            \
+    for (i = 0; i < BENCH_ITERATIONS; i++) {                          \
+        if (save != 0)                                                \
+            printf("unexpected jump\n");                              \
+    }                                                                 \
+    save_ns = (seconds_now() - start) * 1e9 / BENCH_ITERATIONS;       \
+                                                                      \
+    i = 0;                                                            \
+    start = seconds_now();                                            \
+    save;                                                             \
+    if (++i < BENCH_ITERATIONS)                                       \
+        restore;                                                      \
+    jump_ns = (seconds_now() - start) * 1e9 / BENCH_ITERATIONS;       \
+                                                                      \
+    printf("  %-22s %6.2f ns setjmp, %6.2f ns setjmp+longjmp\n",      \
+           #name, save_ns, jump_ns);                                  \
+}
+
+static jmp_buf libc_buf;
+static sigjmp_buf libc_sigbuf;
+
+BENCH(setjmp, setjmp(libc_buf), longjmp(libc_buf, 1))
+BENCH(_setjmp, _setjmp(libc_buf), _longjmp(libc_buf, 1))
+BENCH(sigsetjmp_nomask, sigsetjmp(libc_sigbuf, 0), siglongjmp(libc_sigbuf, 1))
+BENCH(sigsetjmp_mask, sigsetjmp(libc_sigbuf, 1), siglongjmp(libc_sigbuf, 1))
+
 #include "my_setjmp.h"
 
+static jmp_buf my_buf;
+
+BENCH(my_setjmp, setjmp(my_buf), longjmp(my_buf, 1))
+
+void run_benchmarks() {
+    printf("Benchmarking (%d iterations each).\n", BENCH_ITERATIONS);
+    bench_my_setjmp();
+    bench_setjmp();
+    bench__setjmp();
+    bench_sigsetjmp_nomask();
+    bench_sigsetjmp_mask();
+}
+
 // declarations of all test and helper functions
 void f1(jmp_buf buf, int x);
 void f2(jmp_buf buf, int x);
@@ -164,5 +225,7 @@ int main() {
     test_local_variables();
     printf("Tests completed.\n");
 
+    run_benchmarks();
+
     return 0;
 }
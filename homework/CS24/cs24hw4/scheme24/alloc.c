@@ -1,9 +1,14 @@
 #include "alloc.h"
+#include "bytecode.h"
+#include "cacheprof.h"
+#include "pool.h"
+#include "profile.h"
 #include "ptr_vector.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 
 /*! Change to #define to output garbage-collector statistics. */
@@ -19,73 +24,256 @@
 #define ALWAYS_GC
 
 
+/*!
+ * Change to #define to perform major collections at the REPL's safe points by
+ * copying the live values, rather than by marking and sweeping.  See
+ * copy_live_values() below.
+ */
+#undef COPYING_GC
+
+
 /* Change to #define for other verbose output. */
 #undef VERBOSE
 
 
+/* Benchmark builds ("make bench") measure the collector as it normally runs. */
+#ifdef BENCHMARK
+#undef GC_STATS
+#undef ALWAYS_GC
+#endif
+
+
 void free_value(Value *v);
+static long payload_size(Value *v);
 void free_lambda(Lambda *f);
 void free_environment(Environment *env);
 
 void mark_value(Value *v);
 void mark_lambda(Lambda *f);
 void mark_environment(Environment *env);
+void drain_mark_stacks();
+void mark_value_references(Value *v);
+
+void sweep_young_values();
+void sweep_young_lambdas();
+void sweep_young_environments();
+void sweep_old_values();
+void sweep_old_lambdas();
+void sweep_old_environments();
+void sweep_some_old_values(int max_blocks);
+void finish_sweeping_old_values();
+
+long young_size();
+long old_size();
+static double now(void);
+
+
+/*
+ * The collector is generational.  Every object starts out in the young
+ * generation (the "nursery"), and any object that survives a collection is
+ * promoted to the old generation.  Most collections are minor collections,
+ * which only mark and sweep the young generation; objects in the old
+ * generation are assumed to be live, and are not traced.  A major collection
+ * marks and sweeps both generations, and only happens once the old generation
+ * has grown enough since the last one.
+ *
+ * A minor collection must still find every young object that an old object
+ * refers to.  Since all survivors are promoted, the only way an old object can
+ * refer to a young one is if it was modified after its promotion, and the only
+ * ways Scheme code can modify an existing object are set-car!/set-cdr! on a
+ * cons pair, storing into a vector or hash table, and define/set! on an
+ * environment's bindings.  Those paths call the write barriers below, which
+ * record the modified old object in the remembered set.  A minor collection
+ * then treats the remembered objects' references as additional roots.
+ */
+
+
+/*
+ * Value structs are far more numerous than lambdas and environments, so they
+ * aren't malloc()ed one at a time.  Instead they are carved out of blocks of
+ * VALUE_BLOCK_SLOTS slots:  the nursery is a list of blocks that alloc_value()
+ * fills from front to back by bumping the block's used count.  A minor
+ * collection looks at each nursery block in turn.  A block with no survivors
+ * is reclaimed in bulk and reused for the next nursery; a block with survivors
+ * is promoted in place, as a whole, to the old generation.  Its dead slots
+ * stay empty until a major collection finds the block completely empty and
+ * releases it.
+ *
+ * Within an old block, a slot holds a live value exactly when its old flag is
+ * set, so no separate free map is needed.
+ */
+
+/*! Number of Value slots in each block. */
+#define VALUE_BLOCK_SLOTS 128
+
+/*! A block of Value slots. */
+typedef struct ValueBlock {
+    /*! The next block on the same list. */
+    struct ValueBlock *next;
+
+    /*! Number of slots handed out so far; only grows while in the nursery. */
+    int used;
+
+    /*! Number of slots currently holding a value. */
+    int live;
+
+    /*! The slots themselves. */
+    Value slots[VALUE_BLOCK_SLOTS];
+} ValueBlock;
+
+
+/*! The nursery blocks, with the block currently being filled first. */
+static ValueBlock *young_blocks;
+
+/*! Blocks that have been promoted to the old generation. */
+static ValueBlock *old_blocks;
+
+/*! Empty blocks that are waiting to be reused by the nursery. */
+static ValueBlock *free_blocks;
+
+/*! Number of values allocated in each generation, for statistics. */
+static int num_young_values, num_old_values;
+
+/*! Number of blocks on the old_blocks list. */
+static int num_old_blocks;
+
+/*!
+ * Bytes that the values in each generation own outside their slots:  string
+ * contents, vector elements, and hash tables and string builders.  A large
+ * vector takes up a single slot, so without these its elements would never
+ * count toward a collection.  Each value's share is payload_size().
+ */
+static long young_payload, old_payload;
+
+/*!
+ * The payload bytes of the values that the current collection has marked.
+ * The old blocks are swept lazily, so right after a major collection this is
+ * the only measure of how much of old_payload is still live.
+ */
+static long marked_payload;
 
-void sweep_values();
-void sweep_lambdas();
-void sweep_environments();
 
 /*!
- * A growable vector of pointers to all Value structs that are currently
- * allocated.
+ * Growable vectors of pointers to all Lambda structs that are currently
+ * allocated, one for each generation.  Note that each Lambda struct will only
+ * have ONE Value struct that points to it.
  */
-static PtrVector allocated_values;
+static PtrVector young_lambdas, old_lambdas;
 
 
 /*!
- * A growable vector of pointers to all Lambda structs that are currently
- * allocated.  Note that each Lambda struct will only have ONE Value struct that
- * points to it.
+ * Growable vectors of pointers to all Environment structs that are currently
+ * allocated, one for each generation.
  */
-static PtrVector allocated_lambdas;
+static PtrVector young_environments, old_environments;
 
 
 /*!
- * A growable vector of pointers to all Environment structs that are currently
- * allocated.
+ * The pools that Lambda and Environment structs come from, so that they
+ * aren't malloc()ed one at a time either.  Unlike values they are freed one
+ * at a time, when they are swept, and go back on their pool's free list.
+ */
+static pool lambda_pool, environment_pool;
+
+
+/*!
+ * The remembered set:  old cons pairs and old environments that have been
+ * modified to refer to a young value since the last collection.
+ */
+static PtrVector remembered_values, remembered_environments;
+
+
+/*! Nonzero while a major collection is marking the whole heap. */
+static int major_collection;
+
+
+/*!
+ * Once the old generation is larger than this many bytes, the next collection
+ * is a major collection.  After each major collection this is reset so that
+ * the surviving heap makes up live_ratio of it, but never less than
+ * MIN_MAJOR_THRESHOLD.
+ */
+static long major_threshold;
+
+#define MIN_MAJOR_THRESHOLD 1048576
+
+
+/*!
+ * The fraction of the old generation that is expected to still be live when
+ * the next major collection starts.  The default of 0.5 lets the old
+ * generation double between major collections.  Smaller ratios collect less
+ * often and use more memory; larger ones do the opposite.  Scheme code can
+ * change this with gc-ratio.
+ */
+static float live_ratio = 0.5f;
+
+
+/*
+ * Statistics that print_alloc_stats() reports.  Pause times are in seconds,
+ * and reclaimed space is the total size of the objects that were freed.
  */
-static PtrVector allocated_environments;
+static int num_collections, num_major_collections;
+static double last_pause, total_pause, max_pause;
+static long last_reclaimed, total_reclaimed;
+
+/*! The largest the heap has been when a collection started, in bytes. */
+static long peak_heap;
+
+/*! When init_alloc() was called, so that the run time can be reported. */
+static double start_time;
 
 
 #ifndef ALWAYS_GC
 
-/*! Starts at 1MB, and is doubled every time we can't stay within it. */
-static long max_allocation_size = 1048576;
+/*! A minor collection is performed once the nursery grows past this size. */
+#define NURSERY_SIZE 262144
 
 #endif
 
+/*
+ * Objects that have been marked but whose references haven't been followed
+ * yet wait on these stacks, so that marking a long list or a deep chain of
+ * environments doesn't recurse once per object.  drain_mark_stacks() does the
+ * tracing.
+ */
+static PtrStack gray_values, gray_lambdas, gray_environments;
+
+/*
+ * The accesses that marking makes to each kind of object, and to the slots
+ * of vectors and hash tables, which are simulated on the cache hierarchy of
+ * the cache simulator for "make CACHEPROF=1".  The mark stacks and the
+ * sweeps aren't reported.
+ */
+CACHEPROF_DEFINE(value_region, "gc marking values");
+CACHEPROF_DEFINE(lambda_region, "gc marking lambdas");
+CACHEPROF_DEFINE(environment_region, "gc marking environments");
+CACHEPROF_DEFINE(binding_region, "gc marking bindings");
+CACHEPROF_DEFINE(element_region, "gc marking slots");
+
+
 /*
  * the next three functions mark the passed value, lambda, and environment, and
- * recursively calls other mark_xxxx functions as needed.
+ * queue it up to have its references traced.  During a minor collection, old
+ * objects are not traced at all.
  */
 void mark_value(Value *v) {
-    // if null or already marked do nothing
-    if (v == NULL) {
+    // if null, immediate or already marked do nothing
+    if (v == NULL || is_immediate(v)) {
         return;
     }
-    if (v->marked) {
+    CACHEPROF_READ(value_region, v, sizeof(Value));
+    if (v->marked || (v->old && !major_collection)) {
         return;
     }
 
     v->marked = 1;
+    CACHEPROF_WRITE(value_region, &v->marked, sizeof(v->marked));
+    marked_payload += payload_size(v);
 
-    // check type and mark appropriately
-    if (v->type == T_ConsPair) {
-        mark_value(v->cons_val.p_car);
-        mark_value(v->cons_val.p_cdr);
-    }
-    else if (v->type == T_Lambda) {
-        mark_lambda(v->lambda_val);
+    // only cons pairs, lambdas, vectors and hash tables refer to anything
+    if (v->type == T_ConsPair || v->type == T_Lambda ||
+        v->type == T_Vector || v->type == T_HashTable) {
+        ps_push_elem(&gray_values, v);
     }
 }
 
@@ -94,23 +282,14 @@ void mark_lambda(Lambda *f) {
     if (f == NULL) {
         return;
     }
-    if (f->marked) {
+    CACHEPROF_READ(lambda_region, f, sizeof(Lambda));
+    if (f->marked || (f->old && !major_collection)) {
         return;
     }
 
     f->marked = 1;
-
-    // if native mark body and arg_spec
-    if (!f->native_impl) {
-        mark_value(f->body);
-        mark_value(f->arg_spec);
-    }
-
-    // mark parent
-    if (f->parent_env != NULL) {
-        mark_environment(f->parent_env);
-    }
-
+    CACHEPROF_WRITE(lambda_region, &f->marked, sizeof(f->marked));
+    ps_push_elem(&gray_lambdas, f);
 }
 
 void mark_environment(Environment *env) {
@@ -118,82 +297,397 @@ void mark_environment(Environment *env) {
     if (env == NULL) {
         return;
     }
-    if (env->marked) {
+    CACHEPROF_READ(environment_region, env, sizeof(Environment));
+    if (env->marked || (env->old && !major_collection)) {
         return;
     }
 
     env->marked = 1;
+    CACHEPROF_WRITE(environment_region, &env->marked, sizeof(env->marked));
+    ps_push_elem(&gray_environments, env);
+}
+
+
+/*! Marks everything that a value refers to. */
+void mark_value_references(Value *v) {
+    HashTable *table;
+    int i;
+
+    CACHEPROF_READ(value_region, v, sizeof(Value));
+
+    // check type and mark appropriately
+    switch (v->type) {
+    case T_ConsPair:
+        mark_value(v->cons_val.p_car);
+        mark_value(v->cons_val.p_cdr);
+        break;
+
+    case T_Lambda:
+        mark_lambda(v->lambda_val);
+        break;
+
+    case T_Vector:
+        for (i = 0; i < v->vector_val.length; i++) {
+            CACHEPROF_READ(element_region, &v->vector_val.elems[i],
+                           sizeof(Value *));
+            mark_value(v->vector_val.elems[i]);
+        }
+        break;
+
+    case T_HashTable:
+        table = v->table_val;
+        CACHEPROF_READ(element_region, table, sizeof(HashTable));
+        for (i = 0; i < table->capacity; i++) {
+            CACHEPROF_READ(element_region, &table->keys[i], sizeof(Value *));
+            if (table->keys[i] != NULL) {
+                CACHEPROF_READ(element_region, &table->values[i],
+                               sizeof(Value *));
+                mark_value(table->keys[i]);
+                mark_value(table->values[i]);
+            }
+        }
+        break;
 
-    // mark parent and bindings
-    if (env->parent_env != NULL) {
-        mark_environment(env->parent_env);
+    default:
+        break;
     }
+}
+
 
+/*!
+ * Traces the references of everything on the mark stacks, marking what they
+ * refer to in turn, until the stacks are empty.
+ */
+void drain_mark_stacks() {
+    Value *v;
+    Lambda *f;
+    Environment *env;
     int i;
-    for (i = 0; i < env->num_bindings; i++) {
-        mark_value(env->bindings[i].value);
+
+    while (1) {
+        if (gray_values.size > 0) {
+            v = (Value *) ps_pop_elem(&gray_values);
+            mark_value_references(v);
+        }
+        else if (gray_lambdas.size > 0) {
+            f = (Lambda *) ps_pop_elem(&gray_lambdas);
+            CACHEPROF_READ(lambda_region, f, sizeof(Lambda));
+
+            // if interpreted mark body and arg_spec
+            if (!f->native_impl) {
+                mark_value(f->body);
+                mark_value(f->arg_spec);
+            }
+
+            // mark parent
+            mark_environment(f->parent_env);
+        }
+        else if (gray_environments.size > 0) {
+            env = (Environment *) ps_pop_elem(&gray_environments);
+            CACHEPROF_READ(environment_region, env, sizeof(Environment));
+
+            // mark parent and bindings
+            mark_environment(env->parent_env);
+            for (i = 0; i < env->num_bindings; i++) {
+                CACHEPROF_READ(binding_region, &env->bindings[i],
+                               sizeof(Binding));
+                mark_value(env->bindings[i].value);
+            }
+        }
+        else {
+            break;
+        }
+    }
+}
+
+
+/*!
+ * Records that an old cons pair, vector or hash table has been modified to
+ * refer to the value v.  If v is young, the modified value is added to the
+ * remembered set so that the next minor collection doesn't miss v.
+ * set_car(), set_cdr(), vector_set() and hash_table_set() call this.
+ */
+void write_barrier_value(Value *cons, Value *v) {
+    if (cons->old && v != NULL && !is_immediate(v) && !v->old &&
+        !cons->remembered) {
+        cons->remembered = 1;
+        pv_add_elem(&remembered_values, cons);
     }
 }
 
-// the next three functions sweep values, lambdas, environments for unmarked
-void sweep_values() {
+
+/*!
+ * Records that one of an old environment's bindings has been set to the value
+ * v.  If v is young, the environment is added to the remembered set so that
+ * the next minor collection doesn't miss v.  create_binding() and
+ * update_binding() call this.
+ */
+void write_barrier_environment(Environment *env, Value *v) {
+    if (env->old && v != NULL && !is_immediate(v) && !v->old &&
+        !env->remembered) {
+        env->remembered = 1;
+        pv_add_elem(&remembered_environments, env);
+    }
+}
+
+
+/*!
+ * Marks everything that the remembered set refers to.  Only used in minor
+ * collections; a major collection traces the old objects themselves.
+ */
+void mark_remembered_set() {
+    Environment *env;
+    int i, j;
+
+    for (i = 0; i < remembered_values.size; i++)
+        mark_value_references((Value *) pv_get_elem(&remembered_values, i));
+
+    for (i = 0; i < remembered_environments.size; i++) {
+        env = (Environment *) pv_get_elem(&remembered_environments, i);
+        CACHEPROF_READ(environment_region, env, sizeof(Environment));
+        for (j = 0; j < env->num_bindings; j++) {
+            CACHEPROF_READ(binding_region, &env->bindings[j],
+                           sizeof(Binding));
+            mark_value(env->bindings[j].value);
+        }
+    }
+}
+
+
+/*!
+ * Empties the remembered set.  This must happen before sweeping, since a major
+ * collection may free objects that are in the set.
+ */
+void clear_remembered_set() {
+    int i;
+
+    for (i = 0; i < remembered_values.size; i++)
+        ((Value *) pv_get_elem(&remembered_values, i))->remembered = 0;
+
+    for (i = 0; i < remembered_environments.size; i++)
+        ((Environment *) pv_get_elem(&remembered_environments, i))->remembered = 0;
+
+    pv_truncate(&remembered_values, 0);
+    pv_truncate(&remembered_environments, 0);
+}
+
+
+/*
+ * The next three functions sweep the young generation.  Unmarked objects are
+ * freed, and every marked object is promoted to the old generation.  The young
+ * vectors are empty afterward.
+ */
+void sweep_young_values() {
+    ValueBlock *block, *next;
     Value * val;
     int i;
-    for (i = 0; i < allocated_values.size; i++) {
-        val = (Value *) pv_get_elem(&allocated_values, i);
-        // if not null and marked then free and set position to null
-        if (val != NULL) {
+    for (block = young_blocks; block != NULL; block = next) {
+        next = block->next;
+        block->live = 0;
+        for (i = 0; i < block->used; i++) {
+            val = &block->slots[i];
             if (!val->marked) {
                 free_value(val);
-                pv_set_elem(&allocated_values, i, NULL);
             }
+            else {
+                // promote survivors to old generation, without moving them
+                val->marked = 0;
+                val->old = 1;
+                block->live++;
+            }
+        }
+
+        if (block->live == 0) {
+            // nothing survived, so the whole block can be reused at once
+            block->next = free_blocks;
+            free_blocks = block;
+        }
+        else {
+            block->next = old_blocks;
+            old_blocks = block;
+            num_old_blocks++;
+            num_old_values += block->live;
+        }
+    }
+    young_blocks = NULL;
+    num_young_values = 0;
+
+    // the dead values' payloads are gone, so the rest belong to survivors
+    old_payload += young_payload;
+    young_payload = 0;
+}
+
+void sweep_young_lambdas() {
+    Lambda * func;
+    int i;
+    for (i = 0; i < young_lambdas.size; i++) {
+        func = (Lambda *) pv_get_elem(&young_lambdas, i);
+        if (!func->marked) {
+            free_lambda(func);
+        }
+        else {
+            // promote survivors to old generation
+            func->marked = 0;
+            func->old = 1;
+            pv_add_elem(&old_lambdas, func);
+        }
+    }
+    pv_truncate(&young_lambdas, 0);
+}
+
+void sweep_young_environments() {
+    Environment * env;
+    int i;
+    for (i = 0; i < young_environments.size; i++) {
+        env = (Environment *) pv_get_elem(&young_environments, i);
+        if (!env->marked) {
+            free_environment(env);
+        }
+        else {
+            // promote survivors to old generation
+            env->marked = 0;
+            env->old = 1;
+            pv_add_elem(&old_environments, env);
+        }
+    }
+    pv_truncate(&young_environments, 0);
+}
+
+
+/*
+ * Old value blocks are swept lazily.  A major collection only moves the old
+ * blocks onto the unswept_blocks list, and then each new nursery block sweeps
+ * a few of them, so the cost of sweeping a large old generation is spread
+ * over the allocations that follow instead of adding to the pause.  Until a
+ * block is swept, its live values are still marked, and its dead values are
+ * still in place.  Neither matters to a minor collection, which doesn't look
+ * at old values, but every block must be swept before the next major
+ * collection starts marking.
+ */
+
+/*! Old blocks that the last major collection hasn't swept yet. */
+static ValueBlock *unswept_blocks;
+
+/*! Number of unswept blocks that each new nursery block sweeps. */
+#define LAZY_SWEEP_BLOCKS 4
+
+
+/*!
+ * Sweeps one old block, and then either returns it to old_blocks or, if it
+ * emptied out completely, releases it.
+ */
+static void sweep_old_block(ValueBlock *block) {
+    Value * val;
+    int i;
+    for (i = 0; i < block->used; i++) {
+        val = &block->slots[i];
+        if (!val->old)
+            continue;   // an empty slot
+
+        // if not marked then free and empty the slot
+        if (!val->marked) {
+            total_reclaimed += sizeof(Value) + payload_size(val);
+            free_value(val);
+            val->old = 0;
+            block->live--;
+            num_old_values--;
+        }
+        else {
             // reset marked flag
             val->marked = 0;
         }
     }
-    pv_compact(&allocated_values);
+
+    if (block->live == 0) {
+        // release blocks that have emptied out completely
+        num_old_blocks--;
+        free(block);
+    }
+    else {
+        block->next = old_blocks;
+        old_blocks = block;
+    }
 }
 
-void sweep_lambdas() {
+/*! Sweeps up to max_blocks of the unswept old blocks. */
+void sweep_some_old_values(int max_blocks) {
+    ValueBlock *block;
+
+    while (max_blocks-- > 0 && (block = unswept_blocks) != NULL) {
+        unswept_blocks = block->next;
+        sweep_old_block(block);
+    }
+}
+
+/*! Sweeps every old block that is still waiting to be swept. */
+void finish_sweeping_old_values() {
+    while (unswept_blocks != NULL)
+        sweep_some_old_values(LAZY_SWEEP_BLOCKS);
+}
+
+
+// the next three functions sweep the old generation, in major collections
+void sweep_old_values() {
+    // hand every old block over to the lazy sweeper
+    assert(unswept_blocks == NULL);
+    unswept_blocks = old_blocks;
+    old_blocks = NULL;
+}
+
+void sweep_old_lambdas() {
     Lambda * func;
     int i;
-    for (i = 0; i < allocated_lambdas.size; i++) {
-        func = (Lambda *) pv_get_elem(&allocated_lambdas, i);
-        // if not null and marked then free and set position to null
-        if (func != NULL) {
-            if (!func->marked) {
-                free_lambda(func);
-                pv_set_elem(&allocated_lambdas, i, NULL);
-            }
+    for (i = 0; i < old_lambdas.size; i++) {
+        func = (Lambda *) pv_get_elem(&old_lambdas, i);
+        // if not marked then free and set position to null
+        if (!func->marked) {
+            free_lambda(func);
+            pv_set_elem(&old_lambdas, i, NULL);
+        }
+        else {
             // reset marked flag
             func->marked = 0;
         }
     }
-    pv_compact(&allocated_lambdas);
+    pv_compact(&old_lambdas);
 }
 
-void sweep_environments() {
+void sweep_old_environments() {
     Environment * env;
     int i;
-    for (i = 0; i < allocated_environments.size; i++) {
-        env = (Environment *) pv_get_elem(&allocated_environments, i);
-        // if not null and marked then free and set position to null
-        if (env != NULL) {
-            if (!env->marked) {
-                free_environment(env);
-                pv_set_elem(&allocated_environments, i, NULL);
-            }
+    for (i = 0; i < old_environments.size; i++) {
+        env = (Environment *) pv_get_elem(&old_environments, i);
+        // if not marked then free and set position to null
+        if (!env->marked) {
+            free_environment(env);
+            pv_set_elem(&old_environments, i, NULL);
+        }
+        else {
             // reset marked flag
             env->marked = 0;
         }
     }
-    pv_compact(&allocated_environments);
+    pv_compact(&old_environments);
 }
 
 void init_alloc() {
-    pv_init(&allocated_values);
-    pv_init(&allocated_lambdas);
-    pv_init(&allocated_environments);
+    pv_init(&young_lambdas);
+    pv_init(&old_lambdas);
+    pv_init(&young_environments);
+    pv_init(&old_environments);
+
+    pv_init(&remembered_values);
+    pv_init(&remembered_environments);
+
+    pv_init(&gray_values);
+    pv_init(&gray_lambdas);
+    pv_init(&gray_environments);
+
+    pool_init(&lambda_pool, "lambdas", sizeof(Lambda));
+    pool_init(&environment_pool, "environments", sizeof(Environment));
+
+    major_threshold = MIN_MAJOR_THRESHOLD;
+    start_time = now();
 }
 
 
@@ -209,84 +703,246 @@ void print_alloc_stats(FILE *f) {
     fprintf(f, "\tAllocated values:  %u\n", allocated_values.size);
     */
 
-    fprintf(f, "%d vals \t%d lambdas \t%d envs\n", allocated_values.size,
-        allocated_lambdas.size, allocated_environments.size);
+    fprintf(f, "%d vals \t%d lambdas \t%d envs\n",
+        num_young_values + num_old_values,
+        young_lambdas.size + old_lambdas.size,
+        young_environments.size + old_environments.size);
+
+    fprintf(f, "%d collections (%d major), heap %ld bytes, "
+        "next major at %ld bytes\n", num_collections, num_major_collections,
+        young_size() + old_size(), major_threshold);
+
+    if (num_collections > 0) {
+        fprintf(f, "pause:  last %.3f ms \tmax %.3f ms \tmean %.3f ms\n",
+            last_pause * 1e3, max_pause * 1e3,
+            total_pause * 1e3 / num_collections);
+        fprintf(f, "reclaimed:  last %ld bytes \ttotal %ld bytes\n",
+            last_reclaimed, total_reclaimed);
+    }
+
+    fprintf(f, "time:  %.1f ms elapsed \t%.1f ms in GC \tpeak heap %ld bytes\n",
+        (now() - start_time) * 1e3, total_pause * 1e3, peak_heap);
+
+    pool_print_stats(f, &lambda_pool);
+    pool_print_stats(f, &environment_pool);
 }
 
 
 /*!
- * This helper function returns the amount of memory currently being used by
- * garbage-collected objects.  It is NOT the total amount of memory being used
- * by the interpreter!
+ * Returns the fraction of the old generation that may still be live when a
+ * major collection starts; see live_ratio.
  */
-long allocation_size() {
+float get_gc_live_ratio() {
+    return live_ratio;
+}
+
+/*! Changes live_ratio.  The ratio must be greater than 0 and at most 1. */
+void set_gc_live_ratio(float ratio) {
+    assert(ratio > 0 && ratio <= 1);
+    live_ratio = ratio;
+}
+
+
+/*! Returns the current time in seconds, for timing collections. */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/*!
+ * These helper functions return the amount of memory currently being used by
+ * garbage-collected objects in each generation.  They are NOT the total amount
+ * of memory being used by the interpreter!  Old values are counted by whole
+ * blocks, including the empty slots, since that is the memory they hold on to.
+ * Both include the payloads that the generation's values own.
+ */
+/*!
+ * Returns the total size of every allocated object.  Unlike old_size(), this
+ * doesn't count the empty slots in old blocks.
+ */
+static long object_bytes(void) {
+    return sizeof(Value) * (num_young_values + num_old_values) +
+        young_payload + old_payload +
+        sizeof(Lambda) * (young_lambdas.size + old_lambdas.size) +
+        sizeof(Environment) * (young_environments.size + old_environments.size);
+}
+
+
+long young_size() {
+    long size = 0;
+
+    size += sizeof(Value) * num_young_values;
+    size += young_payload;
+    size += sizeof(Lambda) * young_lambdas.size;
+    size += sizeof(Environment) * young_environments.size;
+
+    return size;
+}
+
+long old_size() {
     long size = 0;
 
-    size += sizeof(Value) * allocated_values.size;
-    size += sizeof(Lambda) * allocated_lambdas.size;
-    size += sizeof(Value) * allocated_environments.size;
+    size += sizeof(ValueBlock) * num_old_blocks;
+    size += old_payload;
+    size += sizeof(Lambda) * old_lambdas.size;
+    size += sizeof(Environment) * old_environments.size;
 
     return size;
 }
 
 
 /*!
- * This function heap-allocates a new Value struct, initializes it to be empty,
- * and then records the struct's pointer in the allocated_values vector.
+ * Returns an empty block, reusing one from free_blocks if there is one.
+ */
+static ValueBlock * take_empty_block(void) {
+    ValueBlock *block;
+
+    if (free_blocks != NULL) {
+        block = free_blocks;
+        free_blocks = block->next;
+    }
+    else {
+        block = malloc(sizeof(ValueBlock));
+        if (block == NULL) {
+            fprintf(stderr, "alloc_value: out of memory\n");
+            exit(1);
+        }
+    }
+
+    block->used = 0;
+    block->live = 0;
+    block->next = NULL;
+    return block;
+}
+
+
+/*!
+ * Starts a new nursery block, reusing an empty block if there is one.
+ */
+static void new_nursery_block(void) {
+    ValueBlock *block;
+
+    sweep_some_old_values(LAZY_SWEEP_BLOCKS);
+
+    block = take_empty_block();
+
+    block->next = young_blocks;
+    young_blocks = block;
+}
+
+
+/*!
+ * This function allocates a new Value struct from the nursery and initializes
+ * it to be empty.
  */
 Value * alloc_value(void) {
-    Value *v = malloc(sizeof(Value));
-    memset(v, 0, sizeof(Value));
+    Value *v;
+
+    if (young_blocks == NULL || young_blocks->used == VALUE_BLOCK_SLOTS)
+        new_nursery_block();
 
-    pv_add_elem(&allocated_values, v);
+    v = &young_blocks->slots[young_blocks->used++];
+    memset(v, 0, sizeof(Value));
+    num_young_values++;
 
     return v;
 }
 
 
 /*!
- * This function frees a heap-allocated Value struct.  Since a Value struct can
- * represent several different kinds of values, the function looks at the
+ * Returns the number of bytes that v owns outside its slot.  This must agree
+ * with what is passed to note_payload() as the payload is allocated and grows.
+ */
+static long payload_size(Value *v) {
+    if (v->type == T_String || v->type == T_Error) {
+        return v->string_val != NULL ? strlen(v->string_val) + 1 : 0;
+    }
+    else if (v->type == T_Vector) {
+        return (v->vector_val.length > 0 ? v->vector_val.length : 1) *
+            sizeof(Value *);
+    }
+    else if (v->type == T_HashTable) {
+        return sizeof(HashTable) +
+            2 * v->table_val->capacity * sizeof(Value *);
+    }
+    else if (v->type == T_StringBuilder) {
+        return sizeof(StringBuffer) + v->builder_val->capacity;
+    }
+    return 0;
+}
+
+
+/*!
+ * Records that bytes more memory has been malloc()ed for v's payload, or less
+ * if bytes is negative, so that it counts toward the size of v's generation.
+ */
+void note_payload(Value *v, long bytes) {
+    if (v->old)
+        old_payload += bytes;
+    else
+        young_payload += bytes;
+}
+
+
+/*!
+ * This function frees the memory owned by a Value struct.  Since a Value struct
+ * can represent several different kinds of values, the function looks at the
  * value's type tag to determine if additional memory needs to be freed for the
- * value.
- *
- * Note:  It is assumed that the value's pointer has already been removed from
- *        the allocated_values vector!  If this is not the case, serious errors
- *        will almost certainly occur.
+ * value.  The struct itself lives in a block slot, and is reclaimed along with
+ * its block.
  */
 void free_value(Value *v) {
     assert(v != NULL);
 
+    note_payload(v, -payload_size(v));
+
     /*
      * If value refers to a lambda, we don't free it here!  Lambdas are freed
      * by the free_lambda() function, and that is called when cleaning up
      * unreachable objects.
      */
 
-    if (v->type == T_String || v->type == T_Atom || v->type == T_Error)
+    /* Atom names are interned symbols, which are never freed. */
+    if (v->type == T_String || v->type == T_Error) {
         free(v->string_val);
-
-    free(v);
+    }
+    else if (v->type == T_Vector) {
+        free(v->vector_val.elems);
+    }
+    else if (v->type == T_HashTable) {
+        free(v->table_val->keys);
+        free(v->table_val->values);
+        free(v->table_val);
+    }
+    else if (v->type == T_StringBuilder) {
+        sb_uninit(v->builder_val);
+        free(v->builder_val);
+    }
 }
 
 /*!
- * This function heap-allocates a new Lambda struct, initializes it to be empty,
- * and then records the struct's pointer in the allocated_lambdas vector.
+ * This function allocates a new Lambda struct from its pool, initialized to be
+ * empty, and then records the struct's pointer in the young_lambdas vector.
  */
 Lambda * alloc_lambda(void) {
-    Lambda *f = malloc(sizeof(Lambda));
-    memset(f, 0, sizeof(Lambda));
+    Lambda *f = pool_alloc(&lambda_pool);
+    if (f == NULL) {
+        fprintf(stderr, "alloc_lambda: out of memory\n");
+        exit(1);
+    }
 
-    pv_add_elem(&allocated_lambdas, f);
+    pv_add_elem(&young_lambdas, f);
 
     return f;
 }
 
 /*!
- * This function frees a heap-allocated Lambda struct.
+ * This function frees a Lambda struct, returning it to its pool.
  *
  * Note:  It is assumed that the lambda's pointer has already been removed from
- *        the allocated_labmdas vector!  If this is not the case, serious errors
+ *        the young_lambdas or old_lambdas vector!  If this is not the case, serious errors
  *        will almost certainly occur.
  */
 void free_lambda(Lambda *f) {
@@ -294,84 +950,74 @@ void free_lambda(Lambda *f) {
 
     /* Lambdas typically reference lists of Value objects for the argument-spec
      * and the body, but we don't need to free these here because they are
-     * managed separately.
+     * managed separately.  The compiled body may be shared with other
+     * lambdas, so it is only released.
      */
+    if (f->code != NULL)
+        release_code(f->code);
 
-    free(f);
+    pool_release(&lambda_pool, f);
 }
 
 /*!
- * This function heap-allocates a new Environment struct, initializes it to be
- * empty, and then records the struct's pointer in the allocated_environments
+ * This function allocates a new Environment struct from its pool, initialized
+ * to be empty, and then records the struct's pointer in the young_environments
  * vector.
  */
 Environment * alloc_environment(void) {
-    Environment *env = malloc(sizeof(Environment));
-    memset(env, 0, sizeof(Environment));
+    Environment *env = pool_alloc(&environment_pool);
+    if (env == NULL) {
+        fprintf(stderr, "alloc_environment: out of memory\n");
+        exit(1);
+    }
 
-    pv_add_elem(&allocated_environments, env);
+    pv_add_elem(&young_environments, env);
 
     return env;
 }
 
 /*!
- * This function frees a heap-allocated Environment struct.  The environment's
- * bindings are also freed since they are owned by the environment, but the
- * binding-values are not freed since they are externally managed.
+ * This function frees an Environment struct, returning it to its pool.  The
+ * environment's bindings are also freed since they are owned by the
+ * environment, but the binding-values are not freed since they are externally
+ * managed.
  *
  * Note:  It is assumed that the environment's pointer has already been removed
- *        from the allocated_environments vector!  If this is not the case,
+ *        from the young_environments or old_environments vector!  If this is not the case,
  *        serious errors will almost certainly occur.
  */
 void free_environment(Environment *env) {
-    int i;
-
-    /* Free the bindings in the environment first. */
-    for (i = 0; i < env->num_bindings; i++) {
-        free(env->bindings[i].name);
-        /* Don't free the value, since those are handled separately. */
-    }
+    /* Free the bindings in the environment first.  The names are interned
+     * symbols, and the values are handled separately, so neither is freed.
+     */
     free(env->bindings);
+    free(env->index);
 
     /* Now free the environment object itself. */
-    free(env);
+    pool_release(&environment_pool, env);
 }
 
 
 /*!
- * This function performs the garbage collection for the Scheme interpreter.
- * It also contains code to track how many objects were collected on each run,
- * and also it can optionally be set to do GC when the total memory used grows
- * beyond a certain limit.
+ * Marks everything reachable from the global environment and from the
+ * evaluation stack.
  */
-void collect_garbage() {
+void mark_roots() {
     Environment *global_env;
     PtrStack *eval_stack;
-
-#ifdef GC_STATS
-    int vals_before, procs_before, envs_before;
-    int vals_after, procs_after, envs_after;
-
-    vals_before = allocated_values.size;
-    procs_before = allocated_lambdas.size;
-    envs_before = allocated_environments.size;
-#endif
-
-#ifndef ALWAYS_GC
-    /* Don't perform garbage collection if we still have room to grow. */
-    if (allocation_size() < max_allocation_size)
-        return;
-#endif
+    Value **vm_stack;
+    int vm_size;
+    EvaluationContext *ctx;
+    int i, j;
 
     global_env = get_global_environment();
     eval_stack = get_eval_stack();
+    vm_stack = get_vm_stack(&vm_size);
 
     // mark referenceable from global env
     mark_environment(global_env);
 
     // mark referenceable from eval stack
-    EvaluationContext *ctx;
-    int i, j;
     for (i = 0; i < eval_stack->size; i++) {
         ctx = (EvaluationContext *) pv_get_elem(eval_stack, i);
         if (ctx != NULL) {
@@ -388,27 +1034,420 @@ void collect_garbage() {
         }
     }
 
-    // sweep all
-    sweep_values();
-    sweep_lambdas();
-    sweep_environments();
+    // mark the bytecode VM's working values
+    for (i = 0; i < vm_size; i++)
+        mark_value(vm_stack[i]);
+}
+
+
+#ifdef COPYING_GC
+
+/*
+ * The copying collector.  Instead of marking the live values and then sweeping
+ * every block, a copying collection moves each reachable value into a fresh
+ * set of blocks ("to-space"), leaving a forwarding pointer behind in the old
+ * slot.  The new blocks are scanned in the order they were filled, Cheney
+ * style, copying whatever the values already moved refer to, until the scan
+ * catches up.  The work done is proportional to the number of live values,
+ * the survivors end up packed into as few blocks as possible, and the old
+ * blocks are released without being swept.
+ *
+ * Moving a value means updating every pointer to it, so this can only happen
+ * where the collector can see every pointer:  between top-level expressions
+ * in the REPL, when no C function is holding on to a value.  Those are the
+ * only places collect_garbage_at_safe_point() is called from.  A major
+ * collection that comes due anywhere else is put off until the next safe
+ * point, unless the old generation has grown to twice major_threshold first,
+ * in which case it is done by mark-and-sweep.
+ *
+ * Lambdas and environments are not moved; they are allocated one at a time
+ * from their pools, and C code holds on to environments across safe points.
+ * They are marked while the values are copied, and swept as in any major
+ * collection.
+ */
+
+/*!
+ * The marked field of a value that has been moved.  Its new location is kept
+ * in cons_val.p_car.  Values that have been copied into to-space are marked
+ * with 1 until the collection is over, as are the shared constants.
+ */
+#define FORWARDED 2
+
+/*! The to-space blocks, in the order they were filled. */
+static ValueBlock *to_space, *to_space_tail;
+
+/*! Nonzero while collect_garbage() is being called at a safe point. */
+static int at_safe_point;
+
+
+/*!
+ * Returns nonzero if a collection may move values right now:  the REPL is
+ * between expressions, and is not itself running inside an evaluation, as it
+ * is for eval-file.
+ */
+static int can_move_values(void) {
+    int vm_size;
+
+    get_vm_stack(&vm_size);
+    return at_safe_point && get_eval_stack()->size <= 1 && vm_size == 0;
+}
+
+
+/*! Copies the value v into to-space, and returns the copy. */
+static Value * copy_value(Value *v) {
+    Value *copy;
+
+    if (to_space_tail == NULL || to_space_tail->used == VALUE_BLOCK_SLOTS) {
+        ValueBlock *block = take_empty_block();
+        if (to_space_tail == NULL)
+            to_space = block;
+        else
+            to_space_tail->next = block;
+        to_space_tail = block;
+    }
+
+    copy = &to_space_tail->slots[to_space_tail->used++];
+    *copy = *v;
+    copy->marked = 1;
+    copy->remembered = 0;
+
+    v->marked = FORWARDED;
+    v->cons_val.p_car = copy;
+
+    return copy;
+}
+
+
+/*!
+ * Returns the current location of the value v, moving it first if this
+ * collection hasn't reached it yet.  Values that are already in to-space, the
+ * shared constants, and immediates are returned unchanged.
+ */
+static Value * forward_value(Value *v) {
+    if (v == NULL || is_immediate(v))
+        return v;
+    if (v->marked == FORWARDED)
+        return v->cons_val.p_car;
+    if (v->marked)
+        return v;
+    return copy_value(v);
+}
+
+
+static void forward_environment(Environment *env);
+static void forward_lambda(Lambda *f);
+
+
+/*! Forwards everything that a value in to-space refers to. */
+static void forward_value_references(Value *val) {
+    HashTable *table;
+    int i;
+
+    switch (val->type) {
+    case T_ConsPair:
+        val->cons_val.p_car = forward_value(val->cons_val.p_car);
+        val->cons_val.p_cdr = forward_value(val->cons_val.p_cdr);
+        break;
+
+    case T_Lambda:
+        forward_lambda(val->lambda_val);
+        break;
+
+    case T_Vector:
+        for (i = 0; i < val->vector_val.length; i++)
+            val->vector_val.elems[i] = forward_value(val->vector_val.elems[i]);
+        break;
+
+    case T_HashTable:
+        /* Keys that are hashed by address would need rehashing after they
+         * move, so every key is put back in its new place.
+         */
+        table = val->table_val;
+        for (i = 0; i < table->capacity; i++) {
+            if (table->keys[i] != NULL) {
+                table->keys[i] = forward_value(table->keys[i]);
+                table->values[i] = forward_value(table->values[i]);
+            }
+        }
+        rehash_table(val);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/*! Marks a lambda, and forwards the values it refers to. */
+static void forward_lambda(Lambda *f) {
+    if (f == NULL || f->marked)
+        return;
+
+    f->marked = 1;
+
+    if (!f->native_impl) {
+        f->arg_spec = forward_value(f->arg_spec);
+        f->body = forward_value(f->body);
+        forward_code_values(f->code, forward_value);
+    }
+
+    forward_environment(f->parent_env);
+}
+
+/*! Marks an environment, and forwards its bindings' values. */
+static void forward_environment(Environment *env) {
+    int i;
+
+    if (env == NULL || env->marked)
+        return;
+
+    env->marked = 1;
+
+    for (i = 0; i < env->num_bindings; i++)
+        env->bindings[i].value = forward_value(env->bindings[i].value);
+
+    forward_environment(env->parent_env);
+}
+
+
+/*!
+ * Moves every reachable value into to-space, and then releases the blocks they
+ * used to live in, which become the old generation.  Reachable lambdas and
+ * environments are left marked, ready to be swept.
+ */
+void copy_live_values() {
+    Environment *global_env;
+    PtrStack *eval_stack;
+    Value **vm_stack;
+    int vm_size;
+    EvaluationContext *ctx;
+    ValueBlock *block, *next;
+    Value *val;
+    int i, j;
+
+    global_env = get_global_environment();
+    eval_stack = get_eval_stack();
+    vm_stack = get_vm_stack(&vm_size);
+
+    to_space = to_space_tail = NULL;
+
+    // forward the roots
+    forward_environment(global_env);
+
+    for (i = 0; i < eval_stack->size; i++) {
+        ctx = (EvaluationContext *) pv_get_elem(eval_stack, i);
+        if (ctx != NULL) {
+            ctx->expression = forward_value(ctx->expression);
+            ctx->child_eval_result = forward_value(ctx->child_eval_result);
+            forward_environment(ctx->current_env);
+
+            for (j = 0; j < ctx->local_vals.size; j++) {
+                Value **ppv = (Value **) pv_get_elem(&ctx->local_vals, j);
+                if (ppv != NULL) {
+                    *ppv = forward_value(*ppv);
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < vm_size; i++)
+        vm_stack[i] = forward_value(vm_stack[i]);
+
+    // scan to-space until everything the copies refer to has been copied too;
+    // the loop sees blocks and slots that are added while it runs
+    for (block = to_space; block != NULL; block = block->next) {
+        for (i = 0; i < block->used; i++) {
+            val = &block->slots[i];
+            forward_value_references(val);
+        }
+    }
+
+    // release the from-space blocks; only values that weren't moved still
+    // own memory of their own
+    for (block = young_blocks; block != NULL; block = next) {
+        next = block->next;
+        for (i = 0; i < block->used; i++) {
+            if (block->slots[i].marked != FORWARDED)
+                free_value(&block->slots[i]);
+        }
+        block->next = free_blocks;
+        free_blocks = block;
+    }
+
+    for (block = old_blocks; block != NULL; block = next) {
+        next = block->next;
+        for (i = 0; i < block->used; i++) {
+            val = &block->slots[i];
+            if (val->old && val->marked != FORWARDED)
+                free_value(val);
+        }
+        free(block);
+    }
+
+    // to-space becomes the old generation
+    young_blocks = NULL;
+    num_young_values = 0;
+    old_blocks = to_space;
+    num_old_blocks = 0;
+    num_old_values = 0;
+    young_payload = 0;
+    old_payload = 0;
+
+    for (block = to_space; block != NULL; block = block->next) {
+        for (i = 0; i < block->used; i++) {
+            block->slots[i].marked = 0;
+            block->slots[i].old = 1;
+            old_payload += payload_size(&block->slots[i]);
+        }
+        block->live = block->used;
+        num_old_blocks++;
+        num_old_values += block->live;
+    }
+}
+
+
+/*!
+ * Performs a collection at one of the REPL's safe points, where a major
+ * collection may move values.  Without COPYING_GC this is the same as
+ * collect_garbage().
+ */
+void collect_garbage_at_safe_point() {
+    at_safe_point = 1;
+    collect_garbage();
+    at_safe_point = 0;
+}
+
+#else /* !COPYING_GC */
+
+void collect_garbage_at_safe_point() {
+    collect_garbage();
+}
+
+#endif /* COPYING_GC */
+
+
+/*!
+ * This function performs the garbage collection for the Scheme interpreter.
+ * It also contains code to track how many objects were collected on each run,
+ * and also it can optionally be set to do GC only when the nursery has grown
+ * beyond a certain limit.
+ *
+ * Each call performs a minor collection, unless the old generation has grown
+ * past major_threshold, in which case a major collection is performed.
+ */
+void collect_garbage() {
+    int copying = 0;
+    long size_before, live_size;
+    double start;
+
+#ifdef GC_STATS
+    int vals_before, procs_before, envs_before;
+    int vals_after, procs_after, envs_after;
+
+    vals_before = num_young_values + num_old_values;
+    procs_before = young_lambdas.size + old_lambdas.size;
+    envs_before = young_environments.size + old_environments.size;
+#endif
+
+    major_collection = (old_size() >= major_threshold);
+
+#ifdef COPYING_GC
+    /* Major collections copy at safe points, and wait for one otherwise. */
+    if (can_move_values())
+        copying = major_collection;
+    else
+        major_collection = (old_size() >= 2 * major_threshold);
+#endif
 
 #ifndef ALWAYS_GC
-    /* If we are still above the maximum allocation size, increase it. */
-    if (allocation_size() > max_allocation_size) {
-        max_allocation_size *= 2;
+    /* Don't perform garbage collection if the nursery still has room. */
+    if (young_size() < NURSERY_SIZE && !copying)
+        return;
+#endif
+
+    start = now();
+    if (profiling)
+        profile_gc_start();
+
+    if (young_size() + old_size() > peak_heap)
+        peak_heap = young_size() + old_size();
+
+    /* The last major collection's sweep must be finished before marking the
+     * old generation again.
+     */
+    if (major_collection)
+        finish_sweeping_old_values();
+
+    size_before = object_bytes();
+    marked_payload = 0;
 
-        printf("Increasing maximum allocation size to %ld bytes.\n",
-            max_allocation_size);
+    /* Every survivor is promoted below, so afterward no old object can refer
+     * to a young one, and the remembered set can start over.
+     */
+    if (copying) {
+        clear_remembered_set();
+#ifdef COPYING_GC
+        copy_live_values();
+#endif
     }
+    else {
+        mark_roots();
+        if (!major_collection)
+            mark_remembered_set();
+        drain_mark_stacks();
+        clear_remembered_set();
+    }
+
+    if (major_collection) {
+        if (!copying)
+            sweep_old_values();
+        sweep_old_lambdas();
+        sweep_old_environments();
+    }
+
+    if (!copying)
+        sweep_young_values();
+    sweep_young_lambdas();
+    sweep_young_environments();
+
+    if (major_collection) {
+        /* Let the old generation grow until the data that is live now makes
+         * up only live_ratio of it.  The dead values' payloads are still
+         * counted in old_payload until their blocks are swept, so a marking
+         * collection counts only the payloads it marked.
+         */
+        live_size = old_size();
+        if (!copying)
+            live_size += marked_payload - old_payload;
+
+        major_threshold = (long) (live_size / live_ratio);
+        if (major_threshold < MIN_MAJOR_THRESHOLD)
+            major_threshold = MIN_MAJOR_THRESHOLD;
+
+#ifndef ALWAYS_GC
+        printf("Next major collection at %ld bytes.\n", major_threshold);
 #endif
+    }
+
+    if (profiling)
+        profile_gc_end();
+
+    last_pause = now() - start;
+    last_reclaimed = size_before - object_bytes();
+    total_pause += last_pause;
+    total_reclaimed += last_reclaimed;
+    if (last_pause > max_pause)
+        max_pause = last_pause;
+    num_collections++;
+    if (major_collection)
+        num_major_collections++;
 
 #ifdef GC_STATS
-    vals_after = allocated_values.size;
-    procs_after = allocated_lambdas.size;
-    envs_after = allocated_environments.size;
+    vals_after = num_young_values + num_old_values;
+    procs_after = young_lambdas.size + old_lambdas.size;
+    envs_after = young_environments.size + old_environments.size;
 
-    printf("GC Results:\n");
+    printf("GC Results (%s):\n",
+           copying ? "copying" : major_collection ? "major" : "minor");
     printf("\tBefore: \t%d vals \t%d lambdas \t%d envs\n",
             vals_before, procs_before, envs_before);
     printf("\tAfter:  \t%d vals \t%d lambdas \t%d envs\n",
@@ -416,6 +1455,9 @@ void collect_garbage() {
     printf("\tChange: \t%d vals \t%d lambdas \t%d envs\n",
             vals_after - vals_before, procs_after - procs_before,
             envs_after - envs_before);
+    printf("\tPause:  \t%.3f ms \t%ld bytes reclaimed\n",
+            last_pause * 1e3, last_reclaimed);
 #endif
-}
 
+    major_collection = 0;
+}
@@ -10,10 +10,17 @@ void init_alloc(void);
 Value * alloc_value(void);
 Lambda * alloc_lambda(void);
 Environment * alloc_environment(void);
+void note_payload(Value *v, long bytes);
+
+void write_barrier_value(Value *cons, Value *v);
+void write_barrier_environment(Environment *env, Value *v);
 
 void collect_garbage(void);
+void collect_garbage_at_safe_point(void);
 
 void print_alloc_stats(FILE *f);
+float get_gc_live_ratio(void);
+void set_gc_live_ratio(float ratio);
 
 
 #endif /* ALLOC_H */
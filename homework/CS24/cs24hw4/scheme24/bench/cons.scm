@@ -0,0 +1,20 @@
+;; List-heavy consing:  builds, reverses and sums long lists, so that most of
+;; the time goes to allocation and garbage collection.
+
+(define (make-list-of n)
+  (define (helper i acc)
+    (if (= i 0) acc (helper (- i 1) (cons i acc))))
+  (helper n nil))
+
+(define (sum-list lst acc)
+  (if (null? lst) acc (sum-list (cdr lst) (+ acc (car lst)))))
+
+(define (churn rounds total)
+  (if (= rounds 0)
+      total
+      (churn (- rounds 1)
+             (+ total (sum-list (reverse (make-list-of 10000)) 0)))))
+
+(churn 50 0)
+
+(gc-stats)
@@ -0,0 +1,14 @@
+;; Deep recursion:  non-tail recursion thousands of calls deep, which keeps
+;; long chains of evaluation contexts and environments alive.
+
+(define (count-down n)
+  (if (= n 0) 0 (+ 1 (count-down (- n 1)))))
+
+(define (repeat rounds total)
+  (if (= rounds 0)
+      total
+      (repeat (- rounds 1) (+ total (count-down 5000)))))
+
+(repeat 40 0)
+
+(gc-stats)
@@ -0,0 +1,10 @@
+;; Doubly-recursive Fibonacci:  procedure calls and fixnum arithmetic.
+
+(define (fib n)
+  (if (< n 2)
+      n
+      (+ (fib (- n 1)) (fib (- n 2)))))
+
+(fib 25)
+
+(gc-stats)
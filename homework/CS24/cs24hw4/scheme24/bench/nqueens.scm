@@ -0,0 +1,28 @@
+;; Counts the solutions to the 8-queens problem:  list building, closures,
+;; and recursion with backtracking.
+
+(define (ok? row dist placed)
+  (if (null? placed)
+      #t
+      (and (not (= (car placed) (+ row dist)))
+           (not (= (car placed) (- row dist)))
+           (ok? row (+ dist 1) (cdr placed)))))
+
+(define (try-it x y z)
+  (if (null? x)
+      (if (null? y) 1 0)
+      (+ (if (ok? (car x) 1 z)
+             (try-it (append (cdr x) y) nil (cons (car x) z))
+             0)
+         (try-it (cdr x) (cons (car x) y) z))))
+
+(define (iota1 n)
+  (define (helper i acc)
+    (if (= i 0) acc (helper (- i 1) (cons i acc))))
+  (helper n nil))
+
+(define (queens n) (try-it (iota1 n) nil nil))
+
+(queens 8)
+
+(gc-stats)
@@ -0,0 +1,37 @@
+;; String building:  appends the numbers 1 .. n onto a growing string, first
+;; with string-append, which copies the string so far every time, and then
+;; with a string builder.
+
+(define (build i n acc)
+  (if (> i n)
+      acc
+      (build (+ i 1) n (string-append acc (number->string i) " "))))
+
+(define (build-with sb i n)
+  (if (> i n)
+      (string-builder->string sb)
+      (begin
+        (string-builder-append! sb i " ")
+        (build-with sb (+ i 1) n))))
+
+(define (string-rounds rounds)
+  (if (= rounds 0)
+      #t
+      (begin
+        (build 1 1000 "")
+        (string-rounds (- rounds 1)))))
+
+(define (builder-rounds rounds)
+  (if (= rounds 0)
+      #t
+      (begin
+        (build-with (make-string-builder) 1 1000)
+        (builder-rounds (- rounds 1)))))
+
+(string-rounds 20)
+
+(builder-rounds 20)
+
+(equal? (build 1 1000 "") (build-with (make-string-builder) 1 1000))
+
+(gc-stats)
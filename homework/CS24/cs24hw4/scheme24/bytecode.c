@@ -0,0 +1,776 @@
+/*! \file
+ * This file implements a bytecode compiler and virtual machine for the bodies
+ * of interpreted lambdas.  The first time a lambda is applied, its body is
+ * compiled into a linear sequence of instructions, which the VM then runs
+ * instead of walking the body's cons cells with evaluate().
+ *
+ * Only the most common forms are compiled:  constants, variable references,
+ * procedure calls, if, begin, cond, quote and lambda.  Anything else (define,
+ * set!, let, and, or, and any malformed expression) is compiled into an
+ * instruction that hands the expression to evaluate(), so the interpreter
+ * remains the reference for what every expression means.  Calls in tail
+ * position reuse the current VM frame, so a tail-recursive loop runs in
+ * constant C stack space.
+ *
+ * Values the VM is working with are kept on an explicit stack that the
+ * garbage collector treats as a root, and each VM frame has an evaluation
+ * context holding its environment, just like evaluate() does.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bytecode.h"
+#include "alloc.h"
+#include "evaluator.h"
+#include "profile.h"
+#include "special_forms.h"
+#include "symbols.h"
+#include "values.h"
+
+
+/* Use GCC's labels-as-values for the dispatch loop when they are available. */
+#ifdef __GNUC__
+#define USE_COMPUTED_GOTO
+#endif
+
+
+/*!
+ * The VM's instructions.  The operands that follow each opcode are listed in
+ * the comments.
+ */
+typedef enum Opcode {
+    OP_CONST,           /* k:  push consts[k] */
+    OP_LOAD,            /* k:  push the value of the variable named by atom consts[k] */
+    OP_EVAL,            /* k:  push evaluate(env, consts[k]) */
+    OP_LAMBDA,          /* k, c:  push a lambda for expression consts[k], with code children[c] */
+    OP_JUMP,            /* t:  continue at t */
+    OP_JUMP_IF_FALSE,   /* t:  pop a value, continue at t if it is #f */
+    OP_POP,             /* discard the top value */
+    OP_CALL,            /* n:  apply the procedure under n operands */
+    OP_TAIL_CALL,       /* n:  the same, replacing the current frame */
+    OP_RETURN,          /* return the top value */
+    OP_TRY,             /* t:  on an error, resume at t */
+    OP_END_TRY,         /* discard the top value and stop watching for errors */
+    OP_FAIL,            /* m:  fail with the error message vm_errors[m] */
+    NUM_OPCODES
+} Opcode;
+
+
+/*!
+ * The explicit stack of values the VM is working with.  Unlike a PtrStack it
+ * may hold NULL, which is what procedures like display return.
+ */
+static Value **vm_stack;
+static int vm_size, vm_capacity;
+
+
+/*! The messages of the errors that OP_FAIL reports. */
+static const char *vm_errors[] = {
+#define ERR_NO_COND_BRANCH 0
+    "cond expression contains no matching branches!"
+};
+
+
+/*! Marks Lambdas whose bodies can't be compiled, so we only try once. */
+static Code uncompilable;
+
+
+/* The interned names of the special forms the compiler understands. */
+static char *quote_symbol, *if_symbol, *begin_symbol, *cond_symbol,
+    *else_symbol, *lambda_symbol;
+
+
+/*! Returns the VM's stack of values, and stores its size into *size. */
+Value ** get_vm_stack(int *size) {
+    *size = vm_size;
+    return vm_stack;
+}
+
+
+/*! Pushes a value onto the VM's stack. */
+static void push(Value *v) {
+    if (vm_size == vm_capacity) {
+        vm_capacity = vm_capacity ? vm_capacity * 2 : 256;
+        vm_stack = realloc(vm_stack, vm_capacity * sizeof(Value *));
+        if (vm_stack == NULL) {
+            fprintf(stderr, "VM: out of memory\n");
+            exit(1);
+        }
+    }
+    vm_stack[vm_size++] = v;
+}
+
+
+/*! Pops the top value off the VM's stack. */
+#define POP() (vm_stack[--vm_size])
+
+
+/*!
+ * Pushes a value onto the VM's stack.  evaluate() uses the stack to pass
+ * operands to procedures the same way the VM does.
+ */
+void push_vm_value(Value *v) {
+    push(v);
+}
+
+
+/*! Pops values off the VM's stack until only size of them are left. */
+void truncate_vm_stack(int size) {
+    assert(size <= vm_size);
+    vm_size = size;
+}
+
+
+/*============================================================================
+ * Compiler
+ */
+
+
+/*! Appends an int to one of the Code's growable arrays. */
+static void emit(Code *code, int op) {
+    if (code->num_ops == code->ops_capacity) {
+        code->ops_capacity = code->ops_capacity ? code->ops_capacity * 2 : 32;
+        code->ops = realloc(code->ops, code->ops_capacity * sizeof(int));
+        if (code->ops == NULL) {
+            fprintf(stderr, "compiler: out of memory\n");
+            exit(1);
+        }
+    }
+    code->ops[code->num_ops++] = op;
+}
+
+
+/*! Adds a value to the Code's constants, and returns its index. */
+static int add_const(Code *code, Value *v) {
+    if (code->num_consts == code->consts_capacity) {
+        code->consts_capacity =
+            code->consts_capacity ? code->consts_capacity * 2 : 16;
+        code->consts = realloc(code->consts,
+                               code->consts_capacity * sizeof(Value *));
+        if (code->consts == NULL) {
+            fprintf(stderr, "compiler: out of memory\n");
+            exit(1);
+        }
+    }
+    code->consts[code->num_consts] = v;
+    return code->num_consts++;
+}
+
+
+/*! Adds a nested lambda's Code to the Code's children, and returns its index. */
+static int add_child(Code *code, Code *child) {
+    if (code->num_children == code->children_capacity) {
+        code->children_capacity =
+            code->children_capacity ? code->children_capacity * 2 : 4;
+        code->children = realloc(code->children,
+                                 code->children_capacity * sizeof(Code *));
+        if (code->children == NULL) {
+            fprintf(stderr, "compiler: out of memory\n");
+            exit(1);
+        }
+    }
+    code->children[code->num_children] = child;
+    return code->num_children++;
+}
+
+
+/*! Emits a jump with a placeholder target, and returns where to patch it. */
+static int emit_jump(Code *code, int op) {
+    emit(code, op);
+    emit(code, -1);
+    return code->num_ops - 1;
+}
+
+
+/*! Points the jump at position at to the next instruction to be emitted. */
+static void patch_jump(Code *code, int at) {
+    code->ops[at] = code->num_ops;
+}
+
+
+/*!
+ * Returns the number of elements in a proper list, or -1 if v is not a proper
+ * list.
+ */
+static int proper_length(Value *v) {
+    int length = 0;
+
+    while (is_cons_pair(v)) {
+        length++;
+        v = v->cons_val.p_cdr;
+    }
+
+    return is_nil(v) ? length : -1;
+}
+
+
+Code * compile_body(Value *body);
+void compile_expr(Code *code, Value *expr, int tail);
+static void compile_cond(Code *code, Value *expr, int tail);
+
+
+/*!
+ * Compiles an expression that evaluate() will handle.  In tail position the
+ * result is returned; otherwise it is left on the stack.
+ */
+static void compile_fallback(Code *code, Value *expr, int tail) {
+    emit(code, OP_EVAL);
+    emit(code, add_const(code, expr));
+    if (tail)
+        emit(code, OP_RETURN);
+}
+
+
+/*!
+ * Compiles a procedure call.  The operator and the operands are evaluated in
+ * order, stopping at the first error, just like evaluate() does.
+ */
+static void compile_call(Code *code, Value *expr, int tail) {
+    Value *operand;
+    int num_operands = 0;
+
+    compile_expr(code, expr->cons_val.p_car, 0);
+
+    for (operand = expr->cons_val.p_cdr; is_cons_pair(operand);
+         operand = operand->cons_val.p_cdr) {
+        compile_expr(code, operand->cons_val.p_car, 0);
+        num_operands++;
+    }
+
+    emit(code, tail ? OP_TAIL_CALL : OP_CALL);
+    emit(code, num_operands);
+}
+
+
+/*!
+ * Compiles the expressions of a begin block or cond clause, which must be a
+ * proper, non-empty list.  An error in any of them ends the whole form.
+ */
+static void compile_sequence(Code *code, Value *exprs, int tail) {
+    while (!is_nil(exprs->cons_val.p_cdr)) {
+        compile_expr(code, exprs->cons_val.p_car, 0);
+        emit(code, OP_POP);
+        exprs = exprs->cons_val.p_cdr;
+    }
+    compile_expr(code, exprs->cons_val.p_car, tail);
+}
+
+
+/*!
+ * Compiles (cond (test expr ...) ... (else expr ...)).  The tests are tried in
+ * order, and the expressions of the first clause whose test is true are
+ * evaluated as with begin.  Clauses with no expressions, and cond forms that
+ * eval_cond() would reject, are left to evaluate().
+ */
+static void compile_cond(Code *code, Value *expr, int tail) {
+    Value *clauses, *clause;
+    int ends[64], num_ends = 0, next_clause = -1, i;
+
+    clauses = expr->cons_val.p_cdr;
+    if (proper_length(clauses) < 1 || proper_length(clauses) > 64) {
+        compile_fallback(code, expr, tail);
+        return;
+    }
+
+    for (clause = clauses; is_cons_pair(clause);
+         clause = clause->cons_val.p_cdr) {
+        Value *c = clause->cons_val.p_car;
+        if (proper_length(c) < 2 ||
+            (is_atom(c->cons_val.p_car) &&
+             c->cons_val.p_car->string_val == else_symbol &&
+             !is_nil(clause->cons_val.p_cdr))) {
+            compile_fallback(code, expr, tail);
+            return;
+        }
+    }
+
+    for (clause = clauses; is_cons_pair(clause);
+         clause = clause->cons_val.p_cdr) {
+        Value *test = clause->cons_val.p_car->cons_val.p_car;
+        Value *body = clause->cons_val.p_car->cons_val.p_cdr;
+
+        if (is_atom(test) && test->string_val == else_symbol) {
+            compile_sequence(code, body, tail);
+            next_clause = -1;
+            break;
+        }
+
+        compile_expr(code, test, 0);
+        next_clause = emit_jump(code, OP_JUMP_IF_FALSE);
+        compile_sequence(code, body, tail);
+        if (!tail)
+            ends[num_ends++] = emit_jump(code, OP_JUMP);
+        patch_jump(code, next_clause);
+    }
+
+    if (next_clause != -1) {
+        /* No else clause:  falling off the end is an error. */
+        emit(code, OP_FAIL);
+        emit(code, ERR_NO_COND_BRANCH);
+    }
+
+    for (i = 0; i < num_ends; i++)
+        patch_jump(code, ends[i]);
+}
+
+
+/*!
+ * Compiles an expression.  If tail is nonzero the expression is in tail
+ * position, and the code returns its value; otherwise the value is pushed
+ * onto the stack.
+ */
+void compile_expr(Code *code, Value *expr, int tail) {
+    if (is_atom(expr)) {
+        emit(code, OP_LOAD);
+        emit(code, add_const(code, expr));
+        if (tail)
+            emit(code, OP_RETURN);
+        return;
+    }
+
+    if (!is_cons_pair(expr)) {
+        /* Self-evaluating values. */
+        emit(code, OP_CONST);
+        emit(code, add_const(code, expr));
+        if (tail)
+            emit(code, OP_RETURN);
+        return;
+    }
+
+    if (is_atom(expr->cons_val.p_car)) {
+        char *name = expr->cons_val.p_car->string_val;
+        Value *args = expr->cons_val.p_cdr;
+
+        if (name == quote_symbol) {
+            /* (quote datum) */
+            if (proper_length(args) != 1) {
+                compile_fallback(code, expr, tail);
+                return;
+            }
+
+            emit(code, OP_CONST);
+            emit(code, add_const(code, get_car(args)));
+            if (tail)
+                emit(code, OP_RETURN);
+            return;
+        }
+
+        if (name == if_symbol) {
+            /* (if test then else); like eval_if, extra parts are ignored. */
+            Value *then_expr, *else_expr;
+            int to_else, to_end = -1;
+
+            if (!is_cons_pair(args) || !is_cons_pair(args->cons_val.p_cdr) ||
+                !is_cons_pair(args->cons_val.p_cdr->cons_val.p_cdr)) {
+                compile_fallback(code, expr, tail);
+                return;
+            }
+
+            then_expr = args->cons_val.p_cdr->cons_val.p_car;
+            else_expr = args->cons_val.p_cdr->cons_val.p_cdr->cons_val.p_car;
+
+            compile_expr(code, get_car(args), 0);
+            to_else = emit_jump(code, OP_JUMP_IF_FALSE);
+            compile_expr(code, then_expr, tail);
+            if (!tail)
+                to_end = emit_jump(code, OP_JUMP);
+            patch_jump(code, to_else);
+            compile_expr(code, else_expr, tail);
+            if (!tail)
+                patch_jump(code, to_end);
+            return;
+        }
+
+        if (name == cond_symbol) {
+            compile_cond(code, expr, tail);
+            return;
+        }
+
+        if (name == begin_symbol) {
+            /* (begin expr ...); like eval_begin, an error stops the block. */
+            if (proper_length(args) < 1) {
+                compile_fallback(code, expr, tail);
+                return;
+            }
+
+            compile_sequence(code, args, tail);
+            return;
+        }
+
+        if (name == lambda_symbol) {
+            /* (lambda args body ...) */
+            Code *child;
+
+            if (!is_cons_pair(args) || !is_cons_pair(args->cons_val.p_cdr) ||
+                (child = compile_body(args->cons_val.p_cdr)) == NULL) {
+                compile_fallback(code, expr, tail);
+                return;
+            }
+
+            emit(code, OP_LAMBDA);
+            emit(code, add_const(code, expr));
+            emit(code, add_child(code, child));
+            if (tail)
+                emit(code, OP_RETURN);
+            return;
+        }
+
+        if (is_special_form(name)) {
+            compile_fallback(code, expr, tail);
+            return;
+        }
+    }
+
+    compile_call(code, expr, tail);
+}
+
+
+/*!
+ * Compiles the body of a lambda.  Every expression but the last is evaluated
+ * for its side effects only; as in evaluate(), an error in one of them just
+ * abandons that expression.  The last expression is in tail position.
+ * Returns NULL if the body is not a proper, non-empty list.
+ */
+Code * compile_body(Value *body) {
+    Code *code;
+    int resume;
+
+    if (proper_length(body) < 1)
+        return NULL;
+
+    code = calloc(1, sizeof(Code));
+    if (code == NULL) {
+        fprintf(stderr, "compiler: out of memory\n");
+        exit(1);
+    }
+    code->refs = 1;
+
+    while (!is_nil(body->cons_val.p_cdr)) {
+        resume = emit_jump(code, OP_TRY);
+        compile_expr(code, body->cons_val.p_car, 0);
+        emit(code, OP_END_TRY);
+        patch_jump(code, resume);
+        body = body->cons_val.p_cdr;
+    }
+    compile_expr(code, body->cons_val.p_car, 1);
+
+    return code;
+}
+
+
+/*!
+ * Returns the compiled code for an interpreted lambda, compiling its body the
+ * first time.  Returns NULL if the body can't be compiled, in which case the
+ * lambda must be run with evaluate().
+ */
+Code * get_lambda_code(Lambda *f) {
+    assert(!f->native_impl);
+
+    if (f->code == NULL) {
+        if (quote_symbol == NULL) {
+            quote_symbol = intern_symbol("quote");
+            if_symbol = intern_symbol("if");
+            begin_symbol = intern_symbol("begin");
+            cond_symbol = intern_symbol("cond");
+            else_symbol = intern_symbol("else");
+            lambda_symbol = intern_symbol("lambda");
+        }
+
+        f->code = compile_body(f->body);
+        if (f->code == NULL)
+            f->code = &uncompilable;
+    }
+
+    return (f->code == &uncompilable) ? NULL : f->code;
+}
+
+
+/*! Drops one reference to a Code object, freeing it if it was the last. */
+void release_code(Code *code) {
+    int i;
+
+    if (code == &uncompilable || --code->refs > 0)
+        return;
+
+    for (i = 0; i < code->num_children; i++)
+        release_code(code->children[i]);
+
+    free(code->children);
+    free(code->consts);
+    free(code->ops);
+    free(code);
+}
+
+
+/*!
+ * Replaces each of the Code's constants, and those of its children, with
+ * forward(constant).  A collector that moves values uses this to keep
+ * compiled code pointing at the values' new locations; forward() must return
+ * its argument unchanged for a value that has already been moved.
+ */
+void forward_code_values(Code *code, Value * (*forward)(Value *)) {
+    int i;
+
+    if (code == NULL || code == &uncompilable)
+        return;
+
+    for (i = 0; i < code->num_consts; i++)
+        code->consts[i] = forward(code->consts[i]);
+
+    for (i = 0; i < code->num_children; i++)
+        forward_code_values(code->children[i], forward);
+}
+
+
+/*============================================================================
+ * Virtual Machine
+ */
+
+
+/*!
+ * Runs a lambda's body with evaluate(), for bodies that couldn't be compiled.
+ * This is the same loop evaluate() uses.
+ */
+static Value * evaluate_body(Lambda *f, Environment *env) {
+    Value *body_iter = f->body, *result;
+
+    do {
+        result = evaluate(env, get_car(body_iter));
+        body_iter = get_cdr(body_iter);
+    }
+    while (!is_nil(body_iter));
+
+    return result;
+}
+
+
+/*!
+ * Runs the body of an interpreted lambda in env, whose arguments must already
+ * be bound.  The caller must keep lambda reachable by the garbage collector
+ * until this returns.
+ */
+Value * execute_lambda(Value *lambda, Environment *env) {
+    EvaluationContext *ctx;
+    Code *code;
+    int *ops;
+    Value **consts;
+    int base, handler_sp = 0;
+    int pc = 0, handler_pc = -1;
+    Value *v, *result;
+
+    /* The frame's environment is rooted through its evaluation context, and
+     * the lambda that owns the running code sits at the bottom of the frame.
+     */
+    ctx = push_new_evalctx(env, lambda->lambda_val->body);
+    ctx->procedure = get_lambda_name(lambda->lambda_val);
+    base = vm_size;
+    push(lambda);
+
+    code = get_lambda_code(lambda->lambda_val);
+    if (code == NULL) {
+        result = evaluate_body(lambda->lambda_val, env);
+        goto Return;
+    }
+
+    ops = code->ops;
+    consts = code->consts;
+
+#ifdef USE_COMPUTED_GOTO
+    static void *dispatch_table[NUM_OPCODES] = {
+        &&L_OP_CONST, &&L_OP_LOAD, &&L_OP_EVAL, &&L_OP_LAMBDA, &&L_OP_JUMP,
+        &&L_OP_JUMP_IF_FALSE, &&L_OP_POP, &&L_OP_CALL, &&L_OP_TAIL_CALL,
+        &&L_OP_RETURN, &&L_OP_TRY, &&L_OP_END_TRY, &&L_OP_FAIL
+    };
+#define CASE(op)    L_##op:
+#define DISPATCH()  goto *dispatch_table[ops[pc++]]
+Dispatch:
+    DISPATCH();
+#else
+#define CASE(op)    case op:
+#define DISPATCH()  continue
+Dispatch:
+    for (;;) switch (ops[pc++]) {
+#endif
+
+    CASE(OP_CONST)
+        push(consts[ops[pc++]]);
+        DISPATCH();
+
+    CASE(OP_LOAD)
+        v = consts[ops[pc++]];
+        result = resolve_lexical(env, v);
+        if (result == NULL) {
+            v = make_error("couldn't resolve name \"%s\" to a value!",
+                           v->string_val);
+            goto Error;
+        }
+        push(result);
+        DISPATCH();
+
+    CASE(OP_EVAL)
+        v = evaluate(env, consts[ops[pc++]]);
+        if (is_error(v))
+            goto Error;
+        push(v);
+        DISPATCH();
+
+    CASE(OP_LAMBDA) {
+        Value *expr = consts[ops[pc++]];
+        Code *child = code->children[ops[pc++]];
+
+        v = make_closure(env, get_car(expr), get_cadr(expr),
+                         get_cdr(get_cdr(expr)));
+        if (is_error(v))
+            goto Error;
+
+        /* Lambdas made from this expression share its compiled code. */
+        v->lambda_val->code = child;
+        child->refs++;
+
+        push(v);
+        DISPATCH();
+    }
+
+    CASE(OP_JUMP)
+        pc = ops[pc];
+        DISPATCH();
+
+    CASE(OP_JUMP_IF_FALSE)
+        v = POP();
+        if (is_false(v))
+            pc = ops[pc];
+        else
+            pc++;
+        DISPATCH();
+
+    CASE(OP_POP)
+        vm_size--;
+        DISPATCH();
+
+    CASE(OP_CALL)
+    CASE(OP_TAIL_CALL) {
+        int tail = (ops[pc - 1] == OP_TAIL_CALL);
+        int num_operands = ops[pc++];
+        Value *operator, **operands;
+        Environment *child_env;
+
+        operator = vm_stack[vm_size - num_operands - 1];
+        if (!is_lambda(operator)) {
+            v = make_error("operator is not a valid lambda expression");
+            goto Error;
+        }
+
+        if (profiling)
+            profile_call(operator->lambda_val);
+
+        /* The operands are passed to the procedure where they are, on the
+         * stack above the operator.
+         */
+        operands = &vm_stack[vm_size - num_operands];
+
+        if (operator->lambda_val->native_impl) {
+            v = operator->lambda_val->func(num_operands, operands);
+            vm_size -= num_operands + 1;
+            if (is_error(v))
+                goto Error;
+
+            if (tail) {
+                result = v;
+                goto Return;
+            }
+            push(v);
+            collect_garbage();
+            DISPATCH();
+        }
+
+        child_env = make_environment(operator->lambda_val->parent_env);
+        v = bind_arguments(child_env, operator->lambda_val, num_operands,
+                           operands);
+        vm_size -= num_operands;
+        if (is_error(v))
+            goto Error;
+
+        if (tail && get_lambda_code(operator->lambda_val) != NULL) {
+            /* Replace this frame with the callee's:  the callee's lambda
+             * takes the bottom slot, and then the new body starts running.
+             */
+            vm_stack[base] = operator;
+            vm_size = base + 1;
+            ctx->current_env = env = child_env;
+            ctx->expression = operator->lambda_val->body;
+            ctx->procedure = get_lambda_name(operator->lambda_val);
+
+            code = operator->lambda_val->code;
+            ops = code->ops;
+            consts = code->consts;
+            pc = 0;
+
+            collect_garbage();
+            DISPATCH();
+        }
+
+        v = execute_lambda(operator, child_env);
+        vm_size--;
+        if (is_error(v))
+            goto Error;
+
+        if (tail) {
+            result = v;
+            goto Return;
+        }
+
+        /* The result is rooted on the stack now, and the callee's frame is
+         * garbage, so this is where a deep recursion gets to collect.
+         */
+        push(v);
+        collect_garbage();
+        DISPATCH();
+    }
+
+    CASE(OP_RETURN)
+        result = POP();
+        goto Return;
+
+    CASE(OP_TRY)
+        handler_pc = ops[pc++];
+        handler_sp = vm_size;
+        DISPATCH();
+
+    CASE(OP_END_TRY)
+        vm_size--;
+        handler_pc = -1;
+        DISPATCH();
+
+    CASE(OP_FAIL)
+        v = make_error("%s", vm_errors[ops[pc++]]);
+        goto Error;
+
+#ifndef USE_COMPUTED_GOTO
+    default:
+        assert(0);
+    }
+#endif
+
+#undef CASE
+#undef DISPATCH
+
+Error:
+    /* v is the error.  Inside a TRY block, abandon the expression and carry
+     * on after it; otherwise the error is the result of the call.
+     */
+    if (handler_pc != -1) {
+        vm_size = handler_sp;
+        pc = handler_pc;
+        handler_pc = -1;
+        goto Dispatch;
+    }
+    result = v;
+
+Return:
+    vm_size = base;
+    pop_evalctx(result);
+
+    return result;
+}
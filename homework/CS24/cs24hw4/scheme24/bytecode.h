@@ -0,0 +1,48 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "types.h"
+
+
+/*!
+ * The compiled form of an interpreted lambda's body.  A Code object is shared
+ * by every lambda made from the same lambda expression, so it is reference
+ * counted, and freed when the last lambda using it is collected.
+ */
+typedef struct Code {
+    /*! Number of lambdas and enclosing Code objects that refer to this one. */
+    int refs;
+
+    /*! The instructions:  each opcode is followed by its operands. */
+    int *ops;
+    int num_ops;
+    int ops_capacity;
+
+    /*!
+     * Values the instructions refer to by index:  constants, variable names,
+     * and expressions left to evaluate().  These are all parts of the lambda's
+     * body, so the garbage collector already keeps them alive.
+     */
+    Value **consts;
+    int num_consts;
+    int consts_capacity;
+
+    /*! Code for the lambda expressions that appear inside this body. */
+    struct Code **children;
+    int num_children;
+    int children_capacity;
+} Code;
+
+
+Code * get_lambda_code(Lambda *f);
+void release_code(Code *code);
+void forward_code_values(Code *code, Value * (*forward)(Value *));
+
+Value * execute_lambda(Value *lambda, Environment *env);
+
+Value ** get_vm_stack(int *size);
+void push_vm_value(Value *v);
+void truncate_vm_stack(int size);
+
+
+#endif /* BYTECODE_H */
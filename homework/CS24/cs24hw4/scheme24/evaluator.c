@@ -1,4 +1,6 @@
 #include <assert.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -6,11 +8,40 @@
 #include "alloc.h"
 #include "native_lambdas.h"
 #include "special_forms.h"
+#include "symbols.h"
+#include "bytecode.h"
+#include "profile.h"
+#include "lexical.h"
+#include "probe.h"
 
 
 #undef VERBOSE_EVAL
 
 
+/*!
+ * Change to #undef to apply interpreted lambdas by walking their bodies with
+ * evaluate(), instead of compiling them to bytecode.
+ */
+#define USE_BYTECODE
+
+
+/*!
+ * Environments with more bindings than this get a hash index.  Below this
+ * size, comparing the name pointers one by one is just as fast.
+ */
+#define ENV_INDEX_THRESHOLD 8
+
+
+/*!
+ * The probes of evaluate(), for "make PROBES=1".  The time of each call
+ * includes the calls it makes to evaluate subexpressions, and to run the
+ * lambdas it applies; tail calls are counted separately, since they go
+ * around again within the same call.
+ */
+PROBE_DEFINE(evaluate_probe, "evaluate");
+PROBE_DEFINE(tail_call_probe, "evaluate tail calls");
+
+
 /*! This is the global environment used for evaluation of Scheme programs. */
 static Environment *global_env = NULL;
 
@@ -18,8 +49,6 @@ static Environment *global_env = NULL;
 static PtrStack evaluation_stack = PTR_VECTOR_STATIC_INIT;
 
 
-Value * bind_arguments(Environment *child_env, Lambda *lambda, Value *operands);
-
 
 /*!
  * This struct is used for representing Scheme functions with native
@@ -57,6 +86,9 @@ static NativeLambdaBinding native_lambdas[] = {
     { "procedure?", scheme_is_procedure },
     { "string?"   , scheme_is_string    },
     { "symbol?"   , scheme_is_symbol    },
+    { "vector?"   , scheme_is_vector    },
+    { "hash-table?", scheme_is_hash_table },
+    { "string-builder?", scheme_is_string_builder },
 
     { "+", scheme_add },
     { "-", scheme_sub },
@@ -74,14 +106,36 @@ static NativeLambdaBinding native_lambdas[] = {
     { "set-car!", scheme_set_car },
     { "set-cdr!", scheme_set_cdr },
 
+    /* Functions for vectors and hash tables. */
+    { "make-vector"  , scheme_make_vector   },
+    { "vector"       , scheme_vector        },
+    { "vector-ref"   , scheme_vector_ref    },
+    { "vector-set!"  , scheme_vector_set    },
+    { "vector-length", scheme_vector_length },
+
+    { "make-hash-table" , scheme_make_hash_table  },
+    { "hash-table-ref"  , scheme_hash_table_ref   },
+    { "hash-table-set!" , scheme_hash_table_set   },
+    { "hash-table-count", scheme_hash_table_count },
+
     /* Utility functions. */
     { "display"  , scheme_display   },
     { "error"    , scheme_error     },
+    { "string-append" , scheme_string_append    },
+    { "number->string", scheme_number_to_string },
+    { "make-string-builder"   , scheme_make_string_builder      },
+    { "string-builder-append!", scheme_string_builder_append    },
+    { "string-builder->string", scheme_string_builder_to_string },
     { "srandom"  , scheme_srandom   },
     { "random"   , scheme_random    },
     { "time"     , scheme_time      },
     { "sqrt"     , scheme_sqrt      },
     { "eval-file", scheme_eval_file },
+    { "save-image", scheme_save_image },
+
+    /* Garbage-collector tuning. */
+    { "gc-ratio", scheme_gc_ratio },
+    { "gc-stats", scheme_gc_stats },
 
     /* Terminator. */
     { NULL, NULL }
@@ -90,6 +144,38 @@ static NativeLambdaBinding native_lambdas[] = {
 
 
 
+/*!
+ * Returns the name that a native function is registered under, or NULL if it
+ * isn't one of the built-in functions.
+ */
+const char * get_native_lambda_name(NativeLambda func) {
+    NativeLambdaBinding *binding;
+
+    for (binding = native_lambdas; binding->name != NULL; binding++) {
+        if (binding->func == func)
+            return binding->name;
+    }
+
+    return NULL;
+}
+
+
+/*!
+ * Returns the built-in function registered under a name, or NULL if there is
+ * no such function.
+ */
+NativeLambda find_native_lambda(const char *name) {
+    NativeLambdaBinding *binding;
+
+    for (binding = native_lambdas; binding->name != NULL; binding++) {
+        if (strcmp(binding->name, name) == 0)
+            return binding->func;
+    }
+
+    return NULL;
+}
+
+
 /*!
  * Creates and initializes a new environment struct, having the specified parent
  * environment.  This function supports a NULL input-value for the parent
@@ -104,6 +190,51 @@ Environment * make_environment(Environment *parent_env) {
 }
 
 
+/*!
+ * Makes an interpreted lambda for a lambda expression evaluated in env.
+ * keyword is the atom that starts the expression, lambda or define.  If the
+ * lexical-addressing pass gave the lambda a flat closure record, the record is
+ * made here, holding copies of just the variables the lambda uses; its parent
+ * is the global environment.  Lambdas that capture nothing share the global
+ * environment itself.  Otherwise the lambda keeps env, as usual.
+ */
+Value * make_closure(Environment *env, Value *keyword, Value *arg_spec,
+                     Value *body) {
+    const ClosureTemplate *t = NULL;
+    Environment *closure_env, *frame;
+    Capture *c;
+    int i, depth;
+
+    if (is_atom(keyword) && keyword->lex_depth == LEX_CLOSURE)
+        t = get_closure_template(keyword->lex_index);
+    if (t == NULL)
+        return make_lambda(env, arg_spec, body);
+    if (t->num_captures == 0)
+        return make_lambda(global_env, arg_spec, body);
+
+    closure_env = make_environment(global_env);
+    for (i = 0; i < t->num_captures; i++) {
+        c = &t->captures[i];
+
+        frame = env;
+        for (depth = c->depth; depth > 0 && frame != NULL; depth--)
+            frame = frame->parent_env;
+
+        /* The body finds its variables by name too, so if the environment
+         * isn't shaped as expected, it can still be run in env.
+         */
+        if (frame == NULL || c->index >= frame->num_bindings ||
+            frame->bindings[c->index].name != c->name ||
+            !create_binding(closure_env, c->name,
+                            frame->bindings[c->index].value)) {
+            return make_lambda(env, arg_spec, body);
+        }
+    }
+
+    return make_lambda(closure_env, arg_spec, body);
+}
+
+
 /*!
  * Creates and initializes a new environment struct for the global environment.
  * The global environment is the root of all other environments, and has a
@@ -119,8 +250,10 @@ Environment * init_global_environment(void) {
 
     binding = native_lambdas;
     while (binding->name != NULL) {
-        create_binding(global_env, binding->name,
-                       make_native_lambda(global_env, binding->func));
+        Value *f = make_native_lambda(global_env, binding->func);
+
+        f->lambda_val->name = intern_symbol(binding->name);
+        create_binding(global_env, f->lambda_val->name, f);
 
         binding++;
     }
@@ -134,11 +267,85 @@ Environment * get_global_environment(void) {
 }
 
 
+/*! Hashes an interned symbol by its address. */
+static unsigned int hash_symbol(const char *name) {
+    return (unsigned int) ((uintptr_t) name >> 3) * 2654435761u;
+}
+
+
+/*!
+ * Adds the binding at the specified position to the environment's hash index.
+ * The index must have room for it.
+ */
+static void index_binding(Environment *env, int i) {
+    unsigned int mask = env->index_capacity - 1;
+    unsigned int slot = hash_symbol(env->bindings[i].name) & mask;
+
+    while (env->index[slot] != 0)
+        slot = (slot + 1) & mask;
+
+    env->index[slot] = i + 1;
+}
+
+
+/*!
+ * Rebuilds the environment's hash index after its bindings array has grown,
+ * keeping the index at most half full.  If memory runs out, the index is just
+ * dropped, and lookups fall back to scanning the bindings.
+ */
+static void reindex_bindings(Environment *env) {
+    int i;
+
+    free(env->index);
+    env->index_capacity = 2 * env->capacity;
+    env->index = calloc(env->index_capacity, sizeof(int));
+    if (env->index == NULL) {
+        env->index_capacity = 0;
+        return;
+    }
+
+    for (i = 0; i < env->num_bindings; i++)
+        index_binding(env, i);
+}
+
+
+/*!
+ * Returns the position of the binding with the specified name in this
+ * environment (not its parents), or -1 if there is no such binding.  Since
+ * names are interned symbols, they are compared by pointer.
+ */
+static int find_binding(Environment *env, char *name) {
+    int i;
+
+    if (env->index != NULL) {
+        unsigned int mask = env->index_capacity - 1;
+        unsigned int slot = hash_symbol(name) & mask;
+
+        while (env->index[slot] != 0) {
+            i = env->index[slot] - 1;
+            if (env->bindings[i].name == name)
+                return i;
+            slot = (slot + 1) & mask;
+        }
+
+        return -1;
+    }
+
+    for (i = 0; i < env->num_bindings; i++) {
+        if (env->bindings[i].name == name)
+            return i;
+    }
+
+    return -1;
+}
+
+
 /*!
  * Attempts to create a new binding in the specified environment, and returns a
  * status value indicating success or failure.  Success is indicated by a result
  * of 1, and failure is indicated by a 0 result.  If the specified name already
- * appears in this environment, then the previous binding is replaced.
+ * appears in this environment, then the previous binding is replaced.  The name
+ * must be an interned symbol, such as the string_val of an atom.
  *
  * The only way this function will fail is if the function can't allocate the
  * necessary memory.
@@ -150,11 +357,11 @@ int create_binding(Environment *env, char *name, Value *v) {
     assert(name != NULL);
     assert(v != NULL);
 
-    for (i = 0; i < env->num_bindings; i++) {
-        if (strcmp(env->bindings[i].name, name) == 0) {
-            env->bindings[i].value = v;
-            return 1;
-        }
+    i = find_binding(env, name);
+    if (i >= 0) {
+        write_barrier_environment(env, v);
+        env->bindings[i].value = v;
+        return 1;
     }
 
     if (env->num_bindings == env->capacity) {
@@ -176,11 +383,20 @@ int create_binding(Environment *env, char *name, Value *v) {
 
     assert(env->num_bindings < env->capacity);
 
+    write_barrier_environment(env, v);
+
     i = env->num_bindings;
-    env->bindings[i].name = strdup(name);
+    env->bindings[i].name = name;
     env->bindings[i].value = v;
     env->num_bindings++;
 
+    if (env->num_bindings > ENV_INDEX_THRESHOLD) {
+        if (env->index_capacity != 2 * env->capacity)
+            reindex_bindings(env);
+        else
+            index_binding(env, i);
+    }
+
     return 1;
 }
 
@@ -207,11 +423,11 @@ int update_binding(Environment *env, char *name, Value *v) {
          * the value and return success.  Otherwise, we'll move to the parent
          * of this environment.
          */
-        for (i = 0; i < env->num_bindings; i++) {
-            if (strcmp(env->bindings[i].name, name) == 0) {
-                env->bindings[i].value = v;
-                return 1;
-            }
+        i = find_binding(env, name);
+        if (i >= 0) {
+            write_barrier_environment(env, v);
+            env->bindings[i].value = v;
+            return 1;
         }
 
         /*
@@ -226,6 +442,58 @@ int update_binding(Environment *env, char *name, Value *v) {
 }
 
 
+/*!
+ * Resolves an atom that can only name a global variable.  The position of
+ * the global binding is cached in the atom; since bindings are never removed
+ * or reordered, and define and set! update a binding in place, the cached
+ * position stays right, and the name check only fails for an atom that was
+ * loaded from an image.  Returns NULL if the name is not bound.
+ */
+static Value * resolve_global(Value *atom) {
+    int i = atom->lex_index;
+
+    if (i >= 0 && i < global_env->num_bindings &&
+        global_env->bindings[i].name == atom->string_val) {
+        return global_env->bindings[i].value;
+    }
+
+    i = find_binding(global_env, atom->string_val);
+    if (i < 0)
+        return NULL;
+
+    if (i <= SHRT_MAX)
+        atom->lex_index = i;
+    return global_env->bindings[i].value;
+}
+
+
+/*!
+ * Resolves an atom that is being evaluated as a variable.  If the lexical-
+ * addressing pass recorded where the variable lives, the binding is read
+ * directly; the name is still checked, and anything unexpected falls back to
+ * the normal lookup by name.  Returns NULL if the name cannot be resolved.
+ */
+Value * resolve_lexical(Environment *env, Value *atom) {
+    Environment *frame = env;
+    int depth;
+
+    if (atom->lex_depth == LEX_GLOBAL)
+        return resolve_global(atom);
+
+    if (atom->lex_depth != LEX_UNRESOLVED) {
+        for (depth = atom->lex_depth; depth > 0 && frame != NULL; depth--)
+            frame = frame->parent_env;
+
+        if (frame != NULL && atom->lex_index < frame->num_bindings &&
+            frame->bindings[atom->lex_index].name == atom->string_val) {
+            return frame->bindings[atom->lex_index].value;
+        }
+    }
+
+    return resolve_binding(env, atom->string_val);
+}
+
+
 /*!
  * Given a name and a starting environment, this function resolves the name to
  * a value using the bindings in the environment.  If the environment doesn't
@@ -243,18 +511,17 @@ Value * resolve_binding(Environment *env, char *name) {
 
     /* Starting with the original environment, search for the specified name. */
     do {
-        for (i = 0; i < env->num_bindings; i++) {
-            if (strcmp(env->bindings[i].name, name) == 0) {
-                Value *v = env->bindings[i].value;
+        i = find_binding(env, name);
+        if (i >= 0) {
+            Value *v = env->bindings[i].value;
 
 #ifdef VERBOSE_EVAL
-                printf("\tName \"%s\" is bound to:  ", name);
-                print_value(stdout, v);
-                printf("\n");
+            printf("\tName \"%s\" is bound to:  ", name);
+            print_value(stdout, v);
+            printf("\n");
 #endif
 
-                return v;
-            }
+            return v;
         }
 
         /* Couldn't find binding in this environment.
@@ -391,12 +658,13 @@ void pop_evalctx(Value *result) {
 Value * evaluate(Environment *env, Value *expr) {
 
     EvaluationContext *ctx;
-    Value *temp, *result;
+    Value *temp, *result, *tail_expr;
 
-    Value *operator;
-    Value *operand_val, *operand_cons;
-    Value *operands, *operands_end, *nil_value;
-    int num_operands;
+    Value *operator, *operand_val;
+    Value **operands;
+    int num_operands, base;
+
+    PROBE_BEGIN(evaluate_probe);
 
     /* Set up a new evaluation context and record our local variables, so that
      * the garbage-collector can see any temporary values we use.
@@ -406,10 +674,18 @@ Value * evaluate(Environment *env, Value *expr) {
     evalctx_register(&result);
     evalctx_register(&operator);
     evalctx_register(&operand_val);
-    evalctx_register(&operand_cons);
-    evalctx_register(&operands);
-    evalctx_register(&operands_end);
-    evalctx_register(&nil_value);
+
+    /* Operands are evaluated onto the VM's stack, above whatever is on it. */
+    get_vm_stack(&base);
+
+    /*
+     * Expressions in tail position are evaluated by jumping back here with a
+     * new expr (and possibly a new env), reusing this evaluation context
+     * rather than calling evaluate() recursively.  That way loops written as
+     * tail calls run in constant stack space, and the stack the garbage
+     * collector scans doesn't grow with the number of iterations.
+     */
+TailCall:
 
 #ifdef VERBOSE_EVAL
     printf("\nEvaluating expression:  ");
@@ -420,7 +696,12 @@ Value * evaluate(Environment *env, Value *expr) {
     /* If this is a special form, evaluate it.  Otherwise, this function will
      * simply pass the input through to the result.
      */
-    result = eval_special_form(env, expr);
+    result = eval_special_form(env, expr, &tail_expr);
+    if (tail_expr != NULL) {
+        /* The special form's value is the value of tail_expr. */
+        expr = tail_expr;
+        goto NextTailCall;
+    }
     if (result != expr)
         goto Done;    /* It was a special form. */
 
@@ -431,7 +712,7 @@ Value * evaluate(Environment *env, Value *expr) {
 
     if (is_atom(expr)) {
         /* Treat the atom as a name - resolve it to a value. */
-        result = resolve_binding(env, expr->string_val);
+        result = resolve_lexical(env, expr);
         if (result == NULL) {
             result = make_error("couldn't resolve name \"%s\" to a value!",
                 expr->string_val);
@@ -473,7 +754,10 @@ Value * evaluate(Environment *env, Value *expr) {
 #endif
 
     /*
-     * Evaluate each operand into a value, and build a list up of the values.
+     * Evaluate each operand into a value, and push the values onto the VM's
+     * stack, where they form the argument array for the operator.  The stack
+     * is rooted for the garbage collector, and it isn't freed between calls,
+     * so applying a procedure doesn't allocate anything for its arguments.
      */
 
 #ifdef VERBOSE_EVAL
@@ -481,8 +765,6 @@ Value * evaluate(Environment *env, Value *expr) {
 #endif
 
     num_operands = 0;
-    operands_end = NULL;
-    operands = nil_value = make_nil();
 
     temp = get_cdr(expr);
     while (is_cons_pair(temp)) {
@@ -501,30 +783,36 @@ Value * evaluate(Environment *env, Value *expr) {
             goto Done;
         }
 
-        operand_cons = make_cons(operand_val, nil_value);
-        if (operands_end != NULL)
-            set_cdr(operands_end, operand_cons);
-        else
-            operands = operand_cons;
-
-        operands_end = operand_cons;
+        push_vm_value(operand_val);
 
         temp = get_cdr(temp);
     }
 
+    /* Only look up the array now, since evaluating an operand can grow the
+     * stack and move it.
+     */
+    operands = get_vm_stack(&num_operands) + base;
+    num_operands -= base;
+
     /*
      * Apply the operator to the operands, to generate a result.
      */
 
+    if (profiling)
+        profile_call(operator->lambda_val);
+
     if (operator->lambda_val->native_impl) {
         /* Native lambdas don't need an environment created for them.  Rather,
-         * we just pass the list of arguments to the native function, and it
+         * we just pass the array of arguments to the native function, and it
          * processes the arguments as needed.
          */
         result = operator->lambda_val->func(num_operands, operands);
+        goto Done;
     }
     else {
-        /* These don't need registered on the explicit stack.  (I hope.) */
+        /* The child environment is rooted through ctx->current_env below;
+         * body_iter is part of the lambda, which is reachable from operator.
+         */
         Environment *child_env;
         Value *body_iter;
 
@@ -533,23 +821,54 @@ Value * evaluate(Environment *env, Value *expr) {
          * and the input operands.
          */
         child_env = make_environment(operator->lambda_val->parent_env);
-        temp = bind_arguments(child_env, operator->lambda_val, operands);
+        ctx->current_env = child_env;
+        temp = bind_arguments(child_env, operator->lambda_val, num_operands,
+                              operands);
+        truncate_vm_stack(base);
         if (is_error(temp)) {
             result = temp;
             goto Done;
         }
 
+#ifdef USE_BYTECODE
+        /* Run the lambda's compiled body on the bytecode VM, if it could be
+         * compiled.
+         */
+        if (get_lambda_code(operator->lambda_val) != NULL) {
+            result = execute_lambda(operator, child_env);
+            goto Done;
+        }
+#endif
+
         /* Evaluate each expression in the lambda, using the child environment.
-         * The result of the last expression is the result of the lambda.
+         * The result of the last expression is the result of the lambda, and
+         * that expression is in tail position.
          */
+        ctx->procedure = get_lambda_name(operator->lambda_val);
         body_iter = operator->lambda_val->body;
-        do {
-            result = evaluate(child_env, get_car(body_iter));
+        while (is_cons_pair(get_cdr(body_iter))) {
+            evaluate(child_env, get_car(body_iter));
             body_iter = get_cdr(body_iter);
         }
-        while (!is_nil(body_iter));
+
+        env = child_env;
+        expr = get_car(body_iter);
+        goto NextTailCall;
     }
 
+NextTailCall:
+    /* Everything still needed is reachable from the context's expression and
+     * environment, so the previous step's temporaries can be dropped and
+     * collected before going around again.
+     */
+    ctx->current_env = env;
+    ctx->expression = expr;
+    temp = result = operator = operand_val = NULL;
+    truncate_vm_stack(base);
+    collect_garbage();
+    PROBE_COUNT(tail_call_probe);
+    goto TailCall;
+
 Done:
 
 #ifdef VERBOSE_EVAL
@@ -559,78 +878,69 @@ Done:
 #endif
 
     /* Record the result and then perform garbage-collection. */
+    truncate_vm_stack(base);
     pop_evalctx(result);
     collect_garbage();
 
+    PROBE_END(evaluate_probe);
     return result;
 }
 
 
 /*!
- * This helper function takes an interpreted lambda expression, a list of
+ * This helper function takes an interpreted lambda expression, an array of
  * evaluated operands for the lambda, and the environment that the lambda will
  * be run in, and binds each operand into the environment with the argument name
- * specified in the lambda's argument list.
+ * specified in the lambda's argument list.  Operands left over for a rest
+ * argument are bound as a new list.
  *
  * The function returns NULL on success, or a Value* of type T_Error if
  * something horrible happens along the way.  For example, the function may
  * receive too many or too few arguments, or the interpreter may not have enough
  * memory to construct a specific binding.
  */
-Value * bind_arguments(Environment *child_env, Lambda *lambda, Value *operands) {
-    Value *argname_iter, *argval_iter;
+Value * bind_arguments(Environment *child_env, Lambda *lambda,
+                       int num_operands, Value **operands) {
+    Value *argname_iter;
+    int i = 0;
 
     assert(child_env != NULL);
     assert(lambda != NULL);
     assert(!lambda->native_impl);
-    assert(operands != NULL);
+    assert(num_operands == 0 || operands != NULL);
 
     /* Populate the child environment with values based on the lambda's
      * argument-specification, and the input operands.
      */
     argname_iter = lambda->arg_spec;
-    argval_iter = operands;
-    if (is_atom(argname_iter)) {
-        /* Entire operand list gets bound under a single name. */
-        create_binding(child_env, argname_iter->string_val, operands);
-    }
-    else {
-        /* Bind each operand under its specified name.
-         *
-         * TODO:  Find a way to use bind_names_values(), one day...
-         */
-        assert(is_cons_pair(argname_iter));
-        do {
-            Value *argname = get_car(argname_iter);
+    while (is_cons_pair(argname_iter)) {
+        Value *argname = get_car(argname_iter);
 
-            if (is_nil(argval_iter))
-                return make_error("not enough arguments for lambda!");
+        if (i == num_operands)
+            return make_error("not enough arguments for lambda!");
 
-            assert(is_cons_pair(operands));
+        create_binding(child_env, argname->string_val, operands[i]);
+        i++;
 
-            create_binding(child_env, argname->string_val,
-                           get_car(argval_iter));
+        argname_iter = get_cdr(argname_iter);
+    }
 
-            argname_iter = get_cdr(argname_iter);
-            argval_iter = get_cdr(argval_iter);
-        }
-        while (is_cons_pair(argname_iter));
+    /* If argname_iter is an atom then the argument-list was an improper
+     * list (or a single name), and the remainder of the operands get bound
+     * under this name.
+     */
+    if (is_atom(argname_iter)) {
+        create_binding(child_env, argname_iter->string_val,
+                       make_list(num_operands - i, operands + i));
+    }
+    else {
+        /* The lambda special-form should have constructed the argument
+         * specification properly, so this assertion should never fail.
+         */
+        assert(is_nil(argname_iter));
 
-        if (is_nil(argname_iter) && !is_nil(argval_iter))
+        if (i != num_operands)
             return make_error("too many arguments for lambda!");
-
-        /* If argname_iter is an atom then the argument-list was an improper
-         * list, and the remainder of the operands get bound under this name.
-         */
-        if (is_atom(argname_iter)) {
-            create_binding(child_env, argname_iter->string_val, argval_iter);
-        }
-        else {
-            /* The lambda special-form should have constructed the argument
-             * specification properly, so this assertion should never fail.
-             */
-            assert(is_nil(argname_iter));
-        }
     }
 
     /* NULL just means "success" here.  The only other thing this function might
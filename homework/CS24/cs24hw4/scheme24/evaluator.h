@@ -10,12 +10,21 @@ Environment * init_global_environment(void);
 Environment * get_global_environment(void);
 
 Environment * make_environment(Environment *parent_env);
+Value * make_closure(Environment *env, Value *keyword, Value *arg_spec,
+                     Value *body);
+
+/* Looking up the built-in functions by name, and names by function. */
+const char * get_native_lambda_name(NativeLambda func);
+NativeLambda find_native_lambda(const char *name);
 
 /* Functions for managing name/value bindings in environments. */
 int create_binding(Environment *env, char *name, Value *v);
 int update_binding(Environment *env, char *name, Value *v);
 Value * resolve_binding(Environment *env, char *name);
 Value * bind_names_values(Environment *env, Value *names, Value *values);
+Value * resolve_lexical(Environment *env, Value *atom);
+Value * bind_arguments(Environment *child_env, Lambda *lambda,
+                       int num_operands, Value **operands);
 
 /*
  * Functions for managing evaluation contexts, which are used for the explicit
@@ -0,0 +1,775 @@
+/*! \file
+ * This file implements heap images:  a snapshot of the global environment and
+ * everything reachable from it, written to a file so that a later run of the
+ * interpreter can start from it instead of loading stdlib.scm and other
+ * prelude files all over again.
+ *
+ * An image refers to objects by number rather than by address, so it doesn't
+ * matter where anything ends up in memory when the image is loaded.  The file
+ * starts with a header giving the number of values, lambdas and environments,
+ * followed by one record for each of them, in that order:
+ *
+ *   value:        a type byte, then the type's contents.  Numbers are stored
+ *                 as a 32-bit float or a 64-bit integer.  Atoms and strings
+ *                 are stored as text; an atom also keeps its lexical address,
+ *                 and a keyword atom marked for closure conversion keeps the
+ *                 name and address of each variable its closures capture.
+ *                 Cons pairs refer to two values, and lambda values to a
+ *                 lambda.  A vector has its length and then its elements;
+ *                 a hash table has its count and then each key and value;
+ *                 a string builder has its text.
+ *   lambda:       a native flag, and the name the lambda was defined under
+ *                 (empty if it has none).  Native lambdas are found by that
+ *                 name when loading, since function addresses change from
+ *                 one build to another.  Interpreted lambdas refer to their
+ *                 argument-spec, body, and parent environment.
+ *   environment:  the parent environment, then each binding's name and value.
+ *
+ * A reference is the object's number, or NO_REF for NULL.  Environment 0 is
+ * always the global environment.  Compiled code isn't saved; lambdas loaded
+ * from an image are compiled again when they are first applied.
+ *
+ * Loading maps the file into memory and builds ordinary heap objects from it,
+ * so the garbage collector treats them like any other objects.  Everything is
+ * allocated before anything is collected, and the loaded objects are only
+ * reachable through the global environment, so no extra rooting is needed.
+ */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "image.h"
+#include "alloc.h"
+#include "evaluator.h"
+#include "lexical.h"
+#include "symbols.h"
+#include "values.h"
+
+
+/*! The first bytes of every image file. */
+#define IMAGE_MAGIC "S24IMG3"
+
+/*! The reference stored for a NULL pointer. */
+#define NO_REF (-1)
+
+
+/*============================================================================
+ * Numbering the objects in an image
+ */
+
+
+/*!
+ * The objects being saved, in the order they were first reached.  An object's
+ * position in its vector is its number in the image.
+ */
+static PtrVector image_values, image_lambdas, image_envs;
+
+/*!
+ * A hash table from object addresses to their numbers, using open addressing
+ * with linear probing.  Values, lambdas and environments never share an
+ * address, so one table serves all three.
+ */
+static uintptr_t *number_keys;
+static int *number_vals;
+static unsigned int numbers_capacity, num_numbers;
+
+
+static unsigned int hash_address(uintptr_t key) {
+    key ^= key >> 17;
+    key *= 0x9E3779B1u;
+    return (unsigned int) (key ^ (key >> 15));
+}
+
+
+/*! Records the number of an object.  The object must not already have one. */
+static void set_number(const void *p, int n);
+
+static void grow_numbers(void) {
+    uintptr_t *old_keys = number_keys;
+    int *old_vals = number_vals;
+    unsigned int old_capacity = numbers_capacity, i;
+
+    numbers_capacity = numbers_capacity ? numbers_capacity * 2 : 1024;
+    number_keys = calloc(numbers_capacity, sizeof(uintptr_t));
+    number_vals = malloc(numbers_capacity * sizeof(int));
+    if (number_keys == NULL || number_vals == NULL) {
+        fprintf(stderr, "save_image: out of memory\n");
+        exit(1);
+    }
+
+    num_numbers = 0;
+    for (i = 0; i < old_capacity; i++) {
+        if (old_keys[i] != 0)
+            set_number((void *) old_keys[i], old_vals[i]);
+    }
+
+    free(old_keys);
+    free(old_vals);
+}
+
+static void set_number(const void *p, int n) {
+    unsigned int i;
+
+    if (2 * (num_numbers + 1) > numbers_capacity)
+        grow_numbers();
+
+    i = hash_address((uintptr_t) p) & (numbers_capacity - 1);
+    while (number_keys[i] != 0)
+        i = (i + 1) & (numbers_capacity - 1);
+
+    number_keys[i] = (uintptr_t) p;
+    number_vals[i] = n;
+    num_numbers++;
+}
+
+/*! Returns the number of an object, or NO_REF if it hasn't got one yet. */
+static int get_number(const void *p) {
+    unsigned int i;
+
+    if (p == NULL || numbers_capacity == 0)
+        return NO_REF;
+
+    i = hash_address((uintptr_t) p) & (numbers_capacity - 1);
+    while (number_keys[i] != 0) {
+        if (number_keys[i] == (uintptr_t) p)
+            return number_vals[i];
+        i = (i + 1) & (numbers_capacity - 1);
+    }
+
+    return NO_REF;
+}
+
+
+/*!
+ * Gives an object the next number of its kind, unless it has one already.
+ * The objects it refers to are numbered later, when the vector is scanned.
+ */
+static void reach(PtrVector *objects, void *p) {
+    if (p == NULL || get_number(p) != NO_REF)
+        return;
+
+    set_number(p, objects->size);
+    pv_add_elem(objects, p);
+}
+
+
+/*! Numbers everything reachable from the global environment. */
+static void number_objects(Environment *global_env) {
+    unsigned int iv = 0, il = 0, ie = 0;
+    Value *v;
+    Lambda *f;
+    Environment *env;
+    int i;
+
+    reach(&image_envs, global_env);
+
+    /* Numbering an object can reach new ones of any kind, so keep scanning
+     * until none of the vectors has anything left to look at.
+     */
+    while (iv < image_values.size || il < image_lambdas.size ||
+           ie < image_envs.size) {
+        for (; iv < image_values.size; iv++) {
+            v = (Value *) pv_get_elem(&image_values, iv);
+            if (is_cons_pair(v)) {
+                reach(&image_values, v->cons_val.p_car);
+                reach(&image_values, v->cons_val.p_cdr);
+            }
+            else if (is_lambda(v)) {
+                reach(&image_lambdas, v->lambda_val);
+            }
+            else if (is_vector(v)) {
+                for (i = 0; i < v->vector_val.length; i++)
+                    reach(&image_values, v->vector_val.elems[i]);
+            }
+            else if (is_hash_table(v)) {
+                HashTable *table = v->table_val;
+                for (i = 0; i < table->capacity; i++) {
+                    if (table->keys[i] != NULL) {
+                        reach(&image_values, table->keys[i]);
+                        reach(&image_values, table->values[i]);
+                    }
+                }
+            }
+        }
+
+        for (; il < image_lambdas.size; il++) {
+            f = (Lambda *) pv_get_elem(&image_lambdas, il);
+            if (!f->native_impl) {
+                reach(&image_values, f->arg_spec);
+                reach(&image_values, f->body);
+                reach(&image_envs, f->parent_env);
+            }
+        }
+
+        for (; ie < image_envs.size; ie++) {
+            env = (Environment *) pv_get_elem(&image_envs, ie);
+            reach(&image_envs, env->parent_env);
+            for (i = 0; i < env->num_bindings; i++)
+                reach(&image_values, env->bindings[i].value);
+        }
+    }
+}
+
+
+/*! Forgets the numbering, so that the next image starts over. */
+static void clear_numbers(void) {
+    pv_uninit(&image_values);
+    pv_uninit(&image_lambdas);
+    pv_uninit(&image_envs);
+
+    free(number_keys);
+    free(number_vals);
+    number_keys = NULL;
+    number_vals = NULL;
+    numbers_capacity = num_numbers = 0;
+}
+
+
+/*============================================================================
+ * Saving an image
+ */
+
+
+static void write_int(FILE *f, int32_t n) {
+    fwrite(&n, sizeof(n), 1, f);
+}
+
+static void write_string(FILE *f, const char *s) {
+    int32_t len = strlen(s);
+    write_int(f, len);
+    fwrite(s, 1, len, f);
+}
+
+
+static void write_value(FILE *f, Value *v) {
+    Type type = get_type(v);
+    HashTable *table;
+    float fval;
+    int64_t ival;
+    int i;
+
+    fputc(type, f);
+
+    switch (type) {
+    case T_Nil:
+        break;
+
+    case T_Boolean:
+        fputc(is_true(v), f);
+        break;
+
+    case T_Atom:
+        write_string(f, v->string_val);
+        write_int(f, v->lex_depth);
+        write_int(f, v->lex_index);
+
+        if (v->lex_depth == LEX_CLOSURE) {
+            /* Template ids are only meaningful in this process. */
+            const ClosureTemplate *t = get_closure_template(v->lex_index);
+
+            write_int(f, t != NULL ? t->num_captures : 0);
+            for (i = 0; t != NULL && i < t->num_captures; i++) {
+                write_string(f, t->captures[i].name);
+                write_int(f, t->captures[i].depth);
+                write_int(f, t->captures[i].index);
+            }
+        }
+        break;
+
+    case T_String:
+    case T_Error:
+        write_string(f, v->string_val);
+        break;
+
+    case T_Float:
+        fval = get_float(v);
+        fwrite(&fval, sizeof(fval), 1, f);
+        break;
+
+    case T_Fixnum:
+        ival = get_fixnum(v);
+        fwrite(&ival, sizeof(ival), 1, f);
+        break;
+
+    case T_Lambda:
+        write_int(f, get_number(v->lambda_val));
+        break;
+
+    case T_ConsPair:
+        write_int(f, get_number(v->cons_val.p_car));
+        write_int(f, get_number(v->cons_val.p_cdr));
+        break;
+
+    case T_Vector:
+        write_int(f, v->vector_val.length);
+        for (i = 0; i < v->vector_val.length; i++)
+            write_int(f, get_number(v->vector_val.elems[i]));
+        break;
+
+    case T_HashTable:
+        table = v->table_val;
+        write_int(f, table->count);
+        for (i = 0; i < table->capacity; i++) {
+            if (table->keys[i] != NULL) {
+                write_int(f, get_number(table->keys[i]));
+                write_int(f, get_number(table->values[i]));
+            }
+        }
+        break;
+
+    case T_StringBuilder:
+        write_string(f, sb_contents(v->builder_val));
+        break;
+    }
+}
+
+
+static void write_lambda(FILE *f, Lambda *lambda) {
+    fputc(lambda->native_impl, f);
+    write_string(f, lambda->name != NULL ? lambda->name : "");
+
+    if (lambda->native_impl) {
+        write_string(f, get_native_lambda_name(lambda->func));
+    }
+    else {
+        write_int(f, get_number(lambda->arg_spec));
+        write_int(f, get_number(lambda->body));
+        write_int(f, get_number(lambda->parent_env));
+    }
+}
+
+
+static void write_environment(FILE *f, Environment *env) {
+    int i;
+
+    write_int(f, get_number(env->parent_env));
+    write_int(f, env->num_bindings);
+    for (i = 0; i < env->num_bindings; i++) {
+        write_string(f, env->bindings[i].name);
+        write_int(f, get_number(env->bindings[i].value));
+    }
+}
+
+
+/*!
+ * Writes the global environment, and everything reachable from it, to an
+ * image file.  Returns 1 on success, or 0 if the file couldn't be written.
+ */
+int save_image(const char *filename) {
+    FILE *f;
+    unsigned int i;
+    int ok;
+
+    f = fopen(filename, "wb");
+    if (f == NULL)
+        return 0;
+
+    number_objects(get_global_environment());
+
+    fwrite(IMAGE_MAGIC, 1, sizeof(IMAGE_MAGIC), f);
+    write_int(f, image_values.size);
+    write_int(f, image_lambdas.size);
+    write_int(f, image_envs.size);
+
+    for (i = 0; i < image_values.size; i++)
+        write_value(f, (Value *) pv_get_elem(&image_values, i));
+
+    for (i = 0; i < image_lambdas.size; i++)
+        write_lambda(f, (Lambda *) pv_get_elem(&image_lambdas, i));
+
+    for (i = 0; i < image_envs.size; i++)
+        write_environment(f, (Environment *) pv_get_elem(&image_envs, i));
+
+    clear_numbers();
+
+    ok = !ferror(f);
+    if (fclose(f) != 0)
+        ok = 0;
+
+    return ok;
+}
+
+
+/*============================================================================
+ * Loading an image
+ */
+
+
+/*! The part of the mapped image that hasn't been read yet. */
+typedef struct ImageReader {
+    const char *pos;
+    const char *end;
+    int failed;     /*!< Set once the reader runs off the end of the image. */
+} ImageReader;
+
+
+static const char * read_bytes(ImageReader *r, size_t n) {
+    const char *p = r->pos;
+
+    if (r->failed || (size_t) (r->end - r->pos) < n) {
+        r->failed = 1;
+        return NULL;
+    }
+
+    r->pos += n;
+    return p;
+}
+
+static int32_t read_int(ImageReader *r) {
+    const char *p = read_bytes(r, sizeof(int32_t));
+    int32_t n = 0;
+
+    if (p != NULL)
+        memcpy(&n, p, sizeof(n));
+    return n;
+}
+
+static int read_byte(ImageReader *r) {
+    const char *p = read_bytes(r, 1);
+    return p != NULL ? (unsigned char) *p : 0;
+}
+
+/*! Returns a NUL-terminated copy of the next string in the image. */
+static char * read_string(ImageReader *r, char **buf, int32_t *buf_size) {
+    int32_t len = read_int(r);
+    const char *p;
+
+    if (len < 0)
+        r->failed = 1;
+    p = read_bytes(r, len);
+    if (p == NULL)
+        return "";
+
+    if (len + 1 > *buf_size) {
+        *buf_size = len + 1;
+        *buf = realloc(*buf, *buf_size);
+        if (*buf == NULL) {
+            fprintf(stderr, "load_image: out of memory\n");
+            exit(1);
+        }
+    }
+
+    memcpy(*buf, p, len);
+    (*buf)[len] = '\0';
+    return *buf;
+}
+
+/*! Reads a reference to one of count objects, which may be NO_REF. */
+static int read_ref(ImageReader *r, int count) {
+    int32_t n = read_int(r);
+
+    if (n < NO_REF || n >= count)
+        r->failed = 1;
+    return r->failed ? NO_REF : n;
+}
+
+
+/*!
+ * Builds the objects described by an image in memory.  The global
+ * environment's bindings are added to the current global environment,
+ * replacing any that are already there.  Returns 1 on success, or 0 if the
+ * image couldn't be read or isn't valid; in that case the global environment
+ * may have been partly updated.
+ */
+static int build_image(ImageReader *r) {
+    Environment *global_env = get_global_environment();
+    int32_t num_values, num_lambdas, num_envs;
+    Value **values = NULL;
+    Lambda **lambdas = NULL;
+    Environment **envs = NULL;
+    int *cons_refs = NULL;
+    const char **elem_refs = NULL;
+    char *buf = NULL;
+    int32_t buf_size = 0;
+    int i, j, n, ok = 0;
+
+    num_values = read_int(r);
+    num_lambdas = read_int(r);
+    num_envs = read_int(r);
+    if (r->failed || num_values < 0 || num_lambdas < 0 || num_envs < 1)
+        return 0;
+
+    values = calloc(num_values + 1, sizeof(Value *));
+    lambdas = calloc(num_lambdas + 1, sizeof(Lambda *));
+    envs = calloc(num_envs, sizeof(Environment *));
+    cons_refs = malloc((2 * num_values + 1) * sizeof(int));
+    elem_refs = calloc(num_values + 1, sizeof(const char *));
+    if (values == NULL || lambdas == NULL || envs == NULL ||
+        cons_refs == NULL || elem_refs == NULL) {
+        goto Done;
+    }
+
+    /* Lambdas and environments are created first, so that values can refer to
+     * them straight away.  Environment 0 is the global environment.
+     */
+    for (i = 0; i < num_lambdas; i++)
+        lambdas[i] = alloc_lambda();
+    envs[0] = global_env;
+    for (i = 1; i < num_envs; i++)
+        envs[i] = make_environment(NULL);
+
+    for (i = 0; i < num_values && !r->failed; i++) {
+        Type type = read_byte(r);
+        Value *v;
+
+        cons_refs[2 * i] = cons_refs[2 * i + 1] = NO_REF;
+
+        switch (type) {
+        case T_Nil:
+            v = make_nil();
+            break;
+
+        case T_Boolean:
+            v = make_bool(read_byte(r));
+            break;
+
+        case T_Atom:
+            v = make_atom(read_string(r, &buf, &buf_size));
+            v->lex_depth = read_int(r);
+            v->lex_index = read_int(r);
+
+            if (v->lex_depth == LEX_CLOSURE) {
+                Capture *captures;
+
+                n = read_int(r);
+                if (n < 0 || n > SHRT_MAX)
+                    goto Done;
+                captures = malloc((n > 0 ? n : 1) * sizeof(Capture));
+                if (captures == NULL)
+                    goto Done;
+
+                for (j = 0; j < n; j++) {
+                    captures[j].name = intern_symbol(
+                        read_string(r, &buf, &buf_size));
+                    captures[j].depth = read_int(r);
+                    captures[j].index = read_int(r);
+                }
+
+                /* Without its template, the lambda just keeps its whole
+                 * environment, which is always correct.
+                 */
+                v->lex_index = add_closure_template(n, captures);
+                if (v->lex_index == -1)
+                    v->lex_depth = v->lex_index = LEX_UNRESOLVED;
+                free(captures);
+            }
+            break;
+
+        case T_String:
+        case T_Error:
+            v = make_string(read_string(r, &buf, &buf_size));
+            v->type = type;
+            break;
+
+        case T_Float: {
+            const char *p = read_bytes(r, sizeof(float));
+            float fval = 0;
+            if (p != NULL)
+                memcpy(&fval, p, sizeof(fval));
+            v = make_float(fval);
+            break;
+        }
+
+        case T_Fixnum: {
+            /* An image from a 64-bit host may hold integers too large to be
+             * fixnums here; those become floats.
+             */
+            const char *p = read_bytes(r, sizeof(int64_t));
+            int64_t ival = 0;
+            if (p != NULL)
+                memcpy(&ival, p, sizeof(ival));
+            if (ival < FIXNUM_MIN || ival > FIXNUM_MAX)
+                v = make_float((float) ival);
+            else
+                v = make_fixnum((intptr_t) ival);
+            break;
+        }
+
+        case T_Lambda:
+            n = read_ref(r, num_lambdas);
+            if (n == NO_REF)
+                goto Done;
+            v = alloc_value();
+            v->type = T_Lambda;
+            v->lambda_val = lambdas[n];
+            break;
+
+        case T_ConsPair:
+            cons_refs[2 * i] = read_ref(r, num_values);
+            cons_refs[2 * i + 1] = read_ref(r, num_values);
+            v = make_cons(NULL, NULL);
+            break;
+
+        /* The elements of vectors and hash tables are read again on the
+         * second pass, once they exist; for now they are just skipped.
+         */
+        case T_Vector:
+            n = read_int(r);
+            if (n < 0)
+                goto Done;
+            elem_refs[i] = r->pos;
+            read_bytes(r, (size_t) n * sizeof(int32_t));
+            v = make_vector(n, make_nil());
+            break;
+
+        case T_HashTable:
+            elem_refs[i] = r->pos;
+            n = read_int(r);
+            if (n < 0)
+                goto Done;
+            read_bytes(r, (size_t) n * 2 * sizeof(int32_t));
+            v = make_hash_table();
+            break;
+
+        case T_StringBuilder:
+            v = make_string_builder();
+            if (is_error(v) || !sb_append_str(v->builder_val,
+                                              read_string(r, &buf, &buf_size))) {
+                goto Done;
+            }
+            note_payload(v, v->builder_val->capacity);
+            break;
+
+        default:
+            goto Done;
+        }
+
+        values[i] = v;
+    }
+
+    /* Now that every value exists, the cons pairs can be linked up. */
+    for (i = 0; i < num_values && !r->failed; i++) {
+        if (is_cons_pair(values[i])) {
+            if (cons_refs[2 * i] == NO_REF || cons_refs[2 * i + 1] == NO_REF)
+                goto Done;
+            values[i]->cons_val.p_car = values[cons_refs[2 * i]];
+            values[i]->cons_val.p_cdr = values[cons_refs[2 * i + 1]];
+        }
+        else if (elem_refs[i] != NULL) {
+            ImageReader elems = {elem_refs[i], r->end, 0};
+            Value *v = values[i];
+
+            if (is_error(v))
+                goto Done;
+
+            if (is_vector(v)) {
+                for (j = 0; j < v->vector_val.length; j++) {
+                    n = read_ref(&elems, num_values);
+                    if (n == NO_REF)
+                        goto Done;
+                    v->vector_val.elems[j] = values[n];
+                }
+            }
+            else {
+                int count = read_int(&elems);
+                for (j = 0; j < count; j++) {
+                    int key = read_ref(&elems, num_values);
+                    n = read_ref(&elems, num_values);
+                    if (key == NO_REF || n == NO_REF ||
+                        !hash_table_set(v, values[key], values[n])) {
+                        goto Done;
+                    }
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < num_lambdas && !r->failed; i++) {
+        Lambda *f = lambdas[i];
+        char *name;
+
+        f->native_impl = read_byte(r);
+        name = read_string(r, &buf, &buf_size);
+        if (*name != '\0')
+            f->name = intern_symbol(name);
+
+        if (f->native_impl) {
+            f->func = find_native_lambda(read_string(r, &buf, &buf_size));
+            f->parent_env = global_env;
+            if (f->func == NULL)
+                goto Done;
+        }
+        else {
+            int arg_spec = read_ref(r, num_values);
+            int body = read_ref(r, num_values);
+            n = read_ref(r, num_envs);
+            if (arg_spec == NO_REF || body == NO_REF || n == NO_REF)
+                goto Done;
+            f->arg_spec = values[arg_spec];
+            f->body = values[body];
+            f->parent_env = envs[n];
+        }
+    }
+
+    for (i = 0; i < num_envs && !r->failed; i++) {
+        n = read_ref(r, num_envs);
+        if (i > 0 && n != NO_REF)
+            envs[i]->parent_env = envs[n];
+
+        n = read_int(r);
+        for (j = 0; j < n && !r->failed; j++) {
+            char *name = intern_symbol(read_string(r, &buf, &buf_size));
+            int k = read_ref(r, num_values);
+            if (k == NO_REF || !create_binding(envs[i], name, values[k]))
+                goto Done;
+        }
+    }
+
+    ok = !r->failed;
+
+Done:
+    free(buf);
+    free(elem_refs);
+    free(cons_refs);
+    free(envs);
+    free(lambdas);
+    free(values);
+    return ok;
+}
+
+
+/*!
+ * Maps an image file written by save_image() into memory, and adds its global
+ * bindings, and everything they refer to, to the global environment.  Returns
+ * 1 on success, or 0 if the file couldn't be opened or isn't a valid image.
+ */
+int load_image(const char *filename) {
+    ImageReader reader;
+    struct stat st;
+    const char *magic;
+    void *data;
+    int fd, ok;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return 0;
+
+    reader.pos = data;
+    reader.end = reader.pos + st.st_size;
+    reader.failed = 0;
+
+    magic = read_bytes(&reader, sizeof(IMAGE_MAGIC));
+    ok = magic != NULL && memcmp(magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) == 0 &&
+         build_image(&reader);
+
+    munmap(data, st.st_size);
+    return ok;
+}
@@ -0,0 +1,9 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+
+int save_image(const char *filename);
+int load_image(const char *filename);
+
+
+#endif /* IMAGE_H */
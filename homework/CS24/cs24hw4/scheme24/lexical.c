@@ -0,0 +1,643 @@
+/*! \file
+ * This file implements the lexical-addressing pass, which runs over each
+ * top-level expression before it is evaluated.  Every atom that refers to an
+ * argument of an enclosing lambda, or to a name bound by an enclosing let, is
+ * annotated with the variable's lexical address:  how many parent_env links
+ * separate the environment where the atom is evaluated from the environment
+ * holding the variable, and the variable's position in that environment's
+ * bindings.  The evaluator can then go straight to the binding, instead of
+ * searching each environment by name.
+ *
+ * Arguments are bound in the order they appear in the lambda's argument list,
+ * and let names in the order they are listed, so their positions are known
+ * ahead of time.  Names added by define inside a body are not:  their
+ * positions depend on the order the defines run in.  Those names are left
+ * unresolved, and the evaluator looks them up by name as before.
+ *
+ * An atom that isn't bound or defined in any enclosing scope can only refer to
+ * the global environment, so it is marked as global.  The evaluator then skips
+ * the local environments, and caches where the global binding is; the cache
+ * refers to the binding rather than its value, so define and set! never make
+ * it stale.
+ *
+ * Lambdas nested inside other scopes are also closure-converted where that is
+ * safe.  The analysis finds the lambda's free variables, the local variables
+ * of enclosing scopes that its body refers to, and addresses them in a flat
+ * closure record instead:  when the lambda is created, the evaluator copies
+ * just those values into a new environment whose parent is the global
+ * environment, and the lambda keeps that instead of the whole chain of
+ * enclosing environments (see make_closure()).  Lookups of free variables
+ * then never go more than one link, and a closure no longer keeps alive
+ * everything its creator could see.  Copying is only correct if the copies
+ * can't go stale, so a lambda is left as it is if any captured variable is
+ * the target of a set! anywhere in the top-level expression, or is redefined
+ * in its own scope, or if the body has to look up an enclosing variable by
+ * name (because a define may add it).  The keyword atom of a converted lambda
+ * is marked with LEX_CLOSURE, and its lex_index names the closure template
+ * that lists where each captured variable comes from.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lexical.h"
+#include "ptr_vector.h"
+#include "symbols.h"
+#include "values.h"
+
+
+/*!
+ * One environment that will exist at run time, as seen by the analysis.  The
+ * scopes form a chain that mirrors the parent_env chain of the environments.
+ */
+typedef struct Scope {
+    /*! The enclosing scope, or NULL for the outermost local scope. */
+    struct Scope *parent;
+
+    /*! The interned names bound on entry, in binding order. */
+    PtrVector names;
+
+    /*! The interned names that define may add to this environment. */
+    PtrVector defined;
+
+    /*!
+     * For the scope that stands for a flat closure record, the scope the
+     * lambda is created in; its parent is NULL, since the record's parent is
+     * the global environment.  names holds the variables captured so far, and
+     * captures where each of them comes from.  NULL for every other scope.
+     */
+    struct Scope *creator;
+    Capture *captures;
+    int captures_capacity;
+
+    /*! Nonzero if the closure record turned out not to be safe to use. */
+    int failed;
+} Scope;
+
+
+/*! The results of looking up a name in a chain of scopes. */
+typedef enum Lookup {
+    NOT_LOCAL,      /*!< Not bound in any local scope, so it must be global. */
+    FOUND,          /*!< Bound at a known position. */
+    BY_NAME         /*!< Must be looked up by name, since a define may add it. */
+} Lookup;
+
+
+/* The interned names of the special forms that affect scoping. */
+static char *quote_symbol, *lambda_symbol, *define_symbol, *let_symbol,
+    *set_symbol;
+
+/*! The names that set! assigns anywhere in the expression being analyzed. */
+static PtrVector assigned_names;
+
+/*! Every closure template made so far; a template's id is its position. */
+static ClosureTemplate *templates;
+static int num_templates, templates_capacity;
+
+
+void analyze(Value *expr, Scope *scope);
+void analyze_body(Value *body, Scope *scope);
+
+
+/*
+ * List accessors for the analysis.  Unlike get_car() and friends, these never
+ * allocate an error value:  the expression hasn't been checked yet, so these
+ * just yield NULL for anything that isn't shaped as expected, and the
+ * evaluator reports the error later.
+ */
+
+static int is_pair(Value *v) {
+    return v != NULL && get_type(v) == T_ConsPair;
+}
+
+static int is_symbol(Value *v) {
+    return v != NULL && get_type(v) == T_Atom;
+}
+
+static Value * car(Value *v) {
+    return is_pair(v) ? v->cons_val.p_car : NULL;
+}
+
+static Value * cdr(Value *v) {
+    return is_pair(v) ? v->cons_val.p_cdr : NULL;
+}
+
+static Value * cadr(Value *v) {
+    return car(cdr(v));
+}
+
+static Value * cddr(Value *v) {
+    return cdr(cdr(v));
+}
+
+
+/*! Returns the position of name in the vector, or -1 if it isn't there. */
+static int find_name(PtrVector *pv, char *name) {
+    int i;
+
+    for (i = 0; i < pv->size; i++) {
+        if (pv_get_elem(pv, i) == name)
+            return i;
+    }
+
+    return -1;
+}
+
+
+/*! Adds a name to a scope's bindings, unless it is already bound there. */
+static void add_name(Scope *scope, Value *atom) {
+    if (is_symbol(atom) && find_name(&scope->names, atom->string_val) == -1)
+        pv_add_elem(&scope->names, atom->string_val);
+}
+
+
+static void init_scope(Scope *scope, Scope *parent) {
+    scope->parent = parent;
+    pv_init(&scope->names);
+    pv_init(&scope->defined);
+    scope->creator = NULL;
+    scope->captures = NULL;
+    scope->captures_capacity = 0;
+    scope->failed = 0;
+}
+
+
+static void uninit_scope(Scope *scope) {
+    pv_uninit(&scope->names);
+    pv_uninit(&scope->defined);
+    free(scope->captures);
+}
+
+
+static Lookup lookup_name(Scope *scope, char *name, int *depth, int *index);
+
+
+/*!
+ * Adds a variable of the closure's creator to the closure record, if it can
+ * be copied there safely, and stores its position in the record into *index.
+ * Otherwise the closure is marked as failed.
+ */
+static Lookup capture(Scope *closure, char *name, int *index) {
+    Lookup result;
+    Scope *owner;
+    int depth, i, d;
+
+    result = lookup_name(closure->creator, name, &depth, &i);
+    if (result == NOT_LOCAL)
+        return NOT_LOCAL;
+
+    /* Find the scope the variable belongs to, to see if define may change
+     * it there.
+     */
+    owner = closure->creator;
+    for (d = 0; result == FOUND && d < depth; d++)
+        owner = owner->parent;
+
+    if (result == BY_NAME || find_name(&assigned_names, name) != -1 ||
+        find_name(&owner->defined, name) != -1 ||
+        depth > SHRT_MAX || i > SHRT_MAX) {
+        closure->failed = 1;
+        return BY_NAME;
+    }
+
+    if (closure->names.size == closure->captures_capacity) {
+        int capacity = closure->captures_capacity ?
+                       2 * closure->captures_capacity : 4;
+        Capture *captures = realloc(closure->captures,
+                                    capacity * sizeof(Capture));
+
+        if (captures == NULL) {
+            closure->failed = 1;
+            return BY_NAME;
+        }
+        closure->captures = captures;
+        closure->captures_capacity = capacity;
+    }
+
+    if (!pv_add_elem(&closure->names, name)) {
+        closure->failed = 1;
+        return BY_NAME;
+    }
+
+    *index = closure->names.size - 1;
+    closure->captures[*index].name = name;
+    closure->captures[*index].depth = depth;
+    closure->captures[*index].index = i;
+    return FOUND;
+}
+
+
+/*!
+ * Marks every closure record that a lookup of the name by name, starting at
+ * the specified scope, would pass through before reaching the name's
+ * binding.  Since a define may add the name anywhere on the way, the records
+ * can't hold it, and the lookup has to see the whole chain of environments.
+ */
+static void fail_closures(Scope *scope, char *name) {
+    while (scope != NULL) {
+        if (find_name(&scope->names, name) != -1)
+            return;
+
+        if (scope->creator != NULL) {
+            scope->failed = 1;
+            scope = scope->creator;
+        }
+        else {
+            scope = scope->parent;
+        }
+    }
+}
+
+
+/*!
+ * Looks up a name in a chain of scopes.  If it is bound at a known position,
+ * its address is stored into *depth and *index.  Reaching a closure record
+ * captures the variable into the record, if it is bound further out.
+ */
+static Lookup lookup_name(Scope *scope, char *name, int *depth, int *index) {
+    int d, i;
+
+    for (d = 0; scope != NULL; d++, scope = scope->parent) {
+        i = find_name(&scope->names, name);
+        if (i != -1) {
+            *depth = d;
+            *index = i;
+            return FOUND;
+        }
+
+        /* A define may shadow outer variables with a binding at an unknown
+         * position, so this one has to be looked up by name.
+         */
+        if (find_name(&scope->defined, name) != -1) {
+            fail_closures(scope->parent, name);
+            return BY_NAME;
+        }
+
+        if (scope->creator != NULL) {
+            Lookup result = capture(scope, name, &i);
+            if (result == FOUND) {
+                *depth = d;
+                *index = i;
+            }
+            return result;
+        }
+    }
+
+    return NOT_LOCAL;
+}
+
+
+/*!
+ * Records the lexical address of a variable reference, if the variable is
+ * bound in one of the enclosing scopes at a known position.
+ */
+void resolve_atom(Value *atom, Scope *scope) {
+    int depth, index;
+
+    atom->lex_depth = LEX_UNRESOLVED;
+    atom->lex_index = LEX_UNRESOLVED;
+
+    switch (lookup_name(scope, atom->string_val, &depth, &index)) {
+    case FOUND:
+        if (depth <= SHRT_MAX && index <= SHRT_MAX) {
+            atom->lex_depth = depth;
+            atom->lex_index = index;
+        }
+        break;
+
+    case NOT_LOCAL:
+        atom->lex_depth = LEX_GLOBAL;
+        break;
+
+    case BY_NAME:
+        break;
+    }
+}
+
+
+/*============================================================================
+ * Closure templates
+ */
+
+
+/*!
+ * Returns the id of a closure template with the specified captures, adding
+ * one if there isn't one already, or -1 if the template can't be added.
+ * Closures made from different lambda expressions often capture the same
+ * things, so templates are shared.
+ */
+int add_closure_template(int num_captures, const Capture *captures) {
+    ClosureTemplate *t;
+    int i, j;
+
+    for (i = 0; i < num_templates; i++) {
+        t = &templates[i];
+        if (t->num_captures != num_captures)
+            continue;
+
+        for (j = 0; j < num_captures; j++) {
+            if (t->captures[j].name != captures[j].name ||
+                t->captures[j].depth != captures[j].depth ||
+                t->captures[j].index != captures[j].index) {
+                break;
+            }
+        }
+        if (j == num_captures)
+            return i;
+    }
+
+    if (num_templates > SHRT_MAX)
+        return -1;
+
+    if (num_templates == templates_capacity) {
+        int capacity = templates_capacity ? 2 * templates_capacity : 64;
+        ClosureTemplate *new_templates;
+
+        new_templates = realloc(templates, capacity * sizeof(ClosureTemplate));
+        if (new_templates == NULL)
+            return -1;
+        templates = new_templates;
+        templates_capacity = capacity;
+    }
+
+    t = &templates[num_templates];
+    t->num_captures = num_captures;
+    t->captures = malloc((num_captures > 0 ? num_captures : 1) *
+                         sizeof(Capture));
+    if (t->captures == NULL)
+        return -1;
+    if (num_captures > 0)
+        memcpy(t->captures, captures, num_captures * sizeof(Capture));
+
+    return num_templates++;
+}
+
+
+/*! Returns the closure template with the specified id, or NULL. */
+const ClosureTemplate * get_closure_template(int id) {
+    if (id < 0 || id >= num_templates)
+        return NULL;
+
+    return &templates[id];
+}
+
+
+/*============================================================================
+ * The analysis
+ */
+
+
+/*!
+ * Finds the names that define may bind in the environment that expr is
+ * evaluated in, and adds them to the scope's defined names.  Bodies of nested
+ * lambdas and lets are skipped, since their defines go into their own
+ * environments.
+ */
+void collect_defines(Value *expr, Scope *scope) {
+    Value *op;
+
+    if (!is_pair(expr))
+        return;
+
+    op = car(expr);
+    if (is_symbol(op)) {
+        if (op->string_val == quote_symbol || op->string_val == lambda_symbol)
+            return;
+
+        if (op->string_val == define_symbol && is_pair(cdr(expr))) {
+            Value *target = cadr(expr);
+
+            if (is_pair(target)) {
+                /* (define (name . args) body ...) */
+                target = car(target);
+                if (is_symbol(target))
+                    pv_add_elem(&scope->defined, target->string_val);
+                return;
+            }
+
+            if (is_symbol(target))
+                pv_add_elem(&scope->defined, target->string_val);
+
+            for (expr = cddr(expr); is_pair(expr);
+                 expr = cdr(expr)) {
+                collect_defines(car(expr), scope);
+            }
+            return;
+        }
+
+        if (op->string_val == let_symbol && is_pair(cdr(expr))) {
+            /* Only the binding expressions are evaluated in this scope. */
+            Value *bindings = cadr(expr);
+
+            for ( ; is_pair(bindings); bindings = cdr(bindings)) {
+                Value *binding = car(bindings);
+                if (is_pair(binding) && is_pair(cdr(binding)))
+                    collect_defines(cadr(binding), scope);
+            }
+            return;
+        }
+    }
+
+    for ( ; is_pair(expr); expr = cdr(expr))
+        collect_defines(car(expr), scope);
+}
+
+
+/*! Analyzes the arguments and body of a lambda, in a new scope. */
+static void analyze_lambda_scope(Value *arg_spec, Value *body, Scope *scope) {
+    Scope child;
+
+    init_scope(&child, scope);
+
+    /* Same binding order as bind_arguments():  the named arguments first,
+     * then the name that collects the rest of the operands, if any.
+     */
+    while (is_pair(arg_spec)) {
+        add_name(&child, car(arg_spec));
+        arg_spec = cdr(arg_spec);
+    }
+    add_name(&child, arg_spec);
+
+    analyze_body(body, &child);
+    uninit_scope(&child);
+}
+
+
+/*!
+ * Analyzes the body of a lambda whose argument specification is arg_spec, and
+ * which is created in the specified scope.  keyword is the atom that starts
+ * the lambda's expression; it is marked if the lambda gets a closure record.
+ */
+void analyze_lambda(Value *keyword, Value *arg_spec, Value *body,
+                    Scope *scope) {
+    keyword->lex_depth = LEX_UNRESOLVED;
+    keyword->lex_index = LEX_UNRESOLVED;
+
+    /* Lambdas created in the global environment already have the shortest
+     * possible chain.
+     */
+    if (scope != NULL) {
+        Scope closure;
+        int id = -1;
+
+        init_scope(&closure, NULL);
+        closure.creator = scope;
+
+        analyze_lambda_scope(arg_spec, body, &closure);
+        if (!closure.failed)
+            id = add_closure_template(closure.names.size, closure.captures);
+        uninit_scope(&closure);
+
+        if (id != -1) {
+            keyword->lex_depth = LEX_CLOSURE;
+            keyword->lex_index = id;
+            return;
+        }
+    }
+
+    /* The body has to be analyzed again, as seeing the whole chain. */
+    analyze_lambda_scope(arg_spec, body, scope);
+}
+
+
+/*! Analyzes a let expression (let ((name expr) ...) body ...). */
+void analyze_let(Value *expr, Scope *scope) {
+    Value *bindings, *binding;
+    Scope child;
+
+    if (!is_pair(cdr(expr)))
+        return;
+
+    init_scope(&child, scope);
+
+    /* The binding expressions are evaluated in the enclosing scope, and the
+     * names are bound in the order they are listed.
+     */
+    for (bindings = cadr(expr); is_pair(bindings);
+         bindings = cdr(bindings)) {
+        binding = car(bindings);
+        if (is_pair(binding)) {
+            add_name(&child, car(binding));
+            if (is_pair(cdr(binding)))
+                analyze(cadr(binding), scope);
+        }
+    }
+
+    analyze_body(cddr(expr), &child);
+    uninit_scope(&child);
+}
+
+
+/*! Analyzes a sequence of expressions that are evaluated in a new scope. */
+void analyze_body(Value *body, Scope *scope) {
+    Value *iter;
+
+    for (iter = body; is_pair(iter); iter = cdr(iter))
+        collect_defines(car(iter), scope);
+
+    for (iter = body; is_pair(iter); iter = cdr(iter))
+        analyze(car(iter), scope);
+}
+
+
+/*! Analyzes an expression that is evaluated in the specified scope. */
+void analyze(Value *expr, Scope *scope) {
+    Value *op;
+
+    if (is_symbol(expr)) {
+        resolve_atom(expr, scope);
+        return;
+    }
+
+    if (!is_pair(expr))
+        return;
+
+    op = car(expr);
+    if (is_symbol(op)) {
+        if (op->string_val == quote_symbol)
+            return;
+
+        if (op->string_val == lambda_symbol) {
+            if (is_pair(cdr(expr)))
+                analyze_lambda(op, cadr(expr), cddr(expr), scope);
+            return;
+        }
+
+        if (op->string_val == let_symbol) {
+            analyze_let(expr, scope);
+            return;
+        }
+
+        if ((op->string_val == define_symbol || op->string_val == set_symbol)
+            && is_pair(cdr(expr))) {
+            Value *target = cadr(expr);
+
+            if (is_pair(target)) {
+                /* (define (name . args) body ...) */
+                analyze_lambda(op, cdr(target), cddr(expr), scope);
+                return;
+            }
+
+            /* The name being bound or set is not a reference; only the value
+             * expression needs analyzing.  set! still looks the name up, so
+             * a closure record it would have to see past can't be used.
+             */
+            if (op->string_val == set_symbol && is_symbol(target)) {
+                int depth, index;
+                lookup_name(scope, target->string_val, &depth, &index);
+            }
+
+            for (expr = cddr(expr); is_pair(expr);
+                 expr = cdr(expr)) {
+                analyze(car(expr), scope);
+            }
+            return;
+        }
+    }
+
+    /* Any other form or procedure call:  analyze every subexpression. */
+    for ( ; is_pair(expr); expr = cdr(expr))
+        analyze(car(expr), scope);
+}
+
+
+/*! Adds the target of every set! in expr to assigned_names. */
+static void collect_assigned(Value *expr) {
+    Value *op;
+
+    if (!is_pair(expr))
+        return;
+
+    op = car(expr);
+    if (is_symbol(op)) {
+        if (op->string_val == quote_symbol)
+            return;
+
+        if (op->string_val == set_symbol && is_symbol(cadr(expr)))
+            pv_add_elem(&assigned_names, cadr(expr)->string_val);
+    }
+
+    for ( ; is_pair(expr); expr = cdr(expr))
+        collect_assigned(car(expr));
+}
+
+
+/*!
+ * Annotates the local variable references in a top-level expression with their
+ * lexical addresses.  The expression is evaluated in the global environment,
+ * which is not addressed, so the analysis starts with no enclosing scope.
+ */
+void resolve_lexical_addresses(Value *expr) {
+    if (quote_symbol == NULL) {
+        quote_symbol = intern_symbol("quote");
+        lambda_symbol = intern_symbol("lambda");
+        define_symbol = intern_symbol("define");
+        let_symbol = intern_symbol("let");
+        set_symbol = intern_symbol("set!");
+    }
+
+    collect_assigned(expr);
+    analyze(expr, NULL);
+    pv_truncate(&assigned_names, 0);
+}
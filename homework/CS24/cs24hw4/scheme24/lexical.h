@@ -0,0 +1,31 @@
+#ifndef LEXICAL_H
+#define LEXICAL_H
+
+#include "types.h"
+
+
+/*! One variable captured by a flat closure record. */
+typedef struct Capture {
+    char *name;             /*!< The variable's name (an interned symbol). */
+    short depth;            /*!< Its lexical address where the lambda is made. */
+    short index;
+} Capture;
+
+
+/*!
+ * The variables a closure record holds, in binding order.  Templates are
+ * shared by lambdas that capture the same variables, and live forever.
+ */
+typedef struct ClosureTemplate {
+    int num_captures;
+    Capture *captures;
+} ClosureTemplate;
+
+
+void resolve_lexical_addresses(Value *expr);
+
+int add_closure_template(int num_captures, const Capture *captures);
+const ClosureTemplate * get_closure_template(int id);
+
+
+#endif /* LEXICAL_H */
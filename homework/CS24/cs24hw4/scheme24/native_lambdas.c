@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -7,110 +8,117 @@
 #include "native_lambdas.h"
 #include "values.h"
 #include "repl.h"                /* for exec_file */
+#include "alloc.h"               /* for the gc- functions */
+#include "image.h"
 
 
 /*!
- * Performs equality check between two Value objects containing floating-point
- * numbers.  This function is used as an argument to do_comparison().
+ * Returns the number held by v, which may be a fixnum or a float, as a double.
+ * A double holds every float exactly, and every fixnum close enough, so mixed
+ * comparisons don't lose precision to a conversion.
+ */
+static double to_double(Value *v) {
+    return is_fixnum(v) ? (double) get_fixnum(v) : get_float(v);
+}
+
+
+/*!
+ * Performs equality check between two Value objects containing numbers.  This
+ * function is used as an argument to do_comparison().
  */
 int fn_equal(Value *v1, Value *v2) {
-    assert(v1 != NULL);
-    assert(is_float(v1));
-    assert(v2 != NULL);
-    assert(is_float(v2));
+    assert(is_number(v1));
+    assert(is_number(v2));
 
-    return (v1->float_val == v2->float_val);
+    if (is_fixnum(v1) && is_fixnum(v2))
+        return v1 == v2;
+
+    return (to_double(v1) == to_double(v2));
 }
 
 /*!
- * Performs less-than check between two Value objects containing floating-point
- * numbers.  This function is used as an argument to do_comparison().
+ * Performs less-than check between two Value objects containing numbers.  This
+ * function is used as an argument to do_comparison().
  */
 int fn_less_than(Value *v1, Value *v2) {
-    assert(v1 != NULL);
-    assert(is_float(v1));
-    assert(v2 != NULL);
-    assert(is_float(v2));
+    assert(is_number(v1));
+    assert(is_number(v2));
+
+    if (is_fixnum(v1) && is_fixnum(v2))
+        return get_fixnum(v1) < get_fixnum(v2);
 
-    return (v1->float_val < v2->float_val);
+    return (to_double(v1) < to_double(v2));
 }
 
 /*!
- * Performs greater-than check between two Value objects containing
- * floating-point numbers.  This function is used as an argument to
- * do_comparison().
+ * Performs greater-than check between two Value objects containing numbers.
+ * This function is used as an argument to do_comparison().
  */
 int fn_greater_than(Value *v1, Value *v2) {
-    assert(v1 != NULL);
-    assert(is_float(v1));
-    assert(v2 != NULL);
-    assert(is_float(v2));
+    assert(is_number(v1));
+    assert(is_number(v2));
+
+    if (is_fixnum(v1) && is_fixnum(v2))
+        return get_fixnum(v1) > get_fixnum(v2);
 
-    return (v1->float_val > v2->float_val);
+    return (to_double(v1) > to_double(v2));
 }
 
 /*!
  * Performs less-or-equal (i.e. at-most) check between two Value objects
- * containing floating-point numbers.  This function is used as an argument to
+ * containing numbers.  This function is used as an argument to
  * do_comparison().
  */
 int fn_less_equal(Value *v1, Value *v2) {
-    assert(v1 != NULL);
-    assert(is_float(v1));
-    assert(v2 != NULL);
-    assert(is_float(v2));
+    assert(is_number(v1));
+    assert(is_number(v2));
 
-    return (v1->float_val <= v2->float_val);
+    if (is_fixnum(v1) && is_fixnum(v2))
+        return get_fixnum(v1) <= get_fixnum(v2);
+
+    return (to_double(v1) <= to_double(v2));
 }
 
 /*!
  * Performs greater-or-equal (i.e. at-least) check between two Value objects
- * containing floating-point numbers.  This function is used as an argument to
+ * containing numbers.  This function is used as an argument to
  * do_comparison().
  */
 int fn_greater_equal(Value *v1, Value *v2) {
-    assert(v1 != NULL);
-    assert(is_float(v1));
-    assert(v2 != NULL);
-    assert(is_float(v2));
+    assert(is_number(v1));
+    assert(is_number(v2));
+
+    if (is_fixnum(v1) && is_fixnum(v2))
+        return get_fixnum(v1) >= get_fixnum(v2);
 
-    return (v1->float_val >= v2->float_val);
+    return (to_double(v1) >= to_double(v2));
 }
 
 
 /*!
  * This helper function is used to implement the Scheme built-in numeric
- * comparison functions.  It can handle two or more floating-point arguments,
+ * comparison functions.  It can handle two or more numeric arguments,
  * and applies the specified comparison function to successive pairs of
  * arguments as long as the comparison result is true.
  */
-Value * do_comparison(int num_args, Value *args,
+Value * do_comparison(int num_args, Value **argv,
                       int (*compare)(Value *, Value *)) {
-    Value *v1, *v2;
+    int i;
 
     if (num_args < 2)
         return make_error("comparison requires at least two arguments");
 
-    v2 = get_car(args);
-    if (!is_float(v2))
+    if (!is_number(argv[0]))
         return make_error("comparison requires numeric values");
 
-    do {
-        v1 = v2;
-        args = get_cdr(args);
-        v2 = get_car(args);
-
-        if (!is_float(v2))
+    for (i = 1; i < num_args; i++) {
+        if (!is_number(argv[i]))
             return make_error("comparison requires numeric values");
 
         /* If these values aren't in order, we can stop early! */
-        if (!compare(v1, v2))
+        if (!compare(argv[i - 1], argv[i]))
             return make_false();
     }
-    while (!is_nil(get_cdr(args)));
-
-    /* Make sure arguments-list was constructed properly by the evaluator. */
-    assert(is_nil(get_cdr(args)));
 
     /* If we made it through all the values then they are in the proper order,
      * and we can return #t.
@@ -123,125 +131,168 @@ Value * do_comparison(int num_args, Value *args,
  * This function implements the Scheme built-in function "=" for numeric
  * equality comparisons.
  */
-Value * scheme_numeric_equals(int num_args, Value *args) {
-    return do_comparison(num_args, args, fn_equal);
+Value * scheme_numeric_equals(int num_args, Value **argv) {
+    return do_comparison(num_args, argv, fn_equal);
 }
 
 /*!
  * This function implements the Scheme built-in function "&lt;" for numeric
  * less-than comparisons.
  */
-Value * scheme_numeric_less_than(int num_args, Value *args) {
-    return do_comparison(num_args, args, fn_less_than);
+Value * scheme_numeric_less_than(int num_args, Value **argv) {
+    return do_comparison(num_args, argv, fn_less_than);
 }
 
 /*!
  * This function implements the Scheme built-in function "&gt;" for numeric
  * greater-than comparisons.
  */
-Value * scheme_numeric_greater_than(int num_args, Value *args) {
-    return do_comparison(num_args, args, fn_greater_than);
+Value * scheme_numeric_greater_than(int num_args, Value **argv) {
+    return do_comparison(num_args, argv, fn_greater_than);
 }
 
 /*!
  * This function implements the Scheme built-in function "&lt;=" for numeric
  * less-or-equal (i.e. "at most") comparisons.
  */
-Value * scheme_numeric_less_equal(int num_args, Value *args) {
-    return do_comparison(num_args, args, fn_less_equal);
+Value * scheme_numeric_less_equal(int num_args, Value **argv) {
+    return do_comparison(num_args, argv, fn_less_equal);
 }
 
 /*!
  * This function implements the Scheme built-in function "&gt;=" for numeric
  * greater-or-equal (i.e. "at least") comparisons.
  */
-Value * scheme_numeric_greater_equal(int num_args, Value *args) {
-    return do_comparison(num_args, args, fn_greater_equal);
+Value * scheme_numeric_greater_equal(int num_args, Value **argv) {
+    return do_comparison(num_args, argv, fn_greater_equal);
 }
 
 
-Value * type_predicate_helper(const char *name, int num_args, Value *args,
+Value * type_predicate_helper(const char *name, int num_args, Value **argv,
         int (*predicate)(Value *)) {
 
     if (num_args != 1)
         return make_error("%s takes exactly one argument", name);
 
-    assert(is_cons_pair(args));
-    return make_bool(predicate(get_car(args)));
+    return make_bool(predicate(argv[0]));
+}
+
+
+/*!
+ *
+ */
+Value * scheme_is_boolean(int num_args, Value **argv) {
+    return type_predicate_helper("boolean?", num_args, argv, is_bool);
+}
+
+
+/*!
+ *
+ */
+Value * scheme_is_number(int num_args, Value **argv) {
+    return type_predicate_helper("number?", num_args, argv, is_number);
+}
+
+
+/*!
+ *
+ */
+Value * scheme_is_pair(int num_args, Value **argv) {
+    return type_predicate_helper("pair?", num_args, argv, is_cons_pair);
 }
 
 
 /*!
  *
  */
-Value * scheme_is_boolean(int num_args, Value *args) {
-    return type_predicate_helper("boolean?", num_args, args, is_bool);
+Value * scheme_is_procedure(int num_args, Value **argv) {
+    return type_predicate_helper("procedure?", num_args, argv, is_lambda);
 }
 
 
 /*!
  *
  */
-Value * scheme_is_number(int num_args, Value *args) {
-    return type_predicate_helper("number?", num_args, args, is_float);
+Value * scheme_is_string(int num_args, Value **argv) {
+    return type_predicate_helper("string?", num_args, argv, is_string);
 }
 
 
 /*!
  *
  */
-Value * scheme_is_pair(int num_args, Value *args) {
-    return type_predicate_helper("pair?", num_args, args, is_cons_pair);
+Value * scheme_is_symbol(int num_args, Value **argv) {
+    return type_predicate_helper("symbol?", num_args, argv, is_atom);
 }
 
 
 /*!
  *
  */
-Value * scheme_is_procedure(int num_args, Value *args) {
-    return type_predicate_helper("procedure?", num_args, args, is_lambda);
+Value * scheme_is_vector(int num_args, Value **argv) {
+    return type_predicate_helper("vector?", num_args, argv, is_vector);
 }
 
 
 /*!
  *
  */
-Value * scheme_is_string(int num_args, Value *args) {
-    return type_predicate_helper("string?", num_args, args, is_string);
+Value * scheme_is_hash_table(int num_args, Value **argv) {
+    return type_predicate_helper("hash-table?", num_args, argv, is_hash_table);
 }
 
 
 /*!
  *
  */
-Value * scheme_is_symbol(int num_args, Value *args) {
-    return type_predicate_helper("symbol?", num_args, args, is_atom);
+Value * scheme_is_string_builder(int num_args, Value **argv) {
+    return type_predicate_helper("string-builder?", num_args, argv,
+                                 is_string_builder);
 }
 
 
 
+/*
+ * The arithmetic functions keep an exact integer result for as long as every
+ * operand is a fixnum and the result stays in the fixnum range.  Once a float
+ * operand turns up, or the result overflows, the rest of the computation is
+ * done with floats.
+ */
+
+
 /*!
  * This function implements the Scheme built-in function "+" for numeric
  * addition.
  */
-Value * scheme_add(int num_args, Value *args) {
+Value * scheme_add(int num_args, Value **argv) {
     Value *v;
+    intptr_t iresult = 0;
     float result = 0;
-
-    while (is_cons_pair(args)) {
-        v = get_car(args);
-        if (!is_float(v))
+    int exact = 1, i;
+
+    for (i = 0; i < num_args; i++) {
+        v = argv[i];
+        if (exact && is_fixnum(v)) {
+            /* The sum of two fixnums always fits in an intptr_t. */
+            iresult += get_fixnum(v);
+            if (iresult < FIXNUM_MIN || iresult > FIXNUM_MAX) {
+                result = (float) iresult;
+                exact = 0;
+            }
+        }
+        else if (is_number(v)) {
+            if (exact) {
+                result = (float) iresult;
+                exact = 0;
+            }
+            result += get_float(v);
+        }
+        else {
             return make_error("invalid argument to +");
-
-        result += v->float_val;
-
-        args = get_cdr(args);
+        }
     }
 
-    if (!is_nil(args))
-        return make_error("invalid argument to +");
-
-    return make_float(result);
+    return exact ? make_fixnum(iresult) : make_float(result);
 }
 
 
@@ -249,41 +300,56 @@ Value * scheme_add(int num_args, Value *args) {
  * This function implements the Scheme built-in function "-" for numeric
  * subtraction.
  */
-Value * scheme_sub(int num_args, Value *args) {
+Value * scheme_sub(int num_args, Value **argv) {
     Value *v;
-    float result;
+    intptr_t iresult = 0;
+    float result = 0;
+    int exact, i;
 
     if (num_args == 0)
         return make_error("- requires at least one argument");
 
-    assert(is_cons_pair(args));
-    v = get_car(args);
-    if (!is_float(v))
+    v = argv[0];
+    if (!is_number(v))
         return make_error("invalid argument to -");
 
-    result = v->float_val;
+    exact = is_fixnum(v);
+    if (exact)
+        iresult = get_fixnum(v);
+    else
+        result = get_float(v);
 
-    args = get_cdr(args);
-    if (is_nil(args)) {
+    if (num_args == 1) {
         /* - functions as unary negate, when given one argument. */
+        if (exact)
+            return make_integer(-iresult);
         result = -result;
     }
     else {
-        while (is_cons_pair(args)) {
-            v = get_car(args);
-            if (!is_float(v))
+        for (i = 1; i < num_args; i++) {
+            v = argv[i];
+            if (exact && is_fixnum(v)) {
+                /* The difference of two fixnums always fits, too. */
+                iresult -= get_fixnum(v);
+                if (iresult < FIXNUM_MIN || iresult > FIXNUM_MAX) {
+                    result = (float) iresult;
+                    exact = 0;
+                }
+            }
+            else if (is_number(v)) {
+                if (exact) {
+                    result = (float) iresult;
+                    exact = 0;
+                }
+                result -= get_float(v);
+            }
+            else {
                 return make_error("invalid argument to -");
-
-            result -= v->float_val;
-
-            args = get_cdr(args);
+            }
         }
-
-        if (!is_nil(args))
-            return make_error("invalid argument to -");
     }
 
-    return make_float(result);
+    return exact ? make_fixnum(iresult) : make_float(result);
 }
 
 
@@ -291,73 +357,111 @@ Value * scheme_sub(int num_args, Value *args) {
  * This function implements the Scheme built-in function "*" for numeric
  * multiplication.
  */
-Value * scheme_mul(int num_args, Value *args) {
+Value * scheme_mul(int num_args, Value **argv) {
     Value *v;
+    intptr_t iresult = 1, n;
+    double product;
     float result = 1;
+    int exact = 1, i;
 
-    while (is_cons_pair(args)) {
-        v = get_car(args);
-        if (!is_float(v))
+    for (i = 0; i < num_args; i++) {
+        v = argv[i];
+        if (exact && is_fixnum(v)) {
+            /* The magnitude is checked in floating point first, so that the
+             * exact product is only computed when it can't overflow.
+             */
+            n = get_fixnum(v);
+            product = (double) iresult * n;
+            if (fabs(product) <= (double) FIXNUM_MAX)
+                iresult *= n;
+
+            if (fabs(product) > (double) FIXNUM_MAX ||
+                iresult < FIXNUM_MIN || iresult > FIXNUM_MAX) {
+                result = (float) product;
+                exact = 0;
+            }
+        }
+        else if (is_number(v)) {
+            if (exact) {
+                result = (float) iresult;
+                exact = 0;
+            }
+            result *= get_float(v);
+        }
+        else {
             return make_error("invalid argument to *");
-
-        result *= v->float_val;
-
-        args = get_cdr(args);
+        }
     }
 
-    if (!is_nil(args))
-        return make_error("invalid argument to *");
-
-    return make_float(result);
+    return exact ? make_fixnum(iresult) : make_float(result);
 }
 
 
 /*!
  * This function implements the Scheme built-in function "/" for numeric
- * division.
+ * division.  Dividing one fixnum by another gives a fixnum when the division
+ * is exact, and a float otherwise.
  */
-Value * scheme_div(int num_args, Value *args) {
+Value * scheme_div(int num_args, Value **argv) {
     Value *v;
-    float result;
+    intptr_t iresult = 0, n;
+    float result = 0;
+    int exact, i;
 
     if (num_args == 0)
         return make_error("/ requires at least one argument");
 
-    assert(is_cons_pair(args));
-    v = get_car(args);
-    if (!is_float(v))
+    v = argv[0];
+    if (!is_number(v))
         return make_error("invalid argument to /");
 
-    result = v->float_val;
+    exact = is_fixnum(v);
+    if (exact)
+        iresult = get_fixnum(v);
+    else
+        result = get_float(v);
 
-    args = get_cdr(args);
-    if (is_nil(args)) {
+    if (num_args == 1) {
         /* / functions as multiplicative inverse, when given one argument. */
-        
-        if (result == 0)
+
+        if (exact ? iresult == 0 : result == 0)
             return make_error("divide by zero");
 
-        result = 1.0 / result;
+        if (exact && (iresult == 1 || iresult == -1))
+            return v;
+        if (exact)
+            result = (float) iresult;
+
+        return make_float(1.0 / result);
     }
-    else {
-        while (is_cons_pair(args)) {
-            v = get_car(args);
-            if (!is_float(v))
-                return make_error("invalid argument to /");
 
-            if (v->float_val == 0)
-                return make_error("divide by zero");
-        
-            result /= v->float_val;
+    for (i = 1; i < num_args; i++) {
+        v = argv[i];
+        if (!is_number(v))
+            return make_error("invalid argument to /");
 
-            args = get_cdr(args);
-        }
+        if (is_fixnum(v) ? get_fixnum(v) == 0 : get_float(v) == 0)
+            return make_error("divide by zero");
 
-        if (!is_nil(args))
-            return make_error("invalid argument to /");
+        if (exact && is_fixnum(v) && iresult % get_fixnum(v) == 0) {
+            /* Only FIXNUM_MIN / -1 can leave the fixnum range. */
+            n = get_fixnum(v);
+            iresult /= n;
+            if (iresult > FIXNUM_MAX) {
+                result = (float) iresult;
+                exact = 0;
+            }
+        }
+        else {
+            if (exact) {
+                result = (float) iresult;
+                exact = 0;
+            }
+            result /= get_float(v);
+        }
     }
 
-    return make_float(result);
+    return exact ? make_fixnum(iresult) : make_float(result);
 }
 
 
@@ -365,11 +469,11 @@ Value * scheme_div(int num_args, Value *args) {
  * This function implements the Scheme built-in function "cons", which creates a
  * new cons-pair with the specified contents.
  */
-Value * scheme_cons(int num_args, Value *args) {
+Value * scheme_cons(int num_args, Value **argv) {
     if (num_args != 2)
         return make_error("cons takes exactly two arguments");
 
-    return make_cons(get_car(args), get_cadr(args));
+    return make_cons(argv[0], argv[1]);
 }
 
 
@@ -377,13 +481,13 @@ Value * scheme_cons(int num_args, Value *args) {
  * This function implements the Scheme built-in function "car", which returns
  * the first value in a cons-pair.
  */
-Value * scheme_car(int num_args, Value *args) {
+Value * scheme_car(int num_args, Value **argv) {
     Value *v;
 
     if (num_args != 1)
         return make_error("car takes exactly one argument");
 
-    v = get_car(args);   /* Extract the first (and only) argument to car. */
+    v = argv[0];   /* Extract the first (and only) argument to car. */
     if (!is_cons_pair(v))
         return make_error("argument to car must be a cons pair");
 
@@ -395,13 +499,13 @@ Value * scheme_car(int num_args, Value *args) {
  * This function implements the Scheme built-in function "cdr", which returns
  * the second value in a cons-pair.
  */
-Value * scheme_cdr(int num_args, Value *args) {
+Value * scheme_cdr(int num_args, Value **argv) {
     Value *v;
 
     if (num_args != 1)
         return make_error("cdr takes exactly one argument");
 
-    v = get_car(args);   /* Extract the first (and only) argument to cdr. */
+    v = argv[0];   /* Extract the first (and only) argument to cdr. */
     if (!is_cons_pair(v))
         return make_error("argument to cdr must be a cons pair");
 
@@ -413,9 +517,8 @@ Value * scheme_cdr(int num_args, Value *args) {
  * This function implements the Scheme built-in function "list", which returns
  * a list containing its arguments.
  */
-Value * scheme_list(int num_args, Value *args) {
-    /* Easy implementation!!! */
-    return args;
+Value * scheme_list(int num_args, Value **argv) {
+    return make_list(num_args, argv);
 }
 
 
@@ -423,19 +526,19 @@ Value * scheme_list(int num_args, Value *args) {
  * This function implements the Scheme built-in function "length", which returns
  * the length of a proper list.
  */
-Value * scheme_length(int num_args, Value *args) {
+Value * scheme_length(int num_args, Value **argv) {
     int n;
     
     if (num_args != 1)
         return make_error("length requires exactly one argument");
 
     /* Function returns -1 if argument isn't a proper list. */
-    n = list_length(get_car(args));
+    n = list_length(argv[0]);
     
     if (n == -1)
         return make_error("argument to length must be a proper list");
     
-    return make_float(n);
+    return make_fixnum(n);
 }
 
 
@@ -443,25 +546,29 @@ Value * scheme_length(int num_args, Value *args) {
  * This function implements the Scheme built-in function "eq?", which performs
  * an object-identity check between Scheme values.
  */
-Value * scheme_eq(int num_args, Value *args) {
+Value * scheme_eq(int num_args, Value **argv) {
     Value *v1, *v2;
     int result;
 
     if (num_args != 2)
         return make_error("eq? requires exactly two arguments");
 
-    v1 = get_car(args);
-    v2 = get_car(get_cdr(args));
+    v1 = argv[0];
+    v2 = argv[1];
 
-    if (v1->type != v2->type)
+    if (get_type(v1) != get_type(v2))
         return make_false();
 
-    switch (v1->type) {
+    switch (get_type(v1)) {
     case T_Nil:
         result = 1;
         break;
 
     case T_Atom:
+        /* Atom names are interned, so equal names are the same pointer. */
+        result = (v1->string_val == v2->string_val);
+        break;
+
     case T_String:
         result = (strcmp(v1->string_val, v2->string_val) == 0);
         break;
@@ -473,11 +580,18 @@ Value * scheme_eq(int num_args, Value *args) {
         break;
 
     case T_Float:
-        result = (v1->float_val == v2->float_val);
+        result = (get_float(v1) == get_float(v2));
+        break;
+
+    case T_Fixnum:
+        result = (v1 == v2);
         break;
 
     case T_ConsPair:
     case T_Lambda:
+    case T_Vector:
+    case T_HashTable:
+    case T_StringBuilder:
         result = (v1 == v2);
         break;
     default:
@@ -496,15 +610,19 @@ Value * scheme_eq(int num_args, Value *args) {
 int fn_value_equality(Value *v1, Value *v2) {
     int result;
 
-    if (v1->type != v2->type)
+    if (get_type(v1) != get_type(v2))
         return 0;
 
-    switch (v1->type) {
+    switch (get_type(v1)) {
     case T_Nil:
         result = 1;
         break;
 
     case T_Atom:
+        /* Atom names are interned, so equal names are the same pointer. */
+        result = (v1->string_val == v2->string_val);
+        break;
+
     case T_String:
         result = (strcmp(v1->string_val, v2->string_val) == 0);
         break;
@@ -516,7 +634,11 @@ int fn_value_equality(Value *v1, Value *v2) {
         break;
 
     case T_Float:
-        result = (v1->float_val == v2->float_val);
+        result = (get_float(v1) == get_float(v2));
+        break;
+
+    case T_Fixnum:
+        result = (v1 == v2);
         break;
 
     case T_ConsPair:
@@ -530,6 +652,27 @@ int fn_value_equality(Value *v1, Value *v2) {
 
         break;
 
+    case T_Vector:
+        if (v1 == v2) {
+            result = 1;
+        }
+        else {
+            int i, n = v1->vector_val.length;
+
+            result = (n == v2->vector_val.length);
+            for (i = 0; result && i < n; i++) {
+                result = fn_value_equality(v1->vector_val.elems[i],
+                                           v2->vector_val.elems[i]);
+            }
+        }
+
+        break;
+
+    case T_HashTable:
+    case T_StringBuilder:
+        result = (v1 == v2);
+        break;
+
     case T_Lambda:
         result = 0;
         if (v1 == v2) {  /* Just in case we are lucky, do this fast. */
@@ -566,14 +709,14 @@ int fn_value_equality(Value *v1, Value *v2) {
  * This function implements the Scheme built-in function "equal?", which
  * performs a value-equality check between Scheme values.
  */
-Value * scheme_equal(int num_args, Value *args) {
+Value * scheme_equal(int num_args, Value **argv) {
     Value *v1, *v2;
 
     if (num_args != 2)
         return make_error("eq? requires exactly two arguments");
 
-    v1 = get_car(args);
-    v2 = get_car(get_cdr(args));
+    v1 = argv[0];
+    v2 = argv[1];
 
     return make_bool(fn_value_equality(v1, v2));
 }
@@ -583,19 +726,19 @@ Value * scheme_equal(int num_args, Value *args) {
  * This function implements the Scheme built-in function "set-car!", which
  * performs in-place mutation of the first value in a cons-pair.
  */
-Value * scheme_set_car(int num_args, Value *args) {
+Value * scheme_set_car(int num_args, Value **argv) {
     Value *target, *val;
 
     if (num_args != 2)
         return make_error("set-car! requires exactly two arguments");
 
-    target = get_car(args);
+    target = argv[0];
     return_if_error(target);
 
     if (!is_cons_pair(target))
         return make_error("first argument to set-car! must be a cons pair");
 
-    val = get_car(get_cdr(args));
+    val = argv[1];
     return_if_error(val);
 
     set_car(target, val);
@@ -608,19 +751,19 @@ Value * scheme_set_car(int num_args, Value *args) {
  * This function implements the Scheme built-in function "set-cdr!", which
  * performs in-place mutation of the second value in a cons-pair.
  */
-Value * scheme_set_cdr(int num_args, Value *args) {
+Value * scheme_set_cdr(int num_args, Value **argv) {
     Value *target, *val;
 
     if (num_args != 2)
         return make_error("set-cdr! requires exactly two arguments");
 
-    target = get_car(args);
+    target = argv[0];
     return_if_error(target);
 
     if (!is_cons_pair(target))
         return make_error("first argument to set-cdr! must be a cons pair");
 
-    val = get_car(get_cdr(args));
+    val = argv[1];
     return_if_error(val);
 
     set_cdr(target, val);
@@ -629,20 +772,243 @@ Value * scheme_set_cdr(int num_args, Value *args) {
 }
 
 
-Value * scheme_display(int num_args, Value *args) {
+/*!
+ * Returns the integer that v holds, if v is a number that can index something
+ * with the specified length; otherwise returns -1.
+ */
+static int get_index(Value *v, int length) {
+    float f;
 
-    if (num_args == 0) {
-        printf("\n");
-    }
-    else {
-        while (!is_nil(args)) {
-            Value *v = get_car(args);
-            print_value(stdout, v);
-            args = get_cdr(args);
-        }
-        printf("\n");
+    if (is_fixnum(v)) {
+        intptr_t n = get_fixnum(v);
+        return (n >= 0 && n < length) ? (int) n : -1;
     }
-    
+
+    if (!is_float(v))
+        return -1;
+
+    f = get_float(v);
+    if (f < 0 || f >= length || f != (int) f)
+        return -1;
+
+    return (int) f;
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "make-vector", which
+ * creates a vector of the specified length.  Every element is set to the
+ * optional second argument, or to the empty list if it isn't given.
+ */
+Value * scheme_make_vector(int num_args, Value **argv) {
+    Value *length, *fill;
+    float n;
+
+    if (num_args != 1 && num_args != 2)
+        return make_error("make-vector takes one or two arguments");
+
+    length = argv[0];
+    if (!is_number(length))
+        return make_error("length given to make-vector must be a number");
+
+    n = get_float(length);
+    if (n < 0 || n > INT_MAX || n != (int) n)
+        return make_error("length given to make-vector must be a whole number");
+
+    fill = (num_args == 2) ? argv[1] : make_nil();
+    return make_vector((int) n, fill);
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "vector", which
+ * returns a vector containing its arguments.
+ */
+Value * scheme_vector(int num_args, Value **argv) {
+    Value *vector;
+    int i;
+
+    vector = make_vector(num_args, make_nil());
+    return_if_error(vector);
+
+    for (i = 0; i < num_args; i++)
+        vector->vector_val.elems[i] = argv[i];
+
+    return vector;
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "vector-ref", which
+ * returns the element of a vector at an index.
+ */
+Value * scheme_vector_ref(int num_args, Value **argv) {
+    Value *vector;
+    int i;
+
+    if (num_args != 2)
+        return make_error("vector-ref requires exactly two arguments");
+
+    vector = argv[0];
+    if (!is_vector(vector))
+        return make_error("first argument to vector-ref must be a vector");
+
+    i = get_index(argv[1], vector->vector_val.length);
+    if (i == -1)
+        return make_error("vector-ref index is out of range");
+
+    return vector->vector_val.elems[i];
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "vector-set!", which
+ * performs in-place mutation of the element of a vector at an index.
+ */
+Value * scheme_vector_set(int num_args, Value **argv) {
+    Value *vector, *val;
+    int i;
+
+    if (num_args != 3)
+        return make_error("vector-set! requires exactly three arguments");
+
+    vector = argv[0];
+    if (!is_vector(vector))
+        return make_error("first argument to vector-set! must be a vector");
+
+    i = get_index(argv[1], vector->vector_val.length);
+    if (i == -1)
+        return make_error("vector-set! index is out of range");
+
+    val = argv[2];
+    return_if_error(val);
+
+    vector_set(vector, i, val);
+
+    return val;
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "vector-length", which
+ * returns the number of elements in a vector.
+ */
+Value * scheme_vector_length(int num_args, Value **argv) {
+    Value *vector;
+
+    if (num_args != 1)
+        return make_error("vector-length requires exactly one argument");
+
+    vector = argv[0];
+    if (!is_vector(vector))
+        return make_error("argument to vector-length must be a vector");
+
+    return make_fixnum(vector->vector_val.length);
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "make-hash-table",
+ * which creates a new, empty hash table.  Keys are compared as eq? compares
+ * them.
+ */
+Value * scheme_make_hash_table(int num_args, Value **argv) {
+    if (num_args != 0)
+        return make_error("make-hash-table takes zero arguments");
+
+    return make_hash_table();
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "hash-table-ref",
+ * which returns the value a hash table maps a key to.  If the table has no
+ * entry for the key, the optional third argument is returned instead, or an
+ * error if it isn't given.
+ */
+Value * scheme_hash_table_ref(int num_args, Value **argv) {
+    Value *table, *key, *val;
+
+    if (num_args != 2 && num_args != 3)
+        return make_error("hash-table-ref takes two or three arguments");
+
+    table = argv[0];
+    if (!is_hash_table(table))
+        return make_error("first argument to hash-table-ref must be a hash table");
+
+    key = argv[1];
+    val = hash_table_get(table, key);
+    if (val != NULL)
+        return val;
+
+    if (num_args == 3)
+        return argv[2];
+
+    return make_error("hash-table-ref:  key not found");
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "hash-table-set!",
+ * which maps a key to a value in a hash table, replacing any value the key
+ * was mapped to before.
+ */
+Value * scheme_hash_table_set(int num_args, Value **argv) {
+    Value *table, *key, *val;
+
+    if (num_args != 3)
+        return make_error("hash-table-set! requires exactly three arguments");
+
+    table = argv[0];
+    if (!is_hash_table(table))
+        return make_error("first argument to hash-table-set! must be a hash table");
+
+    key = argv[1];
+    return_if_error(key);
+
+    val = argv[2];
+    return_if_error(val);
+
+    if (!hash_table_set(table, key, val))
+        return make_error("out of memory growing a hash table");
+
+    return val;
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "hash-table-count",
+ * which returns the number of keys in a hash table.
+ */
+Value * scheme_hash_table_count(int num_args, Value **argv) {
+    Value *table;
+
+    if (num_args != 1)
+        return make_error("hash-table-count requires exactly one argument");
+
+    table = argv[0];
+    if (!is_hash_table(table))
+        return make_error("argument to hash-table-count must be a hash table");
+
+    return make_fixnum(table->table_val->count);
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "display", which
+ * prints its arguments one after another, followed by a newline.  The whole
+ * line is formatted into a buffer and written at once.
+ */
+Value * scheme_display(int num_args, Value **argv) {
+    static StringBuffer line = STRING_BUFFER_STATIC_INIT;
+    int i;
+
+    sb_clear(&line);
+    for (i = 0; i < num_args; i++)
+        format_value(&line, argv[i]);
+    sb_append_char(&line, '\n');
+    sb_write(&line, stdout);
+
     return NULL;
 }
 
@@ -651,13 +1017,13 @@ Value * scheme_display(int num_args, Value *args) {
  * This function generates an error result from a single string argument
  * specifying the error message.
  */
-Value * scheme_error(int num_args, Value *args) {
+Value * scheme_error(int num_args, Value **argv) {
     Value *msg;
 
     if (num_args != 1)
         return make_error("error currently only supports one argument");
 
-    msg = get_car(args);
+    msg = argv[0];
     return_if_error(msg);
 
     if (!is_string(msg))
@@ -667,12 +1033,145 @@ Value * scheme_error(int num_args, Value *args) {
 }
 
 
+/*!
+ * This function implements the Scheme built-in function "string-append", which
+ * returns a new string holding the contents of its string arguments in order.
+ */
+Value * scheme_string_append(int num_args, Value **argv) {
+    Value *result;
+    size_t length = 0;
+    char *buf, *p;
+    int i;
+
+    for (i = 0; i < num_args; i++) {
+        if (!is_string(argv[i]))
+            return make_error("arguments to string-append must be strings");
+        length += strlen(argv[i]->string_val);
+    }
+
+    buf = malloc(length + 1);
+    if (buf == NULL)
+        return make_error("out of memory appending strings");
+
+    p = buf;
+    for (i = 0; i < num_args; i++) {
+        size_t n = strlen(argv[i]->string_val);
+        memcpy(p, argv[i]->string_val, n);
+        p += n;
+    }
+    *p = '\0';
+
+    result = make_string(buf);
+    free(buf);
+    return result;
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "number->string",
+ * which returns a number written out the same way the REPL prints it.
+ */
+Value * scheme_number_to_string(int num_args, Value **argv) {
+    Value *v;
+    char buf[32];
+
+    if (num_args != 1)
+        return make_error("number->string requires exactly one argument");
+
+    v = argv[0];
+    if (!is_number(v))
+        return make_error("argument to number->string must be a number");
+
+    if (is_fixnum(v))
+        snprintf(buf, sizeof(buf), "%ld", (long) get_fixnum(v));
+    else
+        snprintf(buf, sizeof(buf), "%g", get_float(v));
+
+    return make_string(buf);
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "make-string-builder",
+ * which creates a new, empty string builder.  A string builder collects text
+ * with string-builder-append!, without making a new string each time the way
+ * string-append does.
+ */
+Value * scheme_make_string_builder(int num_args, Value **argv) {
+    if (num_args != 0)
+        return make_error("make-string-builder takes zero arguments");
+
+    return make_string_builder();
+}
+
+
+/*!
+ * This function implements the Scheme built-in function
+ * "string-builder-append!", which appends the rest of its arguments to a
+ * string builder.  Strings are appended as they are, and any other value the
+ * same way display would print it.  The builder is returned.
+ */
+Value * scheme_string_builder_append(int num_args, Value **argv) {
+    Value *builder, *result;
+    size_t capacity;
+    int i;
+
+    if (num_args < 1)
+        return make_error("string-builder-append! requires at least one argument");
+
+    builder = argv[0];
+    if (!is_string_builder(builder)) {
+        return make_error(
+            "first argument to string-builder-append! must be a string builder");
+    }
+
+    capacity = builder->builder_val->capacity;
+    result = builder;
+    for (i = 1; i < num_args; i++) {
+        if (is_string(argv[i])) {
+            if (!sb_append_str(builder->builder_val, argv[i]->string_val)) {
+                result = make_error("out of memory growing a string builder");
+                break;
+            }
+        }
+        else {
+            format_value(builder->builder_val, argv[i]);
+        }
+    }
+
+    /* Whatever the buffer grew by counts toward the builder's generation. */
+    note_payload(builder, (long) (builder->builder_val->capacity - capacity));
+    return result;
+}
+
+
+/*!
+ * This function implements the Scheme built-in function
+ * "string-builder->string", which returns a new string holding the text
+ * appended to a string builder so far.
+ */
+Value * scheme_string_builder_to_string(int num_args, Value **argv) {
+    Value *builder;
+
+    if (num_args != 1)
+        return make_error("string-builder->string requires exactly one argument");
+
+    builder = argv[0];
+    if (!is_string_builder(builder)) {
+        return make_error(
+            "argument to string-builder->string must be a string builder");
+    }
+
+    return make_string(sb_contents(builder->builder_val));
+}
+
+
 /*!
  * This function seeds the random number generator, either with a single numeric
  * argument, or with the current time value if no argument is provided.  The
  * argument will be a float, but we cast it to an unsigned integer in here.
  */
-Value * scheme_srandom(int num_args, Value *args) {
+Value * scheme_srandom(int num_args, Value **argv) {
     Value *seed, *result;
     unsigned int seed_val;
 
@@ -680,19 +1179,19 @@ Value * scheme_srandom(int num_args, Value *args) {
         seed_val = time(NULL);
     }
     else if (num_args == 1) {
-        seed = get_car(args);
+        seed = argv[0];
         return_if_error(seed);
 
-        if (!is_float(seed))
+        if (!is_number(seed))
             return make_error("invalid argument to srandom");
     
-        seed_val = (unsigned) seed->float_val;
+        seed_val = (unsigned) get_float(seed);
     }
     else {
         return make_error("srandom takes zero or one arguments");
     }
 
-    result = make_float((float) seed_val);
+    result = make_integer(seed_val);
     return_if_error(result);
 
     srandom(seed_val);
@@ -704,13 +1203,13 @@ Value * scheme_srandom(int num_args, Value *args) {
 /*!
  * This function returns a random number from the random generator.
  */
-Value * scheme_random(int num_args, Value *args) {
+Value * scheme_random(int num_args, Value **argv) {
     Value *max = NULL;
     long rand_val;
 
     if (num_args == 1) {
-        max = get_car(args);
-        if (!is_float(max))
+        max = argv[0];
+        if (!is_number(max))
             return make_error("argument to random must be a number");
     }
     else if (num_args > 1) {
@@ -719,9 +1218,9 @@ Value * scheme_random(int num_args, Value *args) {
 
     rand_val = random();
     if (max != NULL)
-        rand_val %= (int) max->float_val;
+        rand_val %= (int) get_float(max);
         
-    return make_float((float) rand_val);
+    return make_integer(rand_val);
 }
 
 
@@ -729,13 +1228,13 @@ Value * scheme_random(int num_args, Value *args) {
  * This function returns the current time in seconds from the epoch, as the C
  * time() function returns.
  */
-Value * scheme_time(int num_args, Value *args) {
+Value * scheme_time(int num_args, Value **argv) {
     Value *result;
 
     if (num_args != 0)
         return make_error("time takes zero arguments");
 
-    result = make_float((float) time(NULL));
+    result = make_integer(time(NULL));
     return result;
 }
 
@@ -743,21 +1242,21 @@ Value * scheme_time(int num_args, Value *args) {
 /*!
  * This function computes the square-root of the input argument.
  */
-Value * scheme_sqrt(int num_args, Value *args) {
+Value * scheme_sqrt(int num_args, Value **argv) {
     Value *input, *result;
 
     if (num_args == 1) {
-        input = get_car(args);
+        input = argv[0];
         return_if_error(input);
 
-        if (!is_float(input))
+        if (!is_number(input))
             return make_error("invalid argument to sqrt");
     }
     else {
         return make_error("sqrt takes one argument");
     }
 
-    result = make_float(sqrtf(input->float_val));
+    result = make_float(sqrtf(get_float(input)));
     return_if_error(result);
 
     return result;
@@ -768,13 +1267,13 @@ Value * scheme_sqrt(int num_args, Value *args) {
  * This function evaluates a Scheme file in the context of the global
  * environment.
  */
-Value * scheme_eval_file(int num_args, Value *args) {
+Value * scheme_eval_file(int num_args, Value **argv) {
     Value *filename;
 
     if (num_args != 1)
         return make_error("eval-file takes exactly one string argument");
 
-    filename = get_car(args);
+    filename = argv[0];
     if (!is_string(filename))
         return make_error("eval-file takes exactly one string argument");
 
@@ -787,3 +1286,62 @@ Value * scheme_eval_file(int num_args, Value *args) {
 }
 
 
+/*!
+ * This function writes the global environment, and everything reachable from
+ * it, to an image file that the interpreter can be started from later with
+ * the -i option.
+ */
+Value * scheme_save_image(int num_args, Value **argv) {
+    Value *filename;
+
+    if (num_args != 1)
+        return make_error("save-image takes exactly one string argument");
+
+    filename = argv[0];
+    if (!is_string(filename))
+        return make_error("save-image takes exactly one string argument");
+
+    if (!save_image(filename->string_val))
+        return make_error("couldn't write image \"%s\"", filename->string_val);
+
+    return make_true();
+}
+
+
+
+
+/*!
+ * This function implements gc-ratio, which sets the fraction of the old
+ * generation that may still be live when a major collection starts.  Smaller
+ * ratios mean fewer major collections and a larger heap.  With no argument the
+ * setting is left alone.  Either way the current setting is returned.
+ */
+Value * scheme_gc_ratio(int num_args, Value **argv) {
+    Value *ratio;
+
+    if (num_args == 0)
+        return make_float(get_gc_live_ratio());
+
+    if (num_args != 1)
+        return make_error("gc-ratio takes zero or one arguments");
+
+    ratio = argv[0];
+    if (!is_number(ratio) || get_float(ratio) <= 0 || get_float(ratio) > 1)
+        return make_error("gc-ratio must be a number greater than 0, at most 1");
+
+    set_gc_live_ratio(get_float(ratio));
+    return ratio;
+}
+
+
+/*!
+ * This function implements gc-stats, which prints the allocator's statistics,
+ * including the pause time and the space reclaimed by each collection.
+ */
+Value * scheme_gc_stats(int num_args, Value **argv) {
+    if (num_args != 0)
+        return make_error("gc-stats takes zero arguments");
+
+    print_alloc_stats(stdout);
+    return NULL;
+}
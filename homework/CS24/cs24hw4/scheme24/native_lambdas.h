@@ -5,46 +5,70 @@
 #include "types.h"
 
 
-Value * scheme_eq(int num_args, Value *args);
-Value * scheme_equal(int num_args, Value *args);
-
-Value * scheme_numeric_equals(int num_args, Value *args);
-Value * scheme_numeric_less_than(int num_args, Value *args);
-Value * scheme_numeric_greater_than(int num_args, Value *args);
-Value * scheme_numeric_less_equal(int num_args, Value *args);
-Value * scheme_numeric_greater_equal(int num_args, Value *args);
-
-Value * scheme_is_boolean(int num_args, Value *args);
-Value * scheme_is_number(int num_args, Value *args);
-Value * scheme_is_pair(int num_args, Value *args);
-Value * scheme_is_procedure(int num_args, Value *args);
-Value * scheme_is_string(int num_args, Value *args);
-Value * scheme_is_symbol(int num_args, Value *args);
-
-Value * scheme_add(int num_args, Value *args);
-Value * scheme_sub(int num_args, Value *args);
-Value * scheme_mul(int num_args, Value *args);
-Value * scheme_div(int num_args, Value *args);
-
-Value * scheme_cons(int num_args, Value *args);
-Value * scheme_car(int num_args, Value *args);
-Value * scheme_cdr(int num_args, Value *args);
-Value * scheme_list(int num_args, Value *args);
-Value * scheme_length(int num_args, Value *args);
-
-Value * scheme_set_car(int num_args, Value *args);
-Value * scheme_set_cdr(int num_args, Value *args);
-
-Value * scheme_display(int num_args, Value *args);
-Value * scheme_error(int num_args, Value *args);
-
-Value * scheme_srandom(int num_args, Value *args);
-Value * scheme_random(int num_args, Value *args);
-Value * scheme_time(int num_args, Value *args);
-
-Value * scheme_sqrt(int num_args, Value *args);
-
-Value * scheme_eval_file(int num_args, Value *args);
+Value * scheme_eq(int num_args, Value **argv);
+Value * scheme_equal(int num_args, Value **argv);
+
+Value * scheme_numeric_equals(int num_args, Value **argv);
+Value * scheme_numeric_less_than(int num_args, Value **argv);
+Value * scheme_numeric_greater_than(int num_args, Value **argv);
+Value * scheme_numeric_less_equal(int num_args, Value **argv);
+Value * scheme_numeric_greater_equal(int num_args, Value **argv);
+
+Value * scheme_is_boolean(int num_args, Value **argv);
+Value * scheme_is_number(int num_args, Value **argv);
+Value * scheme_is_pair(int num_args, Value **argv);
+Value * scheme_is_procedure(int num_args, Value **argv);
+Value * scheme_is_string(int num_args, Value **argv);
+Value * scheme_is_symbol(int num_args, Value **argv);
+Value * scheme_is_vector(int num_args, Value **argv);
+Value * scheme_is_hash_table(int num_args, Value **argv);
+Value * scheme_is_string_builder(int num_args, Value **argv);
+
+Value * scheme_add(int num_args, Value **argv);
+Value * scheme_sub(int num_args, Value **argv);
+Value * scheme_mul(int num_args, Value **argv);
+Value * scheme_div(int num_args, Value **argv);
+
+Value * scheme_cons(int num_args, Value **argv);
+Value * scheme_car(int num_args, Value **argv);
+Value * scheme_cdr(int num_args, Value **argv);
+Value * scheme_list(int num_args, Value **argv);
+Value * scheme_length(int num_args, Value **argv);
+
+Value * scheme_set_car(int num_args, Value **argv);
+Value * scheme_set_cdr(int num_args, Value **argv);
+
+Value * scheme_make_vector(int num_args, Value **argv);
+Value * scheme_vector(int num_args, Value **argv);
+Value * scheme_vector_ref(int num_args, Value **argv);
+Value * scheme_vector_set(int num_args, Value **argv);
+Value * scheme_vector_length(int num_args, Value **argv);
+
+Value * scheme_make_hash_table(int num_args, Value **argv);
+Value * scheme_hash_table_ref(int num_args, Value **argv);
+Value * scheme_hash_table_set(int num_args, Value **argv);
+Value * scheme_hash_table_count(int num_args, Value **argv);
+
+Value * scheme_display(int num_args, Value **argv);
+Value * scheme_error(int num_args, Value **argv);
+
+Value * scheme_string_append(int num_args, Value **argv);
+Value * scheme_number_to_string(int num_args, Value **argv);
+Value * scheme_make_string_builder(int num_args, Value **argv);
+Value * scheme_string_builder_append(int num_args, Value **argv);
+Value * scheme_string_builder_to_string(int num_args, Value **argv);
+
+Value * scheme_srandom(int num_args, Value **argv);
+Value * scheme_random(int num_args, Value **argv);
+Value * scheme_time(int num_args, Value **argv);
+
+Value * scheme_sqrt(int num_args, Value **argv);
+
+Value * scheme_eval_file(int num_args, Value **argv);
+Value * scheme_save_image(int num_args, Value **argv);
+
+Value * scheme_gc_ratio(int num_args, Value **argv);
+Value * scheme_gc_stats(int num_args, Value **argv);
 
 #endif /* NATIVE_LAMBDAS_H */
 
@@ -3,12 +3,27 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
 
 
 static Token curr_token;
 
+/*! Length of curr_token's string, for VALUE and STRING_VALUE tokens. */
+static int curr_token_length;
+
+
+/*
+ * Each character is read with getc_unlocked(), which is a macro that reads
+ * straight out of the stream's buffer.  fgetc() takes the stream's lock on
+ * every call, and reading a large file one character at a time spends much
+ * of its time doing that.  Nothing else reads from a stream while the parser
+ * is reading it.
+ */
+#define next_char(f) getc_unlocked(f)
+
 static const char *token_types[] = {
     "STREAM_END", "ERROR", "LPAREN", "RPAREN", "SQUOTE", "DQUOTE", "VALUE",
     "STRING_VALUE"
@@ -47,7 +62,7 @@ TokenType next_token(FILE *f) {
     while (1) {
         /* Consume whitespace. */
         do {
-            ch = fgetc(f);
+            ch = next_char(f);
         }
         while (ch != EOF && isspace(ch));
 
@@ -60,7 +75,7 @@ TokenType next_token(FILE *f) {
         /* Consume comments. */
         if (ch == ';') {
             do {
-                ch = fgetc(f);
+                ch = next_char(f);
             }
             while (ch != EOF && ch != '\r' && ch != '\n');
 
@@ -97,7 +112,7 @@ TokenType next_token(FILE *f) {
             curr_token.type = STRING_VALUE;
 
             for (i = 0; i < MAX_LENGTH; i++) {
-                ch = fgetc(f);
+                ch = next_char(f);
 
                 if (ch == EOF) {
                     /* It's an error if we reach end of stream in the middle
@@ -116,6 +131,7 @@ TokenType next_token(FILE *f) {
                 }
                 else if (ch == '\"') {
                     curr_token.string[i] = 0;  /* Zero-terminate string. */
+                    curr_token_length = i;
                     break;
                 }
 
@@ -129,7 +145,7 @@ TokenType next_token(FILE *f) {
             curr_token.string[0] = ch;
 
             for (i = 1; i < MAX_LENGTH; i++) {
-                ch = fgetc(f);
+                ch = next_char(f);
                 
                 if (ch == EOF) {
                     /* It's probably an error if we hit EOF in this case, but
@@ -153,10 +169,12 @@ TokenType next_token(FILE *f) {
                         "ERROR:  Token was more than %d characters long!\n",
                         MAX_LENGTH);
                 curr_token.string[MAX_LENGTH - 1] = '\0';
+                i = MAX_LENGTH - 1;
             }
+            curr_token_length = i;
 
             /* Distinguish between a numeric value and a simple period. */
-            if (strlen(curr_token.string) == 1 && curr_token.string[0] == '.')
+            if (i == 1 && curr_token.string[0] == '.')
                 curr_token.type = PERIOD;
         }
     }
@@ -206,18 +224,52 @@ Value * read_value(FILE *f, int advance) {
 }
 
 
+/*!
+ * Returns nonzero if sscanf()'s %f conversion could accept the start of the
+ * string.  That takes an optional sign followed by a digit, a decimal point,
+ * or the start of "inf" or "nan".  Most atoms fail this test, and can skip
+ * the much slower sscanf() call.
+ */
+static int might_be_number(const char *s) {
+    if (*s == '+' || *s == '-')
+        s++;
+
+    return isdigit((unsigned char) *s) || *s == '.' ||
+           *s == 'i' || *s == 'I' || *s == 'n' || *s == 'N';
+}
+
+
+/*!
+ * Returns nonzero if a token that sscanf() accepted as a number is written as
+ * an integer:  an optional sign followed only by digits.
+ */
+static int is_integer_literal(const char *s) {
+    if (*s == '+' || *s == '-')
+        s++;
+
+    while (isdigit((unsigned char) *s))
+        s++;
+
+    return *s == '\0';
+}
+
+
 Value * read_atom_or_number(const Token *p_tok) {
     Value *val = NULL;
     int str_len;
     int count_parsed, chars_consumed;
     float fval;
+    long lval;
 
     assert(p_tok != NULL);
     assert(p_tok->type == VALUE);
 
     /* NOTE:  Couldn't get strtof()/strtod() to work... */
-    str_len = strlen(p_tok->string);
-    count_parsed = sscanf(p_tok->string, "%f%n", &fval, &chars_consumed);
+    str_len = (p_tok == &curr_token) ? curr_token_length : strlen(p_tok->string);
+    if (might_be_number(p_tok->string))
+        count_parsed = sscanf(p_tok->string, "%f%n", &fval, &chars_consumed);
+    else
+        count_parsed = 0;
     if (count_parsed == 0) {
         /* No conversion occurred at all.  This value is an atom or a Boolean
          * literal.
@@ -239,6 +291,15 @@ Value * read_atom_or_number(const Token *p_tok) {
         fprintf(stderr, "ERROR:  Invalid number format \"%s\".\n",
                 p_tok->string);
     }
+    else if (is_integer_literal(p_tok->string)) {
+        /* Integers are exact, unless they are too large for a fixnum. */
+        errno = 0;
+        lval = strtol(p_tok->string, NULL, 10);
+        if (errno == 0 && lval >= FIXNUM_MIN && lval <= FIXNUM_MAX)
+            val = make_fixnum(lval);
+        else
+            val = make_float(fval);
+    }
     else {
         /* This is a number. */
         val = make_float(fval);
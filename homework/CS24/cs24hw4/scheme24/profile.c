@@ -0,0 +1,387 @@
+/*! \file
+ * This file implements an optional profiler for Scheme code, turned on with
+ * the interpreter's -p option.  It does two things:
+ *
+ *   1. It counts how many times each procedure is applied.  Procedures are
+ *      known by the name they were first defined under (see eval_define()),
+ *      so every closure made from the same definition is counted together.
+ *
+ *   2. It samples the evaluation stack on a timer.  A SIGPROF timer fires
+ *      every SAMPLE_USEC microseconds of CPU time, but the signal handler
+ *      only counts the tick; the stack is recorded the next time a procedure
+ *      is applied, since the stack can't be safely walked from inside a
+ *      signal handler.  Each evaluation context that is running a procedure's
+ *      body names that procedure, so a sample is the chain of procedures from
+ *      the REPL down to the one being applied.  Ticks are also recorded when
+ *      a garbage collection starts and ends, so that the time spent
+ *      collecting is reported as a "(gc)" procedure rather than being
+ *      charged to whichever procedure happens to be applied next.
+ *
+ * When the interpreter exits, print_profile() reports a flat profile of the
+ * samples each procedure was running in (self) or under (total), and an
+ * inclusive call tree.  Direct recursion is folded into a single node of the
+ * tree, so that deeply recursive procedures don't produce deep trees.
+ */
+
+#include <assert.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "profile.h"
+#include "evaluator.h"
+#include "ptr_vector.h"
+
+
+/*! The sampling interval, in microseconds of CPU time. */
+#define SAMPLE_USEC 1000
+
+/*! The name reported for lambdas that were never bound with define. */
+#define ANONYMOUS "(lambda)"
+
+/*! The name that garbage collection is reported under. */
+#define GC_NAME "(gc)"
+
+/*! Call-tree paths are cut off below this many procedures. */
+#define MAX_TREE_DEPTH 64
+
+/*! Call-tree nodes with a smaller share of the samples aren't printed. */
+#define TREE_MIN_PERCENT 0.5
+
+
+/*! What the profiler knows about one procedure. */
+typedef struct ProfileEntry {
+    const char *name;
+    long calls;             /*!< Number of times the procedure was applied. */
+    long self;              /*!< Samples taken while it was being applied. */
+    long total;             /*!< Samples it appeared anywhere in. */
+    long last_sample;       /*!< The last sample counted in total. */
+} ProfileEntry;
+
+
+/*! A node of the call tree:  one path of procedures from the REPL down. */
+typedef struct CallNode {
+    const char *name;
+    long samples;           /*!< Samples taken in or under this path. */
+    struct CallNode *children;
+    struct CallNode *next_sibling;
+} CallNode;
+
+
+int profiling;
+
+/*! Timer ticks that haven't been recorded as samples yet. */
+static volatile sig_atomic_t pending_ticks;
+
+/*! The number of samples recorded, counting each tick separately. */
+static long num_samples;
+
+/*! Open-addressed table of entries, keyed by the address of the name. */
+static ProfileEntry *entries;
+static int num_entries, entries_capacity;
+
+/*! The root of the call tree, which stands for the REPL itself. */
+static CallNode call_tree;
+
+
+/*============================================================================
+ * Procedure entries
+ */
+
+
+static unsigned int hash_name(const char *name) {
+    return (unsigned int) ((uintptr_t) name >> 3) * 2654435761u;
+}
+
+
+/*! Returns the entry for the procedure with the specified name. */
+static ProfileEntry * get_entry(const char *name) {
+    unsigned int mask, i;
+
+    if (2 * (num_entries + 1) > entries_capacity) {
+        ProfileEntry *old_entries = entries;
+        int old_capacity = entries_capacity, j;
+
+        entries_capacity = entries_capacity ? 2 * entries_capacity : 256;
+        entries = calloc(entries_capacity, sizeof(ProfileEntry));
+        if (entries == NULL) {
+            fprintf(stderr, "profiler: out of memory\n");
+            exit(1);
+        }
+
+        mask = entries_capacity - 1;
+        for (j = 0; j < old_capacity; j++) {
+            if (old_entries[j].name != NULL) {
+                i = hash_name(old_entries[j].name) & mask;
+                while (entries[i].name != NULL)
+                    i = (i + 1) & mask;
+                entries[i] = old_entries[j];
+            }
+        }
+        free(old_entries);
+    }
+
+    mask = entries_capacity - 1;
+    i = hash_name(name) & mask;
+    while (entries[i].name != NULL && entries[i].name != name)
+        i = (i + 1) & mask;
+
+    if (entries[i].name == NULL) {
+        entries[i].name = name;
+        entries[i].last_sample = -1;
+        num_entries++;
+    }
+
+    return &entries[i];
+}
+
+
+/*!
+ * Returns the name a lambda is reported under:  the name it was first defined
+ * under, or the name a native lambda is registered under.
+ */
+const char * get_lambda_name(Lambda *f) {
+    return f->name != NULL ? f->name : ANONYMOUS;
+}
+
+
+/*============================================================================
+ * Sampling
+ */
+
+
+static void profile_tick(int signum) {
+    pending_ticks++;
+}
+
+
+/*! Starts counting calls, and starts the sampling timer. */
+void start_profiler(void) {
+    struct sigaction action;
+    struct itimerval timer;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = profile_tick;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL) != 0) {
+        perror("profiler: sigaction");
+        return;
+    }
+
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = SAMPLE_USEC;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        perror("profiler: setitimer");
+        return;
+    }
+
+    profiling = 1;
+}
+
+
+/*! Returns the child of the node with the specified name, adding it first. */
+static CallNode * get_child(CallNode *node, const char *name) {
+    CallNode *child;
+
+    for (child = node->children; child != NULL; child = child->next_sibling) {
+        if (child->name == name)
+            return child;
+    }
+
+    child = calloc(1, sizeof(CallNode));
+    if (child == NULL) {
+        fprintf(stderr, "profiler: out of memory\n");
+        exit(1);
+    }
+
+    child->name = name;
+    child->next_sibling = node->children;
+    node->children = child;
+    return child;
+}
+
+
+/*!
+ * Records the current evaluation stack, with leaf on top, as a sample that
+ * stands for the specified number of timer ticks.  If leaf is NULL, the
+ * sample is charged to the innermost procedure on the stack.
+ */
+static void take_sample(const char *leaf, long ticks) {
+    PtrStack *stack = get_eval_stack();
+    CallNode *node = &call_tree;
+    const char *name;
+    ProfileEntry *entry = NULL;
+    unsigned int i;
+    int depth = 0;
+
+    call_tree.samples += ticks;
+
+    for (i = 0; i <= stack->size; i++) {
+        if (i < stack->size)
+            name = ((EvaluationContext *) stack->elems[i])->procedure;
+        else
+            name = leaf;
+
+        if (name == NULL || name == node->name)
+            continue;   /* Not running a procedure, or direct recursion. */
+
+        entry = get_entry(name);
+        if (entry->last_sample != num_samples) {
+            entry->total += ticks;
+            entry->last_sample = num_samples;
+        }
+
+        if (depth < MAX_TREE_DEPTH) {
+            node = get_child(node, name);
+            node->samples += ticks;
+            depth++;
+        }
+    }
+
+    if (entry != NULL)
+        entry->self += ticks;
+    num_samples++;
+}
+
+
+/*! Records a sample of any timer ticks that haven't been recorded yet. */
+static void flush_ticks(const char *leaf) {
+    long ticks;
+
+    if (pending_ticks > 0) {
+        ticks = pending_ticks;
+        pending_ticks = 0;
+        take_sample(leaf, ticks);
+    }
+}
+
+
+/*!
+ * Counts an application of f, and records a sample if the timer has ticked
+ * since the last one.  The evaluator calls this for every procedure it
+ * applies while profiling.
+ */
+void profile_call(Lambda *f) {
+    const char *name = get_lambda_name(f);
+
+    get_entry(name)->calls++;
+    flush_ticks(name);
+}
+
+
+/*!
+ * Called when a garbage collection starts.  The ticks so far belong to the
+ * code that was running before the collection.
+ */
+void profile_gc_start(void) {
+    flush_ticks(NULL);
+}
+
+
+/*! Called when a garbage collection ends, to charge its ticks to "(gc)". */
+void profile_gc_end(void) {
+    flush_ticks(GC_NAME);
+}
+
+
+/*============================================================================
+ * Reporting
+ */
+
+
+static double percent(long samples) {
+    return call_tree.samples ? 100.0 * samples / call_tree.samples : 0;
+}
+
+
+/*! qsort() comparison that puts the entries with the most self samples first. */
+static int compare_self(const void *a, const void *b) {
+    const ProfileEntry *e1 = *(ProfileEntry * const *) a;
+    const ProfileEntry *e2 = *(ProfileEntry * const *) b;
+
+    if (e1->self != e2->self)
+        return (e1->self < e2->self) ? 1 : -1;
+    if (e1->calls != e2->calls)
+        return (e1->calls < e2->calls) ? 1 : -1;
+    return strcmp(e1->name, e2->name);
+}
+
+
+/*! qsort() comparison that puts the nodes with the most samples first. */
+static int compare_samples(const void *a, const void *b) {
+    const CallNode *n1 = *(CallNode * const *) a;
+    const CallNode *n2 = *(CallNode * const *) b;
+
+    if (n1->samples != n2->samples)
+        return (n1->samples < n2->samples) ? 1 : -1;
+    return strcmp(n1->name, n2->name);
+}
+
+
+static void print_tree(FILE *f, CallNode *node, int depth) {
+    CallNode *child, **children;
+    int num_children = 0, i;
+
+    if (depth > 0) {
+        fprintf(f, "  %6.1f%% %8ld  %*s%s\n", percent(node->samples),
+                node->samples, 2 * (depth - 1), "", node->name);
+    }
+
+    for (child = node->children; child != NULL; child = child->next_sibling)
+        num_children++;
+    if (num_children == 0)
+        return;
+
+    children = malloc(num_children * sizeof(CallNode *));
+    if (children == NULL)
+        return;
+
+    i = 0;
+    for (child = node->children; child != NULL; child = child->next_sibling)
+        children[i++] = child;
+    qsort(children, num_children, sizeof(CallNode *), compare_samples);
+
+    for (i = 0; i < num_children; i++) {
+        if (percent(children[i]->samples) >= TREE_MIN_PERCENT)
+            print_tree(f, children[i], depth + 1);
+    }
+
+    free(children);
+}
+
+
+/*! Prints the flat profile and the call tree. */
+void print_profile(FILE *f) {
+    ProfileEntry **sorted;
+    int i, n = 0;
+
+    if (!profiling)
+        return;
+
+    sorted = malloc((num_entries + 1) * sizeof(ProfileEntry *));
+    if (sorted == NULL)
+        return;
+
+    for (i = 0; i < entries_capacity; i++) {
+        if (entries[i].name != NULL)
+            sorted[n++] = &entries[i];
+    }
+    qsort(sorted, n, sizeof(ProfileEntry *), compare_self);
+
+    fprintf(f, "\nFlat profile (%ld samples, %d usec each):\n",
+            call_tree.samples, SAMPLE_USEC);
+    fprintf(f, "  %7s %7s %12s  %s\n", "self", "total", "calls", "procedure");
+    for (i = 0; i < n; i++) {
+        fprintf(f, "  %6.1f%% %6.1f%% %12ld  %s\n", percent(sorted[i]->self),
+                percent(sorted[i]->total), sorted[i]->calls, sorted[i]->name);
+    }
+
+    fprintf(f, "\nCall tree (inclusive samples):\n");
+    print_tree(f, &call_tree, 0);
+
+    free(sorted);
+}
@@ -0,0 +1,20 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include "types.h"
+
+
+/*! Nonzero once start_profiler() has been called. */
+extern int profiling;
+
+void start_profiler(void);
+void profile_call(Lambda *f);
+void profile_gc_start(void);
+void profile_gc_end(void);
+void print_profile(FILE *f);
+
+const char * get_lambda_name(Lambda *f);
+
+
+#endif /* PROFILE_H */
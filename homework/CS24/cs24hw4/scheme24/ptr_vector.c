@@ -15,6 +15,7 @@
  * module, and the "pvh_*" names.
  */
 
+int pvh_grow(PtrVector *pv, unsigned int min_capacity);
 void pvh_reduce_capacity(PtrVector *pv);
 
 
@@ -31,13 +32,31 @@ void pv_init(PtrVector *pv) {
  */
 void pv_uninit(PtrVector *pv) {
     assert(pv != NULL);
-    if (pv->elems != NULL)
+    if (pv->elems != NULL && pv->elems != pv->inline_elems)
         free(pv->elems);
 
     memset(pv, 0, sizeof(PtrVector));
 }
 
 
+/*!
+ * Make sure the pointer-vector can hold at least the specified number of
+ * elements without any further allocation.  Callers that know roughly how many
+ * elements they will add can use this to avoid repeated reallocation.
+ *
+ * This function returns 1 if the vector now has the requested capacity, or 0
+ * if more memory could not be allocated.
+ */
+int pv_reserve(PtrVector *pv, unsigned int capacity) {
+    assert(pv != NULL);
+
+    if (capacity <= pv->capacity)
+        return 1;
+
+    return pvh_grow(pv, capacity);
+}
+
+
 /*!
  * Add an element to the end of a pointer-vector.  If the pointer-vector
  * already has space to accommodate the new pointer, it will simply add it to
@@ -52,25 +71,9 @@ int pv_add_elem(PtrVector *pv, void *elem) {
     assert(elem != NULL);
 
     if (pv->size == pv->capacity) {
-        /* Need to allocate more space for the pointer-vector. */
-
-        unsigned int new_capacity;
-        void **new_elems;
-
-        new_capacity = 2 * pv->capacity;
-        if (new_capacity == 0)
-            new_capacity = 16;
-
-        new_elems = (void **) realloc(pv->elems, new_capacity * sizeof(void *));
-
-        if (new_elems == NULL)
+        /* Need more space for the pointer-vector. */
+        if (!pvh_grow(pv, pv->size + 1))
             return 0;
-
-        memset(new_elems + pv->capacity, 0,
-               sizeof(void *) * (new_capacity - pv->capacity));
-
-        pv->capacity = new_capacity;
-        pv->elems = new_elems;
     }
 
     pv->elems[pv->size] = elem;
@@ -106,27 +109,70 @@ void pv_set_elem(PtrVector *pv, unsigned int index, void *elem) {
 }
 
 
+/*!
+ * Append an array of elements to the end of a pointer-vector in one operation.
+ * The vector grows at most once to make room for all of the new elements.
+ * None of the elements may be NULL.
+ *
+ * This function returns 1 if the elements were appended, or 0 if the vector
+ * could not be grown; in that case the vector is left unchanged.
+ */
+int pv_append_array(PtrVector *pv, void **elems, unsigned int count) {
+#ifndef NDEBUG
+    unsigned int i;
+#endif
+
+    assert(pv != NULL);
+    assert(elems != NULL || count == 0);
+
+#ifndef NDEBUG
+    for (i = 0; i < count; i++)
+        assert(elems[i] != NULL);
+#endif
+
+    if (count == 0)
+        return 1;
+
+    if (pv->size + count > pv->capacity) {
+        if (!pvh_grow(pv, pv->size + count))
+            return 0;
+    }
+
+    memcpy(pv->elems + pv->size, elems, count * sizeof(void *));
+    pv->size += count;
+
+    return 1;
+}
+
+
+/*!
+ * Drop every element at or above the specified index, so that the
+ * pointer-vector is left holding size elements.  The vector's capacity is
+ * reduced afterward if it has become much larger than necessary.
+ */
+void pv_truncate(PtrVector *pv, unsigned int size) {
+    assert(pv != NULL);
+    assert(size <= pv->size);
+
+    memset(pv->elems + size, 0, (pv->size - size) * sizeof(void *));
+    pv->size = size;
+
+    pvh_reduce_capacity(pv);
+}
+
+
 /*!
  * This function compacts down the pointer-vector to take up the minimal space
  * necessary for the number of pointers it contains.  All elements set to NULL
  * are considered to be unused, and after this function runs, there should be no
  * NULL entries in the pointer-vector from indexes 0 to pv->size - 1.
  *
- * The implementation is very straightforward.  The function performs two
- * iterative operations each cycle through the pointer-vector:
- *
- * First, if the pointer-vector has NULL values at the end, the vector's size is
- * decreased to remove these elements.  Once this is finished, we know that the
- * element at pv->size - 1 is non-NULL.
- *
- * Second, we have another index that we start at the beginning of the
- * pointer-vector, and we increment this from the start all the way through to
- * the end, looking for NULL entries.  When we find a NULL entry, we move the
- * topmost (non-NULL) entry down into this spot, and then we go back to the
- * first part of the loop again.
- *
- * Repeatedly performing these two steps eventually results in a pointer-vector
- * with no NULL entries.
+ * The implementation makes a single linear pass over the pointer-vector.  It
+ * finds each run of non-NULL entries and moves the whole run down with one
+ * memmove() so that it immediately follows the entries already kept.  The
+ * relative order of the remaining elements is preserved.  The slots vacated
+ * at the top of the vector are then cleared, and the size is set to the
+ * number of entries kept.
  *
  * Finally, the pointer-vector may have a much larger capacity than the current
  * number of elements really calls for, so the capacity is reduced until it is
@@ -137,7 +183,7 @@ void pv_set_elem(PtrVector *pv, unsigned int index, void *elem) {
  * "minimal" amount of memory, given its current contents.
  */
 void pv_compact(PtrVector *pv) {
-    unsigned int empty_idx;
+    unsigned int read_idx, run_start, write_idx;
 #ifdef VERBOSE
     unsigned int initial_size, initial_capacity;
 #endif
@@ -150,27 +196,29 @@ void pv_compact(PtrVector *pv) {
     initial_capacity = pv->capacity;
 #endif
 
-    empty_idx = 0;
-    while (1) {
-        /* Shrink down the size of the pointer-vector until the topmost element
-         * is not NULL.
-         */
-        while (pv->size != 0 && pv->elems[pv->size - 1] == NULL)
-            pv->size--;
-
-        /* Find another empty slot in the pointer-vector. */
-        while (empty_idx < pv->size && pv->elems[empty_idx] != NULL)
-            empty_idx++;
-
-        /* All done eliminating empty slots. */
-        if (empty_idx == pv->size)
-            break;
-
-        /* Move topmost non-NULL slot down into the empty slot we have found. */
-        pv->elems[empty_idx] = pv->elems[pv->size - 1];
-        pv->elems[pv->size - 1] = NULL;
+    read_idx = 0;
+    write_idx = 0;
+    while (read_idx < pv->size) {
+        /* Skip over empty slots. */
+        while (read_idx < pv->size && pv->elems[read_idx] == NULL)
+            read_idx++;
+
+        /* Find the end of the run of non-NULL slots starting here. */
+        run_start = read_idx;
+        while (read_idx < pv->size && pv->elems[read_idx] != NULL)
+            read_idx++;
+
+        /* Move the whole run down next to the entries already kept. */
+        if (run_start != write_idx) {
+            memmove(pv->elems + write_idx, pv->elems + run_start,
+                    (read_idx - run_start) * sizeof(void *));
+        }
+        write_idx += read_idx - run_start;
     }
 
+    memset(pv->elems + write_idx, 0, (pv->size - write_idx) * sizeof(void *));
+    pv->size = write_idx;
+
     pvh_reduce_capacity(pv);
 
 #ifdef VERBOSE
@@ -182,6 +230,56 @@ void pv_compact(PtrVector *pv) {
 }
 
 
+/*!
+ * This helper function grows the pointer-vector's storage so that it can hold
+ * at least min_capacity elements.  A vector that has never held anything
+ * starts out using its inline slots; once those are exhausted, the elements
+ * move to a heap array, and the heap array at least doubles in size on each
+ * subsequent growth.  New slots are always zeroed.
+ */
+int pvh_grow(PtrVector *pv, unsigned int min_capacity) {
+    unsigned int new_capacity;
+    void **new_elems;
+
+    assert(pv != NULL);
+
+    if (pv->capacity == 0 && min_capacity <= PTR_VECTOR_INLINE_SLOTS) {
+        memset(pv->inline_elems, 0, sizeof(pv->inline_elems));
+        pv->elems = pv->inline_elems;
+        pv->capacity = PTR_VECTOR_INLINE_SLOTS;
+        return 1;
+    }
+
+    new_capacity = 2 * pv->capacity;
+    if (new_capacity < 16)
+        new_capacity = 16;
+    if (new_capacity < min_capacity)
+        new_capacity = min_capacity;
+
+    if (pv->elems == pv->inline_elems) {
+        /* Spill the inline slots over into a heap array. */
+        new_elems = (void **) malloc(new_capacity * sizeof(void *));
+        if (new_elems == NULL)
+            return 0;
+
+        memcpy(new_elems, pv->inline_elems, pv->capacity * sizeof(void *));
+    }
+    else {
+        new_elems = (void **) realloc(pv->elems, new_capacity * sizeof(void *));
+        if (new_elems == NULL)
+            return 0;
+    }
+
+    memset(new_elems + pv->capacity, 0,
+           sizeof(void *) * (new_capacity - pv->capacity));
+
+    pv->capacity = new_capacity;
+    pv->elems = new_elems;
+
+    return 1;
+}
+
+
 /*!
  * This helper function reduces the capacity of a PtrVector so that it only uses
  * as much capacity as necessary for the pointer-vector's current size.
@@ -191,6 +289,10 @@ void pvh_reduce_capacity(PtrVector *pv) {
 
     assert(pv != NULL);
 
+    /* Inline storage is never resized. */
+    if (pv->elems == pv->inline_elems)
+        return;
+
     /* Shrink down the size of the pointer-array, since this will have also
      * grown very large.
      */
@@ -219,6 +321,16 @@ int ps_push_elem(PtrStack *ps, void *elem) {
 }
 
 
+/*!
+ * Push count elements onto the stack; elems[count - 1] ends up on top.  This
+ * returns 1 on success, or 0 if the stack could not be grown.
+ */
+int ps_push_n(PtrStack *ps, void **elems, unsigned int count) {
+    assert(ps != NULL);
+    return pv_append_array(ps, elems, count);
+}
+
+
 void * ps_pop_elem(PtrStack *ps) {
     void *elem;
     unsigned int tos_index;
@@ -239,6 +351,24 @@ void * ps_pop_elem(PtrStack *ps) {
 }
 
 
+/*!
+ * Pop the top count elements off the stack.  If elems is not NULL, the popped
+ * elements are stored into it in the same order ps_push_n() takes them, so the
+ * old top of the stack ends up in elems[count - 1].
+ */
+void ps_pop_n(PtrStack *ps, unsigned int count, void **elems) {
+    assert(ps != NULL);
+    assert(count <= ps->size);
+
+    if (elems != NULL) {
+        memcpy(elems, ps->elems + ps->size - count,
+               count * sizeof(void *));
+    }
+
+    pv_truncate(ps, ps->size - count);
+}
+
+
 void * ps_peek_top(PtrStack *ps) {
     assert(ps != NULL);
     assert(ps->size > 0);
@@ -3,8 +3,20 @@
 
 
 
+/*!
+ * Number of element slots stored directly inside each PtrVector.  Vectors
+ * holding no more than this many pointers never touch the heap; larger ones
+ * spill over into a heap-allocated array.
+ */
+#define PTR_VECTOR_INLINE_SLOTS 8
+
+
 /*!
  * A growable vector whose elements are void-pointers.
+ *
+ * While the vector is small, elems points at inline_elems, so a PtrVector
+ * must not be copied by struct assignment; the copy's elems would still refer
+ * to the original's inline slots.
  */
 typedef struct PtrVector {
     /*! Number of elements the pointer-vector *could* hold. */
@@ -15,6 +27,9 @@ typedef struct PtrVector {
 
     /*! The array of elements in the pointer-vector. */
     void **elems;
+
+    /*! Inline storage used until the vector outgrows it. */
+    void *inline_elems[PTR_VECTOR_INLINE_SLOTS];
 } PtrVector;
 
 
@@ -23,15 +38,18 @@ typedef struct PtrVector {
  * this symbol is defined to the struct-initialization code to initialize the
  * pointer-vector's values properly.
  */
-#define PTR_VECTOR_STATIC_INIT { 0, 0, NULL }
+#define PTR_VECTOR_STATIC_INIT { 0, 0, NULL, { NULL } }
 
 
 void pv_init(PtrVector *pv);
 void pv_uninit(PtrVector *pv);
 
+int pv_reserve(PtrVector *pv, unsigned int capacity);
 int pv_add_elem(PtrVector *pv, void *elem);
 void * pv_get_elem(PtrVector *pv, unsigned int index);
 void pv_set_elem(PtrVector *pv, unsigned int index, void *elem);
+int pv_append_array(PtrVector *pv, void **elems, unsigned int count);
+void pv_truncate(PtrVector *pv, unsigned int size);
 void pv_compact(PtrVector *pv);
 
 
@@ -42,7 +60,9 @@ void pv_compact(PtrVector *pv);
 typedef PtrVector PtrStack;
 
 int ps_push_elem(PtrStack *ps, void *elem);
+int ps_push_n(PtrStack *ps, void **elems, unsigned int count);
 void * ps_pop_elem(PtrStack *ps);
+void ps_pop_n(PtrStack *ps, unsigned int count, void **elems);
 void * ps_peek_top(PtrStack *ps);
 
 
@@ -5,17 +5,32 @@
 
 
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include "alloc.h"
 #include "parse.h"
 #include "evaluator.h"
+#include "lexical.h"
+#include "image.h"
+#include "profile.h"
 
 
 /* Change to #define VERBOSE to see garbage-collection debug output. */
 #undef VERBOSE
 
 
+/*! Size of the stdio buffer used for files loaded with exec_file(). */
+#define FILE_BUFFER_SIZE 65536
+
+/*!
+ * Size of the stdio buffer for the interpreter's output, when it isn't going
+ * to a terminal.  Scripts that print a lot then write it out in large chunks.
+ */
+#define OUTPUT_BUFFER_SIZE 65536
+
+
 int read_eval_print_loop(FILE *input, const char *prompt, FILE *output) {
 
     Value *expr, *result;
@@ -38,6 +53,7 @@ int read_eval_print_loop(FILE *input, const char *prompt, FILE *output) {
         }
 
         reset_current_evalctx(global_env, expr);
+        resolve_lexical_addresses(expr);
         result = evaluate(global_env, expr);
 
         /* If we have interactive style output then we don't terminate the loop
@@ -53,9 +69,11 @@ int read_eval_print_loop(FILE *input, const char *prompt, FILE *output) {
             return 0;
         }
         
-        /* Make sure every last bit of garbage is gone! */
+        /* Make sure every last bit of garbage is gone!  Nothing in C refers to
+         * a value at this point, so the collector may move them.
+         */
         reset_current_evalctx(global_env, NULL);
-        collect_garbage();
+        collect_garbage_at_safe_point();
     }
 
     /* Report success. */
@@ -73,6 +91,9 @@ int exec_file(const char *filename) {
         return 0;
     }
 
+    /* Files can be large, so read them in bigger chunks than the default. */
+    setvbuf(f, NULL, _IOFBF, FILE_BUFFER_SIZE);
+
     result = read_eval_print_loop(f, NULL, NULL);
 
     fclose(f);
@@ -86,19 +107,52 @@ int exec_file(const char *filename) {
  * Scheme interpreter.  The first thing it does is to set up the global
  * environment, and the root evaluation context which is always present on the
  * stack so that evaluation can store its results into this root context.
+ *
+ * Started as "scheme24 -i image", the interpreter loads an image written by
+ * save-image instead of stdlib.scm, so whatever was defined when the image was
+ * saved is available straight away.  With -p, the Scheme code is profiled,
+ * and the profile is printed when the interpreter exits.
  */
-int main() {
+int main(int argc, char **argv) {
     Environment *global_env;
     EvaluationContext *root_eval_ctx;
+    const char *image = NULL;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            image = argv[++i];
+        }
+        else if (strcmp(argv[i], "-p") == 0) {
+            start_profiler();
+        }
+        else {
+            fprintf(stderr, "usage:  %s [-p] [-i image]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    /* A terminal still gets each line as soon as it's printed. */
+    if (!isatty(fileno(stdout)))
+        setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
 
     init_alloc();
     global_env = init_global_environment();
     root_eval_ctx = push_new_evalctx(NULL, NULL);
 
-    fprintf(stdout, "Loading standard functions...");    
-    if (!exec_file("stdlib.scm")) {
-        fprintf(stdout, "\nError loading standard functions!  Exiting.\n");
-        return 2;
+    if (image != NULL) {
+        fprintf(stdout, "Loading image %s...", image);
+        if (!load_image(image)) {
+            fprintf(stdout, "\nError loading image!  Exiting.\n");
+            return 2;
+        }
+    }
+    else {
+        fprintf(stdout, "Loading standard functions...");
+        if (!exec_file("stdlib.scm")) {
+            fprintf(stdout, "\nError loading standard functions!  Exiting.\n");
+            return 2;
+        }
     }
     fprintf(stdout, "  done.\n");
     
@@ -110,6 +164,8 @@ int main() {
 
     read_eval_print_loop(stdin, "> ", stdout);
 
+    print_profile(stdout);
+
     return 0;
 }
 
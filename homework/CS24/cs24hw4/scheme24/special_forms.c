@@ -1,6 +1,7 @@
 #include "special_forms.h"
 #include "values.h"
 #include "evaluator.h"
+#include "symbols.h"
 
 #include <assert.h>
 #include <string.h>
@@ -11,27 +12,34 @@
  * all have the signature of the SpecialFormEvaluator typedef.
  */
 
-Value * eval_begin(Environment *env, Value *expr);
-Value * eval_let(Environment *env, Value *expr);
-Value * eval_if(Environment *env, Value *expr);
-Value * eval_and(Environment *env, Value *expr);
-Value * eval_or(Environment *env, Value *expr);
-Value * eval_cond(Environment *env, Value *expr);
-Value * eval_define(Environment *env, Value *expr);
-Value * eval_lambda(Environment *env, Value *expr);
-Value * eval_quote(Environment *env, Value *expr);
-Value * eval_set_bang(Environment *env, Value *expr);
+Value * eval_begin(Environment *env, Value *expr, Value **tail_expr);
+Value * eval_let(Environment *env, Value *expr, Value **tail_expr);
+Value * eval_if(Environment *env, Value *expr, Value **tail_expr);
+Value * eval_and(Environment *env, Value *expr, Value **tail_expr);
+Value * eval_or(Environment *env, Value *expr, Value **tail_expr);
+Value * eval_cond(Environment *env, Value *expr, Value **tail_expr);
+Value * eval_define(Environment *env, Value *expr, Value **tail_expr);
+Value * eval_lambda(Environment *env, Value *expr, Value **tail_expr);
+Value * eval_quote(Environment *env, Value *expr, Value **tail_expr);
+Value * eval_set_bang(Environment *env, Value *expr, Value **tail_expr);
 
 /* Helper function for eval_define. */
-Value * eval_sugared_define(Environment *env, Value *expr);
+Value * eval_sugared_define(Environment *env, Value *keyword, Value *expr);
 
 
 /*!
  * This typedef defines a function-pointer type that is used for evaluating
  * special forms.  All the special-form evaluation functions conform to this
  * signature.
+ *
+ * Forms whose value is the value of one of their subexpressions (if, begin and
+ * cond) don't evaluate that last subexpression themselves when tail_expr is
+ * not NULL.  Instead they store it into *tail_expr and return NULL, and the
+ * caller evaluates it in the same environment.  This lets evaluate() loop
+ * instead of recursing, so tail calls don't use up the evaluation stack.
  */
-typedef Value * (*SpecialFormEvaluator)(Environment *env, Value *expr);
+typedef Value * (*SpecialFormEvaluator)(Environment *env, Value *expr,
+                                        Value **tail_expr);
 
 
 /*!
@@ -43,6 +51,9 @@ typedef Value * (*SpecialFormEvaluator)(Environment *env, Value *expr);
 typedef struct SpecialForm {
     char *name;
     SpecialFormEvaluator func;
+
+    /*! The interned copy of name, filled in by intern_special_forms(). */
+    char *symbol;
 } SpecialForm;
 
 
@@ -71,6 +82,57 @@ SpecialForm special_forms[] = {
 };
 
 
+/*! The interned "else" symbol, for recognizing else clauses in cond. */
+static char *else_symbol;
+
+
+/*!
+ * Interns the names of the special forms the first time they are needed, so
+ * that an expression's operator can be matched by comparing pointers.
+ */
+static void intern_special_forms(void) {
+    int i;
+
+    for (i = 0; special_forms[i].name != NULL; i++)
+        special_forms[i].symbol = intern_symbol(special_forms[i].name);
+
+    else_symbol = intern_symbol("else");
+}
+
+
+
+/*!
+ * Returns nonzero if the interned symbol is the name of a special form.
+ */
+int is_special_form(char *symbol) {
+    int i;
+
+    if (else_symbol == NULL)
+        intern_special_forms();
+
+    for (i = 0; special_forms[i].name != NULL; i++) {
+        if (symbol == special_forms[i].symbol)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/*!
+ * Finishes a special form whose value is the value of expr.  If the caller can
+ * take a tail call, expr is handed back through tail_expr and NULL is returned;
+ * otherwise expr is evaluated here.
+ */
+static Value * eval_tail(Environment *env, Value *expr, Value **tail_expr) {
+    if (tail_expr != NULL) {
+        *tail_expr = expr;
+        return NULL;
+    }
+
+    return evaluate(env, expr);
+}
+
 
 /*!
  * This function determines if the passed-in expression is a special form that
@@ -81,13 +143,21 @@ SpecialForm special_forms[] = {
  * expression is returned completely unmodified.  Thus, the caller can tell if
  * an expression was a special form, if the result-pointer is different from the
  * argument-pointer.
+ *
+ * If tail_expr is not NULL, the special form may hand its last subexpression
+ * back through it instead of evaluating it; see SpecialFormEvaluator.  In that
+ * case *tail_expr is set and NULL is returned.  Otherwise *tail_expr is left
+ * NULL.
  */
-Value * eval_special_form(Environment *env, Value *expr) {
+Value * eval_special_form(Environment *env, Value *expr, Value **tail_expr) {
     Value *car;
     char *string_val;
     int i;
     Value *result = expr;
 
+    if (tail_expr != NULL)
+        *tail_expr = NULL;
+
     if (!is_cons_pair(expr))
         goto Done;
 
@@ -100,10 +170,15 @@ Value * eval_special_form(Environment *env, Value *expr) {
      * the name in our list though, just leave the result unchanged.
      */
 
+    if (else_symbol == NULL)
+        intern_special_forms();
+
     string_val = car->string_val;
     for (i = 0; special_forms[i].name != NULL; i++) {
-        if (strcmp(string_val, special_forms[i].name) == 0)
-            result = special_forms[i].func(env, expr);
+        if (string_val == special_forms[i].symbol) {
+            result = special_forms[i].func(env, expr, tail_expr);
+            break;
+        }
     }
 
 Done:
@@ -118,7 +193,7 @@ Done:
  * sequence.  The result of the evaluation is simply the last expression's
  * result.
  */
-Value * eval_begin(Environment *env, Value *expr) {
+Value * eval_begin(Environment *env, Value *expr, Value **tail_expr) {
     Value *subexpr;
     Value *result = NULL;
 
@@ -130,6 +205,10 @@ Value * eval_begin(Environment *env, Value *expr) {
         subexpr = get_car(expr);
         return_if_error(subexpr);
 
+        /* The last subexpression is in tail position. */
+        if (is_nil(get_cdr(expr)))
+            return eval_tail(env, subexpr, tail_expr);
+
         result = evaluate(env, subexpr);
         return_if_error(result);
 
@@ -170,7 +249,7 @@ Value * eval_begin(Environment *env, Value *expr) {
  * Donnie decided to explicitly implement the let-evaluation manually, without a
  * transform.
  */
-Value * eval_let(Environment *env, Value *expr) {
+Value * eval_let(Environment *env, Value *expr, Value **tail_expr) {
     Value *bindings, *body, *result;
 
     ListBuilder binding_names, binding_values;
@@ -275,7 +354,7 @@ Done:
 /*!
  * This function handles the if special form:  (if condval trueval falseval)
  */
-Value * eval_if(Environment *env, Value *expr) {
+Value * eval_if(Environment *env, Value *expr, Value **tail_expr) {
     Value *test_expr, *true_expr, *false_expr;
     Value *test_result, *final_result;
 
@@ -307,10 +386,11 @@ Value * eval_if(Environment *env, Value *expr) {
     test_result = evaluate(env, test_expr);
     return_if_error(test_result);
 
+    /* Whichever branch is taken is in tail position. */
     if (is_true(test_result))
-        final_result = evaluate(env, true_expr);
+        final_result = eval_tail(env, true_expr, tail_expr);
     else
-        final_result = evaluate(env, false_expr);
+        final_result = eval_tail(env, false_expr, tail_expr);
 
     return final_result;
 }
@@ -325,7 +405,7 @@ Value * eval_if(Environment *env, Value *expr) {
  * evaluation to cease and the false result is returned.  If no results are
  * false then the last true value evaluated is returned.
  */
-Value * eval_and(Environment *env, Value *expr) {
+Value * eval_and(Environment *env, Value *expr, Value **tail_expr) {
     Value *test_expr;
     Value *test_result = NULL;
 
@@ -363,7 +443,7 @@ Value * eval_and(Environment *env, Value *expr) {
  * than #f) causes evaluation to cease and the true result is returned.  If no
  * results are true then the last false value evaluated is returned.
  */
-Value * eval_or(Environment *env, Value *expr) {
+Value * eval_or(Environment *env, Value *expr, Value **tail_expr) {
     Value *test_expr;
     Value *test_result = NULL;
 
@@ -398,7 +478,7 @@ Value * eval_or(Environment *env, Value *expr) {
  *     (cond (test exp1 exp2 ...)
  *     (cond ... (else ...))
  */
-Value * eval_cond(Environment *env, Value *expr) {
+Value * eval_cond(Environment *env, Value *expr, Value **tail_expr) {
     Value *clause, *test_expr, *test_result;
 
     /* Skip past the "cond" atom. */
@@ -420,7 +500,7 @@ Value * eval_cond(Environment *env, Value *expr) {
          * else clause.
          */
 
-        if (is_atom(test_expr) && strcmp(test_expr->string_val, "else") == 0) {
+        if (is_atom(test_expr) && test_expr->string_val == else_symbol) {
             /* else clause must appear last in list of clauses. */
             if (!is_nil(get_cdr(expr)))
                 return make_error("else clause must be last clause in cond");
@@ -445,6 +525,10 @@ Value * eval_cond(Environment *env, Value *expr) {
                 test_expr = get_car(clause);  /* Get the actual expression. */
                 return_if_error(test_expr);
 
+                /* The last expression in the clause is in tail position. */
+                if (is_nil(get_cdr(clause)))
+                    return eval_tail(env, test_expr, tail_expr);
+
                 /* Evaluate the next expression in the clause. */
                 test_result = evaluate(env, test_expr);
                 return_if_error(test_result);
@@ -479,11 +563,12 @@ Value * eval_cond(Environment *env, Value *expr) {
  *     (define (f . x) body)
  * These expressions are handled with the eval_sugared_define helper.
  */
-Value * eval_define(Environment *env, Value *expr) {
-    Value *name, *val;
+Value * eval_define(Environment *env, Value *expr, Value **tail_expr) {
+    Value *keyword, *name, *val;
 
     /* Break apart the S-expression into its component parts. */
 
+    keyword = get_car(expr);
     expr = get_cdr(expr);   /* Skip past the define atom. */
     return_if_error(expr);
 
@@ -493,7 +578,7 @@ Value * eval_define(Environment *env, Value *expr) {
 
     /* Special case:  is this a sugared lambda definition? */
     if (is_cons_pair(name))
-        return eval_sugared_define(env, expr);
+        return eval_sugared_define(env, keyword, expr);
 
     /*
      * The rest of this function is focused on handling the normal "bind a
@@ -516,6 +601,10 @@ Value * eval_define(Environment *env, Value *expr) {
     if (!create_binding(env, name->string_val, val))
         return make_error("couldn't create specified binding!");
 
+    /* Profiles report a lambda under the first name it is defined as. */
+    if (is_lambda(val) && val->lambda_val->name == NULL)
+        val->lambda_val->name = name->string_val;
+
     return val;
 }
 
@@ -526,8 +615,10 @@ Value * eval_define(Environment *env, Value *expr) {
  *     (define (f x y z) body)
  *     (define (f x y z . w) body)
  *     (define (f . x) body)
+ * keyword is the define atom itself, which the lexical-addressing pass may
+ * have marked for closure conversion.
  */
-Value * eval_sugared_define(Environment *env, Value *expr) {
+Value * eval_sugared_define(Environment *env, Value *keyword, Value *expr) {
     Value *func_spec, *body;
     Value *func_name, *func_args;
     Value *lambda;
@@ -550,11 +641,13 @@ Value * eval_sugared_define(Environment *env, Value *expr) {
     body = get_cdr(expr);
     return_if_error(body);
 
-    lambda = make_lambda(env, func_args, body);
+    lambda = make_closure(env, keyword, func_args, body);
     return_if_error(lambda);
     if (!create_binding(env, func_name->string_val, lambda))
         return make_error("couldn't create specified binding!");
 
+    lambda->lambda_val->name = func_name->string_val;
+
     return lambda;
 }
 
@@ -566,11 +659,12 @@ Value * eval_sugared_define(Environment *env, Value *expr) {
  *     (lambda (x y z . w) body)
  *     (lambda x body)
  */
-Value * eval_lambda(Environment *env, Value *expr) {
-    Value *arg_spec, *body;
+Value * eval_lambda(Environment *env, Value *expr, Value **tail_expr) {
+    Value *keyword, *arg_spec, *body;
 
     /* Break apart the S-expression into its component parts. */
 
+    keyword = get_car(expr);
     expr = get_cdr(expr);   /* Skip past the lambda atom. */
     return_if_error(expr);
 
@@ -585,7 +679,7 @@ Value * eval_lambda(Environment *env, Value *expr) {
     if (!is_cons_pair(body))
         return make_error("lambda body must be a list of scheme expressions");
 
-    return make_lambda(env, arg_spec, body);
+    return make_closure(env, keyword, arg_spec, body);
 }
 
 
@@ -595,7 +689,7 @@ Value * eval_lambda(Environment *env, Value *expr) {
  * The evaluation is very simple; the result is simply the unevaluated
  * expression.
  */
-Value * eval_quote(Environment *env, Value *expr) {
+Value * eval_quote(Environment *env, Value *expr, Value **tail_expr) {
     Value *result;
 
     expr = get_cdr(expr);   /* Skip past the quote atom. */
@@ -619,7 +713,7 @@ Value * eval_quote(Environment *env, Value *expr) {
  * The expression is evaluated normally, and then the closest existing binding
  * is updated with the new value.  Note that set! NEVER creates a new binding!
  */
-Value * eval_set_bang(Environment *env, Value *expr) {
+Value * eval_set_bang(Environment *env, Value *expr, Value **tail_expr) {
     Value *name, *val;
 
     expr = get_cdr(expr);   /* Skip past the set! atom. */
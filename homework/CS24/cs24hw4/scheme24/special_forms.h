@@ -3,7 +3,8 @@
 
 #include "types.h"
 
-Value * eval_special_form(Environment *env, Value *expr);
+Value * eval_special_form(Environment *env, Value *expr, Value **tail_expr);
+int is_special_form(char *symbol);
 
 #endif /* SPECIAL_FORMS_H */
 
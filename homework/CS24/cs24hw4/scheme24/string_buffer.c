@@ -0,0 +1,215 @@
+#include "string_buffer.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*! The capacity a string-buffer starts out with, the first time it grows. */
+#define SB_INITIAL_CAPACITY 64
+
+
+/*
+ * This is a helper function, hence the declaration/definition only within this
+ * module, and the "sbh_*" name.
+ */
+
+int sbh_grow(StringBuffer *sb, size_t min_capacity);
+
+
+
+/*! Initialize the data for a brand new string-buffer. */
+void sb_init(StringBuffer *sb) {
+    assert(sb != NULL);
+    memset(sb, 0, sizeof(StringBuffer));
+}
+
+
+/*! Reset the state of the string-buffer so that all memory is freed. */
+void sb_uninit(StringBuffer *sb) {
+    assert(sb != NULL);
+    free(sb->data);
+    memset(sb, 0, sizeof(StringBuffer));
+}
+
+
+/*!
+ * Make sure the string-buffer can hold at least the specified number of
+ * characters, plus the terminator, without any further allocation.
+ *
+ * This function returns 1 if the buffer now has the requested capacity, or 0
+ * if more memory could not be allocated.
+ */
+int sb_reserve(StringBuffer *sb, size_t capacity) {
+    assert(sb != NULL);
+
+    if (capacity < sb->capacity)
+        return 1;
+
+    return sbh_grow(sb, capacity + 1);
+}
+
+
+/*!
+ * Empty the string-buffer.  Its memory is kept, so a buffer that is cleared
+ * and filled over and over only allocates until it reaches its largest size.
+ */
+void sb_clear(StringBuffer *sb) {
+    assert(sb != NULL);
+
+    sb->length = 0;
+    if (sb->data != NULL)
+        sb->data[0] = '\0';
+}
+
+
+/*!
+ * Append n characters from str to the end of the string-buffer.
+ *
+ * This function, like the other sb_append functions, returns 1 if the
+ * characters were added, or 0 if more memory could not be allocated.
+ */
+int sb_append(StringBuffer *sb, const char *str, size_t n) {
+    assert(sb != NULL);
+    assert(str != NULL || n == 0);
+
+    if (sb->length + n >= sb->capacity) {
+        if (!sbh_grow(sb, sb->length + n + 1))
+            return 0;
+    }
+
+    memcpy(sb->data + sb->length, str, n);
+    sb->length += n;
+    sb->data[sb->length] = '\0';
+
+    return 1;
+}
+
+
+/*! Append a '\0'-terminated string to the end of the string-buffer. */
+int sb_append_str(StringBuffer *sb, const char *str) {
+    assert(str != NULL);
+    return sb_append(sb, str, strlen(str));
+}
+
+
+/*! Append a single character to the end of the string-buffer. */
+int sb_append_char(StringBuffer *sb, char c) {
+    assert(sb != NULL);
+
+    if (sb->length + 1 >= sb->capacity) {
+        if (!sbh_grow(sb, sb->length + 2))
+            return 0;
+    }
+
+    sb->data[sb->length++] = c;
+    sb->data[sb->length] = '\0';
+
+    return 1;
+}
+
+
+/*!
+ * Append the decimal digits of n to the end of the string-buffer.  This is
+ * the same as sb_printf(sb, "%ld", n), but without parsing a format string.
+ */
+int sb_append_long(StringBuffer *sb, long n) {
+    char digits[24], *p = digits + sizeof(digits);
+    unsigned long u = (n < 0) ? -(unsigned long) n : (unsigned long) n;
+
+    do {
+        *--p = '0' + (u % 10);
+        u /= 10;
+    }
+    while (u != 0);
+
+    if (n < 0)
+        *--p = '-';
+
+    return sb_append(sb, p, digits + sizeof(digits) - p);
+}
+
+
+/*! Append text formatted as printf() would to the end of the string-buffer. */
+int sb_printf(StringBuffer *sb, const char *format, ...) {
+    va_list args;
+    int n;
+
+    assert(sb != NULL);
+    assert(format != NULL);
+
+    va_start(args, format);
+    if (sb->data != NULL)
+        n = vsnprintf(sb->data + sb->length, sb->capacity - sb->length,
+                      format, args);
+    else
+        n = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    if (n < 0)
+        return 0;
+
+    if (sb->length + n >= sb->capacity) {
+        /* The text didn't fit, so make room and format it again. */
+        if (!sbh_grow(sb, sb->length + n + 1))
+            return 0;
+
+        va_start(args, format);
+        vsnprintf(sb->data + sb->length, sb->capacity - sb->length,
+                  format, args);
+        va_end(args);
+    }
+
+    sb->length += n;
+    return 1;
+}
+
+
+/*! Returns the contents of the string-buffer as a C string. */
+const char * sb_contents(StringBuffer *sb) {
+    assert(sb != NULL);
+    return sb->data != NULL ? sb->data : "";
+}
+
+
+/*!
+ * Write the contents of the string-buffer to a file, with a single call to
+ * fwrite().  Returns 1 on success, or 0 if the write failed.
+ */
+int sb_write(StringBuffer *sb, FILE *f) {
+    assert(sb != NULL);
+    assert(f != NULL);
+
+    if (sb->length == 0)
+        return 1;
+
+    return fwrite(sb->data, 1, sb->length, f) == sb->length;
+}
+
+
+/*!
+ * Grow the string-buffer so that it has room for at least min_capacity
+ * characters, including the terminator.  The capacity at least doubles, so a
+ * buffer filled one piece at a time is only copied a logarithmic number of
+ * times.
+ */
+int sbh_grow(StringBuffer *sb, size_t min_capacity) {
+    size_t capacity;
+    char *data;
+
+    capacity = sb->capacity ? sb->capacity * 2 : SB_INITIAL_CAPACITY;
+    if (capacity < min_capacity)
+        capacity = min_capacity;
+
+    data = realloc(sb->data, capacity);
+    if (data == NULL)
+        return 0;
+
+    if (sb->data == NULL)
+        data[0] = '\0';
+
+    sb->data = data;
+    sb->capacity = capacity;
+    return 1;
+}
@@ -0,0 +1,49 @@
+#ifndef STRING_BUFFER_H
+#define STRING_BUFFER_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+
+/*!
+ * A growable buffer of characters.  The contents are always terminated with a
+ * '\0', so that data can be used as a C string, but they may also contain '\0'
+ * characters of their own; length is the number of characters before the
+ * terminator.
+ */
+typedef struct StringBuffer {
+    /*! The characters in the buffer, or NULL if nothing was ever added. */
+    char *data;
+
+    /*! The number of characters in the buffer, not counting the terminator. */
+    size_t length;
+
+    /*! The number of characters data has room for, including the terminator. */
+    size_t capacity;
+} StringBuffer;
+
+
+/*!
+ * In cases where a string-buffer is statically declared, this symbol is
+ * defined to the struct-initialization code to initialize it properly.
+ */
+#define STRING_BUFFER_STATIC_INIT { NULL, 0, 0 }
+
+
+void sb_init(StringBuffer *sb);
+void sb_uninit(StringBuffer *sb);
+
+int sb_reserve(StringBuffer *sb, size_t capacity);
+void sb_clear(StringBuffer *sb);
+
+int sb_append(StringBuffer *sb, const char *str, size_t n);
+int sb_append_str(StringBuffer *sb, const char *str);
+int sb_append_char(StringBuffer *sb, char c);
+int sb_append_long(StringBuffer *sb, long n);
+int sb_printf(StringBuffer *sb, const char *format, ...);
+
+const char * sb_contents(StringBuffer *sb);
+int sb_write(StringBuffer *sb, FILE *f);
+
+
+#endif /* STRING_BUFFER_H */
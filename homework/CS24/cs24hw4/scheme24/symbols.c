@@ -0,0 +1,89 @@
+#include "symbols.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*!
+ * The symbol table is a hash table of interned names, using open addressing
+ * with linear probing.  Its capacity is always a power of two, and it is
+ * doubled whenever it becomes more than half full.
+ */
+static char **symbols;
+static unsigned int symbols_capacity;
+static unsigned int num_symbols;
+
+/*! The capacity of the symbol table when it is first created. */
+#define INITIAL_SYMBOLS_CAPACITY 256
+
+
+/*! The FNV-1a hash of a string. */
+static unsigned int hash_string(const char *s) {
+    unsigned int h = 2166136261u;
+
+    while (*s != 0) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+
+/*!
+ * Returns the slot where the specified name is stored in the table, or the
+ * empty slot where it would be stored.
+ */
+static char ** find_slot(char **table, unsigned int capacity,
+                         const char *name) {
+    unsigned int i = hash_string(name) & (capacity - 1);
+
+    while (table[i] != NULL && strcmp(table[i], name) != 0)
+        i = (i + 1) & (capacity - 1);
+
+    return table + i;
+}
+
+
+/*! Creates or doubles the symbol table, rehashing all existing names. */
+static void grow_symbols(void) {
+    unsigned int new_capacity, i;
+    char **new_symbols;
+
+    if (symbols_capacity == 0)
+        new_capacity = INITIAL_SYMBOLS_CAPACITY;
+    else
+        new_capacity = symbols_capacity * 2;
+
+    new_symbols = calloc(new_capacity, sizeof(char *));
+    if (new_symbols == NULL) {
+        fprintf(stderr, "intern_symbol: out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; i < symbols_capacity; i++) {
+        if (symbols[i] != NULL)
+            *find_slot(new_symbols, new_capacity, symbols[i]) = symbols[i];
+    }
+
+    free(symbols);
+    symbols = new_symbols;
+    symbols_capacity = new_capacity;
+}
+
+
+char * intern_symbol(const char *name) {
+    char **slot;
+
+    if (2 * (num_symbols + 1) > symbols_capacity)
+        grow_symbols();
+
+    slot = find_slot(symbols, symbols_capacity, name);
+    if (*slot == NULL) {
+        *slot = strdup(name);
+        num_symbols++;
+    }
+
+    return *slot;
+}
@@ -0,0 +1,13 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+
+/*!
+ * Returns the interned copy of a symbol name.  Every call with an equal string
+ * returns the same pointer, so interned names can be compared with == instead
+ * of strcmp().  Interned names are never freed, and must not be modified.
+ */
+char * intern_symbol(const char *name);
+
+
+#endif /* SYMBOLS_H */
@@ -7,12 +7,15 @@
 #ifndef TYPES_H
 #define TYPES_H
 
+#include <stdint.h>
+
 #include "ptr_vector.h"
+#include "string_buffer.h"
 
 
 /*! A struct for tracking variable-bindings within an environment. */
 typedef struct Binding {
-    char *name;             /*!< The name of the binding. */
+    char *name;             /*!< The name of the binding (an interned symbol). */
     struct Value *value;    /*!< The value that is bound to the name. */
 } Binding;
 
@@ -41,6 +44,17 @@ typedef struct Environment {
     /*! An array of "binding" structs, which store the name/value pairs. */
     Binding *bindings;
 
+    /*!
+     * Environments with many bindings also get a hash index, so that looking up
+     * a name doesn't have to scan every binding.  Each slot holds a binding's
+     * position plus one, or 0 if the slot is empty.  This is NULL for small
+     * environments.
+     */
+    int *index;
+
+    /*! The number of slots in the hash index; always a power of two. */
+    int index_capacity;
+
 
     /*!
      * Pointer to parent environment.  This will be set to NULL for the global
@@ -51,6 +65,12 @@ typedef struct Environment {
     /*! For garbage collection. */
     int marked;
 
+    /*! Nonzero once the environment has been promoted to the old generation. */
+    char old;
+
+    /*! Nonzero while the environment is in the GC's remembered set. */
+    char remembered;
+
 } Environment;
 
 
@@ -66,7 +86,11 @@ typedef enum Type {
     T_String,
     T_Float,
     T_Lambda,
-    T_ConsPair
+    T_ConsPair,
+    T_Vector,
+    T_HashTable,
+    T_Fixnum,
+    T_StringBuilder
 } Type;
 
 
@@ -81,6 +105,48 @@ typedef struct ConsPair {
 } ConsPair;
 
 
+/*!
+ * A vector is a fixed-length array of values, which unlike a list can be
+ * indexed in constant time.  The elements array belongs to the vector.
+ */
+typedef struct Vector {
+    struct Value **elems;   /*!< The elements. */
+    int length;             /*!< The number of elements. */
+} Vector;
+
+
+/*!
+ * A hash table maps keys to values.  Keys are compared the way eq? compares
+ * values:  atoms, numbers and strings by their contents, and everything else
+ * by identity.  The table uses open addressing with linear probing; its capacity
+ * is a power of two, and it doubles whenever it becomes more than half full.
+ * The table and its arrays belong to the hash-table Value.
+ */
+typedef struct HashTable {
+    int count;              /*!< The number of entries. */
+    int capacity;           /*!< The number of slots. */
+    struct Value **keys;    /*!< Each slot's key, or NULL if it's empty. */
+    struct Value **values;  /*!< Each slot's value. */
+} HashTable;
+
+
+/*! The lex_depth of an atom whose variable must be looked up by name. */
+#define LEX_UNRESOLVED (-1)
+
+/*!
+ * The lex_depth of an atom that can only name a variable in the global
+ * environment.  Its lex_index caches the position of that binding, once the
+ * variable has been found, or is LEX_UNRESOLVED until then.
+ */
+#define LEX_GLOBAL (-2)
+
+/*!
+ * The lex_depth of a lambda or define keyword atom whose lambda gets a flat
+ * closure record.  Its lex_index is the id of the closure template.
+ */
+#define LEX_CLOSURE (-3)
+
+
 /*!
  * This is a tagged data type used to represent all the different kinds of
  * values that this Scheme interpreter supports.  The type field indicates the
@@ -102,19 +168,80 @@ typedef struct Value {
         float  float_val;            /* T_Float */
         struct Lambda *lambda_val;   /* T_Lambda */
         ConsPair cons_val;           /* T_ConsPair */
+        Vector vector_val;           /* T_Vector */
+        HashTable *table_val;        /* T_HashTable */
+        StringBuffer *builder_val;   /* T_StringBuilder */
+
+        /*
+         * T_Atom:  an atom that names a local variable also records where the
+         * variable lives, as the number of parent_env links to follow and the
+         * binding's position in that environment.  atom_name is the same
+         * pointer as string_val.  See lexical.c.
+         */
+        struct {
+            char *atom_name;
+            short lex_depth;         /* LEX_UNRESOLVED or LEX_GLOBAL if not known */
+            short lex_index;
+        };
     };
 
     /*! For garbage collection. */
     int marked;
 
+    /*! Nonzero once the value has been promoted to the old generation. */
+    char old;
+
+    /*! Nonzero while the value is in the GC's remembered set. */
+    char remembered;
+
 } Value;
 
 
+/*
+ * Floats don't need a Value struct of their own when a pointer is wide enough
+ * to hold one.  On hosts with 64-bit pointers, make_float() stores the float's
+ * bits in the upper half of the Value pointer itself and sets the lowest bit,
+ * which is always clear in a real pointer.  Such an "immediate" value must
+ * never be dereferenced; use get_type() and get_float() from values.h to look
+ * at a Value that might be one.  The garbage collector skips them entirely.
+ */
+#if UINTPTR_MAX > 0xFFFFFFFFu
+#define IMMEDIATE_FLOATS
+#endif
+
+/*! The tag bit that marks a Value pointer as an immediate value. */
+#define IMMEDIATE_TAG ((uintptr_t) 1)
+
+/*! Nonzero if v is an immediate value rather than a pointer to a Value. */
+#define is_immediate(v) (((uintptr_t) (v) & IMMEDIATE_TAG) != 0)
+
+/*
+ * Integers are always immediate:  a fixnum is a Value pointer whose lowest two
+ * bits are both set, with the integer itself in the remaining bits.  That
+ * leaves room for 62-bit integers on 64-bit hosts, and 30-bit integers on
+ * 32-bit hosts; results outside that range are promoted to floats.  An
+ * immediate float has only the lowest bit set.
+ */
+
+/*! The tag bits that mark a Value pointer as a fixnum. */
+#define FIXNUM_TAG ((uintptr_t) 3)
+
+/*! The number of tag bits below a fixnum's integer. */
+#define FIXNUM_SHIFT 2
+
+/*! The range of integers that can be fixnums. */
+#define FIXNUM_MAX (INTPTR_MAX >> FIXNUM_SHIFT)
+#define FIXNUM_MIN (-FIXNUM_MAX - 1)
+
+
 /*!
  * This type-definition declares the interface used for calling procedures that
- * are implemented in C, hence the name "native lambda."
+ * are implemented in C, hence the name "native lambda."  The evaluated
+ * arguments are passed as an array of num_args values, which lives on the
+ * evaluator's operand stack.  The array is only valid until the native lambda
+ * evaluates any Scheme code itself, since that can grow the stack.
  */
-typedef Value * (*NativeLambda)(int num_args, Value *inputs);
+typedef Value * (*NativeLambda)(int num_args, Value **argv);
 
 
 /*!
@@ -150,9 +277,22 @@ typedef struct Lambda {
     /*! The parent environment of the lambda. */
     struct Environment *parent_env;
 
+    /*! The compiled body of an interpreted lambda; see bytecode.c. */
+    struct Code *code;
+
+    /*!
+     * The interned name the lambda was first bound to by define, or the name
+     * a native lambda is registered under; NULL for an anonymous lambda.  Only
+     * the profiler uses this.
+     */
+    char *name;
+
     /*! For garbage collection. */
     int marked;
 
+    /*! Nonzero once the lambda has been promoted to the old generation. */
+    char old;
+
 } Lambda;
 
 
@@ -171,6 +311,12 @@ typedef struct EvaluationContext {
     /*! The expression being evaluated in this context. */
     Value *expression;
 
+    /*!
+     * If this context is running the body of a procedure, the name it is
+     * reported under by the profiler; otherwise NULL.  See profile.c.
+     */
+    const char *procedure;
+
     /*!
      * An evaluation frequently requires multiple nested evaluations, such as
      * when a procedure is being called and its operands need to be evaluated.
@@ -6,11 +6,13 @@
 #include "values.h"
 #include "alloc.h"
 #include "evaluator.h"
+#include "symbols.h"
 
 
 static char *value_type_names[] = {
     "T_Error", "T_Nil", "T_Atom", "T_Boolean", "T_String", "T_Float",
-    "T_Lambda", "T_ConsPair"
+    "T_Lambda", "T_ConsPair", "T_Vector", "T_HashTable", "T_Fixnum",
+    "T_StringBuilder"
 };
 
 
@@ -21,7 +23,7 @@ void raw_print_value(const Value *v) {
         return;
     }
 
-    switch (v->type) {
+    switch (get_type(v)) {
 
     case T_Nil:
         printf("nil");
@@ -37,7 +39,12 @@ void raw_print_value(const Value *v) {
         break;
 
     case T_Float:
-        printf("Value[%s:%f]\n", value_type_names[v->type], v->float_val);
+        printf("Value[%s:%f]\n", value_type_names[T_Float], get_float(v));
+        break;
+
+    case T_Fixnum:
+        printf("Value[%s:%ld]\n", value_type_names[T_Fixnum],
+            (long) get_fixnum(v));
         break;
 
     case T_ConsPair:
@@ -51,44 +58,54 @@ void raw_print_value(const Value *v) {
 }
 
 
-void print_value(FILE *f, const Value *v) {
-    assert(f != NULL);
+/*!
+ * Appends the printed form of a value to a string-buffer, the same way
+ * print_value() prints it.  The interpreter prints values by formatting them
+ * into a buffer first, so that printing a large list is just a few memory
+ * copies and a single write, rather than one stdio call per element.
+ */
+void format_value(StringBuffer *sb, const Value *v) {
+    assert(sb != NULL);
 
     if (v == NULL) {
-        fprintf(f, "NULL");
+        sb_append_str(sb, "NULL");
         return;
     }
 
-    switch (v->type) {
+    switch (get_type(v)) {
 
     case T_Nil:
-        fprintf(f, "nil");
+        sb_append_str(sb, "nil");
         break;
 
     case T_Boolean:
-        fprintf(f, "%s", (v->bool_val ? "#t" : "#f"));
+        sb_append_str(sb, (v->bool_val ? "#t" : "#f"));
         break;
 
     case T_Atom:
     case T_String:
-        fprintf(f, "%s", v->string_val);
+        sb_append_str(sb, v->string_val);
         break;
 
     case T_Float:
-        fprintf(f, "%g", v->float_val);
+        sb_printf(sb, "%g", get_float(v));
+        break;
+
+    case T_Fixnum:
+        sb_append_long(sb, (long) get_fixnum(v));
         break;
 
     case T_Lambda:
         if (!v->lambda_val->native_impl) {
-            fprintf(f, "#lambda[args=");
-            print_value(f, v->lambda_val->arg_spec);
-            fprintf(f, " body=");
-            print_value(f, v->lambda_val->body);
-            fprintf(f, "]");
+            sb_append_str(sb, "#lambda[args=");
+            format_value(sb, v->lambda_val->arg_spec);
+            sb_append_str(sb, " body=");
+            format_value(sb, v->lambda_val->body);
+            sb_append_char(sb, ']');
         }
         else {
-            fprintf(f, "#native_lambda[0x%08x]",
-                    (unsigned int) v->lambda_val->func);
+            sb_printf(sb, "#native_lambda[0x%08x]",
+                      (unsigned int) v->lambda_val->func);
         }
         break;
 
@@ -98,46 +115,84 @@ void print_value(FILE *f, const Value *v) {
             Value *cdr;
             int first = 1;
 
-            fprintf(f, "(");
+            sb_append_char(sb, '(');
 
             while (1) {
                 car = v->cons_val.p_car;
                 cdr = v->cons_val.p_cdr;
 
                 if (!first)
-                    fprintf(f, " ");
+                    sb_append_char(sb, ' ');
                 else
                     first = 0;
 
-                print_value(f, car);
+                format_value(sb, car);
 
-                if (cdr != NULL && cdr->type == T_ConsPair)
+                if (is_cons_pair(cdr))
                     v = cdr;
                 else
                     break;
             }
 
-            assert(cdr == NULL || cdr->type != T_ConsPair);
+            assert(!is_cons_pair(cdr));
 
-            if (cdr != NULL && cdr->type == T_Nil) {
-                fprintf(f, ")");
+            if (is_nil(cdr)) {
+                sb_append_char(sb, ')');
             }
             else {
-                fprintf(f, " . ");
-                print_value(f, cdr);
-                fprintf(f, ")");
+                sb_append_str(sb, " . ");
+                format_value(sb, cdr);
+                sb_append_char(sb, ')');
             }
         }
         break;
 
+    case T_Vector:
+        {
+            int i;
+
+            sb_append_str(sb, "#(");
+            for (i = 0; i < v->vector_val.length; i++) {
+                if (i > 0)
+                    sb_append_char(sb, ' ');
+                format_value(sb, v->vector_val.elems[i]);
+            }
+            sb_append_char(sb, ')');
+        }
+        break;
+
+    case T_HashTable:
+        sb_printf(sb, "#hash-table[count=%d]", v->table_val->count);
+        break;
+
+    case T_StringBuilder:
+        sb_printf(sb, "#string-builder[length=%lu]",
+                  (unsigned long) v->builder_val->length);
+        break;
+
     case T_Error:
-        fprintf(f, "ERROR:  %s", v->string_val);
+        sb_append_str(sb, "ERROR:  ");
+        sb_append_str(sb, v->string_val);
         break;
 
     default:
-        fprintf(f, "UNKNOWN");
+        sb_append_str(sb, "UNKNOWN");
     }
+}
+
+
+/*! Prints a value to a file, formatting it into a buffer first. */
+void print_value(FILE *f, const Value *v) {
+    /* Reused from one call to the next, so it only grows to the largest
+     * value printed.
+     */
+    static StringBuffer print_buffer = STRING_BUFFER_STATIC_INIT;
 
+    assert(f != NULL);
+
+    sb_clear(&print_buffer);
+    format_value(&print_buffer, v);
+    sb_write(&print_buffer, f);
 }
 
 
@@ -160,58 +215,64 @@ Value * make_error(const char *str, ...) {
 
     v->type = T_Error;
     v->string_val = strdup(buf);
+    if (v->string_val != NULL)
+        note_payload(v, strlen(v->string_val) + 1);
 
     return v;
 }
 
 
 
-/*! Returns a pointer to the nil value. */
-Value * make_nil() {
-    Value *v = alloc_value();
+/*
+ * There is only one nil value and one of each Boolean value.  They live
+ * outside the garbage-collected heap, already marked and old, so the collector
+ * never traces or frees them.  They are never modified:  set_car() and
+ * set_cdr() only accept cons pairs.
+ */
+static Value nil_value = { .type = T_Nil, .marked = 1, .old = 1 };
+static Value true_value = {
+    .type = T_Boolean, .bool_val = 1, .marked = 1, .old = 1
+};
+static Value false_value = {
+    .type = T_Boolean, .bool_val = 0, .marked = 1, .old = 1
+};
 
-    v->type = T_Nil;
 
-    return v;
+/*! Returns a pointer to the nil value. */
+Value * make_nil() {
+    return &nil_value;
 }
 
 
 /*!
  * Given a string representation of an atom, this function creates a new Value
- * object of type T_Atom.  Note that the passed-in string is NOT owned by the
- * new Value object; rather, the input is copied.
+ * object of type T_Atom.  The atom's name is the interned copy of the string,
+ * so two atoms with the same name share one string_val pointer.
  */
 Value * make_atom(const char *str) {
     Value *v = alloc_value();
 
     v->type = T_Atom;
-    v->string_val = strdup(str);
+    v->string_val = intern_symbol(str);
+    v->lex_depth = LEX_UNRESOLVED;
 
     return v;
 }
 
 
-/*!
- * Given a Boolean value, this function creates a new Value object of type
- * T_Boolean.
- */
+/*! Given a C truth value, this function returns the Scheme #t or #f value. */
 Value * make_bool(int b) {
-    Value *v = alloc_value();
-
-    v->type = T_Boolean;
-    v->bool_val = b;
-
-    return v;
+    return b ? &true_value : &false_value;
 }
 
-/*! This function creates a new Boolean true value. */
+/*! This function returns the Boolean true value. */
 Value * make_true() {
-    return make_bool(1);
+    return &true_value;
 }
 
-/*! This function creates a new Boolean false value. */
+/*! This function returns the Boolean false value. */
 Value * make_false() {
-    return make_bool(0);
+    return &false_value;
 }
 
 
@@ -225,18 +286,43 @@ Value * make_string(const char *str) {
 
     v->type = T_String;
     v->string_val = strdup(str);
+    if (v->string_val != NULL)
+        note_payload(v, strlen(v->string_val) + 1);
 
     return v;
 }
 
 
+/*!
+ * Returns a T_Float value holding f.  Where pointers are wide enough, this is
+ * an immediate value and nothing is allocated; see types.h.
+ */
 Value * make_float(float f) {
+#ifdef IMMEDIATE_FLOATS
+    uint32_t bits;
+
+    memcpy(&bits, &f, sizeof(bits));
+    return (Value *) (((uintptr_t) bits << 32) | IMMEDIATE_TAG);
+#else
     Value *v = alloc_value();
 
     v->type = T_Float;
     v->float_val = f;
 
     return v;
+#endif
+}
+
+
+/*!
+ * Returns the integer n as a fixnum, or as a T_Float value if it is too large
+ * in magnitude to be a fixnum.
+ */
+Value * make_integer(intptr_t n) {
+    if (n < FIXNUM_MIN || n > FIXNUM_MAX)
+        return make_float((float) n);
+
+    return make_fixnum(n);
 }
 
 
@@ -251,6 +337,107 @@ Value * make_cons(Value *car, Value *cdr) {
 }
 
 
+/*! Creates a new proper list holding the n values in elems, in order. */
+Value * make_list(int n, Value **elems) {
+    Value *list = make_nil();
+
+    while (n > 0) {
+        n--;
+        list = make_cons(elems[n], list);
+    }
+
+    return list;
+}
+
+
+/*!
+ * Creates a new vector of the specified length, with every element set to
+ * fill.  Returns an error value if the memory couldn't be allocated.
+ */
+Value * make_vector(int length, Value *fill) {
+    Value *v;
+    Value **elems;
+    int i;
+
+    assert(length >= 0);
+    assert(fill != NULL);
+
+    elems = malloc((length > 0 ? length : 1) * sizeof(Value *));
+    if (elems == NULL)
+        return make_error("out of memory allocating a vector of %d", length);
+
+    for (i = 0; i < length; i++)
+        elems[i] = fill;
+
+    v = alloc_value();
+    v->type = T_Vector;
+    v->vector_val.elems = elems;
+    v->vector_val.length = length;
+    note_payload(v, (length > 0 ? length : 1) * sizeof(Value *));
+
+    return v;
+}
+
+
+/*! The number of slots in a new hash table; always a power of two. */
+#define INITIAL_TABLE_CAPACITY 8
+
+/*!
+ * Creates a new, empty hash table.  Returns an error value if the memory
+ * couldn't be allocated.
+ */
+Value * make_hash_table() {
+    Value *v;
+    HashTable *table;
+
+    table = malloc(sizeof(HashTable));
+    if (table != NULL) {
+        table->count = 0;
+        table->capacity = INITIAL_TABLE_CAPACITY;
+        table->keys = calloc(INITIAL_TABLE_CAPACITY, sizeof(Value *));
+        table->values = calloc(INITIAL_TABLE_CAPACITY, sizeof(Value *));
+    }
+    if (table == NULL || table->keys == NULL || table->values == NULL) {
+        if (table != NULL) {
+            free(table->keys);
+            free(table->values);
+            free(table);
+        }
+        return make_error("out of memory allocating a hash table");
+    }
+
+    v = alloc_value();
+    v->type = T_HashTable;
+    v->table_val = table;
+    note_payload(v, sizeof(HashTable) +
+                 2 * INITIAL_TABLE_CAPACITY * sizeof(Value *));
+
+    return v;
+}
+
+
+/*!
+ * Creates a new, empty string builder.  Returns an error value if the memory
+ * couldn't be allocated.
+ */
+Value * make_string_builder() {
+    Value *v;
+    StringBuffer *sb;
+
+    sb = malloc(sizeof(StringBuffer));
+    if (sb == NULL)
+        return make_error("out of memory allocating a string builder");
+    sb_init(sb);
+
+    v = alloc_value();
+    v->type = T_StringBuilder;
+    v->builder_val = sb;
+    note_payload(v, sizeof(StringBuffer));
+
+    return v;
+}
+
+
 Value * make_lambda(Environment *parent_env, Value *arg_spec, Value *body) {
     Value *v;
     Lambda *f;
@@ -318,11 +505,11 @@ Value * make_native_lambda(Environment *parent_env, NativeLambda func) {
 
 
 int is_atom(Value *v) {
-    return (v != NULL && v->type == T_Atom);
+    return (v != NULL && get_type(v) == T_Atom);
 }
 
 int is_bool(Value *v) {
-    return (v != NULL && v->type == T_Boolean);
+    return (v != NULL && get_type(v) == T_Boolean);
 }
 
 /*!
@@ -339,32 +526,49 @@ int is_true(Value *v) {
  * value #f counts as false.  Every other value, including nil, counts as true.
  */
 int is_false(Value *v) {
-    return (v != NULL && v->type == T_Boolean && v->bool_val == 0);
+    return (v == &false_value);
 }
 
 int is_error(Value *v) {
-    return (v != NULL && v->type == T_Error);
+    return (v != NULL && get_type(v) == T_Error);
 }
 
 int is_float(Value *v) {
-    return (v != NULL && v->type == T_Float);
+    return (v != NULL && get_type(v) == T_Float);
+}
+
+/*! Nonzero if v is a number:  either a fixnum, or a T_Float value. */
+int is_number(Value *v) {
+    return (v != NULL && (is_fixnum(v) || get_type(v) == T_Float));
 }
 
 int is_string(Value *v) {
-    return (v != NULL && v->type == T_String);
+    return (v != NULL && get_type(v) == T_String);
 }
 
 int is_cons_pair(Value *v) {
-    return (v != NULL && v->type == T_ConsPair);
+    return (v != NULL && get_type(v) == T_ConsPair);
 }
 
 int is_nil(Value *v) {
-    return (v != NULL && v->type == T_Nil);
+    return (v == &nil_value);
 }
 
 
 int is_lambda(Value *v) {
-    return (v != NULL && v->type == T_Lambda);
+    return (v != NULL && get_type(v) == T_Lambda);
+}
+
+int is_vector(Value *v) {
+    return (v != NULL && get_type(v) == T_Vector);
+}
+
+int is_hash_table(Value *v) {
+    return (v != NULL && get_type(v) == T_HashTable);
+}
+
+int is_string_builder(Value *v) {
+    return (v != NULL && get_type(v) == T_StringBuilder);
 }
 
 
@@ -409,6 +613,7 @@ void set_car(Value *cons, Value *v) {
 
     assert(v != NULL);
 
+    write_barrier_value(cons, v);
     cons->cons_val.p_car = v;
 }
 
@@ -418,6 +623,7 @@ void set_cdr(Value *cons, Value *v) {
 
     assert(v != NULL);
 
+    write_barrier_value(cons, v);
     cons->cons_val.p_cdr = v;
 }
 
@@ -469,3 +675,191 @@ void append_value_to_list(ListBuilder *builder, Value *v) {
     }
 }
 
+
+
+/*
+ * Hash-table operations.  Keys are compared the way eq? compares values, so
+ * the hash of a key has to depend on the same things:  the interned name of an
+ * atom, the contents of a string, the value of a number, and the address of
+ * anything else.
+ */
+
+static unsigned int hash_key(Value *key) {
+    uintptr_t h;
+    uint32_t bits;
+    float f;
+    const char *p;
+
+    switch (get_type(key)) {
+    case T_String:
+        h = 2166136261u;
+        for (p = key->string_val; *p != '\0'; p++)
+            h = (h ^ (unsigned char) *p) * 16777619u;
+        break;
+
+    case T_Float:
+        /* 0 and -0 are eq?, so they must hash the same. */
+        f = get_float(key);
+        if (f == 0)
+            f = 0;
+        memcpy(&bits, &f, sizeof(bits));
+        h = bits;
+        break;
+
+    case T_Atom:
+        h = (uintptr_t) key->string_val;
+        break;
+
+    default:
+        h = (uintptr_t) key;
+    }
+
+    h ^= h >> 16;
+    h *= 0x45D9F3Bu;
+    return (unsigned int) (h ^ (h >> 16));
+}
+
+static int keys_equal(Value *k1, Value *k2) {
+    Type type = get_type(k1);
+
+    if (k1 == k2)
+        return 1;
+    if (type != get_type(k2))
+        return 0;
+
+    switch (type) {
+    case T_String:
+        return strcmp(k1->string_val, k2->string_val) == 0;
+    case T_Float:
+        return get_float(k1) == get_float(k2);
+    case T_Atom:
+        return k1->string_val == k2->string_val;
+    default:
+        return 0;
+    }
+}
+
+/*! Returns the slot that holds key, or the empty slot where it would go. */
+static int find_slot(HashTable *table, Value *key) {
+    int mask = table->capacity - 1;
+    int i = hash_key(key) & mask;
+
+    while (table->keys[i] != NULL && !keys_equal(table->keys[i], key))
+        i = (i + 1) & mask;
+
+    return i;
+}
+
+
+/*!
+ * Moves every entry of a hash table into new slot arrays of the specified
+ * capacity.  Returns 1 on success, or 0 if the arrays couldn't be allocated,
+ * in which case the table is unchanged.
+ */
+static int resize_table(HashTable *table, int capacity) {
+    Value **old_keys = table->keys, **old_values = table->values;
+    int old_capacity = table->capacity, i, j;
+    Value **new_keys = calloc(capacity, sizeof(Value *));
+    Value **new_values = calloc(capacity, sizeof(Value *));
+
+    if (new_keys == NULL || new_values == NULL) {
+        free(new_keys);
+        free(new_values);
+        return 0;
+    }
+
+    table->keys = new_keys;
+    table->values = new_values;
+    table->capacity = capacity;
+    for (i = 0; i < old_capacity; i++) {
+        if (old_keys[i] != NULL) {
+            j = find_slot(table, old_keys[i]);
+            table->keys[j] = old_keys[i];
+            table->values[j] = old_values[i];
+        }
+    }
+
+    free(old_keys);
+    free(old_values);
+    return 1;
+}
+
+
+/*!
+ * Puts every key of a hash table back in the slot its hash now selects.  The
+ * copying collector calls this after moving a table's keys, since keys that
+ * are hashed by address have new hashes once they move.
+ */
+void rehash_table(Value *table_val) {
+    assert(is_hash_table(table_val));
+
+    if (!resize_table(table_val->table_val, table_val->table_val->capacity)) {
+        fprintf(stderr, "rehash_table: out of memory\n");
+        exit(1);
+    }
+}
+
+
+/*!
+ * Returns the value that a hash table maps key to, or NULL if the table has
+ * no entry for key.
+ */
+Value * hash_table_get(Value *table_val, Value *key) {
+    HashTable *table;
+    int i;
+
+    assert(is_hash_table(table_val));
+    assert(key != NULL);
+
+    table = table_val->table_val;
+    i = find_slot(table, key);
+    return table->keys[i] != NULL ? table->values[i] : NULL;
+}
+
+
+/*!
+ * Maps key to v in a hash table, replacing any value key had before.  Returns
+ * 1 on success, or 0 if the table needed to grow and couldn't.
+ */
+int hash_table_set(Value *table_val, Value *key, Value *v) {
+    HashTable *table;
+    int i;
+
+    assert(is_hash_table(table_val));
+    assert(key != NULL);
+    assert(v != NULL);
+
+    table = table_val->table_val;
+
+    if (2 * (table->count + 1) > table->capacity) {
+        if (!resize_table(table, 2 * table->capacity))
+            return 0;
+
+        /* Both slot arrays doubled, adding capacity slots between them. */
+        note_payload(table_val, table->capacity * sizeof(Value *));
+    }
+
+    /* The table may be old, and the key and value young. */
+    write_barrier_value(table_val, key);
+    write_barrier_value(table_val, v);
+
+    i = find_slot(table, key);
+    if (table->keys[i] == NULL) {
+        table->keys[i] = key;
+        table->count++;
+    }
+    table->values[i] = v;
+
+    return 1;
+}
+
+
+/*! Sets element i of a vector to v.  The index must be in range. */
+void vector_set(Value *vector, int i, Value *v) {
+    assert(is_vector(vector));
+    assert(i >= 0 && i < vector->vector_val.length);
+    assert(v != NULL);
+
+    write_barrier_value(vector, v);
+    vector->vector_val.elems[i] = v;
+}
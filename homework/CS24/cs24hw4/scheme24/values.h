@@ -4,11 +4,13 @@
 
 #include "types.h"
 #include <stdio.h>
+#include <string.h>
 
 
 void raw_print_value(const Value *v);
 
 void print_value(FILE *f, const Value *v);
+void format_value(StringBuffer *sb, const Value *v);
 
 
 Value * make_error(const char *str, ...) __attribute__((format (printf, 1, 2)));
@@ -21,13 +23,66 @@ Value * make_false(void);
 
 Value * make_string(const char *str);
 Value * make_float(float f);
+Value * make_integer(intptr_t n);
 
 Value * make_nil(void);
 Value * make_cons(Value *car, Value *cdr);
+Value * make_list(int n, Value **elems);
+
+Value * make_vector(int length, Value *fill);
+Value * make_hash_table(void);
+Value * make_string_builder(void);
 
 Value * make_lambda(struct Environment *parent_env, Value *arg_spec, Value *body);
 Value * make_native_lambda(struct Environment *parent_env, NativeLambda func);
 
+/*! Nonzero if v is a fixnum.  Unlike is_float(), v may not be NULL. */
+static inline int is_fixnum(const Value *v) {
+    return ((uintptr_t) v & FIXNUM_TAG) == FIXNUM_TAG;
+}
+
+/*! Returns the integer held by v, which must be a fixnum. */
+static inline intptr_t get_fixnum(const Value *v) {
+    /* Arithmetic shift of the pointer bits recovers the sign. */
+    return (intptr_t) v >> FIXNUM_SHIFT;
+}
+
+/*!
+ * Returns a fixnum holding n, which must be between FIXNUM_MIN and FIXNUM_MAX;
+ * make_integer() checks the range.
+ */
+static inline Value * make_fixnum(intptr_t n) {
+    return (Value *) (((uintptr_t) n << FIXNUM_SHIFT) | FIXNUM_TAG);
+}
+
+/*! Returns the type of v, which may be an immediate value. */
+static inline Type get_type(const Value *v) {
+    if (is_immediate(v))
+        return is_fixnum(v) ? T_Fixnum : T_Float;
+    return v->type;
+}
+
+/*!
+ * Returns the number held by v as a float.  v must be a T_Float value or a
+ * fixnum; see is_number().
+ */
+static inline float get_float(const Value *v) {
+    if (is_fixnum(v))
+        return (float) get_fixnum(v);
+
+#ifdef IMMEDIATE_FLOATS
+    if (is_immediate(v)) {
+        uint32_t bits = (uint32_t) ((uintptr_t) v >> 32);
+        float f;
+
+        memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+#endif
+    return v->float_val;
+}
+
+
 int is_atom(Value *v);
 
 int is_bool(Value *v);
@@ -37,6 +92,7 @@ int is_false(Value *v);
 int is_error(Value *v);
 
 int is_float(Value *v);
+int is_number(Value *v);
 
 int is_string(Value *v);
 
@@ -46,6 +102,10 @@ int is_nil(Value *v);
 
 int is_lambda(Value *v);
 
+int is_vector(Value *v);
+int is_hash_table(Value *v);
+int is_string_builder(Value *v);
+
 
 Value * get_car(Value *cons);
 Value * get_cdr(Value *cons);
@@ -59,6 +119,13 @@ void set_cdr(Value *cons, Value *v);
 int list_length(Value *cons);
 
 
+void vector_set(Value *vector, int i, Value *v);
+
+Value * hash_table_get(Value *table, Value *key);
+int hash_table_set(Value *table, Value *key, Value *v);
+void rehash_table(Value *table);
+
+
 #define return_if_error(v) { if (is_error(v)) return (v); }
 #define goto_done_if_error(v) { if (is_error(v)) { result = (v); goto Done; } }
 
@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <time.h>
 
 #include "cmdline.h"
@@ -7,9 +9,15 @@
 #include "cache.h"
 
 
-/* This is the number of nodes to have in the graph. */
+/* This is the default number of nodes to have in the graph. */
 #define NUM_NODES 400
 
+/* This is the default edge length of the tiles used by the tiled and
+ * recursive algorithms.  A 32x32 tile of ints is 4KB, so the three tiles
+ * that each step works on fit comfortably in a typical L1 cache.
+ */
+#define TILE_SIZE 32
+
 /* This is a value between 0 and 100 indicating the percent of edges
  * that are connections.
  */
@@ -25,43 +33,157 @@
 #define SEED 54321098
 
 
+/* The weights and paths are held either in the simulated memory, or, when
+ * p_mem is NULL, in the native array, so that each algorithm can also be
+ * timed without the simulator.  Both hold the nodes x nodes weight matrix
+ * followed by the nodes x nodes path matrix.
+ */
 typedef struct {
     int num_nodes;
 
+    /* The edge length of the tiles used by the tiled algorithms. */
+    int tile_size;
+
     membase_t *p_mem;
+    int *native;
 } shortest_path_info;
 
 
+/* An all-points-shortest-paths algorithm that can be selected with -a. */
+typedef struct {
+    const char *name;
+    void (*compute)(shortest_path_info *info);
+} apsp_algorithm;
+
+
+void apsptest_usage(const char *progname);
+void generate_graph(shortest_path_info *info);
+void clear_paths(shortest_path_info *info);
+void run_algorithm(const apsp_algorithm *algorithm, membase_t *p_mem,
+                   int num_nodes, int tile_size);
+
+void compute_shortest_paths(shortest_path_info *info);
+void compute_tiled_shortest_paths(shortest_path_info *info);
+void compute_recursive_shortest_paths(shortest_path_info *info);
+
+void relax_tile(shortest_path_info *info, int row0, int col0, int mid0,
+                int size);
+void recursive_relax(shortest_path_info *info, int row0, int col0, int mid0,
+                     int size);
+
+
+/* The algorithms, for looking them up by name. */
+static const apsp_algorithm all_algorithms[] = {
+    { "textbook", compute_shortest_paths },
+    { "tiled", compute_tiled_shortest_paths },
+    { "recursive", compute_recursive_shortest_paths },
+    { NULL, NULL }
+};
+
+
+/* Prints the program usage. */
+void apsptest_usage(const char *progname) {
+    printf("usage: %s [-a algorithm] [-t tile] [-n nodes] [cache-spec ...]"
+           "\n\n", progname);
+    printf("\tComputes the all-points-shortest-paths of a random graph "
+           "through the\n");
+    printf("\tsimulated memory, and then again natively to time it.\n\n");
+    printf("\t-a algorithm  textbook (the default), tiled, recursive, or "
+           "all to run\n");
+    printf("\t              each of them in turn\n");
+    printf("\t-t tile       the tile edge length of the tiled and recursive "
+           "algorithms\n");
+    printf("\t              (default %d)\n", TILE_SIZE);
+    printf("\t-n nodes      the number of nodes in the graph (default %d)"
+           "\n\n", NUM_NODES);
+    printf("\tCache specifications are in the form B:S:E, as for the other "
+           "test\n");
+    printf("\tprograms:  B = block size, S = number of cache-sets, and "
+           "E = number\n");
+    printf("\tof cache-lines per set.\n");
+}
+
+
 int get_weight(shortest_path_info *info, int row, int col) {
+    if (info->p_mem == NULL)
+        return info->native[row * info->num_nodes + col];
+
     return read_int(info->p_mem, row * info->num_nodes + col);
 }
 
 
 void set_weight(shortest_path_info *info, int row, int col, int weight) {
+    if (info->p_mem == NULL) {
+        info->native[row * info->num_nodes + col] = weight;
+        return;
+    }
+
     write_int(info->p_mem, row * info->num_nodes + col, weight);
 }
 
 
 int get_path(shortest_path_info *info, int row, int col) {
     int nodes = info->num_nodes;
+
+    if (info->p_mem == NULL)
+        return info->native[nodes * nodes + row * nodes + col];
+
     return read_int(info->p_mem, nodes * nodes + row * nodes + col);
 }
 
 
 void set_path(shortest_path_info *info, int row, int col, int node) {
     int nodes = info->num_nodes;
+
+    if (info->p_mem == NULL) {
+        info->native[nodes * nodes + row * nodes + col] = node;
+        return;
+    }
+
     write_int(info->p_mem, nodes * nodes + row * nodes + col, node);
 }
 
 
-void compute_shortest_paths(shortest_path_info *info) {
+/* Fills in the weights of a random graph, always the same one for a given
+ * number of nodes.
+ */
+void generate_graph(shortest_path_info *info) {
+    int i, j;
+
+    srand(SEED);
+
+    for (i = 0; i < info->num_nodes; i++) {
+        for (j = 0; j < info->num_nodes; j++) {
+            if (i != j) {
+                if (rand() % 100 < CONNECTED_PCT)
+                    set_weight(info, i, j, 1 + rand() % 10);
+                else
+                    set_weight(info, i, j, INFINITY);
+            }
+            else {
+                set_weight(info, i, j, 0);
+            }
+        }
+    }
+}
+
+
+void clear_paths(shortest_path_info *info) {
     int nodes = info->num_nodes;
-    int i, j, k;
+    int i, j;
 
     printf(" * Clearing the path-reconstruction state.\n");
     for (i = 0; i < nodes; i++)
         for (j = 0; j < nodes; j++)
             set_path(info, i, j, -1);
+}
+
+
+void compute_shortest_paths(shortest_path_info *info) {
+    int nodes = info->num_nodes;
+    int i, j, k;
+
+    clear_paths(info);
 
     printf(" * Computing the all-points shortest path results.\n");
     for (k = 0; k < nodes; k++) {
@@ -83,52 +205,270 @@ void compute_shortest_paths(shortest_path_info *info) {
 }
 
 
+/* Runs the Floyd-Warshall updates for every row in [row0, row0 + size),
+ * column in [col0, col0 + size) and intermediate node in
+ * [mid0, mid0 + size), clipped to the graph.  This touches just three
+ * tiles of the weight matrix:  (row, col), (row, mid) and (mid, col).
+ */
+void relax_tile(shortest_path_info *info, int row0, int col0, int mid0,
+                int size) {
+    int nodes = info->num_nodes;
+    int row_end = row0 + size < nodes ? row0 + size : nodes;
+    int col_end = col0 + size < nodes ? col0 + size : nodes;
+    int mid_end = mid0 + size < nodes ? mid0 + size : nodes;
+    int i, j, k;
 
-int main(int argc, const char **argv) {
-    memory_t memory;
-    cache_t cache;
-    membase_t *p_mem;
+    for (k = mid0; k < mid_end; k++) {
+        for (i = row0; i < row_end; i++) {
+            int weight_ik = get_weight(info, i, k);
 
-    shortest_path_info info;
-    int i, j;
+            for (j = col0; j < col_end; j++) {
+                int weight_ikj = weight_ik + get_weight(info, k, j);
+                int weight_ij = get_weight(info, i, j);
 
-    /* Set up the simulated memory. */
-    p_mem = make_cached_memory(argc, argv,
-                               2 * NUM_NODES * NUM_NODES * sizeof(int));
+                if (weight_ikj < weight_ij) {
+                    set_weight(info, i, j, weight_ikj);
+                    set_path(info, i, j, k);
+                }
+            }
+        }
+    }
+}
 
-    /* Generate a random graph. */
 
-    printf("Generating a random graph containing %d nodes.\n", NUM_NODES);
+/* The blocked Floyd-Warshall algorithm.  For each block of intermediate
+ * nodes, the diagonal tile is updated first, then the rest of its row and
+ * column of tiles, which only depend on the diagonal tile, and then every
+ * other tile, which only depends on the tiles in its row and column.  Each
+ * tile is worked on while it is still in the cache, instead of the whole
+ * matrix being streamed through once per intermediate node.
+ */
+void compute_tiled_shortest_paths(shortest_path_info *info) {
+    int nodes = info->num_nodes, tile = info->tile_size;
+    int kb, ib, jb;
 
-    srand(SEED);
+    clear_paths(info);
 
-    info.num_nodes = NUM_NODES;
-    info.p_mem = p_mem;
+    printf(" * Computing the all-points shortest path results with %dx%d "
+           "tiles.\n", tile, tile);
+    for (kb = 0; kb < nodes; kb += tile) {
+        relax_tile(info, kb, kb, kb, tile);
 
-    for (i = 0; i < info.num_nodes; i++) {
-        for (j = 0; j < info.num_nodes; j++) {
-            if (i != j) {
-                if (rand() % 100 < CONNECTED_PCT)
-                    set_weight(&info, i, j, 1 + rand() % 10);
-                else
-                    set_weight(&info, i, j, INFINITY);
+        for (jb = 0; jb < nodes; jb += tile) {
+            if (jb != kb) {
+                relax_tile(info, kb, jb, kb, tile);
+                relax_tile(info, jb, kb, kb, tile);
             }
-            else {
-                set_weight(&info, i, j, 0);
+        }
+
+        for (ib = 0; ib < nodes; ib += tile) {
+            for (jb = 0; jb < nodes; jb += tile) {
+                if (ib != kb && jb != kb)
+                    relax_tile(info, ib, jb, kb, tile);
             }
         }
+        printf(".");
+        fflush(stdout);
+    }
+    printf("\n");
+}
+
+
+/* Recursively runs the Floyd-Warshall updates for a square of rows, columns
+ * and intermediate nodes, by splitting it into halves along each axis.  The
+ * eight quarters are visited in the order that keeps every update's inputs
+ * up to date:  all four (row, col) quarters with the first half of the
+ * intermediate nodes, and then all four again in reverse order with the
+ * second half.  The subproblems shrink until they fit in whatever cache
+ * there is, without the program knowing its size.
+ */
+void recursive_relax(shortest_path_info *info, int row0, int col0, int mid0,
+                     int size) {
+    int nodes = info->num_nodes, half = size / 2;
+
+    if (row0 >= nodes || col0 >= nodes || mid0 >= nodes)
+        return;
+
+    if (size <= info->tile_size) {
+        relax_tile(info, row0, col0, mid0, size);
+        return;
     }
 
+    recursive_relax(info, row0, col0, mid0, half);
+    recursive_relax(info, row0, col0 + half, mid0, half);
+    recursive_relax(info, row0 + half, col0, mid0, half);
+    recursive_relax(info, row0 + half, col0 + half, mid0, half);
+
+    recursive_relax(info, row0 + half, col0 + half, mid0 + half, half);
+    recursive_relax(info, row0 + half, col0, mid0 + half, half);
+    recursive_relax(info, row0, col0 + half, mid0 + half, half);
+    recursive_relax(info, row0, col0, mid0 + half, half);
+}
+
+
+/* The cache-oblivious recursive Floyd-Warshall algorithm.  The matrix is
+ * treated as padded out to a power-of-2 multiple of the tile size, and the
+ * recursion bottoms out at single tiles.
+ */
+void compute_recursive_shortest_paths(shortest_path_info *info) {
+    int size = info->tile_size;
+
+    clear_paths(info);
+
+    while (size < info->num_nodes)
+        size *= 2;
+
+    printf(" * Computing the all-points shortest path results recursively, "
+           "down to\n   %dx%d tiles.\n", info->tile_size, info->tile_size);
+    recursive_relax(info, 0, 0, 0, size);
+}
+
+
+/* Runs one algorithm through the simulated memory, prints the simulator's
+ * statistics, and then runs it again natively, checking that the results
+ * match and reporting how long the native run took.
+ */
+void run_algorithm(const apsp_algorithm *algorithm, membase_t *p_mem,
+                   int num_nodes, int tile_size) {
+    shortest_path_info info, native_info;
+    struct timespec start, end;
+    int i, j, mismatches;
+
+    info.num_nodes = num_nodes;
+    info.tile_size = tile_size;
+    info.p_mem = p_mem;
+    info.native = NULL;
+
+    /* Generate a random graph. */
+
+    printf("Generating a random graph containing %d nodes.\n", num_nodes);
+    generate_graph(&info);
+
     /* Compute the all-points shortest path of the graph. */
 
     printf("Computing the all-points-shortest-paths of the graph.\n");
-    compute_shortest_paths(&info);
+    algorithm->compute(&info);
 
     /* Print out the results of the all-points-shortest-paths computation. */
 
-    printf("\nMemory-Access Statistics:\n\n");
+    printf("\nMemory-Access Statistics (%s):\n\n", algorithm->name);
     p_mem->print_stats(p_mem);
     printf("\n");
+    print_memory_costs();
+    printf("\n");
+
+    /* Run the same algorithm natively. */
+
+    native_info = info;
+    native_info.p_mem = NULL;
+    native_info.native = malloc(2 * (size_t) num_nodes * num_nodes *
+                                sizeof(int));
+    if (native_info.native == NULL) {
+        printf("ERROR:  unable to allocate memory for the native run.\n");
+        exit(1);
+    }
+
+    printf("Computing the all-points-shortest-paths natively.\n");
+    generate_graph(&native_info);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    algorithm->compute(&native_info);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    mismatches = 0;
+    for (i = 0; i < num_nodes; i++) {
+        for (j = 0; j < num_nodes; j++) {
+            if (get_weight(&info, i, j) != get_weight(&native_info, i, j))
+                mismatches++;
+        }
+    }
+    if (mismatches != 0) {
+        printf("ERROR:  %d simulated and native weights don't match!\n",
+               mismatches);
+    }
+
+    printf("Native time (%s):  %.3f seconds\n\n", algorithm->name,
+           (end.tv_sec - start.tv_sec) +
+           (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    free(native_info.native);
+}
+
+
+int main(int argc, const char **argv) {
+    const char *progname = argv[0], **spec_argv;
+    const apsp_algorithm *algorithm = all_algorithms;
+    int num_nodes = NUM_NODES, tile_size = TILE_SIZE, run_all = 0;
+    int i, num_specs;
+    membase_t *p_mem;
+
+    /* Parse the options that come before the cache specifications. */
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            i++;
+            if (strcasecmp(argv[i], "all") == 0) {
+                run_all = 1;
+                continue;
+            }
+
+            for (algorithm = all_algorithms; algorithm->name != NULL;
+                 algorithm++) {
+                if (strcasecmp(algorithm->name, argv[i]) == 0)
+                    break;
+            }
+            if (algorithm->name == NULL) {
+                printf("ERROR:  unrecognized algorithm \"%s\".\n", argv[i]);
+                apsptest_usage(progname);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            tile_size = atoi(argv[++i]);
+            if (tile_size <= 0) {
+                printf("ERROR:  tile size must be positive, got %s.\n",
+                       argv[i]);
+                apsptest_usage(progname);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            num_nodes = atoi(argv[++i]);
+            if (num_nodes <= 0 || num_nodes > 16384) {
+                printf("ERROR:  number of nodes must be between 1 and 16384, "
+                       "got %s.\n", argv[i]);
+                apsptest_usage(progname);
+                exit(1);
+            }
+        }
+        else {
+            apsptest_usage(progname);
+            exit(1);
+        }
+    }
+
+    /* make_cached_memory() expects the program name before the cache
+     * specifications.
+     */
+    num_specs = argc - i;
+    spec_argv = malloc((num_specs + 1) * sizeof(const char *));
+    spec_argv[0] = progname;
+    memcpy(spec_argv + 1, argv + i, num_specs * sizeof(const char *));
+
+    /* Set up the simulated memory. */
+    p_mem = make_cached_memory(num_specs + 1, spec_argv,
+                               2 * (unsigned int) num_nodes * num_nodes *
+                               sizeof(int));
+    free(spec_argv);
+
+    if (!run_all) {
+        run_algorithm(algorithm, p_mem, num_nodes, tile_size);
+        return 0;
+    }
+
+    /* Run every algorithm in turn, each with fresh statistics. */
+    for (algorithm = all_algorithms; algorithm->name != NULL; algorithm++) {
+        p_mem->reset_stats(p_mem);
+        run_algorithm(algorithm, p_mem, num_nodes, tile_size);
+    }
 
     return 0;
 }
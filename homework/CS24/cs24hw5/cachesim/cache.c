@@ -4,6 +4,14 @@
 #include <assert.h>
 
 #include "cache.h"
+#include "coherence.h"
+#include "probe.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 
 /* Set this to a nonzero value and rebuild to see debug output. */
@@ -11,22 +19,34 @@
 
 
 /* Set this to 0 to activate your custom replacement policy, which is
- * hopefully smarter and better than a random replacement policy!
+ * hopefully smarter and better than a random replacement policy!  This only
+ * picks the default; any policy in replacement.c can be chosen for a cache
+ * with set_replacement_policy(), or in its command-line specification.
  */
 #define RANDOM_REPLACEMENT_POLICY 0
 
+/* The probe of the simulated block reads, which read_int() and read_float()
+ * go through, for "make PROBES=1".
+ */
+PROBE_DEFINE(read_block_probe, "cache_read_block");
+
 /* Local functions used by the cache implementation, roughly in order of
  * usage.
  */
 
 unsigned char cache_read_byte(membase_t *mb, addr_t address);
 void cache_write_byte(membase_t *mb, addr_t address, unsigned char value);
+void cache_read_block(membase_t *mb, addr_t address, unsigned char *buf,
+                      unsigned int size);
+void cache_write_block(membase_t *mb, addr_t address,
+                       const unsigned char *buf, unsigned int size);
 void cache_free(membase_t *mb);
 
 void cache_print_stats(membase_t *mb);
 void cache_reset_stats(membase_t *mb);
 
-cacheline_t *resolve_cache_access(cache_t *p_cache, addr_t address);
+cacheline_t *resolve_cache_access(cache_t *p_cache, addr_t address,
+                                  int allocate);
 
 void decompose_address(cache_t *p_cache, addr_t address,
     addr_t *tag, addr_t *set, addr_t *offset);
@@ -36,9 +56,11 @@ addr_t get_offset_in_block(cache_t *p_cache, addr_t address);
 addr_t get_block_start_from_line_info(cache_t *p_cache,
                                       addr_t tag, addr_t set_no);
 
+unsigned int match_tags(const addr_t *tags, addr_t tag);
 cacheline_t * find_line_in_set(cacheset_t *p_set, addr_t tag);
+void run_prefetches(cache_t *p_cache);
 
-cacheline_t * choose_victim(cacheset_t *p_set);
+cacheline_t * choose_victim(cache_t *p_cache, cacheset_t *p_set);
 cacheline_t * evict_cache_line(cache_t *p_cache, cacheset_t *p_set);
 
 void load_cache_line(cache_t *p_cache, cacheline_t *p_line, addr_t address,
@@ -46,6 +68,15 @@ void load_cache_line(cache_t *p_cache, cacheline_t *p_line, addr_t address,
 void write_back_cache_line(cache_t *p_cache, cacheline_t *p_line,
                            addr_t set_no);
 
+void pass_on_write(cache_t *p_cache, addr_t address,
+                   const unsigned char *buf, unsigned int size);
+void coherent_fill(cache_t *p_cache, addr_t address, cacheline_t *p_line,
+                   int shared);
+void coherent_write(cache_t *p_cache, cacheline_t *p_line, addr_t address,
+                    unsigned int size);
+void drain_wcb_entry(cache_t *p_cache, wcb_entry_t *p_entry);
+void drain_wcb_block(cache_t *p_cache, addr_t block_start);
+
 
 /* Initializes the members of the cache_t struct to be a cache with the
  * specified block size, number of cache-sets, and the number of cache lines
@@ -56,7 +87,7 @@ void init_cache(cache_t *p_cache, unsigned int block_size,
                 unsigned int num_sets, unsigned int lines_per_set,
                 membase_t *next_mem) {
     addr_t set_no;
-    unsigned int line_no;
+    unsigned int line_no, num_tags;
 
     assert(p_cache != NULL);
     assert(next_mem != NULL);
@@ -72,10 +103,22 @@ void init_cache(cache_t *p_cache, unsigned int block_size,
     /* Set up the functions this cache exposes. */
     p_cache->read_byte = cache_read_byte;
     p_cache->write_byte = cache_write_byte;
+    p_cache->read_block = cache_read_block;
+    p_cache->write_block = cache_write_block;
     p_cache->print_stats = cache_print_stats;
     p_cache->reset_stats = cache_reset_stats;
     p_cache->free = cache_free;
 
+    p_cache->policy =
+        RANDOM_REPLACEMENT_POLICY ? &random_policy : &lru_policy;
+
+    /* Caches are write-back and write-allocate unless set_write_policy()
+     * says otherwise.
+     */
+    p_cache->write_allocate = 1;
+
+    p_cache->bandwidth = DEFAULT_CACHE_BANDWIDTH;
+
     /* These are various parameters for the cache. */
 
     p_cache->block_size = block_size;
@@ -97,6 +140,11 @@ void init_cache(cache_t *p_cache, unsigned int block_size,
         p_set->num_lines = lines_per_set;
         p_set->cache_lines = malloc(lines_per_set * sizeof(cacheline_t));
 
+        num_tags = (lines_per_set + TAG_CHUNK - 1) / TAG_CHUNK * TAG_CHUNK;
+        p_set->tags = malloc(num_tags * sizeof(addr_t));
+        for (line_no = 0; line_no < num_tags; line_no++)
+            p_set->tags[line_no] = INVALID_TAG;
+
         for (line_no = 0; line_no < lines_per_set; line_no++) {
             cacheline_t *p_line = p_set->cache_lines + line_no;
             bzero(p_line, sizeof(cacheline_t));
@@ -118,35 +166,132 @@ unsigned char cache_read_byte(membase_t *mb, addr_t address) {
     printf("Resolving cache read to address %u\n", address);
 #endif
 
-    p_line = resolve_cache_access(p_cache, address);
+    p_line = resolve_cache_access(p_cache, address, 1);
     block_offset = get_offset_in_block(p_cache, address);
 
-    /* Update access_time to reflect this access. */
-    p_line->access_time = clock_tick();
-
 #if DEBUG_CACHE
     printf(" * Block offset within cache line:  %u\n", block_offset);
 #endif
 
+    if (p_cache->bus != NULL)
+        p_line->touched |= touch_mask(p_cache, address, 1);
+
     /* Return the byte read by the requester. */
     p_cache->num_reads++;
     return p_line->block[block_offset];
 }
 
 
-/* This function implements writing bytes of memory through the cache. */
+/* This function implements writing bytes of memory through the cache.  A
+ * write-back cache marks the line dirty.  A write-through cache passes the
+ * write on to the next level, as does a write-no-allocate cache that
+ * doesn't hold the block.
+ */
 void cache_write_byte(membase_t *mb, addr_t address, unsigned char value) {
     cache_t *p_cache = (cache_t *) mb;
-    cacheline_t *p_line = resolve_cache_access(p_cache, address);
+    cacheline_t *p_line =
+        resolve_cache_access(p_cache, address, p_cache->write_allocate);
     addr_t block_offset = get_offset_in_block(p_cache, address);
 
     /* Write the byte specified by the requester. */
     p_cache->num_writes++;
-    p_line->block[block_offset] = value;
-    p_line->dirty = 1;
+    if (p_line != NULL) {
+        if (p_cache->bus != NULL)
+            coherent_write(p_cache, p_line, address, 1);
 
-    /* Update access_time to reflect this access. */
-    p_line->access_time = clock_tick();
+        p_line->block[block_offset] = value;
+        if (!p_cache->write_through)
+            p_line->dirty = 1;
+    }
+
+    if (p_line == NULL || p_cache->write_through)
+        pass_on_write(p_cache, address, &value, 1);
+}
+
+
+/* This function implements reading a block of bytes through the cache.  The
+ * block is split at cache-line boundaries, and each piece is served from its
+ * line with a single lookup.  The statistics still count bytes:  a piece of
+ * n bytes counts as n reads, and its lookup as one hit or miss followed by
+ * n - 1 hits, exactly as if the bytes had been read one at a time.
+ */
+void cache_read_block(membase_t *mb, addr_t address, unsigned char *buf,
+                      unsigned int size) {
+    cache_t *p_cache = (cache_t *) mb;
+    cacheline_t *p_line;
+    addr_t block_offset;
+    unsigned int n;
+
+    PROBE_BEGIN(read_block_probe);
+
+    while (size > 0) {
+        block_offset = get_offset_in_block(p_cache, address);
+        n = p_cache->block_size - block_offset;
+        if (n > size)
+            n = size;
+
+        p_line = resolve_cache_access(p_cache, address, 1);
+        if (p_cache->bus != NULL)
+            p_line->touched |= touch_mask(p_cache, address, n);
+
+        memcpy(buf, p_line->block + block_offset, n);
+        p_cache->num_reads += n;
+        p_cache->num_hits += n - 1;
+
+        address += n;
+        buf += n;
+        size -= n;
+    }
+
+    PROBE_END(read_block_probe);
+}
+
+
+/* This function implements writing a block of bytes through the cache, in
+ * the same way as cache_read_block(), and with the same write policy as
+ * cache_write_byte().
+ */
+void cache_write_block(membase_t *mb, addr_t address,
+                       const unsigned char *buf, unsigned int size) {
+    cache_t *p_cache = (cache_t *) mb;
+    cacheline_t *p_line;
+    addr_t block_offset;
+    unsigned int n;
+
+    while (size > 0) {
+        block_offset = get_offset_in_block(p_cache, address);
+        n = p_cache->block_size - block_offset;
+        if (n > size)
+            n = size;
+
+        p_line = resolve_cache_access(p_cache, address,
+                                      p_cache->write_allocate);
+
+        if (p_line != NULL) {
+            if (p_cache->bus != NULL)
+                coherent_write(p_cache, p_line, address, n);
+
+            memcpy(p_line->block + block_offset, buf, n);
+            if (!p_cache->write_through)
+                p_line->dirty = 1;
+        }
+
+        if (p_line == NULL || p_cache->write_through)
+            pass_on_write(p_cache, address, buf, n);
+
+        /* Without an allocation, each of the other bytes would have missed
+         * too.
+         */
+        p_cache->num_writes += n;
+        if (p_line != NULL)
+            p_cache->num_hits += n - 1;
+        else
+            p_cache->num_misses += n - 1;
+
+        address += n;
+        buf += n;
+        size -= n;
+    }
 }
 
 
@@ -164,7 +309,32 @@ void cache_print_stats(membase_t *mb) {
            "\n", p_cache->num_reads, p_cache->num_writes,
            p_cache->num_hits, p_cache->num_misses);
     printf("   miss-rate=%.2f%% %s replacement policy\n", miss_rate,
-           (RANDOM_REPLACEMENT_POLICY ? "random" : "LRU"));
+           p_cache->policy->name);
+
+    if (p_cache->classifier != NULL) {
+        printf("   misses:  compulsory=%lld capacity=%lld conflict=%lld\n",
+               p_cache->num_compulsory_misses, p_cache->num_capacity_misses,
+               p_cache->num_conflict_misses);
+    }
+
+    printf("   %s, %s traffic:  fills=%lld (%lld bytes)\n"
+           "   write-backs=%lld (%lld bytes) write-throughs=%lld (%lld bytes)",
+           p_cache->write_through ? "write-through" : "write-back",
+           p_cache->write_allocate ? "write-allocate" : "write-no-allocate",
+           p_cache->num_fills, p_cache->fill_bytes, p_cache->num_write_backs,
+           p_cache->write_back_bytes, p_cache->num_write_throughs,
+           p_cache->write_through_bytes);
+    if (p_cache->num_wcb_entries > 0)
+        printf("\n   through a %u-entry write-combining buffer",
+               p_cache->num_wcb_entries);
+    printf("\n");
+
+    if (p_cache->prefetcher != NULL) {
+        printf("   %s prefetcher:  prefetches=%lld useful=%lld "
+               "useless=%lld\n", p_cache->prefetcher->name,
+               p_cache->num_prefetches, p_cache->num_useful_prefetches,
+               p_cache->num_useless_prefetches);
+    }
 
     p_cache->next_memory->print_stats(p_cache->next_memory);
 }
@@ -180,6 +350,19 @@ void cache_reset_stats(membase_t *mb) {
     p_cache->num_writes = 0;
     p_cache->num_hits = 0;
     p_cache->num_misses = 0;
+    p_cache->num_lookups = 0;
+    p_cache->num_prefetches = 0;
+    p_cache->num_useful_prefetches = 0;
+    p_cache->num_useless_prefetches = 0;
+    p_cache->num_fills = 0;
+    p_cache->fill_bytes = 0;
+    p_cache->num_write_backs = 0;
+    p_cache->write_back_bytes = 0;
+    p_cache->num_write_throughs = 0;
+    p_cache->write_through_bytes = 0;
+    p_cache->num_compulsory_misses = 0;
+    p_cache->num_capacity_misses = 0;
+    p_cache->num_conflict_misses = 0;
 
     p_cache->next_memory->reset_stats(p_cache->next_memory);
 }
@@ -199,18 +382,62 @@ void cache_free(membase_t *mb) {
             free(p_line->block);
         }
         free(p_set->cache_lines);
+        free(p_set->tags);
     }
     free(p_cache->cache_sets);
+
+    for (i_line = 0; i_line < p_cache->num_wcb_entries; i_line++) {
+        free(p_cache->wcb[i_line].data);
+        free(p_cache->wcb[i_line].written);
+    }
+    free(p_cache->wcb);
+
+    free_miss_classifier(p_cache);
+
+    if (p_cache->prefetcher != NULL && p_cache->prefetcher->free != NULL)
+        p_cache->prefetcher->free(p_cache);
+}
+
+
+/* Sets the write policy of a cache, and gives it a write-combining buffer
+ * of the specified number of entries, or none if it is 0.  This should be
+ * done before the cache is used.
+ */
+void set_write_policy(cache_t *p_cache, int write_through,
+                      int write_allocate, unsigned int num_wcb_entries) {
+    unsigned int i;
+
+    assert(p_cache != NULL);
+    assert(p_cache->wcb == NULL);
+
+    p_cache->write_through = write_through;
+    p_cache->write_allocate = write_allocate;
+
+    if (num_wcb_entries == 0)
+        return;
+
+    p_cache->num_wcb_entries = num_wcb_entries;
+    p_cache->wcb = calloc(num_wcb_entries, sizeof(wcb_entry_t));
+    for (i = 0; i < num_wcb_entries; i++) {
+        p_cache->wcb[i].data = malloc(p_cache->block_size);
+        p_cache->wcb[i].written = calloc(p_cache->block_size, 1);
+    }
 }
 
 
 /* This method flushes lines out of the cache so that all modified data in the
  * cache is properly reflected in the next level of the simulated memory.
+ * The write-combining buffer is drained as well.
  */
 int flush_cache(cache_t *p_cache) {
     addr_t i_set, i_line;
     int flushed;
 
+    for (i_line = 0; i_line < p_cache->num_wcb_entries; i_line++) {
+        if (p_cache->wcb[i_line].valid)
+            drain_wcb_entry(p_cache, p_cache->wcb + i_line);
+    }
+
     flushed = 0;
     for (i_set = 0; i_set < p_cache->num_sets; i_set++) {
         cacheset_t *p_set = p_cache->cache_sets + i_set;
@@ -227,6 +454,71 @@ int flush_cache(cache_t *p_cache) {
 }
 
 
+/* This function is called by a coherence bus to snoop the cache for the
+ * block holding the specified address, on behalf of another core.  A dirty
+ * copy is written back to the next level, so that the other core will see
+ * its data.  The line is then invalidated if invalidate is nonzero, or left
+ * shared otherwise.  The mask of the line's touched bytes is stored in
+ * *p_touched if the block is found.  Returns a combination of SNOOP_FOUND
+ * and SNOOP_WROTE_BACK, or 0 if the cache doesn't hold the block.
+ */
+int snoop_cache(cache_t *p_cache, addr_t address, int invalidate,
+                unsigned long long *p_touched) {
+    addr_t tag, set_no, block_offset;
+    cacheset_t *p_set;
+    cacheline_t *p_line;
+    int result = SNOOP_FOUND;
+
+    decompose_address(p_cache, address, &tag, &set_no, &block_offset);
+    p_set = p_cache->cache_sets + set_no;
+    p_line = find_line_in_set(p_set, tag);
+    if (p_line == NULL)
+        return 0;
+
+    if (p_line->dirty) {
+        write_back_cache_line(p_cache, p_line, set_no);
+        p_line->dirty = 0;
+        result |= SNOOP_WROTE_BACK;
+    }
+
+    *p_touched = p_line->touched;
+
+    if (invalidate) {
+        p_line->valid = 0;
+        p_line->prefetched = 0;
+        p_line->tag = 0;
+        p_set->tags[p_line->line_no] = INVALID_TAG;
+    }
+    else {
+        p_line->mesi = MESI_SHARED;
+    }
+
+    return result;
+}
+
+
+/* This function returns the mask of the parts of a block that an access of
+ * size bytes at the specified address covers, as kept in a line's touched
+ * member.  The access must lie within one block.
+ */
+unsigned long long touch_mask(cache_t *p_cache, addr_t address,
+                              unsigned int size) {
+    unsigned int shift = 0, first, last;
+    addr_t block_offset = get_offset_in_block(p_cache, address);
+
+    if (p_cache->block_offset_bits > 6)
+        shift = p_cache->block_offset_bits - 6;
+
+    first = block_offset >> shift;
+    last = (block_offset + size - 1) >> shift;
+
+    if (last - first == 63)
+        return ~0ULL;
+
+    return ((1ULL << (last - first + 1)) - 1) << first;
+}
+
+
 /*---------------------------------------------------------------------------
  * CACHE HELPER FUNCTIONS
  */
@@ -234,17 +526,28 @@ int flush_cache(cache_t *p_cache) {
 
 /* This function is used by both the read-byte and write-byte functions to
  * ensure that the cache contains a cache-line for the specified address.
+ * When allocate is 0, as for a write to a write-no-allocate cache, a miss is
+ * counted but nothing is loaded, and NULL is returned.
  * This way, the read or write can be performed against the cache-line.  If
  * the cache doesn't contain a line for the specified address, the
  * corresponding block will be loaded from the next level of the memory.  An
  * eviction will also occur if the cache doesn't currently have room for the
  * new line.
  */
-cacheline_t *resolve_cache_access(cache_t *p_cache, addr_t address) {
+cacheline_t *resolve_cache_access(cache_t *p_cache, addr_t address,
+                                  int allocate) {
     addr_t tag, set_no, block_offset;
     cacheset_t *p_set;
     cacheline_t *p_line;
 
+    int missed, first_use = 0;
+
+    /* Load any blocks that the prefetcher asked for since the last access. */
+    if (p_cache->num_queued > 0)
+        run_prefetches(p_cache);
+
+    p_cache->num_lookups++;
+
     /* Map the address to a cache set, and pull out the tag and block
      * offset too.
      */
@@ -257,6 +560,7 @@ cacheline_t *resolve_cache_access(cache_t *p_cache, addr_t address) {
     /* Get the cache set that should contain the address. */
     p_set = p_cache->cache_sets + set_no;
     p_line = find_line_in_set(p_set, tag);
+    missed = (p_line == NULL);
 
     if (p_line == NULL) {
         /* CACHE MISS.  :-( */
@@ -267,18 +571,86 @@ cacheline_t *resolve_cache_access(cache_t *p_cache, addr_t address) {
 #endif
 
         /* Resolve the cache miss. */
-        p_line = evict_cache_line(p_cache, p_set);
-        load_cache_line(p_cache, p_line, address, tag);
+        if (allocate) {
+            /* Other cores must give up the block first, so that our load
+             * sees their modifications.
+             */
+            int shared = 0;
+            if (p_cache->bus != NULL)
+                shared = bus_read(p_cache->bus, p_cache->core, address);
+
+            p_line = evict_cache_line(p_cache, p_set);
+            load_cache_line(p_cache, p_line, address, tag);
+            p_cache->policy->on_fill(p_cache, p_set, p_line);
+
+            if (p_cache->bus != NULL)
+                coherent_fill(p_cache, address, p_line, shared);
+        }
     }
     else {
         /* CACHE HIT!  :-) */
         p_cache->num_hits++;
+        p_cache->policy->on_hit(p_cache, p_set, p_line);
+
+        if (p_line->prefetched) {
+            p_cache->num_useful_prefetches++;
+            p_line->prefetched = 0;
+            first_use = 1;
+        }
     }
 
+    if (p_cache->classifier != NULL)
+        classify_access(p_cache, address, missed);
+
+    if (p_cache->prefetcher != NULL)
+        p_cache->prefetcher->on_access(p_cache, address, missed, first_use);
+
     return p_line;
 }
 
 
+/* This function loads the blocks waiting in the prefetch queue into the
+ * cache.  Blocks that are already in the cache are skipped.  A prefetched
+ * line is filled like any other, but doesn't count as a hit or a miss.
+ */
+void run_prefetches(cache_t *p_cache) {
+    addr_t tag, set_no, block_offset;
+    cacheset_t *p_set;
+    cacheline_t *p_line;
+    unsigned int i;
+    int shared;
+
+    for (i = 0; i < p_cache->num_queued; i++) {
+        addr_t address = p_cache->prefetch_queue[i];
+
+        decompose_address(p_cache, address, &tag, &set_no, &block_offset);
+        p_set = p_cache->cache_sets + set_no;
+        if (find_line_in_set(p_set, tag) != NULL)
+            continue;
+
+#if DEBUG_CACHE
+        printf(" * Prefetching block at address %u\n", address);
+#endif
+
+        shared = 0;
+        if (p_cache->bus != NULL)
+            shared = bus_read(p_cache->bus, p_cache->core, address);
+
+        p_line = evict_cache_line(p_cache, p_set);
+        load_cache_line(p_cache, p_line, address, tag);
+        p_cache->policy->on_fill(p_cache, p_set, p_line);
+
+        if (p_cache->bus != NULL)
+            coherent_fill(p_cache, address, p_line, shared);
+
+        p_line->prefetched = 1;
+        p_cache->num_prefetches++;
+    }
+
+    p_cache->num_queued = 0;
+}
+
+
 /* This function takes a cache and an address being accessed through the
  * cache, and it breaks the address down into the values needed by the cache:
  *  - The tag that identifies the block.
@@ -356,32 +728,63 @@ addr_t get_block_start_from_line_info(cache_t *p_cache,
 }
 
 
+/* This function compares TAG_CHUNK entries of a packed tag array against a
+ * tag, and returns a bit-mask with bit i set if tags[i] matches.
+ */
+unsigned int match_tags(const addr_t *tags, addr_t tag) {
+#if defined(__AVX2__)
+    __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) tags),
+                                    _mm256_set1_epi32((int) tag));
+    return _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+#elif defined(__SSE2__)
+    __m128i key = _mm_set1_epi32((int) tag);
+    __m128i lo = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) tags), key);
+    __m128i hi = _mm_cmpeq_epi32(
+        _mm_loadu_si128((const __m128i *) (tags + 4)), key);
+    return _mm_movemask_ps(_mm_castsi128_ps(lo)) |
+           (_mm_movemask_ps(_mm_castsi128_ps(hi)) << 4);
+#else
+    unsigned int mask = 0, i;
+
+    for (i = 0; i < TAG_CHUNK; i++) {
+        if (tags[i] == tag)
+            mask |= 1U << i;
+    }
+    return mask;
+#endif
+}
+
+
 /* This function searches through a cache set, looking for the cache line with
  * the specified tag.  If no line can be found with this tag, the function
- * returns NULL.
+ * returns NULL.  The packed tags are compared TAG_CHUNK at a time, and only
+ * lines whose tags match are looked at.
  */
 cacheline_t * find_line_in_set(cacheset_t *p_set, addr_t tag) {
-    cacheline_t * found_line = NULL, * curr;
-    int i;
+    unsigned int mask;
+    int i, j;
 
 #if DEBUG_CACHE
     printf(" * Finding line with tag %u in cache set:\n", tag);
 #endif
-    curr = p_set->cache_lines;
 
-    for (i = 0; i < p_set->num_lines; ++i) {
-        /* If any are valid and have desired tag then return. */
-        if ((curr->valid) && (curr->tag == tag)) {
-            found_line = curr;
-            break;
-        }
+    for (i = 0; i < p_set->num_lines; i += TAG_CHUNK) {
+        mask = match_tags(p_set->tags + i, tag);
+
+        while (mask != 0) {
+            j = i + __builtin_ctz(mask);
+            if (j >= p_set->num_lines)
+                break;
+
+            /* A tag of INVALID_TAG also matches the invalid lines. */
+            if (p_set->cache_lines[j].valid)
+                return p_set->cache_lines + j;
 
-        /* Go to next line. */
-        curr++;
+            mask &= mask - 1;
+        }
     }
 
-    /* found_line will remain NULL if not found */
-    return found_line;
+    return NULL;
 }
 
 
@@ -389,42 +792,34 @@ cacheline_t * find_line_in_set(cacheset_t *p_set, addr_t tag) {
  * must be loaded into the cache.  Note that this function is slightly mis-
  * named; if it selects a cache line that is currently invalid, nothing will
  * actually be evicted; the line will simply be used to store the new block
- * of data.
+ * of data.  Invalid lines are always used first; otherwise the cache's
+ * replacement policy picks the victim.
  */
-cacheline_t * choose_victim(cacheset_t *p_set) {
-    cacheline_t * victim = NULL, * curr;
-    int i_victim, i, oldest;
-
-#if RANDOM_REPLACEMENT_POLICY
-    /* Randomly choose a victim line to evict. */
-    i_victim = rand() % p_set->num_lines;
-    victim = p_set->cache_lines + i_victim;
-#else
-    /* If any invalid lines then use that, if not then use the LRU line. */
-    curr = p_set->cache_lines;
-
-    /* Init victim to the first line in cache. */
-    victim = curr;
-    oldest = victim->access_time;
-
-    for (i = 0; i < p_set->num_lines; ++i) {
-        /* Check if invalid line. */
-        if (!curr->valid) {
-            victim = curr;
-            break;
-        }
+cacheline_t * choose_victim(cache_t *p_cache, cacheset_t *p_set) {
+    cacheline_t * victim = NULL;
+    unsigned int mask;
+    int i, j;
+
+    /* Invalid lines have a packed tag of INVALID_TAG. */
+    for (i = 0; i < p_set->num_lines && victim == NULL; i += TAG_CHUNK) {
+        mask = match_tags(p_set->tags + i, INVALID_TAG);
+
+        while (mask != 0) {
+            j = i + __builtin_ctz(mask);
+            if (j >= p_set->num_lines)
+                break;
+
+            if (!p_set->cache_lines[j].valid) {
+                victim = p_set->cache_lines + j;
+                break;
+            }
 
-        /* Check if older than oldest so far. */
-        if (curr->access_time < oldest) {
-            oldest = curr->access_time;
-            victim = curr;
+            mask &= mask - 1;
         }
-
-        /* Go to next line. */
-        curr++;
     }
 
-#endif
+    if (victim == NULL)
+        victim = p_cache->policy->choose_victim(p_cache, p_set);
 
 #if DEBUG_CACHE
     if (victim->valid) {
@@ -445,8 +840,11 @@ cacheline_t * choose_victim(cacheset_t *p_set) {
  * to load a new block from the next level of memory.
  */
 cacheline_t * evict_cache_line(cache_t *p_cache, cacheset_t *p_set) {
-    /* Randomly choose a victim line to evict. */
-    cacheline_t *victim = choose_victim(p_set);
+    /* Choose a victim line to evict. */
+    cacheline_t *victim = choose_victim(p_cache, p_set);
+
+    if (victim->valid && victim->prefetched)
+        p_cache->num_useless_prefetches++;
 
     if (victim->valid && victim->dirty) {
         /* The line being evicted is dirty, so we need to
@@ -462,7 +860,9 @@ cacheline_t * evict_cache_line(cache_t *p_cache, cacheset_t *p_set) {
 
     victim->valid = 0;
     victim->dirty = 0;
+    victim->prefetched = 0;
     victim->tag = 0;
+    p_set->tags[victim->line_no] = INVALID_TAG;
 
     return victim;
 }
@@ -476,19 +876,31 @@ cacheline_t * evict_cache_line(cache_t *p_cache, cacheset_t *p_set) {
 void load_cache_line(cache_t *p_cache, cacheline_t *p_line, addr_t address,
                      addr_t tag) {
     membase_t *next_mem = p_cache->next_memory;
+    cacheset_t *p_set;
     addr_t start_addr;
-    int offset;
 
     /* Determine the start of the block that holds the specified address. */
     start_addr = get_block_start_from_address(p_cache, address);
 
-    /* Read each byte of the new line from the next level. */
-    for (offset = 0; offset < p_cache->block_size; offset++)
-        p_line->block[offset] = read_byte(next_mem, start_addr + offset);
+    /* Writes to the block that are still in the write-combining buffer
+     * must reach the next level before the block is read from it.
+     */
+    if (p_cache->num_wcb_entries > 0)
+        drain_wcb_block(p_cache, start_addr);
+
+    /* Read the new line from the next level. */
+    read_block(next_mem, start_addr, p_line->block, p_cache->block_size);
+    p_cache->num_fills++;
+    p_cache->fill_bytes += p_cache->block_size;
 
     p_line->valid = 1;
     p_line->dirty = 0;
     p_line->tag = tag;
+
+    /* The line's set is found from the address, as in decompose_address(). */
+    p_set = p_cache->cache_sets +
+        ((address >> p_cache->block_offset_bits) & (p_cache->num_sets - 1));
+    p_set->tags[p_line->line_no] = tag;
 }
 
 
@@ -504,7 +916,6 @@ void write_back_cache_line(cache_t *p_cache, cacheline_t *p_line,
      */
     membase_t *next_mem = p_cache->next_memory;
     addr_t start_addr;
-    int offset;
 
     assert(p_line->valid);
     assert(p_line->dirty);
@@ -523,7 +934,136 @@ void write_back_cache_line(cache_t *p_cache, cacheline_t *p_line,
            start_addr);
 #endif
 
-    /* Write each byte of the victim line out to the next level. */
-    for (offset = 0; offset < p_cache->block_size; offset++)
-        write_byte(next_mem, start_addr + offset, p_line->block[offset]);
+    /* Write the victim line out to the next level. */
+    write_block(next_mem, start_addr, p_line->block, p_cache->block_size);
+    p_cache->num_write_backs++;
+    p_cache->write_back_bytes += p_cache->block_size;
+}
+
+
+/* This function sets the coherence state of a line that has just been
+ * loaded for an access by this core.  The line is exclusive unless another
+ * core held a copy of the block.
+ */
+void coherent_fill(cache_t *p_cache, addr_t address, cacheline_t *p_line,
+                   int shared) {
+    p_line->mesi = shared ? MESI_SHARED : MESI_EXCLUSIVE;
+    p_line->touched = 0;
+}
+
+
+/* This function gets a line ready to be written by this core.  A shared line
+ * must first be invalidated in every other core; an exclusive line can
+ * become modified without telling anyone.
+ */
+void coherent_write(cache_t *p_cache, cacheline_t *p_line, addr_t address,
+                    unsigned int size) {
+    unsigned long long mask = touch_mask(p_cache, address, size);
+
+    if (p_line->mesi == MESI_SHARED)
+        bus_upgrade(p_cache->bus, p_cache->core, address, mask);
+
+    p_line->mesi = MESI_MODIFIED;
+    p_line->touched |= mask;
+}
+
+
+/* This function passes a write on to the next level of the memory, for a
+ * write-through cache or a write-no-allocate miss.  The bytes must all be
+ * within one block.  If the cache has a write-combining buffer, the write is
+ * merged into the buffer's entry for the block; a new entry drains the
+ * oldest one when the buffer is full.
+ */
+void pass_on_write(cache_t *p_cache, addr_t address,
+                   const unsigned char *buf, unsigned int size) {
+    addr_t block_start = get_block_start_from_address(p_cache, address);
+    addr_t block_offset = get_offset_in_block(p_cache, address);
+    wcb_entry_t *p_entry = NULL;
+    unsigned int i;
+
+    if (p_cache->num_wcb_entries == 0) {
+        write_block(p_cache->next_memory, address, buf, size);
+        p_cache->num_write_throughs++;
+        p_cache->write_through_bytes += size;
+        return;
+    }
+
+    for (i = 0; i < p_cache->num_wcb_entries; i++) {
+        if (p_cache->wcb[i].valid &&
+            p_cache->wcb[i].block_start == block_start) {
+            p_entry = p_cache->wcb + i;
+            break;
+        }
+    }
+
+    if (p_entry == NULL) {
+        /* Use a free entry, or drain the oldest one. */
+        p_entry = p_cache->wcb;
+        for (i = 0; i < p_cache->num_wcb_entries; i++) {
+            if (!p_cache->wcb[i].valid) {
+                p_entry = p_cache->wcb + i;
+                break;
+            }
+            if (p_cache->wcb[i].last_use < p_entry->last_use)
+                p_entry = p_cache->wcb + i;
+        }
+
+        if (p_entry->valid)
+            drain_wcb_entry(p_cache, p_entry);
+
+        p_entry->valid = 1;
+        p_entry->block_start = block_start;
+    }
+
+    memcpy(p_entry->data + block_offset, buf, size);
+    memset(p_entry->written + block_offset, 1, size);
+    p_entry->last_use = clock_tick();
+}
+
+
+/* This function writes the data held in a write-combining buffer entry to
+ * the next level of the memory, and frees the entry.  Each run of written
+ * bytes goes out as one transfer, so a fully written block is a single
+ * block-sized write.
+ */
+void drain_wcb_entry(cache_t *p_cache, wcb_entry_t *p_entry) {
+    unsigned int start = 0, end;
+
+    assert(p_entry->valid);
+
+    while (start < p_cache->block_size) {
+        if (!p_entry->written[start]) {
+            start++;
+            continue;
+        }
+
+        for (end = start; end < p_cache->block_size && p_entry->written[end];
+             end++);
+
+        write_block(p_cache->next_memory, p_entry->block_start + start,
+                    p_entry->data + start, end - start);
+        p_cache->num_write_throughs++;
+        p_cache->write_through_bytes += end - start;
+
+        start = end;
+    }
+
+    bzero(p_entry->written, p_cache->block_size);
+    p_entry->valid = 0;
+}
+
+
+/* This function drains the write-combining buffer entry for the block that
+ * starts at the specified address, if there is one.
+ */
+void drain_wcb_block(cache_t *p_cache, addr_t block_start) {
+    unsigned int i;
+
+    for (i = 0; i < p_cache->num_wcb_entries; i++) {
+        if (p_cache->wcb[i].valid &&
+            p_cache->wcb[i].block_start == block_start) {
+            drain_wcb_entry(p_cache, p_cache->wcb + i);
+            return;
+        }
+    }
 }
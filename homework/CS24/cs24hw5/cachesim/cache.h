@@ -1,6 +1,34 @@
 #include "membase.h"
 
 
+/* The packed tag array of each cache set holds this value for every line
+ * that is invalid.  It could also be the tag of a valid line, so a match on
+ * it must still be checked against the line's valid flag.
+ */
+#define INVALID_TAG ((addr_t) ~0)
+
+/* Tags are compared this many at a time, with a single vector compare when
+ * the compiler targets SSE2 or AVX2.  Each set's tag array is padded to a
+ * multiple of this size.
+ */
+#define TAG_CHUNK 8
+
+/* The bytes per cycle that a cache moves to or from the level above, unless
+ * configured otherwise.
+ */
+#define DEFAULT_CACHE_BANDWIDTH 32
+
+
+/* The MESI coherence states of a valid line, in a cache that is connected
+ * to a coherence bus.  An invalid line is simply not valid.
+ */
+typedef enum mesi_state_t {
+    MESI_SHARED,
+    MESI_EXCLUSIVE,
+    MESI_MODIFIED
+} mesi_state_t;
+
+
 /* This struct represents to a cache line within a cache set. */
 typedef struct cacheline_t {
     /* The index of the cache line.  This is mainly for informational and
@@ -24,6 +52,25 @@ typedef struct cacheline_t {
     /* Last time line accessed. Used for LRU. */
     unsigned long long int access_time;
 
+    /* The re-reference prediction value of the line, used by the RRIP
+     * policies.  Lines with larger values are expected to be reused later.
+     */
+    unsigned char rrpv;
+
+    /* This value will be 1 if the line was loaded by a prefetch and hasn't
+     * been used by a demand access yet, 0 otherwise.
+     */
+    char prefetched;
+
+    /* The MESI state of the line, for a cache on a coherence bus. */
+    unsigned char mesi;
+
+    /* For a cache on a coherence bus, a mask of the parts of the block that
+     * this core has accessed since the line was loaded.  Each bit covers
+     * 1/64th of the block, or one byte of blocks smaller than 64 bytes.
+     */
+    unsigned long long touched;
+
 } cacheline_t;
 
 
@@ -43,9 +90,118 @@ typedef struct cacheset_t {
 
     /* The cache lines in this cache set. */
     cacheline_t *cache_lines;
+
+    /* The tags of the cache lines, packed together so that a lookup touches
+     * only the tags rather than whole cache lines.  An invalid line's entry
+     * is INVALID_TAG, as are the entries that pad the array to a multiple of
+     * TAG_CHUNK.
+     */
+    addr_t *tags;
+
+    /* The bits of the tree-PLRU policy's binary tree over the lines.  Bit i
+     * is the node whose children are nodes 2i + 1 and 2i + 2, or lines when
+     * i is on the last level; a 0 points the victim search left.
+     */
+    unsigned long long plru_bits;
 } cacheset_t;
 
 
+struct cache_t;
+struct coherence_bus_t;
+
+
+/* A cache-line replacement policy.  The cache calls on_hit() whenever an
+ * access hits a line, and on_fill() when a missing block has just been
+ * loaded into a line.  choose_victim() is only called when every line in
+ * the set is valid, since an invalid line is always used first.
+ */
+typedef struct replacement_policy_t {
+    /* The name of the policy, as given in a cache specification. */
+    const char *name;
+
+    void (*on_hit)(struct cache_t *p_cache, cacheset_t *p_set,
+                   cacheline_t *p_line);
+    void (*on_fill)(struct cache_t *p_cache, cacheset_t *p_set,
+                    cacheline_t *p_line);
+    cacheline_t * (*choose_victim)(struct cache_t *p_cache,
+                                   cacheset_t *p_set);
+} replacement_policy_t;
+
+
+/* One entry of a write-combining buffer.  Writes that a cache passes on to
+ * the next level are gathered here a block at a time, so that several small
+ * writes to the same block go out together.  written[i] is 1 if byte i of
+ * the block holds data still to be written.
+ */
+typedef struct wcb_entry_t {
+    /* This value will be 0 if the entry is free, 1 if it is in use. */
+    int valid;
+
+    /* The address of the start of the block the entry holds writes for. */
+    addr_t block_start;
+
+    unsigned char *data;
+    unsigned char *written;
+
+    /* Last time the entry was written, for draining the oldest entry. */
+    unsigned long long last_use;
+} wcb_entry_t;
+
+
+/* The state used to sort a cache's misses into the three C's.  Every block
+ * the cache has been asked for is kept in a hash table, so that a miss on a
+ * block never seen before is compulsory.  A fully associative LRU cache with
+ * the same number of lines shadows the real one; a miss that also misses in
+ * the shadow is a capacity miss, and one that hits in the shadow is a
+ * conflict miss.
+ */
+typedef struct miss_classifier_t {
+    /* The hash table of blocks seen.  nodes[slot] is SLOT_EMPTY for an empty
+     * slot, SLOT_SEEN for a block that isn't in the shadow cache, or the
+     * block's node in the shadow cache's LRU list.
+     */
+    addr_t *blocks;
+    int *nodes;
+    unsigned int num_slots;
+    unsigned int num_blocks;
+
+    /* The shadow cache's LRU list, as arrays indexed by node.  head is the
+     * most recently used node, and tail the least.
+     */
+    addr_t *node_blocks;
+    int *prev, *next;
+    int head, tail;
+    unsigned int num_nodes;
+    unsigned int capacity;
+} miss_classifier_t;
+
+
+/* The most prefetches that a cache can have waiting to be issued. */
+#define PREFETCH_QUEUE_SIZE 16
+
+
+/* A hardware prefetcher model.  After every demand lookup, the cache calls
+ * on_access() with the address, whether the lookup missed, and whether it
+ * was the first use of a prefetched line.  The prefetcher requests blocks
+ * with issue_prefetch(); they are queued, and loaded into the cache before
+ * its next demand lookup, so that a prefetch never evicts the line that the
+ * current access is using.
+ */
+typedef struct prefetcher_t {
+    /* The name of the prefetcher, as given in a cache specification. */
+    const char *name;
+
+    /* Allocates and releases the prefetcher's state in the cache.  Either
+     * may be NULL if the prefetcher has no state.
+     */
+    void (*init)(struct cache_t *p_cache);
+    void (*free)(struct cache_t *p_cache);
+
+    void (*on_access)(struct cache_t *p_cache, addr_t address, int missed,
+                      int first_use);
+} prefetcher_t;
+
+
 /* This struct represents a cache that sits in front of another memory (which
  * could be another cache, or the final memory in the sequence), and which
  * will serve requests out of its own cache lines if it can, or will access
@@ -64,6 +220,12 @@ typedef struct cache_t {
     /* The function to write a byte to the cache. */
     void (*write_byte)(membase_t *mb, addr_t address, unsigned char value);
 
+    /* The functions to read and write blocks of bytes through the cache. */
+    void (*read_block)(membase_t *mb, addr_t address, unsigned char *buf,
+                       unsigned int size);
+    void (*write_block)(membase_t *mb, addr_t address,
+                        const unsigned char *buf, unsigned int size);
+
     /* The function to print the cache's access statistics. */
     void (*print_stats)(struct membase_t *mb);
 
@@ -109,12 +271,137 @@ typedef struct cache_t {
     /* The number of cache misses. */
     unsigned long long num_misses;
 
+    /* The number of lookups made for the level above, each of which is one
+     * of the hits or misses; num_hits also counts the other bytes of each
+     * access.
+     */
+    unsigned long long num_lookups;
+
+    /* For estimating time:  the cycles that each lookup takes, and the bytes
+     * per cycle that the cache can move to or from the level above.  A
+     * latency of 0 means that it hasn't been configured.
+     */
+    unsigned int latency;
+    unsigned int bandwidth;
+
+    /* The policy used to choose which line of a set to evict. */
+    const replacement_policy_t *policy;
+
+    /* The number of fills done by the BRRIP policy, which inserts one line
+     * in every BRRIP_EPSILON with a nearer re-reference prediction.
+     */
+    unsigned int brrip_fills;
+
+    /* The prefetcher attached to the cache, or NULL for none, and any state
+     * it keeps.
+     */
+    const prefetcher_t *prefetcher;
+    void *prefetch_state;
+
+    /* Prefetches at or above this address are dropped, so that none goes
+     * past the end of the memory.
+     */
+    addr_t prefetch_limit;
+
+    /* This value will be 1 if every write is also passed on to the next
+     * level (write-through), or 0 if modified lines are only written when
+     * they are evicted (write-back).
+     */
+    int write_through;
+
+    /* This value will be 1 if a write miss loads the block into the cache
+     * (write-allocate), or 0 if the write is just passed on to the next
+     * level (write-no-allocate).
+     */
+    int write_allocate;
+
+    /* The write-combining buffer that writes to the next level go through,
+     * and the number of entries in it; 0 entries means there is no buffer.
+     * Write-backs of evicted lines are whole blocks, and bypass the buffer.
+     */
+    unsigned int num_wcb_entries;
+    wcb_entry_t *wcb;
+
+    /* The traffic from this cache to the next level:  the transfers and
+     * bytes of lines loaded, dirty lines written back, and writes passed on
+     * by write-through or write-no-allocate.  With a write-combining buffer,
+     * the last are counted as the buffer drains.
+     */
+    unsigned long long num_fills, fill_bytes;
+    unsigned long long num_write_backs, write_back_bytes;
+    unsigned long long num_write_throughs, write_through_bytes;
+
+    /* The coherence bus that this cache is the first level of a core's
+     * private hierarchy on, or NULL, and the core it belongs to.
+     */
+    struct coherence_bus_t *bus;
+    unsigned int core;
+
+    /* The state for classifying misses, or NULL if they aren't classified,
+     * and the number of misses of each kind.
+     */
+    miss_classifier_t *classifier;
+    unsigned long long num_compulsory_misses;
+    unsigned long long num_capacity_misses;
+    unsigned long long num_conflict_misses;
+
+    /* The prefetches waiting to be issued. */
+    addr_t prefetch_queue[PREFETCH_QUEUE_SIZE];
+    unsigned int num_queued;
+
+    /* The number of blocks loaded by prefetches, how many of those were
+     * later used by a demand access, and how many were evicted unused.
+     */
+    unsigned long long num_prefetches;
+    unsigned long long num_useful_prefetches;
+    unsigned long long num_useless_prefetches;
+
 } cache_t;
 
 
 void init_cache(cache_t *p_cache, unsigned int block_size,
     unsigned int num_sets, unsigned int lines_per_set, membase_t *next_mem);
 
+/* The replacement policies, from replacement.c. */
+extern const replacement_policy_t lru_policy;
+extern const replacement_policy_t plru_policy;
+extern const replacement_policy_t srrip_policy;
+extern const replacement_policy_t brrip_policy;
+extern const replacement_policy_t random_policy;
+
+const replacement_policy_t * find_replacement_policy(const char *name);
+const char * check_replacement_policy(const replacement_policy_t *policy,
+                                      unsigned int lines_per_set);
+void set_replacement_policy(cache_t *p_cache,
+                            const replacement_policy_t *policy);
+
+void set_write_policy(cache_t *p_cache, int write_through,
+                      int write_allocate, unsigned int num_wcb_entries);
+
+/* Miss classification, from classify.c. */
+void enable_miss_classification(cache_t *p_cache);
+void classify_access(cache_t *p_cache, addr_t address, int missed);
+void free_miss_classifier(cache_t *p_cache);
+
+/* The prefetchers, from prefetch.c. */
+extern const prefetcher_t nextline_prefetcher;
+extern const prefetcher_t stride_prefetcher;
+extern const prefetcher_t stream_prefetcher;
+
+const prefetcher_t * find_prefetcher(const char *name);
+void set_prefetcher(cache_t *p_cache, const prefetcher_t *prefetcher,
+                    addr_t limit);
+void issue_prefetch(cache_t *p_cache, addr_t address);
+
 int flush_cache(cache_t *p_cache);
 
+/* The results of snoop_cache(), combined with bitwise-or. */
+#define SNOOP_FOUND 1
+#define SNOOP_WROTE_BACK 2
+
+int snoop_cache(cache_t *p_cache, addr_t address, int invalidate,
+                unsigned long long *p_touched);
+unsigned long long touch_mask(cache_t *p_cache, addr_t address,
+                              unsigned int size);
+
 
@@ -0,0 +1,353 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "cacheprof.h"
+
+
+/*
+   The shim that profiles other modules' data structures on the simulated
+   caches.  It builds the hierarchy with the same make_cache() as the
+   cachesim programs, on top of a sparse memory_t, and sends each reported
+   access through it with read_block() or write_block().  A region's misses
+   at each level are the growth of that cache's counts over its accesses.
+
+   The blocks of the simulated memory only ever hold zeros:  every write
+   writes zeros, so that the real memory, which may not even be mapped yet,
+   is never read.
+*/
+
+
+#ifdef CACHEPROF
+
+#include "membase.h"
+#include "memory.h"
+#include "cache.h"
+#include "cmdline.h"
+
+
+/* The slots of the table that maps real chunks to simulated ones; a power of
+ * 2, with room to spare for CACHEPROF_MAX_CHUNKS.
+ */
+#define CHUNK_SLOTS  16384
+
+/* Accesses are simulated in pieces of at most this many bytes. */
+#define PIECE_SIZE   256
+
+
+/* A region's accesses, and its lookups and misses at each level. */
+typedef struct region_counts {
+    unsigned long long accesses;
+    unsigned long long bytes;
+    unsigned long long lookups[CACHEPROF_MAX_LEVELS];
+    unsigned long long misses[CACHEPROF_MAX_LEVELS];
+} region_counts;
+
+
+/* The simulated hierarchy, first level first, and the memory behind it. */
+static cache_t *caches[CACHEPROF_MAX_LEVELS];
+static int num_levels;
+static memory_t *memory;
+
+/* The regions, and their counts.  The counts at CACHEPROF_MAX_REGIONS are
+ * those of every region that didn't get its own.
+ */
+static cacheprof_region *regions[CACHEPROF_MAX_REGIONS];
+static region_counts counts[CACHEPROF_MAX_REGIONS + 1];
+static int num_regions;
+
+/* The table of the real chunks that have been mapped, as real chunk number
+ * plus one so that 0 is an empty slot, with the simulated chunk of each.
+ * The last chunk looked up is kept apart, since most accesses are to it.
+ */
+static uintptr_t chunk_keys[CHUNK_SLOTS];
+static unsigned int chunk_values[CHUNK_SLOTS];
+static unsigned int num_chunks;
+static unsigned long long num_overflows;
+static uintptr_t last_key;
+static unsigned int last_value;
+
+/* Held while an access is simulated, since the caches aren't thread-safe. */
+static char lock;
+
+static const unsigned char zeros[PIECE_SIZE];
+
+
+/* Builds the hierarchy from the specifications in CACHEPROF_CACHES.  The
+ * descriptions that make_cache() prints go to stderr, so that the output of
+ * the profiled program isn't mixed up with them.
+ */
+static void build_hierarchy(void) {
+    const char *env = getenv("CACHEPROF_CACHES");
+    char *specs, *spec, *spec_list[CACHEPROF_MAX_LEVELS];
+    unsigned int mem_size =
+        (unsigned int) (CACHEPROF_MAX_CHUNKS * CACHEPROF_CHUNK_SIZE);
+    membase_t *next;
+    int saved_stdout, i;
+
+    if (env == NULL || *env == '\0')
+        env = CACHEPROF_DEFAULT_CACHES;
+
+    specs = strdup(env);
+    if (specs == NULL) {
+        fprintf(stderr, "cacheprof:  out of memory.\n");
+        exit(1);
+    }
+
+    num_levels = 0;
+    for (spec = strtok(specs, " \t"); spec != NULL;
+         spec = strtok(NULL, " \t")) {
+        if (num_levels == CACHEPROF_MAX_LEVELS) {
+            fprintf(stderr, "cacheprof:  CACHEPROF_CACHES has more than %d "
+                    "caches.\n", CACHEPROF_MAX_LEVELS);
+            exit(1);
+        }
+        spec_list[num_levels++] = spec;
+    }
+    if (num_levels == 0) {
+        fprintf(stderr, "cacheprof:  CACHEPROF_CACHES has no caches.\n");
+        exit(1);
+    }
+
+    fflush(stdout);
+    saved_stdout = dup(1);
+    if (saved_stdout >= 0)
+        dup2(2, 1);
+
+    printf("cacheprof:  building the simulated caches, last level "
+           "first:\n");
+    memory = malloc(sizeof(memory_t));
+    if (memory == NULL) {
+        fprintf(stderr, "cacheprof:  out of memory.\n");
+        exit(1);
+    }
+    init_memory(memory, mem_size);
+
+    next = (membase_t *) memory;
+    for (i = num_levels - 1; i >= 0; i--) {
+        caches[i] = make_cache(spec_list[i], i + 1, "CACHEPROF_CACHES", next,
+                               mem_size);
+        next = (membase_t *) caches[i];
+    }
+
+    fflush(stdout);
+    if (saved_stdout >= 0) {
+        dup2(saved_stdout, 1);
+        close(saved_stdout);
+    }
+
+    free(specs);
+}
+
+
+/* Returns the simulated address of a real address, mapping its chunk if it
+ * hasn't been mapped yet.
+ */
+static addr_t map_address(uintptr_t real) {
+    uintptr_t key = (real >> CACHEPROF_CHUNK_BITS) + 1;
+    unsigned int slot;
+
+    if (key != last_key) {
+        slot = (unsigned int) (key * 2654435761U) & (CHUNK_SLOTS - 1);
+        while (chunk_keys[slot] != 0 && chunk_keys[slot] != key)
+            slot = (slot + 1) & (CHUNK_SLOTS - 1);
+
+        if (chunk_keys[slot] == 0) {
+            chunk_keys[slot] = key;
+            if (num_chunks < CACHEPROF_MAX_CHUNKS) {
+                chunk_values[slot] = num_chunks++;
+            }
+            else {
+                chunk_values[slot] = CACHEPROF_MAX_CHUNKS - 1;
+                num_overflows++;
+            }
+        }
+
+        last_key = key;
+        last_value = chunk_values[slot];
+    }
+
+    return (addr_t) ((last_value << CACHEPROF_CHUNK_BITS) |
+                     (real & (CACHEPROF_CHUNK_SIZE - 1)));
+}
+
+
+/* Gives the region its counters, or the shared ones if they have all been
+ * given out, and returns their index.
+ */
+static int register_region(cacheprof_region *region) {
+    if (num_regions < CACHEPROF_MAX_REGIONS) {
+        regions[num_regions] = region;
+        region->index = num_regions++;
+    }
+    else {
+        region->index = CACHEPROF_MAX_REGIONS;
+    }
+    return region->index;
+}
+
+
+/* Simulates a read or write of size bytes at addr, and counts it in the
+ * region.
+ */
+void cacheprof_access(cacheprof_region *region, const void *addr,
+                      unsigned int size, int is_write) {
+    unsigned long long lookups[CACHEPROF_MAX_LEVELS];
+    unsigned long long misses[CACHEPROF_MAX_LEVELS];
+    unsigned char buf[PIECE_SIZE];
+    uintptr_t real = (uintptr_t) addr;
+    region_counts *rc;
+    unsigned int n;
+    int i;
+
+    while (__atomic_test_and_set(&lock, __ATOMIC_ACQUIRE))
+        ;
+
+    if (memory == NULL)
+        build_hierarchy();
+
+    i = region->index;
+    if (i < 0)
+        i = register_region(region);
+    rc = &counts[i];
+
+    for (i = 0; i < num_levels; i++) {
+        lookups[i] = caches[i]->num_lookups;
+        misses[i] = caches[i]->num_misses;
+    }
+
+    rc->accesses++;
+    rc->bytes += size;
+
+    /* A piece never crosses the end of a chunk, since the next chunk may be
+     * anywhere in the simulated memory.
+     */
+    while (size > 0) {
+        n = CACHEPROF_CHUNK_SIZE - (real & (CACHEPROF_CHUNK_SIZE - 1));
+        if (n > PIECE_SIZE)
+            n = PIECE_SIZE;
+        if (n > size)
+            n = size;
+
+        if (is_write)
+            write_block((membase_t *) caches[0], map_address(real), zeros, n);
+        else
+            read_block((membase_t *) caches[0], map_address(real), buf, n);
+
+        real += n;
+        size -= n;
+    }
+
+    for (i = 0; i < num_levels; i++) {
+        rc->lookups[i] += caches[i]->num_lookups - lookups[i];
+        rc->misses[i] += caches[i]->num_misses - misses[i];
+    }
+
+    __atomic_clear(&lock, __ATOMIC_RELEASE);
+}
+
+
+/* Prints one line of a region's counts, with the misses at each level, and
+ * adds them to the total.
+ */
+static void print_counts(FILE *f, const char *name, const region_counts *rc,
+                         region_counts *total) {
+    int i;
+
+    fprintf(f, "  %-24s %12llu %14llu", name, rc->accesses, rc->bytes);
+    for (i = 0; i < num_levels; i++) {
+        fprintf(f, " %12llu %6.2f%%", rc->misses[i],
+                rc->lookups[i] > 0 ? 100.0 * rc->misses[i] / rc->lookups[i]
+                                   : 0.0);
+    }
+    fprintf(f, "\n");
+
+    if (total != NULL) {
+        total->accesses += rc->accesses;
+        total->bytes += rc->bytes;
+        for (i = 0; i < num_levels; i++) {
+            total->lookups[i] += rc->lookups[i];
+            total->misses[i] += rc->misses[i];
+        }
+    }
+}
+
+
+/* Prints every region's accesses and misses, and their totals.  The miss
+ * rate at each level is of the lookups that reached that level.
+ */
+void cacheprof_dump(FILE *f) {
+    region_counts total;
+    int i;
+
+    while (__atomic_test_and_set(&lock, __ATOMIC_ACQUIRE))
+        ;
+
+    if (memory == NULL) {
+        __atomic_clear(&lock, __ATOMIC_RELEASE);
+        return;
+    }
+
+    fprintf(f, "cacheprof:  ");
+    for (i = 0; i < num_levels; i++) {
+        fprintf(f, "%sL%d %u:%u:%u", i > 0 ? ", " : "", i + 1,
+                caches[i]->block_size, caches[i]->num_sets,
+                caches[i]->cache_sets[0].num_lines);
+    }
+    fprintf(f, "\n  %-24s %12s %14s", "region", "accesses", "bytes");
+    for (i = 0; i < num_levels; i++)
+        fprintf(f, "    L%d misses    rate", i + 1);
+    fprintf(f, "\n");
+
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < num_regions; i++)
+        print_counts(f, regions[i]->name, &counts[i], &total);
+    if (counts[CACHEPROF_MAX_REGIONS].accesses > 0) {
+        print_counts(f, "other regions", &counts[CACHEPROF_MAX_REGIONS],
+                     &total);
+    }
+    print_counts(f, "total", &total, NULL);
+
+    if (num_overflows > 0) {
+        fprintf(f, "  %llu chunks didn't fit in the simulated memory, and "
+                "shared its last chunk.\n", num_overflows);
+    }
+
+    __atomic_clear(&lock, __ATOMIC_RELEASE);
+}
+
+
+/* Dumps the regions when the program exits. */
+__attribute__((destructor))
+static void dump_at_exit(void) {
+    const char *output = getenv("CACHEPROF_OUTPUT");
+    FILE *f = stderr;
+
+    if (memory == NULL)
+        return;
+
+    if (output != NULL && *output != '\0') {
+        f = fopen(output, "a");
+        if (f == NULL) {
+            perror(output);
+            return;
+        }
+    }
+
+    cacheprof_dump(f);
+
+    if (f != stderr)
+        fclose(f);
+}
+
+#else
+
+/* Without the shim, there is nothing to report. */
+void cacheprof_dump(FILE *f) {
+    (void) f;
+}
+
+#endif /* CACHEPROF */
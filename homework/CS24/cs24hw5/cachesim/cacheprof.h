@@ -0,0 +1,93 @@
+#ifndef CACHEPROF_H
+#define CACHEPROF_H
+
+#include <stdio.h>
+
+
+/*
+ * A shim that routes the memory accesses of another module's data
+ * structures through a simulated cache hierarchy, so that a change to their
+ * layout can be judged by its simulated miss rates before it is timed on
+ * real hardware.  It is switched on and reports in the same way as the
+ * probes of common/probe.h, with CACHEPROF and CACHEPROF_OUTPUT in place of
+ * PROBES and PROBE_OUTPUT.  Each data structure is a region, defined once at
+ * file scope, and its accesses are reported where they are made:
+ *
+ *     CACHEPROF_DEFINE(node_region, "multimap nodes");
+ *
+ *     while (node != NULL) {
+ *         CACHEPROF_READ(node_region, &node->key, sizeof(node->key));
+ *         ...
+ *     }
+ *
+ * The real addresses are mapped into the simulated memory a chunk of
+ * CACHEPROF_CHUNK_SIZE bytes at a time, in the order that the chunks are
+ * first touched, so that addresses keep their offsets within a chunk, and
+ * so their cache sets too in any cache with no more than a chunk per way.
+ * The real memory itself is never touched.
+ *
+ * The hierarchy is built on the first access, from the cache specifications
+ * in the CACHEPROF_CACHES environment variable, in the B:S:E[:opt...] form
+ * of the cachesim programs, separated by spaces and first level first.  The
+ * default is CACHEPROF_DEFAULT_CACHES.  The accesses of all threads go
+ * through the one hierarchy, one at a time, as if the threads shared one
+ * core.  The report gives each region's accesses, and its misses at each
+ * level.
+ */
+
+
+/* The hierarchy that is simulated if CACHEPROF_CACHES doesn't say:  32KiB
+ * of 8-way first-level cache, and 256KiB of 8-way second-level cache, both
+ * with 64-byte blocks.
+ */
+#define CACHEPROF_DEFAULT_CACHES  "64:64:8 64:512:8"
+
+/* The most levels of cache, and the most regions that are reported
+ * separately; any more regions are reported together as "other regions".
+ */
+#define CACHEPROF_MAX_LEVELS      4
+#define CACHEPROF_MAX_REGIONS     32
+
+/* The real addresses are mapped into the simulated memory in chunks of this
+ * many bytes, and the simulated memory has room for CACHEPROF_MAX_CHUNKS of
+ * them, just under the 4GiB that an addr_t can address.  Chunks touched
+ * after it is full share its last chunk.
+ */
+#define CACHEPROF_CHUNK_BITS      20
+#define CACHEPROF_CHUNK_SIZE      (1UL << CACHEPROF_CHUNK_BITS)
+#define CACHEPROF_MAX_CHUNKS      4095
+
+
+/* A data structure whose accesses are counted on their own. */
+typedef struct cacheprof_region {
+    const char *name;
+
+    /* The region's counters, or -1 until it is first accessed. */
+    int index;
+} cacheprof_region;
+
+
+void cacheprof_dump(FILE *f);
+
+
+#ifdef CACHEPROF
+
+void cacheprof_access(cacheprof_region *region, const void *addr,
+                      unsigned int size, int is_write);
+
+#define CACHEPROF_DEFINE(region, name) \
+    static cacheprof_region region = { name, -1 }
+#define CACHEPROF_READ(region, addr, size) \
+    cacheprof_access(&(region), (addr), (size), 0)
+#define CACHEPROF_WRITE(region, addr, size) \
+    cacheprof_access(&(region), (addr), (size), 1)
+
+#else
+
+#define CACHEPROF_DEFINE(region, name)       extern int cacheprof_unused
+#define CACHEPROF_READ(region, addr, size)   ((void) 0)
+#define CACHEPROF_WRITE(region, addr, size)  ((void) 0)
+
+#endif /* CACHEPROF */
+
+#endif /* CACHEPROF_H */
@@ -0,0 +1,32 @@
+# The cache-profiling shim of cacheprof.h, used like the probes of
+# common/probe.mk with CACHEPROF=1 in place of PROBES=1.  The module's
+# Makefile sets CACHESIM_DIR to the path of this directory, and
+# CACHEPROF_PROGRAMS to the programs that use the shim, which are linked
+# with the shim and the simulator.  The simulator's sources are compiled
+# here with the module's own flags, into objects named cachesim_*.o.
+#
+# A program whose link line doesn't use $^ adds $(CACHEPROF_OBJS) to it,
+# and one that is compiled straight from its sources adds
+# $(CACHEPROF_SRCS) instead.
+
+CACHEPROF_SIM = membase memory cache replacement prefetch classify \
+	coherence sweep tlb cmdline
+
+ifeq ($(filter -I$(CACHESIM_DIR),$(CPPFLAGS)),)
+CPPFLAGS += -I$(CACHESIM_DIR)
+endif
+
+ifdef CACHEPROF
+override CFLAGS += -DCACHEPROF
+CACHEPROF_OBJS = cacheprof.o $(CACHEPROF_SIM:%=cachesim_%.o)
+CACHEPROF_SRCS = $(CACHESIM_DIR)/cacheprof.c \
+	$(CACHEPROF_SIM:%=$(CACHESIM_DIR)/%.c)
+
+$(CACHEPROF_PROGRAMS): $(CACHEPROF_OBJS)
+endif
+
+cacheprof.o: $(CACHESIM_DIR)/cacheprof.c $(CACHESIM_DIR)/cacheprof.h
+	$(CC) $(CPPFLAGS) $(CFLAGS) -c $< -o $@
+
+cachesim_%.o: $(CACHESIM_DIR)/%.c
+	$(CC) $(CPPFLAGS) $(CFLAGS) -c $< -o $@
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "cache.h"
+
+
+/* The values of nodes[] for slots that don't hold a node of the shadow
+ * cache.
+ */
+#define SLOT_EMPTY (-2)
+#define SLOT_SEEN (-1)
+
+/* The hash table of blocks seen starts out with this many slots, and
+ * doubles when it gets half full.
+ */
+#define INITIAL_SLOTS 4096
+
+
+/* Local functions used by the miss classifier. */
+
+unsigned int block_slot(miss_classifier_t *p_mc, addr_t block);
+void grow_block_table(miss_classifier_t *p_mc);
+void unlink_node(miss_classifier_t *p_mc, int node);
+void push_node(miss_classifier_t *p_mc, int node);
+
+
+/* Starts classifying the misses of a cache as compulsory, capacity or
+ * conflict misses.  This should be done before the cache is used, since a
+ * block already in the cache would otherwise look like it was never seen.
+ */
+void enable_miss_classification(cache_t *p_cache) {
+    miss_classifier_t *p_mc;
+    unsigned int i;
+
+    assert(p_cache != NULL);
+    assert(p_cache->classifier == NULL);
+
+    p_mc = calloc(1, sizeof(miss_classifier_t));
+    if (p_mc == NULL) {
+        printf("ERROR:  unable to allocate memory for miss classification.\n");
+        exit(1);
+    }
+
+    p_mc->num_slots = INITIAL_SLOTS;
+    p_mc->blocks = malloc(p_mc->num_slots * sizeof(addr_t));
+    p_mc->nodes = malloc(p_mc->num_slots * sizeof(int));
+
+    p_mc->capacity =
+        p_cache->num_sets * (unsigned int) p_cache->cache_sets[0].num_lines;
+    p_mc->node_blocks = malloc(p_mc->capacity * sizeof(addr_t));
+    p_mc->prev = malloc(p_mc->capacity * sizeof(int));
+    p_mc->next = malloc(p_mc->capacity * sizeof(int));
+
+    if (p_mc->blocks == NULL || p_mc->nodes == NULL ||
+        p_mc->node_blocks == NULL || p_mc->prev == NULL ||
+        p_mc->next == NULL) {
+        printf("ERROR:  unable to allocate memory for miss classification.\n");
+        exit(1);
+    }
+
+    for (i = 0; i < p_mc->num_slots; i++)
+        p_mc->nodes[i] = SLOT_EMPTY;
+
+    p_mc->head = -1;
+    p_mc->tail = -1;
+
+    p_cache->classifier = p_mc;
+}
+
+
+/* Records a demand lookup of the block holding the specified address, and
+ * if the lookup missed, classifies the miss.  Both hits and misses move the
+ * block to the front of the shadow cache.
+ */
+void classify_access(cache_t *p_cache, addr_t address, int missed) {
+    miss_classifier_t *p_mc = p_cache->classifier;
+    addr_t block = address >> p_cache->block_offset_bits;
+    unsigned int slot = block_slot(p_mc, block);
+    int node, first_touch = 0, shadow_hit;
+
+    if (p_mc->nodes[slot] == SLOT_EMPTY) {
+        first_touch = 1;
+
+        p_mc->blocks[slot] = block;
+        p_mc->nodes[slot] = SLOT_SEEN;
+        p_mc->num_blocks++;
+
+        if (2 * p_mc->num_blocks > p_mc->num_slots) {
+            grow_block_table(p_mc);
+            slot = block_slot(p_mc, block);
+        }
+    }
+
+    node = p_mc->nodes[slot];
+    shadow_hit = (node >= 0);
+
+    if (shadow_hit) {
+        unlink_node(p_mc, node);
+    }
+    else if (p_mc->num_nodes < p_mc->capacity) {
+        node = p_mc->num_nodes++;
+    }
+    else {
+        /* Evict the shadow cache's least recently used block. */
+        node = p_mc->tail;
+        unlink_node(p_mc, node);
+        p_mc->nodes[block_slot(p_mc, p_mc->node_blocks[node])] = SLOT_SEEN;
+    }
+
+    p_mc->node_blocks[node] = block;
+    p_mc->nodes[slot] = node;
+    push_node(p_mc, node);
+
+    if (!missed)
+        return;
+
+    if (first_touch)
+        p_cache->num_compulsory_misses++;
+    else if (!shadow_hit)
+        p_cache->num_capacity_misses++;
+    else
+        p_cache->num_conflict_misses++;
+}
+
+
+/* Releases the memory used to classify a cache's misses. */
+void free_miss_classifier(cache_t *p_cache) {
+    miss_classifier_t *p_mc = p_cache->classifier;
+
+    if (p_mc == NULL)
+        return;
+
+    free(p_mc->blocks);
+    free(p_mc->nodes);
+    free(p_mc->node_blocks);
+    free(p_mc->prev);
+    free(p_mc->next);
+    free(p_mc);
+
+    p_cache->classifier = NULL;
+}
+
+
+/*---------------------------------------------------------------------------
+ * CLASSIFIER HELPER FUNCTIONS
+ */
+
+
+/* Returns the slot that holds the specified block, or the empty slot where
+ * it belongs if it isn't in the table.
+ */
+unsigned int block_slot(miss_classifier_t *p_mc, addr_t block) {
+    unsigned int mask = p_mc->num_slots - 1;
+    unsigned int slot = (block * 0x9E3779B1U) & mask;
+
+    while (p_mc->nodes[slot] != SLOT_EMPTY && p_mc->blocks[slot] != block)
+        slot = (slot + 1) & mask;
+
+    return slot;
+}
+
+
+/* Doubles the number of slots in the table of blocks seen. */
+void grow_block_table(miss_classifier_t *p_mc) {
+    addr_t *old_blocks = p_mc->blocks;
+    int *old_nodes = p_mc->nodes;
+    unsigned int old_slots = p_mc->num_slots, i, slot;
+
+    p_mc->num_slots *= 2;
+    p_mc->blocks = malloc(p_mc->num_slots * sizeof(addr_t));
+    p_mc->nodes = malloc(p_mc->num_slots * sizeof(int));
+    if (p_mc->blocks == NULL || p_mc->nodes == NULL) {
+        printf("ERROR:  unable to allocate memory for miss classification.\n");
+        exit(1);
+    }
+
+    for (i = 0; i < p_mc->num_slots; i++)
+        p_mc->nodes[i] = SLOT_EMPTY;
+
+    for (i = 0; i < old_slots; i++) {
+        if (old_nodes[i] != SLOT_EMPTY) {
+            slot = block_slot(p_mc, old_blocks[i]);
+            p_mc->blocks[slot] = old_blocks[i];
+            p_mc->nodes[slot] = old_nodes[i];
+        }
+    }
+
+    free(old_blocks);
+    free(old_nodes);
+}
+
+
+/* Removes a node from the shadow cache's LRU list. */
+void unlink_node(miss_classifier_t *p_mc, int node) {
+    if (p_mc->prev[node] >= 0)
+        p_mc->next[p_mc->prev[node]] = p_mc->next[node];
+    else
+        p_mc->head = p_mc->next[node];
+
+    if (p_mc->next[node] >= 0)
+        p_mc->prev[p_mc->next[node]] = p_mc->prev[node];
+    else
+        p_mc->tail = p_mc->prev[node];
+}
+
+
+/* Puts a node at the front of the shadow cache's LRU list. */
+void push_node(miss_classifier_t *p_mc, int node) {
+    p_mc->prev[node] = -1;
+    p_mc->next[node] = p_mc->head;
+
+    if (p_mc->head >= 0)
+        p_mc->prev[p_mc->head] = node;
+    else
+        p_mc->tail = node;
+
+    p_mc->head = node;
+}
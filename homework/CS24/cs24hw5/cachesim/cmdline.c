@@ -1,25 +1,439 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "cmdline.h"
 #include "memory.h"
 #include "cache.h"
+#include "sweep.h"
+#include "tlb.h"
+
+
+/* The cycles that each lookup takes in the first, second and third levels
+ * of caches, unless configured otherwise; any further levels take as long as
+ * the third.
+ */
+static const unsigned int level_latencies[] = { 4, 12, 40 };
+#define NUM_LEVEL_LATENCIES 3
+
+
+/* The parts of the memory built by the last call to make_cached_memory(),
+ * for print_memory_costs().  The caches are in order from the first level.
+ */
+static tlb_t *costed_tlb;
+static cache_t **costed_caches;
+static int num_costed_caches;
+static memory_t *costed_memory;
 
 
 /* Prints the program usage. */
 void usage(const char *progname) {
     printf("usage: %s [cache-spec ...]\n\n", progname);
-    printf("\tAll arguments are cache specifications in the form B:S:E, where\n");
-    printf("\tB, S and E are all positive integers with the following meanings:\n");
+    printf("\tAll arguments are cache specifications in the form B:S:E[:opt...],\n");
+    printf("\twhere B, S and E are all positive integers with the following meanings:\n");
     printf("\t\tB = block size for the cache, in bytes (must be a power of 2)\n");
     printf("\t\tS = the number of cache-sets in the cache (must be a power of 2)\n");
     printf("\t\tE = the number of cache-lines in each cache-set (may be 1 or more)\n");
+    printf("\tand each optional opt is one of the following:\n");
+    printf("\t\tlru      = replace the least recently used line (the default)\n");
+    printf("\t\tplru     = tree pseudo-LRU (E must be a power of 2, at most 64)\n");
+    printf("\t\tsrrip    = static re-reference interval prediction\n");
+    printf("\t\tbrrip    = bimodal re-reference interval prediction\n");
+    printf("\t\trandom   = replace a randomly chosen line\n");
+    printf("\t\tnextline = prefetch the block after each miss\n");
+    printf("\t\tstride   = prefetch constant-stride address streams\n");
+    printf("\t\tstream   = prefetch with stream buffers\n");
+    printf("\t\twb, wt   = write-back (the default) or write-through\n");
+    printf("\t\twa, nwa  = write-allocate (the default) or write-no-allocate\n");
+    printf("\t\twcb=N    = pass writes on through an N-entry write-combining buffer\n");
+    printf("\t\t3c       = classify misses as compulsory, capacity or conflict\n");
+    printf("\t\tlat=N    = each lookup takes N cycles (default %u, %u, %u, ... by level)\n",
+           level_latencies[0], level_latencies[1], level_latencies[2]);
+    printf("\t\tbw=N     = the cache moves N bytes per cycle (default %d)\n",
+           DEFAULT_CACHE_BANDWIDTH);
+    printf("\n");
+    printf("\tThe last argument may be a memory specification in the form\n");
+    printf("\tmem:L[:W], for a memory whose accesses take L cycles (default %d)\n",
+           DEFAULT_MEMORY_LATENCY);
+    printf("\tand that moves W bytes per cycle (default %d).\n",
+           DEFAULT_MEMORY_BANDWIDTH);
+    printf("\n");
+    printf("\tThe first argument may instead be a sweep specification in the form\n");
+    printf("\tsweep:B1-B2:S1-S2:E, which simulates every LRU cache with a block\n");
+    printf("\tsize from B1 to B2, S1 to S2 cache-sets, and 1 to E lines per set,\n");
+    printf("\tall powers of 2, in a single run.  Any caches after it see the\n");
+    printf("\tsame accesses.\n");
+    printf("\n");
+    printf("\tA TLB may be put in front of everything else with a first argument\n");
+    printf("\tin the form tlb:N:E:P[:C], for a TLB of N entries in sets of E,\n");
+    printf("\tfor pages of P bytes (a power of 2, which may end in K or M), with\n");
+    printf("\tpage walks of C cycles (default %d).  A sweep may follow it.\n",
+           DEFAULT_WALK_CYCLES);
     printf("\n");
     printf("\tThe actual memory size will be fixed by the program itself, as it\n");
     printf("\tdepends on the specific tests being run against the cache simulator.\n");
 }
 
 
+/* The options that can follow B:S:E in a cache specification. */
+typedef struct cache_options_t {
+    const replacement_policy_t *policy;
+    const prefetcher_t *prefetcher;
+    int write_through;
+    int write_allocate;
+    unsigned int num_wcb_entries;
+    int classify_misses;
+    unsigned int latency;
+    unsigned int bandwidth;
+} cache_options_t;
+
+
+void parse_cache_options(const char *spec, int arg_no, const char *progname,
+                         cache_options_t *p_opts);
+void set_memory_costs(memory_t *p_memory, const char *spec, int arg_no,
+                      const char *progname);
+
+
+/* Parses the colon-separated options after the B:S:E part of a cache
+ * specification into *p_opts.  Options not given keep their defaults.
+ */
+void parse_cache_options(const char *spec, int arg_no, const char *progname,
+                         cache_options_t *p_opts) {
+    char opt[32];
+    const char *p;
+    unsigned int len;
+    int wcb_entries, value, skip;
+
+    p_opts->policy = NULL;
+    p_opts->prefetcher = NULL;
+    p_opts->write_through = 0;
+    p_opts->write_allocate = 1;
+    p_opts->num_wcb_entries = 0;
+    p_opts->classify_misses = 0;
+    p_opts->latency = 0;
+    p_opts->bandwidth = DEFAULT_CACHE_BANDWIDTH;
+
+    /* Skip past the B:S:E part. */
+    p = strchr(spec, ':');
+    if (p != NULL)
+        p = strchr(p + 1, ':');
+    if (p != NULL)
+        p = strchr(p + 1, ':');
+
+    while (p != NULL) {
+        p++;
+        len = strcspn(p, ":");
+        if (len == 0 || len >= sizeof(opt)) {
+            printf("ERROR:  argument %d:  empty or overlong option.\n",
+                   arg_no);
+            usage(progname);
+            exit(1);
+        }
+
+        memcpy(opt, p, len);
+        opt[len] = '\0';
+
+        if (strcmp(opt, "wb") == 0) {
+            p_opts->write_through = 0;
+        }
+        else if (strcmp(opt, "wt") == 0) {
+            p_opts->write_through = 1;
+        }
+        else if (strcmp(opt, "wa") == 0) {
+            p_opts->write_allocate = 1;
+        }
+        else if (strcmp(opt, "nwa") == 0) {
+            p_opts->write_allocate = 0;
+        }
+        else if (strcmp(opt, "3c") == 0) {
+            p_opts->classify_misses = 1;
+        }
+        else if (sscanf(opt, "wcb=%d%n", &wcb_entries, &skip) == 1 &&
+                 opt[skip] == '\0') {
+            if (wcb_entries <= 0) {
+                printf("ERROR:  argument %d:  write-combining buffer must "
+                       "have a positive number of entries, got %d.\n",
+                       arg_no, wcb_entries);
+                usage(progname);
+                exit(1);
+            }
+            p_opts->num_wcb_entries = wcb_entries;
+        }
+        else if (sscanf(opt, "lat=%d%n", &value, &skip) == 1 &&
+                 opt[skip] == '\0') {
+            if (value <= 0) {
+                printf("ERROR:  argument %d:  latency must be a positive "
+                       "number of cycles, got %d.\n", arg_no, value);
+                usage(progname);
+                exit(1);
+            }
+            p_opts->latency = value;
+        }
+        else if (sscanf(opt, "bw=%d%n", &value, &skip) == 1 &&
+                 opt[skip] == '\0') {
+            if (value <= 0) {
+                printf("ERROR:  argument %d:  bandwidth must be a positive "
+                       "number of bytes per cycle, got %d.\n", arg_no,
+                       value);
+                usage(progname);
+                exit(1);
+            }
+            p_opts->bandwidth = value;
+        }
+        else if (find_replacement_policy(opt) != NULL) {
+            p_opts->policy = find_replacement_policy(opt);
+        }
+        else if (find_prefetcher(opt) != NULL) {
+            p_opts->prefetcher = find_prefetcher(opt);
+        }
+        else {
+            printf("ERROR:  argument %d:  unrecognized option \"%s\".\n",
+                   arg_no, opt);
+            usage(progname);
+            exit(1);
+        }
+
+        p = strchr(p, ':');
+    }
+}
+
+
+/* Builds the sweep described by a specification of the form
+ * sweep:B1-B2:S1-S2:E, on top of the specified memory.
+ */
+membase_t * make_sweep(const char *spec, membase_t *next_mem,
+                       const char *progname) {
+    unsigned int min_block, max_block, min_sets, max_sets, max_lines;
+    sweep_t *p_sweep;
+
+    if (sscanf(spec, "sweep:%u-%u:%u-%u:%u", &min_block, &max_block,
+               &min_sets, &max_sets, &max_lines) != 5) {
+        printf("ERROR:  argument 1 isn't a correctly formatted sweep.\n");
+        usage(progname);
+        exit(1);
+    }
+
+    if (!is_power_of_2(min_block) || !is_power_of_2(max_block) ||
+        !is_power_of_2(min_sets) || !is_power_of_2(max_sets) ||
+        !is_power_of_2(max_lines) || min_block > max_block ||
+        min_sets > max_sets) {
+        printf("ERROR:  argument 1:  sweep ranges must be increasing "
+               "powers of 2, got %s.\n", spec);
+        usage(progname);
+        exit(1);
+    }
+
+    printf(" * Building sweep over block-sizes of %u to %u bytes, %u to %u "
+           "cache-sets,\n   and 1 to %u cache-lines per set.\n", min_block,
+           max_block, min_sets, max_sets, max_lines);
+
+    p_sweep = malloc(sizeof(sweep_t));
+    init_sweep(p_sweep, min_block, max_block, min_sets, max_sets, max_lines,
+               next_mem);
+
+    return (membase_t *) p_sweep;
+}
+
+
+/* Sets the latency and bandwidth of the memory from a specification of the
+ * form mem:L[:W].  arg_no is the number of the specification's argument,
+ * for error messages.
+ */
+void set_memory_costs(memory_t *p_memory, const char *spec, int arg_no,
+                      const char *progname) {
+    int latency, bandwidth = DEFAULT_MEMORY_BANDWIDTH, skip = 0, ct;
+
+    ct = sscanf(spec, "mem:%d%n:%d%n", &latency, &skip, &bandwidth, &skip);
+    if (ct < 1 || spec[skip] != '\0') {
+        printf("ERROR:  argument %d isn't a correctly formatted memory.\n",
+               arg_no);
+        usage(progname);
+        exit(1);
+    }
+
+    if (latency <= 0 || bandwidth <= 0) {
+        printf("ERROR:  argument %d:  memory latency and bandwidth must be "
+               "positive, got %s.\n", arg_no, spec);
+        usage(progname);
+        exit(1);
+    }
+
+    printf("   Memory accesses take %d cycles, and move %d bytes per "
+           "cycle.\n", latency, bandwidth);
+
+    p_memory->latency = latency;
+    p_memory->bandwidth = bandwidth;
+}
+
+
+/* Builds the TLB described by a specification of the form tlb:N:E:P[:C],
+ * on top of the specified memory.
+ */
+membase_t * make_tlb(const char *spec, membase_t *next_mem,
+                     const char *progname) {
+    unsigned int num_entries, num_ways, page_size, walk_cycles;
+    const char *p;
+    tlb_t *p_tlb;
+    int skip = 0;
+
+    if (sscanf(spec, "tlb:%u:%u:%u%n", &num_entries, &num_ways, &page_size,
+               &skip) != 3) {
+        printf("ERROR:  argument 1 isn't a correctly formatted TLB.\n");
+        usage(progname);
+        exit(1);
+    }
+
+    /* The page size may be given in kilobytes or megabytes. */
+    p = spec + skip;
+    if (*p == 'K' || *p == 'k') {
+        page_size <<= 10;
+        p++;
+    }
+    else if (*p == 'M' || *p == 'm') {
+        page_size <<= 20;
+        p++;
+    }
+
+    walk_cycles = DEFAULT_WALK_CYCLES;
+    if (*p == ':') {
+        if (sscanf(p, ":%u%n", &walk_cycles, &skip) != 1) {
+            printf("ERROR:  argument 1:  page walk cycles must be a "
+                   "number.\n");
+            usage(progname);
+            exit(1);
+        }
+        p += skip;
+    }
+
+    if (*p != '\0') {
+        printf("ERROR:  argument 1 isn't a correctly formatted TLB.\n");
+        usage(progname);
+        exit(1);
+    }
+
+    if (num_ways == 0 || num_entries == 0 || num_entries % num_ways != 0 ||
+        !is_power_of_2(num_entries / num_ways)) {
+        printf("ERROR:  argument 1:  TLB entries must be a power of 2 "
+               "multiple of the\n        associativity, got %s.\n", spec);
+        usage(progname);
+        exit(1);
+    }
+
+    if (page_size == 0 || !is_power_of_2(page_size)) {
+        printf("ERROR:  argument 1:  page size must be a power of 2, "
+               "got %s.\n", spec);
+        usage(progname);
+        exit(1);
+    }
+
+    printf(" * Building TLB with %u entries in sets of %u, for %u-byte "
+           "pages,\n   with %u-cycle page walks.\n", num_entries, num_ways,
+           page_size, walk_cycles);
+
+    p_tlb = malloc(sizeof(tlb_t));
+    init_tlb(p_tlb, num_entries, num_ways, page_size, walk_cycles, next_mem);
+
+    return (membase_t *) p_tlb;
+}
+
+
+/* Builds the cache described by a specification of the form
+ * B:S:E[:opt...], in front of the specified memory.  arg_no is the number of
+ * the specification's argument, for error messages.
+ */
+cache_t * make_cache(const char *spec, int arg_no, const char *progname,
+                     membase_t *next_mem, unsigned int mem_size) {
+    int block_size, num_sets, lines_per_set;
+    cache_options_t opts;
+    const char *policy_error;
+    cache_t *p_cache;
+    int ct;
+
+    ct = sscanf(spec, "%d:%d:%d",
+                &block_size, &num_sets, &lines_per_set);
+    if (ct != 3) {
+        printf("ERROR:  argument %d isn't correctly formatted.\n", arg_no);
+        usage(progname);
+        exit(1);
+    }
+
+    parse_cache_options(spec, arg_no, progname, &opts);
+    
+    if (block_size <= 0 || !is_power_of_2(block_size)) {
+        printf("ERROR:  argument %d:  block size must be a positive "
+               "power of 2, got %d.\n", arg_no, block_size);
+        usage(progname);
+        exit(1);
+    }
+
+    if (num_sets <= 0 || !is_power_of_2(num_sets)) {
+        printf("ERROR:  argument %d:  number of cache-sets must be a "
+               "positive power of 2, got %d.\n", arg_no, num_sets);
+        usage(progname);
+        exit(1);
+    }
+
+    if (lines_per_set <= 0) {
+        printf("ERROR:  argument %d:  number of cache-lines per set "
+               "must be a positive integer, got %d.\n", arg_no,
+               lines_per_set);
+        usage(progname);
+        exit(1);
+    }
+
+    if (opts.policy != NULL)
+        policy_error = check_replacement_policy(opts.policy, lines_per_set);
+    else
+        policy_error = NULL;
+
+    if (policy_error != NULL) {
+        printf("ERROR:  argument %d:  %s, got %d.\n", arg_no,
+               policy_error, lines_per_set);
+        usage(progname);
+        exit(1);
+    }
+
+    printf(" * Building cache with a block-size of %d bytes, %d cache-sets,\n"
+           "   and %d cache-lines per set.  Total cache size is %d bytes.\n",
+           block_size, num_sets, lines_per_set,
+           block_size * num_sets * lines_per_set);
+    if (opts.policy != NULL)
+        printf("   Lines are replaced using %s.\n", opts.policy->name);
+    if (opts.prefetcher != NULL)
+        printf("   Blocks are prefetched by the %s prefetcher.\n",
+               opts.prefetcher->name);
+    if (opts.write_through || !opts.write_allocate)
+        printf("   Writes are %s and %s.\n",
+               opts.write_through ? "write-through" : "write-back",
+               opts.write_allocate ? "write-allocate" : "write-no-allocate");
+    if (opts.num_wcb_entries > 0)
+        printf("   Writes to the next level are combined in a %u-entry "
+               "buffer.\n", opts.num_wcb_entries);
+
+    p_cache = malloc(sizeof(cache_t));
+    init_cache(p_cache, block_size, num_sets, lines_per_set, next_mem);
+    if (opts.policy != NULL)
+        set_replacement_policy(p_cache, opts.policy);
+    if (opts.prefetcher != NULL)
+        set_prefetcher(p_cache, opts.prefetcher, mem_size);
+    if (opts.write_through || !opts.write_allocate ||
+        opts.num_wcb_entries > 0) {
+        set_write_policy(p_cache, opts.write_through, opts.write_allocate,
+                         opts.num_wcb_entries);
+    }
+    if (opts.classify_misses)
+        enable_miss_classification(p_cache);
+
+    /* A latency of 0 is filled in by make_cached_memory(), which knows the
+     * level of the cache.
+     */
+    p_cache->latency = opts.latency;
+    p_cache->bandwidth = opts.bandwidth;
+
+    return p_cache;
+}
+
+
 /* Initializes a set of caches and a memory, using the cache configuration
  * specified from command-line arguments.
  *
@@ -33,11 +447,16 @@ membase_t * make_cached_memory(int argc, const char **argv,
     const char *progname;
     membase_t **p_mems;
     memory_t *p_memory;
-    cache_t *p_cache;
+    const char *mem_spec = NULL;
     
     progname = argv[0];
     argc--;
     argv++;
+
+    if (argc > 0 && strncmp(argv[argc - 1], "mem:", 4) == 0) {
+        mem_spec = argv[argc - 1];
+        argc--;
+    }
     
     p_mems = malloc((argc + 1) * sizeof(membase_t *));
 
@@ -46,51 +465,124 @@ membase_t * make_cached_memory(int argc, const char **argv,
     printf(" * Building memory of size %u bytes\n", mem_size);
     p_memory = malloc(sizeof(memory_t));
     init_memory(p_memory, mem_size);
+    if (mem_spec != NULL)
+        set_memory_costs(p_memory, mem_spec, argc + 1, progname);
     p_mems[argc] = (membase_t *) p_memory;
+
+    costed_tlb = NULL;
+    costed_caches = malloc((argc + 1) * sizeof(cache_t *));
+    num_costed_caches = 0;
+    costed_memory = p_memory;
     
     for (i = argc - 1; i >= 0; i--) {
-        int block_size, num_sets, lines_per_set;
-        int ct = sscanf(argv[i], "%d:%d:%d",
-                        &block_size, &num_sets, &lines_per_set);
-        if (ct != 3) {
-            printf("ERROR:  argument %d isn't correctly formatted.\n", i + 1);
-            usage(progname);
-            exit(1);
-        }
-        
-        if (block_size <= 0 || !is_power_of_2(block_size)) {
-            printf("ERROR:  argument %d:  block size must be a positive "
-                   "power of 2, got %d.\n", i + 1, block_size);
-            usage(progname);
-            exit(1);
+        if (strncmp(argv[i], "tlb:", 4) == 0) {
+            if (i != 0) {
+                printf("ERROR:  argument %d:  a TLB must be the first "
+                       "argument.\n", i + 1);
+                usage(progname);
+                exit(1);
+            }
+
+            p_mems[i] = make_tlb(argv[i], p_mems[i + 1], progname);
+            costed_tlb = (tlb_t *) p_mems[i];
+            continue;
         }
 
-        if (num_sets <= 0 || !is_power_of_2(num_sets)) {
-            printf("ERROR:  argument %d:  number of cache-sets must be a "
-                   "positive power of 2, got %d.\n", i + 1, num_sets);
-            usage(progname);
-            exit(1);
+        if (strncmp(argv[i], "sweep:", 6) == 0) {
+            if (i != 0 && !(i == 1 && strncmp(argv[0], "tlb:", 4) == 0)) {
+                printf("ERROR:  argument %d:  a sweep must be the first "
+                       "argument, or follow a TLB.\n", i + 1);
+                usage(progname);
+                exit(1);
+            }
+
+            p_mems[i] = make_sweep(argv[i], p_mems[i + 1], progname);
+            continue;
         }
 
-        if (lines_per_set <= 0) {
-            printf("ERROR:  argument %d:  number of cache-lines per set "
-                   "must be a positive integer, got %d.\n", i + 1,
-                   lines_per_set);
+        if (strncmp(argv[i], "mem:", 4) == 0) {
+            printf("ERROR:  argument %d:  a memory specification must be "
+                   "the last argument.\n", i + 1);
             usage(progname);
             exit(1);
         }
 
-        printf(" * Building cache with a block-size of %d bytes, %d cache-sets,\n"
-               "   and %d cache-lines per set.  Total cache size is %d bytes.\n",
-               block_size, num_sets, lines_per_set,
-               block_size * num_sets * lines_per_set);
+        p_mems[i] = (membase_t *) make_cache(argv[i], i + 1, progname,
+                                             p_mems[i + 1], mem_size);
+        costed_caches[num_costed_caches++] = (cache_t *) p_mems[i];
+    }
+    printf("\n");
 
-        p_cache = malloc(sizeof(cache_t));
-        init_cache(p_cache, block_size, num_sets, lines_per_set, p_mems[i + 1]);
+    /* The caches were built from the last level up; put them in order from
+     * the first level, and give each one without a configured latency the
+     * default for its level.
+     */
+    for (i = 0; i < num_costed_caches / 2; i++) {
+        cache_t *p_cache = costed_caches[i];
+        costed_caches[i] = costed_caches[num_costed_caches - 1 - i];
+        costed_caches[num_costed_caches - 1 - i] = p_cache;
+    }
 
-        p_mems[i] = (membase_t *) p_cache;
+    for (i = 0; i < num_costed_caches; i++) {
+        if (costed_caches[i]->latency == 0) {
+            costed_caches[i]->latency = level_latencies[
+                i < NUM_LEVEL_LATENCIES ? i : NUM_LEVEL_LATENCIES - 1];
+        }
     }
-    printf("\n");
     
     return p_mems[0];
 }
+
+
+/* Prints the estimated time taken by the accesses to the memory built by
+ * the last call to make_cached_memory().  Every level is charged its
+ * latency for each access made to it, and the bytes it moves divided by its
+ * bandwidth; each TLB miss is charged a page walk.  The levels aren't
+ * assumed to overlap, so this is the cost of doing all of the work one step
+ * at a time, which is useful for comparing configurations rather than as a
+ * prediction of the running time.  The average memory access time is the
+ * total divided by the accesses made to the first level.
+ */
+void print_memory_costs(void) {
+    unsigned long long level_cycles, total_cycles = 0, references = 0;
+    unsigned long long bytes;
+    int i;
+
+    printf("Estimated Time (cycles):\n\n");
+
+    if (costed_tlb != NULL) {
+        level_cycles = tlb_walk_cycles(costed_tlb);
+        printf(" * TLB:  %lld misses x %u = %lld\n",
+               costed_tlb->num_misses, costed_tlb->walk_cycles, level_cycles);
+        total_cycles += level_cycles;
+    }
+
+    for (i = 0; i < num_costed_caches; i++) {
+        cache_t *p_cache = costed_caches[i];
+
+        bytes = p_cache->num_reads + p_cache->num_writes;
+        level_cycles = p_cache->num_lookups * p_cache->latency +
+                       bytes / p_cache->bandwidth;
+        printf(" * Cache %d:  %lld lookups x %u + %lld bytes / %u = %lld\n",
+               i + 1, p_cache->num_lookups, p_cache->latency, bytes,
+               p_cache->bandwidth, level_cycles);
+        total_cycles += level_cycles;
+
+        if (i == 0)
+            references = p_cache->num_lookups;
+    }
+
+    bytes = costed_memory->num_reads + costed_memory->num_writes;
+    level_cycles = costed_memory->num_accesses * costed_memory->latency +
+                   bytes / costed_memory->bandwidth;
+    printf(" * Memory:  %lld accesses x %u + %lld bytes / %u = %lld\n",
+           costed_memory->num_accesses, costed_memory->latency, bytes,
+           costed_memory->bandwidth, level_cycles);
+    total_cycles += level_cycles;
+
+    if (num_costed_caches == 0)
+        references = costed_memory->num_accesses;
+
+    printf(" * Total=%lld AMAT=%.2f cycles per access\n", total_cycles,
+           references > 0 ? (double) total_cycles / references : 0.0);
+}
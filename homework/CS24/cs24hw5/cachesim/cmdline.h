@@ -1,5 +1,13 @@
 #include "membase.h"
 
 void usage(const char *progname);
+membase_t * make_sweep(const char *spec, membase_t *next_mem,
+                       const char *progname);
+membase_t * make_tlb(const char *spec, membase_t *next_mem,
+                     const char *progname);
+struct cache_t * make_cache(const char *spec, int arg_no,
+                            const char *progname, membase_t *next_mem,
+                            unsigned int mem_size);
 membase_t * make_cached_memory(int argc, const char **argv,
                                unsigned int mem_size);
+void print_memory_costs(void);
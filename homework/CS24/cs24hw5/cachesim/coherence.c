@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "cache.h"
+#include "coherence.h"
+
+
+/* Initializes a coherence bus for the specified number of cores, each with
+ * levels_per_core private caches.  The caches are added with attach_core().
+ */
+void init_coherence_bus(coherence_bus_t *p_bus, unsigned int num_cores,
+                        unsigned int levels_per_core) {
+    assert(p_bus != NULL);
+    assert(num_cores > 0 && levels_per_core > 0);
+
+    bzero(p_bus, sizeof(coherence_bus_t));
+
+    p_bus->num_cores = num_cores;
+    p_bus->levels_per_core = levels_per_core;
+    p_bus->caches = calloc(num_cores * levels_per_core, sizeof(cache_t *));
+    if (p_bus->caches == NULL) {
+        printf("ERROR:  unable to allocate memory for the coherence bus.\n");
+        exit(1);
+    }
+}
+
+
+/* Attaches the private caches of a core to the bus, first level first.
+ * The first level must allocate on writes, since a write that bypassed it
+ * wouldn't be seen by the bus.
+ */
+void attach_core(coherence_bus_t *p_bus, unsigned int core,
+                 cache_t **private_caches) {
+    unsigned int level;
+
+    assert(core < p_bus->num_cores);
+    assert(private_caches[0]->write_allocate);
+
+    for (level = 0; level < p_bus->levels_per_core; level++) {
+        p_bus->caches[core * p_bus->levels_per_core + level] =
+            private_caches[level];
+    }
+
+    private_caches[0]->bus = p_bus;
+    private_caches[0]->core = core;
+}
+
+
+/* Called by a core's first level before it loads the block holding the
+ * specified address.  Every other core that holds the block writes back any
+ * modified copy and keeps it shared.  Returns 1 if any other core held the
+ * block, or 0 if this core can have it exclusively.
+ */
+int bus_read(coherence_bus_t *p_bus, unsigned int core, addr_t address) {
+    unsigned long long touched;
+    unsigned int other, level;
+    int shared = 0, result;
+
+    p_bus->num_bus_reads++;
+
+    for (other = 0; other < p_bus->num_cores; other++) {
+        if (other == core)
+            continue;
+
+        for (level = 0; level < p_bus->levels_per_core; level++) {
+            result = snoop_cache(
+                p_bus->caches[other * p_bus->levels_per_core + level],
+                address, 0, &touched);
+
+            if (result & SNOOP_FOUND)
+                shared = 1;
+            if (result & SNOOP_WROTE_BACK)
+                p_bus->num_snoop_write_backs++;
+        }
+    }
+
+    return shared;
+}
+
+
+/* Called by a core's first level before it writes to a shared line.  Every
+ * other core's copies of the block are invalidated.  written is the touch
+ * mask of the bytes being written; if another core's first level holds the
+ * block but hasn't touched any of those bytes, the invalidation is counted
+ * as false sharing.
+ */
+void bus_upgrade(coherence_bus_t *p_bus, unsigned int core, addr_t address,
+                 unsigned long long written) {
+    unsigned long long touched;
+    unsigned int other, level;
+    int result, found, false_sharing;
+
+    p_bus->num_upgrades++;
+
+    for (other = 0; other < p_bus->num_cores; other++) {
+        if (other == core)
+            continue;
+
+        found = 0;
+        false_sharing = 0;
+        for (level = 0; level < p_bus->levels_per_core; level++) {
+            result = snoop_cache(
+                p_bus->caches[other * p_bus->levels_per_core + level],
+                address, 1, &touched);
+
+            if (result & SNOOP_WROTE_BACK)
+                p_bus->num_snoop_write_backs++;
+
+            /* Only the first level sees the core's own accesses; lower
+             * levels just see whole blocks being loaded.
+             */
+            if ((result & SNOOP_FOUND) && !found) {
+                found = 1;
+                false_sharing = (level == 0 && (touched & written) == 0);
+            }
+        }
+
+        if (found) {
+            p_bus->num_invalidations++;
+            if (false_sharing)
+                p_bus->num_false_sharing++;
+        }
+    }
+}
+
+
+/* Prints the bus's coherence statistics. */
+void print_bus_stats(coherence_bus_t *p_bus) {
+    printf(" * Bus reads=%lld upgrades=%lld invalidations=%lld "
+           "false-sharing=%lld\n", p_bus->num_bus_reads, p_bus->num_upgrades,
+           p_bus->num_invalidations, p_bus->num_false_sharing);
+    printf("   snoop write-backs=%lld\n", p_bus->num_snoop_write_backs);
+}
+
+
+/* Resets the bus's coherence statistics. */
+void reset_bus_stats(coherence_bus_t *p_bus) {
+    p_bus->num_bus_reads = 0;
+    p_bus->num_upgrades = 0;
+    p_bus->num_invalidations = 0;
+    p_bus->num_false_sharing = 0;
+    p_bus->num_snoop_write_backs = 0;
+}
+
+
+/* Releases the memory used by the bus.  The caches are not freed. */
+void free_coherence_bus(coherence_bus_t *p_bus) {
+    free(p_bus->caches);
+}
@@ -0,0 +1,64 @@
+#ifndef COHERENCE_H
+#define COHERENCE_H
+
+
+#include "membase.h"
+
+
+struct cache_t;
+
+
+/* This struct holds the state of a snooping bus that keeps the private
+ * caches of several cores coherent with the MESI protocol.  Each core has
+ * the same number of private levels, which all lead to the same shared
+ * level below them.  Only a core's first level talks to the bus:  it asks
+ * the other cores to give up a block before loading it, and to invalidate
+ * their copies before it writes to a shared line.  Every private level of
+ * the other cores is snooped, from the first level down, so that modified
+ * data is written back level by level until it reaches the shared level.
+ */
+typedef struct coherence_bus_t {
+    unsigned int num_cores;
+    unsigned int levels_per_core;
+
+    /* The private caches, levels_per_core for each core, with each core's
+     * first level first.
+     */
+    struct cache_t **caches;
+
+    /* The number of bus reads (a core loading a block), upgrades (a core
+     * writing to a shared line), and the copies of blocks that upgrades
+     * invalidated in other cores.
+     */
+    unsigned long long num_bus_reads;
+    unsigned long long num_upgrades;
+    unsigned long long num_invalidations;
+
+    /* The invalidations where the other core had not touched any part of
+     * the block that the writer wrote; the two cores were only sharing the
+     * block, not the data.
+     */
+    unsigned long long num_false_sharing;
+
+    /* The number of times a snoop found a modified copy, which had to be
+     * written back so that another core could see it.
+     */
+    unsigned long long num_snoop_write_backs;
+} coherence_bus_t;
+
+
+void init_coherence_bus(coherence_bus_t *p_bus, unsigned int num_cores,
+                        unsigned int levels_per_core);
+void attach_core(coherence_bus_t *p_bus, unsigned int core,
+                 struct cache_t **private_caches);
+
+int bus_read(coherence_bus_t *p_bus, unsigned int core, addr_t address);
+void bus_upgrade(coherence_bus_t *p_bus, unsigned int core, addr_t address,
+                 unsigned long long written);
+
+void print_bus_stats(coherence_bus_t *p_bus);
+void reset_bus_stats(coherence_bus_t *p_bus);
+void free_coherence_bus(coherence_bus_t *p_bus);
+
+
+#endif /* COHERENCE_H */
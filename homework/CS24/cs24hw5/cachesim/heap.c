@@ -8,33 +8,96 @@
  * heap data structure, but are not visible outside this module.
  */
 
+void set_layout(float_heap *p_heap, int arity, int page_values);
+int value_slot(float_heap *p_heap, int index);
+float read_value(float_heap *p_heap, int index);
+void write_value(float_heap *p_heap, int index, float value);
 void sift_down(float_heap *p_heap, int index);
 void sift_up(float_heap *p_heap, int index);
 void swap_values(float_heap *p_heap, int i, int j);
 
 /*
- * For heaps stored in an array, left child and right child of a particular
- * index are calculated using these functions.  The "index" value is
- * supposed to be an integer.
+ * For heaps stored in an array, the first child of a particular index is
+ * calculated using this function; the other children follow it.  The
+ * "index" and "arity" values are supposed to be integers.
  */
-#define  LEFT_CHILD(index) (2 * (index) + 1)
-#define RIGHT_CHILD(index) (2 * (index) + 2)
+#define FIRST_CHILD(index, arity) ((arity) * (index) + 1)
 
 /* Given an index, the parent index is computed as follows.
- * The "index" value is supposed to be an integer.
+ * The "index" and "arity" values are supposed to be integers.
  */
-#define PARENT(index) (((index) - 1) / 2)
+#define PARENT(index, arity) (((index) - 1) / (arity))
 
 
-/* Initialize a heap data structure. */
+/* Initialize a binary heap data structure, stored in breadth-first order. */
 void init_heap(float_heap *p_heap, membase_t *memory, int max_values) {
+    init_dary_heap(p_heap, memory, max_values, 2);
+}
+
+
+/* Initialize a heap whose nodes each have arity children. */
+void init_dary_heap(float_heap *p_heap, membase_t *memory, int max_values,
+                    int arity) {
     assert(p_heap != NULL);
     assert(memory != NULL);
+    assert(arity >= 2);
 
     p_heap->memory = memory;
 
     p_heap->num_values = 0;
     p_heap->max_values = max_values;
+
+    set_layout(p_heap, arity, 0);
+}
+
+
+/* Initialize a binary B-heap, whose nodes are clustered into pages. */
+void init_bheap(float_heap *p_heap, membase_t *memory, int max_values,
+                int page_values) {
+    assert(p_heap != NULL);
+    assert(memory != NULL);
+    assert(page_values >= 4 && (page_values & (page_values - 1)) == 0);
+
+    p_heap->memory = memory;
+
+    p_heap->num_values = 0;
+    p_heap->max_values = max_values;
+
+    set_layout(p_heap, 2, page_values);
+}
+
+
+/* Returns the number of bytes of memory that a heap with the specified
+ * layout needs to hold max_values values.
+ */
+unsigned int heap_memory_size(int max_values, int arity, int page_values) {
+    float_heap layout;
+    int last_slot;
+
+    assert(max_values > 0);
+
+    set_layout(&layout, arity, page_values);
+
+    /* The last node has the highest slot in the breadth-first layout.  In a
+     * B-heap the highest-numbered page holds either the last node or the
+     * last node of the level above, which may be further to the right, and
+     * other slots of that page may be higher.
+     */
+    last_slot = value_slot(&layout, max_values - 1);
+    if (layout.page_levels != 0) {
+        unsigned int level_end = 1;
+
+        while (level_end * 2 <= (unsigned int) max_values)
+            level_end *= 2;
+
+        if (level_end > 1 &&
+            value_slot(&layout, level_end - 2) > last_slot) {
+            last_slot = value_slot(&layout, level_end - 2);
+        }
+        last_slot |= layout.page_values - 1;
+    }
+
+    return (unsigned int) (last_slot + 1) * sizeof(float);
 }
 
 
@@ -48,7 +111,7 @@ float get_first_value(float_heap *p_heap) {
     assert(p_heap->num_values > 0);
 
     /* Smallest value is at the root - index 0. */
-    result = read_float(p_heap->memory, 0);
+    result = read_value(p_heap, 0);
 
     /* Decrease the count of how many values are in the heap.  NOTE that if
      * there was more than one value in the heap, the last value is still at
@@ -59,8 +122,8 @@ float get_first_value(float_heap *p_heap) {
     p_heap->num_values--;
     if (p_heap->num_values != 0) {
         /* Move the last value in the heap to the root. */
-        float f = read_float(p_heap->memory, p_heap->num_values);
-        write_float(p_heap->memory, 0, f);
+        float f = read_value(p_heap, p_heap->num_values);
+        write_value(p_heap, 0, f);
 
         /* Sift down the new value to position it properly in the heap. */
         sift_down(p_heap, 0);
@@ -83,7 +146,7 @@ void add_value(float_heap *p_heap, float newval) {
     /* Add the new value to the end of the heap, then sift up. */
 
     index = p_heap->num_values;
-    write_float(p_heap->memory, index, newval);
+    write_value(p_heap, index, newval);
     p_heap->num_values++;
 
     /* If the new value isn't at the root, sift up. */
@@ -97,75 +160,127 @@ void add_value(float_heap *p_heap, float newval) {
 /*==================*/
 
 
+/* Sets up the layout members of a heap. */
+void set_layout(float_heap *p_heap, int arity, int page_values) {
+    p_heap->arity = arity;
+    p_heap->offset = (arity > 2) ? arity - 1 : 0;
+
+    p_heap->page_levels = 0;
+    p_heap->page_values = page_values;
+    while (page_values > 1) {
+        p_heap->page_levels++;
+        page_values /= 2;
+    }
+}
+
+
+/*
+ * Returns the slot in memory that holds the node at the specified index.
+ * In a B-heap, a node at depth d is on a page at level d / page_levels of
+ * the tree of pages, at local depth d % page_levels within its page.  The
+ * page is identified by the node's ancestor at the top of the page, and
+ * the pages of each level are numbered in order after those of the levels
+ * above.  Within the page the nodes are in breadth-first order from slot 1.
+ */
+int value_slot(float_heap *p_heap, int index) {
+    unsigned int node, depth, level, local_depth, top, level_first;
+    unsigned int pages_above, page, local;
+
+    if (p_heap->page_levels == 0)
+        return index + p_heap->offset;
+
+    /* Number the nodes from 1, so that node n's children are 2n and 2n+1. */
+    node = (unsigned int) index + 1;
+    for (depth = 0; (node >> depth) > 1; depth++);
+
+    level = depth / p_heap->page_levels;
+    local_depth = depth % p_heap->page_levels;
+
+    top = node >> local_depth;
+    level_first = 1U << (level * p_heap->page_levels);
+
+    /* There are 1, P', P'^2, ... pages on the levels above, where P' is the
+     * number of pages below each page, 2^page_levels.
+     */
+    pages_above = (level_first - 1) / ((1U << p_heap->page_levels) - 1);
+    page = pages_above + (top - level_first);
+
+    local = (1U << local_depth) | (node & ((1U << local_depth) - 1));
+
+    return (int) (page * p_heap->page_values + local);
+}
+
+
+/* Reads the value of the node at the specified index. */
+float read_value(float_heap *p_heap, int index) {
+    return read_float(p_heap->memory, value_slot(p_heap, index));
+}
+
+
+/* Writes the value of the node at the specified index. */
+void write_value(float_heap *p_heap, int index, float value) {
+    write_float(p_heap->memory, value_slot(p_heap, index), value);
+}
+
+
 /*
  * Given a heap and an index, sift_down checks to see if the value at that
  * index needs to be "sifted downward" in the heap, to preserve the heap
  * properties.  Specifically, a value needs to be moved down in the heap if
- * it is greater than either of its children's values.  (This is the "order"
+ * it is greater than any of its children's values.  (This is the "order"
  * property.)  In order to preserve the "shape" property of heaps, the value
- * is swapped with the *smaller* of its two child values.
+ * is swapped with the *smallest* of its child values.
  *
- * If a value only has a left child, then only the left child is examined
- * for the swap.
+ * If a value has fewer than arity children, only those children are
+ * examined for the swap, and they are all at the bottom of the heap.
  *
- * If a value has both left and right children, it is possible that one
- * child may be larger than the value, while the other is smaller than the
- * value.  Since we swap with the smallest child value, we preserve the
- * heap properties even in that situation.
+ * It is possible that some children may be larger than the value, while
+ * others are smaller than the value.  Since we swap with the smallest child
+ * value, we preserve the heap properties even in that situation.
  */
 void sift_down(float_heap *p_heap, int index) {
     assert(p_heap != NULL);
     assert(index < p_heap->num_values);
 
-    int left_child = LEFT_CHILD(index);
-    int right_child = RIGHT_CHILD(index);
-    float index_val = read_float(p_heap->memory, index);
+    int first_child = FIRST_CHILD(index, p_heap->arity);
+    int end_child = first_child + p_heap->arity;
+    float index_val = read_value(p_heap, index);
+    float swap_val;
+    int child, swap_child;
 
-    if (left_child >= p_heap->num_values) {
-        /* If the left child's index is past the end of the heap
+    if (first_child >= p_heap->num_values) {
+        /* If the first child's index is past the end of the heap
          * then this value has no children.  We're done.
          */
         return;
     }
 
-    if (right_child >= p_heap->num_values) {
-        /* Only have a left child. */
-
-        if (read_float(p_heap->memory, left_child) < index_val) {
-            /* Left child value is smaller.  Swap this value and the
-             * left child value.
-             */
-            swap_values(p_heap, index, left_child);
-
-            /* Don't need to call sift_down again, because if this
-             * node only has a left child, we are at the bottom of
-             * the heap.
-             */
+    if (end_child > p_heap->num_values)
+        end_child = p_heap->num_values;
+
+    /* Find the smallest child.  On a tie the later child is chosen. */
+    swap_child = first_child;
+    swap_val = read_value(p_heap, first_child);
+    for (child = first_child + 1; child < end_child; child++) {
+        float child_val = read_value(p_heap, child);
+        if (child_val <= swap_val) {
+            swap_child = child;
+            swap_val = child_val;
         }
     }
-    else {
-        /* This value has a left and right child. */
-
-        float left_val = read_float(p_heap->memory, left_child);
-        float right_val = read_float(p_heap->memory, right_child);
-        int swap_child;
-
-        if (left_val < index_val || right_val < index_val) {
-            /* Need to swap this node with one of its children.  Pick
-             * the smaller of the two children, since this is a min-heap
-             * and that will preserve the heap properties.
-             */
-            if (left_val < right_val)
-                swap_child = left_child;
-            else
-                swap_child = right_child;
-
-            /* Do the swap, then call sift_down again, in case we aren't
-             * at the bottom of the heap yet.
-             */
-            swap_values(p_heap, index, swap_child);
+
+    if (swap_val < index_val) {
+        /* Need to swap this node with its smallest child, since this is a
+         * min-heap and that will preserve the heap properties.
+         */
+        swap_values(p_heap, index, swap_child);
+
+        /* If this node had all of its children, call sift_down again, in
+         * case we aren't at the bottom of the heap yet.  Otherwise the
+         * children are all leaves.
+         */
+        if (end_child == first_child + p_heap->arity)
             sift_down(p_heap, swap_child);
-        }
     }
 }
 
@@ -178,7 +293,7 @@ void sift_down(float_heap *p_heap, int index) {
  * is not affected by sifting a value up.)
  */
 void sift_up(float_heap *p_heap, int index) {
-    int parent_index = PARENT(index);
+    int parent_index = PARENT(index, p_heap->arity);
 
     /* If the index to sift up is the root, we are done. */
     if (index == 0)
@@ -190,8 +305,7 @@ void sift_up(float_heap *p_heap, int index) {
     /* If the specified value is smaller than its parent value then
      * we have to swap the value and its parent.
      */
-    if (read_float(p_heap->memory, index) <
-        read_float(p_heap->memory, parent_index)) {
+    if (read_value(p_heap, index) < read_value(p_heap, parent_index)) {
         /* Swap the value with its parent value. */
         swap_values(p_heap, index, parent_index);
 
@@ -214,9 +328,9 @@ void swap_values(float_heap *p_heap, int i, int j) {
     assert(j >= 0 && j < p_heap->num_values);
     assert(i != j);
 
-    i_val = read_float(p_heap->memory, i);
-    j_val = read_float(p_heap->memory, j);
+    i_val = read_value(p_heap, i);
+    j_val = read_value(p_heap, j);
 
-    write_float(p_heap->memory, i, j_val);
-    write_float(p_heap->memory, j, i_val);
+    write_value(p_heap, i, j_val);
+    write_value(p_heap, j, i_val);
 }
@@ -5,7 +5,12 @@
 #include "membase.h"
 
 
-/* A simple heap data structure, for storing floats. */
+/* A simple heap data structure, for storing floats.  Each node has arity
+ * children.  The nodes are numbered in breadth-first order, and are either
+ * stored in that order, or, for a B-heap, clustered into pages so that the
+ * nodes along a path from the root to a leaf share as few cache lines as
+ * possible.
+ */
 typedef struct {
     /* Number of values currently in the heap. */
     int num_values;
@@ -13,14 +18,51 @@ typedef struct {
     /* The maximum number of values to be stored in the heap. */
     int max_values;
 
+    /* The number of children of each node. */
+    int arity;
+
+    /* For the breadth-first layout, the number of unused slots before the
+     * root.  d-ary heaps put d - 1 there, so that the children of each node
+     * start on a multiple of d slots and share a cache line.
+     */
+    int offset;
+
+    /* For a B-heap, each page of page_values slots holds a subtree
+     * page_levels deep, and its first slot is unused.  Zero page_levels
+     * means the breadth-first layout.
+     */
+    int page_levels;
+    int page_values;
+
     /* The values in the heap. */
     membase_t *memory;
 } float_heap;
 
 
-/* Initialize a heap data structure. */
+/* Initialize a binary heap data structure, stored in breadth-first order. */
 void init_heap(float_heap *p_heap, membase_t *memory, int max_values);
 
+/* Initialize a heap whose nodes each have arity children.  An arity of 4 or
+ * 8 halves or thirds the height of the heap, and sift_down() finds all of a
+ * node's children in a single cache line.
+ */
+void init_dary_heap(float_heap *p_heap, membase_t *memory, int max_values,
+                    int arity);
+
+/* Initialize a binary B-heap, whose nodes are clustered into pages of
+ * page_values slots, a power of 2.  A path from the root to a leaf then
+ * crosses a page boundary only every log2(page_values) levels.
+ */
+void init_bheap(float_heap *p_heap, membase_t *memory, int max_values,
+                int page_values);
+
+/* Returns the number of bytes of memory that a heap with the specified
+ * layout needs to hold max_values values.  The arity and page_values are
+ * as for init_dary_heap() and init_bheap(); a page_values of 0 means the
+ * breadth-first d-ary layout.
+ */
+unsigned int heap_memory_size(int max_values, int arity, int page_values);
+
 /* Returns the first (i.e. smallest) value in the heap. */
 float get_first_value(float_heap *p_heap);
 
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include "cmdline.h"
@@ -10,6 +11,11 @@
 
 #define NUM_ELEMS 1000000
 
+/* The simulated memory is rounded up to a multiple of this many bytes, so
+ * that a cache block never runs past the end of it.
+ */
+#define MEM_ROUNDING 65536
+
 
 /* Set to time(NULL) to generate new random data each time, or a constant to
  * generate the same random data each time.
@@ -17,6 +23,24 @@
 #define SEED 54321098
 
 
+/* Prints the program usage. */
+void heaptest_usage(const char *progname) {
+    printf("usage: %s [-d arity | -b page-values] [cache-spec ...]\n\n",
+           progname);
+    printf("\tHeap-sorts random floats through the simulated memory.\n\n");
+    printf("\t-d arity        use a d-ary heap with arity children per node "
+           "(default 2)\n");
+    printf("\t-b page-values  use a binary B-heap with pages of page-values "
+           "floats,\n");
+    printf("\t                a power of 2 of at least 4\n\n");
+    printf("\tCache specifications are in the form B:S:E, as for the other "
+           "test\n");
+    printf("\tprograms:  B = block size, S = number of cache-sets, and "
+           "E = number\n");
+    printf("\tof cache-lines per set.\n");
+}
+
+
 /* This function is used by the C standard-library function qsort(), so that
  * we can check the output of our heap-sort algorithm.
  */
@@ -34,17 +58,61 @@ int compare_float_ptrs(const void *v1, const void *v2) {
 
 
 int main(int argc, const char **argv) {
+    const char *progname = argv[0], **spec_argv;
+    int arity = 2, page_values = 0, num_specs;
+    unsigned int mem_size;
     float *inputs;
     int i, error;
 
-    memory_t memory;
-    cache_t cache;
     membase_t *p_mem;
 
     float_heap heap;
 
+    /* Parse the options that come before the cache specifications. */
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            arity = atoi(argv[++i]);
+            if (arity < 2) {
+                printf("ERROR:  heap arity must be at least 2, got %s.\n",
+                       argv[i]);
+                heaptest_usage(progname);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            page_values = atoi(argv[++i]);
+            if (page_values < 4 || (page_values & (page_values - 1)) != 0) {
+                printf("ERROR:  B-heap page size must be a power of 2 of at "
+                       "least 4, got %s.\n", argv[i]);
+                heaptest_usage(progname);
+                exit(1);
+            }
+        }
+        else {
+            heaptest_usage(progname);
+            exit(1);
+        }
+    }
+
+    if (arity != 2 && page_values != 0) {
+        printf("ERROR:  a B-heap must be binary.\n");
+        heaptest_usage(progname);
+        exit(1);
+    }
+
+    /* make_cached_memory() expects the program name before the cache
+     * specifications.
+     */
+    num_specs = argc - i;
+    spec_argv = malloc((num_specs + 1) * sizeof(const char *));
+    spec_argv[0] = progname;
+    memcpy(spec_argv + 1, argv + i, num_specs * sizeof(const char *));
+
     /* Set up the simulated memory. */
-    p_mem = make_cached_memory(argc, argv, NUM_ELEMS * sizeof(int));
+    mem_size = heap_memory_size(NUM_ELEMS, arity, page_values);
+    mem_size = (mem_size + MEM_ROUNDING - 1) & ~(MEM_ROUNDING - 1);
+    p_mem = make_cached_memory(num_specs + 1, spec_argv, mem_size);
+    free(spec_argv);
 
     /* Generate random floats to sort. */
 
@@ -60,7 +128,17 @@ int main(int argc, const char **argv) {
 
     printf("Sorting numbers using the heap.\n");
 
-    init_heap(&heap, p_mem, NUM_ELEMS);
+    if (page_values != 0) {
+        printf(" * Using a B-heap with pages of %d values.\n", page_values);
+        init_bheap(&heap, p_mem, NUM_ELEMS, page_values);
+    }
+    else if (arity != 2) {
+        printf(" * Using a %d-ary heap.\n", arity);
+        init_dary_heap(&heap, p_mem, NUM_ELEMS, arity);
+    }
+    else {
+        init_heap(&heap, p_mem, NUM_ELEMS);
+    }
     for (i = 0; i < NUM_ELEMS; i++)
         add_value(&heap, inputs[i]);
 
@@ -90,6 +168,8 @@ int main(int argc, const char **argv) {
     printf("\nMemory-Access Statistics:\n\n");
     p_mem->print_stats(p_mem);
     printf("\n");
+    print_memory_costs();
+    printf("\n");
 
     return 0;
 }
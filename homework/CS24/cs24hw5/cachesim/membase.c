@@ -37,6 +37,24 @@ void write_byte(membase_t *mb, addr_t address, unsigned char value) {
 }
 
 
+/* Reads size consecutive bytes, starting at a specific memory address in the
+ * simulated memory, into buf.
+ */
+void read_block(membase_t *mb, addr_t address, unsigned char *buf,
+                unsigned int size) {
+    mb->read_block(mb, address, buf, size);
+}
+
+
+/* Writes size consecutive bytes from buf to the simulated memory, starting
+ * at a specific memory address.
+ */
+void write_block(membase_t *mb, addr_t address, const unsigned char *buf,
+                 unsigned int size) {
+    mb->write_block(mb, address, buf, size);
+}
+
+
 /* This struct is used by read_float and write_float so that it can use the
  * read_int and write_int implementations.
  */
@@ -51,11 +69,13 @@ typedef union {
  * is stored in little-endian format, as IA32 normally does.
  */
 int read_int(membase_t *mb, unsigned int index) {
-    addr_t addr = index * 4;
-    return read_byte(mb, addr) |
-           read_byte(mb, addr + 1) <<  8 |
-           read_byte(mb, addr + 2) << 16 |
-           read_byte(mb, addr + 3) << 24;
+    unsigned char bytes[4];
+
+    read_block(mb, index * 4, bytes, 4);
+    return bytes[0] |
+           bytes[1] <<  8 |
+           bytes[2] << 16 |
+           bytes[3] << 24;
 }
 
 
@@ -64,11 +84,13 @@ int read_int(membase_t *mb, unsigned int index) {
  * is stored in little-endian format, as IA32 normally does.
  */
 void write_int(membase_t *mb, unsigned int index, int value) {
-    addr_t addr = index * 4;
-    write_byte(mb, addr, value & 0xFF);
-    write_byte(mb, addr + 1, (value >>  8) & 0xFF);
-    write_byte(mb, addr + 2, (value >> 16) & 0xFF);
-    write_byte(mb, addr + 3, (value >> 24) & 0xFF);
+    unsigned char bytes[4];
+
+    bytes[0] = value & 0xFF;
+    bytes[1] = (value >>  8) & 0xFF;
+    bytes[2] = (value >> 16) & 0xFF;
+    bytes[3] = (value >> 24) & 0xFF;
+    write_block(mb, index * 4, bytes, 4);
 }
 
 
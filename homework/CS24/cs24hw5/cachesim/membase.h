@@ -27,6 +27,15 @@ typedef struct membase_t {
     /* The function to write a byte to the memory. */
     void (*write_byte)(struct membase_t *mb, addr_t address, unsigned char value);
 
+    /* The functions to read and write size consecutive bytes at once.  One
+     * call covers a whole int, or a whole cache line, so that each level
+     * looks up the address once rather than once per byte.
+     */
+    void (*read_block)(struct membase_t *mb, addr_t address,
+                       unsigned char *buf, unsigned int size);
+    void (*write_block)(struct membase_t *mb, addr_t address,
+                        const unsigned char *buf, unsigned int size);
+
     /* The function to print the memory's access statistics. */
     void (*print_stats)(struct membase_t *mb);
 
@@ -53,6 +62,11 @@ unsigned int log_2(unsigned int n);
 unsigned char read_byte(membase_t *mb, addr_t address);
 void write_byte(membase_t *mb, addr_t address, unsigned char value);
 
+void read_block(membase_t *mb, addr_t address, unsigned char *buf,
+                unsigned int size);
+void write_block(membase_t *mb, addr_t address, const unsigned char *buf,
+                 unsigned int size);
+
 
 /*
  * These functions expose the memory as an array of signed integers or floats,
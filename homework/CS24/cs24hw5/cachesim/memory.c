@@ -14,35 +14,67 @@
 
 unsigned char memory_read_byte(membase_t *mb, addr_t address);
 void memory_write_byte(membase_t *mb, addr_t address, unsigned char value);
+void memory_read_block(membase_t *mb, addr_t address, unsigned char *buf,
+                       unsigned int size);
+void memory_write_block(membase_t *mb, addr_t address,
+                        const unsigned char *buf, unsigned int size);
 void memory_print_stats(membase_t *mb);
 void memory_reset_stats(membase_t *mb);
 void memory_free(membase_t *mb);
 
+static unsigned char * find_page(memory_t *p_memory, addr_t address);
+static unsigned char * touch_page(memory_t *p_memory, addr_t address);
+
 
 /* Initializes the members of the memory_t struct to be a memory of the
- * specified number of bytes.  This requires a heap allocation, so the
- * allocated memory must be released when cleaning up the memory.
+ * specified number of bytes.  Only the table of pages is allocated here;
+ * each page is allocated the first time it is written.  The allocated
+ * memory must be released when cleaning up the memory.
  */
-void init_memory(memory_t *p_memory, int mem_size) {
+void init_memory(memory_t *p_memory, unsigned int mem_size) {
     bzero(p_memory, sizeof(memory_t));
 
-    /* Allocate the memory, and clear its contents to 0. */
+    /* Allocate the table of pages, with no pages allocated yet. */
     p_memory->mem_size = mem_size;
-    p_memory->mem = malloc(mem_size);
-    bzero(p_memory->mem, mem_size);
+    p_memory->num_pages =
+        (unsigned int) (((unsigned long long) mem_size +
+                         MEMORY_PAGE_SIZE - 1) >> MEMORY_PAGE_BITS);
+    p_memory->pages = calloc(p_memory->num_pages, sizeof(unsigned char *));
+    if (p_memory->pages == NULL) {
+        printf("ERROR:  unable to allocate memory for the page table.\n");
+        exit(1);
+    }
+
+    p_memory->latency = DEFAULT_MEMORY_LATENCY;
+    p_memory->bandwidth = DEFAULT_MEMORY_BANDWIDTH;
 
     /* Set up the pointers for interacting with the memory. */
     p_memory->read_byte = memory_read_byte;
     p_memory->write_byte = memory_write_byte;
+    p_memory->read_block = memory_read_block;
+    p_memory->write_block = memory_write_block;
     p_memory->print_stats = memory_print_stats;
     p_memory->reset_stats = memory_reset_stats;
     p_memory->free = memory_free;
 }
 
 
-/* This function implements reads against the memory.  It is a very
- * straightforward implementation; it simply increments the appropriate
- * statistic and then returns the value at the specified address.
+/* Returns the byte at the specified address, without counting it as a read.
+ * This is for checking the memory's contents in tests.
+ */
+unsigned char peek_memory(memory_t *p_memory, addr_t address) {
+    unsigned char *page;
+
+    assert(address < p_memory->mem_size);
+
+    page = find_page(p_memory, address);
+    return page != NULL ? page[address & (MEMORY_PAGE_SIZE - 1)] : 0;
+}
+
+
+/* This function implements reads against the memory.  It simply increments
+ * the appropriate statistic and then returns the value at the specified
+ * address, which is 0 if its page was never written.
  */
 unsigned char memory_read_byte(membase_t *mb, addr_t address) {
     memory_t *p_memory = (memory_t *) mb;
@@ -54,13 +86,14 @@ unsigned char memory_read_byte(membase_t *mb, addr_t address) {
 #endif
 
     p_memory->num_reads++;
-    return p_memory->mem[address];
+    p_memory->num_accesses++;
+    return peek_memory(p_memory, address);
 }
 
 
-/* This function implements writes against the memory.  It is a very
- * straightforward implementation; it simply increments the appropriate
- * statistic and then writes to the value at the specified address.
+/* This function implements writes against the memory.  It simply
+ * increments the appropriate statistic and then writes to the value at the
+ * specified address, allocating its page if this is the page's first write.
  */
 void memory_write_byte(membase_t *mb, addr_t address, unsigned char value) {
     memory_t *p_memory = (memory_t *) mb;
@@ -72,7 +105,80 @@ void memory_write_byte(membase_t *mb, addr_t address, unsigned char value) {
 #endif
 
     p_memory->num_writes++;
-    p_memory->mem[address] = value;
+    p_memory->num_accesses++;
+    touch_page(p_memory, address)[address & (MEMORY_PAGE_SIZE - 1)] = value;
+}
+
+
+/* This function implements block reads against the memory.  Each byte
+ * counts as one read, so the statistics are the same as if the bytes had
+ * been read one at a time.  The block is copied a page at a time.
+ */
+void memory_read_block(membase_t *mb, addr_t address, unsigned char *buf,
+                       unsigned int size) {
+    memory_t *p_memory = (memory_t *) mb;
+    unsigned char *page;
+    unsigned int offset, n;
+
+    assert(address < p_memory->mem_size &&
+           size <= p_memory->mem_size - address);
+
+#if DEBUG_MEMORY
+    printf("Reading memory[%u .. %u]\n", address, address + size - 1);
+#endif
+
+    p_memory->num_reads += size;
+    p_memory->num_accesses++;
+
+    while (size > 0) {
+        offset = address & (MEMORY_PAGE_SIZE - 1);
+        n = MEMORY_PAGE_SIZE - offset;
+        if (n > size)
+            n = size;
+
+        page = find_page(p_memory, address);
+        if (page != NULL)
+            memcpy(buf, page + offset, n);
+        else
+            bzero(buf, n);
+
+        address += n;
+        buf += n;
+        size -= n;
+    }
+}
+
+
+/* This function implements block writes against the memory.  As with reads,
+ * each byte counts as one write, and the block is copied a page at a time.
+ */
+void memory_write_block(membase_t *mb, addr_t address,
+                        const unsigned char *buf, unsigned int size) {
+    memory_t *p_memory = (memory_t *) mb;
+    unsigned int offset, n;
+
+    assert(address < p_memory->mem_size &&
+           size <= p_memory->mem_size - address);
+
+#if DEBUG_MEMORY
+    printf("Writing memory[%u .. %u]\n", address, address + size - 1);
+#endif
+
+    p_memory->num_writes += size;
+    p_memory->num_accesses++;
+
+    while (size > 0) {
+        offset = address & (MEMORY_PAGE_SIZE - 1);
+        n = MEMORY_PAGE_SIZE - offset;
+        if (n > size)
+            n = size;
+
+        memcpy(touch_page(p_memory, address) + offset, buf, n);
+
+        address += n;
+        buf += n;
+        size -= n;
+    }
 }
 
 
@@ -91,11 +197,48 @@ void memory_reset_stats(membase_t *mb) {
 
     p_memory->num_reads = 0;
     p_memory->num_writes = 0;
+    p_memory->num_accesses = 0;
 }
 
 
 /* This function releases the, uh, memory used by the, uh, memory. */
 void memory_free(membase_t *mb) {
     memory_t *p_memory = (memory_t *) mb;
-    free(p_memory->mem);
+    unsigned int i;
+
+    for (i = 0; i < p_memory->num_pages; i++)
+        free(p_memory->pages[i]);
+    free(p_memory->pages);
+}
+
+
+/*---------------------------------------------------------------------------
+ * MEMORY HELPER FUNCTIONS
+ */
+
+
+/* Returns the page holding the specified address, or NULL if the page was
+ * never written.
+ */
+static unsigned char * find_page(memory_t *p_memory, addr_t address) {
+    return p_memory->pages[address >> MEMORY_PAGE_BITS];
+}
+
+
+/* Returns the page holding the specified address, allocating it with its
+ * contents cleared to 0 if it was never written.
+ */
+static unsigned char * touch_page(memory_t *p_memory, addr_t address) {
+    unsigned char **p_page = p_memory->pages + (address >> MEMORY_PAGE_BITS);
+
+    if (*p_page == NULL) {
+        *p_page = calloc(1, MEMORY_PAGE_SIZE);
+        if (*p_page == NULL) {
+            printf("ERROR:  unable to allocate a page of memory.\n");
+            exit(1);
+        }
+        p_memory->num_allocated++;
+    }
+
+    return *p_page;
 }
@@ -5,10 +5,24 @@
 #include "membase.h"
 
 
+/* Memory is allocated in pages of this many bytes, the first time each page
+ * is written.
+ */
+#define MEMORY_PAGE_BITS 12
+#define MEMORY_PAGE_SIZE (1 << MEMORY_PAGE_BITS)
+
+/* The cycles that each access to the memory takes, and the bytes per cycle
+ * that it moves, unless configured otherwise.
+ */
+#define DEFAULT_MEMORY_LATENCY 200
+#define DEFAULT_MEMORY_BANDWIDTH 16
+
+
 /* This struct holds the state for a simple memory that is an addressable
- * array of bytes.  Thus, the read_byte and write_byte implementations are
- * very simple; they just access or modify values in the array of memory
- * pointed to by mem.  Access statistics and other operations are also
+ * array of bytes.  The array is sparse:  it is split into pages, and a page
+ * is only allocated when it is first written, so a large memory costs only
+ * as much as the parts of it that are used.  Pages that were never written
+ * read as zeros.  Access statistics and other operations are also
  * provided via the function-pointers held in the struct, which are
  * initialized to point to the memory_t implementations of these functions.
  */
@@ -25,6 +39,12 @@ typedef struct memory_t {
     /* The function to write a byte to the memory. */
     void (*write_byte)(membase_t *mb, addr_t address, unsigned char value);
 
+    /* The functions to read and write blocks of bytes from the memory. */
+    void (*read_block)(membase_t *mb, addr_t address, unsigned char *buf,
+                       unsigned int size);
+    void (*write_block)(membase_t *mb, addr_t address,
+                        const unsigned char *buf, unsigned int size);
+
     /* The function to print the memory's access statistics. */
     void (*print_stats)(struct membase_t *mb);
 
@@ -37,19 +57,36 @@ typedef struct memory_t {
     void (*free)(membase_t *mb);
 
     /* The size of the memory. */
-    int mem_size;
+    unsigned int mem_size;
 
-    /* The malloc'd region of memory. */
-    unsigned char *mem;
+    /* The table of pages, with NULL for each page not yet allocated, and
+     * the number of pages allocated.
+     */
+    unsigned char **pages;
+    unsigned int num_pages;
+    unsigned int num_allocated;
+
+    /* The number of reads and writes made, whatever their size, and for
+     * estimating time, the cycles that each takes and the bytes per cycle
+     * that the memory moves.
+     */
+    unsigned long long num_accesses;
+    unsigned int latency;
+    unsigned int bandwidth;
 
 } memory_t;
 
 
 /* Initializes the members of the memory_t struct to be a memory of the
- * specified number of bytes.  This requires a heap allocation, so the
+ * specified number of bytes.  This requires heap allocations, so the
  * allocated memory must be released as well.
  */
-void init_memory(memory_t *p_memory, int mem_size);
+void init_memory(memory_t *p_memory, unsigned int mem_size);
+
+/* Returns the byte at the specified address, without counting it as a read.
+ * This is for checking the memory's contents in tests.
+ */
+unsigned char peek_memory(memory_t *p_memory, addr_t address);
 
 
 #endif /* MEMORY_H */
@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmdline.h"
+#include "memory.h"
+#include "cache.h"
+#include "coherence.h"
+
+
+/* The default number of cores, and the most that can be simulated. */
+#define DEFAULT_CORES 4
+#define MAX_CORES 64
+
+/* The default private L1 and L2 caches of each core, and the shared L3. */
+#define DEFAULT_L1 "64:64:8"
+#define DEFAULT_L2 "64:512:8"
+#define DEFAULT_L3 "64:4096:16"
+
+/* The size of the simulated memory. */
+#define MEM_SIZE (1024 * 1024)
+
+/* The number of steps that each core takes in each scenario. */
+#define NUM_STEPS 100000
+
+/* Where each scenario keeps its data, as int indexes into the memory, so
+ * that one scenario's blocks don't linger into the next.
+ */
+#define COUNTERS_BASE 0
+#define PADDED_BASE 16384
+#define SHARED_BASE 32768
+#define TABLE_BASE 65536
+#define TABLE_SIZE 4096
+
+
+/* One core's step of a scenario.  p_mem is the core's first-level cache;
+ * pad is the number of ints in a cache block.
+ */
+typedef void (*step_fn)(membase_t *p_mem, int core, int step, int pad);
+
+
+/* The simulated machine. */
+typedef struct machine_t {
+    int num_cores;
+    cache_t *l1[MAX_CORES];
+    cache_t *l2[MAX_CORES];
+    cache_t *l3;
+    memory_t memory;
+    coherence_bus_t bus;
+} machine_t;
+
+
+void mesitest_usage(const char *progname);
+void build_machine(machine_t *p_machine, int num_cores, const char *l1_spec,
+                   const char *l2_spec, const char *l3_spec,
+                   const char *progname);
+void run_scenario(machine_t *p_machine, const char *description,
+                  step_fn step, int check_base, int check_stride,
+                  int check_value, int num_checks);
+
+void packed_step(membase_t *p_mem, int core, int step, int pad);
+void padded_step(membase_t *p_mem, int core, int step, int pad);
+void shared_step(membase_t *p_mem, int core, int step, int pad);
+void table_step(membase_t *p_mem, int core, int step, int pad);
+
+
+/* Prints the program usage. */
+void mesitest_usage(const char *progname) {
+    printf("usage: %s [-n cores] [L1-spec L2-spec L3-spec]\n\n", progname);
+    printf("\tSimulates cores with private L1 and L2 caches, kept coherent by "
+           "a MESI\n");
+    printf("\tsnooping bus, in front of a shared L3 cache and memory.  The "
+           "cores run\n");
+    printf("\tseveral sharing patterns, one step each in turn, and the "
+           "coherence\n");
+    printf("\ttraffic of each pattern is reported.\n\n");
+    printf("\t-n cores  the number of cores (default %d, at most %d)\n\n",
+           DEFAULT_CORES, MAX_CORES);
+    printf("\tThe caches are specified as for the other test programs; the "
+           "defaults\n");
+    printf("\tare %s, %s and %s.\n", DEFAULT_L1, DEFAULT_L2, DEFAULT_L3);
+}
+
+
+/* Builds the caches and memory of the simulated machine, and connects the
+ * private caches to the coherence bus.
+ */
+void build_machine(machine_t *p_machine, int num_cores, const char *l1_spec,
+                   const char *l2_spec, const char *l3_spec,
+                   const char *progname) {
+    cache_t *private_caches[2];
+    int core;
+
+    p_machine->num_cores = num_cores;
+
+    printf("Constructing memory for simulation (in reverse order):\n");
+    printf(" * Building memory of size %u bytes\n", MEM_SIZE);
+    init_memory(&p_machine->memory, MEM_SIZE);
+
+    printf("Shared L3:\n");
+    p_machine->l3 = make_cache(l3_spec, 3, progname,
+                               (membase_t *) &p_machine->memory, MEM_SIZE);
+
+    init_coherence_bus(&p_machine->bus, num_cores, 2);
+
+    for (core = 0; core < num_cores; core++) {
+        printf("Core %d:\n", core);
+        p_machine->l2[core] = make_cache(l2_spec, 2, progname,
+                                         (membase_t *) p_machine->l3,
+                                         MEM_SIZE);
+        p_machine->l1[core] = make_cache(l1_spec, 1, progname,
+                                         (membase_t *) p_machine->l2[core],
+                                         MEM_SIZE);
+
+        if (!p_machine->l1[core]->write_allocate) {
+            printf("ERROR:  argument 1:  the L1 caches must be "
+                   "write-allocate.\n");
+            mesitest_usage(progname);
+            exit(1);
+        }
+
+        private_caches[0] = p_machine->l1[core];
+        private_caches[1] = p_machine->l2[core];
+        attach_core(&p_machine->bus, core, private_caches);
+    }
+    printf("\n");
+}
+
+
+/* Runs one sharing pattern:  every core takes NUM_STEPS steps, one core at
+ * a time in turn.  Afterward num_checks ints, starting at check_base and
+ * check_stride apart, are read through core 0 and checked against
+ * check_value, and the statistics are printed.
+ */
+void run_scenario(machine_t *p_machine, const char *description,
+                  step_fn step, int check_base, int check_stride,
+                  int check_value, int num_checks) {
+    int i, core, pad, value;
+
+    pad = p_machine->l1[0]->block_size / sizeof(int);
+    if (pad == 0)
+        pad = 1;
+
+    reset_bus_stats(&p_machine->bus);
+    for (core = 0; core < p_machine->num_cores; core++) {
+        membase_t *p_l1 = (membase_t *) p_machine->l1[core];
+        p_l1->reset_stats(p_l1);
+    }
+
+    for (i = 0; i < NUM_STEPS; i++) {
+        for (core = 0; core < p_machine->num_cores; core++)
+            step((membase_t *) p_machine->l1[core], core, i, pad);
+    }
+
+    printf("Scenario:  %s\n\n", description);
+    print_bus_stats(&p_machine->bus);
+
+    printf(" * L1 miss-rates:");
+    for (core = 0; core < p_machine->num_cores; core++) {
+        cache_t *p_l1 = p_machine->l1[core];
+        printf(" %.2f%%", 100.0 * p_l1->num_misses /
+               (double) (p_l1->num_hits + p_l1->num_misses));
+    }
+    printf("\n");
+    printf(" * L3 hits=%lld misses=%lld\n", p_machine->l3->num_hits,
+           p_machine->l3->num_misses);
+
+    /* Reading the results through core 0 also checks that the bus brought
+     * every other core's modifications to it.
+     */
+    for (i = 0; i < num_checks; i++) {
+        value = read_int((membase_t *) p_machine->l1[0],
+                         check_base + i * check_stride);
+        if (value != check_value) {
+            printf("ERROR:  value %d is %d, expected %d!\n", i, value,
+                   check_value);
+        }
+    }
+    printf("\n");
+}
+
+
+/* Each core increments its own counter, but the counters are packed next to
+ * each other, so they share cache blocks.
+ */
+void packed_step(membase_t *p_mem, int core, int step, int pad) {
+    int index = COUNTERS_BASE + core;
+    write_int(p_mem, index, read_int(p_mem, index) + 1);
+}
+
+
+/* Each core increments its own counter, padded out to its own block. */
+void padded_step(membase_t *p_mem, int core, int step, int pad) {
+    int index = PADDED_BASE + core * pad;
+    write_int(p_mem, index, read_int(p_mem, index) + 1);
+}
+
+
+/* Every core increments the same counter. */
+void shared_step(membase_t *p_mem, int core, int step, int pad) {
+    write_int(p_mem, SHARED_BASE, read_int(p_mem, SHARED_BASE) + 1);
+}
+
+
+/* Every core reads through the same table, which is never written. */
+void table_step(membase_t *p_mem, int core, int step, int pad) {
+    read_int(p_mem, TABLE_BASE + (step * 7 + core) % TABLE_SIZE);
+}
+
+
+int main(int argc, const char **argv) {
+    const char *progname = argv[0];
+    const char *l1_spec = DEFAULT_L1, *l2_spec = DEFAULT_L2,
+               *l3_spec = DEFAULT_L3;
+    int num_cores = DEFAULT_CORES, i = 1, pad;
+    machine_t *p_machine;
+
+    if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+        num_cores = atoi(argv[i + 1]);
+        if (num_cores <= 0 || num_cores > MAX_CORES) {
+            printf("ERROR:  number of cores must be between 1 and %d, "
+                   "got %s.\n", MAX_CORES, argv[i + 1]);
+            mesitest_usage(progname);
+            exit(1);
+        }
+        i += 2;
+    }
+
+    if (argc - i == 3) {
+        l1_spec = argv[i];
+        l2_spec = argv[i + 1];
+        l3_spec = argv[i + 2];
+    }
+    else if (argc != i) {
+        mesitest_usage(progname);
+        exit(1);
+    }
+
+    p_machine = malloc(sizeof(machine_t));
+    build_machine(p_machine, num_cores, l1_spec, l2_spec, l3_spec, progname);
+
+    pad = p_machine->l1[0]->block_size / sizeof(int);
+    if (pad == 0)
+        pad = 1;
+
+    run_scenario(p_machine, "packed per-core counters (false sharing)",
+                 packed_step, COUNTERS_BASE, 1, NUM_STEPS, num_cores);
+    run_scenario(p_machine, "padded per-core counters",
+                 padded_step, PADDED_BASE, pad, NUM_STEPS, num_cores);
+    run_scenario(p_machine, "one counter shared by every core (true sharing)",
+                 shared_step, SHARED_BASE, 1, NUM_STEPS * num_cores, 1);
+    run_scenario(p_machine, "read-only table shared by every core",
+                 table_step, TABLE_BASE, 1, 0, TABLE_SIZE);
+
+    return 0;
+}
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+
+#include "cache.h"
+
+
+/* The stride prefetcher follows this many address streams at once.  An
+ * access belongs to the stream that predicted its address, or else to the
+ * stream whose last address is nearest to it, if that is within
+ * STRIDE_WINDOW bytes; otherwise it starts a new stream in place of the
+ * least recently used one.  The simulator doesn't see the program counter,
+ * so streams are told apart by address rather than by instruction.  A small
+ * window keeps interleaved streams, like the rows that apsptest walks
+ * together, from being mixed up.
+ */
+#define STRIDE_STREAMS 16
+#define STRIDE_WINDOW 256
+
+/* A stride must be seen this many times in a row before it is prefetched,
+ * and the prefetcher then fetches this many strides ahead.
+ */
+#define STRIDE_CONFIRM 2
+#define STRIDE_DEGREE 2
+
+/* The stream prefetcher has this many stream buffers, each of which runs
+ * this many blocks ahead of the last miss in its stream.
+ */
+#define NUM_STREAM_BUFFERS 4
+#define STREAM_DEPTH 4
+
+
+/* One address stream followed by the stride prefetcher. */
+typedef struct stride_stream_t {
+    addr_t last_address;
+    int stride;
+    unsigned int confidence;
+    unsigned long long last_use;
+    int valid;
+} stride_stream_t;
+
+
+/* One stream buffer of the stream prefetcher.  next_block is the first block
+ * that the buffer hasn't prefetched yet.
+ */
+typedef struct stream_buffer_t {
+    addr_t next_block;
+    unsigned long long last_use;
+    int valid;
+} stream_buffer_t;
+
+
+/* Local functions implementing each of the prefetchers. */
+
+void nextline_access(cache_t *p_cache, addr_t address, int missed,
+                     int first_use);
+
+void stride_init(cache_t *p_cache);
+void stride_free(cache_t *p_cache);
+void stride_access(cache_t *p_cache, addr_t address, int missed,
+                   int first_use);
+
+void stream_init(cache_t *p_cache);
+void stream_free(cache_t *p_cache);
+void stream_access(cache_t *p_cache, addr_t address, int missed,
+                   int first_use);
+
+
+/* Next-line:  a miss, or the first use of a prefetched line, prefetches the
+ * following block.  Sequential scans stay one block ahead.
+ */
+const prefetcher_t nextline_prefetcher = {
+    "nextline", NULL, NULL, nextline_access
+};
+
+/* Stride:  every access is matched to an address stream, and once a stream
+ * has moved by the same stride STRIDE_CONFIRM times in a row, the blocks
+ * that the next STRIDE_DEGREE strides will touch are prefetched.  This
+ * catches column walks and other constant-stride loops.
+ */
+const prefetcher_t stride_prefetcher = {
+    "stride", stride_init, stride_free, stride_access
+};
+
+/* Stream buffers:  a miss that doesn't continue an existing stream starts a
+ * new one, which prefetches the next STREAM_DEPTH blocks.  A later miss or
+ * first use within a stream keeps it STREAM_DEPTH blocks ahead.  The
+ * prefetched blocks go into the cache itself rather than into separate
+ * buffers, so they can displace demand lines.
+ */
+const prefetcher_t stream_prefetcher = {
+    "stream", stream_init, stream_free, stream_access
+};
+
+
+/* All of the prefetchers, for looking them up by name. */
+static const prefetcher_t *all_prefetchers[] = {
+    &nextline_prefetcher, &stride_prefetcher, &stream_prefetcher, NULL
+};
+
+
+/* Returns the prefetcher with the specified name, ignoring case, or NULL if
+ * there is no such prefetcher.
+ */
+const prefetcher_t * find_prefetcher(const char *name) {
+    int i;
+
+    for (i = 0; all_prefetchers[i] != NULL; i++) {
+        if (strcasecmp(all_prefetchers[i]->name, name) == 0)
+            return all_prefetchers[i];
+    }
+
+    return NULL;
+}
+
+
+/* Attaches a prefetcher to a cache.  Prefetches at or above limit, which is
+ * normally the size of the memory, are dropped.  This should be done before
+ * the cache is used.
+ */
+void set_prefetcher(cache_t *p_cache, const prefetcher_t *prefetcher,
+                    addr_t limit) {
+    assert(p_cache != NULL);
+    assert(prefetcher != NULL);
+    assert(p_cache->prefetcher == NULL);
+
+    p_cache->prefetcher = prefetcher;
+    p_cache->prefetch_limit = limit;
+    p_cache->num_queued = 0;
+
+    if (prefetcher->init != NULL)
+        prefetcher->init(p_cache);
+}
+
+
+/* Asks for the block holding the specified address to be prefetched into
+ * the cache.  Requests are dropped if they are past the end of the memory,
+ * or if the queue is full.
+ */
+void issue_prefetch(cache_t *p_cache, addr_t address) {
+    if (address >= p_cache->prefetch_limit)
+        return;
+
+    if (p_cache->num_queued < PREFETCH_QUEUE_SIZE)
+        p_cache->prefetch_queue[p_cache->num_queued++] = address;
+}
+
+
+/*---------------------------------------------------------------------------
+ * NEXT-LINE
+ */
+
+
+/* Prefetches the block after the one accessed. */
+void nextline_access(cache_t *p_cache, addr_t address, int missed,
+                     int first_use) {
+    if (missed || first_use)
+        issue_prefetch(p_cache, (address | (p_cache->block_size - 1)) + 1);
+}
+
+
+/*---------------------------------------------------------------------------
+ * STRIDE
+ */
+
+
+/* Allocates an empty table of streams. */
+void stride_init(cache_t *p_cache) {
+    p_cache->prefetch_state = calloc(STRIDE_STREAMS, sizeof(stride_stream_t));
+    if (p_cache->prefetch_state == NULL) {
+        printf("ERROR:  unable to allocate memory for the prefetcher.\n");
+        exit(1);
+    }
+}
+
+
+/* Releases the table of streams. */
+void stride_free(cache_t *p_cache) {
+    free(p_cache->prefetch_state);
+}
+
+
+/* Matches the access to a stream, updates the stream's stride, and
+ * prefetches ahead once the stride is confirmed.
+ */
+void stride_access(cache_t *p_cache, addr_t address, int missed,
+                   int first_use) {
+    stride_stream_t *streams = p_cache->prefetch_state, *p_stream = NULL;
+    unsigned int best_distance = STRIDE_WINDOW, distance;
+    unsigned long long oldest;
+    addr_t block, target;
+    int i, stride, k;
+
+    /* Find the stream that predicted this address, or else the nearest
+     * stream, or else replace the least recently used one.
+     */
+    for (i = 0; i < STRIDE_STREAMS; i++) {
+        if (streams[i].valid && streams[i].stride != 0 &&
+            streams[i].last_address + streams[i].stride == address) {
+            p_stream = streams + i;
+            break;
+        }
+    }
+
+    if (p_stream == NULL) {
+        for (i = 0; i < STRIDE_STREAMS; i++) {
+            if (!streams[i].valid)
+                continue;
+
+            distance = address > streams[i].last_address ?
+                       address - streams[i].last_address :
+                       streams[i].last_address - address;
+            if (distance <= best_distance) {
+                best_distance = distance;
+                p_stream = streams + i;
+            }
+        }
+    }
+
+    if (p_stream == NULL) {
+        p_stream = streams;
+        oldest = streams[0].last_use;
+        for (i = 0; i < STRIDE_STREAMS; i++) {
+            if (!streams[i].valid) {
+                p_stream = streams + i;
+                break;
+            }
+            if (streams[i].last_use < oldest) {
+                oldest = streams[i].last_use;
+                p_stream = streams + i;
+            }
+        }
+
+        bzero(p_stream, sizeof(stride_stream_t));
+        p_stream->valid = 1;
+        p_stream->last_address = address;
+        p_stream->last_use = clock_tick();
+        return;
+    }
+
+    stride = (int) (address - p_stream->last_address);
+    if (stride == 0)
+        return;
+
+    if (stride == p_stream->stride) {
+        if (p_stream->confidence < STRIDE_CONFIRM)
+            p_stream->confidence++;
+    }
+    else {
+        p_stream->stride = stride;
+        p_stream->confidence = 0;
+    }
+
+    p_stream->last_address = address;
+    p_stream->last_use = clock_tick();
+
+    if (p_stream->confidence < STRIDE_CONFIRM)
+        return;
+
+    /* Strides smaller than a block would prefetch the same block over and
+     * over, so only blocks other than the current one are requested.
+     */
+    block = address & ~(p_cache->block_size - 1);
+    for (k = 1; k <= STRIDE_DEGREE; k++) {
+        target = address + (addr_t) (k * stride);
+        if ((target & ~(p_cache->block_size - 1)) != block)
+            issue_prefetch(p_cache, target);
+    }
+}
+
+
+/*---------------------------------------------------------------------------
+ * STREAM BUFFERS
+ */
+
+
+/* Allocates empty stream buffers. */
+void stream_init(cache_t *p_cache) {
+    p_cache->prefetch_state =
+        calloc(NUM_STREAM_BUFFERS, sizeof(stream_buffer_t));
+    if (p_cache->prefetch_state == NULL) {
+        printf("ERROR:  unable to allocate memory for the prefetcher.\n");
+        exit(1);
+    }
+}
+
+
+/* Releases the stream buffers. */
+void stream_free(cache_t *p_cache) {
+    free(p_cache->prefetch_state);
+}
+
+
+/* On a miss or the first use of a prefetched line, continues the stream
+ * that the block belongs to, or starts a new one.
+ */
+void stream_access(cache_t *p_cache, addr_t address, int missed,
+                   int first_use) {
+    stream_buffer_t *buffers = p_cache->prefetch_state, *p_buf = NULL;
+    addr_t block = address >> p_cache->block_offset_bits;
+    int i;
+
+    if (!missed && !first_use)
+        return;
+
+    /* A block belongs to a stream if the stream prefetched it, or would
+     * have prefetched it next.
+     */
+    for (i = 0; i < NUM_STREAM_BUFFERS; i++) {
+        if (buffers[i].valid && block < buffers[i].next_block + 1 &&
+            block + STREAM_DEPTH + 1 > buffers[i].next_block) {
+            p_buf = buffers + i;
+            break;
+        }
+    }
+
+    if (p_buf == NULL) {
+        p_buf = buffers;
+        for (i = 0; i < NUM_STREAM_BUFFERS; i++) {
+            if (!buffers[i].valid) {
+                p_buf = buffers + i;
+                break;
+            }
+            if (buffers[i].last_use < p_buf->last_use)
+                p_buf = buffers + i;
+        }
+
+        p_buf->valid = 1;
+        p_buf->next_block = block + 1;
+    }
+
+    p_buf->last_use = clock_tick();
+
+    if (p_buf->next_block <= block)
+        p_buf->next_block = block + 1;
+
+    while (p_buf->next_block <= block + STREAM_DEPTH) {
+        issue_prefetch(p_cache,
+                       p_buf->next_block << p_cache->block_offset_bits);
+        p_buf->next_block++;
+    }
+}
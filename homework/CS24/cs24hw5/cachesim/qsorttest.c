@@ -140,6 +140,8 @@ int main(int argc, const char **argv) {
     printf("\nMemory-Access Statistics:\n\n");
     p_mem->print_stats(p_mem);
     printf("\n");
+    print_memory_costs();
+    printf("\n");
 
     return 0;
 }
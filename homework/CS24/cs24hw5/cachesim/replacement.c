@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+
+#include "cache.h"
+
+
+/* The RRIP policies use two-bit re-reference prediction values.  A line with
+ * the largest value is predicted to be reused furthest in the future, and is
+ * evicted first.
+ */
+#define RRPV_MAX 3
+
+/* BRRIP inserts most lines with a distant prediction of RRPV_MAX, but one
+ * fill in every BRRIP_EPSILON gets the long prediction of RRPV_MAX - 1, so
+ * that a working set larger than the cache still keeps part of itself
+ * cached.
+ */
+#define BRRIP_EPSILON 32
+
+
+/* Local functions implementing each of the replacement policies. */
+
+void lru_touch(cache_t *p_cache, cacheset_t *p_set, cacheline_t *p_line);
+cacheline_t * lru_choose_victim(cache_t *p_cache, cacheset_t *p_set);
+
+unsigned int plru_levels(cacheset_t *p_set);
+void plru_touch(cache_t *p_cache, cacheset_t *p_set, cacheline_t *p_line);
+cacheline_t * plru_choose_victim(cache_t *p_cache, cacheset_t *p_set);
+
+void rrip_hit(cache_t *p_cache, cacheset_t *p_set, cacheline_t *p_line);
+void srrip_fill(cache_t *p_cache, cacheset_t *p_set, cacheline_t *p_line);
+void brrip_fill(cache_t *p_cache, cacheset_t *p_set, cacheline_t *p_line);
+cacheline_t * rrip_choose_victim(cache_t *p_cache, cacheset_t *p_set);
+
+void random_touch(cache_t *p_cache, cacheset_t *p_set, cacheline_t *p_line);
+cacheline_t * random_choose_victim(cache_t *p_cache, cacheset_t *p_set);
+
+
+/* True LRU:  every access stamps the line with the time from clock_tick(),
+ * and the line with the oldest stamp is evicted.
+ */
+const replacement_policy_t lru_policy = {
+    "LRU", lru_touch, lru_touch, lru_choose_victim
+};
+
+/* Tree pseudo-LRU:  a binary tree of bits over the lines of each set points
+ * away from the most recently used half at every level, and the victim is
+ * found by following the bits down.  This needs one bit per line instead of
+ * a timestamp, which is why hardware uses it.
+ */
+const replacement_policy_t plru_policy = {
+    "PLRU", plru_touch, plru_touch, plru_choose_victim
+};
+
+/* Static RRIP:  new lines are predicted to be reused in the long term, lines
+ * that hit are predicted to be reused soon, and a line predicted to be
+ * reused in the distant future is evicted.  Lines that are used only once
+ * are evicted before they can push out lines that are reused.
+ */
+const replacement_policy_t srrip_policy = {
+    "SRRIP", rrip_hit, srrip_fill, rrip_choose_victim
+};
+
+/* Bimodal RRIP:  like SRRIP, but most new lines get a distant prediction,
+ * which resists thrashing when the working set is larger than the cache.
+ */
+const replacement_policy_t brrip_policy = {
+    "BRRIP", rrip_hit, brrip_fill, rrip_choose_victim
+};
+
+/* Random:  any line of the set can be evicted. */
+const replacement_policy_t random_policy = {
+    "random", random_touch, random_touch, random_choose_victim
+};
+
+
+/* All of the policies, for looking them up by name. */
+static const replacement_policy_t *all_policies[] = {
+    &lru_policy, &plru_policy, &srrip_policy, &brrip_policy, &random_policy,
+    NULL
+};
+
+
+/* Returns the replacement policy with the specified name, ignoring case, or
+ * NULL if there is no such policy.
+ */
+const replacement_policy_t * find_replacement_policy(const char *name) {
+    int i;
+
+    for (i = 0; all_policies[i] != NULL; i++) {
+        if (strcasecmp(all_policies[i]->name, name) == 0)
+            return all_policies[i];
+    }
+
+    return NULL;
+}
+
+
+/* Checks whether a policy can be used with the specified number of lines
+ * per set.  Returns NULL if it can, or a message explaining why not.
+ */
+const char * check_replacement_policy(const replacement_policy_t *policy,
+                                      unsigned int lines_per_set) {
+    if (policy == &plru_policy) {
+        if (!is_power_of_2(lines_per_set))
+            return "PLRU needs a power-of-2 number of lines per set";
+        if (lines_per_set > 64)
+            return "PLRU supports at most 64 lines per set";
+    }
+
+    return NULL;
+}
+
+
+/* Sets the replacement policy of a cache, and clears the state that the
+ * policies keep in the sets and lines.  This should be done before the cache
+ * is used.
+ */
+void set_replacement_policy(cache_t *p_cache,
+                            const replacement_policy_t *policy) {
+    unsigned int i;
+    int j;
+
+    assert(p_cache != NULL);
+    assert(policy != NULL);
+    assert(check_replacement_policy(policy,
+        p_cache->cache_sets[0].num_lines) == NULL);
+
+    p_cache->policy = policy;
+    p_cache->brrip_fills = 0;
+
+    for (i = 0; i < p_cache->num_sets; i++) {
+        cacheset_t *p_set = p_cache->cache_sets + i;
+
+        p_set->plru_bits = 0;
+        for (j = 0; j < p_set->num_lines; j++) {
+            p_set->cache_lines[j].access_time = 0;
+            p_set->cache_lines[j].rrpv = 0;
+        }
+    }
+}
+
+
+/*---------------------------------------------------------------------------
+ * LRU
+ */
+
+
+/* Stamps a line with the time of its most recent access. */
+void lru_touch(cache_t *p_cache, cacheset_t *p_set, cacheline_t *p_line) {
+    p_line->access_time = clock_tick();
+}
+
+
+/* Returns the line that was accessed least recently. */
+cacheline_t * lru_choose_victim(cache_t *p_cache, cacheset_t *p_set) {
+    cacheline_t *victim = p_set->cache_lines;
+    int i;
+
+    for (i = 1; i < p_set->num_lines; i++) {
+        if (p_set->cache_lines[i].access_time < victim->access_time)
+            victim = p_set->cache_lines + i;
+    }
+
+    return victim;
+}
+
+
+/*---------------------------------------------------------------------------
+ * TREE-PLRU
+ */
+
+
+/* Returns the number of levels in the tree over a set's lines. */
+unsigned int plru_levels(cacheset_t *p_set) {
+    return log_2(p_set->num_lines);
+}
+
+
+/* Walks the tree from the root down to the accessed line, pointing each node
+ * on the way at the other child, away from the line.
+ */
+void plru_touch(cache_t *p_cache, cacheset_t *p_set, cacheline_t *p_line) {
+    unsigned int line = p_line - p_set->cache_lines;
+    unsigned int levels = plru_levels(p_set), node = 0, level;
+
+    for (level = 0; level < levels; level++) {
+        unsigned int right = (line >> (levels - 1 - level)) & 1;
+
+        if (right)
+            p_set->plru_bits &= ~(1ULL << node);
+        else
+            p_set->plru_bits |= 1ULL << node;
+
+        node = 2 * node + 1 + right;
+    }
+}
+
+
+/* Follows the bits from the root of the tree to the victim line. */
+cacheline_t * plru_choose_victim(cache_t *p_cache, cacheset_t *p_set) {
+    unsigned int levels = plru_levels(p_set), node = 0, line = 0, level;
+
+    for (level = 0; level < levels; level++) {
+        unsigned int right = (p_set->plru_bits >> node) & 1;
+
+        line = 2 * line + right;
+        node = 2 * node + 1 + right;
+    }
+
+    return p_set->cache_lines + line;
+}
+
+
+/*---------------------------------------------------------------------------
+ * SRRIP AND BRRIP
+ */
+
+
+/* A line that hits is predicted to be reused again soon. */
+void rrip_hit(cache_t *p_cache, cacheset_t *p_set, cacheline_t *p_line) {
+    p_line->rrpv = 0;
+}
+
+
+/* SRRIP predicts a long re-reference interval for every new line. */
+void srrip_fill(cache_t *p_cache, cacheset_t *p_set, cacheline_t *p_line) {
+    p_line->rrpv = RRPV_MAX - 1;
+}
+
+
+/* BRRIP predicts a distant re-reference interval for most new lines.  A
+ * counter rather than rand() picks the exceptions, so that runs can be
+ * repeated exactly.
+ */
+void brrip_fill(cache_t *p_cache, cacheset_t *p_set, cacheline_t *p_line) {
+    p_cache->brrip_fills++;
+    if (p_cache->brrip_fills % BRRIP_EPSILON == 0)
+        p_line->rrpv = RRPV_MAX - 1;
+    else
+        p_line->rrpv = RRPV_MAX;
+}
+
+
+/* Returns the first line predicted to be reused in the distant future.  If
+ * there isn't one, every line's prediction is aged by the same amount until
+ * there is.
+ */
+cacheline_t * rrip_choose_victim(cache_t *p_cache, cacheset_t *p_set) {
+    unsigned char max_rrpv = 0;
+    int i, i_victim = 0;
+
+    for (i = 0; i < p_set->num_lines; i++) {
+        if (p_set->cache_lines[i].rrpv > max_rrpv) {
+            max_rrpv = p_set->cache_lines[i].rrpv;
+            i_victim = i;
+        }
+    }
+
+    /* Aging all the lines until one reaches RRPV_MAX is the same as adding
+     * the difference once.
+     */
+    for (i = 0; i < p_set->num_lines; i++)
+        p_set->cache_lines[i].rrpv += RRPV_MAX - max_rrpv;
+
+    return p_set->cache_lines + i_victim;
+}
+
+
+/*---------------------------------------------------------------------------
+ * RANDOM
+ */
+
+
+/* The random policy keeps no state. */
+void random_touch(cache_t *p_cache, cacheset_t *p_set, cacheline_t *p_line) {
+}
+
+
+/* Returns a randomly chosen line. */
+cacheline_t * random_choose_victim(cache_t *p_cache, cacheset_t *p_set) {
+    return p_set->cache_lines + rand() % p_set->num_lines;
+}
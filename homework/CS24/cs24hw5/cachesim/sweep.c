@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "sweep.h"
+
+
+/* Local functions used by the sweep implementation. */
+
+unsigned char sweep_read_byte(membase_t *mb, addr_t address);
+void sweep_write_byte(membase_t *mb, addr_t address, unsigned char value);
+void sweep_read_block(membase_t *mb, addr_t address, unsigned char *buf,
+                      unsigned int size);
+void sweep_write_block(membase_t *mb, addr_t address,
+                       const unsigned char *buf, unsigned int size);
+void sweep_print_stats(membase_t *mb);
+void sweep_reset_stats(membase_t *mb);
+void sweep_free(membase_t *mb);
+
+void sweep_access(sweep_t *p_sweep, addr_t address, unsigned int size);
+void geometry_access(sweep_geometry_t *p_geom, unsigned int max_lines,
+                     addr_t address, unsigned int size);
+void print_geometry_rows(sweep_t *p_sweep, unsigned int first,
+                         unsigned int last);
+
+
+/* Initializes a sweep over every block size from min_block to max_block
+ * and every number of cache-sets from min_sets to max_sets, all powers of 2,
+ * with 1 to max_lines lines per set.
+ */
+void init_sweep(sweep_t *p_sweep, unsigned int min_block,
+                unsigned int max_block, unsigned int min_sets,
+                unsigned int max_sets, unsigned int max_lines,
+                membase_t *next_mem) {
+    unsigned int block_size, num_sets, i;
+
+    assert(p_sweep != NULL);
+    assert(next_mem != NULL);
+    assert(is_power_of_2(min_block) && is_power_of_2(max_block));
+    assert(is_power_of_2(min_sets) && is_power_of_2(max_sets));
+    assert(min_block <= max_block && min_sets <= max_sets);
+    assert(max_lines > 0);
+
+    bzero(p_sweep, sizeof(sweep_t));
+
+    p_sweep->read_byte = sweep_read_byte;
+    p_sweep->write_byte = sweep_write_byte;
+    p_sweep->read_block = sweep_read_block;
+    p_sweep->write_block = sweep_write_block;
+    p_sweep->print_stats = sweep_print_stats;
+    p_sweep->reset_stats = sweep_reset_stats;
+    p_sweep->free = sweep_free;
+
+    p_sweep->next_memory = next_mem;
+    p_sweep->max_lines = max_lines;
+
+    p_sweep->num_geometries = (log_2(max_block) - log_2(min_block) + 1) *
+                              (log_2(max_sets) - log_2(min_sets) + 1);
+    p_sweep->geometries = calloc(p_sweep->num_geometries,
+                                 sizeof(sweep_geometry_t));
+    if (p_sweep->geometries == NULL) {
+        printf("ERROR:  unable to allocate memory for the sweep.\n");
+        exit(1);
+    }
+
+    i = 0;
+    for (block_size = min_block; block_size <= max_block; block_size *= 2) {
+        for (num_sets = min_sets; num_sets <= max_sets; num_sets *= 2) {
+            sweep_geometry_t *p_geom = p_sweep->geometries + i++;
+
+            p_geom->block_size = block_size;
+            p_geom->num_sets = num_sets;
+            p_geom->block_offset_bits = log_2(block_size);
+            p_geom->sets_addr_bits = log_2(num_sets);
+
+            p_geom->stacks = malloc((size_t) num_sets * max_lines *
+                                    sizeof(addr_t));
+            p_geom->depths = calloc(num_sets, sizeof(unsigned int));
+            p_geom->hits_at_depth = calloc(max_lines,
+                                           sizeof(unsigned long long));
+            if (p_geom->stacks == NULL || p_geom->depths == NULL ||
+                p_geom->hits_at_depth == NULL) {
+                printf("ERROR:  unable to allocate memory for the sweep.\n");
+                exit(1);
+            }
+        }
+    }
+}
+
+
+/* This function implements reading bytes of memory through the sweep. */
+unsigned char sweep_read_byte(membase_t *mb, addr_t address) {
+    sweep_t *p_sweep = (sweep_t *) mb;
+
+    sweep_access(p_sweep, address, 1);
+    p_sweep->num_reads++;
+    return read_byte(p_sweep->next_memory, address);
+}
+
+
+/* This function implements writing bytes of memory through the sweep. */
+void sweep_write_byte(membase_t *mb, addr_t address, unsigned char value) {
+    sweep_t *p_sweep = (sweep_t *) mb;
+
+    sweep_access(p_sweep, address, 1);
+    p_sweep->num_writes++;
+    write_byte(p_sweep->next_memory, address, value);
+}
+
+
+/* This function implements reading a block of bytes through the sweep. */
+void sweep_read_block(membase_t *mb, addr_t address, unsigned char *buf,
+                      unsigned int size) {
+    sweep_t *p_sweep = (sweep_t *) mb;
+
+    sweep_access(p_sweep, address, size);
+    p_sweep->num_reads += size;
+    read_block(p_sweep->next_memory, address, buf, size);
+}
+
+
+/* This function implements writing a block of bytes through the sweep. */
+void sweep_write_block(membase_t *mb, addr_t address,
+                       const unsigned char *buf, unsigned int size) {
+    sweep_t *p_sweep = (sweep_t *) mb;
+
+    sweep_access(p_sweep, address, size);
+    p_sweep->num_writes += size;
+    write_block(p_sweep->next_memory, address, buf, size);
+}
+
+
+/* This function prints a table of miss-rates for each block size, with a
+ * row for each number of cache-sets and a column for each power of 2 lines
+ * per set up to the maximum, and then calls the next level of the memory to
+ * print its statistics.
+ */
+void sweep_print_stats(membase_t *mb) {
+    sweep_t *p_sweep = (sweep_t *) mb;
+    unsigned int first, last;
+
+    printf(" * Sweep reads=%lld writes=%lld over %u LRU cache geometries\n",
+           p_sweep->num_reads, p_sweep->num_writes, p_sweep->num_geometries);
+
+    for (first = 0; first < p_sweep->num_geometries; first = last) {
+        last = first;
+        while (last < p_sweep->num_geometries &&
+               p_sweep->geometries[last].block_size ==
+               p_sweep->geometries[first].block_size) {
+            last++;
+        }
+
+        print_geometry_rows(p_sweep, first, last);
+    }
+
+    p_sweep->next_memory->print_stats(p_sweep->next_memory);
+}
+
+
+/* This function resets the statistics for the sweep, and passes the
+ * operation on to the next level of the memory as well.  As with a cache,
+ * the blocks already seen are kept.
+ */
+void sweep_reset_stats(membase_t *mb) {
+    sweep_t *p_sweep = (sweep_t *) mb;
+    unsigned int i;
+
+    p_sweep->num_reads = 0;
+    p_sweep->num_writes = 0;
+
+    for (i = 0; i < p_sweep->num_geometries; i++) {
+        sweep_geometry_t *p_geom = p_sweep->geometries + i;
+
+        p_geom->num_accesses = 0;
+        bzero(p_geom->hits_at_depth,
+              p_sweep->max_lines * sizeof(unsigned long long));
+    }
+
+    p_sweep->next_memory->reset_stats(p_sweep->next_memory);
+}
+
+
+/* This method frees all heap-allocated memory used by the sweep.  The
+ * method does *not* pass the call on to the next level of the memory.
+ */
+void sweep_free(membase_t *mb) {
+    sweep_t *p_sweep = (sweep_t *) mb;
+    unsigned int i;
+
+    for (i = 0; i < p_sweep->num_geometries; i++) {
+        free(p_sweep->geometries[i].stacks);
+        free(p_sweep->geometries[i].depths);
+        free(p_sweep->geometries[i].hits_at_depth);
+    }
+    free(p_sweep->geometries);
+}
+
+
+/*---------------------------------------------------------------------------
+ * SWEEP HELPER FUNCTIONS
+ */
+
+
+/* Records an access of size bytes in every geometry of the sweep. */
+void sweep_access(sweep_t *p_sweep, addr_t address, unsigned int size) {
+    unsigned int i;
+
+    for (i = 0; i < p_sweep->num_geometries; i++) {
+        geometry_access(p_sweep->geometries + i, p_sweep->max_lines,
+                        address, size);
+    }
+}
+
+
+/* Records an access of size bytes in one geometry.  The access is split at
+ * block boundaries, and each piece of n bytes is counted the way cache_t
+ * counts it:  one lookup that hits or misses, followed by n - 1 hits.  The
+ * block is then moved to the top of its set's stack, and the block at the
+ * bottom falls off if the stack is full.
+ */
+void geometry_access(sweep_geometry_t *p_geom, unsigned int max_lines,
+                     addr_t address, unsigned int size) {
+    addr_t block, offset_mask = p_geom->block_size - 1;
+    addr_t *stack;
+    unsigned int n, depth, d;
+
+    while (size > 0) {
+        n = p_geom->block_size - (address & offset_mask);
+        if (n > size)
+            n = size;
+
+        block = address >> p_geom->block_offset_bits;
+        stack = p_geom->stacks +
+            (size_t) (block & (p_geom->num_sets - 1)) * max_lines;
+        depth = p_geom->depths[block & (p_geom->num_sets - 1)];
+
+        for (d = 0; d < depth && stack[d] != block; d++);
+
+        if (d < depth) {
+            p_geom->hits_at_depth[d]++;
+        }
+        else if (depth < max_lines) {
+            /* A miss with room to spare in the stack. */
+            p_geom->depths[block & (p_geom->num_sets - 1)]++;
+        }
+        else {
+            /* A miss in every cache; the least recently used block is
+             * pushed off the bottom of the stack.
+             */
+            d = max_lines - 1;
+        }
+
+        memmove(stack + 1, stack, d * sizeof(addr_t));
+        stack[0] = block;
+
+        p_geom->num_accesses += n;
+        p_geom->hits_at_depth[0] += n - 1;
+
+        address += n;
+        size -= n;
+    }
+}
+
+
+/* Prints the rows of the miss-rate table for geometries first through
+ * last - 1, which all have the same block size.
+ */
+void print_geometry_rows(sweep_t *p_sweep, unsigned int first,
+                         unsigned int last) {
+    unsigned int i, lines, d;
+
+    printf("   B=%-6u", p_sweep->geometries[first].block_size);
+    for (lines = 1; lines <= p_sweep->max_lines; lines *= 2)
+        printf("  E=%-5u", lines);
+    printf("\n");
+
+    for (i = first; i < last; i++) {
+        sweep_geometry_t *p_geom = p_sweep->geometries + i;
+        unsigned long long hits = 0;
+
+        printf("   S=%-6u", p_geom->num_sets);
+
+        /* The hits for E lines per set are the hits at depths 0 to E - 1. */
+        d = 0;
+        for (lines = 1; lines <= p_sweep->max_lines; lines *= 2) {
+            double miss_rate = 0;
+
+            for (; d < lines; d++)
+                hits += p_geom->hits_at_depth[d];
+
+            if (p_geom->num_accesses > 0) {
+                miss_rate = 100.0 * (double) (p_geom->num_accesses - hits) /
+                            (double) p_geom->num_accesses;
+            }
+            printf("  %6.2f%%", miss_rate);
+        }
+        printf("\n");
+    }
+}
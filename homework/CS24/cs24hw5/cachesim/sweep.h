@@ -0,0 +1,98 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+
+#include "membase.h"
+
+
+/* This struct holds the LRU stacks for one cache geometry, that is, one
+ * combination of block size and number of cache-sets.  Each set keeps the
+ * blocks it has seen in order of their last access, most recent first.  An
+ * LRU cache with E lines per set holds exactly the top E blocks of each
+ * stack, so the depth at which an access finds its block tells whether it
+ * hits for every value of E at once.
+ */
+typedef struct sweep_geometry_t {
+    unsigned int block_size;
+    unsigned int num_sets;
+
+    unsigned int block_offset_bits;
+    unsigned int sets_addr_bits;
+
+    /* The stacks of block numbers, max_lines entries for each set, and the
+     * number of entries in use in each stack.
+     */
+    addr_t *stacks;
+    unsigned int *depths;
+
+    /* The number of byte accesses, and the number of them that found their
+     * block at each depth of the stack.  An access at depth d hits in every
+     * cache with more than d lines per set; an access whose block isn't in
+     * the stack misses in all of them.
+     */
+    unsigned long long num_accesses;
+    unsigned long long *hits_at_depth;
+} sweep_geometry_t;
+
+
+/* This struct holds the state of a sweep, which simulates a whole range of
+ * LRU cache geometries over the same stream of accesses.  It only tracks
+ * which blocks the caches would hold; the data itself is passed straight
+ * through to the next level of the memory.  The initial members are the
+ * same as those of membase_t.
+ */
+typedef struct sweep_t {
+    /* The number of reads that occurred at this level of the memory. */
+    unsigned long long num_reads;
+
+    /* The number of writes that occurred at this level of the memory. */
+    unsigned long long num_writes;
+
+    /* The function to read a byte from the memory. */
+    unsigned char (*read_byte)(membase_t *mb, addr_t address);
+
+    /* The function to write a byte to the memory. */
+    void (*write_byte)(membase_t *mb, addr_t address, unsigned char value);
+
+    /* The functions to read and write blocks of bytes from the memory. */
+    void (*read_block)(membase_t *mb, addr_t address, unsigned char *buf,
+                       unsigned int size);
+    void (*write_block)(membase_t *mb, addr_t address,
+                        const unsigned char *buf, unsigned int size);
+
+    /* The function to print the memory's access statistics. */
+    void (*print_stats)(struct membase_t *mb);
+
+    /* The function to reset the memory's access statistics. */
+    void (*reset_stats)(struct membase_t *mb);
+
+    /* The function to release any internally allocated data used by
+     * the memory.
+     */
+    void (*free)(membase_t *mb);
+
+    /* The geometries being simulated, ordered by block size and then by
+     * number of cache-sets.
+     */
+    unsigned int num_geometries;
+    sweep_geometry_t *geometries;
+
+    /* The largest number of lines per set that is reported. */
+    unsigned int max_lines;
+
+    /* The next level of the memory, which holds the actual data. */
+    membase_t *next_memory;
+} sweep_t;
+
+
+/* Initializes a sweep over every block size from min_block to max_block
+ * and every number of cache-sets from min_sets to max_sets, all powers of 2,
+ * with 1 to max_lines lines per set.
+ */
+void init_sweep(sweep_t *p_sweep, unsigned int min_block,
+                unsigned int max_block, unsigned int min_sets,
+                unsigned int max_sets, unsigned int max_lines,
+                membase_t *next_mem);
+
+
+#endif /* SWEEP_H */
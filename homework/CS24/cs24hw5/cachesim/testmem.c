@@ -13,6 +13,80 @@
 
 #define DEBUG_TESTMEM 0
 
+#define NUM_BLOCK_WRITES 5000
+#define MAX_BLOCK_WRITE 200
+
+
+/* Writes the same blocks to two write-no-allocate caches, to one a block at
+ * a time and to the other a byte at a time, and checks that both count the
+ * same writes, hits and misses.  Returns 1 if they do, or 0 if they don't.
+ */
+int check_block_stats(void) {
+    cache_t block_cache, byte_cache;
+    memory_t block_memory, byte_memory;
+    unsigned char buf[MAX_BLOCK_WRITE];
+    unsigned int size, j;
+    addr_t addr;
+    int i, same;
+
+    init_memory(&block_memory, TESTMEM_SIZE);
+    init_memory(&byte_memory, TESTMEM_SIZE);
+    init_cache(&block_cache, /* block_size */ 64, /* num_sets */ 16,
+        /* lines_per_set */ 4, (membase_t *) &block_memory);
+    init_cache(&byte_cache, /* block_size */ 64, /* num_sets */ 16,
+        /* lines_per_set */ 4, (membase_t *) &byte_memory);
+    set_write_policy(&block_cache, /* write_through */ 0,
+        /* write_allocate */ 0, /* num_wcb_entries */ 0);
+    set_write_policy(&byte_cache, /* write_through */ 0,
+        /* write_allocate */ 0, /* num_wcb_entries */ 0);
+
+    printf("Checking block-write statistics.\n");
+
+    /* Reads fill some of the lines, so that the writes both hit and miss. */
+    for (i = 0; i < NUM_BLOCK_WRITES; i++) {
+        addr = rand() % (TESTMEM_SIZE - MAX_BLOCK_WRITE);
+        size = 1 + rand() % MAX_BLOCK_WRITE;
+        for (j = 0; j < size; j++)
+            buf[j] = rand() % 256;
+
+        if (i % 2 == 0) {
+            read_block((membase_t *) &block_cache, addr, buf, size);
+            for (j = 0; j < size; j++)
+                buf[j] = read_byte((membase_t *) &byte_cache, addr + j);
+        }
+        else {
+            write_block((membase_t *) &block_cache, addr, buf, size);
+            for (j = 0; j < size; j++)
+                write_byte((membase_t *) &byte_cache, addr + j, buf[j]);
+        }
+    }
+
+    same = block_cache.num_reads == byte_cache.num_reads &&
+           block_cache.num_writes == byte_cache.num_writes &&
+           block_cache.num_hits == byte_cache.num_hits &&
+           block_cache.num_misses == byte_cache.num_misses;
+
+    if (same) {
+        printf("Block and byte statistics are identical.\n");
+    }
+    else {
+        printf("Block and byte statistics differ:\n");
+        printf("  block:  reads=%llu writes=%llu hits=%llu misses=%llu\n",
+            block_cache.num_reads, block_cache.num_writes,
+            block_cache.num_hits, block_cache.num_misses);
+        printf("  byte:   reads=%llu writes=%llu hits=%llu misses=%llu\n",
+            byte_cache.num_reads, byte_cache.num_writes,
+            byte_cache.num_hits, byte_cache.num_misses);
+    }
+
+    block_cache.free((membase_t *) &block_cache);
+    byte_cache.free((membase_t *) &byte_cache);
+    block_memory.free((membase_t *) &block_memory);
+    byte_memory.free((membase_t *) &byte_memory);
+
+    return same;
+}
+
 
 int main() {
     cache_t cache;
@@ -47,10 +121,10 @@ int main() {
 
     count = 0;
     for (i = 0; i < TESTMEM_SIZE; i++) {
-        if (p_raw[i] != memory.mem[i]) {
+        if (p_raw[i] != peek_memory(&memory, i)) {
             count++;
             printf("Values at index %d don't match:  raw[i] = %u, mem[i] = %u\n",
-                i, p_raw[i], memory.mem[i]);
+                i, p_raw[i], peek_memory(&memory, i));
         }
     }
 
@@ -60,6 +134,9 @@ int main() {
     cache.free((membase_t *) &cache);
     memory.free((membase_t *) &memory);
 
-    return 0;
+    if (!check_block_stats())
+        count++;
+
+    return count == 0 ? 0 : 1;
 }
 
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "tlb.h"
+
+
+/* The page number held by an entry that doesn't hold a translation. */
+#define INVALID_PAGE (~(addr_t) 0)
+
+
+/* Local functions used by the TLB implementation. */
+
+unsigned char tlb_read_byte(membase_t *mb, addr_t address);
+void tlb_write_byte(membase_t *mb, addr_t address, unsigned char value);
+void tlb_read_block(membase_t *mb, addr_t address, unsigned char *buf,
+                    unsigned int size);
+void tlb_write_block(membase_t *mb, addr_t address,
+                     const unsigned char *buf, unsigned int size);
+void tlb_print_stats(membase_t *mb);
+void tlb_reset_stats(membase_t *mb);
+void tlb_free(membase_t *mb);
+
+void tlb_access(tlb_t *p_tlb, addr_t address, unsigned int size);
+void translate(tlb_t *p_tlb, addr_t page);
+
+
+/* Initializes a TLB with num_entries entries in sets of num_ways, for pages
+ * of page_size bytes, a power of 2.  Each miss costs walk_cycles cycles.
+ */
+void init_tlb(tlb_t *p_tlb, unsigned int num_entries, unsigned int num_ways,
+              unsigned int page_size, unsigned int walk_cycles,
+              membase_t *next_mem) {
+    unsigned int i;
+
+    assert(p_tlb != NULL);
+    assert(next_mem != NULL);
+    assert(num_ways > 0 && num_entries % num_ways == 0);
+    assert(is_power_of_2(num_entries / num_ways));
+    assert(is_power_of_2(page_size));
+
+    bzero(p_tlb, sizeof(tlb_t));
+
+    p_tlb->read_byte = tlb_read_byte;
+    p_tlb->write_byte = tlb_write_byte;
+    p_tlb->read_block = tlb_read_block;
+    p_tlb->write_block = tlb_write_block;
+    p_tlb->print_stats = tlb_print_stats;
+    p_tlb->reset_stats = tlb_reset_stats;
+    p_tlb->free = tlb_free;
+
+    p_tlb->next_memory = next_mem;
+
+    p_tlb->page_size = page_size;
+    p_tlb->page_offset_bits = log_2(page_size);
+    p_tlb->num_sets = num_entries / num_ways;
+    p_tlb->num_ways = num_ways;
+    p_tlb->walk_cycles = walk_cycles;
+
+    p_tlb->pages = malloc(num_entries * sizeof(addr_t));
+    p_tlb->last_use = calloc(num_entries, sizeof(unsigned long long));
+    if (p_tlb->pages == NULL || p_tlb->last_use == NULL) {
+        printf("ERROR:  unable to allocate memory for the TLB.\n");
+        exit(1);
+    }
+
+    for (i = 0; i < num_entries; i++)
+        p_tlb->pages[i] = INVALID_PAGE;
+}
+
+
+/* Returns the total number of cycles spent on page walks. */
+unsigned long long tlb_walk_cycles(tlb_t *p_tlb) {
+    return p_tlb->num_misses * p_tlb->walk_cycles;
+}
+
+
+/* This function implements reading bytes of memory through the TLB. */
+unsigned char tlb_read_byte(membase_t *mb, addr_t address) {
+    tlb_t *p_tlb = (tlb_t *) mb;
+
+    tlb_access(p_tlb, address, 1);
+    p_tlb->num_reads++;
+    return read_byte(p_tlb->next_memory, address);
+}
+
+
+/* This function implements writing bytes of memory through the TLB. */
+void tlb_write_byte(membase_t *mb, addr_t address, unsigned char value) {
+    tlb_t *p_tlb = (tlb_t *) mb;
+
+    tlb_access(p_tlb, address, 1);
+    p_tlb->num_writes++;
+    write_byte(p_tlb->next_memory, address, value);
+}
+
+
+/* This function implements reading a block of bytes through the TLB. */
+void tlb_read_block(membase_t *mb, addr_t address, unsigned char *buf,
+                    unsigned int size) {
+    tlb_t *p_tlb = (tlb_t *) mb;
+
+    tlb_access(p_tlb, address, size);
+    p_tlb->num_reads += size;
+    read_block(p_tlb->next_memory, address, buf, size);
+}
+
+
+/* This function implements writing a block of bytes through the TLB. */
+void tlb_write_block(membase_t *mb, addr_t address,
+                     const unsigned char *buf, unsigned int size) {
+    tlb_t *p_tlb = (tlb_t *) mb;
+
+    tlb_access(p_tlb, address, size);
+    p_tlb->num_writes += size;
+    write_block(p_tlb->next_memory, address, buf, size);
+}
+
+
+/* This function prints the TLB's statistics, and then calls the next level
+ * of the memory to print its statistics.
+ */
+void tlb_print_stats(membase_t *mb) {
+    tlb_t *p_tlb = (tlb_t *) mb;
+    double miss_rate = 0;
+
+    if (p_tlb->num_lookups > 0) {
+        miss_rate = 100.0 * (double) p_tlb->num_misses /
+                    (double) p_tlb->num_lookups;
+    }
+
+    printf(" * TLB reads=%lld writes=%lld lookups=%lld misses=%lld\n",
+           p_tlb->num_reads, p_tlb->num_writes, p_tlb->num_lookups,
+           p_tlb->num_misses);
+    printf("   miss-rate=%.2f%% with %u-byte pages, page walks=%lld "
+           "cycles\n", miss_rate, p_tlb->page_size, tlb_walk_cycles(p_tlb));
+
+    p_tlb->next_memory->print_stats(p_tlb->next_memory);
+}
+
+
+/* This function resets the statistics for the TLB, and passes the operation
+ * on to the next level of the memory as well.  The translations already in
+ * the TLB are kept.
+ */
+void tlb_reset_stats(membase_t *mb) {
+    tlb_t *p_tlb = (tlb_t *) mb;
+
+    p_tlb->num_reads = 0;
+    p_tlb->num_writes = 0;
+    p_tlb->num_lookups = 0;
+    p_tlb->num_misses = 0;
+
+    p_tlb->next_memory->reset_stats(p_tlb->next_memory);
+}
+
+
+/* This method frees all heap-allocated memory used by the TLB.  The method
+ * does *not* pass the call on to the next level of the memory.
+ */
+void tlb_free(membase_t *mb) {
+    tlb_t *p_tlb = (tlb_t *) mb;
+
+    free(p_tlb->pages);
+    free(p_tlb->last_use);
+}
+
+
+/*---------------------------------------------------------------------------
+ * TLB HELPER FUNCTIONS
+ */
+
+
+/* Translates every page that an access of size bytes touches. */
+void tlb_access(tlb_t *p_tlb, addr_t address, unsigned int size) {
+    addr_t page = address >> p_tlb->page_offset_bits;
+    addr_t last = (address + size - 1) >> p_tlb->page_offset_bits;
+
+    assert(size > 0);
+
+    for (; page <= last; page++)
+        translate(p_tlb, page);
+}
+
+
+/* Looks up the translation of one page, replacing the set's least recently
+ * used entry on a miss.
+ */
+void translate(tlb_t *p_tlb, addr_t page) {
+    unsigned int set = page & (p_tlb->num_sets - 1);
+    addr_t *pages = p_tlb->pages + set * p_tlb->num_ways;
+    unsigned long long *last_use = p_tlb->last_use + set * p_tlb->num_ways;
+    unsigned int way, victim = 0;
+
+    p_tlb->num_lookups++;
+
+    for (way = 0; way < p_tlb->num_ways; way++) {
+        if (pages[way] == page) {
+            last_use[way] = clock_tick();
+            return;
+        }
+
+        if (last_use[way] < last_use[victim])
+            victim = way;
+    }
+
+    /* A miss:  walk the page table, and keep the translation.  Entries that
+     * were never used have a last use of 0, so they are filled first.
+     */
+    p_tlb->num_misses++;
+    pages[victim] = page;
+    last_use[victim] = clock_tick();
+}
@@ -0,0 +1,89 @@
+#ifndef TLB_H
+#define TLB_H
+
+
+#include "membase.h"
+
+
+/* The number of cycles that a page walk takes, if a TLB specification
+ * doesn't give one.
+ */
+#define DEFAULT_WALK_CYCLES 30
+
+
+/* This struct holds the state of a TLB in front of the caches.  The
+ * simulator has no page tables, so addresses are translated to themselves;
+ * the TLB only tracks which pages it would hold, and charges a fixed number
+ * of cycles for the page walk on each miss.  The data is passed straight
+ * through to the next level of the memory.  The initial members are the
+ * same as those of membase_t.
+ */
+typedef struct tlb_t {
+    /* The number of reads that occurred at this level of the memory. */
+    unsigned long long num_reads;
+
+    /* The number of writes that occurred at this level of the memory. */
+    unsigned long long num_writes;
+
+    /* The function to read a byte from the memory. */
+    unsigned char (*read_byte)(membase_t *mb, addr_t address);
+
+    /* The function to write a byte to the memory. */
+    void (*write_byte)(membase_t *mb, addr_t address, unsigned char value);
+
+    /* The functions to read and write blocks of bytes from the memory. */
+    void (*read_block)(membase_t *mb, addr_t address, unsigned char *buf,
+                       unsigned int size);
+    void (*write_block)(membase_t *mb, addr_t address,
+                        const unsigned char *buf, unsigned int size);
+
+    /* The function to print the memory's access statistics. */
+    void (*print_stats)(struct membase_t *mb);
+
+    /* The function to reset the memory's access statistics. */
+    void (*reset_stats)(struct membase_t *mb);
+
+    /* The function to release any internally allocated data used by
+     * the memory.
+     */
+    void (*free)(membase_t *mb);
+
+    /* The page size, and the number of address bits it covers. */
+    unsigned int page_size;
+    unsigned int page_offset_bits;
+
+    /* The TLB has num_sets sets of num_ways entries each.  Each entry holds
+     * a page number, or INVALID_PAGE, and the time of its last use for LRU
+     * replacement.
+     */
+    unsigned int num_sets;
+    unsigned int num_ways;
+    addr_t *pages;
+    unsigned long long *last_use;
+
+    /* The number of cycles that each page walk takes. */
+    unsigned int walk_cycles;
+
+    /* The number of translations looked up, and the number that missed.
+     * An access is one lookup for each page it touches.
+     */
+    unsigned long long num_lookups;
+    unsigned long long num_misses;
+
+    /* The next level of the memory. */
+    membase_t *next_memory;
+} tlb_t;
+
+
+/* Initializes a TLB with num_entries entries in sets of num_ways, for pages
+ * of page_size bytes, a power of 2.  Each miss costs walk_cycles cycles.
+ */
+void init_tlb(tlb_t *p_tlb, unsigned int num_entries, unsigned int num_ways,
+              unsigned int page_size, unsigned int walk_cycles,
+              membase_t *next_mem);
+
+/* Returns the total number of cycles spent on page walks. */
+unsigned long long tlb_walk_cycles(tlb_t *p_tlb);
+
+
+#endif /* TLB_H */
@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "trace.h"
+
+
+/* The longest trace line that is parsed; longer lines are skipped. */
+#define MAX_LINE_LENGTH 1024
+
+
+/* Compressed traces are recognized by their file extensions, and read
+ * through a pipe from the matching decompressor.
+ */
+typedef struct decompressor_t {
+    const char *extension;
+    const char *command;
+} decompressor_t;
+
+static const decompressor_t decompressors[] = {
+    { ".gz",  "gzip -dc" },
+    { ".bz2", "bzip2 -dc" },
+    { ".xz",  "xz -dc" },
+    { ".zst", "zstd -dc" },
+    { NULL,   NULL }
+};
+
+
+/* Local functions used by the trace reader. */
+
+const char * find_decompressor(const char *filename);
+FILE * open_pipe(const char *command, const char *filename);
+int parse_lackey_line(const char *line, trace_reader_t *p_trace,
+                      trace_access_t *p_access);
+int parse_din_line(const char *line, trace_access_t *p_access);
+int parse_perf_line(const char *line, trace_access_t *p_access);
+
+
+/* Sets *format to the trace format with the specified name, which is one of
+ * "lackey", "din" or "perf".  Returns 1 on success, or 0 if the name isn't
+ * recognized.
+ */
+int parse_trace_format(const char *name, trace_format_t *format) {
+    if (strcmp(name, "lackey") == 0)
+        *format = TRACE_LACKEY;
+    else if (strcmp(name, "din") == 0)
+        *format = TRACE_DIN;
+    else if (strcmp(name, "perf") == 0)
+        *format = TRACE_PERF;
+    else
+        return 0;
+
+    return 1;
+}
+
+
+/* Opens a trace file for reading.  A filename of "-" reads the trace from
+ * standard input.  Files ending in .gz, .bz2, .xz or .zst are decompressed
+ * on the fly by the corresponding command-line tool, so that the whole trace
+ * never needs to be decompressed on disk.  Returns 1 on success, or 0 if the
+ * trace can't be opened.
+ */
+int open_trace(trace_reader_t *p_trace, const char *filename,
+               trace_format_t format) {
+    const char *command;
+
+    assert(p_trace != NULL);
+    assert(filename != NULL);
+
+    bzero(p_trace, sizeof(trace_reader_t));
+    p_trace->format = format;
+
+    command = find_decompressor(filename);
+    if (strcmp(filename, "-") == 0) {
+        p_trace->file = stdin;
+    }
+    else if (command != NULL) {
+        p_trace->file = open_pipe(command, filename);
+        p_trace->is_pipe = 1;
+    }
+    else {
+        p_trace->file = fopen(filename, "r");
+    }
+
+    return p_trace->file != NULL;
+}
+
+
+/* Reads the next access from the trace into *p_access.  Returns 1 if an
+ * access was read, or 0 at the end of the trace.  Lines that aren't
+ * accesses, such as the messages Valgrind prints around a lackey trace, are
+ * skipped and counted.
+ */
+int next_trace_access(trace_reader_t *p_trace, trace_access_t *p_access) {
+    char line[MAX_LINE_LENGTH];
+    int parsed;
+
+    assert(p_trace != NULL);
+    assert(p_access != NULL);
+
+    if (p_trace->pending_write) {
+        *p_access = p_trace->pending;
+        p_trace->pending_write = 0;
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), p_trace->file) != NULL) {
+        p_trace->line_no++;
+
+        /* Skip the rest of a line that is too long to parse. */
+        if (strchr(line, '\n') == NULL && !feof(p_trace->file)) {
+            int ch;
+            do {
+                ch = fgetc(p_trace->file);
+            } while (ch != '\n' && ch != EOF);
+
+            p_trace->num_skipped++;
+            continue;
+        }
+
+        switch (p_trace->format) {
+        case TRACE_LACKEY:
+            parsed = parse_lackey_line(line, p_trace, p_access);
+            break;
+
+        case TRACE_DIN:
+            parsed = parse_din_line(line, p_access);
+            break;
+
+        case TRACE_PERF:
+            parsed = parse_perf_line(line, p_access);
+            break;
+
+        default:
+            assert(0);
+            parsed = 0;
+        }
+
+        if (parsed)
+            return 1;
+
+        p_trace->num_skipped++;
+    }
+
+    return 0;
+}
+
+
+/* Closes a trace opened with open_trace().  A decompressor's exit status is
+ * not checked, since a trace that is cut short is still worth simulating.
+ */
+void close_trace(trace_reader_t *p_trace) {
+    assert(p_trace != NULL);
+
+    if (p_trace->file == NULL || p_trace->file == stdin)
+        return;
+
+    if (p_trace->is_pipe)
+        pclose(p_trace->file);
+    else
+        fclose(p_trace->file);
+
+    p_trace->file = NULL;
+}
+
+
+/*---------------------------------------------------------------------------
+ * TRACE HELPER FUNCTIONS
+ */
+
+
+/* Returns the command that decompresses the specified file, or NULL if the
+ * file's extension doesn't mark it as compressed.
+ */
+const char * find_decompressor(const char *filename) {
+    size_t name_len = strlen(filename);
+    int i;
+
+    for (i = 0; decompressors[i].extension != NULL; i++) {
+        size_t ext_len = strlen(decompressors[i].extension);
+        if (name_len > ext_len &&
+            strcmp(filename + name_len - ext_len,
+                   decompressors[i].extension) == 0) {
+            return decompressors[i].command;
+        }
+    }
+
+    return NULL;
+}
+
+
+/* Starts the specified decompression command on a file, and returns a pipe
+ * that the decompressed trace can be read from.  The filename is quoted for
+ * the shell, so that it can contain any characters.
+ */
+FILE * open_pipe(const char *command, const char *filename) {
+    char *shell_cmd, *p;
+    const char *q;
+    FILE *pipe;
+
+    /* Each character can become the four characters '\'' when quoted. */
+    shell_cmd = malloc(strlen(command) + 4 * strlen(filename) + 8);
+    if (shell_cmd == NULL)
+        return NULL;
+
+    p = shell_cmd + sprintf(shell_cmd, "%s -- '", command);
+    for (q = filename; *q != '\0'; q++) {
+        if (*q == '\'') {
+            strcpy(p, "'\\''");
+            p += 4;
+        }
+        else {
+            *p++ = *q;
+        }
+    }
+    strcpy(p, "'");
+
+    pipe = popen(shell_cmd, "r");
+    free(shell_cmd);
+
+    return pipe;
+}
+
+
+/* Parses one line of a lackey trace.  A modify is returned as a read, and
+ * the write that follows it is saved in the reader for the next call.
+ */
+int parse_lackey_line(const char *line, trace_reader_t *p_trace,
+                      trace_access_t *p_access) {
+    char op;
+    unsigned long long address;
+    unsigned int size;
+
+    /* Valgrind's own messages start with "==pid==". */
+    if (line[0] == '=')
+        return 0;
+
+    if (sscanf(line, " %c %llx,%u", &op, &address, &size) != 3 || size == 0)
+        return 0;
+
+    p_access->address = address;
+    p_access->size = size;
+
+    switch (op) {
+    case 'I':
+        p_access->type = ACCESS_IFETCH;
+        break;
+
+    case 'L':
+        p_access->type = ACCESS_READ;
+        break;
+
+    case 'S':
+        p_access->type = ACCESS_WRITE;
+        break;
+
+    case 'M':
+        p_access->type = ACCESS_READ;
+        p_trace->pending = *p_access;
+        p_trace->pending.type = ACCESS_WRITE;
+        p_trace->pending_write = 1;
+        break;
+
+    default:
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/* Parses one line of a din trace. */
+int parse_din_line(const char *line, trace_access_t *p_access) {
+    int label, ct;
+    unsigned long long address;
+    unsigned int size = 4;
+
+    ct = sscanf(line, "%d %llx %u", &label, &address, &size);
+    if (ct < 2 || label < 0 || label > 2 || size == 0)
+        return 0;
+
+    if (label == 0)
+        p_access->type = ACCESS_READ;
+    else if (label == 1)
+        p_access->type = ACCESS_WRITE;
+    else
+        p_access->type = ACCESS_IFETCH;
+
+    p_access->address = address;
+    p_access->size = size;
+    return 1;
+}
+
+
+/* Parses one line of perf script output.  The address is the last field of
+ * the line; samples without a data address have an address of 0, and are
+ * skipped.
+ */
+int parse_perf_line(const char *line, trace_access_t *p_access) {
+    const char *end = line + strlen(line), *start;
+    char *parse_end;
+    unsigned long long address;
+
+    /* Find the last whitespace-separated field on the line. */
+    while (end > line && (end[-1] == '\n' || end[-1] == ' ' ||
+                          end[-1] == '\t' || end[-1] == '\r')) {
+        end--;
+    }
+    start = end;
+    while (start > line && start[-1] != ' ' && start[-1] != '\t')
+        start--;
+
+    if (start == end)
+        return 0;
+
+    address = strtoull(start, &parse_end, 16);
+    if (parse_end != end || address == 0)
+        return 0;
+
+    p_access->type = (strstr(line, "store") != NULL) ?
+        ACCESS_WRITE : ACCESS_READ;
+    p_access->address = address;
+    p_access->size = 4;
+    return 1;
+}
@@ -0,0 +1,87 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+
+#include <stdio.h>
+
+
+/* The formats of address traces that the trace reader understands. */
+typedef enum trace_format_t {
+    /* Valgrind's lackey tool, run with --trace-mem=yes.  Lines look like
+     * "I  0400d7d4,8" or " L 7ff000398,8", where the letter is I for an
+     * instruction fetch, L for a load, S for a store, or M for a modify (a
+     * load followed by a store to the same address).
+     */
+    TRACE_LACKEY,
+
+    /* The "din" format used by the Dinero cache simulators.  Each line is
+     * "<label> <hex address> [size]", where the label is 0 for a read, 1 for
+     * a write, or 2 for an instruction fetch.  The size defaults to 4 bytes.
+     * Pin's pinatrace tool can be converted to this format with a one-line
+     * script.
+     */
+    TRACE_DIN,
+
+    /* The output of "perf script -F event,addr" for a "perf mem record"
+     * session.  The address is the last field on each line, and the access
+     * is a write if the event's name contains "store", or a read otherwise.
+     * perf doesn't report access sizes, so every access is taken to be 4
+     * bytes.
+     */
+    TRACE_PERF
+} trace_format_t;
+
+
+/* The kinds of memory accesses that can appear in a trace. */
+typedef enum access_type_t {
+    ACCESS_READ,
+    ACCESS_WRITE,
+    ACCESS_IFETCH
+} access_type_t;
+
+
+/* One memory access read from a trace.  Traces can come from 64-bit
+ * programs, so the address is kept at its full width here.
+ */
+typedef struct trace_access_t {
+    access_type_t type;
+    unsigned long long address;
+    unsigned int size;
+} trace_access_t;
+
+
+/* The state of a trace that is being read.  Traces are read one line at a
+ * time, so a trace of any length can be streamed through the simulator.
+ */
+typedef struct trace_reader_t {
+    /* The trace file, or a pipe from the program decompressing it. */
+    FILE *file;
+
+    /* This value will be 1 if file is a pipe, 0 if it is a plain file. */
+    int is_pipe;
+
+    trace_format_t format;
+
+    /* A lackey "M" line is returned as a read and then a write.  This is
+     * nonzero when the write is still to be returned.
+     */
+    int pending_write;
+    trace_access_t pending;
+
+    /* The number of the line last read, for error messages. */
+    unsigned long long line_no;
+
+    /* The number of lines that couldn't be parsed, and were skipped. */
+    unsigned long long num_skipped;
+} trace_reader_t;
+
+
+int parse_trace_format(const char *name, trace_format_t *format);
+
+int open_trace(trace_reader_t *p_trace, const char *filename,
+               trace_format_t format);
+int next_trace_access(trace_reader_t *p_trace, trace_access_t *p_access);
+void close_trace(trace_reader_t *p_trace);
+
+
+#endif /* TRACE_H */
@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "cmdline.h"
+#include "memory.h"
+#include "cache.h"
+#include "trace.h"
+
+
+/* The default size of the simulated memory, in megabytes.  Only the pages
+ * that the trace touches need to fit, since they are packed together as
+ * they are first touched; see translate_address().
+ */
+#define DEFAULT_MEM_MB 64
+
+/* The largest simulated memory, which must fit in a 32-bit address.  Memory
+ * pages are only allocated when they are written, so a large memory is
+ * cheap unless the trace really touches all of it.
+ */
+#define MAX_MEM_MB 4095
+
+/* Trace addresses are mapped to simulated memory a page at a time. */
+#define PAGE_SIZE 4096
+#define PAGE_BITS 12
+
+/* The page table starts out with this many slots, and doubles when it gets
+ * half full.
+ */
+#define INITIAL_PAGE_SLOTS 1024
+
+
+/* Maps the pages of the traced program's address space to pages of the
+ * simulated memory, in the order they are first touched, like an operating
+ * system handing out physical pages.  This lets a 64-bit trace with a
+ * scattered address space run against a small simulated memory.  The table
+ * uses open addressing; a slot is empty when its frame is 0, so frames are
+ * stored plus one.
+ */
+typedef struct page_table_t {
+    unsigned long long *pages;
+    unsigned int *frames;
+    unsigned int num_slots;
+    unsigned int num_pages;
+    unsigned int max_pages;
+
+    /* The last page translated, since accesses usually stay on a page. */
+    unsigned long long last_page;
+    unsigned int last_frame;
+} page_table_t;
+
+
+/* Counts of the accesses in the trace. */
+typedef struct trace_stats_t {
+    unsigned long long num_reads;
+    unsigned long long num_writes;
+    unsigned long long num_ifetches;
+    unsigned long long num_bytes;
+} trace_stats_t;
+
+
+void tracesim_usage(const char *progname);
+void init_page_table(page_table_t *p_table, unsigned int max_pages);
+void free_page_table(page_table_t *p_table);
+unsigned int page_slot(page_table_t *p_table, unsigned long long page);
+void grow_page_table(page_table_t *p_table);
+addr_t translate_address(page_table_t *p_table, unsigned long long address);
+void simulate_access(membase_t *p_mem, page_table_t *p_table,
+                     trace_access_t *p_access);
+
+
+/* Prints the program usage. */
+void tracesim_usage(const char *progname) {
+    printf("usage: %s [-f format] [-m mem-MB] [-i] trace-file "
+           "[cache-spec ...]\n\n", progname);
+    printf("\tRuns the memory accesses in trace-file through the specified "
+           "caches.\n");
+    printf("\tA trace-file of - reads standard input, and files ending in "
+           ".gz,\n");
+    printf("\t.bz2, .xz or .zst are decompressed as they are read.\n\n");
+    printf("\t-f format  the trace format:  lackey (Valgrind "
+           "--tool=lackey\n");
+    printf("\t           --trace-mem=yes, the default), din (Dinero), or "
+           "perf\n");
+    printf("\t           (perf script -F event,addr)\n");
+    printf("\t-m mem-MB  the simulated memory size in megabytes (default "
+           "%d); it\n", DEFAULT_MEM_MB);
+    printf("\t           must hold every page the trace touches\n");
+    printf("\t-i         also simulate instruction fetches, which are "
+           "skipped by\n");
+    printf("\t           default since the caches model data caches\n\n");
+    printf("\tCache specifications are in the form B:S:E, as for the other "
+           "test\n");
+    printf("\tprograms:  B = block size, S = number of cache-sets, and "
+           "E = number\n");
+    printf("\tof cache-lines per set.\n");
+}
+
+
+/* Initializes an empty page table that can map up to max_pages pages. */
+void init_page_table(page_table_t *p_table, unsigned int max_pages) {
+    bzero(p_table, sizeof(page_table_t));
+
+    p_table->num_slots = INITIAL_PAGE_SLOTS;
+    p_table->pages = calloc(p_table->num_slots, sizeof(unsigned long long));
+    p_table->frames = calloc(p_table->num_slots, sizeof(unsigned int));
+    if (p_table->pages == NULL || p_table->frames == NULL) {
+        printf("ERROR:  unable to allocate memory for the page table.\n");
+        exit(1);
+    }
+
+    p_table->max_pages = max_pages;
+}
+
+
+/* Releases the memory used by a page table. */
+void free_page_table(page_table_t *p_table) {
+    free(p_table->pages);
+    free(p_table->frames);
+}
+
+
+/* Returns the slot that holds the specified page, or the empty slot where
+ * it belongs if it isn't in the table.
+ */
+unsigned int page_slot(page_table_t *p_table, unsigned long long page) {
+    unsigned int mask = p_table->num_slots - 1;
+    unsigned int slot = (unsigned int)
+        ((page * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+
+    while (p_table->frames[slot] != 0 && p_table->pages[slot] != page)
+        slot = (slot + 1) & mask;
+
+    return slot;
+}
+
+
+/* Doubles the number of slots in a page table. */
+void grow_page_table(page_table_t *p_table) {
+    unsigned long long *old_pages = p_table->pages;
+    unsigned int *old_frames = p_table->frames;
+    unsigned int old_slots = p_table->num_slots, i;
+
+    p_table->num_slots *= 2;
+    p_table->pages = calloc(p_table->num_slots, sizeof(unsigned long long));
+    p_table->frames = calloc(p_table->num_slots, sizeof(unsigned int));
+    if (p_table->pages == NULL || p_table->frames == NULL) {
+        printf("ERROR:  unable to allocate memory for the page table.\n");
+        exit(1);
+    }
+
+    for (i = 0; i < old_slots; i++) {
+        if (old_frames[i] != 0) {
+            unsigned int slot = page_slot(p_table, old_pages[i]);
+            p_table->pages[slot] = old_pages[i];
+            p_table->frames[slot] = old_frames[i];
+        }
+    }
+
+    free(old_pages);
+    free(old_frames);
+}
+
+
+/* Translates a traced address to an address in the simulated memory.  The
+ * offset within the page is kept, so accesses land in the same cache sets
+ * they would with any other physical page.
+ */
+addr_t translate_address(page_table_t *p_table, unsigned long long address) {
+    unsigned long long page = address >> PAGE_BITS;
+    addr_t offset = (addr_t) (address & (PAGE_SIZE - 1));
+    unsigned int slot;
+
+    if (p_table->last_frame != 0 && page == p_table->last_page)
+        return ((p_table->last_frame - 1) << PAGE_BITS) | offset;
+
+    slot = page_slot(p_table, page);
+    if (p_table->frames[slot] == 0) {
+        /* First touch of this page; give it the next free frame. */
+        if (p_table->num_pages == p_table->max_pages) {
+            printf("ERROR:  the trace touches more than %u pages; use -m "
+                   "to simulate a larger memory.\n", p_table->max_pages);
+            exit(1);
+        }
+
+        p_table->pages[slot] = page;
+        p_table->frames[slot] = ++p_table->num_pages;
+
+        if (2 * p_table->num_pages > p_table->num_slots) {
+            grow_page_table(p_table);
+            slot = page_slot(p_table, page);
+        }
+    }
+
+    p_table->last_page = page;
+    p_table->last_frame = p_table->frames[slot];
+    return ((p_table->last_frame - 1) << PAGE_BITS) | offset;
+}
+
+
+/* Performs one traced access against the simulated memory.  An access that
+ * straddles two pages is split at the page boundary, since the two pages
+ * needn't be next to each other in the simulated memory.  Trace files don't
+ * record the data, so zeros are written.
+ */
+void simulate_access(membase_t *p_mem, page_table_t *p_table,
+                     trace_access_t *p_access) {
+    static unsigned char buf[PAGE_SIZE];
+    unsigned long long address = p_access->address;
+    unsigned int size = p_access->size, n;
+
+    while (size > 0) {
+        addr_t addr = translate_address(p_table, address);
+
+        n = PAGE_SIZE - (addr & (PAGE_SIZE - 1));
+        if (n > size)
+            n = size;
+
+        if (p_access->type == ACCESS_WRITE)
+            write_block(p_mem, addr, buf, n);
+        else
+            read_block(p_mem, addr, buf, n);
+
+        address += n;
+        size -= n;
+    }
+}
+
+
+int main(int argc, const char **argv) {
+    trace_format_t format = TRACE_LACKEY;
+    int mem_mb = DEFAULT_MEM_MB, include_ifetches = 0;
+    const char *progname = argv[0], *filename, **spec_argv;
+    int i, num_specs;
+
+    trace_reader_t trace;
+    trace_access_t access;
+    trace_stats_t stats;
+    page_table_t table;
+    membase_t *p_mem;
+
+    /* Parse the options that come before the trace file. */
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            if (!parse_trace_format(argv[++i], &format)) {
+                printf("ERROR:  unrecognized trace format \"%s\".\n", argv[i]);
+                tracesim_usage(progname);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            mem_mb = atoi(argv[++i]);
+            if (mem_mb <= 0 || mem_mb > MAX_MEM_MB) {
+                printf("ERROR:  memory size must be between 1 and %d MB, "
+                       "got %s.\n", MAX_MEM_MB, argv[i]);
+                tracesim_usage(progname);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-i") == 0) {
+            include_ifetches = 1;
+        }
+        else {
+            tracesim_usage(progname);
+            exit(1);
+        }
+    }
+
+    if (i == argc) {
+        tracesim_usage(progname);
+        exit(1);
+    }
+    filename = argv[i++];
+
+    /* make_cached_memory() expects the program name before the cache
+     * specifications.
+     */
+    num_specs = argc - i;
+    spec_argv = malloc((num_specs + 1) * sizeof(const char *));
+    spec_argv[0] = progname;
+    memcpy(spec_argv + 1, argv + i, num_specs * sizeof(const char *));
+
+    p_mem = make_cached_memory(num_specs + 1, spec_argv,
+                               (unsigned int) mem_mb * 1024 * 1024);
+    free(spec_argv);
+
+    if (!open_trace(&trace, filename, format)) {
+        printf("ERROR:  couldn't open trace file \"%s\".\n", filename);
+        exit(1);
+    }
+
+    printf("Simulating the accesses in %s.\n", filename);
+
+    init_page_table(&table, (unsigned int) mem_mb * (1024 * 1024 / PAGE_SIZE));
+    bzero(&stats, sizeof(trace_stats_t));
+
+    while (next_trace_access(&trace, &access)) {
+        switch (access.type) {
+        case ACCESS_READ:
+            stats.num_reads++;
+            break;
+
+        case ACCESS_WRITE:
+            stats.num_writes++;
+            break;
+
+        case ACCESS_IFETCH:
+            stats.num_ifetches++;
+            if (!include_ifetches)
+                continue;
+            break;
+        }
+
+        stats.num_bytes += access.size;
+        simulate_access(p_mem, &table, &access);
+    }
+
+    close_trace(&trace);
+
+    /* Print out the results of the simulation. */
+
+    printf("\nTrace Statistics:\n\n");
+    printf(" * Accesses:  reads=%llu writes=%llu instruction-fetches=%llu%s\n",
+           stats.num_reads, stats.num_writes, stats.num_ifetches,
+           include_ifetches ? "" : " (skipped)");
+    printf(" * Bytes simulated=%llu, pages touched=%u (%.1f MB), lines "
+           "skipped=%llu\n", stats.num_bytes, table.num_pages,
+           (double) table.num_pages * PAGE_SIZE / (1024.0 * 1024.0),
+           trace.num_skipped);
+
+    printf("\nMemory-Access Statistics:\n\n");
+    p_mem->print_stats(p_mem);
+    printf("\n");
+    print_memory_costs();
+    printf("\n");
+
+    free_page_table(&table);
+
+    return 0;
+}
@@ -0,0 +1,445 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "cpuid.h"
+
+
+/* The latency curve runs from MIN_WORKING_SET up to four times the size of
+ * the last-level cache, but at least MIN_LARGEST_SET so that memory is
+ * reached even when CPUID reports no caches, and at most MAX_WORKING_SET.
+ */
+#define MIN_WORKING_SET (4 * 1024)
+#define MIN_LARGEST_SET (64 * 1024 * 1024)
+#define MAX_WORKING_SET (256 * 1024 * 1024)
+
+/* The number of dependent loads timed at each working-set size. */
+#define CHASE_STEPS (1 << 20)
+
+/* The number of bytes read for each bandwidth measurement. */
+#define STREAM_BYTES (512ULL * 1024 * 1024)
+
+/* A new level starts where the latency rises past KNEE_RATIO times the
+ * current level's and stays there; it keeps climbing while each point is more than
+ * CLIMB_RATIO times the one before.
+ */
+#define KNEE_RATIO 1.5
+#define CLIMB_RATIO 1.1
+
+/* A measured cache size replaces the reported one when they differ by more
+ * than this factor.
+ */
+#define SIZE_MISMATCH 2
+
+
+/* What each thread of the stream benchmark reads, and where it runs. */
+typedef struct stream_worker {
+
+    const unsigned long long *buffer;
+
+    unsigned int words;
+
+    unsigned int passes;
+
+    unsigned int cpu;
+
+    unsigned long long sum;
+
+} stream_worker;
+
+
+/* Keeps the compiler from discarding loads whose results are never used. */
+static volatile unsigned long long sink;
+
+
+static double now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/* Returns the average latency of a load whose address depends on the one
+ * before, over a working set of size bytes.  The buffer is linked into a
+ * single random cycle of line-sized nodes, so that neither the prefetchers
+ * nor out-of-order execution can get ahead of the chase.
+ */
+static double chase_latency(void *buffer, unsigned int size,
+                            unsigned int line_size) {
+    unsigned int num_nodes = size / line_size, i, j, tmp;
+    unsigned int *order;
+    char *base = buffer;
+    void **p;
+    double start;
+
+    assert(num_nodes > 1);
+
+    order = malloc(num_nodes * sizeof(unsigned int));
+    if (order == NULL) {
+        printf("ERROR:  unable to allocate memory for calibration.\n");
+        exit(1);
+    }
+
+    /* Sattolo's shuffle, which always produces a single cycle. */
+    for (i = 0; i < num_nodes; i++)
+        order[i] = i;
+    for (i = num_nodes - 1; i > 0; i--) {
+        j = (unsigned int) rand() % i;
+        tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    for (i = 0; i < num_nodes; i++) {
+        *(void **) (base + (size_t) order[i] * line_size) =
+            base + (size_t) order[(i + 1) % num_nodes] * line_size;
+    }
+    free(order);
+
+    /* Walk the cycle once to bring the working set into the caches. */
+    p = (void **) base;
+    for (i = 0; i < num_nodes; i++)
+        p = *p;
+
+    start = now_ns();
+    for (i = 0; i < CHASE_STEPS; i += 4) {
+        p = *p;
+        p = *p;
+        p = *p;
+        p = *p;
+    }
+    sink = (unsigned long long) (size_t) p;
+
+    return (now_ns() - start) / CHASE_STEPS;
+}
+
+
+/* Reads words 64-bit words from buffer passes times, and returns their sum
+ * so that the reads can't be optimized away.
+ */
+static unsigned long long stream_read(const unsigned long long *buffer,
+                                      unsigned int words,
+                                      unsigned int passes) {
+    unsigned long long s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    unsigned int pass, i;
+
+    for (pass = 0; pass < passes; pass++) {
+        for (i = 0; i + 4 <= words; i += 4) {
+            s0 += buffer[i];
+            s1 += buffer[i + 1];
+            s2 += buffer[i + 2];
+            s3 += buffer[i + 3];
+        }
+    }
+
+    return s0 + s1 + s2 + s3;
+}
+
+
+/* Returns the single-threaded read bandwidth, in MB/s, over a working set
+ * of size bytes.
+ */
+static double read_bandwidth(const unsigned long long *buffer,
+                             unsigned int size) {
+    unsigned int words = size / sizeof(unsigned long long);
+    unsigned int passes = (unsigned int) (STREAM_BYTES / size);
+    double start, elapsed;
+
+    if (passes == 0)
+        passes = 1;
+
+    /* One pass first, so the working set is already in the caches. */
+    sink = stream_read(buffer, words, 1);
+
+    start = now_ns();
+    sink = stream_read(buffer, words, passes);
+    elapsed = now_ns() - start;
+
+    return (double) words * sizeof(unsigned long long) * passes * 1000.0 /
+           elapsed;
+}
+
+
+static void * stream_thread(void *arg) {
+    stream_worker *worker = arg;
+
+#ifdef __linux__
+    {
+        cpu_set_t one;
+
+        CPU_ZERO(&one);
+        CPU_SET(worker->cpu, &one);
+        pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+    }
+#endif
+
+    worker->sum = stream_read(worker->buffer, worker->words, worker->passes);
+    return NULL;
+}
+
+
+/* Returns the total read bandwidth, in MB/s, of num_threads threads each
+ * streaming through its own slice of a buffer of size bytes.  The threads
+ * are pinned in the order from order_cpus_for_workers(), so that each runs
+ * on a core of its own for as long as there are cores to go around.
+ */
+static double stream_bandwidth(const unsigned long long *buffer,
+                               unsigned int size, const unsigned int *cpus,
+                               unsigned int num_threads) {
+    stream_worker workers[MAX_STREAM_THREADS];
+    pthread_t threads[MAX_STREAM_THREADS];
+    unsigned int words = size / sizeof(unsigned long long) / num_threads;
+    unsigned int passes = (unsigned int) (STREAM_BYTES / size);
+    unsigned int i;
+    double start, elapsed;
+
+    assert(num_threads > 0 && num_threads <= MAX_STREAM_THREADS);
+
+    if (passes == 0)
+        passes = 1;
+
+    start = now_ns();
+    for (i = 0; i < num_threads; i++) {
+        workers[i].buffer = buffer + (size_t) i * words;
+        workers[i].words = words;
+        workers[i].passes = passes;
+        workers[i].cpu = cpus[i];
+
+        if (pthread_create(threads + i, NULL, stream_thread, workers + i) != 0) {
+            printf("ERROR:  unable to start stream thread %u.\n", i);
+            exit(1);
+        }
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+        sink += workers[i].sum;
+    }
+    elapsed = now_ns() - start;
+
+    return (double) words * sizeof(unsigned long long) * passes *
+           num_threads * 1000.0 / elapsed;
+}
+
+
+/* Splits the latency curve into plateaus, one per cache level and the last
+ * for main memory.  A level's size is the last working set before the
+ * latency starts to climb to the next one.
+ */
+static void find_levels(calibration *result) {
+    const latency_point *points = result->points;
+    double level_latency = points[0].latency_ns;
+    unsigned int i;
+
+    result->num_levels = 0;
+
+    for (i = 1; i < result->num_points; i++) {
+        measured_level *level;
+
+        /* A rise only counts if the next point stays up too, so that one
+         * noisy measurement doesn't split a level.
+         */
+        if (points[i].latency_ns <= KNEE_RATIO * level_latency ||
+            (i + 1 < result->num_points &&
+             points[i + 1].latency_ns <= KNEE_RATIO * level_latency))
+            continue;
+
+        if (result->num_levels == MAX_MEASURED_LEVELS - 1)
+            break;
+
+        level = result->levels + result->num_levels++;
+        level->size = points[i - 1].size;
+        level->latency_ns = level_latency;
+
+        while (i + 1 < result->num_points &&
+               points[i + 1].latency_ns > CLIMB_RATIO * points[i].latency_ns)
+            i++;
+        level_latency = points[i].latency_ns;
+    }
+
+    /* Whatever lies past the last knee is taken to be memory. */
+    result->levels[result->num_levels].size = 0;
+    result->levels[result->num_levels].latency_ns =
+        points[result->num_points - 1].latency_ns;
+    result->num_levels++;
+}
+
+
+/* Measures the memory hierarchy instead of trusting CPUID:  the latency of
+ * dependent loads over working sets from a few kilobytes to well past the
+ * last-level cache, the read bandwidth of each level found that way, and
+ * the memory bandwidth of 1 to max_threads threads.  CPUID's cache sizes
+ * only pick the range of working sets; pass them on to apply_calibration()
+ * to correct them.  This takes a few seconds.
+ */
+void calibrate(const cache_topology *topology, const cpu_topology *cpus,
+               unsigned int max_threads, calibration *result) {
+    unsigned int line_size = data_cache_line_size(topology);
+    unsigned int largest = 0, size, i;
+    unsigned int worker_cpus[MAX_STREAM_THREADS];
+    unsigned long long *buffer;
+
+    assert(topology != NULL && cpus != NULL && result != NULL);
+
+    for (i = 0; i < topology->num_caches; i++) {
+        if (topology->caches[i].type != CACHE_INSTRUCTION &&
+            topology->caches[i].size > largest)
+            largest = topology->caches[i].size;
+    }
+    largest = (largest > MAX_WORKING_SET / 4) ? MAX_WORKING_SET : 4 * largest;
+    if (largest < MIN_LARGEST_SET)
+        largest = MIN_LARGEST_SET;
+
+    buffer = malloc(largest);
+    if (buffer == NULL) {
+        printf("ERROR:  unable to allocate memory for calibration.\n");
+        exit(1);
+    }
+    memset(buffer, 1, largest);
+
+    /* Working sets at each power of two and halfway between powers. */
+    srand(1);
+    result->num_points = 0;
+    for (size = MIN_WORKING_SET; size <= largest &&
+         result->num_points + 2 <= MAX_CALIBRATION_POINTS; size *= 2) {
+        latency_point *point = result->points + result->num_points++;
+
+        point->size = size;
+        point->latency_ns = chase_latency(buffer, size, line_size);
+
+        if (size + size / 2 <= largest) {
+            point = result->points + result->num_points++;
+            point->size = size + size / 2;
+            point->latency_ns = chase_latency(buffer, point->size, line_size);
+        }
+    }
+
+    find_levels(result);
+
+    /* Each cache level's bandwidth is measured over half of it, so that
+     * the working set stays clear of the knee.
+     */
+    for (i = 0; i < result->num_levels; i++) {
+        measured_level *level = result->levels + i;
+
+        size = (level->size != 0) ? level->size / 2 : largest;
+        if (size < MIN_WORKING_SET)
+            size = MIN_WORKING_SET;
+        level->bandwidth_mbs = read_bandwidth(buffer, size);
+    }
+
+    if (max_threads > cpus->num_cpus)
+        max_threads = cpus->num_cpus;
+    if (max_threads > MAX_STREAM_THREADS)
+        max_threads = MAX_STREAM_THREADS;
+    if (max_threads == 0)
+        max_threads = 1;
+
+    order_cpus_for_workers(cpus, worker_cpus, max_threads);
+
+    result->num_threads = max_threads;
+    result->saturating_threads = max_threads;
+    for (i = 0; i < max_threads; i++) {
+        result->stream_mbs[i] = stream_bandwidth(buffer, largest, worker_cpus,
+                                                 i + 1);
+
+        if (i > 0 && result->saturating_threads == max_threads &&
+            result->stream_mbs[i] < 1.1 * result->stream_mbs[i - 1])
+            result->saturating_threads = i;
+    }
+
+    free(buffer);
+}
+
+
+/* Records the measured latency and bandwidth of each cache level in the
+ * topology.  Where the measured size of a level disagrees with CPUID's by
+ * more than a factor of SIZE_MISMATCH, as it can under a hypervisor, the
+ * measured size is used instead, so that suggest_tile_edge() and the other
+ * users of the topology work from what the program will actually see.
+ * Levels that CPUID doesn't report at all are added as unified caches.
+ */
+void apply_calibration(cache_topology *topology, const calibration *result) {
+    unsigned int line_size = data_cache_line_size(topology);
+    unsigned int level, i;
+
+    assert(topology != NULL && result != NULL);
+
+    for (level = 1; level < result->num_levels; level++) {
+        const measured_level *measured = result->levels + level - 1;
+        cache_info *cache = NULL;
+
+        for (i = 0; i < topology->num_caches; i++) {
+            if (topology->caches[i].level == level &&
+                topology->caches[i].type != CACHE_INSTRUCTION) {
+                cache = topology->caches + i;
+                break;
+            }
+        }
+
+        if (cache == NULL) {
+            if (topology->num_caches == MAX_CACHES)
+                break;
+
+            cache = topology->caches + topology->num_caches++;
+            memset(cache, 0, sizeof(cache_info));
+            cache->type = CACHE_UNIFIED;
+            cache->level = level;
+            cache->line_size = line_size;
+            cache->partitions = 1;
+            cache->size = measured->size;
+        }
+        else if (measured->size * SIZE_MISMATCH < cache->size ||
+                 measured->size > cache->size * SIZE_MISMATCH) {
+            cache->size = measured->size;
+        }
+
+        cache->latency_ns = measured->latency_ns;
+        cache->bandwidth_mbs = measured->bandwidth_mbs;
+        cache->flag_measured = 1;
+    }
+}
+
+
+void print_calibration(const calibration *result) {
+    const measured_level *level;
+    unsigned int i;
+
+    printf("Working set    Latency\n");
+    for (i = 0; i < result->num_points; i++) {
+        printf("%8u KB    %6.2f ns\n", result->points[i].size / 1024,
+            result->points[i].latency_ns);
+    }
+    printf("\n");
+
+    for (i = 0; i < result->num_levels; i++) {
+        level = result->levels + i;
+
+        if (level->size != 0) {
+            printf("Measured L%u:  up to %u KB, latency %.2f ns, "
+                "bandwidth %.0f MB/s\n", i + 1, level->size / 1024,
+                level->latency_ns, level->bandwidth_mbs);
+        }
+        else {
+            printf("Measured memory:  latency %.2f ns, bandwidth %.0f MB/s\n",
+                level->latency_ns, level->bandwidth_mbs);
+        }
+    }
+    printf("\n");
+
+    printf("Threads    Memory bandwidth\n");
+    for (i = 0; i < result->num_threads; i++)
+        printf("%7u    %10.0f MB/s\n", i + 1, result->stream_mbs[i]);
+    printf("Memory bandwidth stops scaling past %u thread%s\n",
+        result->saturating_threads,
+        result->saturating_threads == 1 ? "" : "s");
+}
@@ -16,6 +16,8 @@ unsigned int cpuid_0(char *vendor_string, unsigned int *max_ext_value);
 
 void cpuid_4(unsigned int ecx, regs_t *regs);
 void cpuid_n(unsigned int eax, regs_t *regs);
+void cpuid_sub(unsigned int eax, unsigned int ecx, regs_t *regs);
+unsigned int xgetbv_0(void);
 
 unsigned int num_cores_in_package(void);
 
@@ -54,7 +56,339 @@ typedef struct cpuid_1_info {
 
 void cpuid_1(cpuid_1_info *info);
 
+/* The kinds of cache that CPUID reports, as numbered by CPUID itself. */
+typedef enum cache_type_t {
+    CACHE_NONE = 0,
+    CACHE_DATA = 1,
+    CACHE_INSTRUCTION = 2,
+    CACHE_UNIFIED = 3
+} cache_type_t;
+
+
+/* One cache, as described by CPUID leaf 4 (or 0x8000001D on AMD). */
+typedef struct cache_info {
+
+    cache_type_t type;
+
+    unsigned int level;
+
+    unsigned int line_size;
+
+    unsigned int partitions;
+
+    unsigned int ways_assoc;
+
+    unsigned int n_sets;
+
+    /* The total size in bytes:  line_size * partitions * ways * sets. */
+    unsigned int size;
+
+    /* The number of logical processors that share this cache, and the
+     * number of cores in the package.
+     */
+    unsigned int shared_by;
+
+    unsigned int package_cores;
+
+    unsigned int flag_fully_assoc;
+
+    unsigned int flag_inclusive;
+
+    /* Filled in by apply_calibration():  the measured load-to-use latency
+     * in nanoseconds and read bandwidth in MB/s, or 0 if not measured.
+     */
+    double latency_ns;
+
+    double bandwidth_mbs;
+
+    unsigned int flag_measured;
+
+} cache_info;
+
+
+/* The most caches that get_cache_topology() records. */
+#define MAX_CACHES 16
+
+/* All of the caches of the processor, in the order CPUID reports them,
+ * which is normally by level.
+ */
+typedef struct cache_topology {
+
+    unsigned int num_caches;
+
+    cache_info caches[MAX_CACHES];
+
+} cache_topology;
+
+
+unsigned int get_cache_topology(cache_topology *topology);
+
+const cache_info * find_data_cache(const cache_topology *topology,
+                                   unsigned int level);
+
+unsigned int data_cache_size(const cache_topology *topology,
+                             unsigned int level);
+
+unsigned int data_cache_line_size(const cache_topology *topology);
+
+unsigned int suggest_tile_edge(const cache_topology *topology,
+                               unsigned int level, unsigned int elem_size,
+                               unsigned int num_tiles);
+
 void enumerate_caches(void);
 
+/* The instruction-set features decoded from CPUID leaves 1, 7 and
+ * 0x80000001.  Each is a bit number in cpu_features.flags.
+ */
+typedef enum cpu_feature_t {
+    FEATURE_FPU,
+    FEATURE_TSC,
+    FEATURE_CX8,
+    FEATURE_CMOV,
+    FEATURE_CLFLUSH,
+    FEATURE_MMX,
+    FEATURE_FXSR,
+    FEATURE_SSE,
+    FEATURE_SSE2,
+    FEATURE_HTT,
+    FEATURE_SSE3,
+    FEATURE_PCLMULQDQ,
+    FEATURE_SSSE3,
+    FEATURE_FMA,
+    FEATURE_CX16,
+    FEATURE_SSE4_1,
+    FEATURE_SSE4_2,
+    FEATURE_MOVBE,
+    FEATURE_POPCNT,
+    FEATURE_AES,
+    FEATURE_XSAVE,
+    FEATURE_OSXSAVE,
+    FEATURE_AVX,
+    FEATURE_F16C,
+    FEATURE_RDRAND,
+    FEATURE_BMI1,
+    FEATURE_HLE,
+    FEATURE_AVX2,
+    FEATURE_BMI2,
+    FEATURE_ERMS,
+    FEATURE_RTM,
+    FEATURE_AVX512F,
+    FEATURE_AVX512DQ,
+    FEATURE_RDSEED,
+    FEATURE_ADX,
+    FEATURE_AVX512IFMA,
+    FEATURE_CLFLUSHOPT,
+    FEATURE_AVX512PF,
+    FEATURE_AVX512ER,
+    FEATURE_AVX512CD,
+    FEATURE_SHA,
+    FEATURE_AVX512BW,
+    FEATURE_AVX512VL,
+    FEATURE_AVX512VBMI,
+    FEATURE_AVX512VBMI2,
+    FEATURE_GFNI,
+    FEATURE_VAES,
+    FEATURE_VPCLMULQDQ,
+    FEATURE_AVX512VNNI,
+    FEATURE_AVX512BITALG,
+    FEATURE_AVX512VPOPCNTDQ,
+    FEATURE_FSRM,
+    FEATURE_HYBRID,
+    FEATURE_LZCNT,
+    NUM_FEATURES
+} cpu_feature_t;
+
+
+/* The mask of a feature's bit in cpu_features.flags. */
+#define FEATURE_BIT(feature) (1ULL << (feature))
+
+
+typedef struct cpu_features {
+
+    unsigned int max_cpuid;
+
+    unsigned int max_ext_cpuid;
+
+    /* One bit for each feature that the processor supports, and that the
+     * operating system allows to be used:  the AVX and AVX-512 features are
+     * cleared unless the OS saves the YMM and ZMM register state.
+     */
+    unsigned long long flags;
+
+    unsigned int flag_os_avx;
+
+    unsigned int flag_os_avx512;
+
+} cpu_features;
+
+
+void get_cpu_features(cpu_features *features);
+
+const cpu_features * cpu_features_once(void);
+
+int has_feature(const cpu_features *features, cpu_feature_t feature);
+
+const char * feature_name(cpu_feature_t feature);
+
+
+/* One implementation of a kernel, for select_impl().  required holds the
+ * FEATURE_BIT()s of every feature that the implementation needs, and impl
+ * points to it; callers cast it back to the kernel's own type.
+ */
+typedef struct dispatch_entry {
+
+    const char *name;
+
+    unsigned long long required;
+
+    void (*impl)(void);
+
+} dispatch_entry;
+
+
+const dispatch_entry * select_impl(const dispatch_entry *table);
+
+/* The kinds of core on a hybrid processor, as numbered by CPUID leaf 0x1A.
+ * Processors that aren't hybrid have only CORE_TYPE_UNKNOWN cores.
+ */
+typedef enum cpu_core_type {
+    CORE_TYPE_UNKNOWN = 0,
+    CORE_TYPE_EFFICIENCY = 0x20,
+    CORE_TYPE_PERFORMANCE = 0x40
+} cpu_core_type;
+
+
+/* Where one logical processor sits:  its OS CPU number, its x2APIC ID (or
+ * initial APIC ID on older processors), and the IDs decoded from that.
+ * core_id is only unique within a package, and smt_id within a core.  On a
+ * hybrid processor, core_type is the kind of its core, and native_model the
+ * model ID of that kind of core's microarchitecture.
+ */
+typedef struct cpu_location {
+
+    unsigned int cpu;
+
+    unsigned int apic_id;
+
+    unsigned int smt_id;
+
+    unsigned int core_id;
+
+    unsigned int package_id;
+
+    cpu_core_type core_type;
+
+    unsigned int native_model;
+
+} cpu_location;
+
+
+/* The most logical processors that get_cpu_topology() records. */
+#define MAX_CPUS 1024
+
+typedef struct cpu_topology {
+
+    /* The APIC ID is split into SMT ID (the low smt_shift bits), core ID
+     * (up to package_shift), and package ID (the rest).
+     */
+    unsigned int smt_shift;
+
+    unsigned int package_shift;
+
+    unsigned int num_cpus;
+
+    unsigned int num_cores;
+
+    unsigned int num_packages;
+
+    /* Nonzero if the processor has more than one kind of core, and how many
+     * logical processors are of each kind.
+     */
+    unsigned int flag_hybrid;
+
+    unsigned int num_performance_cpus;
+
+    unsigned int num_efficiency_cpus;
+
+    cpu_location cpus[MAX_CPUS];
+
+} cpu_topology;
+
+
+unsigned int get_cpu_topology(cpu_topology *topology);
+
+unsigned int smt_siblings(const cpu_topology *topology, unsigned int cpu,
+                          unsigned int *siblings, unsigned int max_siblings);
+
+unsigned int order_cpus_for_workers(const cpu_topology *topology,
+                                    unsigned int *cpus, unsigned int n);
+
+unsigned int cpus_of_type(const cpu_topology *topology, cpu_core_type type,
+                          unsigned int *cpus, unsigned int max_cpus);
+
+const char * core_type_name(cpu_core_type type);
+
+/* The most working-set sizes, memory levels and stream threads that
+ * calibrate() measures.
+ */
+#define MAX_CALIBRATION_POINTS 64
+#define MAX_MEASURED_LEVELS 6
+#define MAX_STREAM_THREADS 64
+
+/* The average latency of a dependent load over a working set of size bytes. */
+typedef struct latency_point {
+
+    unsigned int size;
+
+    double latency_ns;
+
+} latency_point;
+
+
+/* One plateau of the latency curve.  size is the largest working set
+ * measured at this level's latency, or 0 for main memory.
+ */
+typedef struct measured_level {
+
+    unsigned int size;
+
+    double latency_ns;
+
+    double bandwidth_mbs;
+
+} measured_level;
+
+
+typedef struct calibration {
+
+    unsigned int num_points;
+
+    latency_point points[MAX_CALIBRATION_POINTS];
+
+    /* The cache levels in order, then main memory last. */
+    unsigned int num_levels;
+
+    measured_level levels[MAX_MEASURED_LEVELS];
+
+    /* stream_mbs[i] is the total memory bandwidth of i + 1 threads, and
+     * saturating_threads is the number past which another thread adds less
+     * than a tenth more.
+     */
+    unsigned int num_threads;
+
+    double stream_mbs[MAX_STREAM_THREADS];
+
+    unsigned int saturating_threads;
+
+} calibration;
+
+
+void calibrate(const cache_topology *topology, const cpu_topology *cpus,
+               unsigned int max_threads, calibration *result);
+
+void apply_calibration(cache_topology *topology, const calibration *result);
+
+void print_calibration(const calibration *result);
+
 #endif /* CPUID_H */
 
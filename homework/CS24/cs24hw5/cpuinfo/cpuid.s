@@ -99,6 +99,67 @@ cpuid_4:
     ret
 
 
+#=============================================================================
+# void cpuid_sub(unsigned int eax, unsigned int ecx, regs_t *regs)
+#
+#     Invokes the CPUID instruction with the specified values of %eax and
+#     %ecx, for the leaves that take a subleaf in %ecx, and stores the results
+#     into regs.
+#
+.globl _cpuid_sub
+.globl cpuid_sub
+_cpuid_sub:
+cpuid_sub:
+    pushl %ebp
+    movl  %esp, %ebp
+
+    pushl %ebx
+    pushl %edi
+
+    # Invoke CPUID with the specified values for %eax and %ecx
+    movl  8(%ebp), %eax
+    movl 12(%ebp), %ecx
+    cpuid
+
+    # Store the results into the target location
+    movl 16(%ebp), %edi
+    movl %eax,   (%edi)
+    movl %ebx,  4(%edi)
+    movl %ecx,  8(%edi)
+    movl %edx, 12(%edi)
+
+    popl %edi
+    popl %ebx
+
+    movl %ebp, %esp
+    popl %ebp
+    ret
+
+
+#=============================================================================
+# unsigned int xgetbv_0(void)
+#
+#     Reads the low 32 bits of extended control register XCR0, which say
+#     which register states the operating system saves on a context switch.
+#     The caller must check that CPUID reports OSXSAVE first, since the
+#     instruction faults otherwise.
+#
+.globl _xgetbv_0
+.globl xgetbv_0
+_xgetbv_0:
+xgetbv_0:
+    pushl %ebp
+    movl  %esp, %ebp
+
+    # XCR0 is returned in %edx:%eax; only %eax is kept
+    xorl  %ecx, %ecx
+    xgetbv
+
+    movl %ebp, %esp
+    popl %ebp
+    ret
+
+
 #=============================================================================
 # void cpuid_n(unsigned int eax, regs_t *regs)
 #
@@ -85,40 +85,174 @@ static const char * CACHE_TYPES[] = {
 };
 
 
-void enumerate_caches(void) {
-    unsigned int index;
+/* Decodes one cache descriptor from CPUID leaf 4 or 0x8000001D, which have
+ * the same layout.  Returns 0 once there are no more caches.
+ */
+static int decode_cache(const regs_t *regs, cache_info *cache) {
+    unsigned int type = regs->eax & 0x1F;
+
+    if (type == CACHE_NONE || type > CACHE_UNIFIED)
+        return 0;
+
+    cache->type = (cache_type_t) type;
+    cache->level = (regs->eax >> 5) & 0x07;
+    cache->flag_fully_assoc = (regs->eax >> 9) & 1;
+    cache->shared_by = 1 + ((regs->eax >> 14) & 0x0FFF);
+    cache->package_cores = 1 + ((regs->eax >> 26) & 0x3F);
+
+    cache->line_size = 1 + (regs->ebx & 0x0FFF);
+    cache->partitions = 1 + ((regs->ebx >> 12) & 0x3FF);
+    cache->ways_assoc = 1 + ((regs->ebx >> 22) & 0x3FF);
+    cache->n_sets = 1 + regs->ecx;
+
+    cache->flag_inclusive = (regs->edx >> 1) & 1;
+
+    cache->size = cache->line_size * cache->partitions * cache->ways_assoc *
+                  cache->n_sets;
+
+    cache->latency_ns = 0;
+    cache->bandwidth_mbs = 0;
+    cache->flag_measured = 0;
+
+    return 1;
+}
+
+
+/* Fills in the processor's cache topology, and returns the number of caches
+ * found.  Intel processors describe their caches with leaf 4, and AMD ones
+ * with leaf 0x8000001D; a processor with neither reports no caches.
+ */
+unsigned int get_cache_topology(cache_topology *topology) {
+    unsigned int max_cpuid, max_ext_cpuid, leaf, index;
+    char vendor_string[13];
     regs_t regs;
 
-    unsigned int cache_type, cache_level;
-    unsigned int cache_proc_ids, package_proc_ids;
-    unsigned int line_size, partitions, ways_assoc, n_sets;
+    assert(topology != NULL);
 
-    index = 0;
-    while (1) {
-        cpuid_4(index, &regs);
+    topology->num_caches = 0;
 
-        cache_type = regs.eax & 0x1F;
-        if (cache_type == 0)
+    max_cpuid = cpuid_0(vendor_string, &max_ext_cpuid);
+    if (max_cpuid >= 4)
+        leaf = 4;
+    else if (max_ext_cpuid >= 0x8000001D)
+        leaf = 0x8000001D;
+    else
+        return 0;
+
+    for (index = 0; index < MAX_CACHES; index++) {
+        cpuid_sub(leaf, index, &regs);
+        if (!decode_cache(&regs, topology->caches + index))
             break;
 
-        cache_level = (regs.eax >> 5) & 0x07;
+        topology->num_caches++;
+    }
+
+    /* AMD processors also answer leaf 4 on some models, but with nothing
+     * in it.
+     */
+    if (topology->num_caches == 0 && leaf == 4 &&
+        max_ext_cpuid >= 0x8000001D) {
+        for (index = 0; index < MAX_CACHES; index++) {
+            cpuid_sub(0x8000001D, index, &regs);
+            if (!decode_cache(&regs, topology->caches + index))
+                break;
 
-        cache_proc_ids = 1 + (regs.eax >> 14) & 0x0FFF;
-        package_proc_ids = 1 + (regs.eax >> 26) & 0x3F;
+            topology->num_caches++;
+        }
+    }
 
-        line_size = 1 + regs.ebx & 0x0FFF;
-        partitions = 1 + (regs.ebx >> 12) & 0x3FF;
-        ways_assoc = 1 + (regs.ebx >> 22) & 0x3FF;
-        n_sets = 1 + regs.ecx;
+    return topology->num_caches;
+}
 
-        printf("Cache index %u:  type %u (%s), level %u, procIDs %u, "
-            "totIDs %u\n", index, cache_type, CACHE_TYPES[cache_type],
-            cache_level, cache_proc_ids, package_proc_ids);
-        printf("    Line size %uB, partitions %u, associativity %u, sets %u\n",
-            line_size, partitions, ways_assoc, n_sets);
-        printf("    Cache size:  %u bytes\n", line_size * ways_assoc * n_sets);
 
-        index++;
+/* Returns the data or unified cache at the specified level, or NULL if there
+ * is no such cache.
+ */
+const cache_info * find_data_cache(const cache_topology *topology,
+                                   unsigned int level) {
+    unsigned int i;
+
+    assert(topology != NULL);
+
+    for (i = 0; i < topology->num_caches; i++) {
+        const cache_info *cache = topology->caches + i;
+
+        if (cache->level == level && cache->type != CACHE_INSTRUCTION)
+            return cache;
+    }
+
+    return NULL;
+}
+
+
+/* Returns the size in bytes of the data or unified cache at the specified
+ * level, or 0 if there is no such cache.
+ */
+unsigned int data_cache_size(const cache_topology *topology,
+                             unsigned int level) {
+    const cache_info *cache = find_data_cache(topology, level);
+    return cache != NULL ? cache->size : 0;
+}
+
+
+/* Returns the line size of the first-level data cache, or 64 if the
+ * processor doesn't report one.
+ */
+unsigned int data_cache_line_size(const cache_topology *topology) {
+    const cache_info *cache = find_data_cache(topology, 1);
+    return cache != NULL ? cache->line_size : 64;
+}
+
+
+/* Returns the edge length, in elements, of the largest square tiles of
+ * elem_size-byte elements such that num_tiles of them fill no more than half
+ * of the data cache at the specified level.  The other half is left for
+ * everything else the program touches.  The edge is rounded down to a whole
+ * number of cache lines where possible, and is at least 1; if there is no
+ * cache at that level, 0 is returned.
+ */
+unsigned int suggest_tile_edge(const cache_topology *topology,
+                               unsigned int level, unsigned int elem_size,
+                               unsigned int num_tiles) {
+    unsigned int size = data_cache_size(topology, level);
+    unsigned int line_elems, edge;
+
+    assert(elem_size > 0 && num_tiles > 0);
+
+    if (size == 0)
+        return 0;
+
+    /* The largest edge whose num_tiles tiles fit in half of the cache. */
+    edge = 1;
+    while ((unsigned long long) (edge + 1) * (edge + 1) * elem_size *
+           num_tiles <= size / 2) {
+        edge++;
     }
+
+    line_elems = data_cache_line_size(topology) / elem_size;
+    if (line_elems > 1 && edge >= line_elems)
+        edge -= edge % line_elems;
+
+    return edge;
 }
 
+
+void enumerate_caches(void) {
+    cache_topology topology;
+    unsigned int index;
+
+    get_cache_topology(&topology);
+
+    for (index = 0; index < topology.num_caches; index++) {
+        const cache_info *cache = topology.caches + index;
+
+        printf("Cache index %u:  type %u (%s), level %u, procIDs %u, "
+            "cores %u\n", index, cache->type, CACHE_TYPES[cache->type],
+            cache->level, cache->shared_by, cache->package_cores);
+        printf("    Line size %uB, partitions %u, associativity %u, sets %u"
+            "%s%s\n", cache->line_size, cache->partitions, cache->ways_assoc,
+            cache->n_sets, cache->flag_fully_assoc ? ", fully associative" : "",
+            cache->flag_inclusive ? ", inclusive" : "");
+        printf("    Cache size:  %u bytes\n", cache->size);
+    }
+}
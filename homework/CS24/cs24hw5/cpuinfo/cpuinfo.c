@@ -1,11 +1,71 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "cpuid.h"
 
 
-int main() {
+/* Two implementations of a small kernel, to show select_impl() choosing
+ * between them.
+ */
+typedef unsigned int (*popcount_fn)(unsigned int);
+
+static unsigned int popcount_portable(unsigned int x) {
+    unsigned int n = 0;
+
+    while (x != 0) {
+        x &= x - 1;
+        n++;
+    }
+    return n;
+}
+
+__attribute__((target("popcnt")))
+static unsigned int popcount_popcnt(unsigned int x) {
+    return __builtin_popcount(x);
+}
+
+static const dispatch_entry POPCOUNT_IMPLS[] = {
+    { "popcnt", FEATURE_BIT(FEATURE_POPCNT), (void (*)(void)) popcount_popcnt },
+    { "portable", 0, (void (*)(void)) popcount_portable }
+};
+
+
+static void usage(const char *progname) {
+    printf("usage: %s [-c [threads]]\n\n", progname);
+    printf("\t-c  also measure the cache latencies and bandwidths, and the\n");
+    printf("\t    memory bandwidth of up to threads threads (default one per\n");
+    printf("\t    logical processor)\n");
+}
+
+
+int main(int argc, char **argv) {
     unsigned int max_cpuid, max_ext_cpuid;
     char vendor_string[13];
     cpuid_1_info info1;
+    cache_topology topology;
+    const cpu_features *features;
+    const dispatch_entry *impl;
+    static cpu_topology cpu_topo;
+    static unsigned int worker_cpus[MAX_CPUS];
+    static calibration calib;
+    unsigned int i, n, max_threads = MAX_STREAM_THREADS;
+    int do_calibrate = 0;
+
+    if (argc > 1) {
+        if (strcmp(argv[1], "-c") != 0 || argc > 3) {
+            usage(argv[0]);
+            return 1;
+        }
+        do_calibrate = 1;
+
+        if (argc == 3) {
+            max_threads = (unsigned int) atoi(argv[2]);
+            if (max_threads == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+    }
 
     max_cpuid = cpuid_0(vendor_string, &max_ext_cpuid);
 
@@ -43,7 +103,72 @@ int main() {
         info1.flag_multithreading ? "yes" : "no");
     printf("\n");
 
+    features = cpu_features_once();
+    printf("Instruction-set features:");
+    n = 0;
+    for (i = 0; i < NUM_FEATURES; i++) {
+        if (!has_feature(features, i))
+            continue;
+
+        if (n++ % 10 == 0)
+            printf("\n   ");
+        printf(" %s", feature_name(i));
+    }
+    printf("\n");
+    printf("OS saves AVX state:  %s    AVX-512 state:  %s\n",
+        features->flag_os_avx ? "yes" : "no",
+        features->flag_os_avx512 ? "yes" : "no");
+
+    impl = select_impl(POPCOUNT_IMPLS);
+    printf("Selected popcount implementation:  %s (popcount(0xF0F0) = %u)\n",
+        impl->name, ((popcount_fn) impl->impl)(0xF0F0));
+    printf("\n");
+
     enumerate_caches();
+    printf("\n");
+
+    get_cpu_topology(&cpu_topo);
+    printf("Logical processors:  %u in %u cores and %u packages "
+        "(SMT shift %u, package shift %u)\n", cpu_topo.num_cpus,
+        cpu_topo.num_cores, cpu_topo.num_packages, cpu_topo.smt_shift,
+        cpu_topo.package_shift);
+    if (cpu_topo.flag_hybrid) {
+        printf("Hybrid:  %u on performance cores, %u on efficiency cores\n",
+            cpu_topo.num_performance_cpus, cpu_topo.num_efficiency_cpus);
+    }
+    for (i = 0; i < cpu_topo.num_cpus; i++) {
+        const cpu_location *loc = cpu_topo.cpus + i;
+        printf("    CPU %u:  APIC ID %u, package %u, core %u, thread %u",
+            loc->cpu, loc->apic_id, loc->package_id, loc->core_id,
+            loc->smt_id);
+        if (loc->core_type != CORE_TYPE_UNKNOWN)
+            printf(", %s core (native model 0x%06X)",
+                core_type_name(loc->core_type), loc->native_model);
+        printf("\n");
+    }
+
+    n = order_cpus_for_workers(&cpu_topo, worker_cpus, MAX_CPUS);
+    printf("Order to pin workers in:");
+    for (i = 0; i < n; i++)
+        printf(" %u", worker_cpus[i]);
+    printf("\n\n");
+
+    get_cache_topology(&topology);
+    printf("Suggested tile edge for 3 tiles of 4-byte elements:  "
+        "L1 %u, L2 %u\n", suggest_tile_edge(&topology, 1, 4, 3),
+        suggest_tile_edge(&topology, 2, 4, 3));
+
+    if (do_calibrate) {
+        printf("\n");
+        calibrate(&topology, &cpu_topo, max_threads, &calib);
+        print_calibration(&calib);
+
+        apply_calibration(&topology, &calib);
+        printf("\n");
+        printf("Suggested tile edge from the measured caches:  "
+            "L1 %u, L2 %u\n", suggest_tile_edge(&topology, 1, 4, 3),
+            suggest_tile_edge(&topology, 2, 4, 3));
+    }
 
     return 0;
 }
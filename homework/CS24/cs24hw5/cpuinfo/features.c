@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "cpuid.h"
+
+
+/* The registers that CPUID returns, for the table of feature bits. */
+typedef enum reg_name_t {
+    REG_EAX,
+    REG_EBX,
+    REG_ECX,
+    REG_EDX
+} reg_name_t;
+
+
+/* Where each feature's bit comes from.  The table is in the same order as
+ * cpu_feature_t.
+ */
+typedef struct feature_bit {
+    cpu_feature_t feature;
+    unsigned int leaf;
+    reg_name_t reg;
+    unsigned int bit;
+    const char *name;
+} feature_bit;
+
+
+static const feature_bit FEATURE_BITS[] = {
+    { FEATURE_FPU, 1, REG_EDX, 0, "fpu" },
+    { FEATURE_TSC, 1, REG_EDX, 4, "tsc" },
+    { FEATURE_CX8, 1, REG_EDX, 8, "cx8" },
+    { FEATURE_CMOV, 1, REG_EDX, 15, "cmov" },
+    { FEATURE_CLFLUSH, 1, REG_EDX, 19, "clflush" },
+    { FEATURE_MMX, 1, REG_EDX, 23, "mmx" },
+    { FEATURE_FXSR, 1, REG_EDX, 24, "fxsr" },
+    { FEATURE_SSE, 1, REG_EDX, 25, "sse" },
+    { FEATURE_SSE2, 1, REG_EDX, 26, "sse2" },
+    { FEATURE_HTT, 1, REG_EDX, 28, "htt" },
+    { FEATURE_SSE3, 1, REG_ECX, 0, "sse3" },
+    { FEATURE_PCLMULQDQ, 1, REG_ECX, 1, "pclmulqdq" },
+    { FEATURE_SSSE3, 1, REG_ECX, 9, "ssse3" },
+    { FEATURE_FMA, 1, REG_ECX, 12, "fma" },
+    { FEATURE_CX16, 1, REG_ECX, 13, "cx16" },
+    { FEATURE_SSE4_1, 1, REG_ECX, 19, "sse4.1" },
+    { FEATURE_SSE4_2, 1, REG_ECX, 20, "sse4.2" },
+    { FEATURE_MOVBE, 1, REG_ECX, 22, "movbe" },
+    { FEATURE_POPCNT, 1, REG_ECX, 23, "popcnt" },
+    { FEATURE_AES, 1, REG_ECX, 25, "aes" },
+    { FEATURE_XSAVE, 1, REG_ECX, 26, "xsave" },
+    { FEATURE_OSXSAVE, 1, REG_ECX, 27, "osxsave" },
+    { FEATURE_AVX, 1, REG_ECX, 28, "avx" },
+    { FEATURE_F16C, 1, REG_ECX, 29, "f16c" },
+    { FEATURE_RDRAND, 1, REG_ECX, 30, "rdrand" },
+    { FEATURE_BMI1, 7, REG_EBX, 3, "bmi1" },
+    { FEATURE_HLE, 7, REG_EBX, 4, "hle" },
+    { FEATURE_AVX2, 7, REG_EBX, 5, "avx2" },
+    { FEATURE_BMI2, 7, REG_EBX, 8, "bmi2" },
+    { FEATURE_ERMS, 7, REG_EBX, 9, "erms" },
+    { FEATURE_RTM, 7, REG_EBX, 11, "rtm" },
+    { FEATURE_AVX512F, 7, REG_EBX, 16, "avx512f" },
+    { FEATURE_AVX512DQ, 7, REG_EBX, 17, "avx512dq" },
+    { FEATURE_RDSEED, 7, REG_EBX, 18, "rdseed" },
+    { FEATURE_ADX, 7, REG_EBX, 19, "adx" },
+    { FEATURE_AVX512IFMA, 7, REG_EBX, 21, "avx512ifma" },
+    { FEATURE_CLFLUSHOPT, 7, REG_EBX, 23, "clflushopt" },
+    { FEATURE_AVX512PF, 7, REG_EBX, 26, "avx512pf" },
+    { FEATURE_AVX512ER, 7, REG_EBX, 27, "avx512er" },
+    { FEATURE_AVX512CD, 7, REG_EBX, 28, "avx512cd" },
+    { FEATURE_SHA, 7, REG_EBX, 29, "sha" },
+    { FEATURE_AVX512BW, 7, REG_EBX, 30, "avx512bw" },
+    { FEATURE_AVX512VL, 7, REG_EBX, 31, "avx512vl" },
+    { FEATURE_AVX512VBMI, 7, REG_ECX, 1, "avx512vbmi" },
+    { FEATURE_AVX512VBMI2, 7, REG_ECX, 6, "avx512vbmi2" },
+    { FEATURE_GFNI, 7, REG_ECX, 8, "gfni" },
+    { FEATURE_VAES, 7, REG_ECX, 9, "vaes" },
+    { FEATURE_VPCLMULQDQ, 7, REG_ECX, 10, "vpclmulqdq" },
+    { FEATURE_AVX512VNNI, 7, REG_ECX, 11, "avx512vnni" },
+    { FEATURE_AVX512BITALG, 7, REG_ECX, 12, "avx512bitalg" },
+    { FEATURE_AVX512VPOPCNTDQ, 7, REG_ECX, 14, "avx512vpopcntdq" },
+    { FEATURE_FSRM, 7, REG_EDX, 4, "fsrm" },
+    { FEATURE_HYBRID, 7, REG_EDX, 15, "hybrid" },
+    { FEATURE_LZCNT, 0x80000001, REG_ECX, 5, "lzcnt" },
+};
+
+
+/* XCR0 bits:  the SSE and AVX (YMM) state, and the AVX-512 opmask and ZMM
+ * state.
+ */
+#define XCR0_AVX 0x06
+#define XCR0_AVX512 0xE6
+
+
+/* The features that need the OS to save the YMM or ZMM state. */
+#define AVX_FEATURES (FEATURE_BIT(FEATURE_AVX) | FEATURE_BIT(FEATURE_AVX2) | \
+    FEATURE_BIT(FEATURE_FMA) | FEATURE_BIT(FEATURE_F16C) | \
+    FEATURE_BIT(FEATURE_VAES) | FEATURE_BIT(FEATURE_VPCLMULQDQ))
+
+#define AVX512_FEATURES (FEATURE_BIT(FEATURE_AVX512F) | \
+    FEATURE_BIT(FEATURE_AVX512DQ) | FEATURE_BIT(FEATURE_AVX512IFMA) | \
+    FEATURE_BIT(FEATURE_AVX512PF) | FEATURE_BIT(FEATURE_AVX512ER) | \
+    FEATURE_BIT(FEATURE_AVX512CD) | FEATURE_BIT(FEATURE_AVX512BW) | \
+    FEATURE_BIT(FEATURE_AVX512VL) | FEATURE_BIT(FEATURE_AVX512VBMI) | \
+    FEATURE_BIT(FEATURE_AVX512VBMI2) | FEATURE_BIT(FEATURE_AVX512VNNI) | \
+    FEATURE_BIT(FEATURE_AVX512BITALG) | \
+    FEATURE_BIT(FEATURE_AVX512VPOPCNTDQ))
+
+
+static unsigned int reg_value(const regs_t *regs, reg_name_t reg) {
+    switch (reg) {
+    case REG_EAX:
+        return regs->eax;
+    case REG_EBX:
+        return regs->ebx;
+    case REG_ECX:
+        return regs->ecx;
+    default:
+        return regs->edx;
+    }
+}
+
+
+/* Decodes the feature bits of CPUID leaves 1, 7 (subleaf 0) and 0x80000001,
+ * for the leaves that the processor supports.
+ */
+void get_cpu_features(cpu_features *features) {
+    char vendor_string[13];
+    regs_t leaf_1, leaf_7, leaf_ext_1;
+    const regs_t *regs;
+    unsigned int i, xcr0;
+
+    assert(features != NULL);
+
+    features->max_cpuid = cpuid_0(vendor_string, &features->max_ext_cpuid);
+    features->flags = 0;
+    features->flag_os_avx = 0;
+    features->flag_os_avx512 = 0;
+
+    /* Leaves that the processor doesn't support read as all zeros. */
+    leaf_1.eax = leaf_1.ebx = leaf_1.ecx = leaf_1.edx = 0;
+    leaf_7 = leaf_1;
+    leaf_ext_1 = leaf_1;
+
+    if (features->max_cpuid >= 1)
+        cpuid_n(1, &leaf_1);
+    if (features->max_cpuid >= 7)
+        cpuid_sub(7, 0, &leaf_7);
+    if (features->max_ext_cpuid >= 0x80000001)
+        cpuid_n(0x80000001, &leaf_ext_1);
+
+    for (i = 0; i < NUM_FEATURES; i++) {
+        const feature_bit *fb = FEATURE_BITS + i;
+
+        assert(fb->feature == i);
+
+        if (fb->leaf == 1)
+            regs = &leaf_1;
+        else if (fb->leaf == 7)
+            regs = &leaf_7;
+        else
+            regs = &leaf_ext_1;
+
+        if ((reg_value(regs, fb->reg) >> fb->bit) & 1)
+            features->flags |= FEATURE_BIT(fb->feature);
+    }
+
+    /* The vector registers can only be used if the OS saves them. */
+    if (features->flags & FEATURE_BIT(FEATURE_OSXSAVE)) {
+        xcr0 = xgetbv_0();
+        features->flag_os_avx = (xcr0 & XCR0_AVX) == XCR0_AVX;
+        features->flag_os_avx512 = (xcr0 & XCR0_AVX512) == XCR0_AVX512;
+    }
+
+    if (!features->flag_os_avx)
+        features->flags &= ~(AVX_FEATURES | AVX512_FEATURES);
+    else if (!features->flag_os_avx512)
+        features->flags &= ~AVX512_FEATURES;
+}
+
+
+/* Returns the features of the processor, decoding them on the first call
+ * only, so that kernels can look them up cheaply at startup.
+ */
+const cpu_features * cpu_features_once(void) {
+    static cpu_features features;
+    static int decoded = 0;
+
+    if (!decoded) {
+        get_cpu_features(&features);
+        decoded = 1;
+    }
+
+    return &features;
+}
+
+
+int has_feature(const cpu_features *features, cpu_feature_t feature) {
+    assert(features != NULL);
+    assert(feature < NUM_FEATURES);
+
+    return (features->flags & FEATURE_BIT(feature)) != 0;
+}
+
+
+const char * feature_name(cpu_feature_t feature) {
+    if (feature >= NUM_FEATURES)
+        return NULL;
+
+    return FEATURE_BITS[feature].name;
+}
+
+
+/* Returns the first entry of table whose required features are all
+ * supported.  The table lists the implementations best first, and ends with
+ * a portable one that requires nothing, so there is always an answer.
+ */
+const dispatch_entry * select_impl(const dispatch_entry *table) {
+    const cpu_features *features = cpu_features_once();
+
+    assert(table != NULL);
+
+    while ((table->required & ~features->flags) != 0) {
+        assert(table->required != 0);
+        table++;
+    }
+
+    return table;
+}
@@ -0,0 +1,374 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "cpuid.h"
+
+
+/* The level types reported in bits 15:8 of %ecx by leaves 0xB and 0x1F. */
+#define LEVEL_INVALID 0
+#define LEVEL_SMT 1
+
+
+/* The leaf with the core type of a hybrid processor's logical processors. */
+#define LEAF_HYBRID 0x1A
+
+
+/* Returns the number of bits needed to number n things. */
+static unsigned int id_bits(unsigned int n) {
+    unsigned int bits = 0;
+
+    while ((1U << bits) < n)
+        bits++;
+    return bits;
+}
+
+
+/* Finds how the x2APIC ID is split into SMT, core and package IDs.  Leaf
+ * 0x1F is preferred, since it also reports modules, tiles and dies; those
+ * are counted as part of the core ID here.  Returns the APIC ID of the
+ * processor that the caller is running on.
+ */
+static unsigned int read_apic_layout(cpu_topology *topology) {
+    unsigned int max_cpuid, max_ext_cpuid, leaf, level, type;
+    char vendor_string[13];
+    cpuid_1_info info1;
+    regs_t regs;
+
+    max_cpuid = cpuid_0(vendor_string, &max_ext_cpuid);
+
+    leaf = 0;
+    if (max_cpuid >= 0x1F) {
+        cpuid_sub(0x1F, 0, &regs);
+        if (regs.ebx != 0)
+            leaf = 0x1F;
+    }
+    if (leaf == 0 && max_cpuid >= 0xB) {
+        cpuid_sub(0xB, 0, &regs);
+        if (regs.ebx != 0)
+            leaf = 0xB;
+    }
+
+    if (leaf != 0) {
+        topology->smt_shift = 0;
+        topology->package_shift = 0;
+
+        for (level = 0; ; level++) {
+            cpuid_sub(leaf, level, &regs);
+            type = (regs.ecx >> 8) & 0xFF;
+            if (type == LEVEL_INVALID)
+                break;
+
+            if (type == LEVEL_SMT)
+                topology->smt_shift = regs.eax & 0x1F;
+            topology->package_shift = regs.eax & 0x1F;
+        }
+
+        /* %edx holds the full 32-bit x2APIC ID. */
+        return regs.edx;
+    }
+
+    /* Older processors only have the 8-bit initial APIC ID, and the number
+     * of IDs and cores in the package.
+     */
+    cpuid_1(&info1);
+    if (info1.flag_multithreading) {
+        unsigned int cores = (max_cpuid >= 4) ? num_cores_in_package() : 1;
+        unsigned int ids = info1.max_addressable_ids;
+
+        if (ids < cores)
+            ids = cores;
+        topology->package_shift = id_bits(ids);
+        topology->smt_shift = id_bits((ids + cores - 1) / cores);
+    }
+    else {
+        topology->package_shift = 0;
+        topology->smt_shift = 0;
+    }
+
+    return info1.initial_apic_id;
+}
+
+
+/* Reads the core type of the processor that the caller is running on from
+ * leaf 0x1A:  the type in bits 31:24 of %eax, and the native model ID in
+ * bits 23:0.  Only hybrid processors report them.
+ */
+static void read_core_type(cpu_location *loc) {
+    const cpu_features *features = cpu_features_once();
+    regs_t regs;
+
+    loc->core_type = CORE_TYPE_UNKNOWN;
+    loc->native_model = 0;
+
+    if (!has_feature(features, FEATURE_HYBRID) ||
+        features->max_cpuid < LEAF_HYBRID)
+        return;
+
+    cpuid_sub(LEAF_HYBRID, 0, &regs);
+    switch (regs.eax >> 24) {
+    case CORE_TYPE_EFFICIENCY:
+    case CORE_TYPE_PERFORMANCE:
+        loc->core_type = (cpu_core_type) (regs.eax >> 24);
+        break;
+    default:
+        loc->core_type = CORE_TYPE_UNKNOWN;
+    }
+    loc->native_model = regs.eax & 0xFFFFFF;
+}
+
+
+/* Records the logical processor with the specified APIC ID, which must be
+ * the one that the caller is running on, for its core type.
+ */
+static void add_cpu(cpu_topology *topology, unsigned int cpu,
+                    unsigned int apic_id) {
+    cpu_location *loc = topology->cpus + topology->num_cpus++;
+    unsigned int core_bits = topology->package_shift - topology->smt_shift;
+
+    loc->cpu = cpu;
+    loc->apic_id = apic_id;
+    loc->smt_id = apic_id & ((1U << topology->smt_shift) - 1);
+    loc->core_id = (apic_id >> topology->smt_shift) & ((1U << core_bits) - 1);
+    loc->package_id = apic_id >> topology->package_shift;
+    read_core_type(loc);
+}
+
+
+/* Counts the distinct cores and packages in the table, and the logical
+ * processors of each core type.
+ */
+static void count_cores(cpu_topology *topology) {
+    unsigned int i, j;
+
+    topology->num_cores = 0;
+    topology->num_packages = 0;
+    topology->num_performance_cpus = 0;
+    topology->num_efficiency_cpus = 0;
+
+    for (i = 0; i < topology->num_cpus; i++) {
+        const cpu_location *loc = topology->cpus + i;
+        int new_core = 1, new_package = 1;
+
+        if (loc->core_type == CORE_TYPE_PERFORMANCE)
+            topology->num_performance_cpus++;
+        else if (loc->core_type == CORE_TYPE_EFFICIENCY)
+            topology->num_efficiency_cpus++;
+
+        for (j = 0; j < i; j++) {
+            if (topology->cpus[j].package_id == loc->package_id) {
+                new_package = 0;
+                if (topology->cpus[j].core_id == loc->core_id)
+                    new_core = 0;
+            }
+        }
+
+        topology->num_cores += new_core;
+        topology->num_packages += new_package;
+    }
+
+    topology->flag_hybrid = (topology->num_performance_cpus > 0 &&
+                             topology->num_efficiency_cpus > 0);
+}
+
+
+/* Fills in the table of logical processors that this process may run on,
+ * with the SMT, core and package ID and the core type of each, and returns
+ * their number.  On Linux, each processor's APIC ID is read by briefly
+ * running on it; the process's CPU affinity is restored afterward.
+ * Elsewhere only the current processor can be described.
+ */
+unsigned int get_cpu_topology(cpu_topology *topology) {
+    unsigned int apic_id;
+
+    assert(topology != NULL);
+
+    topology->num_cpus = 0;
+    apic_id = read_apic_layout(topology);
+
+#ifdef __linux__
+    {
+        cpu_set_t original, one;
+        int cpu;
+
+        if (sched_getaffinity(0, sizeof(original), &original) == 0) {
+            for (cpu = 0; cpu < CPU_SETSIZE &&
+                          topology->num_cpus < MAX_CPUS; cpu++) {
+                if (!CPU_ISSET(cpu, &original))
+                    continue;
+
+                CPU_ZERO(&one);
+                CPU_SET(cpu, &one);
+                if (sched_setaffinity(0, sizeof(one), &one) != 0)
+                    continue;
+
+                add_cpu(topology, cpu, read_apic_layout(topology));
+            }
+
+            sched_setaffinity(0, sizeof(original), &original);
+        }
+    }
+#endif
+
+    if (topology->num_cpus == 0)
+        add_cpu(topology, 0, apic_id);
+
+    count_cores(topology);
+    return topology->num_cpus;
+}
+
+
+/* Stores into siblings the OS numbers of the logical processors on the same
+ * core as the specified one, itself included, and returns how many there
+ * are.  At most max_siblings are stored.
+ */
+unsigned int smt_siblings(const cpu_topology *topology, unsigned int cpu,
+                          unsigned int *siblings, unsigned int max_siblings) {
+    const cpu_location *loc = NULL;
+    unsigned int i, n = 0;
+
+    assert(topology != NULL);
+
+    for (i = 0; i < topology->num_cpus; i++) {
+        if (topology->cpus[i].cpu == cpu)
+            loc = topology->cpus + i;
+    }
+    if (loc == NULL)
+        return 0;
+
+    for (i = 0; i < topology->num_cpus; i++) {
+        const cpu_location *other = topology->cpus + i;
+
+        if (other->package_id == loc->package_id &&
+            other->core_id == loc->core_id) {
+            if (n < max_siblings)
+                siblings[n] = other->cpu;
+            n++;
+        }
+    }
+
+    return n < max_siblings ? n : max_siblings;
+}
+
+
+/* Returns the order in which cores of a type get workers:  performance
+ * cores first, and efficiency cores last.
+ */
+static unsigned int core_type_rank(cpu_core_type type) {
+    switch (type) {
+    case CORE_TYPE_PERFORMANCE:
+        return 0;
+    case CORE_TYPE_EFFICIENCY:
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+
+/* Returns nonzero if processor a should be given a worker before b:  first
+ * by its rank among its core's SMT siblings, then by core type, then by
+ * package and core.
+ */
+static int pins_before(const cpu_location *a, unsigned int rank_a,
+                       const cpu_location *b, unsigned int rank_b) {
+    if (rank_a != rank_b)
+        return rank_a < rank_b;
+    if (a->core_type != b->core_type)
+        return core_type_rank(a->core_type) < core_type_rank(b->core_type);
+    if (a->package_id != b->package_id)
+        return a->package_id < b->package_id;
+    return a->core_id < b->core_id;
+}
+
+
+/* Stores into cpus an order in which to pin worker threads:  one logical
+ * processor of every core of the first package, then of the next package,
+ * and so on, and only then the second SMT sibling of each core in the same
+ * order, and so on.  On a hybrid processor, each round takes the
+ * performance cores before the efficiency cores.  Up to n processors are
+ * stored, and their number is returned.  A pool of k workers pinned to the
+ * first k entries shares no core until it has to, and only spreads to
+ * another package once the first one's cores are all busy.
+ */
+unsigned int order_cpus_for_workers(const cpu_topology *topology,
+                                    unsigned int *cpus, unsigned int n) {
+    unsigned int rank[MAX_CPUS], order[MAX_CPUS];
+    unsigned int i, j, best, tmp;
+
+    assert(topology != NULL);
+
+    /* A processor's rank is the number of its siblings with lower SMT IDs. */
+    for (i = 0; i < topology->num_cpus; i++) {
+        const cpu_location *loc = topology->cpus + i;
+
+        rank[i] = 0;
+        for (j = 0; j < topology->num_cpus; j++) {
+            const cpu_location *other = topology->cpus + j;
+
+            if (other->package_id == loc->package_id &&
+                other->core_id == loc->core_id &&
+                other->smt_id < loc->smt_id)
+                rank[i]++;
+        }
+        order[i] = i;
+    }
+
+    if (n > topology->num_cpus)
+        n = topology->num_cpus;
+
+    /* Selection sort; the table is small. */
+    for (i = 0; i < n; i++) {
+        best = i;
+        for (j = i + 1; j < topology->num_cpus; j++) {
+            if (pins_before(topology->cpus + order[j], rank[order[j]],
+                            topology->cpus + order[best], rank[order[best]]))
+                best = j;
+        }
+
+        tmp = order[i];
+        order[i] = order[best];
+        order[best] = tmp;
+
+        cpus[i] = topology->cpus[order[i]].cpu;
+    }
+
+    return n;
+}
+
+
+/* Stores into cpus the OS numbers of the logical processors whose cores are
+ * of the specified type, and returns how many there are, up to max_cpus.
+ * Latency-sensitive threads can be pinned to the CORE_TYPE_PERFORMANCE ones;
+ * on a processor that isn't hybrid, every processor is CORE_TYPE_UNKNOWN.
+ */
+unsigned int cpus_of_type(const cpu_topology *topology, cpu_core_type type,
+                          unsigned int *cpus, unsigned int max_cpus) {
+    unsigned int i, n = 0;
+
+    assert(topology != NULL);
+
+    for (i = 0; i < topology->num_cpus && n < max_cpus; i++) {
+        if (topology->cpus[i].core_type == type)
+            cpus[n++] = topology->cpus[i].cpu;
+    }
+    return n;
+}
+
+
+/* Returns the name of a core type, for printing. */
+const char * core_type_name(cpu_core_type type) {
+    switch (type) {
+    case CORE_TYPE_PERFORMANCE:
+        return "performance";
+    case CORE_TYPE_EFFICIENCY:
+        return "efficiency";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,1034 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "multimap.h"
+#include "frozen_mm.h"
+#include "key_index.h"
+#include "simd_search.h"
+#include "value_set.h"
+
+
+/* The size of a cache line.  Tree nodes are allocated on cache-line
+ * boundaries, and their keys come first, so the keys of a node always fill
+ * exactly one line.
+ */
+#define CACHE_LINE_SIZE  64
+
+/* The number of keys in every tree node.  This is the block size of the
+ * vectorized searches, so a node is searched with a single block search.
+ */
+#define NODE_KEYS  SEARCH_BLOCK_KEYS
+
+/* When this is nonzero, the multimap keeps a hash index from each key to the
+ * leaf that holds it, so point lookups skip the descent from the root.  It
+ * can be turned off by compiling with -DNO_HASH_INDEX.
+ */
+#ifdef NO_HASH_INDEX
+#define HASH_INDEX  0
+#else
+#define HASH_INDEX  1
+#endif
+
+/* mm_add_values() merges a batch into the tree by rebuilding it, unless the
+ * batch has fewer pairs than the tree has keys divided by this ratio, in
+ * which case the pairs are inserted one at a time.
+ */
+#define MERGE_RATIO  16
+
+/* mm_contains_pairs() walks this many probes down the tree together, so that
+ * their cache misses overlap.
+ */
+#define PROBE_GROUP  16
+
+
+/*============================================================================
+ * TYPES
+ *
+ *   These types are defined in the implementation file so that they can
+ *   be kept hidden to code outside this source file.  This is not for any
+ *   security reason, but rather just so we can enforce that our testing
+ *   programs are generic and don't have any access to implementation details.
+ *============================================================================*/
+
+/* An internal node of the B+ tree.  keys[i] is the smallest key stored under
+ * children[i + 1], so every key under children[i] is less than keys[i].
+ */
+typedef struct inner_node {
+    int keys[NODE_KEYS];
+    int num_keys;
+    void *children[NODE_KEYS + 1];
+} inner_node;
+
+
+/* A leaf of the B+ tree, which holds keys and their values.  The leaves are
+ * linked together in key order, so that traversals don't have to walk the
+ * internal nodes.
+ */
+typedef struct leaf_node {
+    int keys[NODE_KEYS];
+    int num_keys;
+    value_set values[NODE_KEYS];
+    struct leaf_node *next;
+} leaf_node;
+
+
+/* The entry-point of the multimap data structure. */
+struct multimap {
+    /* The root of the tree, or NULL if nothing has been added yet. */
+    void *root;
+
+    /* The number of internal-node levels above the leaves.  When this is 0,
+     * the root is a leaf.
+     */
+    int height;
+
+    /* The leaf holding the smallest keys. */
+    leaf_node *first_leaf;
+
+    /* The number of distinct keys in the multimap. */
+    int num_keys;
+
+    /* Maps each key to its leaf, if HASH_INDEX is nonzero. */
+    key_index index;
+
+    /* The file that the multimap was opened from by mm_open_readonly(), or
+     * NULL if it is an ordinary multimap.  When this is set, the tree is
+     * empty, and every query goes to the file.
+     */
+    frozen_mm *frozen;
+};
+
+
+/* A (key, value) pair, used to sort the batches given to mm_add_values(). */
+typedef struct mm_pair {
+    int key;
+    int value;
+} mm_pair;
+
+
+/* A cursor over a range of keys.  It points at the next value to return,
+ * as a leaf, a key within the leaf, and a position in that key's values.
+ * A cursor over a read-only multimap scans its file instead.
+ */
+struct mm_cursor {
+    leaf_node *leaf;
+    int index;
+    vs_iter it;
+    int hi;
+
+    const frozen_mm *frozen;
+    fm_cursor frozen_cursor;
+};
+
+
+/* Builds a new tree from keys that are added in increasing order.  The
+ * leaves are filled completely, and the internal nodes are built on top of
+ * them once all the keys have been added.
+ */
+typedef struct tree_builder {
+    leaf_node *first_leaf;
+    leaf_node *last_leaf;
+    int num_leaves;
+    int num_keys;
+} tree_builder;
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *
+ *   Declarations of helper functions that are local to this module.  Again,
+ *   these are not visible outside of this module.
+ *============================================================================*/
+
+void * alloc_tree_node(size_t size);
+leaf_node * find_leaf(multimap *mm, int key);
+int find_in_leaf(leaf_node *leaf, int key);
+value_set * find_values(multimap *mm, int key);
+value_set * insert_key(multimap *mm, int key);
+void split_child(multimap *mm, inner_node *parent, int index,
+                 int child_is_leaf);
+void free_tree_node(void *node, int height, int free_values);
+
+/* bulk-loading functions. */
+void init_tree_builder(tree_builder *tb);
+value_set * builder_add_key(tree_builder *tb, int key, value_set *values);
+int builder_add_run(tree_builder *tb, const mm_pair *pairs, int i, int n);
+void builder_finish(tree_builder *tb, multimap *mm);
+void sort_pairs(mm_pair *pairs, int n);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Allocates a zeroed tree node of the specified size, aligned to a cache
+ * line.
+ */
+void * alloc_tree_node(size_t size) {
+    void *node;
+
+    /* aligned_alloc() requires the size to be a multiple of the alignment. */
+    size = (size + CACHE_LINE_SIZE - 1) & ~(size_t) (CACHE_LINE_SIZE - 1);
+    node = aligned_alloc(CACHE_LINE_SIZE, size);
+    if (node == NULL) {
+        printf("error: unable to allocate memory for tree node.\n");
+        abort();
+    }
+
+    memset(node, 0, size);
+    return node;
+}
+
+
+/* Returns the index of the child of an internal node that would hold key. */
+static inline int find_child(inner_node *node, int key) {
+    return count_keys_less_equal(node->keys, node->num_keys, key);
+}
+
+
+/* Returns the index of the first key in the leaf that isn't less than key.
+ * This is where the key is, or where it would be inserted.
+ */
+static inline int find_slot(leaf_node *leaf, int key) {
+    return count_keys_less(leaf->keys, leaf->num_keys, key);
+}
+
+
+/* Returns the leaf that would hold key, or NULL if the multimap is empty. */
+leaf_node * find_leaf(multimap *mm, int key) {
+    void *node = mm->root;
+    int level;
+
+    if (node == NULL)
+        return NULL;
+
+    for (level = mm->height; level > 0; level--)
+        node = ((inner_node *) node)->children[find_child(node, key)];
+
+    return (leaf_node *) node;
+}
+
+
+/* Returns the index of key within the leaf, or -1 if it isn't there. */
+int find_in_leaf(leaf_node *leaf, int key) {
+    int i = find_slot(leaf, key);
+    if (i < leaf->num_keys && leaf->keys[i] == key)
+        return i;
+    return -1;
+}
+
+
+/* Returns the values of the specified key, or NULL if the key is not in the
+ * multimap.  With the hash index, the key's leaf is looked up directly, and
+ * a key that isn't in the index isn't in the tree either.
+ */
+value_set * find_values(multimap *mm, int key) {
+    leaf_node *leaf;
+    int i;
+
+    if (HASH_INDEX)
+        leaf = ki_find(&mm->index, key);
+    else
+        leaf = find_leaf(mm, key);
+
+    if (leaf == NULL)
+        return NULL;
+
+    i = find_in_leaf(leaf, key);
+    return (i >= 0) ? &leaf->values[i] : NULL;
+}
+
+
+/* Splits the full child at the specified index of parent into two nodes, and
+ * adds the separating key to parent, which must not be full.  A leaf keeps
+ * the separating key, as the first key of the new right-hand leaf; an
+ * internal node moves it up into parent.  The keys that move to a new leaf
+ * are updated in the hash index.
+ */
+void split_child(multimap *mm, inner_node *parent, int index,
+                 int child_is_leaf) {
+    int mid = NODE_KEYS / 2, separator, i;
+    void *right;
+
+    assert(parent->num_keys < NODE_KEYS);
+
+    if (child_is_leaf) {
+        leaf_node *left = parent->children[index];
+        leaf_node *new_leaf = alloc_tree_node(sizeof(leaf_node));
+
+        assert(left->num_keys == NODE_KEYS);
+
+        new_leaf->num_keys = NODE_KEYS - mid;
+        memcpy(new_leaf->keys, left->keys + mid,
+               new_leaf->num_keys * sizeof(int));
+        memcpy(new_leaf->values, left->values + mid,
+               new_leaf->num_keys * sizeof(value_set));
+        left->num_keys = mid;
+
+        if (HASH_INDEX) {
+            for (i = 0; i < new_leaf->num_keys; i++)
+                ki_set(&mm->index, new_leaf->keys[i], new_leaf);
+        }
+
+        new_leaf->next = left->next;
+        left->next = new_leaf;
+
+        separator = new_leaf->keys[0];
+        right = new_leaf;
+    }
+    else {
+        inner_node *left = parent->children[index];
+        inner_node *new_inner = alloc_tree_node(sizeof(inner_node));
+
+        assert(left->num_keys == NODE_KEYS);
+
+        new_inner->num_keys = NODE_KEYS - mid - 1;
+        memcpy(new_inner->keys, left->keys + mid + 1,
+               new_inner->num_keys * sizeof(int));
+        memcpy(new_inner->children, left->children + mid + 1,
+               (new_inner->num_keys + 1) * sizeof(void *));
+        left->num_keys = mid;
+
+        separator = left->keys[mid];
+        right = new_inner;
+    }
+
+    /* Make room in the parent for the separator and the new child. */
+    memmove(parent->keys + index + 1, parent->keys + index,
+            (parent->num_keys - index) * sizeof(int));
+    memmove(parent->children + index + 2, parent->children + index + 1,
+            (parent->num_keys - index) * sizeof(void *));
+    parent->keys[index] = separator;
+    parent->children[index + 1] = right;
+    parent->num_keys++;
+}
+
+
+/* Returns the values of the specified key, adding the key to the multimap
+ * first if it isn't already there.  Full nodes are split on the way down, so
+ * that there is always room in the parent for a node that has to be split.
+ */
+value_set * insert_key(multimap *mm, int key) {
+    void *node;
+    leaf_node *leaf;
+    int level, i;
+
+    /* A key that is already there can be found without the descent. */
+    if (HASH_INDEX) {
+        value_set *vs = find_values(mm, key);
+        if (vs != NULL)
+            return vs;
+    }
+
+    if (mm->root == NULL) {
+        leaf = alloc_tree_node(sizeof(leaf_node));
+        mm->root = leaf;
+        mm->first_leaf = leaf;
+        mm->height = 0;
+    }
+
+    /* Grow a new root if the old one is full.  (Leaves and internal nodes
+     * both start with the same fields, so either can be tested this way.)
+     */
+    if (((inner_node *) mm->root)->num_keys == NODE_KEYS) {
+        inner_node *new_root = alloc_tree_node(sizeof(inner_node));
+        new_root->children[0] = mm->root;
+        split_child(mm, new_root, 0, mm->height == 0);
+        mm->root = new_root;
+        mm->height++;
+    }
+
+    node = mm->root;
+    for (level = mm->height; level > 0; level--) {
+        inner_node *inner = (inner_node *) node;
+
+        i = find_child(inner, key);
+        if (((inner_node *) inner->children[i])->num_keys == NODE_KEYS) {
+            split_child(mm, inner, i, level == 1);
+            if (key >= inner->keys[i])
+                i++;
+        }
+        node = inner->children[i];
+    }
+
+    leaf = (leaf_node *) node;
+    i = find_slot(leaf, key);
+    if (i < leaf->num_keys && leaf->keys[i] == key)
+        return &leaf->values[i];
+
+    assert(leaf->num_keys < NODE_KEYS);
+    memmove(leaf->keys + i + 1, leaf->keys + i,
+            (leaf->num_keys - i) * sizeof(int));
+    memmove(leaf->values + i + 1, leaf->values + i,
+            (leaf->num_keys - i) * sizeof(value_set));
+    leaf->keys[i] = key;
+    vs_init(&leaf->values[i]);
+    leaf->num_keys++;
+    mm->num_keys++;
+
+    if (HASH_INDEX)
+        ki_set(&mm->index, key, leaf);
+
+    return &leaf->values[i];
+}
+
+
+/* This helper function frees a tree node, along with everything under it.
+ * The height is the number of internal-node levels at and below the node.
+ * The value sets in the leaves are only freed if free_values is nonzero.
+ */
+void free_tree_node(void *node, int height, int free_values) {
+    int i;
+
+    if (height > 0) {
+        inner_node *inner = (inner_node *) node;
+        for (i = 0; i <= inner->num_keys; i++)
+            free_tree_node(inner->children[i], height - 1, free_values);
+    }
+    else if (free_values) {
+        leaf_node *leaf = (leaf_node *) node;
+        for (i = 0; i < leaf->num_keys; i++)
+            vs_free(&leaf->values[i]);
+    }
+
+    free(node);
+}
+
+
+/* Initializes a builder for a tree with no keys. */
+void init_tree_builder(tree_builder *tb) {
+    tb->first_leaf = NULL;
+    tb->last_leaf = NULL;
+    tb->num_leaves = 0;
+    tb->num_keys = 0;
+}
+
+
+/* Adds a key to the tree being built, which must be greater than every key
+ * added so far.  If values is not NULL, the key takes over that value set;
+ * otherwise it gets a new empty list.  Returns the key's values.
+ */
+value_set * builder_add_key(tree_builder *tb, int key, value_set *values) {
+    leaf_node *leaf = tb->last_leaf;
+
+    assert(leaf == NULL || leaf->num_keys == 0 ||
+           leaf->keys[leaf->num_keys - 1] < key);
+
+    if (leaf == NULL || leaf->num_keys == NODE_KEYS) {
+        leaf = alloc_tree_node(sizeof(leaf_node));
+        if (tb->last_leaf != NULL)
+            tb->last_leaf->next = leaf;
+        else
+            tb->first_leaf = leaf;
+        tb->last_leaf = leaf;
+        tb->num_leaves++;
+    }
+
+    leaf->keys[leaf->num_keys] = key;
+    if (values != NULL)
+        leaf->values[leaf->num_keys] = *values;
+    else
+        vs_init(&leaf->values[leaf->num_keys]);
+    tb->num_keys++;
+
+    return &leaf->values[leaf->num_keys++];
+}
+
+
+/* Adds the key of pairs[i] to the tree being built, with the values of all
+ * the pairs that follow it with the same key.  Returns the index of the
+ * first pair with a different key.
+ */
+int builder_add_run(tree_builder *tb, const mm_pair *pairs, int i, int n) {
+    int key = pairs[i].key;
+    value_set *vs = builder_add_key(tb, key, NULL);
+
+    while (i < n && pairs[i].key == key)
+        vs_add(vs, pairs[i++].value);
+
+    return i;
+}
+
+
+/* Builds the internal nodes above the leaves that have been added, and makes
+ * the result the contents of the multimap, which must be empty.  Each level
+ * is built from the one below it, with the children shared out as evenly as
+ * possible between the fewest nodes that can hold them.  The hash index is
+ * rebuilt from the new leaves.
+ */
+void builder_finish(tree_builder *tb, multimap *mm) {
+    void **level;
+    int *min_keys;
+    leaf_node *leaf;
+    int n, i, parent, height = 0;
+
+    assert(mm->root == NULL);
+
+    if (HASH_INDEX)
+        ki_free(&mm->index);
+
+    if (tb->num_leaves == 0)
+        return;
+
+    level = malloc(tb->num_leaves * sizeof(void *));
+    min_keys = malloc(tb->num_leaves * sizeof(int));
+    if (level == NULL || min_keys == NULL) {
+        printf("error: unable to allocate memory for tree builder.\n");
+        abort();
+    }
+
+    if (HASH_INDEX)
+        ki_reserve(&mm->index, tb->num_keys);
+
+    n = 0;
+    for (leaf = tb->first_leaf; leaf != NULL; leaf = leaf->next) {
+        level[n] = leaf;
+        min_keys[n] = leaf->keys[0];
+        n++;
+
+        if (HASH_INDEX) {
+            for (i = 0; i < leaf->num_keys; i++)
+                ki_set(&mm->index, leaf->keys[i], leaf);
+        }
+    }
+
+    /* Each level is written over the start of the one below it, which is
+     * safe since a parent never comes after its first child.
+     */
+    while (n > 1) {
+        int num_parents = (n + NODE_KEYS) / (NODE_KEYS + 1);
+        int child = 0;
+
+        for (parent = 0; parent < num_parents; parent++) {
+            inner_node *inner = alloc_tree_node(sizeof(inner_node));
+            int count = n / num_parents + (parent < n % num_parents);
+            int first_min = min_keys[child];
+
+            for (i = 0; i < count; i++, child++) {
+                inner->children[i] = level[child];
+                if (i > 0)
+                    inner->keys[i - 1] = min_keys[child];
+            }
+            inner->num_keys = count - 1;
+
+            level[parent] = inner;
+            min_keys[parent] = first_min;
+        }
+
+        n = num_parents;
+        height++;
+    }
+
+    mm->root = level[0];
+    mm->height = height;
+    mm->first_leaf = tb->first_leaf;
+    mm->num_keys = tb->num_keys;
+
+    free(level);
+    free(min_keys);
+}
+
+
+/* Sorts pairs by key with an LSD radix sort, one byte of the key per pass.
+ * The sort is stable, so values keep the order they had in the batch.
+ * Passes in which every key has the same byte are skipped, which is common
+ * when the keys span a small range.
+ */
+void sort_pairs(mm_pair *pairs, int n) {
+    mm_pair *temp = malloc(n * sizeof(mm_pair)), *from = pairs, *to = temp;
+    int counts[256], shift, i;
+
+    if (temp == NULL) {
+        printf("error: unable to allocate memory for batch.\n");
+        abort();
+    }
+
+    for (shift = 0; shift < 32; shift += 8) {
+        int total = 0;
+
+        memset(counts, 0, sizeof(counts));
+        for (i = 0; i < n; i++) {
+            /* Flipping the sign bit makes negative keys order first. */
+            unsigned int key = (unsigned int) from[i].key ^ 0x80000000u;
+            counts[(key >> shift) & 0xff]++;
+        }
+
+        if (counts[(((unsigned int) from[0].key ^ 0x80000000u) >> shift)
+                   & 0xff] == n)
+            continue;
+
+        for (i = 0; i < 256; i++) {
+            int count = counts[i];
+            counts[i] = total;
+            total += count;
+        }
+
+        for (i = 0; i < n; i++) {
+            unsigned int key = (unsigned int) from[i].key ^ 0x80000000u;
+            to[counts[(key >> shift) & 0xff]++] = from[i];
+        }
+
+        /* The output of this pass is the input of the next. */
+        from = to;
+        to = (to == temp) ? pairs : temp;
+    }
+
+    if (from != pairs)
+        memcpy(pairs, from, n * sizeof(mm_pair));
+    free(temp);
+}
+
+
+/* Initialize a multimap data structure. */
+multimap * init_multimap() {
+    multimap *mm = malloc(sizeof(multimap));
+    mm->root = NULL;
+    mm->height = 0;
+    mm->first_leaf = NULL;
+    mm->num_keys = 0;
+    ki_init(&mm->index);
+    mm->frozen = NULL;
+    return mm;
+}
+
+
+/* Release all dynamically allocated memory associated with the multimap
+ * data structure.  A read-only multimap's file is closed.
+ */
+void clear_multimap(multimap *mm) {
+    assert(mm != NULL);
+
+    if (mm->frozen != NULL) {
+        fm_close(mm->frozen);
+        mm->frozen = NULL;
+    }
+
+    if (mm->root != NULL)
+        free_tree_node(mm->root, mm->height, /* free_values */ 1);
+
+    mm->root = NULL;
+    mm->height = 0;
+    mm->first_leaf = NULL;
+    mm->num_keys = 0;
+    ki_free(&mm->index);
+}
+
+
+/* Adds the specified (key, value) pair to the multimap. */
+void mm_add_value(multimap *mm, int key, int value) {
+    assert(mm != NULL);
+
+    if (mm->frozen != NULL)
+        fm_read_only();
+
+    vs_add(insert_key(mm, key), value);
+}
+
+
+/* Adds n (key, value) pairs to the multimap.  The batch is radix-sorted,
+ * and then merged with the keys already in the tree in a single pass over
+ * the leaves, building a new tree from the result.  This takes O(n + k) time
+ * for a tree with k keys, and leaves the tree packed.
+ */
+void mm_add_values(multimap *mm, const int *keys, const int *values, int n) {
+    tree_builder tb;
+    leaf_node *leaf;
+    mm_pair *pairs;
+    int i, j;
+
+    assert(mm != NULL);
+
+    if (mm->frozen != NULL)
+        fm_read_only();
+
+    if (n <= 0)
+        return;
+
+    /* Merging costs a pass over the whole tree, which isn't worth it for a
+     * batch that is small next to the tree.
+     */
+    if (n < mm->num_keys / MERGE_RATIO) {
+        for (i = 0; i < n; i++)
+            mm_add_value(mm, keys[i], values[i]);
+        return;
+    }
+
+    pairs = malloc(n * sizeof(mm_pair));
+    if (pairs == NULL) {
+        printf("error: unable to allocate memory for batch.\n");
+        abort();
+    }
+    for (i = 0; i < n; i++) {
+        pairs[i].key = keys[i];
+        pairs[i].value = values[i];
+    }
+    sort_pairs(pairs, n);
+
+    /* Merge the existing keys with the batch.  The existing value sets move
+     * to the new leaves as they are.
+     */
+    init_tree_builder(&tb);
+    i = 0;
+    for (leaf = mm->first_leaf; leaf != NULL; leaf = leaf->next) {
+        for (j = 0; j < leaf->num_keys; j++) {
+            int key = leaf->keys[j];
+            value_set *vs;
+
+            while (i < n && pairs[i].key < key)
+                i = builder_add_run(&tb, pairs, i, n);
+
+            vs = builder_add_key(&tb, key, &leaf->values[j]);
+            while (i < n && pairs[i].key == key)
+                vs_add(vs, pairs[i++].value);
+        }
+    }
+    while (i < n)
+        i = builder_add_run(&tb, pairs, i, n);
+
+    /* The old nodes are now empty shells, since their value sets moved. */
+    if (mm->root != NULL)
+        free_tree_node(mm->root, mm->height, /* free_values */ 0);
+    mm->root = NULL;
+    builder_finish(&tb, mm);
+
+    free(pairs);
+}
+
+
+/* Replaces the contents of the multimap with n (key, value) pairs that are
+ * already sorted by key.  The tree is built bottom-up in O(n) time.
+ */
+void mm_build_from_sorted(multimap *mm, const int *keys, const int *values,
+                          int n) {
+    tree_builder tb;
+    value_set *vs = NULL;
+    int i;
+
+    assert(mm != NULL);
+
+    clear_multimap(mm);
+    init_tree_builder(&tb);
+
+    for (i = 0; i < n; i++) {
+        assert(i == 0 || keys[i - 1] <= keys[i]);
+
+        if (i == 0 || keys[i] != keys[i - 1])
+            vs = builder_add_key(&tb, keys[i], NULL);
+        vs_add(vs, values[i]);
+    }
+
+    builder_finish(&tb, mm);
+}
+
+
+/* Returns nonzero if the multimap contains the specified key-value, zero
+ * otherwise.
+ */
+int mm_contains_key(multimap *mm, int key) {
+    if (mm->frozen != NULL)
+        return fm_contains_key(mm->frozen, key);
+
+    return find_values(mm, key) != NULL;
+}
+
+
+/* Returns nonzero if the multimap contains the specified (key, value) pair,
+ * zero otherwise.
+ */
+int mm_contains_pair(multimap *mm, int key, int value) {
+    value_set *vs;
+
+    assert(mm != NULL);
+
+    if (mm->frozen != NULL)
+        return fm_contains_pair(mm->frozen, key, value);
+
+    vs = find_values(mm, key);
+    if (vs == NULL)
+        return 0;
+
+    return vs_contains(vs, value);
+}
+
+
+/* Probes the multimap for n (key, value) pairs.  The probes are done in
+ * groups of PROBE_GROUP, which descend the tree one level at a time:  each
+ * probe in the group steps down a level and prefetches its next node, so by
+ * the time the group comes back to the first probe, its node has had a
+ * chance to arrive.  With the hash index, the group looks up its leaves in
+ * the index instead, after prefetching the index slots.  The value sets at
+ * the bottom are prefetched the same way before any of them are searched.
+ */
+void mm_contains_pairs(multimap *mm, const int *keys, const int *values,
+                       int n, int *results) {
+    void *nodes[PROBE_GROUP];
+    value_set *sets[PROBE_GROUP];
+    int start, count, level, i, j;
+
+    assert(mm != NULL);
+
+    if (mm->frozen != NULL) {
+        fm_contains_pairs(mm->frozen, keys, values, n, results);
+        return;
+    }
+
+    for (start = 0; start < n; start += count) {
+        count = (n - start < PROBE_GROUP) ? n - start : PROBE_GROUP;
+
+        if (mm->root == NULL) {
+            memset(results + start, 0, count * sizeof(int));
+            continue;
+        }
+
+        if (HASH_INDEX) {
+            for (i = 0; i < count; i++)
+                ki_prefetch(&mm->index, keys[start + i]);
+
+            for (i = 0; i < count; i++) {
+                nodes[i] = ki_find(&mm->index, keys[start + i]);
+
+                /* The keys, and the sizes of the first value sets. */
+                if (nodes[i] != NULL) {
+                    __builtin_prefetch(nodes[i]);
+                    __builtin_prefetch((char *) nodes[i] + CACHE_LINE_SIZE);
+                }
+            }
+        }
+        else {
+            for (i = 0; i < count; i++)
+                nodes[i] = mm->root;
+
+            for (level = mm->height; level > 0; level--) {
+                for (i = 0; i < count; i++) {
+                    inner_node *inner = (inner_node *) nodes[i];
+                    nodes[i] =
+                        inner->children[find_child(inner, keys[start + i])];
+
+                    /* The keys, and the first children pointers. */
+                    __builtin_prefetch(nodes[i]);
+                    __builtin_prefetch((char *) nodes[i] + CACHE_LINE_SIZE);
+                }
+            }
+        }
+
+        for (i = 0; i < count; i++) {
+            leaf_node *leaf = (leaf_node *) nodes[i];
+
+            j = (leaf != NULL) ? find_in_leaf(leaf, keys[start + i]) : -1;
+            sets[i] = (j >= 0) ? &leaf->values[j] : NULL;
+            if (sets[i] != NULL)
+                vs_prefetch(sets[i], values[start + i]);
+        }
+
+        for (i = 0; i < count; i++) {
+            results[start + i] = (sets[i] != NULL) &&
+                vs_contains(sets[i], values[start + i]);
+        }
+    }
+}
+
+
+/* Removes the specified (key, value) pair from the multimap.  Returns 1 if
+ * the specified pair was found, or 0 if the pair was not found.
+ *
+ * A key whose last value is removed is taken out of its leaf, and out of the
+ * hash index, but leaves are never merged, so a leaf may be left with few
+ * keys or none at all.  Lookups are still correct, since the separators in
+ * the internal nodes still bound the keys beneath them.
+ */
+int mm_remove_pair(multimap *mm, int key, int value) {
+    leaf_node *leaf;
+    int i;
+
+    assert(mm != NULL);
+
+    if (mm->frozen != NULL)
+        fm_read_only();
+
+    if (HASH_INDEX)
+        leaf = ki_find(&mm->index, key);
+    else
+        leaf = find_leaf(mm, key);
+    if (leaf == NULL)
+        return 0;
+
+    i = find_in_leaf(leaf, key);
+    if (i < 0 || !vs_remove(&leaf->values[i], value))
+        return 0;
+
+    if (leaf->values[i].size == 0) {
+        vs_free(&leaf->values[i]);
+        memmove(leaf->keys + i, leaf->keys + i + 1,
+                (leaf->num_keys - i - 1) * sizeof(int));
+        memmove(leaf->values + i, leaf->values + i + 1,
+                (leaf->num_keys - i - 1) * sizeof(value_set));
+        leaf->num_keys--;
+        mm->num_keys--;
+
+        if (HASH_INDEX)
+            ki_remove(&mm->index, key);
+    }
+
+    return 1;
+}
+
+
+/* Performs an in-order traversal of the multimap, passing each (key, value)
+ * pair to the specified function.
+ */
+void mm_traverse(multimap *mm, void (*f)(int key, int value)) {
+    leaf_node *leaf;
+    vs_iter it;
+    int i, value;
+
+    if (mm->frozen != NULL) {
+        fm_traverse(mm->frozen, f);
+        return;
+    }
+
+    for (leaf = mm->first_leaf; leaf != NULL; leaf = leaf->next) {
+        for (i = 0; i < leaf->num_keys; i++) {
+            vs_iter_init(&it);
+            while (vs_iter_next(&leaf->values[i], &it, &value))
+                f(leaf->keys[i], value);
+        }
+    }
+}
+
+
+/* Performs an in-order traversal of the pairs whose keys are in [lo, hi).
+ * The first leaf is found by a normal descent, and the rest by following
+ * the leaf chain, so this takes O(log n + k) time for k keys in the range.
+ */
+void mm_range(multimap *mm, int lo, int hi, void (*f)(int key, int value)) {
+    leaf_node *leaf;
+    vs_iter it;
+    int i, value;
+
+    if (mm->frozen != NULL) {
+        fm_range(mm->frozen, lo, hi, f);
+        return;
+    }
+
+    if (lo >= hi)
+        return;
+
+    leaf = find_leaf(mm, lo);
+    if (leaf == NULL)
+        return;
+
+    for (i = find_slot(leaf, lo); leaf != NULL; leaf = leaf->next, i = 0) {
+        for (; i < leaf->num_keys; i++) {
+            if (leaf->keys[i] >= hi)
+                return;
+
+            vs_iter_init(&it);
+            while (vs_iter_next(&leaf->values[i], &it, &value))
+                f(leaf->keys[i], value);
+        }
+    }
+}
+
+
+/* Opens a cursor over the pairs whose keys are in [lo, hi). */
+mm_cursor * mm_cursor_open(multimap *mm, int lo, int hi) {
+    mm_cursor *cursor = malloc(sizeof(mm_cursor));
+
+    if (cursor == NULL) {
+        printf("error: unable to allocate memory for cursor.\n");
+        abort();
+    }
+
+    cursor->leaf = (lo < hi) ? find_leaf(mm, lo) : NULL;
+    cursor->index = (cursor->leaf != NULL) ? find_slot(cursor->leaf, lo) : 0;
+    vs_iter_init(&cursor->it);
+    cursor->hi = hi;
+
+    cursor->frozen = mm->frozen;
+    if (mm->frozen != NULL)
+        fm_cursor_open(mm->frozen, &cursor->frozen_cursor, lo, hi);
+
+    return cursor;
+}
+
+
+/* Returns the cursor's next pair, moving on to the next key, or the next
+ * leaf, as each one runs out.
+ */
+int mm_cursor_next(mm_cursor *cursor, int *key, int *value) {
+    if (cursor->frozen != NULL)
+        return fm_cursor_next(cursor->frozen, &cursor->frozen_cursor,
+                              key, value);
+
+    while (cursor->leaf != NULL) {
+        leaf_node *leaf = cursor->leaf;
+
+        if (cursor->index == leaf->num_keys) {
+            cursor->leaf = leaf->next;
+            cursor->index = 0;
+            continue;
+        }
+
+        if (leaf->keys[cursor->index] >= cursor->hi) {
+            cursor->leaf = NULL;
+            break;
+        }
+
+        if (vs_iter_next(&leaf->values[cursor->index], &cursor->it, value)) {
+            *key = leaf->keys[cursor->index];
+            return 1;
+        }
+
+        cursor->index++;
+        vs_iter_init(&cursor->it);
+    }
+
+    return 0;
+}
+
+
+/* Releases a cursor returned by mm_cursor_open(). */
+void mm_cursor_close(mm_cursor *cursor) {
+    free(cursor);
+}
+
+
+/* Writes the multimap to a file, walking the leaves in key order. */
+int mm_save(multimap *mm, const char *path) {
+    frozen_writer fw;
+    leaf_node *leaf;
+    vs_iter it;
+    int i, value;
+
+    assert(mm != NULL);
+
+    if (mm->frozen != NULL)
+        return fm_save(mm->frozen, path);
+
+    fw_init(&fw);
+    for (leaf = mm->first_leaf; leaf != NULL; leaf = leaf->next) {
+        for (i = 0; i < leaf->num_keys; i++) {
+            vs_iter_init(&it);
+            while (vs_iter_next(&leaf->values[i], &it, &value))
+                fw_add(&fw, leaf->keys[i], value);
+        }
+    }
+
+    return fw_finish(&fw, path);
+}
+
+
+/* Opens a file written by mm_save() as a read-only multimap. */
+multimap * mm_open_readonly(const char *path) {
+    frozen_mm *fm = fm_open(path);
+    multimap *mm;
+
+    if (fm == NULL)
+        return NULL;
+
+    mm = init_multimap();
+    mm->frozen = fm;
+    return mm;
+}
@@ -0,0 +1,602 @@
+/* A thread-safe multimap, built from the B+ tree implementation.
+ *
+ * The keys are split between NUM_STRIPES stripes by a hash of the key, and
+ * each stripe is a separate B+ tree with its own reader/writer lock.  Lookups
+ * take their stripe's lock for reading, so they never block one another;
+ * changes take it for writing, so changes to keys in different stripes
+ * proceed in parallel.  Operations that span stripes, like mm_traverse(),
+ * lock every stripe they touch, always in stripe order.
+ *
+ * The B+ tree code is compiled into this file with its multimap names
+ * renamed to tree names, so that the trees can be used as the stripes here
+ * without a second copy of the code.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define multimap              tree
+#define init_multimap         tree_init
+#define clear_multimap        tree_clear
+#define mm_add_value          tree_add_value
+#define mm_add_values         tree_add_values
+#define mm_build_from_sorted  tree_build_from_sorted
+#define mm_contains_key       tree_contains_key
+#define mm_contains_pair      tree_contains_pair
+#define mm_contains_pairs     tree_contains_pairs
+#define mm_remove_pair        tree_remove_pair
+#define mm_traverse           tree_traverse
+#define mm_range              tree_range
+#define mm_cursor             tree_cursor
+#define mm_cursor_open        tree_cursor_open
+#define mm_cursor_next        tree_cursor_next
+#define mm_cursor_close       tree_cursor_close
+#define mm_save               tree_save
+#define mm_open_readonly      tree_open_readonly
+
+#include "btree_mm_impl.c"
+
+#undef multimap
+#undef init_multimap
+#undef clear_multimap
+#undef mm_add_value
+#undef mm_add_values
+#undef mm_build_from_sorted
+#undef mm_contains_key
+#undef mm_contains_pair
+#undef mm_contains_pairs
+#undef mm_remove_pair
+#undef mm_traverse
+#undef mm_range
+#undef mm_cursor
+#undef mm_cursor_open
+#undef mm_cursor_next
+#undef mm_cursor_close
+#undef mm_save
+#undef mm_open_readonly
+
+/* Now declare the real multimap functions that this file defines. */
+#undef MULTIMAP_H
+#include "multimap.h"
+
+
+/* The number of stripes the keys are split between.  This must be a power
+ * of 2.
+ */
+#define STRIPE_BITS  4
+#define NUM_STRIPES  (1 << STRIPE_BITS)
+
+
+/*============================================================================
+ * TYPES
+ *============================================================================*/
+
+/* One stripe of the multimap.  Stripes are aligned to cache lines so that
+ * threads working in different stripes don't share a line with each other's
+ * locks.
+ */
+typedef struct stripe {
+    pthread_rwlock_t lock;
+    tree tree;
+} __attribute__((aligned(CACHE_LINE_SIZE))) stripe;
+
+
+/* The entry-point of the multimap data structure. */
+struct multimap {
+    stripe stripes[NUM_STRIPES];
+
+    /* The file that the multimap was opened from by mm_open_readonly(), or
+     * NULL.  A read-only multimap can't change, so its queries go straight
+     * to the file without taking any locks.
+     */
+    frozen_mm *frozen;
+};
+
+
+/* A growable array of pairs. */
+typedef struct pair_array {
+    mm_pair *pairs;
+    int size;
+    int max;
+} pair_array;
+
+
+/* A cursor over a copy of the pairs in its range, or over the file of a
+ * read-only multimap, which needs no copy.
+ */
+struct mm_cursor {
+    pair_array snapshot;
+    int next;
+
+    const frozen_mm *frozen;
+    fm_cursor frozen_cursor;
+};
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *============================================================================*/
+
+int stripe_of(int key);
+int * partition_by_stripe(const int *keys, int n, int *starts);
+void gather_pairs(const int *keys, const int *values, const int *order,
+                  int start, int end, int *out_keys, int *out_values);
+void merge_stripes(multimap *mm, int lo, int hi, void (*f)(int key, int value),
+                   pair_array *out);
+void append_pair(pair_array *out, int key, int value);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Returns the stripe that holds the specified key.  The hash spreads nearby
+ * keys across the stripes, so that a narrow range of keys doesn't all end up
+ * behind one lock.
+ */
+int stripe_of(int key) {
+    return ((unsigned int) key * 2654435761u) >> (32 - STRIPE_BITS);
+}
+
+
+/* Returns the indexes 0 .. n - 1, ordered by the stripe that keys[i] is in,
+ * and keeping the original order within each stripe.  The indexes for stripe
+ * s are at starts[s] .. starts[s + 1] - 1, so starts must have room for
+ * NUM_STRIPES + 1 elements.  The caller must free the result.
+ */
+int * partition_by_stripe(const int *keys, int n, int *starts) {
+    int *order = malloc((n > 0 ? n : 1) * sizeof(int));
+    int next[NUM_STRIPES];
+    int i, s;
+
+    if (order == NULL) {
+        printf("error: unable to allocate memory for batch.\n");
+        abort();
+    }
+
+    memset(starts, 0, (NUM_STRIPES + 1) * sizeof(int));
+    for (i = 0; i < n; i++)
+        starts[stripe_of(keys[i]) + 1]++;
+    for (s = 0; s < NUM_STRIPES; s++)
+        starts[s + 1] += starts[s];
+
+    memcpy(next, starts, sizeof(next));
+    for (i = 0; i < n; i++)
+        order[next[stripe_of(keys[i])]++] = i;
+
+    return order;
+}
+
+
+/* Initialize a multimap data structure. */
+multimap * init_multimap() {
+    multimap *mm = alloc_tree_node(sizeof(multimap));
+    int s;
+
+    /* alloc_tree_node() zeroes the trees, which makes them empty, and
+     * leaves frozen NULL.
+     */
+    for (s = 0; s < NUM_STRIPES; s++)
+        pthread_rwlock_init(&mm->stripes[s].lock, NULL);
+
+    return mm;
+}
+
+
+/* Release all dynamically allocated memory associated with the multimap
+ * data structure.  The locks are kept, so that the multimap can be used
+ * again.
+ */
+void clear_multimap(multimap *mm) {
+    int s;
+
+    assert(mm != NULL);
+
+    if (mm->frozen != NULL) {
+        fm_close(mm->frozen);
+        mm->frozen = NULL;
+    }
+
+    for (s = 0; s < NUM_STRIPES; s++) {
+        pthread_rwlock_wrlock(&mm->stripes[s].lock);
+        tree_clear(&mm->stripes[s].tree);
+        pthread_rwlock_unlock(&mm->stripes[s].lock);
+    }
+}
+
+
+/* Adds the specified (key, value) pair to the multimap. */
+void mm_add_value(multimap *mm, int key, int value) {
+    stripe *st = &mm->stripes[stripe_of(key)];
+
+    if (mm->frozen != NULL)
+        fm_read_only();
+
+    pthread_rwlock_wrlock(&st->lock);
+    tree_add_value(&st->tree, key, value);
+    pthread_rwlock_unlock(&st->lock);
+}
+
+
+/* Gathers the pairs of a batch that belong to one stripe, in batch order. */
+void gather_pairs(const int *keys, const int *values, const int *order,
+                  int start, int end, int *out_keys, int *out_values) {
+    int i;
+    for (i = start; i < end; i++) {
+        out_keys[i - start] = keys[order[i]];
+        out_values[i - start] = values[order[i]];
+    }
+}
+
+
+/* Adds n (key, value) pairs to the multimap.  The batch is split by stripe,
+ * and each stripe's share is added as a batch while that stripe is locked.
+ */
+void mm_add_values(multimap *mm, const int *keys, const int *values, int n) {
+    int starts[NUM_STRIPES + 1], *order, *part_keys, *part_values, s;
+
+    if (mm->frozen != NULL)
+        fm_read_only();
+
+    if (n <= 0)
+        return;
+
+    order = partition_by_stripe(keys, n, starts);
+    part_keys = malloc(n * sizeof(int));
+    part_values = malloc(n * sizeof(int));
+    if (part_keys == NULL || part_values == NULL) {
+        printf("error: unable to allocate memory for batch.\n");
+        abort();
+    }
+
+    for (s = 0; s < NUM_STRIPES; s++) {
+        int count = starts[s + 1] - starts[s];
+        if (count == 0)
+            continue;
+
+        gather_pairs(keys, values, order, starts[s], starts[s + 1],
+                     part_keys, part_values);
+
+        pthread_rwlock_wrlock(&mm->stripes[s].lock);
+        tree_add_values(&mm->stripes[s].tree, part_keys, part_values, count);
+        pthread_rwlock_unlock(&mm->stripes[s].lock);
+    }
+
+    free(order);
+    free(part_keys);
+    free(part_values);
+}
+
+
+/* Replaces the contents of the multimap with n (key, value) pairs that are
+ * already sorted by key.  Splitting the pairs by stripe keeps each stripe's
+ * share sorted, so each tree is bulk-loaded from its share.  Every stripe is
+ * locked for the whole rebuild, so no reader sees it half done.
+ */
+void mm_build_from_sorted(multimap *mm, const int *keys, const int *values,
+                          int n) {
+    int starts[NUM_STRIPES + 1], *order, *part_keys, *part_values, s;
+
+    order = partition_by_stripe(keys, n, starts);
+    part_keys = malloc((n > 0 ? n : 1) * sizeof(int));
+    part_values = malloc((n > 0 ? n : 1) * sizeof(int));
+    if (part_keys == NULL || part_values == NULL) {
+        printf("error: unable to allocate memory for batch.\n");
+        abort();
+    }
+
+    for (s = 0; s < NUM_STRIPES; s++)
+        pthread_rwlock_wrlock(&mm->stripes[s].lock);
+
+    for (s = 0; s < NUM_STRIPES; s++) {
+        gather_pairs(keys, values, order, starts[s], starts[s + 1],
+                     part_keys, part_values);
+        tree_build_from_sorted(&mm->stripes[s].tree, part_keys, part_values,
+                               starts[s + 1] - starts[s]);
+    }
+
+    for (s = NUM_STRIPES - 1; s >= 0; s--)
+        pthread_rwlock_unlock(&mm->stripes[s].lock);
+
+    free(order);
+    free(part_keys);
+    free(part_values);
+}
+
+
+/* Returns nonzero if the multimap contains the specified key-value, zero
+ * otherwise.
+ */
+int mm_contains_key(multimap *mm, int key) {
+    stripe *st = &mm->stripes[stripe_of(key)];
+    int found;
+
+    if (mm->frozen != NULL)
+        return fm_contains_key(mm->frozen, key);
+
+    pthread_rwlock_rdlock(&st->lock);
+    found = tree_contains_key(&st->tree, key);
+    pthread_rwlock_unlock(&st->lock);
+
+    return found;
+}
+
+
+/* Returns nonzero if the multimap contains the specified (key, value) pair,
+ * zero otherwise.
+ */
+int mm_contains_pair(multimap *mm, int key, int value) {
+    stripe *st = &mm->stripes[stripe_of(key)];
+    int found;
+
+    if (mm->frozen != NULL)
+        return fm_contains_pair(mm->frozen, key, value);
+
+    pthread_rwlock_rdlock(&st->lock);
+    found = tree_contains_pair(&st->tree, key, value);
+    pthread_rwlock_unlock(&st->lock);
+
+    return found;
+}
+
+
+/* Probes the multimap for n (key, value) pairs.  The probes are split by
+ * stripe, so that each stripe is locked once, and its probes are still done
+ * as a batch.
+ */
+void mm_contains_pairs(multimap *mm, const int *keys, const int *values,
+                       int n, int *results) {
+    int starts[NUM_STRIPES + 1], *order, *part_keys, *part_values;
+    int *part_results, s, i;
+
+    if (mm->frozen != NULL) {
+        fm_contains_pairs(mm->frozen, keys, values, n, results);
+        return;
+    }
+
+    if (n <= 0)
+        return;
+
+    order = partition_by_stripe(keys, n, starts);
+    part_keys = malloc(n * sizeof(int));
+    part_values = malloc(n * sizeof(int));
+    part_results = malloc(n * sizeof(int));
+    if (part_keys == NULL || part_values == NULL || part_results == NULL) {
+        printf("error: unable to allocate memory for batch.\n");
+        abort();
+    }
+
+    gather_pairs(keys, values, order, 0, n, part_keys, part_values);
+
+    for (s = 0; s < NUM_STRIPES; s++) {
+        int count = starts[s + 1] - starts[s];
+        if (count == 0)
+            continue;
+
+        pthread_rwlock_rdlock(&mm->stripes[s].lock);
+        tree_contains_pairs(&mm->stripes[s].tree, part_keys + starts[s],
+                            part_values + starts[s], count,
+                            part_results + starts[s]);
+        pthread_rwlock_unlock(&mm->stripes[s].lock);
+    }
+
+    for (i = 0; i < n; i++)
+        results[order[i]] = part_results[i];
+
+    free(order);
+    free(part_keys);
+    free(part_values);
+    free(part_results);
+}
+
+
+/* Removes the specified (key, value) pair from the multimap.  Returns 1 if
+ * the specified pair was found, or 0 if the pair was not found.
+ */
+int mm_remove_pair(multimap *mm, int key, int value) {
+    stripe *st = &mm->stripes[stripe_of(key)];
+    int found;
+
+    if (mm->frozen != NULL)
+        fm_read_only();
+
+    pthread_rwlock_wrlock(&st->lock);
+    found = tree_remove_pair(&st->tree, key, value);
+    pthread_rwlock_unlock(&st->lock);
+
+    return found;
+}
+
+
+/* Passes every pair whose key is in the range [lo, hi], inclusive, to f in
+ * key order, or appends it to out if f is NULL.  Every stripe is locked for
+ * reading while this runs, and the stripes' leaf chains are merged by key,
+ * starting from each stripe's first key in the range.
+ */
+void merge_stripes(multimap *mm, int lo, int hi, void (*f)(int key, int value),
+                   pair_array *out) {
+    leaf_node *leaves[NUM_STRIPES], *leaf;
+    int positions[NUM_STRIPES];
+    vs_iter it;
+    int s, i, value;
+
+    for (s = 0; s < NUM_STRIPES; s++) {
+        pthread_rwlock_rdlock(&mm->stripes[s].lock);
+        leaves[s] = find_leaf(&mm->stripes[s].tree, lo);
+        positions[s] = (leaves[s] != NULL) ? find_slot(leaves[s], lo) : 0;
+    }
+
+    while (1) {
+        int best = -1;
+
+        /* Find the stripe with the smallest next key.  Each key is in only
+         * one stripe, so there are never ties.
+         */
+        for (s = 0; s < NUM_STRIPES; s++) {
+            /* Skip past the end of each leaf, including empty leaves. */
+            while (leaves[s] != NULL && positions[s] == leaves[s]->num_keys) {
+                leaves[s] = leaves[s]->next;
+                positions[s] = 0;
+            }
+
+            /* A stripe is done once it passes the end of the range. */
+            if (leaves[s] != NULL && leaves[s]->keys[positions[s]] > hi)
+                leaves[s] = NULL;
+
+            if (leaves[s] != NULL && (best < 0 ||
+                leaves[s]->keys[positions[s]] <
+                    leaves[best]->keys[positions[best]])) {
+                best = s;
+            }
+        }
+
+        if (best < 0)
+            break;
+
+        leaf = leaves[best];
+        i = positions[best]++;
+        vs_iter_init(&it);
+        while (vs_iter_next(&leaf->values[i], &it, &value)) {
+            if (f != NULL)
+                f(leaf->keys[i], value);
+            else
+                append_pair(out, leaf->keys[i], value);
+        }
+    }
+
+    for (s = NUM_STRIPES - 1; s >= 0; s--)
+        pthread_rwlock_unlock(&mm->stripes[s].lock);
+}
+
+
+/* Appends a pair to a pair_array, making it larger if needed. */
+void append_pair(pair_array *out, int key, int value) {
+    if (out->size == out->max) {
+        out->max = (out->max > 0) ? 2 * out->max : 64;
+        out->pairs = realloc(out->pairs, out->max * sizeof(mm_pair));
+        if (out->pairs == NULL) {
+            printf("error: unable to allocate memory for cursor.\n");
+            abort();
+        }
+    }
+
+    out->pairs[out->size].key = key;
+    out->pairs[out->size].value = value;
+    out->size++;
+}
+
+
+/* Performs an in-order traversal of the multimap, passing each (key, value)
+ * pair to the specified function.  The function must not change the
+ * multimap, since that would deadlock.
+ */
+void mm_traverse(multimap *mm, void (*f)(int key, int value)) {
+    if (mm->frozen != NULL)
+        fm_traverse(mm->frozen, f);
+    else
+        merge_stripes(mm, INT_MIN, INT_MAX, f, NULL);
+}
+
+
+/* Performs an in-order traversal of the pairs whose keys are in [lo, hi).
+ * As with mm_traverse(), the function must not change the multimap.
+ */
+void mm_range(multimap *mm, int lo, int hi, void (*f)(int key, int value)) {
+    if (mm->frozen != NULL)
+        fm_range(mm->frozen, lo, hi, f);
+    else if (lo < hi)
+        merge_stripes(mm, lo, hi - 1, f, NULL);
+}
+
+
+/* Opens a cursor over the pairs whose keys are in [lo, hi).  The range is
+ * copied out when the cursor is opened, so that the cursor doesn't have to
+ * keep the stripes locked; it sees the range as it was at that moment.
+ */
+mm_cursor * mm_cursor_open(multimap *mm, int lo, int hi) {
+    mm_cursor *cursor = malloc(sizeof(mm_cursor));
+
+    if (cursor == NULL) {
+        printf("error: unable to allocate memory for cursor.\n");
+        abort();
+    }
+
+    memset(&cursor->snapshot, 0, sizeof(pair_array));
+    cursor->next = 0;
+
+    cursor->frozen = mm->frozen;
+    if (mm->frozen != NULL)
+        fm_cursor_open(mm->frozen, &cursor->frozen_cursor, lo, hi);
+    else if (lo < hi)
+        merge_stripes(mm, lo, hi - 1, NULL, &cursor->snapshot);
+
+    return cursor;
+}
+
+
+/* Returns the next pair of the cursor's copy of its range. */
+int mm_cursor_next(mm_cursor *cursor, int *key, int *value) {
+    if (cursor->frozen != NULL)
+        return fm_cursor_next(cursor->frozen, &cursor->frozen_cursor,
+                              key, value);
+
+    if (cursor->next == cursor->snapshot.size)
+        return 0;
+
+    *key = cursor->snapshot.pairs[cursor->next].key;
+    *value = cursor->snapshot.pairs[cursor->next].value;
+    cursor->next++;
+    return 1;
+}
+
+
+/* Releases a cursor returned by mm_cursor_open(). */
+void mm_cursor_close(mm_cursor *cursor) {
+    free(cursor->snapshot.pairs);
+    free(cursor);
+}
+
+
+/* Writes the multimap to a file.  The stripes are merged into one sorted
+ * copy first, which sees the multimap as it was at one moment, as a cursor
+ * does.
+ */
+int mm_save(multimap *mm, const char *path) {
+    pair_array pairs;
+    frozen_writer fw;
+    int i;
+
+    assert(mm != NULL);
+
+    if (mm->frozen != NULL)
+        return fm_save(mm->frozen, path);
+
+    memset(&pairs, 0, sizeof(pair_array));
+    merge_stripes(mm, INT_MIN, INT_MAX, NULL, &pairs);
+
+    fw_init(&fw);
+    for (i = 0; i < pairs.size; i++)
+        fw_add(&fw, pairs.pairs[i].key, pairs.pairs[i].value);
+    free(pairs.pairs);
+
+    return fw_finish(&fw, path);
+}
+
+
+/* Opens a file written by mm_save() as a read-only multimap. */
+multimap * mm_open_readonly(const char *path) {
+    frozen_mm *fm = fm_open(path);
+    multimap *mm;
+
+    if (fm == NULL)
+        return NULL;
+
+    mm = init_multimap();
+    mm->frozen = fm;
+    return mm;
+}
@@ -0,0 +1,420 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "frozen_mm.h"
+
+
+/* The capacities of a writer's arrays when it first needs them. */
+#define FW_START_KEYS    1024
+#define FW_START_VALUES  4096
+
+/* fm_contains_pairs() runs this many binary searches together. */
+#define FM_PROBE_GROUP   16
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *============================================================================*/
+
+void fw_grow_keys(frozen_writer *fw);
+void fw_grow_values(frozen_writer *fw);
+int write_all(FILE *file, const void *data, size_t size);
+int compare_int32s(const void *a, const void *b);
+int lower_bound_int32(const int32_t *array, int n, int key);
+int find_key(const frozen_mm *fm, int key);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Initializes a writer with no pairs. */
+void fw_init(frozen_writer *fw) {
+    fw->keys = NULL;
+    fw->offsets = NULL;
+    fw->values = NULL;
+    fw->num_keys = fw->max_keys = 0;
+    fw->num_values = fw->max_values = 0;
+}
+
+
+/* Doubles the capacity of a writer's keys, and of its offsets, which always
+ * have room for one more entry than the keys.
+ */
+void fw_grow_keys(frozen_writer *fw) {
+    fw->max_keys = (fw->max_keys > 0) ? 2 * fw->max_keys : FW_START_KEYS;
+    fw->keys = realloc(fw->keys, fw->max_keys * sizeof(int32_t));
+    fw->offsets = realloc(fw->offsets, (fw->max_keys + 1) * sizeof(uint32_t));
+
+    if (fw->keys == NULL || fw->offsets == NULL) {
+        printf("error: unable to allocate memory for frozen_writer.\n");
+        abort();
+    }
+}
+
+
+/* Doubles the capacity of a writer's values. */
+void fw_grow_values(frozen_writer *fw) {
+    if (fw->max_values > UINT32_MAX / 2) {
+        printf("error: too many values for a frozen multimap.\n");
+        abort();
+    }
+
+    fw->max_values = (fw->max_values > 0) ? 2 * fw->max_values :
+                                             FW_START_VALUES;
+    fw->values = realloc(fw->values,
+                         (size_t) fw->max_values * sizeof(int32_t));
+
+    if (fw->values == NULL) {
+        printf("error: unable to allocate memory for frozen_writer.\n");
+        abort();
+    }
+}
+
+
+/* Adds a pair to the writer.  Pairs must be added in key order, but the
+ * values of a key may come in any order.
+ */
+void fw_add(frozen_writer *fw, int key, int value) {
+    if (fw->num_keys == 0 || fw->keys[fw->num_keys - 1] != key) {
+        assert(fw->num_keys == 0 || fw->keys[fw->num_keys - 1] < key);
+
+        if (fw->num_keys == fw->max_keys)
+            fw_grow_keys(fw);
+
+        fw->keys[fw->num_keys] = key;
+        fw->offsets[fw->num_keys] = fw->num_values;
+        fw->num_keys++;
+    }
+
+    if (fw->num_values == fw->max_values)
+        fw_grow_values(fw);
+
+    fw->values[fw->num_values++] = value;
+}
+
+
+/* qsort() comparison for 32-bit ints. */
+int compare_int32s(const void *a, const void *b) {
+    int32_t i1 = *(const int32_t *) a, i2 = *(const int32_t *) b;
+    return (i1 > i2) - (i1 < i2);
+}
+
+
+/* Writes size bytes to file.  Returns 0 on success, or -1 on failure. */
+int write_all(FILE *file, const void *data, size_t size) {
+    return (size == 0 || fwrite(data, size, 1, file) == 1) ? 0 : -1;
+}
+
+
+/* Sorts the values of each key, and writes the writer's pairs to the
+ * specified file.  The writer's memory is released whether or not the write
+ * succeeds.  Returns 0 on success, or -1 on failure, with errno set.
+ */
+int fw_finish(frozen_writer *fw, const char *path) {
+    frozen_header header;
+    FILE *file;
+    int i, result = -1;
+
+    for (i = 0; i < fw->num_keys; i++) {
+        uint32_t end = (i + 1 < fw->num_keys) ?
+            fw->offsets[i + 1] : fw->num_values;
+        qsort(fw->values + fw->offsets[i], end - fw->offsets[i],
+              sizeof(int32_t), compare_int32s);
+    }
+    /* The offsets have room for the end of the last key's values, once
+     * there are any offsets at all.
+     */
+    if (fw->offsets == NULL)
+        fw_grow_keys(fw);
+    fw->offsets[fw->num_keys] = fw->num_values;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FM_MAGIC, sizeof(header.magic));
+    header.version = FM_VERSION;
+    header.num_keys = fw->num_keys;
+    header.num_values = fw->num_values;
+
+    file = fopen(path, "wb");
+    if (file != NULL) {
+        if (write_all(file, &header, sizeof(header)) == 0 &&
+            write_all(file, fw->keys, fw->num_keys * sizeof(int32_t)) == 0 &&
+            write_all(file, fw->offsets,
+                      (fw->num_keys + 1) * sizeof(uint32_t)) == 0 &&
+            write_all(file, fw->values,
+                      (size_t) fw->num_values * sizeof(int32_t)) == 0) {
+            result = 0;
+        }
+        if (fclose(file) != 0)
+            result = -1;
+    }
+
+    free(fw->keys);
+    free(fw->offsets);
+    free(fw->values);
+    fw_init(fw);
+
+    return result;
+}
+
+
+/* Maps the specified file, and checks that its header and size agree.
+ * Returns NULL if the file can't be opened or mapped, with errno set, or
+ * isn't a valid file.  The offsets aren't checked one by one, since that
+ * would mean reading the whole file.
+ */
+frozen_mm * fm_open(const char *path) {
+    const frozen_header *header;
+    frozen_mm *fm;
+    struct stat st;
+    void *addr;
+    uint64_t expected;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(frozen_header)) {
+        close(fd);
+        return NULL;
+    }
+
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return NULL;
+
+    header = (const frozen_header *) addr;
+    expected = sizeof(frozen_header) +
+               ((uint64_t) header->num_keys * 2 + 1 +
+                header->num_values) * sizeof(int32_t);
+
+    if (memcmp(header->magic, FM_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != FM_VERSION || header->num_keys > INT32_MAX ||
+        expected != (uint64_t) st.st_size) {
+        munmap(addr, st.st_size);
+        return NULL;
+    }
+
+    fm = malloc(sizeof(frozen_mm));
+    if (fm == NULL) {
+        printf("error: unable to allocate memory for frozen_mm.\n");
+        abort();
+    }
+
+    fm->addr = addr;
+    fm->length = st.st_size;
+    fm->num_keys = (int) header->num_keys;
+    fm->keys = (const int32_t *) (header + 1);
+    fm->offsets = (const uint32_t *) (fm->keys + fm->num_keys);
+    fm->values = (const int32_t *) (fm->offsets + fm->num_keys + 1);
+
+    if (fm->offsets[0] != 0 ||
+        fm->offsets[fm->num_keys] != header->num_values) {
+        fm_close(fm);
+        return NULL;
+    }
+
+    return fm;
+}
+
+
+/* Unmaps a file opened with fm_open(). */
+void fm_close(frozen_mm *fm) {
+    munmap(fm->addr, fm->length);
+    free(fm);
+}
+
+
+/* Writes a copy of an open file to the specified path.  Returns 0 on
+ * success, or -1 on failure.
+ */
+int fm_save(const frozen_mm *fm, const char *path) {
+    FILE *file = fopen(path, "wb");
+    int result;
+
+    if (file == NULL)
+        return -1;
+
+    result = write_all(file, fm->addr, fm->length);
+    if (fclose(file) != 0)
+        result = -1;
+    return result;
+}
+
+
+/* Returns the index of the first of the n sorted values that isn't less
+ * than key.  The search has no data-dependent branches, so it doesn't
+ * suffer from mispredictions.
+ */
+int lower_bound_int32(const int32_t *array, int n, int key) {
+    const int32_t *base = array;
+
+    if (n == 0)
+        return 0;
+
+    while (n > 1) {
+        int half = n / 2;
+        base = (base[half - 1] < key) ? base + half : base;
+        n -= half;
+    }
+
+    return (int) (base - array) + (*base < key);
+}
+
+
+/* Returns the index of key, or -1 if it isn't in the file. */
+int find_key(const frozen_mm *fm, int key) {
+    int i = lower_bound_int32(fm->keys, fm->num_keys, key);
+    return (i < fm->num_keys && fm->keys[i] == key) ? i : -1;
+}
+
+
+/* Returns nonzero if the file has the key, zero otherwise. */
+int fm_contains_key(const frozen_mm *fm, int key) {
+    return find_key(fm, key) >= 0;
+}
+
+
+/* Returns nonzero if the file has the (key, value) pair, zero otherwise.
+ * The key's values are sorted, so they are binary-searched too.
+ */
+int fm_contains_pair(const frozen_mm *fm, int key, int value) {
+    int i = find_key(fm, key), n, j;
+    const int32_t *values;
+
+    if (i < 0)
+        return 0;
+
+    values = fm->values + fm->offsets[i];
+    n = (int) (fm->offsets[i + 1] - fm->offsets[i]);
+    j = lower_bound_int32(values, n, value);
+    return j < n && values[j] == value;
+}
+
+
+/* Probes the file for n (key, value) pairs.  The binary searches of a group
+ * of probes are run in lockstep, and each step prefetches both of the keys
+ * that the next step of its search might look at, so that the cache misses
+ * of the whole group overlap instead of following one another.
+ */
+void fm_contains_pairs(const frozen_mm *fm, const int *keys,
+                       const int *values, int n, int *results) {
+    const int32_t *bases[FM_PROBE_GROUP];
+    int start, count, remaining, i;
+
+    for (start = 0; start < n; start += count) {
+        count = (n - start < FM_PROBE_GROUP) ? n - start : FM_PROBE_GROUP;
+
+        /* Every search in the group covers the same number of keys at each
+         * step, so they all finish together.
+         */
+        for (i = 0; i < count; i++)
+            bases[i] = fm->keys;
+
+        for (remaining = fm->num_keys; remaining > 1; ) {
+            int half = remaining / 2;
+            remaining -= half;
+
+            for (i = 0; i < count; i++) {
+                const int32_t *base = bases[i];
+                base = (base[half - 1] < keys[start + i]) ? base + half : base;
+                __builtin_prefetch(base + remaining / 2 - 1);
+                __builtin_prefetch(base + remaining - 1);
+                bases[i] = base;
+            }
+        }
+
+        for (i = 0; i < count; i++) {
+            int j = (fm->num_keys > 0) ? (int) (bases[i] - fm->keys) : 0;
+            const int32_t *vals;
+            int num_vals, k;
+
+            if (j < fm->num_keys && fm->keys[j] < keys[start + i])
+                j++;
+            if (j >= fm->num_keys || fm->keys[j] != keys[start + i]) {
+                results[start + i] = 0;
+                continue;
+            }
+
+            vals = fm->values + fm->offsets[j];
+            num_vals = (int) (fm->offsets[j + 1] - fm->offsets[j]);
+            k = lower_bound_int32(vals, num_vals, values[start + i]);
+            results[start + i] =
+                (k < num_vals && vals[k] == values[start + i]);
+        }
+    }
+}
+
+
+/* Passes every pair in the file to f, in key order. */
+void fm_traverse(const frozen_mm *fm, void (*f)(int key, int value)) {
+    uint32_t j;
+    int i;
+
+    for (i = 0; i < fm->num_keys; i++) {
+        for (j = fm->offsets[i]; j < fm->offsets[i + 1]; j++)
+            f(fm->keys[i], fm->values[j]);
+    }
+}
+
+
+/* Passes every pair whose key is in [lo, hi) to f, in key order. */
+void fm_range(const frozen_mm *fm, int lo, int hi,
+              void (*f)(int key, int value)) {
+    uint32_t j;
+    int i;
+
+    if (lo >= hi)
+        return;
+
+    for (i = lower_bound_int32(fm->keys, fm->num_keys, lo);
+         i < fm->num_keys && fm->keys[i] < hi; i++) {
+        for (j = fm->offsets[i]; j < fm->offsets[i + 1]; j++)
+            f(fm->keys[i], fm->values[j]);
+    }
+}
+
+
+/* Starts a scan of the pairs whose keys are in [lo, hi). */
+void fm_cursor_open(const frozen_mm *fm, fm_cursor *cursor, int lo, int hi) {
+    cursor->index = (lo < hi) ?
+        lower_bound_int32(fm->keys, fm->num_keys, lo) : fm->num_keys;
+    cursor->value_index = fm->offsets[cursor->index];
+    cursor->hi = hi;
+}
+
+
+/* Stores the scan's next pair in *key and *value and returns 1, or returns 0
+ * once the scan is done.  The values of consecutive keys are next to each
+ * other, so the value index just runs on from one key to the next.
+ */
+int fm_cursor_next(const frozen_mm *fm, fm_cursor *cursor,
+                   int *key, int *value) {
+    while (cursor->index < fm->num_keys &&
+           fm->keys[cursor->index] < cursor->hi) {
+        if (cursor->value_index < fm->offsets[cursor->index + 1]) {
+            *key = fm->keys[cursor->index];
+            *value = fm->values[cursor->value_index++];
+            return 1;
+        }
+        cursor->index++;
+    }
+
+    return 0;
+}
+
+
+/* Reports an attempt to change a multimap opened with mm_open_readonly(). */
+void fm_read_only() {
+    printf("error: multimap opened with mm_open_readonly() can't be "
+           "changed.\n");
+    abort();
+}
@@ -0,0 +1,98 @@
+/* This file declares the frozen_mm type, a read-only multimap that is stored
+ * in a flat file and memory-mapped, so that it can be queried in place.
+ * Every multimap implementation writes its files with a frozen_writer, and
+ * answers queries on a multimap returned by mm_open_readonly() with the
+ * fm_* functions.
+ *
+ * The file holds no pointers, only these parts, one after another:
+ *
+ *   - a frozen_header;
+ *   - the num_keys distinct keys, in increasing order;
+ *   - num_keys + 1 offsets into the values, where the values of keys[i] are
+ *     values[offsets[i] .. offsets[i + 1]);
+ *   - the num_values values, in increasing order for each key.
+ *
+ * Everything is stored as 32-bit integers in the byte order of the machine
+ * that wrote the file.  Since the pages of the file are mapped rather than
+ * read, opening a file takes the same short time however large it is, and
+ * processes that open the same file share its pages.
+ */
+
+#ifndef FROZEN_MM_H
+#define FROZEN_MM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* The first bytes of every file, and the version of the layout. */
+#define FM_MAGIC    "MMFROZEN"
+#define FM_VERSION  1
+
+
+typedef struct frozen_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_keys;
+    uint32_t num_values;
+    uint32_t reserved;
+} frozen_header;
+
+
+/* An open, memory-mapped file.  The arrays point into the mapping. */
+typedef struct frozen_mm {
+    void *addr;
+    size_t length;
+
+    int num_keys;
+    const int32_t *keys;
+    const uint32_t *offsets;
+    const int32_t *values;
+} frozen_mm;
+
+
+/* A position in a scan over a frozen_mm:  the index of the current key, the
+ * index of its next value, and the end of the scan's range.
+ */
+typedef struct fm_cursor {
+    int index;
+    uint32_t value_index;
+    int hi;
+} fm_cursor;
+
+
+/* Collects pairs in key order, and writes them out as a file. */
+typedef struct frozen_writer {
+    int32_t *keys;
+    uint32_t *offsets;
+    int32_t *values;
+    int num_keys, max_keys;
+    uint32_t num_values, max_values;
+} frozen_writer;
+
+
+void fw_init(frozen_writer *fw);
+void fw_add(frozen_writer *fw, int key, int value);
+int fw_finish(frozen_writer *fw, const char *path);
+
+frozen_mm * fm_open(const char *path);
+void fm_close(frozen_mm *fm);
+int fm_save(const frozen_mm *fm, const char *path);
+
+int fm_contains_key(const frozen_mm *fm, int key);
+int fm_contains_pair(const frozen_mm *fm, int key, int value);
+void fm_contains_pairs(const frozen_mm *fm, const int *keys,
+                       const int *values, int n, int *results);
+
+void fm_traverse(const frozen_mm *fm, void (*f)(int key, int value));
+void fm_range(const frozen_mm *fm, int lo, int hi,
+              void (*f)(int key, int value));
+
+void fm_cursor_open(const frozen_mm *fm, fm_cursor *cursor, int lo, int hi);
+int fm_cursor_next(const frozen_mm *fm, fm_cursor *cursor,
+                   int *key, int *value);
+
+void fm_read_only();
+
+
+#endif /* FROZEN_MM_H */
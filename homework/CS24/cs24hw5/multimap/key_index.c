@@ -0,0 +1,182 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "key_index.h"
+
+
+/* The number of slots in a table when it first needs some. */
+#define KI_START_CAPACITY  16
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *============================================================================*/
+
+void ki_resize(key_index *ki, int capacity);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Returns the home slot of a key.  This is the finalizer of MurmurHash3,
+ * which mixes every bit of the key into the top bits of the hash.  (The
+ * concurrent multimap picks stripes with a multiplicative hash of the top
+ * bits, so using that hash here too would crowd each stripe's keys together.)
+ */
+static inline int ki_slot(const key_index *ki, int key) {
+    unsigned int h = (unsigned int) key;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+
+    return (int) (h >> ki->shift);
+}
+
+
+/* Initializes an empty key_index.  No slots are allocated until the first
+ * key is added.
+ */
+void ki_init(key_index *ki) {
+    ki->entries = NULL;
+    ki->capacity = 0;
+    ki->size = 0;
+    ki->shift = 32;
+}
+
+
+/* Frees the slots of a key_index, leaving it empty. */
+void ki_free(key_index *ki) {
+    free(ki->entries);
+    ki_init(ki);
+}
+
+
+/* Moves every key into a new table with the specified number of slots. */
+void ki_resize(key_index *ki, int capacity) {
+    key_index_entry *old = ki->entries;
+    int old_capacity = ki->capacity, bits = 0, i;
+
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+
+    while ((1 << bits) < capacity)
+        bits++;
+
+    ki->entries = calloc(capacity, sizeof(key_index_entry));
+    if (ki->entries == NULL) {
+        printf("error: unable to allocate memory for key_index.\n");
+        abort();
+    }
+    ki->capacity = capacity;
+    ki->shift = 32 - bits;
+    ki->size = 0;
+
+    for (i = 0; i < old_capacity; i++) {
+        if (old[i].node != NULL)
+            ki_set(ki, old[i].key, old[i].node);
+    }
+
+    free(old);
+}
+
+
+/* Makes room for n keys, so that adding them won't resize the table. */
+void ki_reserve(key_index *ki, int n) {
+    int capacity = (ki->capacity > 0) ? ki->capacity : KI_START_CAPACITY;
+
+    while (capacity < 2 * n)
+        capacity *= 2;
+
+    if (capacity > ki->capacity)
+        ki_resize(ki, capacity);
+}
+
+
+/* Returns the node of the specified key, or NULL if the key isn't in the
+ * index.
+ */
+void * ki_find(const key_index *ki, int key) {
+    int mask = ki->capacity - 1, i;
+
+    if (ki->size == 0)
+        return NULL;
+
+    for (i = ki_slot(ki, key); ki->entries[i].node != NULL;
+         i = (i + 1) & mask) {
+        if (ki->entries[i].key == key)
+            return ki->entries[i].node;
+    }
+
+    return NULL;
+}
+
+
+/* Maps key to node, which must not be NULL, replacing the key's old node if
+ * it was already in the index.
+ */
+void ki_set(key_index *ki, int key, void *node) {
+    int mask, i;
+
+    assert(node != NULL);
+
+    if (2 * (ki->size + 1) > ki->capacity)
+        ki_reserve(ki, ki->size + 1);
+
+    mask = ki->capacity - 1;
+    for (i = ki_slot(ki, key); ki->entries[i].node != NULL;
+         i = (i + 1) & mask) {
+        if (ki->entries[i].key == key) {
+            ki->entries[i].node = node;
+            return;
+        }
+    }
+
+    ki->entries[i].key = key;
+    ki->entries[i].node = node;
+    ki->size++;
+}
+
+
+/* Removes key from the index, if it is there.  The entries after it in its
+ * probe sequence are moved back to fill the gap, when that doesn't move them
+ * in front of their home slots.
+ */
+void ki_remove(key_index *ki, int key) {
+    int mask = ki->capacity - 1, i, j;
+
+    if (ki->size == 0)
+        return;
+
+    for (i = ki_slot(ki, key); ; i = (i + 1) & mask) {
+        if (ki->entries[i].node == NULL)
+            return;
+        if (ki->entries[i].key == key)
+            break;
+    }
+
+    for (j = (i + 1) & mask; ki->entries[j].node != NULL; j = (j + 1) & mask) {
+        int home = ki_slot(ki, ki->entries[j].key);
+
+        /* The entry can fill the gap if the gap is no nearer the entry than
+         * its home slot is.
+         */
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            ki->entries[i] = ki->entries[j];
+            i = j;
+        }
+    }
+
+    ki->entries[i].node = NULL;
+    ki->size--;
+}
+
+
+/* Prefetches the home slot of a key. */
+void ki_prefetch(const key_index *ki, int key) {
+    if (ki->size > 0)
+        __builtin_prefetch(&ki->entries[ki_slot(ki, key)]);
+}
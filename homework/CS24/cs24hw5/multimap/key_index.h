@@ -0,0 +1,48 @@
+/* This file declares the key_index type, a hash table from int keys to the
+ * nodes that hold them.  It lets an ordered multimap answer point lookups in
+ * O(1) expected time, while its ordered structure is kept for traversals and
+ * range scans.
+ *
+ * The table uses open addressing with linear probing, and removes entries by
+ * shifting later entries of the same probe sequence back, so it never needs
+ * tombstones.  It grows so that it is at most half full.
+ */
+
+#ifndef KEY_INDEX_H
+#define KEY_INDEX_H
+
+
+/* One slot of the table.  A slot is empty when its node is NULL. */
+typedef struct key_index_entry {
+    int key;
+    void *node;
+} key_index_entry;
+
+
+/* A key_index that is all zeroes is empty, just as after ki_init(). */
+typedef struct key_index {
+    /* The slots of the table, or NULL if no slots have been allocated. */
+    key_index_entry *entries;
+
+    /* The number of slots, which is zero or a power of 2. */
+    int capacity;
+
+    /* The number of keys in the table. */
+    int size;
+
+    /* A key's hash is shifted right by this much to give its home slot. */
+    int shift;
+} key_index;
+
+
+void ki_init(key_index *ki);
+void ki_free(key_index *ki);
+void ki_reserve(key_index *ki, int n);
+
+void * ki_find(const key_index *ki, int key);
+void ki_set(key_index *ki, int key, void *node);
+void ki_remove(key_index *ki, int key);
+void ki_prefetch(const key_index *ki, int key);
+
+
+#endif /* KEY_INDEX_H */
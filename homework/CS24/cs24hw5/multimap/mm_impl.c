@@ -4,6 +4,39 @@
 #include <string.h>
 
 #include "multimap.h"
+#include "frozen_mm.h"
+#include "pool.h"
+#include "probe.h"
+#include "cacheprof.h"
+
+
+/* mm_contains_pairs() walks this many probes down the tree together, so that
+ * their cache misses overlap.
+ */
+#define PROBE_GROUP 16
+
+/* When this is nonzero, the tree is kept balanced as an AVL tree, so that
+ * keys added in sorted order still give O(log n) lookups instead of a tree
+ * that is one long chain.  The Makefile's avl target builds this file with
+ * -DAVL_TREE to turn it on.
+ */
+#ifdef AVL_TREE
+#define BALANCED  1
+#else
+#define BALANCED  0
+#endif
+
+
+/* The probes of the single-pair operations, for "make PROBES=1". */
+PROBE_DEFINE(add_value_probe, "mm_add_value");
+PROBE_DEFINE(contains_pair_probe, "mm_contains_pair");
+
+/* The accesses to the tree's nodes and value-lists, which are simulated on
+ * the cache hierarchy of the cache simulator for "make CACHEPROF=1".  Only
+ * the unbalanced tree's accesses are reported; the AVL rotations aren't.
+ */
+CACHEPROF_DEFINE(node_region, "multimap nodes");
+CACHEPROF_DEFINE(value_region, "multimap values");
 
 
 /*============================================================================
@@ -28,6 +61,11 @@ typedef struct multimap_node {
     /* The key-value that this multimap node represents. */
     int key;
 
+    /* The height of the subtree rooted at this node, counting the node
+     * itself.  This is only kept up to date when BALANCED is nonzero.
+     */
+    int height;
+
     /* A linked list of the values associated with this key in the multimap. */
     multimap_value *values;
 
@@ -51,6 +89,35 @@ typedef struct multimap_node {
 /* The entry-point of the multimap data structure. */
 struct multimap {
     multimap_node *root;
+
+    /* The pools that the nodes and value-nodes come from. */
+    pool nodes;
+    pool values;
+
+    /* The file that the multimap was opened from by mm_open_readonly(), or
+     * NULL.  The tree of a read-only multimap is empty.
+     */
+    frozen_mm *frozen;
+};
+
+
+/* A cursor over a range of keys.  The nodes that the in-order scan still has
+ * to come back to are kept on a stack, since the nodes don't point to their
+ * parents; the top of the stack is the node whose values are being returned.
+ */
+struct mm_cursor {
+    multimap_node **stack;
+    int depth;
+    int max_depth;
+
+    /* The next value of the node on top of the stack. */
+    multimap_value *curr;
+
+    int hi;
+
+    /* The file being scanned, if the multimap is read-only. */
+    const frozen_mm *frozen;
+    fm_cursor frozen_cursor;
 };
 
 
@@ -61,29 +128,62 @@ struct multimap {
  *   these are not visible outside of this module.
  *============================================================================*/
 
-multimap_node * alloc_mm_node();
+void * mm_pool_alloc(pool *p);
+
+multimap_node * alloc_mm_node(multimap *mm);
 
-multimap_node * find_mm_node(multimap_node *root, int key,
-                             int create_if_not_found);
+multimap_node * find_mm_node(multimap *mm, int key, int create_if_not_found);
 
 void remove_mm_node(multimap *mm, multimap_node *to_remove);
 int remove_mm_node_helper(multimap_node *node, multimap_node *to_remove);
 
-void free_multimap_values(multimap_value *values);
-void free_multimap_node(multimap_node *node);
+void append_mm_value(multimap *mm, multimap_node *node, int value);
+multimap_node * build_balanced_tree(multimap_node **nodes, int lo, int hi);
+
+/* AVL tree functions, used when BALANCED is nonzero. */
+int avl_height(multimap_node *node);
+void avl_update_height(multimap_node *node);
+multimap_node * avl_rotate_left(multimap_node *node);
+multimap_node * avl_rotate_right(multimap_node *node);
+multimap_node * avl_rebalance(multimap_node *node);
+multimap_node * avl_insert(multimap_node *node, multimap_node *new);
+multimap_node * avl_remove(multimap_node *node, multimap_node *to_remove);
+multimap_node * avl_remove_min(multimap_node *node, multimap_node **min);
+
+void release_mm_value(multimap *mm, multimap_value *value);
+void release_mm_node(multimap *mm, multimap_node *node);
+
+void mm_range_helper(multimap_node *node, int lo, int hi,
+                     void (*f)(int key, int value));
+void push_left_path(mm_cursor *cursor, multimap_node *node, int lo);
+void mm_save_helper(multimap_node *node, frozen_writer *fw);
 
 
 /*============================================================================
  * FUNCTION IMPLEMENTATIONS
  *============================================================================*/
 
-/* Allocates a multimap node, and zeros out its contents so that we know what
- * the initial value of everything will be.
+/* Returns a zeroed object from one of the multimap's pools, terminating the
+ * program if there is no memory for it.
+ */
+void * mm_pool_alloc(pool *p) {
+    void *object = pool_alloc(p);
+
+    if (object == NULL) {
+        printf("error: unable to allocate memory for %s.\n", p->name);
+        abort();
+    }
+    return object;
+}
+
+
+/* Allocates a multimap node from the multimap's node pool.  Its contents
+ * are zeroed, so that we know what the initial value of everything will be.
  */
-multimap_node * alloc_mm_node() {
-    multimap_node *node = malloc(sizeof(multimap_node));
-    bzero(node, sizeof(multimap_node));
+multimap_node * alloc_mm_node(multimap *mm) {
+    multimap_node *node = mm_pool_alloc(&mm->nodes);
 
+    CACHEPROF_WRITE(node_region, node, sizeof(multimap_node));
     return node;
 }
 
@@ -92,44 +192,64 @@ multimap_node * alloc_mm_node() {
  * specified key.  If such a node doesn't exist, the function can initialize
  * a new node and add this into the structure, or it will simply return NULL.
  * The one exception is the root - if the root is NULL then the function will
- * return a new root node.
+ * create a new root node.  In a balanced tree, a new node is added with
+ * avl_insert(), which rebalances the tree on the way back up.
  */
-multimap_node * find_mm_node(multimap_node *root, int key,
-                             int create_if_not_found) {
+multimap_node * find_mm_node(multimap *mm, int key, int create_if_not_found) {
     multimap_node *node;
 
+    if (BALANCED && create_if_not_found) {
+        node = find_mm_node(mm, key, /* create */ 0);
+        if (node == NULL) {
+            node = alloc_mm_node(mm);
+            node->key = key;
+            node->height = 1;
+            mm->root = avl_insert(mm->root, node);
+        }
+        return node;
+    }
+
     /* If the entire multimap is empty, the root will be NULL. */
-    if (root == NULL) {
+    if (mm->root == NULL) {
         if (create_if_not_found) {
-            root = alloc_mm_node();
-            root->key = key;
+            mm->root = alloc_mm_node(mm);
+            mm->root->key = key;
         }
-        return root;
+        return mm->root;
     }
 
     /* Now we know the multimap has at least a root node, so start there. */
-    node = root;
+    node = mm->root;
     while (1) {
+        CACHEPROF_READ(node_region, &node->key, sizeof(node->key));
         if (node->key == key)
             break;
 
         if (node->key > key) {   /* Follow left child */
+            CACHEPROF_READ(node_region, &node->left_child,
+                           sizeof(node->left_child));
             if (node->left_child == NULL && create_if_not_found) {
                 /* No left child, but caller wants us to create a new node. */
-                multimap_node *new = alloc_mm_node();
+                multimap_node *new = alloc_mm_node(mm);
                 new->key = key;
 
                 node->left_child = new;
+                CACHEPROF_WRITE(node_region, &node->left_child,
+                                sizeof(node->left_child));
             }
             node = node->left_child;
         }
         else {                   /* Follow right child */
+            CACHEPROF_READ(node_region, &node->right_child,
+                           sizeof(node->right_child));
             if (node->right_child == NULL && create_if_not_found) {
                 /* No right child, but caller wants us to create a new node. */
-                multimap_node *new = alloc_mm_node();
+                multimap_node *new = alloc_mm_node(mm);
                 new->key = key;
 
                 node->right_child = new;
+                CACHEPROF_WRITE(node_region, &node->right_child,
+                                sizeof(node->right_child));
             }
             node = node->right_child;
         }
@@ -150,7 +270,11 @@ void remove_mm_node(multimap *mm, multimap_node *to_remove) {
     assert(mm != NULL);
     assert(to_remove != NULL);
 
-    if (mm->root == to_remove) {
+    if (BALANCED) {
+        /* A balanced tree is rebalanced along the path to the node. */
+        mm->root = avl_remove(mm->root, to_remove);
+    }
+    else if (mm->root == to_remove) {
         /* The root of the multimap is the node being removed. */
 
         multimap_node *left, *right;
@@ -185,11 +309,11 @@ void remove_mm_node(multimap *mm, multimap_node *to_remove) {
     }
 
     /* Presumably, the node to remove has been found, so extract it from the
-     * tree and call the free-node helper.
+     * tree and call the release-node helper.
      */
     to_remove->left_child = NULL;
     to_remove->right_child = NULL;
-    free_multimap_node(to_remove);
+    release_mm_node(mm, to_remove);
 }
 
 
@@ -258,39 +382,205 @@ int remove_mm_node_helper(multimap_node *node, multimap_node *to_remove) {
 }
 
 
-/* This helper function frees all values in a multimap node's value-list. */
-void free_multimap_values(multimap_value *values) {
-    while (values != NULL) {
-        multimap_value *next = values->next;
-#ifdef DEBUG_ZERO
-        /* Clear out what we are about to free, to expose issues quickly. */
-        bzero(values, sizeof(multimap_value));
-#endif
-        free(values);
-        values = next;
+/* Adds a value to the end of a multimap node's value-list. */
+void append_mm_value(multimap *mm, multimap_node *node, int value) {
+    multimap_value *new_value = mm_pool_alloc(&mm->values);
+    new_value->value = value;
+    new_value->next = NULL;
+    CACHEPROF_WRITE(value_region, new_value, sizeof(multimap_value));
+
+    CACHEPROF_READ(node_region, &node->values_tail,
+                   sizeof(node->values_tail));
+    if (node->values_tail != NULL) {
+        node->values_tail->next = new_value;
+        CACHEPROF_WRITE(value_region, &node->values_tail->next,
+                        sizeof(node->values_tail->next));
+    }
+    else {
+        node->values = new_value;
+        CACHEPROF_WRITE(node_region, &node->values, sizeof(node->values));
+    }
+
+    node->values_tail = new_value;
+    CACHEPROF_WRITE(node_region, &node->values_tail,
+                    sizeof(node->values_tail));
+}
+
+
+/* Links the nodes in nodes[lo .. hi), which must be sorted by key, into a
+ * balanced tree, and returns the root of the tree.
+ */
+multimap_node * build_balanced_tree(multimap_node **nodes, int lo, int hi) {
+    int mid;
+
+    if (lo >= hi)
+        return NULL;
+
+    mid = lo + (hi - lo) / 2;
+    nodes[mid]->left_child = build_balanced_tree(nodes, lo, mid);
+    nodes[mid]->right_child = build_balanced_tree(nodes, mid + 1, hi);
+    avl_update_height(nodes[mid]);
+    return nodes[mid];
+}
+
+
+/* Returns the height of a subtree, which is 0 for an empty subtree. */
+int avl_height(multimap_node *node) {
+    return (node != NULL) ? node->height : 0;
+}
+
+
+/* Recomputes the height of a node from the heights of its children. */
+void avl_update_height(multimap_node *node) {
+    int left = avl_height(node->left_child);
+    int right = avl_height(node->right_child);
+
+    node->height = 1 + ((left > right) ? left : right);
+}
+
+
+/* Rotates the subtree rooted at node to the left, so that its right child
+ * becomes its root, and returns the new root.
+ */
+multimap_node * avl_rotate_left(multimap_node *node) {
+    multimap_node *right = node->right_child;
+
+    node->right_child = right->left_child;
+    right->left_child = node;
+
+    avl_update_height(node);
+    avl_update_height(right);
+    return right;
+}
+
+
+/* Rotates the subtree rooted at node to the right, so that its left child
+ * becomes its root, and returns the new root.
+ */
+multimap_node * avl_rotate_right(multimap_node *node) {
+    multimap_node *left = node->left_child;
+
+    node->left_child = left->right_child;
+    left->right_child = node;
+
+    avl_update_height(node);
+    avl_update_height(left);
+    return left;
+}
+
+
+/* Restores the AVL property at a node whose children are balanced, and whose
+ * children's heights differ by at most 2, and returns the subtree's new root.
+ * A child that leans the other way is rotated first, so that a single
+ * rotation at the node balances it.
+ */
+multimap_node * avl_rebalance(multimap_node *node) {
+    int balance;
+
+    avl_update_height(node);
+    balance = avl_height(node->left_child) - avl_height(node->right_child);
+
+    if (balance > 1) {
+        if (avl_height(node->left_child->left_child) <
+            avl_height(node->left_child->right_child)) {
+            node->left_child = avl_rotate_left(node->left_child);
+        }
+        return avl_rotate_right(node);
+    }
+
+    if (balance < -1) {
+        if (avl_height(node->right_child->right_child) <
+            avl_height(node->right_child->left_child)) {
+            node->right_child = avl_rotate_right(node->right_child);
+        }
+        return avl_rotate_left(node);
     }
+
+    return node;
 }
 
 
-/* This helper function frees a multimap node, including its children and
- * value-list.
+/* Adds a new node, whose key isn't in the tree yet, to the subtree rooted at
+ * node, and returns the subtree's new root.
  */
-void free_multimap_node(multimap_node *node) {
+multimap_node * avl_insert(multimap_node *node, multimap_node *new) {
     if (node == NULL)
-        return;
+        return new;
 
-    /* Free the children first. */
-    free_multimap_node(node->left_child);
-    free_multimap_node(node->right_child);
+    assert(new->key != node->key);
 
-    /* Free the list of values. */
-    free_multimap_values(node->values);
+    if (new->key < node->key)
+        node->left_child = avl_insert(node->left_child, new);
+    else
+        node->right_child = avl_insert(node->right_child, new);
 
-#ifdef DEBUG_ZERO
-    /* Clear out what we are about to free, to expose issues quickly. */
-    bzero(node, sizeof(multimap_node));
-#endif
-    free(node);
+    return avl_rebalance(node);
+}
+
+
+/* Unlinks the leftmost node of the subtree rooted at node, stores it in
+ * *min, and returns the subtree's new root.
+ */
+multimap_node * avl_remove_min(multimap_node *node, multimap_node **min) {
+    if (node->left_child == NULL) {
+        *min = node;
+        return node->right_child;
+    }
+
+    node->left_child = avl_remove_min(node->left_child, min);
+    return avl_rebalance(node);
+}
+
+
+/* Unlinks to_remove from the subtree rooted at node, which must contain it,
+ * and returns the subtree's new root.  A node with two children is replaced
+ * by the leftmost node of its right subtree.
+ */
+multimap_node * avl_remove(multimap_node *node, multimap_node *to_remove) {
+    multimap_node *min, *right;
+
+    assert(node != NULL);
+
+    if (node == to_remove) {
+        if (node->left_child == NULL)
+            return node->right_child;
+        if (node->right_child == NULL)
+            return node->left_child;
+
+        right = avl_remove_min(node->right_child, &min);
+        min->left_child = node->left_child;
+        min->right_child = right;
+        return avl_rebalance(min);
+    }
+
+    if (to_remove->key < node->key)
+        node->left_child = avl_remove(node->left_child, to_remove);
+    else
+        node->right_child = avl_remove(node->right_child, to_remove);
+
+    return avl_rebalance(node);
+}
+
+
+/* This helper function returns a value-node to the multimap's value pool. */
+void release_mm_value(multimap *mm, multimap_value *value) {
+    pool_release(&mm->values, value);
+}
+
+
+/* This helper function returns a multimap node, along with its value-list,
+ * to the multimap's pools.  The node's children are not released.
+ */
+void release_mm_node(multimap *mm, multimap_node *node) {
+    multimap_value *values = node->values;
+
+    while (values != NULL) {
+        multimap_value *next = values->next;
+        release_mm_value(mm, values);
+        values = next;
+    }
+
+    pool_release(&mm->nodes, node);
 }
 
 
@@ -298,16 +588,26 @@ void free_multimap_node(multimap_node *node) {
 multimap * init_multimap() {
     multimap *mm = malloc(sizeof(multimap));
     mm->root = NULL;
+    pool_init(&mm->nodes, "multimap nodes", sizeof(multimap_node));
+    pool_init(&mm->values, "multimap values", sizeof(multimap_value));
+    mm->frozen = NULL;
     return mm;
 }
 
 
 /* Release all dynamically allocated memory associated with the multimap
- * data structure.
+ * data structure.  Every node and value-node came from the multimap's
+ * pools, so freeing the pools' slabs frees them all, without walking the
+ * tree.  A read-only multimap's file is closed.
  */
 void clear_multimap(multimap *mm) {
     assert(mm != NULL);
-    free_multimap_node(mm->root);
+    if (mm->frozen != NULL) {
+        fm_close(mm->frozen);
+        mm->frozen = NULL;
+    }
+    pool_free(&mm->nodes);
+    pool_free(&mm->values);
     mm->root = NULL;
 }
 
@@ -315,30 +615,67 @@ void clear_multimap(multimap *mm) {
 /* Adds the specified (key, value) pair to the multimap. */
 void mm_add_value(multimap *mm, int key, int value) {
     multimap_node *node;
-    multimap_value *new_value;
 
     assert(mm != NULL);
 
+    if (mm->frozen != NULL)
+        fm_read_only();
+
+    PROBE_BEGIN(add_value_probe);
+
     /* Look up the node with the specified key.  Create if not found. */
-    node = find_mm_node(mm->root, key, /* create */ 1);
-    if (mm->root == NULL)
-        mm->root = node;
+    node = find_mm_node(mm, key, /* create */ 1);
 
     assert(node != NULL);
     assert(node->key == key);
 
     /* Add the new value to the multimap node. */
+    append_mm_value(mm, node, value);
 
-    new_value = malloc(sizeof(multimap_value));
-    new_value->value = value;
-    new_value->next = NULL;
+    PROBE_END(add_value_probe);
+}
 
-    if (node->values_tail != NULL)
-        node->values_tail->next = new_value;
-    else
-        node->values = new_value;
 
-    node->values_tail = new_value;
+/* Adds n (key, value) pairs to the multimap.  The pairs are inserted in the
+ * order given; sorting them first would only make the tree more lopsided.
+ */
+void mm_add_values(multimap *mm, const int *keys, const int *values, int n) {
+    int i;
+    for (i = 0; i < n; i++)
+        mm_add_value(mm, keys[i], values[i]);
+}
+
+
+/* Replaces the contents of the multimap with n (key, value) pairs that are
+ * already sorted by key.  One node is made for each distinct key, and the
+ * nodes are then linked into a balanced tree.  Since the nodes and values
+ * are allocated in key order, they are laid out in key order in the pools.
+ */
+void mm_build_from_sorted(multimap *mm, const int *keys, const int *values,
+                          int n) {
+    multimap_node **nodes;
+    int i, num_nodes = 0;
+
+    assert(mm != NULL);
+
+    clear_multimap(mm);
+    if (n <= 0)
+        return;
+
+    nodes = malloc(n * sizeof(multimap_node *));
+    for (i = 0; i < n; i++) {
+        assert(i == 0 || keys[i - 1] <= keys[i]);
+
+        if (i == 0 || keys[i] != keys[i - 1]) {
+            nodes[num_nodes] = alloc_mm_node(mm);
+            nodes[num_nodes]->key = keys[i];
+            num_nodes++;
+        }
+        append_mm_value(mm, nodes[num_nodes - 1], values[i]);
+    }
+
+    mm->root = build_balanced_tree(nodes, 0, num_nodes);
+    free(nodes);
 }
 
 
@@ -346,7 +683,10 @@ void mm_add_value(multimap *mm, int key, int value) {
  * otherwise.
  */
 int mm_contains_key(multimap *mm, int key) {
-    return find_mm_node(mm->root, key, /* create */ 0) != NULL;
+    if (mm->frozen != NULL)
+        return fm_contains_key(mm->frozen, key);
+
+    return find_mm_node(mm, key, /* create */ 0) != NULL;
 }
 
 
@@ -356,20 +696,111 @@ int mm_contains_key(multimap *mm, int key) {
 int mm_contains_pair(multimap *mm, int key, int value) {
     multimap_node *node;
     multimap_value *curr;
+    int found = 0;
 
-    node = find_mm_node(mm->root, key, /* create */ 0);
-    if (node == NULL)
-        return 0;
+    if (mm->frozen != NULL)
+        return fm_contains_pair(mm->frozen, key, value);
 
-    curr = node->values;
-    while (curr != NULL) {
-        if (curr->value == value)
-            return 1;
+    PROBE_BEGIN(contains_pair_probe);
 
-        curr = curr->next;
+    node = find_mm_node(mm, key, /* create */ 0);
+    if (node != NULL) {
+        CACHEPROF_READ(node_region, &node->values, sizeof(node->values));
+        curr = node->values;
+        while (curr != NULL) {
+            CACHEPROF_READ(value_region, curr, sizeof(multimap_value));
+            if (curr->value == value) {
+                found = 1;
+                break;
+            }
+
+            curr = curr->next;
+        }
     }
 
-    return 0;
+    PROBE_END(contains_pair_probe);
+    return found;
+}
+
+
+/* Probes the multimap for n (key, value) pairs.  The probes are done in
+ * groups, which descend the tree in lockstep:  each probe in the group steps
+ * down one node and prefetches the next, so that the misses of the whole
+ * group are outstanding at once.  The value lists are then scanned the same
+ * way, one value-node per probe per step.
+ */
+void mm_contains_pairs(multimap *mm, const int *keys, const int *values,
+                       int n, int *results) {
+    multimap_node *nodes[PROBE_GROUP];
+    multimap_value *curr[PROBE_GROUP];
+    int start, count, active, i;
+
+    if (mm->frozen != NULL) {
+        fm_contains_pairs(mm->frozen, keys, values, n, results);
+        return;
+    }
+
+    for (start = 0; start < n; start += count) {
+        count = (n - start < PROBE_GROUP) ? n - start : PROBE_GROUP;
+
+        for (i = 0; i < count; i++)
+            nodes[i] = mm->root;
+
+        /* Find each probe's node.  A probe is done when its node is NULL or
+         * holds its key.
+         */
+        do {
+            active = 0;
+            for (i = 0; i < count; i++) {
+                multimap_node *node = nodes[i];
+                int key = keys[start + i];
+
+                if (node == NULL)
+                    continue;
+                CACHEPROF_READ(node_region, &node->key, sizeof(node->key));
+                if (node->key == key)
+                    continue;
+
+                CACHEPROF_READ(node_region, (node->key > key) ?
+                               &node->left_child : &node->right_child,
+                               sizeof(multimap_node *));
+                node = (node->key > key) ? node->left_child : node->right_child;
+                if (node != NULL)
+                    __builtin_prefetch(node);
+                nodes[i] = node;
+                active = 1;
+            }
+        } while (active);
+
+        for (i = 0; i < count; i++) {
+            curr[i] = (nodes[i] != NULL) ? nodes[i]->values : NULL;
+            results[start + i] = 0;
+        }
+
+        /* Scan each probe's value-list.  A probe is done at the end of the
+         * list or when its value is found.
+         */
+        do {
+            active = 0;
+            for (i = 0; i < count; i++) {
+                if (curr[i] == NULL)
+                    continue;
+
+                CACHEPROF_READ(value_region, curr[i], sizeof(multimap_value));
+                if (curr[i]->value == values[start + i]) {
+                    results[start + i] = 1;
+                    curr[i] = NULL;
+                    continue;
+                }
+
+                curr[i] = curr[i]->next;
+                if (curr[i] != NULL) {
+                    __builtin_prefetch(curr[i]);
+                    active = 1;
+                }
+            }
+        } while (active);
+    }
 }
 
 
@@ -383,8 +814,11 @@ int mm_remove_pair(multimap *mm, int key, int value) {
 
     assert(mm != NULL);
 
+    if (mm->frozen != NULL)
+        fm_read_only();
+
     /* Look up the node with the specified key.  DO NOT create if not found. */
-    node = find_mm_node(mm->root, key, /* create */ 0);
+    node = find_mm_node(mm, key, /* create */ 0);
     if (node == NULL)
         return 0;      /* Pair already doesn't appear in the multiset. */
 
@@ -420,13 +854,7 @@ int mm_remove_pair(multimap *mm, int key, int value) {
             node->values_tail = prev;
         }
 
-#ifdef DEBUG_ZERO
-        /* Zero out all the memory that we are about to free, so that we don't
-         * encourage access-after-free bugs.
-         */
-        bzero(curr, sizeof(multimap_value));
-#endif
-        free(curr);
+        release_mm_value(mm, curr);
 
         /* Finally, if the value-node is now empty, remove it from the tree. */
         if (node->values == NULL)
@@ -462,6 +890,177 @@ void mm_traverse_helper(multimap_node *node, void (*f)(int key, int value)) {
  * pair to the specified function.
  */
 void mm_traverse(multimap *mm, void (*f)(int key, int value)) {
-    mm_traverse_helper(mm->root, f);
+    if (mm->frozen != NULL)
+        fm_traverse(mm->frozen, f);
+    else
+        mm_traverse_helper(mm->root, f);
 }
 
+
+/* This helper function is used by mm_range() to traverse the pairs within
+ * [lo, hi).  Subtrees that lie entirely outside the range are skipped.
+ */
+void mm_range_helper(multimap_node *node, int lo, int hi,
+                     void (*f)(int key, int value)) {
+    multimap_value *curr;
+
+    if (node == NULL)
+        return;
+
+    if (node->key > lo)
+        mm_range_helper(node->left_child, lo, hi, f);
+
+    if (node->key >= lo && node->key < hi) {
+        curr = node->values;
+        while (curr != NULL) {
+            f(node->key, curr->value);
+            curr = curr->next;
+        }
+    }
+
+    if (node->key < hi - 1)
+        mm_range_helper(node->right_child, lo, hi, f);
+}
+
+
+/* Performs an in-order traversal of the pairs whose keys are in [lo, hi),
+ * passing each (key, value) pair to the specified function.
+ */
+void mm_range(multimap *mm, int lo, int hi, void (*f)(int key, int value)) {
+    if (mm->frozen != NULL)
+        fm_range(mm->frozen, lo, hi, f);
+    else if (lo < hi)
+        mm_range_helper(mm->root, lo, hi, f);
+}
+
+
+/* Pushes the nodes of the subtree rooted at node that have keys of at least
+ * lo, and that the in-order scan reaches by going left, onto the cursor's
+ * stack.  The last node pushed is then the next node in key order.
+ */
+void push_left_path(mm_cursor *cursor, multimap_node *node, int lo) {
+    while (node != NULL) {
+        if (node->key < lo) {
+            node = node->right_child;
+            continue;
+        }
+
+        if (cursor->depth == cursor->max_depth) {
+            cursor->max_depth *= 2;
+            cursor->stack = realloc(cursor->stack,
+                                    cursor->max_depth * sizeof(multimap_node *));
+        }
+        cursor->stack[cursor->depth++] = node;
+        node = node->left_child;
+    }
+}
+
+
+/* Opens a cursor over the pairs whose keys are in [lo, hi). */
+mm_cursor * mm_cursor_open(multimap *mm, int lo, int hi) {
+    mm_cursor *cursor = malloc(sizeof(mm_cursor));
+
+    cursor->max_depth = 16;
+    cursor->stack = malloc(cursor->max_depth * sizeof(multimap_node *));
+    cursor->depth = 0;
+    cursor->hi = hi;
+
+    cursor->frozen = mm->frozen;
+    if (mm->frozen != NULL)
+        fm_cursor_open(mm->frozen, &cursor->frozen_cursor, lo, hi);
+    else if (lo < hi)
+        push_left_path(cursor, mm->root, lo);
+
+    cursor->curr = (cursor->depth > 0) ?
+        cursor->stack[cursor->depth - 1]->values : NULL;
+
+    return cursor;
+}
+
+
+/* Returns the cursor's next pair.  When the node on top of the stack runs out
+ * of values, it is popped, and the left path of its right subtree is pushed.
+ */
+int mm_cursor_next(mm_cursor *cursor, int *key, int *value) {
+    if (cursor->frozen != NULL)
+        return fm_cursor_next(cursor->frozen, &cursor->frozen_cursor,
+                              key, value);
+
+    while (cursor->depth > 0) {
+        multimap_node *node = cursor->stack[cursor->depth - 1];
+
+        if (node->key >= cursor->hi) {
+            cursor->depth = 0;
+            break;
+        }
+
+        if (cursor->curr != NULL) {
+            *key = node->key;
+            *value = cursor->curr->value;
+            cursor->curr = cursor->curr->next;
+            return 1;
+        }
+
+        cursor->depth--;
+        push_left_path(cursor, node->right_child, node->key);
+        cursor->curr = (cursor->depth > 0) ?
+            cursor->stack[cursor->depth - 1]->values : NULL;
+    }
+
+    return 0;
+}
+
+
+/* Releases a cursor returned by mm_cursor_open(). */
+void mm_cursor_close(mm_cursor *cursor) {
+    free(cursor->stack);
+    free(cursor);
+}
+
+
+
+/* This helper function is used by mm_save() to add the pairs of a subtree to
+ * the writer, in key order.
+ */
+void mm_save_helper(multimap_node *node, frozen_writer *fw) {
+    multimap_value *curr;
+
+    if (node == NULL)
+        return;
+
+    mm_save_helper(node->left_child, fw);
+
+    for (curr = node->values; curr != NULL; curr = curr->next)
+        fw_add(fw, node->key, curr->value);
+
+    mm_save_helper(node->right_child, fw);
+}
+
+
+/* Writes the multimap to a file.  Returns 0 on success, or -1 on failure. */
+int mm_save(multimap *mm, const char *path) {
+    frozen_writer fw;
+
+    assert(mm != NULL);
+
+    if (mm->frozen != NULL)
+        return fm_save(mm->frozen, path);
+
+    fw_init(&fw);
+    mm_save_helper(mm->root, &fw);
+    return fw_finish(&fw, path);
+}
+
+
+/* Opens a file written by mm_save() as a read-only multimap. */
+multimap * mm_open_readonly(const char *path) {
+    frozen_mm *fm = fm_open(path);
+    multimap *mm;
+
+    if (fm == NULL)
+        return NULL;
+
+    mm = init_multimap();
+    mm->frozen = fm;
+    return mm;
+}
@@ -1,6 +1,17 @@
 #include <assert.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#ifdef __MACH__
+#include <malloc/malloc.h>
+#endif
 
 #include "multimap.h"
 #include "realtime.h"
@@ -12,6 +23,22 @@
 #define MODE_RAND 0
 #define MODE_INCR 1
 #define MODE_DECR 2
+#define MODE_ZIPF 3
+#define MODE_CLUST 4
+
+/* Zipfian keys are drawn so that the key of rank r (key r - 1) is chosen
+ * with probability proportional to 1 / r^ZIPF_EXPONENT.  Probes of a
+ * zipfian test are drawn the same way, so the hot keys are also the ones
+ * that are looked up most.
+ */
+#define ZIPF_EXPONENT 0.99
+
+/* Clustered keys come in runs of CLUSTER_RUN insertions, each with keys
+ * within CLUSTER_SPAN of a random starting key, like the keys of records
+ * that are written together.
+ */
+#define CLUSTER_RUN 64
+#define CLUSTER_SPAN 256
 
 /* This value can be increased or decreased baased on how fast or slow the
  * performance tests run on your machine.
@@ -24,18 +51,141 @@
  */
 #define EXCLUDE_SLOW_TESTS 0
 
+/* The number of probes passed to each mm_contains_pairs() call. */
+#define PROBE_BATCH 1024
+
+/* The number of probes that are timed one by one for the latency
+ * percentiles, and how many times the timer is read to measure its own
+ * overhead.
+ */
+#define LATENCY_SAMPLES 100000
+#define TIMER_SAMPLES 1000
+
+
+/* The cumulative distribution of the zipfian keys:  zipf_cdf[k] is the
+ * probability that a key is at most k.  It is computed by zipf_setup() for
+ * zipf_max_key keys.
+ */
+double *zipf_cdf = NULL;
+int zipf_max_key = 0;
+
+
+/* Returns the current value of the realtime clock, in nanoseconds. */
+long long int now_ns() {
+    struct timespec ts;
+    clock_get_realtime(&ts);
+    return (ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+
+/* Computes the distribution of zipfian keys in the range [0, max_key). */
+void zipf_setup(int max_key) {
+    double total = 0;
+    int k;
+
+    if (zipf_max_key == max_key)
+        return;
+
+    free(zipf_cdf);
+    zipf_cdf = malloc(max_key * sizeof(double));
+    assert(zipf_cdf != NULL);
+
+    for (k = 0; k < max_key; k++) {
+        total += 1.0 / pow(k + 1, ZIPF_EXPONENT);
+        zipf_cdf[k] = total;
+    }
+    for (k = 0; k < max_key; k++)
+        zipf_cdf[k] /= total;
+
+    zipf_max_key = max_key;
+}
+
+
+/* Returns the zipfian key that a uniform random number in [0, 1) maps to,
+ * by binary-searching the cumulative distribution.
+ */
+int zipf_key(double u) {
+    int lo = 0, hi = zipf_max_key - 1;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (zipf_cdf[mid] <= u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+
+/* Returns a probe key for the specified populate-mode, drawn from the
+ * specified random sequence.  Only zipfian tests probe with the same skew
+ * they were populated with; every other test probes keys uniformly.
+ */
+int probe_key(int keygen_mode, unsigned int *seed, int max_key) {
+    if (keygen_mode == MODE_ZIPF)
+        return zipf_key(rand_r(seed) / (RAND_MAX + 1.0));
+
+    return rand_r(seed) % max_key;
+}
+
+
+/* Returns the number of bytes of heap memory in use, or -1 if the C library
+ * doesn't say.  This counts what the multimap has allocated, even when
+ * memory freed by an earlier test is reused, which the process's resident
+ * size wouldn't.
+ */
+long long int heap_bytes_in_use() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 mi = mallinfo2();
+    return (long long int) mi.uordblks + (long long int) mi.hblkhd;
+#elif defined(__GLIBC__)
+    struct mallinfo mi = mallinfo();
+    return (long long int) (unsigned int) mi.uordblks +
+           (long long int) (unsigned int) mi.hblkhd;
+#elif defined(__MACH__)
+    return (long long int) mstats().bytes_used;
+#else
+    return -1;
+#endif
+}
+
+
+/* Returns the peak resident set size of the process so far, in bytes. */
+long long int peak_rss_bytes() {
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+
+#ifdef __MACH__
+    return (long long int) usage.ru_maxrss;           /* Bytes on OS X. */
+#else
+    return (long long int) usage.ru_maxrss * 1024;    /* Kilobytes. */
+#endif
+}
+
+
+/* qsort() comparison for latencies. */
+int compare_latencies(const void *a, const void *b) {
+    long long int l1 = *(const long long int *) a;
+    long long int l2 = *(const long long int *) b;
+    return (l1 > l2) - (l1 < l2);
+}
+
 
 /* Populate the multimap with a specific number of key/value pairs.  The keys
- * can be generated in one of three ways, either randomly, incrementing, or
- * decrementing.
+ * can be generated in one of five ways, either randomly, incrementing,
+ * decrementing, zipfian, or clustered.
  */
 void populate_multimap(multimap *mm, int num_pairs, int keygen_mode,
                        int max_key, int max_val) {
-    int i, key, value;
+    int i, key, value, cluster_start = 0;
 
     assert(mm != NULL);
     assert(num_pairs > 0);
-    assert(keygen_mode >= 0 && keygen_mode <= 2);
+    assert(keygen_mode >= 0 && keygen_mode <= MODE_CLUST);
     assert(max_key > 0);
     assert(max_val > 0);
 
@@ -56,6 +206,15 @@ void populate_multimap(multimap *mm, int num_pairs, int keygen_mode,
             else
                 key = (key + 1) % (max_key + 1);
         }
+        else if (keygen_mode == MODE_ZIPF) {
+            key = zipf_key(rand() / (RAND_MAX + 1.0));
+        }
+        else if (keygen_mode == MODE_CLUST) {
+            /* Pick a new place for the cluster at the start of each run. */
+            if (i % CLUSTER_RUN == 0)
+                cluster_start = rand() % max_key;
+            key = (cluster_start + rand() % CLUSTER_SPAN) % max_key;
+        }
         else {
             assert(keygen_mode == MODE_DECR);
 
@@ -83,7 +242,8 @@ void populate_multimap(multimap *mm, int num_pairs, int keygen_mode,
  * and values to use in probing.  The function returns how many probes were
  * found in the map.
  */
-int probe_multimap(multimap *mm, int num_probes, int max_key, int max_val) {
+int probe_multimap(multimap *mm, int num_probes, int keygen_mode,
+                   int max_key, int max_val) {
     int i, key, value, in_map, total;
 
     assert(mm != NULL);
@@ -96,7 +256,10 @@ int probe_multimap(multimap *mm, int num_probes, int max_key, int max_val) {
 
     /* Probe the multimap with a bunch of (key, value) pairs. */
     for (i = 0, total = 0; i < num_probes; i++) {
-        key = rand() % max_key;
+        if (keygen_mode == MODE_ZIPF)
+            key = zipf_key(rand() / (RAND_MAX + 1.0));
+        else
+            key = rand() % max_key;
         value = rand() % max_val;
 
         in_map = mm_contains_pair(mm, key, value);
@@ -113,38 +276,169 @@ int probe_multimap(multimap *mm, int num_probes, int max_key, int max_val) {
 }
 
 
+/* Performs a fixed number of probes against the multimap in batches, using
+ * mm_contains_pairs(), and reports the number found and the time taken.  The
+ * probes are generated up front, from a separate random sequence so that the
+ * following tests see the same pairs and probes whether or not this one
+ * runs.
+ */
+void probe_multimap_batched(multimap *mm, int num_probes, int keygen_mode,
+                            int max_key, int max_val) {
+    static unsigned int seed = 24;
+    int *keys, *values, *results;
+    int i, n, total_hits;
+    struct timespec ts;
+    long long int start_us, end_us;
+
+    keys = malloc(num_probes * sizeof(int));
+    values = malloc(num_probes * sizeof(int));
+    results = malloc(num_probes * sizeof(int));
+    assert(keys != NULL && values != NULL && results != NULL);
+
+    for (i = 0; i < num_probes; i++) {
+        keys[i] = probe_key(keygen_mode, &seed, max_key);
+        values[i] = rand_r(&seed) % max_val;
+    }
+
+    printf("Probing multimap %d times in batches of %d.\n", num_probes,
+           PROBE_BATCH);
+
+    clock_get_realtime(&ts);
+    start_us = (ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+
+    for (i = 0; i < num_probes; i += n) {
+        n = (num_probes - i < PROBE_BATCH) ? num_probes - i : PROBE_BATCH;
+        mm_contains_pairs(mm, keys + i, values + i, n, results + i);
+    }
+
+    clock_get_realtime(&ts);
+    end_us = (ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+
+    for (i = 0, total_hits = 0; i < num_probes; i++) {
+        if (results[i])
+            total_hits++;
+    }
+
+    printf("Total hits:  %d/%d (%.1f%%)\n", total_hits, num_probes,
+           (double) total_hits * 100.0 / (double) num_probes);
+    printf("Batched wall-clock time:  %.2f seconds\tus per probe:  %.3f us\n\n",
+           (double) (end_us - start_us) / 1000000.0,
+           (double) (end_us - start_us) / (double) num_probes);
+
+    free(keys);
+    free(values);
+    free(results);
+}
+
+
+/* Times LATENCY_SAMPLES single probes one by one, and reports the median,
+ * 99th and 99.9th percentile latencies.  The timer is slow next to a probe,
+ * so its own median overhead is measured and taken off of every sample.
+ * Like the batched probes, these come from a separate random sequence.
+ */
+void probe_multimap_latency(multimap *mm, int keygen_mode, int max_key,
+                            int max_val) {
+    static unsigned int seed = 42;
+    long long int *latencies, overhead, start_ns;
+    int i, key, value, hits = 0;
+
+    latencies = malloc(LATENCY_SAMPLES * sizeof(long long int));
+    assert(latencies != NULL);
+
+    for (i = 0; i < TIMER_SAMPLES; i++) {
+        start_ns = now_ns();
+        latencies[i] = now_ns() - start_ns;
+    }
+    qsort(latencies, TIMER_SAMPLES, sizeof(long long int), compare_latencies);
+    overhead = latencies[TIMER_SAMPLES / 2];
+
+    for (i = 0; i < LATENCY_SAMPLES; i++) {
+        key = probe_key(keygen_mode, &seed, max_key);
+        value = rand_r(&seed) % max_val;
+
+        start_ns = now_ns();
+        hits += mm_contains_pair(mm, key, value);
+        latencies[i] = now_ns() - start_ns - overhead;
+        if (latencies[i] < 0)
+            latencies[i] = 0;
+    }
+    qsort(latencies, LATENCY_SAMPLES, sizeof(long long int),
+          compare_latencies);
+
+    printf("Probe latency over %d probes (%d hits, timer overhead %lld ns "
+           "removed):\n", LATENCY_SAMPLES, hits, overhead);
+    printf("p50:  %lld ns	p99:  %lld ns	p999:  %lld ns	max:  %lld ns\n\n",
+           latencies[LATENCY_SAMPLES / 2],
+           latencies[LATENCY_SAMPLES * 99 / 100],
+           latencies[LATENCY_SAMPLES * 999 / 1000],
+           latencies[LATENCY_SAMPLES - 1]);
+
+    free(latencies);
+}
+
+
 /* Performs a single performance test against the multimap:
- *   1)  Generates key/value pairs to add to the map, using either incrementing,
- *       decrementing, or random key generation, and the specified maximum key
- *       and value parameters.
+ *   1)  Generates key/value pairs to add to the map, using one of the key
+ *       generation modes, and the specified maximum key and value
+ *       parameters.  The time to add them, and the memory the multimap
+ *       takes up afterward, are reported.
  *
  *   2)  Performs the specified number of probes, measuring the total wall-clock
  *       time that is required to perform the test.  This is not a particularly
  *       accurate way to measure the performance, but it should work well enough.
+ *
+ *   3)  Repeats the probes in batches, and then times a sample of single
+ *       probes to find the spread of their latencies.
  */
 void test_multimap_perf(int num_pairs, int num_probes, int keygen_mode,
                         int max_key, int max_val) {
     multimap *mm;
     struct timespec ts;
     int total_hits;
-    long long int start_us, end_us;
+    long long int start_us, end_us, heap_before, heap_after, peak_rss;
     double total_seconds, us_per_probe;
-    const char *mode_str[] = { "random", "incrementing", "decrementing" };
+    const char *mode_str[] = { "random", "incrementing", "decrementing",
+                               "zipfian", "clustered" };
 
-    assert(keygen_mode >= 0 && keygen_mode <= 2);
+    assert(keygen_mode >= 0 && keygen_mode <= MODE_CLUST);
+
+    if (keygen_mode == MODE_ZIPF)
+        zipf_setup(max_key);
 
     printf("Testing multimap performance:  %d pairs, %d probes, %s keys.\n",
            num_pairs, num_probes, mode_str[keygen_mode]);
 
     /* Initialize the multimap data structure. */
     mm = init_multimap();
+    heap_before = heap_bytes_in_use();
+
+    clock_get_realtime(&ts);
+    start_us = (ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
 
     populate_multimap(mm, num_pairs, keygen_mode, max_key, max_val);
 
+    clock_get_realtime(&ts);
+    end_us = (ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+
+    printf("Insert wall-clock time:  %.2f seconds\tmillion inserts per "
+           "second:  %.2f\n", (double) (end_us - start_us) / 1000000.0,
+           (double) num_pairs / (double) (end_us - start_us));
+
+    heap_after = heap_bytes_in_use();
+    peak_rss = peak_rss_bytes();
+    if (heap_before >= 0 && heap_after >= 0) {
+        printf("Heap in use:  %.1f MB\t\tbytes per pair:  %.1f\t",
+               (double) (heap_after - heap_before) / (1024.0 * 1024.0),
+               (double) (heap_after - heap_before) / (double) num_pairs);
+    }
+    printf("Peak RSS so far:  %.1f MB\n\n",
+           (double) peak_rss / (1024.0 * 1024.0));
+
     clock_get_realtime(&ts);
     start_us = (ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
 
-    total_hits = probe_multimap(mm, num_probes, max_key, max_val);
+    total_hits = probe_multimap(mm, num_probes, keygen_mode, max_key,
+                                max_val);
 
     clock_get_realtime(&ts);
     end_us = (ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
@@ -157,12 +451,130 @@ void test_multimap_perf(int num_pairs, int num_probes, int keygen_mode,
     printf("Total wall-clock time:  %.2f seconds\t\tus per probe:  %.3f us\n\n",
            total_seconds, us_per_probe);
 
+    probe_multimap_batched(mm, num_probes, keygen_mode, max_key, max_val);
+    probe_multimap_latency(mm, keygen_mode, max_key, max_val);
+
     /* Free it!  We're done. */
     clear_multimap(mm);
 }
 
 
-int main() {
+/* What each thread of a multi-threaded test does, and what it found. */
+typedef struct thread_args {
+    multimap *mm;
+    int num_ops;
+    int max_key;
+    int max_val;
+    int write_percent;      /* Percentage of operations that are inserts. */
+    unsigned int seed;
+    int hits;
+} thread_args;
+
+
+/* The body of each thread in a multi-threaded test:  a mix of probes and
+ * inserts with random keys and values.
+ */
+void * perf_thread(void *arg) {
+    thread_args *args = (thread_args *) arg;
+    int i, key, value;
+
+    for (i = 0; i < args->num_ops; i++) {
+        key = rand_r(&args->seed) % args->max_key;
+        value = rand_r(&args->seed) % args->max_val;
+
+        if ((int) (rand_r(&args->seed) % 100) < args->write_percent)
+            mm_add_value(args->mm, key, value);
+        else if (mm_contains_pair(args->mm, key, value))
+            args->hits++;
+    }
+
+    return NULL;
+}
+
+
+/* Measures how throughput scales with the number of threads using the
+ * multimap at once.  The multimap is populated once, and then the same
+ * total number of operations is split between 1, 2, 4, ... threads, up to
+ * max_threads.  This only makes sense for a thread-safe implementation.
+ */
+void test_multimap_threads(int num_pairs, int num_ops, int max_key,
+                           int max_val, int write_percent, int max_threads) {
+    multimap *mm;
+    pthread_t *threads;
+    thread_args *args;
+    struct timespec ts;
+    long long int start_us, end_us;
+    double base_rate = 0, rate;
+    int num_threads, i;
+
+    printf("Testing multimap scaling:  %d pairs, %d operations, "
+           "%d%% inserts.\n", num_pairs, num_ops, write_percent);
+
+    mm = init_multimap();
+    populate_multimap(mm, num_pairs, MODE_RAND, max_key, max_val);
+
+    threads = malloc(max_threads * sizeof(pthread_t));
+    args = malloc(max_threads * sizeof(thread_args));
+    assert(threads != NULL && args != NULL);
+
+    for (num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        clock_get_realtime(&ts);
+        start_us = (ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+
+        for (i = 0; i < num_threads; i++) {
+            args[i].mm = mm;
+            args[i].num_ops = num_ops / num_threads;
+            args[i].max_key = max_key;
+            args[i].max_val = max_val;
+            args[i].write_percent = write_percent;
+            args[i].seed = 24 + i;
+            args[i].hits = 0;
+            pthread_create(&threads[i], NULL, perf_thread, &args[i]);
+        }
+        for (i = 0; i < num_threads; i++)
+            pthread_join(threads[i], NULL);
+
+        clock_get_realtime(&ts);
+        end_us = (ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+
+        rate = (double) num_ops / (double) (end_us - start_us);
+        if (num_threads == 1)
+            base_rate = rate;
+        printf("%3d threads:  %.2f million ops per second  (%.2fx)\n",
+               num_threads, rate, rate / base_rate);
+    }
+    printf("\n");
+
+    free(threads);
+    free(args);
+    clear_multimap(mm);
+    free(mm);
+}
+
+
+int main(int argc, char **argv) {
+    int max_threads;
+
+    /* "-t N" runs the multi-threaded scaling tests instead of the usual ones,
+     * with up to N threads.
+     */
+    if (argc == 3 && strcmp(argv[1], "-t") == 0) {
+        max_threads = atoi(argv[2]);
+        if (max_threads < 1) {
+            printf("usage:  %s [-t max_threads]\n", argv[0]);
+            return 1;
+        }
+
+        srand(11);
+        test_multimap_threads(300000, SCALE * 1000000, 50, 1000, 0,
+                              max_threads);
+        test_multimap_threads(1500000, SCALE * 1000000, 100000, 50, 0,
+                              max_threads);
+        test_multimap_threads(1500000, SCALE * 1000000, 100000, 50, 10,
+                              max_threads);
+        return 0;
+    }
+
     srand(11);
 
     /* Arguments:  num_pairs, num_probes, keygen_mode, max_key, max_value */
@@ -178,6 +590,12 @@ int main() {
     test_multimap_perf(100000, SCALE * 5000, MODE_DECR, 100000, 50);
 #endif
 
+    /* The skewed distributions come last, so that the tests above see the
+     * same pairs and probes as they always have.
+     */
+    test_multimap_perf(1500000, SCALE * 100000, MODE_ZIPF, 100000, 50);
+    test_multimap_perf(1500000, SCALE * 100000, MODE_CLUST, 100000, 50);
+
     return 0;
 }
 
@@ -70,6 +70,28 @@ int remove_probe_values[] = {
 };
 
 
+/* The test values again, as separate key and value arrays in no particular
+ * order, and sorted by key.  These are used to test the batch-insert
+ * functions.
+ */
+int batch_keys[] = { 4, 1, 2, 3, 2, 1 };
+int batch_vals[] = { 50, 10, 20, 30, 15, 40 };
+int sorted_keys[] = { 1, 1, 2, 2, 3, 4 };
+int sorted_vals[] = { 10, 40, 20, 15, 30, 50 };
+#define NUM_BATCH_VALUES 6
+
+
+int range_values[] = {
+    2, 4, 3,  /* lo, hi, number of pairs in [lo, hi) */
+    1, 3, 4,
+    0, 100, 6,
+    4, 5, 1,
+    5, 30, 0,
+    3, 3, 0,
+    -1
+};
+
+
 int prev_key;
 
 void check_order(int key, int value) {
@@ -86,6 +108,121 @@ void check_order(int key, int value) {
 
 
 
+/* The range being checked by check_range(), and how many pairs it saw. */
+int range_lo, range_hi, range_count;
+
+void check_range(int key, int value) {
+    if (key < range_lo || key >= range_hi) {
+        printf(" * (%d, %d) - OUT OF RANGE!\n", key, value);
+        failures++;
+    }
+    check_order(key, value);
+    range_count++;
+}
+
+
+/* Probes the multimap with probe_values, and returns the number of probes
+ * that gave the wrong answer.
+ */
+int check_probes(multimap *mm) {
+    int i, wrong = 0;
+
+    for (i = 0; probe_values[i] != -1; i += 3) {
+        int answer = probe_values[i + 2];
+        int probe = mm_contains_pair(mm, probe_values[i], probe_values[i + 1]);
+
+        if ((probe && !answer) || (!probe && answer)) {
+            printf(" * (%d, %d) should%s be present:  FAIL\n",
+                probe_values[i], probe_values[i + 1], answer ? "" : " NOT");
+            wrong++;
+        }
+    }
+
+    return wrong;
+}
+
+
+/* Probes the multimap with probe_values in a single mm_contains_pairs()
+ * call, and returns the number of probes that gave the wrong answer.
+ */
+int check_batch_probes(multimap *mm) {
+    int keys[16] = { 0 }, values[16] = { 0 }, answers[16], results[16];
+    int i, n, wrong = 0;
+
+    for (n = 0; probe_values[3 * n] != -1; n++) {
+        keys[n] = probe_values[3 * n];
+        values[n] = probe_values[3 * n + 1];
+        answers[n] = probe_values[3 * n + 2];
+    }
+
+    mm_contains_pairs(mm, keys, values, n, results);
+
+    for (i = 0; i < n; i++) {
+        if ((results[i] && !answers[i]) || (!results[i] && answers[i])) {
+            printf(" * (%d, %d) should%s be present:  FAIL\n",
+                keys[i], values[i], answers[i] ? "" : " NOT");
+            wrong++;
+        }
+    }
+
+    return wrong;
+}
+
+
+/* The file that mm_save() is tested with. */
+#define SAVE_PATH "mmtest.dat"
+
+
+/* Counts the pairs passed to it, for checking traversals of a saved
+ * multimap.
+ */
+int pair_count;
+
+void count_pair(int key, int value) {
+    (void) key;
+    (void) value;
+    pair_count++;
+}
+
+
+/* Checks a multimap opened with mm_open_readonly() against the test values,
+ * and returns the number of checks that failed.
+ */
+int check_saved(multimap *mm) {
+    mm_cursor *cursor;
+    int i, key, value, cursor_count, wrong = 0;
+
+    wrong += check_probes(mm);
+    wrong += check_batch_probes(mm);
+
+    for (i = 0; probe_keys[i] != -1; i += 2) {
+        if (!mm_contains_key(mm, probe_keys[i]) != !probe_keys[i + 1])
+            wrong++;
+    }
+
+    prev_key = -1;
+    mm_traverse(mm, check_order);
+
+    for (i = 0; range_values[i] != -1; i += 3) {
+        pair_count = 0;
+        mm_range(mm, range_values[i], range_values[i + 1], count_pair);
+
+        cursor_count = 0;
+        cursor = mm_cursor_open(mm, range_values[i], range_values[i + 1]);
+        while (mm_cursor_next(cursor, &key, &value))
+            cursor_count++;
+        mm_cursor_close(cursor);
+
+        if (pair_count != range_values[i + 2] ||
+            cursor_count != range_values[i + 2]) {
+            wrong++;
+        }
+    }
+
+    return wrong;
+}
+
+
 int main() {
     multimap *mm;
     int i;
@@ -121,6 +258,11 @@ int main() {
         printf("\n");
     }
 
+    printf("\nProbing multimap for pairs in a batch.\n");
+    i = check_batch_probes(mm);
+    printf(" * mm_contains_pairs:  %s\n", i ? "FAIL" : "PASS");
+    failures += i;
+
     printf("\nProbing multimap for keys.\n");
     for (i = 0; probe_keys[i] != -1; i += 2) {
         int answer = probe_keys[i + 1];
@@ -144,6 +286,36 @@ int main() {
     prev_key = -1;
     mm_traverse(mm, check_order);
 
+    printf("\nChecking range queries.\n");
+    for (i = 0; range_values[i] != -1; i += 3) {
+        mm_cursor *cursor;
+        int key, value, cursor_count = 0;
+
+        range_lo = range_values[i];
+        range_hi = range_values[i + 1];
+        range_count = 0;
+        prev_key = -1;
+        printf("Range [%d, %d):\n", range_lo, range_hi);
+        mm_range(mm, range_lo, range_hi, check_range);
+
+        cursor = mm_cursor_open(mm, range_lo, range_hi);
+        while (mm_cursor_next(cursor, &key, &value)) {
+            if (key < range_lo || key >= range_hi)
+                failures++;
+            cursor_count++;
+        }
+        mm_cursor_close(cursor);
+
+        printf(" * mm_range found %d, cursor found %d, should be %d:  %s\n",
+            range_count, cursor_count, range_values[i + 2],
+            (range_count == range_values[i + 2] &&
+             cursor_count == range_values[i + 2]) ? "PASS" : "FAIL");
+        if (range_count != range_values[i + 2] ||
+            cursor_count != range_values[i + 2]) {
+            failures++;
+        }
+    }
+
     printf("\nChecking key removal.\n");
     for (i = 0; remove_values[i] != -1; i += 3) {
         int answer = remove_values[i + 2];
@@ -185,6 +357,59 @@ int main() {
         printf("\n");
     }
 
+    printf("\nTesting insertion after clearing.\n");
+    clear_multimap(mm);
+    i = mm_contains_key(mm, remove_values[0]);
+    mm_add_value(mm, remove_values[0], remove_values[1]);
+    i |= !mm_contains_pair(mm, remove_values[0], remove_values[1]);
+    printf(" * mm_add_value after clear_multimap:  %s\n", i ? "FAIL" : "PASS");
+    failures += i;
+
+    printf("\nTesting batch insertion.\n");
+    clear_multimap(mm);
+    free(mm);
+
+    mm = init_multimap();
+    mm_add_values(mm, batch_keys, batch_vals, NUM_BATCH_VALUES);
+    i = check_probes(mm);
+    printf(" * mm_add_values:  %s\n", i ? "FAIL" : "PASS");
+    failures += i;
+
+    prev_key = -1;
+    mm_traverse(mm, check_order);
+
+    mm_build_from_sorted(mm, sorted_keys, sorted_vals, NUM_BATCH_VALUES);
+    i = check_probes(mm);
+    printf(" * mm_build_from_sorted:  %s\n", i ? "FAIL" : "PASS");
+    failures += i;
+
+    printf("\nTesting saving and read-only opening.\n");
+    if (mm_save(mm, SAVE_PATH) != 0) {
+        printf(" * mm_save:  FAIL\n");
+        failures++;
+    }
+    else {
+        multimap *saved = mm_open_readonly(SAVE_PATH);
+
+        if (saved == NULL) {
+            printf(" * mm_open_readonly:  FAIL\n");
+            failures++;
+        }
+        else {
+            i = check_saved(saved);
+            printf(" * mm_open_readonly:  %s\n", i ? "FAIL" : "PASS");
+            failures += i;
+            clear_multimap(saved);
+            free(saved);
+        }
+        remove(SAVE_PATH);
+    }
+
+    i = (mm_open_readonly("no/such/" SAVE_PATH) != NULL);
+    printf(" * mm_open_readonly of a missing file:  %s\n",
+        i ? "FAIL" : "PASS");
+    failures += i;
+
     printf("\nTesting finished, freeing multimap.\n");
     clear_multimap(mm);
     free(mm);
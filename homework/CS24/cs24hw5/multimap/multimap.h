@@ -12,6 +12,9 @@
 
 typedef struct multimap multimap;
 
+/* A position in an ordered scan over part of a multimap. */
+typedef struct mm_cursor mm_cursor;
+
 
 /* Allocate and initialize a multimap data structure. */
 multimap * init_multimap();
@@ -24,6 +27,17 @@ void clear_multimap(multimap *mm);
 /* Adds the specified (key, value) pair to the multimap. */
 void mm_add_value(multimap *mm, int key, int value);
 
+/* Adds n (key, value) pairs to the multimap, the i-th pair being
+ * (keys[i], values[i]).  The pairs can be in any order.
+ */
+void mm_add_values(multimap *mm, const int *keys, const int *values, int n);
+
+/* Replaces the contents of the multimap with n (key, value) pairs, which must
+ * be sorted by key.
+ */
+void mm_build_from_sorted(multimap *mm, const int *keys, const int *values,
+                          int n);
+
 /* Returns nonzero if the multimap contains the specified key-value, zero
  * otherwise.
  */
@@ -34,6 +48,15 @@ int mm_contains_key(multimap *mm, int key);
  */
 int mm_contains_pair(multimap *mm, int key, int value);
 
+/* Probes the multimap for n (key, value) pairs, the i-th pair being
+ * (keys[i], values[i]).  results[i] is set to nonzero if the multimap
+ * contains the i-th pair, or zero otherwise.  This gives the same answers as
+ * calling mm_contains_pair() n times, but can be much faster on large
+ * multimaps, since several probes are in flight at once.
+ */
+void mm_contains_pairs(multimap *mm, const int *keys, const int *values,
+                       int n, int *results);
+
 /* Removes the specified (key, value) pair from the multimap.  Returns 1 if
  * the specified pair was found, or 0 if the pair was not found.
  */
@@ -44,5 +67,37 @@ int mm_remove_pair(multimap *mm, int key, int value);
  */
 void mm_traverse(multimap *mm, void (*f)(int key, int value));
 
+/* Performs an in-order traversal of the pairs whose keys are in the range
+ * [lo, hi), passing each (key, value) pair to the specified function.
+ */
+void mm_range(multimap *mm, int lo, int hi, void (*f)(int key, int value));
+
+/* Opens a cursor over the pairs whose keys are in the range [lo, hi), in key
+ * order.  The multimap must not be changed while the cursor is open.
+ */
+mm_cursor * mm_cursor_open(multimap *mm, int lo, int hi);
+
+/* Stores the next (key, value) pair of the cursor's range in *key and
+ * *value and returns 1, or returns 0 if the cursor's range is exhausted.
+ */
+int mm_cursor_next(mm_cursor *cursor, int *key, int *value);
+
+/* Releases a cursor returned by mm_cursor_open(). */
+void mm_cursor_close(mm_cursor *cursor);
+
+/* Writes the contents of the multimap to the specified file, in a flat
+ * layout that mm_open_readonly() can map into memory.  Returns 0 on success,
+ * or -1 on failure, with errno set.
+ */
+int mm_save(multimap *mm, const char *path);
+
+/* Opens a file written by mm_save() as a multimap that is queried in place,
+ * without reading the file in.  The multimap can't be changed with
+ * mm_add_value(), mm_add_values() or mm_remove_pair(); clear_multimap()
+ * closes the file, leaving an empty multimap that can be.  Returns NULL if
+ * the file can't be opened or wasn't written by mm_save().
+ */
+multimap * mm_open_readonly(const char *path);
+
 #endif
 
@@ -5,9 +5,13 @@
 #include <math.h>
 
 #include "multimap.h"
+#include "frozen_mm.h"
+#include "value_set.h"
 
 #define NODE_LIST_START_SIZE   64
-#define VALUE_LIST_START_SIZE  1
+
+/* The number of probes that mm_contains_pairs() prefetches for at once. */
+#define PROBE_GROUP            16
 
 /*============================================================================
  * TYPES
@@ -18,18 +22,12 @@
  *   programs are generic and don't have any access to implementation details.
  *============================================================================*/
 
- /* Represents a the set of values that are associated with a given key. */
-typedef struct value_list {
-    int * list;
-    int size;
-    int max;
-} value_list;
-
-
 /* Represents a key and its associated values in the multimap. */
 typedef struct multimap_node {
-    /* A struct containing values associated with this key in the multimap. */
-    struct value_list * values;
+    /* The values associated with this key in the multimap.  These are kept
+     * in the node itself, so keys with few values need no other memory.
+     */
+    value_set values;
 } multimap_node;
 
 
@@ -43,6 +41,26 @@ typedef struct node_list {
 /* The entry-point of the multimap data structure. */
 struct multimap {
     struct node_list * nodes;
+
+    /* The file this multimap was opened from by mm_open_readonly(), or NULL.
+     * The node list of a read-only multimap stays empty.
+     */
+    frozen_mm * frozen;
+};
+
+
+/* A cursor over a range of keys.  Since keys are indexes into the node
+ * list, the cursor is just the next key to look at, and a position in its
+ * values.
+ */
+struct mm_cursor {
+    multimap * mm;
+    int key;
+    vs_iter it;
+    int hi;
+
+    /* Where the cursor is in the file, if the multimap is read-only. */
+    fm_cursor frozen_cursor;
 };
 
 
@@ -57,13 +75,6 @@ multimap_node * find_mm_node(multimap * mm, int key, int create_if_not_found);
 void free_multimap_node(multimap_node *node);
 multimap_node new_mm_node();
 
-/*value list functions. */
-value_list * new_value_list();
-void add_to_value_list(value_list * vl, int value);
-int remove_from_value_list(value_list * vl, int value);
-int find_in_value_list(value_list * vl, int value);
-void free_value_list(value_list * vl);
-
 /* node list functions. */
 node_list * new_node_list();
 void add_to_node_list(node_list * nl, int key);
@@ -75,96 +86,11 @@ void free_node_list(node_list * nl);
  * FUNCTION IMPLEMENTATIONS
  *============================================================================*/
 
-/* Creates and returns new value_list. */
-value_list * new_value_list() {
-    struct value_list * vl = (value_list *) malloc(sizeof(struct value_list));
-
-    /* Make sure alloc worked. */
-    if (vl == NULL) {
-        printf("error: unable to allocate memory for value_list.\n");
-    }
-
-    vl->size = 0;
-    vl->max = VALUE_LIST_START_SIZE;
-    vl->list = (int *) malloc(vl->max * sizeof(int));
-
-    /* Make sure alloc worked. */
-    if (vl->list == NULL) {
-        printf("error: unable to allocate memory for value_list.\n");
-    }
-
-    return vl;
-}
-
-/* Adds value to value_list. Makes larger if needed. */
-void add_to_value_list(value_list * vl, int value) {
-    /* Check if resizing is needed. */
-    if (vl->size + 1 > vl->max) {
-        /* Make new size double. */
-        vl->max *= 2;
-        vl->list = (int *) realloc(vl->list, vl->max * sizeof(int));
-
-        /* Make sure realloc worked. */
-        if (vl->list == NULL) {
-            printf("error: unable to reallocate memory for value_list.\n");
-        }
-    }
-
-    /* Add new value to list. */
-    vl->list[vl->size] = value;
-    vl->size++;
-}
-
-/* Removes value from value_list. Makes smaller if needed. */
-int remove_from_value_list(value_list * vl, int value) {
-    /*Find value in list. */
-    int i = 0, flag = 0;
-    for (i = 0; i < vl->size; ++i) {
-        if (vl->list[i] == value) {
-            /* Remove by replacing with last value and decreasing size. */
-            vl->list[i] = vl->list[vl->size - 1];
-            vl->size--;
-            flag = 1;
-            break;
-        }
-    }
-
-    /* If half of allocated memory, reallocate to use less memory. */
-    if (vl->size <= (vl->max / 2)) {
-        vl->max /= 2;
-        vl->list = (int *) realloc(vl->list, vl->max * sizeof(int));
-
-        /* Make sure realloc worked. */
-        if (vl->list == NULL) {
-            printf("error: unable to reallocate memory for value_list.\n");
-        }
-    }
-
-    /* 1 if found the value, 0 otherwise. */
-    return flag;
-}
-
-/* Returns 1 if value is in list, 0 otherwise. */
-int find_in_value_list(value_list * vl, int value) {
-    int i = 0;
-    for (i = 0; i < vl->size; ++i) {
-        if (vl->list[i] == value) {
-            return 1;
-        }
-    }
-    return 0;
-}
-
-/* Frees the value_list. */
-void free_value_list(value_list * vl) {
-    free(vl->list);
-}
-
 /* Creates and returns new multimap node. */
 multimap_node new_mm_node() {
     multimap_node node;
-    /* Create a value list for the node. */
-    node.values = new_value_list();
+    /* Start the node with no values. */
+    vs_init(&node.values);
 
     return node;
 }
@@ -221,9 +147,8 @@ void add_to_node_list(node_list * nl, int key) {
 int remove_from_node_list(node_list * nl, int key) {
     /* Check if key is in node list. */
     if (key < nl->size) {
-        /* Free the list, create a new one. */
-        free(nl->list[key].values);
-        nl->list[key].values = new_value_list();
+        /* Free the values, leaving the node empty. */
+        vs_free(&nl->list[key].values);
         return 1;
     }
 
@@ -237,8 +162,13 @@ multimap_node find_in_node_list(node_list * nl, int key) {
     return nl->list[key];
 }
 
-/* Frees a node list. */
+/* Frees a node list, along with all of its nodes' values. */
 void free_node_list(node_list * nl) {
+    int i;
+    for (i = 0; i < nl->size; ++i) {
+        vs_free(&nl->list[i].values);
+    }
+    free(nl->list);
     free(nl);
 }
 
@@ -274,7 +204,7 @@ void free_multimap_node(multimap_node *node) {
         return;
 
     /* Free the list of values. */
-    free_value_list(node->values);
+    vs_free(&node->values);
 
     /* Free node itself. */
     free(node);
@@ -286,29 +216,85 @@ multimap * init_multimap() {
     multimap *mm = malloc(sizeof(multimap));
     /* Allocates a node_list for the new multimap. */
     mm->nodes = new_node_list();
+    mm->frozen = NULL;
 
     return mm;
 }
 
 
 /* Release all dynamically allocated memory associated with the multimap
- * data structure.
+ * data structure.  The multimap is left empty, with a new node list, so that
+ * values can be added to it again.
  */
 void clear_multimap(multimap *mm) {
     assert(mm != NULL);
 
-    /* Free the node list. */
+    /* Close the file of a read-only multimap. */
+    if (mm->frozen != NULL) {
+        fm_close(mm->frozen);
+        mm->frozen = NULL;
+    }
+
+    /* Free the node list, and start over with an empty one. */
     free_node_list(mm->nodes);
+    mm->nodes = new_node_list();
 }
 
 
 /* Adds the specified (key, value) pair to the multimap. */
 void mm_add_value(multimap *mm, int key, int value) {
+    multimap_node * node;
+
+    if (mm->frozen != NULL) {
+        fm_read_only();
+    }
+
     /* Find key's node, if it does not exist then create. */
-    multimap_node * node = find_mm_node(mm, key, /* create */ 1);
+    node = find_mm_node(mm, key, /* create */ 1);
 
     /* Add the value to the nodes list. */
-    add_to_value_list(node->values, value);
+    vs_add(&node->values, value);
+}
+
+
+/* Adds n (key, value) pairs to the multimap.  The node list is grown once,
+ * to fit the largest key, before any of the values are added.
+ */
+void mm_add_values(multimap *mm, const int *keys, const int *values, int n) {
+    int i, max_key;
+
+    if (mm->frozen != NULL) {
+        fm_read_only();
+    }
+
+    if (n <= 0)
+        return;
+
+    /* Make room for every key in the batch. */
+    max_key = keys[0];
+    for (i = 1; i < n; ++i) {
+        if (keys[i] > max_key) {
+            max_key = keys[i];
+        }
+    }
+    add_to_node_list(mm->nodes, max_key);
+
+    /* Add the values straight to their nodes. */
+    for (i = 0; i < n; ++i) {
+        vs_add(&mm->nodes->list[keys[i]].values, values[i]);
+    }
+}
+
+
+/* Replaces the contents of the multimap with n (key, value) pairs that are
+ * already sorted by key.
+ */
+void mm_build_from_sorted(multimap *mm, const int *keys, const int *values,
+                          int n) {
+    /* Start over with an empty node list. */
+    clear_multimap(mm);
+
+    mm_add_values(mm, keys, values, n);
 }
 
 
@@ -318,6 +304,10 @@ void mm_add_value(multimap *mm, int key, int value) {
 int mm_contains_key(multimap *mm, int key) {
     multimap_node *node;
 
+    if (mm->frozen != NULL) {
+        return fm_contains_key(mm->frozen, key);
+    }
+
     /* Get the node. */
     node = find_mm_node(mm, key, /* create */ 0);
 
@@ -326,7 +316,7 @@ int mm_contains_key(multimap *mm, int key) {
         return 0;
     }
 
-    if (node->values->size == 0) {
+    if (node->values.size == 0) {
         return 0;
     }
 
@@ -343,6 +333,10 @@ int mm_contains_pair(multimap *mm, int key, int value) {
 
     assert(mm != NULL);
 
+    if (mm->frozen != NULL) {
+        return fm_contains_pair(mm->frozen, key, value);
+    }
+
     /* Get the node. */
     node = find_mm_node(mm, key, /* create */ 0);
 
@@ -352,7 +346,50 @@ int mm_contains_pair(multimap *mm, int key, int value) {
     }
 
     /* Node exists, so check if value is in and return that. */
-    return find_in_value_list(node->values, value);
+    return vs_contains(&node->values, value);
+}
+
+
+/* Probes the multimap for n (key, value) pairs.  A lookup here is a load
+ * of the key's node, and then, if the key has too many values to keep in the
+ * node, a load of its value_set storage.  Each stage is prefetched for a
+ * whole group of probes before the next stage needs it.
+ */
+void mm_contains_pairs(multimap *mm, const int *keys, const int *values,
+                       int n, int *results) {
+    value_set *sets[PROBE_GROUP];
+    int start, count, i;
+
+    if (mm->frozen != NULL) {
+        fm_contains_pairs(mm->frozen, keys, values, n, results);
+        return;
+    }
+
+    for (start = 0; start < n; start += count) {
+        count = (n - start < PROBE_GROUP) ? n - start : PROBE_GROUP;
+
+        /* The key's node holds its value_set. */
+        for (i = 0; i < count; ++i) {
+            if (keys[start + i] < mm->nodes->size) {
+                __builtin_prefetch(&mm->nodes->list[keys[start + i]]);
+            }
+        }
+
+        /* The value_set may point at the values. */
+        for (i = 0; i < count; ++i) {
+            int key = keys[start + i];
+            sets[i] = (key < mm->nodes->size) ?
+                &mm->nodes->list[key].values : NULL;
+            if (sets[i] != NULL) {
+                vs_prefetch(sets[i], values[start + i]);
+            }
+        }
+
+        for (i = 0; i < count; ++i) {
+            results[start + i] = (sets[i] != NULL) &&
+                vs_contains(sets[i], values[start + i]);
+        }
+    }
 }
 
 
@@ -364,6 +401,10 @@ int mm_remove_pair(multimap *mm, int key, int value) {
 
     assert(mm != NULL);
 
+    if (mm->frozen != NULL) {
+        fm_read_only();
+    }
+
     /* Find key's node, if it does not exist then do not create. */
     node = find_mm_node(mm, key, /* create */ 0);
 
@@ -372,7 +413,7 @@ int mm_remove_pair(multimap *mm, int key, int value) {
         return 0;
 
     /* Remove the value from the node's list and return whether or not found. */
-    return remove_from_value_list(node->values, value);
+    return vs_remove(&node->values, value);
 }
 
 
@@ -380,11 +421,138 @@ int mm_remove_pair(multimap *mm, int key, int value) {
  * pair to the specified function.
  */
 void mm_traverse(multimap *mm, void (*f)(int key, int value)) {
-    int i, j;
+    vs_iter it;
+    int i, value;
+
+    if (mm->frozen != NULL) {
+        fm_traverse(mm->frozen, f);
+        return;
+    }
+
     for (i = 0; i < mm->nodes->size; ++i) {
-        for (j = 0; j < mm->nodes->list[i].values->size; ++j) {
-            (*f) (i, mm->nodes->list[i].values->list[j]);
+        vs_iter_init(&it);
+        while (vs_iter_next(&mm->nodes->list[i].values, &it, &value)) {
+            (*f) (i, value);
         }
     }
 }
 
+
+/* Performs an in-order traversal of the pairs whose keys are in [lo, hi).
+ * Only the part of the node list inside the range is visited.
+ */
+void mm_range(multimap *mm, int lo, int hi, void (*f)(int key, int value)) {
+    vs_iter it;
+    int i, value;
+
+    if (mm->frozen != NULL) {
+        fm_range(mm->frozen, lo, hi, f);
+        return;
+    }
+
+    /* Keys can't be negative or past the end of the node list. */
+    if (lo < 0) {
+        lo = 0;
+    }
+    if (hi > mm->nodes->size) {
+        hi = mm->nodes->size;
+    }
+
+    for (i = lo; i < hi; ++i) {
+        vs_iter_init(&it);
+        while (vs_iter_next(&mm->nodes->list[i].values, &it, &value)) {
+            (*f) (i, value);
+        }
+    }
+}
+
+
+/* Opens a cursor over the pairs whose keys are in [lo, hi). */
+mm_cursor * mm_cursor_open(multimap *mm, int lo, int hi) {
+    mm_cursor * cursor = (mm_cursor *) malloc(sizeof(mm_cursor));
+
+    /* Make sure alloc worked. */
+    if (cursor == NULL) {
+        printf("error: unable to allocate memory for cursor.\n");
+    }
+
+    cursor->mm = mm;
+    cursor->key = (lo < 0) ? 0 : lo;
+    vs_iter_init(&cursor->it);
+    cursor->hi = hi;
+
+    if (mm->frozen != NULL) {
+        fm_cursor_open(mm->frozen, &cursor->frozen_cursor, lo, hi);
+    }
+
+    return cursor;
+}
+
+
+/* Returns the cursor's next pair, skipping keys without any values. */
+int mm_cursor_next(mm_cursor *cursor, int *key, int *value) {
+    node_list * nl = cursor->mm->nodes;
+
+    if (cursor->mm->frozen != NULL) {
+        return fm_cursor_next(cursor->mm->frozen, &cursor->frozen_cursor,
+                              key, value);
+    }
+
+    while (cursor->key < cursor->hi && cursor->key < nl->size) {
+        if (vs_iter_next(&nl->list[cursor->key].values, &cursor->it, value)) {
+            *key = cursor->key;
+            return 1;
+        }
+
+        cursor->key++;
+        vs_iter_init(&cursor->it);
+    }
+
+    return 0;
+}
+
+
+/* Releases a cursor returned by mm_cursor_open(). */
+void mm_cursor_close(mm_cursor *cursor) {
+    free(cursor);
+}
+
+
+
+/* Writes the multimap to a file.  The node list is already in key order. */
+int mm_save(multimap *mm, const char *path) {
+    frozen_writer fw;
+    vs_iter it;
+    int i, value;
+
+    assert(mm != NULL);
+
+    if (mm->frozen != NULL) {
+        return fm_save(mm->frozen, path);
+    }
+
+    fw_init(&fw);
+    for (i = 0; i < mm->nodes->size; ++i) {
+        vs_iter_init(&it);
+        while (vs_iter_next(&mm->nodes->list[i].values, &it, &value)) {
+            fw_add(&fw, i, value);
+        }
+    }
+
+    return fw_finish(&fw, path);
+}
+
+
+/* Opens a file written by mm_save() as a read-only multimap. */
+multimap * mm_open_readonly(const char *path) {
+    frozen_mm * fm = fm_open(path);
+    multimap * mm;
+
+    if (fm == NULL) {
+        return NULL;
+    }
+
+    mm = init_multimap();
+    mm->frozen = fm;
+    return mm;
+}
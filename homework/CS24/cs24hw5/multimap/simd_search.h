@@ -0,0 +1,171 @@
+/* Vectorized searches over arrays of ints, shared by the multimap
+ * implementations.  Each search has an AVX2 version, an SSE2 version, and a
+ * plain C version, and the best one the compiler is allowed to use is chosen
+ * when the file is compiled.  (SSE2 is always available on x86-64; AVX2 has
+ * to be turned on with -mavx2 or -march.)
+ */
+
+#ifndef SIMD_SEARCH_H
+#define SIMD_SEARCH_H
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+/* The number of keys searched by count_keys_less() and
+ * count_keys_less_equal().  The keys must be readable all the way to the
+ * end, even if fewer of them are in use.
+ */
+#define SEARCH_BLOCK_KEYS 16
+
+
+/* Returns a bit-mask of the keys in keys[0 .. SEARCH_BLOCK_KEYS) that are
+ * greater than key, with bit i standing for keys[i].
+ */
+static inline unsigned int block_mask_greater(const int *keys, int key) {
+#if defined(__AVX2__)
+    __m256i k = _mm256_set1_epi32(key);
+    __m256i lo = _mm256_loadu_si256((const __m256i *) keys);
+    __m256i hi = _mm256_loadu_si256((const __m256i *) (keys + 8));
+    unsigned int m_lo, m_hi;
+
+    m_lo = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(lo, k)));
+    m_hi = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(hi, k)));
+    return m_lo | (m_hi << 8);
+#elif defined(__SSE2__)
+    __m128i k = _mm_set1_epi32(key);
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < SEARCH_BLOCK_KEYS; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (keys + i));
+        mask |= (unsigned int)
+            _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, k))) << i;
+    }
+    return mask;
+#else
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < SEARCH_BLOCK_KEYS; i++) {
+        if (keys[i] > key)
+            mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+
+/* Returns a bit-mask of the keys in keys[0 .. SEARCH_BLOCK_KEYS) that are
+ * less than key.
+ */
+static inline unsigned int block_mask_less(const int *keys, int key) {
+#if defined(__AVX2__)
+    __m256i k = _mm256_set1_epi32(key);
+    __m256i lo = _mm256_loadu_si256((const __m256i *) keys);
+    __m256i hi = _mm256_loadu_si256((const __m256i *) (keys + 8));
+    unsigned int m_lo, m_hi;
+
+    m_lo = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, lo)));
+    m_hi = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, hi)));
+    return m_lo | (m_hi << 8);
+#elif defined(__SSE2__)
+    __m128i k = _mm_set1_epi32(key);
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < SEARCH_BLOCK_KEYS; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (keys + i));
+        mask |= (unsigned int)
+            _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, v))) << i;
+    }
+    return mask;
+#else
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < SEARCH_BLOCK_KEYS; i++) {
+        if (keys[i] < key)
+            mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+
+/* Given the first n keys of a sorted block of SEARCH_BLOCK_KEYS keys, returns
+ * how many of them are less than key.  This is the index of the first key
+ * that isn't less than key.
+ */
+static inline int count_keys_less(const int *keys, int n, int key) {
+    unsigned int valid = (n < 32) ? (1u << n) - 1 : ~0u;
+    return __builtin_popcount(block_mask_less(keys, key) & valid);
+}
+
+
+/* Given the first n keys of a sorted block of SEARCH_BLOCK_KEYS keys, returns
+ * how many of them are less than or equal to key.
+ */
+static inline int count_keys_less_equal(const int *keys, int n, int key) {
+    unsigned int valid = (n < 32) ? (1u << n) - 1 : ~0u;
+    return n - __builtin_popcount(block_mask_greater(keys, key) & valid);
+}
+
+
+/* Returns 1 if value appears in list[0 .. n), or 0 otherwise.  The list
+ * doesn't have to be sorted.
+ */
+static inline int find_int(const int *list, int n, int value) {
+    int i = 0;
+
+#if defined(__AVX2__)
+    __m256i v = _mm256_set1_epi32(value);
+
+    /* Test 16 values per iteration, with one test for a match. */
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (list + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (list + i + 8));
+        __m256i eq = _mm256_or_si256(_mm256_cmpeq_epi32(a, v),
+                                     _mm256_cmpeq_epi32(b, v));
+        if (!_mm256_testz_si256(eq, eq))
+            return 1;
+    }
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (list + i));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, v)))
+            return 1;
+    }
+#elif defined(__SSE2__)
+    __m128i v = _mm_set1_epi32(value);
+
+    /* Test 16 values per iteration, with one test for a match. */
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (list + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (list + i + 4));
+        __m128i c = _mm_loadu_si128((const __m128i *) (list + i + 8));
+        __m128i d = _mm_loadu_si128((const __m128i *) (list + i + 12));
+        __m128i eq = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(a, v), _mm_cmpeq_epi32(b, v)),
+            _mm_or_si128(_mm_cmpeq_epi32(c, v), _mm_cmpeq_epi32(d, v)));
+        if (_mm_movemask_epi8(eq))
+            return 1;
+    }
+    for (; i + 4 <= n; i += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (list + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, v)))
+            return 1;
+    }
+#endif
+
+    for (; i < n; i++) {
+        if (list[i] == value)
+            return 1;
+    }
+    return 0;
+}
+
+
+#endif /* SIMD_SEARCH_H */
@@ -0,0 +1,467 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "value_set.h"
+#include "simd_search.h"
+
+
+/* The capacity of a sorted array when a set first needs one. */
+#define SORTED_START_SIZE  8
+
+/* The unsorted tail of a sorted array is merged into the sorted part once it
+ * is longer than this, and longer than 1/TAIL_RATIO of the sorted part.
+ */
+#define TAIL_MIN    16
+#define TAIL_RATIO  8
+
+/* A set of counts is switched back to a sorted array once its range is more
+ * than twice its size plus this, so that a set doesn't flip back and forth
+ * between the two as values are added and removed.
+ */
+#define COUNTS_SLACK  64
+
+/* The largest count a counter can hold. */
+#define MAX_COUNT  0xffff
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *============================================================================*/
+
+sorted_values * alloc_sorted(int max);
+value_counts * alloc_counts(int range);
+void make_sorted(value_set *vs, int max);
+void make_inline(value_set *vs);
+void merge_tail(value_set *vs);
+int try_make_counts(value_set *vs);
+int lower_bound(const int *values, int n, int value);
+int compare_ints(const void *a, const void *b);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Allocates a sorted_values with room for max values, and no values. */
+sorted_values * alloc_sorted(int max) {
+    sorted_values *sorted = malloc(sizeof(sorted_values) + max * sizeof(int));
+
+    if (sorted == NULL) {
+        printf("error: unable to allocate memory for value_set.\n");
+        abort();
+    }
+
+    sorted->max = max;
+    sorted->num_sorted = 0;
+    return sorted;
+}
+
+
+/* Allocates a value_counts with the specified number of zeroed counters. */
+value_counts * alloc_counts(int range) {
+    value_counts *counts = calloc(1, sizeof(value_counts) +
+                                  range * sizeof(unsigned short));
+
+    if (counts == NULL) {
+        printf("error: unable to allocate memory for value_set.\n");
+        abort();
+    }
+
+    counts->range = range;
+    return counts;
+}
+
+
+/* qsort() comparison for ints. */
+int compare_ints(const void *a, const void *b) {
+    int i1 = *(const int *) a, i2 = *(const int *) b;
+    return (i1 > i2) - (i1 < i2);
+}
+
+
+/* Returns the index of the first of the n sorted values that isn't less
+ * than value.
+ */
+int lower_bound(const int *values, int n, int value) {
+    int lo = 0, hi = n;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (values[mid] < value)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+
+/* Initializes an empty value_set. */
+void vs_init(value_set *vs) {
+    vs->size = 0;
+    vs->kind = VS_INLINE;
+}
+
+
+/* Frees the values in the value_set, leaving it empty. */
+void vs_free(value_set *vs) {
+    if (vs->kind == VS_SORTED)
+        free(vs->u.sorted);
+    else if (vs->kind == VS_COUNTS)
+        free(vs->u.counts);
+
+    vs_init(vs);
+}
+
+
+/* Switches a set to a sorted array with room for at least max values.  The
+ * values go into the unsorted tail, except that a set of counts is already
+ * in order.
+ */
+void make_sorted(value_set *vs, int max) {
+    sorted_values *sorted;
+    vs_iter it;
+    int i = 0, value;
+
+    if (max < SORTED_START_SIZE)
+        max = SORTED_START_SIZE;
+    sorted = alloc_sorted(max);
+
+    vs_iter_init(&it);
+    while (vs_iter_next(vs, &it, &value))
+        sorted->values[i++] = value;
+    assert(i == vs->size);
+
+    if (vs->kind == VS_COUNTS) {
+        sorted->num_sorted = i;
+        free(vs->u.counts);
+    }
+
+    vs->kind = VS_SORTED;
+    vs->u.sorted = sorted;
+}
+
+
+/* Switches a set that has few enough values back to inline storage. */
+void make_inline(value_set *vs) {
+    int values[VS_INLINE_VALUES];
+    vs_iter it;
+    int i = 0, value, size = vs->size;
+
+    assert(size <= VS_INLINE_VALUES);
+
+    vs_iter_init(&it);
+    while (vs_iter_next(vs, &it, &value))
+        values[i++] = value;
+
+    vs_free(vs);
+    memcpy(vs->u.values, values, size * sizeof(int));
+    vs->size = size;
+}
+
+
+/* Sorts the unsorted tail of a sorted array and merges it into the sorted
+ * part.  The merge runs from the back, so only the tail needs to be copied
+ * out of the way.
+ */
+void merge_tail(value_set *vs) {
+    sorted_values *sorted = vs->u.sorted;
+    int tail_size = vs->size - sorted->num_sorted;
+    int *tail, i, j, k;
+
+    if (tail_size == 0)
+        return;
+
+    tail = malloc(tail_size * sizeof(int));
+    if (tail == NULL) {
+        printf("error: unable to allocate memory for value_set.\n");
+        abort();
+    }
+
+    memcpy(tail, sorted->values + sorted->num_sorted, tail_size * sizeof(int));
+    qsort(tail, tail_size, sizeof(int), compare_ints);
+
+    i = sorted->num_sorted - 1;
+    j = tail_size - 1;
+    for (k = vs->size - 1; j >= 0; k--) {
+        if (i >= 0 && sorted->values[i] > tail[j])
+            sorted->values[k] = sorted->values[i--];
+        else
+            sorted->values[k] = tail[j--];
+    }
+
+    sorted->num_sorted = vs->size;
+    free(tail);
+}
+
+
+/* Switches a fully sorted array to counts, if the values are dense enough
+ * that the counts are no larger, and no value repeats too often for its
+ * counter.  Returns 1 if the set was switched.
+ */
+int try_make_counts(value_set *vs) {
+    sorted_values *sorted = vs->u.sorted;
+    value_counts *counts;
+    long long range;
+    int i;
+
+    assert(sorted->num_sorted == vs->size && vs->size > 0);
+
+    range = (long long) sorted->values[vs->size - 1] - sorted->values[0] + 1;
+    if (range > vs->size)
+        return 0;
+
+    counts = alloc_counts((int) range);
+    counts->base = sorted->values[0];
+    for (i = 0; i < vs->size; i++) {
+        unsigned short *count =
+            &counts->counts[sorted->values[i] - counts->base];
+        if (*count == MAX_COUNT) {
+            free(counts);
+            return 0;
+        }
+        (*count)++;
+    }
+
+    free(sorted);
+    vs->kind = VS_COUNTS;
+    vs->u.counts = counts;
+    return 1;
+}
+
+
+/* Adds a value to the set. */
+void vs_add(value_set *vs, int value) {
+    int tail_size;
+
+    if (vs->kind == VS_INLINE) {
+        if (vs->size < VS_INLINE_VALUES) {
+            vs->u.values[vs->size++] = value;
+            return;
+        }
+        make_sorted(vs, 2 * vs->size);
+    }
+
+    if (vs->kind == VS_COUNTS) {
+        value_counts *counts = vs->u.counts;
+        long long index = (long long) value - counts->base;
+
+        if (index >= 0 && index < counts->range &&
+            counts->counts[index] < MAX_COUNT) {
+            counts->counts[index]++;
+            vs->size++;
+            return;
+        }
+
+        if (index >= 0 && index < counts->range) {
+            /* The counter is full, so the values can't be counted. */
+            make_sorted(vs, 2 * vs->size);
+        }
+        else {
+            /* Widen the range to take in the value, if it stays dense. */
+            long long new_base = (index < 0) ? value : counts->base;
+            long long new_range =
+                (index < 0) ? counts->range - index : index + 1;
+
+            if (new_range <= vs->size + 1) {
+                value_counts *wider = alloc_counts((int) new_range);
+                wider->base = (int) new_base;
+                memcpy(wider->counts + (counts->base - new_base),
+                       counts->counts, counts->range * sizeof(unsigned short));
+                wider->counts[value - new_base]++;
+                free(counts);
+                vs->u.counts = wider;
+                vs->size++;
+                return;
+            }
+
+            make_sorted(vs, 2 * vs->size);
+        }
+    }
+
+    /* Now the set is a sorted array.  Append to the tail. */
+    if (vs->size == vs->u.sorted->max) {
+        int max = 2 * vs->u.sorted->max;
+        vs->u.sorted = realloc(vs->u.sorted,
+                               sizeof(sorted_values) + max * sizeof(int));
+        if (vs->u.sorted == NULL) {
+            printf("error: unable to reallocate memory for value_set.\n");
+            abort();
+        }
+        vs->u.sorted->max = max;
+    }
+    vs->u.sorted->values[vs->size++] = value;
+
+    tail_size = vs->size - vs->u.sorted->num_sorted;
+    if (tail_size > TAIL_MIN &&
+        tail_size > vs->u.sorted->num_sorted / TAIL_RATIO) {
+        merge_tail(vs);
+        try_make_counts(vs);
+    }
+}
+
+
+/* Removes one instance of value from the set.  Returns 1 if the value was
+ * found, 0 otherwise.
+ */
+int vs_remove(value_set *vs, int value) {
+    int i;
+
+    switch (vs->kind) {
+    case VS_INLINE:
+        for (i = 0; i < vs->size; i++) {
+            if (vs->u.values[i] == value) {
+                vs->u.values[i] = vs->u.values[vs->size - 1];
+                vs->size--;
+                return 1;
+            }
+        }
+        return 0;
+
+    case VS_SORTED: {
+        sorted_values *sorted = vs->u.sorted;
+
+        i = lower_bound(sorted->values, sorted->num_sorted, value);
+        if (i < sorted->num_sorted && sorted->values[i] == value) {
+            memmove(sorted->values + i, sorted->values + i + 1,
+                    (vs->size - i - 1) * sizeof(int));
+            sorted->num_sorted--;
+        }
+        else {
+            for (i = sorted->num_sorted; i < vs->size; i++) {
+                if (sorted->values[i] == value)
+                    break;
+            }
+            if (i == vs->size)
+                return 0;
+            sorted->values[i] = sorted->values[vs->size - 1];
+        }
+        vs->size--;
+        break;
+    }
+
+    case VS_COUNTS: {
+        value_counts *counts = vs->u.counts;
+        long long index = (long long) value - counts->base;
+
+        if (index < 0 || index >= counts->range || counts->counts[index] == 0)
+            return 0;
+
+        counts->counts[index]--;
+        vs->size--;
+
+        if (vs->size > VS_INLINE_VALUES &&
+            counts->range > 2 * vs->size + COUNTS_SLACK) {
+            make_sorted(vs, 2 * vs->size);
+        }
+        break;
+    }
+    }
+
+    if (vs->size <= VS_INLINE_VALUES)
+        make_inline(vs);
+
+    return 1;
+}
+
+
+/* Returns 1 if value is in the set, 0 otherwise. */
+int vs_contains(const value_set *vs, int value) {
+    int i;
+
+    switch (vs->kind) {
+    case VS_INLINE:
+        for (i = 0; i < vs->size; i++) {
+            if (vs->u.values[i] == value)
+                return 1;
+        }
+        return 0;
+
+    case VS_SORTED: {
+        const sorted_values *sorted = vs->u.sorted;
+
+        i = lower_bound(sorted->values, sorted->num_sorted, value);
+
+        if (i < sorted->num_sorted && sorted->values[i] == value)
+            return 1;
+        return find_int(sorted->values + sorted->num_sorted,
+                        vs->size - sorted->num_sorted, value);
+    }
+
+    default: {
+        const value_counts *counts = vs->u.counts;
+        long long index = (long long) value - counts->base;
+        return index >= 0 && index < counts->range && counts->counts[index];
+    }
+    }
+}
+
+
+/* Starts an iteration over a value_set. */
+void vs_iter_init(vs_iter *it) {
+    it->pos = 0;
+    it->repeat = 0;
+}
+
+
+/* Stores the next value of the set in *value and returns 1, or returns 0 if
+ * there are no more values.  The set must not change during an iteration.
+ */
+int vs_iter_next(const value_set *vs, vs_iter *it, int *value) {
+    if (vs->kind == VS_COUNTS) {
+        const value_counts *counts = vs->u.counts;
+
+        while (it->pos < counts->range) {
+            if (it->repeat < counts->counts[it->pos]) {
+                *value = counts->base + it->pos;
+                it->repeat++;
+                return 1;
+            }
+            it->pos++;
+            it->repeat = 0;
+        }
+        return 0;
+    }
+
+    if (it->pos == vs->size)
+        return 0;
+
+    if (vs->kind == VS_INLINE)
+        *value = vs->u.values[it->pos++];
+    else
+        *value = vs->u.sorted->values[it->pos++];
+    return 1;
+}
+
+
+/* Prefetches the out-of-line storage that vs_contains() will look at first
+ * when it looks for value:  the counter for the value, or the start of the
+ * sorted array.
+ */
+void vs_prefetch(const value_set *vs, int value) {
+    if (vs->kind == VS_COUNTS) {
+        const value_counts *counts = vs->u.counts;
+        long long index = (long long) value - counts->base;
+
+        __builtin_prefetch(counts);
+        if (index >= 0 && index < counts->range)
+            __builtin_prefetch(&counts->counts[index]);
+    }
+    else if (vs->kind == VS_SORTED) {
+        __builtin_prefetch(vs->u.sorted);
+    }
+}
+
+
+/* Returns the number of bytes of out-of-line storage the set uses. */
+long vs_memory(const value_set *vs) {
+    if (vs->kind == VS_SORTED)
+        return sizeof(sorted_values) + vs->u.sorted->max * sizeof(int);
+    if (vs->kind == VS_COUNTS)
+        return sizeof(value_counts) +
+               vs->u.counts->range * sizeof(unsigned short);
+    return 0;
+}
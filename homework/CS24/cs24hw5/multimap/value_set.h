@@ -0,0 +1,90 @@
+/* This file declares the value_set type, which holds the values associated
+ * with one key of a multimap.  A value may appear in the set more than once.
+ *
+ * The representation adapts to the number and spread of the values:
+ *
+ *   - A few values are stored inline, in the value_set itself, so keys with
+ *     one or two values don't need any other memory.
+ *
+ *   - More values are stored in an array that is mostly sorted.  New values
+ *     are appended to an unsorted tail, which is sorted and merged into the
+ *     rest once it grows past a fraction of the array, so adding a value
+ *     costs O(log n) amortized and lookups can binary-search the sorted part.
+ *
+ *   - When there are at least as many values as there are distinct numbers
+ *     between the smallest and the largest, the values are stored as a count
+ *     for each number in that range, which takes half the memory or less and
+ *     answers lookups with a single load.
+ */
+
+#ifndef VALUE_SET_H
+#define VALUE_SET_H
+
+
+/* The number of values that can be stored inline. */
+#define VS_INLINE_VALUES  2
+
+/* The representations a value_set can use. */
+#define VS_INLINE  0
+#define VS_SORTED  1
+#define VS_COUNTS  2
+
+
+/* The out-of-line storage of a VS_SORTED set.  values[0 .. num_sorted) are
+ * in increasing order, and values[num_sorted .. size) are in the order they
+ * were added.
+ */
+typedef struct sorted_values {
+    int max;
+    int num_sorted;
+    int values[];
+} sorted_values;
+
+
+/* The out-of-line storage of a VS_COUNTS set.  counts[i] is the number of
+ * times base + i appears in the set.
+ */
+typedef struct value_counts {
+    int base;
+    int range;
+    unsigned short counts[];
+} value_counts;
+
+
+typedef struct value_set {
+    /* The number of values in the set, counting repeats. */
+    int size;
+
+    /* Which representation the set uses; one of the VS_* constants. */
+    int kind;
+
+    union {
+        int values[VS_INLINE_VALUES];
+        sorted_values *sorted;
+        value_counts *counts;
+    } u;
+} value_set;
+
+
+/* The position of an iteration over a value_set. */
+typedef struct vs_iter {
+    int pos;
+    int repeat;
+} vs_iter;
+
+
+void vs_init(value_set *vs);
+void vs_free(value_set *vs);
+
+void vs_add(value_set *vs, int value);
+int vs_remove(value_set *vs, int value);
+int vs_contains(const value_set *vs, int value);
+
+void vs_iter_init(vs_iter *it);
+int vs_iter_next(const value_set *vs, vs_iter *it, int *value);
+
+void vs_prefetch(const value_set *vs, int value);
+long vs_memory(const value_set *vs);
+
+
+#endif /* VALUE_SET_H */
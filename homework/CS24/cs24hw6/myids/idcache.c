@@ -0,0 +1,86 @@
+/*
+ * A cache of the process's IDs.
+ *
+ * get_ids() makes a system call for each ID, every time it is called.  The
+ * IDs only change when the process changes them, with setuid() and the
+ * like, or forks, so they are read once here and kept until invalidate_ids()
+ * says they may have changed.  After that, a query is a few loads from
+ * memory, with no trip into the kernel.  A child process invalidates its
+ * copy when it is forked, since its process ID differs.
+ *
+ * The cache is a sequence lock:  the one thread that refreshes it makes
+ * seq odd while it writes, and readers retry if seq was odd or changed while
+ * they copied the IDs.  Readers never take the lock.
+ */
+#include <unistd.h>
+#include <pthread.h>
+#include "myids.h"
+#include "idcache.h"
+
+static id_info cached;
+static volatile unsigned int seq;
+static volatile int valid;
+static pthread_mutex_t refresh_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+
+/* Re-reads the IDs into the cache, unless another thread just did. */
+static void refresh_ids(void) {
+    pthread_mutex_lock(&refresh_lock);
+    if (!valid) {
+        seq++;
+        __sync_synchronize();
+
+        get_ids(&cached.uid, &cached.gid);
+        cached.euid = geteuid();
+        cached.egid = getegid();
+        cached.pid = getpid();
+
+        __sync_synchronize();
+        seq++;
+        valid = 1;
+    }
+    pthread_mutex_unlock(&refresh_lock);
+}
+
+
+static void register_atfork(void) {
+    pthread_atfork(NULL, NULL, invalidate_ids);
+}
+
+
+/* Stores all of the IDs of the process into *ids. */
+void get_id_info(id_info *ids) {
+    unsigned int start;
+
+    if (!valid) {
+        pthread_once(&atfork_once, register_atfork);
+        refresh_ids();
+    }
+
+    do {
+        start = seq;
+        __sync_synchronize();
+        *ids = cached;
+        __sync_synchronize();
+    } while ((start & 1) != 0 || start != seq);
+}
+
+
+/* The same as get_ids(), from the cache. */
+void get_cached_ids(int *uid, int *gid) {
+    id_info ids;
+
+    get_id_info(&ids);
+    *uid = ids.uid;
+    *gid = ids.gid;
+}
+
+
+/*
+ * Makes the next query read the IDs again.  Call this after anything that
+ * changes them, such as setuid(), setgid() or setresuid().
+ */
+void invalidate_ids(void) {
+    valid = 0;
+}
@@ -0,0 +1,17 @@
+#ifndef IDCACHE_H
+#define IDCACHE_H
+
+/* All of the IDs of the process, as get_id_info() returns them. */
+typedef struct id_info {
+    int uid;
+    int gid;
+    int euid;
+    int egid;
+    int pid;
+} id_info;
+
+void get_id_info(id_info *ids);
+void get_cached_ids(int *uid, int *gid);
+void invalidate_ids(void);
+
+#endif /* IDCACHE_H */
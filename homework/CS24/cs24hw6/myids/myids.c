@@ -1,9 +1,17 @@
 #include "myids.h"
+#include "idcache.h"
 
 int main() {
     int uid, gid;
+    id_info ids;
+
     get_ids(&uid, &gid);
     printf("User ID is %d. Group ID is %d.\n", uid, gid);
 
+    get_id_info(&ids);
+    printf("Cached:  user ID %d, group ID %d, effective user ID %d, "
+           "effective group ID %d, process ID %d.\n",
+           ids.uid, ids.gid, ids.euid, ids.egid, ids.pid);
+
     return 0;
 }
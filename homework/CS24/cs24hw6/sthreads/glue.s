@@ -12,8 +12,11 @@ scheduler_context:      .long   0
 # scheduler.  It has three parts:
 #
 #    1. Save the context of the current thread on the stack.
-#       The context includes only the integer registers
-#       and EFLAGS.
+#       Threads only get here by calling __sthread_schedule,
+#       so the context only needs the registers that the
+#       calling convention has the callee preserve:  %ebx,
+#       %esi, %edi and %ebp.  The others, and EFLAGS, are
+#       the caller's to save.
 #    2. Call __sthread_scheduler (the C scheduler function),
 #       passing the context as an argument.  The scheduler
 #       stack *must* be restored by setting %esp to the
@@ -28,12 +31,8 @@ scheduler_context:      .long   0
         .globl __sthread_schedule
 __sthread_schedule:
 
-        # Save the process state (all registers and flags) onto its stack
-        pushfl
-        push    %eax
+        # Save the callee-saved registers onto its stack
         push    %ebx
-        push    %ecx
-        push    %edx
         push    %esi
         push    %edi
         push    %ebp
@@ -51,15 +50,11 @@ __sthread_restore:
         # go to new stack
         mov     %eax, %esp
 
-        # Restore all process state (all registers and flags) from stack
+        # Restore the callee-saved registers from the stack
         pop     %ebp
         pop     %edi
         pop     %esi
-        pop     %edx
-        pop     %ecx
         pop     %ebx
-        pop     %eax
-        popfl
 
         ret
 
@@ -96,11 +91,7 @@ __sthread_initialize_context:
         push    12(%ebp)
 
         # need to push dummy values as if pushing registers
-        pushfl
-        push    %eax
         push    %ebx
-        push    %ecx
-        push    %edx
         push    %esi
         push    %edi
         push    %ebp
@@ -65,6 +65,12 @@ void __sthread_finish(void);
  */
 void __sthread_delete(Thread *threadp);
 
+/*
+ * This function deallocates the stack of a finished thread, leaving the
+ * Thread struct for the thread that joins it.
+ */
+static void __sthread_release_stack(Thread *threadp);
+
 /************************************************************************
  * Types and global variables.
  */
@@ -94,6 +100,8 @@ typedef enum {
     /*!
      * The thread's function has returned, and therefore the thread is ready to
      * be permanently removed from the scheduling mechanism and deallocated.
+     * Unless the thread is detached, its Thread struct is kept until another
+     * thread joins it.
      */
     ThreadFinished
 } ThreadState;
@@ -117,6 +125,15 @@ struct _thread {
      */
     ThreadContext *context;
 
+    /*
+     * The result that the thread finished with, the thread that is blocked
+     * waiting to join it, if any, and whether the thread is detached, so
+     * that it is deallocated as soon as it finishes.
+     */
+    void *result;
+    struct _thread *joiner;
+    int detached;
+
     /* The processes are linked in a doubly-linked list. */
     struct _thread *prev;
     struct _thread *next;
@@ -273,8 +290,14 @@ ThreadContext *__sthread_scheduler(ThreadContext *context) {
         current->context = context;
         /* Either queue up or deallocate current thread, based on its state. */
         if (current->state == ThreadFinished) {
-            /* Deallocatate because finished. */
-            __sthread_delete(current);
+            /*
+             * Deallocatate because finished, keeping the Thread struct of a
+             * thread that is still to be joined.
+             */
+            if (current->detached)
+                __sthread_delete(current);
+            else
+                __sthread_release_stack(current);
         }
         else if (current->state == ThreadBlocked) {
             /* Queue up because blocked. */
@@ -351,6 +374,11 @@ Thread * sthread_create(void (*f)(void *arg), void *arg) {
     /* Set thread to ready. */
     new_thread->state = ThreadReady;
 
+    /* Nobody is waiting for it yet. */
+    new_thread->result = NULL;
+    new_thread->joiner = NULL;
+    new_thread->detached = 0;
+
     /* Set contect to end of stack (because it grows down). */
     new_thread->context = __sthread_initialize_context((char *) new_stack +
         DEFAULT_STACKSIZE, f, arg);
@@ -372,11 +400,66 @@ Thread * sthread_create(void (*f)(void *arg), void *arg) {
  */
 void __sthread_finish(void) {
     printf("Thread 0x%08x has finished executing.\n", (unsigned int) current);
+
+    /* Wake the thread waiting to join this one. */
+    if (current->joiner != NULL)
+        sthread_unblock(current->joiner);
+
     current->state = ThreadFinished;
     __sthread_schedule();
 }
 
 
+/*
+ * Finish the current thread with the specified result, as though its
+ * function had returned.
+ */
+void sthread_exit(void *result) {
+    current->result = result;
+    __sthread_finish();
+}
+
+
+/*
+ * Wait for a thread to finish, and pass its result back.  The joiner
+ * blocks until __sthread_finish unblocks it, and then deallocates the
+ * Thread struct that the scheduler left behind.
+ */
+int sthread_join(Thread *threadp, void **ret) {
+    assert(threadp != NULL);
+
+    if (threadp == current || threadp->detached || threadp->joiner != NULL)
+        return -1;
+
+    if (threadp->state != ThreadFinished) {
+        threadp->joiner = current;
+        sthread_block();
+    }
+
+    assert(threadp->state == ThreadFinished);
+    if (ret != NULL)
+        *ret = threadp->result;
+
+    free(threadp);
+    return 0;
+}
+
+
+/*
+ * Detach a thread, so that it is deallocated as soon as it finishes, or
+ * straight away if it has finished already.
+ */
+void sthread_detach(Thread *threadp) {
+    assert(threadp != NULL);
+    assert(threadp->joiner == NULL);
+
+    if (threadp->state == ThreadFinished)
+        free(threadp);
+    else
+        threadp->detached = 1;
+}
+
+
 /*
  * This function is used by the scheduler to release the memory used by the
  * specified thread.  The function deletes the memory used for the thread's
@@ -388,6 +471,20 @@ void __sthread_delete(Thread *threadp) {
     free(threadp);
 }
 
+static void __sthread_release_stack(Thread *threadp) {
+    free(threadp->memory);
+    threadp->memory = NULL;
+    threadp->context = NULL;
+}
+
+
+/*
+ * Return the pointer to the currently running thread.
+ */
+Thread * sthread_current() {
+    return current;
+}
+
 
 /*
  * Yield, so that another thread can run.  This is easy: just
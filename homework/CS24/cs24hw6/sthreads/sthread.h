@@ -39,11 +39,32 @@ typedef void (*ThreadFunction)(void *arg);
  * Thread operations.
  */
 Thread *sthread_create(ThreadFunction f, void *arg);
+Thread *sthread_current(void);
 void sthread_yield(void);
 void sthread_block(void);
 void sthread_unblock(Thread *threadp);
 
 
+/*
+ * Finishing and joining threads.
+ *
+ * A thread finishes when its function returns, with a NULL result, or
+ * when it calls sthread_exit with its result.  sthread_join blocks the
+ * caller until the thread has finished, stores the thread's result in
+ * *ret unless ret is NULL, and releases what is left of the thread.  It
+ * returns 0, or -1 if the thread is the caller itself, is detached, or
+ * already has a thread waiting to join it.  Each thread must be joined
+ * at most once.
+ *
+ * A detached thread is released as soon as it finishes, and can't be
+ * joined.  A thread that is never joined or detached keeps its Thread
+ * struct, though not its stack, until the program exits.
+ */
+void sthread_exit(void *result);
+int sthread_join(Thread *threadp, void **ret);
+void sthread_detach(Thread *threadp);
+
+
 /*
  * The start function should be called *once* in
  * the main() function of your program.  This function
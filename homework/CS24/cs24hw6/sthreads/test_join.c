@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "sthread.h"
+
+#define NUM_WORKERS 5
+
+/* Helper function that yields a few times, and passes back a result. */
+static void worker(void *arg) {
+    int i, n = *((int *) arg);
+
+    for (i = 0; i < n; ++i)
+        sthread_yield();
+
+    if (n % 2 == 0)
+        sthread_exit(arg);
+}
+
+/* Helper function that detaches itself, and just finishes. */
+static void loner(void *arg) {
+    sthread_detach(sthread_current());
+    sthread_yield();
+}
+
+/* Joins the workers, some before and some after they have finished. */
+static void joiner(void *arg) {
+    Thread **threads = (Thread **) arg;
+    int *counts[NUM_WORKERS];
+    void *result;
+    int i;
+
+    for (i = 0; i < NUM_WORKERS; ++i) {
+        assert(sthread_join(threads[i], &result) == 0);
+        counts[i] = (int *) result;
+        printf("Joined thread %d, result %p\n", i, result);
+    }
+
+    /* Odd counts return from the thread function, with a NULL result. */
+    for (i = 0; i < NUM_WORKERS; ++i)
+        assert(counts[i] == NULL || *counts[i] % 2 == 0);
+
+    /* A thread can't join itself. */
+    assert(sthread_join(sthread_current(), NULL) == -1);
+}
+
+int main(int argc, char **argv) {
+    static int counts[NUM_WORKERS];
+    static Thread *threads[NUM_WORKERS];
+    int i;
+
+    /* Create workers that finish at different times, and one to join them. */
+    for (i = 0; i < NUM_WORKERS; ++i) {
+        counts[i] = rand() % 10;
+        threads[i] = sthread_create(worker, (void *) &counts[i]);
+    }
+    sthread_create(joiner, (void *) threads);
+    sthread_create(loner, NULL);
+
+    /* Start all threads. */
+    sthread_start();
+
+    return 0;
+}
@@ -15,10 +15,54 @@
 #include "bounded_buffer.h"
 #include "semaphore.h"
 
+/*
+ * The ring buffers keep the indexes that producers and consumers write on
+ * separate cache lines, so that they don't take the line from each other on
+ * every element.
+ */
+#define CACHE_LINE_SIZE 64
+
+/*
+ * The kinds of bounded buffer.
+ */
+typedef enum {
+    /* Coordinated by semaphores. */
+    BufferSemaphore,
+
+    /* A lock-free ring for one producer and one consumer. */
+    BufferSPSC,
+
+    /* A lock-free ring for any number of producers and consumers. */
+    BufferMPMC
+} BufferKind;
+
+/*
+ * One slot of a ring buffer.  In the MPMC ring, seq says whose turn the
+ * slot is:  slot i is free for the producer of element n when seq is n,
+ * and holds element n for its consumer when seq is n + 1, where n is i
+ * modulo the length.
+ */
+typedef struct _ring_cell {
+    volatile unsigned int seq;
+    BufferElem elem;
+} RingCell;
+
+/*
+ * Threads waiting for a ring buffer to stop being full or empty.  The count
+ * is bumped before a waiter looks at the ring again under the scheduler
+ * lock, so the other side only needs the lock when it is nonzero.
+ */
+typedef struct _ring_waiters {
+    volatile int count;
+    WaitQueue queue;
+} RingWaiters;
+
 /*
  * The bounded buffer data.
  */
 struct _bounded_buffer {
+    BufferKind kind;
+
     /* The maximum number of elements in the buffer */
     int length;
 
@@ -40,6 +84,23 @@ struct _bounded_buffer {
     /* Binary Semaphore used to make sure only one thread accesses buffer. */
     Semaphore * access;
 
+    /*
+     * The ring buffers.  head is the number of elements ever taken, and tail
+     * the number ever added; slots are numbered modulo the length, which is
+     * a power of two so that mask picks the slot.
+     */
+    RingCell *cells;
+    unsigned int mask;
+
+    char pad0[CACHE_LINE_SIZE];
+    volatile unsigned int head;
+    char pad1[CACHE_LINE_SIZE];
+    volatile unsigned int tail;
+    char pad2[CACHE_LINE_SIZE];
+
+    /* Consumers waiting for an element, and producers waiting for room. */
+    RingWaiters not_empty;
+    RingWaiters not_full;
 };
 
 /*
@@ -71,6 +132,7 @@ BoundedBuffer *new_bounded_buffer(int length) {
     for (i = 0; i != length; i++)
         buffer[i] = empty;
 
+    bufp->kind = BufferSemaphore;
     bufp->length = length;
     bufp->buffer = buffer;
 
@@ -88,11 +150,245 @@ BoundedBuffer *new_bounded_buffer(int length) {
     return bufp;
 }
 
+/*
+ * Allocate a new ring buffer of the specified kind.
+ */
+static BoundedBuffer *new_ring_buffer(BufferKind kind, int length) {
+    BoundedBuffer *bufp;
+    unsigned int size = 1, i;
+
+    while (size < (unsigned int) length)
+        size *= 2;
+
+    bufp = (BoundedBuffer *) malloc(sizeof(BoundedBuffer));
+    if (bufp == 0) {
+        fprintf(stderr, "new_bounded_buffer: out of memory\n");
+        exit(1);
+    }
+    memset(bufp, 0, sizeof(BoundedBuffer));
+
+    bufp->cells = (RingCell *) malloc(size * sizeof(RingCell));
+    if (bufp->cells == 0) {
+        fprintf(stderr, "new_bounded_buffer: out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; i != size; i++) {
+        bufp->cells[i].seq = i;
+        bufp->cells[i].elem = empty;
+    }
+
+    bufp->kind = kind;
+    bufp->length = size;
+    bufp->mask = size - 1;
+
+    return bufp;
+}
+
+BoundedBuffer *new_spsc_bounded_buffer(int length) {
+    return new_ring_buffer(BufferSPSC, length);
+}
+
+BoundedBuffer *new_mpmc_bounded_buffer(int length) {
+    return new_ring_buffer(BufferMPMC, length);
+}
+
+/*
+ * Try to move up to n elements into or out of a ring buffer without
+ * blocking.  Returns the number moved, which is 0 if the ring is full (for
+ * an add) or empty (for a take).  Each call publishes its elements with a
+ * single update of tail or head.
+ */
+static int spsc_try_add(BoundedBuffer *bufp, BufferElem *elems, int n) {
+    unsigned int tail = bufp->tail;
+    unsigned int room = bufp->length -
+        (tail - __atomic_load_n(&bufp->head, __ATOMIC_SEQ_CST));
+    int i;
+
+    if ((unsigned int) n > room)
+        n = room;
+
+    for (i = 0; i < n; i++)
+        bufp->cells[(tail + i) & bufp->mask].elem = elems[i];
+    __atomic_store_n(&bufp->tail, tail + n, __ATOMIC_SEQ_CST);
+    return n;
+}
+
+static int spsc_try_take(BoundedBuffer *bufp, BufferElem *elems, int n) {
+    unsigned int head = bufp->head;
+    unsigned int avail = __atomic_load_n(&bufp->tail, __ATOMIC_SEQ_CST) - head;
+    int i;
+
+    if ((unsigned int) n > avail)
+        n = avail;
+
+    for (i = 0; i < n; i++)
+        elems[i] = bufp->cells[(head + i) & bufp->mask].elem;
+    __atomic_store_n(&bufp->head, head + n, __ATOMIC_SEQ_CST);
+    return n;
+}
+
+/*
+ * The MPMC ring is Dmitry Vyukov's bounded queue:  a producer claims slots
+ * from tail with a compare-and-swap once their seqs say they are free,
+ * fills them, and then publishes each by advancing its seq; consumers do
+ * the same at head.  A batch claims the run of ready slots with one
+ * compare-and-swap.
+ */
+static int mpmc_try_add(BoundedBuffer *bufp, BufferElem *elems, int n) {
+    unsigned int tail = __atomic_load_n(&bufp->tail, __ATOMIC_RELAXED);
+    int diff, k, i;
+
+    while (1) {
+        diff = (int) (__atomic_load_n(&bufp->cells[tail & bufp->mask].seq,
+                                      __ATOMIC_SEQ_CST) - tail);
+
+        if (diff == 0) {
+            for (k = 1; k < n; k++) {
+                if (__atomic_load_n(&bufp->cells[(tail + k) & bufp->mask].seq,
+                                    __ATOMIC_SEQ_CST) != tail + k)
+                    break;
+            }
+
+            if (__atomic_compare_exchange_n(&bufp->tail, &tail, tail + k, 1,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0) {
+            return 0;
+        }
+        else {
+            tail = __atomic_load_n(&bufp->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    for (i = 0; i < k; i++) {
+        RingCell *cell = bufp->cells + ((tail + i) & bufp->mask);
+
+        cell->elem = elems[i];
+        __atomic_store_n(&cell->seq, tail + i + 1, __ATOMIC_SEQ_CST);
+    }
+    return k;
+}
+
+static int mpmc_try_take(BoundedBuffer *bufp, BufferElem *elems, int n) {
+    unsigned int head = __atomic_load_n(&bufp->head, __ATOMIC_RELAXED);
+    int diff, k, i;
+
+    while (1) {
+        diff = (int) (__atomic_load_n(&bufp->cells[head & bufp->mask].seq,
+                                      __ATOMIC_SEQ_CST) - (head + 1));
+
+        if (diff == 0) {
+            for (k = 1; k < n; k++) {
+                if (__atomic_load_n(&bufp->cells[(head + k) & bufp->mask].seq,
+                                    __ATOMIC_SEQ_CST) != head + k + 1)
+                    break;
+            }
+
+            if (__atomic_compare_exchange_n(&bufp->head, &head, head + k, 1,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0) {
+            return 0;
+        }
+        else {
+            head = __atomic_load_n(&bufp->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    for (i = 0; i < k; i++) {
+        RingCell *cell = bufp->cells + ((head + i) & bufp->mask);
+
+        elems[i] = cell->elem;
+        cell->elem = empty;
+        __atomic_store_n(&cell->seq, head + i + bufp->mask + 1,
+                         __ATOMIC_SEQ_CST);
+    }
+    return k;
+}
+
+/*
+ * Wake up to n of the threads waiting on the other side of a ring.  The
+ * scheduler lock must be held.
+ */
+static void wake_waiters(RingWaiters *waitersp, int n) {
+    while (n-- > 0 && sthread_wake_one(&waitersp->queue) != NULL)
+        ;
+}
+
+/*
+ * Move up to n elements into or out of a ring buffer, blocking on waitersp
+ * while try can't move any.  If all is true, keep going until all n have
+ * been moved; otherwise return as soon as at least one has.  Threads
+ * waiting on the other side are woken for the elements moved, including
+ * before blocking for the rest, so a large batch can't deadlock against
+ * the threads that would make room for it.  Returns the number moved.
+ */
+static int ring_transfer(BoundedBuffer *bufp, BufferElem *elems, int n,
+                         int all,
+                         int (*try)(BoundedBuffer *, BufferElem *, int),
+                         RingWaiters *waitersp, RingWaiters *otherp) {
+    int moved, pending, step;
+
+    moved = pending = try(bufp, elems, n);
+
+    if (moved < n && (all || moved == 0)) {
+        sthread_lock();
+        __atomic_add_fetch(&waitersp->count, 1, __ATOMIC_SEQ_CST);
+
+        while (1) {
+            step = try(bufp, elems + moved, n - moved);
+            moved += step;
+            pending += step;
+            if (moved == n || (moved > 0 && !all))
+                break;
+
+            if (pending > 0 &&
+                __atomic_load_n(&otherp->count, __ATOMIC_SEQ_CST) != 0)
+                wake_waiters(otherp, pending);
+            pending = 0;
+
+            sthread_block_on(&waitersp->queue);
+            sthread_lock();
+        }
+
+        __atomic_sub_fetch(&waitersp->count, 1, __ATOMIC_SEQ_CST);
+        sthread_unlock();
+    }
+
+    if (pending > 0 && __atomic_load_n(&otherp->count, __ATOMIC_SEQ_CST) != 0) {
+        sthread_lock();
+        wake_waiters(otherp, pending);
+        sthread_unlock();
+    }
+
+    return moved;
+}
+
 /*
  * Add an integer to the buffer.  Yield control to another
  * thread if the buffer is full.
  */
 void bounded_buffer_add(BoundedBuffer *bufp, const BufferElem *elem) {
+    switch (bufp->kind) {
+    case BufferSPSC:
+        ring_transfer(bufp, (BufferElem *) elem, 1, 1, spsc_try_add,
+                      &bufp->not_full, &bufp->not_empty);
+        return;
+
+    case BufferMPMC:
+        ring_transfer(bufp, (BufferElem *) elem, 1, 1, mpmc_try_add,
+                      &bufp->not_full, &bufp->not_empty);
+        return;
+
+    case BufferSemaphore:
+        break;
+    }
+
     /*
      * Wait until the buffer has space by waiting on the open semaphore (there
      * must be an open spot to add an element). Need to wait on access as well
@@ -118,6 +414,21 @@ void bounded_buffer_add(BoundedBuffer *bufp, const BufferElem *elem) {
  * thread if the buffer is empty.
  */
 void bounded_buffer_take(BoundedBuffer *bufp, BufferElem *elem) {
+    switch (bufp->kind) {
+    case BufferSPSC:
+        ring_transfer(bufp, elem, 1, 1, spsc_try_take, &bufp->not_empty,
+                      &bufp->not_full);
+        return;
+
+    case BufferMPMC:
+        ring_transfer(bufp, elem, 1, 1, mpmc_try_take, &bufp->not_empty,
+                      &bufp->not_full);
+        return;
+
+    case BufferSemaphore:
+        break;
+    }
+
     /*
      * Wait until the buffer has a value to retrieve by waiting on the taken
      * semaphore (there must be an element to take). Need to wait on access as
@@ -140,3 +451,89 @@ void bounded_buffer_take(BoundedBuffer *bufp, BufferElem *elem) {
     semaphore_signal(bufp->access);
 }
 
+/*
+ * Add n elements to the buffer, moving as many as there is room for at a
+ * time, so that each synchronization round is shared by a whole run of
+ * elements.  Yield control to another thread while the buffer is full.
+ */
+void bounded_buffer_add_n(BoundedBuffer *bufp, const BufferElem *elems, int n) {
+    int k, i;
+
+    if (n <= 0)
+        return;
+
+    switch (bufp->kind) {
+    case BufferSPSC:
+        ring_transfer(bufp, (BufferElem *) elems, n, 1, spsc_try_add,
+                      &bufp->not_full, &bufp->not_empty);
+        return;
+
+    case BufferMPMC:
+        ring_transfer(bufp, (BufferElem *) elems, n, 1, mpmc_try_add,
+                      &bufp->not_full, &bufp->not_empty);
+        return;
+
+    case BufferSemaphore:
+        break;
+    }
+
+    while (n > 0) {
+        /* Wait for one open spot, then claim as many more as are open. */
+        semaphore_wait(bufp->open);
+        k = 1 + semaphore_try_wait_up_to(bufp->open, n - 1);
+        semaphore_wait(bufp->access);
+
+        for (i = 0; i < k; i++) {
+            bufp->buffer[(bufp->first + bufp->count) % bufp->length] = elems[i];
+            bufp->count++;
+        }
+
+        semaphore_signal_n(bufp->taken, k);
+        semaphore_signal(bufp->access);
+
+        elems += k;
+        n -= k;
+    }
+}
+
+/*
+ * Take up to max elements from the buffer, and return how many were taken.
+ * Yield control to another thread if the buffer is empty; once there is at
+ * least one element, take everything there is, up to max.
+ */
+int bounded_buffer_take_up_to(BoundedBuffer *bufp, BufferElem *elems,
+                              int max) {
+    int k, i;
+
+    if (max <= 0)
+        return 0;
+
+    switch (bufp->kind) {
+    case BufferSPSC:
+        return ring_transfer(bufp, elems, max, 0, spsc_try_take,
+                             &bufp->not_empty, &bufp->not_full);
+
+    case BufferMPMC:
+        return ring_transfer(bufp, elems, max, 0, mpmc_try_take,
+                             &bufp->not_empty, &bufp->not_full);
+
+    case BufferSemaphore:
+        break;
+    }
+
+    /* Wait for one element, then claim as many more as there are. */
+    semaphore_wait(bufp->taken);
+    k = 1 + semaphore_try_wait_up_to(bufp->taken, max - 1);
+    semaphore_wait(bufp->access);
+
+    for (i = 0; i < k; i++) {
+        elems[i] = bufp->buffer[bufp->first];
+        bufp->buffer[bufp->first] = empty;
+        bufp->count--;
+        bufp->first = (bufp->first + 1) % bufp->length;
+    }
+
+    semaphore_signal_n(bufp->open, k);
+    semaphore_signal(bufp->access);
+    return k;
+}
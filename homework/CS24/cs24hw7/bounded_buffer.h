@@ -28,11 +28,29 @@ typedef struct buffer_elem {
  */
 BoundedBuffer * new_bounded_buffer(int length);
 
+/*
+ * Create a lock-free ring buffer, for exactly one producer and one
+ * consumer (spsc) or for any number of each (mpmc).  Threads only block
+ * when the buffer is full or empty.  The length is rounded up to a power
+ * of two.
+ */
+BoundedBuffer * new_spsc_bounded_buffer(int length);
+BoundedBuffer * new_mpmc_bounded_buffer(int length);
+
 /*
  * Add and remove values from the queue.
  */
 void bounded_buffer_add(BoundedBuffer *bufp, const BufferElem *s);
 void bounded_buffer_take(BoundedBuffer *bufp, BufferElem *s);
 
+/*
+ * Add or remove many values under each synchronization round.  add_n
+ * returns once all n values are in the buffer.  take_up_to waits for at
+ * least one value, takes as many as are there up to max, and returns how
+ * many it took.
+ */
+void bounded_buffer_add_n(BoundedBuffer *bufp, const BufferElem *elems, int n);
+int bounded_buffer_take_up_to(BoundedBuffer *bufp, BufferElem *elems, int max);
+
 #endif /* _BOUNDED_BUFFER_H */
 
@@ -6,6 +6,20 @@
  * the buffer, checks that the values are correct,
  * and prints them out.
  *
+ * usage: fibtest [-w workers] [-b sem|spsc|mpmc] [-p] [-s] [-c]
+ *                [-n items [-k batch]]
+ *
+ * With -p, the consumer runs at the highest priority, so that it takes
+ * each result as soon as it is produced.  With -s, scheduler statistics
+ * are kept and printed when the program exits.  With -c, how much stack
+ * each thread used is reported as it finishes.
+ *
+ * With -n, the producers instead look their results up in a table, and
+ * the consumer checks the specified number of items without printing them,
+ * and reports the buffer's throughput.  With -k, items are moved in
+ * batches of up to that many.  The spsc buffer only allows a single
+ * producer.
+ *
  *--------------------------------------------------------------------
  * Adapted from code for CS24 by Jason Hickey.
  * Copyright (C) 2003-2010, Caltech.  All rights reserved.
@@ -15,6 +29,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <memory.h>
+#include <string.h>
+#include <time.h>
 #include "sthread.h"
 #include "semaphore.h"
 #include "bounded_buffer.h"
@@ -30,6 +46,15 @@
 
 static BoundedBuffer *queue;
 
+/*
+ * In throughput mode, the number of items each producer produces, and the
+ * most that are added or taken at a time.
+ */
+static int items_per_producer;
+static int batch = 1;
+
+#define MAX_BATCH       256
+
 
 /*
  * Recursive Fibonacci.
@@ -47,11 +72,35 @@ static int fib(int i) {
 
 #define FIB_MODULUS     20
 
+/* In throughput mode, the producers look their results up here. */
+static int fib_table[FIB_MODULUS];
+
 static void producer(void *arg) {
-    BufferElem elem;
-    int i = 0;
+    BufferElem elem, elems[MAX_BATCH];
+    int i = 0, j, k;
+
+    elem.id = (int) (size_t) arg;
+
+    if (items_per_producer > 0) {
+        for (i = 0; i < items_per_producer; i += k) {
+            k = items_per_producer - i;
+            if (k > batch)
+                k = batch;
+
+            for (j = 0; j < k; j++) {
+                elems[j].id = elem.id;
+                elems[j].arg = (i + j) % FIB_MODULUS;
+                elems[j].val = fib_table[elems[j].arg];
+            }
+
+            if (k == 1)
+                bounded_buffer_add(queue, elems);
+            else
+                bounded_buffer_add_n(queue, elems, k);
+        }
+        return;
+    }
 
-    elem.id = (int) arg;
     while (1) {
         /* Place the next computed Fibonacci result into the buffer */
         elem.arg = i;
@@ -65,10 +114,18 @@ static void producer(void *arg) {
 /*
  * Consumer prints them out.
  */
+/*
+ * Nonzero if the consumer runs at the highest priority.
+ */
+static int urgent_consumer;
+
 static void consumer(void *arg) {
     BufferElem elem;
     int i;
 
+    if (urgent_consumer)
+        sthread_set_priority(STHREAD_NUM_PRIORITIES - 1);
+
     /* Read the contents of the buffer, and print them */
     while (1) {
         bounded_buffer_take(queue, &elem);
@@ -80,21 +137,113 @@ static void consumer(void *arg) {
 }
 
 
+/*
+ * In throughput mode, the consumer checks num_items items and reports how
+ * long they took.
+ */
+static int num_items;
+
+static void throughput_consumer(void *arg) {
+    BufferElem elems[MAX_BATCH];
+    struct timespec start, end;
+    double elapsed;
+    int i, j, k, errors = 0;
+
+    if (urgent_consumer)
+        sthread_set_priority(STHREAD_NUM_PRIORITIES - 1);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < num_items; i += k) {
+        if (batch == 1) {
+            bounded_buffer_take(queue, elems);
+            k = 1;
+        }
+        else {
+            k = num_items - i;
+            k = bounded_buffer_take_up_to(queue, elems, k < batch ? k : batch);
+        }
+
+        for (j = 0; j < k; j++) {
+            if (elems[j].val != fib_table[elems[j].arg])
+                errors++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (end.tv_sec - start.tv_sec) +
+              (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%d items in %.3f s:  %.0f items/s, %.1f ns per item, "
+           "%d mismatches\n", num_items, elapsed, num_items / elapsed,
+           elapsed * 1e9 / num_items, errors);
+    exit(errors != 0);
+}
+
+
+static void usage(const char *progname) {
+    fprintf(stderr, "usage: %s [-w workers] [-b sem|spsc|mpmc] [-p] [-s] "
+            "[-c] [-n items [-k batch]]\n", progname);
+    exit(1);
+}
+
+
 /*
  * The main function starts the two producers and the consumer,
  * the starts the thread scheduler.
  */
 int main(int argc, char **argv) {
-    queue = new_bounded_buffer(DEFAULT_BUFFER_LENGTH);
-    sthread_create(producer, (void *) 0);
-    sthread_create(producer, (void *) 1);
-    sthread_create(consumer, (void *) 0);
+    const char *kind = "sem";
+    int workers = 1, producers, i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            workers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            kind = argv[++i];
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            num_items = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc)
+            batch = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-p") == 0)
+            urgent_consumer = 1;
+        else if (strcmp(argv[i], "-s") == 0)
+            sthread_enable_stats();
+        else if (strcmp(argv[i], "-c") == 0)
+            sthread_enable_stack_check();
+        else
+            usage(argv[0]);
+    }
+
+    if (strcmp(kind, "sem") == 0)
+        queue = new_bounded_buffer(DEFAULT_BUFFER_LENGTH);
+    else if (strcmp(kind, "spsc") == 0)
+        queue = new_spsc_bounded_buffer(DEFAULT_BUFFER_LENGTH);
+    else if (strcmp(kind, "mpmc") == 0)
+        queue = new_mpmc_bounded_buffer(DEFAULT_BUFFER_LENGTH);
+    else
+        usage(argv[0]);
+
+    if (batch < 1 || batch > MAX_BATCH)
+        usage(argv[0]);
+
+    producers = (strcmp(kind, "spsc") == 0) ? 1 : 2;
+
+    if (num_items > 0) {
+        for (i = 0; i < FIB_MODULUS; i++)
+            fib_table[i] = fib(i);
+
+        items_per_producer = num_items / producers;
+        num_items = items_per_producer * producers;
+    }
+
+    for (i = 0; i < producers; i++)
+        sthread_create(producer, (void *) (size_t) i);
+    sthread_create(num_items > 0 ? throughput_consumer : consumer, (void *) 0);
 
     /*
      * Start the thread scheduler.  By default, the timer is
      * not started.  Change the argument to 1 to start the timer.
      */
-    sthread_start(1);
+    sthread_start_workers(1, workers);
     return 0;
 }
 
@@ -25,6 +25,12 @@ typedef void (*ThreadFunction)(void *arg);
  */
 extern int __sthread_lock(void);
 
+/*
+ * Lock the scheduler, waiting for another worker to unlock it if
+ * necessary.  This must not be used in a signal handler.
+ */
+extern void __sthread_spin_lock(void);
+
 /* Unlock the scheduler. */
 extern void __sthread_unlock(void);
 
@@ -33,10 +39,43 @@ void __sthread_start(void);
 
 /*
  * The is the entry point into the scheduler, to be called
- * whenever a thread action is required.
+ * whenever a thread action is required.  Preemption must be
+ * off; it is turned back on when the next thread resumes.
  */
 void __sthread_schedule(void);
 
+/*
+ * The timer makes a preempted thread call this instead, with the
+ * interrupted program counter as the return address.  Unlike
+ * __sthread_schedule, it can't rely on the calling convention, so it
+ * saves the whole machine state, the FPU and SSE registers included
+ * where the glue code saves a smaller context for calls.
+ */
+void __sthread_preempt(void);
+
+/*
+ * Switch directly from the calling thread to another, saving the
+ * caller's context into *savep.  Preemption must be off; once the
+ * caller's context is saved, __sthread_switch_done is called on the
+ * other thread's stack to make the caller ready and turn preemption
+ * back on.  This returns when the caller is next resumed.
+ */
+void __sthread_switch(ThreadContext **savep, ThreadContext *next);
+void __sthread_switch_done(void);
+
+/*
+ * Turn timer preemption of the calling worker off and on.
+ */
+void __sthread_preempt_disable(void);
+void __sthread_preempt_enable(void);
+
+/*
+ * The scheduler stack of the calling worker, saved by
+ * __sthread_start and switched to by __sthread_schedule.
+ */
+ThreadContext *__sthread_worker_context(void);
+void __sthread_set_worker_context(ThreadContext *context);
+
 /*
  * Initialize the context for a new thread.
  *
@@ -3,16 +3,16 @@
 #
 
 #
-# Keep a pointer to the main scheduler context.
-# This variable should be initialized to %esp;
-# which is done in the __sthread_start routine.
+# Each worker's scheduler context is kept by the C code, and is
+# reached through __sthread_worker_context and
+# __sthread_set_worker_context.
 #
         .data
         .align 4
-scheduler_context:      .long   0
 
 #
-# Integer variable for locking the scheduler
+# Integer variable for locking the scheduler, which is shared
+# by all of the workers.
 #
 scheduler_lock:         .long   0
 
@@ -40,6 +40,28 @@ __sthread_lock:
 
         ret
 
+#
+# Obtain the scheduler lock, spinning until the worker that holds
+# it lets go.  The spin only reads the lock, so that it doesn't
+# keep taking the cache line away from the holder.
+#
+        .globl __sthread_spin_lock
+__sthread_spin_lock:
+        movl    $1, %eax
+        lock
+        xchgl   %eax, scheduler_lock
+        testl   %eax, %eax
+        jz      spin_lock_done
+
+spin_lock_wait:
+        pause
+        cmpl    $0, scheduler_lock
+        jne     spin_lock_wait
+        jmp     __sthread_spin_lock
+
+spin_lock_done:
+        ret
+
         .globl __sthread_unlock
 __sthread_unlock:
         # release the lock by putting 0 in scheduler_lock
@@ -56,28 +78,64 @@ __sthread_unlock:
 #    2. Call __sthread_scheduler (the C scheduler function),
 #       passing the context as an argument.  The scheduler
 #       stack *must* be restored by setting %esp to the
-#       scheduler_context before __sthread_scheduler is
-#       called.
+#       worker's scheduler context before __sthread_scheduler
+#       is called.
 #    3. __sthread_scheduler will return the context of
-#       a new thread.  Restore the context, and return
-#       to the thread.
+#       a new thread.  Restore the context, turn preemption
+#       back on, and return to the thread.
 #
+# Preemption must be off on entry.  Since it saves everything, it
+# is also __sthread_preempt, which the timer makes a preempted
+# thread call.
+#
+        .globl __sthread_preempt
         .globl __sthread_schedule
+__sthread_preempt:
 __sthread_schedule:
         # Save the process state onto its stack
         pushfl
         pusha
 
-        # Call the high-level scheduler with the current context as an argument
-        movl    %esp, %eax
-        movl    scheduler_context, %esp
-        pushl   %eax
+        # Call the high-level scheduler with the current context as an
+        # argument, on this worker's scheduler stack.  %ebx has already
+        # been saved in the context, and the C code preserves it.
+        movl    %esp, %ebx
+        call    __sthread_worker_context
+        movl    %eax, %esp
+        pushl   %ebx
         call    __sthread_scheduler
 
         # The scheduler will return a context to start.
         # Restore the context to resume the thread.
 __sthread_restore:
         movl    %eax, %esp
+        call    __sthread_preempt_enable
+        popa
+        popfl
+
+        ret
+
+#
+# __sthread_switch(savep, next) switches from the calling thread
+# straight to the thread whose context is next, without going
+# through the scheduler.  The caller's context is saved just as
+# __sthread_schedule saves it, so either routine can resume it.
+#
+        .globl __sthread_switch
+__sthread_switch:
+        # Save the process state onto its stack
+        pushfl
+        pusha
+
+        # Store the context into *savep, and switch to the next one.
+        # The arguments are above the 36 bytes of state and the
+        # return address.
+        movl    40(%esp), %ecx
+        movl    %esp, (%ecx)
+        movl    44(%esp), %esp
+
+        # Now that the old context is saved, it can be made ready.
+        call    __sthread_switch_done
         popa
         popfl
 
@@ -121,16 +179,21 @@ __sthread_initialize_context:
         ret
 
 #
-# The start routine initializes the scheduler_context variable,
-# and calls the __sthread_scheduler with a NULL context.
-# The scheduler will return a context to resume.
+# The start routine records the worker's scheduler context, and
+# calls the __sthread_scheduler with a NULL context.  Each worker
+# calls it once, on its own kernel thread.  The scheduler will
+# return a context to resume.
 #
         .globl __sthread_start
 __sthread_start:
         # Remember the context
-        movl    %esp, scheduler_context
+        movl    %esp, %eax
+        pushl   %eax
+        call    __sthread_set_worker_context
+        addl    $4, %esp
 
         # Call the scheduler with no context
+        call    __sthread_preempt_disable
         pushl   $0
         call    __sthread_scheduler
 
@@ -0,0 +1,291 @@
+################################################
+# The glue code for x86-64, following the System V ABI.
+#
+# A thread's context is saved on its own stack, and starts with
+# the address of the code that restores it, so that contexts of
+# two shapes can be resumed alike, by pointing %rsp at them and
+# returning:
+#
+#    - A thread that calls __sthread_schedule or __sthread_switch
+#      only needs what a function call preserves:  %rbx, %rbp,
+#      %r12-%r15, the x87 control word and the MXCSR.  The SSE
+#      and x87 registers are caller-saved, so the compiler has
+#      already saved whatever it needs from them.
+#    - A thread that the timer preempts is in the middle of
+#      arbitrary code, so __sthread_preempt saves every integer
+#      register, the flags, and the whole FPU and SSE state.
+#
+# Every context is 16-byte aligned, so that the C functions called
+# on top of one find the stack aligned as the ABI requires.
+#
+
+################################################
+# Data section.
+#
+# Each worker's scheduler context is kept by the C code, and is
+# reached through __sthread_worker_context and
+# __sthread_set_worker_context.
+#
+        .data
+        .align 4
+
+#
+# Integer variable for locking the scheduler, which is shared
+# by all of the workers.
+#
+scheduler_lock:         .long   0
+
+################################################
+# Code section.
+#
+        .text
+        .align 16
+
+#
+# This function can be called from C to obtain the scheduler lock.
+# It returns 1 if the lock is granted, 0 otherwise.
+#
+        .globl __sthread_lock
+__sthread_lock:
+        movl    $1, %eax
+        lock
+        xchgl   %eax, scheduler_lock(%rip)
+        xorl    $1, %eax
+        ret
+
+#
+# Obtain the scheduler lock, spinning until the worker that holds
+# it lets go.  The spin only reads the lock, so that it doesn't
+# keep taking the cache line away from the holder.
+#
+        .globl __sthread_spin_lock
+__sthread_spin_lock:
+        movl    $1, %eax
+        lock
+        xchgl   %eax, scheduler_lock(%rip)
+        testl   %eax, %eax
+        jz      spin_lock_done
+
+spin_lock_wait:
+        pause
+        cmpl    $0, scheduler_lock(%rip)
+        jne     spin_lock_wait
+        jmp     __sthread_spin_lock
+
+spin_lock_done:
+        ret
+
+        .globl __sthread_unlock
+__sthread_unlock:
+        movl    $0, scheduler_lock(%rip)
+        ret
+
+#
+# Save the callee-saved state of a thread that called into the
+# glue, on top of its return address.  This only clobbers %rax.
+# The 16 bytes of control words keep the context aligned.
+#
+        .macro  SAVE_CALLEE_SAVED
+        pushq   %rbp
+        pushq   %rbx
+        pushq   %r12
+        pushq   %r13
+        pushq   %r14
+        pushq   %r15
+        subq    $16, %rsp
+        fnstcw  (%rsp)
+        stmxcsr 4(%rsp)
+        leaq    resume_callee_saved(%rip), %rax
+        pushq   %rax
+        .endm
+
+resume_callee_saved:
+        fldcw   (%rsp)
+        ldmxcsr 4(%rsp)
+        addq    $16, %rsp
+        popq    %r15
+        popq    %r14
+        popq    %r13
+        popq    %r12
+        popq    %rbx
+        popq    %rbp
+        ret
+
+#
+# __sthread_schedule is the main entry point for the thread
+# scheduler.  It has three parts:
+#
+#    1. Save the context of the current thread on the stack.
+#    2. Call __sthread_scheduler (the C scheduler function),
+#       passing the context as an argument, on the worker's
+#       scheduler stack.
+#    3. __sthread_scheduler will return the context of a new
+#       thread.  Switch to it, turn preemption back on, and
+#       resume the thread.
+#
+# Preemption must be off on entry.
+#
+        .globl __sthread_schedule
+__sthread_schedule:
+        SAVE_CALLEE_SAVED
+        movq    %rsp, %rbx
+
+        # Call the high-level scheduler with the current context,
+        # which is in %rbx, on this worker's scheduler stack.
+call_scheduler:
+        call    __sthread_worker_context
+        movq    %rax, %rsp
+        movq    %rbx, %rdi
+        call    __sthread_scheduler
+
+        # The scheduler will return a context to start.
+__sthread_restore:
+        movq    %rax, %rsp
+        call    __sthread_preempt_enable
+        ret
+
+#
+# The timer makes a preempted thread call __sthread_preempt, with
+# the interrupted program counter as the return address, pushed
+# below the 128-byte red zone that the interrupted code may be
+# using.  The FPU and SSE state goes in a 512-byte fxsave area,
+# which must be 16-byte aligned; the stack pointer above it is
+# saved along with it.
+#
+        .globl __sthread_preempt
+__sthread_preempt:
+        pushfq
+        cld
+        pushq   %rax
+        pushq   %rbx
+        pushq   %rcx
+        pushq   %rdx
+        pushq   %rsi
+        pushq   %rdi
+        pushq   %rbp
+        pushq   %r8
+        pushq   %r9
+        pushq   %r10
+        pushq   %r11
+        pushq   %r12
+        pushq   %r13
+        pushq   %r14
+        pushq   %r15
+
+        movq    %rsp, %rbx
+        subq    $512, %rsp
+        andq    $-16, %rsp
+        fxsave  (%rsp)
+        pushq   %rbx
+        leaq    resume_all(%rip), %rax
+        pushq   %rax
+
+        movq    %rsp, %rbx
+        jmp     call_scheduler
+
+resume_all:
+        popq    %rbx
+        fxrstor (%rsp)
+        movq    %rbx, %rsp
+        popq    %r15
+        popq    %r14
+        popq    %r13
+        popq    %r12
+        popq    %r11
+        popq    %r10
+        popq    %r9
+        popq    %r8
+        popq    %rbp
+        popq    %rdi
+        popq    %rsi
+        popq    %rdx
+        popq    %rcx
+        popq    %rbx
+        popq    %rax
+        popfq
+
+        # Return to the interrupted code, and skip back over the
+        # red zone.
+        ret     $128
+
+#
+# __sthread_switch(savep, next) switches from the calling thread
+# straight to the thread whose context is next, without going
+# through the scheduler.  The caller's context is saved just as
+# __sthread_schedule saves it, so either routine can resume it.
+#
+        .globl __sthread_switch
+__sthread_switch:
+        SAVE_CALLEE_SAVED
+
+        # Store the context into *savep, and switch to the next one.
+        movq    %rsp, (%rdi)
+        movq    %rsi, %rsp
+
+        # Now that the old context is saved, it can be made ready.
+        call    __sthread_switch_done
+        ret
+
+#
+# Initialize a process context, given:
+#    1. the stack for the process
+#    2. the function to start
+#    3. its argument
+# The context looks as though the thread had called
+# __sthread_schedule from thread_start, with the function in %r12
+# and the argument in %r13.
+#
+        .globl __sthread_initialize_context
+__sthread_initialize_context:
+        # The final context pointer will be in %rax.
+        movq    %rdi, %rax
+        andq    $-16, %rax
+
+        leaq    thread_start(%rip), %rcx
+        movq    %rcx, -8(%rax)          # return address
+        movq    $0, -16(%rax)           # %rbp
+        movq    $0, -24(%rax)           # %rbx
+        movq    %rsi, -32(%rax)         # %r12
+        movq    %rdx, -40(%rax)         # %r13
+        movq    $0, -48(%rax)           # %r14
+        movq    $0, -56(%rax)           # %r15
+        movq    $0, -72(%rax)           # control words:
+        movw    $0x37f, -72(%rax)       #   the default x87 one
+        movl    $0x1f80, -68(%rax)      #   and MXCSR
+        movq    $0, -64(%rax)
+        subq    $80, %rax
+        leaq    resume_callee_saved(%rip), %rcx
+        movq    %rcx, (%rax)
+        ret
+
+#
+# Each thread starts here, with its stack aligned, and finishes
+# when its function returns.
+#
+thread_start:
+        movq    %r13, %rdi
+        call    *%r12
+        call    __sthread_finish
+
+#
+# The start routine records the worker's scheduler context, and
+# calls the __sthread_scheduler with a NULL context.  Each worker
+# calls it once, on its own kernel thread.  The scheduler will
+# return a context to resume.
+#
+        .globl __sthread_start
+__sthread_start:
+        # Remember the context, aligned for the calls made on it
+        subq    $8, %rsp
+        movq    %rsp, %rdi
+        call    __sthread_set_worker_context
+
+        # Call the scheduler with no context
+        call    __sthread_preempt_disable
+        xorl    %edi, %edi
+        call    __sthread_scheduler
+
+        # Restore the context returned by the scheduler
+        jmp     __sthread_restore
+
+        .section .note.GNU-stack,"",@progbits
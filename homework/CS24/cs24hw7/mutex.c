@@ -0,0 +1,202 @@
+/*
+ * Mutexes and condition variables, with ownership handoff.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <assert.h>
+
+#include "sthread.h"
+#include "mutex.h"
+
+/*
+ * The states of a mutex.  Locking and unlocking an uncontended mutex
+ * only changes the state with a compare-and-swap, between MUTEX_UNLOCKED
+ * and MUTEX_LOCKED.  While threads are waiting, the state is
+ * MUTEX_CONTENDED, and only ever leaves it with the scheduler lock held,
+ * when the holder hands the mutex on.
+ */
+#define MUTEX_UNLOCKED          0
+#define MUTEX_LOCKED            1
+#define MUTEX_CONTENDED         2
+
+/*
+ * The mutex data structure contains:
+ *     int state          : one of the states above
+ *     WaitQueue waitq    : the threads waiting for the mutex, which are
+ *                          handed it in order
+ */
+struct _mutex {
+    volatile int state;
+    WaitQueue waitq;
+};
+
+/*
+ * The condition variable data structure contains:
+ *     Mutex *mutexp      : the mutex that its waiters use, once there
+ *                          has been one
+ *     WaitQueue waitq    : the threads waiting to be signalled
+ *
+ * Both are protected by the scheduler lock.
+ */
+struct _condvar {
+    Mutex *mutexp;
+    WaitQueue waitq;
+};
+
+/************************************************************************
+ * Mutexes.
+ */
+
+Mutex *new_mutex(void) {
+    Mutex *mutexp = (Mutex *) malloc(sizeof(Mutex));
+
+    if (mutexp == NULL) {
+        fprintf(stderr, "Can't allocate a mutex\n");
+        exit(1);
+    }
+
+    mutexp->state = MUTEX_UNLOCKED;
+    mutexp->waitq.head = NULL;
+    mutexp->waitq.tail = NULL;
+    return mutexp;
+}
+
+/*
+ * Change the state from one value to another, and return true (1) if it
+ * had the first value, or false (0) if it didn't.
+ */
+static int change_state(Mutex *mutexp, int from, int to) {
+    return __atomic_compare_exchange_n(&mutexp->state, &from, to, 0,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+int mutex_trylock(Mutex *mutexp) {
+    return change_state(mutexp, MUTEX_UNLOCKED, MUTEX_LOCKED);
+}
+
+/*
+ * Mark a locked mutex as having waiters, so that its holder goes through
+ * the scheduler lock to unlock it, or take it if it has been unlocked.
+ * Returns true (1) if the caller now holds the mutex.  The caller must
+ * hold the scheduler lock.
+ */
+static int take_or_contend(Mutex *mutexp) {
+    int state;
+
+    while (1) {
+        state = __atomic_load_n(&mutexp->state, __ATOMIC_SEQ_CST);
+        if (state == MUTEX_UNLOCKED) {
+            if (change_state(mutexp, MUTEX_UNLOCKED, MUTEX_LOCKED))
+                return 1;
+        }
+        else if (state == MUTEX_CONTENDED ||
+                 change_state(mutexp, MUTEX_LOCKED, MUTEX_CONTENDED))
+            return 0;
+    }
+}
+
+void mutex_lock(Mutex *mutexp) {
+    /* The fast path:  nobody holds the mutex. */
+    if (mutex_trylock(mutexp))
+        return;
+
+    sthread_lock();
+    if (take_or_contend(mutexp)) {
+        sthread_unlock();
+        return;
+    }
+
+    /*
+     * The holder can't unlock the mutex until this thread is queued, since
+     * that takes the scheduler lock.  The thread is woken holding it.
+     */
+    sthread_block_on(&mutexp->waitq);
+}
+
+/*
+ * Unlock the mutex, handing it to the first waiter if there is one.  The
+ * caller must hold the scheduler lock.
+ */
+static void release(Mutex *mutexp) {
+    if (change_state(mutexp, MUTEX_LOCKED, MUTEX_UNLOCKED))
+        return;
+
+    assert(mutexp->state == MUTEX_CONTENDED);
+    if (sthread_wake_one(&mutexp->waitq) == NULL)
+        __atomic_store_n(&mutexp->state, MUTEX_UNLOCKED, __ATOMIC_SEQ_CST);
+    else if (mutexp->waitq.head == NULL)
+        __atomic_store_n(&mutexp->state, MUTEX_LOCKED, __ATOMIC_SEQ_CST);
+}
+
+void mutex_unlock(Mutex *mutexp) {
+    /* The fast path:  nobody is waiting. */
+    if (change_state(mutexp, MUTEX_LOCKED, MUTEX_UNLOCKED))
+        return;
+
+    sthread_lock();
+    release(mutexp);
+    sthread_unlock();
+}
+
+/************************************************************************
+ * Condition variables.
+ */
+
+CondVar *new_condvar(void) {
+    CondVar *condp = (CondVar *) malloc(sizeof(CondVar));
+
+    if (condp == NULL) {
+        fprintf(stderr, "Can't allocate a condition variable\n");
+        exit(1);
+    }
+
+    condp->mutexp = NULL;
+    condp->waitq.head = NULL;
+    condp->waitq.tail = NULL;
+    return condp;
+}
+
+void condvar_wait(CondVar *condp, Mutex *mutexp) {
+    sthread_lock();
+    assert(condp->mutexp == NULL || condp->mutexp == mutexp);
+    condp->mutexp = mutexp;
+
+    /*
+     * The mutex is released and the thread queued in one step, under the
+     * scheduler lock, so a signal can't come in between.  The thread is
+     * woken holding the mutex.
+     */
+    release(mutexp);
+    sthread_block_on(&condp->waitq);
+}
+
+/*
+ * Let up to n waiters go on.  If the mutex is free, the first waiter is
+ * given it and woken; the others are moved to the mutex's queue, to be
+ * handed it in turn.  The caller must hold the scheduler lock.
+ */
+static void requeue(CondVar *condp, int n) {
+    Mutex *mutexp = condp->mutexp;
+
+    while (n > 0 && condp->waitq.head != NULL) {
+        if (take_or_contend(mutexp)) {
+            sthread_wake_one(&condp->waitq);
+            n--;
+        }
+        else
+            n -= sthread_requeue(&condp->waitq, &mutexp->waitq, n);
+    }
+}
+
+void condvar_signal(CondVar *condp) {
+    sthread_lock();
+    requeue(condp, 1);
+    sthread_unlock();
+}
+
+void condvar_broadcast(CondVar *condp) {
+    sthread_lock();
+    requeue(condp, INT_MAX);
+    sthread_unlock();
+}
@@ -0,0 +1,63 @@
+/*
+ * Mutexes and condition variables for the sthread package.
+ *
+ * Unlocking a mutex that threads are waiting for hands it straight to
+ * the first of them, so a woken thread never has to fight for the mutex
+ * again, and waiters get it in the order that they came.  Signalling a
+ * condition variable moves its waiters onto the mutex's queue instead of
+ * waking them, so a broadcast only ever wakes one thread at a time, as
+ * the mutex is handed on.
+ */
+#ifndef _MUTEX_H
+#define _MUTEX_H
+
+/*
+ * The contents of both are opaque; they are defined in mutex.c.
+ */
+typedef struct _mutex Mutex;
+typedef struct _condvar CondVar;
+
+/*
+ * Create a new mutex, which starts out unlocked.
+ */
+Mutex *new_mutex(void);
+
+/*
+ * Lock the mutex, blocking while another thread holds it.  Mutexes are
+ * not recursive.
+ */
+void mutex_lock(Mutex *mutexp);
+
+/*
+ * Lock the mutex if nobody holds it, and return true (1); otherwise
+ * return false (0) without blocking.
+ */
+int mutex_trylock(Mutex *mutexp);
+
+/*
+ * Unlock the mutex, which the calling thread must hold.
+ */
+void mutex_unlock(Mutex *mutexp);
+
+/*
+ * Create a new condition variable.
+ */
+CondVar *new_condvar(void);
+
+/*
+ * Unlock the mutex, which the calling thread must hold, and wait until
+ * the condition variable is signalled; the thread returns holding the
+ * mutex again.  Every thread waiting on a condition variable at the
+ * same time must use the same mutex.  As usual, the condition must be
+ * checked again when this returns.
+ */
+void condvar_wait(CondVar *condp, Mutex *mutexp);
+
+/*
+ * Let one of the threads waiting on the condition variable, or all of
+ * them, go on once they get the mutex.  Nothing happens if nobody waits.
+ */
+void condvar_signal(CondVar *condp);
+void condvar_broadcast(CondVar *condp);
+
+#endif /* _MUTEX_H */
@@ -0,0 +1,155 @@
+/*
+ * Multiplies two square matrices with sthread_parallel_for, over the rows
+ * of the result, and checks the product against a plain loop.  Then sums
+ * the product's columns with one task per column in a task group.  The
+ * time of each is reported.
+ *
+ * usage: partest [-w workers] [-n size] [-g grain]
+ *
+ *     -w  the number of workers to run on
+ *     -n  the number of rows and columns of the matrices
+ *     -g  the most rows that one piece of the loop multiplies
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sthread.h"
+#include "task.h"
+
+#define DEFAULT_SIZE            256
+#define DEFAULT_GRAIN           4
+
+static int size = DEFAULT_SIZE;
+static long grain = DEFAULT_GRAIN;
+
+static double *m1, *m2, *product, *expected, *column_sums;
+
+
+static double now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+
+/*
+ * Multiply rows begin up to end of m1 by m2, into result.
+ */
+static void multiply_rows(long begin, long end, void *ctx) {
+    double *result = (double *) ctx;
+    long r;
+    int c, i;
+
+    for (r = begin; r < end; r++) {
+        for (c = 0; c < size; c++) {
+            double val = 0;
+
+            for (i = 0; i < size; i++)
+                val += m1[r * size + i] * m2[i * size + c];
+            result[r * size + c] = val;
+        }
+    }
+}
+
+
+static void sum_column(void *arg) {
+    int c = (int) (size_t) arg, r;
+    double sum = 0;
+
+    for (r = 0; r < size; r++)
+        sum += product[r * size + c];
+    column_sums[c] = sum;
+}
+
+
+static void bench(void *arg) {
+    TaskGroup *groupp = new_task_group();
+    double start, serial_ms, parallel_ms, group_ms, sum;
+    int i, c, r;
+
+    for (i = 0; i < size * size; i++) {
+        m1[i] = (i % 7) - 3;
+        m2[i] = (i % 5) - 2;
+    }
+
+    start = now_ms();
+    multiply_rows(0, size, expected);
+    serial_ms = now_ms() - start;
+
+    start = now_ms();
+    sthread_parallel_for(0, size, grain, multiply_rows, product);
+    parallel_ms = now_ms() - start;
+
+    if (memcmp(product, expected, size * size * sizeof(double)) != 0) {
+        printf("The parallel product is wrong\n");
+        exit(1);
+    }
+
+    start = now_ms();
+    for (c = 0; c < size; c++)
+        task_group_run(groupp, sum_column, (void *) (size_t) c);
+    task_group_wait(groupp);
+    group_ms = now_ms() - start;
+
+    for (c = 0; c < size; c++) {
+        sum = 0;
+        for (r = 0; r < size; r++)
+            sum += expected[r * size + c];
+        if (sum != column_sums[c]) {
+            printf("The sum of column %d is wrong\n", c);
+            exit(1);
+        }
+    }
+
+    printf("serial multiply:         %8.2f ms\n", serial_ms);
+    printf("parallel multiply:       %8.2f ms\n", parallel_ms);
+    printf("column sums in tasks:    %8.2f ms\n", group_ms);
+    exit(0);
+}
+
+
+static void usage(const char *progname) {
+    fprintf(stderr, "usage: %s [-w workers] [-n size] [-g grain]\n",
+            progname);
+    exit(1);
+}
+
+
+int main(int argc, char **argv) {
+    int workers = 1, i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            workers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            size = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc)
+            grain = atol(argv[++i]);
+        else
+            usage(argv[0]);
+    }
+
+    if (size <= 0 || grain <= 0)
+        usage(argv[0]);
+
+    m1 = (double *) malloc(size * size * sizeof(double));
+    m2 = (double *) malloc(size * size * sizeof(double));
+    product = (double *) malloc(size * size * sizeof(double));
+    expected = (double *) malloc(size * size * sizeof(double));
+    column_sums = (double *) malloc(size * sizeof(double));
+    if (m1 == NULL || m2 == NULL || product == NULL || expected == NULL ||
+        column_sums == NULL) {
+        fprintf(stderr, "Can't allocate the matrices\n");
+        exit(1);
+    }
+
+    printf("%dx%d matrices, grain %ld, %d worker%s\n", size, size, grain,
+           workers, workers == 1 ? "" : "s");
+
+    sthread_create(bench, NULL);
+    sthread_start_workers(1, workers);
+    return 0;
+}
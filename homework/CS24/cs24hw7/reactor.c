@@ -0,0 +1,366 @@
+/*
+ * An epoll reactor, so that sthreads can wait for I/O without blocking the
+ * worker that they run on.
+ *
+ * A thread whose call would block arms a one-shot epoll registration for
+ * its descriptor and blocks on the descriptor's wait queue for reading or
+ * writing.  The scheduler polls the epoll set now and then while there are
+ * such threads, and waits in it when there is nothing else to run; the
+ * threads waiting on a descriptor that became ready are unblocked and retry
+ * their calls.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+
+#include "sthread.h"
+#include "reactor.h"
+
+/*
+ * The most ready descriptors that one poll handles.
+ */
+#define MAX_EVENTS              64
+
+/*
+ * What the reactor knows about a descriptor.
+ */
+#define FD_NONBLOCKING          1       /* O_NONBLOCK has been set */
+#define FD_REGISTERED           2       /* It is in the epoll set */
+
+typedef struct _io_fd {
+    int flags;
+
+    /* The threads waiting to read and to write. */
+    WaitQueue readers;
+    WaitQueue writers;
+} IoFd;
+
+/*
+ * The descriptors, indexed by number, and the number of threads blocked on
+ * any of them.  All of these are protected by the scheduler lock.
+ */
+static IoFd *fds;
+static int num_fds;
+static volatile int num_waiters;
+
+static int epoll_fd = -1;
+static pthread_once_t reactor_once = PTHREAD_ONCE_INIT;
+
+static void init_reactor(void) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        exit(1);
+    }
+}
+
+/*
+ * Return the record for a descriptor, growing the table if necessary.  The
+ * caller must hold the scheduler lock.
+ */
+static IoFd *get_fd(int fd) {
+    int size;
+
+    if (fd >= num_fds) {
+        size = num_fds > 0 ? num_fds : 64;
+        while (size <= fd)
+            size *= 2;
+
+        fds = (IoFd *) realloc(fds, size * sizeof(IoFd));
+        if (fds == NULL) {
+            fprintf(stderr, "Can't allocate the descriptor table\n");
+            exit(1);
+        }
+        memset(fds + num_fds, 0, (size - num_fds) * sizeof(IoFd));
+        num_fds = size;
+    }
+
+    return fds + fd;
+}
+
+/*
+ * Unblock every thread in a wait queue, and return how many there were.
+ * The caller must hold the scheduler lock.
+ */
+static int wake_all(WaitQueue *queuep) {
+    int n = 0;
+
+    while (sthread_wake_one(queuep) != NULL)
+        n++;
+    return n;
+}
+
+/*
+ * Point the descriptor's epoll registration at the events that its waiters
+ * need.  A descriptor that was closed without sthread_close, and then
+ * reused, may not be in the set even though it is marked as registered, or
+ * the other way around, so each operation falls back on the other.  The
+ * caller must hold the scheduler lock.
+ */
+static int arm_fd(int fd, IoFd *iop, unsigned int events) {
+    struct epoll_event event;
+    int op = (iop->flags & FD_REGISTERED) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+    memset(&event, 0, sizeof(event));
+    event.events = events | EPOLLONESHOT;
+    event.data.fd = fd;
+
+    if (epoll_ctl(epoll_fd, op, fd, &event) < 0) {
+        if (errno != ENOENT && errno != EEXIST)
+            return -1;
+
+        op = (op == EPOLL_CTL_MOD) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        if (epoll_ctl(epoll_fd, op, fd, &event) < 0)
+            return -1;
+    }
+
+    iop->flags |= FD_REGISTERED;
+    return 0;
+}
+
+static unsigned int wanted_events(const IoFd *iop) {
+    return (iop->readers.head != NULL ? EPOLLIN : 0) |
+           (iop->writers.head != NULL ? EPOLLOUT : 0);
+}
+
+/*
+ * Make sure that a descriptor is non-blocking.  Returns -1 if it can't be.
+ */
+static int prepare_fd(int fd) {
+    int flags, done;
+
+    if (fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+
+    sthread_lock();
+    done = get_fd(fd)->flags & FD_NONBLOCKING;
+    sthread_unlock();
+    if (done)
+        return 0;
+
+    flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+
+    sthread_lock();
+    get_fd(fd)->flags |= FD_NONBLOCKING;
+    sthread_unlock();
+    return 0;
+}
+
+/*
+ * Block the calling thread until the descriptor is ready for reading, or
+ * for writing.  Returns -1 if the descriptor can't be waited for, which is
+ * also the case for regular files; those never block anyway.
+ */
+static int wait_for_fd(int fd, int writing) {
+    IoFd *iop;
+    int err;
+
+    pthread_once(&reactor_once, init_reactor);
+
+    /*
+     * The lock is held from arming the descriptor until the thread has
+     * blocked, so the reactor can't look for the thread before it is queued.
+     */
+    sthread_lock();
+    iop = get_fd(fd);
+    if (arm_fd(fd, iop,
+               wanted_events(iop) | (writing ? EPOLLOUT : EPOLLIN)) < 0) {
+        err = errno;
+        sthread_unlock();
+        errno = err;
+        return -1;
+    }
+
+    num_waiters++;
+    sthread_block_on(writing ? &iop->writers : &iop->readers);
+    return 0;
+}
+
+/*
+ * Wait for descriptors to become ready, and unblock their waiters.
+ */
+int __reactor_poll(int timeout_ms) {
+    struct epoll_event events[MAX_EVENTS];
+    IoFd *iop;
+    int n, i, woken = 0;
+
+    if (epoll_fd < 0)
+        return 0;
+
+    n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+    if (n <= 0)
+        return 0;
+
+    sthread_lock();
+    for (i = 0; i < n; i++) {
+        iop = get_fd(events[i].data.fd);
+
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            woken += wake_all(&iop->readers);
+        if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+            woken += wake_all(&iop->writers);
+
+        /* The registration is one-shot; rearm it for anyone still waiting. */
+        if (wanted_events(iop) != 0)
+            arm_fd(events[i].data.fd, iop, wanted_events(iop));
+    }
+    num_waiters -= woken;
+    sthread_unlock();
+
+    return woken;
+}
+
+int __reactor_waiting(void) {
+    return num_waiters != 0;
+}
+
+/*
+ * errno belongs to the kernel thread, so each call and the errno that it
+ * sets are read with preemption off, in a function of their own, so that
+ * the compiler can't use the errno of the worker that the thread ran on
+ * before.  Returns the result of the call, or -errno.
+ */
+static ssize_t __attribute__((noinline)) io_read(int fd, void *buf,
+                                                 size_t count) {
+    ssize_t n;
+
+    __sthread_preempt_disable();
+    n = read(fd, buf, count);
+    if (n < 0)
+        n = -errno;
+    __sthread_preempt_enable();
+    return n;
+}
+
+static ssize_t __attribute__((noinline)) io_write(int fd, const void *buf,
+                                                  size_t count) {
+    ssize_t n;
+
+    __sthread_preempt_disable();
+    n = write(fd, buf, count);
+    if (n < 0)
+        n = -errno;
+    __sthread_preempt_enable();
+    return n;
+}
+
+static int __attribute__((noinline)) io_accept(int fd, struct sockaddr *addr,
+                                               socklen_t *addrlen) {
+    int n;
+
+    __sthread_preempt_disable();
+    n = accept4(fd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (n < 0)
+        n = -errno;
+    __sthread_preempt_enable();
+    return n;
+}
+
+static void __attribute__((noinline)) set_errno(int err) {
+    errno = err;
+}
+
+/*
+ * Returns true if a call that failed with -result should wait and retry.
+ */
+static int would_block(ssize_t result) {
+    return result == -EAGAIN || result == -EWOULDBLOCK;
+}
+
+ssize_t sthread_read(int fd, void *buf, size_t count) {
+    ssize_t n;
+
+    if (prepare_fd(fd) < 0)
+        return -1;
+
+    while (1) {
+        n = io_read(fd, buf, count);
+        if (n >= 0)
+            return n;
+
+        if (n != -EINTR && (!would_block(n) || wait_for_fd(fd, 0) < 0))
+            break;
+    }
+
+    set_errno((int) -n);
+    return -1;
+}
+
+ssize_t sthread_write(int fd, const void *buf, size_t count) {
+    ssize_t n;
+
+    if (prepare_fd(fd) < 0)
+        return -1;
+
+    while (1) {
+        n = io_write(fd, buf, count);
+        if (n >= 0)
+            return n;
+
+        if (n != -EINTR && (!would_block(n) || wait_for_fd(fd, 1) < 0))
+            break;
+    }
+
+    set_errno((int) -n);
+    return -1;
+}
+
+/*
+ * The new connection is non-blocking already, ready for sthread_read and
+ * sthread_write.
+ */
+int sthread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+    int n;
+
+    if (prepare_fd(fd) < 0)
+        return -1;
+
+    while (1) {
+        n = io_accept(fd, addr, addrlen);
+        if (n >= 0) {
+            sthread_lock();
+            get_fd(n)->flags = FD_NONBLOCKING;
+            sthread_unlock();
+            return n;
+        }
+
+        if (n != -EINTR && (!would_block(n) || wait_for_fd(fd, 0) < 0))
+            break;
+    }
+
+    set_errno(-n);
+    return -1;
+}
+
+/*
+ * Forget about the descriptor, and close it.  Threads still waiting on it
+ * are woken, and their calls fail.
+ */
+int sthread_close(int fd) {
+    IoFd *iop;
+
+    if (fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+
+    sthread_lock();
+    iop = get_fd(fd);
+    if (iop->flags & FD_REGISTERED)
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    iop->flags = 0;
+    num_waiters -= wake_all(&iop->readers) + wake_all(&iop->writers);
+    sthread_unlock();
+
+    return close(fd);
+}
@@ -0,0 +1,40 @@
+/*
+ * Blocking I/O for sthreads.
+ *
+ * These calls behave like the system calls they are named after, but when
+ * one would block, only the calling thread waits:  it is blocked until the
+ * epoll reactor, which the scheduler polls, reports that the descriptor is
+ * ready, and the other threads keep running meanwhile.  Descriptors used
+ * with them are switched to non-blocking mode, and must be closed with
+ * sthread_close.
+ *
+ * errno belongs to the kernel thread, and a user thread may be moved to
+ * another worker whenever it is preempted or blocks, so errno is only
+ * reliable when read straight after a failed call.
+ */
+#ifndef _REACTOR_H
+#define _REACTOR_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+ssize_t sthread_read(int fd, void *buf, size_t count);
+ssize_t sthread_write(int fd, const void *buf, size_t count);
+int sthread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+int sthread_close(int fd);
+
+/*
+ * Returns true if any thread is blocked in the reactor.  Such threads
+ * aren't deadlocked, since the reactor may wake them.
+ */
+int __reactor_waiting(void);
+
+/*
+ * Wait up to timeout_ms milliseconds (0 to not wait at all) for descriptors
+ * to become ready, and unblock the threads waiting on them, onto the calling
+ * worker.  Returns the number of threads unblocked.  The caller must be a
+ * worker with preemption off, and must not hold the scheduler lock.
+ */
+int __reactor_poll(int timeout_ms);
+
+#endif /* _REACTOR_H */
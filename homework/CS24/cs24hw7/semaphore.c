@@ -13,30 +13,26 @@
 
 #include "sthread.h"
 #include "semaphore.h"
-
-/*
- * Struct used to form the queue of threads that the semaphore has. Implemented
- * as a linked list.
- */
-struct thread_node {
-    Thread * thread;
-    struct thread_node * next;
-} thread_node;
+#include "wheel.h"
 
 /*
  * The semaphore data structure contains:
  *     int i              : the count of the semaphore
- *     thread_node * head : head of the queue containing blocked threads
- *     thread_node * tail : tail of the queue containing blocked threads
+ *     int waiters        : the number of threads in the slow path of wait
+ *     WaitQueue waitq    : the threads blocked on the semaphore
  *
- * The queue is needed so that when a thread calls wait and the semaphore count
- * is 0, it can be blocked. Then when the semaphore is signalled, the thread
- * that was blocked first can be unblocked.
+ * The count is changed with atomic operations, so that waiting on a
+ * semaphore with a positive count, or signalling one that nobody waits on,
+ * never takes the scheduler lock.  The queue is needed so that when a
+ * thread calls wait and the semaphore count is 0, it can be blocked.  Then
+ * when the semaphore is signalled, the thread that was blocked first can be
+ * unblocked.  The queue is linked through the threads themselves, so
+ * blocking never allocates memory.
  */
 struct _semaphore {
-    int i;
-    struct thread_node * head;
-    struct thread_node * tail;
+    volatile int i;
+    volatile int waiters;
+    WaitQueue waitq;
 };
 
 /************************************************************************
@@ -58,57 +54,123 @@ Semaphore *new_semaphore(int init) {
 
     /* Set the intiial count of the semaphore. */
     semp->i = init;
+    semp->waiters = 0;
 
     /* Queue is empty initially so set head and tail of queue to NULL. */
-    semp->head = NULL;
-    semp->tail = NULL;
+    semp->waitq.head = NULL;
+    semp->waitq.tail = NULL;
 
     return semp;
 }
 
+/*
+ * Decrement the count if it is positive, and return true (1); otherwise
+ * return false (0).
+ */
+static int try_decrement(Semaphore *semp) {
+    int i = __atomic_load_n(&semp->i, __ATOMIC_SEQ_CST);
+
+    while (i > 0) {
+        if (__atomic_compare_exchange_n(&semp->i, &i, i - 1, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Decrement the count by as much as it can be without going negative, up to
+ * n, and return the amount.
+ */
+int semaphore_try_wait_up_to(Semaphore *semp, int n) {
+    int i = __atomic_load_n(&semp->i, __ATOMIC_SEQ_CST);
+    int k;
+
+    while (i > 0 && n > 0) {
+        k = (i < n) ? i : n;
+        if (__atomic_compare_exchange_n(&semp->i, &i, i - k, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            return k;
+    }
+
+    return 0;
+}
+
 /*
  * Decrement the semaphore.
  * This operation must be atomic, and it blocks iff the semaphore is zero.
  */
 void semaphore_wait(Semaphore *semp) {
+    /* The fast path:  the count is positive, so there is no need to block. */
+    if (try_decrement(semp))
+        return;
+
     /* This must be atomic, so make sure no other threads interfere. */
-    __sthread_lock();
-
-    while (semp->i == 0) {
-        /* Semaphore cannot handle another thread, so block current one. */
-
-        /* Add to queue of blocked threads. */
-        struct thread_node * current =
-            (struct thread_node *) malloc(sizeof(struct thread_node));
-
-        /* The thread to be held is the currently executing one. */
-        current->thread = sthread_current();
-
-        /* Will be at the end of queue so next is NULL. */
-        current->next = NULL;
-
-        /* Add to queue. */
-        if (semp->head == NULL) {
-            /* Empty queue, head and tail are the new thread_node. */
-            semp->head = current;
-            semp->tail = semp->head;
-        }
-        else {
-            /* This will be the next of tail, and new tail. */
-            semp->tail->next = current;
-            semp->tail = semp->tail->next;
-        }
-
-        /* Block it. */
-        sthread_block();
+    sthread_lock();
+
+    /*
+     * Announce the wait before looking at the count again.  A signaller
+     * increments the count before it looks for waiters, so either this
+     * thread sees the new count, or the signaller sees this thread.
+     */
+    __atomic_add_fetch(&semp->waiters, 1, __ATOMIC_SEQ_CST);
+
+    while (!try_decrement(semp)) {
+        /*
+         * Semaphore cannot handle another thread, so block current one.
+         * This releases the lock, so take it again before looking at the
+         * count.
+         */
+        sthread_block_on(&semp->waitq);
+        sthread_lock();
     }
 
-    /* Decrement semaphore count, should still be non-negative. */
-    semp->i--;
-    assert(semp->i >= 0);
+    __atomic_sub_fetch(&semp->waiters, 1, __ATOMIC_SEQ_CST);
 
     /* Can unlock now that operations are done. */
-    __sthread_unlock();
+    sthread_unlock();
+}
+
+/*
+ * Decrement the semaphore, waiting at most ms milliseconds for it to become
+ * positive.  Returns true (1) if it was decremented, or false (0) on a
+ * timeout.
+ */
+int semaphore_timedwait(Semaphore *semp, unsigned int ms) {
+    WheelTimer timer;
+    int acquired;
+
+    if (try_decrement(semp))
+        return 1;
+    if (ms == 0)
+        return 0;
+
+    sthread_lock();
+    __atomic_add_fetch(&semp->waiters, 1, __ATOMIC_SEQ_CST);
+
+    /*
+     * The timer takes the thread off the wait queue if it fires first.
+     * Either way, the thread looks at the count once more before giving up.
+     */
+    wheel_start(&timer, ms, &semp->waitq);
+    while (!(acquired = try_decrement(semp)) && !timer.fired) {
+        sthread_block_on(&semp->waitq);
+        sthread_lock();
+    }
+    wheel_cancel(&timer);
+
+    /*
+     * A signal may have woken this thread just as it timed out; pass the
+     * wakeup on, so that it isn't lost.
+     */
+    if (!acquired && __atomic_load_n(&semp->i, __ATOMIC_SEQ_CST) > 0)
+        sthread_wake_one(&semp->waitq);
+
+    __atomic_sub_fetch(&semp->waiters, 1, __ATOMIC_SEQ_CST);
+    sthread_unlock();
+
+    return acquired;
 }
 
 /*
@@ -116,39 +178,41 @@ void semaphore_wait(Semaphore *semp) {
  * This operation must be atomic.
  */
 void semaphore_signal(Semaphore *semp) {
-    /* This must be atomic, so make sure no other threads interfere. */
-    __sthread_lock();
-
     /* Incrememnt semaphore count. */
-    semp->i++;
+    __atomic_add_fetch(&semp->i, 1, __ATOMIC_SEQ_CST);
 
-    /* Get next in queue to run. */
-    if (semp->head == NULL) {
-        /* Queue empty! Do nothing. */
-    }
-    else {
-        /* Save the current head to free it later. */
-        struct thread_node * old_head = semp->head;
-
-        /* Unblock the head. */
-        sthread_unblock(semp->head->thread);
-
-        /* Remove from queue and free. */
-        if (semp->head->next == NULL) {
-            /* If this has no next them queue is empty now. */
-            semp->head = NULL;
-            semp->tail = NULL;
-        }
-        else {
-            /* Move head to the next. */
-            semp->head = semp->head->next;
-        }
-
-        /* Free it. */
-        free(old_head);
-    }
+    /* The fast path:  nobody is waiting, so nobody needs to be woken. */
+    if (__atomic_load_n(&semp->waiters, __ATOMIC_SEQ_CST) == 0)
+        return;
+
+    /* This must be atomic, so make sure no other threads interfere. */
+    sthread_lock();
+
+    /*
+     * Unblock the head of the queue, if there is one; a waiter may not have
+     * blocked yet, in which case it will see the new count.
+     */
+    sthread_wake_one(&semp->waitq);
 
     /* Can unlock now that operations are done. */
-    __sthread_unlock();
+    sthread_unlock();
 }
 
+/*
+ * Increment the semaphore by n in one step, and wake as many waiters as
+ * the new count can satisfy.
+ */
+void semaphore_signal_n(Semaphore *semp, int n) {
+    if (n <= 0)
+        return;
+
+    __atomic_add_fetch(&semp->i, n, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&semp->waiters, __ATOMIC_SEQ_CST) == 0)
+        return;
+
+    sthread_lock();
+    while (n-- > 0 && sthread_wake_one(&semp->waitq) != NULL)
+        ;
+    sthread_unlock();
+}
@@ -26,10 +26,28 @@ Semaphore *new_semaphore(int init);
  */
 void semaphore_wait(Semaphore *semp);
 
+/*
+ * Decrement the semaphore, blocking for at most ms milliseconds.  Returns
+ * true (1) if the semaphore was decremented, and false (0) if the time ran
+ * out first.
+ */
+int semaphore_timedwait(Semaphore *semp, unsigned int ms);
+
+/*
+ * Decrement the semaphore by as much as it can be without blocking, up to
+ * n, and return the amount.
+ */
+int semaphore_try_wait_up_to(Semaphore *semp, int n);
+
 /*
  * Increment the semaphore.
  */
 void semaphore_signal(Semaphore *semp);
 
+/*
+ * Increment the semaphore by n, waking up to n waiting threads.
+ */
+void semaphore_signal_n(Semaphore *semp, int n);
+
 #endif /* _SEMAPHORE_H */
 
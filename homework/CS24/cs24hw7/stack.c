@@ -0,0 +1,159 @@
+/*
+ * A pool of thread stacks, backed by mmap reservations.
+ *
+ * Each stack is a power-of-two number of pages, with a PROT_NONE guard page
+ * below it.  The mapping is made with MAP_NORESERVE, so a stack costs only
+ * address space until the thread touches its pages.  Released stacks are
+ * kept on a free list for their size, up to STACKS_PER_CLASS of them, so
+ * that creating many short-lived threads doesn't go to the kernel each time;
+ * the rest are unmapped.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+#include "stack.h"
+
+/*
+ * Stacks of 2^0 up to 2^(NUM_CLASSES - 1) times MIN_STACKSIZE are pooled;
+ * larger ones are mapped and unmapped each time.
+ */
+#define NUM_CLASSES             12
+
+/*
+ * The most released stacks of each size that are kept for reuse.
+ */
+#define STACKS_PER_CLASS        1024
+
+/*
+ * A released stack links to the next one through its first word.
+ */
+typedef struct _free_stack {
+    struct _free_stack *next;
+} FreeStack;
+
+static FreeStack *free_stacks[NUM_CLASSES];
+static int num_free[NUM_CLASSES];
+
+/*
+ * The pool is shared by all of the workers.  Callers that are user threads
+ * must have turned preemption off, so that the lock is never held by a
+ * thread that isn't running.
+ */
+static volatile char pool_lock;
+
+static void lock_pool(void) {
+    while (__atomic_test_and_set(&pool_lock, __ATOMIC_ACQUIRE)) {
+        while (pool_lock)
+            ;
+    }
+}
+
+static void unlock_pool(void) {
+    __atomic_clear(&pool_lock, __ATOMIC_RELEASE);
+}
+
+static size_t page_size(void) {
+    static size_t size;
+
+    if (size == 0)
+        size = (size_t) sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+/*
+ * Returns the size class of a stack of the specified size, rounding it up
+ * to the class's size, which is stored into *class_size.  Returns
+ * NUM_CLASSES if the stack is too big to pool.
+ */
+static int size_class(size_t size, size_t *class_size) {
+    size_t cs = MIN_STACKSIZE;
+    int c = 0;
+
+    while (cs < size && c < NUM_CLASSES) {
+        cs *= 2;
+        c++;
+    }
+
+    if (c == NUM_CLASSES) {
+        /* Unpooled; just round up to whole pages. */
+        cs = (size + page_size() - 1) & ~(page_size() - 1);
+    }
+
+    *class_size = cs;
+    return c;
+}
+
+/*
+ * Map a new stack of the specified size, with a guard page below it.
+ */
+static void *map_stack(size_t size) {
+    char *region;
+
+    region = mmap(NULL, size + page_size(), PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED) {
+        perror("mmap");
+        fprintf(stderr, "Can't allocate a stack for the new thread\n");
+        exit(1);
+    }
+
+    if (mprotect(region, page_size(), PROT_NONE) < 0) {
+        perror("mprotect");
+        exit(1);
+    }
+
+    return region + page_size();
+}
+
+void *stack_alloc(size_t size, size_t *actual_size) {
+    FreeStack *stack = NULL;
+    int c;
+
+    assert(actual_size != NULL);
+
+    c = size_class(size, actual_size);
+    if (c < NUM_CLASSES) {
+        lock_pool();
+        stack = free_stacks[c];
+        if (stack != NULL) {
+            free_stacks[c] = stack->next;
+            num_free[c]--;
+        }
+        unlock_pool();
+    }
+
+    if (stack != NULL)
+        return stack;
+
+    return map_stack(*actual_size);
+}
+
+void stack_release(void *stack, size_t size) {
+    size_t class_size;
+    int c;
+
+    assert(stack != NULL);
+
+    c = size_class(size, &class_size);
+    assert(class_size == size);
+
+    if (c < NUM_CLASSES) {
+        lock_pool();
+        if (num_free[c] < STACKS_PER_CLASS) {
+            ((FreeStack *) stack)->next = free_stacks[c];
+            free_stacks[c] = (FreeStack *) stack;
+            num_free[c]++;
+            stack = NULL;
+        }
+        unlock_pool();
+
+        if (stack == NULL)
+            return;
+    }
+
+    munmap((char *) stack - page_size(), size + page_size());
+}
@@ -0,0 +1,30 @@
+/*
+ * A pool of thread stacks.  Stacks are reserved with mmap, with a guard
+ * page below each one so that an overflow faults instead of running into
+ * the neighboring memory, and their pages are only committed as the thread
+ * touches them.  Stacks that are released are kept for reuse.
+ */
+#ifndef _STACK_H
+#define _STACK_H
+
+#include <stddef.h>
+
+/*
+ * The smallest stack that stack_alloc will hand out; smaller requests are
+ * rounded up to this.
+ */
+#define MIN_STACKSIZE   (16 * 1024)
+
+/*
+ * Get a stack of at least size bytes.  The usable region starts at the
+ * returned address, and its actual size is stored into *actual_size.
+ */
+void *stack_alloc(size_t size, size_t *actual_size);
+
+/*
+ * Release a stack from stack_alloc, with the size that it reported.  The
+ * stack is kept for reuse if the pool has room for it.
+ */
+void stack_release(void *stack, size_t size);
+
+#endif /* _STACK_H */
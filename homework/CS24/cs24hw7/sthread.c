@@ -7,16 +7,71 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 #include "sthread.h"
 #include "timer.h"
 #include "glue.h"
+#include "stack.h"
+#include "reactor.h"
+#include "wheel.h"
+#include "probe.h"
 
 /*
- * By default, create threads with 1MB of stack space.
+ * By default, create threads with 1MB of stack space.  Use
+ * sthread_create_with_stack for threads that need less.
  */
 #define DEFAULT_STACKSIZE       (1 << 20)
 
+/*
+ * With stack checking on, a new thread's stack is filled with this
+ * pattern, and the words that still hold it when the thread finishes
+ * were never used.
+ */
+#define STACK_CANARY            ((size_t) 0xcafef00dcafef00dULL)
+
+/*
+ * The most kernel threads that sthread_start_workers() will run user
+ * threads on.
+ */
+#define MAX_WORKERS             64
+
+/*
+ * The number of slots that a worker's ready deque starts out with.  The
+ * deque doubles whenever it fills up.
+ */
+#define INITIAL_DEQUE_SLOTS     256
+
+/*
+ * While threads wait in the reactor, a worker polls it without waiting
+ * whenever its thread was preempted, so that I/O is never left waiting much
+ * longer than a quantum, and otherwise once every POLL_INTERVAL times that
+ * it schedules a thread.  It waits in the reactor for up to IDLE_POLL_MS
+ * milliseconds when it has nothing to run.  An idle worker that only has
+ * timers to wait for sleeps for the same time.
+ */
+#define POLL_INTERVAL           16
+#define IDLE_POLL_MS            1
+
+/*
+ * Run-queue lengths are counted in buckets of powers of two:  0, 1, 2-3,
+ * 4-7, and so on, the last bucket taking everything longer.  The statistics
+ * dump lists at most STATS_MAX_LISTED threads one by one.
+ */
+#define RUNQ_BUCKETS            16
+#define STATS_MAX_LISTED        32
+
+/*
+ * The probes of the scheduler, for "make PROBES=1".  Its time includes
+ * waiting for a thread to run when the worker is idle.  The counts are
+ * kept per worker, since each worker is its own kernel thread.
+ */
+PROBE_DEFINE(scheduler_probe, "__sthread_scheduler");
+PROBE_DEFINE(preempt_probe, "__sthread_scheduler preemptions");
+
 
 /************************************************************************
  * Internal helper functions.
@@ -26,6 +81,7 @@
 
 void __sthread_finish(void);
 void __sthread_delete(Thread *threadp);
+static unsigned long long clock_ns(void);
 
 
 /************************************************************************
@@ -37,8 +93,8 @@ void __sthread_delete(Thread *threadp);
  */
 typedef enum {
     /*!
-     * The thread is currently running on the CPU.  Only one thread should be
-     * in this state.
+     * The thread is currently running on a worker.  Each worker has at most
+     * one thread in this state.
      */
     ThreadRunning,
 
@@ -70,20 +126,72 @@ struct _thread {
 
     /*
      * The start of the memory region being used for the thread's stack
-     * and machine context.
+     * and machine context, and its size.
      */
     void *memory;
+    size_t stack_size;
 
     /* The machine context itself.  This will be some address within the
      * memory region referenced by the previous field.
      */
     ThreadContext *context;
 
+    /*
+     * Nonzero if the timer must never preempt this thread, so that it only
+     * gives up the CPU when it yields, blocks or finishes.
+     */
+    int cooperative;
+
+    /* Nonzero if the thread finishes without announcing it. */
+    int quiet;
+
+    /* Nonzero if the stack was filled with STACK_CANARY. */
+    int stack_checked;
+
+    /*
+     * The thread's priority, from 0 up to STHREAD_NUM_PRIORITIES - 1; a
+     * ready thread only runs when no thread of a higher priority is ready.
+     */
+    int priority;
+
+    /*
+     * The number of timer ticks that the thread runs for before it is
+     * preempted, and how many of them are left.  A weight above 1 gives the
+     * thread that many times the CPU of its peers at the same priority.
+     */
+    int weight;
+    int ticks_left;
+
     /*
      * The processes are linked in a doubly-linked list.
      */
     struct _thread *prev;
     struct _thread *next;
+
+    /*
+     * The WaitQueue that this thread is blocked on, or NULL, and its
+     * neighbors in that queue, so that a timeout can take it out of the
+     * middle.
+     */
+    WaitQueue *waiting_on;
+    struct _thread *wait_prev;
+    struct _thread *wait_next;
+
+    /*
+     * Every thread that hasn't finished is on the list of all threads,
+     * which is protected by the scheduler lock.
+     */
+    struct _thread *all_prev;
+    struct _thread *all_next;
+
+    /*
+     * The thread's scheduler statistics, and the times at which it was last
+     * made ready and last given the CPU, in nanoseconds, or 0 if that wasn't
+     * measured.  Only the worker that the thread is on touches these.
+     */
+    SthreadStats stats;
+    unsigned long long ready_since;
+    unsigned long long running_since;
 };
 
 /*
@@ -95,36 +203,159 @@ typedef struct _queue {
 } Queue;
 
 /*
- * The thread that is currently running.
- *
- * Invariant: during normal operation, there is exactly one thread in
- * the ThreadRunning state, and this variable points to that thread.
+ * The circular array of a work-stealing deque.  The deque's indexes only
+ * grow; slot i is stored at i % size.
+ */
+typedef struct _deque_array {
+    long size;
+    struct _deque_array *older;
+    Thread *slots[];
+} DequeArray;
+
+/*
+ * A Chase-Lev work-stealing deque of ready threads.  Only the worker that
+ * owns it pushes and pops at the bottom, without locking; any worker may
+ * steal from the top with a compare-and-swap.
+ */
+typedef struct _deque {
+    volatile long top;
+    volatile long bottom;
+    DequeArray * volatile array;
+} Deque;
+
+/*
+ * A worker is a kernel thread that runs user threads, one at a time, from
+ * its own ready deque.  When its deque is empty it steals threads from the
+ * other workers' deques, so M user threads are spread over the N workers.
+ */
+typedef struct _worker {
+    /* The index of the worker in the workers array. */
+    int id;
+
+    /* The kernel thread; unused for worker 0, which is the main thread. */
+    pthread_t pthread;
+
+    /*
+     * The worker's own scheduler stack, which __sthread_schedule switches
+     * to before calling __sthread_scheduler.
+     */
+    ThreadContext *scheduler_context;
+
+    /*
+     * The thread that is currently running on this worker, or NULL while
+     * the worker is in the scheduler.
+     */
+    Thread *current;
+
+    /*
+     * Threads that are ready to run, preferably on this worker, with one
+     * deque per priority.  Bit p of ready_levels is set while the deque of
+     * priority p may be nonempty; only the worker itself changes it, setting
+     * the bit when it pushes and clearing it once it finds the deque empty,
+     * so other workers may read it to decide where to steal from.
+     */
+    Deque ready_deques[STHREAD_NUM_PRIORITIES];
+    volatile unsigned int ready_levels;
+
+    /*
+     * Set when a thread of a higher priority than the running one is made
+     * ready here, so that sthread_unlock yields to it.
+     */
+    int resched;
+
+    /*
+     * Nonzero while the timer must not preempt the worker's thread:  while
+     * it holds the scheduler lock, and from entering the scheduler until the
+     * next thread's context is restored.  Only the worker itself, or its
+     * signal handler, touches this.
+     */
+    volatile int preempt_off;
+
+    /*
+     * The number of threads still to be taken oldest-first rather than
+     * newest-first.  When a thread is preempted, every thread that is then
+     * ready on this worker gets its turn before the worker goes back to
+     * taking the newest, so that a thread that never blocks can't keep
+     * jumping ahead of the older ones.
+     */
+    int rotate;
+
+    /*
+     * The thread that sthread_yield is switching away from, which is made
+     * ready once its context has been saved.
+     */
+    Thread *switch_from;
+
+    /* The number of threads scheduled since the reactor was last polled. */
+    int since_poll;
+
+    /*
+     * While statistics are kept, the number of times that the worker picked
+     * a thread with each bucket's number of others still ready on it.
+     */
+    unsigned long runq_hist[RUNQ_BUCKETS];
+} Worker;
+
+static Worker workers[MAX_WORKERS];
+static int num_workers = 1;
+
+/*
+ * The worker that the calling kernel thread is, or NULL if it isn't one.
+ * Since user threads move between workers, no function may use this both
+ * before and after it calls the scheduler; the compiler could keep the
+ * thread-local address from the old worker.
  */
-static Thread *current;
+static __thread Worker *self;
+
+/*
+ * The number of threads that haven't finished, and how many of them are
+ * blocked, both protected by the scheduler lock.  Once every thread is
+ * blocked, and none of them is waiting in the reactor or for a timer,
+ * nothing can ever run again.
+ */
+static int num_threads;
+static int num_blocked;
+
+/*
+ * Nonzero once statistics are being kept.  The list of every thread that
+ * hasn't finished, and the totals of the statistics of the threads that
+ * have, are protected by the scheduler lock.
+ */
+static int stats_enabled;
+static Thread *all_threads;
+static SthreadStats finished_stats;
+static unsigned long num_finished;
+
+/*
+ * Nonzero once new stacks are filled with STACK_CANARY, and the number of
+ * checked threads that have finished and the most stack that any of them
+ * used, which are updated atomically.
+ */
+static int stack_check_enabled;
+static unsigned long num_stacks_checked;
+static size_t max_stack_used;
+static size_t max_stack_size;
+
+/*
+ * Set on a worker that is making the program exit while it holds the
+ * scheduler lock, so that the statistics dump doesn't wait for the lock.
+ */
+static __thread int exit_holds_lock;
 
 /************************************************************************
  * Queue operations.
  */
 
 /*
- * Queues for ready and blocked threads.
+ * The queue for blocked threads, which is protected by the scheduler lock.
+ * Ready threads are kept in the workers' deques.
  *
  * Invariants:
- *     All threads in the ready queue are in state ThreadReady.
+ *     All threads in the ready deques are in state ThreadReady.
  *     All threads in the blocked queue are in state ThreadBlocked.
  */
-static Queue ready_queue;
 static Queue blocked_queue;
 
-/*
- * Returns true (1) if the specified queue is empty.  Otherwise, returns
- * false (0).
- */
-static int queue_empty(Queue *queuep) {
-    assert(queuep != NULL);
-    return (queuep->head == NULL);
-}
-
 /*
  * Add the process to the head of the queue.
  * If the queue is empty, add the singleton element.
@@ -149,84 +380,489 @@ static void queue_append(Queue *queuep, Thread *threadp) {
 }
 
 /*
- * Add a thread to the queue based on its state.
+ * Remove a process from a queue.
  */
-static void queue_add(Thread *threadp) {
+static void queue_remove(Queue *queuep, Thread *threadp) {
+    assert(queuep != NULL);
     assert(threadp != NULL);
 
-    switch(threadp->state) {
-    case ThreadReady:
-        queue_append(&ready_queue, threadp);
-        break;
-    case ThreadBlocked:
-        queue_append(&blocked_queue, threadp);
-        break;
-    default:
-        fprintf(stderr, "Thread state has been corrupted: %d\n",
-                threadp->state);
+    /* Unlink */
+    if(threadp->prev != NULL)
+        threadp->prev->next = threadp->next;
+    if(threadp->next != NULL)
+        threadp->next->prev = threadp->prev;
+
+    /* Reset head and tail pointers */
+    if(queuep->head == threadp)
+        queuep->head = threadp->next;
+    if(queuep->tail == threadp)
+        queuep->tail = threadp->prev;
+}
+
+/************************************************************************
+ * Work-stealing deque operations.
+ *
+ * These follow Le, Pop, Cohen and Zappa Nardelli, "Correct and Efficient
+ * Work-Stealing for Weak Memory Models" (PPoPP 2013).  The owner must not be
+ * preempted in the middle of a push or pop.
+ */
+
+static DequeArray *deque_array_new(long size) {
+    DequeArray *array;
+
+    array = (DequeArray *) malloc(sizeof(DequeArray) + size * sizeof(Thread *));
+    if (array == NULL) {
+        fprintf(stderr, "Can't allocate a ready deque\n");
         exit(1);
     }
+
+    array->size = size;
+    array->older = NULL;
+    return array;
+}
+
+static void deque_init(Deque *dequep) {
+    dequep->top = 0;
+    dequep->bottom = 0;
+    dequep->array = deque_array_new(INITIAL_DEQUE_SLOTS);
+}
+
+static void worker_init_deques(Worker *workerp) {
+    int p;
+
+    if (workerp->ready_deques[0].array != NULL)
+        return;
+
+    for (p = 0; p < STHREAD_NUM_PRIORITIES; p++)
+        deque_init(&workerp->ready_deques[p]);
+    workerp->ready_levels = 0;
 }
 
 /*
- * Get the first process from the queue.
+ * Double the deque's array.  A thief may still be reading the old array, so
+ * it is kept, linked from the new one, rather than freed.
  */
-static Thread *queue_take(Queue *queuep) {
-    Thread *threadp;
+static DequeArray *deque_grow(Deque *dequep, DequeArray *array,
+                              long top, long bottom) {
+    DequeArray *bigger = deque_array_new(2 * array->size);
+    long i;
 
-    assert(queuep != NULL);
+    for (i = top; i < bottom; i++)
+        bigger->slots[i % bigger->size] = array->slots[i % array->size];
 
-    /* Return NULL if the queue is empty */
-    if(queuep->head == NULL)
-        return NULL;
+    bigger->older = array;
+    __atomic_store_n(&dequep->array, bigger, __ATOMIC_RELEASE);
+    return bigger;
+}
 
-    /* Go to the final element */
-    threadp = queuep->head;
-    if(threadp == queuep->tail) {
-        queuep->head = NULL;
-        queuep->tail = NULL;
+/*
+ * Push a thread on the bottom of the deque.  Only the owner may do this.
+ */
+static void deque_push(Deque *dequep, Thread *threadp) {
+    long bottom = __atomic_load_n(&dequep->bottom, __ATOMIC_RELAXED);
+    long top = __atomic_load_n(&dequep->top, __ATOMIC_ACQUIRE);
+    DequeArray *array = __atomic_load_n(&dequep->array, __ATOMIC_RELAXED);
+
+    if (bottom - top > array->size - 1)
+        array = deque_grow(dequep, array, top, bottom);
+
+    array->slots[bottom % array->size] = threadp;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&dequep->bottom, bottom + 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Pop the newest thread from the bottom of the deque, or return NULL if it
+ * is empty.  Only the owner may do this.
+ */
+static Thread *deque_pop(Deque *dequep) {
+    long bottom = __atomic_load_n(&dequep->bottom, __ATOMIC_RELAXED) - 1;
+    DequeArray *array = __atomic_load_n(&dequep->array, __ATOMIC_RELAXED);
+    Thread *threadp = NULL;
+    long top;
+
+    __atomic_store_n(&dequep->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    top = __atomic_load_n(&dequep->top, __ATOMIC_RELAXED);
+
+    if (top <= bottom) {
+        threadp = array->slots[bottom % array->size];
+        if (top == bottom) {
+            /* The last thread; race any thieves for it. */
+            if (!__atomic_compare_exchange_n(&dequep->top, &top, top + 1, 0,
+                                             __ATOMIC_SEQ_CST,
+                                             __ATOMIC_RELAXED))
+                threadp = NULL;
+            __atomic_store_n(&dequep->bottom, bottom + 1, __ATOMIC_RELAXED);
+        }
     }
     else {
-        threadp->next->prev = NULL;
-        queuep->head = threadp->next;
+        __atomic_store_n(&dequep->bottom, bottom + 1, __ATOMIC_RELAXED);
     }
+
     return threadp;
 }
 
 /*
- * Remove a process from a queue.
+ * Steal the oldest thread from the top of the deque.  Returns NULL if the
+ * deque is empty, or if another worker got to it first.  Any worker may do
+ * this, the owner included.
  */
-static void queue_remove(Queue *queuep, Thread *threadp) {
-    assert(queuep != NULL);
+static Thread *deque_steal(Deque *dequep) {
+    long top = __atomic_load_n(&dequep->top, __ATOMIC_ACQUIRE);
+    long bottom;
+    DequeArray *array;
+    Thread *threadp;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    bottom = __atomic_load_n(&dequep->bottom, __ATOMIC_ACQUIRE);
+
+    if (top >= bottom)
+        return NULL;
+
+    array = __atomic_load_n(&dequep->array, __ATOMIC_ACQUIRE);
+    threadp = array->slots[top % array->size];
+    if (!__atomic_compare_exchange_n(&dequep->top, &top, top + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+
+    return threadp;
+}
+
+/*
+ * Put a ready thread on the calling worker's deque for its priority.
+ * Threads made ready before the workers start go to worker 0.
+ */
+static void make_ready(Thread *threadp) {
+    Worker *workerp = self != NULL ? self : &workers[0];
+
     assert(threadp != NULL);
+    assert(threadp->state == ThreadReady);
 
-    /* Unlink */
-    if(threadp->prev != NULL)
-        threadp->prev->next = threadp->next;
-    if(threadp->next != NULL)
-        threadp->next->prev = threadp->prev;
+    if (stats_enabled)
+        threadp->ready_since = clock_ns();
 
-    /* Reset head and tail pointers */
-    if(queuep->head == threadp)
-        queuep->head = threadp->next;
-    if(queuep->tail == threadp)
-        queuep->tail = threadp->prev;
+    deque_push(&workerp->ready_deques[threadp->priority], threadp);
+    if (!(workerp->ready_levels & (1U << threadp->priority)))
+        workerp->ready_levels |= 1U << threadp->priority;
+}
+
+/*
+ * Returns the highest priority whose bit is set, or -1 if none is.
+ */
+static int highest_level(unsigned int levels) {
+    return levels != 0 ? 31 - __builtin_clz(levels) : -1;
+}
+
+/*
+ * The number of threads ready on the calling worker.
+ */
+static int ready_count(void) {
+    int p, n = 0;
+
+    for (p = 0; p < STHREAD_NUM_PRIORITIES; p++)
+        n += (int) (self->ready_deques[p].bottom - self->ready_deques[p].top);
+    return n;
+}
+
+/************************************************************************
+ * Statistics.
+ *
+ * These are only called while stats_enabled is set, by the worker that the
+ * thread is on, with preemption off.
+ */
+
+static unsigned long long clock_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Account for a thread giving up the CPU.  This must be done before the
+ * thread is made ready or unlocked, since another worker may then run it.
+ */
+static void stats_stop(Thread *threadp, int preempted) {
+    unsigned long long now = clock_ns();
+
+    if (preempted)
+        threadp->stats.preempted++;
+    else
+        threadp->stats.voluntary++;
+
+    if (threadp->running_since != 0)
+        threadp->stats.running_ns += now - threadp->running_since;
+    threadp->running_since = 0;
+}
+
+/*
+ * Account for a thread being given the CPU, and count the length of the
+ * calling worker's run queue in its histogram.
+ */
+static void stats_start(Thread *threadp) {
+    unsigned long long now = clock_ns();
+    int n = ready_count(), bucket = 0;
+
+    threadp->stats.switches++;
+    if (threadp->ready_since != 0)
+        threadp->stats.ready_ns += now - threadp->ready_since;
+    threadp->ready_since = 0;
+    threadp->running_since = now;
+
+    while (n > 0 && bucket < RUNQ_BUCKETS - 1) {
+        n >>= 1;
+        bucket++;
+    }
+    self->runq_hist[bucket]++;
+}
+
+static void add_stats(SthreadStats *totalp, const SthreadStats *statsp) {
+    totalp->switches += statsp->switches;
+    totalp->voluntary += statsp->voluntary;
+    totalp->preempted += statsp->preempted;
+    totalp->ready_ns += statsp->ready_ns;
+    totalp->running_ns += statsp->running_ns;
+}
+
+static void print_stats(FILE *fp, const char *label,
+                        const SthreadStats *statsp) {
+    fprintf(fp, "  %-18s %10lu %10lu %10lu %12.3f %12.3f\n", label,
+            statsp->switches, statsp->voluntary, statsp->preempted,
+            statsp->ready_ns / 1e6, statsp->running_ns / 1e6);
+}
+
+/*
+ * Write the statistics out.  The live threads are only listed if the
+ * caller holds the scheduler lock, since they can finish otherwise.
+ */
+static void dump_stats(FILE *fp, int locked) {
+    SthreadStats total = finished_stats;
+    unsigned long hist[RUNQ_BUCKETS], picks = 0;
+    char label[32];
+    Thread *threadp;
+    int i, b, live = 0;
+
+    fprintf(fp, "sthread statistics:\n");
+    fprintf(fp, "  %-18s %10s %10s %10s %12s %12s\n", "thread", "switches",
+            "voluntary", "preempted", "ready ms", "running ms");
+
+    if (locked) {
+        for (threadp = all_threads; threadp != NULL;
+             threadp = threadp->all_next) {
+            if (live < STATS_MAX_LISTED) {
+                snprintf(label, sizeof(label), "%p", (void *) threadp);
+                print_stats(fp, label, &threadp->stats);
+            }
+            add_stats(&total, &threadp->stats);
+            live++;
+        }
+        if (live > STATS_MAX_LISTED)
+            fprintf(fp, "  (%d more)\n", live - STATS_MAX_LISTED);
+    }
+    else
+        fprintf(fp, "  (live threads not listed; the scheduler is busy)\n");
+
+    snprintf(label, sizeof(label), "%lu finished", num_finished);
+    print_stats(fp, label, &finished_stats);
+    if (locked)
+        print_stats(fp, "total", &total);
+
+    for (b = 0; b < RUNQ_BUCKETS; b++) {
+        hist[b] = 0;
+        for (i = 0; i < num_workers; i++)
+            hist[b] += workers[i].runq_hist[b];
+        picks += hist[b];
+    }
+
+    fprintf(fp, "  run-queue length when a thread was picked (%lu picks):\n",
+            picks);
+    for (b = 0; b < RUNQ_BUCKETS; b++) {
+        if (hist[b] == 0)
+            continue;
+
+        if (b == 0)
+            snprintf(label, sizeof(label), "0");
+        else if (b == 1)
+            snprintf(label, sizeof(label), "1");
+        else if (b == RUNQ_BUCKETS - 1)
+            snprintf(label, sizeof(label), "%d+", 1 << (b - 1));
+        else
+            snprintf(label, sizeof(label), "%d-%d", 1 << (b - 1),
+                     (1 << b) - 1);
+        fprintf(fp, "  %18s %10lu %9.1f%%\n", label, hist[b],
+                100.0 * hist[b] / picks);
+    }
+}
+
+/*
+ * The dump at exit only waits a little for the scheduler lock, since the
+ * thread that is exiting may hold it.
+ */
+static void dump_stats_at_exit(void) {
+    int i, locked = exit_holds_lock;
+
+    fflush(stdout);
+    if (locked) {
+        dump_stats(stderr, 1);
+        return;
+    }
+
+    for (i = 0; i < 1000 && !locked; i++) {
+        locked = __sthread_lock();
+        if (!locked)
+            sched_yield();
+    }
+
+    dump_stats(stderr, locked);
+    if (locked)
+        __sthread_unlock();
 }
 
 /************************************************************************
  * Scheduler.
  */
 
+/*
+ * Take the next thread for this worker to run, of at least priority
+ * min_level:  the one of the highest priority that is ready anywhere, as
+ * far as the other workers' ready_levels tell.  From this worker's own
+ * deque for that priority, take the newest thread, which was most likely
+ * just unblocked by the thread that ran here and shares its data in the
+ * cache, or the oldest one while a thread has been preempted or yielded,
+ * so that every ready thread gets its turn.  Other workers' threads are
+ * stolen oldest first.  Returns NULL if there is nothing to run.
+ *
+ * take_ready_thread keeps looking until there is something to run, waiting
+ * in the reactor meanwhile if any thread is blocked on I/O, and turning the
+ * timer wheel; if every thread is blocked otherwise, nothing can ever
+ * become ready, and the program exits.
+ */
+static Thread *steal_above(Worker *victim, int level) {
+    unsigned int levels = victim->ready_levels & ~((1U << (level + 1)) - 1);
+    Thread *threadp;
+    int p;
+
+    while (levels != 0) {
+        p = highest_level(levels);
+        threadp = deque_steal(&victim->ready_deques[p]);
+        if (threadp != NULL)
+            return threadp;
+        levels &= ~(1U << p);
+    }
+
+    return NULL;
+}
+
+static Thread *find_ready_thread(int oldest, int min_level) {
+    Thread *threadp = NULL;
+    Deque *dequep;
+    int i, level;
+
+    while (1) {
+        level = highest_level(self->ready_levels);
+
+        /* A thread of a higher priority on another worker goes first. */
+        for (i = 1; i < num_workers; i++) {
+            threadp = steal_above(&workers[(self->id + i) % num_workers],
+                                  level > min_level - 1 ? level : min_level - 1);
+            if (threadp != NULL)
+                return threadp;
+        }
+
+        if (level < min_level)
+            return NULL;
+
+        dequep = &self->ready_deques[level];
+        if (oldest)
+            threadp = deque_steal(dequep);
+        if (threadp == NULL)
+            threadp = deque_pop(dequep);
+        if (threadp != NULL)
+            return threadp;
+
+        /* Only this worker pushes onto its deques, so it stays empty. */
+        self->ready_levels &= ~(1U << level);
+    }
+}
+
+/*
+ * Poll the reactor, without waiting, if it is time to.
+ */
+static void maybe_poll_reactor(int preempted) {
+    if (__reactor_waiting() &&
+        (preempted || ++self->since_poll >= POLL_INTERVAL)) {
+        self->since_poll = 0;
+        __reactor_poll(0);
+    }
+}
+
+/*
+ * Wait a little when there is nothing to run:  in the reactor, if any
+ * thread is waiting on I/O, or for the next tick of the timer wheel, or
+ * else just until other workers have run.
+ */
+static void idle(void) {
+    struct timespec pause = { 0, IDLE_POLL_MS * 1000000L };
+
+    if (__reactor_waiting())
+        __reactor_poll(IDLE_POLL_MS);
+    else if (__wheel_pending())
+        nanosleep(&pause, NULL);
+    else
+        sched_yield();
+}
+
+static Thread *take_ready_thread(int preempted) {
+    Thread *threadp;
+
+    __wheel_advance();
+    maybe_poll_reactor(preempted);
+    if (preempted)
+        self->rotate = ready_count();
+
+    while (1) {
+        threadp = find_ready_thread(self->rotate > 0, 0);
+        if (threadp != NULL) {
+            if (self->rotate > 0)
+                self->rotate--;
+            return threadp;
+        }
+        self->rotate = 0;
+
+        __sthread_spin_lock();
+        if (num_threads == 0) {
+            fprintf(stderr, "All threads completed, exiting.\n");
+            exit_holds_lock = 1;
+            exit(0);
+        }
+        else if (num_blocked == num_threads && !__reactor_waiting() &&
+                 !__wheel_pending()) {
+            fprintf(stderr, "The system is deadlocked!\n");
+            exit_holds_lock = 1;
+            exit(1);
+        }
+        __sthread_unlock();
+
+        idle();
+        __wheel_advance();
+    }
+}
+
 /*
  * The scheduler is called with the context of the current thread,
- * or NULL when the scheduler is first started.
+ * or NULL when the scheduler is first started on a worker.  It runs on
+ * the worker's scheduler stack with preemption off, which __sthread_schedule
+ * turns back on once the next thread's context is restored.  A thread that
+ * is blocking enters with the scheduler lock held, and the lock is released
+ * here once its context is saved.
  *
  * The general operation of this function is:
  *   1.  Save the context argument into the current thread.
  *   2.  Either queue up or deallocate the current thread,
  *       based on its state.
- *   3.  Select a new "ready" thread to run, and set the "current"
- *       variable to that thread.
+ *   3.  Select a new "ready" thread to run, and make it the worker's
+ *       current thread.
  *        - If no "ready" thread is available, examine the system
  *          state to handle this situation properly.
  *   4.  Return the context of the thread to run, so that a context-
@@ -235,76 +871,354 @@ static void queue_remove(Queue *queuep, Thread *threadp) {
  * This function is global because it needs to be called from the assembly.
  */
 ThreadContext *__sthread_scheduler(ThreadContext *context) {
+    Thread *current;
+    int preempted = 0;
+
+    PROBE_BEGIN(scheduler_probe);
+
+    assert(self != NULL);
+    assert(self->preempt_off == 1);
+
+    /* The highest priority is about to be chosen anyway. */
+    self->resched = 0;
 
     /* Add the current thread to the ready queue */
     if (context != NULL) {
+        current = self->current;
         assert(current != NULL);
 
-        if (current->state == ThreadRunning)
-            current->state = ThreadReady;
+        self->current = NULL;
+        current->context = context;
 
-        if (current->state != ThreadFinished) {
-            current->context = context;
-            queue_add(current);
-        }
-        else {
+        if (stats_enabled)
+            stats_stop(current, current->state == ThreadRunning);
+
+        switch (current->state) {
+        case ThreadRunning:
+            current->state = ThreadReady;
+            make_ready(current);
+            preempted = 1;
+            PROBE_COUNT(preempt_probe);
+            break;
+
+        case ThreadBlocked:
+            queue_append(&blocked_queue, current);
+            num_blocked++;
+            __sthread_unlock();
+            break;
+
+        case ThreadFinished:
+            __sthread_spin_lock();
+            num_threads--;
+            if (current->all_prev != NULL)
+                current->all_prev->all_next = current->all_next;
+            else
+                all_threads = current->all_next;
+            if (current->all_next != NULL)
+                current->all_next->all_prev = current->all_prev;
+            add_stats(&finished_stats, &current->stats);
+            num_finished++;
+            __sthread_unlock();
             __sthread_delete(current);
-        }
-    }
+            break;
 
-    /*
-     * Choose a new process from the ready queue.
-     * Abort if the queue is empty.
-     */
-    current = queue_take(&ready_queue);
-    if (current == NULL) {
-        if (queue_empty(&blocked_queue)) {
-            fprintf(stderr, "All threads completed, exiting.\n");
-            exit(0);
-        }
-        else {
-            fprintf(stderr, "The system is deadlocked!\n");
+        default:
+            fprintf(stderr, "Thread state has been corrupted: %d\n",
+                    current->state);
             exit(1);
         }
     }
 
+    /* Choose a new process from the ready deques. */
+    current = take_ready_thread(preempted);
+    if (stats_enabled)
+        stats_start(current);
+
     current->state = ThreadRunning;
+    self->current = current;
+
+    PROBE_END(scheduler_probe);
 
     /* Return the next thread to resume executing. */
     return current->context;
 }
 
 
+/*
+ * The glue code keeps each worker's scheduler stack here.
+ */
+ThreadContext *__sthread_worker_context(void) {
+    assert(self != NULL);
+    return self->scheduler_context;
+}
+
+void __sthread_set_worker_context(ThreadContext *context) {
+    assert(self != NULL);
+    self->scheduler_context = context;
+}
+
+
+/*
+ * Called by the timer on every tick.  Returns true (1) if the calling
+ * kernel thread is a worker that is running a user thread with preemption
+ * on, and the thread has used up its ticks, so that the timer may preempt
+ * it.  A worker that is in its scheduler, or a kernel thread that isn't a
+ * worker, must not be preempted, and neither may a cooperative thread.
+ */
+int __sthread_preemptible(void) {
+    Thread *current;
+
+    if (self == NULL || self->current == NULL || self->preempt_off != 0)
+        return 0;
+
+    current = self->current;
+    if (current->cooperative || --current->ticks_left > 0)
+        return 0;
+
+    current->ticks_left = current->weight;
+    return 1;
+}
+
+/*
+ * The count may be out of date as soon as it is returned, since other
+ * workers steal, and the thread may be moved to another worker.
+ */
+int __sthread_ready_count(void) {
+    int n;
+
+    __sthread_preempt_disable();
+    n = self != NULL ? ready_count() : 0;
+    __sthread_preempt_enable();
+    return n;
+}
+
+/*
+ * Turn preemption of the calling worker off and back on.  These calls nest,
+ * but the scheduler must be entered with exactly one level of them.  They
+ * do nothing on a kernel thread that isn't a worker.
+ */
+void __sthread_preempt_disable(void) {
+    if (self != NULL)
+        self->preempt_off++;
+}
+
+void __sthread_preempt_enable(void) {
+    if (self != NULL) {
+        assert(self->preempt_off > 0);
+        self->preempt_off--;
+    }
+}
+
+/*
+ * Called by __sthread_switch on the stack of the thread it switched to, once
+ * the context of the thread that yielded has been saved, so that the
+ * yielding thread can now be resumed by any worker.
+ */
+void __sthread_switch_done(void) {
+    Thread *threadp = self->switch_from;
+
+    assert(threadp != NULL);
+    self->switch_from = NULL;
+
+    make_ready(threadp);
+    __sthread_preempt_enable();
+}
+
+/*
+ * Yield to a thread of a higher priority that sthread_unblock made ready.
+ * This must not be inlined:  the thread may have been preempted and moved
+ * to another worker since the caller last looked at self.
+ */
+static void __attribute__((noinline)) yield_to_higher(void) {
+    sthread_yield();
+}
+
+/*
+ * Take and release the scheduler lock around the use of sthread_block and
+ * sthread_unblock.  The calling thread can't be preempted while it holds the
+ * lock, since another thread on the same worker could then spin on it
+ * forever.
+ */
+void sthread_lock() {
+    __sthread_preempt_disable();
+    __sthread_spin_lock();
+}
+
+void sthread_unlock() {
+    int resched = 0;
+
+    __sthread_unlock();
+
+    /*
+     * A thread of a higher priority than the current one was unblocked.
+     * The lock may be nested in a region with preemption off, or taken in
+     * the scheduler, and then the switch has to wait.
+     */
+    if (self != NULL && self->resched && self->preempt_off == 1 &&
+        self->current != NULL) {
+        self->resched = 0;
+        resched = 1;
+    }
+
+    __sthread_preempt_enable();
+    if (resched)
+        yield_to_higher();
+}
+
+
 /************************************************************************
  * Thread operations.
  */
 
 /*
- * Start the scheduler.
+ * The body of workers 1 and up.
+ */
+static void *worker_main(void *arg) {
+    self = (Worker *) arg;
+    init_timer_stack();
+
+    __sthread_start();
+    return NULL;
+}
+
+/*
+ * Start the scheduler on a single worker.
  */
 void sthread_start(int timer) {
+    sthread_start_workers(timer, 1);
+}
+
+/*
+ * Start the scheduler on the specified number of workers.  The calling
+ * thread becomes worker 0, and the others are new kernel threads.
+ */
+void sthread_start_workers(int timer, int nworkers) {
+    int i;
+
+    if (nworkers < 1 || nworkers > MAX_WORKERS) {
+        fprintf(stderr, "The number of workers must be between 1 and %d\n",
+                MAX_WORKERS);
+        exit(1);
+    }
+
+    num_workers = nworkers;
+    for (i = 0; i < num_workers; i++) {
+        workers[i].id = i;
+        worker_init_deques(&workers[i]);
+    }
+    self = &workers[0];
+
     if(timer)
         start_timer();
 
+    for (i = 1; i < num_workers; i++) {
+        if (pthread_create(&workers[i].pthread, NULL, worker_main,
+                           &workers[i]) != 0) {
+            fprintf(stderr, "Can't start worker %d\n", i);
+            exit(1);
+        }
+    }
+
     __sthread_start();
 }
 
 /*
- * Create a new thread.
+ * Fill a new stack with STACK_CANARY if stack checking is on, and return
+ * true (1) if it was filled.
+ */
+static int fill_stack(void *memory, size_t stack_size) {
+    size_t *wordp, *endp;
+
+    if (!stack_check_enabled)
+        return 0;
+
+    endp = (size_t *) ((char *) memory + stack_size);
+    for (wordp = (size_t *) memory; wordp < endp; wordp++)
+        *wordp = STACK_CANARY;
+    return 1;
+}
+
+/*
+ * Returns how many bytes at the top of a filled stack have been written,
+ * by finding the lowest word that doesn't hold STACK_CANARY.  The stack
+ * grows down, so everything above that word counts as used.
+ */
+static size_t stack_used(const Thread *threadp) {
+    const size_t *wordp, *endp;
+
+    endp = (const size_t *) ((char *) threadp->memory + threadp->stack_size);
+    for (wordp = (const size_t *) threadp->memory; wordp < endp; wordp++) {
+        if (*wordp != STACK_CANARY)
+            break;
+    }
+    return (size_t) ((const char *) endp - (const char *) wordp);
+}
+
+/*
+ * Record how much of a finished thread's stack it used, and report it
+ * unless the thread is quiet.
+ */
+static void check_stack(const Thread *threadp) {
+    size_t used = stack_used(threadp), max;
+
+    if (!threadp->quiet)
+        fprintf(stderr, "Thread 0x%08x used %lu of %lu bytes of stack.\n",
+                (unsigned int) (size_t) threadp, (unsigned long) used,
+                (unsigned long) threadp->stack_size);
+
+    __atomic_add_fetch(&num_stacks_checked, 1, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&max_stack_used, __ATOMIC_RELAXED);
+    while (used > max &&
+           !__atomic_compare_exchange_n(&max_stack_used, &max, used, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    max = __atomic_load_n(&max_stack_size, __ATOMIC_RELAXED);
+    while (threadp->stack_size > max &&
+           !__atomic_compare_exchange_n(&max_stack_size, &max,
+                                        threadp->stack_size, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void dump_stack_check_at_exit(void) {
+    fflush(stdout);
+    fprintf(stderr, "sthread stacks: %lu checked threads finished; the "
+            "deepest used %lu bytes, and the largest stack was %lu bytes\n",
+            __atomic_load_n(&num_stacks_checked, __ATOMIC_RELAXED),
+            (unsigned long) __atomic_load_n(&max_stack_used,
+                                            __ATOMIC_RELAXED),
+            (unsigned long) __atomic_load_n(&max_stack_size,
+                                            __ATOMIC_RELAXED));
+}
+
+/*
+ * Create a new thread, with the default stack size.
+ */
+Thread * sthread_create(void (*f)(void *arg), void *arg) {
+    return sthread_create_with_stack(f, arg, DEFAULT_STACKSIZE);
+}
+
+/*
+ * Create a new thread with a stack of at least stack_size bytes.
  *
  * This function allocates a new context, and a new Thread
  * structure, and it adds the thread to the Ready queue.
+ * Stacks come from the pool in stack.c, so a recently finished
+ * thread's stack is reused, and only the pages that the thread
+ * touches take up memory.
  */
-Thread * sthread_create(void (*f)(void *arg), void *arg) {
+Thread * sthread_create_with_stack(void (*f)(void *arg), void *arg,
+                                   size_t stack_size) {
     Thread *threadp;
     void *memory;
 
-    /* Create a stack for use by the thread */
-    memory = (void *) malloc(DEFAULT_STACKSIZE);
-    if (memory == NULL) {
-        fprintf(stderr, "Can't allocate a stack for the new thread\n");
-        exit(1);
-    }
+    /*
+     * Create a stack for use by the thread.  The pool's lock must not be
+     * held by a preempted thread.
+     */
+    __sthread_preempt_disable();
+    memory = stack_alloc(stack_size, &stack_size);
+    __sthread_preempt_enable();
 
     /* Create a thread struct */
     threadp = (Thread *) malloc(sizeof(Thread));
@@ -315,10 +1229,35 @@ Thread * sthread_create(void (*f)(void *arg), void *arg) {
 
     /* Initialize the thread */
     threadp->state = ThreadReady;
+    threadp->cooperative = 0;
+    threadp->quiet = 0;
+    threadp->stack_checked = fill_stack(memory, stack_size);
+    threadp->priority = STHREAD_PRIORITY_DEFAULT;
+    threadp->weight = 1;
+    threadp->ticks_left = 1;
+    threadp->waiting_on = NULL;
+    memset(&threadp->stats, 0, sizeof(threadp->stats));
+    threadp->ready_since = 0;
+    threadp->running_since = 0;
     threadp->memory = memory;
+    threadp->stack_size = stack_size;
     threadp->context = __sthread_initialize_context(
-        (char *) memory + DEFAULT_STACKSIZE, f, arg);
-    queue_add(threadp);
+        (char *) memory + stack_size, f, arg);
+
+    sthread_lock();
+    num_threads++;
+    threadp->all_prev = NULL;
+    threadp->all_next = all_threads;
+    if (all_threads != NULL)
+        all_threads->all_prev = threadp;
+    all_threads = threadp;
+    sthread_unlock();
+
+    /* The worker must not be preempted in the middle of a push. */
+    __sthread_preempt_disable();
+    worker_init_deques(&workers[0]);
+    make_ready(threadp);
+    __sthread_preempt_enable();
 
     return threadp;
 }
@@ -334,28 +1273,31 @@ Thread * sthread_create(void (*f)(void *arg), void *arg) {
  */
 void __sthread_finish(void) {
     /*
-     * Any time we schedule we should lock and then unlock once it is done so
-     * that it is never interrupted by another thread. Also, the queue is
-     * changed during schedule, and two threads should not be able to change the
-     * queue at the same time.
+     * The scheduler must only be entered with preemption off, so that it is
+     * never interrupted by the timer.  __sthread_schedule turns it back on.
      */
-    __sthread_lock();
-    printf("Thread 0x%08x has finished executing.\n", (unsigned int) current);
-    current->state = ThreadFinished;
+    __sthread_preempt_disable();
+    if (!self->current->quiet)
+        printf("Thread 0x%08x has finished executing.\n",
+               (unsigned int) (size_t) self->current);
+    self->current->state = ThreadFinished;
     __sthread_schedule();
-    __sthread_unlock();
 }
 
 
 /*
  * This function is used by the scheduler to release the memory used by the
- * specified thread.  The function deletes the memory used for the thread's
- * context, as well as the memory for the Thread struct.
+ * specified thread.  The function returns the thread's stack, which also
+ * holds its context, to the pool, and frees the Thread struct.  A checked
+ * stack is measured first, since the pool reuses its first word.
  */
 void __sthread_delete(Thread *threadp) {
     assert(threadp != NULL);
 
-    free(threadp->memory);
+    if (threadp->stack_checked)
+        check_stack(threadp);
+
+    stack_release(threadp->memory, threadp->stack_size);
     free(threadp);
 }
 
@@ -364,65 +1306,295 @@ void __sthread_delete(Thread *threadp) {
  * Return the pointer to the currently running thread.
  */
 Thread * sthread_current() {
-    return current;
+    return self != NULL ? self->current : NULL;
 }
 
 
 /*
- * Yield, so that another thread can run.  This is easy:
- * just call the scheduler, and it will pick a new thread to
- * run.
+ * Yield, so that another thread can run.  The oldest ready thread of the
+ * highest priority is switched to directly, without going through the
+ * scheduler; if there is no other thread to run, or only ones of a lower
+ * priority, the current one just carries on.
  */
 void sthread_yield() {
+    Thread *current, *next;
+
     /*
-     * Any time we schedule we should lock and then unlock once it is done so
-     * that it is never interrupted by another thread. Also, the queue is
-     * changed during schedule, and two threads should not be able to change the
-     * queue at the same time.
+     * Preemption must be off, so that the timer doesn't interrupt the
+     * switch.  __sthread_switch turns it back on.  No lock is needed, since
+     * the ready deques are lock-free.
      */
-    __sthread_lock();
-    __sthread_schedule();
-    __sthread_unlock();
+    __sthread_preempt_disable();
+
+    __wheel_advance();
+    maybe_poll_reactor(0);
+    next = find_ready_thread(1, self->current->priority);
+    if (next == NULL) {
+        __sthread_preempt_enable();
+        return;
+    }
+
+    current = self->current;
+    if (stats_enabled) {
+        stats_stop(current, 0);
+        stats_start(next);
+    }
+
+    current->state = ThreadReady;
+    next->state = ThreadRunning;
+    self->current = next;
+    self->switch_from = current;
+
+    __sthread_switch(&current->context, next->context);
+}
+
+
+/*
+ * Make the current thread cooperative, so that the timer never preempts
+ * it, or preemptive again.  A program that never starts the timer is
+ * entirely cooperative.
+ */
+void sthread_set_cooperative(int cooperative) {
+    assert(self != NULL && self->current != NULL);
+    self->current->cooperative = cooperative;
+}
+
+
+/*
+ * Keep the current thread from announcing that it has finished, for
+ * threads that are too many and short-lived for the message to help.
+ */
+void sthread_set_quiet(int quiet) {
+    assert(self != NULL && self->current != NULL);
+    self->current->quiet = quiet;
+}
+
+
+/*
+ * Set the priority of the current thread, which takes effect the next time
+ * it is made ready.
+ */
+void sthread_set_priority(int priority) {
+    assert(self != NULL && self->current != NULL);
+    assert(priority >= 0 && priority < STHREAD_NUM_PRIORITIES);
+    self->current->priority = priority;
+}
+
+int sthread_get_priority(void) {
+    assert(self != NULL && self->current != NULL);
+    return self->current->priority;
+}
+
+
+/*
+ * Give the current thread a fair-share weight:  it runs for that many timer
+ * ticks at a time, so that among the threads of one priority that never
+ * block, each gets a share of the CPU in proportion to its weight.  The
+ * default weight is 1.
+ */
+void sthread_set_weight(int weight) {
+    assert(self != NULL && self->current != NULL);
+    assert(weight >= 1);
+    self->current->weight = weight;
+    self->current->ticks_left = weight;
 }
 
 
 /*
  * Block the current thread.  Set the state of the current thread
  * to Blocked, and call the scheduler.
+ *
+ * The caller must hold the scheduler lock, taken with sthread_lock, which
+ * is released once the thread's context has been saved; the thread returns
+ * from this function, after it is unblocked, without the lock.  Holding the
+ * lock from the moment the caller decides to block means that another
+ * worker can't unblock the thread before it has really stopped running.
  */
 void sthread_block() {
-    /*
-     * Any time we schedule we should lock and then unlock once it is done so
-     * that it is never interrupted by another thread. Also, the queue is
-     * changed during schedule, and two threads should not be able to change the
-     * queue at the same time.
-     */
-    __sthread_lock();
-    current->state = ThreadBlocked;
+    self->current->state = ThreadBlocked;
     __sthread_schedule();
-    __sthread_unlock();
 }
 
 
 /*
  * Unblock a thread that is blocked.  The thread is placed on
- * the ready queue.
+ * the ready queue of the calling worker.
+ *
+ * The caller must hold the scheduler lock, taken with sthread_lock.
  */
 void sthread_unblock(Thread *threadp) {
     /* Make sure the thread was blocked */
     assert(threadp != NULL);
     assert(threadp->state == ThreadBlocked);
 
-    /* Two threads should not be able to change the queue at the same time. */
-    __sthread_lock();
-
     /* Remove from the blocked queue */
     queue_remove(&blocked_queue, threadp);
+    num_blocked--;
 
     /* Re-queue it */
     threadp->state = ThreadReady;
-    queue_add(threadp);
+    make_ready(threadp);
 
-    __sthread_unlock();
+    /* Let it take over from the current thread, if it is more important. */
+    if (self != NULL && self->current != NULL &&
+        threadp->priority > self->current->priority)
+        self->resched = 1;
+}
+
+
+/*
+ * Add a thread to the end of a wait queue.
+ */
+static void wait_queue_append(WaitQueue *queuep, Thread *threadp) {
+    threadp->waiting_on = queuep;
+    threadp->wait_prev = queuep->tail;
+    threadp->wait_next = NULL;
+    if (queuep->head == NULL)
+        queuep->head = threadp;
+    else
+        queuep->tail->wait_next = threadp;
+    queuep->tail = threadp;
+}
+
+
+/*
+ * Block the current thread on a wait queue.  The caller must hold the
+ * scheduler lock, which is released as for sthread_block.
+ */
+void sthread_block_on(WaitQueue *queuep) {
+    assert(queuep != NULL);
+
+    wait_queue_append(queuep, self->current);
+    sthread_block();
 }
 
+
+/*
+ * Take a thread out of the wait queue that it is blocked on.
+ */
+static void wait_queue_remove(WaitQueue *queuep, Thread *threadp) {
+    if (threadp->wait_prev != NULL)
+        threadp->wait_prev->wait_next = threadp->wait_next;
+    else
+        queuep->head = threadp->wait_next;
+
+    if (threadp->wait_next != NULL)
+        threadp->wait_next->wait_prev = threadp->wait_prev;
+    else
+        queuep->tail = threadp->wait_prev;
+
+    threadp->waiting_on = NULL;
+    threadp->wait_prev = NULL;
+    threadp->wait_next = NULL;
+}
+
+
+/*
+ * Unblock the thread at the head of a wait queue, and return it, or return
+ * NULL if the queue is empty.  The caller must hold the scheduler lock.
+ */
+Thread *sthread_wake_one(WaitQueue *queuep) {
+    Thread *threadp;
+
+    assert(queuep != NULL);
+
+    threadp = queuep->head;
+    if (threadp == NULL)
+        return NULL;
+
+    wait_queue_remove(queuep, threadp);
+    sthread_unblock(threadp);
+    return threadp;
+}
+
+
+/*
+ * Unblock a thread if it is blocked on the specified wait queue, or, if the
+ * queue is NULL, on no queue at all, and return true (1); otherwise return
+ * false (0).  The caller must hold the scheduler lock.
+ */
+int sthread_unblock_from(WaitQueue *queuep, Thread *threadp) {
+    assert(threadp != NULL);
+
+    if (threadp->state != ThreadBlocked || threadp->waiting_on != queuep)
+        return 0;
+
+    if (queuep != NULL)
+        wait_queue_remove(queuep, threadp);
+    sthread_unblock(threadp);
+    return 1;
+}
+
+
+/*
+ * Move up to n threads from the head of one wait queue to the end of
+ * another, leaving them blocked, and return how many were moved.  The
+ * caller must hold the scheduler lock.
+ */
+int sthread_requeue(WaitQueue *fromp, WaitQueue *top, int n) {
+    Thread *threadp;
+    int moved = 0;
+
+    assert(fromp != NULL && top != NULL);
+
+    while (moved < n && (threadp = fromp->head) != NULL) {
+        wait_queue_remove(fromp, threadp);
+        wait_queue_append(top, threadp);
+        moved++;
+    }
+
+    return moved;
+}
+
+
+/*
+ * Start keeping scheduler statistics, and dump them when the program exits.
+ */
+void sthread_enable_stats(void) {
+    if (!stats_enabled) {
+        stats_enabled = 1;
+        atexit(dump_stats_at_exit);
+    }
+}
+
+
+/*
+ * Fill the stacks of threads created from now on, so that how much of them
+ * was used can be measured when the threads finish.
+ */
+void sthread_enable_stack_check(void) {
+    if (!stack_check_enabled) {
+        stack_check_enabled = 1;
+        atexit(dump_stack_check_at_exit);
+    }
+}
+
+
+/*
+ * Copy out the statistics of a thread that hasn't finished, or of the
+ * current thread if threadp is NULL.  The current thread's running time
+ * includes the time that it has been running for now.
+ */
+void sthread_get_stats(Thread *threadp, SthreadStats *statsp) {
+    assert(statsp != NULL);
+
+    __sthread_preempt_disable();
+    if (threadp == NULL)
+        threadp = sthread_current();
+    assert(threadp != NULL);
+
+    *statsp = threadp->stats;
+    if (threadp == sthread_current() && threadp->running_since != 0)
+        statsp->running_ns += clock_ns() - threadp->running_since;
+    __sthread_preempt_enable();
+}
+
+
+/*
+ * Write out the statistics of every thread and of the workers' run queues.
+ */
+void sthread_dump_stats(FILE *fp) {
+    sthread_lock();
+    dump_stats(fp, 1);
+    sthread_unlock();
+}
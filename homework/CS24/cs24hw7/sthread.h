@@ -8,6 +8,8 @@
 #ifndef _STHREAD_H
 #define _STHREAD_H
 
+#include <stddef.h>
+#include <stdio.h>
 #include "glue.h"
 
 /*
@@ -19,11 +21,126 @@ typedef struct _thread Thread;
  * Thread operations.
  */
 Thread *sthread_create(ThreadFunction f, void *arg);
+Thread *sthread_create_with_stack(ThreadFunction f, void *arg,
+                                  size_t stack_size);
 void sthread_yield(void);
-void sthread_block(void);
 Thread *sthread_current(void);
+
+/*
+ * A cooperative thread is never preempted by the timer, and only gives up
+ * the CPU when it yields, blocks or finishes.  This applies to the calling
+ * thread.
+ */
+void sthread_set_cooperative(int cooperative);
+
+/*
+ * Each thread prints a message when it finishes, unless it is quiet.
+ * This applies to the calling thread.
+ */
+void sthread_set_quiet(int quiet);
+
+/*
+ * Priorities run from 0 up to STHREAD_NUM_PRIORITIES - 1, and threads
+ * start at STHREAD_PRIORITY_DEFAULT.  A ready thread only runs when no
+ * thread of a higher priority is ready, and unblocking a thread of a
+ * higher priority than the running one switches to it straight away.
+ * Within a priority, threads take turns; sthread_set_weight gives the
+ * calling thread that many quanta per turn, for a weighted share of the
+ * CPU.  These apply to the calling thread.
+ */
+#define STHREAD_NUM_PRIORITIES          8
+#define STHREAD_PRIORITY_DEFAULT        3
+
+void sthread_set_priority(int priority);
+int sthread_get_priority(void);
+void sthread_set_weight(int weight);
+
+/*
+ * Blocking and unblocking are the building blocks of synchronization
+ * primitives such as semaphores, and must be called with the scheduler
+ * lock held.  sthread_block returns, once the thread has been unblocked,
+ * with the lock released.
+ */
+void sthread_lock(void);
+void sthread_unlock(void);
+void sthread_block(void);
 void sthread_unblock(Thread *threadp);
 
+/*
+ * A queue of threads blocked on some condition, linked through the
+ * threads themselves so that waiting never allocates memory.  An
+ * empty queue has both pointers NULL.  These functions must also be
+ * called with the scheduler lock held.
+ *
+ * sthread_block_on adds the current thread to the end of the queue and
+ * blocks it; sthread_wake_one unblocks the thread at the head of the
+ * queue, and returns it, or NULL if the queue is empty.
+ * sthread_unblock_from unblocks a particular thread, if it is blocked on
+ * the queue (or, for a NULL queue, blocked on no queue), and returns true,
+ * or returns false if it isn't; timeouts use this.  sthread_requeue moves
+ * up to n threads from the head of one queue to the end of another,
+ * without waking them, and returns how many it moved.
+ */
+typedef struct _wait_queue {
+    Thread *head;
+    Thread *tail;
+} WaitQueue;
+
+void sthread_block_on(WaitQueue *queuep);
+Thread *sthread_wake_one(WaitQueue *queuep);
+int sthread_unblock_from(WaitQueue *queuep, Thread *threadp);
+int sthread_requeue(WaitQueue *fromp, WaitQueue *top, int n);
+
+/*
+ * Block the calling thread for at least the specified number of
+ * milliseconds.
+ */
+void sthread_sleep(unsigned int ms);
+
+/*
+ * Scheduler statistics.  These are only kept once sthread_enable_stats
+ * has been called, preferably before the threads start; until then the
+ * scheduler only pays for a test of a flag on each switch.  Once enabled,
+ * the statistics are also written to stderr when the program exits.
+ *
+ * sthread_get_stats fills in the statistics of a thread that hasn't
+ * finished, or of the current thread if threadp is NULL; the counters of
+ * a thread running on another worker may be slightly out of date.
+ * sthread_dump_stats writes every live thread's statistics, the totals of
+ * the finished ones, and a histogram of the run-queue lengths that the
+ * workers saw each time they picked a thread.
+ */
+typedef struct _sthread_stats {
+    /* The number of times the thread was given the CPU. */
+    unsigned long switches;
+
+    /*
+     * The number of times it gave the CPU up by yielding, blocking or
+     * finishing, and the number of times the timer preempted it.
+     */
+    unsigned long voluntary;
+    unsigned long preempted;
+
+    /* Nanoseconds spent ready to run but waiting for a worker, and running. */
+    unsigned long long ready_ns;
+    unsigned long long running_ns;
+} SthreadStats;
+
+void sthread_enable_stats(void);
+void sthread_get_stats(Thread *threadp, SthreadStats *statsp);
+void sthread_dump_stats(FILE *fp);
+
+/*
+ * Stack checking, for choosing stack sizes for sthread_create_with_stack.
+ * Once sthread_enable_stack_check has been called, the stacks of threads
+ * created afterwards are filled with a pattern, and when each of them
+ * finishes, how much of the pattern it overwrote is written to stderr,
+ * unless the thread is quiet.  The deepest use of all is written when the
+ * program exits.  Filling a stack commits every one of its pages, so this
+ * is for measuring, not for normal runs.
+ */
+void sthread_enable_stack_check(void);
+
 /*
  * The function called when a thread returns (which they shouldn't
  * do).
@@ -31,11 +148,28 @@ void sthread_unblock(Thread *threadp);
 void __sthread_return_handler(void);
 
 /*
- * The start function should be called *once* in
- * the main() function of your program.  This function
- * never returns.
+ * One of the start functions should be called *once* in
+ * the main() function of your program.  These functions
+ * never return.  sthread_start runs every thread on the
+ * calling kernel thread; sthread_start_workers runs them
+ * on a pool of nworkers kernel threads, the calling one
+ * included, so that they can use several cores.
  */
 void sthread_start(int timer);
+void sthread_start_workers(int timer, int nworkers);
+
+/*
+ * Returns true if the calling kernel thread is running a user
+ * thread.  The timer uses this to decide whether to preempt.
+ */
+int __sthread_preemptible(void);
+
+/*
+ * Returns the number of threads ready on the calling thread's worker, so
+ * that parallel loops only split off work while there is little of it to
+ * steal.
+ */
+int __sthread_ready_count(void);
 
 #endif /* _STHREAD_H */
 
@@ -0,0 +1,199 @@
+/*
+ * Measures the cost of switching between sthreads, with and without the
+ * preemption timer.
+ *
+ * A group of threads yields to each other a fixed number of times, which
+ * goes through the direct switch in sthread_yield.  Then two threads hand a
+ * pair of semaphores back and forth, so that every switch blocks one thread
+ * and goes through the scheduler, and then take turns under a mutex, with a
+ * condition variable.  Each kind of switch is reported in nanoseconds.
+ *
+ * usage: switchbench [-t] [-c] [-s] [-w workers] [-n switches] [-y threads]
+ *
+ *     -t  start the preemption timer
+ *     -c  make every thread cooperative, so the timer never preempts it
+ *     -s  keep scheduler statistics, and print them at the end
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sthread.h"
+#include "semaphore.h"
+#include "mutex.h"
+
+#define DEFAULT_SWITCHES        1000000
+#define DEFAULT_YIELDERS        2
+
+/* The stacks of the benchmark threads don't need to be big. */
+#define BENCH_STACKSIZE         (64 * 1024)
+
+static int num_switches = DEFAULT_SWITCHES;
+static int num_yielders = DEFAULT_YIELDERS;
+static int cooperative;
+
+static Semaphore *yielders_done;
+static Semaphore *ping, *pong, *pingpong_done;
+
+/* Whose turn it is in the condition variable ping-pong. */
+static Mutex *turn_mutex;
+static CondVar *turn_changed;
+static int turn;
+
+
+static double now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/*
+ * Each yielder does its share of the switches.
+ */
+static void yielder(void *arg) {
+    int i;
+
+    sthread_set_cooperative(cooperative);
+    for (i = 0; i < num_switches / num_yielders; i++)
+        sthread_yield();
+
+    semaphore_signal(yielders_done);
+}
+
+
+/*
+ * The two halves of the semaphore ping-pong.  Each round trip is two
+ * switches.
+ */
+static void pinger(void *arg) {
+    int i;
+
+    sthread_set_cooperative(cooperative);
+    for (i = 0; i < num_switches / 2; i++) {
+        semaphore_signal(ping);
+        semaphore_wait(pong);
+    }
+
+    semaphore_signal(pingpong_done);
+}
+
+static void ponger(void *arg) {
+    int i;
+
+    sthread_set_cooperative(cooperative);
+    for (i = 0; i < num_switches / 2; i++) {
+        semaphore_wait(ping);
+        semaphore_signal(pong);
+    }
+}
+
+
+/*
+ * Each of the two players waits for its turn, and then gives the turn to
+ * the other.
+ */
+static void player(void *arg) {
+    int me = (int) (size_t) arg, i;
+
+    sthread_set_cooperative(cooperative);
+    for (i = 0; i < num_switches / 2; i++) {
+        mutex_lock(turn_mutex);
+        while (turn != me)
+            condvar_wait(turn_changed, turn_mutex);
+        turn = !me;
+        condvar_signal(turn_changed);
+        mutex_unlock(turn_mutex);
+    }
+
+    semaphore_signal(pingpong_done);
+}
+
+
+/*
+ * Runs the benchmarks, one after the other, and exits.
+ */
+static void bench(void *arg) {
+    double start, yield_ns, pingpong_ns, condvar_ns;
+    int i;
+
+    sthread_set_cooperative(cooperative);
+
+    start = now_ns();
+    for (i = 0; i < num_yielders; i++)
+        sthread_create_with_stack(yielder, NULL, BENCH_STACKSIZE);
+    for (i = 0; i < num_yielders; i++)
+        semaphore_wait(yielders_done);
+    yield_ns = now_ns() - start;
+
+    start = now_ns();
+    sthread_create_with_stack(pinger, NULL, BENCH_STACKSIZE);
+    sthread_create_with_stack(ponger, NULL, BENCH_STACKSIZE);
+    semaphore_wait(pingpong_done);
+    pingpong_ns = now_ns() - start;
+
+    start = now_ns();
+    sthread_create_with_stack(player, (void *) 0, BENCH_STACKSIZE);
+    sthread_create_with_stack(player, (void *) 1, BENCH_STACKSIZE);
+    semaphore_wait(pingpong_done);
+    semaphore_wait(pingpong_done);
+    condvar_ns = now_ns() - start;
+
+    printf("sthread_yield:           %7.1f ns per switch\n",
+           yield_ns / num_switches);
+    printf("semaphore ping-pong:     %7.1f ns per switch\n",
+           pingpong_ns / num_switches);
+    printf("condvar ping-pong:       %7.1f ns per switch\n",
+           condvar_ns / num_switches);
+    exit(0);
+}
+
+
+static void usage(const char *progname) {
+    fprintf(stderr, "usage: %s [-t] [-c] [-s] [-w workers] [-n switches] "
+            "[-y threads]\n", progname);
+    exit(1);
+}
+
+
+int main(int argc, char **argv) {
+    int timer = 0, workers = 1, i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0)
+            timer = 1;
+        else if (strcmp(argv[i], "-c") == 0)
+            cooperative = 1;
+        else if (strcmp(argv[i], "-s") == 0)
+            sthread_enable_stats();
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            workers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            num_switches = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-y") == 0 && i + 1 < argc)
+            num_yielders = atoi(argv[++i]);
+        else
+            usage(argv[0]);
+    }
+
+    if (num_switches <= 0 || num_yielders <= 0)
+        usage(argv[0]);
+
+    yielders_done = new_semaphore(0);
+    ping = new_semaphore(0);
+    pong = new_semaphore(0);
+    pingpong_done = new_semaphore(0);
+    turn_mutex = new_mutex();
+    turn_changed = new_condvar();
+
+    printf("%d switches, %s timer, %s threads, %d worker%s\n", num_switches,
+           timer ? "with" : "without",
+           cooperative ? "cooperative" : "preemptible", workers,
+           workers == 1 ? "" : "s");
+
+    sthread_create(bench, NULL);
+    sthread_start_workers(timer, workers);
+    return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * Task groups, and parallel loops built on them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "sthread.h"
+#include "task.h"
+
+/*
+ * A parallel loop only splits off half of its range while fewer than this
+ * many threads are ready on its worker.
+ */
+#define SPLIT_READY_MAX         2
+
+/*
+ * The task group data structure contains:
+ *     int pending        : the number of tasks that haven't finished
+ *     WaitQueue waitq    : the threads waiting for them
+ *
+ * The count is only decremented with the scheduler lock held, and the
+ * decrement is the last that a finishing task touches the group, so a
+ * waiter that sees the count reach 0 may free the group straight away.
+ */
+struct _task_group {
+    volatile int pending;
+    WaitQueue waitq;
+};
+
+/*
+ * What a task's thread starts with.
+ */
+typedef struct _task {
+    ThreadFunction f;
+    void *arg;
+    TaskGroup *groupp;
+} Task;
+
+/*
+ * A piece of a parallel loop.
+ */
+typedef struct _range {
+    long begin;
+    long end;
+    long grain;
+    RangeFunction fn;
+    void *ctx;
+} Range;
+
+static void *alloc_or_die(size_t size) {
+    void *p = malloc(size);
+
+    if (p == NULL) {
+        fprintf(stderr, "Can't allocate a task\n");
+        exit(1);
+    }
+    return p;
+}
+
+/************************************************************************
+ * Task groups.
+ */
+
+static void group_init(TaskGroup *groupp) {
+    groupp->pending = 0;
+    groupp->waitq.head = NULL;
+    groupp->waitq.tail = NULL;
+}
+
+TaskGroup *new_task_group(void) {
+    TaskGroup *groupp = (TaskGroup *) alloc_or_die(sizeof(TaskGroup));
+
+    group_init(groupp);
+    return groupp;
+}
+
+/*
+ * The last task to finish wakes the waiters before it takes the count to
+ * 0; they look at the count again once they get the lock.
+ */
+static void task_done(TaskGroup *groupp) {
+    sthread_lock();
+    if (groupp->pending == 1) {
+        while (sthread_wake_one(&groupp->waitq) != NULL)
+            ;
+    }
+    __atomic_sub_fetch(&groupp->pending, 1, __ATOMIC_SEQ_CST);
+    sthread_unlock();
+}
+
+static void task_main(void *arg) {
+    Task task = *(Task *) arg;
+
+    free(arg);
+    sthread_set_quiet(1);
+
+    task.f(task.arg);
+    task_done(task.groupp);
+}
+
+void task_group_run(TaskGroup *groupp, ThreadFunction f, void *arg) {
+    Task *taskp = (Task *) alloc_or_die(sizeof(Task));
+
+    assert(groupp != NULL);
+
+    taskp->f = f;
+    taskp->arg = arg;
+    taskp->groupp = groupp;
+
+    __atomic_add_fetch(&groupp->pending, 1, __ATOMIC_SEQ_CST);
+    sthread_create(task_main, taskp);
+}
+
+void task_group_wait(TaskGroup *groupp) {
+    assert(groupp != NULL);
+
+    /* The fast path:  everything has finished already. */
+    if (__atomic_load_n(&groupp->pending, __ATOMIC_SEQ_CST) == 0)
+        return;
+
+    sthread_lock();
+    while (__atomic_load_n(&groupp->pending, __ATOMIC_SEQ_CST) > 0) {
+        sthread_block_on(&groupp->waitq);
+        sthread_lock();
+    }
+    sthread_unlock();
+}
+
+/************************************************************************
+ * Parallel loops.
+ */
+
+static void run_range(void *arg);
+
+/*
+ * Work through the range a grain at a time, peeling off the upper half of
+ * what is left as a task whenever there is little ready to steal, and then
+ * wait for the halves.  Splitting lazily like this keeps the number of
+ * threads near the number of workers times the depth of the splits, even
+ * when the scheduler starts old pieces in rotation, rather than one per
+ * grain.
+ */
+static void split_range(long begin, long end, const Range *rangep) {
+    TaskGroup group;
+    Range *halfp;
+    long mid, step;
+
+    group_init(&group);
+
+    while (begin < end) {
+        if (end - begin > rangep->grain &&
+            __sthread_ready_count() < SPLIT_READY_MAX) {
+            mid = begin + (end - begin) / 2;
+
+            halfp = (Range *) alloc_or_die(sizeof(Range));
+            *halfp = *rangep;
+            halfp->begin = mid;
+            halfp->end = end;
+            task_group_run(&group, run_range, halfp);
+
+            end = mid;
+        }
+        else {
+            step = end - begin < rangep->grain ? end - begin : rangep->grain;
+            rangep->fn(begin, begin + step, rangep->ctx);
+            begin += step;
+        }
+    }
+
+    task_group_wait(&group);
+}
+
+static void run_range(void *arg) {
+    Range range = *(Range *) arg;
+
+    free(arg);
+    split_range(range.begin, range.end, &range);
+}
+
+void sthread_parallel_for(long begin, long end, long grain, RangeFunction fn,
+                          void *ctx) {
+    Range range;
+
+    assert(fn != NULL);
+    if (begin >= end)
+        return;
+
+    range.begin = begin;
+    range.end = end;
+    range.grain = grain > 0 ? grain : 1;
+    range.fn = fn;
+    range.ctx = ctx;
+
+    split_range(begin, end, &range);
+}
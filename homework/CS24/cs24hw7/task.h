@@ -0,0 +1,51 @@
+/*
+ * Task groups and parallel loops for the sthread package.
+ *
+ * A task is a function that runs on a thread of its own, and a task
+ * group counts the tasks run in it that haven't finished yet, so that a
+ * thread can wait for all of them.  New tasks go on the ready deque of the
+ * worker that runs them, where the other workers steal them when they run
+ * out of work, oldest first.
+ *
+ * These must be called from a running thread, since waiting blocks it.
+ */
+#ifndef _TASK_H
+#define _TASK_H
+
+#include "sthread.h"
+
+/*
+ * The task group's contents are opaque; it is defined in task.c.
+ */
+typedef struct _task_group TaskGroup;
+
+TaskGroup *new_task_group(void);
+
+/*
+ * Run f(arg) as a task in the group.  A task may run further tasks, in its
+ * own group or in another.
+ */
+void task_group_run(TaskGroup *groupp, ThreadFunction f, void *arg);
+
+/*
+ * Wait until every task run in the group so far has finished.  The group
+ * can be used again afterwards.
+ */
+void task_group_wait(TaskGroup *groupp);
+
+/*
+ * Call fn on subranges that together cover the indexes from begin up to,
+ * but not including, end, in parallel, and return once every call has
+ * returned.  Each call gets at most grain indexes.  While there is little
+ * work ready to steal, the upper half of what is left of the range is split
+ * off as a task, recursively, so an idle worker steals the biggest piece
+ * there is; otherwise the range is worked through a grain at a time.  The
+ * grain should be large enough that a call takes much longer than creating
+ * a thread.
+ */
+typedef void (*RangeFunction)(long begin, long end, void *ctx);
+
+void sthread_parallel_for(long begin, long end, long grain, RangeFunction fn,
+                          void *ctx);
+
+#endif /* _TASK_H */
@@ -31,6 +31,7 @@
 
 #include "timer.h"
 #include "glue.h"
+#include "sthread.h"
 
 /*
  * Default timeslice quantum.  This is configured for a 10ms timeslice;
@@ -41,6 +42,22 @@
 #define QUANTUM_SEC     0
 #define QUANTUM_USEC    10000
 
+/*
+ * The registers that the signal handler redirects, and the size of the
+ * red zone below the stack pointer that the interrupted code may be using,
+ * which the return address must be pushed below.  __sthread_preempt skips
+ * back over it when it returns.
+ */
+#ifdef __x86_64__
+#define REG_SP          REG_RSP
+#define REG_PC          REG_RIP
+#define RED_ZONE        128
+#else
+#define REG_SP          REG_ESP
+#define REG_PC          REG_EIP
+#define RED_ZONE        0
+#endif
+
 /*
  * Default size of signal stack is set to 64k.
  */
@@ -48,51 +65,66 @@
 
 /*
  * When the timer fires, set up the process context so that
- * the signal handler returns to the __sthread_schedule function.
+ * the signal handler returns to the __sthread_preempt function.
  */
 static void timer_action(int signum, siginfo_t *infop, void *data) {
     /*
-     * Get the scheduler lock.
-     * If the scheduler is already active, ignore this timer interrupt.
+     * If the scheduler is already active, or the thread has turned
+     * preemption off, ignore this timer interrupt.  The signal goes to
+     * whichever kernel thread the OS picks, so it is also ignored if that
+     * thread isn't running a user thread.
      */
-    if (__sthread_lock()) {
+    if (__sthread_preemptible()) {
+
         ucontext_t *contextp = (ucontext_t *) data;
         greg_t *regs = contextp->uc_mcontext.gregs;
-        void **esp = (void **) regs[REG_ESP];
-        void *eip = (void *) regs[REG_EIP];
+        void **esp = (void **) ((char *) regs[REG_SP] - RED_ZONE);
+        void *eip = (void *) regs[REG_PC];
 
         /* Push the current program counter as the new return address */
         *--esp = eip;
 
-        /* Set the program counter to the __sthread_schedule function */
-        eip = (void *) __sthread_schedule;
+        /* Set the program counter to the __sthread_preempt function */
+        eip = (void *) __sthread_preempt;
+        __sthread_preempt_disable();
 
         /* Save these two registers back to the context */
-        regs[REG_ESP] = (greg_t) esp;
-        regs[REG_EIP] = (greg_t) eip;
+        regs[REG_SP] = (greg_t) esp;
+        regs[REG_PC] = (greg_t) eip;
     }
 }
 
 /*
- * Start the timer to generate periodic interrupts.
  * Signals are handled on an alternate stack, so that
  * we can manipulate the process stack in the signal
- * handler.
+ * handler.  Each kernel thread needs its own.
  */
-void start_timer() {
-    static char sigstack[SIGNAL_STACKSIZE];
-    struct sigaction action;
-    struct itimerval itimer;
+void init_timer_stack() {
     stack_t stackinfo;
 
-    /* Handle signals on an alternate stack */
-    stackinfo.ss_sp = sigstack;
+    stackinfo.ss_sp = malloc(SIGNAL_STACKSIZE);
+    if (stackinfo.ss_sp == NULL) {
+        fprintf(stderr, "Can't allocate a signal stack\n");
+        exit(1);
+    }
+
     stackinfo.ss_flags = SS_ONSTACK;
-    stackinfo.ss_size = sizeof(sigstack);
+    stackinfo.ss_size = SIGNAL_STACKSIZE;
     if (sigaltstack(&stackinfo, (stack_t *) 0) < 0) {
         perror("sigaltstack");
         exit(1);
     }
+}
+
+/*
+ * Start the timer to generate periodic interrupts.
+ */
+void start_timer() {
+    struct sigaction action;
+    struct itimerval itimer;
+
+    /* Handle signals on an alternate stack */
+    init_timer_stack();
 
     /* Install the signal handler */
     memset(&action, 0, sizeof(action));
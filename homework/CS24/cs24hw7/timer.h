@@ -14,5 +14,12 @@
  */
 void start_timer(void);
 
+/*
+ * Give the calling kernel thread its own stack for handling
+ * the timer signal.  start_timer does this for its caller;
+ * every other worker must do it too.
+ */
+void init_timer_stack(void);
+
 #endif /* _TIMER_H */
 
@@ -0,0 +1,216 @@
+/*
+ * A hierarchical timer wheel.
+ *
+ * There are WHEEL_LEVELS wheels of WHEEL_SLOTS slots each.  A timer that
+ * expires less than WHEEL_SLOTS ticks from now goes in the slot of level 0
+ * for its tick; one that expires later goes in a coarser level, whose slots
+ * each cover WHEEL_SLOTS times as many ticks as the level below.  Each time
+ * the wheel turns to a new slot of a level, the timers in that slot are
+ * cascaded down to the finer levels, which they now fit in, so every timer
+ * is moved at most WHEEL_LEVELS - 1 times before it expires.  The slots are
+ * doubly-linked lists, so a timer is started and cancelled in constant time.
+ *
+ * Everything here is protected by the scheduler lock.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "sthread.h"
+#include "wheel.h"
+
+#define SLOT_BITS               6
+#define WHEEL_SLOTS             (1 << SLOT_BITS)
+#define WHEEL_LEVELS            4
+
+/*
+ * The longest timeout, in ticks (milliseconds), that the wheel can hold;
+ * longer ones are cut down to this, about four and a half hours.
+ */
+#define MAX_TICKS       ((1UL << (SLOT_BITS * WHEEL_LEVELS)) - 1)
+
+static WheelTimer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+
+/*
+ * The last tick that the wheel has turned to, and the number of timers
+ * pending.  Ticks count milliseconds from the first use of the wheel.
+ */
+static unsigned long now;
+static volatile int num_pending;
+
+static int started;
+static unsigned long base_ms;
+
+static unsigned long clock_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static unsigned long current_tick(void) {
+    if (!started) {
+        base_ms = clock_ms();
+        started = 1;
+    }
+    return clock_ms() - base_ms;
+}
+
+/*
+ * Put a timer in the slot of the finest level that its expiry fits in.
+ */
+static void place(WheelTimer *timerp) {
+    unsigned long delta = timerp->expires - now;
+    WheelTimer **slotp;
+    int level = 0;
+
+    while (level < WHEEL_LEVELS - 1 &&
+           delta >= (1UL << (SLOT_BITS * (level + 1))))
+        level++;
+
+    slotp = &slots[level][(timerp->expires >> (SLOT_BITS * level)) &
+                          (WHEEL_SLOTS - 1)];
+
+    timerp->slot = slotp;
+    timerp->prev = NULL;
+    timerp->next = *slotp;
+    if (*slotp != NULL)
+        (*slotp)->prev = timerp;
+    *slotp = timerp;
+}
+
+/*
+ * Take a timer out of its slot.
+ */
+static void unlink_timer(WheelTimer *timerp) {
+    if (timerp->prev != NULL)
+        timerp->prev->next = timerp->next;
+    else
+        *timerp->slot = timerp->next;
+
+    if (timerp->next != NULL)
+        timerp->next->prev = timerp->prev;
+}
+
+/*
+ * Start a timer for the calling thread.  The expiry is counted from the
+ * clock rather than from the wheel, which may lag it by up to a quantum.
+ */
+void wheel_start(WheelTimer *timerp, unsigned int ms, WaitQueue *queuep) {
+    unsigned long tick = current_tick();
+
+    assert(timerp != NULL);
+
+    /* An empty wheel may have stopped turning long ago. */
+    if (num_pending == 0)
+        now = tick;
+
+    if (ms > MAX_TICKS - WHEEL_SLOTS)
+        ms = MAX_TICKS - WHEEL_SLOTS;
+
+    /* The current tick is already partly over, so wait one more. */
+    timerp->expires = tick + ms + 1;
+    timerp->threadp = sthread_current();
+    timerp->queuep = queuep;
+    timerp->fired = 0;
+
+    place(timerp);
+    num_pending++;
+}
+
+void wheel_cancel(WheelTimer *timerp) {
+    assert(timerp != NULL);
+
+    if (!timerp->fired) {
+        unlink_timer(timerp);
+        num_pending--;
+    }
+}
+
+int __wheel_pending(void) {
+    return num_pending != 0;
+}
+
+/*
+ * Turn the wheel one tick:  cascade the slots that the tick starts, coarsest
+ * first so that their timers can cascade on down, and then expire the
+ * timers in the tick's slot of level 0.
+ */
+static void turn(void) {
+    WheelTimer *timerp, *next;
+    Thread *threadp;
+    WaitQueue *queuep;
+    int level, top = 0;
+
+    now++;
+
+    while (top < WHEEL_LEVELS - 1 &&
+           (now & ((1UL << (SLOT_BITS * (top + 1))) - 1)) == 0)
+        top++;
+
+    for (level = top; level > 0; level--) {
+        WheelTimer **slotp = &slots[level][(now >> (SLOT_BITS * level)) &
+                                           (WHEEL_SLOTS - 1)];
+
+        timerp = *slotp;
+        *slotp = NULL;
+        for (; timerp != NULL; timerp = next) {
+            next = timerp->next;
+            place(timerp);
+        }
+    }
+
+    timerp = slots[0][now & (WHEEL_SLOTS - 1)];
+    slots[0][now & (WHEEL_SLOTS - 1)] = NULL;
+    for (; timerp != NULL; timerp = next) {
+        next = timerp->next;
+        num_pending--;
+
+        /*
+         * The timer lives on the thread's stack, so it can't be touched once
+         * the thread may run again.
+         */
+        threadp = timerp->threadp;
+        queuep = timerp->queuep;
+        timerp->fired = 1;
+        sthread_unblock_from(queuep, threadp);
+    }
+}
+
+void __wheel_advance(void) {
+    unsigned long tick;
+
+    /* Nothing is due until the clock reaches the next tick. */
+    if (num_pending == 0 || current_tick() == now)
+        return;
+
+    sthread_lock();
+    tick = current_tick();
+    while (num_pending != 0 && (long) (tick - now) > 0)
+        turn();
+    if (num_pending == 0)
+        now = tick;
+    sthread_unlock();
+}
+
+/*
+ * Block the calling thread for at least the specified number of
+ * milliseconds.
+ */
+void sthread_sleep(unsigned int ms) {
+    WheelTimer timer;
+
+    if (ms == 0) {
+        sthread_yield();
+        return;
+    }
+
+    sthread_lock();
+    wheel_start(&timer, ms, NULL);
+    while (!timer.fired) {
+        sthread_block();
+        sthread_lock();
+    }
+    sthread_unlock();
+}
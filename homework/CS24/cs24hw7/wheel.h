@@ -0,0 +1,57 @@
+/*
+ * A hierarchical timer wheel, for timeouts of blocked threads.
+ *
+ * Timers count milliseconds.  Starting and cancelling one takes constant
+ * time, and so does expiring one, over the life of the timer, so there can
+ * be any number of them pending.  The wheel is advanced by the scheduler,
+ * which the preemption tick enters at least once a quantum, and by idle
+ * workers, so timers fire within about a millisecond of their expiry when
+ * a worker is free, and within a quantum otherwise.
+ */
+#ifndef _WHEEL_H
+#define _WHEEL_H
+
+#include "sthread.h"
+
+/*
+ * A timer, which lives in the blocked thread's own stack frame.  When it
+ * expires, the thread is unblocked with sthread_unblock_from, if it is still
+ * blocked on the queue, and fired is set.
+ */
+typedef struct _wheel_timer {
+    /* The slot that the timer is in, and its neighbors there. */
+    struct _wheel_timer **slot;
+    struct _wheel_timer *prev;
+    struct _wheel_timer *next;
+
+    /* The tick that the timer expires at. */
+    unsigned long expires;
+
+    Thread *threadp;
+    WaitQueue *queuep;
+
+    volatile int fired;
+} WheelTimer;
+
+/*
+ * Start a timer that unblocks the calling thread from the queue, or from
+ * sthread_block if the queue is NULL, after ms milliseconds, and cancel
+ * one that hasn't fired.  These must be called with the scheduler lock
+ * held.
+ */
+void wheel_start(WheelTimer *timerp, unsigned int ms, WaitQueue *queuep);
+void wheel_cancel(WheelTimer *timerp);
+
+/*
+ * Returns true if any timer is pending.  Threads waiting for one aren't
+ * deadlocked.
+ */
+int __wheel_pending(void);
+
+/*
+ * Expire every timer that is due.  The caller must be a worker with
+ * preemption off, and must not hold the scheduler lock.
+ */
+void __wheel_advance(void);
+
+#endif /* _WHEEL_H */
@@ -6,10 +6,36 @@
 
 
 #include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "matrix.h"
+#include "virtualmem.h"
 #include "vmalloc.h"
+#include "cacheprof.h"
+
+
+/* The accesses that each way of multiplying makes to each matrix, which are
+ * simulated on the cache hierarchy of the cache simulator for "make
+ * CACHEPROF=1".  The packed GEMM and the threaded multiply aren't reported.
+ */
+CACHEPROF_DEFINE(naive_m1_region, "multiply m1");
+CACHEPROF_DEFINE(naive_m2_region, "multiply m2");
+CACHEPROF_DEFINE(naive_result_region, "multiply result");
+CACHEPROF_DEFINE(tiled_m1_region, "tiled m1");
+CACHEPROF_DEFINE(tiled_m2_region, "tiled m2");
+CACHEPROF_DEFINE(tiled_result_region, "tiled result");
+CACHEPROF_DEFINE(transposed_m1_region, "transposed m1");
+CACHEPROF_DEFINE(transposed_m2_region, "transposed m2");
+CACHEPROF_DEFINE(transposed_m2t_region, "transposed m2t");
+CACHEPROF_DEFINE(transposed_result_region, "transposed result");
+
+
+/* Returns the size in bytes of a matrix and its elements. */
+static size_t matrix_bytes(const matrix_t *m) {
+    return sizeof(matrix_t) + (size_t) m->rows * m->cols * sizeof(int);
+}
 
 
 /* Allocate a new matrix object of size rows x cols, from the virtual memory
@@ -26,6 +52,12 @@ matrix_t * vmalloc_matrix(int rows, int cols) {
 }
 
 
+/* Free a matrix allocated with vmalloc_matrix().  Freeing NULL does nothing. */
+void vfree_matrix(matrix_t *m) {
+    vmem_free(m);
+}
+
+
 /* Allocate a new matrix object of size rows x cols, using malloc().  The
  * elements themselves are uninitialized.  This function allows us to have a
  * copy of the test matrices outside of the virtual memory system, so that we
@@ -99,15 +131,283 @@ void multiply_matrices(const matrix_t *m1, const matrix_t *m2,
     for (r = 0; r < result->rows; r++) {
         for (c = 0; c < result->cols; c++) {
             val = 0;
-            for (i = 0; i < m1->cols; i++)
+            for (i = 0; i < m1->cols; i++) {
+                CACHEPROF_READ(naive_m1_region,
+                               &m1->elems[r * m1->cols + i], sizeof(int));
+                CACHEPROF_READ(naive_m2_region,
+                               &m2->elems[i * m2->cols + c], sizeof(int));
                 val += get_elem(m1, r, i) * get_elem(m2, i, c);
+            }
 
+            CACHEPROF_WRITE(naive_result_region,
+                            &result->elems[r * result->cols + c],
+                            sizeof(int));
             set_elem(result, r, c, val);
         }
     }
 }
 
 
+/* Multiplies the two matrices m1 and m2 a tile at a time, storing the results
+ * into the result matrix.  Within each tile, a row of m1's tile is multiplied
+ * into a row of the result's tile, so that every matrix is walked along its
+ * rows and the innermost loop is sequential.  The elements are accessed
+ * directly, since the dimensions are checked once here.
+ */
+void multiply_matrices_tiled(const matrix_t *m1, const matrix_t *m2,
+                             matrix_t *result, int tile) {
+    int r0, c0, i0, r, c, i, r_end, c_end, i_end, val;
+    const int *a, *b;
+    int *out;
+
+    assert(m1 != NULL);
+    assert(m2 != NULL);
+    assert(result != NULL);
+    assert(tile > 0);
+
+    assert(m1->cols == m2->rows);
+    assert(m1->rows == result->rows);
+    assert(m2->cols == result->cols);
+
+    for (r = 0; r < result->rows * result->cols; r++)
+        result->elems[r] = 0;
+    CACHEPROF_WRITE(tiled_result_region, result->elems,
+                    result->rows * result->cols * sizeof(int));
+
+    for (r0 = 0; r0 < result->rows; r0 += tile) {
+        r_end = (r0 + tile < result->rows) ? r0 + tile : result->rows;
+
+        for (i0 = 0; i0 < m1->cols; i0 += tile) {
+            i_end = (i0 + tile < m1->cols) ? i0 + tile : m1->cols;
+
+            for (c0 = 0; c0 < result->cols; c0 += tile) {
+                c_end = (c0 + tile < result->cols) ? c0 + tile : result->cols;
+
+                /* Multiply the m1 and m2 tiles into the result tile. */
+                for (r = r0; r < r_end; r++) {
+                    a = m1->elems + r * m1->cols;
+                    out = result->elems + r * result->cols;
+
+                    for (i = i0; i < i_end; i++) {
+                        CACHEPROF_READ(tiled_m1_region, &a[i], sizeof(int));
+                        val = a[i];
+                        b = m2->elems + i * m2->cols;
+                        for (c = c0; c < c_end; c++) {
+                            CACHEPROF_READ(tiled_m2_region, &b[c],
+                                           sizeof(int));
+                            CACHEPROF_READ(tiled_result_region, &out[c],
+                                           sizeof(int));
+                            CACHEPROF_WRITE(tiled_result_region, &out[c],
+                                            sizeof(int));
+                            out[c] += val * b[c];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+/* Returns the number of pages that a tile x tile tile of a matrix with cols
+ * columns may touch:  the rows of a tile share pages when the matrix's rows
+ * are shorter than a page, and each need their own otherwise.
+ */
+static unsigned int tile_pages(int cols, int tile) {
+    size_t row_bytes = (size_t) cols * sizeof(int);
+    size_t tile_row_bytes = (size_t) tile * sizeof(int);
+
+    if (row_bytes < PAGE_SIZE)
+        return (tile * row_bytes + PAGE_SIZE - 1) / PAGE_SIZE + 1;
+
+    return tile * ((tile_row_bytes + PAGE_SIZE - 1) / PAGE_SIZE + 1);
+}
+
+
+/* Choose the largest tile size such that a tile of each of the three
+ * matrices fits in the given number of resident pages.  The matrices are
+ * square in practice, so the result's column count stands for all three.
+ */
+int tile_size_for_pages(const matrix_t *result, unsigned int pages) {
+    int tile;
+
+    assert(result != NULL);
+
+    for (tile = 1; tile < result->rows || tile < result->cols; tile++) {
+        if (3 * tile_pages(result->cols, tile + 1) > pages)
+            break;
+    }
+    return tile;
+}
+
+
+/* Choose the largest tile size such that a tile of each of the three
+ * matrices fits in a cache of the given number of bytes.
+ */
+int tile_size_for_cache(size_t bytes) {
+    int tile = 1;
+
+    while (3 * (size_t) (tile + 1) * (tile + 1) * sizeof(int) <= bytes)
+        tile++;
+    return tile;
+}
+
+
+/* Stores the transpose of the matrix m into the matrix mt. */
+void transpose_matrix(const matrix_t *m, matrix_t *mt) {
+    int r, c;
+
+    assert(m != NULL);
+    assert(mt != NULL);
+    assert(m->rows == mt->cols);
+    assert(m->cols == mt->rows);
+
+    for (r = 0; r < m->rows; r++) {
+        for (c = 0; c < m->cols; c++) {
+            CACHEPROF_READ(transposed_m2_region, &m->elems[r * m->cols + c],
+                           sizeof(int));
+            CACHEPROF_WRITE(transposed_m2t_region,
+                            &mt->elems[c * mt->cols + r], sizeof(int));
+            mt->elems[c * mt->cols + r] = m->elems[r * m->cols + c];
+        }
+    }
+}
+
+
+/* Multiplies the two matrices m1 and m2, storing the results into the result
+ * matrix.  m2 is transposed into m2t first, so that each result element is
+ * the dot product of two rows instead of a row and a column.
+ */
+void multiply_matrices_transposed(const matrix_t *m1, const matrix_t *m2,
+                                  matrix_t *m2t, matrix_t *result) {
+    int r, c, i, val;
+    const int *a, *b;
+
+    assert(m1 != NULL);
+    assert(m2 != NULL);
+    assert(result != NULL);
+
+    assert(m1->cols == m2->rows);
+    assert(m1->rows == result->rows);
+    assert(m2->cols == result->cols);
+
+    transpose_matrix(m2, m2t);
+
+    for (r = 0; r < result->rows; r++) {
+        a = m1->elems + r * m1->cols;
+        for (c = 0; c < result->cols; c++) {
+            b = m2t->elems + c * m2t->cols;
+            val = 0;
+            for (i = 0; i < m1->cols; i++) {
+                CACHEPROF_READ(transposed_m1_region, &a[i], sizeof(int));
+                CACHEPROF_READ(transposed_m2t_region, &b[i], sizeof(int));
+                val += a[i] * b[i];
+            }
+
+            CACHEPROF_WRITE(transposed_result_region,
+                            &result->elems[r * result->cols + c],
+                            sizeof(int));
+            result->elems[r * result->cols + c] = val;
+        }
+    }
+}
+
+
+/* One thread's share of a multiplication:  the panel of result rows from
+ * r_begin up to, but not including, r_end.
+ */
+typedef struct row_panel_t {
+    const matrix_t *m1;
+    const matrix_t *m2;
+    matrix_t *result;
+    int r_begin;
+    int r_end;
+} row_panel_t;
+
+
+/* Computes one panel of result rows.  Each row of m1 is multiplied into its
+ * row of the result one m2 row at a time, so that every matrix is walked
+ * along its rows.
+ */
+static void * multiply_panel(void *arg) {
+    row_panel_t *panel = arg;
+    const matrix_t *m1 = panel->m1, *m2 = panel->m2;
+    int r, c, i, val;
+    const int *b;
+    int *out;
+
+    for (r = panel->r_begin; r < panel->r_end; r++) {
+        out = panel->result->elems + r * m2->cols;
+        for (c = 0; c < m2->cols; c++)
+            out[c] = 0;
+
+        for (i = 0; i < m1->cols; i++) {
+            val = m1->elems[r * m1->cols + i];
+            b = m2->elems + i * m2->cols;
+            for (c = 0; c < m2->cols; c++)
+                out[c] += val * b[c];
+        }
+    }
+
+    return NULL;
+}
+
+
+/* Multiplies the two matrices m1 and m2 using nthreads threads, storing the
+ * results into the result matrix.  The result rows are split into nthreads
+ * panels of nearly equal size; the calling thread computes the first, and a
+ * new thread computes each of the others.
+ */
+void multiply_matrices_mt(const matrix_t *m1, const matrix_t *m2,
+                          matrix_t *result, int nthreads) {
+    row_panel_t *panels;
+    pthread_t *threads;
+    int t;
+
+    assert(m1 != NULL);
+    assert(m2 != NULL);
+    assert(result != NULL);
+    assert(nthreads > 0);
+
+    assert(m1->cols == m2->rows);
+    assert(m1->rows == result->rows);
+    assert(m2->cols == result->cols);
+
+    if (nthreads > result->rows)
+        nthreads = (result->rows > 0) ? result->rows : 1;
+
+    panels = malloc(nthreads * sizeof(row_panel_t));
+    threads = malloc(nthreads * sizeof(pthread_t));
+    if (panels == NULL || threads == NULL) {
+        fprintf(stderr, "multiply_matrices_mt: out of memory\n");
+        abort();
+    }
+
+    for (t = 0; t < nthreads; t++) {
+        panels[t].m1 = m1;
+        panels[t].m2 = m2;
+        panels[t].result = result;
+        panels[t].r_begin = (int) ((long) result->rows * t / nthreads);
+        panels[t].r_end = (int) ((long) result->rows * (t + 1) / nthreads);
+    }
+
+    for (t = 1; t < nthreads; t++) {
+        if (pthread_create(&threads[t], NULL, multiply_panel, &panels[t]) != 0) {
+            fprintf(stderr, "multiply_matrices_mt: can't create a thread\n");
+            abort();
+        }
+    }
+
+    multiply_panel(&panels[0]);
+
+    for (t = 1; t < nthreads; t++)
+        pthread_join(threads[t], NULL);
+
+    free(panels);
+    free(threads);
+}
+
+
 /* Given two matrices of the same dimensions, copies the elements from the
  * source matrix into the destination matrix.
  */
@@ -119,8 +419,15 @@ void copy_matrix(const matrix_t *src, matrix_t *dst) {
     assert(src->rows == dst->rows);
     assert(src->cols == dst->cols);
 
+    /* Both matrices are walked once, from start to end. */
+    vmem_advise((void *) src, matrix_bytes(src), VMEM_SEQUENTIAL);
+    vmem_advise(dst, matrix_bytes(dst), VMEM_SEQUENTIAL);
+
     for (i = 0; i < src->rows * src->cols; i++)
         dst->elems[i] = src->elems[i];
+
+    vmem_advise((void *) src, matrix_bytes(src), VMEM_NORMAL);
+    vmem_advise(dst, matrix_bytes(dst), VMEM_NORMAL);
 }
 
 
@@ -136,11 +443,18 @@ int compare_matrices(const matrix_t *m1, const matrix_t *m2) {
     if (m1->rows != m2->rows || m1->cols != m2->cols)
         return 0;
 
+    /* Both matrices are walked once, from start to end. */
+    vmem_advise((void *) m1, matrix_bytes(m1), VMEM_SEQUENTIAL);
+    vmem_advise((void *) m2, matrix_bytes(m2), VMEM_SEQUENTIAL);
+
     for (i = 0; i < m1->rows * m1->cols; i++) {
         if (m1->elems[i] != m2->elems[i])
-            return 0;
+            break;
     }
 
-    return 1;
+    vmem_advise((void *) m1, matrix_bytes(m1), VMEM_NORMAL);
+    vmem_advise((void *) m2, matrix_bytes(m2), VMEM_NORMAL);
+
+    return i == m1->rows * m1->cols;
 }
 
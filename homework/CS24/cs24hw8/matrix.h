@@ -9,6 +9,8 @@
 #ifndef MATRIX_H
 #define MATRIX_H
 
+#include <stddef.h>
+
 
 /* A simple 2D matrix type. */
 typedef struct matrix_t {
@@ -20,11 +22,49 @@ typedef struct matrix_t {
 
 matrix_t * malloc_matrix(int rows, int cols);
 matrix_t * vmalloc_matrix(int rows, int cols);
+void vfree_matrix(matrix_t *m);
 void generate_matrix_values(matrix_t *m);
 int get_elem(const matrix_t *m, int r, int c);
 void set_elem(matrix_t *m, int r, int c, int value);
 void multiply_matrices(const matrix_t *m1, const matrix_t *m2,
                        matrix_t *result);
+
+/* Multiply in square tiles of tile x tile elements, so that only one tile of
+ * each matrix needs to be resident, or cached, at a time.
+ */
+void multiply_matrices_tiled(const matrix_t *m1, const matrix_t *m2,
+                             matrix_t *result, int tile);
+
+/* Choose the largest tile size for multiplying into result such that a tile
+ * of each of the three matrices fits in the given number of resident pages,
+ * or in a cache of the given number of bytes.  Neither is ever below 1.
+ */
+int tile_size_for_pages(const matrix_t *result, unsigned int pages);
+int tile_size_for_cache(size_t bytes);
+
+/* Multiply after transposing m2 into m2t, which must have m2's dimensions
+ * swapped, so that both operands are read along their rows.
+ */
+void transpose_matrix(const matrix_t *m, matrix_t *mt);
+void multiply_matrices_transposed(const matrix_t *m1, const matrix_t *m2,
+                                  matrix_t *m2t, matrix_t *result);
+
+/* Multiply using nthreads threads, each computing its own panel of
+ * consecutive result rows.  The matrices can come from malloc() or from the
+ * virtual memory pool.
+ */
+void multiply_matrices_mt(const matrix_t *m1, const matrix_t *m2,
+                          matrix_t *result, int nthreads);
+
+/* Multiply with the packed, register-blocked GEMM in matrix_gemm.c.  Its
+ * micro-kernel is chosen for the processor the first time it runs, unless
+ * gemm_use_impl() picks one by name ("avx2" or "portable") first.
+ */
+void multiply_matrices_gemm(const matrix_t *m1, const matrix_t *m2,
+                            matrix_t *result);
+int gemm_use_impl(const char *name);
+const char * gemm_impl_name(void);
+
 void copy_matrix(const matrix_t *src, matrix_t *dst);
 int compare_matrices(const matrix_t *m1, const matrix_t *m2);
 
@@ -0,0 +1,347 @@
+/*============================================================================
+ * A blocked integer matrix multiply, with an AVX2 micro-kernel and a portable
+ * one, for the matrix type declared in matrix.h.
+ *
+ * The multiply follows the usual GEMM structure.  m2 is cut into panels of
+ * KC rows by NC columns, and each panel is packed so that every NR columns
+ * of it are contiguous, row after row.  m1 is cut into blocks of MC rows by
+ * KC columns, packed so that every MR rows are contiguous, column after
+ * column.  The micro-kernel then multiplies one MR-row sliver of the m1
+ * block by one NR-column sliver of the m2 panel, keeping the MR x NR block of
+ * the result in registers for all KC steps, and only then adds it into the
+ * result.  Slivers at the edges are padded with zeros when they are packed,
+ * so the micro-kernel always does a whole block, and only the part of it
+ * that is inside the result is added in.
+ *
+ * The implementation is chosen when the first multiply runs, from a table
+ * ordered best first, in the same way as select_impl() in cs24hw5/cpuinfo.
+ * That code's CPUID routines are 32-bit assembly, so the processor is asked
+ * through __builtin_cpu_supports() here instead.
+ */
+
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL 1
+#endif
+
+#include "matrix.h"
+
+
+/* The size of the result block that the micro-kernel keeps in registers:
+ * MR rows of two 8-int vectors each, for eight accumulators.
+ */
+#define MR 4
+#define NR 16
+
+/* The sizes of the packed blocks:  a KC x NC panel of m2, 256 KiB, and an
+ * MC x KC block of m1, 64 KiB, so that the m1 block stays in the L2 cache
+ * while the panel is streamed through it.
+ */
+#define MC 64
+#define KC 256
+#define NC 256
+
+
+/* A micro-kernel:  multiply the packed MR x k sliver a by the packed k x NR
+ * sliver b, and add the rows x cols part of the product into c, whose rows
+ * are ldc elements apart.
+ */
+typedef void (*gemm_kernel_func)(int k, const int *a, const int *b, int *c,
+                                 int ldc, int rows, int cols);
+
+
+/* One implementation of the micro-kernel.  supported returns nonzero if the
+ * processor can run this one.
+ */
+typedef struct gemm_impl_t {
+    const char *name;
+    int (*supported)(void);
+    gemm_kernel_func kernel;
+} gemm_impl_t;
+
+
+/* The implementation chosen by the first multiply. */
+static const gemm_impl_t *chosen_impl = NULL;
+
+
+/*============================================================================
+ * Micro-Kernels
+ */
+
+
+/* Add the rows x cols part of the MR x NR block acc into c. */
+static void add_block(const int *acc, int *c, int ldc, int rows, int cols) {
+    int r, j;
+
+    for (r = 0; r < rows; r++) {
+        for (j = 0; j < cols; j++)
+            c[r * ldc + j] += acc[r * NR + j];
+    }
+}
+
+
+static int always_supported(void) {
+    return 1;
+}
+
+
+/* The portable micro-kernel, with the same packed layout as the AVX2 one. */
+static void kernel_portable(int k, const int *a, const int *b, int *c,
+                            int ldc, int rows, int cols) {
+    int acc[MR * NR];
+    int p, r, j, val;
+
+    memset(acc, 0, sizeof(acc));
+    for (p = 0; p < k; p++) {
+        for (r = 0; r < MR; r++) {
+            val = a[p * MR + r];
+            for (j = 0; j < NR; j++)
+                acc[r * NR + j] += val * b[p * NR + j];
+        }
+    }
+
+    add_block(acc, c, ldc, rows, cols);
+}
+
+
+#if HAVE_AVX2_KERNEL
+
+static int avx2_supported(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+
+/* The AVX2 micro-kernel.  Each step loads one row of the m2 sliver as two
+ * vectors, broadcasts each of the MR elements of a column of the m1 sliver,
+ * and multiplies and adds them into the accumulators.  A whole block goes
+ * straight into c with unaligned loads and stores; an edge block goes through
+ * a buffer.
+ */
+__attribute__((target("avx2")))
+static void kernel_avx2(int k, const int *a, const int *b, int *c, int ldc,
+                        int rows, int cols) {
+    __m256i c00, c01, c10, c11, c20, c21, c30, c31;
+    __m256i b0, b1, av;
+    int acc[MR * NR];
+    int p;
+
+    c00 = c01 = c10 = c11 = _mm256_setzero_si256();
+    c20 = c21 = c30 = c31 = _mm256_setzero_si256();
+
+    for (p = 0; p < k; p++) {
+        b0 = _mm256_loadu_si256((const __m256i *) (b + p * NR));
+        b1 = _mm256_loadu_si256((const __m256i *) (b + p * NR + 8));
+
+        av = _mm256_set1_epi32(a[p * MR + 0]);
+        c00 = _mm256_add_epi32(c00, _mm256_mullo_epi32(av, b0));
+        c01 = _mm256_add_epi32(c01, _mm256_mullo_epi32(av, b1));
+
+        av = _mm256_set1_epi32(a[p * MR + 1]);
+        c10 = _mm256_add_epi32(c10, _mm256_mullo_epi32(av, b0));
+        c11 = _mm256_add_epi32(c11, _mm256_mullo_epi32(av, b1));
+
+        av = _mm256_set1_epi32(a[p * MR + 2]);
+        c20 = _mm256_add_epi32(c20, _mm256_mullo_epi32(av, b0));
+        c21 = _mm256_add_epi32(c21, _mm256_mullo_epi32(av, b1));
+
+        av = _mm256_set1_epi32(a[p * MR + 3]);
+        c30 = _mm256_add_epi32(c30, _mm256_mullo_epi32(av, b0));
+        c31 = _mm256_add_epi32(c31, _mm256_mullo_epi32(av, b1));
+    }
+
+    if (rows == MR && cols == NR) {
+#define ADD_ROW(r, lo, hi) do {                                              \
+        __m256i *row = (__m256i *) (c + (r) * ldc);                          \
+        _mm256_storeu_si256(row,                                             \
+            _mm256_add_epi32(_mm256_loadu_si256(row), lo));                  \
+        _mm256_storeu_si256(row + 1,                                         \
+            _mm256_add_epi32(_mm256_loadu_si256(row + 1), hi));              \
+    } while (0)
+
+        ADD_ROW(0, c00, c01);
+        ADD_ROW(1, c10, c11);
+        ADD_ROW(2, c20, c21);
+        ADD_ROW(3, c30, c31);
+#undef ADD_ROW
+        return;
+    }
+
+    _mm256_storeu_si256((__m256i *) (acc + 0 * NR), c00);
+    _mm256_storeu_si256((__m256i *) (acc + 0 * NR + 8), c01);
+    _mm256_storeu_si256((__m256i *) (acc + 1 * NR), c10);
+    _mm256_storeu_si256((__m256i *) (acc + 1 * NR + 8), c11);
+    _mm256_storeu_si256((__m256i *) (acc + 2 * NR), c20);
+    _mm256_storeu_si256((__m256i *) (acc + 2 * NR + 8), c21);
+    _mm256_storeu_si256((__m256i *) (acc + 3 * NR), c30);
+    _mm256_storeu_si256((__m256i *) (acc + 3 * NR + 8), c31);
+    add_block(acc, c, ldc, rows, cols);
+}
+
+#endif /* HAVE_AVX2_KERNEL */
+
+
+/* The implementations, best first.  The last one runs anywhere. */
+static const gemm_impl_t GEMM_IMPLS[] = {
+#if HAVE_AVX2_KERNEL
+    { "avx2", avx2_supported, kernel_avx2 },
+#endif
+    { "portable", always_supported, kernel_portable }
+};
+
+
+/* Returns the implementation to use, choosing it on the first call. */
+static const gemm_impl_t * select_gemm_impl(void) {
+    const gemm_impl_t *impl = GEMM_IMPLS;
+
+    if (chosen_impl == NULL) {
+        while (!impl->supported())
+            impl++;
+
+        chosen_impl = impl;
+    }
+
+    return chosen_impl;
+}
+
+
+/*============================================================================
+ * Packing
+ */
+
+
+/* Pack the k x n block of m2 starting at (row, col) into slivers of NR
+ * columns, each stored row after row, padding the last sliver with zeros.
+ */
+static void pack_b(const matrix_t *m2, int row, int col, int k, int n,
+                   int *packed) {
+    int j0, p, j, width;
+    const int *src;
+
+    for (j0 = 0; j0 < n; j0 += NR) {
+        width = (n - j0 < NR) ? n - j0 : NR;
+
+        for (p = 0; p < k; p++) {
+            src = m2->elems + (row + p) * m2->cols + col + j0;
+            for (j = 0; j < width; j++)
+                packed[j] = src[j];
+            for (; j < NR; j++)
+                packed[j] = 0;
+
+            packed += NR;
+        }
+    }
+}
+
+
+/* Pack the m x k block of m1 starting at (row, col) into slivers of MR rows,
+ * each stored column after column, padding the last sliver with zeros.
+ */
+static void pack_a(const matrix_t *m1, int row, int col, int m, int k,
+                   int *packed) {
+    int r0, p, r, height;
+
+    for (r0 = 0; r0 < m; r0 += MR) {
+        height = (m - r0 < MR) ? m - r0 : MR;
+
+        for (p = 0; p < k; p++) {
+            for (r = 0; r < height; r++)
+                packed[r] = m1->elems[(row + r0 + r) * m1->cols + col + p];
+            for (; r < MR; r++)
+                packed[r] = 0;
+
+            packed += MR;
+        }
+    }
+}
+
+
+/*============================================================================
+ * Multiplication
+ */
+
+
+/* Use the named micro-kernel from now on, instead of the best one.  Returns 0
+ * on success, or -1 if there is no such kernel or the processor can't run it.
+ */
+int gemm_use_impl(const char *name) {
+    unsigned int i;
+
+    for (i = 0; i < sizeof(GEMM_IMPLS) / sizeof(GEMM_IMPLS[0]); i++) {
+        if (strcmp(GEMM_IMPLS[i].name, name) == 0) {
+            if (!GEMM_IMPLS[i].supported())
+                return -1;
+
+            chosen_impl = GEMM_IMPLS + i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+/* Returns the name of the micro-kernel that multiply_matrices_gemm() uses. */
+const char * gemm_impl_name(void) {
+    return select_gemm_impl()->name;
+}
+
+
+/* Multiplies the two matrices m1 and m2 with the blocked GEMM, storing the
+ * results into the result matrix.
+ */
+void multiply_matrices_gemm(const matrix_t *m1, const matrix_t *m2,
+                            matrix_t *result) {
+    gemm_kernel_func kernel = select_gemm_impl()->kernel;
+    int *packed_a, *packed_b;
+    int jc, pc, ic, jr, ir, nc, kc, mc, rows, cols;
+
+    assert(m1 != NULL);
+    assert(m2 != NULL);
+    assert(result != NULL);
+
+    assert(m1->cols == m2->rows);
+    assert(m1->rows == result->rows);
+    assert(m2->cols == result->cols);
+
+    packed_a = malloc(MC * KC * sizeof(int));
+    packed_b = malloc(KC * ((NC + NR - 1) / NR * NR) * sizeof(int));
+    if (packed_a == NULL || packed_b == NULL) {
+        fprintf(stderr, "multiply_matrices_gemm: out of memory\n");
+        abort();
+    }
+
+    memset(result->elems, 0, (size_t) result->rows * result->cols * sizeof(int));
+
+    for (jc = 0; jc < result->cols; jc += NC) {
+        nc = (result->cols - jc < NC) ? result->cols - jc : NC;
+
+        for (pc = 0; pc < m1->cols; pc += KC) {
+            kc = (m1->cols - pc < KC) ? m1->cols - pc : KC;
+            pack_b(m2, pc, jc, kc, nc, packed_b);
+
+            for (ic = 0; ic < result->rows; ic += MC) {
+                mc = (result->rows - ic < MC) ? result->rows - ic : MC;
+                pack_a(m1, ic, pc, mc, kc, packed_a);
+
+                for (jr = 0; jr < nc; jr += NR) {
+                    cols = (nc - jr < NR) ? nc - jr : NR;
+
+                    for (ir = 0; ir < mc; ir += MR) {
+                        rows = (mc - ir < MR) ? mc - ir : MR;
+                        kernel(kc, packed_a + ir * kc, packed_b + jr * kc,
+                               result->elems + (ic + ir) * result->cols +
+                               jc + jr, result->cols, rows, cols);
+                    }
+                }
+            }
+        }
+    }
+
+    free(packed_a);
+    free(packed_b);
+}
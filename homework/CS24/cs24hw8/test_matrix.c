@@ -14,24 +14,91 @@
 #include "virtualmem.h"
 #include "vmalloc.h"
 #include "matrix.h"
+#include "vmzswap.h"
 
 #define DEFAULT_MAX_RESIDENT 64
 
 
+/* The ways that the vmalloc()'d matrices can be multiplied. */
+typedef enum algorithm_t {
+    ALG_NAIVE,
+    ALG_TILED,
+    ALG_TRANSPOSED,
+    ALG_GEMM,
+    ALG_THREADED
+} algorithm_t;
+
+static const char *algorithm_names[] = {
+    "naive", "tiled", "transposed", "gemm", "threaded"
+};
+
+
 static long seed = 0;
 static unsigned int max_resident = DEFAULT_MAX_RESIDENT;
+static unsigned int readahead = 0;
+static int writeback = 0;
+static unsigned int region_pages = 1;
+static unsigned int zswap_kb = 0;
+static int show_stats = 0;
+static const char *heatmap_file = NULL;
+static algorithm_t algorithm = ALG_NAIVE;
+static int tile = 0;
+static const char *gemm_kernel = NULL;
+static int nthreads = 0;
+static int rounds = 1;
+static int use_uffd = 0;
 static int size;
 
 
+/* Prints the range of pages that hold a matrix's elements. */
+static void print_matrix_pages(const char *name, matrix_t *m) {
+    void *last = m->elems + m->rows * m->cols - 1;
+
+    printf("Matrix %s is in pages %u to %u\n", name, addr_to_page(m->elems),
+           addr_to_page(last));
+}
+
+
 /* Prints the test program's usage, and then exit the program. */
-void usage(const char *prog) {
-    printf("usage: %s [--seed num] [--max_resident num] size\n", prog);
+static void usage(const char *prog) {
+    printf("usage: %s [--seed num] [--max_resident num] [--readahead num] "
+           "[--writeback] [--region num]\n\t\t[--zswap kb] [--stats] "
+           "[--heatmap file]\n\t\t[--algorithm name] [--tile num] "
+           "[--kernel name]\n\t\t[--threads num] [--rounds num] [--userfaultfd] "
+           "size\n",
+           prog);
     printf("\tRuns the test program, generating two square matrices with size\n");
     printf("\trows and columns, and then multiplying them into a third matrix.\n\n");
     printf("\t--seed | -s num optionally specifies the seed for the random\n");
     printf("\tnumber generator.  The system time is used otherwise.\n\n");
     printf("\t--max_resident | -m num specifies the maximum number of pages\n");
-    printf("\tthat may be resident in the virtual memory system.\n");
+    printf("\tthat may be resident in the virtual memory system.\n\n");
+    printf("\t--readahead | -r num specifies how many pages to read ahead\n");
+    printf("\twhen page faults form a sequential or strided stream.  The\n");
+    printf("\tdefault of 0 turns readahead off.\n\n");
+    printf("\t--writeback | -w starts a thread that writes dirty pages\n");
+    printf("\tback ahead of their eviction.\n\n");
+    printf("\t--region | -g num maps and evicts pages in aligned regions of\n");
+    printf("\tnum pages, a power of two; the default is 1.\n\n");
+    printf("\t--zswap | -z kb keeps up to kb KiB of compressed evicted\n");
+    printf("\tpages in memory instead of the swap file.\n\n");
+    printf("\t--stats | -t prints histograms of how long page faults took\n");
+    printf("\tto service.\n\n");
+    printf("\t--heatmap | -h file writes the number of loads, permission\n");
+    printf("\tfaults and evictions of every page to file.\n\n");
+    printf("\t--algorithm | -a name multiplies the matrices with the naive,\n");
+    printf("\ttiled, transposed, gemm or threaded algorithm; the default\n");
+    printf("\tis naive.\n\n");
+    printf("\t--tile | -b num sets the tiled algorithm's tile size.  By\n");
+    printf("\tdefault it is chosen to fit in the maximum resident pages.\n\n");
+    printf("\t--kernel | -k name makes the gemm algorithm use the avx2 or\n");
+    printf("\tportable micro-kernel, instead of the best one available.\n\n");
+    printf("\t--threads | -j num sets how many threads the threaded\n");
+    printf("\talgorithm uses.  By default it uses one per online CPU.\n\n");
+    printf("\t--rounds | -n num repeats the test num times, freeing the\n");
+    printf("\tmatrices after each round; the default is 1.\n\n");
+    printf("\t--userfaultfd | -u loads missing pages from a userfaultfd\n");
+    printf("\thandler thread instead of the SIGSEGV handler.\n");
     exit(1);
 }
 
@@ -49,13 +116,25 @@ void parse_args(int argc, char **argv) {
              * We distinguish them by their indices. */
             {"seed",         required_argument, 0, 's'},
             {"max_resident", required_argument, 0, 'm'},
+            {"readahead",    required_argument, 0, 'r'},
+            {"writeback",    no_argument,       0, 'w'},
+            {"region",       required_argument, 0, 'g'},
+            {"zswap",        required_argument, 0, 'z'},
+            {"stats",        no_argument,       0, 't'},
+            {"heatmap",      required_argument, 0, 'h'},
+            {"algorithm",    required_argument, 0, 'a'},
+            {"tile",         required_argument, 0, 'b'},
+            {"kernel",       required_argument, 0, 'k'},
+            {"threads",      required_argument, 0, 'j'},
+            {"rounds",       required_argument, 0, 'n'},
+            {"userfaultfd",  no_argument,       0, 'u'},
             {0, 0, 0, 0}
         };
 
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        c = getopt_long(argc, argv, "s:m:", long_options, &option_index);
+        c = getopt_long(argc, argv, "s:m:r:wg:z:th:a:b:k:j:n:u", long_options, &option_index);
 
         /* Detect the end of the options. */
         if (c == -1)
@@ -83,6 +162,71 @@ void parse_args(int argc, char **argv) {
             printf("Max resident pages = %d\n", max_resident);
             break;
 
+        case 'r':
+            readahead = atoi(optarg);
+            printf("Readahead window = %u\n", readahead);
+            break;
+
+        case 'w':
+            writeback = 1;
+            break;
+
+        case 'g':
+            region_pages = atoi(optarg);
+            printf("Region size = %u pages\n", region_pages);
+            break;
+
+        case 'z':
+            zswap_kb = atoi(optarg);
+            printf("Compressed pool = %u KiB\n", zswap_kb);
+            break;
+
+        case 't':
+            show_stats = 1;
+            break;
+
+        case 'h':
+            heatmap_file = optarg;
+            break;
+
+        case 'a':
+            if (strcmp(optarg, "naive") == 0)
+                algorithm = ALG_NAIVE;
+            else if (strcmp(optarg, "tiled") == 0)
+                algorithm = ALG_TILED;
+            else if (strcmp(optarg, "transposed") == 0)
+                algorithm = ALG_TRANSPOSED;
+            else if (strcmp(optarg, "gemm") == 0)
+                algorithm = ALG_GEMM;
+            else if (strcmp(optarg, "threaded") == 0)
+                algorithm = ALG_THREADED;
+            else
+                usage(argv[0]);
+            break;
+
+        case 'b':
+            tile = atoi(optarg);
+            printf("Tile size = %d\n", tile);
+            break;
+
+        case 'k':
+            gemm_kernel = optarg;
+            break;
+
+        case 'j':
+            nthreads = atoi(optarg);
+            printf("Threads = %d\n", nthreads);
+            break;
+
+        case 'n':
+            rounds = atoi(optarg);
+            printf("Rounds = %d\n", rounds);
+            break;
+
+        case 'u':
+            use_uffd = 1;
+            break;
+
         case '?':
             /* getopt_long already printed an error message. */
             usage(argv[0]);
@@ -101,9 +245,22 @@ void parse_args(int argc, char **argv) {
 }
 
 
+/* Returns the time since some fixed point, in seconds. */
+static double now_seconds() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
 int main(int argc, char **argv) {
     matrix_t *m1, *m2, *result;     /* Allocated from virtual memory pool */
     matrix_t *m1v, *m2v, *resultv;  /* Allocated with malloc(), to verify */
+    matrix_t *m2t = NULL;           /* m2's transpose, for that algorithm */
+    unsigned int faults = 0, loads = 0, faults_before, loads_before;
+    double start, vm_seconds = 0, ref_seconds = 0;
+    int round;
 
     /* Parse arguments */
     parse_args(argc, argv);
@@ -116,64 +273,194 @@ int main(int argc, char **argv) {
     printf("Options:\n");
     printf(" * Random seed = %ld\n", seed);
     printf(" * Max resident pages = %u\n", max_resident);
+    printf(" * Readahead window = %u pages\n", readahead);
+    printf(" * Background writeback is %s\n", writeback ? "on" : "off");
+    printf(" * Mapping region = %u pages\n", region_pages);
+    printf(" * Compressed pool = %u KiB\n", zswap_kb);
+    printf(" * Missing pages are caught by %s\n",
+           use_uffd ? "userfaultfd" : "SIGSEGV");
     printf(" * Using %d x %d matrices\n", size, size);
+    printf(" * Multiplying with the %s algorithm\n",
+           algorithm_names[algorithm]);
     printf("\n");
 
+    if (gemm_kernel != NULL && gemm_use_impl(gemm_kernel) != 0) {
+        printf("ERROR:  The %s kernel isn't available\n", gemm_kernel);
+        return 1;
+    }
+
     srand(seed);
 
     /* Initialize the virtual memory system. */
     vmem_init(max_resident);
+    if (use_uffd && vmem_use_userfaultfd() != 0) {
+        printf("ERROR:  userfaultfd isn't available\n");
+        return 1;
+    }
+    vmem_set_readahead(readahead);
+    vmem_set_region_pages(region_pages);
+    if (zswap_kb > 0)
+        vmem_set_zswap((size_t) zswap_kb * 1024);
+    if (writeback)
+        vmem_start_writeback();
+    if (heatmap_file != NULL)
+        vmem_enable_heatmap();
     vmem_alloc_init();
 
-    /* Perform the test. */
-
-    printf("Generating two matrices\n\n");
-
-    /* Allocate matrices from the two memory sources.  Generate values into
-     * the malloc()'d matrix since we can trust it.  Then copy the values into
-     * the vmalloc()'d matrix.
-     */
-
-    m1v = malloc_matrix(size, size);
-    m1 = vmalloc_matrix(size, size);
-    generate_matrix_values(m1v);
-    copy_matrix(m1v, m1);
+    if (nthreads <= 0)
+        nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0)
+        nthreads = 1;
 
-    m2v = malloc_matrix(size, size);
-    m2 = vmalloc_matrix(size, size);
-    generate_matrix_values(m2v);
-    copy_matrix(m2v, m2);
+    /* Perform the test. */
 
-    resultv = malloc_matrix(size, size);
-    result = vmalloc_matrix(size, size);
+    for (round = 1; round <= rounds; round++) {
+        if (rounds > 1)
+            printf("Round %d of %d\n\n", round, rounds);
+
+        printf("Generating two matrices\n\n");
+
+        /* Allocate matrices from the two memory sources.  Generate values
+         * into the malloc()'d matrix since we can trust it.  Then copy the
+         * values into the vmalloc()'d matrix.
+         */
+
+        m1v = malloc_matrix(size, size);
+        m1 = vmalloc_matrix(size, size);
+        generate_matrix_values(m1v);
+        copy_matrix(m1v, m1);
+
+        m2v = malloc_matrix(size, size);
+        m2 = vmalloc_matrix(size, size);
+        generate_matrix_values(m2v);
+        copy_matrix(m2v, m2);
+
+        resultv = malloc_matrix(size, size);
+        result = vmalloc_matrix(size, size);
+
+        if (algorithm == ALG_TRANSPOSED)
+            m2t = vmalloc_matrix(size, size);
+        if (algorithm == ALG_TILED && tile <= 0)
+            tile = tile_size_for_pages(result, max_resident);
+
+        if (heatmap_file != NULL) {
+            /* Say which pages hold which matrix, to read the heat map by. */
+            print_matrix_pages("m1", m1);
+            print_matrix_pages("m2", m2);
+            print_matrix_pages("result", result);
+            if (m2t != NULL)
+                print_matrix_pages("m2t", m2t);
+            printf("\n");
+        }
 
-    printf("Multiplying the matrices together\n\n");
+        printf("Multiplying the matrices together\n\n");
+
+        /* Multiply the vmalloc()'d matrices and the malloc()'d matrices
+         * separately, so that we can compare the results.  The malloc()'d ones
+         * are always multiplied the naive way, as the reference.
+         */
+        faults_before = get_num_faults();
+        loads_before = get_num_loads();
+        start = now_seconds();
+        switch (algorithm) {
+        case ALG_NAIVE:
+            multiply_matrices(m1, m2, result);
+            break;
 
-    /* Multiply the vmalloc()'d matrices and the malloc()'d matrices
-     * separately, so that we can compare the results.
-     */
-    multiply_matrices(m1, m2, result);
-    multiply_matrices(m1v, m2v, resultv);
+        case ALG_TILED:
+            printf("Using %d x %d tiles\n\n", tile, tile);
+            multiply_matrices_tiled(m1, m2, result, tile);
+            break;
 
-    printf("Verifying source and result matrix contents\n");
-    if (compare_matrices(m1, m1v))
-        printf(" * Matrix m1 is correct\n");
-    else
-        printf(" * ERROR:  Matrix m1 doesn't contain correct values!\n");
+        case ALG_TRANSPOSED:
+            multiply_matrices_transposed(m1, m2, m2t, result);
+            break;
 
-    if (compare_matrices(m2, m2v))
-        printf(" * Matrix m2 is correct\n");
-    else
-        printf(" * ERROR:  Matrix m2 doesn't contain correct values!\n");
+        case ALG_GEMM:
+            printf("Using the %s GEMM kernel\n\n", gemm_impl_name());
+            multiply_matrices_gemm(m1, m2, result);
+            break;
 
-    if (compare_matrices(result, resultv))
-        printf(" * Result matrix is correct\n");
-    else
-        printf(" * ERROR:  Result matrix doesn't contain correct values!\n");
+        case ALG_THREADED:
+            printf("Using %d threads\n\n", nthreads);
+            multiply_matrices_mt(m1, m2, result, nthreads);
+            break;
+        }
+        vm_seconds += now_seconds() - start;
+        faults += get_num_faults() - faults_before;
+        loads += get_num_loads() - loads_before;
+
+        start = now_seconds();
+        multiply_matrices(m1v, m2v, resultv);
+        ref_seconds += now_seconds() - start;
+
+        printf("Verifying source and result matrix contents\n");
+        if (compare_matrices(m1, m1v))
+            printf(" * Matrix m1 is correct\n");
+        else
+            printf(" * ERROR:  Matrix m1 doesn't contain correct values!\n");
+
+        if (compare_matrices(m2, m2v))
+            printf(" * Matrix m2 is correct\n");
+        else
+            printf(" * ERROR:  Matrix m2 doesn't contain correct values!\n");
+
+        if (compare_matrices(result, resultv))
+            printf(" * Result matrix is correct\n");
+        else
+            printf(" * ERROR:  Result matrix doesn't contain correct "
+                   "values!\n");
+
+        /* Give the matrices back, so the next round can reuse the space. */
+        vfree_matrix(m1);
+        vfree_matrix(m2);
+        vfree_matrix(result);
+        vfree_matrix(m2t);
+        m2t = NULL;
+        free(m1v);
+        free(m2v);
+        free(resultv);
+
+        if (round < rounds)
+            printf("\n");
+    }
 
     printf("\nDone!\n\n");
 
+    printf("Multiplication:    %u faults, %u page loads, %.3f s "
+           "(%.3f s without virtual memory)\n", faults, loads, vm_seconds,
+           ref_seconds);
     printf("Total page loads:  %u\n", get_num_loads());
+    printf("Total faults:      %u\n", get_num_faults());
+    if (get_num_prefetches() > 0) {
+        printf("Pages read ahead:  %u (%u accessed before eviction)\n",
+               get_num_prefetches(), get_num_prefetch_hits());
+    }
+    printf("Evictions:         %u clean, %u dirty\n",
+           get_num_clean_evictions(), get_num_dirty_evictions());
+    printf("Discarded pages:   %u\n", get_num_discards());
+    if (zswap_kb > 0) {
+        printf("Compressed pool:   %u stored (%u zero), %u faulted back, "
+               "%u spilled, %u rejected\n", zswap_num_stores(),
+               zswap_num_zero_pages(), zswap_num_loads(), zswap_num_spills(),
+               zswap_num_rejects());
+    }
+    if (writeback) {
+        printf("Written back:      %u pages in %u writes\n",
+               get_num_writebacks(), get_num_writeback_calls());
+    }
+
+    if (show_stats) {
+        printf("\n");
+        vmem_dump_stats(stdout);
+    }
+    if (heatmap_file != NULL) {
+        if (vmem_dump_heatmap(heatmap_file) == 0)
+            printf("\nWrote the page heat map to %s\n", heatmap_file);
+        else
+            printf("\nERROR:  Couldn't write the page heat map to %s\n",
+                   heatmap_file);
+    }
     return 0;
 }
 
@@ -3,21 +3,30 @@
  * memory system.
  */
 
+/* For mremap()'s MREMAP_FIXED. */
+#define _GNU_SOURCE
 
 #include <assert.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <linux/userfaultfd.h>
 #include <sys/errno.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "virtualmem.h"
 #include "vmpolicy.h"
+#include "vmzswap.h"
+#include "probe.h"
 
 
 /* The start of the virtual address range.  Choosing a value for this is a bit
@@ -32,6 +41,17 @@
 #define TIMESLICE_SEC 0
 #define TIMESLICE_USEC 10000
 
+/* Faults only count as a strided stream if they are at most this many pages
+ * apart.
+ */
+#define MAX_READAHEAD_STRIDE 16
+
+/* The writeback thread writes at most this many adjacent dirty pages with one
+ * call, and sleeps this long between passes over the page table.
+ */
+#define WRITEBACK_BATCH 16
+#define WRITEBACK_INTERVAL_USEC 2000
+
 
 /*============================================================================
  * Global state for the virtual memory system.
@@ -75,12 +95,131 @@ static unsigned int num_faults;
 static unsigned int num_loads;
 
 
+/* How many pages past a fault in a stream are read ahead; 0 means none. */
+static unsigned int readahead_window;
+
+/* Counts of the pages that were read ahead, and of those that were accessed
+ * before being evicted.
+ */
+static unsigned int num_prefetches;
+static unsigned int num_prefetch_hits;
+
+/* The state of the stream of page loads:  the page loaded last, the
+ * distance from the one before it, and, after a readahead, the page that the
+ * stream would fault on next.
+ */
+static page_t last_fault_page;
+static int fault_stride;
+static page_t stream_next;
+
+
+/* The fault service times are counted in buckets by powers of two of
+ * nanoseconds:  bucket b holds the times from 2^b up to 2^(b+1) - 1 ns, and
+ * the last bucket holds everything longer.
+ */
+#define LATENCY_BUCKETS 32
+
+/* Histograms of how long the SIGSEGV handler took to service faults that
+ * loaded a page, and faults that only changed a page's permission.
+ */
+static unsigned int load_latency[LATENCY_BUCKETS];
+static unsigned int access_latency[LATENCY_BUCKETS];
+
+/* The probes of the SIGSEGV handler, for "make PROBES=1".  Unlike the
+ * histograms, they also count the faults that another thread had already
+ * resolved, and the time taken by the probes includes waiting for the lock.
+ */
+PROBE_DEFINE(fault_probe, "sigsegv_handler");
+PROBE_DEFINE(retried_probe, "sigsegv_handler retried faults");
+
+/* Counts of the pages that were evicted clean, and so were simply dropped,
+ * and of those evicted dirty.
+ */
+static unsigned int num_clean_evictions;
+static unsigned int num_dirty_evictions;
+
+/* Per-page counts of loads, permission faults and evictions, for the heat
+ * map.  These are only allocated once the heat map is enabled.
+ */
+static unsigned int *heat_loads;
+static unsigned int *heat_accesses;
+static unsigned int *heat_evictions;
+
+
+/* Pages whose contents were discarded by vmem_discard():  their slots in the
+ * swap file are out of date, so they are filled with zeros when they are next
+ * loaded.  A page's flag is cleared when its contents are next saved.
+ */
+static unsigned char page_discarded[NUM_PAGES];
+
+/* The VMEM_NORMAL, VMEM_SEQUENTIAL or VMEM_RANDOM hint given for each page. */
+static unsigned char page_advice[NUM_PAGES];
+
+/* A count of the resident pages that vmem_discard() dropped. */
+static unsigned int num_discards;
+
+
+/* The number of pages in a mapping region.  Regions are aligned to their
+ * size, and are resident either completely or not at all.
+ */
+static unsigned int region_pages = 1;
+
+
+/* Set once the writeback thread has been started. */
+static int writeback_running;
+
+/* Counts of the pages that the writeback thread cleaned, and of the calls
+ * that it wrote them with.
+ */
+static unsigned int num_writebacks;
+static unsigned int num_writeback_calls;
+
+/* The userfaultfd that missing pages are reported on, or -1 when they are
+ * caught as SIGSEGVs.  Its handler thread fills the pages from a staging
+ * buffer big enough for the longest run that map_pages() is asked for.
+ */
+static int uffd = -1;
+static char *uffd_staging;
+
+
+/* The page table, the resident pages and the policy's state are shared by the
+ * fault handlers, the userfaultfd thread and the writeback thread, which hold
+ * this lock while they use them.  The program itself never holds it outside of the handlers, and
+ * SIGALRM is blocked during SIGSEGV handling, so a handler never waits for
+ * the thread that it interrupted.  When the program has several threads,
+ * their faults are handled one at a time under the lock, and a fault that
+ * another thread's fault has already resolved is simply retried.
+ */
+static pthread_mutex_t vm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
 /* This page table records the state of every virtual page in the virtual
- * memory area, including whether the page has been mapped into physical
- * memory, and also whether the page has been accessed and/or is dirty.
+ * memory area:  its permission, and whether it was read ahead or is part of
+ * a region.
  */
 static pte_t page_table[NUM_PAGES];
 
+/* Whether each page is resident, has been accessed and is dirty are kept
+ * apart from the page table, one bit per page, so that the policies and the
+ * writeback thread can look over 64 pages with one test.  These bits of a
+ * page's entry in page_table are never set.
+ */
+typedef unsigned long long bitmap_word_t;
+
+#define BITMAP_BITS 64
+#define BITMAP_WORDS (NUM_PAGES / BITMAP_BITS)
+
+#define BITMAP_SET(map, page) \
+    ((map)[(page) / BITMAP_BITS] |= 1ULL << ((page) % BITMAP_BITS))
+#define BITMAP_CLEAR(map, page) \
+    ((map)[(page) / BITMAP_BITS] &= ~(1ULL << ((page) % BITMAP_BITS)))
+#define BITMAP_TEST(map, page) \
+    (((map)[(page) / BITMAP_BITS] >> ((page) % BITMAP_BITS)) & 1)
+
+static bitmap_word_t resident_map[BITMAP_WORDS];
+static bitmap_word_t accessed_map[BITMAP_WORDS];
+static bitmap_word_t dirty_map[BITMAP_WORDS];
+
 
 /*============================================================================
  * Helper Functions
@@ -138,6 +277,211 @@ unsigned int get_num_loads() {
 }
 
 
+/* Returns the number of pages that were read ahead of a stream of faults. */
+unsigned int get_num_prefetches() {
+    return num_prefetches;
+}
+
+
+/* Returns the number of pages read ahead that were then accessed.  The
+ * difference from get_num_prefetches() is the readahead that was wasted.
+ */
+unsigned int get_num_prefetch_hits() {
+    return num_prefetch_hits;
+}
+
+
+/* Returns the number of dirty pages that the writeback thread cleaned. */
+unsigned int get_num_writebacks() {
+    return num_writebacks;
+}
+
+
+/* Returns the number of writes that the writeback thread cleaned them with. */
+unsigned int get_num_writeback_calls() {
+    return num_writeback_calls;
+}
+
+
+/* Returns the number of evicted pages that were still dirty, and so had to be
+ * written out, or compressed, on the faulting path.
+ */
+unsigned int get_num_dirty_evictions() {
+    return num_dirty_evictions;
+}
+
+
+/* Returns the number of evicted pages that were clean, and so were dropped. */
+unsigned int get_num_clean_evictions() {
+    return num_clean_evictions;
+}
+
+
+/* Returns the number of resident pages that were discarded, and so were
+ * dropped no matter whether they were dirty.
+ */
+unsigned int get_num_discards() {
+    return num_discards;
+}
+
+
+/* Returns the current time in nanoseconds.  clock_gettime() is safe to call
+ * from a signal handler.
+ */
+static unsigned long long now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/* Count a fault service time of ns nanoseconds in a latency histogram. */
+static void record_latency(unsigned int *hist, unsigned long long ns) {
+    int b = 0;
+
+    while (ns > 1 && b < LATENCY_BUCKETS - 1) {
+        ns >>= 1;
+        b++;
+    }
+    hist[b]++;
+}
+
+
+/* Count an eviction of the page, before its page-table entry is cleared. */
+static void record_eviction(page_t page) {
+    if (is_page_dirty(page))
+        num_dirty_evictions++;
+    else
+        num_clean_evictions++;
+
+    if (heat_evictions != NULL)
+        heat_evictions[page]++;
+}
+
+
+/* Write out one latency histogram, leaving out empty buckets. */
+static void dump_latency(FILE *fp, const char *label, const unsigned int *hist) {
+    unsigned int total = 0;
+    int b;
+
+    for (b = 0; b < LATENCY_BUCKETS; b++)
+        total += hist[b];
+
+    fprintf(fp, "  %s (%u faults):\n", label, total);
+    for (b = 0; b < LATENCY_BUCKETS; b++) {
+        if (hist[b] == 0)
+            continue;
+
+        if (b == LATENCY_BUCKETS - 1)
+            fprintf(fp, "    >= %10llu ns %10u %6.1f%%\n", 1ULL << b, hist[b],
+                    100.0 * hist[b] / total);
+        else
+            fprintf(fp, "    %10llu ns+ %10u %6.1f%%\n", 1ULL << b, hist[b],
+                    100.0 * hist[b] / total);
+    }
+}
+
+
+/* Writes out the fault and eviction counts, and histograms of how long
+ * faults took to service.
+ */
+void vmem_dump_stats(FILE *fp) {
+    fprintf(fp, "Virtual memory statistics:\n");
+    fprintf(fp, "  faults %u, page loads %u\n", num_faults, num_loads);
+    fprintf(fp, "  evictions %u clean, %u dirty\n", num_clean_evictions,
+            num_dirty_evictions);
+    dump_latency(fp, "service time of faults that loaded a page",
+                 load_latency);
+    dump_latency(fp, "service time of permission faults", access_latency);
+}
+
+
+/* Starts counting loads, permission faults and evictions for every page. */
+void vmem_enable_heatmap() {
+    if (heat_loads != NULL)
+        return;
+
+    heat_loads = calloc(NUM_PAGES, sizeof(unsigned int));
+    heat_accesses = calloc(NUM_PAGES, sizeof(unsigned int));
+    heat_evictions = calloc(NUM_PAGES, sizeof(unsigned int));
+    if (heat_loads == NULL || heat_accesses == NULL || heat_evictions == NULL) {
+        fprintf(stderr, "vmem_enable_heatmap: out of memory\n");
+        abort();
+    }
+}
+
+
+/* Writes the heat map to the named file, one line for each page that was
+ * loaded, accessed or evicted.  Returns 0 on success, or -1 if the heat map
+ * isn't enabled or the file can't be written.
+ */
+int vmem_dump_heatmap(const char *filename) {
+    FILE *fp;
+    page_t page;
+
+    if (heat_loads == NULL)
+        return -1;
+
+    fp = fopen(filename, "w");
+    if (fp == NULL) {
+        perror(filename);
+        return -1;
+    }
+
+    fprintf(fp, "# page address loads access_faults evictions\n");
+    for (page = 0; page < NUM_PAGES; page++) {
+        if (heat_loads[page] == 0 && heat_accesses[page] == 0 &&
+            heat_evictions[page] == 0)
+            continue;
+
+        fprintf(fp, "%u %p %u %u %u\n", page, page_to_addr(page),
+                heat_loads[page], heat_accesses[page], heat_evictions[page]);
+    }
+
+    if (fclose(fp) != 0) {
+        perror(filename);
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Sets the number of pages that are mapped and evicted together. */
+void vmem_set_region_pages(unsigned int pages) {
+    assert(pages > 0 && (pages & (pages - 1)) == 0 && pages <= NUM_PAGES);
+    assert(num_resident == 0);
+
+    if (pages > max_resident) {
+        fprintf(stderr, "vmem_set_region_pages: a region of %u pages can't "
+                "fit in %u resident pages\n", pages, max_resident);
+        abort();
+    }
+    region_pages = pages;
+}
+
+
+static void spill_to_swap(page_t page, const void *data);
+
+
+/* Starts the compressed swap tier with a pool of the specified size. */
+void vmem_set_zswap(size_t bytes) {
+    zswap_init(bytes, spill_to_swap);
+}
+
+
+/* Returns the first page of the mapping region that the page is in. */
+static page_t region_start(page_t page) {
+    return page & ~(region_pages - 1);
+}
+
+
+/* Sets how many pages are read ahead when faults form a stream. */
+void vmem_set_readahead(unsigned int window) {
+    readahead_window = window;
+}
+
+
 /* Returns a string representation of the signal-code value from the SIGSEGV
  * signal details.
  */
@@ -164,13 +508,16 @@ const char *signal_code(int code) {
 void clear_page_entry(page_t page) {
     assert(page < NUM_PAGES);
     page_table[page] = 0;
+    BITMAP_CLEAR(resident_map, page);
+    BITMAP_CLEAR(accessed_map, page);
+    BITMAP_CLEAR(dirty_map, page);
 }
 
 
 /* Sets the specified page's "resident" bit in its page-table entry. */
 void set_page_resident(page_t page) {
     assert(page < NUM_PAGES);
-    page_table[page] |= PAGE_RESIDENT;
+    BITMAP_SET(resident_map, page);
 }
 
 
@@ -179,21 +526,21 @@ void set_page_resident(page_t page) {
  */
 int is_page_resident(page_t page) {
     assert(page < NUM_PAGES);
-    return page_table[page] & PAGE_RESIDENT;
+    return BITMAP_TEST(resident_map, page);
 }
 
 
 /* Sets the specified page's "accessed" bit in its page-table entry. */
 void set_page_accessed(page_t page) {
     assert(page < NUM_PAGES);
-    page_table[page] |= PAGE_ACCESSED;
+    BITMAP_SET(accessed_map, page);
 }
 
 
 /* Clears the specified page's "accessed" bit in its page-table entry. */
 void clear_page_accessed(page_t page) {
     assert(page < NUM_PAGES);
-    page_table[page] &= ~PAGE_ACCESSED;
+    BITMAP_CLEAR(accessed_map, page);
 }
 
 
@@ -202,21 +549,21 @@ void clear_page_accessed(page_t page) {
  */
 int is_page_accessed(page_t page) {
     assert(page < NUM_PAGES);
-    return page_table[page] & PAGE_ACCESSED;
+    return BITMAP_TEST(accessed_map, page);
 }
 
 
 /* Sets the specified page's "dirty" bit in its page-table entry. */
 void set_page_dirty(page_t page) {
     assert(page < NUM_PAGES);
-    page_table[page] |= PAGE_DIRTY;
+    BITMAP_SET(dirty_map, page);
 }
 
 
 /* Clears the specified page's "dirty" bit in its page-table entry. */
 void clear_page_dirty(page_t page) {
     assert(page < NUM_PAGES);
-    page_table[page] &= ~PAGE_DIRTY;
+    BITMAP_CLEAR(dirty_map, page);
 }
 
 
@@ -225,7 +572,137 @@ void clear_page_dirty(page_t page) {
  */
 int is_page_dirty(page_t page) {
     assert(page < NUM_PAGES);
-    return page_table[page] & PAGE_DIRTY;
+    return BITMAP_TEST(dirty_map, page);
+}
+
+
+/* Returns the first resident page at or after start whose bit in the bitmap,
+ * flipped if invert is set, is 1, or NUM_PAGES if there isn't one.  Whole
+ * words of 64 pages are looked at a time.
+ */
+static page_t scan_bitmap(const bitmap_word_t *map, int invert, page_t start) {
+    unsigned int w;
+    bitmap_word_t bits;
+
+    if (start >= NUM_PAGES)
+        return NUM_PAGES;
+
+    w = start / BITMAP_BITS;
+    bits = ((invert ? ~map[w] : map[w]) & resident_map[w]) &
+           (~(bitmap_word_t) 0 << (start % BITMAP_BITS));
+
+    while (bits == 0) {
+        if (++w == BITMAP_WORDS)
+            return NUM_PAGES;
+        bits = (invert ? ~map[w] : map[w]) & resident_map[w];
+    }
+
+    return w * BITMAP_BITS + __builtin_ctzll(bits);
+}
+
+
+/* Returns the first resident page at or after start that hasn't been
+ * accessed, or NUM_PAGES if there isn't one.
+ */
+page_t find_unaccessed_page(page_t start) {
+    return scan_bitmap(accessed_map, 1, start);
+}
+
+
+/* Returns the first resident page at or after start that has been accessed,
+ * or NUM_PAGES if there isn't one.
+ */
+page_t find_accessed_page(page_t start) {
+    return scan_bitmap(accessed_map, 0, start);
+}
+
+
+/* Returns the first resident page at or after start that is dirty, or
+ * NUM_PAGES if there isn't one.
+ */
+page_t find_dirty_page(page_t start) {
+    return scan_bitmap(dirty_map, 0, start);
+}
+
+
+/* Clears the accessed bit of every page, and takes the permission of each
+ * page that had it set away, so that its next access is noticed.  Adjacent
+ * pages are protected with one mprotect() call.  Returns how many pages had
+ * been accessed.
+ */
+unsigned int clear_accessed_pages() {
+    unsigned int w, count = 0;
+    bitmap_word_t bits, rest;
+    page_t first, page;
+    int lo, len;
+
+    for (w = 0; w < BITMAP_WORDS; w++) {
+        bits = accessed_map[w];
+        accessed_map[w] = 0;
+
+        /* Take one run of adjacent set bits at a time. */
+        while (bits != 0) {
+            lo = __builtin_ctzll(bits);
+            rest = ~(bits >> lo);
+            len = (rest != 0) ? __builtin_ctzll(rest) : BITMAP_BITS - lo;
+
+            first = w * BITMAP_BITS + lo;
+            if (mprotect(page_to_addr(first), (size_t) len * PAGE_SIZE,
+                         PROT_NONE) == -1) {
+                perror("mprotect");
+                abort();
+            }
+
+            for (page = first; page < first + len; page++) {
+                page_table[page] = (page_table[page] & ~PAGEPERM_MASK) |
+                                   PAGEPERM_NONE;
+            }
+
+            count += len;
+            bits &= ~(bitmap_word_t) 0 << (lo + len - 1) << 1;
+        }
+    }
+
+    return count;
+}
+
+
+/* Sets the specified page's "prefetched" bit in its page-table entry. */
+void set_page_prefetched(page_t page) {
+    assert(page < NUM_PAGES);
+    page_table[page] |= PAGE_PREFETCHED;
+}
+
+
+/* Clears the specified page's "prefetched" bit in its page-table entry. */
+void clear_page_prefetched(page_t page) {
+    assert(page < NUM_PAGES);
+    page_table[page] &= ~PAGE_PREFETCHED;
+}
+
+
+/* Sets the specified page's "region" bit in its page-table entry. */
+void set_page_region(page_t page) {
+    assert(page < NUM_PAGES);
+    page_table[page] |= PAGE_REGION;
+}
+
+
+/* Returns the specified page's "region" bit.  Nonzero means the page was
+ * mapped as part of a multi-page region, and is evicted with it.
+ */
+int is_page_region(page_t page) {
+    assert(page < NUM_PAGES);
+    return page_table[page] & PAGE_REGION;
+}
+
+
+/* Returns the specified page's "prefetched" bit.  Nonzero means the page was
+ * read ahead and hasn't been accessed since.
+ */
+int is_page_prefetched(page_t page) {
+    assert(page < NUM_PAGES);
+    return page_table[page] & PAGE_PREFETCHED;
 }
 
 
@@ -293,7 +770,14 @@ int pageperm_to_mmap(int perm) {
  * the virtual-memory code itself.
  */
 void map_page(page_t page, unsigned initial_perm);
+void map_pages(page_t first, unsigned count, unsigned initial_perm);
 void unmap_page(page_t page);
+static void read_ahead(page_t page);
+static void read_from_swap(page_t first, unsigned count, void *dest);
+static void copy_with_uffd(page_t first, unsigned count, const char *src);
+static void unmap_region(page_t first);
+static void set_region_permission(page_t first, int perm);
+static void * writeback_main(void *arg);
 static void sigsegv_handler(int signum, siginfo_t *infop, void *data);
 static void sigalrm_handler(int signum, siginfo_t *infop, void *data);
 
@@ -336,9 +820,24 @@ void * vmem_init(unsigned _max_resident) {
     num_resident = 0;
     max_resident = _max_resident;
     num_faults = 0;
+    num_clean_evictions = 0;
+    num_dirty_evictions = 0;
+    num_discards = 0;
+    memset(page_discarded, 0, sizeof(page_discarded));
+    memset(page_advice, 0, sizeof(page_advice));
+    memset(load_latency, 0, sizeof(load_latency));
+    memset(access_latency, 0, sizeof(access_latency));
+    num_prefetches = 0;
+    num_prefetch_hits = 0;
+    last_fault_page = 0;
+    fault_stride = 0;
+    stream_next = NUM_PAGES;
 
     /* Clear the entire page table. */
     memset(page_table, 0, sizeof(page_table));
+    memset(resident_map, 0, sizeof(resident_map));
+    memset(accessed_map, 0, sizeof(accessed_map));
+    memset(dirty_map, 0, sizeof(dirty_map));
 
     /* Initialize the page replacement policy. */
     if (policy_init() == -1) {
@@ -416,20 +915,41 @@ void * vmem_init(unsigned _max_resident) {
  * to the page can be detected.
  */
 void map_page(page_t page, unsigned initial_perm) {
-    int ret;
+    map_pages(page, 1, initial_perm);
+}
 
-    assert(page < NUM_PAGES);
+
+/* This function maps a run of count consecutive pages, starting at first, from
+ * the swap file into the virtual address space, with the same initial
+ * permission.  The whole run is mapped, read and protected with one system
+ * call each, since the pages are contiguous both in the address space and in
+ * the swap file.
+ *
+ * The pages are filled at a staging address and only then moved into place,
+ * so that another of the program's threads can never see a page that is only
+ * partly loaded:  until the move, an access to it faults, and waits for this
+ * fault to finish.
+ */
+void map_pages(page_t first, unsigned count, unsigned initial_perm) {
+    size_t size = (size_t) count * PAGE_SIZE;
+    page_t page;
+
+    assert(count > 0);
+    assert(first < NUM_PAGES && count <= NUM_PAGES - first);
     assert(initial_perm == PAGEPERM_NONE || initial_perm == PAGEPERM_READ ||
            initial_perm == PAGEPERM_RDWR);
-    assert(!is_page_resident(page));  /* Shouldn't already be mapped */
+
+    for (page = first; page < first + count; page++)
+        assert(!is_page_resident(page));  /* Shouldn't already be mapped */
 
 #if VERBOSE
-    fprintf(stderr, "Mapping in page %u.  Resident (before mapping) = %u, "
-           "max resident = %u.\n", page, num_resident, max_resident);
+    fprintf(stderr, "Mapping in pages %u..%u.  Resident (before mapping) = "
+           "%u, max resident = %u.\n", first, first + count - 1, num_resident,
+           max_resident);
 #endif
 
     /* Make sure we don't exceed the physical memory constraint. */
-    num_resident++;
+    num_resident += count;
     if (num_resident > max_resident) {
         fprintf(stderr, "map_page: exceeded physical memory, resident pages "
                 "= %u, max resident = %u\n", num_resident, max_resident);
@@ -438,134 +958,374 @@ void map_page(page_t page, unsigned initial_perm) {
 
     /*
      * Step 1:
-     * Add the page’s address-range to the process’ virtual memory.
-     * Use the flags MAP_FIXED | MAP_SHARED | MAP_ANONYMOUS to force mmap() to
-     * use the specified address, and to use the anonymous file so that the
-     * page will initially be filled with zeros.
+     * Add a staging address-range for the pages to the process' virtual
+     * memory.  Use the flags MAP_SHARED | MAP_ANONYMOUS to use the anonymous
+     * file so that the pages will initially be filled with zeros.
      */
 
-    /* Use mmap to add to virtual memory. */
-    void * vm_address = mmap(page_to_addr(page), PAGE_SIZE,
-        pageperm_to_mmap(PAGEPERM_RDWR), MAP_FIXED | MAP_SHARED | MAP_ANONYMOUS,
-        -1, 0);
+    /* Use mmap to add to virtual memory.  With userfaultfd, the staging
+     * buffer is always there, and only needs to be cleared.
+     */
+    char *staging;
+    if (uffd != -1) {
+        assert(count <= max_resident);
+        staging = uffd_staging;
+        memset(staging, 0, size);
+    }
+    else {
+        staging = mmap(NULL, size, pageperm_to_mmap(PAGEPERM_RDWR),
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    }
 
     /* Check that it worked. */
-    if (vm_address == (void *) -1) {
+    if (staging == (void *) -1) {
         perror("mmap");
         abort();
     }
-    if (vm_address != page_to_addr(page)) {
-        fprintf(stderr, "mmap: address changed\n");
-        abort();
-    }
 
     /*
      * Step 2:
-     * Seek to the start of the corresponding slot in the swap file, read the
-     * contents into the page.
+     * Fill the pages from the compressed pool if they are in it, and read the
+     * runs of the rest from their slots in the swap file.  A page from the
+     * pool whose swap-file copy is out of date is marked dirty, so that it is
+     * written back when it is evicted again.  Discarded pages are left as
+     * zeros.
      */
+    page = first;
+    while (page < first + count) {
+        char *dest = staging + (size_t) (page - first) * PAGE_SIZE;
+        page_t run;
+        int dirty;
+
+        if (page_discarded[page]) {
+            page++;
+        }
+        else if (zswap_load(page, dest, &dirty)) {
+            if (dirty)
+                set_page_dirty(page);
+            page++;
+        }
+        else {
+            for (run = page + 1; run < first + count &&
+                 !page_discarded[run] && !zswap_contains(run); run++)
+                ;
 
-    /* Seek. */
-    ret = lseek(fd_swapfile, page * PAGE_SIZE, (size_t) SEEK_SET);
-
-    /* Check that it worked. */
-    if (ret == -1) {
-        perror("lseek");
-        abort();
-    }
-
-    /* Read contents. */
-    ret = read(fd_swapfile, page_to_addr(page), (size_t) PAGE_SIZE);
-
-    /* Check that it worked. */
-    if (ret == -1) {
-        perror("read");
-        abort();
-    }
-    if (ret != PAGE_SIZE) {
-        fprintf(stderr, "read: only read %d bytes (%d expected)\n", ret,
-            PAGE_SIZE);
-        abort();
+            read_from_swap(page, run - page, dest);
+            page = run;
+        }
     }
 
     /*
      * Step 3:
-     * Update the page table entry for the page to be resident, and set the
-     * appropriate permissions on the page.
+     * Set the appropriate permissions on the pages, move them to their
+     * address, and update the page table entries for the pages to be
+     * resident.  With userfaultfd, the pages are copied into place instead,
+     * after their permissions are set, so that no other thread can get at
+     * them before the permission that tracks its accesses is in force.  The
+     * faulting thread is woken by the handler thread afterwards.
      */
-    set_page_resident(page);
-    set_page_permission(page, initial_perm);
+    if (uffd != -1) {
+        if (mprotect(page_to_addr(first), size,
+                     pageperm_to_mmap(initial_perm)) == -1) {
+            perror("mprotect");
+            abort();
+        }
+        copy_with_uffd(first, count, staging);
+    }
+    else {
+        if (mprotect(staging, size, pageperm_to_mmap(initial_perm)) == -1) {
+            perror("mprotect");
+            abort();
+        }
+
+        if (mremap(staging, size, size, MREMAP_MAYMOVE | MREMAP_FIXED,
+                   page_to_addr(first)) != page_to_addr(first)) {
+            perror("mremap");
+            abort();
+        }
+    }
 
+    for (page = first; page < first + count; page++) {
+        set_page_resident(page);
+        page_table[page] = (page_table[page] & ~PAGEPERM_MASK) | initial_perm;
 
-    assert(is_page_resident(page));  /* Now it should be mapped! */
-    num_loads++;
+        assert(is_page_resident(page));  /* Now it should be mapped! */
+        num_loads++;
 
-    /* Inform the paging policy that the page was mapped. */
-    policy_page_mapped(page);
+        /* Inform the paging policy that the page was mapped. */
+        policy_page_mapped(page);
+    }
 
 #if VERBOSE
-    fprintf(stderr, "Successfully mapped in page %u with initial "
+    fprintf(stderr, "Successfully mapped in pages %u..%u with initial "
         "permission %u.\n  Resident (after mapping) = %u.\n",
-        page, initial_perm, num_resident);
+        first, first + count - 1, initial_perm, num_resident);
 #endif
 }
 
 
-/* This function unmaps the specified page from the virtual address space,
- * making sure to write the contents of dirty pages back into the swap file.
+/* This function copies a run of count pages from src to their place in the
+ * virtual memory area, with UFFDIO_COPY, without waking the threads waiting
+ * on them.  A copy can be cut short, so it is repeated until the whole run is
+ * in.
  */
-void unmap_page(page_t page) {
-    int ret;
-
-    assert(page < NUM_PAGES);
-    assert(num_resident > 0);
-    assert(is_page_resident(page));
-
-
-    /*
-     * Step 1:
-     * If the page is dirty, seek to the start of the corresponding slot in the
-     * swap file and save the page’s contents to the slot.
-     */
-
-    /* Only if dirty. */
-    if (is_page_dirty(page)) {
-        /* Seek. */
-        ret = lseek(fd_swapfile, page * PAGE_SIZE, SEEK_SET);
-
-        /* Check that it worked. */
-        if (ret == -1) {
-            perror("lseek");
+static void copy_with_uffd(page_t first, unsigned count, const char *src) {
+    struct uffdio_copy copy;
+    size_t done = 0, size = (size_t) count * PAGE_SIZE;
+
+    while (done < size) {
+        copy.dst = (unsigned long) page_to_addr(first) + done;
+        copy.src = (unsigned long) src + done;
+        copy.len = size - done;
+        copy.mode = UFFDIO_COPY_MODE_DONTWAKE;
+        copy.copy = 0;
+
+        if (ioctl(uffd, UFFDIO_COPY, &copy) == -1 && errno != EAGAIN) {
+            perror("UFFDIO_COPY");
             abort();
         }
+        if (copy.copy > 0)
+            done += copy.copy;
+    }
+}
 
-        /* Save to slot, need to be able to read from page to write to slot. */
-        set_page_permission(page, PAGEPERM_READ);
-        ret = write(fd_swapfile, page_to_addr(page), PAGE_SIZE);
 
-        /* Check that it worked. */
-        if (ret == -1) {
-            perror("write");
-            abort();
-        }
-        if (ret != PAGE_SIZE) {
-            fprintf(stderr, "write: only wrote %d bytes (%d expected)\n", ret,
-                PAGE_SIZE);
+/* This function takes a run of count pages out of the address space, without
+ * saving their contents.  With userfaultfd, the range stays mapped, and the
+ * pages are dropped and only then made read-write again, so that the next
+ * access to any of them is reported as a missing page.
+ */
+static void release_pages(page_t first, unsigned count) {
+    size_t size = (size_t) count * PAGE_SIZE;
+
+    if (uffd == -1) {
+        if (munmap(page_to_addr(first), size) == -1) {
+            perror("munmap");
             abort();
         }
+        return;
     }
 
-    /*
-     * Step 2:
-     * Remove the page’s address-range from the process’ virtual address space.
-     */
-    ret = munmap(page_to_addr(page), PAGE_SIZE);
+    if (madvise(page_to_addr(first), size, MADV_DONTNEED) == -1) {
+        perror("madvise");
+        abort();
+    }
+    if (mprotect(page_to_addr(first), size, PROT_READ | PROT_WRITE) == -1) {
+        perror("mprotect");
+        abort();
+    }
+}
+
+
+/* This function reads a run of pages from their slots in the swap file into
+ * memory at dest.  pread() seeks and reads in one call.
+ */
+static void read_from_swap(page_t first, unsigned count, void *dest) {
+    size_t size = (size_t) count * PAGE_SIZE;
+    ssize_t ret;
+
+    ret = pread(fd_swapfile, dest, size, (off_t) first * PAGE_SIZE);
 
     /* Check that it worked. */
     if (ret == -1) {
-        perror("munmap");
+        perror("read");
+        abort();
+    }
+    if (ret != (ssize_t) size) {
+        fprintf(stderr, "read: only read %zd bytes (%zu expected)\n", ret,
+            size);
         abort();
     }
+}
+
+
+/* This function writes a page that the compressed pool is spilling to its slot
+ * in the swap file.
+ */
+static void spill_to_swap(page_t page, const void *data) {
+    ssize_t ret;
+
+    ret = pwrite(fd_swapfile, data, PAGE_SIZE, (off_t) page * PAGE_SIZE);
+    if (ret != PAGE_SIZE) {
+        perror("write");
+        abort();
+    }
+}
+
+
+/* This function is called when a fault lands on a page advised as
+ * sequential.  The pages up to window pages behind the one before it are
+ * marked as not accessed, and have their permission taken away so that a
+ * later access is still noticed, since a sequential stream won't come back
+ * to them.
+ */
+static void drop_behind(page_t page, unsigned int window) {
+    page_t behind;
+    unsigned int i;
+
+    for (i = 2; i < window + 2 && i <= page; i++) {
+        behind = page - i;
+        if (!is_page_resident(behind) ||
+            page_advice[behind] != VMEM_SEQUENTIAL)
+            break;
+
+        clear_page_accessed(behind);
+        set_page_permission(behind, PAGEPERM_NONE);
+    }
+}
+
+
+/* This function is called after a page has been loaded to resolve a fault.
+ * If the loads have been following a stream, either of consecutive pages or
+ * of pages a fixed stride apart, up to readahead_window of the next pages in
+ * the stream are loaded too, and marked as prefetched.  Pages are evicted to
+ * make room for them, but never the page that just faulted, and readahead
+ * only ever takes up half of the resident pages, so that a stream can't
+ * flush out everything else.  Pages advised as sequential always form an
+ * ascending stream, and pages advised as random never do.
+ */
+static void read_ahead(page_t page) {
+    int stride, in_stream;
+    unsigned int window, count, limit, i;
+    long next;
+
+    if (page_advice[page] == VMEM_RANDOM)
+        return;
+
+    window = readahead_window;
+    if (page_advice[page] == VMEM_SEQUENTIAL) {
+        if (window == 0)
+            window = SEQUENTIAL_READAHEAD;
+        drop_behind(page, window);
+
+        in_stream = 1;
+        fault_stride = 1;
+    }
+
+    /* Follow the stream.  A load where a readahead said the stream would
+     * fault next continues it; otherwise two loads in a row the same
+     * distance apart start one.
+     */
+    else {
+        stride = (int) page - (int) last_fault_page;
+        if (page == stream_next && fault_stride != 0) {
+            in_stream = 1;
+        }
+        else {
+            in_stream = (stride == fault_stride && stride != 0 &&
+                         abs(stride) <= MAX_READAHEAD_STRIDE);
+            fault_stride = stride;
+        }
+    }
+    last_fault_page = page;
+    stream_next = NUM_PAGES;
+
+    if (!in_stream || window == 0)
+        return;
+    stride = fault_stride;
+
+    /* Count the pages ahead that aren't resident yet, stopping where the
+     * advice changes.
+     */
+    limit = window;
+    if (limit > max_resident / 2)
+        limit = max_resident / 2;
+
+    for (count = 0; count < limit; count++) {
+        next = (long) page + (long) (count + 1) * stride;
+        if (next < 0 || next >= NUM_PAGES || is_page_resident((page_t) next) ||
+            page_advice[next] != page_advice[page])
+            break;
+    }
+
+    /* Make room for them. */
+    while (count > 0 && num_resident + count > max_resident) {
+        page_t victim = choose_victim_page();
+        assert(is_page_resident(victim));
+        if (victim == page) {
+            count = max_resident - num_resident;
+            break;
+        }
+        unmap_page(victim);
+    }
+
+    if (count == 0)
+        return;
+
+    /* Load them, as one run if they are consecutive. */
+    if (stride == 1)
+        map_pages(page + 1, count, PAGEPERM_NONE);
+    else if (stride == -1)
+        map_pages(page - count, count, PAGEPERM_NONE);
+    else {
+        for (i = 1; i <= count; i++)
+            map_page(page + i * stride, PAGEPERM_NONE);
+    }
+
+    for (i = 1; i <= count; i++)
+        set_page_prefetched(page + i * stride);
+    num_prefetches += count;
+
+    next = (long) page + (long) (count + 1) * stride;
+    if (next >= 0 && next < NUM_PAGES)
+        stream_next = (page_t) next;
+}
+
+
+/* This function unmaps the specified page from the virtual address space,
+ * making sure to write the contents of dirty pages back into the swap file.
+ */
+void unmap_page(page_t page) {
+    int ret, stored = 0;
+
+    assert(page < NUM_PAGES);
+    assert(num_resident > 0);
+    assert(is_page_resident(page));
+
+
+    /*
+     * Step 1:
+     * Keep the page in the compressed pool if it is on and the page compresses
+     * well.  Otherwise, if the page is dirty, seek to the start of the
+     * corresponding slot in the swap file and save the page’s contents to the
+     * slot.
+     */
+    record_eviction(page);
+
+    if (zswap_should_try(is_page_dirty(page))) {
+        set_page_permission(page, PAGEPERM_READ);
+        stored = zswap_store(page, page_to_addr(page), is_page_dirty(page));
+        if (stored)
+            page_discarded[page] = 0;
+    }
+
+    /* Only if dirty. */
+    if (!stored && is_page_dirty(page)) {
+        /* Save to slot, need to be able to read from page to write to slot.
+         * pwrite() seeks and writes in one call.
+         */
+        set_page_permission(page, PAGEPERM_READ);
+        ret = pwrite(fd_swapfile, page_to_addr(page), PAGE_SIZE,
+                     (off_t) page * PAGE_SIZE);
+
+        /* Check that it worked. */
+        if (ret == -1) {
+            perror("write");
+            abort();
+        }
+        if (ret != PAGE_SIZE) {
+            fprintf(stderr, "write: only wrote %d bytes (%d expected)\n", ret,
+                PAGE_SIZE);
+            abort();
+        }
+        page_discarded[page] = 0;
+    }
+
+    /*
+     * Step 2:
+     * Remove the page’s address-range from the process’ virtual address space.
+     */
+    release_pages(page, 1);
 
     /*
      * Step 3:
@@ -582,11 +1342,313 @@ void unmap_page(page_t page) {
 }
 
 
+/* This function unmaps the whole mapping region that starts at the specified
+ * page.  Each page is offered to the compressed pool as unmap_page() does,
+ * runs of the remaining dirty pages are written back with one call each, and
+ * the region is unmapped with one call.
+ */
+static void unmap_region(page_t first) {
+    size_t size = (size_t) region_pages * PAGE_SIZE;
+    page_t page, run;
+    ssize_t ret;
+
+    assert(first == region_start(first));
+    assert(num_resident >= region_pages);
+
+    /* Writing the pages out needs them to be readable. */
+    if (mprotect(page_to_addr(first), size, PROT_READ) == -1) {
+        perror("mprotect");
+        abort();
+    }
+
+    /* A page that the pool takes needn't be written back, so its dirty bit is
+     * cleared; the pool remembers whether its swap-file copy is out of date.
+     */
+    for (page = first; page < first + region_pages; page++) {
+        assert(is_page_resident(page) && is_page_region(page));
+        record_eviction(page);
+
+        if (zswap_should_try(is_page_dirty(page)) &&
+            zswap_store(page, page_to_addr(page), is_page_dirty(page))) {
+            page_discarded[page] = 0;
+            clear_page_dirty(page);
+        }
+    }
+
+    page = first;
+    while (page < first + region_pages) {
+        if (!is_page_dirty(page)) {
+            page++;
+            continue;
+        }
+
+        for (run = page; run < first + region_pages && is_page_dirty(run); run++)
+            ;
+
+        ret = pwrite(fd_swapfile, page_to_addr(page),
+                     (size_t) (run - page) * PAGE_SIZE, (off_t) page * PAGE_SIZE);
+        if (ret != (ssize_t) (run - page) * PAGE_SIZE) {
+            perror("write");
+            abort();
+        }
+        for (; page < run; page++)
+            page_discarded[page] = 0;
+    }
+
+    release_pages(first, region_pages);
+
+    for (page = first; page < first + region_pages; page++) {
+        clear_page_entry(page);
+        num_resident--;
+
+        /* Inform the paging policy that the page was unmapped. */
+        policy_page_unmapped(page);
+    }
+}
+
+
+/* This function sets the permission of every page in the mapping region that
+ * starts at the specified page with one call.
+ */
+static void set_region_permission(page_t first, int perm) {
+    page_t page;
+
+    if (mprotect(page_to_addr(first), (size_t) region_pages * PAGE_SIZE,
+                 pageperm_to_mmap(perm)) == -1) {
+        perror("mprotect");
+        abort();
+    }
+
+    for (page = first; page < first + region_pages; page++)
+        page_table[page] = (page_table[page] & ~PAGEPERM_MASK) | perm;
+}
+
+
+/* These functions take and release the lock outside of the signal handlers.
+ * The timer's handler takes the lock too, so SIGALRM is blocked while it is
+ * held.
+ */
+static void lock_vm(sigset_t *old_mask) {
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &mask, old_mask);
+    pthread_mutex_lock(&vm_lock);
+}
+
+
+static void unlock_vm(const sigset_t *old_mask) {
+    pthread_mutex_unlock(&vm_lock);
+    pthread_sigmask(SIG_SETMASK, old_mask, NULL);
+}
+
+
+/* This function discards the contents of every whole page in a range.  In
+ * single-page mapping, the resident pages are unmapped with one call, dirty
+ * or not.  In region mapping, only the regions wholly inside the range are
+ * unmapped; the resident pages of the regions at its ends are just marked
+ * clean, and made read-only if they were writable, so that they are only
+ * written back if they are written again.
+ */
+void vmem_discard(void *addr, size_t len) {
+    char *start = addr, *end = start + len;
+    page_t first, last, page;
+    sigset_t old_mask;
+
+    if (start < (char *) vmem_start)
+        start = vmem_start;
+    if (end > (char *) vmem_end)
+        end = vmem_end;
+    if (start >= end)
+        return;
+
+    /* Only whole pages are discarded. */
+    first = (start - (char *) vmem_start + PAGE_SIZE - 1) / PAGE_SIZE;
+    last = (end - (char *) vmem_start) / PAGE_SIZE;
+    if (first >= last)
+        return;
+
+    lock_vm(&old_mask);
+
+    if (region_pages == 1)
+        release_pages(first, last - first);
+
+    for (page = first; page < last; page++) {
+        page_discarded[page] = 1;
+        zswap_drop(page);
+
+        if (!is_page_resident(page))
+            continue;
+
+        if (region_pages > 1 && (region_start(page) < first ||
+                                 region_start(page) + region_pages > last)) {
+            if (get_page_permission(page) == PAGEPERM_RDWR)
+                set_region_permission(region_start(page), PAGEPERM_READ);
+            clear_page_dirty(page);
+            continue;
+        }
+
+        if (region_pages > 1 && page == region_start(page))
+            release_pages(page, region_pages);
+
+        clear_page_entry(page);
+        num_resident--;
+        num_discards++;
+
+        /* Inform the paging policy that the page was unmapped. */
+        policy_page_unmapped(page);
+    }
+
+    unlock_vm(&old_mask);
+}
+
+
+/* This function loads the pages from first up to last that aren't resident,
+ * a run at a time, as if they had been read ahead, until half of the maximum
+ * resident pages have been loaded.  Victims are evicted to make room, but it
+ * stops if the policy would evict a page in the range.
+ */
+static void will_need(page_t first, page_t last) {
+    unsigned int limit = max_resident / 2, loaded = 0, count, i;
+    page_t page = first, victim;
+
+    while (page < last && loaded < limit) {
+        if (is_page_resident(page)) {
+            page++;
+            continue;
+        }
+
+        for (count = 1; page + count < last && loaded + count < limit &&
+             !is_page_resident(page + count); count++)
+            ;
+
+        /* Make room for the run. */
+        while (num_resident + count > max_resident) {
+            victim = choose_victim_page();
+            assert(is_page_resident(victim));
+            if (victim >= first && victim < last) {
+                count = max_resident - num_resident;
+                break;
+            }
+            unmap_page(victim);
+        }
+
+        if (count == 0)
+            break;
+
+        map_pages(page, count, PAGEPERM_NONE);
+        for (i = 0; i < count; i++)
+            set_page_prefetched(page + i);
+
+        num_prefetches += count;
+        loaded += count;
+        page += count;
+    }
+}
+
+
+/* This function records a hint about how a range will be used, or acts on
+ * it straight away.  See virtualmem.h.
+ */
+int vmem_advise(void *addr, size_t len, int advice) {
+    char *start = addr, *end = start + len;
+    page_t first, last, page;
+    sigset_t old_mask;
+
+    if (advice == VMEM_DONTNEED) {
+        vmem_discard(addr, len);
+        return 0;
+    }
+
+    if (advice != VMEM_NORMAL && advice != VMEM_SEQUENTIAL &&
+        advice != VMEM_RANDOM && advice != VMEM_WILLNEED)
+        return -1;
+
+    if (start < (char *) vmem_start)
+        start = vmem_start;
+    if (end > (char *) vmem_end)
+        end = vmem_end;
+    if (start >= end)
+        return 0;
+
+    /* Every page that the range touches. */
+    first = (start - (char *) vmem_start) / PAGE_SIZE;
+    last = (end - (char *) vmem_start + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    lock_vm(&old_mask);
+
+    if (advice == VMEM_WILLNEED) {
+        if (region_pages == 1)
+            will_need(first, last);
+    }
+    else {
+        for (page = first; page < last; page++)
+            page_advice[page] = advice;
+    }
+
+    unlock_vm(&old_mask);
+    return 0;
+}
+
+
 /*============================================================================
  * Signal Handlers for the Virtual Memory System
  */
 
 
+/* This function loads the page that a missing-page fault landed on, with
+ * the rest of its region or the pages read ahead of it, evicting pages to
+ * make room.  The caller must hold vm_lock.
+ */
+static void load_faulting_page(page_t page) {
+    if (region_pages > 1) {
+        /* Evict whole regions until the page's region fits. */
+        page_t first = region_start(page), victim, p;
+
+        while (num_resident + region_pages > max_resident) {
+            victim = choose_victim_page();
+            assert(is_page_resident(victim));
+            unmap_region(region_start(victim));
+            assert(!is_page_resident(victim));
+        }
+
+        /* Load the whole region, with no permissions initially. */
+        map_pages(first, region_pages, PAGEPERM_NONE);
+        for (p = first; p < first + region_pages; p++)
+            set_page_region(p);
+    }
+    else {
+        /* Evict a page. */
+        assert(num_resident <= max_resident);
+        if (num_resident == max_resident) {
+            page_t victim = choose_victim_page();
+            assert(is_page_resident(victim));
+            unmap_page(victim);
+            assert(!is_page_resident(victim));
+        }
+
+        /*
+         * There should now be space, so load the new page. No permissions
+         * initially.
+         */
+        assert(num_resident < max_resident);
+        map_page(page, PAGEPERM_NONE);
+
+        /* Load the pages that a stream of faults is going to want next. */
+        read_ahead(page);
+    }
+}
+
+
+/* Account for a fault that loaded the page, and started at start ns. */
+static void record_load(page_t page, unsigned long long start) {
+    record_latency(load_latency, now_ns() - start);
+    if (heat_loads != NULL)
+        heat_loads[page]++;
+}
+
+
 /* This function is the SIGSEGV handler for the virtual memory system.  If the
  * faulting address is within the user-space virtual memory pool then this
  * function responds appropriately to allow the faulting operation to be
@@ -597,9 +1659,12 @@ void unmap_page(page_t page) {
  * a timer interrupt will never interrupt the segmentation-fault handler.
  */
 static void sigsegv_handler(int signum, siginfo_t *infop, void *data) {
+    unsigned long long start = now_ns();
     void *addr;
     page_t page;
 
+    PROBE_BEGIN(fault_probe);
+
     /* Only handle SIGSEGVs addresses in range */
     addr = infop->si_addr;
     if (addr < vmem_start || addr >= vmem_end) {
@@ -607,6 +1672,7 @@ static void sigsegv_handler(int signum, siginfo_t *infop, void *data) {
         abort();
     }
 
+    pthread_mutex_lock(&vm_lock);
     num_faults++;
 
     /* Figure out what page generated the fault. */
@@ -625,27 +1691,52 @@ static void sigsegv_handler(int signum, siginfo_t *infop, void *data) {
      */
     assert(infop->si_code == SEGV_MAPERR || infop->si_code == SEGV_ACCERR);
 
+    /* Another thread may have resolved the fault while this one waited for
+     * the lock, by loading the page, by evicting it, or by raising it to
+     * read-write.  Then the access is just retried, and faults again if it
+     * still needs to.  A read that finds the page already made readable by
+     * another thread makes it read-write, since the handler can't tell reads
+     * from writes; at worst, a clean page is written back.
+     */
+    if (infop->si_code == SEGV_MAPERR ? is_page_resident(page) :
+        (!is_page_resident(page) ||
+         get_page_permission(page) == PAGEPERM_RDWR)) {
+        pthread_mutex_unlock(&vm_lock);
+        PROBE_COUNT(retried_probe);
+        PROBE_END(fault_probe);
+        return;
+    }
+
     /* Map the page into memory so that the fault can be resolved.  Of course,
      * this may result in some other page being unmapped.
      */
+    if (infop->si_code == SEGV_MAPERR)
+        load_faulting_page(page);
 
-    /* Handle unmapped address (SEGV_MAPERR). */
-    if (infop->si_code == SEGV_MAPERR) {
-        /* Evict a page. */
-        assert(num_resident <= max_resident);
-        if (num_resident == max_resident) {
-            page_t victim = choose_victim_page();
-            assert(is_page_resident(victim));
-            unmap_page(victim);
-            assert(!is_page_resident(victim));
-        }
+    /* An access to a region raises the permission of the whole region, and
+     * marks every page in it accessed, and dirty for a write.
+     */
+    else if (is_page_region(page)) {
+        page_t first = region_start(page), p;
 
-        /*
-         * There should now be space, so load the new page. No permissions
-         * initially.
-         */
-        assert(num_resident < max_resident);
-        map_page(page, PAGEPERM_NONE);
+        for (p = first; p < first + region_pages; p++)
+            set_page_accessed(p);
+
+        switch(get_page_permission(page)) {
+            case PAGEPERM_NONE:
+                set_region_permission(first, PAGEPERM_READ);
+                break;
+            case PAGEPERM_READ:
+                set_region_permission(first, PAGEPERM_RDWR);
+                for (p = first; p < first + region_pages; p++)
+                    set_page_dirty(p);
+                break;
+            case PAGEPERM_RDWR:
+                fprintf(stderr, "sigsegv_handler: got unpermitted access error \
+                    on page that already has read-write permission.\n");
+                abort();
+                break;
+        }
     }
 
     /* Handle unpermitted access (SEGV_ACCERR). */
@@ -654,6 +1745,12 @@ static void sigsegv_handler(int signum, siginfo_t *infop, void *data) {
         set_page_accessed(page);
         assert(is_page_accessed(page));
 
+        /* A page that was read ahead has turned out to be wanted. */
+        if (is_page_prefetched(page)) {
+            clear_page_prefetched(page);
+            num_prefetch_hits++;
+        }
+
         switch(get_page_permission(page)) {
             case PAGEPERM_NONE:
                 /*
@@ -677,6 +1774,19 @@ static void sigsegv_handler(int signum, siginfo_t *infop, void *data) {
                 break;
         }
     }
+
+    /* Account for the fault. */
+    if (infop->si_code == SEGV_MAPERR) {
+        record_load(page, start);
+    }
+    else {
+        record_latency(access_latency, now_ns() - start);
+        if (heat_accesses != NULL)
+            heat_accesses[page]++;
+    }
+
+    pthread_mutex_unlock(&vm_lock);
+    PROBE_END(fault_probe);
 }
 
 
@@ -696,7 +1806,254 @@ static void sigalrm_handler(int signum, siginfo_t *infop, void *data) {
     /* All we have to do is inform the page replacement policy that a timer
      * tick occurred!
      */
+    pthread_mutex_lock(&vm_lock);
     policy_timer_tick();
+    pthread_mutex_unlock(&vm_lock);
 }
 
 
+/*============================================================================
+ * Background Writeback
+ */
+
+
+/* Write out a run of count adjacent resident dirty pages with one call, and
+ * mark them clean.  Each page is made read-only first, so that a write to it
+ * faults and marks it dirty again; a page with no permission is only made
+ * readable for the write, and then put back, so that its next access is
+ * still noticed.  The caller must hold vm_lock.
+ */
+static void write_back_run(page_t first, unsigned count) {
+    size_t size = (size_t) count * PAGE_SIZE;
+    page_t page;
+    ssize_t ret;
+
+    for (page = first; page < first + count; page++) {
+        if (get_page_permission(page) == PAGEPERM_RDWR)
+            set_page_permission(page, PAGEPERM_READ);
+        else if (get_page_permission(page) == PAGEPERM_NONE)
+            mprotect(page_to_addr(page), PAGE_SIZE, PROT_READ);
+    }
+
+    ret = pwrite(fd_swapfile, page_to_addr(first), size,
+                 (off_t) first * PAGE_SIZE);
+    if (ret != (ssize_t) size) {
+        perror("writeback");
+        abort();
+    }
+
+    for (page = first; page < first + count; page++) {
+        if (get_page_permission(page) == PAGEPERM_NONE)
+            set_page_permission(page, PAGEPERM_NONE);
+        clear_page_dirty(page);
+        page_discarded[page] = 0;
+    }
+
+    num_writebacks += count;
+    num_writeback_calls++;
+}
+
+
+/* The writeback thread repeatedly sweeps the page table, cleaning runs of
+ * adjacent dirty pages, so that the victims that faults choose are usually
+ * clean and can simply be dropped.  The lock is only held for one run at a
+ * time, so a fault waits for at most one write.
+ */
+static void * writeback_main(void *arg) {
+    page_t page, first;
+    unsigned count;
+
+    while (1) {
+        page = 0;
+        while (page < NUM_PAGES) {
+            pthread_mutex_lock(&vm_lock);
+
+            /* Find the next dirty page, and the run of them that it starts. */
+            page = find_dirty_page(page);
+
+            first = page;
+            count = 0;
+            while (page < NUM_PAGES && count < WRITEBACK_BATCH &&
+                   is_page_resident(page) && is_page_dirty(page)) {
+                page++;
+                count++;
+            }
+
+            if (count > 0)
+                write_back_run(first, count);
+
+            pthread_mutex_unlock(&vm_lock);
+        }
+
+        usleep(WRITEBACK_INTERVAL_USEC);
+    }
+
+    return NULL;
+}
+
+
+/* Start the writeback thread, with the virtual memory system's signals
+ * blocked, so that only the program's own thread handles them.
+ */
+void vmem_start_writeback() {
+    pthread_t thread;
+    sigset_t mask, old_mask;
+
+    if (writeback_running)
+        return;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGSEGV);
+    sigaddset(&mask, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+
+    if (pthread_create(&thread, NULL, writeback_main, NULL) != 0) {
+        fprintf(stderr, "vmem_start_writeback: can't create the thread\n");
+        abort();
+    }
+    pthread_detach(thread);
+
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    writeback_running = 1;
+}
+
+
+
+
+/*============================================================================
+ * Userfaultfd Backend
+ */
+
+
+/* The userfaultfd handler thread reads the missing-page faults one at a time,
+ * loads each page as the SIGSEGV handler would, and then wakes the threads
+ * that faulted on it.  If another fault has already loaded the page, they are
+ * just woken.
+ */
+static void * uffd_main(void *arg) {
+    struct uffd_msg msg;
+    struct uffdio_range range;
+    unsigned long long start;
+    page_t page;
+    ssize_t ret;
+
+    while (1) {
+        ret = read(uffd, &msg, sizeof(msg));
+        if (ret == -1 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (ret != sizeof(msg)) {
+            perror("read(userfaultfd)");
+            abort();
+        }
+
+        if (msg.event != UFFD_EVENT_PAGEFAULT)
+            continue;
+
+        start = now_ns();
+        page = addr_to_page((void *) (unsigned long) msg.arg.pagefault.address);
+
+#if VERBOSE
+        fprintf(stderr,
+            "================================================================\n");
+        fprintf(stderr, "userfaultfd:  Address %p, Page %u\n",
+                (void *) (unsigned long) msg.arg.pagefault.address, page);
+#endif
+
+        pthread_mutex_lock(&vm_lock);
+        num_faults++;
+        if (!is_page_resident(page)) {
+            load_faulting_page(page);
+            record_load(page, start);
+        }
+        pthread_mutex_unlock(&vm_lock);
+
+        range.start = (unsigned long) page_to_addr(page);
+        range.len = PAGE_SIZE;
+        if (ioctl(uffd, UFFDIO_WAKE, &range) == -1) {
+            perror("UFFDIO_WAKE");
+            abort();
+        }
+    }
+
+    return NULL;
+}
+
+
+/* Report missing pages through a userfaultfd instead of SIGSEGV.  The whole
+ * virtual memory area is mapped read-write and registered with it, so that a
+ * first access to a page that isn't resident blocks the thread, and a
+ * dedicated thread resolves the fault.  Evicted pages are dropped with
+ * MADV_DONTNEED rather than unmapped.  Permission faults, which track
+ * accesses and writes, still arrive as SIGSEGVs.
+ */
+int vmem_use_userfaultfd() {
+    struct uffdio_api api;
+    struct uffdio_register reg;
+    size_t size = (size_t) NUM_PAGES * PAGE_SIZE;
+    pthread_t thread;
+    sigset_t mask, old_mask;
+
+    assert(uffd == -1);
+    assert(num_loads == 0);
+
+    /* Only faults from user space are wanted, where the kernel allows it. */
+    uffd = syscall(SYS_userfaultfd, O_CLOEXEC | UFFD_USER_MODE_ONLY);
+    if (uffd == -1)
+        uffd = syscall(SYS_userfaultfd, O_CLOEXEC);
+    if (uffd == -1) {
+        perror("userfaultfd");
+        return -1;
+    }
+
+    memset(&api, 0, sizeof(api));
+    api.api = UFFD_API;
+    if (ioctl(uffd, UFFDIO_API, &api) == -1) {
+        perror("UFFDIO_API");
+        goto fail;
+    }
+
+    if (mmap(vmem_start, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0) !=
+        vmem_start) {
+        perror("mmap");
+        goto fail;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.range.start = (unsigned long) vmem_start;
+    reg.range.len = size;
+    reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+    if (ioctl(uffd, UFFDIO_REGISTER, &reg) == -1) {
+        perror("UFFDIO_REGISTER");
+        munmap(vmem_start, size);
+        goto fail;
+    }
+
+    uffd_staging = mmap(NULL, (size_t) max_resident * PAGE_SIZE,
+                        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1, 0);
+    if (uffd_staging == (void *) -1) {
+        perror("mmap");
+        abort();
+    }
+
+    /* The thread mustn't take the virtual memory system's signals. */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGSEGV);
+    sigaddset(&mask, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+
+    if (pthread_create(&thread, NULL, uffd_main, NULL) != 0) {
+        fprintf(stderr, "vmem_use_userfaultfd: can't create the thread\n");
+        abort();
+    }
+    pthread_detach(thread);
+
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    return 0;
+
+fail:
+    close(uffd);
+    uffd = -1;
+    return -1;
+}
@@ -6,6 +6,9 @@
 #ifndef VIRTUALMEM_H
 #define VIRTUALMEM_H
 
+#include <stddef.h>
+#include <stdio.h>
+
 
 /* When debugging virtual memory, setting this to 1 will result in a lot of
  * details being output to standard error.
@@ -39,8 +42,12 @@ typedef unsigned char pte_t;
 #define PAGE_RESIDENT 0x01   /* Is the page resident in memory? */
 #define PAGE_ACCESSED 0x02   /* Has the page been accessed?     */
 #define PAGE_DIRTY    0x04   /* Has the page been modified?     */
+#define PAGE_PREFETCHED 0x08 /* Was the page read ahead, and not
+                              * accessed since?                 */
+#define PAGE_REGION   0x80   /* Is the page part of a multi-page
+                              * mapping region?                 */
 
-#define PAGEPERM_MASK 0xF0   /* A mask for extracting the permission value. */
+#define PAGEPERM_MASK 0x70   /* A mask for extracting the permission value. */
 
 #define PAGEPERM_NONE 0x10   /* No access is permitted.         */
 #define PAGEPERM_READ 0x20   /* Read-only access is permitted.  */
@@ -57,9 +64,29 @@ int is_page_accessed(page_t page);
 void set_page_dirty(page_t page);
 void clear_page_dirty(page_t page);
 int is_page_dirty(page_t page);
+void set_page_prefetched(page_t page);
+void clear_page_prefetched(page_t page);
+int is_page_prefetched(page_t page);
+void set_page_region(page_t page);
+int is_page_region(page_t page);
 int get_page_permission(page_t page);
 void set_page_permission(page_t page, int perm);
 
+/* The resident, accessed and dirty bits are kept in bitmaps, so that these
+ * can look over many pages at once.  Each returns the first resident page at
+ * or after start with the bit set, or clear for find_unaccessed_page(), or
+ * NUM_PAGES if there is none.
+ */
+page_t find_unaccessed_page(page_t start);
+page_t find_accessed_page(page_t start);
+page_t find_dirty_page(page_t start);
+
+/* Clear every page's accessed bit, and set each page that had it to
+ * PAGEPERM_NONE, so that its next access is noticed.  Returns the number of
+ * pages that had been accessed.
+ */
+unsigned int clear_accessed_pages();
+
 /* This function translates permission values from page-table entries into the
  * corresponding permissions for mmap() and mprotect() to use.
  */
@@ -80,8 +107,112 @@ void * get_vmem_end();
 void * page_to_addr(page_t page);
 page_t addr_to_page(void *addr);
 
-/* Return statistics about the virtual memory system. */
+/* Set how many pages past a fault are read ahead when the faults form a
+ * sequential or strided stream.  0, the default, turns readahead off.
+ */
+void vmem_set_readahead(unsigned int window);
+
+/* Set the mapping granularity to regions of the specified number of pages,
+ * which must be a power of two no larger than the maximum number of resident
+ * pages; for example 16 for 64 KiB regions, or 512 for 2 MiB ones.  A fault
+ * maps the whole aligned region that the page is in, all of its pages are
+ * evicted together, and a change of permission applies to the whole region,
+ * so a region is accessed and dirtied as a unit.  The default is 1, which maps
+ * single pages; readahead only applies then.  This must be called before the
+ * first fault.
+ */
+void vmem_set_region_pages(unsigned int pages);
+
+/* Start a compressed in-memory swap tier, holding up to the specified number
+ * of bytes of evicted pages, so that faulting them back in doesn't read the
+ * swap file.  Pages that are all zeros cost nothing.  This only applies to
+ * single-page mapping.  See vmzswap.h.
+ */
+void vmem_set_zswap(size_t bytes);
+
+/* Start a background thread that writes dirty pages back to the swap file
+ * ahead of their eviction, batching adjacent pages into single writes, so that
+ * faults can usually drop a clean victim instead of writing it out.
+ */
+void vmem_start_writeback();
+
+/* Report the first access to a page that isn't resident through a Linux
+ * userfaultfd, instead of as a SIGSEGV.  A dedicated thread loads the page
+ * with UFFDIO_COPY while the faulting thread waits in the kernel, so no
+ * signal is delivered for a missing page; permission faults, which track
+ * accesses and writes, are still SIGSEGVs.  This must be called before the
+ * first fault.  Returns 0, or -1 if the kernel doesn't allow userfaultfd, in
+ * which case SIGSEGV is still used.
+ */
+int vmem_use_userfaultfd();
+
+/* Discard the contents of every whole page in the range from addr for len
+ * bytes, because nothing uses them any more.  Resident pages are unmapped
+ * without being written back, copies in the compressed pool are dropped, and
+ * the pages read as zeros when they are next faulted in, without reading the
+ * swap file.  This must not be called from a signal handler.
+ */
+void vmem_discard(void *addr, size_t len);
+
+/* Hints about how a range of the virtual memory area will be used, in the
+ * style of madvise():
+ *
+ * VMEM_NORMAL     Forget any earlier hint about the range.
+ * VMEM_SEQUENTIAL The range will be read in ascending order.  A fault in it
+ *                 always reads ahead, readahead window pages or
+ *                 SEQUENTIAL_READAHEAD if readahead is off, and the pages
+ *                 that the stream has left behind are marked as not
+ *                 accessed, so that the policy evicts them first.
+ * VMEM_RANDOM     The range will be used in no particular order, so faults
+ *                 in it never read ahead, or count towards a stream.
+ * VMEM_WILLNEED   Load the range now, up to half of the maximum resident
+ *                 pages, as if it had been read ahead.
+ * VMEM_DONTNEED   Discard the range's contents, with vmem_discard().
+ *
+ * Hints apply to every page that the range touches, except that DONTNEED
+ * only discards whole pages.  WILLNEED only loads pages in single-page
+ * mapping.  Returns 0, or -1 for an unknown hint.
+ */
+#define SEQUENTIAL_READAHEAD 8
+
+typedef enum vmem_advice_t {
+    VMEM_NORMAL,
+    VMEM_SEQUENTIAL,
+    VMEM_RANDOM,
+    VMEM_WILLNEED,
+    VMEM_DONTNEED
+} vmem_advice_t;
+
+int vmem_advise(void *addr, size_t len, int advice);
+
+/* Return statistics about the virtual memory system.  The loads include the
+ * pages that were read ahead; a prefetch hit is a page that was read ahead
+ * and then accessed before it was evicted.
+ */
 unsigned int get_num_faults();
 unsigned int get_num_loads();
+unsigned int get_num_prefetches();
+unsigned int get_num_prefetch_hits();
+unsigned int get_num_writebacks();
+unsigned int get_num_writeback_calls();
+unsigned int get_num_dirty_evictions();
+unsigned int get_num_clean_evictions();
+unsigned int get_num_discards();
+
+/* Write out the fault and eviction counts, and histograms of how long the
+ * fault handler took to service faults that loaded a page and faults that
+ * only changed a page's permission.
+ */
+void vmem_dump_stats(FILE *fp);
+
+/* The heat map counts, for every page, how many times it was loaded, how
+ * many permission faults it took, and how many times it was evicted, so that
+ * the data that causes thrashing can be found.  It is only kept once
+ * vmem_enable_heatmap() has been called.  vmem_dump_heatmap() writes one line
+ * per page that was touched to the named file, and returns 0, or -1 on
+ * failure.
+ */
+void vmem_enable_heatmap();
+int vmem_dump_heatmap(const char *filename);
 
 #endif /* VIRTUALMEM_H */
@@ -1,27 +1,296 @@
 /*============================================================================
  * Implementation of the simple allocator that sits on top of the virtual
  * memory system.
+ *
+ * The virtual memory area is handed out in whole pages.  Free pages are kept
+ * in runs, on one list per size class, where size classes are powers of two
+ * of pages; a request for n pages takes the best fit from the first class
+ * that can hold it, and freed runs are coalesced with their free neighbors.
+ *
+ * Allocations of up to SMALL_MAX bytes are rounded up to a power of two, and
+ * carved out of pages that only hold objects of that size.  Each small-object
+ * size has a list of its pages that have a free slot.  When the last object in
+ * a page is freed, and when a large allocation is freed, the pages are given
+ * back to the virtual memory system with vmem_discard(), so that they take up
+ * no resident page and are never written back.
+ *
+ * All of the allocator's bookkeeping lives in arrays outside of the virtual
+ * memory area, indexed by page number, so that allocating and freeing never
+ * faults a page in.
  */
 
+#include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "virtualmem.h"
 #include "vmalloc.h"
 
 
-/* Just like the "unacceptable allocator" in HW3, we start our pointer at
- * the start of virtual memory, and just move it forward by the requested
- * allocation size, as long as the request will fit in the virtual memory
- * area.  When we run out of space, we start returning NULL.
- *
- * Oh, and we never deallocate...
+/* The smallest and largest small-object sizes.  Each size class holds one
+ * power of two between them.
+ */
+#define SMALL_MIN 16
+#define SMALL_MAX 2048
+#define NUM_SMALL_CLASSES 8
+
+/* The most small objects that a page can hold. */
+#define MAX_SLOTS (PAGE_SIZE / SMALL_MIN)
+
+/* The number of size classes of free page runs:  class k holds runs of
+ * 2^k up to 2^(k+1) - 1 pages.
+ */
+#define NUM_RUN_CLASSES 13
+
+/* A missing link in the lists of pages. */
+#define NO_PAGE NUM_PAGES
+
+
+/* What each page is being used for. */
+typedef enum page_kind_t {
+    PAGE_FREE,      /* Part of a run of free pages */
+    PAGE_SMALL,     /* Holds small objects of one size */
+    PAGE_LARGE,     /* The first page of a large allocation */
+    PAGE_LARGE_TAIL /* A later page of a large allocation */
+} page_kind_t;
+
+
+static unsigned char page_kind[NUM_PAGES];
+
+/* The length of the run that starts at each page, for free runs and for large
+ * allocations, and the first page of the free run that ends at each page.
+ */
+static unsigned int run_length[NUM_PAGES];
+static page_t run_head[NUM_PAGES];
+
+/* The links of free runs in their class's list, and of small-object pages in
+ * their class's list of pages with a free slot.
+ */
+static page_t next_page[NUM_PAGES];
+static page_t prev_page[NUM_PAGES];
+
+static page_t free_runs[NUM_RUN_CLASSES];
+
+/* For each small-object page:  its size class, how many objects it holds, and
+ * a bitmap with a 1 for every free slot.
+ */
+static unsigned char small_class[NUM_PAGES];
+static unsigned short small_used[NUM_PAGES];
+static unsigned int small_free[NUM_PAGES][MAX_SLOTS / 32];
+
+static page_t partial_pages[NUM_SMALL_CLASSES];
+
+
+/*============================================================================
+ * Helper Functions
+ */
+
+
+/* Remove the page from a doubly linked list of pages. */
+static void unlink_page(page_t *list, page_t page) {
+    if (prev_page[page] != NO_PAGE)
+        next_page[prev_page[page]] = next_page[page];
+    else
+        *list = next_page[page];
+
+    if (next_page[page] != NO_PAGE)
+        prev_page[next_page[page]] = prev_page[page];
+}
+
+
+/* Add the page to the front of a doubly linked list of pages. */
+static void link_page(page_t *list, page_t page) {
+    prev_page[page] = NO_PAGE;
+    next_page[page] = *list;
+    if (*list != NO_PAGE)
+        prev_page[*list] = page;
+    *list = page;
+}
+
+
+/* Returns the size class of a free run of the given number of pages. */
+static int run_class(unsigned int length) {
+    int class = 0;
+
+    while (length > 1 && class < NUM_RUN_CLASSES - 1) {
+        length >>= 1;
+        class++;
+    }
+    return class;
+}
+
+
+/* Record the pages from first as a free run, and put it on its list. */
+static void add_free_run(page_t first, unsigned int length) {
+    page_t page;
+
+    for (page = first; page < first + length; page++)
+        page_kind[page] = PAGE_FREE;
+
+    run_length[first] = length;
+    run_head[first + length - 1] = first;
+    link_page(&free_runs[run_class(length)], first);
+}
+
+
+/* Take the free run that starts at first off its list. */
+static void remove_free_run(page_t first) {
+    unlink_page(&free_runs[run_class(run_length[first])], first);
+}
+
+
+/* Allocate a run of count pages, or return NO_PAGE if there isn't one.  The
+ * best fit is taken from the first class that could hold the run; every run
+ * in a later class is larger than anything in that one.
+ */
+static page_t alloc_pages(unsigned int count) {
+    page_t page, best = NO_PAGE;
+    int class;
+
+    for (class = run_class(count); class < NUM_RUN_CLASSES; class++) {
+        for (page = free_runs[class]; page != NO_PAGE; page = next_page[page]) {
+            if (run_length[page] >= count &&
+                (best == NO_PAGE || run_length[page] < run_length[best]))
+                best = page;
+        }
+
+        if (best != NO_PAGE)
+            break;
+    }
+
+    if (best == NO_PAGE)
+        return NO_PAGE;
+
+    /* Split the run, and give back what isn't needed. */
+    remove_free_run(best);
+    if (run_length[best] > count)
+        add_free_run(best + count, run_length[best] - count);
+
+    run_length[best] = count;
+    return best;
+}
+
+
+/* Give a run of count pages back to the virtual memory system, and coalesce
+ * it with the free runs on either side.
+ */
+static void free_pages(page_t first, unsigned int count) {
+    page_t next = first + count;
+
+    vmem_discard(page_to_addr(first), (size_t) count * PAGE_SIZE);
+
+    if (next < NUM_PAGES && page_kind[next] == PAGE_FREE) {
+        remove_free_run(next);
+        count += run_length[next];
+    }
+
+    if (first > 0 && page_kind[first - 1] == PAGE_FREE) {
+        page_t head = run_head[first - 1];
+
+        remove_free_run(head);
+        count += first - head;
+        first = head;
+    }
+
+    add_free_run(first, count);
+}
+
+
+/* Returns the small-object class for a size of at most SMALL_MAX bytes. */
+static int small_size_class(unsigned int size) {
+    int class = 0;
+
+    while ((SMALL_MIN << class) < size)
+        class++;
+    return class;
+}
+
+
+/* Allocate an object from the class's pages, starting a new page if none has
+ * a free slot.
  */
-static void *nextptr;
+static void * small_alloc(int class) {
+    unsigned int size = SMALL_MIN << class;
+    unsigned int slots = PAGE_SIZE / size, slot, word;
+    page_t page = partial_pages[class];
+
+    if (page == NO_PAGE) {
+        page = alloc_pages(1);
+        if (page == NO_PAGE)
+            return NULL;
+
+        page_kind[page] = PAGE_SMALL;
+        small_class[page] = class;
+        small_used[page] = 0;
+        memset(small_free[page], 0, sizeof(small_free[page]));
+        for (slot = 0; slot < slots; slot++)
+            small_free[page][slot / 32] |= 1U << (slot % 32);
+
+        link_page(&partial_pages[class], page);
+    }
 
+    /* Take the lowest free slot. */
+    for (word = 0; small_free[page][word] == 0; word++)
+        assert(word < MAX_SLOTS / 32);
+
+    slot = word * 32 + __builtin_ctz(small_free[page][word]);
+    small_free[page][word] &= ~(1U << (slot % 32));
+
+    small_used[page]++;
+    if (small_used[page] == slots)
+        unlink_page(&partial_pages[class], page);
+
+    return (char *) page_to_addr(page) + slot * size;
+}
+
+
+/* Free an object in a small-object page, and give the page back once it is
+ * empty.
+ */
+static void small_free_obj(page_t page, void *ptr) {
+    int class = small_class[page];
+    unsigned int size = SMALL_MIN << class;
+    unsigned int slots = PAGE_SIZE / size;
+    size_t offset = (char *) ptr - (char *) page_to_addr(page);
+    unsigned int slot = offset / size;
 
-/* Initialize the simple memory allocator. */
+    if (offset % size != 0 ||
+        (small_free[page][slot / 32] >> (slot % 32)) & 1) {
+        fprintf(stderr, "vmem_free(%p): not an allocated object\n", ptr);
+        abort();
+    }
+
+    if (small_used[page] == slots)
+        link_page(&partial_pages[class], page);
+
+    small_free[page][slot / 32] |= 1U << (slot % 32);
+    small_used[page]--;
+
+    if (small_used[page] == 0) {
+        unlink_page(&partial_pages[class], page);
+        free_pages(page, 1);
+    }
+}
+
+
+/*============================================================================
+ * Allocator Implementation
+ */
+
+
+/* Initialize the simple memory allocator, with the whole virtual memory area
+ * as one free run.
+ */
 void vmem_alloc_init() {
-    nextptr = get_vmem_start();
+    int class;
+
+    for (class = 0; class < NUM_RUN_CLASSES; class++)
+        free_runs[class] = NO_PAGE;
+    for (class = 0; class < NUM_SMALL_CLASSES; class++)
+        partial_pages[class] = NO_PAGE;
+
+    add_free_run(0, NUM_PAGES);
 }
 
 
@@ -29,16 +298,55 @@ void vmem_alloc_init() {
  * no more memory is available.
  */
 void * vmem_alloc(unsigned int size) {
+    unsigned int count;
+    page_t first, page;
     void *p;
 
-    if (nextptr + size > get_vmem_end()) {
-        fprintf(stderr, "vmem_alloc(%u): ran out of heap space\n", size);
-        return NULL;
+    if (size <= SMALL_MAX) {
+        p = small_alloc(small_size_class(size));
+    }
+    else {
+        count = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+        first = alloc_pages(count);
+        if (first == NO_PAGE) {
+            p = NULL;
+        }
+        else {
+            page_kind[first] = PAGE_LARGE;
+            for (page = first + 1; page < first + count; page++)
+                page_kind[page] = PAGE_LARGE_TAIL;
+            p = page_to_addr(first);
+        }
     }
 
-    p = nextptr;
-    nextptr += size;
+    if (p == NULL)
+        fprintf(stderr, "vmem_alloc(%u): ran out of heap space\n", size);
 
     return p;
 }
 
+
+/* Free an allocation made by vmem_alloc().  Freeing NULL does nothing. */
+void vmem_free(void *ptr) {
+    page_t page;
+
+    if (ptr == NULL)
+        return;
+
+    if (ptr < get_vmem_start() || ptr >= get_vmem_end()) {
+        fprintf(stderr, "vmem_free(%p): not in the virtual memory area\n", ptr);
+        abort();
+    }
+
+    page = addr_to_page(ptr);
+    if (page_kind[page] == PAGE_SMALL) {
+        small_free_obj(page, ptr);
+    }
+    else if (page_kind[page] == PAGE_LARGE && ptr == page_to_addr(page)) {
+        free_pages(page, run_length[page]);
+    }
+    else {
+        fprintf(stderr, "vmem_free(%p): not an allocated object\n", ptr);
+        abort();
+    }
+}
@@ -8,6 +8,7 @@
 
 void vmem_alloc_init();
 void * vmem_alloc(unsigned int size);
+void vmem_free(void *ptr);
 
 #endif /* VMALLOC_H */
 
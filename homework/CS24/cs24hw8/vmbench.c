@@ -0,0 +1,486 @@
+/*============================================================================
+ * A benchmark for comparing the page replacement policies.  Like test_matrix,
+ * it is linked once with each policy.  Each run performs one access pattern
+ * over a region of the virtual memory area, and prints one CSV line with the
+ * faults, page loads and time that it took:
+ *
+ *     policy,pattern,size,max_resident,faults,loads,seconds,checksum
+ *
+ * With --opt, the pattern is run over ordinary memory instead, recording the
+ * pages that it touches, and the page loads are those of Belady's optimal
+ * policy, which evicts the page whose next use is furthest away.  The time is
+ * then that of the pattern without virtual memory.  No policy can do better,
+ * so OPT is a lower bound for the others.  "make bench" runs every policy
+ * and OPT over a grid of patterns and maximum resident pages, into bench.csv.
+ *
+ * The patterns lay out their data in the same way in both cases, and use
+ * their own random number generator, since the RANDOM policy uses rand(), so
+ * the pages are touched in the same order.  The checksum is the same for
+ * every run of a pattern, if the virtual memory system is working.
+ */
+
+#include <assert.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "virtualmem.h"
+#include "vmalloc.h"
+
+
+#define DEFAULT_MAX_RESIDENT 64
+
+#define INTS_PER_PAGE (PAGE_SIZE / sizeof(int))
+
+
+/* The access patterns. */
+typedef enum pattern_t {
+    PAT_MATMUL,     /* Naive multiply of two size x size matrices */
+    PAT_RANDOM,     /* Random touches of a region of size pages */
+    PAT_SCAN,       /* Sequential passes over a region of size pages */
+    PAT_LOOP,       /* A loop over a quarter of size pages, with the rest
+                     * streamed through one page per lap */
+    NUM_PATTERNS
+} pattern_t;
+
+static const char *pattern_names[] = {
+    "matmul", "random", "scan", "loop"
+};
+
+
+static long seed = 1;
+static unsigned int max_resident = DEFAULT_MAX_RESIDENT;
+static pattern_t pattern = PAT_MATMUL;
+static const char *label = "vm";
+static int opt = 0;
+static int size;
+
+
+/* The region that the pattern runs over. */
+static char *region;
+
+/* When computing OPT, the pages of the region that the pattern touched, in
+ * order, with repeated touches of the same page recorded once.  trace is NULL
+ * when the pattern runs in virtual memory.
+ */
+static page_t *trace;
+static size_t trace_len, trace_cap;
+
+/* The state of the patterns' random number generator. */
+static unsigned long long rng_state;
+
+
+/*============================================================================
+ * Page Trace
+ */
+
+
+/* Record a touch of the page that holds p. */
+static void record_touch(const void *p) {
+    page_t page = ((const char *) p - region) / PAGE_SIZE;
+
+    if (trace_len > 0 && trace[trace_len - 1] == page)
+        return;
+
+    if (trace_len == trace_cap) {
+        trace_cap *= 2;
+        trace = realloc(trace, trace_cap * sizeof(page_t));
+        if (trace == NULL) {
+            fprintf(stderr, "record_touch: out of memory\n");
+            abort();
+        }
+    }
+    trace[trace_len++] = page;
+}
+
+
+/* Every access the patterns make is announced with this, just before it. */
+#define TOUCH(p) do { if (trace != NULL) record_touch(p); } while (0)
+
+
+/* An entry in the heap of resident pages that OPT keeps:  the position in
+ * the trace of the page's next use.
+ */
+typedef struct opt_entry_t {
+    size_t next;
+    page_t page;
+} opt_entry_t;
+
+
+/* Returns the number of page loads of Belady's optimal policy with the
+ * specified number of frames, for the recorded trace.  The resident pages are
+ * kept in a max-heap keyed by their next use; an entry is left in the heap
+ * when its page is used again, and is skipped when it reaches the top if it
+ * is no longer the page's latest.
+ */
+static unsigned int opt_loads(unsigned int frames) {
+    size_t *next_use, *page_next, i, last[NUM_PAGES];
+    unsigned char resident[NUM_PAGES];
+    opt_entry_t *heap, top, tmp;
+    size_t heap_len = 0, pos, child;
+    unsigned int loads = 0, num_resident = 0;
+    page_t page;
+
+    next_use = malloc(trace_len * sizeof(size_t));
+    page_next = malloc(NUM_PAGES * sizeof(size_t));
+    heap = malloc((trace_len + 1) * sizeof(opt_entry_t));
+    if (next_use == NULL || page_next == NULL || heap == NULL) {
+        fprintf(stderr, "opt_loads: out of memory\n");
+        abort();
+    }
+
+    /* A use that never comes is trace_len, later than any that does. */
+    for (page = 0; page < NUM_PAGES; page++)
+        last[page] = trace_len;
+    for (i = trace_len; i-- > 0; ) {
+        next_use[i] = last[trace[i]];
+        last[trace[i]] = i;
+    }
+
+    memset(resident, 0, sizeof(resident));
+
+    for (i = 0; i < trace_len; i++) {
+        page = trace[i];
+
+        if (!resident[page]) {
+            loads++;
+
+            if (num_resident == frames) {
+                /* Pop stale entries until the top is a current one. */
+                while (1) {
+                    top = heap[0];
+                    heap[0] = heap[--heap_len];
+                    for (pos = 0; (child = 2 * pos + 1) < heap_len;
+                         pos = child) {
+                        if (child + 1 < heap_len &&
+                            heap[child + 1].next > heap[child].next)
+                            child++;
+                        if (heap[child].next <= heap[pos].next)
+                            break;
+                        tmp = heap[pos];
+                        heap[pos] = heap[child];
+                        heap[child] = tmp;
+                    }
+
+                    if (resident[top.page] && page_next[top.page] == top.next)
+                        break;
+                }
+
+                resident[top.page] = 0;
+                num_resident--;
+            }
+
+            resident[page] = 1;
+            num_resident++;
+        }
+
+        /* Push the page's new next use. */
+        page_next[page] = next_use[i];
+        pos = heap_len++;
+        heap[pos].next = next_use[i];
+        heap[pos].page = page;
+        while (pos > 0 && heap[(pos - 1) / 2].next < heap[pos].next) {
+            tmp = heap[pos];
+            heap[pos] = heap[(pos - 1) / 2];
+            heap[(pos - 1) / 2] = tmp;
+            pos = (pos - 1) / 2;
+        }
+    }
+
+    free(next_use);
+    free(page_next);
+    free(heap);
+    return loads;
+}
+
+
+/*============================================================================
+ * Access Patterns
+ */
+
+
+/* Returns the next number from the patterns' xorshift generator. */
+static unsigned long long next_random() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+
+/* Returns the number of pages that the pattern's region needs. */
+static unsigned int pattern_pages() {
+    if (pattern == PAT_MATMUL) {
+        /* Three matrices, each starting on a new page. */
+        return 3 * ((size * size + INTS_PER_PAGE - 1) / INTS_PER_PAGE);
+    }
+    return size;
+}
+
+
+/* c = a * b the naive way, after filling in a and b. */
+static unsigned long long run_matmul() {
+    unsigned int pages = pattern_pages() / 3;
+    int *a = (int *) region;
+    int *b = a + pages * INTS_PER_PAGE;
+    int *c = b + pages * INTS_PER_PAGE;
+    unsigned long long checksum = 0;
+    int i, j, k, sum;
+
+    for (i = 0; i < size * size; i++) {
+        TOUCH(&a[i]);
+        a[i] = next_random() % 10;
+    }
+    for (i = 0; i < size * size; i++) {
+        TOUCH(&b[i]);
+        b[i] = next_random() % 10;
+    }
+
+    for (i = 0; i < size; i++) {
+        for (j = 0; j < size; j++) {
+            sum = 0;
+            for (k = 0; k < size; k++) {
+                TOUCH(&a[i * size + k]);
+                TOUCH(&b[k * size + j]);
+                sum += a[i * size + k] * b[k * size + j];
+            }
+            TOUCH(&c[i * size + j]);
+            c[i * size + j] = sum;
+            checksum += sum;
+        }
+    }
+    return checksum;
+}
+
+
+/* Increment 16 random ints for every page of the region. */
+static unsigned long long run_random() {
+    int *x = (int *) region;
+    unsigned long long checksum = 0;
+    unsigned int n, i;
+
+    for (n = 0; n < 16 * (unsigned int) size; n++) {
+        i = next_random() % (size * INTS_PER_PAGE);
+        TOUCH(&x[i]);
+        x[i]++;
+        checksum += x[i];
+    }
+    return checksum;
+}
+
+
+/* Add to every int of the region, in order, three times. */
+static unsigned long long run_scan() {
+    int *x = (int *) region;
+    unsigned long long checksum = 0;
+    unsigned int i;
+    int pass;
+
+    for (pass = 1; pass <= 3; pass++) {
+        for (i = 0; i < size * INTS_PER_PAGE; i++) {
+            TOUCH(&x[i]);
+            x[i] += pass;
+            checksum += x[i];
+        }
+    }
+    return checksum;
+}
+
+
+/* Touch each page of the first quarter of the region in turn, and then the
+ * next page of the rest of it, going around the rest twice.  A policy that
+ * keeps the loop's pages does well; one that lets the stream push them out
+ * does badly.
+ */
+static unsigned long long run_loop() {
+    int *x = (int *) region;
+    unsigned int hot = size / 4, cold = size - hot;
+    unsigned long long checksum = 0;
+    unsigned int lap, page;
+    int *p;
+
+    assert(hot > 0 && cold > 0);
+
+    for (lap = 0; lap < 2 * cold; lap++) {
+        for (page = 0; page < hot; page++) {
+            p = x + page * INTS_PER_PAGE + lap % INTS_PER_PAGE;
+            TOUCH(p);
+            (*p)++;
+            checksum += *p;
+        }
+
+        p = x + (hot + lap % cold) * INTS_PER_PAGE;
+        TOUCH(p);
+        (*p)++;
+        checksum += *p;
+    }
+    return checksum;
+}
+
+
+/* Run the chosen pattern over the region, and return its checksum. */
+static unsigned long long run_pattern() {
+    rng_state = 0x9E3779B97F4A7C15ULL ^ (unsigned long long) seed;
+    if (rng_state == 0)
+        rng_state = 1;
+
+    switch (pattern) {
+    case PAT_MATMUL:
+        return run_matmul();
+    case PAT_RANDOM:
+        return run_random();
+    case PAT_SCAN:
+        return run_scan();
+    case PAT_LOOP:
+        return run_loop();
+    default:
+        abort();
+    }
+}
+
+
+/*============================================================================
+ * Benchmark Program
+ */
+
+
+/* Prints the benchmark's usage, and then exit the program. */
+static void usage(const char *prog) {
+    printf("usage: %s [--seed num] [--max_resident num] [--pattern name] "
+           "[--label name]\n\t\t[--opt] size\n", prog);
+    printf("\tRuns one access pattern in the virtual memory system, and\n");
+    printf("\tprints a CSV line of\n");
+    printf("\tpolicy,pattern,size,max_resident,faults,loads,seconds,checksum\n\n");
+    printf("\t--seed | -s num sets the seed for the patterns' random\n");
+    printf("\tnumbers; the default is 1.\n\n");
+    printf("\t--max_resident | -m num specifies the maximum number of pages\n");
+    printf("\tthat may be resident in the virtual memory system.\n\n");
+    printf("\t--pattern | -p name is matmul, which multiplies two size x size\n");
+    printf("\tmatrices, random, scan, or loop, which touch a region of size\n");
+    printf("\tpages; the default is matmul.\n\n");
+    printf("\t--label | -l name is the policy name to print.\n\n");
+    printf("\t--opt | -o computes the loads of Belady's optimal policy from\n");
+    printf("\ta trace of the pattern, instead of using virtual memory.\n");
+    exit(1);
+}
+
+
+/* Parse the command-line arguments passed to the program. */
+void parse_args(int argc, char **argv) {
+    static struct option long_options[] = {
+        {"seed",         required_argument, 0, 's'},
+        {"max_resident", required_argument, 0, 'm'},
+        {"pattern",      required_argument, 0, 'p'},
+        {"label",        required_argument, 0, 'l'},
+        {"opt",          no_argument,       0, 'o'},
+        {0, 0, 0, 0}
+    };
+    int c, i;
+
+    while ((c = getopt_long(argc, argv, "s:m:p:l:o", long_options,
+                            NULL)) != -1) {
+        switch (c) {
+        case 's':
+            seed = atol(optarg);
+            break;
+
+        case 'm':
+            max_resident = atoi(optarg);
+            break;
+
+        case 'p':
+            for (i = 0; i < NUM_PATTERNS; i++) {
+                if (strcmp(optarg, pattern_names[i]) == 0)
+                    break;
+            }
+            if (i == NUM_PATTERNS)
+                usage(argv[0]);
+            pattern = i;
+            break;
+
+        case 'l':
+            label = optarg;
+            break;
+
+        case 'o':
+            opt = 1;
+            break;
+
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind + 1 != argc)
+        usage(argv[0]);
+
+    size = atoi(argv[optind]);
+    if (size <= 0 || max_resident == 0)
+        usage(argv[0]);
+}
+
+
+/* Returns the time since some fixed point, in seconds. */
+static double now_seconds() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int main(int argc, char **argv) {
+    unsigned int pages, faults, loads;
+    unsigned long long checksum;
+    double start, seconds;
+
+    parse_args(argc, argv);
+
+    pages = pattern_pages();
+    if (pages > NUM_PAGES || (pattern == PAT_LOOP && size < 2)) {
+        fprintf(stderr, "%s: a %s pattern of size %d doesn't fit\n", argv[0],
+                pattern_names[pattern], size);
+        return 1;
+    }
+
+    if (opt) {
+        region = aligned_alloc(PAGE_SIZE, (size_t) pages * PAGE_SIZE);
+        trace_cap = 1024;
+        trace = malloc(trace_cap * sizeof(page_t));
+        if (region == NULL || trace == NULL) {
+            fprintf(stderr, "%s: out of memory\n", argv[0]);
+            return 1;
+        }
+        memset(region, 0, (size_t) pages * PAGE_SIZE);
+
+        start = now_seconds();
+        checksum = run_pattern();
+        seconds = now_seconds() - start;
+
+        loads = opt_loads(max_resident);
+        faults = loads;
+        label = "opt";
+    }
+    else {
+        vmem_init(max_resident);
+        vmem_alloc_init();
+
+        region = vmem_alloc(pages * PAGE_SIZE);
+        if (region == NULL)
+            return 1;
+        assert(((region - (char *) get_vmem_start()) % PAGE_SIZE) == 0);
+
+        start = now_seconds();
+        checksum = run_pattern();
+        seconds = now_seconds() - start;
+
+        faults = get_num_faults();
+        loads = get_num_loads();
+    }
+
+    printf("%s,%s,%d,%u,%u,%u,%.3f,%llu\n", label, pattern_names[pattern],
+           size, max_resident, faults, loads, seconds, checksum);
+    return 0;
+}
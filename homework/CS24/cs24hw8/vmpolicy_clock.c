@@ -0,0 +1,158 @@
+/*============================================================================
+ * Implementation of the CLOCK (second-chance) page replacement policy.
+ *
+ * Resident pages sit in a circular array of slots, one slot per resident
+ * page, and a "hand" sweeps around it looking for a victim.  A page whose
+ * accessed bit is set gets a second chance:  the bit is cleared and the
+ * hand moves on.  The first page found without the bit is evicted, and the
+ * page that replaces it takes over its slot, just behind the hand, so it is
+ * the last to be looked at again.
+ *
+ * Unlike the list-based policies, nothing here ever searches for a page:
+ * each page's slot is recorded in a table indexed by page number, and the
+ * timer tick has no work to do, since the accessed bits are only looked at
+ * as the hand passes them.  Finding a victim is amortized O(1), because
+ * every page that the hand passes over has had its bit cleared.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "vmpolicy.h"
+
+
+/*============================================================================
+ * Clock Data Structure
+ */
+
+
+/* The value of an empty slot, and of the slot of a page that isn't
+ * resident.
+ */
+#define NO_SLOT NUM_PAGES
+
+
+/* The page in each slot of the clock, or NO_SLOT if the slot is free. */
+static page_t slot_page[NUM_PAGES];
+
+/* The slot that each resident page is in, or NO_SLOT. */
+static unsigned int page_slot[NUM_PAGES];
+
+/* The number of slots that have ever been used; the hand wraps around at
+ * this point.  It never exceeds the maximum number of resident pages.
+ */
+static unsigned int num_slots;
+
+/* Slots that have been emptied, to be filled before any new slot is used. */
+static unsigned int free_slots[NUM_PAGES];
+static unsigned int num_free_slots;
+
+/* The slot that the hand will look at next. */
+static unsigned int hand;
+
+
+/*============================================================================
+ * Policy Implementation
+ */
+
+
+/* Initialize the policy.  Return 0 for success, -1 for failure. */
+int policy_init() {
+    unsigned int i;
+
+    fprintf(stderr, "Using CLOCK eviction policy.\n\n");
+
+    for (i = 0; i < NUM_PAGES; i++) {
+        slot_page[i] = NO_SLOT;
+        page_slot[i] = NO_SLOT;
+    }
+    num_slots = 0;
+    num_free_slots = 0;
+    hand = 0;
+    return 0;
+}
+
+
+/* This function is called when the virtual memory system maps a page into the
+ * virtual address space.  Put the page in an empty slot, which is the last
+ * victim's slot when the page is replacing one.
+ */
+void policy_page_mapped(page_t page) {
+    unsigned int slot;
+
+    assert(page < NUM_PAGES);
+    assert(page_slot[page] == NO_SLOT);
+
+    if (num_free_slots > 0)
+        slot = free_slots[--num_free_slots];
+    else
+        slot = num_slots++;
+
+    assert(slot < NUM_PAGES);
+    assert(slot_page[slot] == NO_SLOT);
+
+    slot_page[slot] = page;
+    page_slot[page] = slot;
+}
+
+
+/* This function is called when the virtual memory system unmaps a page from
+ * the virtual address space.  Empty the page's slot, so that the next page
+ * to be mapped can use it.
+ */
+void policy_page_unmapped(page_t page) {
+    unsigned int slot;
+
+    assert(page < NUM_PAGES);
+
+    slot = page_slot[page];
+    assert(slot != NO_SLOT);
+
+    slot_page[slot] = NO_SLOT;
+    page_slot[page] = NO_SLOT;
+    free_slots[num_free_slots++] = slot;
+}
+
+
+/* This function is called when the virtual memory system has a timer tick.
+ * The accessed bits are only examined by the hand, so there is nothing to do.
+ */
+void policy_timer_tick() {
+    /* Do nothing! */
+}
+
+
+/* Sweep the hand around the clock until it reaches a page that hasn't been
+ * accessed since the hand last passed it, giving every accessed page that it
+ * passes a second chance.  An accessed page has its permission taken away
+ * again, so that the next access to it sets the bit.  Since every page is
+ * cleared as it is passed, the hand goes around at most once.
+ */
+page_t choose_victim_page() {
+    page_t victim;
+
+    assert(num_slots > 0);
+
+    while (1) {
+        victim = slot_page[hand];
+        hand = (hand + 1) % num_slots;
+
+        if (victim == NO_SLOT)
+            continue;
+
+        if (!is_page_accessed(victim))
+            break;
+
+        clear_page_accessed(victim);
+        set_page_permission(victim, PAGEPERM_NONE);
+    }
+
+    assert(is_page_resident(victim));
+
+#if VERBOSE
+    fprintf(stderr, "Choosing victim page %u to evict.\n", victim);
+#endif
+
+    return victim;
+}
@@ -1,14 +1,17 @@
 /*============================================================================
  * Implementation of the CLOCK/LRU page replacement policy.
  *
- * We don't mind if policies use malloc() and free(), just because it keeps
- * things simpler.
+ * A page's node is allocated when the page is mapped and freed when it is
+ * unmapped, which happens on nearly every page fault once memory is full, so
+ * the nodes come from a pool instead of malloc() and free().
  */
 
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "pool.h"
 #include "vmpolicy.h"
 
 
@@ -20,38 +23,37 @@
 /* A single node in the page-info linked list. */
 typedef struct pageinfo_t {
     page_t page;
+    unsigned long stamp;    /* When the node was last added to the tail */
+    struct pageinfo_t *prev;
     struct pageinfo_t *next;
 } pageinfo_t;
 
 
-/* A page-info linked list structure for tracking page details. */
+/* A page-info linked list structure for tracking page details.  The list is
+ * doubly linked, and each page's node is also recorded in a table indexed by
+ * page number, so that finding and removing a page don't have to search the
+ * list.  Nodes are stamped in the order that they are added to the tail, so
+ * the stamps increase along the list.
+ */
 typedef struct pagelist_t {
     pageinfo_t *head;
     pageinfo_t *tail;
+    pageinfo_t *by_page[NUM_PAGES];
+    unsigned long next_stamp;
+
+    /* The pool that the list's nodes come from. */
+    pool nodes;
 } pagelist_t;
 
 
 /* Find the pageinfo struct with the specified page number.  NULL is returned
- * if the page cannot be found.  If desired, the previous page can be returned
- * by this function as well.
+ * if the page cannot be found.
  */
-pageinfo_t * find_page(pagelist_t *list, page_t page, pageinfo_t **p_prev) {
-    pageinfo_t *pginfo, *prev;
-
+pageinfo_t * find_page(pagelist_t *list, page_t page) {
     assert(list != NULL);
+    assert(page < NUM_PAGES);
 
-    pginfo = list->head;
-    prev = NULL;
-    while (pginfo != NULL) {
-        if (pginfo->page == page) {
-            if (p_prev != NULL)
-                *p_prev = prev;
-            return pginfo;
-        }
-        prev = pginfo;
-        pginfo = pginfo->next;
-    }
-    return NULL;
+    return list->by_page[page];
 }
 
 
@@ -60,7 +62,9 @@ void add_to_tail(pagelist_t *list, pageinfo_t *pginfo) {
     assert(list != NULL);
     assert(pginfo != NULL);
 
+    pginfo->prev = list->tail;
     pginfo->next = NULL;
+    pginfo->stamp = list->next_stamp++;
 
     if (list->tail != NULL)
         list->tail->next = pginfo;
@@ -71,25 +75,30 @@ void add_to_tail(pagelist_t *list, pageinfo_t *pginfo) {
 }
 
 
-/* Remove a pageinfo_t struct from the specified list.  The previous-node
- * pointer is necessary so that the linked list can be updated properly.  If
- * the node being removed is the first node in the list, the prev pointer
- * should be NULL (obvious).
+/* Remove a pageinfo_t struct from the specified list.  The node itself is
+ * left for the caller to free or to add to the list again.
  */
-void remove_from_list(pagelist_t *list, pageinfo_t *pginfo, pageinfo_t *prev) {
-    assert(prev == NULL || prev->next == pginfo);
+void remove_from_list(pagelist_t *list, pageinfo_t *pginfo) {
+    assert(list != NULL);
+    assert(pginfo != NULL);
 
-    if (prev != NULL) {
-        prev->next = pginfo->next;
+    if (pginfo->prev != NULL) {
+        pginfo->prev->next = pginfo->next;
     }
     else {
         assert(list->head == pginfo);
         list->head = pginfo->next;
     }
 
-    if (pginfo == list->tail)
-        list->tail = prev;
+    if (pginfo->next != NULL) {
+        pginfo->next->prev = pginfo->prev;
+    }
+    else {
+        assert(list->tail == pginfo);
+        list->tail = pginfo->prev;
+    }
 
+    pginfo->prev = NULL;
     pginfo->next = NULL;
 }
 
@@ -101,15 +110,32 @@ void add_page(pagelist_t *list, page_t page) {
     pageinfo_t *pginfo;
 
     assert(list != NULL);
-    assert(find_page(list, page, NULL) == NULL);
+    assert(find_page(list, page) == NULL);
 
     /* Always add the page to the back of the queue. */
 
-    pginfo = malloc(sizeof(pageinfo_t));
+    pginfo = pool_alloc(&list->nodes);
+    if (pginfo == NULL) {
+        perror("pool_alloc");
+        abort();
+    }
     pginfo->page = page;
-    pginfo->next = NULL;
 
     add_to_tail(list, pginfo);
+    list->by_page[page] = pginfo;
+}
+
+
+/* Remove the specified page from the linked list, and free its node. */
+void remove_page(pagelist_t *list, page_t page) {
+    pageinfo_t *pginfo;
+
+    pginfo = find_page(list, page);
+    assert(pginfo != NULL);
+
+    remove_from_list(list, pginfo);
+    list->by_page[page] = NULL;
+    pool_release(&list->nodes, pginfo);
 }
 
 
@@ -125,8 +151,8 @@ static pagelist_t pagelist;
 /* Initialize the policy.  Return 0 for success, -1 for failure. */
 int policy_init() {
     fprintf(stderr, "Using CLOCK/LRU eviction policy.\n\n");
-    pagelist.head = NULL;
-    pagelist.tail = NULL;
+    memset(&pagelist, 0, sizeof(pagelist));
+    pool_init(&pagelist.nodes, "pageinfo", sizeof(pageinfo_t));
     return 0;
 }
 
@@ -144,56 +170,53 @@ void policy_page_mapped(page_t page) {
  * pages.
  */
 void policy_page_unmapped(page_t page) {
-    pageinfo_t *pginfo, *prev;
+    remove_page(&pagelist, page);
+}
 
-    pginfo = find_page(&pagelist, page, &prev);
-    assert(pginfo != NULL);
 
-    remove_from_list(&pagelist, pginfo, prev);
-}
+
+/* The nodes of the pages that were accessed since the last tick. */
+static pageinfo_t *accessed[NUM_PAGES];
 
 
+/* Orders nodes by their position in the list. */
+static int compare_stamps(const void *a, const void *b) {
+    const pageinfo_t *pa = *(pageinfo_t * const *) a;
+    const pageinfo_t *pb = *(pageinfo_t * const *) b;
+
+    return (pa->stamp > pb->stamp) - (pa->stamp < pb->stamp);
+}
 
-/* This function reorders the page list by iterating through it and moving any
- * pages that have been accessed since the last tick to the back so that the
- * least recently used pages tend to be in the front. It is called when the
- * virtual memory system has a timer tick for efficiency.
+
+/* This function reorders the page list by moving any pages that have been
+ * accessed since the last tick to the back, so that the least recently used
+ * pages tend to be in the front.  It is called when the virtual memory system
+ * has a timer tick for efficiency.  The accessed pages are found from the
+ * accessed bitmap rather than by walking the whole list, and are sorted back
+ * into list order before being moved, so that they keep their order at the
+ * back.  Then all of their bits are cleared, and their permissions reset to
+ * none, at once.
  */
 void policy_timer_tick() {
-    pageinfo_t * curr = pagelist.head, * prev = NULL;
-    page_t curr_page;
-
-    /*
-     * Iterate through the linked list. End condition can be curr being the tail
-     * because whether or not the tail has been accessed, it will remain the
-     * tail so no need to handle it.
-     */
-    while (curr != NULL) {
-        /*
-         * Get current page and move prev forward so it can be used to put curr
-         * in the right place later.
-         */
-        curr_page = curr->page;
-        prev = curr->next;
-
-        /* If the page has been accessed it should be moved. */
-        if (is_page_accessed(curr_page)) {
-            /* Remove from list and add again so it is at the end. */
-            policy_page_unmapped(curr_page);
-            policy_page_mapped(curr_page);
-
-            /* Reset accessed bit for next timer tick. */
-            clear_page_accessed(curr_page);
-
-            /* Reset permissions to none. */
-            set_page_permission(curr_page, PAGEPERM_NONE);
-
-            /* Free the old pageinfo as it is no longer used. */
-            free(curr);
-        }
-        /* Move forward in linked list. */
-        curr = prev;
+    unsigned int i, count = 0;
+    page_t page;
+
+    for (page = find_accessed_page(0); page < NUM_PAGES;
+         page = find_accessed_page(page + 1)) {
+        accessed[count] = find_page(&pagelist, page);
+        assert(accessed[count] != NULL);
+        count++;
     }
+
+    qsort(accessed, count, sizeof(accessed[0]), compare_stamps);
+
+    /* Move the nodes to the end of the list. */
+    for (i = 0; i < count; i++) {
+        remove_from_list(&pagelist, accessed[i]);
+        add_to_tail(&pagelist, accessed[i]);
+    }
+
+    clear_accessed_pages();
 }
 
 
@@ -8,6 +8,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "vmpolicy.h"
 
@@ -20,38 +21,31 @@
 /* A single node in the page-info linked list. */
 typedef struct pageinfo_t {
     page_t page;
+    struct pageinfo_t *prev;
     struct pageinfo_t *next;
 } pageinfo_t;
 
 
-/* A page-info linked list structure for tracking page details. */
+/* A page-info linked list structure for tracking page details.  The list is
+ * doubly linked, and each page's node is also recorded in a table indexed by
+ * page number, so that finding and removing a page don't have to search the
+ * list.
+ */
 typedef struct pagelist_t {
     pageinfo_t *head;
     pageinfo_t *tail;
+    pageinfo_t *by_page[NUM_PAGES];
 } pagelist_t;
 
 
 /* Find the pageinfo struct with the specified page number.  NULL is returned
- * if the page cannot be found.  If desired, the previous page can be returned
- * by this function as well.
+ * if the page cannot be found.
  */
-pageinfo_t * find_page(pagelist_t *list, page_t page, pageinfo_t **p_prev) {
-    pageinfo_t *pginfo, *prev;
-
+pageinfo_t * find_page(pagelist_t *list, page_t page) {
     assert(list != NULL);
+    assert(page < NUM_PAGES);
 
-    pginfo = list->head;
-    prev = NULL;
-    while (pginfo != NULL) {
-        if (pginfo->page == page) {
-            if (p_prev != NULL)
-                *p_prev = prev;
-            return pginfo;
-        }
-        prev = pginfo;
-        pginfo = pginfo->next;
-    }
-    return NULL;
+    return list->by_page[page];
 }
 
 
@@ -60,6 +54,7 @@ void add_to_tail(pagelist_t *list, pageinfo_t *pginfo) {
     assert(list != NULL);
     assert(pginfo != NULL);
 
+    pginfo->prev = list->tail;
     pginfo->next = NULL;
 
     if (list->tail != NULL)
@@ -71,25 +66,30 @@ void add_to_tail(pagelist_t *list, pageinfo_t *pginfo) {
 }
 
 
-/* Remove a pageinfo_t struct from the specified list.  The previous-node
- * pointer is necessary so that the linked list can be updated properly.  If
- * the node being removed is the first node in the list, the prev pointer
- * should be NULL (obvious).
+/* Remove a pageinfo_t struct from the specified list.  The node itself is
+ * left for the caller to free or to add to the list again.
  */
-void remove_from_list(pagelist_t *list, pageinfo_t *pginfo, pageinfo_t *prev) {
-    assert(prev == NULL || prev->next == pginfo);
+void remove_from_list(pagelist_t *list, pageinfo_t *pginfo) {
+    assert(list != NULL);
+    assert(pginfo != NULL);
 
-    if (prev != NULL) {
-        prev->next = pginfo->next;
+    if (pginfo->prev != NULL) {
+        pginfo->prev->next = pginfo->next;
     }
     else {
         assert(list->head == pginfo);
         list->head = pginfo->next;
     }
 
-    if (pginfo == list->tail)
-        list->tail = prev;
+    if (pginfo->next != NULL) {
+        pginfo->next->prev = pginfo->prev;
+    }
+    else {
+        assert(list->tail == pginfo);
+        list->tail = pginfo->prev;
+    }
 
+    pginfo->prev = NULL;
     pginfo->next = NULL;
 }
 
@@ -101,15 +101,32 @@ void add_page(pagelist_t *list, page_t page) {
     pageinfo_t *pginfo;
 
     assert(list != NULL);
-    assert(find_page(list, page, NULL) == NULL);
+    assert(find_page(list, page) == NULL);
 
     /* Always add the page to the back of the queue. */
 
     pginfo = malloc(sizeof(pageinfo_t));
+    if (pginfo == NULL) {
+        perror("malloc");
+        abort();
+    }
     pginfo->page = page;
-    pginfo->next = NULL;
 
     add_to_tail(list, pginfo);
+    list->by_page[page] = pginfo;
+}
+
+
+/* Remove the specified page from the linked list, and free its node. */
+void remove_page(pagelist_t *list, page_t page) {
+    pageinfo_t *pginfo;
+
+    pginfo = find_page(list, page);
+    assert(pginfo != NULL);
+
+    remove_from_list(list, pginfo);
+    list->by_page[page] = NULL;
+    free(pginfo);
 }
 
 
@@ -125,8 +142,7 @@ static pagelist_t pagelist;
 /* Initialize the policy.  Return 0 for success, -1 for failure. */
 int policy_init() {
     fprintf(stderr, "Using RANDOM eviction policy.\n\n");
-    pagelist.head = NULL;
-    pagelist.tail = NULL;
+    memset(&pagelist, 0, sizeof(pagelist));
     return 0;
 }
 
@@ -144,12 +160,7 @@ void policy_page_mapped(page_t page) {
  * pages.
  */
 void policy_page_unmapped(page_t page) {
-    pageinfo_t *pginfo, *prev;
-
-    pginfo = find_page(&pagelist, page, &prev);
-    assert(pginfo != NULL);
-
-    remove_from_list(&pagelist, pginfo, prev);
+    remove_page(&pagelist, page);
 }
 
 
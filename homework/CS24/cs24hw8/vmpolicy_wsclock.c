@@ -0,0 +1,232 @@
+/*============================================================================
+ * Implementation of the WSClock (working-set clock) page replacement policy.
+ *
+ * Every resident page has an 8-bit age.  On each timer tick the ages are
+ * shifted right, and the page's accessed bit is shifted in at the top and
+ * cleared, so the age records which of the last eight ticks the page was
+ * used in.  A page used in any of the last WS_WINDOW ticks, or since the last
+ * tick, is in the working set.
+ *
+ * As in the CLOCK policy, the resident pages sit in a circular array of
+ * slots that a hand sweeps around.  A page that the hand finds accessed is
+ * given a second chance:  its bit is cleared and it counts as used in the
+ * current tick.  The first clean page that the hand finds outside the working
+ * set is evicted, since dropping it needs no write.
+ * If the hand gets all the way around without finding one, the first dirty
+ * page outside the working set is evicted instead, and if every page is in
+ * the working set, the one with the lowest age is.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "vmpolicy.h"
+
+
+/* The number of ticks, up to 8, that a page stays in the working set after
+ * it was last accessed.
+ */
+#define WS_WINDOW 2
+
+/* The bits of the age for the ticks in the working-set window. */
+#define WS_MASK ((unsigned char) (0xFF << (8 - WS_WINDOW)))
+
+
+/*============================================================================
+ * Clock Data Structure
+ */
+
+
+/* The value of an empty slot, and of the slot of a page that isn't
+ * resident.
+ */
+#define NO_SLOT NUM_PAGES
+
+
+/* The page in each slot of the clock, or NO_SLOT if the slot is free. */
+static page_t slot_page[NUM_PAGES];
+
+/* The slot that each resident page is in, or NO_SLOT. */
+static unsigned int page_slot[NUM_PAGES];
+
+/* The age of each resident page. */
+static unsigned char page_age[NUM_PAGES];
+
+/* The number of slots that have ever been used; the hand wraps around at
+ * this point.  It never exceeds the maximum number of resident pages.
+ */
+static unsigned int num_slots;
+
+/* Slots that have been emptied, to be filled before any new slot is used. */
+static unsigned int free_slots[NUM_PAGES];
+static unsigned int num_free_slots;
+
+/* The slot that the hand will look at next. */
+static unsigned int hand;
+
+
+/* Returns nonzero if the page has been used within the working-set window,
+ * not counting an access since the hand or the tick last cleared its bit.
+ */
+static int in_working_set(page_t page) {
+    return (page_age[page] & WS_MASK) != 0;
+}
+
+
+/* Record an access to the page in the current tick, and take its permission
+ * away again so that the next access is noticed.
+ */
+static void note_access(page_t page) {
+    page_age[page] |= 0x80;
+    clear_page_accessed(page);
+    set_page_permission(page, PAGEPERM_NONE);
+}
+
+
+/*============================================================================
+ * Policy Implementation
+ */
+
+
+/* Initialize the policy.  Return 0 for success, -1 for failure. */
+int policy_init() {
+    unsigned int i;
+
+    fprintf(stderr, "Using WSCLOCK eviction policy.\n\n");
+
+    for (i = 0; i < NUM_PAGES; i++) {
+        slot_page[i] = NO_SLOT;
+        page_slot[i] = NO_SLOT;
+        page_age[i] = 0;
+    }
+    num_slots = 0;
+    num_free_slots = 0;
+    hand = 0;
+    return 0;
+}
+
+
+/* This function is called when the virtual memory system maps a page into the
+ * virtual address space.  Put the page in an empty slot, which is the last
+ * victim's slot when the page is replacing one.  A new page starts with an
+ * age of 0; the access that faulted it in sets its accessed bit straight
+ * away.
+ */
+void policy_page_mapped(page_t page) {
+    unsigned int slot;
+
+    assert(page < NUM_PAGES);
+    assert(page_slot[page] == NO_SLOT);
+
+    if (num_free_slots > 0)
+        slot = free_slots[--num_free_slots];
+    else
+        slot = num_slots++;
+
+    assert(slot < NUM_PAGES);
+    assert(slot_page[slot] == NO_SLOT);
+
+    slot_page[slot] = page;
+    page_slot[page] = slot;
+    page_age[page] = 0;
+}
+
+
+/* This function is called when the virtual memory system unmaps a page from
+ * the virtual address space.  Empty the page's slot, so that the next page
+ * to be mapped can use it.
+ */
+void policy_page_unmapped(page_t page) {
+    unsigned int slot;
+
+    assert(page < NUM_PAGES);
+
+    slot = page_slot[page];
+    assert(slot != NO_SLOT);
+
+    slot_page[slot] = NO_SLOT;
+    page_slot[page] = NO_SLOT;
+    free_slots[num_free_slots++] = slot;
+}
+
+
+/* This function is called when the virtual memory system has a timer tick.
+ * Age every resident page, shifting its accessed bit into its age, and take
+ * its permission away again so that the next access to it is noticed.  The
+ * accessed pages are found from the accessed bitmap, and their bits are all
+ * cleared at once.
+ */
+void policy_timer_tick() {
+    unsigned int slot;
+    page_t page;
+
+    for (slot = 0; slot < num_slots; slot++) {
+        page = slot_page[slot];
+        if (page != NO_SLOT)
+            page_age[page] >>= 1;
+    }
+
+    for (page = find_accessed_page(0); page < NUM_PAGES;
+         page = find_accessed_page(page + 1))
+        page_age[page] |= 0x80;
+
+    clear_accessed_pages();
+}
+
+
+/* Sweep the hand around the clock, at most once, for a clean page outside the
+ * working set, giving accessed pages a second chance.  The first dirty page
+ * outside the working set, and the page with the lowest age, are remembered
+ * along the way in case there isn't one.
+ */
+page_t choose_victim_page() {
+    page_t page, victim = NO_SLOT, dirty_victim = NO_SLOT;
+    page_t oldest = NO_SLOT;
+    unsigned int i, age, oldest_age = 0;
+
+    assert(num_slots > 0);
+
+    for (i = 0; i < num_slots; i++) {
+        page = slot_page[hand];
+        hand = (hand + 1) % num_slots;
+
+        if (page == NO_SLOT)
+            continue;
+
+        /* A page that the hand finds accessed ranks as the youngest. */
+        age = page_age[page];
+        if (is_page_accessed(page)) {
+            note_access(page);
+            age = 0x100;
+        }
+
+        if (oldest == NO_SLOT || age < oldest_age) {
+            oldest = page;
+            oldest_age = age;
+        }
+
+        if (in_working_set(page))
+            continue;
+
+        if (!is_page_dirty(page)) {
+            victim = page;
+            break;
+        }
+
+        if (dirty_victim == NO_SLOT)
+            dirty_victim = page;
+    }
+
+    if (victim == NO_SLOT)
+        victim = (dirty_victim != NO_SLOT) ? dirty_victim : oldest;
+
+    assert(victim != NO_SLOT);
+    assert(is_page_resident(victim));
+
+#if VERBOSE
+    fprintf(stderr, "Choosing victim page %u to evict.\n", victim);
+#endif
+
+    return victim;
+}
@@ -0,0 +1,342 @@
+/*============================================================================
+ * Implementation of the compressed in-memory swap tier.
+ *
+ * Each stored page has an entry holding its PackBits encoding, or just a flag
+ * if the page was all zeros.  The entries are kept on a list in the order that
+ * they were stored, so that the oldest can be spilled to the swap file when
+ * the pool runs out of space.  As with the policies, we don't mind using
+ * malloc() and free() from the signal handler.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vmzswap.h"
+#include "rl_packbits.h"
+
+
+/* Pages that don't compress to at most this many bytes aren't worth keeping
+ * in the pool.
+ */
+#define ZSWAP_MAX_STORED (PAGE_SIZE * 3 / 4)
+
+/* Before a whole page is compressed, this many bytes from its start are, and
+ * the page is only compressed if they shrink by as much as a whole page must;
+ * most pages that don't compress are turned away for an eighth of the work.
+ */
+#define ZSWAP_SAMPLE (PAGE_SIZE / 8)
+
+/* After each page that is turned away, compression isn't tried on the
+ * following pages, for twice as many pages as after the last one, up to this
+ * many, so that a workload whose pages don't compress pays little for the
+ * tier.  Zero pages are still kept while backing off, as long as the page
+ * could be looked at cheaply.
+ */
+#define ZSWAP_MAX_BACKOFF 64
+
+
+/* The value of a missing link in the list of stored pages. */
+#define NO_PAGE NUM_PAGES
+
+
+/* A stored page.  data is NULL and size is 0 for a zero page. */
+typedef struct zentry_t {
+    int stored;
+    int dirty;
+    unsigned char *data;
+    unsigned int size;
+
+    /* Neighbors in the list of stored pages, oldest first. */
+    page_t prev;
+    page_t next;
+} zentry_t;
+
+
+static zentry_t entries[NUM_PAGES];
+static page_t oldest, newest;
+
+static size_t budget;
+static size_t pool_bytes;
+static zswap_spill_func spill_page;
+
+static unsigned int num_stores;
+static unsigned int num_zero_pages;
+static unsigned int num_loads;
+static unsigned int num_spills;
+static unsigned int num_rejects;
+
+/* How many more pages not to try compressing, and how many to skip after the
+ * next page that is turned away.
+ */
+static unsigned int skip_left;
+static unsigned int backoff;
+
+/* Where pages are compressed to before being copied into the pool.  Only the
+ * fault handler uses the pool, so one buffer will do.
+ */
+static unsigned char scratch[RL_PACKBITS_BOUND(PAGE_SIZE)];
+
+
+/*============================================================================
+ * Helper Functions
+ */
+
+
+/* Note that a page was turned away, and back off from trying more. */
+static void reject() {
+    num_rejects++;
+    if (backoff == 0)
+        backoff = 1;
+    else if (backoff < ZSWAP_MAX_BACKOFF)
+        backoff *= 2;
+    skip_left = backoff;
+}
+
+
+/* Compress length bytes into scratch, and return the compressed size. */
+static int compress(const void *data, int length) {
+    rl_packbits_encoder enc;
+    int size;
+
+    rl_packbits_encoder_init(&enc);
+    size = rl_packbits_encode_chunk(&enc, data, length, scratch);
+    size += rl_packbits_encode_finish(&enc, scratch + size);
+    return size;
+}
+
+
+/* Returns nonzero if the page is all zeros. */
+static int is_zero_page(const void *data) {
+    const unsigned long *word = data;
+    unsigned int i;
+
+    for (i = 0; i < PAGE_SIZE / sizeof(unsigned long); i++) {
+        if (word[i] != 0)
+            return 0;
+    }
+    return 1;
+}
+
+
+/* Add the page's entry to the newest end of the list. */
+static void append_entry(page_t page) {
+    entries[page].prev = newest;
+    entries[page].next = NO_PAGE;
+
+    if (newest != NO_PAGE)
+        entries[newest].next = page;
+    else
+        oldest = page;
+
+    newest = page;
+}
+
+
+/* Take the page's entry out of the pool, and free its data. */
+static void remove_entry(page_t page) {
+    zentry_t *entry = &entries[page];
+
+    assert(entry->stored);
+
+    if (entry->prev != NO_PAGE)
+        entries[entry->prev].next = entry->next;
+    else
+        oldest = entry->next;
+
+    if (entry->next != NO_PAGE)
+        entries[entry->next].prev = entry->prev;
+    else
+        newest = entry->prev;
+
+    pool_bytes -= entry->size;
+    free(entry->data);
+    memset(entry, 0, sizeof(*entry));
+}
+
+
+/* Write the oldest page in the pool to the swap file, if the swap file's copy
+ * is out of date, and drop it.
+ */
+static void spill_oldest() {
+    static unsigned char page_data[PAGE_SIZE];
+    page_t page = oldest;
+    zentry_t *entry = &entries[page];
+
+    assert(page != NO_PAGE);
+
+    if (entry->dirty) {
+        memset(page_data, 0, PAGE_SIZE);
+        rl_packbits_decode_into(entry->data, entry->size, page_data);
+        spill_page(page, page_data);
+    }
+
+    remove_entry(page);
+    num_spills++;
+}
+
+
+/*============================================================================
+ * Pool Implementation
+ */
+
+
+void zswap_init(size_t _budget, zswap_spill_func spill) {
+    memset(entries, 0, sizeof(entries));
+    oldest = NO_PAGE;
+    newest = NO_PAGE;
+
+    budget = _budget;
+    pool_bytes = 0;
+    spill_page = spill;
+
+    num_stores = 0;
+    num_zero_pages = 0;
+    num_loads = 0;
+    num_spills = 0;
+    num_rejects = 0;
+    skip_left = 0;
+    backoff = 0;
+}
+
+
+int zswap_enabled() {
+    return budget > 0;
+}
+
+
+int zswap_should_try(int dirty) {
+    if (!zswap_enabled())
+        return 0;
+
+    if (!dirty && skip_left > 0) {
+        skip_left--;
+        num_rejects++;
+        return 0;
+    }
+    return 1;
+}
+
+
+int zswap_store(page_t page, const void *data, int dirty) {
+    zentry_t *entry;
+    int size;
+
+    assert(page < NUM_PAGES);
+    assert(!entries[page].stored);
+
+    if (!zswap_enabled())
+        return 0;
+
+    entry = &entries[page];
+
+    if (is_zero_page(data)) {
+        /* A zero page is just a flag; it costs nothing in the pool. */
+        size = 0;
+        num_zero_pages++;
+    }
+    else if (skip_left > 0) {
+        skip_left--;
+        num_rejects++;
+        return 0;
+    }
+    else {
+        if (compress(data, ZSWAP_SAMPLE) >
+            ZSWAP_SAMPLE * ZSWAP_MAX_STORED / PAGE_SIZE) {
+            reject();
+            return 0;
+        }
+
+        size = compress(data, PAGE_SIZE);
+        if (size > ZSWAP_MAX_STORED || (size_t) size > budget) {
+            reject();
+            return 0;
+        }
+        backoff = 0;
+
+        /* Make room by spilling the oldest pages. */
+        while (pool_bytes + size > budget)
+            spill_oldest();
+
+        entry->data = malloc(size);
+        if (entry->data == NULL) {
+            reject();
+            return 0;
+        }
+        memcpy(entry->data, scratch, size);
+    }
+
+    entry->stored = 1;
+    entry->dirty = dirty;
+    entry->size = size;
+    pool_bytes += size;
+    append_entry(page);
+
+    num_stores++;
+    return 1;
+}
+
+
+int zswap_load(page_t page, void *dest, int *dirty) {
+    zentry_t *entry;
+
+    assert(page < NUM_PAGES);
+
+    entry = &entries[page];
+    if (!entry->stored)
+        return 0;
+
+    /* A zero page needs nothing written, since dest is already zeroed. */
+    if (entry->size > 0)
+        rl_packbits_decode_into(entry->data, entry->size, dest);
+
+    *dirty = entry->dirty;
+    remove_entry(page);
+    num_loads++;
+    return 1;
+}
+
+
+void zswap_drop(page_t page) {
+    assert(page < NUM_PAGES);
+
+    if (entries[page].stored)
+        remove_entry(page);
+}
+
+
+int zswap_contains(page_t page) {
+    assert(page < NUM_PAGES);
+    return entries[page].stored;
+}
+
+
+unsigned int zswap_num_stores() {
+    return num_stores;
+}
+
+
+unsigned int zswap_num_zero_pages() {
+    return num_zero_pages;
+}
+
+
+unsigned int zswap_num_loads() {
+    return num_loads;
+}
+
+
+unsigned int zswap_num_spills() {
+    return num_spills;
+}
+
+
+unsigned int zswap_num_rejects() {
+    return num_rejects;
+}
+
+
+size_t zswap_pool_bytes() {
+    return pool_bytes;
+}
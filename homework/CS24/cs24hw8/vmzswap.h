@@ -0,0 +1,72 @@
+/*============================================================================
+ * Declarations for the compressed in-memory swap tier, which sits between the
+ * resident pages and the swap file.
+ *
+ * Evicted pages are compressed with PackBits (from cs24hw3/rle) into a pool
+ * of a fixed size, so that faulting one back in doesn't need to read the swap
+ * file.  A page that is all zeros takes no space in the pool at all.  When the
+ * pool is full, its oldest pages are spilled to the swap file to make room.
+ */
+
+#ifndef VMZSWAP_H
+#define VMZSWAP_H
+
+#include <stddef.h>
+
+#include "virtualmem.h"
+
+
+/* The function that the pool spills a page with.  It must write the page's
+ * contents to the page's slot in the swap file.
+ */
+typedef void (*zswap_spill_func)(page_t page, const void *data);
+
+
+/* Start the pool with space for budget bytes of compressed data.  A budget of
+ * 0 leaves the tier off.
+ */
+void zswap_init(size_t budget, zswap_spill_func spill);
+
+/* Returns nonzero if the tier is on. */
+int zswap_enabled();
+
+/* Returns nonzero if an evicted page should be offered to the pool.  A dirty
+ * page always is, since it has to be made readable to be written out anyway,
+ * and may be a zero page.  After a run of pages that didn't compress, the pool
+ * backs off from trying more for a while, and clean pages needn't even be made
+ * readable for it.
+ */
+int zswap_should_try(int dirty);
+
+/* Store an evicted page's contents in the pool.  dirty says whether the swap
+ * file's copy of the page is out of date.  Returns nonzero if the page was
+ * stored; if it wasn't, because it doesn't compress well enough, a dirty page
+ * must still be written to the swap file.
+ */
+int zswap_store(page_t page, const void *data, int dirty);
+
+/* If the page is in the pool, decompress it into dest, which must be writable
+ * and already filled with zeros, drop it from the pool, and return nonzero.
+ * *dirty is set to whether the swap file's copy is still out of date, in
+ * which case the page must be marked dirty again.  Returns 0 if the page
+ * isn't in the pool.
+ */
+int zswap_load(page_t page, void *dest, int *dirty);
+
+/* Drop the page from the pool without loading it, if it is there, since its
+ * contents are no longer wanted.
+ */
+void zswap_drop(page_t page);
+
+/* Returns nonzero if the page is in the pool. */
+int zswap_contains(page_t page);
+
+/* Statistics about the pool. */
+unsigned int zswap_num_stores();
+unsigned int zswap_num_zero_pages();
+unsigned int zswap_num_loads();
+unsigned int zswap_num_spills();
+unsigned int zswap_num_rejects();
+size_t zswap_pool_bytes();
+
+#endif /* VMZSWAP_H */
@@ -121,6 +121,9 @@ void alu_eval(ALU *alu) {
             break;
     }
 
+    /* Registers only hold DATA_BITS bits. */
+    result = TRUNCATE_DATA(result);
+
     pin_set(alu->out, result);
 
     /* Set the status output to be 1 if the result is 0, or 0 otherwise. */
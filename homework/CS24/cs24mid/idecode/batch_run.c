@@ -0,0 +1,292 @@
+/*! \file
+ * This file contains the main entry point for running one program against many
+ * initial register files at once.  The program is loaded and predecoded once,
+ * and the runs are shared out among a pool of threads, each of which runs
+ * them on the fast functional simulator, or SIMD_LANES at a time on the
+ * lockstep simulator.
+ *
+ * The register files are read from one batch file, with one register file per
+ * line:  NUM_REGISTERS hexadecimal values separated by whitespace.  Blank lines
+ * and anything after a '#' are ignored.  For each register file, one line is
+ * written to the output file, in the same order:  the final values of the
+ * registers, followed by the number of instructions that the run took, or -1
+ * if it reached the instruction limit.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "instruction_store.h"
+#include "branching_decode.h"
+#include "fast_sim.h"
+#include "jit.h"
+#include "simd_sim.h"
+
+
+/*! How many runs a thread takes from the batch at a time. */
+#define BATCH_CHUNK 64
+
+/* The ways that the runs can be dispatched, as in run's -d option. */
+#define DISPATCH_SWITCH   0
+#define DISPATCH_THREADED 1
+#define DISPATCH_JIT      2
+#define DISPATCH_SIMD     3
+
+
+/*! The batch of runs that the threads share. */
+typedef struct Batch {
+    const DecodedInstr *program;  /*!< The predecoded program. */
+    int dispatch;                 /*!< One of the DISPATCH_XXXX values. */
+    int max_steps;                /*!< The instruction limit of each run. */
+
+    ArchState *states;  /*!< The state of each run, initial then final. */
+    int *steps;         /*!< What each run returned. */
+    int num_runs;
+
+    /*! The first run that no thread has taken yet. */
+    int next_run;
+} Batch;
+
+
+/*! Prints the usage message and exits. */
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-j threads] [-d switch|threaded|jit|simd] "
+                    "[-t max-instructions] instruction-file batch-file "
+                    "output-file\n"
+                    "\t-j  the number of threads (default: one per CPU)\n"
+                    "\t-d  how instructions are dispatched (default switch)\n"
+                    "\t-t  the instruction limit of each run "
+                    "(default 1000000)\n", prog);
+    exit(1);
+}
+
+
+/*! Returns the current time in seconds. */
+static double get_seconds() {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/*!
+ * Reads every register file in the batch file into batch->states, and sets
+ * batch->num_runs.  The program is terminated if a line has the wrong number
+ * of values.
+ */
+static void load_batch(FILE *fd, const char *name, Batch *batch) {
+    char buf[1000], *p, *end, *comment;
+    int capacity = 0, line_no = 0, i;
+    ArchState *state;
+
+    batch->num_runs = 0;
+    batch->states = NULL;
+
+    while (fgets(buf, sizeof(buf), fd)) {
+        line_no++;
+
+        comment = strchr(buf, '#');
+        if (comment)
+            *comment = '\0';
+
+        p = buf;
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+            p++;
+        if (*p == '\0')
+            continue;
+
+        if (batch->num_runs == capacity) {
+            capacity = capacity ? 2 * capacity : 1024;
+            batch->states = realloc(batch->states,
+                                    capacity * sizeof(ArchState));
+            if (!batch->states) {
+                fprintf(stderr, "Out of memory loading the batch!\n");
+                exit(11);
+            }
+        }
+
+        state = &batch->states[batch->num_runs];
+        memset(state, 0, sizeof(ArchState));
+
+        for (i = 0; i < NUM_REGISTERS; i++) {
+            state->regs[i] = TRUNCATE_DATA(strtoul(p, &end, 16));
+            if (end == p)
+                break;
+            p = end;
+        }
+        if (i < NUM_REGISTERS || strtoul(p, &end, 16) != 0 || end != p) {
+            fprintf(stderr, "%s:%d:  expected %d hexadecimal values\n",
+                    name, line_no, NUM_REGISTERS);
+            exit(2);
+        }
+
+        batch->num_runs++;
+    }
+
+    fclose(fd);
+}
+
+
+/*!
+ * The body of each thread in the pool:  takes runs from the batch until there
+ * are none left, and runs them.
+ */
+static void * run_batch_thread(void *arg) {
+    Batch *batch = arg;
+    Jit *jit = NULL;
+    int first, i;
+
+    /* Each thread translates the program for itself, so that the threads
+     * never share a JIT.
+     */
+    if (batch->dispatch == DISPATCH_JIT)
+        jit = build_jit(batch->program);
+
+    while (1) {
+        first = __sync_fetch_and_add(&batch->next_run, BATCH_CHUNK);
+        if (first >= batch->num_runs)
+            break;
+
+        if (batch->dispatch == DISPATCH_SIMD) {
+            for (i = first; i < first + BATCH_CHUNK && i < batch->num_runs;
+                 i += SIMD_LANES) {
+                int lanes = batch->num_runs - i;
+
+                run_lanes(batch->program, &batch->states[i], &batch->steps[i],
+                          lanes < SIMD_LANES ? lanes : SIMD_LANES,
+                          batch->max_steps);
+            }
+            continue;
+        }
+
+        for (i = first; i < first + BATCH_CHUNK && i < batch->num_runs; i++) {
+            ArchState *state = &batch->states[i];
+
+            if (jit)
+                batch->steps[i] = run_jit(jit, state, batch->max_steps);
+            else if (batch->dispatch == DISPATCH_THREADED)
+                batch->steps[i] = run_threaded(batch->program, state,
+                                               batch->max_steps);
+            else
+                batch->steps[i] = run_fast(batch->program, state,
+                                           batch->max_steps);
+        }
+    }
+
+    if (jit)
+        free_jit(jit);
+
+    return NULL;
+}
+
+
+/*! Run the program against every register file in the batch. */
+int main(int argc, char **argv) {
+    FILE *bfd;     /* File for loading the batch of register files from. */
+    FILE *ofd;     /* File for storing the final register files to. */
+    InstructionStore *is;
+    DecodedInstr program[INSTRUCTION_STORE_DEPTH];
+    Batch batch;
+    pthread_t *threads;
+    int num_threads, opt, i, j, finished;
+    double start, seconds;
+
+    memset(&batch, 0, sizeof(Batch));
+    batch.dispatch = DISPATCH_SWITCH;
+    batch.max_steps = 1000000;
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((opt = getopt(argc, argv, "j:d:t:")) != -1) {
+        switch (opt) {
+        case 'j':
+            num_threads = atoi(optarg);
+            break;
+        case 'd':
+            if (strcmp(optarg, "switch") == 0)
+                batch.dispatch = DISPATCH_SWITCH;
+            else if (strcmp(optarg, "threaded") == 0)
+                batch.dispatch = DISPATCH_THREADED;
+            else if (strcmp(optarg, "jit") == 0)
+                batch.dispatch = DISPATCH_JIT;
+            else if (strcmp(optarg, "simd") == 0)
+                batch.dispatch = DISPATCH_SIMD;
+            else
+                usage(argv[0]);
+            break;
+        case 't':
+            batch.max_steps = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (argc - optind < 3 || num_threads <= 0 || batch.max_steps <= 0)
+        usage(argv[0]);
+    argv += optind - 1;
+
+    is = build_instruction_store();
+    load_instruction_store_from_file(argv[1], is);
+    predecode(is, program);
+    batch.program = program;
+
+    bfd = fopen(argv[2], "r");
+    if (!bfd) {
+        fprintf(stderr, "Opening %s: ", argv[2]);
+        perror("fopen");
+        exit(2);
+    }
+    load_batch(bfd, argv[2], &batch);
+
+    ofd = fopen(argv[3], "w");
+    if (!ofd) {
+        fprintf(stderr, "Opening %s: ", argv[3]);
+        perror("fopen");
+        exit(2);
+    }
+
+    batch.steps = malloc((batch.num_runs + 1) * sizeof(int));
+    threads = malloc(num_threads * sizeof(pthread_t));
+    if (!batch.steps || !threads) {
+        fprintf(stderr, "Out of memory starting the batch!\n");
+        exit(11);
+    }
+
+    start = get_seconds();
+    for (i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, run_batch_thread, &batch) != 0) {
+            perror("pthread_create");
+            exit(12);
+        }
+    }
+    for (i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+    seconds = get_seconds() - start;
+
+    finished = 0;
+    for (i = 0; i < batch.num_runs; i++) {
+        for (j = 0; j < NUM_REGISTERS; j++)
+            fprintf(ofd, "%lX ", batch.states[i].regs[j]);
+        fprintf(ofd, "%d\n", batch.steps[i]);
+        finished += (batch.steps[i] >= 0);
+    }
+    fclose(ofd);
+
+    printf("Ran %d register files on %d threads in %.3f seconds; "
+           "%d finished, %d reached the instruction limit.\n",
+           batch.num_runs, num_threads, seconds, finished,
+           batch.num_runs - finished);
+
+    free(batch.states);
+    free(batch.steps);
+    free(threads);
+    free_instruction_store(is);
+
+    return 0;
+}
@@ -0,0 +1,192 @@
+/*! \file
+ *
+ * This file contains the definitions for the branch predictors.
+ *
+ * The bimodal predictor indexes its table of 2-bit saturating counters by the
+ * branch's address, and gshare by the address XORed with the outcomes of the
+ * most recent conditional branches, so that it can tell apart the same branch
+ * on different paths through the program.  A counter of 2 or 3 predicts taken.
+ * Unconditional branches are always taken, so they don't use the counters, but
+ * they do use the BTB.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "branch_predictor.h"
+
+
+/*!
+ * Allocates and initializes a branch predictor of the given kind, with
+ * 1 << table_bits counters and btb_size BTB entries.  The counters start out
+ * weakly not taken.  If allocation fails, the program is terminated.
+ */
+BranchPredictor * build_branch_predictor(PredictorKind kind, int table_bits,
+                                         int btb_size) {
+    BranchPredictor *bp = malloc(sizeof(BranchPredictor));
+    if (!bp) {
+        fprintf(stderr, "Out of memory building a branch predictor!\n");
+        exit(11);
+    }
+    memset(bp, 0, sizeof(BranchPredictor));
+
+    bp->kind = kind;
+    bp->table_bits = table_bits;
+    bp->btb_size = btb_size;
+
+    bp->counters = malloc(1 << table_bits);
+    bp->btb_tag = calloc(btb_size + 1, sizeof(busdata_t));
+    bp->btb_target = calloc(btb_size + 1, sizeof(busdata_t));
+    bp->btb_valid = calloc(btb_size + 1, 1);
+    if (!bp->counters || !bp->btb_tag || !bp->btb_target || !bp->btb_valid) {
+        fprintf(stderr, "Out of memory building a branch predictor!\n");
+        exit(11);
+    }
+    memset(bp->counters, 1, 1 << table_bits);
+
+    return bp;
+}
+
+
+/*! Frees the branch predictor. */
+void free_branch_predictor(BranchPredictor *bp) {
+    free(bp->counters);
+    free(bp->btb_tag);
+    free(bp->btb_target);
+    free(bp->btb_valid);
+    free(bp);
+}
+
+
+/*! Returns the index of the counter for the branch at pc. */
+static unsigned int counter_index(BranchPredictor *bp, busdata_t pc) {
+    unsigned int mask = (1U << bp->table_bits) - 1;
+
+    if (bp->kind == PREDICT_GSHARE)
+        return (pc ^ bp->history) & mask;
+    return pc & mask;
+}
+
+
+/*!
+ * Predicts the branch at pc, and returns 1 if it will be taken.  If the BTB
+ * has the branch's target, *btb_hit is set to 1 and the target is stored in
+ * *target; otherwise *btb_hit is set to 0.
+ */
+int predict_branch(BranchPredictor *bp, busdata_t pc, int conditional,
+                   int *btb_hit, busdata_t *target) {
+    int slot;
+
+    *btb_hit = 0;
+    if (bp->btb_size > 0) {
+        slot = pc % bp->btb_size;
+        if (bp->btb_valid[slot] && bp->btb_tag[slot] == pc) {
+            *btb_hit = 1;
+            *target = bp->btb_target[slot];
+        }
+    }
+
+    if (!conditional)
+        return 1;
+    if (bp->kind == PREDICT_NOT_TAKEN)
+        return 0;
+
+    return bp->counters[counter_index(bp, pc)] >= 2;
+}
+
+
+/*!
+ * Tells the predictor what the branch at pc did, after predict_branch()
+ * predicted it.  predicted is what was predicted, and target is where the
+ * branch goes when it is taken.
+ */
+void update_branch_predictor(BranchPredictor *bp, busdata_t pc,
+                             int conditional, int predicted, int taken,
+                             busdata_t target) {
+    unsigned char *counter;
+    int slot;
+
+    if (pc < INSTRUCTION_STORE_DEPTH) {
+        BranchStats *stats = &bp->stats[pc];
+
+        stats->executed++;
+        stats->taken += taken;
+        stats->mispredicted += (predicted != taken);
+
+        if (bp->btb_size > 0) {
+            slot = pc % bp->btb_size;
+            stats->btb_hits += (bp->btb_valid[slot] && bp->btb_tag[slot] == pc);
+        }
+    }
+
+    if (taken && bp->btb_size > 0) {
+        slot = pc % bp->btb_size;
+        bp->btb_valid[slot] = 1;
+        bp->btb_tag[slot] = pc;
+        bp->btb_target[slot] = target;
+    }
+
+    if (!conditional || bp->kind == PREDICT_NOT_TAKEN)
+        return;
+
+    counter = &bp->counters[counter_index(bp, pc)];
+    if (taken && *counter < 3)
+        (*counter)++;
+    else if (!taken && *counter > 0)
+        (*counter)--;
+
+    if (bp->kind == PREDICT_GSHARE) {
+        bp->history = ((bp->history << 1) | taken) &
+                      ((1U << bp->table_bits) - 1);
+    }
+}
+
+
+/*! Returns the name of the kind of predictor. */
+const char * predictor_name(PredictorKind kind) {
+    switch (kind) {
+        case PREDICT_BIMODAL:  return "bimodal";
+        case PREDICT_GSHARE:   return "gshare";
+        default:               return "not-taken";
+    }
+}
+
+
+/*! Prints the statistics of every branch that ran, and their totals. */
+void print_branch_stats(FILE *fd, BranchPredictor *bp) {
+    BranchStats total;
+    int pc;
+
+    memset(&total, 0, sizeof(total));
+
+    fprintf(fd, "Branch predictor:  %s, %d counters, %d BTB entries\n",
+            predictor_name(bp->kind), 1 << bp->table_bits, bp->btb_size);
+    fprintf(fd, "  PC     executed        taken mispredicted accuracy "
+                "    BTB hits\n");
+
+    for (pc = 0; pc < INSTRUCTION_STORE_DEPTH; pc++) {
+        BranchStats *s = &bp->stats[pc];
+
+        if (s->executed == 0)
+            continue;
+
+        fprintf(fd, "  %02d %12ld %12ld %12ld  %6.2f%% %12ld\n", pc,
+                s->executed, s->taken, s->mispredicted,
+                100.0 * (s->executed - s->mispredicted) / s->executed,
+                s->btb_hits);
+
+        total.executed += s->executed;
+        total.taken += s->taken;
+        total.mispredicted += s->mispredicted;
+        total.btb_hits += s->btb_hits;
+    }
+
+    if (total.executed > 0) {
+        fprintf(fd, "  all%12ld %12ld %12ld  %6.2f%% %12ld\n",
+                total.executed, total.taken, total.mispredicted,
+                100.0 * (total.executed - total.mispredicted) / total.executed,
+                total.btb_hits);
+    }
+}
@@ -0,0 +1,80 @@
+/*! \file
+ *
+ * This file contains declarations for the branch predictors that the branch
+ * unit and the pipeline's timing model can use.  A predictor guesses whether
+ * each conditional branch will be taken, and a branch target buffer (BTB)
+ * remembers where taken branches went, so that a pipeline can fetch from the
+ * target before the branch is decoded.  The predictor keeps statistics for
+ * every branch in the program.
+ */
+
+
+#ifndef BRANCH_PREDICTOR_H
+#define BRANCH_PREDICTOR_H
+
+
+#include <stdio.h>
+
+#include "bus.h"
+#include "instruction_store.h"
+
+
+/*! The kinds of direction predictor. */
+typedef enum PredictorKind {
+    PREDICT_NOT_TAKEN,  /*!< Always predicts not taken. */
+    PREDICT_BIMODAL,    /*!< A 2-bit counter for each branch address. */
+    PREDICT_GSHARE      /*!< 2-bit counters indexed by address XOR history. */
+} PredictorKind;
+
+
+/*! What happened to the branch at one address. */
+typedef struct BranchStats {
+    long executed;      /*!< Times the branch was run. */
+    long taken;         /*!< Times it was taken. */
+    long mispredicted;  /*!< Times its direction was predicted wrongly. */
+    long btb_hits;      /*!< Times the BTB had its target. */
+} BranchStats;
+
+
+/*! A branch predictor and its branch target buffer. */
+typedef struct BranchPredictor {
+    PredictorKind kind;
+
+    /*! The 2-bit counters, of which there are 1 << table_bits. */
+    unsigned char *counters;
+    int table_bits;
+
+    /*! The outcomes of the last table_bits conditional branches, for gshare. */
+    unsigned int history;
+
+    /*!
+     * The branch target buffer, direct-mapped by address, with btb_size
+     * entries.  With no entries, taken branches are only redirected once they
+     * are decoded.
+     */
+    int btb_size;
+    busdata_t *btb_tag;
+    busdata_t *btb_target;
+    unsigned char *btb_valid;
+
+    /*! The statistics for the branch at each address. */
+    BranchStats stats[INSTRUCTION_STORE_DEPTH];
+} BranchPredictor;
+
+
+/* Documentation appears in branch_predictor.c. */
+BranchPredictor * build_branch_predictor(PredictorKind kind, int table_bits,
+                                         int btb_size);
+void free_branch_predictor(BranchPredictor *bp);
+
+int predict_branch(BranchPredictor *bp, busdata_t pc, int conditional,
+                   int *btb_hit, busdata_t *target);
+void update_branch_predictor(BranchPredictor *bp, busdata_t pc,
+                             int conditional, int predicted, int taken,
+                             busdata_t target);
+
+const char * predictor_name(PredictorKind kind);
+void print_branch_stats(FILE *fd, BranchPredictor *bp);
+
+
+#endif /* BRANCH_PREDICTOR_H */
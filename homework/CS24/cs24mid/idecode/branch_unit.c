@@ -47,11 +47,14 @@ void free_branch_unit(BranchUnit *bru) {
 /*! 
  * This function performs the branching test.  It reads the current opcode and
  * the output from the first source register, and then writes either BRANCH or
- * NOBRANCH to the branch pin.
+ * NOBRANCH to the branch pin.  If the branch unit has a predictor, the branch
+ * is predicted first, and the predictor is told what happened.
  */
 void branch_test(BranchUnit *bru) {
     int status;
     int brop;
+    int taken, predicted, conditional, btb_hit;
+    busdata_t pc, target;
 
     /* The status value will be 1 if the result was 0, or 0 if the result
      * was nonzero.
@@ -59,8 +62,20 @@ void branch_test(BranchUnit *bru) {
     status = pin_read(bru->status);
     brop = pin_read(bru->op);
 
-    if (brop == OP_BRA || (brop == OP_BNZ && status == 0) ||
-        (brop == OP_BRZ && status != 0)) {
+    taken = (brop == OP_BRA || (brop == OP_BNZ && status == 0) ||
+             (brop == OP_BRZ && status != 0));
+
+    if (bru->predictor &&
+        (brop == OP_BRA || brop == OP_BRZ || brop == OP_BNZ)) {
+        pc = pin_read(bru->pc);
+        conditional = (brop != OP_BRA);
+        predicted = predict_branch(bru->predictor, pc, conditional,
+                                   &btb_hit, &target);
+        update_branch_predictor(bru->predictor, pc, conditional, predicted,
+                                taken, pin_read(bru->target));
+    }
+
+    if (taken) {
         pin_set(bru->branch, BRANCH);
     }
     else {
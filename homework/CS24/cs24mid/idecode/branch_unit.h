@@ -10,6 +10,7 @@
 
 
 #include "bus.h"
+#include "branch_predictor.h"
 
 
 /*!
@@ -33,6 +34,21 @@ typedef struct BranchUnit {
      */
     pin op;
 
+    /*!
+     * These pins allow the branch unit to read the address of the current
+     * instruction and its branch target, for the branch predictor.
+     */
+    pin pc;
+    pin target;
+
+    /*!
+     * If not NULL, the predictor that the branch unit predicts every branch
+     * with before testing it, to collect statistics on how well it does.  The
+     * processor still goes wherever the test says.  The branch unit doesn't
+     * free the predictor.
+     */
+    BranchPredictor *predictor;
+
     /* Outputs */
     
     /*!
@@ -34,9 +34,14 @@ static int VERBOSE = 0;
  * clock.  This includes fetching and decoding the current instruction, reading
  * the register file, activating both the branch unit and the ALU, writing any
  * output back to the register file, then advancing to the next instruction.
+ * Once the program has been predecoded, the decoded instruction is taken from
+ * it instead of being fetched from the instruction store and decoded.
  */
 void clock(Processor* proc) {
-    fetch_and_decode(proc->is, proc->decode, proc->pc);
+    if (proc->predecoded)
+        fetch_predecoded(proc->program, proc->decode, proc->pc);
+    else
+        fetch_and_decode(proc->is, proc->decode, proc->pc);
 
     rf_read(proc->rf);
 
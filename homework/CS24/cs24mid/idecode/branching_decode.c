@@ -15,12 +15,6 @@
 #include "register_file.h"
 #include "instruction.h"
 
-/* constants used for getting information from bytes */
-#define ADDR_MASK 0x07
-#define BRA_MASK  0x0F
-#define ISREG_LOC 3
-#define OP_LOC    4
-
 /*
  * Branching Instruction Decoder
  *
@@ -55,49 +49,29 @@ void free_decode(Decode *d) {
 
 
 /*!
- * This function decodes the instruction on the input pin, and writes all of the
- * various components to output pins.  Other components can then read their
- * respective parts of the instruction.
+ * This function decodes the instruction that starts with the word byte1.  The
+ * word after it, byte2, is only used if the instruction takes two words.  The
+ * layout of the fields is described in instruction.h.
  *
  * NOTE:  the busdata_t type is defined in bus.h, and is simply
  *        an unsigned long.
  */
-void fetch_and_decode(InstructionStore *is, Decode *d, ProgramCounter *pc) {
-    /* This is the current instruction byte we are decoding. */
-    unsigned char instr_byte;
-
+void decode_instruction(instr_t byte1, instr_t byte2, DecodedInstr *di) {
     /* The CPU operation the instruction represents.  This will be one of the
      * OP_XXXX values from instruction.h.
      */
-    busdata_t operation;
-
-    /* Source-register values, including defaults for src1-related values. */
-    busdata_t src1_addr = 0, src1_const = 0, src1_isreg = 1;
-    busdata_t src2_addr = 0;
-
-    /* Destination register.  For both single-argument and two-argument
-     * instructions, dst == src2.
-     */
-    busdata_t dst_addr = 0;
+    unsigned char operation = byte1 >> OP_SHIFT;
 
-    /* Flag controlling whether the destination register is written to.
-     * Default value is to *not* write to the destination register.
+    /* Source-register values, including defaults for src1-related values.
+     * The destination register is always src2, for both single-argument and
+     * two-argument instructions.  The default is to *not* write to the
+     * destination register.
      */
-    busdata_t dst_write = NOWRITE_REG;
-
-    /* The branching address loaded from a branch instruction. */
-    busdata_t branch_addr = 0;
-
-    /* All instructions have at least one byte, so read the first byte. */
-    ifetch(is);   /* Cause InstructionStore to push out the instruction byte */
-    instr_byte = pin_read(d->input);
-
-    /*=====================================================*/
-    /* TODO:  Fill in the implementation of the multi-byte */
-    /*        instruction decoder.                         */
-    /*=====================================================*/
-    /* read operation */
-    operation = instr_byte >> OP_LOC;
+    memset(di, 0, sizeof(DecodedInstr));
+    di->op = operation;
+    di->src1_isreg = 1;
+    di->dst_write = NOWRITE_REG;
+    di->length = 1;
 
     /* decode remaining bytes based on operation */
     if (operation == OP_DONE) {
@@ -105,52 +79,168 @@ void fetch_and_decode(InstructionStore *is, Decode *d, ProgramCounter *pc) {
     }
     else if (operation <= OP_SHR) {
         /* one-byte operation */
-        dst_write = WRITE_REG;
-        src2_addr = instr_byte & ADDR_MASK;
+        di->dst_write = WRITE_REG;
+        di->src2_addr = byte1 & REG_MASK;
     }
     else if ((operation == OP_BRA) || (operation == OP_BRZ)
         || (operation == OP_BNZ)) {
         /* set branch addr */
-        branch_addr = instr_byte & BRA_MASK;
+        di->branch_addr = byte1 & BRANCH_ADDR_MASK;
     }
     else if (operation <= OP_BNZ) {
         /* must be a two-byte operation */
-        dst_write = WRITE_REG;
+        di->dst_write = WRITE_REG;
+        di->length = 2;
 
         /* check src1_isreg */
-        src1_isreg = (instr_byte >> ISREG_LOC) & 0x01;
+        di->src1_isreg = (byte1 >> ISREG_SHIFT) & 0x01;
 
         /* set dst */
-        src2_addr = instr_byte & ADDR_MASK;
-
-        /* get second instruction byte */
-        incrPC(pc);
-        ifetch(is);
-        instr_byte = pin_read(d->input);
+        di->src2_addr = byte1 & REG_MASK;
 
         /* set src */
-        src1_const = instr_byte;
-        if (src1_isreg) {
-            src1_addr = instr_byte & ADDR_MASK;
+        di->src1_const = byte2;
+        if (di->src1_isreg) {
+            di->src1_addr = byte2 & REG_MASK;
         }
     }
     else {
-        printf("invalid operation: %lu\n", operation);
+        printf("invalid operation: %u\n", operation);
     }
+}
 
-    /* All decoded!  Write out the decoded values. */
 
-    pin_set(d->cpuop,       operation);
+/*! Writes a decoded instruction to the decoder's output pins. */
+static void set_decode_pins(Decode *d, const DecodedInstr *di) {
+    pin_set(d->cpuop,       di->op);
 
-    pin_set(d->src1_addr,   src1_addr);
-    pin_set(d->src1_const,  src1_const);
-    pin_set(d->src1_isreg,  src1_isreg);
+    pin_set(d->src1_addr,   di->src1_addr);
+    pin_set(d->src1_const,  di->src1_const);
+    pin_set(d->src1_isreg,  di->src1_isreg);
 
-    pin_set(d->src2_addr,   src2_addr);
+    pin_set(d->src2_addr,   di->src2_addr);
 
     /* For this processor, like IA32, dst is always src2. */
-    pin_set(d->dst_addr,    src2_addr);
-    pin_set(d->dst_write,   dst_write);
+    pin_set(d->dst_addr,    di->src2_addr);
+    pin_set(d->dst_write,   di->dst_write);
+
+    pin_set(d->branch_addr, di->branch_addr);
+}
+
+
+/*!
+ * This function decodes the instruction on the input pin, and writes all of the
+ * various components to output pins.  Other components can then read their
+ * respective parts of the instruction.  The second byte of a two-byte
+ * instruction is fetched from the instruction store as well.
+ */
+void fetch_and_decode(InstructionStore *is, Decode *d, ProgramCounter *pc) {
+    /* These are the instruction words we are decoding. */
+    instr_t byte1, byte2 = 0;
+    DecodedInstr di;
+
+    /* All instructions have at least one byte, so read the first byte. */
+    ifetch(is);   /* Cause InstructionStore to push out the instruction byte */
+    byte1 = pin_read(d->input);
+
+    decode_instruction(byte1, 0, &di);
+    if (di.length == 2) {
+        /* get second instruction byte */
+        incrPC(pc);
+        ifetch(is);
+        byte2 = pin_read(d->input);
+        decode_instruction(byte1, byte2, &di);
+    }
+
+    /* All decoded!  Write out the decoded values. */
+    set_decode_pins(d, &di);
+}
+
+
+/*!
+ * This function decodes the instruction that starts at every address of the
+ * instruction store, into the program array, which must have
+ * INSTRUCTION_STORE_DEPTH entries.  Since branches may go to any address, the
+ * instructions are decoded at every address, not just at the ones that
+ * straight-line execution reaches.  A byte past the end of the store reads as
+ * 0.
+ */
+void predecode(InstructionStore *is, DecodedInstr *program) {
+    int addr;
+    instr_t next;
+
+    for (addr = 0; addr < INSTRUCTION_STORE_DEPTH; addr++) {
+        next = (addr + 1 < INSTRUCTION_STORE_DEPTH) ? is->imemory[addr + 1] : 0;
+        decode_instruction(is->imemory[addr], next, &program[addr]);
+    }
+}
+
+
+/*!
+ * This function does the job of fetch_and_decode() from a program that was
+ * decoded by predecode(), so the instruction bytes aren't fetched or decoded
+ * again.  The program counter is moved past the second byte of a two-byte
+ * instruction, just as fetch_and_decode() does.  An address past the end of
+ * the instruction store holds OP_DONE.
+ */
+void fetch_predecoded(const DecodedInstr *program, Decode *d,
+                      ProgramCounter *pc) {
+    static const DecodedInstr done = { OP_DONE, 0, 0, 1, 0, NOWRITE_REG, 0, 1 };
+    busdata_t addr = pin_read(pc->pc_pin);
+    const DecodedInstr *di;
+
+    di = (addr < INSTRUCTION_STORE_DEPTH) ? &program[addr] : &done;
+    if (di->length == 2)
+        incrPC(pc);
+
+    set_decode_pins(d, di);
+}
 
-    pin_set(d->branch_addr, branch_addr);
+
+/*! The mnemonics of the opcodes, indexed by opcode. */
+static const char *op_names[16] = {
+    "DONE", "INC", "DEC", "NEG", "INV", "SHL", "SHR", "BRA",
+    "MOV", "ADD", "SUB", "BRZ", "AND", "OR", "XOR", "BNZ"
+};
+
+
+/*! Returns the mnemonic of an OP_XXXX value. */
+const char * op_name(unsigned char op) {
+    return op_names[op & 0xF];
+}
+
+
+/*! Writes the decoded instruction in assembly syntax into buf. */
+void disassemble(const DecodedInstr *di, char *buf, size_t size) {
+    const char *name = op_name(di->op);
+
+    switch (di->op) {
+    case OP_DONE:
+        snprintf(buf, size, "%s", name);
+        break;
+
+    case OP_BRA:
+    case OP_BRZ:
+    case OP_BNZ:
+        snprintf(buf, size, "%s %02X", name, di->branch_addr);
+        break;
+
+    case OP_INC:
+    case OP_DEC:
+    case OP_NEG:
+    case OP_INV:
+    case OP_SHL:
+    case OP_SHR:
+        snprintf(buf, size, "%s R%d", name, di->src2_addr);
+        break;
+
+    default:
+        if (di->src1_isreg)
+            snprintf(buf, size, "%s R%d, R%d", name, di->src1_addr,
+                     di->src2_addr);
+        else
+            snprintf(buf, size, "%s $%X, R%d", name, di->src1_const,
+                     di->src2_addr);
+        break;
+    }
 }
@@ -11,6 +11,8 @@
 #define BRANCHING_DECODE_H
 
 
+#include <stddef.h>
+
 #include "bus.h"
 #include "instruction_store.h"
 #include "branching_program_counter.h"
@@ -43,12 +45,38 @@ typedef struct Decode {
 } Decode;
 
 
+/*!
+ * One instruction, decoded ahead of time.  The fields are the values that the
+ * decoder writes to its output pins, plus the number of bytes that the
+ * instruction takes up, so the simulator doesn't have to pull them out of the
+ * instruction bytes again every time the instruction runs.
+ */
+typedef struct DecodedInstr {
+    unsigned char op;           /*!< The OP_XXXX value of the instruction. */
+    unsigned char src1_addr;    /*!< The register for src1, if it is one. */
+    instr_t src1_const;         /*!< The constant for src1, if it is one. */
+    unsigned char src1_isreg;   /*!< 1 if src1 is a register. */
+    unsigned char src2_addr;    /*!< src2 and dst, which are the same. */
+    unsigned char dst_write;    /*!< WRITE_REG or NOWRITE_REG. */
+    instr_t branch_addr;        /*!< The target of a branch instruction. */
+    unsigned char length;       /*!< The instruction's size in words. */
+} DecodedInstr;
+
+
 /* Documentation appears in branching_decode.c. */
 Decode * build_decode();
 void free_decode(Decode *d);
 
 void fetch_and_decode(InstructionStore *is, Decode *d, ProgramCounter *pc);
 
+void decode_instruction(instr_t byte1, instr_t byte2, DecodedInstr *di);
+void predecode(InstructionStore *is, DecodedInstr *program);
+void fetch_predecoded(const DecodedInstr *program, Decode *d,
+                      ProgramCounter *pc);
+
+const char * op_name(unsigned char op);
+void disassemble(const DecodedInstr *di, char *buf, size_t size);
+
 
 #endif /* BRANCHING_DECODE_H */
 
@@ -12,15 +12,10 @@
 #include "branching_processor.h"
 
 
-
-/*!
- * This constant specifies the longest that a program may execute before the
- * processor terminates.  Since this processor includes branching, we can't just
- * run until we hit the instruction store depth; instead, we set a "max execute
- * time," beyond which we assume that the program has a bug like an infinite
- * loop in it.
- */
-#define MAX_EXECUTE_TIME 1000
+/*! What the instruction store holds past its end. */
+static const DecodedInstr done_instr = {
+    OP_DONE, 0, 0, 1, 0, NOWRITE_REG, 0, 1
+};
 
 
 /*!
@@ -54,7 +49,7 @@ Processor * build_processor() {
 
     // Wire up the components into a processor.
 
-    proc->pc_bus = connect(&pc->pc_pin,        &is->address_input);
+    proc->pc_bus = connect3(&pc->pc_pin,       &is->address_input, &bru->pc);
     proc->instr  = connect(&is->output,        &decode->input);
     proc->cpuop  = connect3(&decode->cpuop,    &alu->op, &bru->op);
 
@@ -73,7 +68,8 @@ Processor * build_processor() {
     proc->aluout    = connect(&alu->out,    &rf->dst);
     proc->alustatus = connect(&alu->status, &bru->status);
 
-    proc->branch_addr = connect(&decode->branch_addr, &pc->branch_addr);
+    proc->branch_addr = connect3(&decode->branch_addr, &pc->branch_addr,
+                                 &bru->target);
     proc->branch      = connect(&bru->branch,         &pc->branch);
 
     // Reset the program counter to 0.
@@ -123,12 +119,19 @@ void free_processor(Processor *proc) {
 
 /*!
  * Starts running the processor with the current contents of the instruction
- * store and the register file.  The function terminates when the processor hits
- * the ALUOP_DONE instruction.
+ * store and the register file, which are decoded once before the program
+ * starts.  The function terminates when the processor hits the ALUOP_DONE
+ * instruction.  If the processor has a trace, every instruction is recorded in
+ * it, and if it has a profile, every instruction is counted in it, and the
+ * profile is printed at the end.
  */
 void run(Processor *proc) {
+    const DecodedInstr *di;
     int t;
 
+    predecode(proc->is, proc->program);
+    proc->predecoded = 1;
+
     printf("Running processor.\n\n");
 
     printf("T=0\tRegister File: ");
@@ -142,6 +145,16 @@ void run(Processor *proc) {
         busdata_t pc = bus_read(proc->pc_bus);
         clock(proc);
 
+        /* The instruction that just ran, for the trace and the profile. */
+        di = (pc < INSTRUCTION_STORE_DEPTH) ? &proc->program[pc] : &done_instr;
+
+        if (proc->trace) {
+            trace_record(proc->trace, t, pc, di, bus_read(proc->aluout),
+                         bus_read(proc->alustatus));
+        }
+        if (proc->profile)
+            profile_record(proc->profile, pc, di, bus_read(proc->branch));
+
         printf("\nT=%d\tPC=%02d\tCPUOP=0x%X\tSRC1=%X (%s)\tSRC2=%X\n"
                "\tW=%X\tDST=%X\tBRA=%X\n"
                "\tRF1=%X\tRF2=%X\tALUOUT=%X\tALUSTAT=%X\tBR?=%X\n",
@@ -180,6 +193,11 @@ void run(Processor *proc) {
     else {
         printf("Program terminated normally.\n");
     }
+
+    if (proc->profile) {
+        printf("\n");
+        print_profile(stdout, proc->profile, proc->program);
+    }
 }
 
 
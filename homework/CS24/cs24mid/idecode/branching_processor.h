@@ -18,6 +18,18 @@
 #include "branching_program_counter.h"
 #include "branching_decode.h"
 #include "branch_unit.h"
+#include "trace.h"
+#include "profile.h"
+
+
+/*!
+ * This constant specifies the longest that a program may execute before the
+ * processor terminates.  Since this processor includes branching, we can't just
+ * run until we hit the instruction store depth; instead, we set a "max execute
+ * time," beyond which we assume that the program has a bug like an infinite
+ * loop in it.
+ */
+#define MAX_EXECUTE_TIME 1000
 
 
 /*!
@@ -35,6 +47,20 @@ typedef struct Processor {
 
     BranchUnit *bru;       /*!< Determines when the processor should branch. */
 
+    /*!
+     * The instruction store's contents, decoded at every address by run()
+     * before the program starts.  Until then, predecoded is 0, and each clock
+     * fetches and decodes the instruction bytes instead.
+     */
+    DecodedInstr program[INSTRUCTION_STORE_DEPTH];
+    int predecoded;
+
+    /*! If not NULL, run() adds the record of every instruction to it. */
+    ExecTrace *trace;
+
+    /*! If not NULL, run() counts every instruction in it, and prints it. */
+    Profile *profile;
+
     /*! Bus that stores and exposes the program counter. */
     bus pc_bus;
 
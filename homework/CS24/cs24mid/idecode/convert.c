@@ -2,29 +2,53 @@
  * into hexadecimal values suitable for loading into the processor
  * simulator.
  *
+ * With the -b option, a binary program image is written to stdout instead,
+ * which the simulator can load without parsing.  The image is only written
+ * if the whole input converts without errors.
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
 
+#include "instruction_store.h"
+
 
 /* Maximum length of a line in the input. */
 #define BUF_SIZE 1000
 
+/* Maximum number of bits in one value:  16, or the width of an instruction
+ * word if that is wider.
+ */
+#define MAX_BITS (INSTR_BITS > 16 ? INSTR_BITS : 16)
+
 
 int prepare(int line_no, char *input, char *clean, char *comment);
-int convert(const char *bits);
+long convert(const char *bits);
+void write_image(const instr_t *words, unsigned int length);
 
 
-int main() {
+int main(int argc, char **argv) {
     char input[BUF_SIZE];
     char clean[BUF_SIZE];
     char comment[BUF_SIZE];
+    instr_t image[INSTRUCTION_STORE_DEPTH];
+    unsigned int length = 0;
     int line_no = 0;
     int status = 0;
-    int value;
+    int binary = 0;
+    long value;
+
+    if (argc == 2 && strcmp(argv[1], "-b") == 0) {
+        binary = 1;
+    }
+    else if (argc != 1) {
+        fprintf(stderr, "Usage: %s [-b] < input > output\n"
+                "\t-b  write a binary program image\n", argv[0]);
+        return 1;
+    }
 
     while (fgets(input, BUF_SIZE, stdin) != NULL) {
         line_no++;
@@ -39,17 +63,56 @@ int main() {
              * out the result.
              */
             value = convert(clean);
-            if (value >= 0)          /* It's an actual value. */
-                printf("%x    %s\n", value, comment);
+            if (binary) {
+                if (value < 0)
+                    continue;
+
+                if (value > INSTR_MASK) {
+                    fprintf(stderr, "ERROR:  Line %d doesn't fit in an "
+                        "instruction word:  %s\n", line_no, input);
+                    status = 1;
+                }
+                else if (length == INSTRUCTION_STORE_DEPTH) {
+                    fprintf(stderr, "ERROR:  Line %d is past the end of the "
+                        "instruction store.\n", line_no);
+                    status = 1;
+                }
+                else {
+                    image[length++] = value;
+                }
+            }
+            else if (value >= 0)     /* It's an actual value. */
+                printf("%lx    %s\n", value, comment);
             else                     /* Just print out any comment. */
                 printf("%s\n", comment);
         }
     }
 
+    if (binary && status == 0)
+        write_image(image, length);
+
     return status;
 }
 
 
+/* Write a program image holding the given instruction words to stdout. */
+void write_image(const instr_t *words, unsigned int length) {
+    ProgramImageHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PROGRAM_IMAGE_MAGIC, sizeof(header.magic));
+    header.version = PROGRAM_IMAGE_VERSION;
+    header.instr_bits = INSTR_BITS;
+    header.length = length;
+
+    if (fwrite(&header, sizeof(header), 1, stdout) != 1 ||
+        fwrite(words, sizeof(instr_t), length, stdout) != length || fflush(stdout) != 0) {
+        perror("fwrite");
+        exit(2);
+    }
+}
+
+
 /* This helper function takes a raw line of input, strips off any comments,
  * and also strips out any whitespace contained within the line.  This way
  * the input can actually use whitespace and comments to clarify the code.
@@ -116,7 +179,7 @@ int prepare(int line_no, char *input, char *clean, char *comment) {
 
     clean[j] = 0;
 
-    if (j > 16) {
+    if (j > MAX_BITS) {
         printf("ERROR:  Line %d has too many bits:  %s\n", line_no, input);
         return 0;
     }
@@ -136,11 +199,12 @@ int prepare(int line_no, char *input, char *clean, char *comment) {
  * The function must convert this sequence of bits into a numeric value,
  * and then return the value.
  *
- * This function will never be given a sequence longer than 16 bits, so
+ * This function will never be given a sequence longer than MAX_BITS bits, so
  * we don't need to worry about signed/unsigned issues.
  */
-int convert(const char *bits) {
-    int length, value, i;
+long convert(const char *bits) {
+    int length, i;
+    long value;
 
     assert(bits != 0);
 
@@ -150,7 +214,7 @@ int convert(const char *bits) {
         return -1;
     }
 
-    assert(length <= 16);
+    assert(length <= MAX_BITS);
 
     value = 0;
     for (i = 0; i < length; i++) {
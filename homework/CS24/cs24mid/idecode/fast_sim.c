@@ -0,0 +1,223 @@
+/*! \file
+ *
+ * This file contains the definitions for the fast functional simulator of the
+ * branching processor.  Each instruction does what the components of the bus
+ * model do with it in one clock, in the same order:  the branch unit tests the
+ * status that the last instruction left, then the ALU computes the result and
+ * perhaps a new status, the register file stores the result, and the program
+ * counter moves on.
+ *
+ * There are two ways of running a whole program:  run_fast() dispatches each
+ * instruction with a switch, and run_threaded() with threaded code.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "fast_sim.h"
+#include "register_file.h"
+
+
+/*!
+ * The instruction at an address past the end of the instruction store, where
+ * the bus model's fetch_predecoded() finds OP_DONE too.
+ */
+static const DecodedInstr done_instr = {
+    OP_DONE, 0, 0, 1, 0, NOWRITE_REG, 0, 1
+};
+
+
+/*!
+ * Runs the instruction at the state's program counter, and returns its
+ * opcode.  As in the bus model, the ALU's first input is the src2 register and
+ * its second is src1, and MOV, the branches and OP_DONE leave the status as it
+ * was.
+ */
+int fast_step(const DecodedInstr *program, ArchState *state) {
+    const DecodedInstr *di;
+    busdata_t A, B, result = 0;
+    int set_status = 1, branch;
+
+    di = (state->pc < INSTRUCTION_STORE_DEPTH) ? &program[state->pc]
+                                               : &done_instr;
+
+    A = state->regs[di->src2_addr];
+    B = di->src1_isreg ? state->regs[di->src1_addr] : di->src1_const;
+
+    /* The branch unit looks at the status before the ALU changes it. */
+    branch = (di->op == OP_BRA || (di->op == OP_BNZ && state->status == 0) ||
+              (di->op == OP_BRZ && state->status != 0));
+
+    switch (di->op) {
+        case OP_MOV:  result = B; set_status = 0;                  break;
+        case OP_ADD:  result = A + B;                              break;
+        case OP_SUB:  result = A - B;                              break;
+        case OP_NEG:  result = (unsigned long) (-(signed long) A); break;
+        case OP_INC:  result = A + 1;                              break;
+        case OP_DEC:  result = A - 1;                              break;
+        case OP_INV:  result = ~A;                                 break;
+        case OP_AND:  result = A & B;                              break;
+        case OP_OR:   result = A | B;                              break;
+        case OP_XOR:  result = A ^ B;                              break;
+        case OP_SHL:  result = A << 1;                             break;
+        case OP_SHR:  result = A >> 1;                             break;
+        default:      result = 0; set_status = 0;                  break;
+    }
+
+    /* Registers only hold DATA_BITS bits. */
+    result = TRUNCATE_DATA(result);
+
+    if (set_status)
+        state->status = (result == 0 ? 1 : 0);
+
+    if (di->dst_write == WRITE_REG)
+        state->regs[di->src2_addr] = result;
+
+    state->pc = branch ? di->branch_addr : state->pc + di->length;
+    return di->op;
+}
+
+
+/*!
+ * Runs the predecoded program from the state's program counter until it
+ * executes OP_DONE, and returns the number of instructions executed, counting
+ * the OP_DONE.  If the program hasn't finished after max_steps instructions,
+ * -1 is returned instead.
+ */
+int run_fast(const DecodedInstr *program, ArchState *state, int max_steps) {
+    int steps;
+
+    for (steps = 1; steps <= max_steps; steps++) {
+        if (fast_step(program, state) == OP_DONE)
+            return steps;
+    }
+
+    return -1;
+}
+
+
+/*!
+ * Does the same as run_fast(), but with threaded code instead of a switch:
+ * every address in the program gets the address of the code for its opcode,
+ * using GCC's labels-as-values, and each piece of code jumps straight to the
+ * next instruction's.  Every instruction thus ends in its own indirect jump,
+ * which the host's branch predictor can learn separately, instead of all of
+ * them sharing the one jump at the top of a switch.
+ */
+int run_threaded(const DecodedInstr *program, ArchState *state, int max_steps) {
+    static const void *op_code[16] = {
+        [OP_DONE] = &&do_done, [OP_INC] = &&do_inc, [OP_DEC] = &&do_dec,
+        [OP_NEG]  = &&do_neg,  [OP_INV] = &&do_inv, [OP_SHL] = &&do_shl,
+        [OP_SHR]  = &&do_shr,  [OP_BRA] = &&do_bra, [OP_MOV] = &&do_mov,
+        [OP_ADD]  = &&do_add,  [OP_SUB] = &&do_sub, [OP_BRZ] = &&do_brz,
+        [OP_AND]  = &&do_and,  [OP_OR]  = &&do_or,  [OP_XOR] = &&do_xor,
+        [OP_BNZ]  = &&do_bnz
+    };
+
+    /* A two-byte instruction at the end of the store can leave the program
+     * counter one past its end, so two extra slots of OP_DONE cover every
+     * address that execution can reach.
+     */
+    DecodedInstr prog[INSTRUCTION_STORE_DEPTH + 2];
+    const void *code[INSTRUCTION_STORE_DEPTH + 2];
+
+    busdata_t *R = state->regs;
+    busdata_t pc = state->pc, status = state->status, result;
+    const DecodedInstr *di;
+    int i, steps = 0;
+
+    memcpy(prog, program, INSTRUCTION_STORE_DEPTH * sizeof(DecodedInstr));
+    prog[INSTRUCTION_STORE_DEPTH] = done_instr;
+    prog[INSTRUCTION_STORE_DEPTH + 1] = done_instr;
+    for (i = 0; i < INSTRUCTION_STORE_DEPTH + 2; i++)
+        code[i] = op_code[prog[i].op];
+
+    if (pc >= INSTRUCTION_STORE_DEPTH)
+        return run_fast(program, state, max_steps);
+
+/* Go on to the instruction at pc, unless the program is out of time. */
+#define DISPATCH()  do {                                \
+        if (steps++ == max_steps)                       \
+            goto out_of_time;                           \
+        di = &prog[pc];                                 \
+        goto *code[pc];                                 \
+    } while (0)
+
+/* The ALU's second input:  src1, or the constant. */
+#define SRC1  (di->src1_isreg ? R[di->src1_addr] : (busdata_t) di->src1_const)
+
+/* Store the result in the src2 register, and go on to the next instruction.
+ * MOV doesn't set the status, so it stores its result by hand.
+ */
+#define ALU_RESULT(expr)  do {                          \
+        result = TRUNCATE_DATA(expr);                   \
+        status = (result == 0 ? 1 : 0);                 \
+        R[di->src2_addr] = result;                      \
+        pc += di->length;                               \
+        DISPATCH();                                     \
+    } while (0)
+
+/* Take the branch if cond holds; branches leave the status as it is.  If
+ * branch targets can be past the two extra slots, run_fast() takes over at
+ * them.
+ */
+#if BRANCH_ADDR_MASK >= INSTRUCTION_STORE_DEPTH
+#define CHECK_TARGET()  if (pc >= INSTRUCTION_STORE_DEPTH) goto past_end
+#else
+#define CHECK_TARGET()
+#endif
+
+#define BRANCH_IF(cond)  do {                           \
+        pc = (cond) ? di->branch_addr : pc + di->length; \
+        CHECK_TARGET();                                 \
+        DISPATCH();                                     \
+    } while (0)
+
+    DISPATCH();
+
+do_inc:  ALU_RESULT(R[di->src2_addr] + 1);
+do_dec:  ALU_RESULT(R[di->src2_addr] - 1);
+do_neg:  ALU_RESULT((unsigned long) (-(signed long) R[di->src2_addr]));
+do_inv:  ALU_RESULT(~R[di->src2_addr]);
+do_shl:  ALU_RESULT(R[di->src2_addr] << 1);
+do_shr:  ALU_RESULT(R[di->src2_addr] >> 1);
+do_add:  ALU_RESULT(R[di->src2_addr] + SRC1);
+do_sub:  ALU_RESULT(R[di->src2_addr] - SRC1);
+do_and:  ALU_RESULT(R[di->src2_addr] & SRC1);
+do_or:   ALU_RESULT(R[di->src2_addr] | SRC1);
+do_xor:  ALU_RESULT(R[di->src2_addr] ^ SRC1);
+
+do_mov:
+    R[di->src2_addr] = TRUNCATE_DATA(SRC1);
+    pc += di->length;
+    DISPATCH();
+
+do_bra:  BRANCH_IF(1);
+do_brz:  BRANCH_IF(status != 0);
+do_bnz:  BRANCH_IF(status == 0);
+
+do_done:
+    state->pc = pc + 1;
+    state->status = status;
+    return steps;
+
+out_of_time:
+    state->pc = pc;
+    state->status = status;
+    return -1;
+
+#if BRANCH_ADDR_MASK >= INSTRUCTION_STORE_DEPTH
+past_end:
+    state->pc = pc;
+    state->status = status;
+    i = run_fast(program, state, max_steps - steps);
+    return (i < 0) ? -1 : steps + i;
+#endif
+
+#undef DISPATCH
+#undef SRC1
+#undef ALU_RESULT
+#undef CHECK_TARGET
+#undef BRANCH_IF
+}
@@ -0,0 +1,43 @@
+/*! \file
+ *
+ * This file contains declarations for the fast functional simulator of the
+ * branching processor.  Instead of sending every value over the buses between
+ * the processor's components, it runs the predecoded program with a plain
+ * switch over the opcode and an array of registers.  It produces the same
+ * registers, program counter and ALU status as the bus model, after the same
+ * number of instructions.
+ */
+
+
+#ifndef FAST_SIM_H
+#define FAST_SIM_H
+
+
+#include "bus.h"
+#include "instruction.h"
+#include "branching_decode.h"
+
+
+/*!
+ * The architectural state of the processor:  everything that one instruction
+ * leaves behind for the next.
+ */
+typedef struct ArchState {
+    busdata_t regs[NUM_REGISTERS];  /*!< The register file. */
+    busdata_t pc;                   /*!< The address of the next instruction. */
+
+    /*!
+     * The ALU status, 1 if the last instruction that set it had a result of 0,
+     * which the conditional branches test.
+     */
+    busdata_t status;
+} ArchState;
+
+
+/* Documentation appears in fast_sim.c. */
+int fast_step(const DecodedInstr *program, ArchState *state);
+int run_fast(const DecodedInstr *program, ArchState *state, int max_steps);
+int run_threaded(const DecodedInstr *program, ArchState *state, int max_steps);
+
+
+#endif /* FAST_SIM_H */
@@ -1,15 +1,26 @@
 /*! \file
  *
  * This file contains all constants associated with instructions in the simple
- * processor.
+ * processor, including the parameters of the instruction set:  the number of
+ * registers, the width of the data, and the width of each instruction word.
+ * Every part of the simulator takes these from here, so a variant of the
+ * processor can be built by defining REGISTER_BITS, DATA_BITS or INSTR_BITS
+ * on the compiler's command line, e.g. -DREGISTER_BITS=4 -DINSTR_BITS=16 for
+ * 16 registers.
  */
 
 
+#ifndef INSTRUCTION_H
+#define INSTRUCTION_H
+
+
 /**** REGISTER-FILE CONSTANTS ****/
 
 
 /*! Specifies the number of address bits for the register file. */
+#ifndef REGISTER_BITS
 #define REGISTER_BITS 3
+#endif
 
 /*!
  * Using the number of register-bits, this expression is the total number of
@@ -17,6 +28,81 @@
  */
 #define NUM_REGISTERS (1 << REGISTER_BITS)
 
+/*! The mask of a register-address field. */
+#define REG_MASK (NUM_REGISTERS - 1)
+
+
+/**** DATA CONSTANTS ****/
+
+
+/*!
+ * The number of bits in a register, from 1 up to the width of busdata_t.
+ * Every result that the ALU produces is truncated to this many bits.
+ */
+#ifndef DATA_BITS
+#define DATA_BITS 64
+#endif
+
+/*! The mask of the bits of a register. */
+#define DATA_MASK (~0UL >> (8 * sizeof(unsigned long) - DATA_BITS))
+
+/*!
+ * Truncates a value to DATA_BITS bits.  At the full width this is nothing at
+ * all, so the simulators' inner loops are the same as if there were no mask.
+ */
+#if DATA_BITS < 64
+#define TRUNCATE_DATA(x) ((x) & DATA_MASK)
+#else
+#define TRUNCATE_DATA(x) (x)
+#endif
+
+
+/**** INSTRUCTION-ENCODING CONSTANTS ****/
+
+
+/*!
+ * The number of bits in each word of the instruction store, which is 8, 16 or
+ * 32.  Each instruction takes one word, or two if it has a src1 operand; the
+ * second word is the constant, or the src1 register in its low bits.  The
+ * first word is laid out like this, from the most-significant bit down:
+ *
+ *   - the opcode, in the top 4 bits;
+ *   - for two-word instructions, a bit that is set if src1 is a register;
+ *   - the src2 register, in the low REGISTER_BITS bits;
+ *
+ * and for branches, the target address takes up every bit below the opcode.
+ */
+#ifndef INSTR_BITS
+#define INSTR_BITS 8
+#endif
+
+#if INSTR_BITS == 8
+typedef unsigned char instr_t;
+#elif INSTR_BITS == 16
+typedef unsigned short instr_t;
+#elif INSTR_BITS == 32
+typedef unsigned int instr_t;
+#else
+#error "INSTR_BITS must be 8, 16 or 32"
+#endif
+
+/*! The mask of the bits of an instruction word. */
+#define INSTR_MASK (~0UL >> (8 * sizeof(unsigned long) - INSTR_BITS))
+
+#define OP_SHIFT    (INSTR_BITS - 4)   /*!< Where the opcode starts. */
+#define ISREG_SHIFT (OP_SHIFT - 1)     /*!< Where the src1-is-register bit is. */
+
+/*! The mask of a branch target. */
+#define BRANCH_ADDR_MASK ((1UL << OP_SHIFT) - 1)
+
+#if REGISTER_BITS < 1 || REGISTER_BITS > ISREG_SHIFT || REGISTER_BITS > 8
+#error "REGISTER_BITS must leave room for the opcode and the src1-is-register bit"
+#endif
+
+#if DATA_BITS < 1 || DATA_BITS > 64
+#error "DATA_BITS must be from 1 to 64"
+#endif
+
 
 /**** CPU OPCODES ****/
 
@@ -50,4 +136,4 @@
 #define OP_BNZ   0x0F  /*!< The opcode for branch-if-not-zero. */
 
 
-
+#endif /* INSTRUCTION_H */
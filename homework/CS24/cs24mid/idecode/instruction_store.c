@@ -8,6 +8,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "instruction_store.h"
 
@@ -53,7 +57,7 @@ void ifetch(InstructionStore *is) {
 void load_instruction_store_from_fd(FILE *fd, InstructionStore *is) {
     char buf[500];
     int slot = 0;
-    int value;
+    unsigned int value;
     int statusp;
 
     if (VERBOSE > 0)
@@ -73,9 +77,10 @@ void load_instruction_store_from_fd(FILE *fd, InstructionStore *is) {
 
         if (statusp == 1) {
             /* Make sure the value is in a valid range. */
-            if (value < 0 || value >= 256) {
+            if (value > INSTR_MASK) {
                 fprintf(stderr, "Invalid value %X at address %d!  "
-                        "All values must be unsigned chars.\n", value, slot);
+                        "All values must fit in %d bits.\n", value, slot,
+                        INSTR_BITS);
                 exit(11);
             }
 
@@ -93,3 +98,91 @@ void load_instruction_store_from_fd(FILE *fd, InstructionStore *is) {
 }
 
 
+/* Copy a program image out of the len bytes that the file was mapped to.
+ * The program is terminated if the image is malformed.
+ */
+static void load_instruction_store_from_image(const char *filename,
+                                              const unsigned char *data,
+                                              size_t len,
+                                              InstructionStore *is) {
+    const ProgramImageHeader *header = (const ProgramImageHeader *) data;
+
+    if (VERBOSE > 0)
+        printf("Loading instruction store image.\n");
+
+    if (header->version != PROGRAM_IMAGE_VERSION) {
+        fprintf(stderr, "%s:  unsupported program image version %d!\n",
+                filename, header->version);
+        exit(2);
+    }
+    if (header->instr_bits != INSTR_BITS) {
+        fprintf(stderr, "%s:  program image has %d-bit instructions, but "
+                "this simulator has %d-bit instructions!\n", filename,
+                header->instr_bits, INSTR_BITS);
+        exit(2);
+    }
+    if (header->length > INSTRUCTION_STORE_DEPTH) {
+        fprintf(stderr, "%s:  program image has %u instructions, but "
+                "the instruction store only holds %d!\n", filename,
+                header->length, INSTRUCTION_STORE_DEPTH);
+        exit(2);
+    }
+    if ((len - sizeof(ProgramImageHeader)) / sizeof(instr_t) < header->length) {
+        fprintf(stderr, "%s:  program image is truncated!\n", filename);
+        exit(2);
+    }
+
+    memcpy(is->imemory, data + sizeof(ProgramImageHeader),
+           header->length * sizeof(instr_t));
+    if (VERBOSE > 0)
+        printf("Stored %u instructions.\n", header->length);
+}
+
+
+/* Load the instruction store from the named file, which may be either a
+ * program image or the text form that load_instruction_store_from_fd()
+ * reads.  Images are mapped into memory rather than read, and are told apart
+ * from text files by their magic number.  The program is terminated if the
+ * file can't be opened.
+ */
+void load_instruction_store_from_file(const char *filename,
+                                      InstructionStore *is) {
+    struct stat st;
+    unsigned char *data;
+    FILE *fd;
+    int fildes;
+
+    fildes = open(filename, O_RDONLY);
+    if (fildes < 0) {
+        fprintf(stderr, "Opening %s: ", filename);
+        perror("open");
+        exit(2);
+    }
+
+    if (fstat(fildes, &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size >= (off_t) sizeof(ProgramImageHeader)) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fildes, 0);
+        if (data != MAP_FAILED) {
+            int is_image = (memcmp(data, PROGRAM_IMAGE_MAGIC, 4) == 0);
+
+            if (is_image)
+                load_instruction_store_from_image(filename, data, st.st_size,
+                                                  is);
+            munmap(data, st.st_size);
+
+            if (is_image) {
+                close(fildes);
+                return;
+            }
+        }
+    }
+
+    /* Not an image, so parse it as text. */
+    fd = fdopen(fildes, "r");
+    if (!fd) {
+        fprintf(stderr, "Opening %s: ", filename);
+        perror("fdopen");
+        exit(2);
+    }
+    load_instruction_store_from_fd(fd, is);
+}
@@ -10,6 +10,7 @@
 
 
 #include "bus.h"
+#include "instruction.h"
 
 
 /*
@@ -29,7 +30,7 @@ typedef struct InstructionStore {
     pin output;          /*!< The instruction at the specified address. */
 
     /*! These are the actual instructions themselves. */
-    unsigned char imemory[INSTRUCTION_STORE_DEPTH];
+    instr_t imemory[INSTRUCTION_STORE_DEPTH];
 } InstructionStore;
 
 
@@ -38,7 +39,32 @@ void free_instruction_store(InstructionStore *is);
 
 void ifetch(InstructionStore *is);
 
+
+/*
+ * Program Images
+ *
+ * A program image is a binary form of the instruction store's contents that
+ * can be loaded without any parsing:  a ProgramImageHeader, followed by
+ * header.length raw instruction words for addresses 0 onward.  The words and
+ * the header's fields are in the host's byte order.  "convert -b" writes
+ * program images.
+ */
+
+#define PROGRAM_IMAGE_MAGIC "IS24"
+#define PROGRAM_IMAGE_VERSION 1
+
+typedef struct ProgramImageHeader {
+    char magic[4];               /*!< Always PROGRAM_IMAGE_MAGIC. */
+    unsigned char version;       /*!< Always PROGRAM_IMAGE_VERSION. */
+    unsigned char instr_bits;    /*!< The INSTR_BITS it was written with. */
+    unsigned char reserved[2];   /*!< Zero. */
+    unsigned int length;         /*!< The number of instruction words. */
+} ProgramImageHeader;
+
+
 void load_instruction_store_from_fd(FILE *fd, InstructionStore *is);
+void load_instruction_store_from_file(const char *filename,
+                                      InstructionStore *is);
 
 
 #endif /* INSTRUCTION_STORE_H */
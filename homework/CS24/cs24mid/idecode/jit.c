@@ -0,0 +1,510 @@
+/*! \file
+ *
+ * This file contains the definitions for the just-in-time compiler of the
+ * branching processor.
+ *
+ * A basic block runs from the address it starts at up to and including the
+ * first branch or OP_DONE, or until it reaches JIT_MAX_BLOCK_LENGTH
+ * instructions or the end of the instruction store.  While translated code
+ * runs, the guest's registers R0 to R7 live in the host's r8 to r15 and the
+ * status lives in dl, so that each guest instruction becomes one or two host
+ * instructions.  The number of instructions that may still run lives in rbx;
+ * each block takes all of its instructions from it on entry, and leaves the
+ * translated code without running anything if there aren't enough, so that
+ * run_jit() can interpret the last few.
+ *
+ * A block's exits jump straight to the block they go to once it has been
+ * translated, so a loop made of translated blocks never leaves native code
+ * until it finishes.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "jit.h"
+#include "register_file.h"
+
+
+/*! The size of the buffer that native code is written to. */
+#define JIT_CODE_SIZE (256 * 1024)
+
+/*!
+ * More bytes than any one block can be translated to:  no guest instruction
+ * takes more than 10 bytes, and the block's entry check and exits take less
+ * than 128.
+ */
+#define JIT_MAX_BLOCK_BYTES (JIT_MAX_BLOCK_LENGTH * 10 + 128)
+
+
+/* Host registers, by their number in the instruction encoding. */
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RSI 6
+#define RDI 7
+
+/*! The host register that holds guest register i. */
+#define HOST_REG(i) (8 + (i))
+
+/* Where the fields of the ArchState that rdi points at are. */
+#define REG_OFFSET(i)  (offsetof(ArchState, regs) + 8 * (i))
+#define PC_OFFSET      offsetof(ArchState, pc)
+#define STATUS_OFFSET  offsetof(ArchState, status)
+
+
+/*
+ * Code Emission
+ *
+ *  Each of these appends one host instruction at *p, and moves *p past it.
+ */
+
+
+static void emit_byte(unsigned char **p, unsigned char b) {
+    *(*p)++ = b;
+}
+
+
+static void emit_imm32(unsigned char **p, unsigned int imm) {
+    memcpy(*p, &imm, 4);
+    *p += 4;
+}
+
+
+/*! A REX prefix for a 64-bit operation with the given reg and rm fields. */
+static void emit_rex(unsigned char **p, int reg, int rm) {
+    emit_byte(p, 0x48 | ((reg >> 3) << 2) | (rm >> 3));
+}
+
+
+/*! An instruction "op rm, reg" on two 64-bit registers. */
+static void emit_rr(unsigned char **p, unsigned char op, int reg, int rm) {
+    emit_rex(p, reg, rm);
+    emit_byte(p, op);
+    emit_byte(p, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+
+/*! An instruction "op rm, imm32", where digit picks the operation. */
+static void emit_ri(unsigned char **p, int digit, int rm, unsigned int imm) {
+    emit_rex(p, 0, rm);
+    emit_byte(p, 0x81);
+    emit_byte(p, 0xC0 | (digit << 3) | (rm & 7));
+    emit_imm32(p, imm);
+}
+
+
+/*! An instruction with one 64-bit register operand, picked by op and digit. */
+static void emit_unary(unsigned char **p, unsigned char op, int digit, int rm) {
+    emit_rex(p, 0, rm);
+    emit_byte(p, op);
+    emit_byte(p, 0xC0 | (digit << 3) | (rm & 7));
+}
+
+
+/*! mov reg, [rdi + offset] if load is nonzero, or mov [rdi + offset], reg. */
+static void emit_state_move(unsigned char **p, int load, int reg, int offset) {
+    emit_rex(p, reg, RDI);
+    emit_byte(p, load ? 0x8B : 0x89);
+    emit_byte(p, 0x40 | ((reg & 7) << 3) | RDI);
+    emit_byte(p, offset);
+}
+
+
+/*! mov qword [rdi + PC_OFFSET], pc */
+static void emit_set_pc(unsigned char **p, busdata_t pc) {
+    emit_byte(p, 0x48);
+    emit_byte(p, 0xC7);
+    emit_byte(p, 0x40 | RDI);
+    emit_byte(p, PC_OFFSET);
+    emit_imm32(p, pc);
+}
+
+
+/*!
+ * A jump, or a conditional jump if cc isn't 0, to a target that isn't known
+ * yet.  Returns where the 32-bit displacement is, for patch_jump().
+ */
+static unsigned char * emit_jump(unsigned char **p, unsigned char cc) {
+    unsigned char *site;
+
+    if (cc) {
+        emit_byte(p, 0x0F);
+        emit_byte(p, cc);
+    }
+    else {
+        emit_byte(p, 0xE9);
+    }
+
+    site = *p;
+    emit_imm32(p, 0);
+    return site;
+}
+
+
+/*! Makes the jump whose displacement is at site go to target. */
+static void patch_jump(unsigned char *site, unsigned char *target) {
+    unsigned int rel = (unsigned int) (target - (site + 4));
+    memcpy(site, &rel, 4);
+}
+
+
+/* The jumps used. */
+#define CC_JZ  0x84
+#define CC_JNZ 0x85
+#define CC_JL  0x8C
+
+
+/*
+ * Translation
+ */
+
+
+/*!
+ * Writes the code that enters translated code and the code that leaves it, at
+ * the start of the buffer.  Entering saves the host registers that the
+ * translated code uses and loads the guest state into them; leaving does the
+ * opposite, and returns the value in eax.
+ */
+static void emit_enter_leave(Jit *jit) {
+    unsigned char *p = jit->code;
+    int i;
+
+    jit->enter = (jit_enter_func) p;
+
+    emit_byte(&p, 0x53);                        /* push rbx */
+    for (i = 12; i <= 15; i++) {                /* push r12 to r15 */
+        emit_byte(&p, 0x41);
+        emit_byte(&p, 0x50 + (i & 7));
+    }
+    emit_byte(&p, 0x56);                        /* push rsi */
+
+    emit_rex(&p, RBX, RSI);                     /* mov rbx, [rsi] */
+    emit_byte(&p, 0x8B);
+    emit_byte(&p, (RBX << 3) | RSI);
+
+    for (i = 0; i < NUM_REGISTERS; i++)
+        emit_state_move(&p, 1, HOST_REG(i), REG_OFFSET(i));
+
+    emit_rr(&p, 0x89, RDX, RAX);                /* mov rax, rdx */
+    emit_state_move(&p, 1, RDX, STATUS_OFFSET);
+    emit_byte(&p, 0xFF);                        /* jmp rax */
+    emit_byte(&p, 0xE0);
+
+    jit->leave = p;
+
+    for (i = 0; i < NUM_REGISTERS; i++)
+        emit_state_move(&p, 0, HOST_REG(i), REG_OFFSET(i));
+
+    emit_byte(&p, 0x0F);                        /* movzx ecx, dl */
+    emit_byte(&p, 0xB6);
+    emit_byte(&p, 0xCA);
+    emit_state_move(&p, 0, RCX, STATUS_OFFSET);
+
+    emit_byte(&p, 0x5E);                        /* pop rsi */
+    emit_rex(&p, RBX, RSI);                     /* mov [rsi], rbx */
+    emit_byte(&p, 0x89);
+    emit_byte(&p, (RBX << 3) | RSI);
+
+    for (i = 15; i >= 12; i--) {                /* pop r15 to r12 */
+        emit_byte(&p, 0x41);
+        emit_byte(&p, 0x58 + (i & 7));
+    }
+    emit_byte(&p, 0x5B);                        /* pop rbx */
+    emit_byte(&p, 0xC3);                        /* ret */
+
+    jit->code_used = p - jit->code;
+}
+
+
+/*! Leaves the translated code, returning done, after setting the guest PC. */
+static void emit_leave(Jit *jit, unsigned char **p, busdata_t pc, int done) {
+    emit_set_pc(p, pc);
+    if (done) {
+        emit_byte(p, 0xB8);                     /* mov eax, 1 */
+        emit_imm32(p, 1);
+    }
+    else {
+        emit_byte(p, 0x31);                     /* xor eax, eax */
+        emit_byte(p, 0xC0);
+    }
+    patch_jump(emit_jump(p, 0), jit->leave);
+}
+
+
+/*!
+ * Goes on to the block at target, from the block that starts at start and
+ * whose code starts at top.  If the target block hasn't been translated yet,
+ * the jump leaves the translated code, and is recorded to be patched later.
+ */
+static void emit_exit(Jit *jit, unsigned char **p, busdata_t target,
+                      busdata_t start, unsigned char *top) {
+    unsigned char *site = emit_jump(p, 0);
+
+    if (target == start) {
+        patch_jump(site, top);
+    }
+    else if (target < INSTRUCTION_STORE_DEPTH && jit->block[target]) {
+        patch_jump(site, jit->block[target]);
+    }
+    else {
+        patch_jump(site, *p);
+        if (target < INSTRUCTION_STORE_DEPTH &&
+            jit->num_exits < JIT_MAX_EXITS) {
+            jit->exits[jit->num_exits].site = site - jit->code;
+            jit->exits[jit->num_exits].target = target;
+            jit->num_exits++;
+        }
+        emit_leave(jit, p, target, 0);
+    }
+}
+
+
+/*!
+ * Translates one guest ALU instruction.  As in the bus model, src2 is both the
+ * ALU's first input and the destination, MOV leaves the status alone, and
+ * every other operation sets it to whether its result was 0.
+ */
+static void emit_alu(unsigned char **p, const DecodedInstr *di) {
+    int dst = HOST_REG(di->src2_addr);
+    int src = HOST_REG(di->src1_addr);
+    int isreg = di->src1_isreg;
+    unsigned int imm = di->src1_const;
+
+    /* The opcode of "op rm, reg" and the digit of "op rm, imm32", for the
+     * two-argument operations.
+     */
+    unsigned char rr_op = 0;
+    int ri_digit = 0;
+
+    switch (di->op) {
+        case OP_MOV:
+            if (isreg) {
+                emit_rr(p, 0x89, src, dst);
+            }
+            else {
+                /* mov r32, imm32, which clears the top half. */
+                emit_byte(p, 0x41);
+                emit_byte(p, 0xB8 + (dst & 7));
+                emit_imm32(p, imm);
+            }
+            return;
+
+        case OP_INC:  emit_unary(p, 0xFF, 0, dst);  break;
+        case OP_DEC:  emit_unary(p, 0xFF, 1, dst);  break;
+        case OP_NEG:  emit_unary(p, 0xF7, 3, dst);  break;
+        case OP_SHL:  emit_unary(p, 0xD1, 4, dst);  break;
+        case OP_SHR:  emit_unary(p, 0xD1, 5, dst);  break;
+
+        case OP_INV:
+            /* not doesn't set the flags, so test the result. */
+            emit_unary(p, 0xF7, 2, dst);
+            emit_rr(p, 0x85, dst, dst);
+            break;
+
+        case OP_ADD:  rr_op = 0x01; ri_digit = 0;  break;
+        case OP_OR:   rr_op = 0x09; ri_digit = 1;  break;
+        case OP_AND:  rr_op = 0x21; ri_digit = 4;  break;
+        case OP_SUB:  rr_op = 0x29; ri_digit = 5;  break;
+        case OP_XOR:  rr_op = 0x31; ri_digit = 6;  break;
+    }
+
+    if (rr_op) {
+        if (isreg)
+            emit_rr(p, rr_op, src, dst);
+        else
+            emit_ri(p, ri_digit, dst, imm);
+    }
+
+    emit_byte(p, 0x0F);                         /* setz dl */
+    emit_byte(p, 0x94);
+    emit_byte(p, 0xC2);
+}
+
+
+/*! Returns nonzero if the instruction with the given opcode ends a block. */
+static int is_block_end(unsigned char op) {
+    return op == OP_DONE || op == OP_BRA || op == OP_BRZ || op == OP_BNZ;
+}
+
+
+/*!
+ * Translates the block of the program starting at start, and patches the
+ * exits that were waiting for it.  Returns 0 if there isn't room for the block
+ * in the code buffer.
+ */
+static int translate_block(Jit *jit, busdata_t start) {
+    const DecodedInstr *program = jit->program;
+    unsigned char *top, *p, *bail_site, *fall_site;
+    busdata_t pc, last = start;
+    int length, i;
+
+    if (jit->code_used + JIT_MAX_BLOCK_BYTES > jit->code_size)
+        return 0;
+
+    /* Find the end of the block. */
+    pc = start;
+    length = 0;
+    while (pc < INSTRUCTION_STORE_DEPTH && length < JIT_MAX_BLOCK_LENGTH) {
+        length++;
+        if (is_block_end(program[pc].op))
+            break;
+        pc += program[pc].length;
+    }
+
+    top = p = jit->code + jit->code_used;
+
+    /* Take the block's instructions from rbx, or leave if there aren't
+     * enough.
+     */
+    emit_ri(&p, 7, RBX, length);                /* cmp rbx, length */
+    bail_site = emit_jump(&p, CC_JL);
+    emit_ri(&p, 5, RBX, length);                /* sub rbx, length */
+
+    pc = start;
+    for (i = 0; i < length; i++) {
+        const DecodedInstr *di = &program[pc];
+
+        switch (di->op) {
+            case OP_DONE:
+                emit_leave(jit, &p, pc + 1, 1);
+                break;
+
+            case OP_BRA:
+                emit_exit(jit, &p, di->branch_addr, start, top);
+                break;
+
+            case OP_BRZ:
+            case OP_BNZ:
+                /* BRZ branches if the status is set, BNZ if it isn't. */
+                emit_byte(&p, 0x84);            /* test dl, dl */
+                emit_byte(&p, 0xD2);
+                fall_site = emit_jump(&p, di->op == OP_BRZ ? CC_JZ : CC_JNZ);
+                emit_exit(jit, &p, di->branch_addr, start, top);
+                patch_jump(fall_site, p);
+                emit_exit(jit, &p, pc + 1, start, top);
+                break;
+
+            default:
+                emit_alu(&p, di);
+                break;
+        }
+
+        last = pc;
+        pc += di->length;
+    }
+
+    /* A block that didn't end in a branch or OP_DONE falls through to the
+     * next one.
+     */
+    if (!is_block_end(program[last].op))
+        emit_exit(jit, &p, pc, start, top);
+
+    patch_jump(bail_site, p);
+    emit_leave(jit, &p, start, 0);
+
+    jit->code_used = p - jit->code;
+    jit->block[start] = top;
+    jit->block_length[start] = length;
+    jit->blocks_translated++;
+
+    /* Exits that were waiting for this block can now go straight to it. */
+    for (i = 0; i < jit->num_exits; ) {
+        if (jit->exits[i].target == start) {
+            patch_jump(jit->code + jit->exits[i].site, top);
+            jit->exits[i] = jit->exits[--jit->num_exits];
+        }
+        else {
+            i++;
+        }
+    }
+
+    return 1;
+}
+
+
+/*
+ * Running Programs
+ */
+
+
+/*!
+ * Allocates and initializes a just-in-time compiler for the predecoded
+ * program, which must stay in place while the compiler is used.  The result
+ * should be freed with free_jit().  If no executable memory can be had, or
+ * JIT_NATIVE is 0, the compiler still works, but interprets every
+ * instruction.
+ */
+Jit * build_jit(const DecodedInstr *program) {
+    Jit *jit = malloc(sizeof(Jit));
+    if (!jit) {
+        fprintf(stderr, "Out of memory building a JIT!\n");
+        exit(11);
+    }
+    memset(jit, 0, sizeof(Jit));
+
+    jit->program = program;
+
+#if JIT_NATIVE
+    jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        perror("mmap");
+        fprintf(stderr, "JIT disabled; interpreting instead.\n");
+        jit->code = NULL;
+    }
+    else {
+        jit->code_size = JIT_CODE_SIZE;
+        emit_enter_leave(jit);
+    }
+#endif
+
+    return jit;
+}
+
+
+/*! Deallocates the just-in-time compiler and its translated code. */
+void free_jit(Jit *jit) {
+    if (jit->code)
+        munmap(jit->code, jit->code_size);
+    free(jit);
+}
+
+
+/*!
+ * Does the same as run_fast(), but runs translated blocks where it can,
+ * translating each block the first time that execution reaches it.  Blocks
+ * that can't be translated, addresses past the end of the instruction store,
+ * and the last instructions before max_steps that don't make up a whole block
+ * are interpreted.
+ */
+int run_jit(Jit *jit, ArchState *state, int max_steps) {
+    long remaining = max_steps;
+    busdata_t pc;
+
+    while (remaining > 0) {
+        pc = state->pc;
+
+        if (jit->code && pc < INSTRUCTION_STORE_DEPTH) {
+            if (!jit->block[pc])
+                translate_block(jit, pc);
+
+            if (jit->block[pc] && jit->block_length[pc] <= remaining) {
+                if (jit->enter(state, &remaining, jit->block[pc]))
+                    return max_steps - remaining;
+                continue;
+            }
+        }
+
+        remaining--;
+        jit->instrs_interpreted++;
+        if (fast_step(jit->program, state) == OP_DONE)
+            return max_steps - remaining;
+    }
+
+    return -1;
+}
@@ -0,0 +1,103 @@
+/*! \file
+ *
+ * This file contains declarations for the just-in-time compiler of the
+ * branching processor.  It translates the basic blocks of a predecoded program
+ * into native x86-64 code as execution reaches them, and keeps the translated
+ * blocks by the address that they start at.  Anything that it can't run
+ * natively is left to the fast functional simulator.
+ */
+
+
+#ifndef JIT_H
+#define JIT_H
+
+
+#include <stddef.h>
+
+#include "fast_sim.h"
+
+
+/*!
+ * 1 if the JIT translates to native code.  Translation needs an x86-64 host,
+ * and a processor whose eight registers and constants fit in the host's
+ * registers and immediates the way translate_block() uses them; for any other
+ * variant of the instruction set, run_jit() interprets every instruction.
+ */
+#if defined(__x86_64__) && NUM_REGISTERS == 8 && DATA_BITS == 64 && \
+    INSTR_BITS < 32
+#define JIT_NATIVE 1
+#else
+#define JIT_NATIVE 0
+#endif
+
+
+/*! The most instructions that one translated block holds. */
+#define JIT_MAX_BLOCK_LENGTH 64
+
+/*!
+ * The most exits from translated blocks that can be waiting for the block
+ * they go to to be translated.  Each block has at most two exits.
+ */
+#define JIT_MAX_EXITS (2 * INSTRUCTION_STORE_DEPTH)
+
+
+/*!
+ * The translated code for the block starting at block, with the guest's
+ * registers and status loaded into host registers, and the number of
+ * instructions that may still be run.  It returns 1 if the program ran
+ * OP_DONE, or 0 if execution should go on from the program counter in state.
+ */
+typedef int (*jit_enter_func)(ArchState *state, long *remaining,
+                              unsigned char *block);
+
+
+/*!
+ * An exit from a translated block that goes to a block that wasn't translated
+ * yet.  The exit's jump still goes to code that returns to run_jit(), and is
+ * patched to go straight to the block when the block is translated.
+ */
+typedef struct JitExit {
+    size_t site;       /*!< The offset of the jump's 32-bit displacement. */
+    busdata_t target;  /*!< The address of the block the exit goes to. */
+} JitExit;
+
+
+/*! The state of the just-in-time compiler for one program. */
+typedef struct Jit {
+    const DecodedInstr *program;  /*!< The program being run. */
+
+    /*!
+     * The buffer that the native code is written to, or NULL if it couldn't be
+     * allocated, in which case every instruction is interpreted.
+     */
+    unsigned char *code;
+    size_t code_size;
+    size_t code_used;
+
+    /*! The code that enters translated code, and the code that leaves it. */
+    jit_enter_func enter;
+    unsigned char *leave;
+
+    /*!
+     * The translated block starting at each address, or NULL if there isn't
+     * one yet, and the number of instructions in it.
+     */
+    unsigned char *block[INSTRUCTION_STORE_DEPTH];
+    int block_length[INSTRUCTION_STORE_DEPTH];
+
+    JitExit exits[JIT_MAX_EXITS];
+    int num_exits;
+
+    int blocks_translated;       /*!< How many blocks have been translated. */
+    long instrs_interpreted;     /*!< How many instructions were interpreted. */
+} Jit;
+
+
+/* Documentation appears in jit.c. */
+Jit * build_jit(const DecodedInstr *program);
+void free_jit(Jit *jit);
+
+int run_jit(Jit *jit, ArchState *state, int max_steps);
+
+
+#endif /* JIT_H */
@@ -0,0 +1,205 @@
+/*! \file
+ *
+ * This file contains the definitions for the timing model of the five-stage
+ * pipelined branching processor.
+ *
+ * Instructions go through the pipeline in order, one stage per cycle.  An
+ * instruction enters ID the cycle after it was fetched and the cycle after the
+ * instruction ahead of it left ID, but no earlier than its operands can be
+ * had:
+ *
+ *  - With forwarding, an ALU result can be used by EX in the cycle after the
+ *    producing instruction's EX, and by a branch in ID in that cycle too.
+ *  - Without forwarding, a register or the status is written in the first half
+ *    of the producing instruction's WB cycle, and can be read in ID in the
+ *    second half.
+ *
+ * After a branch, the pipeline fetches from wherever the branch predictor
+ * says, or from the next address if there is no predictor.  If that was the
+ * wrong place, the instructions fetched after the branch are flushed, and
+ * fetching starts again at the right one in the cycle after the branch was
+ * resolved, or after it was decoded if only the target was missing.
+ *
+ * This processor has no loads, so with forwarding only branches resolved in
+ * ID ever have to wait.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "pipeline.h"
+#include "register_file.h"
+
+
+/*! Returns nonzero if the instruction uses its src1 register. */
+static int reads_src1(const DecodedInstr *di) {
+    return di->op >= OP_MOV && di->op != OP_BRZ && di->op != OP_BNZ &&
+           di->src1_isreg;
+}
+
+
+/*! Returns nonzero if the instruction uses its src2 register. */
+static int reads_src2(const DecodedInstr *di) {
+    return di->dst_write == WRITE_REG && di->op != OP_MOV;
+}
+
+
+/*! Returns nonzero if the instruction sets the status. */
+static int writes_status(const DecodedInstr *di) {
+    return di->dst_write == WRITE_REG && di->op != OP_MOV;
+}
+
+
+/*!
+ * Updates the earliest cycle in which an instruction can enter ID, *id, for
+ * an operand produced by an instruction whose EX was in cycle produced_ex, and
+ * returns the number of cycles that the operand made the instruction wait.
+ * For an operand used in EX, with forwarding, used_in_ex is nonzero.
+ */
+static long operand_ready(const PipelineConfig *config, long produced_ex,
+                          int used_in_ex, long *id, PipelineStats *stats) {
+    long ready, wait;
+
+    if (produced_ex == 0)
+        return 0;
+
+    if (config->forwarding) {
+        /* The value leaves EX at the end of produced_ex. */
+        ready = used_in_ex ? produced_ex : produced_ex + 1;
+
+        /* Anything read before its producer reaches WB is forwarded. */
+        if (*id < produced_ex + 2)
+            stats->forwards++;
+    }
+    else {
+        ready = produced_ex + 2;
+    }
+
+    wait = ready > *id ? ready - *id : 0;
+    if (wait)
+        *id = ready;
+    return wait;
+}
+
+
+/*!
+ * Runs the predecoded program from the given state, as run_fast() does, and
+ * fills in the pipeline's statistics for it.  Returns the number of
+ * instructions run, or -1 if the program didn't finish in max_steps
+ * instructions.
+ */
+int run_pipeline(const DecodedInstr *program, ArchState *state, int max_steps,
+                 const PipelineConfig *config, PipelineStats *stats) {
+    static const DecodedInstr done_instr = {
+        OP_DONE, 0, 0, 1, 0, NOWRITE_REG, 0, 1
+    };
+
+    /* The EX cycle of the last instruction to write each register, and the
+     * status; 0 if none has.
+     */
+    long reg_ex[NUM_REGISTERS], status_ex = 0;
+
+    /* When the last instruction was in ID and EX, and the earliest cycle in
+     * which the next instruction can be fetched.
+     */
+    long last_id = 0, last_ex = 0, next_if = 1;
+
+    BranchPredictor *bp = config->predictor;
+    const DecodedInstr *di;
+    long fetch, id, earliest, wait, resolved;
+    int steps, op, taken, predicted, conditional, btb_hit;
+    busdata_t pc, target = 0;
+
+    memset(stats, 0, sizeof(PipelineStats));
+    memset(reg_ex, 0, sizeof(reg_ex));
+
+    for (steps = 1; steps <= max_steps; steps++) {
+        di = (state->pc < INSTRUCTION_STORE_DEPTH) ? &program[state->pc]
+                                                   : &done_instr;
+
+        fetch = next_if;
+        earliest = fetch + 1 > last_id + 1 ? fetch + 1 : last_id + 1;
+        id = earliest;
+
+        /* The instructions flushed after a redirected branch delay this one. */
+        if (fetch + 1 > last_id + 1 && last_id > 0)
+            stats->flush_cycles += fetch - last_id;
+
+        if (reads_src1(di)) {
+            stats->reg_stalls += operand_ready(config, reg_ex[di->src1_addr],
+                                               1, &id, stats);
+        }
+        if (reads_src2(di)) {
+            stats->reg_stalls += operand_ready(config, reg_ex[di->src2_addr],
+                                               1, &id, stats);
+        }
+
+        taken = (di->op == OP_BRA || (di->op == OP_BNZ && state->status == 0) ||
+                 (di->op == OP_BRZ && state->status != 0));
+
+        if (di->op == OP_BRZ || di->op == OP_BNZ) {
+            wait = operand_ready(config, status_ex,
+                                 config->branch_stage == RESOLVE_IN_EX,
+                                 &id, stats);
+            stats->status_stalls += wait;
+        }
+
+        last_id = id;
+        last_ex = id + 1;
+
+        if (di->dst_write == WRITE_REG)
+            reg_ex[di->src2_addr] = last_ex;
+        if (writes_status(di))
+            status_ex = last_ex;
+
+        /* The next instruction is fetched behind this one, unless this is a
+         * branch that went somewhere other than where it was predicted to,
+         * which redirects fetching once the pipeline knows.
+         */
+        next_if = fetch + 1;
+        if (di->op == OP_BRA || di->op == OP_BRZ || di->op == OP_BNZ) {
+            pc = state->pc;
+            conditional = (di->op != OP_BRA);
+
+            if (bp) {
+                predicted = predict_branch(bp, pc, conditional, &btb_hit,
+                                           &target);
+            }
+            else {
+                predicted = !conditional;
+                btb_hit = 0;
+            }
+
+            resolved = (!conditional || config->branch_stage == RESOLVE_IN_ID)
+                       ? id : last_ex;
+
+            if (predicted != taken) {
+                stats->flushes++;
+                stats->mispredicts++;
+                next_if = resolved + 1;
+            }
+            else if (taken && !(btb_hit && target == di->branch_addr)) {
+                /* The target is known once the branch is decoded. */
+                stats->flushes++;
+                next_if = id + 1;
+            }
+
+            if (bp) {
+                update_branch_predictor(bp, pc, conditional, predicted, taken,
+                                        di->branch_addr);
+            }
+        }
+
+        op = fast_step(program, state);
+        stats->instructions++;
+
+        if (op == OP_DONE)
+            break;
+    }
+
+    /* The last instruction leaves WB two cycles after its EX. */
+    stats->cycles = last_ex + 2;
+
+    return steps <= max_steps ? steps : -1;
+}
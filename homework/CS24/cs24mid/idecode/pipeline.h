@@ -0,0 +1,80 @@
+/*! \file
+ *
+ * This file contains declarations for the timing model of a five-stage
+ * pipelined version of the branching processor:  instruction fetch (IF),
+ * decode and register read (ID), ALU (EX), an empty memory stage (MEM), and
+ * register writeback (WB).  The program runs on the fast functional
+ * simulator, and the model works out the cycle in which each instruction goes
+ * through each stage, counting the cycles lost to data hazards and to
+ * branches.
+ */
+
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+
+#include "fast_sim.h"
+#include "branch_predictor.h"
+
+
+/*! The stage in which conditional branches are resolved. */
+#define RESOLVE_IN_ID 0
+#define RESOLVE_IN_EX 1
+
+
+/*! The design of the pipeline being modeled. */
+typedef struct PipelineConfig {
+    /*!
+     * Nonzero if the ALU's result is forwarded to the instructions behind it;
+     * otherwise an instruction can't read a register or the status until the
+     * instruction that produced it reaches WB.
+     */
+    int forwarding;
+
+    /*!
+     * RESOLVE_IN_ID or RESOLVE_IN_EX.  Resolving conditional branches in ID
+     * costs one fewer flushed instruction when the branch is taken, but the
+     * branch waits in ID for the status if the instruction just before it
+     * sets it.  Unconditional branches are always resolved in ID.
+     */
+    int branch_stage;
+
+    /*!
+     * The predictor that decides where to fetch from after each branch, or
+     * NULL to fetch the next address after every conditional branch.  A
+     * branch that is predicted taken is fetched from its target at once if
+     * the BTB has the target, or from the cycle after it is decoded if not;
+     * a branch whose direction is mispredicted is redirected in the cycle
+     * after it is resolved.
+     */
+    BranchPredictor *predictor;
+} PipelineConfig;
+
+
+/*! What the pipeline did while running a program. */
+typedef struct PipelineStats {
+    long instructions;   /*!< Instructions run, counting OP_DONE. */
+    long cycles;         /*!< Cycles until the last instruction left WB. */
+
+    long reg_stalls;     /*!< Cycles spent in ID waiting for a register. */
+    long status_stalls;  /*!< Cycles spent in ID waiting for the status. */
+
+    long flushes;        /*!< Redirected branches, which flush fetching. */
+    long mispredicts;    /*!< Conditional branches predicted wrongly. */
+    long flush_cycles;   /*!< Cycles lost to flushed instructions. */
+
+    /*!
+     * Operands that were forwarded from a later stage, because the instruction
+     * that produced them hadn't reached WB yet.
+     */
+    long forwards;
+} PipelineStats;
+
+
+/* Documentation appears in pipeline.c. */
+int run_pipeline(const DecodedInstr *program, ArchState *state, int max_steps,
+                 const PipelineConfig *config, PipelineStats *stats);
+
+
+#endif /* PIPELINE_H */
@@ -0,0 +1,174 @@
+/*! \file
+ *
+ * This file contains the definitions for the profiler of the branching
+ * processor.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+#include "instruction.h"
+
+
+/*! A loop:  the addresses from a branch target up to a branch back to it. */
+typedef struct Loop {
+    busdata_t head;            /*!< The first address in the loop. */
+    busdata_t tail;            /*!< The last branch back to the head. */
+    unsigned long iterations;  /*!< How often the head ran. */
+    int depth;                 /*!< How many other loops hold this one. */
+} Loop;
+
+
+/*! Allocates an empty profile. */
+Profile * build_profile() {
+    Profile *profile = malloc(sizeof(Profile));
+    if (!profile) {
+        fprintf(stderr, "Out of memory building a profile!\n");
+        exit(11);
+    }
+    memset(profile, 0, sizeof(Profile));
+    return profile;
+}
+
+
+/*! Deallocates the profile. */
+void free_profile(Profile *profile) {
+    free(profile);
+}
+
+
+/*!
+ * Counts one run of the instruction at pc.  taken is nonzero if it was a
+ * branch that was taken.
+ */
+void profile_record(Profile *profile, busdata_t pc, const DecodedInstr *di,
+                    int taken) {
+    profile->instructions++;
+    profile->op_counts[di->op & 0xF]++;
+
+    if (pc < INSTRUCTION_STORE_DEPTH) {
+        profile->pc_counts[pc]++;
+        if (taken)
+            profile->taken[pc]++;
+    }
+}
+
+
+/*! Orders loops by their head, and loops with the same head outermost first. */
+static int compare_loops(const void *a, const void *b) {
+    const Loop *x = a, *y = b;
+
+    if (x->head != y->head)
+        return (x->head < y->head) ? -1 : 1;
+    if (x->tail != y->tail)
+        return (x->tail > y->tail) ? -1 : 1;
+    return 0;
+}
+
+
+/*!
+ * Finds the loops that ran, and returns how many there are.  Every branch that
+ * ran and goes back to its own address or an earlier one closes a loop; the
+ * branches back to the same head make up one loop, which ends at the last of
+ * them.  Loops are returned outermost first, with the depth of each set.
+ */
+static int find_loops(const Profile *profile, const DecodedInstr *program,
+                      Loop *loops) {
+    int num_loops = 0, pc, i, j;
+
+    for (pc = 0; pc < INSTRUCTION_STORE_DEPTH; pc++) {
+        const DecodedInstr *di = &program[pc];
+
+        if (profile->pc_counts[pc] == 0 ||
+            (di->op != OP_BRA && di->op != OP_BRZ && di->op != OP_BNZ) ||
+            di->branch_addr > (busdata_t) pc)
+            continue;
+
+        for (i = 0; i < num_loops; i++) {
+            if (loops[i].head == di->branch_addr)
+                break;
+        }
+        if (i == num_loops) {
+            loops[i].head = di->branch_addr;
+            num_loops++;
+        }
+        loops[i].tail = pc;
+    }
+
+    /*
+     * Each iteration starts at the head, whether the loop was just entered or
+     * a branch came back to it, so the head's count is the iterations.
+     */
+    for (i = 0; i < num_loops; i++)
+        loops[i].iterations = profile->pc_counts[loops[i].head];
+
+    qsort(loops, num_loops, sizeof(Loop), compare_loops);
+
+    for (i = 0; i < num_loops; i++) {
+        loops[i].depth = 0;
+        for (j = 0; j < i; j++) {
+            if (loops[j].head <= loops[i].head &&
+                loops[i].tail <= loops[j].tail)
+                loops[i].depth++;
+        }
+    }
+
+    return num_loops;
+}
+
+
+/*! Returns count as a percentage of the instructions in the profile. */
+static double percent(const Profile *profile, unsigned long count) {
+    return profile->instructions ? 100.0 * count / profile->instructions : 0;
+}
+
+
+/*!
+ * Prints the profile of a run of the predecoded program:  the opcode
+ * histogram, the count of each address that ran, and the loops, with the
+ * number of instructions that ran inside each.
+ */
+void print_profile(FILE *fd, const Profile *profile,
+                   const DecodedInstr *program) {
+    Loop loops[INSTRUCTION_STORE_DEPTH];
+    char text[32];
+    unsigned long count;
+    int num_loops, op, pc, i;
+    busdata_t addr;
+
+    fprintf(fd, "Profile of %lu instructions:\n\n", profile->instructions);
+
+    fprintf(fd, "  Opcode      Count       %%\n");
+    for (op = 0; op < 16; op++) {
+        if (profile->op_counts[op] == 0)
+            continue;
+        fprintf(fd, "  %-6s %10lu  %5.1f%%\n", op_name(op),
+                profile->op_counts[op], percent(profile, profile->op_counts[op]));
+    }
+
+    fprintf(fd, "\n  PC          Count       %%  Instruction\n");
+    for (pc = 0; pc < INSTRUCTION_STORE_DEPTH; pc++) {
+        count = profile->pc_counts[pc];
+        if (count == 0)
+            continue;
+        disassemble(&program[pc], text, sizeof(text));
+        fprintf(fd, "  %02X     %10lu  %5.1f%%  %s\n", pc, count,
+                percent(profile, count), text);
+    }
+
+    num_loops = find_loops(profile, program, loops);
+    fprintf(fd, "\n  Loops:%s\n", num_loops ? "" : "  none");
+    for (i = 0; i < num_loops; i++) {
+        count = 0;
+        for (addr = loops[i].head; addr <= loops[i].tail; addr++)
+            count += profile->pc_counts[addr];
+
+        fprintf(fd, "  %*s%02lX-%02lX  %lu iterations, %lu instructions "
+                "(%.1f%%)\n", 2 * loops[i].depth, "", loops[i].head,
+                loops[i].tail, loops[i].iterations, count,
+                percent(profile, count));
+    }
+}
@@ -0,0 +1,49 @@
+/*! \file
+ *
+ * This file contains declarations for the profiler of the branching processor,
+ * which counts how often each instruction of a program runs, so that the
+ * program's author can see where its time goes.  At the end of a run, the
+ * profile is printed with a histogram of the opcodes that ran, the count of
+ * every address that ran, and the program's loops:  each branch back to an
+ * earlier address closes a loop, and loops are shown nested inside the loops
+ * that hold them.
+ */
+
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+
+#include <stdio.h>
+
+#include "bus.h"
+#include "instruction_store.h"
+#include "branching_decode.h"
+
+
+/*! The counts that a profile of one run is made of. */
+typedef struct Profile {
+    unsigned long instructions;  /*!< The number of instructions executed. */
+
+    /*! How often the instruction at each address ran. */
+    unsigned long pc_counts[INSTRUCTION_STORE_DEPTH];
+
+    /*! How often the branch at each address was taken. */
+    unsigned long taken[INSTRUCTION_STORE_DEPTH];
+
+    /*! How often each opcode ran. */
+    unsigned long op_counts[16];
+} Profile;
+
+
+/* Documentation appears in profile.c. */
+Profile * build_profile();
+void free_profile(Profile *profile);
+
+void profile_record(Profile *profile, busdata_t pc, const DecodedInstr *di,
+                    int taken);
+void print_profile(FILE *fd, const Profile *profile,
+                   const DecodedInstr *program);
+
+
+#endif /* PROFILE_H */
@@ -61,7 +61,7 @@ void rf_write(RegisterFile* rf) {
 void load_register_file_from_fd(FILE *fd, RegisterFile *rf) {
     char buf[500];
     int slot = 0;
-    int value;
+    busdata_t value;
     int statusp;
 
     if (VERBOSE > 0)
@@ -78,12 +78,13 @@ void load_register_file_from_fd(FILE *fd, RegisterFile *rf) {
         /* Initial space in format specifier allows for whitespace before values
          * in the input line.
          */
-        statusp = sscanf(buf, " %x", &value);
+        statusp = sscanf(buf, " %lx", &value);
 
         if (statusp == 1) {
-            rf->rfmem[slot] = value;
+            /* Registers only hold DATA_BITS bits. */
+            rf->rfmem[slot] = TRUNCATE_DATA(value);
             if (VERBOSE > 0)
-                printf("Storing rfmem[%d] = %X\n", slot, value);
+                printf("Storing rfmem[%d] = %lX\n", slot, rf->rfmem[slot]);
             slot++;
         }
         /*
@@ -107,7 +108,7 @@ void rfprint(FILE* fd, RegisterFile* rf) {
     int i;
 
     for (i = 0; i < NUM_REGISTERS; i++)
-        fprintf(fd, "%d:%0X ", i, rf->rfmem[i]);
+        fprintf(fd, "%d:%0lX ", i, rf->rfmem[i]);
 
     fprintf(fd,"\n");
 }
@@ -117,7 +118,7 @@ void rfprint(FILE* fd, RegisterFile* rf) {
 void write_register_file_to_fd(FILE *fd, RegisterFile *rf) {
     int i;
     for (i=0; i < NUM_REGISTERS; i++) {
-        fprintf(fd, "%0X\n", rf->rfmem[i]);
+        fprintf(fd, "%0lX\n", rf->rfmem[i]);
     }
 }
 
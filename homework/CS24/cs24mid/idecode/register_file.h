@@ -64,7 +64,7 @@ typedef struct RegisterFile {
     pin src2;
 
     /*! These are the actual register values, stored in an array. */
-    unsigned long rfmem[NUM_REGISTERS];
+    busdata_t rfmem[NUM_REGISTERS];
 
 } RegisterFile;
 
@@ -3,11 +3,30 @@
  * simulator.  It contains a main() method that can be used for executing the
  * processor with a set of registers and instructions, and outputting the
  * results to a data file.
+ *
+ * By default the program runs on the bus model of the processor, printing the
+ * state of every bus after each clock.  With -f it runs on the fast functional
+ * simulator instead, dispatching instructions with a switch or, with -d, with
+ * threaded code or the just-in-time compiler, and reports how long each
+ * instruction took.  With -c it runs on the bus model and the switch
+ * dispatcher one instruction at a time, stopping at the first instruction
+ * after which they disagree, and then checks that the threaded dispatcher and
+ * the just-in-time compiler end up in the same state.  With -p it runs on the
+ * timing model of the pipelined processor, once for each of its designs, and
+ * reports the cycles per instruction and where the other cycles went.  -b and
+ * -B give the bus model or the pipeline a branch predictor, whose statistics
+ * for each branch are printed at the end.  -T records every instruction that
+ * the bus model or -f runs, and writes the trace to a file for trace_print.
+ * -P counts how often every instruction, opcode and loop ran in the bus model
+ * or -f, and prints the profile at the end.
  */
 
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
 
 #include "instruction_store.h"
 #include "register_file.h"
@@ -15,35 +34,409 @@
 
 #ifdef BRANCHING
 #include "branching_processor.h"
+#include "branching_control.h"
+#include "fast_sim.h"
+#include "jit.h"
+#include "pipeline.h"
+#include "trace.h"
+#include "profile.h"
 #else
 #include "simple_processor.h"
 #endif
 
 
 
+/*! The number of counters in branch predictors, if -b doesn't say. */
+#define DEFAULT_PREDICTOR_BITS 10
+
+/*! How many of the most recent instructions -T keeps, if -N doesn't say. */
+#define DEFAULT_TRACE_RECORDS (1 << 20)
+
+
+/*! The branch predictor that -b and -B ask for. */
+typedef struct PredictorOptions {
+    int use;              /*!< Nonzero if either option was given. */
+    PredictorKind kind;
+    int table_bits;
+    int btb_size;
+} PredictorOptions;
+
+
+/*! Prints the usage message and exits. */
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-f | -c | -p] [-d switch|threaded|jit] "
+                    "[-t max-instructions] "
+                    "[-b not-taken|bimodal|gshare[:bits]] [-B btb-entries] "
+                    "[-T trace-file [-N records]] [-P] "
+                    "instruction-file "
+                    "initial-register-file-contents "
+                    "final-register-file-contents\n"
+                    "\t-f  run on the fast functional simulator\n"
+                    "\t-d  how the fast simulator dispatches instructions "
+                    "(default switch)\n"
+                    "\t-c  run on both simulators, and check that they agree "
+                    "after every instruction\n"
+                    "\t-p  run on the timing model of the pipelined "
+                    "processor\n"
+                    "\t-t  stop -f, -c or -p after this many instructions "
+                    "(default %d)\n"
+                    "\t-b  predict branches in the bus model or -p, with "
+                    "1 << bits counters (default %d)\n"
+                    "\t-B  give the branch predictor a BTB with this many "
+                    "entries\n"
+                    "\t-T  trace the bus model or -f into this file\n"
+                    "\t-N  keep this many of the last instructions in the "
+                    "trace (default %d)\n"
+                    "\t-P  profile the bus model or -f\n",
+            prog, MAX_EXECUTE_TIME - 1, DEFAULT_PREDICTOR_BITS,
+            DEFAULT_TRACE_RECORDS);
+    exit(1);
+}
+
+
+/*!
+ * Parses the argument of -b, a kind of predictor with an optional number of
+ * bits, into the options.  Returns 0 if the argument is bad.
+ */
+static int parse_predictor(const char *arg, PredictorOptions *popts) {
+    static const PredictorKind kinds[] = {
+        PREDICT_NOT_TAKEN, PREDICT_BIMODAL, PREDICT_GSHARE
+    };
+    const char *colon = strchr(arg, ':');
+    size_t len = colon ? (size_t) (colon - arg) : strlen(arg);
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        const char *name = predictor_name(kinds[i]);
+
+        if (strlen(name) == len && strncmp(arg, name, len) == 0)
+            break;
+    }
+    if (i == 3)
+        return 0;
+
+    popts->use = 1;
+    popts->kind = kinds[i];
+    if (colon) {
+        popts->table_bits = atoi(colon + 1);
+        if (popts->table_bits < 1 || popts->table_bits > 24)
+            return 0;
+    }
+    return 1;
+}
+
+
+/*! Builds the branch predictor that the options ask for, or returns NULL. */
+static BranchPredictor * make_predictor(const PredictorOptions *popts) {
+    if (!popts->use)
+        return NULL;
+    return build_branch_predictor(popts->kind, popts->table_bits,
+                                  popts->btb_size);
+}
+
+
+/*! Copies the processor's registers, program counter and status. */
+static void get_arch_state(Processor *proc, ArchState *state) {
+    int i;
+
+    for (i = 0; i < NUM_REGISTERS; i++)
+        state->regs[i] = proc->rf->rfmem[i];
+    state->pc = bus_read(proc->pc_bus);
+    state->status = bus_read(proc->alustatus);
+}
+
+
+/*! Prints the architectural state on one line. */
+static void print_arch_state(const char *name, const ArchState *state) {
+    int i;
+
+    printf("\t%-8s PC=%02lu STATUS=%lu", name, state->pc, state->status);
+    for (i = 0; i < NUM_REGISTERS; i++)
+        printf(" R%d=%lX", i, state->regs[i]);
+    printf("\n");
+}
+
+
+/*! Returns the current time in seconds. */
+static double get_seconds() {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/*! The ways that the fast simulator can dispatch instructions. */
+typedef enum Dispatch {
+    DISPATCH_SWITCH,
+    DISPATCH_THREADED,
+    DISPATCH_JIT
+} Dispatch;
+
+static const char *dispatch_names[] = { "switch", "threaded", "jit" };
+
+
+/*!
+ * Runs the program from the given state using the given dispatcher, and
+ * returns what the dispatcher returns.
+ */
+static int run_dispatch(Dispatch dispatch, const DecodedInstr *program,
+                        ArchState *state, int max_steps) {
+    Jit *jit;
+    int steps;
+
+    switch (dispatch) {
+    case DISPATCH_THREADED:
+        return run_threaded(program, state, max_steps);
+
+    case DISPATCH_JIT:
+        jit = build_jit(program);
+        steps = run_jit(jit, state, max_steps);
+        printf("JIT:  %d blocks translated, %ld instructions interpreted\n",
+               jit->blocks_translated, jit->instrs_interpreted);
+        free_jit(jit);
+        return steps;
+
+    default:
+        return run_fast(program, state, max_steps);
+    }
+}
+
+
+/*!
+ * Runs the program on the fast simulator, with the given dispatcher, and
+ * writes the final registers back to the processor's
+ * register file.  If the processor has a trace or a profile, run_traced() is
+ * used instead of the dispatcher.  Returns the number of instructions executed, or -1 if the
+ * program didn't finish in max_steps instructions.
+ */
+static int run_fast_mode(Processor *proc, int max_steps, Dispatch dispatch) {
+    ArchState state;
+    double start, seconds;
+    int i, steps;
+
+    predecode(proc->is, proc->program);
+    get_arch_state(proc, &state);
+
+    start = get_seconds();
+    if (proc->trace || proc->profile) {
+        steps = run_traced(proc->program, &state, max_steps, proc->trace,
+                           proc->profile);
+    }
+    else
+        steps = run_dispatch(dispatch, proc->program, &state, max_steps);
+    seconds = get_seconds() - start;
+
+    printf("Dispatch %s:  %.3f seconds, %.2f ns per instruction\n",
+           (proc->trace || proc->profile) ? "traced" : dispatch_names[dispatch],
+           seconds,
+           seconds * 1e9 / (steps < 0 ? max_steps : steps));
+
+    for (i = 0; i < NUM_REGISTERS; i++)
+        proc->rf->rfmem[i] = state.regs[i];
+
+    return steps;
+}
+
+
+/*!
+ * Runs the program on the bus model and on the fast simulator side by side,
+ * and compares their architectural state after each instruction.  Returns the
+ * number of instructions executed, or -1 if the program didn't finish in
+ * max_steps instructions; the program is stopped with exit code 3 at the first
+ * difference.
+ */
+static int run_check_mode(Processor *proc, int max_steps) {
+    ArchState initial, fast, slow, other;
+    int steps, op, other_steps;
+    Dispatch d;
+
+    predecode(proc->is, proc->program);
+    proc->predecoded = 1;
+    get_arch_state(proc, &initial);
+    fast = initial;
+
+    for (steps = 1; steps <= max_steps; steps++) {
+        busdata_t pc = fast.pc;
+
+        clock(proc);
+        op = fast_step(proc->program, &fast);
+
+        get_arch_state(proc, &slow);
+        if (memcmp(&fast, &slow, sizeof(ArchState)) != 0 ||
+            bus_read(proc->cpuop) != (busdata_t) op) {
+            printf("Simulators disagree after instruction %d at PC=%02lu "
+                   "(bus model CPUOP=0x%lX, fast CPUOP=0x%X):\n",
+                   steps, pc, bus_read(proc->cpuop), op);
+            print_arch_state("bus", &slow);
+            print_arch_state("fast", &fast);
+            exit(3);
+        }
+
+        if (op == OP_DONE)
+            break;
+    }
+
+    if (steps > max_steps)
+        steps = -1;
+
+    for (d = DISPATCH_THREADED; d <= DISPATCH_JIT; d++) {
+        other = initial;
+        other_steps = run_dispatch(d, proc->program, &other, max_steps);
+
+        if (other_steps != steps ||
+            memcmp(&other, &fast, sizeof(ArchState)) != 0) {
+            printf("Dispatch %s disagrees:  %d instructions, not %d:\n",
+                   dispatch_names[d], other_steps, steps);
+            print_arch_state("switch", &fast);
+            print_arch_state(dispatch_names[d], &other);
+            exit(3);
+        }
+    }
+
+    return steps;
+}
+
+
+/*!
+ * Runs the program on the pipeline's timing model, once for each design of
+ * the pipeline, and prints a table of what each did.  The final registers are
+ * written back to the processor's register file.  Returns the number of
+ * instructions executed, or -1 if the program didn't finish in max_steps
+ * instructions.
+ */
+static int run_pipeline_mode(Processor *proc, int max_steps,
+                             const PredictorOptions *popts) {
+    static const char *stage_names[] = { "ID", "EX" };
+    PipelineConfig config;
+    PipelineStats stats;
+    ArchState initial, state;
+    int i, steps = -1;
+
+    config.predictor = NULL;
+
+    predecode(proc->is, proc->program);
+    get_arch_state(proc, &initial);
+
+    printf("forwarding branches instructions     cycles   CPI "
+           "reg-stalls status-stalls flushes mispredicts flush-cycles "
+           "forwards\n");
+
+    for (config.forwarding = 1; config.forwarding >= 0; config.forwarding--) {
+        for (config.branch_stage = RESOLVE_IN_ID;
+             config.branch_stage <= RESOLVE_IN_EX; config.branch_stage++) {
+            state = initial;
+            if (config.predictor)
+                free_branch_predictor(config.predictor);
+            config.predictor = make_predictor(popts);
+
+            steps = run_pipeline(proc->program, &state, max_steps, &config,
+                                 &stats);
+
+            printf("%-10s %-8s %12ld %10ld %5.2f %10ld %13ld %7ld %11ld "
+                   "%12ld %8ld\n",
+                   config.forwarding ? "yes" : "no",
+                   stage_names[config.branch_stage],
+                   stats.instructions, stats.cycles,
+                   (double) stats.cycles / stats.instructions,
+                   stats.reg_stalls, stats.status_stalls, stats.flushes,
+                   stats.mispredicts, stats.flush_cycles, stats.forwards);
+        }
+    }
+
+    /* Every design runs the same branches, so the predictor's statistics are
+     * the same for each.
+     */
+    if (config.predictor) {
+        printf("\n");
+        print_branch_stats(stdout, config.predictor);
+        free_branch_predictor(config.predictor);
+    }
+
+    for (i = 0; i < NUM_REGISTERS; i++)
+        proc->rf->rfmem[i] = state.regs[i];
+
+    return steps;
+}
+
+
 /*! Run the processor against an initial state and set of instructions. */
 int main (int argc,  char **argv) {
-    FILE *ifd;     /* File for loading the instructions from. */
     FILE *rifd;    /* File for loading the initial register-file from. */
     FILE *rofd;    /* File for storing the final register-file to. */
+    FILE *tfd = NULL;  /* File for storing the execution trace to. */
     Processor *proc;  /* The processor state to run with. */
+    Dispatch dispatch = DISPATCH_SWITCH;
+    PredictorOptions popts = {
+        0, PREDICT_NOT_TAKEN, DEFAULT_PREDICTOR_BITS, 0
+    };
+    int fast = 0, check = 0, pipe = 0, max_steps = MAX_EXECUTE_TIME - 1;
+    int trace_records = DEFAULT_TRACE_RECORDS;
+    const char *trace_file = NULL;
+    int profile = 0;
+    int opt, steps;
 
-    if (argc < 4) {
-        fprintf(stderr, "Usage: run instruction-file "
-                        "initial-register-file-contents "
-                        "final-register-file-contents\n");
-        exit(1);
+    while ((opt = getopt(argc, argv, "fcpd:t:b:B:T:N:P")) != -1) {
+        switch (opt) {
+        case 'f':
+            fast = 1;
+            break;
+        case 'c':
+            check = 1;
+            break;
+        case 'p':
+            pipe = 1;
+            break;
+        case 'd':
+            if (strcmp(optarg, "switch") == 0)
+                dispatch = DISPATCH_SWITCH;
+            else if (strcmp(optarg, "threaded") == 0)
+                dispatch = DISPATCH_THREADED;
+            else if (strcmp(optarg, "jit") == 0)
+                dispatch = DISPATCH_JIT;
+            else
+                usage(argv[0]);
+            break;
+        case 'b':
+            if (!parse_predictor(optarg, &popts))
+                usage(argv[0]);
+            break;
+        case 'B':
+            popts.use = 1;
+            popts.btb_size = atoi(optarg);
+            if (popts.btb_size < 0)
+                usage(argv[0]);
+            break;
+        case 't':
+            max_steps = atoi(optarg);
+            if (max_steps <= 0)
+                usage(argv[0]);
+            break;
+        case 'T':
+            trace_file = optarg;
+            break;
+        case 'P':
+            profile = 1;
+            break;
+        case 'N':
+            trace_records = atoi(optarg);
+            if (trace_records <= 0)
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
     }
 
+    if (fast + check + pipe > 1 || argc - optind < 3 ||
+        ((trace_file || profile) && (check || pipe)))
+        usage(argv[0]);
+    argv += optind - 1;
+
     proc = build_processor();
 
-    ifd = fopen(argv[1], "r");
-    if (!ifd) {
-        fprintf(stderr, "Opening %s: ", argv[1]);
-        perror("fopen");
-        exit(2);
-    }
-    load_instruction_store_from_fd(ifd, proc->is);
+    /* The instructions may be text or a program image from "convert -b". */
+    load_instruction_store_from_file(argv[1], proc->is);
 
     rifd = fopen(argv[2], "r");
     if (!rifd) {
@@ -60,11 +453,62 @@ int main (int argc,  char **argv) {
         exit(2);
     }
 
-    run(proc);
+    if (trace_file) {
+        tfd = fopen(trace_file, "wb");
+        if (!tfd) {
+            fprintf(stderr, "Opening %s: ", trace_file);
+            perror("fopen");
+            exit(2);
+        }
+        proc->trace = build_trace(trace_records);
+    }
+    if (profile)
+        proc->profile = build_profile();
+
+    if (fast || check || pipe) {
+        if (fast)
+            steps = run_fast_mode(proc, max_steps, dispatch);
+        else if (check)
+            steps = run_check_mode(proc, max_steps);
+        else
+            steps = run_pipeline_mode(proc, max_steps, &popts);
+
+        if (steps < 0) {
+            printf("ERROR:  Max execute time reached.\n"
+                   "Does your program have an infinite loop in it?\n");
+        }
+        else {
+            printf("Program terminated normally after %d instructions%s.\n",
+                   steps, check ? ", and both simulators agreed" : "");
+        }
+
+        if (proc->profile) {
+            printf("\n");
+            print_profile(stdout, proc->profile, proc->program);
+        }
+    }
+    else {
+        proc->bru->predictor = make_predictor(&popts);
+        run(proc);
+
+        if (proc->bru->predictor) {
+            printf("\n");
+            print_branch_stats(stdout, proc->bru->predictor);
+            free_branch_predictor(proc->bru->predictor);
+        }
+    }
 
     write_register_file_to_fd(rofd, proc->rf);
     fclose(rofd);
 
+    if (proc->trace) {
+        write_trace(tfd, proc->trace);
+        fclose(tfd);
+        free_trace(proc->trace);
+    }
+    if (proc->profile)
+        free_profile(proc->profile);
+
     free_processor(proc);
 
     return 0;
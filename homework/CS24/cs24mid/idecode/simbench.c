@@ -0,0 +1,224 @@
+/*! \file
+ * This file contains a benchmark of the simulator's engines.  It runs one
+ * program on the bus model, and on the fast simulator with each of its
+ * dispatchers, and prints one CSV line for each engine with the instructions
+ * that it ran and how fast it ran them:
+ *
+ *     program,engine,instructions,finished,seconds,mips,checksum
+ *
+ * The bus model is far slower than the others, so it only runs up to its own
+ * limit of instructions; finished is 0 if an engine stopped at its limit
+ * before the program ran OP_DONE.  The checksum is of the registers that the
+ * engine left behind, and is the same for every engine that finished.  The
+ * time of the JIT includes translating the program.  "make bench" runs every
+ * benchmark program, into bench.csv.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+
+#include "branching_processor.h"
+#include "branching_control.h"
+#include "fast_sim.h"
+#include "jit.h"
+
+
+/*! How many instructions the bus model runs, if -b doesn't say. */
+#define DEFAULT_BUS_STEPS 20000000
+
+/*! How many instructions the fast simulator runs, if -t doesn't say. */
+#define DEFAULT_FAST_STEPS 1000000000
+
+
+/*! Prints the usage message and exits. */
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-b bus-instructions] [-t max-instructions] "
+                    "instruction-file register-file\n"
+                    "\t-b  the most instructions to run on the bus model "
+                    "(default %d)\n"
+                    "\t-t  the most instructions to run on the fast simulator "
+                    "(default %d)\n"
+                    "\tprints a CSV line of\n"
+                    "\tprogram,engine,instructions,finished,seconds,mips,"
+                    "checksum\n"
+                    "\tfor each engine\n",
+            prog, DEFAULT_BUS_STEPS, DEFAULT_FAST_STEPS);
+    exit(1);
+}
+
+
+/*! Returns the current time in seconds. */
+static double get_seconds() {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/*! Returns an FNV-1a hash of the registers. */
+static unsigned long checksum(const busdata_t *regs) {
+    const unsigned char *p = (const unsigned char *) regs;
+    unsigned long hash = 14695981039346656037UL;
+    size_t i;
+
+    for (i = 0; i < NUM_REGISTERS * sizeof(busdata_t); i++) {
+        hash ^= p[i];
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+
+/*! Prints the CSV line of one engine's run. */
+static void report(const char *program, const char *engine, long steps,
+                   int finished, double seconds, const busdata_t *regs) {
+    printf("%s,%s,%ld,%d,%.4f,%.2f,%016lx\n", program, engine, steps,
+           finished, seconds, seconds > 0 ? steps / seconds / 1e6 : 0,
+           checksum(regs));
+}
+
+
+/*!
+ * Runs the processor's program on the bus model for up to max_steps
+ * instructions, without printing the buses as run() does.
+ */
+static void bench_bus(const char *program, Processor *proc, long max_steps) {
+    double start, seconds;
+    long steps;
+
+    predecode(proc->is, proc->program);
+    proc->predecoded = 1;
+
+    start = get_seconds();
+    for (steps = 1; steps <= max_steps; steps++) {
+        clock(proc);
+        if (bus_read(proc->cpuop) == OP_DONE)
+            break;
+    }
+    seconds = get_seconds() - start;
+
+    if (steps > max_steps)
+        report(program, "bus", max_steps, 0, seconds, proc->rf->rfmem);
+    else
+        report(program, "bus", steps, 1, seconds, proc->rf->rfmem);
+}
+
+
+/*!
+ * Runs the program on the fast simulator from the initial state, with each
+ * dispatcher in turn.
+ */
+static void bench_fast(const char *program, const DecodedInstr *decoded,
+                       const ArchState *initial, int max_steps) {
+    static const char *names[] = { "switch", "threaded", "jit" };
+    ArchState state;
+    double start, seconds;
+    Jit *jit;
+    int engine, steps;
+
+    for (engine = 0; engine < 3; engine++) {
+        state = *initial;
+
+        start = get_seconds();
+        if (engine == 0) {
+            steps = run_fast(decoded, &state, max_steps);
+        }
+        else if (engine == 1) {
+            steps = run_threaded(decoded, &state, max_steps);
+        }
+        else {
+            jit = build_jit(decoded);
+            steps = run_jit(jit, &state, max_steps);
+            free_jit(jit);
+        }
+        seconds = get_seconds() - start;
+
+        if (steps < 0)
+            report(program, names[engine], max_steps, 0, seconds, state.regs);
+        else
+            report(program, names[engine], steps, 1, seconds, state.regs);
+    }
+}
+
+
+/*! Benchmark every engine on the program named on the command line. */
+int main(int argc, char **argv) {
+    Processor *proc;
+    ArchState initial;
+    FILE *rifd;
+    char program[100], *p;
+    long bus_steps = DEFAULT_BUS_STEPS;
+    int max_steps = DEFAULT_FAST_STEPS;
+    int opt, saved_stdout, devnull, i;
+
+    while ((opt = getopt(argc, argv, "b:t:")) != -1) {
+        switch (opt) {
+        case 'b':
+            bus_steps = atol(optarg);
+            break;
+        case 't':
+            max_steps = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (argc - optind != 2 || bus_steps <= 0 || max_steps <= 0)
+        usage(argv[0]);
+    argv += optind - 1;
+
+    /* The program's name is its file's, without the directory or suffix. */
+    p = strrchr(argv[1], '/');
+    strncpy(program, p ? p + 1 : argv[1], sizeof(program) - 1);
+    program[sizeof(program) - 1] = '\0';
+    p = strrchr(program, '.');
+    if (p)
+        *p = '\0';
+
+    rifd = fopen(argv[2], "r");
+    if (!rifd) {
+        fprintf(stderr, "Opening %s: ", argv[2]);
+        perror("fopen");
+        exit(2);
+    }
+
+    /* The loaders report what they load on stdout, where it would get mixed
+     * up with the CSV lines.
+     */
+    fflush(stdout);
+    saved_stdout = dup(1);
+    devnull = open("/dev/null", O_WRONLY);
+    if (saved_stdout < 0 || devnull < 0) {
+        perror("open");
+        exit(2);
+    }
+    dup2(devnull, 1);
+
+    proc = build_processor();
+    load_instruction_store_from_file(argv[1], proc->is);
+    load_register_file_from_fd(rifd, proc->rf);
+
+    fflush(stdout);
+    dup2(saved_stdout, 1);
+    close(saved_stdout);
+    close(devnull);
+
+    predecode(proc->is, proc->program);
+    for (i = 0; i < NUM_REGISTERS; i++)
+        initial.regs[i] = proc->rf->rfmem[i];
+    initial.pc = bus_read(proc->pc_bus);
+    initial.status = bus_read(proc->alustatus);
+
+    bench_fast(program, proc->program, &initial, max_steps);
+    bench_bus(program, proc, bus_steps);
+
+    free_processor(proc);
+    return 0;
+}
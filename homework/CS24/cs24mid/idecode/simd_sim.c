@@ -0,0 +1,183 @@
+/*! \file
+ *
+ * This file contains the definitions for the lockstep simulator of the
+ * branching processor.
+ *
+ * Every lane has its own program counter.  Each step runs the instruction at
+ * the lowest program counter of any lane that is still running, for the lanes
+ * that are at it, and leaves the other lanes as they are.  While the lanes
+ * follow the same path they all run every step; when a branch sends them
+ * different ways, the lanes that are behind catch up first, which brings them
+ * back together at the top of a loop or where the paths of an if meet.
+ *
+ * Finding the lowest program counter means looking at every lane, so while
+ * all of the running lanes are at the same instruction, the simulator just
+ * follows that instruction's address, and only looks at the lanes again after
+ * a branch that the lanes don't all take the same way.  It also looks when the
+ * lane that has run the most instructions could reach max_steps.
+ *
+ * The vectors use GCC's vector extensions, which the compiler turns into
+ * whatever vector instructions the target has.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "simd_sim.h"
+#include "register_file.h"
+
+
+/*! A vector with one 64-bit value for each lane. */
+typedef unsigned long lanes_t
+    __attribute__((vector_size(SIMD_LANES * sizeof(unsigned long))));
+
+/*! The result of comparing two vectors:  all ones in a lane if it held. */
+typedef long lanemask_t
+    __attribute__((vector_size(SIMD_LANES * sizeof(long))));
+
+
+/*!
+ * a in the lanes of mask, and b in the others.  This is a macro, since passing
+ * vectors wider than the target's registers to a function draws warnings.
+ */
+#define select_lanes(mask, a, b) \
+    (((a) & (lanes_t) (mask)) | ((b) & ~(lanes_t) (mask)))
+
+
+/*!
+ * Runs the predecoded program for the first num_lanes states together, which
+ * may be at most SIMD_LANES.  Each state ends up as run_fast() would leave
+ * it, and steps[i] is set to what run_fast() would return for states[i].
+ */
+void run_lanes(const DecodedInstr *program, ArchState *states, int *steps,
+               int num_lanes, int max_steps) {
+    static const DecodedInstr done_instr = {
+        OP_DONE, 0, 0, 1, 0, NOWRITE_REG, 0, 1
+    };
+
+    lanes_t regs[NUM_REGISTERS], pc, status, count;
+    lanes_t A, B, result, zero, one, target;
+    lanemask_t running, here, taken, done;
+    const DecodedInstr *di;
+    busdata_t lowest = 0, most;
+    long budget = 0;
+    int i, lane, any, together = 0;
+
+    memset(&zero, 0, sizeof(zero));
+    one = zero + 1;
+    count = zero;
+    running = (lanemask_t) zero;
+    done = (lanemask_t) zero;
+
+    /* Lanes past num_lanes stay stopped. */
+    for (lane = 0; lane < SIMD_LANES; lane++) {
+        ArchState *s = &states[lane < num_lanes ? lane : 0];
+
+        for (i = 0; i < NUM_REGISTERS; i++)
+            regs[i][lane] = s->regs[i];
+        pc[lane] = s->pc;
+        status[lane] = s->status;
+        running[lane] = (lane < num_lanes) ? -1 : 0;
+    }
+
+    while (1) {
+        if (together && budget > 0) {
+            here = running;
+        }
+        else {
+            /* Find the lowest program counter of the lanes still running, and
+             * the most instructions that any of them has run.
+             */
+            any = 0;
+            most = 0;
+            for (lane = 0; lane < SIMD_LANES; lane++) {
+                if (!running[lane])
+                    continue;
+                if (!any || pc[lane] < lowest)
+                    lowest = pc[lane];
+                if (count[lane] > most)
+                    most = count[lane];
+                any = 1;
+            }
+            if (!any)
+                break;
+
+            here = running & (pc == lowest);
+            together = (memcmp(&here, &running, sizeof(here)) == 0);
+            budget = max_steps - most;
+        }
+        di = (lowest < INSTRUCTION_STORE_DEPTH) ? &program[lowest]
+                                                : &done_instr;
+
+        A = regs[di->src2_addr];
+        B = di->src1_isreg ? regs[di->src1_addr] : zero + di->src1_const;
+
+        /* The branch unit looks at the status before the ALU changes it. */
+        switch (di->op) {
+            case OP_BRA:  taken = here;                            break;
+            case OP_BRZ:  taken = here & (status != 0);            break;
+            case OP_BNZ:  taken = here & (status == 0);            break;
+            default:      taken = (lanemask_t) zero;               break;
+        }
+
+        switch (di->op) {
+            case OP_MOV:  result = B;        break;
+            case OP_ADD:  result = A + B;    break;
+            case OP_SUB:  result = A - B;    break;
+            case OP_NEG:  result = -A;       break;
+            case OP_INC:  result = A + 1;    break;
+            case OP_DEC:  result = A - 1;    break;
+            case OP_INV:  result = ~A;       break;
+            case OP_AND:  result = A & B;    break;
+            case OP_OR:   result = A | B;    break;
+            case OP_XOR:  result = A ^ B;    break;
+            case OP_SHL:  result = A << 1;   break;
+            case OP_SHR:  result = A >> 1;   break;
+            default:      result = zero;     break;
+        }
+
+        /* Registers only hold DATA_BITS bits. */
+        result = TRUNCATE_DATA(result);
+
+        if (di->dst_write == WRITE_REG) {
+            regs[di->src2_addr] = select_lanes(here, result,
+                                               regs[di->src2_addr]);
+            if (di->op != OP_MOV) {
+                status = select_lanes(here, (lanes_t) (result == 0) & one,
+                                      status);
+            }
+        }
+
+        target = zero + di->branch_addr;
+        pc = select_lanes(taken, target,
+                          select_lanes(here, pc + di->length, pc));
+        count += (lanes_t) here & one;
+
+        /* Lanes stop at OP_DONE, or when they run out of instructions. */
+        if (di->op == OP_DONE)
+            done |= here;
+        running &= ~done & (count != (unsigned long) max_steps);
+
+        /* Work out where the lanes go, if they were all here. */
+        budget--;
+        if (together) {
+            if (di->op == OP_DONE)
+                together = 0;
+            else if (memcmp(&taken, &here, sizeof(taken)) == 0)
+                lowest = di->branch_addr;
+            else if (memcmp(&taken, &zero, sizeof(taken)) == 0)
+                lowest += di->length;
+            else
+                together = 0;
+        }
+    }
+
+    for (lane = 0; lane < num_lanes; lane++) {
+        steps[lane] = done[lane] ? (int) count[lane] : -1;
+        for (i = 0; i < NUM_REGISTERS; i++)
+            states[lane].regs[i] = regs[i][lane];
+        states[lane].pc = pc[lane];
+        states[lane].status = status[lane];
+    }
+}
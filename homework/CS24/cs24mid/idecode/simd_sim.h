@@ -0,0 +1,40 @@
+/*! \file
+ *
+ * This file contains declarations for the lockstep simulator of the branching
+ * processor, which runs one program for several register files at once.  Each
+ * register holds a vector with one lane per register file, so that each ALU
+ * operation is done once for all of the lanes that are at the instruction.
+ */
+
+
+#ifndef SIMD_SIM_H
+#define SIMD_SIM_H
+
+
+#include "fast_sim.h"
+
+
+/*!
+ * The number of register files that are run together, which should fill one
+ * of the target's vector registers:  8 lanes of 64 bits with AVX-512, 4 with
+ * AVX2, and 2 with SSE2.  Wider vectors than the target has are split into
+ * several registers, which is slower than running fewer lanes.  Compile with
+ * -DSIMD_LANES=n, a power of two, to choose another number.
+ */
+#ifndef SIMD_LANES
+#if defined(__AVX512F__)
+#define SIMD_LANES 8
+#elif defined(__AVX2__)
+#define SIMD_LANES 4
+#else
+#define SIMD_LANES 2
+#endif
+#endif
+
+
+/* Documentation appears in simd_sim.c. */
+void run_lanes(const DecodedInstr *program, ArchState *states, int *steps,
+               int num_lanes, int max_steps);
+
+
+#endif /* SIMD_SIM_H */
@@ -0,0 +1,130 @@
+/*! \file
+ *
+ * This file contains the definitions for execution traces of the branching
+ * processor.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "register_file.h"
+
+
+/*! Allocates a trace that keeps the last capacity records. */
+ExecTrace * build_trace(unsigned int capacity) {
+    ExecTrace *trace;
+
+    trace = malloc(sizeof(ExecTrace));
+    if (trace)
+        trace->records = malloc(capacity * sizeof(TraceRecord));
+    if (!trace || !trace->records) {
+        fprintf(stderr, "Out of memory building an execution trace!\n");
+        exit(11);
+    }
+
+    trace->capacity = capacity;
+    trace->total = 0;
+    return trace;
+}
+
+
+/*! Deallocates the trace. */
+void free_trace(ExecTrace *trace) {
+    free(trace->records);
+    free(trace);
+}
+
+
+/*!
+ * Adds the record of one instruction to the trace, overwriting the oldest
+ * record if the trace is full.  dst_value is ignored unless the instruction
+ * writes a register.
+ */
+void trace_record(ExecTrace *trace, unsigned int cycle, busdata_t pc,
+                  const DecodedInstr *di, busdata_t dst_value,
+                  busdata_t status) {
+    TraceRecord *rec = &trace->records[trace->total % trace->capacity];
+
+    rec->cycle = cycle;
+    rec->pc = pc;
+    rec->status = status;
+    memset(rec->unused, 0, sizeof(rec->unused));
+    rec->instr = *di;
+    rec->dst_value = (di->dst_write == WRITE_REG) ? dst_value : 0;
+    trace->total++;
+}
+
+
+/*!
+ * Does the same as run_fast(), but adds the record of every instruction to
+ * the trace, and counts it in the profile.  Either of them may be NULL.
+ */
+int run_traced(const DecodedInstr *program, ArchState *state, int max_steps,
+               ExecTrace *trace, Profile *profile) {
+    static const DecodedInstr done_instr = {
+        OP_DONE, 0, 0, 1, 0, NOWRITE_REG, 0, 1
+    };
+    const DecodedInstr *di;
+    busdata_t pc;
+    int steps, op, taken;
+
+    for (steps = 1; steps <= max_steps; steps++) {
+        pc = state->pc;
+        di = (pc < INSTRUCTION_STORE_DEPTH) ? &program[pc] : &done_instr;
+
+        op = fast_step(program, state);
+        if (trace) {
+            trace_record(trace, steps, pc, di, state->regs[di->src2_addr],
+                         state->status);
+        }
+        if (profile) {
+            /* Branches leave the status alone, so it is the one they tested. */
+            taken = (op == OP_BRA || (op == OP_BRZ && state->status != 0) ||
+                     (op == OP_BNZ && state->status == 0));
+            profile_record(profile, pc, di, taken);
+        }
+
+        if (op == OP_DONE)
+            return steps;
+    }
+
+    return -1;
+}
+
+
+/*!
+ * Writes the trace to the file in the format described in trace.h, with the
+ * records that are still in the ring buffer, oldest first.  The program is
+ * terminated if the file can't be written.
+ */
+void write_trace(FILE *fd, const ExecTrace *trace) {
+    TraceFileHeader header;
+    unsigned int start, count, first_part;
+
+    count = (trace->total < trace->capacity) ? trace->total : trace->capacity;
+    start = (trace->total - count) % trace->capacity;
+
+    /* The records wrap around the end of the ring buffer at most once. */
+    first_part = trace->capacity - start;
+    if (first_part > count)
+        first_part = count;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_FILE_VERSION;
+    header.record_size = sizeof(TraceRecord);
+    header.num_records = count;
+    header.total = trace->total;
+
+    if (fwrite(&header, sizeof(header), 1, fd) != 1 ||
+        fwrite(trace->records + start, sizeof(TraceRecord), first_part, fd)
+            != first_part ||
+        fwrite(trace->records, sizeof(TraceRecord), count - first_part, fd)
+            != count - first_part) {
+        perror("fwrite");
+        exit(2);
+    }
+}
@@ -0,0 +1,88 @@
+/*! \file
+ *
+ * This file contains declarations for execution traces of the branching
+ * processor.  A trace keeps a record of every instruction that a run
+ * executes in a ring buffer that is allocated before the run starts, so that
+ * recording never allocates or does any I/O, and only the most recent records
+ * are kept once the buffer is full.  The trace can be written to a compact
+ * binary file after the run, and trace_print prints such files.
+ *
+ * Tracing costs nothing when it is off:  the bus model only checks whether it
+ * has been given a trace, and the fast simulator's dispatchers aren't traced
+ * at all; run_traced() is a separate, slower loop, which can also fill in a
+ * profile.
+ */
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+
+#include <stdio.h>
+
+#include "bus.h"
+#include "branching_decode.h"
+#include "fast_sim.h"
+#include "profile.h"
+
+
+/*! The record of one executed instruction. */
+typedef struct TraceRecord {
+    unsigned int cycle;      /*!< The clock or step it ran on, from 1. */
+    unsigned int pc;         /*!< Its address. */
+    unsigned char status;    /*!< The ALU status after it ran. */
+    unsigned char unused[3];
+    DecodedInstr instr;      /*!< The instruction itself. */
+
+    /*! The value written to its destination, or 0 if it writes none. */
+    unsigned long dst_value;
+} TraceRecord;
+
+
+/*! A ring buffer of the most recent records of a run. */
+typedef struct ExecTrace {
+    TraceRecord *records;
+    unsigned int capacity;   /*!< The size of records. */
+
+    /*! How many records have been added, including those overwritten. */
+    unsigned long total;
+} ExecTrace;
+
+
+/*
+ * Trace Files
+ *
+ * A trace file is a TraceFileHeader, followed by header.num_records
+ * TraceRecords, oldest first.  Everything is in the host's byte order.
+ */
+
+#define TRACE_FILE_MAGIC "TR24"
+#define TRACE_FILE_VERSION 1
+
+typedef struct TraceFileHeader {
+    char magic[4];             /*!< Always TRACE_FILE_MAGIC. */
+    unsigned int version;      /*!< Always TRACE_FILE_VERSION. */
+    unsigned int record_size;  /*!< sizeof(TraceRecord). */
+    unsigned int num_records;  /*!< The number of records that follow. */
+
+    /*! How many instructions the run executed; more than num_records if the
+     *  trace overflowed. */
+    unsigned long total;
+} TraceFileHeader;
+
+
+/* Documentation appears in trace.c. */
+ExecTrace * build_trace(unsigned int capacity);
+void free_trace(ExecTrace *trace);
+
+void trace_record(ExecTrace *trace, unsigned int cycle, busdata_t pc,
+                  const DecodedInstr *di, busdata_t dst_value,
+                  busdata_t status);
+
+int run_traced(const DecodedInstr *program, ArchState *state, int max_steps,
+               ExecTrace *trace, Profile *profile);
+
+void write_trace(FILE *fd, const ExecTrace *trace);
+
+
+#endif /* TRACE_H */
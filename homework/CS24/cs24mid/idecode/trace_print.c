@@ -0,0 +1,71 @@
+/*! \file
+ * This file contains a program that prints an execution trace written by
+ * branching_run -T, one instruction per line:  the cycle it ran on, its
+ * address, the instruction, the value it wrote to its destination, and the
+ * ALU status after it ran.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "register_file.h"
+
+
+/*! Print the trace file named on the command line. */
+int main(int argc, char **argv) {
+    TraceFileHeader header;
+    TraceRecord rec;
+    FILE *fd;
+    char text[32];
+    unsigned int i;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s trace-file\n", argv[0]);
+        exit(1);
+    }
+
+    fd = fopen(argv[1], "rb");
+    if (!fd) {
+        fprintf(stderr, "Opening %s: ", argv[1]);
+        perror("fopen");
+        exit(2);
+    }
+
+    if (fread(&header, sizeof(header), 1, fd) != 1 ||
+        memcmp(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != TRACE_FILE_VERSION ||
+        header.record_size != sizeof(TraceRecord)) {
+        fprintf(stderr, "%s:  not a trace file from this version of the "
+                "simulator\n", argv[1]);
+        exit(2);
+    }
+
+    printf("%lu instructions executed", header.total);
+    if (header.total > header.num_records)
+        printf(", the last %u of them traced", header.num_records);
+    printf(".\n\n");
+    printf("%10s  %-4s  %-16s  %-20s  %s\n",
+           "CYCLE", "PC", "INSTRUCTION", "DST", "STATUS");
+
+    for (i = 0; i < header.num_records; i++) {
+        if (fread(&rec, sizeof(rec), 1, fd) != 1) {
+            fprintf(stderr, "%s:  trace file is truncated after %u records\n",
+                    argv[1], i);
+            exit(2);
+        }
+
+        disassemble(&rec.instr, text, sizeof(text));
+        printf("%10u  %02X    %-16s  ", rec.cycle, rec.pc, text);
+        if (rec.instr.dst_write == WRITE_REG)
+            printf("R%d = %-15lX  ", rec.instr.src2_addr, rec.dst_value);
+        else
+            printf("%-20s  ", "");
+        printf("%d\n", rec.status);
+    }
+
+    fclose(fd);
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "screen.h"
+#include "drawing.h"
+
+
+/* The size of the screen that the circles are drawn on. */
+#define BENCH_WIDTH  640
+#define BENCH_HEIGHT 480
+
+/* How many circles of each radius are drawn, if the command line doesn't
+ * say.
+ */
+#define DEFAULT_CIRCLES 20000
+
+
+/* Returns the current time in seconds. */
+static double get_seconds() {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/* Draws a circle the way draw_circle() used to, with a draw_pixel() for
+ * every point, to compare it against.
+ */
+static void draw_circle_by_pixels(Screen *s, int xc, int yc, int r,
+                                  unsigned char value, unsigned char depth) {
+    int x = 0, y = r, d = 1 - r;
+
+    circle_points(s, xc, yc, x, y, value, depth);
+    while (y > x) {
+        x++;
+        if (d < 0) {
+            d += 2 * x + 3;
+        }
+        else {
+            d += 2 * (x - y) + 5;
+            y--;
+        }
+        circle_points(s, xc, yc, x, y, value, depth);
+    }
+}
+
+
+/* Draws n circles of radius r with one of the circle functions, at the
+ * centers, colors and depths in the arrays, and returns how many circles a
+ * second it drew.
+ */
+static double bench(Screen *s,
+                    void (*draw)(Screen *, int, int, int,
+                                 unsigned char, unsigned char),
+                    int n, int r, const int *xs, const int *ys,
+                    const unsigned char *values, const unsigned char *depths) {
+    double start, seconds;
+    int i;
+
+    clear_screen(s);
+
+    start = get_seconds();
+    for (i = 0; i < n; i++)
+        draw(s, xs[i], ys[i], r, values[i], depths[i]);
+    seconds = get_seconds() - start;
+
+    return seconds > 0 ? n / seconds : 0;
+}
+
+
+/* Measures how many circles a second can be drawn, at several radii, by
+ * drawing each circle pixel by pixel, with draw_circle(), and with
+ * fill_circle().  The centers are spread a little past the edges of the
+ * screen, so that some of the circles are clipped, and some are off the
+ * screen altogether.
+ */
+int main(int argc, char **argv) {
+    static const int radii[] = { 2, 8, 32, 128 };
+    Screen *s = make_screen(BENCH_WIDTH, BENCH_HEIGHT);
+    int n = DEFAULT_CIRCLES;
+    int *xs, *ys, i, j, r;
+    unsigned char *values, *depths;
+
+    if (argc > 2 || (argc == 2 && (n = atoi(argv[1])) <= 0)) {
+        fprintf(stderr, "Usage: %s [circles]\n", argv[0]);
+        exit(1);
+    }
+
+    xs = malloc(n * sizeof(int));
+    ys = malloc(n * sizeof(int));
+    values = malloc(n);
+    depths = malloc(n);
+    if (!xs || !ys || !values || !depths) {
+        fprintf(stderr, "Out of memory!\n");
+        exit(11);
+    }
+
+    printf("%d circles of each radius on a %dx%d screen, in circles/sec:\n",
+           n, BENCH_WIDTH, BENCH_HEIGHT);
+    printf("%8s %14s %14s %14s\n", "radius", "by pixels", "draw_circle",
+           "fill_circle");
+
+    srand(1);
+    for (j = 0; j < sizeof(radii) / sizeof(radii[0]); j++) {
+        r = radii[j];
+        for (i = 0; i < n; i++) {
+            xs[i] = rand() % (BENCH_WIDTH + 2 * r) - r;
+            ys[i] = rand() % (BENCH_HEIGHT + 2 * r) - r;
+            values[i] = 1 + rand() % MAX_COLOR;
+            depths[i] = rand() % MAX_DEPTH;
+        }
+
+        printf("%8d %14.0f", r,
+               bench(s, draw_circle_by_pixels, n, r, xs, ys, values, depths));
+        printf(" %14.0f", bench(s, draw_circle, n, r, xs, ys, values, depths));
+        printf(" %14.0f\n",
+               bench(s, fill_circle, n, r, xs, ys, values, depths));
+    }
+
+    free(xs);
+    free(ys);
+    free(values);
+    free(depths);
+    free_screen(s);
+
+    return 0;
+}
@@ -1,16 +1,16 @@
 #include "drawing.h"
 #include "pixel.h"
+#include "span.h"
 #include <stdlib.h>
 #include <assert.h>
 
 
-/* Draw a horizontal line. */
+/* Draw a horizontal line.  The pixels of a row are contiguous, so this is a
+ * span.
+ */
 void draw_hline(Screen *s, int x1, int x2, int y,
                 unsigned char value, unsigned char depth) {
-    int x;
-
-    for (x = x1; x < x2; x++)
-        draw_pixel(s, x, y, value, depth);
+    draw_span(s, x1, x2, y, value, depth);
 }
 
 
@@ -25,7 +25,7 @@ void draw_vline(Screen *s, int x, int y1, int y2,
 
 
 /* This helper function draws 8 symmetric points that appear on a circle with
- * the specified center.
+ * the specified center, one draw_pixel() at a time.
  */
 void circle_points(Screen *s, int xc, int yc, int x, int y,
                    unsigned char value, unsigned char depth) {
@@ -43,31 +43,244 @@ void circle_points(Screen *s, int xc, int yc, int x, int y,
 }
 
 
+/* How much of a part of a circle is on the screen. */
+#define CLIP_OUT  0     /* None of it. */
+#define CLIP_PART 1     /* Some of it, so each pixel has to be checked. */
+#define CLIP_IN   2     /* All of it. */
+
+
+/* Returns how much of the box from (x1, y1) to (x2, y2), inclusive, is on the
+ * screen.
+ */
+static int clip_box(Screen *s, int x1, int y1, int x2, int y2) {
+    if (x2 < 0 || y2 < 0 || x1 >= s->width || y1 >= s->height)
+        return CLIP_OUT;
+    if (x1 >= 0 && y1 >= 0 && x2 < s->width && y2 < s->height)
+        return CLIP_IN;
+    return CLIP_PART;
+}
+
+
+/* Draws one point of a circle, in a part of the circle that is clipped as
+ * clip says, with the same depth test as draw_pixel().  This is a macro so
+ * that each point costs no more than the checks it needs.  The caller marks
+ * the pixels dirty.
+ */
+#define OCTANT_POINT(s, clip, x, y, value, depth)                           \
+    do {                                                                    \
+        int px_ = (x), py_ = (y), i_;                                      \
+        if ((clip) == CLIP_IN ||                                            \
+            ((clip) == CLIP_PART && px_ >= 0 && px_ < (s)->width &&        \
+             py_ >= 0 && py_ < (s)->height)) {                              \
+            i_ = PIXEL_INDEX(s, px_, py_);                                  \
+            if ((depth) <= PIXEL_DEPTH(s, i_)) {                            \
+                PIXEL_VALUE(s, i_) = (value);                               \
+                PIXEL_DEPTH(s, i_) = (depth);                               \
+            }                                                               \
+        }                                                                   \
+    } while (0)
+
+
 /* This function draws a circle with the specified location and radius using
- * the Bresenham circle drawing algorithm.
+ * the Bresenham circle drawing algorithm.  It draws the same points that
+ * circle_points() would, but instead of bounds-checking every point, each
+ * quarter of the circle (and so each of the octants in it) is clipped
+ * against the screen once, before the circle is drawn:  octants that are off
+ * the screen are skipped, and octants that are on it are drawn without any
+ * checks.  A circle that is off the screen altogether isn't drawn at all.
  */
 void draw_circle(Screen *s, int xc, int yc, int r,
                  unsigned char value, unsigned char depth) {
+    int x, y, d, x1, x2, y1, y2;
+    int se, ne, sw, nw;
+
+    assert(s != NULL);
+
+    /* Clip each quarter of the circle, by the box around it. */
+    se = clip_box(s, xc, yc, xc + r, yc + r);
+    ne = clip_box(s, xc, yc - r, xc + r, yc);
+    sw = clip_box(s, xc - r, yc, xc, yc + r);
+    nw = clip_box(s, xc - r, yc - r, xc, yc);
+
+    if (se == CLIP_OUT && ne == CLIP_OUT && sw == CLIP_OUT && nw == CLIP_OUT)
+        return;
+
+    x = 0;
+    y = r;
+    d = 1 - r;
+
+    while (1) {
+        OCTANT_POINT(s, se, xc + x, yc + y, value, depth);
+        OCTANT_POINT(s, ne, xc + x, yc - y, value, depth);
+        OCTANT_POINT(s, sw, xc - x, yc + y, value, depth);
+        OCTANT_POINT(s, nw, xc - x, yc - y, value, depth);
+
+        OCTANT_POINT(s, se, xc + y, yc + x, value, depth);
+        OCTANT_POINT(s, ne, xc + y, yc - x, value, depth);
+        OCTANT_POINT(s, sw, xc - y, yc + x, value, depth);
+        OCTANT_POINT(s, nw, xc - y, yc - x, value, depth);
+
+        if (y <= x)
+            break;
+
+        x++;
+        if (d < 0) {
+            d += 2 * x + 3;
+        }
+        else {
+            d += 2 * (x - y) + 5;
+            y--;
+        }
+    }
+
+    /* Mark the rows of the circle dirty, across its whole width. */
+    x1 = xc - r < 0 ? 0 : xc - r;
+    x2 = xc + r + 1 > s->width ? s->width : xc + r + 1;
+    y1 = yc - r < 0 ? 0 : yc - r;
+    y2 = yc + r + 1 > s->height ? s->height : yc + r + 1;
+    for (y = y1; y < y2; y++)
+        mark_dirty(s, x1, x2, y);
+}
+
+
+/* Fills the rectangle from (x1, y1) up to (but not including) (x2, y2). */
+void fill_rect(Screen *s, int x1, int y1, int x2, int y2,
+               unsigned char value, unsigned char depth) {
+    int y;
+
+    assert(s != NULL);
+
+    if (y1 < 0)
+        y1 = 0;
+    if (y2 > s->height)
+        y2 = s->height;
+
+    for (y = y1; y < y2; y++)
+        draw_span(s, x1, x2, y, value, depth);
+}
+
+
+/* Draws the rows dy above and below the center of a filled circle, each
+ * reaching out w pixels to either side.
+ */
+static void circle_rows(Screen *s, int xc, int yc, int dy, int w,
+                        unsigned char value, unsigned char depth) {
+    draw_span(s, xc - w, xc + w + 1, yc + dy, value, depth);
+    if (dy > 0)
+        draw_span(s, xc - w, xc + w + 1, yc - dy, value, depth);
+}
+
+
+/* Fills a circle with the specified location and radius.  This follows the
+ * same points as draw_circle(), but each point becomes the ends of a span
+ * instead, so the filled circle covers exactly the outline and its inside.
+ * Each point (x, y) is the widest that the rows x away from the center reach,
+ * and the last point before y steps down is the widest that the rows y away
+ * reach.
+ */
+void fill_circle(Screen *s, int xc, int yc, int r,
+                 unsigned char value, unsigned char depth) {
     int x, y, d;
 
     assert(s != NULL);
 
+    /* A circle that is off the screen altogether isn't drawn at all. */
+    if (clip_box(s, xc - r, yc - r, xc + r, yc + r) == CLIP_OUT)
+        return;
+
     x = 0;
     y = r;
     d = 1 - r;
 
-    circle_points(s, xc, yc, x, y, value, depth);
+    while (1) {
+        circle_rows(s, xc, yc, x, y, value, depth);
+        if (y <= x) {
+            circle_rows(s, xc, yc, y, x, value, depth);
+            break;
+        }
 
-    while (y > x) {
         x++;
         if (d < 0) {
             d += 2 * x + 3;
         }
         else {
+            circle_rows(s, xc, yc, y, x - 1, value, depth);
             d += 2 * (x - y) + 5;
             y--;
         }
-        circle_points(s, xc, yc, x, y, value, depth);
+    }
+}
+
+
+/* Returns the x coordinate of the edge from (xa, ya) to (xb, yb) on row y,
+ * rounded to the nearest pixel.  A horizontal edge is at xa.
+ */
+static int edge_x(int xa, int ya, int xb, int yb, int y) {
+    int num, den;
+
+    if (ya == yb)
+        return xa;
+
+    num = 2 * (xb - xa) * (y - ya) + (yb - ya);
+    den = 2 * (yb - ya);
+
+    /* Division rounds toward 0, so round negative quotients down by hand. */
+    if (num < 0)
+        return xa - (-num + den - 1) / den;
+    return xa + num / den;
+}
+
+
+/* Fills the triangle with the specified corners, one span per row.  Every
+ * pixel that is on an edge is filled, including the corners.
+ */
+void fill_triangle(Screen *s, int x0, int y0, int x1, int y1, int x2, int y2,
+                   unsigned char value, unsigned char depth) {
+    int t, y, ystart, yend, xa, xb;
+
+    assert(s != NULL);
+
+    /* Sort the corners from top to bottom. */
+    if (y1 < y0) {
+        t = x0; x0 = x1; x1 = t;
+        t = y0; y0 = y1; y1 = t;
+    }
+    if (y2 < y1) {
+        t = x1; x1 = x2; x2 = t;
+        t = y1; y1 = y2; y2 = t;
+    }
+    if (y1 < y0) {
+        t = x0; x0 = x1; x1 = t;
+        t = y0; y0 = y1; y1 = t;
+    }
+
+    /* A flat triangle is just one span. */
+    if (y0 == y2) {
+        xa = x0 < x1 ? x0 : x1;
+        xa = xa < x2 ? xa : x2;
+        xb = x0 > x1 ? x0 : x1;
+        xb = xb > x2 ? xb : x2;
+        draw_span(s, xa, xb + 1, y0, value, depth);
+        return;
+    }
+
+    ystart = y0 < 0 ? 0 : y0;
+    yend = y2 >= s->height ? s->height - 1 : y2;
+
+    /* Each row runs from the long edge, from the top to the bottom corner,
+     * to whichever of the other two edges the row crosses.
+     */
+    for (y = ystart; y <= yend; y++) {
+        xa = edge_x(x0, y0, x2, y2, y);
+        if (y < y1)
+            xb = edge_x(x0, y0, x1, y1, y);
+        else
+            xb = edge_x(x1, y1, x2, y2, y);
+
+        if (xa > xb) {
+            t = xa; xa = xb; xb = t;
+        }
+        draw_span(s, xa, xb + 1, y, value, depth);
     }
 }
 
@@ -9,8 +9,20 @@ void draw_hline(Screen *s, int x1, int x2, int y,
 void draw_vline(Screen *s, int x, int y, int y2,
                 unsigned char value, unsigned char depth);
 
+void circle_points(Screen *s, int xc, int yc, int x, int y,
+                   unsigned char value, unsigned char depth);
+
 void draw_circle(Screen *s, int x, int y, int r,
                  unsigned char value, unsigned char depth);
 
+void fill_rect(Screen *s, int x1, int y1, int x2, int y2,
+               unsigned char value, unsigned char depth);
+
+void fill_circle(Screen *s, int x, int y, int r,
+                 unsigned char value, unsigned char depth);
+
+void fill_triangle(Screen *s, int x0, int y0, int x1, int y1, int x2, int y2,
+                   unsigned char value, unsigned char depth);
+
 #endif /* DRAWING_H */
 
@@ -0,0 +1,534 @@
+#include "drawlist.h"
+#include "drawing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+
+
+/* The size of the blocks of pixels that draw_list() keeps the farthest depth
+ * of, in each direction.
+ */
+#define ZBLOCK_BITS 3
+#define ZBLOCK_SIZE (1 << ZBLOCK_BITS)
+
+
+/* Allocates a new, empty list of draw commands. */
+DrawList * make_draw_list(void) {
+    DrawList *list = malloc(sizeof(DrawList));
+
+    if (list == NULL) {
+        fprintf(stderr, "Out of memory making a draw list!\n");
+        exit(11);
+    }
+
+    list->commands = NULL;
+    list->num_commands = 0;
+    list->capacity = 0;
+
+    return list;
+}
+
+
+/* Removes all of the commands from a list, so that it can be reused. */
+void clear_draw_list(DrawList *list) {
+    list->num_commands = 0;
+}
+
+
+/* Deallocates the memory used by a list of draw commands. */
+void free_draw_list(DrawList *list) {
+    free(list->commands);
+    free(list);
+}
+
+
+/* Adds a command to the end of the list, and returns it for the caller to
+ * fill in the arguments and bounds of.
+ */
+static DrawCommand * add_command(DrawList *list, int kind,
+                                 unsigned char value, unsigned char depth) {
+    DrawCommand *cmd;
+
+    if (list->num_commands == list->capacity) {
+        list->capacity = list->capacity ? 2 * list->capacity : 64;
+        list->commands = realloc(list->commands,
+                                 list->capacity * sizeof(DrawCommand));
+        if (list->commands == NULL) {
+            fprintf(stderr, "Out of memory adding a draw command!\n");
+            exit(11);
+        }
+    }
+
+    cmd = &list->commands[list->num_commands];
+    cmd->kind = kind;
+    cmd->value = value;
+    cmd->depth = depth;
+    cmd->seq = list->num_commands;
+    list->num_commands++;
+
+    return cmd;
+}
+
+
+/* Records a horizontal line, as draw_hline() would draw it. */
+void list_hline(DrawList *list, int x1, int x2, int y,
+                unsigned char value, unsigned char depth) {
+    DrawCommand *cmd = add_command(list, CMD_HLINE, value, depth);
+
+    cmd->args[0] = x1;
+    cmd->args[1] = x2;
+    cmd->args[2] = y;
+
+    cmd->x1 = x1;
+    cmd->x2 = x2;
+    cmd->y1 = y;
+    cmd->y2 = y + 1;
+}
+
+
+/* Records a vertical line, as draw_vline() would draw it. */
+void list_vline(DrawList *list, int x, int y1, int y2,
+                unsigned char value, unsigned char depth) {
+    DrawCommand *cmd = add_command(list, CMD_VLINE, value, depth);
+
+    cmd->args[0] = x;
+    cmd->args[1] = y1;
+    cmd->args[2] = y2;
+
+    cmd->x1 = x;
+    cmd->x2 = x + 1;
+    cmd->y1 = y1;
+    cmd->y2 = y2;
+}
+
+
+/* Fills in the arguments and bounds of a circle command. */
+static void set_circle(DrawCommand *cmd, int x, int y, int r) {
+    cmd->args[0] = x;
+    cmd->args[1] = y;
+    cmd->args[2] = r;
+
+    cmd->x1 = x - r;
+    cmd->x2 = x + r + 1;
+    cmd->y1 = y - r;
+    cmd->y2 = y + r + 1;
+}
+
+
+/* Records the outline of a circle, as draw_circle() would draw it. */
+void list_circle(DrawList *list, int x, int y, int r,
+                 unsigned char value, unsigned char depth) {
+    set_circle(add_command(list, CMD_CIRCLE, value, depth), x, y, r);
+}
+
+
+/* Records a filled rectangle, as fill_rect() would draw it. */
+void list_fill_rect(DrawList *list, int x1, int y1, int x2, int y2,
+                    unsigned char value, unsigned char depth) {
+    DrawCommand *cmd = add_command(list, CMD_FILL_RECT, value, depth);
+
+    cmd->args[0] = x1;
+    cmd->args[1] = y1;
+    cmd->args[2] = x2;
+    cmd->args[3] = y2;
+
+    cmd->x1 = x1;
+    cmd->x2 = x2;
+    cmd->y1 = y1;
+    cmd->y2 = y2;
+}
+
+
+/* Records a filled circle, as fill_circle() would draw it. */
+void list_fill_circle(DrawList *list, int x, int y, int r,
+                      unsigned char value, unsigned char depth) {
+    set_circle(add_command(list, CMD_FILL_CIRCLE, value, depth), x, y, r);
+}
+
+
+/* Records a filled triangle, as fill_triangle() would draw it. */
+void list_fill_triangle(DrawList *list, int x0, int y0, int x1, int y1,
+                        int x2, int y2,
+                        unsigned char value, unsigned char depth) {
+    DrawCommand *cmd = add_command(list, CMD_FILL_TRIANGLE, value, depth);
+
+    cmd->args[0] = x0;
+    cmd->args[1] = y0;
+    cmd->args[2] = x1;
+    cmd->args[3] = y1;
+    cmd->args[4] = x2;
+    cmd->args[5] = y2;
+
+    cmd->x1 = x0 < x1 ? (x0 < x2 ? x0 : x2) : (x1 < x2 ? x1 : x2);
+    cmd->x2 = (x0 > x1 ? (x0 > x2 ? x0 : x2) : (x1 > x2 ? x1 : x2)) + 1;
+    cmd->y1 = y0 < y1 ? (y0 < y2 ? y0 : y2) : (y1 < y2 ? y1 : y2);
+    cmd->y2 = (y0 > y1 ? (y0 > y2 ? y0 : y2) : (y1 > y2 ? y1 : y2)) + 1;
+}
+
+
+/* Orders commands from front to back.  Commands at the same depth stay in
+ * the order they were added, so that the later one still wins, as it would
+ * if they were drawn as they were added.
+ */
+static int compare_commands(const void *a, const void *b) {
+    const DrawCommand *ca = a, *cb = b;
+
+    if (ca->depth != cb->depth)
+        return ca->depth - cb->depth;
+    return ca->seq - cb->seq;
+}
+
+
+/* Sets each block's entry of zmax to the farthest depth in the block, for
+ * the blocks from (bx1, by1) up to (but not including) (bx2, by2).
+ */
+static void update_zmax(Screen *s, unsigned char *zmax, int blocks_across,
+                        int bx1, int by1, int bx2, int by2) {
+    int bx, by, x, y, xend, yend;
+
+    for (by = by1; by < by2; by++) {
+        for (bx = bx1; bx < bx2; bx++) {
+            unsigned char far = 0;
+
+            yend = (by + 1) * ZBLOCK_SIZE;
+            if (yend > s->height)
+                yend = s->height;
+            xend = (bx + 1) * ZBLOCK_SIZE;
+            if (xend > s->width)
+                xend = s->width;
+
+            for (y = by * ZBLOCK_SIZE; y < yend; y++) {
+                for (x = bx * ZBLOCK_SIZE; x < xend; x++) {
+                    unsigned char d = PIXEL_DEPTH(s, PIXEL_INDEX(s, x, y));
+                    if (d > far)
+                        far = d;
+                }
+            }
+
+            zmax[by * blocks_across + bx] = far;
+        }
+    }
+}
+
+
+/* Draws one command, moved dx pixels left and dy pixels up. */
+static void draw_command(Screen *s, const DrawCommand *cmd, int dx, int dy) {
+    const int *a = cmd->args;
+
+    switch (cmd->kind) {
+    case CMD_HLINE:
+        draw_hline(s, a[0] - dx, a[1] - dx, a[2] - dy,
+                   cmd->value, cmd->depth);
+        break;
+    case CMD_VLINE:
+        draw_vline(s, a[0] - dx, a[1] - dy, a[2] - dy,
+                   cmd->value, cmd->depth);
+        break;
+    case CMD_CIRCLE:
+        draw_circle(s, a[0] - dx, a[1] - dy, a[2], cmd->value, cmd->depth);
+        break;
+    case CMD_FILL_RECT:
+        fill_rect(s, a[0] - dx, a[1] - dy, a[2] - dx, a[3] - dy,
+                  cmd->value, cmd->depth);
+        break;
+    case CMD_FILL_CIRCLE:
+        fill_circle(s, a[0] - dx, a[1] - dy, a[2], cmd->value, cmd->depth);
+        break;
+    case CMD_FILL_TRIANGLE:
+        fill_triangle(s, a[0] - dx, a[1] - dy, a[2] - dx, a[3] - dy,
+                      a[4] - dx, a[5] - dy, cmd->value, cmd->depth);
+        break;
+    default:
+        assert(0);
+    }
+}
+
+
+/* Draws n commands, which have already been sorted from front to back, onto
+ * the screen, moved dx pixels left and dy pixels up.  The commands are
+ * commands[order[0]], commands[order[1]], and so on, or the first n commands
+ * if order is NULL.  The farthest depth of each 8x8 block of the screen is
+ * kept as the commands are drawn, and a command that is farther away than
+ * everything in every block that it covers is rejected without being drawn
+ * at all.  Returns the number of commands that were rejected.
+ */
+static int draw_commands(Screen *s, const DrawCommand *commands,
+                         const int *order, int n, int dx, int dy) {
+    int blocks_across = (s->width + ZBLOCK_SIZE - 1) / ZBLOCK_SIZE;
+    int blocks_down = (s->height + ZBLOCK_SIZE - 1) / ZBLOCK_SIZE;
+    unsigned char *zmax;
+    int i, bx, by, bx1, by1, bx2, by2, x1, y1, x2, y2, visible;
+    int rejected = 0;
+
+    zmax = malloc(blocks_across * blocks_down);
+    if (zmax == NULL) {
+        fprintf(stderr, "Out of memory drawing a draw list!\n");
+        exit(11);
+    }
+    update_zmax(s, zmax, blocks_across, 0, 0, blocks_across, blocks_down);
+
+    for (i = 0; i < n; i++) {
+        const DrawCommand *cmd = &commands[order ? order[i] : i];
+
+        /* The blocks that the command covers on the screen. */
+        x1 = cmd->x1 - dx;
+        y1 = cmd->y1 - dy;
+        x2 = cmd->x2 - dx;
+        y2 = cmd->y2 - dy;
+
+        bx1 = x1 < 0 ? 0 : x1 >> ZBLOCK_BITS;
+        by1 = y1 < 0 ? 0 : y1 >> ZBLOCK_BITS;
+        bx2 = x2 > s->width ? blocks_across :
+              (x2 + ZBLOCK_SIZE - 1) >> ZBLOCK_BITS;
+        by2 = y2 > s->height ? blocks_down :
+              (y2 + ZBLOCK_SIZE - 1) >> ZBLOCK_BITS;
+
+        visible = 0;
+        for (by = by1; by < by2 && !visible; by++) {
+            for (bx = bx1; bx < bx2 && !visible; bx++) {
+                if (cmd->depth <= zmax[by * blocks_across + bx])
+                    visible = 1;
+            }
+        }
+        if (!visible) {
+            rejected++;
+            continue;
+        }
+
+        draw_command(s, cmd, dx, dy);
+        update_zmax(s, zmax, blocks_across, bx1, by1, bx2, by2);
+    }
+
+    free(zmax);
+    return rejected;
+}
+
+
+/* Draws every command in the list onto the screen, and empties the list.
+ * The screen ends up the same as if each command had been drawn as it was
+ * added, but the commands are drawn from front to back, so that the nearer
+ * ones are drawn first, and the ones hidden behind them can be rejected.
+ * Returns the number of commands that were rejected.
+ */
+int draw_list(Screen *s, DrawList *list) {
+    int rejected;
+
+    assert(s != NULL);
+
+    qsort(list->commands, list->num_commands, sizeof(DrawCommand),
+          compare_commands);
+    rejected = draw_commands(s, list->commands, NULL, list->num_commands,
+                             0, 0);
+
+    clear_draw_list(list);
+    return rejected;
+}
+
+
+/* The work that draw_list_threaded() shares among its threads. */
+typedef struct TileJob {
+    Screen *s;
+    const DrawCommand *commands;
+
+    int tiles_across;
+    int num_tiles;
+
+    /* The commands that cover tile t are order[first[t]] up to (but not
+     * including) order[first[t + 1]], from front to back.
+     */
+    int *first;
+    int *order;
+
+    /* What each tile changed in each of its rows, as spans of the tile's
+     * pixels, for draw_list_threaded() to mark dirty on the screen after the
+     * threads are done.
+     */
+    ScreenRow *changed;
+
+    /* The first tile that no thread has taken yet. */
+    int next_tile;
+} TileJob;
+
+
+/* Copies the pixels of the tile at (x, y) between the screen and the tile's
+ * own screen, into the tile if to_tile is nonzero, or back out of it if not.
+ */
+static void copy_tile(Screen *s, Screen *tile, int x, int y, int to_tile) {
+    int tx, ty, i, j;
+
+    for (ty = 0; ty < tile->height; ty++) {
+        for (tx = 0; tx < tile->width; tx++) {
+            i = PIXEL_INDEX(s, x + tx, y + ty);
+            j = PIXEL_INDEX(tile, tx, ty);
+
+            if (to_tile) {
+                PIXEL_VALUE(tile, j) = PIXEL_VALUE(s, i);
+                PIXEL_DEPTH(tile, j) = PIXEL_DEPTH(s, i);
+            }
+            else {
+                PIXEL_VALUE(s, i) = PIXEL_VALUE(tile, j);
+                PIXEL_DEPTH(s, i) = PIXEL_DEPTH(tile, j);
+            }
+        }
+    }
+}
+
+
+/* The body of each thread in the pool:  takes tiles from the job until there
+ * are none left, and draws each one's commands.  A tile is drawn onto a
+ * screen of its own, with the commands moved to the tile's corner, so that
+ * the drawing functions clip everything to the tile, and no two threads ever
+ * write the same pixels.
+ */
+static void * draw_tiles_thread(void *arg) {
+    TileJob *job = arg;
+    Screen *s = job->s;
+    Screen *tile;
+    int t, x, y, w, h, ty;
+
+    while (1) {
+        t = __sync_fetch_and_add(&job->next_tile, 1);
+        if (t >= job->num_tiles)
+            break;
+
+        if (job->first[t] == job->first[t + 1])
+            continue;
+
+        x = (t % job->tiles_across) * RASTER_TILE;
+        y = (t / job->tiles_across) * RASTER_TILE;
+        w = s->width - x < RASTER_TILE ? s->width - x : RASTER_TILE;
+        h = s->height - y < RASTER_TILE ? s->height - y : RASTER_TILE;
+
+        tile = make_screen(w, h);
+        copy_tile(s, tile, x, y, 1);
+        for (ty = 0; ty < h; ty++) {
+            tile->rows[ty].dirty_x1 = w;
+            tile->rows[ty].dirty_x2 = 0;
+        }
+
+        draw_commands(tile, job->commands, job->order + job->first[t],
+                      job->first[t + 1] - job->first[t], x, y);
+
+        copy_tile(s, tile, x, y, 0);
+        memcpy(job->changed + t * RASTER_TILE, tile->rows,
+               h * sizeof(ScreenRow));
+        free_screen(tile);
+    }
+
+    return NULL;
+}
+
+
+/* Draws every command in the list onto the screen, as draw_list() does, but
+ * on num_threads threads, or one per CPU if num_threads is 0.  The screen is
+ * divided into RASTER_TILE x RASTER_TILE tiles, each command is put in the
+ * bin of every tile that it covers, and the threads draw a tile at a time.
+ * A pixel is only ever drawn by the thread that draws its tile, with the
+ * same commands in the same order as draw_list() would draw them, so the
+ * screen ends up the same whichever order the tiles are drawn in.
+ */
+void draw_list_threaded(Screen *s, DrawList *list, int num_threads) {
+    TileJob job;
+    pthread_t *threads;
+    int *count;
+    int pass, i, t, tx, ty, tx1, ty1, tx2, ty2, x, y;
+
+    assert(s != NULL);
+
+    if (num_threads <= 0)
+        num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    qsort(list->commands, list->num_commands, sizeof(DrawCommand),
+          compare_commands);
+
+    job.s = s;
+    job.commands = list->commands;
+    job.tiles_across = (s->width + RASTER_TILE - 1) / RASTER_TILE;
+    job.num_tiles = job.tiles_across *
+                    ((s->height + RASTER_TILE - 1) / RASTER_TILE);
+    job.next_tile = 0;
+
+    job.first = calloc(job.num_tiles + 1, sizeof(int));
+    count = calloc(job.num_tiles, sizeof(int));
+    job.changed = malloc(job.num_tiles * RASTER_TILE * sizeof(ScreenRow));
+    threads = malloc(num_threads * sizeof(pthread_t));
+    if (job.first == NULL || count == NULL || job.changed == NULL ||
+        threads == NULL) {
+        fprintf(stderr, "Out of memory drawing a draw list!\n");
+        exit(11);
+    }
+
+    /* Bin the commands in two passes:  count how many commands cover each
+     * tile, to find where each tile's bin starts, and then fill the bins in
+     * order, which keeps every bin sorted from front to back.
+     */
+    for (pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            for (t = 0; t < job.num_tiles; t++) {
+                job.first[t + 1] = job.first[t] + count[t];
+                count[t] = job.first[t];
+            }
+            job.order = malloc((job.first[job.num_tiles] + 1) * sizeof(int));
+            if (job.order == NULL) {
+                fprintf(stderr, "Out of memory drawing a draw list!\n");
+                exit(11);
+            }
+        }
+
+        for (i = 0; i < list->num_commands; i++) {
+            DrawCommand *cmd = &list->commands[i];
+
+            tx1 = cmd->x1 < 0 ? 0 : cmd->x1 / RASTER_TILE;
+            ty1 = cmd->y1 < 0 ? 0 : cmd->y1 / RASTER_TILE;
+            tx2 = cmd->x2 > s->width ? job.tiles_across :
+                  (cmd->x2 + RASTER_TILE - 1) / RASTER_TILE;
+            ty2 = cmd->y2 > s->height ? job.num_tiles / job.tiles_across :
+                  (cmd->y2 + RASTER_TILE - 1) / RASTER_TILE;
+
+            for (ty = ty1; ty < ty2; ty++) {
+                for (tx = tx1; tx < tx2; tx++) {
+                    t = ty * job.tiles_across + tx;
+                    if (pass == 0)
+                        count[t]++;
+                    else
+                        job.order[count[t]++] = i;
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, draw_tiles_thread, &job) != 0) {
+            perror("pthread_create");
+            exit(12);
+        }
+    }
+    for (i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    for (t = 0; t < job.num_tiles; t++) {
+        if (job.first[t] == job.first[t + 1])
+            continue;
+
+        x = (t % job.tiles_across) * RASTER_TILE;
+        y = (t / job.tiles_across) * RASTER_TILE;
+        for (i = 0; i < RASTER_TILE && y + i < s->height; i++) {
+            ScreenRow *row = &job.changed[t * RASTER_TILE + i];
+
+            if (row->dirty_x1 < row->dirty_x2)
+                mark_dirty(s, x + row->dirty_x1, x + row->dirty_x2, y + i);
+        }
+    }
+
+    free(job.first);
+    free(job.order);
+    free(job.changed);
+    free(count);
+    free(threads);
+
+    clear_draw_list(list);
+}
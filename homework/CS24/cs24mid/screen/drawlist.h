@@ -0,0 +1,70 @@
+#ifndef DRAWLIST_H
+#define DRAWLIST_H
+
+#include "screen.h"
+
+
+/* The kinds of draw commands. */
+#define CMD_HLINE         0
+#define CMD_VLINE         1
+#define CMD_CIRCLE        2
+#define CMD_FILL_RECT     3
+#define CMD_FILL_CIRCLE   4
+#define CMD_FILL_TRIANGLE 5
+
+
+/* The size of the tiles that draw_list_threaded() divides the screen into,
+ * in each direction.
+ */
+#define RASTER_TILE 64
+
+
+/* One recorded call of a drawing function.  args holds the function's
+ * coordinates in the order that the function takes them.
+ */
+typedef struct DrawCommand {
+    int kind;
+    int args[6];
+    unsigned char value;
+    unsigned char depth;
+
+    int seq;    /* The order in which the command was added. */
+
+    /* The rectangle that the command can draw in, from (x1, y1) up to (but
+     * not including) (x2, y2).
+     */
+    int x1, y1, x2, y2;
+} DrawCommand;
+
+
+/* A list of draw commands, which are drawn all at once by draw_list(). */
+typedef struct DrawList {
+    DrawCommand *commands;
+    int num_commands;
+    int capacity;
+} DrawList;
+
+
+DrawList * make_draw_list(void);
+void clear_draw_list(DrawList *list);
+void free_draw_list(DrawList *list);
+
+void list_hline(DrawList *list, int x1, int x2, int y,
+                unsigned char value, unsigned char depth);
+void list_vline(DrawList *list, int x, int y1, int y2,
+                unsigned char value, unsigned char depth);
+void list_circle(DrawList *list, int x, int y, int r,
+                 unsigned char value, unsigned char depth);
+void list_fill_rect(DrawList *list, int x1, int y1, int x2, int y2,
+                    unsigned char value, unsigned char depth);
+void list_fill_circle(DrawList *list, int x, int y, int r,
+                      unsigned char value, unsigned char depth);
+void list_fill_triangle(DrawList *list, int x0, int y0, int x1, int y1,
+                        int x2, int y2,
+                        unsigned char value, unsigned char depth);
+
+int draw_list(Screen *s, DrawList *list);
+void draw_list_threaded(Screen *s, DrawList *list, int num_threads);
+
+
+#endif /* DRAWLIST_H */
@@ -9,6 +9,14 @@
 # rets:
 #     none.
 
+# offsets of the fields of a Screen (see screen.h), and of a ScreenRow
+.set SCREEN_ROWS,   8
+.set SCREEN_PIXELS, 16
+.set ROW_DIRTY_X1,  0
+.set ROW_DIRTY_X2,  4
+.set ROW_DRAWN_X1,  8
+.set ROW_DRAWN_X2,  12
+
 .globl draw_pixel
 
 draw_pixel:
@@ -63,21 +71,47 @@ draw_pixel:
     push %ebx
 
     # move current depth to register
-    movb 9(%eax, %ecx, 2), %bl
+    movb SCREEN_PIXELS+1(%eax, %ecx, 2), %bl
 
     # check if depth is in front of current pixel
     cmp  %dl, %bl
-    jl   draw_done      # go to done if current depth < depth
+    jb   draw_done      # go to done if current depth < depth (unsigned)
 
     # popping after temporary push
     pop  %ebx
 
     # put values in array to overwite old pixel
-    movb %bl, 8(%eax, %ecx, 2) # value
-    movb %dl, 9(%eax, %ecx, 2) # depth
+    movb %bl, SCREEN_PIXELS(%eax, %ecx, 2)   # value
+    movb %dl, SCREEN_PIXELS+1(%eax, %ecx, 2) # depth
+
+    # mark the pixel dirty, as mark_dirty(s, x, x + 1, y) does, by widening
+    # the spans of its row to cover x
+    mov  16(%ebp), %ecx         # y
+    shl  $4, %ecx               # y * sizeof(ScreenRow)
+    add  SCREEN_ROWS(%eax), %ecx    # &rows[y]
+    mov  12(%ebp), %ebx         # x
+    lea  1(%ebx), %edx          # x + 1
+
+    cmp  ROW_DIRTY_X1(%ecx), %ebx
+    jge  dirty_x2
+    mov  %ebx, ROW_DIRTY_X1(%ecx)
+dirty_x2:
+    cmp  ROW_DIRTY_X2(%ecx), %edx
+    jle  drawn_x1
+    mov  %edx, ROW_DIRTY_X2(%ecx)
+drawn_x1:
+    cmp  ROW_DRAWN_X1(%ecx), %ebx
+    jge  drawn_x2
+    mov  %ebx, ROW_DRAWN_X1(%ecx)
+drawn_x2:
+    cmp  ROW_DRAWN_X2(%ecx), %edx
+    jle  draw_done
+    mov  %edx, ROW_DRAWN_X2(%ecx)
 
 draw_done:
-    # Restore callee-saved registers
+    # Restore callee-saved registers.  The early exits above leave a value
+    # pushed, so the stack pointer is first put back just below them.
+    lea  -12(%ebp), %esp
     pop  %edi
     pop  %esi
     pop  %ebx
@@ -0,0 +1,22 @@
+#include "pixel.h"
+
+
+/* Draws the pixel at (x, y) if it is on the screen, and if depth is no
+ * farther away than the pixel's current depth.  pixel.s only knows the
+ * interleaved layout of the pixels, so this is the draw_pixel() of the
+ * planar layouts.
+ */
+void draw_pixel(Screen *s, int x, int y,
+                unsigned char value, unsigned char depth) {
+    int i;
+
+    if (x < 0 || x >= s->width || y < 0 || y >= s->height)
+        return;
+
+    i = PIXEL_INDEX(s, x, y);
+    if (depth <= PIXEL_DEPTH(s, i)) {
+        PIXEL_VALUE(s, i) = value;
+        PIXEL_DEPTH(s, i) = depth;
+        mark_dirty(s, x, x + 1, y);
+    }
+}
@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "screen.h"
+#include "pixel.h"
+#include "drawing.h"
+#include "drawlist.h"
+
+
+/* How many shapes are in a scene, and how many times each scene is drawn,
+ * if the command line doesn't say.
+ */
+#define DEFAULT_SHAPES 4000
+#define DEFAULT_FRAMES 5
+
+/* The kinds of shapes in a scene. */
+#define SHAPE_HLINE       0
+#define SHAPE_VLINE       1
+#define SHAPE_CIRCLE      2
+#define SHAPE_FILL_CIRCLE 3
+
+
+/* One shape of a scene.  A line runs from (x, y) for len pixels; a circle
+ * is centered at (x, y), with radius len.
+ */
+typedef struct Shape {
+    int kind;
+    int x, y, len;
+    unsigned char value;
+    unsigned char depth;
+} Shape;
+
+
+/* A function that draws (or counts) one pixel, as draw_pixel() does. */
+typedef void (*PlotFunc)(Screen *s, int x, int y,
+                         unsigned char value, unsigned char depth);
+
+
+/* The number of pixels that count_pixel() has been asked to draw. */
+static long pixels_counted;
+
+
+/* Counts the pixel, if it is on the screen, instead of drawing it. */
+static void count_pixel(Screen *s, int x, int y,
+                        unsigned char value, unsigned char depth) {
+    if (x >= 0 && x < s->width && y >= 0 && y < s->height)
+        pixels_counted++;
+}
+
+
+/* Returns the current time in seconds. */
+static double get_seconds() {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/* Prints the usage message and exits. */
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n shapes] [-f frames] [-j threads]\n"
+                    "\t-n  the number of shapes in each scene (default %d)\n"
+                    "\t-f  how many times each scene is drawn (default %d)\n"
+                    "\t-j  the tile path's threads (default: one per CPU)\n",
+            prog, DEFAULT_SHAPES, DEFAULT_FRAMES);
+    exit(1);
+}
+
+
+/* Fills in a random scene for a screen of the specified size.  The shapes
+ * are spread a little past the edges of the screen, so that some of them
+ * are clipped.
+ */
+static void make_scene(Shape *shapes, int n, int width, int height) {
+    int i, big = width > height ? width : height;
+
+    for (i = 0; i < n; i++) {
+        Shape *sh = &shapes[i];
+
+        sh->kind = rand() % 4;
+        sh->x = rand() % (width + 40) - 20;
+        sh->y = rand() % (height + 40) - 20;
+        if (sh->kind == SHAPE_HLINE || sh->kind == SHAPE_VLINE)
+            sh->len = 1 + rand() % (big / 2);
+        else
+            sh->len = 1 + rand() % (big / 16 + 1);
+        sh->value = 1 + rand() % MAX_COLOR;
+        sh->depth = rand() % MAX_DEPTH;
+    }
+}
+
+
+/* Draws the scene one pixel at a time, with the plot function. */
+static void draw_by_pixels(Screen *s, const Shape *shapes, int n,
+                           PlotFunc plot) {
+    int i, j, x, y, d;
+
+    for (i = 0; i < n; i++) {
+        const Shape *sh = &shapes[i];
+
+        switch (sh->kind) {
+        case SHAPE_HLINE:
+            for (j = 0; j < sh->len; j++)
+                plot(s, sh->x + j, sh->y, sh->value, sh->depth);
+            break;
+
+        case SHAPE_VLINE:
+            for (j = 0; j < sh->len; j++)
+                plot(s, sh->x, sh->y + j, sh->value, sh->depth);
+            break;
+
+        case SHAPE_CIRCLE:
+        case SHAPE_FILL_CIRCLE:
+            /* The same points as draw_circle(), and for a filled circle,
+             * every pixel between them on the same row, as fill_circle().
+             */
+            x = 0;
+            y = sh->len;
+            d = 1 - sh->len;
+            while (1) {
+                if (sh->kind == SHAPE_CIRCLE) {
+                    plot(s, sh->x + x, sh->y + y, sh->value, sh->depth);
+                    plot(s, sh->x + x, sh->y - y, sh->value, sh->depth);
+                    plot(s, sh->x - x, sh->y + y, sh->value, sh->depth);
+                    plot(s, sh->x - x, sh->y - y, sh->value, sh->depth);
+                    plot(s, sh->x + y, sh->y + x, sh->value, sh->depth);
+                    plot(s, sh->x + y, sh->y - x, sh->value, sh->depth);
+                    plot(s, sh->x - y, sh->y + x, sh->value, sh->depth);
+                    plot(s, sh->x - y, sh->y - x, sh->value, sh->depth);
+                }
+                else {
+                    for (j = -y; j <= y; j++) {
+                        plot(s, sh->x + j, sh->y + x, sh->value, sh->depth);
+                        if (x > 0)
+                            plot(s, sh->x + j, sh->y - x,
+                                 sh->value, sh->depth);
+                    }
+                    for (j = -x; j <= x; j++) {
+                        plot(s, sh->x + j, sh->y + y, sh->value, sh->depth);
+                        plot(s, sh->x + j, sh->y - y, sh->value, sh->depth);
+                    }
+                }
+
+                if (y <= x)
+                    break;
+
+                x++;
+                if (d < 0) {
+                    d += 2 * x + 3;
+                }
+                else {
+                    d += 2 * (x - y) + 5;
+                    y--;
+                }
+            }
+            break;
+        }
+    }
+}
+
+
+/* Draws the scene with the drawing functions, which draw spans. */
+static void draw_by_spans(Screen *s, const Shape *shapes, int n) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        const Shape *sh = &shapes[i];
+
+        switch (sh->kind) {
+        case SHAPE_HLINE:
+            draw_hline(s, sh->x, sh->x + sh->len, sh->y, sh->value, sh->depth);
+            break;
+        case SHAPE_VLINE:
+            draw_vline(s, sh->x, sh->y, sh->y + sh->len, sh->value, sh->depth);
+            break;
+        case SHAPE_CIRCLE:
+            draw_circle(s, sh->x, sh->y, sh->len, sh->value, sh->depth);
+            break;
+        case SHAPE_FILL_CIRCLE:
+            fill_circle(s, sh->x, sh->y, sh->len, sh->value, sh->depth);
+            break;
+        }
+    }
+}
+
+
+/* Draws the scene from a draw list, in tiles on num_threads threads. */
+static void draw_by_tiles(Screen *s, const Shape *shapes, int n,
+                          DrawList *list, int num_threads) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        const Shape *sh = &shapes[i];
+
+        switch (sh->kind) {
+        case SHAPE_HLINE:
+            list_hline(list, sh->x, sh->x + sh->len, sh->y,
+                       sh->value, sh->depth);
+            break;
+        case SHAPE_VLINE:
+            list_vline(list, sh->x, sh->y, sh->y + sh->len,
+                       sh->value, sh->depth);
+            break;
+        case SHAPE_CIRCLE:
+            list_circle(list, sh->x, sh->y, sh->len, sh->value, sh->depth);
+            break;
+        case SHAPE_FILL_CIRCLE:
+            list_fill_circle(list, sh->x, sh->y, sh->len,
+                             sh->value, sh->depth);
+            break;
+        }
+    }
+
+    draw_list_threaded(s, list, num_threads);
+}
+
+
+/* Returns an FNV-1a hash of the values and depths of the screen's pixels, in
+ * the order they are on the screen, whatever the layout.
+ */
+static unsigned int checksum(Screen *s) {
+    unsigned int hash = 2166136261U;
+    int x, y, i;
+
+    for (y = 0; y < s->height; y++) {
+        for (x = 0; x < s->width; x++) {
+            i = PIXEL_INDEX(s, x, y);
+            hash = (hash ^ PIXEL_VALUE(s, i)) * 16777619U;
+            hash = (hash ^ PIXEL_DEPTH(s, i)) * 16777619U;
+        }
+    }
+    return hash;
+}
+
+
+/* Renders random scenes of lines and circles at several resolutions, one
+ * pixel at a time with draw_pixel(), with spans, and in tiles on several
+ * threads, and reports how many millions of pixels a second each way draws.
+ * Every way has to leave the same pixels behind, which the checksums show.
+ */
+int main(int argc, char **argv) {
+    static const int sizes[][2] = {
+        { 320, 240 }, { 640, 480 }, { 1280, 720 }, { 1920, 1080 }
+    };
+    static const char *paths[] = { "pixel", "span", "tile" };
+    int num_shapes = DEFAULT_SHAPES, frames = DEFAULT_FRAMES, num_threads = 0;
+    int opt, size, path, frame, mismatches = 0;
+    unsigned int sums[3];
+    Shape *shapes;
+    DrawList *list = make_draw_list();
+    Screen *s;
+    double start, seconds;
+
+    while ((opt = getopt(argc, argv, "n:f:j:")) != -1) {
+        switch (opt) {
+        case 'n':
+            num_shapes = atoi(optarg);
+            break;
+        case 'f':
+            frames = atoi(optarg);
+            break;
+        case 'j':
+            num_threads = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc || num_shapes <= 0 || frames <= 0 || num_threads < 0)
+        usage(argv[0]);
+
+    shapes = malloc(num_shapes * sizeof(Shape));
+    if (shapes == NULL) {
+        fprintf(stderr, "Out of memory making a scene!\n");
+        exit(11);
+    }
+
+    printf("%d shapes, %d frames\n", num_shapes, frames);
+    printf("%11s %6s %12s %10s\n", "resolution", "path", "Mpixels/s",
+           "checksum");
+
+    srand(1);
+    for (size = 0; size < sizeof(sizes) / sizeof(sizes[0]); size++) {
+        s = make_screen(sizes[size][0], sizes[size][1]);
+        make_scene(shapes, num_shapes, s->width, s->height);
+
+        /* The pixels of the scene are the ones that the pixel path draws. */
+        pixels_counted = 0;
+        draw_by_pixels(s, shapes, num_shapes, count_pixel);
+
+        for (path = 0; path < 3; path++) {
+            seconds = 0;
+            for (frame = 0; frame < frames; frame++) {
+                clear_screen(s);
+
+                start = get_seconds();
+                if (path == 0)
+                    draw_by_pixels(s, shapes, num_shapes, draw_pixel);
+                else if (path == 1)
+                    draw_by_spans(s, shapes, num_shapes);
+                else
+                    draw_by_tiles(s, shapes, num_shapes, list, num_threads);
+                seconds += get_seconds() - start;
+            }
+
+            sums[path] = checksum(s);
+            printf("%5dx%-5d %6s %12.2f   %08x\n", s->width, s->height,
+                   paths[path], seconds > 0 ?
+                   pixels_counted * (double) frames / seconds / 1e6 : 0,
+                   sums[path]);
+        }
+
+        if (sums[1] != sums[0] || sums[2] != sums[0]) {
+            printf("The paths drew different pixels at %dx%d!\n",
+                   s->width, s->height);
+            mismatches++;
+        }
+
+        free_screen(s);
+    }
+
+    free(shapes);
+    free_draw_list(list);
+
+    return mismatches ? 1 : 0;
+}
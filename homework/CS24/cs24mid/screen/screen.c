@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <assert.h>
 
 
@@ -11,32 +12,110 @@
 
 /* Allocates and initializes a new "screen" object of the specified size. */
 Screen * make_screen(int width, int height) {
+    int y;
+
     assert(width > 0);
     assert(height > 0);
 
-    Screen *s = malloc(sizeof(Screen) + width * height);
+#ifndef SCREEN_PLANAR
+    Screen *s = malloc(sizeof(Screen) + width * height * sizeof(Pixel));
+
+    if (s == NULL) {
+        fprintf(stderr, "Out of memory making a screen!\n");
+        exit(11);
+    }
+#else
+    int num_pixels = width * height;
+    int tiles_across = 0;
+
+#ifdef SCREEN_TILED
+    /* The planes hold whole tiles, even where they hang off the screen. */
+    tiles_across = (width + TILE_SIZE - 1) / TILE_SIZE;
+    num_pixels = tiles_across * ((height + TILE_SIZE - 1) / TILE_SIZE) *
+                 TILE_SIZE * TILE_SIZE;
+#endif
+
+    Screen *s = malloc(sizeof(Screen) + 2 * num_pixels);
+
+    if (s == NULL) {
+        fprintf(stderr, "Out of memory making a screen!\n");
+        exit(11);
+    }
+
+    s->value = s->planes;
+    s->depth = s->planes + num_pixels;
+    s->tiles_across = tiles_across;
+    s->num_pixels = num_pixels;
+#endif
+
+    s->rows = malloc(height * sizeof(ScreenRow));
+    if (s->rows == NULL) {
+        fprintf(stderr, "Out of memory making a screen!\n");
+        exit(11);
+    }
+
+    /* Everything starts out drawn, so that clear_screen() clears it all. */
+    for (y = 0; y < height; y++) {
+        s->rows[y].dirty_x1 = width;
+        s->rows[y].dirty_x2 = 0;
+        s->rows[y].drawn_x1 = 0;
+        s->rows[y].drawn_x2 = width;
+    }
 
     s->width = width;
     s->height = height;
+    s->presented = 0;
     clear_screen(s);
 
     return s;
 }
 
 
-/* Clears a screen by setting all pixels to ' ', the space character. */
+/* Clears a screen by setting all pixels to ' ', the space character.  Only
+ * the parts of the rows that have been drawn since the screen was last
+ * cleared need to be cleared again.
+ */
 void clear_screen(Screen *s) {
-    int x, y;
+    int x, y, i;
 
     for (y = 0; y < s->height; y++) {
-        for (x = 0; x < s->width; x++) {
-            s->pixels[y * s->width + x].value = BLACK;
-            s->pixels[y * s->width + x].depth = MAX_DEPTH;
+        ScreenRow *row = &s->rows[y];
+
+        if (row->drawn_x1 >= row->drawn_x2)
+            continue;
+
+        for (x = row->drawn_x1; x < row->drawn_x2; x++) {
+            i = PIXEL_INDEX(s, x, y);
+            PIXEL_VALUE(s, i) = BLACK;
+            PIXEL_DEPTH(s, i) = MAX_DEPTH;
         }
+
+        mark_dirty(s, row->drawn_x1, row->drawn_x2, y);
+        row->drawn_x1 = s->width;
+        row->drawn_x2 = 0;
     }
 }
 
 
+/* Records that the pixels from x1 up to (but not including) x2 on row y
+ * have been drawn, and so have changed since the screen was last presented.
+ * The span must already be clipped to the screen.  The drawing functions
+ * all call this for what they draw.
+ */
+void mark_dirty(Screen *s, int x1, int x2, int y) {
+    ScreenRow *row = &s->rows[y];
+
+    if (x1 < row->dirty_x1)
+        row->dirty_x1 = x1;
+    if (x2 > row->dirty_x2)
+        row->dirty_x2 = x2;
+    if (x1 < row->drawn_x1)
+        row->drawn_x1 = x1;
+    if (x2 > row->drawn_x2)
+        row->drawn_x2 = x2;
+}
+
+
 /* Prints the contents of a screen to the console. */
 void print_screen(Screen *s) {
     int x, y;
@@ -49,7 +128,7 @@ void print_screen(Screen *s) {
     for (y = 0; y < s->height; y++) {
         printf("|");
         for (x = 0; x < s->width; x++) {
-            unsigned char value = s->pixels[y * s->width + x].value;
+            unsigned char value = PIXEL_VALUE(s, PIXEL_INDEX(s, x, y));
 #if USE_COLOR
             printf("\x1B[%d;30m  ", 40 + value % (MAX_COLOR + 1));
 #else
@@ -70,8 +149,106 @@ void print_screen(Screen *s) {
 }
 
 
+/* The characters that present_screen() is going to write. */
+typedef struct Output {
+    char *data;
+    int length;
+    int capacity;
+} Output;
+
+
+/* Appends a formatted string of no more than 32 characters to the output. */
+static void output(Output *out, const char *format, int a, int b) {
+    if (out->length + 32 > out->capacity) {
+        out->capacity = 2 * out->capacity + 1024;
+        out->data = realloc(out->data, out->capacity);
+        if (out->data == NULL) {
+            fprintf(stderr, "Out of memory presenting a screen!\n");
+            exit(11);
+        }
+    }
+    out->length += sprintf(out->data + out->length, format, a, b);
+}
+
+
+/* Brings the console up to date with the contents of a screen, as
+ * print_screen() would print it, but in place at the top of the console.
+ * The first time, the console is cleared and the whole screen is drawn;
+ * after that, only the parts of each row that have changed since the last
+ * time are drawn, by moving the cursor to them.  Everything is written with
+ * one write().  Returns how many characters were written.
+ */
+int present_screen(Screen *s) {
+    Output out = { NULL, 0, 0 };
+    int x, y, last_value, written, n;
+
+    if (!s->presented) {
+        output(&out, "\033[H\033[2J+", 0, 0);
+        for (x = 0; x < s->width; x++)
+            output(&out, "--", 0, 0);
+        output(&out, "+", 0, 0);
+        for (y = 0; y < s->height; y++) {
+            output(&out, "\033[%d;1H|", y + 2, 0);
+            output(&out, "\033[%d;%dH|", y + 2, 2 * s->width + 2);
+            mark_dirty(s, 0, s->width, y);
+        }
+        output(&out, "\033[%d;1H+", s->height + 2, 0);
+        for (x = 0; x < s->width; x++)
+            output(&out, "--", 0, 0);
+        output(&out, "+", 0, 0);
+        s->presented = 1;
+    }
+
+    last_value = -1;
+    for (y = 0; y < s->height; y++) {
+        ScreenRow *row = &s->rows[y];
+
+        if (row->dirty_x1 >= row->dirty_x2)
+            continue;
+
+        /* Each pixel is two characters wide, inside the border. */
+        output(&out, "\033[%d;%dH", y + 2, 2 * row->dirty_x1 + 2);
+        for (x = row->dirty_x1; x < row->dirty_x2; x++) {
+            unsigned char value = PIXEL_VALUE(s, PIXEL_INDEX(s, x, y));
+#if USE_COLOR
+            if (value != last_value)
+                output(&out, "\x1B[%d;30m", 40 + value % (MAX_COLOR + 1), 0);
+            output(&out, "  ", 0, 0);
+#else
+            output(&out, "%c%c", value > 0 ? 64 + value : 32,
+                                  value > 0 ? 64 + value : 32);
+#endif
+            last_value = value;
+        }
+
+        row->dirty_x1 = s->width;
+        row->dirty_x2 = 0;
+    }
+
+    /* Leave the cursor below the screen. */
+#if USE_COLOR
+    output(&out, "\033[0m", 0, 0);
+#endif
+    output(&out, "\033[%d;1H", s->height + 3, 0);
+
+    /* Anything already printed has to come out before this. */
+    fflush(stdout);
+    for (written = 0; written < out.length; written += n) {
+        n = write(STDOUT_FILENO, out.data + written, out.length - written);
+        if (n < 0) {
+            perror("write");
+            break;
+        }
+    }
+
+    free(out.data);
+    return out.length;
+}
+
+
 /* Deallocates the memory used by a Screen object. */
 void free_screen(Screen *s) {
+    free(s->rows);
     free(s);
 }
 
@@ -25,22 +25,99 @@ typedef struct Pixel {
 #define MAX_DEPTH 0xFF
 
 
+/* The layout of the pixels can be chosen when compiling.  By default each
+ * pixel's value and depth are stored together, as a Pixel, which is the
+ * layout that pixel.s expects.  With SCREEN_PLANAR defined, the values and the
+ * depths are kept in two separate planes of bytes instead, so that depth
+ * tests only touch depths, and printing only touches values.  SCREEN_TILED
+ * also lays each plane out in 8x8 tiles, so that the pixels that are near
+ * each other on the screen are near each other in memory.
+ */
+#ifdef SCREEN_TILED
+#ifndef SCREEN_PLANAR
+#define SCREEN_PLANAR
+#endif
+#endif
+
+/* The size of a tile, in each direction, in the tiled layout. */
+#define TILE_BITS 3
+#define TILE_SIZE (1 << TILE_BITS)
+
+
+/* What has changed in one row of a screen.  Each is a span of the row's
+ * pixels from x1 up to (but not including) x2, which is empty if x1 >= x2.
+ */
+typedef struct ScreenRow {
+    int dirty_x1, dirty_x2;   /* Changed since present_screen() last ran. */
+    int drawn_x1, drawn_x2;   /* Drawn since clear_screen() last ran. */
+} ScreenRow;
+
+
 /* A simple data structure to represent a screen with width * height
- * pixels.  Values written to the pixels are characters.
+ * pixels.  Values written to the pixels are characters.  pixel.s knows the
+ * offsets of rows and pixels in the default layout.
  */
+#ifndef SCREEN_PLANAR
+
 typedef struct Screen {
     int width;
     int height;
 
+    ScreenRow *rows;     /* What has changed in each row. */
+    int presented;       /* Whether present_screen() has drawn the screen. */
+
     Pixel pixels[];
 } Screen;
 
+#else
+
+typedef struct Screen {
+    int width;
+    int height;
+
+    ScreenRow *rows;         /* What has changed in each row. */
+    int presented;           /* Whether present_screen() has drawn it. */
+
+    unsigned char *value;    /* The color plane. */
+    unsigned char *depth;    /* The depth plane. */
+
+    int tiles_across;        /* The number of tiles in each row of tiles. */
+    int num_pixels;          /* The size of each plane, with any padding. */
+
+    unsigned char planes[];  /* The storage of both planes. */
+} Screen;
+
+#endif
+
+
+/* The index of the pixel at (x, y) in the pixels or in each plane. */
+#ifdef SCREEN_TILED
+#define PIXEL_INDEX(s, x, y)                                              \
+    (((((y) >> TILE_BITS) * (s)->tiles_across + ((x) >> TILE_BITS))       \
+      << (2 * TILE_BITS)) + (((y) & (TILE_SIZE - 1)) << TILE_BITS) +      \
+     ((x) & (TILE_SIZE - 1)))
+#else
+#define PIXEL_INDEX(s, x, y) ((y) * (s)->width + (x))
+#endif
+
+/* The value and the depth of the pixel at an index. */
+#ifdef SCREEN_PLANAR
+#define PIXEL_VALUE(s, i) ((s)->value[i])
+#define PIXEL_DEPTH(s, i) ((s)->depth[i])
+#else
+#define PIXEL_VALUE(s, i) ((s)->pixels[i].value)
+#define PIXEL_DEPTH(s, i) ((s)->pixels[i].depth)
+#endif
+
 
 Screen * make_screen(int width, int height);
 void clear_screen(Screen *s);
 void print_screen(Screen *s);
 void free_screen(Screen *s);
 
+void mark_dirty(Screen *s, int x1, int x2, int y);
+int present_screen(Screen *s);
+
 
 #endif /* SCREEN_H */
 
@@ -5,6 +5,7 @@
 #include "screen.h"
 #include "pixel.h"
 #include "drawing.h"
+#include "drawlist.h"
 
 
 /* This is a simple program to show off the screen drawing code.  It doesn't
@@ -14,7 +15,8 @@
  */
 int main() {
     Screen *s = make_screen(39, 25);
-    int i;
+    DrawList *list = make_draw_list();
+    int i, rejected;
 
     srand(time(NULL));
 
@@ -69,6 +71,34 @@ int main() {
     print_screen(s);
     printf("\n");
 
+    clear_screen(s);
+    printf("Drawing random filled shapes from a draw list.  The nearest "
+           "shapes are\ndrawn first, and shapes hidden behind them are "
+           "skipped.\n");
+    for (i = 0; i < 30; i++) {
+        int x = rand() % s->width;
+        int y = rand() % s->height;
+        int r = 2 + rand() % 6;
+
+        int color = 1 + rand() % MAX_COLOR;
+        int depth = rand() % MAX_DEPTH;
+
+        if (i % 3 == 0)
+            list_fill_rect(list, x - r, y - r, x + r, y + r, color, depth);
+        else if (i % 3 == 1)
+            list_fill_circle(list, x, y, r, color, depth);
+        else
+            list_fill_triangle(list, x, y - r, x - r, y + r, x + r, y + r,
+                               color, depth);
+    }
+    rejected = draw_list(s, list);
+    printf("Screen (%d of 30 shapes were hidden):\n", rejected);
+    print_screen(s);
+    printf("\n");
+
+    free_draw_list(list);
+    free_screen(s);
+
     return 0;
 }
 
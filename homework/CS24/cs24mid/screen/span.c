@@ -0,0 +1,177 @@
+#include "span.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+
+#ifndef SCREEN_PLANAR
+
+/* Depth-tests and writes n interleaved pixels, starting at p. */
+static void blend_pixels(Pixel *p, int n,
+                         unsigned char value, unsigned char depth) {
+    Pixel *end = p + n;
+
+    /* A Pixel is a value byte followed by a depth byte, so as 16-bit lanes,
+     * the depth is the high byte.  A lane is written where the new depth is
+     * the (unsigned) minimum of the two depths; shifting the compare's result
+     * right arithmetically by 8 spreads the depth byte's result across the
+     * whole pixel.
+     */
+#ifdef __AVX2__
+    {
+        __m256i pixel = _mm256_set1_epi16(value | (depth << 8));
+
+        for (; end - p >= 16; p += 16) {
+            __m256i old = _mm256_loadu_si256((__m256i *) p);
+            __m256i nearer = _mm256_cmpeq_epi8(_mm256_min_epu8(pixel, old),
+                                               pixel);
+            __m256i mask = _mm256_srai_epi16(nearer, 8);
+
+            _mm256_storeu_si256((__m256i *) p,
+                                _mm256_blendv_epi8(old, pixel, mask));
+        }
+    }
+#endif
+
+#ifdef __SSE2__
+    {
+        __m128i pixel = _mm_set1_epi16(value | (depth << 8));
+
+        for (; end - p >= 8; p += 8) {
+            __m128i old = _mm_loadu_si128((__m128i *) p);
+            __m128i nearer = _mm_cmpeq_epi8(_mm_min_epu8(pixel, old), pixel);
+            __m128i mask = _mm_srai_epi16(nearer, 8);
+
+            _mm_storeu_si128((__m128i *) p,
+                             _mm_or_si128(_mm_and_si128(mask, pixel),
+                                          _mm_andnot_si128(mask, old)));
+        }
+    }
+#endif
+
+    for (; p < end; p++) {
+        if (depth <= p->depth) {
+            p->value = value;
+            p->depth = depth;
+        }
+    }
+}
+
+#else
+
+/* Depth-tests and writes n pixels of the planes, starting at the values v
+ * and the depths d.
+ */
+static void blend_planes(unsigned char *v, unsigned char *d, int n,
+                         unsigned char value, unsigned char depth) {
+    int i = 0;
+
+    /* With the planes apart, every byte of a vector is a whole pixel's depth
+     * (or value), so the compare's result is already the mask, and twice as
+     * many pixels fit in a vector as when they are interleaved.
+     */
+#ifdef __AVX2__
+    {
+        __m256i values = _mm256_set1_epi8(value);
+        __m256i depths = _mm256_set1_epi8(depth);
+
+        for (; n - i >= 32; i += 32) {
+            __m256i old = _mm256_loadu_si256((__m256i *) (d + i));
+            __m256i mask = _mm256_cmpeq_epi8(_mm256_min_epu8(depths, old),
+                                             depths);
+
+            _mm256_storeu_si256((__m256i *) (d + i),
+                                _mm256_blendv_epi8(old, depths, mask));
+            _mm256_storeu_si256((__m256i *) (v + i),
+                _mm256_blendv_epi8(_mm256_loadu_si256((__m256i *) (v + i)),
+                                   values, mask));
+        }
+    }
+#endif
+
+#ifdef __SSE2__
+    {
+        __m128i values = _mm_set1_epi8(value);
+        __m128i depths = _mm_set1_epi8(depth);
+
+        for (; n - i >= 16; i += 16) {
+            __m128i old = _mm_loadu_si128((__m128i *) (d + i));
+            __m128i mask = _mm_cmpeq_epi8(_mm_min_epu8(depths, old), depths);
+
+            _mm_storeu_si128((__m128i *) (d + i), _mm_min_epu8(depths, old));
+            _mm_storeu_si128((__m128i *) (v + i),
+                _mm_or_si128(_mm_and_si128(mask, values),
+                             _mm_andnot_si128(mask,
+                                 _mm_loadu_si128((__m128i *) (v + i)))));
+        }
+
+        /* A row of a tile is 8 pixels. */
+        for (; n - i >= 8; i += 8) {
+            __m128i old = _mm_loadl_epi64((__m128i *) (d + i));
+            __m128i mask = _mm_cmpeq_epi8(_mm_min_epu8(depths, old), depths);
+
+            _mm_storel_epi64((__m128i *) (d + i), _mm_min_epu8(depths, old));
+            _mm_storel_epi64((__m128i *) (v + i),
+                _mm_or_si128(_mm_and_si128(mask, values),
+                             _mm_andnot_si128(mask,
+                                 _mm_loadl_epi64((__m128i *) (v + i)))));
+        }
+    }
+#endif
+
+    for (; i < n; i++) {
+        if (depth <= d[i]) {
+            v[i] = value;
+            d[i] = depth;
+        }
+    }
+}
+
+#endif
+
+
+/* Draws the pixels from x1 up to (but not including) x2 on row y, with the
+ * same depth test as draw_pixel():  each pixel is only written if depth is
+ * no farther away than the pixel's current depth.  The span is clipped to the
+ * screen and marked dirty once, instead of every pixel being bounds-checked
+ * on its own, and then the pixels are depth-tested and written many at a
+ * time with vector compares and blends, leaving just a few at the end to do
+ * one at a time.
+ */
+void draw_span(Screen *s, int x1, int x2, int y,
+               unsigned char value, unsigned char depth) {
+    if (y < 0 || y >= s->height)
+        return;
+    if (x1 < 0)
+        x1 = 0;
+    if (x2 > s->width)
+        x2 = s->width;
+    if (x1 >= x2)
+        return;
+
+    mark_dirty(s, x1, x2, y);
+
+#if !defined(SCREEN_PLANAR)
+    blend_pixels(s->pixels + PIXEL_INDEX(s, x1, y), x2 - x1, value, depth);
+#elif !defined(SCREEN_TILED)
+    blend_planes(s->value + PIXEL_INDEX(s, x1, y),
+                 s->depth + PIXEL_INDEX(s, x1, y), x2 - x1, value, depth);
+#else
+    /* A row is only contiguous within a tile, so the span is drawn in pieces
+     * that end at the edges of the tiles.
+     */
+    while (x1 < x2) {
+        int end = (x1 | (TILE_SIZE - 1)) + 1;
+        int i = PIXEL_INDEX(s, x1, y);
+
+        if (end > x2)
+            end = x2;
+        blend_planes(s->value + i, s->depth + i, end - x1, value, depth);
+        x1 = end;
+    }
+#endif
+}
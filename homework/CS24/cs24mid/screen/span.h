@@ -0,0 +1,9 @@
+#ifndef SPAN_H
+#define SPAN_H
+
+#include "screen.h"
+
+void draw_span(Screen *s, int x1, int x2, int y,
+               unsigned char value, unsigned char depth);
+
+#endif /* SPAN_H */